@@ -0,0 +1,116 @@
+# Copyright (c) OpenMMLab. All rights reserved.
+import argparse
+import csv
+import os
+from typing import Dict, List
+
+import numpy as np
+
+from lmdeploy.cli.utils import ArgumentHelper, DefaultsAndTypesHelpFormatter
+from lmdeploy.messages import TurbomindEngineConfig
+from lmdeploy.utils import get_logger
+
+get_logger('lmdeploy').setLevel('WARNING')
+os.environ['TM_LOG_LEVEL'] = 'ERROR'
+
+
+def start_engine(model_path: str, engine_config: TurbomindEngineConfig) -> List[Dict[str, float]]:
+    """Start the turbomind engine and return the time of the phases of each
+    device."""
+    from lmdeploy.tokenizer import Tokenizer
+    from lmdeploy.turbomind import TurboMind
+
+    tokenizer = Tokenizer(model_path)
+    tm_model = TurboMind.from_pretrained(model_path, tokenizer=tokenizer, engine_config=engine_config)
+    phases = tm_model.get_startup_phases()
+    tm_model.close()
+    return phases
+
+
+def __proc_cb(*args, ret_pipe, target):
+    try:
+        ret = target(*args)
+        ret_pipe[1].send(ret)
+    except Exception as e:
+        ret_pipe[1].send(e)
+
+
+def _process_map(target, iterable):
+    from multiprocessing import Pipe, get_context
+
+    pipe = Pipe(False)
+    spawn_context = get_context('spawn')
+    proc = spawn_context.Process(target=__proc_cb, args=iterable, kwargs=dict(ret_pipe=pipe, target=target))
+    proc.start()
+    proc.join()
+
+    ret = pipe[0].recv()
+    if isinstance(ret, Exception):
+        raise ret
+
+    return ret
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Profile the time to ready of the turbomind engine by phase',
+                                     formatter_class=DefaultsAndTypesHelpFormatter)
+    parser.add_argument('model_path',
+                        type=str,
+                        help='the path of the model in localhost or '
+                        'the repo_id of the model in huggingface.co')
+    parser.add_argument('-tr', '--test-round', type=int, help='number of engine starts', default=3)
+    parser.add_argument('--csv', type=str, help='Where to save the result.', default='profile_startup.csv')
+
+    tb_group = parser.add_argument_group('TurboMind engine argument')
+    ArgumentHelper.tp(tb_group)
+    ArgumentHelper.session_len(tb_group)
+    ArgumentHelper.cache_max_entry_count(tb_group)
+    ArgumentHelper.dtype(tb_group)
+    ArgumentHelper.model_format(tb_group, default='hf')
+    ArgumentHelper.communicator(tb_group)
+    args = parser.parse_args()
+    return args
+
+
+def main():
+    args = parse_args()
+
+    engine_config = TurbomindEngineConfig(tp=args.tp,
+                                          session_len=args.session_len,
+                                          cache_max_entry_count=args.cache_max_entry_count,
+                                          dtype=args.dtype,
+                                          model_format=args.model_format,
+                                          communicator=args.communicator)
+
+    # each start in a fresh process, the slowest device of a phase sets the time to ready
+    rounds: List[Dict[str, float]] = []
+    for i in range(args.test_round):
+        devices = _process_map(start_engine, (args.model_path, engine_config))
+        phases = {}
+        for device in devices:
+            for name, t in device.items():
+                phases[name] = max(phases.get(name, 0.), t)
+        rounds.append(phases)
+        print(f'round {i}: ready in {phases["ready"]:.2f} s')
+
+    names = list(rounds[0].keys())
+    stats = []
+    for name in names:
+        t = np.array([r.get(name, 0.) for r in rounds])
+        stats.append((name, t.mean(), t.min(), t.max()))
+
+    ready = np.mean([r['ready'] for r in rounds])
+    print(f'\n{"phase":<16}{"mean(s)":>10}{"min(s)":>10}{"max(s)":>10}{"share":>8}')
+    for name, mean, lo, hi in stats:
+        print(f'{name:<16}{mean:>10.2f}{lo:>10.2f}{hi:>10.2f}{mean / ready:>8.1%}')
+
+    if args.csv:
+        with open(args.csv, 'w') as csvfile:
+            writer = csv.writer(csvfile)
+            writer.writerow(['phase', 'mean(s)', 'min(s)', 'max(s)'])
+            for name, mean, lo, hi in stats:
+                writer.writerow([name, f'{mean:.3f}', f'{lo:.3f}', f'{hi:.3f}'])
+
+
+if __name__ == '__main__':
+    main()
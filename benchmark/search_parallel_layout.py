@@ -0,0 +1,469 @@
+# Copyright (c) OpenMMLab. All rights reserved.
+"""Search the parallel layouts of the turbomind engine for a model and a
+device count.
+
+A layout splits the devices into `outer_dp` engines, each with `attn_dp`
+attention groups of `attn_tp` ranks and an MLP of `mlp_tp = attn_dp * attn_tp`
+ranks, optionally with the routed experts distributed over the MLP ranks
+(`ep`). The decoding step and the prefill of each valid layout are costed
+layer by layer from the microbenchmarks of the device:
+
+- the linear layers from `gemm_roofline --output` (for the shapes of a tp),
+  the other shapes and the attention by the roofline of the device
+- the collectives from `bench_comm --output` (one file per rank count), an
+  alpha-beta model of the links otherwise
+
+The kv cache capacity of a rank, from the weights left by the memory of the
+device, caps the batch a layout holds. With `--validate` the best layouts are
+started for real: the memory plan of the engine (`TurboMind.plan_memory` of a
+dry run) and a short run of `profile_generation` are reported next to the
+estimates.
+"""
+import argparse
+import csv
+import json
+import math
+import os
+from dataclasses import dataclass
+from typing import Dict, List, Tuple
+
+import numpy as np
+
+from lmdeploy.cli.utils import ArgumentHelper, DefaultsAndTypesHelpFormatter
+
+
+@dataclass
+class Model:
+    layer_num: int
+    hidden: int
+    head_num: int
+    kv_head_num: int
+    head_dim: int
+    vocab: int
+    inter_size: List[int]  # dense or shared experts of each layer
+    expert_num: List[int]  # routed experts of each layer
+    expert_inter: int
+    experts_per_token: int
+    weight_bits: int
+    group_size: int
+    kv_dim: int  # cached dims of a token per kv head, the latent of MLA
+
+
+def load_model(path: str) -> Model:
+    """Read the model from the turbomind `config.yaml` or the
+    `config.json` of a huggingface model."""
+    if path.endswith(('.yaml', '.yml')):
+        import yaml
+        with open(path) as f:
+            m = yaml.safe_load(f)['model_config']
+        layer_num = m['num_layer']
+        inter = m['inter_size']
+        inter = inter if isinstance(inter, list) else [inter] * layer_num
+        experts = list(m.get('expert_num') or []) + [0] * layer_num
+        head_dim = m.get('size_per_head', 128)
+        kv_lora_rank = m.get('kv_lora_rank', 0)
+        return Model(layer_num=layer_num,
+                     hidden=m['hidden_units'],
+                     head_num=m['head_num'],
+                     kv_head_num=m.get('kv_head_num', m['head_num']),
+                     head_dim=head_dim,
+                     vocab=m['vocab_size'],
+                     inter_size=inter,
+                     expert_num=experts[:layer_num],
+                     expert_inter=m.get('expert_inter_size', 0),
+                     experts_per_token=m.get('experts_per_token', 0),
+                     weight_bits=4 if m.get('weight_type') == 'int4' else 16,
+                     group_size=m.get('group_size', 128),
+                     kv_dim=kv_lora_rank + m.get('qk_rope_dim', 0) if kv_lora_rank else head_dim)
+
+    if os.path.isdir(path):
+        path = os.path.join(path, 'config.json')
+    with open(path) as f:
+        c = json.load(f)
+    c = c.get('text_config', c.get('llm_config', c))
+    layer_num = c['num_hidden_layers']
+    hidden = c['hidden_size']
+    head_num = c['num_attention_heads']
+    head_dim = c.get('head_dim') or hidden // head_num
+    expert_num = c.get('n_routed_experts') or c.get('num_local_experts') or c.get('num_experts') or 0
+    expert_inter = c.get('moe_intermediate_size') or c['intermediate_size']
+    dense = c.get('first_k_dense_replace', 0) if expert_num else layer_num
+    shared = c.get('n_shared_experts') or 0
+    inter = [c['intermediate_size']] * dense + [shared * expert_inter] * (layer_num - dense)
+    quant = c.get('quantization_config') or {}
+    kv_lora_rank = c.get('kv_lora_rank') or 0
+    return Model(layer_num=layer_num,
+                 hidden=hidden,
+                 head_num=head_num,
+                 kv_head_num=c.get('num_key_value_heads') or head_num,
+                 head_dim=head_dim,
+                 vocab=c['vocab_size'],
+                 inter_size=inter,
+                 expert_num=[0] * dense + [expert_num] * (layer_num - dense),
+                 expert_inter=expert_inter if expert_num else 0,
+                 experts_per_token=c.get('num_experts_per_tok') or 0,
+                 weight_bits=quant.get('bits', 16) if quant.get('quant_method') in ('awq', 'gptq') else 16,
+                 group_size=quant.get('group_size', 128),
+                 kv_dim=kv_lora_rank + c.get('qk_rope_head_dim', 0) if kv_lora_rank else head_dim)
+
+
+@dataclass(frozen=True)
+class Layout:
+    outer_dp: int
+    attn_dp: int
+    attn_tp: int
+    ep: int
+
+    @property
+    def mlp_tp(self):
+        return self.attn_dp * self.attn_tp
+
+    def __str__(self):
+        s = f'dp{self.outer_dp}.adp{self.attn_dp}.atp{self.attn_tp}.mtp{self.mlp_tp}'
+        return s + (f'.ep{self.ep}' if self.ep > 1 else '')
+
+
+def valid_layouts(model: Model, devices: int) -> List[Layout]:
+    """The layouts of `devices` the engine accepts for the model."""
+    layouts = []
+    moe = max(model.expert_num) > 0
+    mla = model.kv_dim != model.head_dim
+    for outer_dp in range(1, devices + 1):
+        if devices % outer_dp:
+            continue
+        mlp_tp = devices // outer_dp
+        for attn_tp in range(1, mlp_tp + 1):
+            if mlp_tp % attn_tp or model.head_num % attn_tp:
+                continue
+            # the MLA latent is a single head replicated over the ranks
+            if not mla and model.kv_head_num % attn_tp:
+                continue
+            inter_ok = all(x % mlp_tp == 0 and (model.weight_bits == 16 or x // mlp_tp % model.group_size == 0)
+                           for x in model.inter_size if x)
+            if not inter_ok:
+                continue
+            for ep in sorted({1, mlp_tp} if moe else {1}):
+                if ep == 1 and moe and model.expert_inter % mlp_tp:
+                    continue
+                if ep > 1 and any(e % ep for e in model.expert_num if e):
+                    continue
+                layouts.append(Layout(outer_dp, mlp_tp // attn_tp, attn_tp, ep))
+    return layouts
+
+
+class CommModel:
+    """Time of the collectives by message bytes, the best backend & variant
+    of `bench_comm` results or an alpha-beta model."""
+
+    def __init__(self, files: List[str], link_bw: float, latency_us: float):
+        self.link_bw = link_bw * 1e9
+        self.latency = latency_us * 1e-6
+        self.tables: Dict[Tuple[str, int], Dict[int, float]] = {}
+        for path in files or []:
+            with open(path) as f:
+                data = json.load(f)
+            n = data['n_ranks']
+            for r in data['results']:
+                if r.get('errors', 0) > 0:
+                    continue
+                t = self.tables.setdefault((r['op'], n), {})
+                t[r['bytes']] = min(t.get(r['bytes'], math.inf), r['time_us'] * 1e-6)
+
+    def time(self, op: str, n_ranks: int, nbytes: float) -> float:
+        if n_ranks == 1 or nbytes <= 0:
+            return 0.
+        table = self.tables.get((op, n_ranks))
+        if table and len(table) > 1:
+            xs = sorted(table)
+            if nbytes > xs[-1]:  # bandwidth bound beyond the largest message
+                return table[xs[-1]] * nbytes / xs[-1]
+            return float(np.interp(math.log2(nbytes), np.log2(xs), [table[x] for x in xs]))
+        factor = (n_ranks - 1) / n_ranks * (2 if op == 'allreduce' else 1)
+        return self.latency + factor * nbytes / self.link_bw
+
+
+class GemmModel:
+    """Time of the linear layers by (m, n, k), the `gemm_roofline` results of
+    the shape or the roofline of the device."""
+
+    def __init__(self, files: List[str], weight_bits: int, peak_tflops: float, peak_bw: float, efficiency: float):
+        self.weight_bits = weight_bits
+        self.peak_flops = peak_tflops * 1e12
+        self.peak_bw = peak_bw * 1e9
+        self.efficiency = efficiency
+        self.tables: Dict[Tuple[int, int], Dict[int, float]] = {}
+        for path in files or []:
+            with open(path) as f:
+                data = json.load(f)
+            for r in data['results']:
+                # the u4 kernels for int4 weights, cuBLAS for the fp16 ones
+                ms = r['ms'] if weight_bits == 4 else r['cublas_ms']
+                self.tables.setdefault((r['n'], r['k']), {})[r['m']] = ms * 1e-3
+
+    def roofline(self, nbytes: float, flops: float) -> float:
+        return max(nbytes / self.peak_bw, flops / self.peak_flops) / self.efficiency
+
+    def time(self, m: int, n: int, k: int, weight_bits: int = None) -> float:
+        if m <= 0 or n <= 0 or k <= 0:
+            return 0.
+        bits = weight_bits or self.weight_bits
+        table = self.tables.get((n, k))
+        if table and bits == self.weight_bits and len(table) > 1:
+            xs = sorted(table)
+            if m > xs[-1]:  # compute bound beyond the largest token count
+                return table[xs[-1]] * m / xs[-1]
+            return float(np.interp(math.log2(m), np.log2(xs), [table[x] for x in xs]))
+        return self.roofline(n * k * bits / 8 + 2 * m * (n + k), 2. * m * n * k)
+
+
+@dataclass
+class Estimate:
+    layout: Layout
+    batch: int  # sequences served at once over all the devices, capped by the kv cache
+    fits: bool  # the target batch fits in the kv cache
+    tpot: float  # s per decoding step
+    throughput: float  # output tokens/s
+    ttft: float  # s of the prefill of a single prompt
+    weights_gb: float  # per device
+    kv_sessions: int  # sequences of the context length the kv cache of all the devices holds
+
+
+class Estimator:
+
+    def __init__(self, model: Model, gemm: GemmModel, comm: CommModel, args):
+        self.m = model
+        self.gemm = gemm
+        self.comm = comm
+        self.args = args
+
+    def _experts(self, layout: Layout, tokens: int, experts: int, local: bool) -> float:
+        """Grouped gemms of the routed experts of a rank for `tokens`."""
+        m = self.m
+        rows = tokens * m.experts_per_token / (layout.ep if local else 1)
+        # experts hit by at least one of the rows
+        n_exp = experts / layout.ep if local else experts
+        hit = max(1., n_exp * (1 - (1 - 1 / experts)**(tokens * m.experts_per_token)))
+        inter = m.expert_inter if local else m.expert_inter // layout.mlp_tp
+        r = max(1, math.ceil(rows / hit))
+        return hit * (self.gemm.time(r, 2 * inter, m.hidden) + self.gemm.time(r, m.hidden, inter))
+
+    def _layer(self, layout: Layout, i: int, attn_tokens: int, ffn_tokens: int, attn_time: float) -> float:
+        m = self.m
+        T = 2  # bytes of the activations
+        tp, mtp = layout.attn_tp, layout.mlp_tp
+        q = m.head_num * m.head_dim // tp
+        kv = 0 if m.kv_dim != m.head_dim else 2 * m.kv_head_num * m.head_dim // tp
+        t = self.gemm.time(attn_tokens, q + kv, m.hidden) + self.gemm.time(attn_tokens, m.hidden, q)
+        t += attn_time
+        # all-reduce of the attention & of the ffn over the same ranks without attention DP, otherwise the tokens of
+        # the attention groups are gathered for the ffn and scattered back
+        if layout.attn_dp == 1:
+            t += 2 * self.comm.time('allreduce', tp, attn_tokens * m.hidden * T)
+        else:
+            t += self.comm.time('allreduce', tp, attn_tokens * m.hidden * T)
+            t += 2 * self.comm.time('allgather', mtp, ffn_tokens * m.hidden * T)
+        if m.inter_size[i]:
+            inter = m.inter_size[i] // mtp
+            t += self.gemm.time(ffn_tokens, 2 * inter, m.hidden) + self.gemm.time(ffn_tokens, m.hidden, inter)
+        if m.expert_num[i]:
+            local = layout.ep > 1
+            t += self._experts(layout, ffn_tokens, m.expert_num[i], local)
+            if local:  # dispatch & combine of the routed rows
+                rows = ffn_tokens * m.experts_per_token / layout.ep
+                t += 2 * self.comm.time('allgather', layout.ep, rows * m.hidden * T)
+        return t
+
+    def kv_bytes_per_token(self, layout: Layout) -> float:
+        m = self.m
+        heads = 1 if m.kv_dim != m.head_dim else m.kv_head_num // layout.attn_tp
+        k_and_v = 1 if m.kv_dim != m.head_dim else 2
+        return m.layer_num * k_and_v * heads * m.kv_dim * self.args.kv_bits / 8
+
+    def weight_bytes(self, layout: Layout) -> float:
+        m = self.m
+        bits = m.weight_bits / 8
+        q = m.head_num * m.head_dim
+        kv = 2 * m.kv_head_num * m.head_dim if m.kv_dim == m.head_dim else m.kv_dim
+        attn = (m.hidden * (q + kv) + q * m.hidden) * bits / layout.attn_tp
+        ffn = sum(3 * m.hidden * x for x in m.inter_size) * bits / layout.mlp_tp
+        experts = sum(3 * m.hidden * m.expert_inter * e for e in m.expert_num) * bits / layout.mlp_tp
+        embed = 2 * m.vocab * m.hidden * 2 / layout.attn_tp
+        return m.layer_num * attn + ffn + experts + embed
+
+    def estimate(self, layout: Layout, batch: int) -> Estimate:
+        m, args = self.m, self.args
+        ctx = args.prompt_tokens + args.output_tokens
+        weights = self.weight_bytes(layout)
+        free = args.gpu_mem * (1 << 30) - weights - args.reserve * (1 << 30)
+        kv_tokens = max(0., free * args.cache_max_entry_count) / self.kv_bytes_per_token(layout)
+        # each attention rank holds the kv of its own sequences
+        sessions = int(kv_tokens // ctx) * layout.attn_dp * layout.outer_dp
+        served = min(batch, sessions)
+
+        # decoding, the context is half way the output on average
+        b_engine = math.ceil(served / layout.outer_dp) if served else 0
+        b_attn = math.ceil(b_engine / layout.attn_dp)
+        kv_read = b_attn * (args.prompt_tokens + args.output_tokens / 2) * self.kv_bytes_per_token(layout) / m.layer_num
+        attn_time = self.gemm.roofline(kv_read, 0)
+        step = sum(self._layer(layout, i, b_attn, b_engine, attn_time) for i in range(m.layer_num))
+        step += self.gemm.time(b_attn, math.ceil(m.vocab / layout.attn_tp), m.hidden, 16)
+        throughput = served / step if step > 0 else 0.
+
+        # a single prompt on one attention group, causal attention
+        p = args.prompt_tokens
+        flops = 2 * p * p * m.head_num * (m.head_dim + m.kv_dim) / layout.attn_tp
+        attn_time = self.gemm.roofline(0, flops)
+        ttft = sum(self._layer(layout, i, p, p, attn_time) for i in range(m.layer_num))
+
+        return Estimate(layout, served, served >= batch, step, throughput, ttft, weights / (1 << 30), sessions)
+
+
+def engine_config(layout: Layout, devices: int, batch: int, args):
+    from lmdeploy.messages import TurbomindEngineConfig
+    return TurbomindEngineConfig(device_num=devices,
+                                 outer_dp_size=layout.outer_dp,
+                                 attn_dp_size=layout.attn_dp,
+                                 attn_tp_size=layout.attn_tp,
+                                 mlp_dp_size=1,
+                                 mlp_tp_size=layout.mlp_tp,
+                                 ep=layout.ep,
+                                 communicator='nccl' if layout.ep > 1 else args.communicator,
+                                 session_len=args.prompt_tokens + args.output_tokens,
+                                 max_batch_size=max(1, math.ceil(batch / layout.outer_dp)),
+                                 cache_max_entry_count=args.cache_max_entry_count,
+                                 dtype=args.dtype,
+                                 model_format=args.model_format)
+
+
+def plan_memory(model_path: str, config) -> List[Dict[str, float]]:
+    from lmdeploy.tokenizer import Tokenizer
+    from lmdeploy.turbomind import TurboMind
+
+    config.dry_run = True
+    tm_model = TurboMind.from_pretrained(model_path, tokenizer=Tokenizer(model_path), engine_config=config)
+    plans = tm_model.plan_memory()
+    tm_model.close()
+    return plans
+
+
+def validate(est: Estimate, devices: int, args) -> Dict[str, float]:
+    """Plan the memory of the layout and profile a short run of it."""
+    from profile_generation import _process_map, profile_throughput
+
+    from lmdeploy.messages import GenerationConfig
+
+    plans = _process_map(plan_memory, (args.model_path, engine_config(est.layout, devices, est.batch, args)))
+    kv_tokens = min(p['kv_tokens'] for p in plans)
+    headroom = min(p['headroom'] for p in plans) / (1 << 30)
+
+    gen_config = GenerationConfig(max_new_tokens=args.output_tokens, ignore_eos=True)
+    out = _process_map(profile_throughput, (args.model_path, est.batch, args.prompt_tokens,
+                                            engine_config(est.layout, devices, est.batch, args), gen_config, 1, 1))
+    _, first_token_latency, percentiles, output_throughput, _, _ = out
+    return dict(kv_tokens=kv_tokens,
+                headroom_gb=headroom,
+                ttft=first_token_latency[2],
+                tpot=percentiles[0],
+                throughput=output_throughput)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Search the parallel layout of the turbomind engine',
+                                     formatter_class=DefaultsAndTypesHelpFormatter)
+    parser.add_argument('config',
+                        type=str,
+                        help='turbomind `config.yaml` of the model, or the path of a '
+                        'huggingface model or its `config.json`')
+    parser.add_argument('--devices', type=int, required=True, help='number of devices of the pipeline stage')
+    parser.add_argument('--batch', type=int, nargs='+', help='target numbers of concurrent sequences',
+                        default=[1, 16, 64, 256])
+    parser.add_argument('--prompt-tokens', type=int, help='tokens of a prompt', default=1024)
+    parser.add_argument('--output-tokens', type=int, help='generated tokens of a sequence', default=512)
+    parser.add_argument('--gemm', type=str, nargs='*', help='results of `gemm_roofline --output`', default=[])
+    parser.add_argument('--comm', type=str, nargs='*', help='results of `bench_comm --output`', default=[])
+    parser.add_argument('--gpu-mem', type=float, help='memory of a device in GB', default=80.)
+    parser.add_argument('--reserve', type=float, help='memory in GB of the buffers and workspaces', default=4.)
+    parser.add_argument('--kv-bits', type=int, help='bits of the kv cache elements', default=16)
+    parser.add_argument('--peak-tflops', type=float, help='dense fp16 TFLOPs of a device', default=989.)
+    parser.add_argument('--peak-bw', type=float, help='HBM bandwidth of a device in GB/s', default=3350.)
+    parser.add_argument('--efficiency', type=float, help='share of the roofline achieved', default=0.7)
+    parser.add_argument('--link-bw', type=float, help='bus bandwidth of the collectives in GB/s', default=150.)
+    parser.add_argument('--latency-us', type=float, help='latency of a collective in us', default=10.)
+    parser.add_argument('--max-tpot', type=float, help='max ms per output token of a layout, 0 for any', default=0.)
+    parser.add_argument('--top', type=int, help='layouts reported per batch', default=5)
+    parser.add_argument('--validate', type=int, help='best layouts of each batch started for real', default=0)
+    parser.add_argument('--model-path', type=str, help='model to validate with, the config path by default')
+    parser.add_argument('--csv', type=str, help='Where to save the estimates.', default='')
+    tb_group = parser.add_argument_group('TurboMind engine argument')
+    ArgumentHelper.cache_max_entry_count(tb_group)
+    ArgumentHelper.dtype(tb_group)
+    ArgumentHelper.model_format(tb_group, default='hf')
+    ArgumentHelper.communicator(tb_group)
+    args = parser.parse_args()
+    if args.model_path is None and not args.config.endswith(('.yaml', '.yml')):
+        args.model_path = os.path.dirname(args.config) if args.config.endswith('.json') else args.config
+    return args
+
+
+def main():
+    args = parse_args()
+    model = load_model(args.config)
+    gemm = GemmModel(args.gemm, model.weight_bits, args.peak_tflops, args.peak_bw, args.efficiency)
+    comm = CommModel(args.comm, args.link_bw, args.latency_us)
+    estimator = Estimator(model, gemm, comm, args)
+
+    layouts = valid_layouts(model, args.devices)
+    assert layouts, f'no valid layout of {args.devices} devices for the model'
+
+    rows = []
+    score: Dict[Layout, float] = {}  # log throughput summed over the batches
+    feasible: Dict[Layout, int] = {}  # batches the layout holds within the latency
+    for batch in args.batch:
+        ests = [estimator.estimate(x, batch) for x in layouts]
+        # the target batch & latency first, then throughput
+        ok = [e for e in ests if e.fits and (not args.max_tpot or e.tpot * 1e3 <= args.max_tpot)]
+        ranked = sorted(ok, key=lambda e: -e.throughput) + sorted(
+            [e for e in ests if e not in ok], key=lambda e: -e.throughput)
+
+        print(f'\nbatch {batch}, {args.prompt_tokens} + {args.output_tokens} tokens')
+        print(f'{"layout":<28}{"served":>8}{"tpot(ms)":>10}{"tok/s":>10}{"ttft(ms)":>10}'
+              f'{"weights(GB)":>13}{"sessions":>10}')
+        for e in ranked[:args.top]:
+            mark = '' if e in ok else ' *'
+            print(f'{str(e.layout) + mark:<28}{e.batch:>8}{e.tpot * 1e3:>10.2f}{e.throughput:>10.0f}'
+                  f'{e.ttft * 1e3:>10.1f}{e.weights_gb:>13.1f}{e.kv_sessions:>10}')
+        for e in ests:
+            rows.append(e)
+            score[e.layout] = score.get(e.layout, 0.) + math.log(max(e.throughput, 1e-9))
+            feasible[e.layout] = feasible.get(e.layout, 0) + (e in ok)
+
+        for e in ok[:args.validate]:
+            r = validate(e, args.devices, args)
+            print(f'validated {e.layout}: kv tokens {r["kv_tokens"]:.0f}, headroom {r["headroom_gb"]:.1f} GB, '
+                  f'tpot {r["tpot"] * 1e3:.2f} ms (est. {e.tpot * 1e3:.2f}), '
+                  f'{r["throughput"]:.0f} tok/s (est. {e.throughput:.0f}), '
+                  f'ttft {r["ttft"] * 1e3:.1f} ms (est. {e.ttft * 1e3:.1f})')
+
+    print('\n* the target batch does not fit in the kv cache or the latency is above `--max-tpot`')
+    # the layouts holding the most of the batches, then the best throughput over them
+    best = max(score, key=lambda x: (feasible[x], score[x]))
+    print(f'recommended layout over the batches: {best} '
+          f'(holds {feasible[best]} of {len(args.batch)} target batches)')
+
+    if args.csv:
+        with open(args.csv, 'w') as csvfile:
+            writer = csv.writer(csvfile)
+            writer.writerow([
+                'outer_dp', 'attn_dp', 'attn_tp', 'mlp_tp', 'ep', 'batch', 'fits', 'tpot(ms)', 'throughput(tok/s)',
+                'ttft(ms)', 'weights(GB)', 'sessions'
+            ])
+            for e in rows:
+                x = e.layout
+                writer.writerow([
+                    x.outer_dp, x.attn_dp, x.attn_tp, x.mlp_tp, x.ep, e.batch, e.fits, f'{e.tpot * 1e3:.3f}',
+                    f'{e.throughput:.1f}', f'{e.ttft * 1e3:.2f}', f'{e.weights_gb:.2f}', e.kv_sessions
+                ])
+
+
+if __name__ == '__main__':
+    main()
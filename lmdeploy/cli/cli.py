@@ -36,6 +36,12 @@ class CLI(object):
         ArgumentHelper.download_dir(parser)
         parser.add_argument('--tokenizer-path', type=str, default=None, help='The path of tokenizer model')
         parser.add_argument('--dst-path', type=str, default='workspace', help='The destination path that saves outputs')
+        parser.add_argument('--weight-format',
+                            type=str,
+                            default='bin',
+                            choices=['bin', 'safetensors'],
+                            help='The format of the saved weights. "safetensors" saves '
+                            'sharded files which the engine mmaps and streams to the GPUs')
         parser.add_argument('--group-size',
                             type=int,
                             default=0,
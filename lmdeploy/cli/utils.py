@@ -208,8 +208,9 @@ class ArgumentHelper:
         return parser.add_argument('--quant-policy',
                                    type=int,
                                    default=0,
-                                   choices=[0, 4, 8],
-                                   help='Quantize kv or not. 0: no quant; 4: 4bit kv; 8: 8bit kv')
+                                   choices=[0, 4, 8, 16],
+                                   help='Quantize kv or not. 0: no quant; 4: 4bit kv; 8: 8bit kv; '
+                                   '16: fp8 (e4m3) kv, turbomind only')
 
     @staticmethod
     def rope_scaling_factor(parser):
@@ -446,9 +447,10 @@ class ArgumentHelper:
                                    type=int,
                                    default=64,
                                    help='The length of the token sequence in a k/v block. '
-                                   'For Turbomind Engine, if the GPU compute capability '
-                                   'is >= 8.0, it should be a multiple of 32, otherwise '
-                                   'it should be a multiple of 64. For Pytorch Engine, '
+                                   'For Turbomind Engine, it should be a multiple of 64, '
+                                   'the larger blocks are faster to decode while the '
+                                   'smaller ones waste less memory and match prefixes '
+                                   'at a finer granularity. For Pytorch Engine, '
                                    'if Lora Adapter is specified, this parameter will '
                                    'be ignored')
 
@@ -517,5 +519,7 @@ class ArgumentHelper:
         return parser.add_argument('--communicator',
                                    type=str,
                                    default='nccl',
-                                   choices=['nccl', 'native'],
-                                   help='Communication backend for multi-GPU inference')
+                                   choices=['nccl', 'native', 'hier'],
+                                   help='Communication backend for multi-GPU inference. '
+                                   '`hier` reduces within the islands of peer GPUs with `native` '
+                                   'and across them with `nccl`')
@@ -42,6 +42,12 @@ class GenerationConfig:
         repetition_penalty (float): Penalty to prevent the model from
             generating repeated words or phrases. A value larger than
             1 discourages repetition
+        frequency_penalty (float): Subtracted from the logit of a token for
+            each of its occurrences in the generated tokens, as in the OpenAI
+            API. Only the turbomind backend supports it. Default to 0
+        presence_penalty (float): Subtracted from the logit of a token once
+            if it is in the generated tokens, as in the OpenAI API. Only the
+            turbomind backend supports it. Default to 0
         ignore_eos (bool): Indicator to ignore the eos_token_id or not
         random_seed (int): Seed used when sampling a token
         stop_words (List[str]): Words that stop generating further tokens
@@ -59,8 +65,12 @@ class GenerationConfig:
             around special tokens. The behavior of Fast tokenizers is to have
             this to False. This is setup to True in slow tokenizers.
         logprobs (int): Number of log probabilities to return per output token.
-        response_format (Dict): Only pytorch backend support formatting
-        response. Examples:
+        priority (int): Scheduling class of the request, 0 for interactive
+            traffic and larger values for less latency sensitive (batch)
+            traffic. Requests of smaller values are scheduled first and
+            preempt the others when the kv cache is short. Default to 0
+        response_format (Dict): Constrain the response to a JSON schema or a
+        regex, the turbomind backend requires xgrammar. Examples:
             {
                 "type": "json_schema",
                 "json_schema": {
@@ -82,6 +92,39 @@ class GenerationConfig:
                 "regex_schema": "call me [A-Za-z]{1,10}"
             }
         logits_processors (List[Callable]): Custom logit processors.
+        score (bool): Score the prompt instead of generating, i.e. return the
+            logprob of each prompt token given its prefix. The request runs
+            the prefill only and is not cached. Only the turbomind backend
+            supports it
+        pooling (str): Pool the hidden states of the prompt in the engine,
+            e.g. for embedding models, one of 'last' (the last token),
+            'mean' and 'cls' (the first token). Only the `[hidden]` pooled
+            state is returned. Like `score`, the request runs the prefill
+            only and is not cached. Only the turbomind backend supports it
+        normalize (bool): L2-normalize the pooled hidden state
+        warm (bool): Prefill the prompt and leave it in the prefix cache
+            without generating, e.g. the known system prompts of a cold
+            replica. Requires a complete session with prefix caching. Only
+            the turbomind backend supports it
+        pin_prefix (bool): Keep the cached prompt blocks from eviction,
+            within the `cache_pin_tokens` of the engine. The oldest pins are
+            released first. Only the turbomind backend supports it
+        beam_width (int): Number of beams of beam search, 1 for none. The
+            beams select their tokens by the cumulative logprob of the raw
+            logits, sampling params, penalties, bad words and streaming are
+            not supported with it. Only the turbomind backend supports it
+        length_penalty (float): The best finished beam is the one with the
+            highest cumulative logprob divided by the number of its
+            generated tokens to this power. Default to 1.0
+        tenant_id (int): Tenant of the request, with `fair_share` of the
+            turbomind engine the batch is shared between the tenants by
+            their weights. Default to -1 (the default tenant)
+        tenant_weight (float): Share of the tenant relative to the other
+            tenants, the latest request of a tenant sets it. Default to 1.0
+        expected_output_len (int): Hint of the number of tokens to
+            generate, with `sjf_scheduling` of the turbomind engine the
+            requests expected to finish first are served first. Default to
+            0, which leaves it to the engine
     """
 
     n: int = 1
@@ -92,6 +135,8 @@ class GenerationConfig:
     min_p: float = 0.0
     temperature: float = 0.8
     repetition_penalty: float = 1.0
+    frequency_penalty: float = 0.0
+    presence_penalty: float = 0.0
     ignore_eos: bool = False
     random_seed: int = None
     stop_words: List[str] = None
@@ -106,6 +151,17 @@ class GenerationConfig:
     logits_processors: Optional[List[LogitsProcessor]] = None
     output_logits: Literal['all', 'generation'] = None
     output_last_hidden_state: Literal['all', 'generation'] = None
+    priority: int = 0
+    score: bool = False
+    pooling: Literal['last', 'mean', 'cls'] = None
+    normalize: bool = False
+    warm: bool = False
+    pin_prefix: bool = False
+    beam_width: int = 1
+    length_penalty: float = 1.0
+    tenant_id: int = -1
+    tenant_weight: float = 1.0
+    expected_output_len: int = 0
 
     def convert_stop_bad_words_to_ids(self, tokenizer: Tokenizer):
         """convert stop_words/bad_sords to ids and append the ids to
@@ -156,6 +212,16 @@ class GenerationConfig:
         assert self.temperature >= 0 and self.temperature <= 2  # [0,2]
         assert 0 <= self.min_p <= 1, \
             f'min_p should be in range [0, 1], but found {self.min_p}'
+        assert 0 <= self.priority <= 255, \
+            f'priority should be in range [0, 255], but found {self.priority}'
+        assert 1 <= self.beam_width <= 8, \
+            f'beam_width should be in range [1, 8], but found {self.beam_width}'
+        assert self.tenant_weight > 0, \
+            f'tenant_weight should be positive, but found {self.tenant_weight}'
+        assert self.expected_output_len >= 0, \
+            'invalid expected_output_len'
+        assert not (self.warm and (self.score or self.pooling)), \
+            'warm is not supported with score or pooling'
 
 
 @pydantic_dataclass
@@ -174,6 +240,17 @@ class TurbomindEngineConfig:
             specified, i.e. None, it will be extracted from the input model
         tp (int): the number of GPU cards used in tensor parallelism,
             default to 1
+        pp (int): the number of pipeline stages the decoder layers are
+            split into, each stage holds a contiguous range of layers on its
+            own group of `tp` GPUs. Requires the 'nccl' communicator and no
+            attention DP or LoRA. Default to 1
+        cp (int): context parallelism. The kv cache of each sequence is
+            sharded block-wise over `cp` GPUs per tensor parallel rank, which
+            exchange the softmax statistics of their partial attention, so
+            that long contexts fit in the aggregate cache memory. Works
+            within each attention DP group. Requires `cache_block_seq_len`
+            to be a multiple of 64 * cp and no speculative decoding.
+            Default to 1
         session_len (int): the max session length of a sequence, default to
             None
         max_batch_size (int): the max batch size during inference. If it is
@@ -190,11 +267,99 @@ class TurbomindEngineConfig:
         cache_chunk_size (int): The policy to apply for KV block from
             the block manager, default to -1.
         cache_block_seq_len (int): the length of the token sequence in
-            a k/v block, default to 64
+            a k/v block, a multiple of 64. Larger blocks decode faster while
+            smaller ones waste less memory and match prefixes at a finer
+            granularity, `bench_attention --block-len 64,128,256` compares
+            them on the device. Default to 64
+        cache_swap_space (float): the size (GB) of pinned host memory that
+            holds k/v blocks evicted from gpu memory, so that preempted
+            sequences can resume without recomputing. Default to 0, which
+            disables the host tier
+        cache_swap_bandwidth (float): the bandwidth (GB/s) between host and
+            gpu memory. When set, the kv cache of a preempted sequence is
+            swapped to the host tier only if that is estimated to be faster
+            than recomputing it at `cache_recompute_tflops`. Default to 0,
+            which always swaps
+        cache_recompute_tflops (float): the effective TFLOPS of a gpu in
+            prefill, used along with `cache_swap_bandwidth`. Default to 100
         enable_prefix_caching (bool): enable cache prompts for block reuse,
             default to False
+        cache_pin_tokens (int): the tokens of the prompt blocks the requests
+            with `pin_prefix` keep from eviction, the oldest pins are
+            released beyond it. Requires `enable_prefix_caching`. Default to
+            0, which pins nothing
+        prefix_cache_path (str): directory of the persistent prefix cache.
+            Cached prompt blocks are written to it and reloaded across
+            restarts, the files of another model, data type or kv cache
+            quantization are reset. The writes are dropped while the disk
+            lags behind. Requires `enable_prefix_caching`. Default to None
+        prefix_cache_disk_space (float): the size (GB) of the persistent
+            prefix cache file of each rank, default to 0
+        embedding_cache_size (float): the size (GB) of the device cache of
+            input embeddings (e.g. image features) keyed by their content
+            hashes, on top of the kv cache. Default to 0, which disables it
+        l2_persist_mb (int): the size (MB) of the L2 cache set aside for
+            the kv cache blocks shared by many decoding sequences, e.g. of
+            a common system prompt. The window over the most shared blocks
+            is re-selected every 64 decoding steps and lifted for the steps
+            with prefills. Default to 0, which disables it
+        kv_quant_error_interval (int): the number of forward steps between
+            the measurements of the error of the quantized kv cache on the
+            newly written tokens, reported per layer by the
+            `tm_kv_quant_error` metric. Default to 0, which disables it
+        cache_window_size (int): keep only the kv cache of the recent
+            `cache_window_size` tokens and the first `cache_sink_size`
+            tokens of a sequence, the blocks in between are freed. Bounds
+            the memory and the decoding cost of long streaming sessions.
+            Default to 0, which keeps the whole kv cache
+        cache_sink_size (int): the number of attention sink tokens kept
+            with `cache_window_size` or `cache_score_budget`, rounded up to
+            whole blocks. Default to 0
+        cache_score_budget (int): keep the kv cache of a sequence within
+            this many tokens by dropping the blocks between the sinks and
+            the recent blocks that received the least attention from the
+            decoding tokens (heavy-hitter eviction). Requires a
+            non-quantized f16/bf16 kv cache without prefix caching or
+            `cache_window_size`. Default to 0, which keeps the whole kv
+            cache
+        cache_recent_blocks (int): tiered kv cache, keep the last
+            `cache_recent_blocks` blocks of a sequence in f16 and requantize
+            the older ones to `cache_cold_quant` into a pool of their own.
+            Requires a non-quantized kv cache without prefix caching.
+            Default to 0, which disables it
+        cache_cold_quant (str): the precision of the older blocks of the
+            tiered kv cache, 'int8' or 'int4'. Default to 'int4'
+        cache_cold_ratio (float): the share of the kv cache memory taken by
+            the older blocks of the tiered kv cache. Default to 0.5
+        cache_eviction_policy (str): the order in which cached blocks are
+            evicted, one of 'lru', 'lfu' (least hit by prefix matching
+            first) and '2q' (blocks never hit first, so that one-off
+            prompts don't flush the shared prefixes). Default to 'lru'
+        cache_pool_key (str): the models in the process with the same key
+            share the k/v cache memory of a GPU. Each one leases blocks from
+            the pool as its traffic requires, and gives back its cached
+            blocks when the others need the memory. Default to '', which
+            gives each model its own `cache_max_entry_count`
+        cache_virtual_memory (bool): reserve the addresses of the whole k/v
+            cache upfront and map the physical memory of its chunks on
+            demand. Idle chunks are unmapped when the blocks in use shrink
+            well below the mapped ones. Default to False
+        cache_pool_size (float): the size (GB) of the shared pool, set by
+            the first model joining it. Default to 0, which takes
+            `cache_max_entry_count` of the free GPU memory at that time
+        cache_pool_min (float): the memory (GB) of the pool guaranteed to
+            the model, default to 0
+        cache_pool_max (float): the memory (GB) of the pool the model
+            leases at most. Default to 0, which doesn't limit it
         quant_policy (int): default to 0. When k/v is quantized into 4 or 8
-            bit, set it to 4 or 8, respectively
+            bit, set it to 4 or 8, respectively. Set it to 16 for fp8 (e4m3)
+            k/v, which requires sm80 or newer
+        layer_quant_policy (List[int]): the `quant_policy` of the kv cache of
+            each layer, which takes the place of `quant_policy`, e.g. f16 for
+            the first & last layers and int4 for the others. Default to None,
+            the same in all layers. Not supported with pipeline parallelism,
+            MLA, `sparse_decode_blocks`, `cache_recent_blocks` or
+            `cache_score_budget`
         rope_scaling_factor (float): scaling factor used for dynamic ntk,
             default to 0. TurboMind follows the implementation of transformer
             LlamaAttention
@@ -211,12 +376,305 @@ class TurbomindEngineConfig:
             "Dynamic SplitFuse"-like scheduling
         max_prefill_iters(int): the max number of forward pass during prefill
             stage
+        split_fuse (bool): make every step process `num_tokens_per_iter`
+            tokens, the decoding tokens included, with the prefills split
+            into chunks of what is left. This keeps the inter-token latency
+            flat during bursts of prefills, `max_prefill_iters` is ignored.
+            Default to False
+        overlap_scheduling (bool): receive and set up the requests of the
+            next step on host while the current step runs on gpu. Default
+            to False
+        async_output (bool): push the new tokens of streaming requests from
+            a dedicated thread as soon as they are copied to host, instead
+            of after the bookkeeping of the step. Default to False
+        finish_sync_interval (int): let the host run up to this many
+            decoding steps ahead of their results. Only the finish flags
+            are waited for (one step behind), the tokens are read when a
+            sequence finishes, the batch changes or the interval is up.
+            Streaming requests get their tokens every step with
+            `async_output`, otherwise every interval. Not supported with
+            `overlap_scheduling` or speculative decoding. 0 or 1 reads the
+            results of every step. Default to 0
+        enable_cuda_graph (bool): replay decoding steps (batch size <= 32)
+            with CUDA graphs to save kernel launch overhead. Only effective
+            on a single gpu without MoE or LoRA. Default to False
+        enable_cascade_attention (bool): attend the common prefix (e.g. a
+            shared system prompt) of a group of decoding sequences once for
+            the whole group instead of once per sequence. Only prefixes
+            shared through prefix caching are detected, and a group needs at
+            least 4 sequences sharing 256+ tokens. Not compatible with
+            mla_latent_cache or logn attention. Default to False
+        numa_affinity (bool): bind the threads and the pinned host buffers
+            of each rank to the NUMA node local to its GPU, which keeps the
+            host to device traffic off the inter-socket link on multi-socket
+            machines. Default to False
+        comm_overlap_tokens (int): split the FFN of prefill batches into
+            chunks of this many tokens so that the allreduce of a chunk
+            overlaps with the FFN of the next one under tensor parallelism.
+            0 disables the overlap. Default to 0
+        comm_quant (str): quantize the activations to 'int8' or 'fp8' for
+            the transfers of the tensor parallel allreduces, which halves the
+            traffic on PCIe-only machines at some loss of accuracy. Default to
+            'none'
+        reserved_slots (int): the number of batch slots reserved for
+            interactive requests (`priority` 0), requests of the other
+            priority classes are admitted into the remaining slots only.
+            Default to 0
+        target_itl_ms (float): the target inter-token latency in ms. When
+            set, the number of prefill tokens scheduled per step and the
+            number of running sequences admitted are adapted to the measured
+            GPU time of the steps so that decoding sequences are not stalled
+            by long prefills or oversized batches. Default to 0 (disabled)
+        admission_control (bool): admit new requests only when the kv cache
+            blocks they are projected to take, from `max_new_tokens` and the
+            output lengths of the finished requests, fit beside the projected
+            growth of the running sequences. Requests that don't fit are held
+            in the queue instead of preempting the running ones. Default to
+            False
+        num_speculative_tokens (int): the max number of draft tokens
+            proposed by prompt lookup (n-gram matching against the context)
+            and verified by the model in each decoding step. The output is
+            identical to normal decoding. Default to 0 (disabled)
+        speculative_ngram_size (int): the max n-gram size used to look up
+            draft tokens in the context. Default to 3
+        fp8_linear (bool): quantize the weights of dense linear layers to
+            fp8 (e4m3) with per-channel scales when loading the model, and
+            run them with per-token quantized fp8 activations (W8A8).
+            Requires sm90. MoE experts are kept as is. Default to False
+        int8_linear (bool): like `fp8_linear` but with int8 weights and
+            activations on the int8 tensor cores. Requires sm80 and can't be
+            combined with `fp8_linear`. Default to False
+        w8a16_linear (bool): quantize the fp16 weights of linear layers,
+            MoE experts included, to uint8 with group-wise (128) scales and
+            zeros when loading the model, and run them with the weight-only
+            kernels. About half the memory of fp16 with better accuracy than
+            int4. Requires sm80 and fp16. Layers quantized by `fp8_linear`
+            or `int8_linear` are not affected. Default to False
+        sparse_linear (bool): run the linear layers pruned with 2:4
+            structured sparsity along the input dim on the sparse tensor
+            cores. The weights are checked and compressed when loading the
+            model, layers that are not 2:4 sparse are kept dense. Takes
+            precedence over the weight quantization options, MoE experts are
+            kept as is. Requires sm80. Default to False
+        enable_pdl (bool): launch the gemm, attention and norm kernels of
+            the layers with programmatic dependent launch, so that a kernel
+            starts its prologue while the previous one drains. Requires
+            sm90 and CUDA 12.3, ignored otherwise. Default to False
+        decode_megakernel_batch (int): run each decoder layer of the
+            decoding steps with at most this many sequences in a single
+            persistent kernel. Single GPU, unquantized f16/bf16 Llama-style
+            models only, at most 8. Default to 0 (disabled)
+        lm_head_quant (str): quantize the LM head to 'int8' or 'int4' with
+            group-wise (128) scales and zeros when loading the model, and run
+            it with the weight-only kernels. Requires sm80 and fp16. 'dense'
+            keeps the f16/bf16 weights and runs them with the tuned dense
+            kernels instead of cuBLAS (sm80, fp16/bf16). Default to 'none'
+        embedding_quant (str): keep the embedding table in 'int8' with a
+            scale per row, dequantized on the fly by the lookup. Requires
+            fp16 or bf16. Default to 'none'
+        mla_latent_cache (bool): cache the compressed KV (kv_lora_rank +
+            qk_rope_dim) of MLA models such as DeepSeek-V2/V3 instead of the
+            per-head K/V, which shrinks the k/v cache of a token from
+            2 * H * head_dim to 2 * 576 elements. Decoding attends to the
+            latents by absorbing
+            `kv_b_proj` into the queries. Requires sm80, fp16/bf16 weights
+            and no kv quantization, ignored for other models. Default to False
+        sparse_decode_blocks (int): block-sparse decoding for long contexts.
+            Each decoding token attends to the first block, the most recent
+            blocks and the `sparse_decode_blocks` blocks with the highest
+            upper bound of the attention scores, estimated from the min/max
+            of the keys kept with each cache block. This bounds the cost per
+            token at the price of some accuracy. Requires a non-quantized kv
+            cache and no sliding window. 0 disables. Default to 0
+        share_weights (bool): share the device weights with the other
+            engines of the process that load the same model with the same
+            parallel config, so that each engine has more memory left for
+            the k/v cache. Not compatible with max_loras. Default to False
+        max_loras (int): the number of LoRA adapters resident on the gpus.
+            Requests select an adapter by `adapter_name`, adapters that are
+            not resident are swapped in from host memory replacing the least
+            recently used one, and a batch mixes at most `max_loras`
+            adapters. Not compatible with prefix caching or attention DP.
+            Default to 0 (disabled)
+        max_lora_rank (int): the max rank of the LoRA adapters, at most 64.
+            Default to 64
+        adapters (dict): the paths of the LoRA adapters (PEFT format) to be
+            loaded at startup, keyed by the adapter name. Default to None
+        ep (int): expert parallelism. When it equals `mlp_tp_size`, the
+            routed experts of MoE models are distributed over the ranks
+            instead of being sliced by tensor parallelism, and tokens are
+            exchanged with all-to-all. Requires the `nccl` communicator.
+            Default to 1 (disabled)
+        ep_overlap (bool): overlap the all-to-all dispatch of expert
+            parallelism with the shared experts. Default to False
+        moe_replica_interval (int): with expert parallelism, every
+            `moe_replica_interval` steps of a MoE layer the hottest experts
+            are replicated to the least loaded ranks, which then take half
+            of their tokens. Each rank holds one replica per layer.
+            Default to 0 (disabled)
+        moe_scatter_reduce (bool): the output projection of the routed
+            experts adds its rows, weighted by the routing scores, to the
+            rows of their tokens in its epilogue instead of going through an
+            intermediate buffer and a separate reduction. The atomic adds make
+            the results depend on the order of the experts, it is ignored with
+            expert parallelism or `deterministic`. Default to False
+        moe_shared_overlap (bool): run the shared experts of MoE layers on
+            a side stream concurrently with the routed experts, their output
+            is merged by the reduction of the routed experts. Ignored with
+            expert parallelism and for the batches with LoRA adapters.
+            Default to False
+        prefix_aware_routing (bool): when data parallel is used together
+            with `enable_prefix_caching`, route new sessions to the rank
+            that most likely holds their prompt prefix, weighted against
+            the queue depth of the ranks. Default to False (round-robin)
+        migrate_threshold (int): with data parallel, a new turn of a
+            session bound to a rank that runs `migrate_threshold` more
+            sequences than the least loaded rank is moved there together
+            with its k/v cache, copied between the GPUs. Default to 0
+            (sessions stay on their rank)
+        max_queue_depth (int): requests waiting in the queue of each data
+            parallel rank before a new session has to make room according
+            to `queue_policy`, the dropped session completes with an
+            error. Default to 0 (unbounded)
+        queue_policy (str): how a new session makes room in a full queue.
+            'reject' rejects it, 'shed' drops the latest queued new session
+            of a lower priority (a larger `priority` value) or rejects the
+            new one, 'deadline' drops a queued new session past its
+            `deadline` or rejects the new one. Queued sessions past their
+            deadline are dropped whatever the policy. With the lock-free
+            request queue the new session is always rejected. Default to
+            'reject'
+        edf_slack_ms (int): serve the requests of a scheduling class
+            earliest deadline first, in the request queue and when running
+            sequences are preempted. The requests without a `deadline` are
+            due `edf_slack_ms` after they were queued, so that they are not
+            starved. Not supported by the lock-free request queue. Default
+            to 0 (first come, first served)
+        fair_share (bool): share the batch between the tenants of the
+            requests (`tenant_id`) by their `tenant_weight`. The free batch
+            slots go to the queued requests by deficit round robin on their
+            prompt tokens, and the prefills of the tenants served the least
+            tokens per weight are scheduled first. Default to False
+        sjf_scheduling (bool): serve the requests of a scheduling class
+            shortest expected output first, in the request queue, at the
+            admission and when running sequences are preempted. The output
+            length is the `expected_output_len` of a request, otherwise the
+            average of the finished requests with prompts of a similar
+            length (`max_new_tokens` in the request queue). Long requests
+            may wait under a sustained load. Not supported with
+            `edf_slack_ms`. Default to False
+        symmetric_kv_cache (bool): with the native communicator, allocate
+            the k/v cache from the memory mapped into every GPU of the
+            node, so that migrated sessions are read directly from the
+            peer GPU in one kernel. Not used with `cache_pool_key`.
+            Default to False
+        profile_interval (int): time the attention, FFN/MoE, communication
+            and sampling of each layer in one forward step out of
+            `profile_interval` with CUDA events, the histograms are read by
+            `TurboMind.get_profile`. Sampled steps don't use CUDA graphs.
+            Default to 0 (disabled)
+        trace_buffer (int): keep the last `trace_buffer` spans of the
+            timeline of the process: the host ranges of the engine, the
+            engine events and, with `profile_interval`, the device phases
+            of the sampled steps. Exported by `TurboMind.dump_trace` as a
+            Chrome trace that Perfetto opens. Default to 0 (disabled)
+        candidate_sampling (bool): with tensor parallel, each rank keeps
+            the top-k of its vocab shard and only the candidates are
+            gathered for sampling instead of the full logits. Used for the
+            steps where every request has a top_k <= 1024 and no penalties,
+            bad words, min length or generation logits. Default to False
+        deterministic (bool): batch invariant inference, the output of a
+            request doesn't depend on the batch it's scheduled with. The
+            GEMMs use a fixed kernel per shape without split-k, the kv of a
+            sequence is not split in decoding, and the allreduce of the
+            `cuda-ipc` communicator sums the ranks in a fixed order.
+            Default to False
+        decode_sm_ratio (float): in the steps mixing decodes and
+            prefills, the attention of the decoding sequences runs on this
+            share of the SMs and the prefill attention on the rest, so long
+            prefills don't hold back the decodes. The SMs are partitioned
+            with green contexts (CUDA 12.5+), otherwise the decodes only
+            get a higher stream priority. Default to 0 (disabled)
+        rope_table_len (int): the (cos, sin) of the rotary embedding are
+            read from a table precomputed for the positions below this
+            length instead of computed per element, which saves the
+            special function units at long contexts. The table takes
+            `rope_table_len * rope_dim * 4` bytes per rank. Sequences of
+            dynamic NTK scaling with a scaled rope base compute them.
+            Default to 0 (disabled)
+        pre_rope_kv_cache (bool): cache the keys without the rotary
+            embedding and rotate them when they are read by the attention
+            kernels. The cache doesn't depend on the rope base then, so
+            dynamic NTK scaling updates the base of a session on each
+            request from its context length without a re-prefill. Costs
+            the rotation of the keys on each decoding step. Requires no kv
+            quantization, disables cascade attention and
+            `sparse_decode_blocks`. Default to False
+        streaming_prefill (bool): the prefill attention reads the history
+            from the kv cache blocks instead of a linear copy of the whole
+            context, so the activation memory of a long prompt split into
+            chunks is bounded by the chunk size and `max_context_token_num`
+            no longer limits the context of a prefill batch. Requires
+            head_dim 64 or 128, and sm80 with kv quantization, whose blocks
+            are dequantized in the attention kernel. Default to None,
+            enabled on sm80+ when the model and the cache config support it
+        fp8_attention (bool): the prefill attention over an fp8 kv cache
+            (`quant_policy=16`) computes the scores with the fp8 tensor
+            cores from the cached e4m3 keys, the queries are quantized per
+            token and head. The softmax and its product with the values
+            stay in f16/bf16. Requires sm89+ and `streaming_prefill`.
+            Default to False
+        host_communicator (str): backend of the host communicators that
+            exchange the control data of the ranks. 'thread' for ranks in
+            one process, 'socket' for TCP connections to the rank 0
+            process. The ranks rendezvous at `TM_HOST_COMM_ADDR` (host:port)
+            of the rank 0 process, a loopback address with an ephemeral port
+            by default. The tp ranks exchange the dequeued requests as
+            shared objects, so 'socket' requires `tp=1` and `cp=1`.
+            Default to 'thread'
+        batch_submission (bool): submit the requests of an asyncio loop
+            iteration to the engine in one native call, and wake the
+            streams from a native completion queue polled through an
+            eventfd, one wakeup per batch of state updates instead of a
+            thread-safe callback per update. Linux only. Default to False
+        offload_weights (bool): keep the linear weights of the decoder
+            layers in pinned host memory and copy each layer to the GPU
+            while the one before is computed, for models larger than the
+            GPU memory. The throughput is bound by the host-to-device
+            bandwidth. CUDA graphs are disabled and MoE models are not
+            supported. Default to False
+        moe_expert_cache (int): keep the routed experts of MoE models in
+            pinned host memory and cache this many of them per layer on the
+            GPU, evicting the least recently used. The experts routed to in
+            a step are copied in before the expert GEMMs, and for small
+            batches the gate of the next layer applied to the input of the
+            current one picks the experts to prefetch. Requires the fused
+            MoE method, not supported with expert parallelism or multi-LoRA.
+            Default to 0 (disabled)
+        weight_snapshot (str): directory of the per-rank snapshots of the
+            weights prepared for the kernels. When the snapshots of the
+            model exist they are copied to the gpus in place of loading and
+            converting the model weights, otherwise they are written once
+            the weights are prepared. A snapshot is specific to the model,
+            the parallel config and the gpu arch. Not compatible with
+            offload_weights and MoE models. Default to None (disabled)
+        detokenizer_threads (int): decode the streamed tokens to text in
+            the engine with this many native threads, using the
+            `tokenizer.json` of the model (byte-level BPE or
+            sentencepiece-style vocabs). The delta is reported by
+            `EngineOutput.text`. Default to 0 (disabled)
+        dry_run (bool): load the weights and plan the device memory of the
+            ranks (`TurboMind.plan_memory`) without creating the engines,
+            for the kv cache capacity of the other parameters. The engine
+            can't serve requests. Default to False
     """
 
     dtype: str = 'auto'
     model_format: Optional[str] = None
     tp: int = 1
+    pp: int = 1
     dp: int = 1
+    cp: int = 1
     device_num: int = None
     attn_tp_size: int = None
     attn_dp_size: int = None
@@ -228,8 +686,30 @@ class TurbomindEngineConfig:
     cache_max_entry_count: float = 0.8
     cache_chunk_size: int = -1
     cache_block_seq_len: int = 64
+    cache_swap_space: float = 0
+    cache_swap_bandwidth: float = 0
+    cache_recompute_tflops: float = 100
     enable_prefix_caching: bool = False
+    cache_pin_tokens: int = 0
+    prefix_cache_path: Optional[str] = None
+    prefix_cache_disk_space: float = 0
+    embedding_cache_size: float = 0
+    l2_persist_mb: int = 0
+    kv_quant_error_interval: int = 0
+    cache_window_size: int = 0
+    cache_sink_size: int = 0
+    cache_score_budget: int = 0
+    cache_recent_blocks: int = 0
+    cache_cold_quant: str = 'int4'
+    cache_cold_ratio: float = 0.5
+    cache_eviction_policy: str = 'lru'
+    cache_pool_key: str = ''
+    cache_pool_size: float = 0
+    cache_pool_min: float = 0
+    cache_pool_max: float = 0
+    cache_virtual_memory: bool = False
     quant_policy: int = 0
+    layer_quant_policy: Optional[List[int]] = None
     rope_scaling_factor: float = 0.0
     use_logn_attn: bool = False
     download_dir: Optional[str] = None
@@ -237,19 +717,155 @@ class TurbomindEngineConfig:
     max_prefill_token_num: int = 8192
     num_tokens_per_iter: int = 0
     max_prefill_iters: int = 1
+    split_fuse: bool = False
+    overlap_scheduling: bool = False
+    async_output: bool = False
+    finish_sync_interval: int = 0
+    enable_cuda_graph: bool = False
+    enable_cascade_attention: bool = False
+    numa_affinity: bool = False
+    comm_overlap_tokens: int = 0
+    comm_quant: str = 'none'
+    reserved_slots: int = 0
+    target_itl_ms: float = 0
+    admission_control: bool = False
+    num_speculative_tokens: int = 0
+    speculative_ngram_size: int = 3
+    fp8_linear: bool = False
+    int8_linear: bool = False
+    w8a16_linear: bool = False
+    sparse_linear: bool = False
+    enable_pdl: bool = False
+    decode_megakernel_batch: int = 0
+    lm_head_quant: str = 'none'
+    embedding_quant: str = 'none'
+    mla_latent_cache: bool = False
+    sparse_decode_blocks: int = 0
+    share_weights: bool = False
+    max_loras: int = 0
+    max_lora_rank: int = 64
+    adapters: Optional[Dict[str, str]] = None
+    ep: int = 1
+    ep_overlap: bool = False
+    moe_replica_interval: int = 0
+    moe_scatter_reduce: bool = False
+    moe_shared_overlap: bool = False
     communicator: str = 'nccl'
+    host_communicator: str = 'thread'
+    prefix_aware_routing: bool = False
+    migrate_threshold: int = 0
+    max_queue_depth: int = 0
+    queue_policy: str = 'reject'
+    edf_slack_ms: int = 0
+    fair_share: bool = False
+    sjf_scheduling: bool = False
+    symmetric_kv_cache: bool = False
+    profile_interval: int = 0
+    trace_buffer: int = 0
+    candidate_sampling: bool = False
+    deterministic: bool = False
+    decode_sm_ratio: float = 0.
+    rope_table_len: int = 0
+    pre_rope_kv_cache: bool = False
+    streaming_prefill: Optional[bool] = None
+    fp8_attention: bool = False
+    batch_submission: bool = False
+    offload_weights: bool = False
+    moe_expert_cache: int = 0
+    weight_snapshot: Optional[str] = None
+    detokenizer_threads: int = 0
+    dry_run: bool = False
 
     def __post_init__(self):
         """Check input validation."""
         assert self.dtype in ['auto', 'float16', 'bfloat16']
         assert self.tp >= 1, 'tp must be a positive integer'
+        assert self.pp >= 1, 'pp must be a positive integer'
         assert 0 < self.cache_max_entry_count < 1, \
             'invalid cache_max_entry_count'
-        assert self.quant_policy in (0, 4, 8), 'invalid quant_policy'
+        assert self.cache_block_seq_len > 0 and \
+            self.cache_block_seq_len % 64 == 0, \
+            'cache_block_seq_len must be a multiple of 64'
+        assert self.cache_swap_space >= 0, 'invalid cache_swap_space'
+        assert self.cache_swap_bandwidth >= 0, 'invalid cache_swap_bandwidth'
+        assert self.cache_recompute_tflops > 0, \
+            'invalid cache_recompute_tflops'
+        assert self.prefix_cache_disk_space >= 0, \
+            'invalid prefix_cache_disk_space'
+        assert self.embedding_cache_size >= 0, 'invalid embedding_cache_size'
+        assert self.l2_persist_mb >= 0, 'invalid l2_persist_mb'
+        assert self.kv_quant_error_interval >= 0, \
+            'invalid kv_quant_error_interval'
+        assert self.detokenizer_threads >= 0, 'invalid detokenizer_threads'
+        assert 0 <= self.decode_sm_ratio < 1, 'invalid decode_sm_ratio'
+        assert self.rope_table_len >= 0, 'invalid rope_table_len'
+        assert self.cache_window_size >= 0, 'invalid cache_window_size'
+        assert self.cache_sink_size >= 0, 'invalid cache_sink_size'
+        assert self.cache_score_budget >= 0, 'invalid cache_score_budget'
+        assert self.cache_recent_blocks >= 0, 'invalid cache_recent_blocks'
+        assert self.cache_cold_quant in ('int8', 'int4'), \
+            'invalid cache_cold_quant'
+        assert 0 < self.cache_cold_ratio < 1, 'invalid cache_cold_ratio'
+        assert self.cache_eviction_policy in ('lru', 'lfu', '2q'), \
+            'invalid cache_eviction_policy'
+        assert self.cache_pool_size >= 0, 'invalid cache_pool_size'
+        assert self.cache_pool_min >= 0, 'invalid cache_pool_min'
+        assert self.cache_pool_max >= 0, 'invalid cache_pool_max'
+        assert not (self.cache_window_size and self.enable_prefix_caching), \
+            'cache_window_size is not supported with prefix caching'
+        assert self.cache_pin_tokens >= 0, 'invalid cache_pin_tokens'
+        assert self.quant_policy in (0, 4, 8, 16), 'invalid quant_policy'
+        assert all(x in (0, 4, 8, 16) for x in self.layer_quant_policy or []), \
+            'invalid layer_quant_policy'
         assert self.rope_scaling_factor >= 0, 'invalid rope_scaling_factor'
         assert self.max_prefill_token_num >= 0, \
             'invalid max_prefill_token_num'
         assert self.num_tokens_per_iter >= 0, 'invalid num_tokens_per_iter'
+        assert self.reserved_slots >= 0, 'invalid reserved_slots'
+        assert self.target_itl_ms >= 0, 'invalid target_itl_ms'
+        assert self.num_speculative_tokens >= 0, \
+            'invalid num_speculative_tokens'
+        assert self.speculative_ngram_size >= 1, \
+            'invalid speculative_ngram_size'
+        assert self.max_loras >= 0, 'invalid max_loras'
+        assert 0 < self.max_lora_rank <= 64, 'invalid max_lora_rank'
+        assert not self.adapters or self.max_loras > 0, \
+            'adapters require max_loras > 0'
+        assert not (self.share_weights and self.max_loras), \
+            'share_weights is not supported with max_loras'
+        assert self.ep >= 1, 'invalid ep'
+        assert self.moe_replica_interval >= 0, \
+            'invalid moe_replica_interval'
+        assert self.profile_interval >= 0, 'invalid profile_interval'
+        assert self.trace_buffer >= 0, 'invalid trace_buffer'
+        assert self.max_queue_depth >= 0, 'invalid max_queue_depth'
+        assert self.queue_policy in ('reject', 'shed', 'deadline'), \
+            'invalid queue_policy'
+        assert self.edf_slack_ms >= 0, 'invalid edf_slack_ms'
+        assert self.comm_overlap_tokens >= 0, 'invalid comm_overlap_tokens'
+        assert self.finish_sync_interval >= 0, 'invalid finish_sync_interval'
+        assert 0 <= self.decode_megakernel_batch <= 8, \
+            'invalid decode_megakernel_batch'
+        assert self.comm_quant in ('none', 'int8', 'fp8'), 'invalid comm_quant'
+        assert self.lm_head_quant in ('none', 'dense', 'int8', 'int4'), \
+            'invalid lm_head_quant'
+        assert self.embedding_quant in ('none', 'int8'), \
+            'invalid embedding_quant'
+        assert not (self.fp8_linear and self.int8_linear), \
+            'fp8_linear and int8_linear are exclusive'
+        assert not (self.mla_latent_cache and self.quant_policy), \
+            'mla_latent_cache does not support kv quantization'
+        assert not (self.pre_rope_kv_cache and self.quant_policy), \
+            'pre_rope_kv_cache does not support kv quantization'
+        assert self.host_communicator in ('thread', 'socket'), \
+            'invalid host_communicator'
+        assert self.host_communicator != 'socket' or (
+            self.tp == 1 and self.cp == 1), \
+            "host_communicator='socket' requires tp=1 and cp=1"
+        assert self.sparse_decode_blocks >= 0, 'invalid sparse_decode_blocks'
+        assert self.moe_expert_cache >= 0, 'invalid moe_expert_cache'
+        assert not (self.weight_snapshot and self.offload_weights), \
+            'weight_snapshot is not compatible with offload_weights'
 
 
 @dataclass
@@ -388,6 +1004,8 @@ class Response:
     logprobs: List[Dict[int, float]] = None
     logits: torch.Tensor = None
     last_hidden_state: torch.Tensor = None
+    prompt_logprobs: torch.Tensor = None
+    cached_tokens: int = None
     index: int = 0
 
 
@@ -402,6 +1020,19 @@ class EngineOutput:
             may not equal to the length of token_ids
         logprobs (List[Dict[int, float]]): the top logprobs for each output
             position.
+        cached_tokens (int): the number of context tokens whose kv cache was
+            reused instead of recomputed, e.g. served by the prefix cache.
+            Only reported by turbomind
+        prompt_logprobs (torch.Tensor): the logprob of each prompt token
+            given its prefix for scoring requests, 0 for the first token
+        pooled_hidden_state (torch.Tensor): the pooled hidden state of the
+            prompt for pooling requests, fp32 of shape `[hidden]`
+        req_metrics: timestamps (us, monotonic clock) of the request in the
+            engine, i.e. enqueue, scheduling, prefill end, first token,
+            preemptions and finish, and the computed prompt tokens. Only
+            reported by turbomind in the final output
+        text (str): the text of the new tokens decoded by the engine, only
+            reported by turbomind with `detokenizer_threads`
     """
     status: ResponseType
     token_ids: List[int]
@@ -409,6 +1040,7 @@ class EngineOutput:
     logprobs: List[Dict[int, float]] = None
     logits: torch.Tensor = None
     last_hidden_state: torch.Tensor = None
+    text: str = None
 
 
 @dataclass
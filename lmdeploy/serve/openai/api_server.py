@@ -285,6 +285,10 @@ async def chat_completions_v1(request: ChatCompletionRequest, raw_request: Reque
     - max_tokens (int | None): output token nums. Default to None.
     - repetition_penalty (float): The parameter for repetition penalty.
         1.0 means no penalty
+    - presence_penalty (float): Penalty of the tokens that are in the
+        generated ones. Only supported in turbomind engine.
+    - frequency_penalty (float): Penalty of the tokens proportional to their
+        counts in the generated ones. Only supported in turbomind engine.
     - stop (str | List[str] | None): To stop generating further
         tokens. Only accept stop words that's encoded to one token idex.
     - response_format (Dict | None): Only pytorch backend support formatting
@@ -318,10 +322,6 @@ async def chat_completions_v1(request: ChatCompletionRequest, raw_request: Reque
         0 and 1. Typical values are in the 0.01-0.2 range, comparably
         selective as setting `top_p` in the 0.99-0.8 range (use the
         opposite of normal `top_p` values)
-
-    Currently we do not support the following features:
-    - presence_penalty (replaced with repetition_penalty)
-    - frequency_penalty (replaced with repetition_penalty)
     """
     if request.session_id == -1:
         VariableInterface.session_id += 1
@@ -368,6 +368,8 @@ async def chat_completions_v1(request: ChatCompletionRequest, raw_request: Reque
                                   top_p=request.top_p,
                                   temperature=request.temperature,
                                   repetition_penalty=request.repetition_penalty,
+                                  frequency_penalty=request.frequency_penalty or 0.0,
+                                  presence_penalty=request.presence_penalty or 0.0,
                                   ignore_eos=request.ignore_eos,
                                   stop_words=request.stop,
                                   skip_special_tokens=request.skip_special_tokens,
@@ -583,6 +585,10 @@ async def completions_v1(request: CompletionRequest, raw_request: Request = None
         set stream: true.
     - repetition_penalty (float): The parameter for repetition penalty.
         1.0 means no penalty
+    - presence_penalty (float): Penalty of the tokens that are in the
+        generated ones. Only supported in turbomind engine.
+    - frequency_penalty (float): Penalty of the tokens proportional to their
+        counts in the generated ones. Only supported in turbomind engine.
     - user (str): A unique identifier representing your end-user.
     - stop (str | List[str] | None): To stop generating further
         tokens. Only accept stop words that's encoded to one token idex.
@@ -599,8 +605,6 @@ async def completions_v1(request: CompletionRequest, raw_request: Request = None
 
     Currently we do not support the following features:
     - logprobs (not supported yet)
-    - presence_penalty (replaced with repetition_penalty)
-    - frequency_penalty (replaced with repetition_penalty)
     """
     if request.session_id == -1:
         VariableInterface.session_id += 1
@@ -630,6 +634,8 @@ async def completions_v1(request: CompletionRequest, raw_request: Request = None
                                   top_p=request.top_p,
                                   temperature=request.temperature,
                                   repetition_penalty=request.repetition_penalty,
+                                  frequency_penalty=request.frequency_penalty or 0.0,
+                                  presence_penalty=request.presence_penalty or 0.0,
                                   ignore_eos=request.ignore_eos,
                                   stop_words=request.stop,
                                   skip_special_tokens=request.skip_special_tokens,
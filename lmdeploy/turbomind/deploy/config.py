@@ -42,6 +42,9 @@ class ModelConfig:
     model_arch: str = None
     head_num: int = None
     kv_head_num: int = None
+    # kv heads of each layer of pruned models, `kv_head_num` is the most
+    # of them then
+    layer_kv_head_num: List[int] = None
     hidden_units: int = None
     vocab_size: int = None
     # Turbomind used to assume token_embedding and lm_head has the same size
@@ -62,6 +65,7 @@ class ModelConfig:
     session_len: int = None
     attn_tp_size: int = 1
     mlp_tp_size: int = 1
+    ep_size: int = 1
     model_format: str = 'hf'
     expert_num: List[int] = ()
     expert_inter_size: int = 0
@@ -79,6 +83,8 @@ class ModelConfig:
     v_head_dim: int = 0
     # tuning
     tune_layer_num: int = 1
+    # Medusa draft heads of speculative decoding
+    medusa_num_heads: int = 0
 
     def verify(self):
         invalid = {}
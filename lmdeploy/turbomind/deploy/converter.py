@@ -159,7 +159,8 @@ def get_tm_model(model_path,
                  chat_template_name,
                  engine_config: TurbomindEngineConfig,
                  group_size: int = None,
-                 out_dir: str = None) -> BaseOutputModel:
+                 out_dir: str = None,
+                 weight_format: str = 'bin') -> BaseOutputModel:
     """Create turbomind model.
 
     Args:
@@ -174,6 +175,9 @@ def get_tm_model(model_path,
             is a w4a16(awq or gptq) quantized model
         out_dir(str): the output directory where to save to turbomind model.
             If it is None, the turbomind model won't be saved
+        weight_format(str): the format of the saved weights, `bin` for a
+            file per tensor or `safetensors` for shards that the engine
+            streams to the devices
     """
     _, cfg = get_model_arch(model_path)
     quant_config = search_nested_config(cfg.to_dict(), 'quantization_config')
@@ -230,11 +234,13 @@ def get_tm_model(model_path,
 
     tm_cfg.model_config.attn_tp_size = engine_config.attn_tp_size
     tm_cfg.model_config.mlp_tp_size = engine_config.mlp_tp_size
+    tm_cfg.model_config.ep_size = engine_config.ep
 
     output_model = OUTPUT_MODELS.get(output_model_name)(input_model=input_model,
                                                         cfg=tm_cfg,
                                                         model_cls=Transformer,
-                                                        out_dir=out_dir)
+                                                        out_dir=out_dir,
+                                                        weight_format=weight_format)
 
     return output_model
 
@@ -250,6 +256,7 @@ def main(model_name: str,
          group_size: int = 0,
          revision: str = None,
          download_dir: str = None,
+         weight_format: str = 'bin',
          **kwargs):
     """deploy llama family models via turbomind.
 
@@ -277,6 +284,9 @@ def main(model_name: str,
             the default version.
         download_dir (str): Directory to download and load the weights,
             default to the default cache directory of huggingface.
+        weight_format (str): the format of the saved weights, either `bin`
+            (a file per tensor) or `safetensors` (shards that are mmap'd and
+            streamed to the devices by the engine when loading)
         kwargs (dict): other params for convert
     """
     if chat_template is None:
@@ -306,7 +316,13 @@ def main(model_name: str,
     copy_tokenizer(model_path, tokenizer_path, tm_tokenizer_path)
     engine_config = TurbomindEngineConfig(tp=tp, device_num=tp, model_format=model_format, dtype=dtype)
     update_parallel_config(engine_config)
-    tm_model = get_tm_model(model_path, model_name, chat_template, engine_config, group_size, tm_weight_path)
+    tm_model = get_tm_model(model_path,
+                            model_name,
+                            chat_template,
+                            engine_config,
+                            group_size,
+                            tm_weight_path,
+                            weight_format=weight_format)
     tm_model.export()
 
 
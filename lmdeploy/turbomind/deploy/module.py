@@ -138,6 +138,10 @@ class MoeFfn(Ffn):
         self.expert_num = model.model_config.expert_num
         self.inter_size = model.model_config.expert_inter_size
         self.shared_gate = model.model_config.moe_shared_gate
+        # experts are distributed over the ranks as a whole with expert
+        # parallelism
+        if model.model_config.ep_size > 1:
+            self.tp = 1
 
     def apply(self, i: int, r: BaseReader):
         if self.expert_num[i] == 0:
@@ -293,6 +297,7 @@ class Misc(Module):
         r.tok_embeddings()
         r.norm_weight()
         r.output_weight()
+        r.medusa_heads(), optional
     """
 
     def apply(self, i: int, r: BaseReader):
@@ -320,6 +325,12 @@ class Misc(Module):
             tp = self.model.attn_tp_size
             output_weight = pad_weight(output_weight, tp=tp)
             self.model.save_split(output_weight, 'output.weight', split_dim=0, split_num=tp)
+        medusa_heads = getattr(r, 'medusa_heads', None)
+        for j, res_w, res_b, head_w in medusa_heads() if medusa_heads else []:
+            tp = self.model.attn_tp_size
+            self.model.export_weight(res_w, f'medusa.{j}.res.weight')
+            self.model.export_weight(res_b, f'medusa.{j}.res.bias')
+            self.model.save_split(pad_weight(head_w, tp=tp), f'medusa.{j}.output.weight', split_dim=0, split_num=tp)
 
 
 class Transformer:
@@ -55,6 +55,17 @@ class LlamaReader(BaseReader):
         """Get output."""
         return self.params.get(self.output_weight_key, None)
 
+    def medusa_heads(self):
+        """Get the residual blocks and the projections of the Medusa heads in
+        the params, as (index, res weight, res bias, output weight)"""
+        heads = []
+        for i in range(self.model_cfg.get('medusa_num_heads', 0)):
+            prefix = f'medusa_head.{i}'
+            keys = [f'{prefix}.0.linear.weight', f'{prefix}.0.linear.bias', f'{prefix}.1.weight']
+            if all(k in self.params for k in keys):
+                heads.append((i, *[self.params[k] for k in keys]))
+        return heads
+
     def _transform(self, x: torch.Tensor, kind: str):
         return self.processor(x, kind)
 
@@ -129,6 +140,11 @@ class LlamaModel(BaseInputModel):
                 kv_head_num = model_arg['num_key_value_heads']
             else:
                 kv_head_num = model_arg['num_attention_heads']
+            # pruned models may keep different kv heads in the layers
+            layer_kv_head_num = None
+            if isinstance(kv_head_num, list):
+                layer_kv_head_num = kv_head_num
+                kv_head_num = max(kv_head_num)
             hidden_units = model_arg['hidden_size']
             head_dim = model_arg.get('head_dim', hidden_units // attn_head_num)
             # compute rope param
@@ -181,8 +197,10 @@ class LlamaModel(BaseInputModel):
                     norm_eps=norm_eps,
                     head_num=attn_head_num,
                     kv_head_num=kv_head_num,
+                    layer_kv_head_num=layer_kv_head_num,
                     hidden_units=hidden_units,
                     inter_size=inter_size,
                     vocab_size=vocab_size,
                     max_position_embeddings=max_position_embeddings,
-                    rope_param=rope_param)
+                    rope_param=rope_param,
+                    medusa_num_heads=model_arg.get('medusa_num_heads', 0))
@@ -45,8 +45,22 @@ def _pad_inter_size(inter_size: int, group_size: int, tp: int):
 class BaseOutputModel(ABC):
     """Base output model."""
 
-    def __init__(self, input_model: BaseInputModel, cfg: TurbomindModelConfig, model_cls, out_dir: str = ''):
+    # size of the safetensors shards
+    SHARD_SIZE = 4 << 30
+
+    def __init__(self,
+                 input_model: BaseInputModel,
+                 cfg: TurbomindModelConfig,
+                 model_cls,
+                 out_dir: str = '',
+                 weight_format: str = 'bin'):
         super().__init__()
+        assert weight_format in ['bin', 'safetensors'], \
+            f'unsupported weight format {weight_format}'
+        self.weight_format = weight_format
+        self._shard = {}
+        self._shard_bytes = 0
+        self._shard_num = 0
         self.input_model = input_model
         self.model_config = cfg.model_config
         self.attention_config = cfg.attention_config
@@ -72,6 +86,10 @@ class BaseOutputModel(ABC):
         # and tp is divisble by kv_head_num
         assert self.model_config.head_num % self.attn_tp_size == 0
         self.repeat_kv = 0
+        # the kv heads of the layers of pruned models are not replicated
+        layer_kv_head_num = self.model_config.layer_kv_head_num or []
+        assert all(x % self.attn_tp_size == 0 for x in layer_kv_head_num), \
+            f'kv heads of the layers {layer_kv_head_num} are not divisible by tp {self.attn_tp_size}'
         if (self.attn_tp_size > self.model_config.kv_head_num
                 and self.attn_tp_size % self.model_config.kv_head_num == 0):
             self.repeat_kv = (self.attn_tp_size // self.model_config.kv_head_num)
@@ -138,7 +156,10 @@ class BaseOutputModel(ABC):
                 torch_type = _weight_dtype_map(self.model_config.weight_type, torch.float16)
                 param = param.to(torch_type)
             tprint(name, param.shape)
-            _tofile(param, osp.join(self.out_dir, name))
+            if self.weight_format == 'safetensors':
+                self._add_to_shard(param, name)
+            else:
+                _tofile(param, osp.join(self.out_dir, name))
         elif len(self.tm_params) > 0:
             tm_params = self.tm_params
             weight_type = self.model_config.weight_type
@@ -161,6 +182,25 @@ class BaseOutputModel(ABC):
         else:
             tprint('skip export', name, param.shape)
 
+    def _add_to_shard(self, param: torch.Tensor, name: str):
+        # copies of a tensor must not share memory in a shard
+        param = param.detach().contiguous().cpu().clone()
+        self._shard[name] = param
+        self._shard_bytes += param.numel() * param.element_size()
+        if self._shard_bytes >= self.SHARD_SIZE:
+            self._flush_shard()
+
+    def _flush_shard(self):
+        """write the pending tensors to a safetensors shard, which is streamed
+        to the devices by the engine."""
+        if not self._shard:
+            return
+        from safetensors.torch import save_file
+        self._shard_num += 1
+        save_file(self._shard, osp.join(self.out_dir, f'model-{self._shard_num:05d}.safetensors'))
+        self._shard = {}
+        self._shard_bytes = 0
+
     def save_split(self, tensor: torch.Tensor, name: str, split_dim=None, split_num=1, copy=False) -> None:
         """save split.
 
@@ -205,6 +245,8 @@ class BaseOutputModel(ABC):
             if self.model(i, reader):
                 pbar.update(1)
         pbar.close()
+        if self.to_file:
+            self._flush_shard()
         # manually clean up meta reader
         if hasattr(self.input_model, 'meta_reader'):
             self.input_model.meta_reader.clean_up(True)
@@ -0,0 +1,66 @@
+# Copyright (c) OpenMMLab. All rights reserved.
+import json
+from typing import Dict, Optional
+
+import torch
+
+import _turbomind as _tm
+
+
+class GrammarMatcher(_tm.TokenMatcher):
+    """Token matcher of a compiled xgrammar grammar.
+
+    The engine fills the next token bitmask on its mask workers while the
+    forward pass runs and feeds back the sampled tokens.
+    """
+
+    def __init__(self, compiled_grammar):
+        super().__init__()
+        import xgrammar as xgr
+        self._matcher = xgr.GrammarMatcher(compiled_grammar)
+
+    def fill_next_token_bitmask(self, bitmask):
+        self._matcher.fill_next_token_bitmask(torch.from_numpy(bitmask)[None], 0)
+
+    def accept_token(self, token_id: int):
+        if not self._matcher.is_terminated():
+            self._matcher.accept_token(token_id)
+
+
+class GrammarCompiler:
+    """Compiles the `response_format` of requests into matchers, compiled
+    grammars are cached by xgrammar."""
+
+    def __init__(self, tokenizer: object, vocab_size: int):
+        import xgrammar as xgr
+        hf_tokenizer = getattr(tokenizer, 'model', tokenizer)
+        hf_tokenizer = getattr(hf_tokenizer, 'model', hf_tokenizer)
+        info = xgr.TokenizerInfo.from_huggingface(hf_tokenizer, vocab_size=vocab_size)
+        self._compiler = xgr.GrammarCompiler(info)
+
+    def create_matcher(self, response_format: Optional[Dict]) -> Optional[GrammarMatcher]:
+        if not response_format:
+            return None
+        format_type = response_format.get('type', 'text')
+        if format_type == 'text':
+            return None
+        if format_type == 'json_schema':
+            schema = response_format.get('json_schema')
+            if isinstance(schema, Dict):
+                for key in ['json_schema', 'schema']:
+                    if key in schema:
+                        schema = schema[key]
+            if schema is None:
+                grammar = self._compiler.compile_builtin_json_grammar()
+            elif isinstance(schema, Dict):
+                grammar = self._compiler.compile_json_schema(json.dumps(schema, ensure_ascii=False))
+            else:
+                raise ValueError(f'Cannot parse schema {schema}. The schema must be either a dictionary or a '
+                                 'string that contains the JSON Schema specification')
+        elif format_type == 'json_object':
+            grammar = self._compiler.compile_builtin_json_grammar()
+        elif format_type == 'regex_schema':
+            grammar = self._compiler.compile_regex(response_format.get('regex_schema', ''))
+        else:
+            raise ValueError(f'unsupported format type: {format_type}')
+        return GrammarMatcher(grammar)
@@ -0,0 +1,110 @@
+# Copyright (c) OpenMMLab. All rights reserved.
+import json
+import os.path as osp
+import re
+from typing import Dict, List, Tuple
+
+import torch
+
+from .deploy.config import ModelConfig
+from .deploy.module import permute_v2
+
+_KEY = re.compile(r'layers\.(\d+)\.(?:self_attn|mlp)\.(\w+)\.lora_([AB])\.weight$')
+
+
+def _load_state_dict(path: str) -> Dict[str, torch.Tensor]:
+    file = osp.join(path, 'adapter_model.safetensors')
+    if osp.exists(file):
+        from safetensors.torch import load_file
+        return load_file(file)
+    return torch.load(osp.join(path, 'adapter_model.bin'), map_location='cpu')
+
+
+def load_lora_adapter(path: str,
+                      cfg: ModelConfig,
+                      n_ranks: int,
+                      dtype: torch.dtype,
+                      permute_qk: bool = True) -> Tuple[int, List[torch.Tensor]]:
+    """Convert a PEFT LoRA adapter of a llama-like model into the slot layout
+    of turbomind, one flattened tensor for each tensor parallel rank.
+
+    For each layer the modules are laid out as qkv, wo, w1, w3, w2, each with
+    A [input_dims, sections * r] followed by B [r, output_dims]. A of qkv is
+    the concatenation of the A of q, k & v. Modules of different ranks are
+    zero padded to the max rank and the scaling is folded into B.
+
+    Returns:
+        the rank of the adapter and the weights of each rank
+    """
+    with open(osp.join(path, 'adapter_config.json')) as f:
+        config = json.load(f)
+
+    assert cfg.kv_lora_rank == 0, 'LoRA adapters are not supported for MLA'
+    assert cfg.kv_head_num % cfg.attn_tp_size == 0, \
+        'LoRA adapters require kv heads to be divisible by tp'
+
+    weights = {}
+    for k, v in _load_state_dict(path).items():
+        m = _KEY.search(k)
+        if m:
+            layer, name, ab = m.groups()
+            weights[int(layer), name, ab] = v.float()
+
+    r = max(v.size(0) for (_, _, ab), v in weights.items() if ab == 'A')
+    alpha = config.get('lora_alpha', config['r'])
+
+    def get(layer: int, name: str, in_dims: int, out_dims: int):
+        """A [in_dims, r], B [r, out_dims] with scaling applied."""
+        a = weights.get((layer, name, 'A'))
+        b = weights.get((layer, name, 'B'))
+        if a is None or b is None:
+            return torch.zeros(in_dims, r), torch.zeros(r, out_dims)
+        rank = a.size(0)
+        full_name = f'layers.{layer}.{name}'
+        scale = alpha
+        for pattern, value in config.get('alpha_pattern', {}).items():
+            if re.search(pattern, full_name):
+                scale = value
+                break
+        scale = scale / (rank**0.5 if config.get('use_rslora') else rank)
+        a = torch.nn.functional.pad(a.t(), (0, r - rank))
+        b = torch.nn.functional.pad(b.t() * scale, (0, 0, 0, r - rank))
+        return a, b
+
+    head_dim = cfg.size_per_head
+    hidden = cfg.hidden_units
+    q_dims = cfg.head_num * head_dim
+    kv_dims = cfg.kv_head_num * head_dim
+    tp = cfg.attn_tp_size
+    assert cfg.mlp_tp_size == tp and n_ranks % tp == 0
+
+    def split(x: torch.Tensor, dim: int, tp_rank: int):
+        return x.chunk(tp, dim=dim)[tp_rank]
+
+    outputs = []
+    for rank in range(n_ranks):
+        tp_rank = rank % tp
+        tensors = []
+        for i in range(cfg.num_layer):
+            qa, qb = get(i, 'q_proj', hidden, q_dims)
+            ka, kb = get(i, 'k_proj', hidden, kv_dims)
+            va, vb = get(i, 'v_proj', hidden, kv_dims)
+            if permute_qk:
+                qb = permute_v2(qb, head_dim)
+                kb = permute_v2(kb, head_dim)
+            qkv_b = [split(x, -1, tp_rank) for x in (qb, kb, vb)]
+            tensors += [torch.cat((qa, ka, va), dim=-1), torch.cat(qkv_b, dim=-1)]
+
+            oa, ob = get(i, 'o_proj', q_dims, hidden)
+            tensors += [split(oa, 0, tp_rank), ob]
+
+            inter_size = cfg.inter_size[i]
+            if inter_size:
+                for name in ('gate_proj', 'up_proj'):
+                    a, b = get(i, name, hidden, inter_size)
+                    tensors += [a, split(b, -1, tp_rank)]
+                a, b = get(i, 'down_proj', inter_size, hidden)
+                tensors += [split(a, 0, tp_rank), b]
+        outputs.append(torch.cat([x.contiguous().flatten() for x in tensors]).to(dtype))
+
+    return r, outputs
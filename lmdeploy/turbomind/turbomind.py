@@ -4,8 +4,11 @@ import asyncio
 import copy
 import json
 import math
+import os
 import os.path as osp
+import pickle
 import sys
+import time
 from collections import defaultdict
 from collections.abc import Sequence
 from concurrent.futures import ThreadPoolExecutor
@@ -36,6 +39,11 @@ logger = get_logger('lmdeploy')
 
 MAX_LOGPROBS = 1024
 
+# phases of `StepProfiler`, in order
+_PROFILE_PHASES = ('step', 'attention', 'ffn', 'comm', 'sampling')
+_CACHE_STATS = ('prompt_tokens', 'hit_tokens', 'evicted_blocks', 'trie_nodes', 'active_blocks', 'cached_blocks',
+                'free_blocks', 'swapped_blocks', 'preempt_swap', 'preempt_recompute', 'pinned_blocks')
+
 
 def _construct_stop_or_bad_words(words: List[int] = None):
     if words is None or len(words) == 0:
@@ -82,14 +90,17 @@ def complete_parallel_config(cfg: TurbomindEngineConfig):
 
 def update_parallel_config(cfg: TurbomindEngineConfig):
     if not complete_parallel_config(cfg):
-        total = cfg.dp * cfg.tp
+        total = cfg.dp * cfg.tp * cfg.cp
         if not cfg.device_num:
-            count = torch.cuda.device_count()
+            count = torch.cuda.device_count() // cfg.pp
             if total < count:
                 count = total
-            cfg.device_num = count
-        assert total % cfg.device_num == 0
-        overlap = total // cfg.device_num
+            cfg.device_num = count * cfg.pp
+        # devices of a pipeline stage
+        stage_device_num = cfg.device_num // cfg.pp
+        assert stage_device_num * cfg.pp == cfg.device_num
+        assert total % stage_device_num == 0
+        overlap = total // stage_device_num
         attn_dp_size = overlap
         mlp_tp_size = overlap
         inner_tp_size = cfg.tp // mlp_tp_size
@@ -97,9 +108,9 @@ def update_parallel_config(cfg: TurbomindEngineConfig):
         cfg.attn_dp_size = attn_dp_size
         cfg.attn_tp_size = inner_tp_size
         cfg.mlp_dp_size = 1
-        cfg.mlp_tp_size = mlp_tp_size * inner_tp_size
-    assert cfg.attn_dp_size * cfg.attn_tp_size == cfg.mlp_dp_size * cfg.mlp_tp_size
-    assert cfg.attn_dp_size * cfg.attn_tp_size * cfg.outer_dp_size == cfg.device_num
+        cfg.mlp_tp_size = mlp_tp_size * inner_tp_size * cfg.cp
+    assert cfg.attn_dp_size * cfg.attn_tp_size * cfg.cp == cfg.mlp_dp_size * cfg.mlp_tp_size
+    assert cfg.attn_dp_size * cfg.attn_tp_size * cfg.cp * cfg.outer_dp_size * cfg.pp == cfg.device_num
 
 
 class TurboMind:
@@ -127,6 +138,9 @@ class TurboMind:
                  **kwargs):
         self.model_name = model_name
         self.chat_template_name = chat_template_name
+        # seconds of the phases of the start run by this process for all the devices
+        self._startup_phases: Dict[str, float] = {}
+        start = time.perf_counter()
 
         _engine_config = copy.deepcopy(engine_config)
         if _engine_config is None:
@@ -139,8 +153,14 @@ class TurboMind:
         update_parallel_config(_engine_config)
 
         self.gpu_count = _engine_config.device_num
+        self._ep = _engine_config.ep
+        self._comm_size = _engine_config.attn_dp_size * _engine_config.attn_tp_size * _engine_config.cp
 
         self.tokenizer = tokenizer
+        self._grammar_compiler = None
+        self._permute_qk = True
+        self._adapter_ids: Dict[str, int] = {}
+        self._dispatcher = None
         if model_source == ModelSource.WORKSPACE:
             self.model_comm = self._from_workspace(model_path=model_path, engine_config=_engine_config)
         else:
@@ -150,16 +170,28 @@ class TurboMind:
                                             model_path=model_path,
                                             engine_config=_engine_config)
 
-        with ThreadPoolExecutor(max_workers=self.gpu_count) as e:
-            ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
-            for _ in e.map(self.model_comm.process_weight, range(self.gpu_count), ranks):
-                pass
-            # implicit synchronization
-            for _ in e.map(self.model_comm.create_engine, range(self.gpu_count), ranks):
-                pass
+        if _engine_config.dry_run:
+            for device_id, plan in enumerate(self.plan_memory()):
+                logger.info(f'memory plan of device {device_id}: {plan}')
+            self.session_len = self.config.session_len
+            return
+
+        # weights processing, comm splits, kv cache allocation & tuning of all the ranks run on native threads
+        ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
+        tick = time.perf_counter()
+        self.model_comm.create_engines(list(range(self.gpu_count)), ranks)
+        self._record_phase('create_engines', tick)
+
+        for name, path in (_engine_config.adapters or {}).items():
+            self.load_adapter(name, path)
+
+        self._record_phase('ready', start)
 
         self.session_len = self.config.session_len
 
+    def _record_phase(self, phase: str, start: float):
+        self._startup_phases[phase] = self._startup_phases.get(phase, 0.) + time.perf_counter() - start
+
     def _create_weight(self, model_comm):
         """Allocate weight buffer, load params if from_workspace."""
 
@@ -169,23 +201,19 @@ class TurboMind:
         torch.cuda.synchronize()
 
         # create weight
-        def _create_weight_func(device_id):
-            rank = self.node_id * self.gpu_count + device_id
-            model_comm.create_shared_weights(device_id, rank)
+        ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
+        model_comm.create_all_shared_weights(list(range(self.gpu_count)), ranks)
 
-        with ThreadPoolExecutor(max_workers=self.gpu_count) as executor:
-            futures = []
-            for device_id in range(self.gpu_count):
-                futures.append(executor.submit(_create_weight_func, device_id))
-            for future in futures:
-                future.result()
-
-    def _get_model_params(self, model_comm, tm_params: defaultdict):
-        """Get turbomind model params when loading from hf."""
+    def _get_model_params(self, model_comm, tm_params: defaultdict, update: bool = False):
+        """Get turbomind model params when loading from hf, or the params of
+        the weights to update."""
 
         def _get_params(device_id, que):
             rank = self.node_id * self.gpu_count + device_id
-            out = model_comm.get_params(device_id, rank)
+            if update:
+                out = model_comm.get_update_params(device_id, rank)
+            else:
+                out = model_comm.get_params(device_id, rank)
             que.put(out)
 
         que = Queue()
@@ -226,6 +254,59 @@ class TurboMind:
         logger.info(f'turbomind model config:\n\n'
                     f'{json.dumps(self.config_dict, indent=2)}')
 
+    def _weight_key(self, model_path: str, **extra):
+        """Key of the device weights of the model with the parallel
+        config."""
+        import hashlib
+        model_config = {k: v for k, v in self.config_dict['model_config'].items() if k != 'session_len'}
+        parallel = ('dtype', 'model_format', 'tp', 'pp', 'cp', 'device_num', 'attn_tp_size', 'attn_dp_size',
+                    'mlp_tp_size', 'mlp_dp_size', 'outer_dp_size', 'ep', 'fp8_linear', 'int8_linear', 'w8a16_linear',
+                    'sparse_linear', 'lm_head_quant', 'embedding_quant')
+        key = dict(model_path=osp.abspath(model_path),
+                   model_config=model_config,
+                   lora_config=self.config_dict.get('lora_config'),
+                   parallel={k: getattr(self.engine_config, k) for k in parallel},
+                   **extra)
+        return hashlib.sha1(json.dumps(key, sort_keys=True, default=str).encode()).hexdigest()
+
+    def _set_weight_share_key(self, model_path: str):
+        """Engines of the process with the same key share the device
+        weights."""
+        if not self.engine_config.share_weights:
+            return
+        self.config_dict['engine_config']['weight_share_key'] = self._weight_key(model_path)
+
+    def _set_weight_snapshot_key(self, model_path: str):
+        """The snapshots of the prepared weights are named by the key,
+        which includes the gpu arch the weights are converted for."""
+        if not self.engine_config.weight_snapshot:
+            return
+        os.makedirs(self.engine_config.weight_snapshot, exist_ok=True)
+        key = self._weight_key(model_path, arch=torch.cuda.get_device_capability())
+        self.config_dict['engine_config']['weight_snapshot'] = osp.abspath(self.engine_config.weight_snapshot)
+        self.config_dict['engine_config']['weight_snapshot_key'] = key
+
+    def _has_weight_snapshots(self):
+        """Whether the snapshots of all the ranks exist."""
+        engine_config = self.config_dict['engine_config']
+        if not engine_config.get('weight_snapshot_key'):
+            return False
+        prefix = osp.join(engine_config['weight_snapshot'], engine_config['weight_snapshot_key'])
+        ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
+        return all(osp.isfile(f'{prefix}.{rank}.tmw') for rank in ranks)
+
+    def _set_detokenizer_path(self, model_path: str):
+        """The `tokenizer.json` of the native detokenizer."""
+        if not self.engine_config.detokenizer_threads:
+            return
+        for path in [osp.join(model_path, 'tokenizer.json'),
+                     osp.join(model_path, 'triton_models', 'tokenizer', 'tokenizer.json')]:
+            if osp.exists(path):
+                self.config_dict['engine_config']['detokenizer_path'] = osp.abspath(path)
+                return
+        logger.warning(f'no tokenizer.json found in {model_path}, the native detokenizer is disabled')
+        self.config_dict['engine_config']['detokenizer_threads'] = 0
+
     def _from_hf(self, model_source: ModelSource, model_path: str, engine_config: TurbomindEngineConfig):
         """Load model which is in hf format."""
         assert model_source == ModelSource.HF_MODEL, \
@@ -235,9 +316,15 @@ class TurboMind:
 
         # convert transformers model into turbomind model
         from .deploy.converter import get_tm_model
+        tick = time.perf_counter()
         tm_model = get_tm_model(model_path, self.model_name, self.chat_template_name, engine_config)
+        self._record_phase('load_model', tick)
 
         self._postprocess_config(tm_model.tm_config, engine_config)
+        self._permute_qk = getattr(tm_model, 'permute_qk', True)
+        self._set_weight_share_key(model_path)
+        self._set_weight_snapshot_key(model_path)
+        self._set_detokenizer_path(model_path)
 
         model_comm = _tm.AbstractTransformerModel.create_llama_model(model_dir='',
                                                                      config=yaml.safe_dump(self.config_dict),
@@ -249,8 +336,17 @@ class TurboMind:
         # copy hf model weight to turbomind weight
         tm_params = tm_model.tm_params
         self._get_model_params(model_comm, tm_params)
+        if not tm_params and engine_config.share_weights:
+            logger.info('reuse the weights of a live engine')
+            return model_comm
+        if self._has_weight_snapshots():
+            logger.info('restore the prepared weights from the snapshots')
+            return model_comm
         logger.warning(f'get {len(tm_params)} model params')
+        tick = time.perf_counter()
+        # the checkpoint is read, converted & copied to the devices
         tm_model.export()
+        self._record_phase('export_weights', tick)
         # there should be no left turbomind params.
         if len(tm_params) > 0:
             uninitialized = list(tm_params.keys())
@@ -271,6 +367,9 @@ class TurboMind:
             f'tp size mismatch ({cfg.model_config.attn_tp_size} vs {engine_config.attn_tp_size})'
 
         self._postprocess_config(cfg, engine_config)
+        self._set_weight_share_key(model_path)
+        self._set_weight_snapshot_key(model_path)
+        self._set_detokenizer_path(model_path)
 
         weight_dir = osp.join(model_path, 'triton_models', 'weights')
         model_comm = _tm.AbstractTransformerModel.create_llama_model(model_dir=weight_dir,
@@ -322,6 +421,292 @@ class TurboMind:
         if self.model_comm is not None:
             self.model_comm = None
 
+    def get_expert_stats(self, reset: bool = False):
+        """Get the number of tokens routed to each expert of the MoE layers
+        on the devices of this node.
+
+        Args:
+            reset (bool): clear the counters after reading them
+        Returns:
+            List[List[int]]: the counts indexed by [layer][expert], the
+                lists of dense layers are empty
+        """
+        stats = []
+        for device_id in range(self.gpu_count):
+            counts = self.model_comm.get_expert_stats(device_id, reset)
+            rank = self.node_id * self.gpu_count + device_id
+            # without expert parallelism the ranks of a group route the
+            # same tokens
+            if self._ep == 1 and rank % self._comm_size != 0:
+                continue
+            if not stats:
+                stats = [list(x) for x in counts]
+                continue
+            for s, x in zip(stats, counts):
+                for i, c in enumerate(x):
+                    s[i] += c
+        return stats
+
+    def get_profile(self, reset: bool = False):
+        """Get the step timings sampled by the profiler of the devices of
+        this node, requires `profile_interval` > 0.
+
+        Args:
+            reset (bool): clear the histograms after reading them
+        Returns:
+            List[Dict[str, List[Dict]]]: for each device, the timings of
+                the phases 'step', 'attention', 'ffn', 'comm' & 'sampling'.
+                The layered phases have an entry per layer. An entry holds
+                the number of sampled steps, the mean & max time in us and
+                the counts of the log2 us buckets, i.e. `buckets[i]` counts
+                the steps in [2^i, 2^(i+1)) us
+        """
+        profiles = []
+        for device_id in range(self.gpu_count):
+            phases = self.model_comm.get_profile(device_id, reset)
+            profile = {}
+            for name, entries in zip(_PROFILE_PHASES, phases):
+                profile[name] = [
+                    dict(count=int(x[0]),
+                         mean_us=x[1] / x[0] if x[0] else 0.,
+                         max_us=x[2],
+                         buckets=[int(b) for b in x[3:]]) for x in entries
+                ]
+            profiles.append(profile)
+        return profiles
+
+    def plan_memory(self):
+        """Plan the device memory of the ranks from the engine parameters.
+        Before the engines are created (`dry_run`) the plan takes the memory
+        free now, after that the plan made when they were created is
+        returned.
+
+        Returns:
+            List[Dict[str, float]]: for each device, the 'free' memory with
+                the weights loaded, the 'layer_buffers' allocated before the
+                kv cache, the 'engine_buffers' & 'comm_buffers' allocated
+                after it (bytes), the 'block_size' (bytes), 'block_len' &
+                'block_count' of the kv cache, the 'kv_tokens' and full
+                'sessions' it holds, and the 'headroom' (bytes) left. The
+                suggestions are the largest `cache_max_entry_count`
+                ('max_ratio') leaving room for the unplanned allocations and
+                its blocks ('max_block_count'), also with half the
+                `max_prefill_token_num` or half the `max_batch_size`
+        """
+        plans = []
+        for device_id in range(self.gpu_count):
+            rank = self.node_id * self.gpu_count + device_id
+            plans.append(dict(self.model_comm.plan_memory(device_id, rank)))
+        return plans
+
+    def get_startup_phases(self):
+        """Get the time of the phases of the engine start.
+
+        Returns:
+            List[Dict[str, float]]: for each device, the seconds of the
+                phases of its rank in order, e.g. 'alloc_weights',
+                'process_weights', 'comm_setup', 'create_model', 'kv_cache',
+                'comm_buffers', 'gemm_tuning' and 'sync' (waiting for the
+                other ranks). They are followed by the phases run by this
+                process for all the devices ('load_model',
+                'export_weights', 'create_engines') and the time to ready
+                ('ready')
+        """
+        phases = []
+        for device_id in range(self.gpu_count):
+            p = dict(self.model_comm.get_startup_phases(device_id))
+            p.update(self._startup_phases)
+            phases.append(p)
+        return phases
+
+    def get_cache_stats(self):
+        """Get the kv cache counters of the devices of this node.
+
+        Returns:
+            List[Dict[str, int]]: for each device, the prompt tokens looked
+                up in the prefix cache ('prompt_tokens') and served by it
+                ('hit_tokens'), the evicted blocks and the cached prompt
+                blocks ('trie_nodes') since the start, and the current
+                'active_blocks', 'cached_blocks', 'free_blocks' & the
+                'pinned_blocks'. The ranks of a tensor parallel group report
+                the same counters
+        """
+        stats = []
+        for device_id in range(self.gpu_count):
+            values = self.model_comm.get_cache_stats(device_id)
+            stats.append(dict(zip(_CACHE_STATS, values)))
+        return stats
+
+    def warm_prefixes(self, prompts: List[List[int]], pin: bool = False, session_id: int = 1 << 62) -> List[bool]:
+        """Prefill the prompts and leave them in the prefix cache without
+        generating, e.g. the known system prompts of a cold replica before it
+        takes traffic. Requires `enable_prefix_caching`.
+
+        Args:
+            prompts (List[List[int]]): the token ids of the prompts
+            pin (bool): keep the cached blocks from eviction, within the
+                `cache_pin_tokens` of the engine
+            session_id (int): the session id of the first prompt, the
+                prompts take consecutive ids that must not be in use
+        Returns:
+            List[bool]: whether each prompt is cached
+        """
+        gen_config = GenerationConfig(max_new_tokens=0, warm=True, pin_prefix=pin)
+
+        async def _warm():
+            inst = self.create_instance()
+            ret = []
+            for i, input_ids in enumerate(prompts):
+                status = None
+                async for output in inst.async_stream_infer(session_id + i,
+                                                            input_ids,
+                                                            sequence_start=True,
+                                                            sequence_end=True,
+                                                            gen_config=gen_config):
+                    status = output.status
+                ret.append(status == ResponseType.FINISH)
+            return ret
+
+        return asyncio.run(_warm())
+
+    def get_metrics(self) -> str:
+        """Get the metrics of the engines in this process in the Prometheus
+        text format, e.g. the tokens & batch size per step, the request
+        queue depth, the cache block usage and the preemptions. Readable
+        while the engines are running.
+
+        Returns:
+            str: the exposition of the metrics, labeled by the DP rank
+        """
+        return self.model_comm.get_metrics()
+
+    def dump_trace(self, path: str = None, reset: bool = False) -> str:
+        """Dump the timeline of this process kept by the tracer, requires
+        `trace_buffer` > 0. The host ranges are on a track per thread, the
+        device phases of the steps sampled by `profile_interval` on the
+        'gpu' track of each device.
+
+        Args:
+            path (str): write the trace to this file when given
+            reset (bool): clear the spans after dumping them
+        Returns:
+            str: the Chrome trace (JSON), opened by Perfetto or
+                chrome://tracing
+        """
+        trace = self.model_comm.dump_trace(reset)
+        if path is not None:
+            with open(path, 'w') as f:
+                f.write(trace)
+        return trace
+
+    @property
+    def grammar_compiler(self):
+        """Compiler of the `response_format` of requests, requires
+        xgrammar."""
+        if self._grammar_compiler is None:
+            from .grammar import GrammarCompiler
+            self._grammar_compiler = GrammarCompiler(self.tokenizer, self.config.model_config.vocab_size)
+        return self._grammar_compiler
+
+    def load_adapter(self, name: str, path: str):
+        """Load a PEFT LoRA adapter, which is then used by the requests
+        with `adapter_name=name`. Loading an existing name replaces its
+        weights.
+
+        Args:
+            name (str): name of the adapter
+            path (str): local directory of the adapter
+        """
+        from .lora import load_lora_adapter
+        dtype = torch.bfloat16 if self.config.model_config.weight_type in ('bf16', 'bfloat16') else torch.float16
+        rank, weights = load_lora_adapter(path, self.config.model_config, self.gpu_count, dtype, self._permute_qk)
+        adapter_id = self._adapter_ids.setdefault(name, len(self._adapter_ids))
+        ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
+        with ThreadPoolExecutor(max_workers=self.gpu_count) as e:
+            for _ in e.map(self.model_comm.register_adapter, range(self.gpu_count), [adapter_id] * self.gpu_count,
+                           [rank] * self.gpu_count, [1.0] * self.gpu_count, [weights[r] for r in ranks]):
+                pass
+        logger.info(f'adapter {name} loaded from {path}, rank {rank}')
+
+    def unload_adapter(self, name: str):
+        """Unload an adapter, new requests using it are rejected."""
+        adapter_id = self._adapter_ids.pop(name)
+        for device_id in range(self.gpu_count):
+            self.model_comm.unregister_adapter(device_id, adapter_id)
+
+    def update_weights(self, model_path: str):
+        """Swap in the weights of another checkpoint of the same model (e.g.
+        a new fine-tune) without tearing down the engines. The new weights
+        are loaded next to the live ones, which needs the memory of a second
+        copy of the weights, and swapped in at a step boundary. The sessions
+        and their kv caches are kept, the prefix cache is flushed.
+
+        Args:
+            model_path (str): the huggingface model, a local directory or a
+                model id
+        """
+        assert not self._adapter_ids, 'unload the adapters before updating the weights'
+        if not osp.exists(model_path):
+            model_path = get_model(model_path, self.engine_config.download_dir, self.engine_config.revision)
+
+        from .deploy.converter import get_tm_model
+        tm_model = get_tm_model(model_path, self.model_name, self.chat_template_name, self.engine_config)
+
+        ranks = [self.node_id * self.gpu_count + device_id for device_id in range(self.gpu_count)]
+        with ThreadPoolExecutor(max_workers=self.gpu_count) as e:
+            for _ in e.map(self.model_comm.create_update_weights, range(self.gpu_count), ranks):
+                pass
+
+        tm_params = tm_model.tm_params
+        self._get_model_params(self.model_comm, tm_params, update=True)
+        tm_model.export()
+        if len(tm_params) > 0:
+            uninitialized = list(tm_params.keys())
+            logger.warning(f'{len(tm_params)} params are not updated:\n{uninitialized}')
+
+        with ThreadPoolExecutor(max_workers=self.gpu_count) as e:
+            # the engines swap at the same step, the calls block until all the ranks have their weights
+            for _ in e.map(self.model_comm.commit_update_weights, range(self.gpu_count), ranks):
+                pass
+        logger.info(f'weights updated from {model_path}')
+
+    def create_kv_transport_ids(self):
+        """Create the ids of a kv transport between engines, one for each
+        device of the engine. The ids are shared with the other engines out
+        of band and passed to `connect_kv_transport` by all of them."""
+        return [self.model_comm.create_kv_transport_id() for _ in range(self.gpu_count)]
+
+    def connect_kv_transport(self, ids: List[bytes], n_ranks: int, rank: int):
+        """Join the kv transport for moving the kv cache of sessions between
+        engines, e.g. from prefill engines to decode engines. Blocks until all
+        `n_ranks` engines have joined.
+
+        Args:
+            ids (List[bytes]): ids from `create_kv_transport_ids`
+            n_ranks (int): number of engines in the transport
+            rank (int): rank of this engine in the transport
+        """
+        assert len(ids) == self.gpu_count, 'kv transport requires the engines to have the same device number'
+        with ThreadPoolExecutor(max_workers=self.gpu_count) as e:
+            for _ in e.map(self.model_comm.connect_kv_transport, range(self.gpu_count), ids,
+                           [n_ranks] * self.gpu_count, [rank] * self.gpu_count):
+                pass
+
+    def get_dispatcher(self):
+        """The completion dispatcher of the running event loop, None without
+        `batch_submission`."""
+        if not self.engine_config.batch_submission:
+            return None
+        loop = asyncio.get_running_loop()
+        if self._dispatcher is None or self._dispatcher.loop is not loop:
+            queue = _tm.CompletionQueue()
+            if queue.fd() < 0:
+                logger.warning('eventfd is not available, `batch_submission` is disabled')
+                self.engine_config.batch_submission = False
+                return None
+            self._dispatcher = CompletionDispatcher(queue)
+        return self._dispatcher
+
     def create_instance(self, cuda_stream_id=0):
         """Create a turbomind instance.
 
@@ -351,6 +736,38 @@ def _get_last_hidden_state(outputs, offset: int):
     return _func
 
 
+def _get_text(outputs):
+    output_text = outputs['output_text']
+    text_length = outputs['text_length']
+    offset = 0
+
+    def _func(out: EngineOutput, step: int):
+        nonlocal offset
+        length = text_length.item()
+        out.text = bytes(output_text[offset:length].tolist()).decode('utf-8', errors='replace')
+        offset = length
+
+    return _func
+
+
+def _get_prompt_logprobs(outputs):
+    prompt_logprobs = outputs['prompt_logprobs']
+
+    def _func(out: EngineOutput, step: int):
+        out.prompt_logprobs = prompt_logprobs
+
+    return _func
+
+
+def _get_pooled_hidden_state(outputs):
+    pooled_hidden_state = outputs['pooled_hidden_state']
+
+    def _func(out: EngineOutput, step: int):
+        out.pooled_hidden_state = pooled_hidden_state
+
+    return _func
+
+
 def _get_logprobs_impl(logprob_vals: torch.Tensor,
                        logprob_idxs: torch.Tensor,
                        logprob_nums: torch.Tensor,
@@ -415,6 +832,54 @@ class StreamingSemaphore:
                 self.fut.set_result(None)
 
 
+class CompletionDispatcher:
+    """Submits the requests of an event loop iteration in one native call and
+    wakes their streams from the native completion queue, the loop wakes up
+    once per batch of state updates instead of once per update."""
+
+    def __init__(self, queue):
+        self.loop = asyncio.get_running_loop()
+        self.queue = queue
+        self.sems: Dict[int, StreamingSemaphore] = {}
+        self.pending = []
+        self.next_tag = 0
+        self.loop.add_reader(queue.fd(), self._drain)
+
+    def _drain(self):
+        for tag in self.queue.drain():
+            sem = self.sems.get(tag)
+            if sem is not None:
+                sem.release()
+
+    def _flush(self):
+        pending, self.pending = self.pending, []
+        args = [list(x) for x in zip(*[p[:-1] for p in pending])]
+        try:
+            rets = _tm.forward_batch(*args, self.queue)
+        except Exception as e:
+            for p in pending:
+                p[-1].set_exception(e)
+            return
+        for p, ret in zip(pending, rets):
+            p[-1].set_result(ret)
+
+    def submit(self, model_inst, inputs, session, gen_cfg, stream_output, output_tensors):
+        """Returns the tag & semaphore of the request and the future of
+        (outputs, state)."""
+        tag = self.next_tag
+        self.next_tag += 1
+        sem = StreamingSemaphore()
+        self.sems[tag] = sem
+        fut = self.loop.create_future()
+        if not self.pending:
+            self.loop.call_soon(self._flush)
+        self.pending.append((model_inst, inputs, session, gen_cfg, stream_output, output_tensors, tag, fut))
+        return tag, sem, fut
+
+    def release(self, tag):
+        self.sems.pop(tag, None)
+
+
 class TurboMindInstance:
     """Instance of TurboMind.
 
@@ -457,6 +922,12 @@ class TurboMindInstance:
             fs.append(_get_last_hidden_state(outputs, offset))
         if gen_config.logprobs:
             fs.append(_get_logprobs(outputs, gen_config.logprobs))
+        if gen_config.score:
+            fs.append(_get_prompt_logprobs(outputs))
+        if gen_config.pooling:
+            fs.append(_get_pooled_hidden_state(outputs))
+        if 'output_text' in outputs:
+            fs.append(_get_text(outputs))
         return fs
 
     def prepare_embeddings(self, input_embeddings=None, input_embedding_ranges=None):
@@ -479,6 +950,14 @@ class TurboMindInstance:
                 break
         assert hidden_dim is not None
 
+        # embeddings all on the same gpu (e.g. from a vision encoder, also
+        # the ones shared through `torch.multiprocessing`) stay there, the
+        # engine copies them device to device
+        devices = set(x.device for item in input_embeddings for x in (item or []) if isinstance(x, torch.Tensor))
+        device = devices.pop() if len(devices) == 1 else torch.device('cpu')
+        if device.type != 'cuda':
+            device = torch.device('cpu')
+
         # construct input_embeddings
         for i in range(len(input_embeddings)):
             item = input_embeddings[i] or []
@@ -488,8 +967,8 @@ class TurboMindInstance:
             # convert to lookup table type
             _MAP = dict(float=torch.float, bfloat16=torch.bfloat16, float16=torch.float16)
             dtype = _MAP.get(self.tm_model.config.weight_type, torch.float16)
-            item = [x.to(dtype=dtype) for x in item]
-            item = item or [torch.zeros(0, hidden_dim, dtype=dtype)]
+            item = [x.to(device=device, dtype=dtype) for x in item]
+            item = item or [torch.zeros(0, hidden_dim, dtype=dtype, device=device)]
             input_embeddings[i] = item
         input_embeddings = [torch.cat(x) for x in input_embeddings]
         input_embeddings = pad_sequence(input_embeddings, batch_first=True)
@@ -507,7 +986,8 @@ class TurboMindInstance:
                        input_ids,
                        gen_config: GenerationConfig,
                        input_embeddings=None,
-                       input_embedding_ranges=None):
+                       input_embedding_ranges=None,
+                       input_embedding_hashes=None):
         """Convert inputs format."""
         assert isinstance(input_ids, Sequence)
 
@@ -518,9 +998,20 @@ class TurboMindInstance:
 
         input_embeddings, input_embedding_ranges = self.prepare_embeddings(input_embeddings, input_embedding_ranges)
         if input_embeddings is not None:
-            inputs['input_embeddings'] = input_embeddings.cpu()
+            if input_embeddings.is_cuda:
+                # the engine reads them on its own stream
+                torch.cuda.current_stream(input_embeddings.device).synchronize()
+            inputs['input_embeddings'] = input_embeddings
             inputs['input_embedding_ranges'] = input_embedding_ranges
 
+        if input_embedding_hashes is not None:
+            # content hashes of the embeddings, as int64
+            hashes = [h - (1 << 64) if h >= (1 << 63) else h for h in input_embedding_hashes]
+            inputs['input_embedding_hashes'] = torch.tensor(hashes, dtype=torch.int64).reshape(1, -1)
+            if input_embeddings is None:
+                # passed by reference, the embeddings must be in the embedding cache of the engine
+                inputs['input_embedding_ranges'] = torch.IntTensor(input_embedding_ranges).reshape(1, -1, 2)
+
         return inputs, input_len
 
     async def async_cancel(self, session_id: int = None):
@@ -536,6 +1027,87 @@ class TurboMindInstance:
         self.model_inst.end(partial(self.async_end_cb, fut), session_id)
         await fut
 
+    async def async_export_kv(self, session_id: int, peer: int, release: bool = True, layer_major: bool = False):
+        """Send the kv cache of an ongoing session to engine `peer` of the kv
+        transport, the peer must import it concurrently. Sessions are
+        exported and imported in the same order between a pair of engines.
+        With `layer_major` the blocks were already sent by the prefill of a
+        session started with `kv_stream_to`, only the metadata is returned.
+        The peer may then import ahead of the prefill with the metadata
+        known up front (tokens, cache_len, block_size, layer_major=True).
+
+        Returns:
+            Tuple[int, KvTransfer]: the status and the metadata of the session
+                to be handed over to `async_import_kv` of the peer
+        """
+        fut = asyncio.get_running_loop().create_future()
+        transfer = _tm.KvTransfer(_tm.KvTransfer.EXPORT, peer, release)
+        transfer.layer_major = layer_major
+        self.model_inst.transfer(transfer, partial(self.async_end_cb, fut), session_id)
+        status = await fut
+        return status, transfer
+
+    async def async_import_kv(self, session_id: int, transfer, peer: int):
+        """Receive the kv cache of a session exported by engine `peer`, the
+        session can be continued with `sequence_start=False` afterwards.
+
+        Args:
+            transfer (KvTransfer): metadata returned by `async_export_kv`
+        """
+        fut = asyncio.get_running_loop().create_future()
+        transfer.op = _tm.KvTransfer.IMPORT
+        transfer.peer = peer
+        self.model_inst.transfer(transfer, partial(self.async_end_cb, fut), session_id)
+        return await fut
+
+    async def async_save_kv(self, session_id: int, path: str, release: bool = True):
+        """Save the kv cache of an ongoing session to file `path`, so that
+        it can be restored by `async_load_kv` later or by another engine with
+        the same model & cache config, without prefilling the history again.
+
+        Returns:
+            int: the status of the export
+        """
+        fut = asyncio.get_running_loop().create_future()
+        transfer = _tm.KvTransfer(_tm.KvTransfer.EXPORT, -1, release)
+        transfer.host_blocks = []
+        self.model_inst.transfer(transfer, partial(self.async_end_cb, fut), session_id)
+        status = await fut
+        if status == 0:
+            state = dict(tokens=list(transfer.tokens),
+                         random_state=transfer.random_state,
+                         rope_theta=transfer.rope_theta,
+                         cache_len=transfer.cache_len,
+                         block_size=transfer.block_size,
+                         host_blocks=transfer.host_blocks)
+
+            def _dump():
+                with open(path, 'wb') as f:
+                    pickle.dump(state, f)
+
+            await asyncio.get_running_loop().run_in_executor(None, _dump)
+        return status
+
+    async def async_load_kv(self, session_id: int, path: str):
+        """Restore the kv cache of a session saved by `async_save_kv`, the
+        session can be continued with `sequence_start=False` afterwards.
+
+        Returns:
+            int: the status of the import
+        """
+
+        def _load():
+            with open(path, 'rb') as f:
+                return pickle.load(f)
+
+        state = await asyncio.get_running_loop().run_in_executor(None, _load)
+        transfer = _tm.KvTransfer(_tm.KvTransfer.IMPORT, -1)
+        for k, v in state.items():
+            setattr(transfer, k, v)
+        fut = asyncio.get_running_loop().create_future()
+        self.model_inst.transfer(transfer, partial(self.async_end_cb, fut), session_id)
+        return await fut
+
     def async_signal_cb(self, s: StreamingSemaphore):
         """executing on engine's signaling thread."""
         s.loop.call_soon_threadsafe(s.release)
@@ -565,24 +1137,76 @@ class TurboMindInstance:
             stop (bool): indicator for cancelling the session
             gen_config (GenerationConfig): generation config
             stream_output (bool): indicator for stream output
-            kwargs (dict): kwargs for backward compatibility
+            kwargs (dict): kwargs for backward compatibility. `fork_from`
+              starts the session as a fork of a cached session, sharing its
+              tokens and kv cache, with `step` the number of tokens kept,
+              e.g. n completions of a prompt prefilled once.
+              `output_tensors` maps output names (e.g. `output_ids`, `logits`)
+              to caller-owned tensors the engine writes to directly.
+              `input_embedding_hashes` gives the content hash of each input
+              embedding, which keys the embedding cache and the prefix cache.
+              The embeddings may then be omitted once they are cached.
+              `deadline` is the latest `time.monotonic()` at which a new
+              session may start, it is dropped when still queued by then.
+              `kv_stream_to` sends the kv cache of the prompt to engine
+              `kv_stream_to` of the kv transport layer by layer as the
+              prefill writes it, see `async_export_kv(layer_major=True)`
         """
         logger.info(f'[async_stream_infer] session {session_id} start')
-        gen_cfg = self._get_generation_config(gen_config)
+        try:
+            gen_cfg = self._get_generation_config(gen_config)
+        except Exception as e:
+            logger.error(f'[async_stream_infer] session {session_id} {e}')
+            yield self._get_error_output()
+            return
+        # the python part of the matcher must outlive the request
+        matcher = gen_cfg.matcher  # noqa: F841
+
+        adapter_name = kwargs.get('adapter_name')
+        if adapter_name is not None:
+            if adapter_name not in self.tm_model._adapter_ids:
+                logger.error(f'[async_stream_infer] session {session_id} unknown adapter {adapter_name}')
+                yield self._get_error_output()
+                return
+            gen_cfg.adapter_id = self.tm_model._adapter_ids[adapter_name]
 
         inputs, input_len = self.prepare_inputs(input_ids=input_ids,
                                                 input_embeddings=input_embeddings,
                                                 input_embedding_ranges=input_embedding_ranges,
+                                                input_embedding_hashes=kwargs.get('input_embedding_hashes'),
                                                 gen_config=gen_config)
 
         session = _tm.SessionParam(id=session_id, step=step, start=sequence_start, end=sequence_end)
+        fork_from = kwargs.get('fork_from')
+        if fork_from is not None:
+            assert sequence_start, 'a fork starts a new session'
+            session.fork = True
+            session.parent_id = fork_from
+        deadline = kwargs.get('deadline')
+        if deadline is not None:
+            # the clock of the engine is the monotonic clock in microseconds
+            session.deadline = int(deadline * 1e6)
+        kv_stream_to = kwargs.get('kv_stream_to')
+        if kv_stream_to is not None:
+            session.kv_stream = True
+            session.kv_stream_peer = kv_stream_to
 
         inputs = _np_dict_to_tm_dict(inputs)
 
-        sem = StreamingSemaphore()
-        signal_cb = partial(self.async_signal_cb, sem)
+        output_tensors = kwargs.get('output_tensors')
+        if output_tensors is not None:
+            output_tensors = _np_dict_to_tm_dict(output_tensors)
 
-        outputs, shared_state = self.model_inst.forward(inputs, session, gen_cfg, stream_output, signal_cb)
+        dispatcher = self.tm_model.get_dispatcher()
+        if dispatcher is None:
+            sem = StreamingSemaphore()
+            signal_cb = partial(self.async_signal_cb, sem)
+            outputs, shared_state = self.model_inst.forward(inputs, session, gen_cfg, stream_output, signal_cb,
+                                                            output_tensors)
+        else:
+            tag, sem, fut = dispatcher.submit(self.model_inst, inputs, session, gen_cfg, stream_output,
+                                              output_tensors)
+            outputs, shared_state = await fut
 
         outputs = _tm_dict_to_torch_dict(outputs)
 
@@ -605,6 +1229,10 @@ class TurboMindInstance:
 
                 if status in [7, 8]:  # finish / canceled
                     finish, status = True, 0
+                elif status == 9:  # overload
+                    logger.warning(f'[async_stream_infer] session {session_id} dropped by the full request queue')
+                    yield self._get_error_output()
+                    break
                 elif status:
                     yield self._get_error_output()
                     break
@@ -616,6 +1244,10 @@ class TurboMindInstance:
                 output_len += seq_len - prev_len
                 status = ResponseType.FINISH if finish else ResponseType.SUCCESS  # noqa
                 output = EngineOutput(status, output_ids, output_len)
+                if state.cached_len >= 0:
+                    output.cached_tokens = state.cached_len
+                if finish:
+                    output.req_metrics = state.metrics
 
                 for f in extra_fs:
                     f(output, seq_len)
@@ -640,6 +1272,8 @@ class TurboMindInstance:
             while not state or state.status == 0:
                 await sem.acquire()
                 state = shared_state.consume()
+            if dispatcher is not None:
+                dispatcher.release(tag)
             logger.info(f'[async_stream_infer] session {session_id} done')
 
     def _get_error_output(self):
@@ -659,6 +1293,8 @@ class TurboMindInstance:
         if not cfg.ignore_eos and cfg.stop_token_ids:
             c.stop_ids = _construct_stop_or_bad_words(cfg.stop_token_ids)
         c.repetition_penalty = cfg.repetition_penalty
+        c.frequency_penalty = cfg.frequency_penalty
+        c.presence_penalty = cfg.presence_penalty
         if cfg.min_new_tokens:
             c.min_new_tokens = cfg.min_new_tokens
         output_type = dict(all=1, generation=2)
@@ -666,6 +1302,13 @@ class TurboMindInstance:
             c.output_last_hidden_state = output_type[cfg.output_last_hidden_state]
         if cfg.output_logits:
             c.output_logits = output_type[cfg.output_logits]
+        c.score = cfg.score
+        if cfg.pooling:
+            c.pooling = dict(last=1, mean=2, cls=3)[cfg.pooling]
+            c.normalize = cfg.normalize
+        c.warm = cfg.warm
+        c.pin_prefix = cfg.pin_prefix
+        c.output_text = self.tm_model.engine_config.detokenizer_threads > 0
         if cfg.logprobs:
             if cfg.logprobs > MAX_LOGPROBS:
                 cfg.logprobs = MAX_LOGPROBS
@@ -674,5 +1317,13 @@ class TurboMindInstance:
             c.output_logprobs = cfg.logprobs
         if cfg.random_seed is not None:
             c.random_seed = cfg.random_seed
+        c.priority = cfg.priority
+        c.tenant_id = cfg.tenant_id
+        c.tenant_weight = cfg.tenant_weight
+        c.expected_output_len = cfg.expected_output_len
+        c.beam_width = cfg.beam_width
+        c.length_penalty = cfg.length_penalty
+        if cfg.response_format:
+            c.matcher = self.tm_model.grammar_compiler.create_matcher(cfg.response_format)
         # print (c)
         return c
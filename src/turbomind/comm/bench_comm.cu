@@ -0,0 +1,556 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Sweeps the message sizes of the collectives over the device communicators and reports the bandwidths the same way
+// as nccl-tests, for picking the backend and the thresholds of the kernel variants per platform. e.g.
+//   bench_comm --backends nccl,cuda-ipc --variants all --ops allreduce,rmsnorm --max-bytes 64M --output comm.json
+//
+// The variants of `cuda-ipc` are forced by the `TM_COMM_*_MAX_BYTES` limits and the ones of `nccl` by `NCCL_PROTO`,
+// messages beyond the capacity of a variant (256KB for NVLS, 1MB for LL, 8MB for push) fall through to the next one.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/comm/device_comm.h"
+#include "src/turbomind/comm/host_comm.h"
+#include "src/turbomind/utils/Tensor.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+using namespace turbomind;
+using namespace turbomind::comm;
+
+namespace {
+
+struct Options {
+    std::vector<std::string> backends{"cuda-ipc"};
+    std::vector<std::string> variants{"auto"};
+    std::vector<std::string> ops{"allreduce", "allgather", "rmsnorm"};
+
+    std::string dtype = "half";
+    std::string output;
+
+    int    devices   = -1;
+    size_t min_bytes = 1 << 10;
+    size_t max_bytes = 64 << 20;
+    int    factor    = 2;
+    int    dim       = 8192;  // hidden dim of `rmsnorm`
+    int    warmup    = 5;
+    int    iters     = 20;
+    bool   check     = false;
+};
+
+struct Result {
+    std::string backend;
+    std::string variant;
+    std::string op;
+
+    size_t bytes;
+    size_t count;
+    float  time;  // us
+    float  algbw;
+    float  busbw;
+    long   errors;  // -1 when not checked
+};
+
+// Environment of the variants, `nullptr` unsets the variable
+using Env = std::vector<std::pair<const char*, const char*>>;
+
+const std::map<std::string, std::map<std::string, Env>>& Variants()
+{
+    constexpr const char* kNvls = "TM_COMM_NVLS_MAX_BYTES";
+    constexpr const char* kLL   = "TM_COMM_LL_MAX_BYTES";
+    constexpr const char* kPush = "TM_COMM_PUSH_MAX_BYTES";
+
+    constexpr const char* kMax = "18446744073709551615";
+
+    static const std::map<std::string, std::map<std::string, Env>> variants{
+        {"cuda-ipc",
+         {{"auto", {{kNvls, nullptr}, {kLL, nullptr}, {kPush, nullptr}}},
+          {"nvls", {{kNvls, nullptr}, {kLL, "0"}, {kPush, "0"}}},
+          {"ll", {{kNvls, "0"}, {kLL, kMax}, {kPush, "0"}}},
+          {"push", {{kNvls, "0"}, {kLL, "0"}, {kPush, kMax}}},
+          {"pull", {{kNvls, "0"}, {kLL, "0"}, {kPush, "0"}}}}},
+        {"nccl",
+         {{"auto", {{"NCCL_PROTO", nullptr}}},
+          {"ll", {{"NCCL_PROTO", "LL"}}},
+          {"ll128", {{"NCCL_PROTO", "LL128"}}},
+          {"simple", {{"NCCL_PROTO", "Simple"}}}}},
+        {"hier", {{"auto", {}}}},
+    };
+
+    return variants;
+}
+
+// Scaling of the algorithm bandwidths to the bus bandwidths, same as nccl-tests
+float BusFactor(const std::string& op, int n_ranks)
+{
+    if (op == "allgather") {
+        return (n_ranks - 1) / (float)n_ranks;
+    }
+    return 2.f * (n_ranks - 1) / n_ranks;
+}
+
+template<class T>
+T Pattern(size_t i, int rank)
+{
+    return T((float)((i + rank) % 8));
+}
+
+class Bench {
+public:
+    Bench(const Options& opts, const std::string& backend, const std::string& variant, int n_ranks):
+        opts_{opts}, backend_{backend}, variant_{variant}, n_ranks_{n_ranks}
+    {
+    }
+
+    std::vector<Result> Run()
+    {
+        auto group_id = CreateHostGroupId({});
+        group_id->Initialize();
+        std::stringstream ss;
+        group_id->Export(ss);
+        const std::string group_id_data = ss.str();
+
+        std::vector<std::thread> threads;
+        for (int rank = 0; rank < n_ranks_; ++rank) {
+            threads.emplace_back([&, rank] {
+                if (opts_.dtype == "float") {
+                    RunRank<float>(rank, group_id_data);
+                }
+                else {
+                    RunRank<half>(rank, group_id_data);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        return std::move(results_);
+    }
+
+private:
+    template<class T>
+    void RunRank(int rank, const std::string& group_id_data)
+    {
+        check_cuda_error(cudaSetDevice(rank));
+
+        std::stringstream ss(group_id_data);
+        auto              host_id = CreateHostGroupId({});
+        host_id->Import(ss);
+        HostComm h_comm = host_id->CreateCommunicator(n_ranks_, rank);
+
+        DeviceComm d_comm = CreateDeviceCommunicator(backend_, n_ranks_, rank, h_comm);
+
+        const auto dtype = getTensorType<T>();
+
+        cudaStream_t stream{};
+        cudaEvent_t  ev_start{}, ev_end{};
+        check_cuda_error(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreate(&ev_start));
+        check_cuda_error(cudaEventCreate(&ev_end));
+
+        const size_t max_bytes = opts_.max_bytes;
+
+        void* buf = d_comm->Allocate(max_bytes);
+        d_comm->Register(buf, max_bytes);
+
+        T* residual{};
+        T* weights{};
+        check_cuda_error(cudaMalloc(&residual, max_bytes));
+        check_cuda_error(cudaMalloc(&weights, sizeof(T) * opts_.dim));
+        check_cuda_error(cudaMemset(residual, 0, max_bytes));
+        check_cuda_error(cudaMemset(weights, 0, sizeof(T) * opts_.dim));
+
+        // element counts are kept in whole vectors of 16 bytes
+        constexpr size_t kVec = 16 / sizeof(T);
+
+        for (const auto& op : opts_.ops) {
+            if (op == "allgather" && variant_ != "auto") {
+                continue;  // the variants are of the allreduce kernels
+            }
+
+            size_t last_count = 0;
+
+            for (size_t bytes = opts_.min_bytes; bytes <= max_bytes; bytes *= opts_.factor) {
+                size_t count{};  // elements of the message
+                if (op == "allgather") {
+                    count = bytes / sizeof(T) / n_ranks_ / kVec * kVec * n_ranks_;
+                }
+                else if (op == "rmsnorm") {
+                    count = bytes / sizeof(T) / opts_.dim * opts_.dim;
+                }
+                else {
+                    count = bytes / sizeof(T) / kVec * kVec;
+                }
+                if (count == 0 || count == last_count) {
+                    continue;
+                }
+                last_count = count;
+
+                auto launch = [&] {
+                    if (op == "allreduce") {
+                        d_comm->AllReduceSum(buf, buf, count, dtype, 0, stream);
+                    }
+                    else if (op == "allgather") {
+                        const size_t sendcount = count / n_ranks_;
+                        d_comm->AllGather((T*)buf + rank * sendcount, buf, sendcount, dtype, 0, stream);
+                    }
+                    else {
+                        d_comm->AllreduceResidualBiasRMSnorm(
+                            buf, residual, nullptr, weights, 1e-5f, opts_.dim, count / opts_.dim, dtype, 0, stream);
+                    }
+                };
+
+                long errors = -1;
+                try {
+                    if (opts_.check && op != "rmsnorm") {
+                        errors = Check<T>(op, launch, buf, count, rank, stream);
+                        errors = Sum(h_comm, errors);
+                    }
+                    // zeros stay finite over the iterations of the in-place reductions
+                    check_cuda_error(cudaMemsetAsync(buf, 0, sizeof(T) * count, stream));
+                    for (int i = 0; i < opts_.warmup; ++i) {
+                        launch();
+                    }
+                }
+                catch (const std::runtime_error& e) {
+                    if (rank == 0) {
+                        std::cerr << "[" << backend_ << "] " << op << ": " << e.what() << ", skipped\n";
+                    }
+                    break;
+                }
+                check_cuda_error(cudaStreamSynchronize(stream));
+                h_comm->Sync();
+
+                check_cuda_error(cudaEventRecord(ev_start, stream));
+                for (int i = 0; i < opts_.iters; ++i) {
+                    launch();
+                }
+                check_cuda_error(cudaEventRecord(ev_end, stream));
+                check_cuda_error(cudaEventSynchronize(ev_end));
+
+                float ms{};
+                check_cuda_error(cudaEventElapsedTime(&ms, ev_start, ev_end));
+
+                // the slowest rank bounds the collective
+                const auto times = comm::AllGather(h_comm, ms / opts_.iters);
+
+                if (rank == 0) {
+                    const float  sec   = *std::max_element(times.begin(), times.end()) * 1e-3f;
+                    const size_t size  = sizeof(T) * count;
+                    const float  algbw = size / sec / 1e9f;
+                    results_.push_back({backend_,
+                                        variant_,
+                                        op,
+                                        size,
+                                        count,
+                                        sec * 1e6f,
+                                        algbw,
+                                        algbw * BusFactor(op, n_ranks_),
+                                        errors});
+                }
+            }
+        }
+
+        check_cuda_error(cudaStreamSynchronize(stream));
+        h_comm->Sync();
+
+        check_cuda_error(cudaFree(weights));
+        check_cuda_error(cudaFree(residual));
+        d_comm->Deregister(buf);
+        d_comm->Free(buf);
+
+        check_cuda_error(cudaEventDestroy(ev_end));
+        check_cuda_error(cudaEventDestroy(ev_start));
+        check_cuda_error(cudaStreamDestroy(stream));
+
+        h_comm->Sync();
+    }
+
+    // Number of mismatched elements of a single launch on the pattern of the ranks
+    template<class T, class F>
+    long Check(const std::string& op, F& launch, void* buf, size_t count, int rank, cudaStream_t stream)
+    {
+        std::vector<T> data(count);
+        if (op == "allgather") {
+            const size_t sendcount = count / n_ranks_;
+            for (size_t i = 0; i < sendcount; ++i) {
+                data[rank * sendcount + i] = Pattern<T>(i, rank);
+            }
+        }
+        else {
+            for (size_t i = 0; i < count; ++i) {
+                data[i] = Pattern<T>(i, rank);
+            }
+        }
+        check_cuda_error(cudaMemcpyAsync(buf, data.data(), sizeof(T) * count, cudaMemcpyDefault, stream));
+        launch();
+        check_cuda_error(cudaMemcpyAsync(data.data(), buf, sizeof(T) * count, cudaMemcpyDefault, stream));
+        check_cuda_error(cudaStreamSynchronize(stream));
+
+        long errors = 0;
+        for (size_t i = 0; i < count; ++i) {
+            float ref = 0;
+            if (op == "allgather") {
+                const size_t sendcount = count / n_ranks_;
+                ref                    = (float)Pattern<T>(i % sendcount, i / sendcount);
+            }
+            else {
+                for (int r = 0; r < n_ranks_; ++r) {
+                    ref += (float)Pattern<T>(i, r);
+                }
+            }
+            errors += (float)data[i] != ref;
+        }
+        return errors;
+    }
+
+    static long Sum(HostComm& h_comm, long value)
+    {
+        const auto xs = comm::AllGather(h_comm, value);
+        long       s  = 0;
+        for (const auto& x : xs) {
+            s += x;
+        }
+        return s;
+    }
+
+    const Options&    opts_;
+    const std::string backend_;
+    const std::string variant_;
+    const int         n_ranks_;
+
+    std::vector<Result> results_;  // of rank 0
+};
+
+void Print(const std::vector<Result>& results)
+{
+    std::string key;
+    for (const auto& r : results) {
+        if (auto k = r.backend + " | " + r.variant + " | " + r.op; k != key) {
+            key = k;
+            printf("\n[%s]\n", key.c_str());
+            printf("%14s%14s%14s%14s%14s%10s\n", "size", "count", "time", "algbw", "busbw", "#wrong");
+            printf("%14s%14s%14s%14s%14s%10s\n", "(B)", "(elements)", "(us)", "(GB/s)", "(GB/s)", "");
+        }
+        printf("%14lu%14lu%14.2f%14.2f%14.2f", r.bytes, r.count, r.time, r.algbw, r.busbw);
+        if (r.errors >= 0) {
+            printf("%10ld\n", r.errors);
+        }
+        else {
+            printf("%10s\n", "N/A");
+        }
+    }
+
+    // fastest backend & variant per op and size, where the thresholds are read from
+    std::map<std::pair<std::string, size_t>, const Result*> best;
+    for (const auto& r : results) {
+        auto& b = best[{r.op, r.bytes}];
+        if (!b || r.time < b->time) {
+            b = &r;
+        }
+    }
+    printf("\n[best]\n");
+    printf("%-12s%14s%14s%14s  %s\n", "op", "size", "time", "busbw", "backend | variant");
+    for (const auto& [k, r] : best) {
+        printf("%-12s%14lu%14.2f%14.2f  %s | %s\n",
+               k.first.c_str(),
+               k.second,
+               r->time,
+               r->busbw,
+               r->backend.c_str(),
+               r->variant.c_str());
+    }
+}
+
+void WriteJson(std::ostream& os, const Options& opts, int n_ranks, const std::vector<Result>& results)
+{
+    os << "{\n";
+    os << "  \"n_ranks\": " << n_ranks << ",\n";
+    os << "  \"dtype\": \"" << opts.dtype << "\",\n";
+    os << "  \"dim\": " << opts.dim << ",\n";
+    os << "  \"warmup\": " << opts.warmup << ",\n";
+    os << "  \"iters\": " << opts.iters << ",\n";
+    os << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        os << (i ? ",\n" : "\n") << "    {\"backend\": \"" << r.backend << "\", \"variant\": \"" << r.variant
+           << "\", \"op\": \"" << r.op << "\", \"bytes\": " << r.bytes << ", \"count\": " << r.count
+           << ", \"time_us\": " << r.time << ", \"algbw\": " << r.algbw << ", \"busbw\": " << r.busbw
+           << ", \"errors\": " << r.errors << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+// Sizes with K/M/G suffixes
+size_t ParseBytes(const std::string& str)
+{
+    size_t pos{};
+    double value = std::stod(str, &pos);
+    if (pos < str.size()) {
+        switch (str[pos]) {
+            case 'G':
+                value *= 1024;
+                [[fallthrough]];
+            case 'M':
+                value *= 1024;
+                [[fallthrough]];
+            case 'K':
+                value *= 1024;
+                break;
+            default:
+                throw std::invalid_argument("invalid size " + str);
+        }
+    }
+    return (size_t)value;
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: bench_comm [options]\n"
+                 "  --backends LIST     nccl | cuda-ipc | hier, comma separated (cuda-ipc)\n"
+                 "  --variants LIST     all, or of cuda-ipc: auto | nvls | ll | push | pull,\n"
+                 "                      of nccl: auto | ll | ll128 | simple (auto)\n"
+                 "  --ops LIST          allreduce | allgather | rmsnorm (all of them)\n"
+                 "  --dtype T           half | float (half)\n"
+                 "  --devices N         number of ranks (all the devices)\n"
+                 "  --min-bytes SIZE    (1K)\n"
+                 "  --max-bytes SIZE    (64M)\n"
+                 "  --factor N          multiplication factor between sizes (2)\n"
+                 "  --dim N             hidden dim of rmsnorm (8192)\n"
+                 "  --warmup N          (5)\n"
+                 "  --iters N           (20)\n"
+                 "  --check 0|1         verify the results of allreduce & allgather (0)\n"
+                 "  --output FILE       write the results as JSON\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--backends") {
+            opts.backends = ParseList(value);
+        }
+        else if (key == "--variants") {
+            opts.variants = ParseList(value);
+        }
+        else if (key == "--ops") {
+            opts.ops = ParseList(value);
+        }
+        else if (key == "--dtype") {
+            opts.dtype = value;
+        }
+        else if (key == "--devices") {
+            opts.devices = std::stoi(value);
+        }
+        else if (key == "--min-bytes") {
+            opts.min_bytes = ParseBytes(value);
+        }
+        else if (key == "--max-bytes") {
+            opts.max_bytes = ParseBytes(value);
+        }
+        else if (key == "--factor") {
+            opts.factor = std::stoi(value);
+        }
+        else if (key == "--dim") {
+            opts.dim = std::stoi(value);
+        }
+        else if (key == "--warmup") {
+            opts.warmup = std::stoi(value);
+        }
+        else if (key == "--iters") {
+            opts.iters = std::stoi(value);
+        }
+        else if (key == "--check") {
+            opts.check = std::stoi(value);
+        }
+        else if (key == "--output") {
+            opts.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+    for (const auto& op : opts.ops) {
+        if (op != "allreduce" && op != "allgather" && op != "rmsnorm") {
+            std::cerr << "unknown op " << op << "\n";
+            return false;
+        }
+    }
+    return opts.min_bytes > 0 && opts.factor > 1 && (opts.dtype == "half" || opts.dtype == "float");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    int n_ranks = opts.devices;
+    if (n_ranks < 0) {
+        check_cuda_error(cudaGetDeviceCount(&n_ranks));
+    }
+    if (n_ranks < 2) {
+        std::cerr << "at least 2 devices are required, got " << n_ranks << "\n";
+        return 1;
+    }
+
+    std::vector<Result> results;
+
+    for (const auto& backend : opts.backends) {
+        const auto it = Variants().find(backend == "native" ? "cuda-ipc" : backend);
+        if (it == Variants().end()) {
+            std::cerr << "unknown backend " << backend << "\n";
+            return 1;
+        }
+        std::vector<std::string> variants = opts.variants;
+        if (variants.size() == 1 && variants[0] == "all") {
+            variants.clear();
+            for (const auto& [name, env] : it->second) {
+                variants.push_back(name);
+            }
+        }
+        for (const auto& variant : variants) {
+            const auto v = it->second.find(variant);
+            if (v == it->second.end()) {
+                std::cerr << "variant " << variant << " is not available for " << backend << ", skipped\n";
+                continue;
+            }
+            // the limits are read when the communicators are created
+            for (const auto& [name, value] : v->second) {
+                value ? setenv(name, value, 1) : unsetenv(name);
+            }
+            std::cerr << "running " << backend << " | " << variant << " on " << n_ranks << " ranks\n";
+            auto xs = Bench{opts, backend, variant, n_ranks}.Run();
+            results.insert(results.end(), xs.begin(), xs.end());
+        }
+    }
+
+    Print(results);
+
+    if (!opts.output.empty()) {
+        std::ofstream ofs(opts.output);
+        WriteJson(ofs, opts, n_ranks, results);
+    }
+
+    return 0;
+}
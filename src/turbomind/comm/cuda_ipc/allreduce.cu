@@ -16,6 +16,19 @@ namespace turbomind::comm {
 
 using mscclpp::LLPacket;
 
+// Sum of the ranks in ascending order, `own` for `rank` and `load(p)` for the peer `p`. The sum of an element does not
+// depend on the rank owning its slice
+template<class Vec, class Load>
+__device__ Vec SumInRankOrder(const Vec& own, int rank, int peers, Load load)
+{
+    using namespace ops;
+    Vec acc = rank == 0 ? own : load(0);
+    for (int q = 1; q <= peers; ++q) {
+        acc = acc + (q == rank ? own : load(q < rank ? q : q - 1));
+    }
+    return acc;
+}
+
 // reduce-scatter + allgather using LL16Packet
 template<class T, class CtasPerPeer>
 __global__ void __launch_bounds__(1024, 1) AllreduceKernel_LL(T*                              dst,
@@ -27,6 +40,7 @@ __global__ void __launch_bounds__(1024, 1) AllreduceKernel_LL(T*
                                                               int                             slice,  // padded slice
                                                               int                             count,  // actual count
                                                               uint32_t                        flag,
+                                                              bool                            fixed_order,
                                                               CtasPerPeer                     ctas_per_peer)
 {
 
@@ -54,9 +68,17 @@ __global__ void __launch_bounds__(1024, 1) AllreduceKernel_LL(T*
         for (int idx = threadIdx.x + blockIdx.x * blockDim.x; idx < slice; idx += blockDim.x * gridDim.x) {
             Vec vec;
             Load(vec, src + (rank * slice + idx) * vec_size);
-            for (int p = 0; p < peers; ++p) {
-                uint2 data = incoming[p * slice + idx].read(flag);
-                vec        = vec + (Vec&)data;
+            if (fixed_order) {
+                vec = SumInRankOrder(vec, rank, peers, [&](int p) {
+                    uint2 data = incoming[p * slice + idx].read(flag);
+                    return (Vec&)data;
+                });
+            }
+            else {
+                for (int p = 0; p < peers; ++p) {
+                    uint2 data = incoming[p * slice + idx].read(flag);
+                    vec        = vec + (Vec&)data;
+                }
             }
             Store(dst + (rank * slice + idx) * vec_size, vec);
             for (int i = 0; i < peers; ++i) {
@@ -150,6 +172,7 @@ __global__ void Allreduce_Simple_Pull(T*                           buf,
                                       int                          peers,
                                       int                          slice,
                                       int                          count,
+                                      bool                         fixed_order,
                                       constant<vec_size>,
                                       Relaxed relaxed)
 {
@@ -173,17 +196,31 @@ __global__ void Allreduce_Simple_Pull(T*                           buf,
     const int first = rank * slice;
     const int last  = min(count, first + slice);
 
-    for (int i = 0; i < peers; ++i) {
-        const int p   = i + rank < peers ? i + rank : i + rank - peers;
-        auto      chn = cvta_generic_to_global(chns[p]);
+    if (fixed_order) {
         for (int idx = first + thread_idx; idx < last; idx += thread_num) {
-            Vec acc, tmp;
-            Load(tmp, chn + idx * vec_size);
+            Vec acc;
             Load(acc, buf + idx * vec_size);
-            acc = acc + tmp;
+            acc = SumInRankOrder(acc, rank, peers, [&](int p) {
+                Vec tmp;
+                Load(tmp, cvta_generic_to_global(chns[p]) + idx * vec_size);
+                return tmp;
+            });
             Store(buf + idx * vec_size, acc);
         }
     }
+    else {
+        for (int i = 0; i < peers; ++i) {
+            const int p   = i + rank < peers ? i + rank : i + rank - peers;
+            auto      chn = cvta_generic_to_global(chns[p]);
+            for (int idx = first + thread_idx; idx < last; idx += thread_num) {
+                Vec acc, tmp;
+                Load(tmp, chn + idx * vec_size);
+                Load(acc, buf + idx * vec_size);
+                acc = acc + tmp;
+                Store(buf + idx * vec_size, acc);
+            }
+        }
+    }
 
     __syncthreads();
 
@@ -300,6 +337,7 @@ __global__ void Allreduce_Simple_Push_v2(T*                           buf,
                                          int                          peers,
                                          int                          slice,  // in vec
                                          int                          count,  // in vec
+                                         bool                         fixed_order,
                                          constant<vec_size>,
                                          Relaxed relaxed)
 {
@@ -335,10 +373,19 @@ __global__ void Allreduce_Simple_Push_v2(T*                           buf,
     for (int idx = thread_idx; idx < slice; idx += thread_num) {
         Vec acc;
         Load(acc, buf + (rank * slice + idx) * vec_size);
-        for (int i = 0; i < peers; ++i) {
-            Vec tmp;
-            Load(tmp, scratch + (i * slice + idx) * vec_size);
-            acc = acc + tmp;
+        if (fixed_order) {
+            acc = SumInRankOrder(acc, rank, peers, [&](int p) {
+                Vec tmp;
+                Load(tmp, scratch + (p * slice + idx) * vec_size);
+                return tmp;
+            });
+        }
+        else {
+            for (int i = 0; i < peers; ++i) {
+                Vec tmp;
+                Load(tmp, scratch + (i * slice + idx) * vec_size);
+                acc = acc + tmp;
+            }
         }
         Store(buf + (rank * slice + idx) * vec_size, acc);
         for (int i = 0; i < peers; ++i) {
@@ -362,6 +409,11 @@ void CudaIpcCommImpl::AllReduceSum(
 
     void* data = recvbuff;
 
+    // the order of the multimem reductions is unspecified
+    if (!fixed_order_ && AllReduceSum_NVLS(data, count, type, group, stream)) {
+        return;
+    }
+
     const int n_ranks = this->n_ranks(group);
     const int rank    = this->rank(group);
 
@@ -370,7 +422,7 @@ void CudaIpcCommImpl::AllReduceSum(
     auto invoke = [&](auto t) {
         using T               = decltype(t);
         const size_t bytesize = sizeof(T) * count;
-        if (bytesize <= 1 << 20) {
+        if (bytesize <= ll_max_bytes_) {
             constexpr int vec_size      = sizeof(uint2) / sizeof(T);
             const int     slice         = (count / vec_size + n_ranks - 1) / n_ranks;
             constexpr int ctas_per_peer = 4;
@@ -387,12 +439,13 @@ void CudaIpcCommImpl::AllReduceSum(
                                                                slice,
                                                                count / vec_size,
                                                                flag_++,
+                                                               fixed_order_,
                                                                constant<ctas_per_peer>{});
         }
         else {
             constexpr int vec_size = sizeof(uint4) / sizeof(T);
             const int     slice    = (count / vec_size + n_ranks - 1) / n_ranks;
-            if (bytesize <= kScratchBuffSize && bytesize <= 6 << 20) {
+            if (bytesize <= push_max_bytes_) {
                 constexpr int threads = 1024;
                 const int     blocks  = std::min(48, (slice + threads - 1) / threads);
                 Allreduce_Simple_Push_v2<<<blocks, threads, 0, stream>>>((T*)data,
@@ -404,6 +457,7 @@ void CudaIpcCommImpl::AllReduceSum(
                                                                          n_ranks - 1,
                                                                          slice,
                                                                          count / vec_size,
+                                                                         fixed_order_,
                                                                          constant<vec_size>{},
                                                                          std::false_type{});
             }
@@ -417,6 +471,7 @@ void CudaIpcCommImpl::AllReduceSum(
                                                                       n_ranks - 1,
                                                                       slice,
                                                                       count / vec_size,
+                                                                      fixed_order_,
                                                                       constant<vec_size>{},
                                                                       std::false_type{});
             }
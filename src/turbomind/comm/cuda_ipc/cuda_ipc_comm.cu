@@ -5,6 +5,10 @@
 #include <type_traits>
 #include <vector>
 
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
 #include <cuda.h>
 
 #include "src/turbomind/comm/cuda_ipc/cuda_ipc_comm.h"
@@ -16,6 +20,15 @@
 
 namespace turbomind::comm {
 
+static size_t GetMaxBytesFromEnv(const char* name, size_t value, size_t limit)
+{
+    if (const char* str = std::getenv(name)) {
+        value = std::min<size_t>(std::stoull(str), limit);
+        TM_LOG_INFO("[COMM] %s = %lu", name, value);
+    }
+    return value;
+}
+
 int CudaIpcCommImpl::Split(int color, int key, int group)
 {
     FT_CHECK(color >= 0);
@@ -109,10 +122,14 @@ CudaIpcCommImpl::CudaIpcCommImpl(HostComm h_comm):
 
     Register(packet_buff_, kPacketBuffSize);
     Register(scratch_buff_, kScratchBuffSize);
+
+    InitMulticast();
 }
 
 CudaIpcCommImpl::~CudaIpcCommImpl()
 {
+    FreeMulticast();
+
     Deregister(scratch_buff_);
     Deregister(packet_buff_);
     // device_semaphores_ is not registered
@@ -174,6 +191,16 @@ void CudaIpcCommImpl::Initialize()
                                      sizeof(mscclpp::SmDevice2DeviceSemaphoreDeviceHandle) * device_semaphores.size(),
                                      cudaMemcpyHostToDevice));
 #endif
+
+    if (const char* tune = std::getenv("TM_COMM_TUNE"); tune && std::string{tune} != "0") {
+        const char* cache = std::getenv("TM_COMM_TUNE_CACHE");
+        Tune(cache ? cache : "");
+    }
+
+    // explicit limits take precedence over the tuned ones
+    nvls_max_bytes_ = GetMaxBytesFromEnv("TM_COMM_NVLS_MAX_BYTES", nvls_max_bytes_, kMulticastBytes);
+    ll_max_bytes_   = GetMaxBytesFromEnv("TM_COMM_LL_MAX_BYTES", ll_max_bytes_, kLLMaxBytes);
+    push_max_bytes_ = GetMaxBytesFromEnv("TM_COMM_PUSH_MAX_BYTES", push_max_bytes_, kScratchBuffSize);
 }
 
 void* CudaIpcCommImpl::Allocate(size_t size)
@@ -226,7 +253,7 @@ void CudaIpcCommImpl::Deregister(void* ptr)
 
 int CudaIpcCommImpl::Query(QueryAttr attr) const noexcept
 {
-    if (attr == kHasAllGather2D) {
+    if (attr == kHasAllGather2D || attr == kHasPeerMapping) {
         return 1;
     }
     return 0;
@@ -278,11 +305,24 @@ mscclpp::D2DSemaphoreHandle* CudaIpcCommImpl::init_semaphores(const std::vector<
 
 Array<void*, kMaxNearPeers> CudaIpcCommImpl::get_symmetric_impl(void* ptr, int group)
 {
-    auto& memories = registered_memories_.at(ptr);
+    void*  base   = ptr;
+    size_t offset = 0;
+    if (!registered_memories_.count(ptr)) {
+        // Interior pointer of a registered buffer, e.g. a chunk of the tokens
+        base = nullptr;
+        for (const auto& [p, m] : registered_memories_) {
+            if ((char*)p <= (char*)ptr && (char*)ptr < (char*)p + m.front().second) {
+                base   = p;
+                offset = (char*)ptr - (char*)p;
+            }
+        }
+        FT_CHECK(base);
+    }
+    auto& memories = registered_memories_.at(base);
     FT_CHECK(memories.size() <= kMaxNearPeers);
     std::vector<void*> tmp(memories.size());
     for (size_t i = 0; i < memories.size(); ++i) {
-        tmp[i] = memories[i].first;
+        tmp[i] = (char*)memories[i].first + offset;
     }
     // Put current rank back
     tmp.insert(tmp.begin() + global_rank_, ptr);
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <string>
 #include <unordered_map>
 
 #include "src/turbomind/comm/cuda_ipc/mscclpp.h"
@@ -23,6 +24,8 @@ public:
     static constexpr int kPacketBuffSize  = 8 << 20;  // 8 MB
     static constexpr int kScratchBuffSize = 8 << 20;  // 8 MB
     static constexpr int kChannelsPerConn = 64;
+    static constexpr int kMulticastBytes  = 256 << 10;  // max message size of the NVLS path
+    static constexpr int kLLMaxBytes      = 1 << 20;    // max message size of the LL allreduce
 
     ~CudaIpcCommImpl() override;
 
@@ -52,9 +55,22 @@ public:
 
     int Query(QueryAttr attr) const noexcept override;
 
+    void SetFixedOrder(bool fixed_order) override
+    {
+        fixed_order_ = fixed_order;
+    }
+
     void AllReduceSum(
         const void* sendbuff, void* recvbuff, size_t count, DataType type, int group, cudaStream_t stream) override;
 
+    void AllReduceSumQuant(const void*  sendbuff,
+                           void*        recvbuff,
+                           size_t       count,
+                           DataType     type,
+                           DataType     quant_type,
+                           int          group,
+                           cudaStream_t stream) override;
+
     void AllGather(
         const void* sendbuff, void* recvbuff, size_t sendcount, DataType type, int group, cudaStream_t stream) override;
 
@@ -95,6 +111,23 @@ public:
 private:
     uint64_t* create_semaphore_buffer();
 
+    // Multicast buffer over all the ranks, the NVLS path stays off when any device lacks multicast support
+    void InitMulticast();
+
+    void FreeMulticast();
+
+    // Limits of the allreduce variants from the calibration of the topology, cached in `cache` by the fingerprint
+    void Tune(const std::string& cache);
+
+    // Times the allreduce variants over a grid of message sizes and picks the limits of the least total slowdown
+    void Calibrate();
+
+    // Device models, peer links and multicast support of the ranks
+    std::string Fingerprint() const;
+
+    // One-shot allreduce with multimem reductions for small messages, returns false when not applicable
+    bool AllReduceSum_NVLS(void* data, size_t count, DataType type, int group, cudaStream_t stream);
+
     mscclpp::D2DSemaphoreHandle* init_semaphores(const std::vector<uint64_t*>& buffers, int group);
 
     template<class T>
@@ -124,6 +157,15 @@ private:
     void*    scratch_buff_{};
     uint32_t flag_{1};
 
+    // Message sizes up to which the allreduce variants are picked, calibrated when `TM_COMM_TUNE` is set and
+    // overridable by `TM_COMM_NVLS_MAX_BYTES`, `TM_COMM_LL_MAX_BYTES` and `TM_COMM_PUSH_MAX_BYTES`, messages larger
+    // than all of them are pulled
+    size_t nvls_max_bytes_{kMulticastBytes};
+    size_t ll_max_bytes_{kLLMaxBytes};
+    size_t push_max_bytes_{6 << 20};
+
+    bool fixed_order_{};
+
     struct Allocation {
         CUmemGenericAllocationHandle handle;
         size_t                       size;
@@ -135,6 +177,17 @@ private:
 
     std::unordered_map<void*, Allocation> allocations_;
 
+    struct Multicast {
+        CUmemGenericAllocationHandle mc_handle;
+        CUmemGenericAllocationHandle mem_handle;
+        size_t                       size;
+        void*                        uc_ptr;  // local buffer bound to the multicast object
+        void*                        mc_ptr;  // multicast address of the buffers of all ranks
+    };
+
+    Multicast multicast_{};
+    uint32_t  multicast_phase_{};  // 2 halves of the buffer are used in turn
+
     struct Group {
         std::vector<int> l2g;
         std::vector<int> g2l;
@@ -440,7 +440,7 @@ void CudaIpcCommImpl::AllreduceResidualBiasRMSnorm(void*        hidden,
         constexpr int block_dim = 1024;
         const int     max_ctas  = 48;
         const int     blocks    = std::min((slice + groups - 1) / groups, max_ctas);
-        if (bytesize <= kScratchBuffSize && bytesize <= 6 << 20) {
+        if (bytesize <= push_max_bytes_) {
             AllreduceResidualBiasRMSnorm_Simple_Push<<<blocks, block_dim, 0, stream>>>(
                 (T*)hidden,
                 (T*)residual,
@@ -515,7 +515,8 @@ void CudaIpcCommImpl::AllreduceResidualBiasRMSnorm(void*        hidden,
         }
     };
 
-    if (bytesize > (1 << 19)) {
+    // the fused kernels sum the slice owned by a rank first
+    if (bytesize > (1 << 19) && !fixed_order_) {
         if (auto success = dispatch()) {
             return;
         }
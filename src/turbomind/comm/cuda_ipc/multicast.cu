@@ -0,0 +1,216 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <type_traits>
+
+#include <cuda.h>
+
+#include "src/turbomind/comm/cuda_ipc/cuda_ipc_comm.h"
+#include "src/turbomind/comm/cuda_ipc/device_semaphore.h"
+
+#include "src/turbomind/kernels/core/common.h"
+
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind::comm {
+
+template<class T>
+__device__ void MultimemLoadReduceAdd(uint4& v, const uint4* mc_ptr)
+{
+#if TURBOMIND_ARCH_SM90
+    if constexpr (std::is_same_v<T, half>) {
+        asm volatile("multimem.ld_reduce.relaxed.sys.global.add.v4.f16x2 {%0,%1,%2,%3}, [%4];"
+                     : "=r"(v.x), "=r"(v.y), "=r"(v.z), "=r"(v.w)
+                     : "l"(mc_ptr)
+                     : "memory");
+    }
+    else {
+        asm volatile("multimem.ld_reduce.relaxed.sys.global.add.v4.bf16x2 {%0,%1,%2,%3}, [%4];"
+                     : "=r"(v.x), "=r"(v.y), "=r"(v.z), "=r"(v.w)
+                     : "l"(mc_ptr)
+                     : "memory");
+    }
+#endif
+}
+
+// One-shot allreduce, every rank reduces the whole message from the multicast address
+//  1. copy `buf` to the local buffer bound to the multicast object
+//  2. barrier, block `i` only waits for block `i` of the peers as both cover the same elements
+//  3. multimem reduction of the buffers of all ranks into `buf`
+// The 2 halves of the buffer are used in turn so that the next call never overwrites what the peers may still be
+// reading, a rank can only reach the call after next when all peers have finished this one.
+template<class T>
+__global__ void __launch_bounds__(512) Allreduce_NVLS(uint4*                       buf,
+                                                      uint4*                       uc_buf,
+                                                      const uint4*                 mc_buf,
+                                                      mscclpp::D2DSemaphoreHandle* semaphores,
+                                                      int                          peers,
+                                                      int                          count)  // in uint4
+{
+    const int thread_idx = threadIdx.x + blockIdx.x * blockDim.x;
+    const int thread_num = blockDim.x * gridDim.x;
+
+    for (int idx = thread_idx; idx < count; idx += thread_num) {
+        uc_buf[idx] = buf[idx];
+    }
+
+    // order the stores to the unicast address before the loads from the multicast alias
+    asm volatile("fence.proxy.alias;" ::: "memory");
+
+    __syncthreads();
+
+    if (threadIdx.x < peers) {
+        DeviceSemaphore sem;
+        sem.Load(&semaphores[blockIdx.x * peers + threadIdx.x]);
+        sem.SignalAndWait(false);
+        sem.Save(&semaphores[blockIdx.x * peers + threadIdx.x]);
+    }
+
+    __syncthreads();
+
+    asm volatile("fence.proxy.alias;" ::: "memory");
+
+    for (int idx = thread_idx; idx < count; idx += thread_num) {
+        uint4 v;
+        MultimemLoadReduceAdd<T>(v, mc_buf + idx);
+        buf[idx] = v;
+    }
+}
+
+void CudaIpcCommImpl::InitMulticast()
+{
+#if CUDA_VERSION >= 12010
+    if (global_n_ranks_ == 1 || !h_comm_->is_same_process()) {
+        // the handle of the multicast object is shared as is
+        return;
+    }
+
+    CUdevice device{};
+    CUDRVCHECK(cuDeviceGet(&device, ordinals_[global_rank_]));
+    int supported{};
+    CUDRVCHECK(cuDeviceGetAttribute(&supported, CU_DEVICE_ATTRIBUTE_MULTICAST_SUPPORTED, device));
+
+    const auto all_supported = comm::AllGather(h_comm_, supported);
+    if (std::find(all_supported.begin(), all_supported.end(), 0) != all_supported.end()) {
+        return;
+    }
+
+    CUmulticastObjectProp prop{};
+    prop.numDevices  = global_n_ranks_;
+    prop.handleTypes = CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR;
+    prop.size        = 2 * kMulticastBytes;
+
+    size_t granularity{};
+    CUDRVCHECK(cuMulticastGetGranularity(&granularity, &prop, CU_MULTICAST_GRANULARITY_RECOMMENDED));
+    granularity = std::max(granularity, alloc_granularity_);
+    prop.size   = (prop.size + granularity - 1) / granularity * granularity;
+
+    auto& m = multicast_;
+    m.size  = prop.size;
+
+    if (global_rank_ == 0) {
+        CUDRVCHECK(cuMulticastCreate(&m.mc_handle, &prop));
+    }
+    m.mc_handle = comm::AllGather(h_comm_, m.mc_handle)[0];
+
+    // all devices must be added before any memory is bound
+    CUDRVCHECK(cuMulticastAddDevice(m.mc_handle, device));
+    h_comm_->Sync();
+
+    CUDRVCHECK(cuMemCreate(&m.mem_handle, m.size, &alloc_prop_, 0));
+    CUDRVCHECK(cuMulticastBindMem(m.mc_handle, 0, m.mem_handle, 0, m.size, 0));
+
+    const CUmemAccessDesc& access = alloc_access_descs_[global_rank_];
+
+    CUdeviceptr uc_ptr{};
+    CUDRVCHECK(cuMemAddressReserve(&uc_ptr, m.size, granularity, 0, 0));
+    CUDRVCHECK(cuMemMap(uc_ptr, m.size, 0, m.mem_handle, 0));
+    CUDRVCHECK(cuMemSetAccess(uc_ptr, m.size, &access, 1));
+
+    CUdeviceptr mc_ptr{};
+    CUDRVCHECK(cuMemAddressReserve(&mc_ptr, m.size, granularity, 0, 0));
+    CUDRVCHECK(cuMemMap(mc_ptr, m.size, 0, m.mc_handle, 0));
+    CUDRVCHECK(cuMemSetAccess(mc_ptr, m.size, &access, 1));
+
+    m.uc_ptr = reinterpret_cast<void*>(uc_ptr);
+    m.mc_ptr = reinterpret_cast<void*>(mc_ptr);
+
+    h_comm_->Sync();
+
+    TM_LOG_INFO("[COMM][%d] NVLS multicast enabled for messages up to %d bytes", global_rank_, (int)nvls_max_bytes_);
+#endif
+}
+
+void CudaIpcCommImpl::FreeMulticast()
+{
+#if CUDA_VERSION >= 12010
+    auto& m = multicast_;
+    if (!m.mc_ptr) {
+        return;
+    }
+    check_cuda_error(cudaDeviceSynchronize());
+
+    CUDRVCHECK(cuMemUnmap(reinterpret_cast<CUdeviceptr>(m.mc_ptr), m.size));
+    CUDRVCHECK(cuMemAddressFree(reinterpret_cast<CUdeviceptr>(m.mc_ptr), m.size));
+    CUDRVCHECK(cuMemUnmap(reinterpret_cast<CUdeviceptr>(m.uc_ptr), m.size));
+    CUDRVCHECK(cuMemAddressFree(reinterpret_cast<CUdeviceptr>(m.uc_ptr), m.size));
+
+    CUdevice device{};
+    CUDRVCHECK(cuDeviceGet(&device, ordinals_[global_rank_]));
+    CUDRVCHECK(cuMulticastUnbind(m.mc_handle, device, 0, m.size));
+    CUDRVCHECK(cuMemRelease(m.mem_handle));
+
+    // the object is released by its creator once all ranks are unbound
+    h_comm_->Sync();
+    if (global_rank_ == 0) {
+        CUDRVCHECK(cuMemRelease(m.mc_handle));
+    }
+    m = {};
+#endif
+}
+
+bool CudaIpcCommImpl::AllReduceSum_NVLS(void* data, size_t count, DataType type, int group, cudaStream_t stream)
+{
+    const size_t bytesize = get_elem_size(type) * count;
+
+    if (!multicast_.mc_ptr || bytesize > nvls_max_bytes_ || bytesize % sizeof(uint4)
+        || (uintptr_t)data % sizeof(uint4)) {
+        return false;
+    }
+    // the multicast object spans all the ranks
+    const int n_ranks = this->n_ranks(group);
+    if (n_ranks != global_n_ranks_) {
+        return false;
+    }
+
+    const int     vecs    = bytesize / sizeof(uint4);
+    constexpr int threads = 512;
+    const int     blocks  = std::min<int>(kChannelsPerConn, (vecs + threads - 1) / threads);
+
+    const size_t offset = (multicast_phase_++ % 2) * kMulticastBytes;
+
+    auto uc_buf = (uint4*)((char*)multicast_.uc_ptr + offset);
+    auto mc_buf = (const uint4*)((char*)multicast_.mc_ptr + offset);
+
+    auto semaphores = groups_.at(group).d2d_semaphores;
+
+    switch (type) {
+        case DataType::TYPE_FP16:
+            Allreduce_NVLS<half><<<blocks, threads, 0, stream>>>(
+                (uint4*)data, uc_buf, mc_buf, semaphores, n_ranks - 1, vecs);
+            break;
+        case DataType::TYPE_BF16:
+            Allreduce_NVLS<nv_bfloat16><<<blocks, threads, 0, stream>>>(
+                (uint4*)data, uc_buf, mc_buf, semaphores, n_ranks - 1, vecs);
+            break;
+        default:
+            --multicast_phase_;
+            return false;
+    }
+    sync_check_cuda_error();
+
+    return true;
+}
+
+}  // namespace turbomind::comm
@@ -0,0 +1,154 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <stdexcept>
+
+#include "src/turbomind/comm/cuda_ipc/cuda_ipc_comm.h"
+#include "src/turbomind/comm/cuda_ipc/device_semaphore.h"
+#include "src/turbomind/comm/quant_codec.h"
+
+#include "src/turbomind/utils/Tensor.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind::comm {
+
+// Warp `i` of the grid owns chunks `i + k * warps` of every slice, so block `b` of all ranks covers the same chunks
+// and only waits for block `b` of the peers:
+//  1. quantize the slices of the peers to `scratch[s * slice]`
+//  2. reduce own slice from the quantized slices of the peers, quantize the sum to `scratch[n_ranks * slice]`
+//  3. decode the sums of the peers
+// Own slice keeps its decoded sum too so that the ranks agree on the result.
+template<class T, class Q>
+__global__ void __launch_bounds__(512) AllreduceQuant_Simple_Pull(T*                                buf,
+                                                                  QuantChunk*                       scratch,
+                                                                  Array<QuantChunk*, kMaxNearPeers> near,
+                                                                  mscclpp::D2DSemaphoreHandle*      semaphores,
+                                                                  int                               rank,
+                                                                  int                               peers,
+                                                                  int                               slice,  // in chunks
+                                                                  int                               count)
+{
+    const int lane      = threadIdx.x % WARP_SIZE;
+    const int warp_idx  = (threadIdx.x + blockIdx.x * blockDim.x) / WARP_SIZE;
+    const int warp_num  = blockDim.x * gridDim.x / WARP_SIZE;
+    const int n_ranks   = peers + 1;
+    const int sums_base = n_ranks * slice;
+
+    Rank r{rank, peers};
+
+    for (int s = 0; s < n_ranks; ++s) {
+        if (s == rank) {
+            continue;
+        }
+        for (int j = warp_idx; j < slice; j += warp_num) {
+            auto x = LoadChunk(buf, s * slice + j, lane, count);
+            QuantizeChunk<Q>(scratch[s * slice + j], x, lane);
+        }
+    }
+
+    __syncthreads();
+
+    DeviceSemaphore sem;
+
+    if (threadIdx.x < peers) {
+        sem.Load(&semaphores[blockIdx.x * peers + threadIdx.x]);
+        sem.SignalAndWait(false);
+    }
+
+    __syncthreads();
+
+    using namespace ops;
+
+    for (int j = warp_idx; j < slice; j += warp_num) {
+        const int c   = rank * slice + j;
+        auto      acc = LoadChunk(buf, c, lane, count);
+        for (int i = 0; i < peers; ++i) {
+            const int p = r.get_next_peer(i);
+            acc         = acc + DequantizeChunk<Q>(cvta_generic_to_global(near[p])[c], lane);
+        }
+        QuantizeChunk<Q>(scratch[sums_base + j], acc, lane);
+        StoreChunk(buf, acc, c, lane, count);
+    }
+
+    __syncthreads();
+
+    if (threadIdx.x < peers) {
+        sem.SignalAndWait(false);
+    }
+
+    __syncthreads();
+
+    for (int i = 0; i < peers; ++i) {
+        const int p      = r.get_next_peer(i);
+        const int p_rank = r.get_peer_rank(p);
+        auto      chn    = cvta_generic_to_global(near[p]) + sums_base;
+        for (int j = warp_idx; j < slice; j += warp_num) {
+            StoreChunk(buf, DequantizeChunk<Q>(chn[j], lane), p_rank * slice + j, lane, count);
+        }
+    }
+
+    __syncthreads();
+
+    // the scratch buffer may be reused once the peers are done reading
+    if (threadIdx.x < peers) {
+        sem.SignalAndWait(true);
+        sem.Save(&semaphores[blockIdx.x * peers + threadIdx.x]);
+    }
+}
+
+void CudaIpcCommImpl::AllReduceSumQuant(const void*  sendbuff,
+                                        void*        recvbuff,
+                                        size_t       count,
+                                        DataType     type,
+                                        DataType     quant_type,
+                                        int          group,
+                                        cudaStream_t stream)
+{
+    FT_CHECK(sendbuff == recvbuff);
+
+    const int n_ranks = this->n_ranks(group);
+    const int rank    = this->rank(group);
+
+    const int slice = (GetQuantChunkNum(count) + n_ranks - 1) / n_ranks;
+
+    // vectorized by 8 elements, the quantized slices of the peers & the sum of own slice
+    if (count % 8 || (n_ranks + 1) * slice * sizeof(QuantChunk) > kScratchBuffSize) {
+        return AllReduceSum(sendbuff, recvbuff, count, type, group, stream);
+    }
+
+    constexpr int threads = 512;
+    const int     blocks  = std::min(48, (slice + threads / WARP_SIZE - 1) / (threads / WARP_SIZE));
+
+    auto scratch    = (QuantChunk*)scratch_buff_;
+    auto near       = get_symmetric(scratch, group);
+    auto semaphores = groups_.at(group).d2d_semaphores;
+
+    auto invoke = [&](auto t, auto q) {
+        using T = decltype(t);
+        using Q = decltype(q);
+        AllreduceQuant_Simple_Pull<T, Q><<<blocks, threads, 0, stream>>>(
+            (T*)recvbuff, scratch, near, semaphores, rank, n_ranks - 1, slice, count);
+        sync_check_cuda_error();
+    };
+
+    auto dispatch_Q = [&](auto t) {
+        switch (quant_type) {
+            case DataType::TYPE_INT8:
+                return invoke(t, int8_t{});
+            case DataType::TYPE_FP8_E4M3:
+                return invoke(t, __nv_fp8_e4m3{});
+            default:
+                throw std::runtime_error("not implemented");
+        }
+    };
+
+    switch (type) {
+        case DataType::TYPE_FP16:
+            return dispatch_Q(half{});
+        case DataType::TYPE_BF16:
+            return dispatch_Q(nv_bfloat16{});
+        default:
+            throw std::runtime_error("not implemented");
+    }
+}
+
+}  // namespace turbomind::comm
@@ -0,0 +1,224 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "src/turbomind/comm/cuda_ipc/cuda_ipc_comm.h"
+#include "src/turbomind/comm/host_comm.h"
+
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind::comm {
+
+namespace {
+
+// Variants of the allreduce in the order they are tried by `AllReduceSum`
+enum Variant
+{
+    kNvls,
+    kLL,
+    kPush,
+    kPull,
+    kVariantNum
+};
+
+using Limits = std::array<size_t, kPull>;  // max bytes of NVLS, LL & push
+
+// Each line of the cache is "<fingerprint>\t<nvls> <ll> <push>", the last matching one wins
+bool LoadLimits(const std::string& path, const std::string& key, Limits& limits)
+{
+    std::ifstream ifs(path);
+    std::string   line;
+    bool          found = false;
+    while (std::getline(ifs, line)) {
+        const auto pos = line.rfind('\t');
+        if (pos == std::string::npos || line.compare(0, pos, key) != 0 || pos != key.size()) {
+            continue;
+        }
+        std::stringstream ss(line.substr(pos + 1));
+        Limits            tmp{};
+        if (ss >> tmp[kNvls] >> tmp[kLL] >> tmp[kPush]) {
+            limits = tmp;
+            found  = true;
+        }
+    }
+    return found;
+}
+
+void SaveLimits(const std::string& path, const std::string& key, const Limits& limits)
+{
+    std::ofstream ofs(path, std::ios::app);
+    ofs << key << '\t' << limits[kNvls] << ' ' << limits[kLL] << ' ' << limits[kPush] << '\n';
+    if (!ofs) {
+        TM_LOG_WARNING("[COMM] Failed to write the allreduce limits to %s", path.c_str());
+    }
+}
+
+}  // namespace
+
+std::string CudaIpcCommImpl::Fingerprint() const
+{
+    std::stringstream ss;
+    ss << global_n_ranks_;
+    for (const auto& ordinal : ordinals_) {
+        cudaDeviceProp prop{};
+        check_cuda_error(cudaGetDeviceProperties(&prop, ordinal));
+        ss << '|' << prop.name;
+    }
+    ss << "|p2p";
+    for (const auto& src : ordinals_) {
+        for (const auto& dst : ordinals_) {
+            if (src != dst) {
+                int access{}, perf{};
+                check_cuda_error(cudaDeviceGetP2PAttribute(&access, cudaDevP2PAttrAccessSupported, src, dst));
+                check_cuda_error(cudaDeviceGetP2PAttribute(&perf, cudaDevP2PAttrPerformanceRank, src, dst));
+                ss << ':' << access << perf;
+            }
+        }
+    }
+    ss << "|nvls:" << (multicast_.mc_ptr != nullptr);
+    return ss.str();
+}
+
+void CudaIpcCommImpl::Tune(const std::string& cache)
+{
+    const auto key = Fingerprint();
+
+    Limits limits{nvls_max_bytes_, ll_max_bytes_, push_max_bytes_};
+
+    // rank 0 reads the cache for all the ranks to agree on the outcome
+    bool found = global_rank_ == 0 && !cache.empty() && LoadLimits(cache, key, limits);
+    std::tie(found, limits) = comm::AllGather(h_comm_, std::make_tuple(found, limits)).front();
+
+    if (!found) {
+        Calibrate();
+        limits = {nvls_max_bytes_, ll_max_bytes_, push_max_bytes_};
+        if (global_rank_ == 0 && !cache.empty()) {
+            SaveLimits(cache, key, limits);
+        }
+    }
+
+    nvls_max_bytes_ = std::min<size_t>(limits[kNvls], kMulticastBytes);
+    ll_max_bytes_   = std::min<size_t>(limits[kLL], kLLMaxBytes);
+    push_max_bytes_ = std::min<size_t>(limits[kPush], kScratchBuffSize);
+
+    if (global_rank_ == 0) {
+        TM_LOG_INFO("[COMM] Allreduce limits (%s): nvls %lu, ll %lu, push %lu",
+                    found ? "cached" : "calibrated",
+                    nvls_max_bytes_,
+                    ll_max_bytes_,
+                    push_max_bytes_);
+    }
+}
+
+void CudaIpcCommImpl::Calibrate()
+{
+    constexpr int kWarmup = 3;
+    constexpr int kIters  = 10;
+
+    const std::array<size_t, kVariantNum> caps{multicast_.mc_ptr ? (size_t)kMulticastBytes : 0,
+                                               (size_t)kLLMaxBytes,
+                                               (size_t)kScratchBuffSize,
+                                               std::numeric_limits<size_t>::max()};
+
+    std::vector<size_t> sizes;
+    for (size_t bytes = 4 << 10; bytes <= kScratchBuffSize; bytes *= 2) {
+        sizes.push_back(bytes);
+    }
+
+    void* buf = Allocate(kScratchBuffSize);
+    Register(buf, kScratchBuffSize);
+
+    cudaStream_t stream{};
+    cudaEvent_t  ev_start{}, ev_end{};
+    check_cuda_error(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    check_cuda_error(cudaEventCreate(&ev_start));
+    check_cuda_error(cudaEventCreate(&ev_end));
+
+    // zeros stay zeros over the in-place reductions
+    check_cuda_error(cudaMemsetAsync(buf, 0, kScratchBuffSize, stream));
+
+    constexpr float kInf = std::numeric_limits<float>::infinity();
+
+    std::vector<std::array<float, kVariantNum>> times(sizes.size());
+
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        times[i].fill(kInf);
+        for (int v = 0; v < kVariantNum; ++v) {
+            if (sizes[i] > caps[v]) {
+                continue;
+            }
+            nvls_max_bytes_ = v == kNvls ? caps[kNvls] : 0;
+            ll_max_bytes_   = v == kLL ? caps[kLL] : 0;
+            push_max_bytes_ = v == kPush ? caps[kPush] : 0;
+
+            const size_t count = sizes[i] / sizeof(half);
+            for (int k = 0; k < kWarmup; ++k) {
+                AllReduceSum(buf, buf, count, TYPE_FP16, 0, stream);
+            }
+            check_cuda_error(cudaStreamSynchronize(stream));
+            h_comm_->Sync();
+
+            check_cuda_error(cudaEventRecord(ev_start, stream));
+            for (int k = 0; k < kIters; ++k) {
+                AllReduceSum(buf, buf, count, TYPE_FP16, 0, stream);
+            }
+            check_cuda_error(cudaEventRecord(ev_end, stream));
+            check_cuda_error(cudaEventSynchronize(ev_end));
+
+            float ms{};
+            check_cuda_error(cudaEventElapsedTime(&ms, ev_start, ev_end));
+
+            // the slowest rank bounds the collective
+            const auto ts = comm::AllGather(h_comm_, ms);
+            times[i][v]   = *std::max_element(ts.begin(), ts.end()) / kIters;
+        }
+    }
+
+    check_cuda_error(cudaEventDestroy(ev_end));
+    check_cuda_error(cudaEventDestroy(ev_start));
+    check_cuda_error(cudaStreamDestroy(stream));
+
+    Deregister(buf);
+    Free(buf);
+
+    // The variants are picked by increasing limits in the order they are tried, search the limits minimizing the sum
+    // of the slowdowns against the fastest variant of each size. All the ranks see the same times and agree
+    std::vector<size_t> cands{0};
+    cands.insert(cands.end(), sizes.begin(), sizes.end());
+
+    float  best_cost = kInf;
+    Limits best{};
+    for (const auto& t_nvls : cands) {
+        for (const auto& t_ll : cands) {
+            for (const auto& t_push : cands) {
+                if (t_nvls > caps[kNvls] || t_ll > caps[kLL] || t_push > caps[kPush]) {
+                    continue;
+                }
+                float cost = 0;
+                for (size_t i = 0; i < sizes.size(); ++i) {
+                    const auto s = sizes[i];
+                    const int  v = s <= t_nvls ? kNvls : s <= t_ll ? kLL : s <= t_push ? kPush : kPull;
+                    cost += times[i][v] / *std::min_element(times[i].begin(), times[i].end());
+                }
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best      = {t_nvls, t_ll, t_push};
+                }
+            }
+        }
+    }
+
+    nvls_max_bytes_ = best[kNvls];
+    ll_max_bytes_   = best[kLL];
+    push_max_bytes_ = best[kPush];
+}
+
+}  // namespace turbomind::comm
@@ -1,6 +1,7 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
 #include "src/turbomind/comm/device_comm.h"
+#include "src/turbomind/comm/kv_transport.h"
 #include "src/turbomind/utils/cuda_utils.h"
 
 namespace turbomind::comm {
@@ -11,12 +12,17 @@ DeviceComm CreateNcclCommunicator(int n_ranks, int rank, HostComm h_comm);
 
 DeviceComm CreateCudaIpcCommunicator(int n_ranks, int rank, HostComm h_comm);
 
+DeviceComm CreateHierCommunicator(int n_ranks, int rank, HostComm h_comm);
+
 DeviceComm CreateDeviceCommunicator(const std::string& backend, int n_ranks, int rank, HostComm h_comm)
 {
 #if BUILD_MULTI_GPU && USE_NCCL
     if (backend == "nccl") {
         return CreateNcclCommunicator(n_ranks, rank, h_comm);
     }
+    if (backend == "hier") {
+        return CreateHierCommunicator(n_ranks, rank, h_comm);
+    }
 #endif
 
 #if BUILD_MULTI_GPU
@@ -29,4 +35,34 @@ DeviceComm CreateDeviceCommunicator(const std::string& backend, int n_ranks, int
     return {};
 }
 
+KvTransport::~KvTransport() = default;
+
+std::string CreateNcclKvTransportId();
+
+std::unique_ptr<KvTransport> CreateNcclKvTransport(const std::string& id, int n_ranks, int rank);
+
+std::string CreateKvTransportId(const std::string& backend)
+{
+#if BUILD_MULTI_GPU && USE_NCCL
+    if (backend == "nccl") {
+        return CreateNcclKvTransportId();
+    }
+#endif
+
+    FT_CHECK_WITH_INFO(0, fmtstr("Unsupported kv transport backend: %s", backend.c_str()));
+    return {};
+}
+
+std::unique_ptr<KvTransport> CreateKvTransport(const std::string& backend, const std::string& id, int n_ranks, int rank)
+{
+#if BUILD_MULTI_GPU && USE_NCCL
+    if (backend == "nccl") {
+        return CreateNcclKvTransport(id, n_ranks, rank);
+    }
+#endif
+
+    FT_CHECK_WITH_INFO(0, fmtstr("Unsupported kv transport backend: %s", backend.c_str()));
+    return {};
+}
+
 }  // namespace turbomind::comm
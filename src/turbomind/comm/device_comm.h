@@ -15,7 +15,8 @@ namespace turbomind::comm {
 
 enum QueryAttr
 {
-    kHasAllGather2D
+    kHasAllGather2D,
+    kHasPeerMapping,  // `Allocate` maps the memory into the address space of every rank in the process
 };
 
 class DeviceCommImpl {
@@ -41,6 +42,10 @@ public:
 
     virtual int Query(QueryAttr attr) const noexcept = 0;
 
+    // Sum the ranks in a fixed order for any size of the data, so that an element doesn't depend on the others. No-op
+    // for backends without control over the order
+    virtual void SetFixedOrder(bool fixed_order) {}
+
     virtual void AllReduceSum(const void*  sendbuff,  //
                               void*        recvbuff,
                               size_t       count,
@@ -48,6 +53,19 @@ public:
                               int          group,
                               cudaStream_t stream) = 0;
 
+    // Lossy allreduce for bandwidth bound links. Chunks of the data are scaled and quantized to `quant_type`
+    // (`TYPE_INT8` or `TYPE_FP8_E4M3`) for the transfers, partial sums are accumulated in FP32. In-place only
+    virtual void AllReduceSumQuant(const void*  sendbuff,  //
+                                   void*        recvbuff,
+                                   size_t       count,
+                                   DataType     type,
+                                   DataType     quant_type,
+                                   int          group,
+                                   cudaStream_t stream)
+    {
+        throw std::runtime_error("not implemented");
+    }
+
     virtual void AllGather(const void*  sendbuff,  //
                            void*        recvbuff,
                            size_t       sendcount,
@@ -65,6 +83,31 @@ public:
         throw std::runtime_error("not implemented");
     }
 
+    // Counts and displacements are in elements, one per rank of `group`, and must be accessible on host
+    virtual void AllToAllV(const void*   sendbuff,
+                           const size_t* sendcounts,
+                           const size_t* sdispls,
+                           void*         recvbuff,
+                           const size_t* recvcounts,
+                           const size_t* rdispls,
+                           DataType      type,
+                           int           group,
+                           cudaStream_t  stream)
+    {
+        throw std::runtime_error("not implemented");
+    }
+
+    // Point-to-point transfer to / from rank `peer` of `group`, each `Send` must be matched by a `Recv` of the peer
+    virtual void Send(const void* sendbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream)
+    {
+        throw std::runtime_error("not implemented");
+    }
+
+    virtual void Recv(void* recvbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream)
+    {
+        throw std::runtime_error("not implemented");
+    }
+
     virtual void AllreduceResidualBiasRMSnorm(void*        hidden,
                                               void*        residual,
                                               const void*  bias,
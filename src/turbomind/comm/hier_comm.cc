@@ -0,0 +1,277 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "src/turbomind/comm/device_comm.h"
+#include "src/turbomind/comm/host_comm.h"
+#include "src/turbomind/kernels/norm/rms_norm.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/string_utils.h"
+
+namespace turbomind::comm {
+
+DeviceComm CreateNcclCommunicator(int n_ranks, int rank, HostComm h_comm);
+
+DeviceComm CreateCudaIpcCommunicator(int n_ranks, int rank, HostComm h_comm);
+
+// max ranks of a cuda-ipc communicator
+static constexpr int kMaxIslandSize = 8;
+
+// Allreduce in 3 stages for groups spanning multiple nodes (or more GPUs than a cuda-ipc communicator holds):
+//   1. allreduce within the island of peer-accessible GPUs with cuda-ipc
+//   2. allreduce of a 1/island-size shard across the islands with NCCL
+//   3. allgather of the shards within the island with cuda-ipc
+// The island traffic is a full allreduce instead of a reduce-scatter as cuda-ipc has no reduce-scatter, its LL kernels
+// are latency bound for decoding sizes anyway. The other collectives go through the flat NCCL communicator.
+class HierCommImpl: public DeviceCommImpl {
+public:
+    HierCommImpl(int n_ranks, int rank, HostComm h_comm): global_rank_{rank}
+    {
+        // Ranks of the same host form islands of at most `kMaxIslandSize`, ranks are expected to be host-major
+        char host[256]{};
+        gethostname(host, sizeof(host) - 1);
+        const auto hosts = comm::AllGather(h_comm, std::hash<std::string>{}(host));
+
+        int local_rank = 0, local_size = 0;
+        for (int i = 0; i < n_ranks; ++i) {
+            if (hosts[i] == hosts[rank]) {
+                local_rank += i < rank;
+                ++local_size;
+            }
+        }
+        const int island_size = std::min(local_size, kMaxIslandSize);
+        FT_CHECK_WITH_INFO(local_size % island_size == 0 && n_ranks % island_size == 0,
+                           fmtstr("[HierComm] %d ranks on the host can't be split into islands of %d",
+                                  local_size,
+                                  island_size));
+        // islands are numbered by their first rank
+        const int island = rank - local_rank % island_size;
+
+        nccl_ = CreateNcclCommunicator(n_ranks, rank, h_comm);
+
+        auto h_island = h_comm->Split(island, 0);
+        ipc_          = CreateCudaIpcCommunicator(island_size, h_island->rank(), h_island);
+
+        groups_.push_back(Group{0, 0, nccl_->Split(h_island->rank(), rank, 0)});
+        init(groups_.back());
+
+        TM_LOG_INFO("[HierComm][%d] island size %d, islands %d", rank, island_size, groups_[0].inter_n);
+    }
+
+    int n_ranks(int group) const override
+    {
+        return nccl_->n_ranks(groups_.at(group).flat);
+    }
+
+    int rank(int group) const override
+    {
+        return nccl_->rank(groups_.at(group).flat);
+    }
+
+    // buffers are symmetric for cuda-ipc and registered with NCCL
+    void* Allocate(size_t size) override
+    {
+        return ipc_->Allocate(size);
+    }
+
+    void Free(void* ptr) override
+    {
+        ipc_->Free(ptr);
+    }
+
+    void Register(void* ptr, size_t size) override
+    {
+        ipc_->Register(ptr, size);
+        nccl_->Register(ptr, size);
+    }
+
+    void Deregister(void* ptr) override
+    {
+        nccl_->Deregister(ptr);
+        ipc_->Deregister(ptr);
+    }
+
+    int Split(int color, int key, int group) override
+    {
+        const auto& g = groups_.at(group);
+
+        Group s{};
+        s.flat  = nccl_->Split(color, key, g.flat);
+        s.intra = ipc_->Split(color, key, g.intra);
+        // ranks of the same color & position in their islands
+        s.inter = nccl_->Split(color * kMaxIslandSize + ipc_->rank(s.intra), key, g.flat);
+        init(s);
+
+        const int index = groups_.size();
+        groups_.push_back(s);
+        return index;
+    }
+
+    int Query(QueryAttr attr) const noexcept override
+    {
+        return 0;
+    }
+
+    void AllReduceSum(
+        const void* sendbuff, void* recvbuff, size_t count, DataType type, int group, cudaStream_t stream) override
+    {
+        FT_CHECK(sendbuff == recvbuff);
+
+        const auto& g = groups_.at(group);
+
+        if (!g.hier) {
+            return nccl_->AllReduceSum(sendbuff, recvbuff, count, type, g.flat, stream);
+        }
+        if (g.inter_n == 1) {
+            return ipc_->AllReduceSum(sendbuff, recvbuff, count, type, g.intra, stream);
+        }
+
+        ipc_->AllReduceSum(recvbuff, recvbuff, count, type, g.intra, stream);
+
+        const size_t elem_size = get_elem_size(type);
+        // shards must be 16-byte aligned for the allgather
+        if (count * elem_size % (g.intra_n * sizeof(uint4)) == 0) {
+            const size_t slice = count / g.intra_n;
+            auto         shard = (char*)recvbuff + elem_size * slice * ipc_->rank(g.intra);
+            nccl_->AllReduceSum(shard, shard, slice, type, g.inter, stream);
+            ipc_->AllGather(shard, recvbuff, slice, type, g.intra, stream);
+        }
+        else {
+            nccl_->AllReduceSum(recvbuff, recvbuff, count, type, g.inter, stream);
+        }
+    }
+
+    // the quantized transfers are for the slow links across the islands
+    void AllReduceSumQuant(const void*  sendbuff,
+                           void*        recvbuff,
+                           size_t       count,
+                           DataType     type,
+                           DataType     quant_type,
+                           int          group,
+                           cudaStream_t stream) override
+    {
+        nccl_->AllReduceSumQuant(sendbuff, recvbuff, count, type, quant_type, groups_.at(group).flat, stream);
+    }
+
+    void AllGather(
+        const void* sendbuff, void* recvbuff, size_t sendcount, DataType type, int group, cudaStream_t stream) override
+    {
+        nccl_->AllGather(sendbuff, recvbuff, sendcount, type, groups_.at(group).flat, stream);
+    }
+
+    void ReduceScatter(
+        const void* sendbuff, void* recvbuff, size_t recvcount, DataType type, int group, cudaStream_t stream) override
+    {
+        nccl_->ReduceScatter(sendbuff, recvbuff, recvcount, type, groups_.at(group).flat, stream);
+    }
+
+    void AllToAllV(const void*   sendbuff,
+                   const size_t* sendcounts,
+                   const size_t* sdispls,
+                   void*         recvbuff,
+                   const size_t* recvcounts,
+                   const size_t* rdispls,
+                   DataType      type,
+                   int           group,
+                   cudaStream_t  stream) override
+    {
+        nccl_->AllToAllV(
+            sendbuff, sendcounts, sdispls, recvbuff, recvcounts, rdispls, type, groups_.at(group).flat, stream);
+    }
+
+    void Send(const void* sendbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream) override
+    {
+        nccl_->Send(sendbuff, count, type, peer, groups_.at(group).flat, stream);
+    }
+
+    void Recv(void* recvbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream) override
+    {
+        nccl_->Recv(recvbuff, count, type, peer, groups_.at(group).flat, stream);
+    }
+
+    void AllreduceResidualBiasRMSnorm(void*        hidden,
+                                      void*        residual,
+                                      const void*  bias,
+                                      const void*  weights,
+                                      float        eps,
+                                      int          dim,
+                                      int          token_num,
+                                      DataType     dtype,
+                                      int          group,
+                                      cudaStream_t stream) override
+    {
+        const auto& g = groups_.at(group);
+        if (g.hier && g.inter_n == 1) {
+            // the fused kernel of cuda-ipc
+            return ipc_->AllreduceResidualBiasRMSnorm(
+                hidden, residual, bias, weights, eps, dim, token_num, dtype, g.intra, stream);
+        }
+        AllReduceSum(hidden, hidden, (size_t)token_num * dim, dtype, group, stream);
+        invokeResidualBiasRMSNorm(hidden, residual, weights, bias, dtype, dim, token_num, eps, stream);
+    }
+
+    void AllreduceResidualBiasRMSnormEx(void*        hidden,
+                                        void*        residual,
+                                        const void*  bias,
+                                        const void*  weights,
+                                        float        eps,
+                                        int          dim,
+                                        DataType     type,
+                                        int          group0,
+                                        int          group1,
+                                        const int*   local_token_nums,
+                                        cudaStream_t stream) override
+    {
+        nccl_->AllreduceResidualBiasRMSnormEx(hidden,
+                                              residual,
+                                              bias,
+                                              weights,
+                                              eps,
+                                              dim,
+                                              type,
+                                              groups_.at(group0).flat,
+                                              groups_.at(group1).flat,
+                                              local_token_nums,
+                                              stream);
+    }
+
+private:
+    struct Group {
+        int  flat;   // NCCL group of all the ranks
+        int  intra;  // cuda-ipc group of the ranks in the island
+        int  inter;  // NCCL group of the ranks at the same position in the islands
+        int  intra_n;
+        int  inter_n;
+        bool hier;  // every island holds the same number of ranks
+    };
+
+    void init(Group& g)
+    {
+        g.intra_n = ipc_->n_ranks(g.intra);
+        g.inter_n = nccl_->n_ranks(g.inter);
+        g.hier    = g.intra_n * g.inter_n == nccl_->n_ranks(g.flat);
+        if (!g.hier) {
+            TM_LOG_WARNING("[HierComm][%d] Uneven islands of %d ranks, fall back to NCCL", global_rank_, g.intra_n);
+        }
+    }
+
+private:
+    int global_rank_;
+
+    DeviceComm nccl_;
+    DeviceComm ipc_;
+
+    std::vector<Group> groups_;
+};
+
+DeviceComm CreateHierCommunicator(int n_ranks, int rank, HostComm h_comm)
+{
+    return DeviceComm{std::make_unique<HierCommImpl>(n_ranks, rank, h_comm)};
+}
+
+}  // namespace turbomind::comm
@@ -1,15 +1,90 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
 #include "src/turbomind/comm/host_comm.h"
 
 namespace turbomind::comm {
 
 HostCommImpl::~HostCommImpl() = default;
 
+template<class T, RedOp op>
+static void reduce(void* src, int n, void* dst, int offset)
+{
+    for (int i = 0; i < n; ++i) {
+        auto& s = *((T*)src + offset + i);
+        auto& a = *((T*)dst + offset + i);
+        if constexpr (op == RedOp::kSum) {
+            a += s;
+        }
+        else if constexpr (op == RedOp::kMin) {
+            a = std::min(a, s);
+        }
+        else if constexpr (op == RedOp::kMax) {
+            a = std::max(a, s);
+        }
+        else {
+            static_assert(sizeof(T) != sizeof(T), "not implemented");
+        }
+    }
+}
+
+reduce_fn GetReduceFn(DataType dtype, RedOp red_op)
+{
+    auto dispatch_op = [&](auto t) -> reduce_fn {
+        using T = decltype(t);
+        switch (red_op) {
+            case RedOp::kSum:
+                return reduce<T, RedOp::kSum>;
+            case RedOp::kMax:
+                return reduce<T, RedOp::kMax>;
+            case RedOp::kMin:
+                return reduce<T, RedOp::kMin>;
+            default:
+                return {};
+        }
+    };
+    auto dispatch = [&]() -> reduce_fn {
+        switch (dtype) {
+            case DataType::TYPE_INT32:
+                return dispatch_op(int32_t{});
+            case DataType::TYPE_INT64:
+                return dispatch_op(int64_t{});
+            case DataType::TYPE_UINT32:
+                return dispatch_op(uint32_t{});
+            case DataType::TYPE_UINT64:
+                return dispatch_op(uint64_t{});
+            default:
+                return {};
+        }
+    };
+    if (auto fn = dispatch()) {
+        return fn;
+    }
+    else {
+        throw std::runtime_error("not implemented");
+        return {};
+    }
+}
+
 std::unique_ptr<HostGroupId> CreateThreadGroupId();
 
+#ifndef _WIN32
+std::unique_ptr<HostGroupId> CreateSocketGroupId();
+#endif
+
 std::unique_ptr<HostGroupId> CreateHostGroupId(const std::string& backend)
 {
+#ifndef _WIN32
+    if (backend == "socket") {
+        return CreateSocketGroupId();
+    }
+#endif
+    if (!backend.empty() && backend != "thread") {
+        throw std::runtime_error("unsupported host communicator: " + backend);
+    }
     return CreateThreadGroupId();
 }
 
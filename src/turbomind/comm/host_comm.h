@@ -22,6 +22,9 @@ typedef void (*copy_fn)(void* src, int n, void* dst, int offset);
 
 typedef void (*reduce_fn)(void* src, int n, void* dst, int offset);
 
+// element-wise reduction of the integer types, throws for the others
+reduce_fn GetReduceFn(DataType dtype, RedOp red_op);
+
 class HostCommImpl {
 public:
     virtual ~HostCommImpl();
@@ -152,6 +155,8 @@ public:
     virtual HostComm CreateCommunicator(int n_ranks, int rank) = 0;
 };
 
+// "thread" (default) for the ranks living in one process, "socket" for ranks in separate processes or nodes, which
+// rendezvous at `TM_HOST_COMM_ADDR` (host:port, loopback & an ephemeral port by default) of the rank 0 process
 std::unique_ptr<HostGroupId> CreateHostGroupId(const std::string& backend);
 
 }  // namespace turbomind::comm
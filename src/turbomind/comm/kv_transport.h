@@ -0,0 +1,41 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <cuda_runtime.h>
+
+namespace turbomind::comm {
+
+// Point-to-point transport of device buffers between engines, e.g. kv cache blocks from prefill engines to decode
+// engines. The ranks are engines, device `i` of each engine joins the transport of its own `i`-th id, so the peers
+// of a transfer must have the same parallel layout.
+class KvTransport {
+public:
+    virtual ~KvTransport();
+
+    virtual int rank() const = 0;
+
+    virtual int n_ranks() const = 0;
+
+    // Transfers issued between `GroupStart` and `GroupEnd` progress concurrently
+    virtual void GroupStart() {}
+
+    virtual void GroupEnd() {}
+
+    // Sends and receives between a pair of ranks are matched in the order they are issued
+    virtual void Send(const void* buff, size_t size, int peer, cudaStream_t stream) = 0;
+
+    virtual void Recv(void* buff, size_t size, int peer, cudaStream_t stream) = 0;
+};
+
+// Create the id of a new transport, it's shared with the other ranks out of band
+std::string CreateKvTransportId(const std::string& backend);
+
+// Join the transport of `id`, blocks until all `n_ranks` ranks have joined
+std::unique_ptr<KvTransport>
+CreateKvTransport(const std::string& backend, const std::string& id, int n_ranks, int rank);
+
+}  // namespace turbomind::comm
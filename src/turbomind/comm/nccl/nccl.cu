@@ -1,6 +1,7 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <numeric>
 #include <type_traits>
@@ -10,6 +11,8 @@
 
 #include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/comm/host_comm.h"
+#include "src/turbomind/comm/kv_transport.h"
+#include "src/turbomind/comm/quant_codec.h"
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
@@ -44,11 +47,56 @@ static inline ncclDataType_t getNcclDataType(DataType type)
             return ncclBfloat16;
         case DataType::TYPE_UINT8:
             return ncclUint8;
+        case DataType::TYPE_INT32:
+            return ncclInt32;
         default:
             throw std::runtime_error("not supported");
     }
 }
 
+// A warp per chunk for the kernels of the quantized allreduce
+template<class T, class Q>
+__global__ void QuantizeChunks(QuantChunk* dst, const T* src, int skip_first, int skip_last, int chunks, int count)
+{
+    const int lane = threadIdx.x % WARP_SIZE;
+    const int c    = (threadIdx.x + blockIdx.x * blockDim.x) / WARP_SIZE;
+    if (c < chunks && (c < skip_first || c >= skip_last)) {
+        auto x = LoadChunk(src, c, lane, count);
+        QuantizeChunk<Q>(dst[c], x, lane);
+    }
+}
+
+// Own slice of `buf` + the received slices, the sum is quantized to `dst` & decoded back to `buf`
+template<class T, class Q>
+__global__ void ReduceQuantChunks(
+    QuantChunk* dst, T* buf, const QuantChunk* src, int rank, int n_ranks, int slice, int count)
+{
+    const int lane = threadIdx.x % WARP_SIZE;
+    const int j    = (threadIdx.x + blockIdx.x * blockDim.x) / WARP_SIZE;
+    if (j < slice) {
+        using namespace ops;
+        const int c   = rank * slice + j;
+        auto      acc = LoadChunk(buf, c, lane, count);
+        for (int r = 0; r < n_ranks; ++r) {
+            if (r != rank) {
+                acc = acc + DequantizeChunk<Q>(src[r * slice + j], lane);
+            }
+        }
+        QuantizeChunk<Q>(dst[j], acc, lane);
+        StoreChunk(buf, acc, c, lane, count);
+    }
+}
+
+template<class T, class Q>
+__global__ void DequantizeChunks(T* dst, const QuantChunk* src, int skip_first, int skip_last, int chunks, int count)
+{
+    const int lane = threadIdx.x % WARP_SIZE;
+    const int c    = (threadIdx.x + blockIdx.x * blockDim.x) / WARP_SIZE;
+    if (c < chunks && (c < skip_first || c >= skip_last)) {
+        StoreChunk(dst, DequantizeChunk<Q>(src[c], lane), c, lane, count);
+    }
+}
+
 class NcclCommImpl: public DeviceCommImpl {
 public:
     NcclCommImpl(ncclComm_t comm, int n_ranks, int rank, HostComm h_comm):
@@ -58,6 +106,10 @@ public:
 
     ~NcclCommImpl()
     {
+        if (quant_buff_) {
+            check_cuda_error(cudaFree(quant_buff_));
+        }
+
         for (const auto& [ptr, _] : handles_) {
             TM_LOG_WARNING("[NCCL][%d] Buffer %p is not deregistered", global_rank_, ptr);
         }
@@ -170,6 +222,95 @@ public:
         NCCLCHECK(ncclGroupEnd());
     }
 
+    // quantize the slices of the peers -> all-to-all -> reduce & quantize own slice -> allgather -> decode
+    void AllReduceSumQuant(const void*  sendbuff,
+                           void*        recvbuff,
+                           size_t       count,
+                           DataType     type,
+                           DataType     quant_type,
+                           int          group,
+                           cudaStream_t stream) override
+    {
+        FT_CHECK(sendbuff == recvbuff);
+
+        if (count % 8) {
+            return AllReduceSum(sendbuff, recvbuff, count, type, group, stream);
+        }
+
+        ncclComm_t comm    = groups_.at(group);
+        const int  n_ranks = this->n_ranks(group);
+        const int  rank    = this->rank(group);
+
+        const int    slice = (GetQuantChunkNum(count) + n_ranks - 1) / n_ranks;
+        const int    total = slice * n_ranks;
+        const size_t bytes = sizeof(QuantChunk) * slice;
+
+        // send & recv buffers of all the slices
+        if (const size_t size = 2 * bytes * n_ranks; size > quant_buff_size_) {
+            check_cuda_error(cudaStreamSynchronize(stream));
+            if (quant_buff_) {
+                check_cuda_error(cudaFree(quant_buff_));
+            }
+            check_cuda_error(cudaMalloc(&quant_buff_, size));
+            quant_buff_size_ = size;
+        }
+        auto send = (QuantChunk*)quant_buff_;
+        auto recv = send + total;
+
+        constexpr int threads = 256;
+        const int     blocks  = (total * WARP_SIZE + threads - 1) / threads;
+
+        auto invoke = [&](auto t, auto q) {
+            using T = decltype(t);
+            using Q = decltype(q);
+
+            const int first = rank * slice;
+            QuantizeChunks<T, Q><<<blocks, threads, 0, stream>>>(
+                send, (const T*)recvbuff, first, first + slice, total, count);
+
+            NCCLCHECK(ncclGroupStart());
+            for (int r = 0; r < n_ranks; ++r) {
+                if (r != rank) {
+                    NCCLCHECK(ncclSend(send + r * slice, bytes, ncclUint8, r, comm, stream));
+                    NCCLCHECK(ncclRecv(recv + r * slice, bytes, ncclUint8, r, comm, stream));
+                }
+            }
+            NCCLCHECK(ncclGroupEnd());
+
+            // the sums are gathered into `send`
+            ReduceQuantChunks<T, Q><<<(slice * WARP_SIZE + threads - 1) / threads, threads, 0, stream>>>(
+                send + first, (T*)recvbuff, recv, rank, n_ranks, slice, count);
+
+            NCCLCHECK(ncclGroupStart());
+            NCCLCHECK(ncclAllGather(send + first, send, bytes, ncclUint8, comm, stream));
+            NCCLCHECK(ncclGroupEnd());
+
+            DequantizeChunks<T, Q><<<blocks, threads, 0, stream>>>(
+                (T*)recvbuff, send, first, first + slice, total, count);
+            sync_check_cuda_error();
+        };
+
+        auto dispatch_Q = [&](auto t) {
+            switch (quant_type) {
+                case DataType::TYPE_INT8:
+                    return invoke(t, int8_t{});
+                case DataType::TYPE_FP8_E4M3:
+                    return invoke(t, __nv_fp8_e4m3{});
+                default:
+                    throw std::runtime_error("not supported");
+            }
+        };
+
+        switch (type) {
+            case DataType::TYPE_FP16:
+                return dispatch_Q(half{});
+            case DataType::TYPE_BF16:
+                return dispatch_Q(nv_bfloat16{});
+            default:
+                throw std::runtime_error("not supported");
+        }
+    }
+
     void AllGather(
         const void* sendbuff, void* recvbuff, size_t sendcount, DataType type, int group, cudaStream_t stream) override
     {
@@ -187,6 +328,52 @@ public:
         NCCLCHECK(ncclGroupEnd());
     }
 
+    void AllToAllV(const void*   sendbuff,
+                   const size_t* sendcounts,
+                   const size_t* sdispls,
+                   void*         recvbuff,
+                   const size_t* recvcounts,
+                   const size_t* rdispls,
+                   DataType      type,
+                   int           group,
+                   cudaStream_t  stream) override
+    {
+        const size_t         elem_size = get_elem_size(type);
+        const ncclDataType_t nccl_type = getNcclDataType(type);
+
+        ncclComm_t comm = groups_.at(group);
+
+        int n_ranks{};
+        NCCLCHECK(ncclCommCount(comm, &n_ranks));
+
+        NCCLCHECK(ncclGroupStart());
+        for (int i = 0; i < n_ranks; ++i) {
+            if (sendcounts[i]) {
+                auto buff = (const char*)sendbuff + elem_size * sdispls[i];
+                NCCLCHECK(ncclSend(buff, sendcounts[i], nccl_type, i, comm, stream));
+            }
+            if (recvcounts[i]) {
+                auto buff = (char*)recvbuff + elem_size * rdispls[i];
+                NCCLCHECK(ncclRecv(buff, recvcounts[i], nccl_type, i, comm, stream));
+            }
+        }
+        NCCLCHECK(ncclGroupEnd());
+    }
+
+    void Send(const void* sendbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream) override
+    {
+        NCCLCHECK(ncclGroupStart());
+        NCCLCHECK(ncclSend(sendbuff, count, getNcclDataType(type), peer, groups_.at(group), stream));
+        NCCLCHECK(ncclGroupEnd());
+    }
+
+    void Recv(void* recvbuff, size_t count, DataType type, int peer, int group, cudaStream_t stream) override
+    {
+        NCCLCHECK(ncclGroupStart());
+        NCCLCHECK(ncclRecv(recvbuff, count, getNcclDataType(type), peer, groups_.at(group), stream));
+        NCCLCHECK(ncclGroupEnd());
+    }
+
     void AllreduceResidualBiasRMSnorm(void*        hidden,
                                       void*        residual,
                                       const void*  bias,
@@ -313,6 +500,9 @@ private:
 
     std::unordered_map<void*, void*>  handles_;
     std::unordered_map<void*, size_t> buffers_;
+
+    void*  quant_buff_{};  // of the quantized allreduce, grown on demand
+    size_t quant_buff_size_{};
 };
 
 DeviceComm CreateNcclCommunicator(int n_ranks, int rank, HostComm h_comm)
@@ -331,4 +521,71 @@ DeviceComm CreateNcclCommunicator(int n_ranks, int rank, HostComm h_comm)
     return DeviceComm{std::make_unique<NcclCommImpl>(comm, n_ranks, rank, h_comm)};
 }
 
+// NCCL picks NVLink, IB (GPUDirect RDMA) or sockets for the point-to-point transfers by itself
+class NcclKvTransport: public KvTransport {
+public:
+    NcclKvTransport(ncclComm_t comm, int n_ranks, int rank): comm_{comm}, n_ranks_{n_ranks}, rank_{rank} {}
+
+    ~NcclKvTransport()
+    {
+        if (auto ec = ncclCommDestroy(comm_); ec != ncclSuccess) {
+            TM_LOG_ERROR("[NCCL][KvTransport][%d] Failed to destroy communicator: %s", rank_, ncclGetErrorString(ec));
+        }
+    }
+
+    int rank() const override
+    {
+        return rank_;
+    }
+
+    int n_ranks() const override
+    {
+        return n_ranks_;
+    }
+
+    void GroupStart() override
+    {
+        NCCLCHECK(ncclGroupStart());
+    }
+
+    void GroupEnd() override
+    {
+        NCCLCHECK(ncclGroupEnd());
+    }
+
+    void Send(const void* buff, size_t size, int peer, cudaStream_t stream) override
+    {
+        NCCLCHECK(ncclSend(buff, size, ncclUint8, peer, comm_, stream));
+    }
+
+    void Recv(void* buff, size_t size, int peer, cudaStream_t stream) override
+    {
+        NCCLCHECK(ncclRecv(buff, size, ncclUint8, peer, comm_, stream));
+    }
+
+private:
+    ncclComm_t comm_;
+    int        n_ranks_;
+    int        rank_;
+};
+
+std::string CreateNcclKvTransportId()
+{
+    ncclUniqueId uid{};
+    NCCLCHECK(ncclGetUniqueId(&uid));
+    return std::string((const char*)&uid, sizeof(uid));
+}
+
+std::unique_ptr<KvTransport> CreateNcclKvTransport(const std::string& id, int n_ranks, int rank)
+{
+    ncclUniqueId uid{};
+    FT_CHECK_WITH_INFO(id.size() == sizeof(uid), "invalid NCCL kv transport id");
+    std::memcpy(&uid, id.data(), sizeof(uid));
+
+    ncclComm_t comm{};
+    NCCLCHECK(ncclCommInitRank(&comm, n_ranks, uid, rank));
+
+    return std::make_unique<NcclKvTransport>(comm, n_ranks, rank);
+}
+
 }  // namespace turbomind::comm
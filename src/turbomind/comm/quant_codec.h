@@ -0,0 +1,169 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+
+#include <cuda_fp8.h>
+
+#include "src/turbomind/kernels/core/array.h"
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/common.h"
+
+// Codec of the quantized allreduce, shared by the backends
+
+namespace turbomind::comm {
+
+// Elements sharing a scale, 8 elements per lane of a warp
+constexpr int kQuantChunkSize = 256;
+
+// The scale is kept with the payload so that any range of chunks is contiguous
+struct alignas(16) QuantChunk {
+    uint2 data[WARP_SIZE];
+    float scale;
+};
+
+static_assert(sizeof(QuantChunk) == kQuantChunkSize + 16);
+
+inline int GetQuantChunkNum(size_t count)
+{
+    return (count + kQuantChunkSize - 1) / kQuantChunkSize;
+}
+
+template<class Q>
+struct QuantTraits;
+
+template<>
+struct QuantTraits<int8_t> {
+    static constexpr float kMax = 127.f;
+
+    __device__ static uint32_t pack(float a, float b, float c, float d)
+    {
+        auto cvt = [](float x) { return (uint32_t)(uint8_t)(int8_t)__float2int_rn(fminf(fmaxf(x, -kMax), kMax)); };
+        return cvt(a) | cvt(b) << 8 | cvt(c) << 16 | cvt(d) << 24;
+    }
+
+    __device__ static void unpack(float (&x)[4], uint32_t u)
+    {
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            x[i] = (float)(int8_t)(u >> (i * 8));
+        }
+    }
+};
+
+template<>
+struct QuantTraits<__nv_fp8_e4m3> {
+    static constexpr float kMax = 448.f;
+
+    __device__ static uint32_t pack(float a, float b, float c, float d)
+    {
+        const uint32_t lo = __nv_cvt_float2_to_fp8x2(float2{a, b}, __NV_SATFINITE, __NV_E4M3);
+        const uint32_t hi = __nv_cvt_float2_to_fp8x2(float2{c, d}, __NV_SATFINITE, __NV_E4M3);
+        return lo | hi << 16;
+    }
+
+    __device__ static void unpack(float (&x)[4], uint32_t u)
+    {
+        const float2 lo = __half22float2(__half2(__nv_cvt_fp8x2_to_halfraw2(u & 0xffff, __NV_E4M3)));
+        const float2 hi = __half22float2(__half2(__nv_cvt_fp8x2_to_halfraw2(u >> 16, __NV_E4M3)));
+        x[0]            = lo.x;
+        x[1]            = lo.y;
+        x[2]            = hi.x;
+        x[3]            = hi.y;
+    }
+};
+
+// Called by all lanes of a warp with the 8 elements of the lane, `x` is replaced by the values the peers will decode
+template<class Q>
+__device__ void QuantizeChunk(QuantChunk& dst, Array<float, 8>& x, int lane)
+{
+    using Traits = QuantTraits<Q>;
+
+    float amax = 0.f;
+    PRAGMA_UNROLL
+    for (int i = 0; i < 8; ++i) {
+        amax = fmaxf(amax, fabsf(x[i]));
+    }
+    PRAGMA_UNROLL
+    for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+        amax = fmaxf(amax, __shfl_xor_sync((uint32_t)-1, amax, mask));
+    }
+    const float scale = amax > 0.f ? amax / Traits::kMax : 1.f;
+    const float inv   = 1.f / scale;
+
+    uint2 q;
+    q.x = Traits::pack(x[0] * inv, x[1] * inv, x[2] * inv, x[3] * inv);
+    q.y = Traits::pack(x[4] * inv, x[5] * inv, x[6] * inv, x[7] * inv);
+
+    dst.data[lane] = q;
+    if (lane == 0) {
+        dst.scale = scale;
+    }
+
+    float r[4];
+    Traits::unpack(r, q.x);
+    PRAGMA_UNROLL
+    for (int i = 0; i < 4; ++i) {
+        x[i] = r[i] * scale;
+    }
+    Traits::unpack(r, q.y);
+    PRAGMA_UNROLL
+    for (int i = 0; i < 4; ++i) {
+        x[4 + i] = r[i] * scale;
+    }
+}
+
+template<class Q>
+__device__ Array<float, 8> DequantizeChunk(const QuantChunk& src, int lane)
+{
+    using Traits = QuantTraits<Q>;
+
+    const uint2 q     = src.data[lane];
+    const float scale = src.scale;
+
+    Array<float, 8> x;
+    float           r[4];
+    Traits::unpack(r, q.x);
+    PRAGMA_UNROLL
+    for (int i = 0; i < 4; ++i) {
+        x[i] = r[i] * scale;
+    }
+    Traits::unpack(r, q.y);
+    PRAGMA_UNROLL
+    for (int i = 0; i < 4; ++i) {
+        x[4 + i] = r[i] * scale;
+    }
+    return x;
+}
+
+// 8 elements of the lane in chunk `c`, zeros past `count`
+template<class T>
+__device__ Array<float, 8> LoadChunk(const T* src, int c, int lane, int count)
+{
+    Array<float, 8> x{};
+    if (const int i = c * kQuantChunkSize + lane * 8; i < count) {
+        Array<T, 8> v;
+        Load(v, src + i);
+        PRAGMA_UNROLL
+        for (int k = 0; k < 8; ++k) {
+            x[k] = (float)v[k];
+        }
+    }
+    return x;
+}
+
+template<class T>
+__device__ void StoreChunk(T* dst, const Array<float, 8>& x, int c, int lane, int count)
+{
+    if (const int i = c * kQuantChunkSize + lane * 8; i < count) {
+        Array<T, 8> v;
+        PRAGMA_UNROLL
+        for (int k = 0; k < 8; ++k) {
+            v[k] = (T)x[k];
+        }
+        Store(dst + i, v);
+    }
+}
+
+}  // namespace turbomind::comm
@@ -0,0 +1,435 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "src/turbomind/comm/host_comm.h"
+
+#include "src/turbomind/utils/Tensor.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind::comm {
+
+namespace {
+
+// the processes of the ranks may start in any order
+constexpr int kConnectTimeoutSec = 300;
+
+void SendAll(int fd, const void* data, size_t size)
+{
+    auto p = (const char*)data;
+    while (size) {
+        const auto n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        FT_CHECK_WITH_INFO(n > 0, fmtstr("[SocketComm] send failed: %s", std::strerror(errno)));
+        p += n;
+        size -= n;
+    }
+}
+
+void RecvAll(int fd, void* data, size_t size)
+{
+    auto p = (char*)data;
+    while (size) {
+        const auto n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        FT_CHECK_WITH_INFO(
+            n > 0, n ? fmtstr("[SocketComm] recv failed: %s", std::strerror(errno)) : "[SocketComm] peer closed");
+        p += n;
+        size -= n;
+    }
+}
+
+void SetNoDelay(int fd)
+{
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// listening socket on `port` of all interfaces, 0 picks an ephemeral port which is returned in `port`
+int Listen(int& port)
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    FT_CHECK_WITH_INFO(fd >= 0, fmtstr("[SocketComm] socket failed: %s", std::strerror(errno)));
+
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(port);
+    FT_CHECK_WITH_INFO(::bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0,
+                       fmtstr("[SocketComm] bind to port %d failed: %s", port, std::strerror(errno)));
+    FT_CHECK(::listen(fd, SOMAXCONN) == 0);
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+int Accept(int listen_fd)
+{
+    int fd{};
+    while ((fd = ::accept(listen_fd, nullptr, nullptr)) < 0 && errno == EINTR) {}
+    FT_CHECK_WITH_INFO(fd >= 0, fmtstr("[SocketComm] accept failed: %s", std::strerror(errno)));
+    SetNoDelay(fd);
+    return fd;
+}
+
+// retries until the peer listens
+int Connect(const std::string& host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo*  res{};
+    const auto service = std::to_string(port);
+    FT_CHECK_WITH_INFO(::getaddrinfo(host.c_str(), service.c_str(), &hints, &res) == 0,
+                       fmtstr("[SocketComm] can't resolve %s", host.c_str()));
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(kConnectTimeoutSec);
+
+    int fd = -1;
+    while (true) {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        FT_CHECK(fd >= 0);
+        if (::connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        FT_CHECK_WITH_INFO(std::chrono::steady_clock::now() < deadline,
+                           fmtstr("[SocketComm] can't connect to %s:%d", host.c_str(), port));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ::freeaddrinfo(res);
+
+    SetNoDelay(fd);
+    return fd;
+}
+
+// address of the local end of a connected socket, which is reachable by its peer
+std::string LocalAddress(int fd)
+{
+    sockaddr_in addr{};
+    socklen_t   len = sizeof(addr);
+    ::getsockname(fd, (sockaddr*)&addr, &len);
+    char buf[INET_ADDRSTRLEN]{};
+    ::inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf));
+    return buf;
+}
+
+struct Hello {
+    int rank;
+    int n_ranks;
+};
+
+// connections of rank 0 to the other ranks, indexed by rank
+std::vector<int> AcceptRanks(int listen_fd, int n_ranks)
+{
+    std::vector<int> fds(n_ranks, -1);
+    for (int i = 1; i < n_ranks; ++i) {
+        const int fd = Accept(listen_fd);
+        Hello     hello{};
+        RecvAll(fd, &hello, sizeof(hello));
+        FT_CHECK_WITH_INFO(hello.n_ranks == n_ranks && 0 < hello.rank && hello.rank < n_ranks && fds[hello.rank] < 0,
+                           fmtstr("[SocketComm] unexpected rank %d of %d", hello.rank, hello.n_ranks));
+        fds[hello.rank] = fd;
+    }
+    return fds;
+}
+
+int ConnectRank(const std::string& host, int port, int rank, int n_ranks)
+{
+    const int   fd = Connect(host, port);
+    const Hello hello{rank, n_ranks};
+    SendAll(fd, &hello, sizeof(hello));
+    return fd;
+}
+
+}  // namespace
+
+// Star around rank 0, which relays all the collectives. The host collectives carry small control data once in a few
+// steps, the latency of the extra hop matters more than the bandwidth of rank 0. Only trivially copyable data can be
+// sent, `copy_fn` of the in-process communicator is not used
+struct SocketCommImpl: public HostCommImpl {
+
+    int rank_;
+    int n_ranks_;
+
+    std::vector<int> fds_;  // rank 0: to each rank (-1 for itself), others: to rank 0
+
+    std::vector<char> buf_;
+
+    SocketCommImpl(int rank, int n_ranks, std::vector<int> fds): rank_{rank}, n_ranks_{n_ranks}, fds_{std::move(fds)}
+    {
+    }
+
+    ~SocketCommImpl() override
+    {
+        for (const auto& fd : fds_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    int rank() const override
+    {
+        return rank_;
+    }
+
+    int n_ranks() const override
+    {
+        return n_ranks_;
+    }
+
+    bool is_same_process() const override
+    {
+        return false;
+    }
+
+    std::shared_ptr<HostCommImpl> Split(int color, int key) override
+    {
+        FT_CHECK(color >= 0);
+
+        struct Member {
+            int color;
+            int key;
+            int rank;
+        };
+
+        // `rank` imposes proper ordering when keys are equal
+        auto vec = comm::AllGather(this, Member{color, key, rank_});
+
+        auto last = std::stable_partition(vec.begin(), vec.end(), [&](auto x) {  //
+            return x.color == color;
+        });
+        vec.erase(last, vec.end());
+        std::stable_sort(vec.begin(), vec.end(), [](auto& a, auto& b) {  //
+            return std::tie(a.key, a.rank) < std::tie(b.key, b.rank);
+        });
+
+        const int n_ranks = vec.size();
+        const int rank    = std::find_if(vec.begin(), vec.end(), [&](auto x) { return x.rank == rank_; }) - vec.begin();
+
+        struct Endpoint {
+            char host[INET_ADDRSTRLEN];
+            int  port;
+        };
+
+        // the 1st rank of each new group listens on an ephemeral port, the endpoints are exchanged by the parent group
+        Endpoint self{};
+        int      listen_fd = -1;
+        if (rank == 0 && n_ranks > 1) {
+            listen_fd = Listen(self.port);
+            // any connection of the parent tells the address of this host
+            const auto fd   = *std::max_element(fds_.begin(), fds_.end());
+            const auto host = LocalAddress(fd);
+            std::copy_n(host.c_str(), std::min(host.size(), sizeof(self.host) - 1), self.host);
+        }
+        const auto endpoints = comm::AllGather(this, self);
+
+        std::vector<int> fds{-1};
+        if (rank == 0) {
+            if (listen_fd >= 0) {
+                fds = AcceptRanks(listen_fd, n_ranks);
+                ::close(listen_fd);
+            }
+        }
+        else {
+            const auto& e = endpoints.at(vec[0].rank);
+            fds           = {ConnectRank(e.host, e.port, rank, n_ranks)};
+        }
+
+        return std::make_shared<SocketCommImpl>(rank, n_ranks, std::move(fds));
+    }
+
+    // each rank holds its slot of `data` [n_ranks, size], rank 0 collects the slots and sends them back to all ranks
+    void Exchange(char* data, size_t size)
+    {
+        if (rank_ == 0) {
+            for (int r = 1; r < n_ranks_; ++r) {
+                RecvAll(fds_[r], data + r * size, size);
+            }
+            for (int r = 1; r < n_ranks_; ++r) {
+                SendAll(fds_[r], data, n_ranks_ * size);
+            }
+        }
+        else {
+            SendAll(fds_[0], data + rank_ * size, size);
+            RecvAll(fds_[0], data, n_ranks_ * size);
+        }
+    }
+
+    size_t bytes(int count, DataType dtype) const
+    {
+        FT_CHECK_WITH_INFO(dtype != TYPE_INVALID, "[SocketComm] only trivially copyable data can be sent");
+        // the typed interface sends trivially copyable data as bytes
+        return dtype == TYPE_INT8 ? count : get_elem_size(dtype) * count;
+    }
+
+    void Sync() override
+    {
+        if (n_ranks_ == 1) {
+            return;
+        }
+        buf_.resize(n_ranks_);
+        Exchange(buf_.data(), 1);
+    }
+
+    void Broadcast(void* data, int count, DataType dtype, int root, copy_fn copy) override
+    {
+        FT_CHECK(copy);
+        if (n_ranks_ == 1) {
+            return;
+        }
+        const size_t size = bytes(count, dtype);
+        if (rank_ == 0) {
+            if (root != 0) {
+                RecvAll(fds_[root], data, size);
+            }
+            for (int r = 1; r < n_ranks_; ++r) {
+                if (r != root) {
+                    SendAll(fds_[r], data, size);
+                }
+            }
+        }
+        else if (rank_ == root) {
+            SendAll(fds_[0], data, size);
+        }
+        else {
+            RecvAll(fds_[0], data, size);
+        }
+    }
+
+    void AllGather(void* data, int count, DataType dtype, copy_fn copy) override
+    {
+        FT_CHECK(copy);
+        if (n_ranks_ == 1) {
+            return;
+        }
+        Exchange((char*)data, bytes(count, dtype));
+    }
+
+    void AllReduce(void* data, int count, DataType dtype, RedOp red_op) override
+    {
+        const auto reduce = GetReduceFn(dtype, red_op);
+        if (n_ranks_ == 1) {
+            return;
+        }
+        const size_t size = bytes(count, dtype);
+        if (rank_ == 0) {
+            buf_.resize(size);
+            for (int r = 1; r < n_ranks_; ++r) {
+                RecvAll(fds_[r], buf_.data(), size);
+                reduce(buf_.data(), count, data, 0);
+            }
+            for (int r = 1; r < n_ranks_; ++r) {
+                SendAll(fds_[r], data, size);
+            }
+        }
+        else {
+            SendAll(fds_[0], data, size);
+            RecvAll(fds_[0], data, size);
+        }
+    }
+};
+
+class SocketGroupId: public HostGroupId {
+public:
+    ~SocketGroupId() override
+    {
+        if (listen_fd_ >= 0) {
+            ::close(listen_fd_);
+        }
+    }
+
+    // rank 0 lives in the process initializing the group, it listens from now on
+    void Initialize() override
+    {
+        const char* env = std::getenv("TM_HOST_COMM_ADDR");
+        Parse(env ? env : "127.0.0.1:0");
+        listen_fd_ = Listen(port_);
+        TM_LOG_INFO("[SocketComm] rendezvous at %s:%d", host_.c_str(), port_);
+    }
+
+    void Export(std::ostream& os) override
+    {
+        FT_CHECK(listen_fd_ >= 0);  // `Initialize` must come befor `Export`
+
+        const auto addr = host_ + ":" + std::to_string(port_);
+        const int  size = addr.size();
+        os.write((const char*)&size, sizeof(size));
+        os.write(addr.data(), size);
+    }
+
+    void Import(std::istream& is) override
+    {
+        int size{};
+        is.read((char*)&size, sizeof(size));
+        std::string addr(size, '\0');
+        is.read(addr.data(), size);
+        Parse(addr);
+    }
+
+    HostComm CreateCommunicator(int n_ranks, int rank) override
+    {
+        std::vector<int> fds{-1};
+        if (rank == 0) {
+            FT_CHECK_WITH_INFO(listen_fd_ >= 0, "[SocketComm] rank 0 must be created by the initialized group id");
+            fds = AcceptRanks(listen_fd_, n_ranks);
+        }
+        else {
+            fds = {ConnectRank(host_, port_, rank, n_ranks)};
+        }
+
+        auto impl = std::make_shared<SocketCommImpl>(rank, n_ranks, std::move(fds));
+
+        return std::static_pointer_cast<HostCommImpl>(impl);
+    }
+
+private:
+    void Parse(const std::string& addr)
+    {
+        const auto pos = addr.rfind(':');
+        FT_CHECK_WITH_INFO(pos != std::string::npos, fmtstr("[SocketComm] invalid address: %s", addr.c_str()));
+        host_ = addr.substr(0, pos);
+        port_ = std::stoi(addr.substr(pos + 1));
+    }
+
+private:
+    std::string host_;
+    int         port_{};
+    int         listen_fd_{-1};
+};
+
+std::unique_ptr<HostGroupId> CreateSocketGroupId()
+{
+    return std::make_unique<SocketGroupId>();
+}
+
+}  // namespace turbomind::comm
@@ -0,0 +1,121 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "src/turbomind/comm/host_comm.h"
+#include "src/turbomind/utils/logger.h"
+
+using namespace turbomind::comm;
+
+// The control data an engine step exchanges over its host groups, driven through `backend` with the ranks laid out
+// as the engine does: [dp, tp], `h_tp_group` of the consecutive ranks and `h_dp_group` of the same tp rank
+static int TestEngineStep(const std::string& backend, int dp, int tp, int steps)
+{
+    const int n_ranks = dp * tp;
+
+    auto group_id = CreateHostGroupId(backend);
+    group_id->Initialize();
+    std::stringstream ss;
+    group_id->Export(ss);
+    const auto group_id_data = ss.str();
+
+    std::vector<int> errors(n_ranks);
+
+    auto run = [&](int rank) {
+        HostComm h_comm;
+        if (rank == 0) {
+            h_comm = group_id->CreateCommunicator(n_ranks, rank);
+        }
+        else {
+            std::stringstream is(group_id_data);
+            auto              id = CreateHostGroupId(backend);
+            id->Import(is);
+            h_comm = id->CreateCommunicator(n_ranks, rank);
+        }
+
+        HostComm h_tp_group = h_comm->Split(rank / tp, 0);
+        HostComm h_dp_group = h_comm->Split(rank % tp, 0);
+
+        const int tp_rank = h_tp_group->rank();
+        const int dp_rank = h_dp_group->rank();
+
+        int& error = errors[rank];
+
+        constexpr int kWords = 5;
+
+        for (int step = 0; step < steps; ++step) {
+            // the cancel flag & the token bitmask of the dequeued requests from tp rank 0
+            int canceled = tp_rank == 0 ? (step + dp_rank) % 3 == 0 : -1;
+            Broadcast(h_tp_group, canceled, 0);
+            error += canceled != ((step + dp_rank) % 3 == 0);
+
+            std::vector<uint32_t> bitmask(kWords * (step + 1));
+            for (size_t i = 0; i < bitmask.size(); ++i) {
+                bitmask[i] = tp_rank == 0 ? (uint32_t)(i * 2654435761u + step) : 0;
+            }
+            Broadcast(h_tp_group, bitmask.data(), bitmask.size(), 0);
+            for (size_t i = 0; i < bitmask.size(); ++i) {
+                error += bitmask[i] != (uint32_t)(i * 2654435761u + step);
+            }
+
+            // the budget of the prefix store writes agreed by the tp ranks
+            const int writable = AllReduce(h_tp_group, step + tp_rank, RedOp::kMin);
+            error += writable != step;
+
+            // the batch sizes of the dp ranks
+            const auto bss = AllGather(h_dp_group, step * dp + dp_rank);
+            for (int i = 0; i < dp; ++i) {
+                error += bss[i] != step * dp + i;
+            }
+
+            h_comm->Sync();
+        }
+
+        // the dequeued requests are shared pointers, only ranks of the same process can exchange them
+        auto req = std::make_shared<std::vector<int>>(1, rank);
+        if (h_tp_group->is_same_process()) {
+            Broadcast(h_tp_group, req, 0);
+            error += (*req)[0] != rank / tp * tp;
+        }
+        else {
+            try {
+                Broadcast(h_tp_group, req, 0);
+                ++error;
+            }
+            catch (const std::runtime_error&) {
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < n_ranks; ++r) {
+        threads.emplace_back(run, r);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    int error = 0;
+    for (const auto& e : errors) {
+        error += e;
+    }
+    printf("[%s] dp=%d, tp=%d, steps=%d, errors=%d\n", backend.c_str(), dp, tp, steps, error);
+
+    return error;
+}
+
+int main(int argc, char* argv[])
+{
+    int error = 0;
+    for (const auto& backend : {"thread", "socket"}) {
+        error += TestEngineStep(backend, 1, 2, 16);
+        error += TestEngineStep(backend, 2, 2, 16);
+        error += TestEngineStep(backend, 2, 4, 16);
+    }
+    return error != 0;
+}
@@ -2,21 +2,55 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <new>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 #include "src/turbomind/comm/host_comm.h"
 
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
 
 namespace turbomind::comm {
 
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 struct ThreadCommImpl: public HostCommImpl {
 
+    // How the waits of a communicator were satisfied and how long its collectives took
+    struct Stats {
+        uint64_t calls{};
+        uint64_t spin{};   // satisfied while spinning
+        uint64_t yield{};  // satisfied after yielding the core
+        uint64_t sleep{};  // satisfied after sleeping on the futex
+        double   total_us{};
+        double   max_us{};
+    };
+
     class State {
     public:
         explicit State(int n): n_{n}, channels_(n * n) {}
@@ -25,13 +59,98 @@ struct ThreadCommImpl: public HostCommImpl {
             return channels_[from * n_ + to];
         }
 
+        // Spin on `pred` for the hot steps, yield the core for a while, then sleep on the futex until a change of a
+        // channel is announced by `Notify`
+        template<class Pred>
+        void Wait(const Pred& pred, Stats& stats)
+        {
+            for (int i = 0; i < kSpin; ++i) {
+                if (pred()) {
+                    ++stats.spin;
+                    return;
+                }
+                cpu_relax();
+            }
+            for (int i = 0; i < kYield; ++i) {
+                if (pred()) {
+                    ++stats.yield;
+                    return;
+                }
+                std::this_thread::yield();
+            }
+            while (true) {
+                waiters_.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                const uint32_t event = event_.load();
+                if (pred()) {
+                    waiters_.fetch_sub(1);
+                    ++stats.sleep;
+                    return;
+                }
+                futex_wait(event);
+                waiters_.fetch_sub(1);
+            }
+        }
+
+        // Must follow every update of a channel, free of syscalls unless some rank is sleeping
+        void Notify()
+        {
+            // pairs with the fence in `Wait`, either the waiter observes the update or we observe the waiter
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters_.load(std::memory_order_relaxed) > 0) {
+                event_.fetch_add(1);
+                futex_wake_all();
+            }
+        }
+
     private:
+        void futex_wait(uint32_t expected)
+        {
+#ifdef __linux__
+            // bounded, so a lost wake-up costs a timeout instead of a hang
+            timespec timeout{0, 1000000};
+            syscall(SYS_futex, (uint32_t*)&event_, FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0);
+#else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+        }
+
+        void futex_wake_all()
+        {
+#ifdef __linux__
+            syscall(SYS_futex, (uint32_t*)&event_, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+        }
+
+    private:
+        static constexpr int kSpin  = 4096;
+        static constexpr int kYield = 128;
+
         int                            n_;
         std::deque<std::atomic<void*>> channels_;
+
+        alignas(64) std::atomic<uint32_t> event_{};
+        alignas(64) std::atomic<int> waiters_{};
+    };
+
+    // Times a collective into `stats`
+    struct Timer {
+        explicit Timer(Stats& stats): stats_{stats}, start_{std::chrono::steady_clock::now()} {}
+        ~Timer()
+        {
+            const std::chrono::duration<double, std::micro> dt = std::chrono::steady_clock::now() - start_;
+            ++stats_.calls;
+            stats_.total_us += dt.count();
+            stats_.max_us = std::max(stats_.max_us, dt.count());
+        }
+        Stats&                                stats_;
+        std::chrono::steady_clock::time_point start_;
     };
 
     std::shared_ptr<State> state_;
 
+    Stats stats_;
+
     int rank_;  // global rank
 
     std::vector<int> l2g_;
@@ -44,6 +163,22 @@ struct ThreadCommImpl: public HostCommImpl {
         g2l_ = l2g_;
     }
 
+    ~ThreadCommImpl() override
+    {
+        if (stats_.calls) {
+            TM_LOG_DEBUG("[ThreadComm] rank %d of %d: %lu calls, avg %.2f us, max %.2f us, waits: %lu spin, %lu "
+                         "yield, %lu sleep",
+                         rank(),
+                         n_ranks(),
+                         (unsigned long)stats_.calls,
+                         stats_.total_us / stats_.calls,
+                         stats_.max_us,
+                         (unsigned long)stats_.spin,
+                         (unsigned long)stats_.yield,
+                         (unsigned long)stats_.sleep);
+        }
+    }
+
     ThreadCommImpl(std::vector<int> l2g, std::vector<int> g2l, std::shared_ptr<State> state, int rank):
         state_{std::move(state)}, rank_{rank}, l2g_{std::move(l2g)}, g2l_{std::move(g2l)}
     {
@@ -69,6 +204,39 @@ struct ThreadCommImpl: public HostCommImpl {
         return state_->channel(from, to);
     }
 
+    // wait for the channel to be empty and post `data` on it
+    void Post(std::atomic<void*>& c, void* data)
+    {
+        state_->Wait(
+            [&] {
+                void* expected{};
+                return c.compare_exchange_strong(expected, data, std::memory_order_release);
+            },
+            stats_);
+        state_->Notify();
+    }
+
+    // wait for the data posted on the channel
+    void* Receive(std::atomic<void*>& c)
+    {
+        void* incoming{};
+        state_->Wait([&] { return (bool)(incoming = c.load(std::memory_order_acquire)); }, stats_);
+        return incoming;
+    }
+
+    // release the channel after the posted data is consumed
+    void Release(std::atomic<void*>& c)
+    {
+        c.store(nullptr, std::memory_order_release);
+        state_->Notify();
+    }
+
+    // wait for the data posted on the channel to be consumed
+    void WaitEmpty(std::atomic<void*>& c)
+    {
+        state_->Wait([&] { return !c.load(std::memory_order_acquire); }, stats_);
+    }
+
     std::shared_ptr<HostCommImpl> Split(int color, int key) override
     {
         FT_CHECK(color >= 0);
@@ -102,22 +270,17 @@ struct ThreadCommImpl: public HostCommImpl {
         if (n_ranks() == 1) {
             return;
         }
+        Timer timer{stats_};
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c = channel(rank_, r);
-                void* expected{};
-                while (!c.compare_exchange_weak(expected, (void*)1, std::memory_order_release)) {
-                    expected = {};
-                }
+                Post(channel(rank_, r), (void*)1);
             }
         }
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c        = channel(r, rank_);
-                void* expected = (void*)1;
-                while (!c.compare_exchange_weak(expected, nullptr, std::memory_order_acquire)) {
-                    expected = (void*)1;
-                }
+                auto& c = channel(r, rank_);
+                Receive(c);
+                Release(c);
             }
         }
     }
@@ -130,29 +293,23 @@ struct ThreadCommImpl: public HostCommImpl {
         }
         // transform root to global rank
         root = l2g_.at(root);
+        Timer timer{stats_};
         if (rank_ == root) {
             for (const auto& r : l2g_) {
                 if (r != rank_) {
-                    auto& c = channel(rank_, r);
-                    void* expected{};
-                    while (!c.compare_exchange_weak(expected, data, std::memory_order_release)) {
-                        expected = {};
-                    }
+                    Post(channel(rank_, r), data);
                 }
             }
             for (const auto& r : l2g_) {
                 if (r != rank_) {
-                    auto& c = channel(rank_, r);
-                    while (c.load(std::memory_order_relaxed)) {}
+                    WaitEmpty(channel(rank_, r));
                 }
             }
         }
         else {
             auto& c = channel(root, rank_);
-            void* incoming{};
-            while (!(incoming = c.load(std::memory_order_acquire))) {}
-            copy(incoming, count, data, 0);
-            c.store(nullptr, std::memory_order_relaxed);
+            copy(Receive(c), count, data, 0);
+            Release(c);
         }
     }
 
@@ -162,122 +319,51 @@ struct ThreadCommImpl: public HostCommImpl {
         if (n_ranks() == 1) {
             return;
         }
+        Timer timer{stats_};
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c = channel(rank_, r);
-                void* expected{};
-                while (!c.compare_exchange_weak(expected, data, std::memory_order_release)) {
-                    expected = {};
-                }
+                Post(channel(rank_, r), data);
             }
         }
         for (const auto& r : l2g_) {
             if (r != rank_) {
                 auto& c = channel(r, rank_);
-                void* incoming{};
-                while (!(incoming = c.load(std::memory_order_acquire))) {}
-                copy(incoming, count, data, g2l_[r] * count);
-                c.store(nullptr, std::memory_order_relaxed);
+                copy(Receive(c), count, data, g2l_[r] * count);
+                Release(c);
             }
         }
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c = channel(rank_, r);
-                while (c.load(std::memory_order_relaxed)) {}
-            }
-        }
-    }
-
-    template<class T, RedOp op>
-    static void reduce(void* src, int n, void* dst, int offset)
-    {
-        for (int i = 0; i < n; ++i) {
-            auto& s = *((T*)src + offset + i);
-            auto& a = *((T*)dst + offset + i);
-            if constexpr (op == RedOp::kSum) {
-                a += s;
-            }
-            else if constexpr (op == RedOp::kMin) {
-                a = std::min(a, s);
-            }
-            else if constexpr (op == RedOp::kMax) {
-                a = std::max(a, s);
-            }
-            else {
-                static_assert(sizeof(T) != sizeof(T), "not implemented");
+                WaitEmpty(channel(rank_, r));
             }
         }
     }
 
-    static reduce_fn get_reduce(DataType dtype, RedOp red_op)
-    {
-        auto dispatch_op = [&](auto t) -> reduce_fn {
-            using T = decltype(t);
-            switch (red_op) {
-                case RedOp::kSum:
-                    return reduce<T, RedOp::kSum>;
-                case RedOp::kMax:
-                    return reduce<T, RedOp::kMax>;
-                case RedOp::kMin:
-                    return reduce<T, RedOp::kMin>;
-                default:
-                    return {};
-            }
-        };
-        auto dispatch = [&]() -> reduce_fn {
-            switch (dtype) {
-                case DataType::TYPE_INT32:
-                    return dispatch_op(int32_t{});
-                case DataType::TYPE_INT64:
-                    return dispatch_op(int64_t{});
-                case DataType::TYPE_UINT32:
-                    return dispatch_op(uint32_t{});
-                case DataType::TYPE_UINT64:
-                    return dispatch_op(uint64_t{});
-                default:
-                    return {};
-            }
-        };
-        if (auto fn = dispatch()) {
-            return fn;
-        }
-        else {
-            throw std::runtime_error("not implemented");
-            return {};
-        }
-    }
-
     void AllReduce(void* data, int count, DataType dtype, RedOp red_op) override
     {
-        const auto reduce    = get_reduce(dtype, red_op);
+        const auto reduce    = GetReduceFn(dtype, red_op);
         const auto elem_size = get_elem_size(dtype);
         if (n_ranks() == 1) {
             return;
         }
         std::unique_ptr<char[]> tmp((char*)::operator new[](elem_size* count));
+        Timer timer{stats_};
         std::copy_n((char*)data, elem_size * count, tmp.get());
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c = channel(rank_, r);
-                void* expected{};
-                while (!c.compare_exchange_weak(expected, (void*)tmp.get(), std::memory_order_release)) {
-                    expected = {};
-                }
+                Post(channel(rank_, r), (void*)tmp.get());
             }
         }
         for (const auto& r : l2g_) {
             if (r != rank_) {
                 auto& c = channel(r, rank_);
-                void* incoming{};
-                while (!(incoming = c.load(std::memory_order_acquire))) {}
-                reduce(incoming, count, data, 0);
-                c.store(nullptr, std::memory_order_relaxed);
+                reduce(Receive(c), count, data, 0);
+                Release(c);
             }
         }
         for (const auto& r : l2g_) {
             if (r != rank_) {
-                auto& c = channel(rank_, r);
-                while (c.load(std::memory_order_relaxed)) {}
+                WaitEmpty(channel(rank_, r));
             }
         }
     }
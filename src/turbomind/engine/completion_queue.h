@@ -0,0 +1,78 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace turbomind {
+
+// Tags of the requests with new states, pushed by the signal thread of the gateway instead of a callback per request
+// and drained in bulk by the frontend. The eventfd is written once per batch, when the queue becomes non-empty, so
+// an event loop polling it wakes up once for all the updates in between. `fd()` is -1 where eventfd is missing.
+class CompletionQueue {
+public:
+    CompletionQueue()
+    {
+#ifdef __linux__
+        fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    }
+
+    ~CompletionQueue()
+    {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    int fd() const noexcept
+    {
+        return fd_;
+    }
+
+    void push(uint64_t tag)
+    {
+        std::lock_guard lock{mutex_};
+        tags_.push_back(tag);
+#ifdef __linux__
+        if (tags_.size() == 1 && fd_ >= 0) {
+            const uint64_t one = 1;
+            [[maybe_unused]] auto ret = write(fd_, &one, sizeof(one));
+        }
+#endif
+    }
+
+    // take the tags in the order of the updates, a tag appears once per update; `tags` is overwritten
+    void drain(std::vector<uint64_t>& tags)
+    {
+        tags.clear();
+        std::lock_guard lock{mutex_};
+        tags.swap(tags_);
+#ifdef __linux__
+        if (fd_ >= 0) {
+            uint64_t count{};
+            [[maybe_unused]] auto ret = read(fd_, &count, sizeof(count));
+        }
+#endif
+    }
+
+private:
+    int fd_{-1};
+
+    std::mutex            mutex_;
+    std::vector<uint64_t> tags_;
+};
+
+}  // namespace turbomind
@@ -0,0 +1,252 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include <yaml-cpp/yaml.h>
+
+#include "src/turbomind/engine/detokenizer.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+namespace {
+
+// code point of the UTF-8 sequence at `p`, which is advanced past it
+uint32_t NextCodePoint(const std::string& s, size_t& p)
+{
+    const auto c = (uint8_t)s[p];
+    const int  n = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+    uint32_t   x = n == 1 ? c : c & (0x3f >> (n - 1));
+    for (int i = 1; i < n && p + i < s.size(); ++i) {
+        x = x << 6 | ((uint8_t)s[p + i] & 0x3f);
+    }
+    p += n;
+    return x;
+}
+
+void AppendCodePoint(uint32_t x, std::string& s)
+{
+    if (x < 0x80) {
+        s += (char)x;
+    }
+    else if (x < 0x800) {
+        s += (char)(0xc0 | x >> 6);
+        s += (char)(0x80 | (x & 0x3f));
+    }
+    else if (x < 0x10000) {
+        s += (char)(0xe0 | x >> 12);
+        s += (char)(0x80 | (x >> 6 & 0x3f));
+        s += (char)(0x80 | (x & 0x3f));
+    }
+    else {
+        s += (char)(0xf0 | x >> 18);
+        s += (char)(0x80 | (x >> 12 & 0x3f));
+        s += (char)(0x80 | (x >> 6 & 0x3f));
+        s += (char)(0x80 | (x & 0x3f));
+    }
+}
+
+// Inverse of `bytes_to_unicode` of GPT-2, printable bytes map to themselves and the others to 256 + n in order
+std::array<int, 324> ByteLevelTable()
+{
+    std::array<int, 324> table;
+    table.fill(-1);
+    int n = 0;
+    for (int b = 0; b < 256; ++b) {
+        const bool printable = (b >= 33 && b <= 126) || (b >= 161 && b <= 172) || (b >= 174 && b <= 255);
+        table[printable ? b : 256 + n++] = b;
+    }
+    return table;
+}
+
+std::string DecodeByteLevel(const std::string& piece, const std::array<int, 324>& table)
+{
+    std::string bytes;
+    for (size_t p = 0; p < piece.size();) {
+        const auto x = NextCodePoint(piece, p);
+        if (x < table.size() && table[x] >= 0) {
+            bytes += (char)table[x];
+        }
+        else {
+            AppendCodePoint(x, bytes);
+        }
+    }
+    return bytes;
+}
+
+std::string DecodeMetaspace(const std::string& piece, bool byte_fallback)
+{
+    // <0xNN>
+    if (byte_fallback && piece.size() == 6 && piece.compare(0, 3, "<0x") == 0 && piece.back() == '>'
+        && std::isxdigit(piece[3]) && std::isxdigit(piece[4])) {
+        return std::string(1, (char)std::stoi(piece.substr(3, 2), nullptr, 16));
+    }
+    static const std::string kSpace = "\xe2\x96\x81";  // U+2581
+    std::string              bytes;
+    for (size_t p = 0; p < piece.size();) {
+        if (piece.compare(p, kSpace.size(), kSpace) == 0) {
+            bytes += ' ';
+            p += kSpace.size();
+        }
+        else {
+            bytes += piece[p++];
+        }
+    }
+    return bytes;
+}
+
+// length of the prefix of `s` ending with a complete UTF-8 character
+size_t CompleteLength(const std::string& s)
+{
+    for (size_t i = 0; i < std::min<size_t>(s.size(), 4); ++i) {
+        const auto c = (uint8_t)s[s.size() - 1 - i];
+        if ((c & 0xc0) != 0x80) {  // the lead byte of the last character
+            const size_t n = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+            return n > i + 1 ? s.size() - 1 - i : s.size();
+        }
+    }
+    return s.size();  // invalid, flushed as is
+}
+
+}  // namespace
+
+Detokenizer::Detokenizer(const std::string& path, int threads, std::function<std::shared_ptr<void>()> ctx_factory):
+    ctx_factory_{std::move(ctx_factory)}
+{
+    // JSON is a subset of YAML 1.2
+    const auto root  = YAML::LoadFile(path);
+    const auto model = root["model"];
+    const auto vocab = model["vocab"];
+
+    FT_CHECK_WITH_INFO(vocab.IsMap() || vocab.IsSequence(), fmtstr("No vocab found in %s", path.c_str()));
+
+    const auto decoder    = root["decoder"];
+    const bool byte_level = decoder && decoder["type"].as<std::string>("") == "ByteLevel";
+    const bool fallback   = model["byte_fallback"].as<bool>(false);
+    const auto table      = ByteLevelTable();
+
+    auto set = [&](int id, std::string bytes) {
+        if (id >= (int)pieces_.size()) {
+            pieces_.resize(id + 1);
+        }
+        pieces_[id] = std::move(bytes);
+    };
+
+    auto decode = [&](const std::string& piece) {
+        return byte_level ? DecodeByteLevel(piece, table) : DecodeMetaspace(piece, fallback);
+    };
+
+    if (vocab.IsMap()) {  // BPE, piece -> id
+        for (const auto& kv : vocab) {
+            set(kv.second.as<int>(), decode(kv.first.as<std::string>()));
+        }
+    }
+    else {  // Unigram, [piece, score]
+        for (size_t i = 0; i < vocab.size(); ++i) {
+            set(i, decode(vocab[i][0].as<std::string>()));
+        }
+    }
+
+    // added tokens are not encoded by the model
+    for (const auto& x : root["added_tokens"]) {
+        set(x["id"].as<int>(), x["special"].as<bool>(false) ? std::string{} : x["content"].as<std::string>());
+    }
+
+    TM_LOG_INFO("[Detokenizer] %d tokens (%s) from %s, %d threads",
+                (int)pieces_.size(),
+                byte_level ? "byte-level" : "metaspace",
+                path.c_str(),
+                threads);
+
+    for (int i = 0; i < threads; ++i) {
+        buffers_.push_back(std::make_unique<SignalBuffer>());
+    }
+    for (int i = 0; i < threads; ++i) {
+        workers_.emplace_back(&Detokenizer::worker_entry, this, i);
+    }
+}
+
+Detokenizer::~Detokenizer()
+{
+    for (auto& b : buffers_) {
+        b->close();
+    }
+    for (auto& t : workers_) {
+        t.join();
+    }
+}
+
+void Detokenizer::push(Signal signal)
+{
+    std::vector<Signal> signals;
+    const auto          index = signal.request()->id % buffers_.size();
+    signals.push_back(std::move(signal));
+    buffers_[index]->push(signals);
+}
+
+void Detokenizer::Decode(const int* token_ids, int n, std::string& out) const
+{
+    for (int i = 0; i < n; ++i) {
+        if (0 <= token_ids[i] && token_ids[i] < (int)pieces_.size()) {
+            out += pieces_[token_ids[i]];
+        }
+    }
+}
+
+void Detokenizer::Process(const Signal& signal) const
+{
+    auto& r = *signal.request();
+    auto& t = *r.text_output;
+
+    if (signal.seq_len() > t.offset) {
+        Decode(r.output_ids.getPtr<int>() + t.offset, signal.seq_len() - t.offset, t.pending);
+        t.offset = signal.seq_len();
+    }
+
+    // incomplete characters are held back until the request is done
+    const size_t n = signal.status() == Request::kOk ? CompleteLength(t.pending) : t.pending.size();
+    if (n) {
+        int&         len   = *t.length.getPtr<int>();
+        const size_t count = std::min(n, t.text.sizeBytes() - len);
+        if (count < n && !t.truncated) {
+            TM_LOG_WARNING("[Detokenizer] Text output of (%lu) is truncated at %d bytes", r.id, len);
+            t.truncated = true;
+        }
+        std::copy_n(t.pending.data(), count, t.text.getPtr<char>() + len);
+        len += count;
+        t.pending.erase(0, n);
+    }
+
+    signal();
+}
+
+void Detokenizer::worker_entry(int index) noexcept
+{
+    std::vector<Signal> signals;
+    while (true) {
+        bool abort{};
+        buffers_[index]->take_all(signals, abort);
+        if (abort) {
+            break;
+        }
+        auto ctx = ctx_factory_();
+        for (const auto& s : signals) {
+            try {
+                Process(s);
+            }
+            catch (const std::exception& e) {
+                TM_LOG_ERROR("[Detokenizer] %s", e.what());
+                s();
+            }
+        }
+        signals.clear();
+    }
+}
+
+}  // namespace turbomind
@@ -0,0 +1,54 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/turbomind/engine/request.h"
+#include "src/turbomind/engine/signal_buffer.h"
+
+namespace turbomind {
+
+// Native incremental detokenizer of the generated tokens, loaded from the `tokenizer.json` of HF tokenizers with
+// byte-level BPE (GPT-2 style) or metaspace (sentencepiece style, with byte fallback) vocabs. The state updates of
+// requests with `text_output` are handed over by the signal thread of the gateway, the text of the new tokens is
+// appended to the outputs before the update is published. Special tokens are skipped.
+class Detokenizer {
+public:
+    // bytes of the text buffer reserved per output token
+    static constexpr int kMaxBytesPerToken = 16;
+
+    Detokenizer(const std::string& path, int threads, std::function<std::shared_ptr<void>()> ctx_factory);
+
+    ~Detokenizer();
+
+    // the signals of a request are processed in order by the same worker
+    void push(Signal signal);
+
+    // append the bytes of the tokens to `out`
+    void Decode(const int* token_ids, int n, std::string& out) const;
+
+    size_t vocab_size() const noexcept
+    {
+        return pieces_.size();
+    }
+
+private:
+    void worker_entry(int index) noexcept;
+
+    void Process(const Signal& signal) const;
+
+private:
+    std::vector<std::string> pieces_;  // token id -> bytes
+
+    std::function<std::shared_ptr<void>()> ctx_factory_;
+
+    std::vector<std::unique_ptr<SignalBuffer>> buffers_;
+    std::vector<std::thread>                   workers_;
+};
+
+}  // namespace turbomind
@@ -1,32 +1,227 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include <climits>
+#include <cstdlib>
 #include <memory>
+#include <string>
 
 #include "src/turbomind/engine/gateway.h"
 #include "src/turbomind/engine/request_queue.h"
+#include "src/turbomind/utils/cuda_utils.h"
 
 namespace turbomind {
 
-Gateway::Gateway(int groups, int group_size, std::function<std::shared_ptr<void>()> ctx_factory):
+Gateway::Gateway(int                                    groups,
+                 int                                    group_size,
+                 std::function<std::shared_ptr<void>()> ctx_factory,
+                 int                                    routing_block_len):
     size_{groups * group_size},
     group_size_{group_size},
     queues_(size_),
     flags_(groups),
+    loads_(size_),
     ctx_factory_{ctx_factory},
     next_{0}
 {
     for (int i = 0; i < groups; ++i) {
         flags_[i] = std::make_unique<std::atomic<uint64_t>>(0);
     }
+    for (int i = 0; i < size_; ++i) {
+        loads_[i] = std::make_unique<std::atomic<int>>(0);
+    }
+
+    auto& metrics = MetricsRegistry::instance();
+    for (int i = 0; i < size_; ++i) {
+        const auto labels = fmtstr("dp_rank=\"%d\"", i);
+        received_.push_back(metrics.counter("tm_requests_total", "Requests pushed to the queue", labels));
+        queue_depth_.push_back(metrics.gauge("tm_request_queue_depth", "Requests waiting in the queue", labels));
+        dropped_.push_back(metrics.counter("tm_requests_dropped_total", "New sessions dropped by the queue", labels));
+    }
+
+    // `TM_REQUEST_QUEUE=ring` selects the lock-free queue
+    bool use_ring = false;
+    if (auto str = std::getenv("TM_REQUEST_QUEUE")) {
+        use_ring = std::string{str} == "ring";
+    }
 
     for (int i = 0; i < size_; ++i) {
         const int group_id = i / group_size;
-        queues_[i]         = std::make_unique<RequestQueue>(flags_[group_id].get());
+        if (use_ring) {
+            queues_[i] = std::make_unique<RingRequestQueue>(flags_[group_id].get());
+        }
+        else {
+            queues_[i] = std::make_unique<MutexRequestQueue>(flags_[group_id].get());
+        }
+    }
+
+    if (routing_block_len > 0 && size_ > 1) {
+        FT_CHECK(size_ <= 64);
+        prefix_index_ = std::make_unique<PrefixIndex>(routing_block_len);
     }
 
     signal_thread_ = std::thread(&Gateway::signal_thread_entry, this);
 }
 
+bool Gateway::make_room(std::shared_ptr<Request>& r, int rank)
+{
+    // The depth is sampled without holding the queue, concurrent producers may overshoot the limit slightly
+    if (queues_[rank]->size() < max_queue_depth_) {
+        return true;
+    }
+
+    if (auto victim = queues_[rank]->shed(*r, queue_policy_)) {
+        dropped_[rank]->add();
+        // a canceled victim is already notified
+        if (victim->cancel_flag.exchange(1, std::memory_order_acq_rel) == 0) {
+            notify({{std::move(victim), Request::kOverload, 0}});
+        }
+        return true;
+    }
+
+    dropped_[rank]->add();
+    if (r->cancel_flag.exchange(1, std::memory_order_acq_rel) == 0) {
+        notify({{std::move(r), Request::kOverload, 0}});
+    }
+    return false;
+}
+
+void Gateway::drop_expired(std::vector<std::shared_ptr<Request>>& infer_reqs, int rank)
+{
+    const int64_t now = RequestMetrics::now();
+
+    std::vector<Signal> signals;
+    size_t              n = 0;
+    for (auto& r : infer_reqs) {
+        if (r->session.start_flag && r->session.deadline && r->session.deadline < now) {
+            signals.emplace_back(std::move(r), Request::kOverload, 0);
+        }
+        else {
+            infer_reqs[n++] = std::move(r);
+        }
+    }
+    infer_reqs.resize(n);
+
+    if (!signals.empty()) {
+        dropped_[rank]->add(signals.size());
+        notify(signals);
+    }
+}
+
+int Gateway::route(const Request& r)
+{
+    const int start = next_.fetch_add(1, std::memory_order_relaxed) % size_;
+
+    if (!r.inputs.isExist("input_ids") || r.inputs.isExist("input_embedding_ranges")) {
+        return start;
+    }
+
+    const auto& input_ids = r.inputs.at("input_ids");
+
+    std::vector<uint64_t> keys;
+    prefix_index_->hash(input_ids.getPtr<int>(), input_ids.shape[0], keys);
+
+    std::vector<int> scores(size_);
+    prefix_index_->score(keys, scores);
+
+    // a queued request costs about as much as recomputing one block
+    int rank = start, best = INT_MIN;
+    for (int i = 0; i < size_; ++i) {
+        const int idx   = (start + i) % size_;
+        const int score = scores[idx] - queues_[idx]->size();
+        if (score > best) {
+            rank = idx;
+            best = score;
+        }
+    }
+
+    prefix_index_->insert(keys, rank);
+
+    return rank;
+}
+
+int Gateway::migrate_to(const Request& r, int rank)
+{
+    if (!migrate_threshold_ || size_ == 1 || r.transfer || !r.inputs.isExist("input_ids")) {
+        return -1;
+    }
+
+    auto load = [&](int i) { return loads_[i]->load(std::memory_order_relaxed) + (int)queues_[i]->size(); };
+
+    int to = rank, min_load = load(rank);
+    for (int i = 0; i < size_; ++i) {
+        if (const int x = load(i); x < min_load) {
+            to       = i;
+            min_load = x;
+        }
+    }
+
+    if (load(rank) - min_load < migrate_threshold_) {
+        return -1;
+    }
+
+    std::lock_guard lock{migrating_mutex_};
+    // the other requests of a migrating session go to its old rank
+    return migrating_.insert(r.session.id).second ? to : -1;
+}
+
+// export (held) on `from` -> import on `to` -> drop on `from`, the request runs on `to` when the kv cache is in
+// place or on `from` if the migration fails
+void Gateway::migrate(std::shared_ptr<Request> r, int from, int to)
+{
+    const uint64_t id = r->session.id;
+
+    auto t       = std::make_shared<KvTransfer>();
+    t->op        = KvTransfer::kExport;
+    t->peer      = -1;
+    t->release   = false;
+    t->migration = std::make_shared<KvTransfer::Migration>();
+
+    auto make = [id, t](std::function<void(int)> cb) {
+        auto x = std::make_shared<Request>();
+        x->id = x->session.id = id;
+        x->transfer           = t;
+        x->end_cb             = std::move(cb);
+        return x;
+    };
+
+    auto finish = [this, id, r](int rank) mutable {
+        {
+            std::lock_guard lock{migrating_mutex_};
+            migrating_.erase(id);
+        }
+        queues_[rank]->push({std::move(r)});
+    };
+
+    auto on_import = [this, t, make, finish, id, from, to](int ec) mutable {
+        t->op      = KvTransfer::kDrop;
+        t->release = ec == Request::kOk;
+        if (ec == Request::kOk) {
+            TM_LOG_INFO("[Gateway] Session %lu migrated from rank %d to %d", (long)id, from, to);
+            seqid2rank_.rebind(id, from, to);
+            queues_[from]->kill(make({}));
+            finish(to);
+        }
+        else {
+            // the request goes after the sequence is unlocked
+            queues_[from]->kill(make([finish, from](int) mutable { finish(from); }));
+        }
+    };
+
+    auto on_export = [this, t, make, finish, on_import, from, to](int ec) mutable {
+        if (ec != Request::kOk) {
+            finish(from);
+            return;
+        }
+        t->op  = KvTransfer::kImport;
+        auto x = make(std::move(on_import));
+        // imports create the sequence
+        x->session.start_flag = true;
+        queues_[to]->kill(std::move(x));
+    };
+
+    queues_[from]->kill(make(std::move(on_export)));
+}
+
 void Gateway::shutdown()
 {
     for (auto& q : queues_) {
@@ -35,21 +230,31 @@ void Gateway::shutdown()
 
     signal_buffer_.close();
     signal_thread_.join();
+
+    detokenizer_.reset();
 }
 
 void Gateway::signal_thread_entry() noexcept
 {
+    std::vector<Signal> signals;
     while (true) {
-        bool                abort{};
-        std::vector<Signal> signals = signal_buffer_.take_all(abort);
+        bool abort{};
+        signal_buffer_.take_all(signals, abort);
         if (abort) {
             break;
         }
         else {
             auto ctx = ctx_factory_();
-            for (const auto& s : signals) {
-                s();
+            for (auto& s : signals) {
+                if (detokenizer_ && s.request() && s.request()->text_output) {
+                    detokenizer_->push(std::move(s));
+                }
+                else {
+                    s();
+                }
             }
+            // keep the capacity, requests are released here instead of the engine threads
+            signals.clear();
         }
     }
 }
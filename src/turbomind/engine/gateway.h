@@ -3,15 +3,20 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "src/turbomind/engine/detokenizer.h"
 #include "src/turbomind/engine/request.h"
 #include "src/turbomind/engine/request_queue.h"
 #include "src/turbomind/engine/signal_buffer.h"
 #include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/metrics.h"
 
 namespace turbomind {
 
@@ -36,6 +41,15 @@ public:
         }
     }
 
+    // a migrated sequence
+    void rebind(uint64_t seq_id, int from, int to)
+    {
+        std::lock_guard lock{mutex_};
+        if (auto it = map_.find(seq_id); it != map_.end() && it->second == from) {
+            it->second = to;
+        }
+    }
+
     void unbind(const std::vector<uint64_t>& seq_ids, int rank)
     {
         std::lock_guard lock{mutex_};
@@ -58,9 +72,69 @@ private:
     std::unordered_map<uint64_t, int> map_;
 };
 
+// Approximate view of the prefix caches of the DP ranks. The tries are owned by the engine threads, so the
+// gateway keeps its own record of the prompt blocks it has routed to each rank, keyed by the hash chain of
+// the block tokens. Oldest keys are dropped when the capacity is reached, as the ranks evict their blocks.
+class PrefixIndex {
+public:
+    explicit PrefixIndex(int block_len, size_t capacity = 1 << 20): block_len_{block_len}, capacity_{capacity} {}
+
+    void hash(const int* tokens, int n, std::vector<uint64_t>& keys) const
+    {
+        keys.clear();
+        uint64_t key = 0;
+        // the last (partial) block is never cached
+        for (int i = 0; i + block_len_ < n; i += block_len_) {
+            for (int j = i; j < i + block_len_; ++j) {
+                key ^= (uint64_t)tokens[j] + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+            }
+            keys.push_back(key);
+        }
+    }
+
+    // number of leading blocks found for each rank
+    void score(const std::vector<uint64_t>& keys, std::vector<int>& scores)
+    {
+        std::lock_guard lock{mutex_};
+        uint64_t        mask = ~0ull;
+        for (size_t i = 0; i < keys.size() && mask; ++i) {
+            auto it = map_.find(keys[i]);
+            mask &= it == map_.end() ? 0 : it->second;
+            for (size_t r = 0; r < scores.size(); ++r) {
+                scores[r] += (mask >> r) & 1;
+            }
+        }
+    }
+
+    void insert(const std::vector<uint64_t>& keys, int rank)
+    {
+        std::lock_guard lock{mutex_};
+        for (const auto& k : keys) {
+            auto [it, success] = map_.emplace(k, 0);
+            it->second |= 1ull << rank;
+            if (success) {
+                fifo_.push_back(k);
+            }
+        }
+        while (fifo_.size() > capacity_) {
+            map_.erase(fifo_.front());
+            fifo_.pop_front();
+        }
+    }
+
+private:
+    const int    block_len_;
+    const size_t capacity_;
+
+    std::mutex                             mutex_;
+    std::unordered_map<uint64_t, uint64_t> map_;  // key -> mask of ranks
+    std::deque<uint64_t>                   fifo_;
+};
+
 class Gateway {
 public:
-    Gateway(int groups, int group_size, std::function<std::shared_ptr<void>()> ctx_factory);
+    // `routing_block_len > 0` enables prefix-aware routing of new sessions
+    Gateway(int groups, int group_size, std::function<std::shared_ptr<void>()> ctx_factory, int routing_block_len = 0);
 
     void shutdown();
 
@@ -71,19 +145,30 @@ public:
         if (!r->session.start_flag) {
             // route to corresponding rank
             rank = seqid2rank_.find(r->session.id);
+            if (const int to = rank >= 0 ? migrate_to(*r, rank) : -1; to >= 0) {
+                return migrate(std::move(r), rank, to);
+            }
+        }
+        else if (r->session.fork_flag && (rank = seqid2rank_.find(r->session.parent_id)) >= 0) {
+            // forks go to the rank holding the kv cache of the parent
+        }
+        else if (prefix_index_) {
+            rank = route(*r);
         }
         else {
             rank = next_.fetch_add(1, std::memory_order_relaxed) % size_;
         }
 
         if (rank >= 0) {
+            if (r->session.start_flag && max_queue_depth_ && !make_room(r, rank)) {
+                return;
+            }
+            received_[rank]->add();
             queues_[rank]->push({std::move(r)});
         }
         else {
             TM_LOG_ERROR("[TM][Gateway] Failed to find a binded queue for %lu", r->session.id);
-            notify({[r = std::move(r)] {  //
-                UpdateState(*r, Request::kInvalid, 0);
-            }});
+            notify({{std::move(r), Request::kInvalid, 0}});
         }
     }
 
@@ -120,6 +205,8 @@ public:
             }
         }
 
+        drop_expired(infer_reqs, rank);
+
         // if (infer_reqs.empty() && kill_reqs.empty()) {
         //     TM_LOG_INFO("[Queue][%d] Wake up with no requests", rank);
         // }
@@ -138,23 +225,34 @@ public:
             seqid2rank_.bind(bind_ids, rank);
         }
 
-        // Unbind for stateful kill
+        // Unbind for stateful kill, kv cache transfers bind imported sessions and unbind released ones. Migrations
+        // rebind their sessions when done
         std::vector<uint64_t> unbind_ids;
+        bind_ids.clear();
         for (const auto& r : kill_reqs) {
-            unbind_ids.push_back(r->session.id);
+            if (r->transfer && r->transfer->migration) {
+                continue;
+            }
+            if (!r->transfer || r->transfer->release) {
+                unbind_ids.push_back(r->session.id);
+            }
+            else if (r->transfer->op == KvTransfer::kImport) {
+                bind_ids.push_back(r->session.id);
+            }
         }
         if (!unbind_ids.empty()) {
             seqid2rank_.unbind(unbind_ids, rank);
         }
+        if (!bind_ids.empty()) {
+            seqid2rank_.bind(bind_ids, rank);
+        }
     }
 
     void cancel(std::shared_ptr<Request> r)
     {
         // {-1: canceled, 0: queued, 1: active}
         if (r->cancel_flag.exchange(-1, std::memory_order_acq_rel) == 0) {
-            notify({[r = std::move(r)] {  //
-                UpdateState(*r, Request::kCancel, 0);
-            }});
+            notify({{std::move(r), Request::kCancel, 0}});
         }
         else {
             // request is picked up by engine
@@ -168,35 +266,147 @@ public:
         }
         else {
             TM_LOG_ERROR("[Gateway] Failed to find a binded queue for %lu", r->session.id);
-            notify({[r = std::move(r)] {  //
-                UpdateState(*r, Request::kInvalid, 0);
-            }});
+            notify({{std::move(r), Request::kInvalid, 0}});
         }
     }
 
-    void notify(std::vector<Signal> signals)
+    // exports go to the rank of the session, imports are distributed like new sessions
+    void transfer(std::shared_ptr<Request> r)
     {
-        return signal_buffer_.push(std::move(signals));
+        int rank = -1;
+        if (r->transfer->op == KvTransfer::kExport) {
+            rank = seqid2rank_.find(r->session.id);
+        }
+        else {
+            rank = next_.fetch_add(1, std::memory_order_relaxed) % size_;
+        }
+
+        if (rank >= 0) {
+            queues_[rank]->kill(std::move(r));
+        }
+        else {
+            TM_LOG_ERROR("[Gateway] Failed to find a binded queue for %lu", r->session.id);
+            notify({Signal{[r = std::move(r)] {
+                if (r->end_cb) {
+                    r->end_cb(Request::kInvalid);
+                }
+            }}});
+        }
+    }
+
+    // Continuations of sessions bound to a rank with `threshold` more sequences than the least loaded one are
+    // migrated with their kv cache before they run, 0 disables
+    void enable_migration(int threshold)
+    {
+        migrate_threshold_ = threshold;
+    }
+
+    // New sessions arriving at a rank with `depth` queued requests make room according to `policy`, 0 for unbounded
+    void set_queue_limit(int depth, QueuePolicy policy)
+    {
+        max_queue_depth_ = depth;
+        queue_policy_    = policy;
+    }
+
+    // Requests are served earliest deadline first, the ones without a deadline are due `slack` (us) after they were
+    // queued, 0 for FIFO
+    void set_deadline_order(int64_t slack)
+    {
+        for (auto& q : queues_) {
+            q->set_deadline_order(slack);
+        }
+    }
+
+    // Requests are served shortest expected output first, the order is the one of the hints
+    void set_length_order(bool enable)
+    {
+        for (auto& q : queues_) {
+            q->set_length_order(enable);
+        }
+    }
+
+    // sequences in the batch of `rank`, reported by its engine every step
+    void report_load(int rank, int count)
+    {
+        queue_depth_[rank]->set(queues_[rank]->size());
+        loads_[rank]->store(count, std::memory_order_relaxed);
+    }
+
+    // Decode the text of the requests with `text_output` on `threads` workers beside the signal thread, called
+    // before any request is pushed
+    void enable_detokenizer(const std::string& path, int threads)
+    {
+        detokenizer_ = std::make_unique<Detokenizer>(path, threads, ctx_factory_);
+    }
+
+    const Detokenizer* detokenizer() const noexcept
+    {
+        return detokenizer_.get();
+    }
+
+    // wake the engine of `rank` blocked in `pop`, e.g. for work outside of the requests
+    void interrupt(int rank)
+    {
+        queues_[rank]->interrupt();
+    }
+
+    // take the signals, `signals` is left empty (with recycled capacity)
+    void notify(std::vector<Signal>& signals)
+    {
+        return signal_buffer_.push(signals);
+    }
+
+    void notify(std::vector<Signal>&& signals)
+    {
+        return signal_buffer_.push(signals);
     }
 
 private:
     void signal_thread_entry() noexcept;
 
+    int route(const Request& r);
+
+    int migrate_to(const Request& r, int rank);
+
+    void migrate(std::shared_ptr<Request> r, int from, int to);
+
+    // false when `r` is rejected by the full queue of `rank`
+    bool make_room(std::shared_ptr<Request>& r, int rank);
+
+    // new sessions that were still queued at their deadline
+    void drop_expired(std::vector<std::shared_ptr<Request>>& infer_reqs, int rank);
+
 private:
     const int size_;
     const int group_size_;
 
     std::vector<std::unique_ptr<RequestQueue>>          queues_;
     std::vector<std::unique_ptr<std::atomic<uint64_t>>> flags_;
+    std::vector<std::unique_ptr<std::atomic<int>>>      loads_;
+
+    std::vector<Counter*> received_;     // requests pushed to each rank
+    std::vector<Gauge*>   queue_depth_;  // requests waiting in the queue of each rank, sampled by `report_load`
+    std::vector<Counter*> dropped_;      // new sessions rejected, shed or expired in the queue of each rank
 
     std::function<std::shared_ptr<void>()> ctx_factory_;
 
     SignalBuffer signal_buffer_;
     std::thread  signal_thread_;
 
+    std::unique_ptr<Detokenizer> detokenizer_;
+
     SeqId2Rank seqid2rank_;
 
     std::atomic<uint32_t> next_;
+
+    std::unique_ptr<PrefixIndex> prefix_index_;
+
+    int         max_queue_depth_{};
+    QueuePolicy queue_policy_{};
+
+    int                          migrate_threshold_{};
+    std::mutex                   migrating_mutex_;
+    std::unordered_set<uint64_t> migrating_;
 };
 
 }  // namespace turbomind
@@ -83,12 +83,25 @@ void ModelRequest::End(std::function<void(int)> cb, uint64_t session_id)
     gateway_->kill(std::move(r));
 }
 
+void ModelRequest::Transfer(std::shared_ptr<KvTransfer> transfer, std::function<void(int)> cb, uint64_t session_id)
+{
+    auto r = std::make_shared<Request>();
+
+    r->id = r->session.id = session_id;
+    r->session.start_flag = transfer->op == KvTransfer::kImport;
+
+    r->transfer = std::move(transfer);
+    r->end_cb   = std::move(cb);
+
+    gateway_->transfer(std::move(r));
+}
+
 auto ModelRequest::Forward(InputParam param, std::function<void()> cb) -> OutputParam
 {
     inputs_  = std::make_shared<TensorMap_>();
     outputs_ = std::make_shared<TensorMap_>();
 
-    auto add = [](auto& dest, auto key, auto dtype, auto where, auto shape, auto&&... dims) {
+    auto add = [&](auto& dest, auto key, auto dtype, auto where, auto shape, auto&&... dims) {
         std::vector<int64_t> shape_;
         if constexpr (std::is_integral_v<decltype(shape)>) {
             shape_ = {shape, dims...};
@@ -97,6 +110,24 @@ auto ModelRequest::Forward(InputParam param, std::function<void()> cb) -> Output
             shape_ = {shape.cbegin(), shape.cend()};
         }
         int64_t byte_size{};
+        // Write directly to the buffer provided by the caller, if any
+        if (param.outputs) {
+            if (auto it = param.outputs->find(key); it != param.outputs->end()) {
+                const Tensor& t = *it->second;
+                byte_size       = std::accumulate(
+                    shape_.begin(), shape_.end(), Tensor::getTypeSize(dtype), std::multiplies<>{});
+                FT_CHECK_WITH_INFO(t.type == dtype, fmtstr("type mismatch for output `%s`", key));
+                FT_CHECK_WITH_INFO(t.sizeBytes() >= (size_t)byte_size, fmtstr("output `%s` is too small", key));
+                // tensors other than these are written by `cudaMemcpyAsync` and may reside on device
+                const std::string name = key;
+                if (name == "output_ids" || name == "sequence_length" || name == "output_text"
+                    || name == "text_length") {
+                    FT_CHECK_WITH_INFO(t.where != MEMORY_GPU, fmtstr("output `%s` must be on host", key));
+                }
+                dest->emplace(key, it->second);
+                return std::make_pair(t.data, byte_size);
+            }
+        }
         auto    it = dest->emplace(key, create(dtype, where, shape_, byte_size)).first;
         return std::make_pair(it->second->data, byte_size);
     };
@@ -132,12 +163,26 @@ auto ModelRequest::Forward(InputParam param, std::function<void()> cb) -> Output
         add(outputs_, "last_hidden_state", data_type_, MEMORY_CPU, len, hidden_dim_);
     }
 
+    if (param.gen_cfg.score) {
+        add(outputs_, "prompt_logprobs", TYPE_FP32, MEMORY_CPU, input_len);
+    }
+
+    if (param.gen_cfg.pooling) {
+        add(outputs_, "pooled_hidden_state", TYPE_FP32, MEMORY_CPU, hidden_dim_);
+    }
+
     if (param.gen_cfg.output_logprobs) {
         add(outputs_, "logprob_vals", data_type_, MEMORY_CPU, max_out_len, kMaxLogProb);
         add(outputs_, "logprob_indexes", TYPE_INT32, MEMORY_CPU, max_out_len, kMaxLogProb);
         add(outputs_, "logprob_nums", TYPE_INT32, MEMORY_CPU, max_out_len);
     }
 
+    const bool output_text = param.gen_cfg.output_text && gateway_->detokenizer();
+    if (output_text) {
+        add(outputs_, "output_text", TYPE_UINT8, MEMORY_CPU, max_out_len * Detokenizer::kMaxBytesPerToken);
+        add(outputs_, "text_length", TYPE_INT32, MEMORY_CPU, 1);
+    }
+
     auto r = std::make_shared<Request>();
 
     for (const auto& [k, v] : *inputs_) {
@@ -163,12 +208,33 @@ auto ModelRequest::Forward(InputParam param, std::function<void()> cb) -> Output
     r->output_ids      = *outputs_->at("output_ids");
     r->sequence_length = *outputs_->at("sequence_length");
 
+    if (output_text) {
+        // the prompt is skipped, as the outputs of `async_stream_infer`
+        r->text_output         = std::make_unique<TextOutput>();
+        r->text_output->text   = *outputs_->at("output_text");
+        r->text_output->length = *outputs_->at("text_length");
+        r->text_output->offset = std::max(param.session.step, 0) + input_len;
+
+        *r->text_output->length.getPtr<int>() = 0;
+    }
+
     // Keep a weak reference for canceling the request
     request_ = r;
 
+    r->metrics.enqueue_time = RequestMetrics::now();
+
     gateway_->push({std::move(r)});
 
     return OutputParam{outputs_, state};
 }
 
+auto ModelRequest::Forward(InputParam param, std::shared_ptr<RequestStream> stream) -> OutputParam
+{
+    FT_CHECK(stream != nullptr);
+    // the states are only taken by the consumer after this returns, the notifications before it are kept pending
+    auto out = Forward(std::move(param), [stream] { stream->Notify(); });
+    stream->Bind(out.state);
+    return out;
+}
+
 }  // namespace turbomind
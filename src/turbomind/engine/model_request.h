@@ -5,6 +5,7 @@
 #include <memory>
 
 #include "src/turbomind/engine/gateway.h"
+#include "src/turbomind/engine/request_stream.h"
 #include "src/turbomind/utils/Tensor.h"
 
 namespace turbomind {
@@ -21,10 +22,16 @@ public:
     // Reset the channel to uninitailized state, calls `notify` when done
     void End(std::function<void(int)> cb, uint64_t session_id);
 
+    // Export / import the kv cache of a session through the kv transport of the engine, calls `cb` when done. The
+    // metadata is written to `transfer` by export and read from it by import
+    void Transfer(std::shared_ptr<KvTransfer> transfer, std::function<void(int)> cb, uint64_t session_id);
+
     using TensorMap_ = std::unordered_map<std::string, ManagedTensor>;
 
     struct InputParam {
         std::shared_ptr<TensorMap_> tensors;
+        // Optional caller-owned buffers for the outputs, allocated by `Forward` when absent
+        std::shared_ptr<TensorMap_> outputs;
 
         SessionParam     session;
         GenerationConfig gen_cfg;
@@ -39,6 +46,10 @@ public:
 
     OutputParam Forward(InputParam param, std::function<void()> cb);
 
+    // For native frontends, the states are consumed from `stream` (e.g. `co_await stream->Next()`) and the waiters
+    // are resumed by the signal thread directly
+    OutputParam Forward(InputParam param, std::shared_ptr<RequestStream> stream);
+
 protected:
     Gateway* const gateway_;
 
@@ -53,7 +64,7 @@ protected:
     std::weak_ptr<Request> request_;
 
     std::shared_ptr<TensorMap_> inputs_;   // owned by caller
-    std::shared_ptr<TensorMap_> outputs_;  // owned by `this`
+    std::shared_ptr<TensorMap_> outputs_;  // owned by `this` unless provided by caller
 };
 
 }  // namespace turbomind
@@ -0,0 +1,107 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace turbomind {
+
+// Bounded multi-producer multi-consumer ring (Vyukov). Each cell carries a sequence number telling whether it is
+// ready for the producer or the consumer of the current lap, so neither side ever takes a lock.
+template<class T>
+class MPMCRing {
+public:
+    explicit MPMCRing(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        mask_  = n - 1;
+        cells_ = std::make_unique<Cell[]>(n);
+        for (size_t i = 0; i < n; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCRing(const MPMCRing&) = delete;
+    MPMCRing& operator=(const MPMCRing&) = delete;
+
+    // returns false when the ring is full, `x` is left untouched
+    bool try_push(T& x)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell&          c   = cells_[pos & mask_];
+            const size_t   seq = c.seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.data = std::move(x);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0) {
+                return false;
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> try_pop()
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell&          c   = cells_[pos & mask_];
+            const size_t   seq = c.seq.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::optional<T> x{std::move(c.data)};
+                    c.data = T{};
+                    c.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return x;
+                }
+            }
+            else if (dif < 0) {
+                return std::nullopt;
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // approximate when there are concurrent producers / consumers
+    int size() const noexcept
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T                   data;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t                  mask_;
+
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace turbomind
@@ -2,18 +2,36 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "src/turbomind/utils/Tensor.h"
 
 namespace turbomind {
 
+// Host-side constraint on the generated tokens, e.g. the matcher of a JSON schema or regex grammar. Only used by the
+// first tp rank, the calls for a request are never concurrent
+struct TokenMatcher {
+    virtual ~TokenMatcher() = default;
+
+    // Set bit `i % 32` of word `i / 32` for each token `i` allowed next, all words are written
+    virtual void FillNextTokenBitmask(uint32_t* bitmask, int words) = 0;
+
+    // Advance the matcher by the sampled token
+    virtual void AcceptToken(int token_id) = 0;
+};
+
 struct GenerationConfig {
     int max_new_tokens = 0;
     int min_new_tokens = 0;
@@ -29,6 +47,8 @@ struct GenerationConfig {
     float temperature = 1.f;
 
     float repetition_penalty = 1.f;
+    float frequency_penalty  = 0.f;  // subtracted per occurrence of the token in the generated ones
+    float presence_penalty   = 0.f;  // subtracted once if the token is in the generated ones
 
     uint64_t random_seed = 0;
 
@@ -42,6 +62,36 @@ struct GenerationConfig {
     };
     int output_last_hidden_state = 0;
     int output_logits            = 0;
+
+    bool score = false;  // prefill only, outputs the logprob of each prompt token given its prefix
+
+    enum PoolType
+    {
+        kNoPool = 0,
+        kPoolLast,  // hidden state of the last prompt token
+        kPoolMean,
+        kPoolCls,  // hidden state of the first prompt token
+    };
+    int  pooling   = 0;      // prefill only, outputs the pooled hidden state of the prompt e.g. for embedding models
+    bool normalize = false;  // L2-normalize the pooled hidden state
+
+    bool warm       = false;  // prefill only, caches the prompt for prefix caching without outputs
+    bool pin_prefix = false;  // keep the cached prompt blocks from eviction, within `cache_pin_tokens`
+
+    bool output_text = false;  // utf-8 text of the generated tokens, with the detokenizer of the gateway enabled
+
+    int priority   = 0;   // scheduling class, 0 for interactive requests, lower values are scheduled first
+    int adapter_id = -1;  // multi-LoRA adapter, -1 for the base model
+
+    int   tenant_id     = -1;   // fair sharing of the batch between tenants, -1 for the default one
+    float tenant_weight = 1.f;  // share of the tenant relative to the others
+
+    int expected_output_len = 0;  // hint for the shortest expected job first, 0 for the estimate of the engine
+
+    int   beam_width     = 1;    // beam search with the beams sharing the kv cache of their ancestors, 1 for none
+    float length_penalty = 1.f;  // exponent of the generated length normalizing the scores of the finished beams
+
+    std::shared_ptr<TokenMatcher> matcher;  // grammar constraint, optional
 };
 
 template<typename T>
@@ -69,10 +119,26 @@ inline std::ostream& operator<<(std::ostream& os, const GenerationConfig& c)
     os << ", min_p=" << c.min_p;
     os << ", temperature=" << c.temperature;
     os << ", repetition_penalty=" << c.repetition_penalty;
+    os << ", frequency_penalty=" << c.frequency_penalty;
+    os << ", presence_penalty=" << c.presence_penalty;
     os << ", random_seed=" << c.random_seed;
     os << ", output_logprobs=" << c.output_logprobs;
     os << ", output_hidden_states=" << c.output_last_hidden_state;
     os << ", output_logits=" << c.output_logits;
+    os << ", score=" << c.score;
+    os << ", pooling=" << c.pooling;
+    os << ", normalize=" << c.normalize;
+    os << ", warm=" << c.warm;
+    os << ", pin_prefix=" << c.pin_prefix;
+    os << ", output_text=" << c.output_text;
+    os << ", priority=" << c.priority;
+    os << ", adapter_id=" << c.adapter_id;
+    os << ", tenant_id=" << c.tenant_id;
+    os << ", tenant_weight=" << c.tenant_weight;
+    os << ", expected_output_len=" << c.expected_output_len;
+    os << ", beam_width=" << c.beam_width;
+    os << ", length_penalty=" << c.length_penalty;
+    os << ", matcher=" << (bool)c.matcher;
     os << " }";
     return os;
 }
@@ -85,11 +151,87 @@ struct SessionParam {
     bool start_flag;
     bool end_flag;
     bool kill_flag;
+
+    bool     fork_flag;  // start as a fork of session `parent_id`, sharing its tokens & kv cache
+    uint64_t parent_id;
+
+    int64_t deadline;  // latest start of a new session in the clock of `RequestMetrics::now()`, 0 for none
+
+    bool kv_stream_flag;  // send the kv cache of the prompt to `kv_stream_peer` layer by layer as the prefill writes it
+    int  kv_stream_peer;  // rank of the remote engine in the kv transport, imported with `KvTransfer::layer_major`
+};
+
+// Moving the kv cache of a session between engines, e.g. from a prefill engine to a decode engine. The blocks go
+// through the kv transport of the engines while the metadata is handed over by the caller
+struct KvTransfer {
+    enum Op
+    {
+        kExport = 0,
+        kImport = 1,
+        kDrop   = 2,  // end the hold of a migrated sequence, erased with `release` or unlocked otherwise
+    };
+
+    // Between the DP ranks of an engine the importing ranks copy the blocks from the devices of the exporting ranks,
+    // which hold the locked sequence until `kDrop`
+    struct Migration {
+        std::mutex                                                  mutex;
+        std::unordered_map<int, std::pair<int, std::vector<void*>>> blocks;  // tp rank -> device & block pointers
+    };
+
+    int  op;
+    int  peer;     // rank of the remote engine in the kv transport
+    bool release;  // erase the sequence after exporting it
+
+    // The peer is host memory instead, each tp rank exports its shard of the blocks to its entry, e.g. to persist the
+    // session in a file, and imports from it. The contents are in the layout & quantization of the cache blocks
+    struct HostBlocks {
+        std::mutex                                      mutex;
+        std::unordered_map<int, std::vector<std::byte>> blocks;  // tp rank -> blocks, back to back
+    };
+
+    std::shared_ptr<Migration>  migration;  // the peer is a DP rank of the engine instead
+    std::shared_ptr<HostBlocks> host;
+
+    // filled by export and consumed by import
+    std::vector<int>       tokens;
+    std::vector<std::byte> random_state;
+    float                  rope_theta;
+    int                    cache_len;
+    int64_t                block_size;   // kv layouts of the peers must match
+    int                    block_count;  // blocks sent by the export
+
+    // The blocks are sent by the prefill of a session with `kv_stream_flag` instead, all the layers of the blocks
+    // followed by the rest of them. The import receives them in this order and may be issued before the prefill is
+    // done, the export only hands over the metadata
+    bool layer_major;
+};
+
+// Timestamps of a request in microseconds of the monotonic `std::chrono::steady_clock` (0 when not reached) and the
+// context tokens computed for it. Written on the host by tp rank-0 as the request goes, without extra synchronizations
+struct RequestMetrics {
+    int64_t enqueue_time;      // pushed to the request queue
+    int64_t scheduled_time;    // the sequence is active in the batch for the 1st time
+    int64_t prefill_end_time;  // the step completing the prompt is done
+    int64_t first_token_time;  // the 1st generated token is written to the outputs
+    int64_t finish_time;
+
+    int computed_tokens;  // context tokens prefilled, including the recomputations after preemptions
+
+    std::vector<int64_t> preempt_times;  // the running sequence is swapped out or evicted
+
+    static int64_t now()
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
 };
 
 struct RequestState {
     int status;
     int seq_len;
+    int cached_len;  // context tokens reused from the kv cache, -1 before the request is scheduled
+
+    RequestMetrics metrics;  // only filled in the final state
 };
 
 struct AtomicRequestState {
@@ -109,6 +251,16 @@ struct AtomicRequestState {
     }
 };
 
+// Text of the generated tokens, appended by the `Detokenizer` of the gateway before each state update
+struct TextOutput {
+    Tensor text;    // utf-8 bytes
+    Tensor length;  // bytes written to `text`
+
+    int         offset;     // tokens decoded
+    std::string pending;    // decoded bytes not written yet, e.g. an incomplete character
+    bool        truncated;  // `text` is full
+};
+
 struct Request {
     uint64_t id;         // sequence id
     uint64_t unique_id;  // monotonic increasing
@@ -125,8 +277,12 @@ struct Request {
     Tensor output_ids;
     Tensor sequence_length;
 
+    std::unique_ptr<TextOutput> text_output;  // optional
+
     std::function<void(int)> end_cb;
 
+    std::shared_ptr<KvTransfer> transfer;  // kv cache transfer instead of inference, completes with `end_cb`
+
     std::atomic<int> cancel_flag;
 
     std::function<void()> forward_cb;
@@ -135,6 +291,14 @@ struct Request {
 
     int ec;  // set when disabling conflicting requests
 
+    int cached_len = -1;  // context tokens reused from the kv cache (prefix cache, history or fork) at the 1st schedule
+
+    bool kv_streamed = false;  // the prompt is sent to `session.kv_stream_peer`, once per request
+
+    int pooled_len = 0;  // prompt tokens covered by the pooled hidden state
+
+    RequestMetrics metrics{};
+
     enum
     {
         kOk       = 0,
@@ -146,13 +310,39 @@ struct Request {
         kTooLong  = 6,  // history + prompt > session_len,
         kFinish   = 7,
         kCancel   = 8,
+        kOverload = 9,  // dropped from a full request queue, or still queued at its deadline
     };
 };
 
+// Deadline of `r` in the earliest-deadline-first order, the requests without one are due `slack` (us) after they were
+// queued so that they are not starved
+inline int64_t EffectiveDeadline(const Request& r, int64_t slack)
+{
+    return r.session.deadline ? r.session.deadline : r.metrics.enqueue_time + slack;
+}
+
+// Output length of a queued request, its hint or `max_new_tokens`. The engine predicts the ones without a hint from
+// the finished requests, which the queue doesn't see
+inline int QueuedOutputLength(const Request& r)
+{
+    const auto& c = r.gen_cfg;
+    if (c.score || c.pooling || c.warm) {
+        return 0;
+    }
+    return c.expected_output_len > 0 ? std::min(c.expected_output_len, c.max_new_tokens) : c.max_new_tokens;
+}
+
 inline void UpdateState(Request& r, int status, int seq_len)
 {
     try {
-        auto new_state = new RequestState{status, seq_len};
+        auto new_state = new RequestState{status, seq_len, r.cached_len};
+        if (status != Request::kOk) {
+            // the engine is done with the request, e.g. rejected ones are never scheduled
+            new_state->metrics = r.metrics;
+            if (!new_state->metrics.finish_time) {
+                new_state->metrics.finish_time = RequestMetrics::now();
+            }
+        }
         auto old_state = r.state->exchange(new_state);
         if (!old_state && r.forward_cb) {
             r.forward_cb();
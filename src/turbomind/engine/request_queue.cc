@@ -1,5 +1,12 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include <climits>
+#include <thread>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "src/turbomind/engine/request_queue.h"
 #include "src/turbomind/engine/gateway.h"
 
@@ -7,4 +14,134 @@
 
 namespace turbomind {
 
+static void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static void futex_wake_all(std::atomic<uint32_t>* addr)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+RingRequestQueue::RingRequestQueue(std::atomic<uint64_t>* flag, size_t capacity):
+    flag_{flag}, fresh_{capacity}, resume_{capacity}, kill_{capacity}
+{
+}
+
+void RingRequestQueue::enqueue(MPMCRing<std::shared_ptr<Request>>& ring, std::shared_ptr<Request> r)
+{
+    if (closed_.load(std::memory_order_relaxed)) {
+        throw std::runtime_error("Queue is clsoed");
+    }
+    // back-pressure the producer when the ring is full
+    while (!ring.try_push(r)) {
+        std::this_thread::yield();
+    }
+    wake();
+}
+
+void RingRequestQueue::push(std::shared_ptr<Request> r)
+{
+    auto& ring = r->session.start_flag ? fresh_ : resume_;
+    enqueue(ring, std::move(r));
+}
+
+void RingRequestQueue::kill(std::shared_ptr<Request> r)
+{
+    enqueue(kill_, std::move(r));
+}
+
+int RingRequestQueue::try_pop(std::vector<std::shared_ptr<Request>>& rs, int max_rs_size, int max_count)
+{
+    int count{};
+    while (rs.size() < max_rs_size && count < max_count) {
+        auto r = resume_.try_pop();
+        if (!r) {
+            break;
+        }
+        rs.push_back(std::move(*r));
+        ++count;
+    }
+    return count;
+}
+
+bool RingRequestQueue::pop(std::vector<std::shared_ptr<Request>>& infer_reqs,
+                           std::vector<std::shared_ptr<Request>>& kill_reqs,
+                           unsigned                               max_infer,
+                           bool                                   blocking,
+                           bool&                                  abort)
+{
+    ++expected_;
+
+    if (blocking) {
+        while (true) {
+            const uint32_t event = event_.load();
+            if (ready() || flag_->load(std::memory_order_relaxed) == expected_ || interrupted_.load()
+                || closed_.load()) {
+                break;
+            }
+            ++waiters_;
+            futex_wait(&event_, event);
+            --waiters_;
+        }
+        if (closed_.load()) {
+            abort = true;
+            return false;
+        }
+    }
+
+    interrupted_.store(false);
+
+    bool is_first = false;
+    // Update the flag of current sync DP group
+    if (auto old = flag_->exchange(expected_); old < expected_) {
+        is_first = true;
+    }
+
+    for (auto ring : {&resume_, &fresh_}) {
+        while (infer_reqs.size() < max_infer) {
+            auto r = ring->try_pop();
+            if (!r) {
+                break;
+            }
+            if ((*r)->cancel_flag.exchange(1, std::memory_order_acq_rel) == 0) {
+                infer_reqs.push_back(std::move(*r));
+            }
+        }
+    }
+
+    while (auto r = kill_.try_pop()) {
+        kill_reqs.push_back(std::move(*r));
+    }
+
+    return is_first;
+}
+
+void RingRequestQueue::close()
+{
+    closed_.store(true);
+    wake();
+}
+
+void RingRequestQueue::notify()
+{
+    wake();
+}
+
+void RingRequestQueue::interrupt()
+{
+    interrupted_.store(true);
+    wake();
+}
+
+void RingRequestQueue::wake()
+{
+    event_.fetch_add(1);
+    // a waiter that registers after this observes the new `event_` in `futex_wait` and returns immediately
+    if (waiters_.load() > 0) {
+        futex_wake_all(&event_);
+    }
+}
+
 }  // namespace turbomind
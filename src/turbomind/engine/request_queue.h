@@ -8,27 +8,100 @@
 #include <memory_resource>
 #include <mutex>
 
+#include "src/turbomind/engine/mpmc_ring.h"
 #include "src/turbomind/engine/request.h"
 
 namespace turbomind {
 
+// The request making room for a new session arriving at a full queue, ongoing sessions are never dropped
+enum class QueuePolicy
+{
+    kReject   = 0,  // the new session
+    kShed     = 1,  // the queued new session of the lowest priority, when lower than the one of the new session
+    kDeadline = 2,  // a queued new session past its deadline
+};
+
 class RequestQueue {
 public:
-    explicit RequestQueue(std::atomic<uint64_t>* flag): flag_{flag}, queue_{&pool_} {}
+    virtual ~RequestQueue() = default;
+
+    virtual void push(std::shared_ptr<Request> r) = 0;
+
+    virtual void kill(std::shared_ptr<Request> r) = 0;
+
+    // pop requests of ongoing sessions, used for stealing by the siblings
+    virtual int try_pop(std::vector<std::shared_ptr<Request>>& rs, int max_rs_size, int max_count) = 0;
+
+    virtual bool pop(std::vector<std::shared_ptr<Request>>& infer_reqs,
+                     std::vector<std::shared_ptr<Request>>& kill_reqs,
+                     unsigned                               max_infer,
+                     bool                                   blocking,
+                     bool&                                  abort) = 0;
+
+    virtual void close() = 0;
+
+    virtual void notify() = 0;
+
+    // the pending or next blocking `pop` returns without requests
+    virtual void interrupt() = 0;
+
+    virtual int size() = 0;
+
+    // removes the queued request chosen by `policy` to make room for `r`, null when `r` is to be rejected
+    virtual std::shared_ptr<Request> shed(const Request& r, QueuePolicy policy)
+    {
+        return {};
+    }
+
+    // requests are popped earliest deadline first, `slack` (us) is the deadline of the ones without, 0 for FIFO
+    virtual void set_deadline_order(int64_t slack) {}
+
+    // requests are popped shortest expected output first, see `QueuedOutputLength`
+    virtual void set_length_order(bool enable) {}
 
-    void push(std::shared_ptr<Request> r)
+    void assign_unique_ids(std::vector<std::shared_ptr<Request>>& rs)
+    {
+        for (auto& r : rs) {
+            r->unique_id = unique_id_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<uint64_t> unique_id_{};
+};
+
+class MutexRequestQueue: public RequestQueue {
+public:
+    explicit MutexRequestQueue(std::atomic<uint64_t>* flag): flag_{flag}, queue_{&pool_} {}
+
+    void push(std::shared_ptr<Request> r) override
     {
         {
             std::lock_guard lock{mutex_};
             if (closed_) {
                 throw std::runtime_error("Queue is clsoed");
             }
-            queue_.push_back(std::move(r));
+            auto pos = queue_.end();
+            if (slack_) {
+                // the deadlines are fixed once queued, the queue stays sorted. Most requests are due after all the
+                // queued ones, the search from the back is short
+                const int64_t deadline = EffectiveDeadline(*r, slack_);
+                while (pos != queue_.begin() && EffectiveDeadline(**std::prev(pos), slack_) > deadline) {
+                    --pos;
+                }
+            }
+            else if (length_order_) {
+                const int len = QueuedOutputLength(*r);
+                while (pos != queue_.begin() && QueuedOutputLength(**std::prev(pos)) > len) {
+                    --pos;
+                }
+            }
+            queue_.insert(pos, std::move(r));
         }
         cv_.notify_one();
     }
 
-    void kill(std::shared_ptr<Request> r)
+    void kill(std::shared_ptr<Request> r) override
     {
         {
             std::lock_guard lock{mutex_};
@@ -40,7 +113,7 @@ public:
         cv_.notify_one();
     }
 
-    int try_pop(std::vector<std::shared_ptr<Request>>& rs, int max_rs_size, int max_count)
+    int try_pop(std::vector<std::shared_ptr<Request>>& rs, int max_rs_size, int max_count) override
     {
         std::lock_guard lock{mutex_};
 
@@ -66,7 +139,7 @@ public:
              std::vector<std::shared_ptr<Request>>& kill_reqs,
              unsigned                               max_infer,
              bool                                   blocking,
-             bool&                                  abort)
+             bool&                                  abort) override
     {
         std::unique_lock lock{mutex_};
 
@@ -76,7 +149,7 @@ public:
             cv_.wait(lock, [this] {
                 return !(queue_.empty() && kill_.empty())                      //
                        || flag_->load(std::memory_order_relaxed) == expected_  //
-                       || closed_;
+                       || interrupted_ || closed_;
             });
             if (closed_) {
                 abort = true;
@@ -84,6 +157,8 @@ public:
             }
         }
 
+        interrupted_ = false;
+
         bool is_first = false;
         // Update the flag of current sync DP group
         if (auto old = flag_->exchange(expected_); old < expected_) {
@@ -104,7 +179,7 @@ public:
         return is_first;
     }
 
-    void close()
+    void close() override
     {
         {
             std::lock_guard<std::mutex> lock(mutex_);
@@ -113,33 +188,142 @@ public:
         cv_.notify_all();
     }
 
-    void notify()
+    int size() override
+    {
+        std::lock_guard lock{mutex_};
+        return queue_.size();
+    }
+
+    std::shared_ptr<Request> shed(const Request& r, QueuePolicy policy) override
+    {
+        std::lock_guard lock{mutex_};
+
+        const int64_t now  = RequestMetrics::now();
+        auto          pick = queue_.end();
+        for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+            const auto& q = **it;
+            if (!q.session.start_flag) {
+                continue;
+            }
+            if (policy == QueuePolicy::kShed) {
+                // the latest of the lowest priority, larger values are scheduled later
+                const int p = q.gen_cfg.priority;
+                if (p > r.gen_cfg.priority && (pick == queue_.end() || p >= (*pick)->gen_cfg.priority)) {
+                    pick = it;
+                }
+            }
+            else if (policy == QueuePolicy::kDeadline && q.session.deadline && q.session.deadline < now) {
+                pick = it;
+                break;
+            }
+        }
+
+        if (pick == queue_.end()) {
+            return {};
+        }
+        auto victim = std::move(*pick);
+        queue_.erase(pick);
+        return victim;
+    }
+
+    void set_deadline_order(int64_t slack) override
+    {
+        std::lock_guard lock{mutex_};
+        slack_ = slack;
+    }
+
+    void set_length_order(bool enable) override
+    {
+        std::lock_guard lock{mutex_};
+        length_order_ = enable;
+    }
+
+    void notify() override
     {
         cv_.notify_all();
     }
 
-    void assign_unique_ids(std::vector<std::shared_ptr<Request>>& rs)
+    void interrupt() override
     {
-        for (auto& r : rs) {
-            r->unique_id = unique_id_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard lock{mutex_};
+            interrupted_ = true;
         }
+        cv_.notify_all();
     }
 
 private:
     std::atomic<uint64_t>* flag_;
     uint64_t               expected_{};
 
-    std::atomic<uint64_t> unique_id_{};
-
     std::pmr::list<std::shared_ptr<Request>> queue_;
     std::pmr::unsynchronized_pool_resource   pool_;
 
     std::vector<std::shared_ptr<Request>> kill_;
 
+    int64_t slack_{};  // earliest deadline first when non-zero
+    bool    length_order_{};
+
     std::mutex              mutex_;
     std::condition_variable cv_;
 
+    bool interrupted_{};
     bool closed_{};
 };
 
+
+// Bounded lock-free queue of requests (one ring for new sessions, ongoing sessions and kills each). The owner
+// thread blocks on a futex that is bumped by every producer, avoiding the mutex on the hot path. Queued requests are
+// never removed before the head, new sessions at a full queue are rejected whatever the policy. The order is FIFO
+class RingRequestQueue: public RequestQueue {
+public:
+    explicit RingRequestQueue(std::atomic<uint64_t>* flag, size_t capacity = 4096);
+
+    void push(std::shared_ptr<Request> r) override;
+
+    void kill(std::shared_ptr<Request> r) override;
+
+    int try_pop(std::vector<std::shared_ptr<Request>>& rs, int max_rs_size, int max_count) override;
+
+    bool pop(std::vector<std::shared_ptr<Request>>& infer_reqs,
+             std::vector<std::shared_ptr<Request>>& kill_reqs,
+             unsigned                               max_infer,
+             bool                                   blocking,
+             bool&                                  abort) override;
+
+    void close() override;
+
+    void notify() override;
+
+    void interrupt() override;
+
+    int size() override
+    {
+        return fresh_.size() + resume_.size();
+    }
+
+private:
+    void enqueue(MPMCRing<std::shared_ptr<Request>>& ring, std::shared_ptr<Request> r);
+
+    void wake();
+
+    bool ready()
+    {
+        return !fresh_.empty() || !resume_.empty() || !kill_.empty();
+    }
+
+private:
+    std::atomic<uint64_t>* flag_;
+    uint64_t               expected_{};
+
+    MPMCRing<std::shared_ptr<Request>> fresh_;   // new sessions
+    MPMCRing<std::shared_ptr<Request>> resume_;  // ongoing sessions, can be stolen
+    MPMCRing<std::shared_ptr<Request>> kill_;
+
+    std::atomic<uint32_t> event_{};
+    std::atomic<int>      waiters_{};
+    std::atomic<bool>     interrupted_{};
+    std::atomic<bool>     closed_{};
+};
+
 }  // namespace turbomind
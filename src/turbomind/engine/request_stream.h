@@ -0,0 +1,125 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define TM_REQUEST_STREAM_COROUTINE 1
+#endif
+
+#include "src/turbomind/engine/request.h"
+
+namespace turbomind {
+
+// Rendezvous between the signal thread of the gateway and a single consumer of the states of a request, without a
+// lock or a thread hop per update. The consumer parks a waiter when there is no new state, the signal thread hands
+// the waiter to `resume` when the next state arrives, which runs it inline (on the signal thread) or posts it to an
+// executor. With C++20 coroutines `co_await stream.Next()` yields the next state
+class RequestStream {
+public:
+    // `waiter` is the parked waiter, e.g. the address of a coroutine handle. A null `resume` resumes the coroutine
+    // inline (C++20 only), it must not block the signal thread
+    using Resume = void (*)(void* ctx, void* waiter);
+
+    explicit RequestStream(Resume resume = nullptr, void* ctx = nullptr): resume_{resume}, ctx_{ctx} {}
+
+    RequestStream(const RequestStream&) = delete;
+    RequestStream& operator=(const RequestStream&) = delete;
+
+    // set by `ModelRequest::Forward`
+    void Bind(std::shared_ptr<AtomicRequestState> state) noexcept
+    {
+        state_ = std::move(state);
+    }
+
+    // The latest state since the last call, null when there is none. Taking it enables the next notification
+    std::unique_ptr<RequestState> Take()
+    {
+        return state_->exchange(nullptr);
+    }
+
+    // Parks `waiter` until the next notification, returns false when one is already pending (which is consumed), then
+    // the caller takes the state instead
+    bool Park(void* waiter) noexcept
+    {
+        void* expected = nullptr;
+        if (slot_.compare_exchange_strong(expected, waiter, std::memory_order_acq_rel)) {
+            return true;
+        }
+        // a pending notification, the waiter goes on
+        slot_.store(nullptr, std::memory_order_release);
+        return false;
+    }
+
+    // The `forward_cb` of the request, called by the signal thread when a state is set after the last `Take`
+    void Notify() noexcept
+    {
+        void* cur = slot_.load(std::memory_order_acquire);
+        do {
+            if (cur == notified()) {
+                return;
+            }
+        } while (!slot_.compare_exchange_weak(cur, cur ? nullptr : notified(), std::memory_order_acq_rel));
+        if (!cur) {
+            return;
+        }
+#ifdef TM_REQUEST_STREAM_COROUTINE
+        if (!resume_) {
+            return std::coroutine_handle<>::from_address(cur).resume();
+        }
+#endif
+        resume_(ctx_, cur);
+    }
+
+#ifdef TM_REQUEST_STREAM_COROUTINE
+    struct NextState {
+        RequestStream&                stream;
+        std::unique_ptr<RequestState> state;
+
+        bool await_ready()
+        {
+            return (bool)(state = stream.Take());
+        }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            // a stale notification of an update that was already taken does not wake us up
+            while (!stream.Park(h.address())) {
+                if ((state = stream.Take())) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::unique_ptr<RequestState> await_resume()
+        {
+            return state ? std::move(state) : stream.Take();
+        }
+    };
+
+    // `co_await Next()` returns the next state, the stream ends with a state that is not `Request::kOk`
+    NextState Next()
+    {
+        return {*this, nullptr};
+    }
+#endif
+
+private:
+    void* notified() const noexcept
+    {
+        return const_cast<std::atomic<void*>*>(&slot_);
+    }
+
+    Resume resume_;
+    void*  ctx_;
+
+    std::shared_ptr<AtomicRequestState> state_;
+
+    std::atomic<void*> slot_{};  // null, `notified()` or the parked waiter
+};
+
+}  // namespace turbomind
@@ -4,22 +4,75 @@
 
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <vector>
+
+#include "src/turbomind/engine/request.h"
 
 namespace turbomind {
 
-using Signal = std::function<void()>;
+// Either a state update of a request or a generic callback. State updates, which dominate with streaming output,
+// are stored inline so creating them never allocates.
+class Signal {
+public:
+    Signal(std::function<void()> fn): fn_{std::move(fn)} {}
+
+    Signal(std::shared_ptr<Request> r, int status, int seq_len): r_{std::move(r)}, status_{status}, seq_len_{seq_len} {}
+
+    void operator()() const
+    {
+        if (r_) {
+            UpdateState(*r_, status_, seq_len_);
+        }
+        else if (fn_) {
+            fn_();
+        }
+    }
+
+    // the request of a state update, null for callbacks
+    const std::shared_ptr<Request>& request() const noexcept
+    {
+        return r_;
+    }
+
+    int status() const noexcept
+    {
+        return status_;
+    }
+
+    int seq_len() const noexcept
+    {
+        return seq_len_;
+    }
 
+private:
+    std::shared_ptr<Request> r_;
+    int                      status_{};
+    int                      seq_len_{};
+    std::function<void()>    fn_;
+};
+
+// Signals are passed around by swapping vectors, the buffers circulate between the producers and the consumer so
+// that no allocation happens in steady state.
 class SignalBuffer {
 public:
-    void push(std::vector<Signal> signals)
+    // take the signals, `signals` is left empty
+    void push(std::vector<Signal>& signals)
     {
         if (signals.empty()) {
             return;
         }
         {
             std::lock_guard lock{mutex_};
-            signals_.insert(signals_.end(), std::move_iterator{signals.begin()}, std::move_iterator{signals.end()});
+            if (signals_.empty()) {
+                signals_.swap(signals);
+            }
+            else {
+                signals_.insert(
+                    signals_.end(), std::move_iterator{signals.begin()}, std::move_iterator{signals.end()});
+                signals.clear();
+            }
         }
         cv_.notify_one();
     }
@@ -33,20 +86,17 @@ public:
         cv_.notify_all();
     }
 
-    std::vector<Signal> take_all(bool& abort)
+    // `signals` must be empty, its capacity is handed to the producers
+    void take_all(std::vector<Signal>& signals, bool& abort)
     {
-        std::vector<Signal> signals;
-        {
-            std::unique_lock lock{mutex_};
-            cv_.wait(lock, [&] { return !signals_.empty() || aborted_; });
-            if (aborted_) {
-                abort = true;
-            }
-            else {
-                signals.swap(signals_);
-            }
+        std::unique_lock lock{mutex_};
+        cv_.wait(lock, [&] { return !signals_.empty() || aborted_; });
+        if (aborted_) {
+            abort = true;
+        }
+        else {
+            signals.swap(signals_);
         }
-        return signals;
     }
 
 private:
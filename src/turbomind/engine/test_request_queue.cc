@@ -0,0 +1,281 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "src/turbomind/engine/request_queue.h"
+
+using namespace turbomind;
+using namespace std::chrono_literals;
+
+using Requests = std::vector<std::shared_ptr<Request>>;
+
+static std::shared_ptr<Request> MakeRequest(uint64_t id, bool start)
+{
+    auto r                = std::make_shared<Request>();
+    r->id                 = id;
+    r->session.id         = id;
+    r->session.start_flag = start;
+    r->cancel_flag.store(0);
+    return r;
+}
+
+// Pushing & popping less than the capacity at a time laps the ring several times, the order stays FIFO
+static int TestWraparound()
+{
+    std::atomic<uint64_t> flag{};
+    RingRequestQueue      queue{&flag, 4};
+
+    int      error{};
+    uint64_t next_push{};
+    uint64_t next_pop{};
+    for (int round = 0; round < 16; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            queue.push(MakeRequest(next_push++, true));
+        }
+        error += queue.size() != 3;
+        Requests infer_reqs, kill_reqs;
+        bool     abort = false;
+        queue.pop(infer_reqs, kill_reqs, 3, false, abort);
+        error += infer_reqs.size() != 3 || abort;
+        for (const auto& r : infer_reqs) {
+            error += r->id != next_pop++;
+            // the popped requests are taken by the engine
+            error += r->cancel_flag.load() != 1;
+        }
+        error += queue.size() != 0;
+    }
+    printf("[wraparound] errors=%d\n", error);
+    return error;
+}
+
+// A producer at a full ring waits until the consumer makes room, nothing is dropped
+static int TestFull()
+{
+    std::atomic<uint64_t> flag{};
+    RingRequestQueue      queue{&flag, 4};
+
+    int error{};
+    for (int i = 0; i < 4; ++i) {
+        queue.push(MakeRequest(i, true));
+    }
+    error += queue.size() != 4;
+
+    std::atomic<bool> pushed{};
+    std::thread       producer([&] {
+        queue.push(MakeRequest(4, true));
+        pushed.store(true);
+    });
+
+    std::this_thread::sleep_for(50ms);
+    error += pushed.load();
+    error += queue.size() != 4;
+
+    // kills and ongoing sessions are in rings of their own, a full ring of new sessions doesn't block them
+    queue.push(MakeRequest(5, false));
+    queue.kill(MakeRequest(6, false));
+
+    Requests infer_reqs, kill_reqs;
+    bool     abort = false;
+    queue.pop(infer_reqs, kill_reqs, 2, false, abort);
+    producer.join();
+    error += !pushed.load();
+
+    // ongoing sessions first
+    error += infer_reqs.size() != 2 || infer_reqs[0]->id != 5 || infer_reqs[1]->id != 0;
+    error += kill_reqs.size() != 1 || kill_reqs[0]->id != 6;
+
+    infer_reqs.clear();
+    queue.pop(infer_reqs, kill_reqs, 8, false, abort);
+    error += infer_reqs.size() != 4;
+    for (size_t i = 0; i < infer_reqs.size(); ++i) {
+        error += infer_reqs[i]->id != i + 1;
+    }
+    error += queue.size() != 0;
+
+    printf("[full] errors=%d\n", error);
+    return error;
+}
+
+// Producers push through a small ring while the owner pops blocking and a sibling steals the ongoing sessions. Every
+// request is popped exactly once, and each consumer sees the requests of a producer in a ring in the pushed order
+static int TestConcurrent(int n_producers, int n_requests, size_t capacity)
+{
+    std::atomic<uint64_t> flag{};
+    RingRequestQueue      queue{&flag, capacity};
+
+    const int total = n_producers * n_requests;
+
+    std::vector<std::atomic<int>> seen(total);
+    std::atomic<int>              popped{};
+    std::atomic<bool>             done{};
+
+    auto producer_of = [&](uint64_t id) { return id / n_requests; };
+    auto is_start    = [&](uint64_t id) { return id % 3 != 0; };
+
+    std::atomic<int> error{};
+
+    // the last id of each (producer, ring) seen by a consumer
+    auto check_order = [&](std::vector<int64_t>& last, uint64_t id) {
+        auto& x = last[producer_of(id) * 2 + is_start(id)];
+        error += (int64_t)id <= x;
+        x = id;
+    };
+
+    std::thread owner([&] {
+        std::vector<int64_t> last(n_producers * 2, -1);
+        while (true) {
+            Requests infer_reqs, kill_reqs;
+            bool     abort = false;
+            queue.pop(infer_reqs, kill_reqs, 7, true, abort);
+            if (abort) {
+                break;
+            }
+            for (const auto& r : infer_reqs) {
+                ++seen[r->id];
+                check_order(last, r->id);
+            }
+            popped += infer_reqs.size();
+        }
+    });
+
+    std::thread sibling([&] {
+        std::vector<int64_t> last(n_producers * 2, -1);
+        while (!done.load()) {
+            Requests rs;
+            if (queue.try_pop(rs, 5, 5) == 0) {
+                std::this_thread::yield();
+            }
+            for (const auto& r : rs) {
+                // stolen requests are never of new sessions
+                error += r->session.start_flag;
+                ++seen[r->id];
+                check_order(last, r->id);
+            }
+            popped += rs.size();
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < n_producers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < n_requests; ++i) {
+                const uint64_t id = (uint64_t)p * n_requests + i;
+                queue.push(MakeRequest(id, is_start(id)));
+            }
+        });
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+
+    while (popped.load() < total) {
+        std::this_thread::sleep_for(1ms);
+    }
+    done.store(true);
+    sibling.join();
+
+    queue.close();
+    owner.join();
+
+    for (const auto& x : seen) {
+        error += x.load() != 1;
+    }
+    error += queue.size() != 0;
+
+    printf("[concurrent] producers=%d, requests=%d, capacity=%d, errors=%d\n",
+           n_producers,
+           n_requests,
+           (int)capacity,
+           error.load());
+    return error;
+}
+
+// Canceled requests are drained without being popped, `close` & `interrupt` wake a blocking pop
+static int TestShutdown()
+{
+    std::atomic<uint64_t> flag{};
+    RingRequestQueue      queue{&flag, 8};
+
+    int error{};
+
+    Requests rs;
+    for (int i = 0; i < 6; ++i) {
+        rs.push_back(MakeRequest(i, i % 2));
+        queue.push(rs.back());
+    }
+    // canceled by the gateway while queued
+    rs[1]->cancel_flag.store(-1);
+    rs[4]->cancel_flag.store(-1);
+    queue.kill(MakeRequest(6, false));
+
+    {
+        Requests infer_reqs, kill_reqs;
+        bool     abort = false;
+        queue.pop(infer_reqs, kill_reqs, 8, false, abort);
+        std::vector<uint64_t> ids;
+        for (const auto& r : infer_reqs) {
+            ids.push_back(r->id);
+        }
+        // ongoing sessions (even ids) first, the canceled ones are dropped
+        error += ids != std::vector<uint64_t>{0, 2, 3, 5};
+        error += kill_reqs.size() != 1 || kill_reqs[0]->id != 6;
+        error += queue.size() != 0;
+    }
+
+    auto blocking_pop = [&](bool& abort) {
+        Requests infer_reqs, kill_reqs;
+        queue.pop(infer_reqs, kill_reqs, 8, true, abort);
+        return infer_reqs.size() + kill_reqs.size();
+    };
+
+    {
+        bool        abort = false;
+        size_t      n     = 1;
+        std::thread consumer([&] { n = blocking_pop(abort); });
+        std::this_thread::sleep_for(20ms);
+        queue.interrupt();
+        consumer.join();
+        error += n != 0 || abort;
+    }
+
+    {
+        bool        abort = false;
+        std::thread consumer([&] { blocking_pop(abort); });
+        std::this_thread::sleep_for(20ms);
+        queue.close();
+        consumer.join();
+        error += !abort;
+    }
+
+    // a closed queue takes no more requests and doesn't block
+    try {
+        queue.push(MakeRequest(7, true));
+        ++error;
+    }
+    catch (const std::runtime_error&) {
+    }
+    bool abort = false;
+    blocking_pop(abort);
+    error += !abort;
+
+    printf("[shutdown] errors=%d\n", error);
+    return error;
+}
+
+int main(int argc, char* argv[])
+{
+    int error = 0;
+    error += TestWraparound();
+    error += TestFull();
+    error += TestConcurrent(1, 100000, 16);
+    error += TestConcurrent(4, 50000, 16);
+    error += TestConcurrent(8, 20000, 4096);
+    error += TestShutdown();
+    return error != 0;
+}
@@ -0,0 +1,584 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// OpenAI-compatible serving frontend without python. Prompts are tokenized natively and submitted to the gateway of
+// the engine through `ModelRequest`, the updates of the requests are collected by a `CompletionQueue` polled by the
+// event loop of the HTTP server, and their text is decoded by the detokenizer of the gateway on its own workers
+//
+//   POST /v1/completions  {"prompt": "text" | [token ids], "max_tokens": 16, "stream": false, ...}
+//   GET  /v1/models
+//   GET  /health
+//
+// Chat templates, stop strings, `echo`, `logprobs` and `n` > 1 are left to the python `api_server`
+
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include "src/turbomind/engine/completion_queue.h"
+#include "src/turbomind/engine/model_request.h"
+#include "src/turbomind/frontend/http_server.h"
+#include "src/turbomind/frontend/tokenizer.h"
+#include "src/turbomind/triton_backend/llama/LlamaTritonModel.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+using namespace turbomind;
+
+namespace {
+
+struct Options {
+    std::string model_dir;
+    std::string config;  // yaml file overriding `model_dir/config.yaml`
+    std::string dtype;
+    std::string tokenizer;  // `tokenizer.json`, default to `model_dir/tokenizer.json`
+    std::string model_name = "turbomind";
+    std::string host       = "0.0.0.0";
+
+    int port                = 23333;
+    int devices             = 0;
+    int detokenizer_threads = 2;
+};
+
+void PrintUsage()
+{
+    std::cerr << "usage: api_server --model-dir DIR [options]\n"
+                 "  --model-dir DIR            turbomind model dir with `config.yaml` and the weights\n"
+                 "  --config FILE              yaml config overriding `DIR/config.yaml`\n"
+                 "  --dtype TYPE               fp16 | bf16, default to `model_config.weight_type`\n"
+                 "  --devices N                number of devices, default to tp * pp\n"
+                 "  --tokenizer FILE           `tokenizer.json` of the model (DIR/tokenizer.json)\n"
+                 "  --model-name NAME          name of the served model (turbomind)\n"
+                 "  --host HOST                (0.0.0.0)\n"
+                 "  --port PORT                (23333)\n"
+                 "  --detokenizer-threads N    workers of the detokenizer (2)\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--model-dir") {
+            opts.model_dir = value;
+        }
+        else if (key == "--config") {
+            opts.config = value;
+        }
+        else if (key == "--dtype") {
+            opts.dtype = value;
+        }
+        else if (key == "--devices") {
+            opts.devices = std::stoi(value);
+        }
+        else if (key == "--tokenizer") {
+            opts.tokenizer = value;
+        }
+        else if (key == "--model-name") {
+            opts.model_name = value;
+        }
+        else if (key == "--host") {
+            opts.host = value;
+        }
+        else if (key == "--port") {
+            opts.port = std::stoi(value);
+        }
+        else if (key == "--detokenizer-threads") {
+            opts.detokenizer_threads = std::stoi(value);
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    return ok && !opts.model_dir.empty() && opts.detokenizer_threads > 0;
+}
+
+// The end tokens of the model from `generation_config.json` or `tokenizer_config.json` beside `tokenizer.json`
+std::vector<int> LoadEosIds(const std::string& tokenizer_path, const Tokenizer& tokenizer)
+{
+    const auto dir = tokenizer_path.substr(0, tokenizer_path.find_last_of('/') + 1);
+
+    std::vector<int> ids;
+    if (std::ifstream{dir + "generation_config.json"}.good()) {
+        const auto eos = YAML::LoadFile(dir + "generation_config.json")["eos_token_id"];
+        if (eos && eos.IsSequence()) {
+            ids = eos.as<std::vector<int>>();
+        }
+        else if (eos && eos.IsScalar()) {
+            ids.push_back(eos.as<int>());
+        }
+    }
+    if (ids.empty() && std::ifstream{dir + "tokenizer_config.json"}.good()) {
+        const auto eos = YAML::LoadFile(dir + "tokenizer_config.json")["eos_token"];
+        if (eos && (eos.IsScalar() || eos.IsMap())) {
+            const int id = tokenizer.TokenId(eos.IsMap() ? eos["content"].as<std::string>() : eos.as<std::string>());
+            if (id >= 0) {
+                ids.push_back(id);
+            }
+        }
+    }
+    if (ids.empty()) {
+        TM_LOG_WARNING("[api_server] No eos token found beside %s, requests end with `stop_token_ids` or the length",
+                       tokenizer_path.c_str());
+    }
+    return ids;
+}
+
+std::string Escape(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size() + 2);
+    for (const auto& c : s) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                    out += buf;
+                }
+                else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+std::string ErrorJson(int code, const std::string& message)
+{
+    std::stringstream ss;
+    ss << "{\"object\": \"error\", \"message\": \"" << Escape(message) << "\", \"type\": \""
+       << (code < 500 ? "invalid_request_error" : "internal_error") << "\", \"code\": " << code << "}";
+    return ss.str();
+}
+
+struct Completion {
+    uint64_t conn;  // 0 when the client is gone
+    bool     stream;
+    int64_t  created;
+    int      prompt_len;
+    int      max_tokens;
+
+    std::unique_ptr<ModelRequest> request;
+    ModelRequest::OutputParam     out;
+
+    int sent = 0;  // bytes of the text sent
+};
+
+class ApiServer {
+public:
+    ApiServer(std::shared_ptr<AbstractTransformerModel> model, const Options& opts, int vocab_size):
+        model_{std::move(model)},
+        name_{opts.model_name},
+        vocab_size_{vocab_size},
+        tokenizer_{opts.tokenizer},
+        eos_ids_{LoadEosIds(opts.tokenizer, tokenizer_)},
+        server_{opts.host,
+                opts.port,
+                [this](uint64_t conn, const HttpRequest& r) { Handle(conn, r); },
+                [this](uint64_t conn) { OnClose(conn); }},
+        rng_{std::random_device{}()}
+    {
+        server_.Watch(queue_.fd(), [this] { Poll(); });
+    }
+
+    void Run()
+    {
+        server_.Run();
+
+        // the callbacks of the pending requests refer to the queue
+        for (auto& [tag, c] : completions_) {
+            c.request->Cancel();
+        }
+        while (!completions_.empty()) {
+            pollfd fd{queue_.fd(), POLLIN, 0};
+            ::poll(&fd, 1, 100);
+            Poll();
+        }
+    }
+
+    HttpServer& server() noexcept
+    {
+        return server_;
+    }
+
+private:
+    void Handle(uint64_t conn, const HttpRequest& r)
+    {
+        if (r.path == "/v1/completions") {
+            return r.method == "POST" ? Complete(conn, r) : Error(conn, 405, "use POST");
+        }
+        if (r.path == "/v1/chat/completions") {
+            return Error(conn, 501, "chat templates are not supported by the native frontend");
+        }
+        if (r.path == "/v1/models" && r.method == "GET") {
+            return server_.Send(conn,
+                                200,
+                                "application/json",
+                                "{\"object\": \"list\", \"data\": [{\"id\": \"" + Escape(name_)
+                                    + "\", \"object\": \"model\", \"owned_by\": \"lmdeploy\"}]}");
+        }
+        if (r.path == "/health" && r.method == "GET") {
+            return server_.Send(conn, 200, "text/plain", "");
+        }
+        Error(conn, 404, "no route for " + r.method + " " + r.path);
+    }
+
+    void Error(uint64_t conn, int code, const std::string& message)
+    {
+        server_.Send(conn, code, "application/json", ErrorJson(code, message));
+    }
+
+    void Complete(uint64_t conn, const HttpRequest& r)
+    {
+        std::vector<int> ids;
+        GenerationConfig gen_cfg{};
+        bool             stream{};
+
+        // JSON is a subset of YAML 1.2, quoted scalars are tagged with "!"
+        try {
+            const auto body = YAML::Load(r.body);
+            if (!body.IsMap()) {
+                return Error(conn, 400, "the body is not a JSON object");
+            }
+
+            auto absent = [](const YAML::Node& x) { return !x || x.IsNull(); };
+
+            // a batch of one prompt
+            auto prompt = body["prompt"];
+            if (!absent(prompt) && prompt.IsSequence() && prompt.size() == 1
+                && (prompt[0].IsSequence() || prompt[0].Tag() == "!")) {
+                prompt = prompt[0];
+            }
+            if (!absent(prompt) && prompt.IsScalar()) {
+                ids = tokenizer_.Encode(prompt.as<std::string>());
+            }
+            else if (!absent(prompt) && prompt.IsSequence()) {
+                for (const auto& x : prompt) {
+                    ids.push_back(x.as<int>());
+                    if (ids.back() < 0 || ids.back() >= vocab_size_) {
+                        return Error(conn, 400, "token id out of the vocab");
+                    }
+                }
+            }
+            if (ids.empty()) {
+                return Error(conn, 400, "`prompt` is required as a string or a list of token ids");
+            }
+
+            if (body["n"].as<int>(1) != 1 || body["echo"].as<bool>(false) || !absent(body["logprobs"])
+                || !absent(body["stop"])) {
+                return Error(conn, 400, "`n`, `echo`, `logprobs` and `stop` are not supported by the native frontend");
+            }
+
+            stream = body["stream"].as<bool>(false);
+
+            gen_cfg.max_new_tokens      = body["max_tokens"].as<int>(16);
+            gen_cfg.top_k               = body["top_k"].as<int>(40);
+            gen_cfg.top_p               = body["top_p"].as<float>(1.f);
+            gen_cfg.min_p               = body["min_p"].as<float>(0.f);
+            gen_cfg.temperature         = body["temperature"].as<float>(.7f);
+            gen_cfg.repetition_penalty  = body["repetition_penalty"].as<float>(1.f);
+            gen_cfg.frequency_penalty   = body["frequency_penalty"].as<float>(0.f);
+            gen_cfg.presence_penalty    = body["presence_penalty"].as<float>(0.f);
+            gen_cfg.random_seed         = body["seed"].as<uint64_t>(rng_());
+            gen_cfg.tenant_id           = body["tenant_id"].as<int>(-1);
+            gen_cfg.tenant_weight       = body["tenant_weight"].as<float>(1.f);
+            gen_cfg.expected_output_len = body["expected_output_len"].as<int>(0);
+            gen_cfg.output_text         = true;
+
+            // same as `_get_generation_config` of the python frontend
+            const auto stop_token_ids = body["stop_token_ids"].as<std::vector<int>>(eos_ids_);
+            if (!stop_token_ids.empty()) {
+                gen_cfg.eos_ids = stop_token_ids;
+                if (!body["ignore_eos"].as<bool>(false)) {
+                    gen_cfg.stop_ids[0] = stop_token_ids;
+                    for (size_t i = 0; i < stop_token_ids.size(); ++i) {
+                        gen_cfg.stop_ids[1].push_back(i + 1);
+                    }
+                }
+            }
+        }
+        catch (const YAML::Exception& e) {
+            return Error(conn, 400, std::string{"invalid request, "} + e.what());
+        }
+
+        if (gen_cfg.max_new_tokens <= 0) {
+            return Error(conn, 400, "`max_tokens` must be positive");
+        }
+        if (!(gen_cfg.tenant_weight > 0)) {
+            return Error(conn, 400, "`tenant_weight` must be positive");
+        }
+        if (gen_cfg.expected_output_len < 0) {
+            return Error(conn, 400, "`expected_output_len` must not be negative");
+        }
+
+        const uint64_t tag = next_tag_++;
+
+        auto& c      = completions_[tag];
+        c.conn       = conn;
+        c.stream     = stream;
+        c.created    = std::time(nullptr);
+        c.prompt_len = ids.size();
+        c.max_tokens = gen_cfg.max_new_tokens;
+        c.request    = model_->createModelInstance(0);
+
+        auto input_ids = std::make_shared<std::vector<int>>(std::move(ids));
+        auto inputs    = std::make_shared<ModelRequest::TensorMap_>();
+        inputs->emplace(
+            "input_ids",
+            ManagedTensor{Tensor{MEMORY_CPU, TYPE_INT32, {input_ids->size()}, input_ids->data()}, input_ids});
+
+        ModelRequest::InputParam param{};
+        param.tensors       = inputs;
+        param.session       = {tag, 0, true, true, false, false, 0};
+        param.gen_cfg       = std::move(gen_cfg);
+        param.stream_output = stream;
+
+        conn_tags_[conn] = tag;
+
+        if (stream && !server_.BeginStream(conn, "text/event-stream")) {
+            completions_.erase(tag);
+            return;
+        }
+
+        c.out = c.request->Forward(std::move(param), [q = &queue_, tag] { q->push(tag); });
+    }
+
+    // the client went away with its request pending
+    void OnClose(uint64_t conn)
+    {
+        if (auto it = conn_tags_.find(conn); it != conn_tags_.end()) {
+            auto& c = completions_.at(it->second);
+            c.conn  = 0;
+            c.request->Cancel();
+            conn_tags_.erase(it);
+        }
+    }
+
+    void Poll()
+    {
+        queue_.drain(tags_);
+        for (const auto& tag : tags_) {
+            const auto it = completions_.find(tag);
+            if (it == completions_.end()) {
+                continue;
+            }
+            auto&      c = it->second;
+            const auto s = c.out.state->exchange(nullptr);
+            if (!s) {  // coalesced into an earlier update
+                continue;
+            }
+            if (c.conn) {
+                Update(c, tag, *s);
+            }
+            if (s->status != Request::kOk) {
+                if (c.conn) {
+                    conn_tags_.erase(c.conn);
+                }
+                completions_.erase(it);
+            }
+        }
+    }
+
+    void Update(Completion& c, uint64_t tag, const RequestState& s)
+    {
+        const auto& outputs = *c.out.tensors;
+
+        // the text is appended before each update and never rewritten
+        const int   length = *outputs.at("text_length")->getPtr<int>();
+        std::string delta(outputs.at("output_text")->getPtr<char>() + c.sent, length - c.sent);
+        c.sent = length;
+
+        const bool done = s.status != Request::kOk;
+
+        if (done && s.status != Request::kFinish) {
+            const int code = s.status == Request::kInvalid || s.status == Request::kTooLong ? 400 :
+                             s.status == Request::kOverload                                  ? 503 :
+                                                                                               500;
+            const auto msg = fmtstr("request failed with status %d", s.status);
+            if (c.stream) {
+                server_.Write(c.conn, "data: " + ErrorJson(code, msg) + "\n\n");
+                server_.Write(c.conn, "data: [DONE]\n\n");
+                server_.EndStream(c.conn);
+            }
+            else {
+                Error(c.conn, code, msg);
+            }
+            return;
+        }
+
+        const int   completion_tokens = std::max(s.seq_len - c.prompt_len, 0);
+        const char* finish_reason     = completion_tokens >= c.max_tokens ? "\"length\"" : "\"stop\"";
+
+        if (c.stream) {
+            if (!delta.empty()) {
+                server_.Write(c.conn, "data: " + Json(c, tag, delta, "null", -1) + "\n\n");
+            }
+            if (done) {
+                server_.Write(c.conn, "data: " + Json(c, tag, "", finish_reason, completion_tokens) + "\n\n");
+                server_.Write(c.conn, "data: [DONE]\n\n");
+                server_.EndStream(c.conn);
+            }
+        }
+        else if (done) {
+            server_.Send(c.conn, 200, "application/json", Json(c, tag, delta, finish_reason, completion_tokens));
+        }
+    }
+
+    // a response or a chunk of the stream, with the usage when `completion_tokens` >= 0
+    std::string
+    Json(const Completion& c, uint64_t tag, const std::string& text, const char* finish_reason, int completion_tokens)
+    {
+        std::stringstream ss;
+        ss << "{\"id\": \"cmpl-" << tag << "\", \"object\": \"text_completion\", \"created\": " << c.created
+           << ", \"model\": \"" << Escape(name_) << "\", \"choices\": [{\"index\": 0, \"text\": \"" << Escape(text)
+           << "\", \"logprobs\": null, \"finish_reason\": " << finish_reason << "}]";
+        if (completion_tokens >= 0) {
+            ss << ", \"usage\": {\"prompt_tokens\": " << c.prompt_len
+               << ", \"completion_tokens\": " << completion_tokens
+               << ", \"total_tokens\": " << c.prompt_len + completion_tokens << "}";
+        }
+        ss << "}";
+        return ss.str();
+    }
+
+private:
+    std::shared_ptr<AbstractTransformerModel> model_;
+
+    const std::string name_;
+    const int         vocab_size_;
+
+    Tokenizer        tokenizer_;
+    std::vector<int> eos_ids_;
+
+    CompletionQueue       queue_;
+    std::vector<uint64_t> tags_;
+
+    HttpServer server_;
+
+    std::unordered_map<uint64_t, Completion> completions_;  // by tag, which is also the session id
+    std::unordered_map<uint64_t, uint64_t>   conn_tags_;
+
+    uint64_t next_tag_ = 1;
+
+    std::mt19937_64 rng_;
+};
+
+HttpServer* g_server{};
+
+void OnSignal(int)
+{
+    if (g_server) {
+        g_server->Stop();
+    }
+}
+
+template<class T>
+std::shared_ptr<AbstractTransformerModel> CreateModel(const std::string& model_dir, const std::string& config)
+{
+    // no context is needed for the callbacks of the native frontend
+    auto ctx_factory = [] { return std::shared_ptr<void>{}; };
+    return std::make_shared<LlamaTritonModel<T>>(model_dir, config, ctx_factory);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+    if (opts.tokenizer.empty()) {
+        opts.tokenizer = opts.model_dir + "/tokenizer.json";
+    }
+
+    YAML::Node reader = opts.config.empty() ? YAML::LoadFile(opts.model_dir + "/config.yaml") :
+                                              YAML::LoadFile(opts.config);
+
+    // the text of the outputs is decoded by the gateway
+    reader["engine_config"]["detokenizer_path"]    = opts.tokenizer;
+    reader["engine_config"]["detokenizer_threads"] = opts.detokenizer_threads;
+
+    YAML::Emitter emitter;
+    emitter << reader;
+    const std::string config = emitter.c_str();
+
+    const int vocab_size = reader["model_config"]["vocab_size"].as<int>();
+
+    if (opts.dtype.empty()) {
+        opts.dtype = reader["model_config"]["weight_type"].as<std::string>("fp16");
+    }
+
+    std::shared_ptr<AbstractTransformerModel> model;
+    if (opts.dtype == "bf16" || opts.dtype == "bfloat16") {
+#ifdef ENABLE_BF16
+        model = CreateModel<__nv_bfloat16>(opts.model_dir, config);
+#else
+        TM_LOG_ERROR("turbomind has not been built with bf16 support.");
+        return 1;
+#endif
+    }
+    else {
+        model = CreateModel<half>(opts.model_dir, config);
+    }
+
+    const int devices = opts.devices ? opts.devices : model->getTensorParaSize() * model->getPipelineParaSize();
+
+    auto for_each_device = [&](auto func) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < devices; ++i) {
+            threads.emplace_back(func, i);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+
+    // same sequence as the python frontend, `createEngine` synchronizes the ranks
+    for_each_device([&](int i) { model->createSharedWeights(i, i); });
+    for_each_device([&](int i) {
+        model->processWeights(i, i);
+        model->createEngine(i, i);
+    });
+
+    TM_LOG_INFO("%s", model->toString().c_str());
+
+    ApiServer server{model, opts, vocab_size};
+
+    g_server = &server.server();
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGTERM, OnSignal);
+
+    server.Run();
+
+    g_server = nullptr;
+
+    return 0;
+}
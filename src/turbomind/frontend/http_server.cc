@@ -0,0 +1,440 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "src/turbomind/frontend/http_server.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+namespace {
+
+// epoll tokens: the listening socket, the stop event, the watched fds and then the connections
+constexpr uint64_t kListen    = 0;
+constexpr uint64_t kStop      = 1;
+constexpr uint64_t kFirstConn = 1024;
+
+constexpr size_t kMaxHeaderBytes = 64 << 10;
+constexpr size_t kMaxBodyBytes   = 64 << 20;
+
+const char* Reason(int status)
+{
+    switch (status) {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 413:
+            return "Payload Too Large";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 500:
+            return "Internal Server Error";
+        case 501:
+            return "Not Implemented";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "";
+    }
+}
+
+std::string Lower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+}  // namespace
+
+struct HttpServer::Connection {
+    uint64_t id;
+    int      fd;
+
+    std::string in;
+    std::string out;
+
+    bool busy{};        // a request is being served
+    bool keep_alive{};  // of the request being served
+    bool closing{};     // closed once the output is flushed
+    bool writable{};    // EPOLLOUT is armed
+};
+
+HttpServer::HttpServer(const std::string& host, int port, Handler handler, OnClose on_close):
+    handler_{std::move(handler)}, on_close_{std::move(on_close)}, next_conn_{kFirstConn}
+{
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    addrinfo*         res{};
+    const std::string service = std::to_string(port);
+    const int         ec      = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &res);
+    FT_CHECK_WITH_INFO(ec == 0, fmtstr("failed to resolve %s:%d, %s", host.c_str(), port, gai_strerror(ec)));
+
+    for (auto p = res; p && listen_fd_ < 0; p = p->ai_next) {
+        const int fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+            listen_fd_ = fd;
+        }
+        else {
+            close(fd);
+        }
+    }
+    freeaddrinfo(res);
+    FT_CHECK_WITH_INFO(listen_fd_ >= 0, fmtstr("failed to listen on %s:%d, %s", host.c_str(), port, strerror(errno)));
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd_  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    FT_CHECK(epoll_fd_ >= 0 && stop_fd_ >= 0);
+
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u64 = kListen;
+    FT_CHECK(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == 0);
+    ev.data.u64 = kStop;
+    FT_CHECK(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &ev) == 0);
+
+    TM_LOG_INFO("[HttpServer] listening on %s:%d", host.c_str(), port);
+}
+
+HttpServer::~HttpServer()
+{
+    for (auto& [id, c] : conns_) {
+        close(c->fd);
+    }
+    close(stop_fd_);
+    close(epoll_fd_);
+    close(listen_fd_);
+}
+
+void HttpServer::Watch(int fd, std::function<void()> cb)
+{
+    const uint64_t token = kStop + 1 + watches_.size();
+    FT_CHECK(token < kFirstConn);
+
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u64 = token;
+    FT_CHECK(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0);
+
+    watches_.emplace(token, std::move(cb));
+}
+
+void HttpServer::Stop() noexcept
+{
+    const uint64_t        one = 1;
+    [[maybe_unused]] auto ret = write(stop_fd_, &one, sizeof(one));
+}
+
+void HttpServer::Run()
+{
+    epoll_event events[256];
+    while (true) {
+        const int n = epoll_wait(epoll_fd_, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n < 0) {
+            FT_CHECK_WITH_INFO(errno == EINTR, fmtstr("epoll_wait failed, %s", strerror(errno)));
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            const uint64_t token = events[i].data.u64;
+            if (token == kStop) {
+                return;
+            }
+            if (token == kListen) {
+                Accept();
+            }
+            else if (token < kFirstConn) {
+                watches_.at(token)();
+            }
+            else if (auto c = Find(token)) {
+                // the connection may be closed by an earlier event of the batch
+                if (events[i].events & EPOLLOUT) {
+                    Flush(*c);
+                }
+                if ((c = Find(token)) && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    Read(*c);
+                }
+            }
+        }
+    }
+}
+
+void HttpServer::Accept()
+{
+    while (true) {
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                TM_LOG_WARNING("[HttpServer] accept failed, %s", strerror(errno));
+            }
+            return;
+        }
+        // the tokens of the streams are small and latency bound
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto c = std::make_unique<Connection>();
+        c->id  = next_conn_++;
+        c->fd  = fd;
+
+        epoll_event ev{};
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = c->id;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        conns_.emplace(c->id, std::move(c));
+    }
+}
+
+void HttpServer::Read(Connection& c)
+{
+    char buf[16 << 10];
+    while (true) {
+        const ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return Close(c);  // closed by the peer or failed
+    }
+    if (!c.busy) {
+        Parse(c);
+    }
+}
+
+void HttpServer::Parse(Connection& c)
+{
+    const size_t header_end = c.in.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+        if (c.in.size() > kMaxHeaderBytes) {
+            Error(c, 431);
+        }
+        return;
+    }
+
+    HttpRequest request;
+
+    // request line, `GET /v1/models HTTP/1.1`
+    size_t     line_end = c.in.find("\r\n");
+    const auto line     = c.in.substr(0, line_end);
+    const auto sp1      = line.find(' ');
+    const auto sp2      = line.rfind(' ');
+    if (sp1 == std::string::npos || sp2 <= sp1) {
+        return Error(c, 400);
+    }
+    request.method = line.substr(0, sp1);
+    request.path   = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    request.path   = request.path.substr(0, request.path.find('?'));
+
+    bool keep_alive = line.substr(sp2 + 1) != "HTTP/1.0";
+
+    size_t length = 0;
+    for (size_t p = line_end + 2; p < header_end; p = line_end + 2) {
+        line_end          = c.in.find("\r\n", p);
+        const auto header = c.in.substr(p, line_end - p);
+        const auto colon  = header.find(':');
+        if (colon == std::string::npos) {
+            return Error(c, 400);
+        }
+        const auto key   = Lower(header.substr(0, colon));
+        const auto first = header.find_first_not_of(" \t", colon + 1);
+        const auto value = first == std::string::npos ? std::string{} : Lower(header.substr(first));
+        if (key == "content-length") {
+            length = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (key == "transfer-encoding" && value != "identity") {
+            return Error(c, 501);
+        }
+        else if (key == "connection") {
+            keep_alive = value == "close" ? false : value == "keep-alive" ? true : keep_alive;
+        }
+    }
+    if (length > kMaxBodyBytes) {
+        return Error(c, 413);
+    }
+
+    const size_t body_begin = header_end + 4;
+    if (c.in.size() < body_begin + length) {
+        return;
+    }
+    request.body = c.in.substr(body_begin, length);
+    c.in.erase(0, body_begin + length);
+
+    c.busy       = true;
+    c.keep_alive = keep_alive;
+
+    handler_(c.id, request);
+}
+
+void HttpServer::Flush(Connection& c)
+{
+    while (!c.out.empty()) {
+        const ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n >= 0) {
+            c.out.erase(0, n);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return Close(c);
+        }
+        break;
+    }
+
+    // wait for the socket to drain before writing the rest
+    if (c.out.empty() == c.writable) {
+        c.writable = !c.out.empty();
+        epoll_event ev{};
+        ev.events   = EPOLLIN | EPOLLRDHUP | (c.writable ? EPOLLOUT : 0);
+        ev.data.u64 = c.id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    if (c.out.empty() && c.closing) {
+        Close(c);
+    }
+}
+
+void HttpServer::Close(Connection& c)
+{
+    const uint64_t id   = c.id;
+    const bool     busy = c.busy;
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+    conns_.erase(id);
+
+    if (busy) {
+        on_close_(id);
+    }
+}
+
+void HttpServer::Error(Connection& c, int status)
+{
+    c.busy       = true;
+    c.keep_alive = false;
+    Send(c.id, status, "text/plain", Reason(status));
+}
+
+HttpServer::Connection* HttpServer::Find(uint64_t conn)
+{
+    const auto it = conns_.find(conn);
+    return it != conns_.end() ? it->second.get() : nullptr;
+}
+
+void HttpServer::Send(uint64_t conn, int status, const std::string& content_type, const std::string& body)
+{
+    auto c = Find(conn);
+    if (!c || !c->busy) {
+        return;
+    }
+
+    char head[256];
+    std::snprintf(head,
+                  sizeof(head),
+                  "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                  status,
+                  Reason(status),
+                  content_type.c_str(),
+                  body.size(),
+                  c->keep_alive ? "keep-alive" : "close");
+    c->out += head;
+    c->out += body;
+
+    c->busy    = false;
+    c->closing = !c->keep_alive;
+
+    Flush(*c);
+
+    // the next request may be already buffered
+    if ((c = Find(conn)) && !c->closing) {
+        Parse(*c);
+    }
+}
+
+bool HttpServer::BeginStream(uint64_t conn, const std::string& content_type)
+{
+    auto c = Find(conn);
+    if (!c || !c->busy) {
+        return false;
+    }
+    c->out += "HTTP/1.1 200 OK\r\nContent-Type: " + content_type
+              + "\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\nConnection: "
+              + (c->keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+    Flush(*c);
+    return Find(conn);
+}
+
+bool HttpServer::Write(uint64_t conn, const std::string& data)
+{
+    auto c = Find(conn);
+    if (!c || !c->busy) {
+        return false;
+    }
+    if (data.empty()) {  // an empty chunk ends the stream
+        return true;
+    }
+    char size[32];
+    std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    c->out += size;
+    c->out += data;
+    c->out += "\r\n";
+    Flush(*c);
+    return Find(conn);
+}
+
+void HttpServer::EndStream(uint64_t conn)
+{
+    auto c = Find(conn);
+    if (!c || !c->busy) {
+        return;
+    }
+    c->out += "0\r\n\r\n";
+
+    c->busy    = false;
+    c->closing = !c->keep_alive;
+
+    Flush(*c);
+
+    if ((c = Find(conn)) && !c->closing) {
+        Parse(*c);
+    }
+}
+
+}  // namespace turbomind
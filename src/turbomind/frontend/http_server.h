@@ -0,0 +1,86 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace turbomind {
+
+struct HttpRequest {
+    std::string method;
+    std::string path;  // without the query
+    std::string body;
+};
+
+// Minimal HTTP/1.1 server of the native frontend on a single epoll loop. Bodies are sized by `Content-Length`,
+// connections are kept alive unless asked otherwise and serve their requests one at a time. A response is sent whole
+// by `Send` or as a chunked stream (e.g. server-sent events) by `BeginStream` / `Write` / `EndStream`, all of them are
+// only called on the thread of `Run`. Other fds, e.g. the eventfd of a `CompletionQueue`, are polled by the same loop
+class HttpServer {
+public:
+    // `conn` identifies the connection until `on_close`, which is called when it goes away with a response pending
+    using Handler = std::function<void(uint64_t conn, const HttpRequest& request)>;
+    using OnClose = std::function<void(uint64_t conn)>;
+
+    HttpServer(const std::string& host, int port, Handler handler, OnClose on_close);
+
+    ~HttpServer();
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    // `cb` is called on the loop when `fd` is readable
+    void Watch(int fd, std::function<void()> cb);
+
+    // Serves until `Stop`
+    void Run();
+
+    // Async-signal-safe
+    void Stop() noexcept;
+
+    void Send(uint64_t conn, int status, const std::string& content_type, const std::string& body);
+
+    // false when the connection is gone
+    bool BeginStream(uint64_t conn, const std::string& content_type);
+
+    bool Write(uint64_t conn, const std::string& data);
+
+    void EndStream(uint64_t conn);
+
+private:
+    struct Connection;
+
+    void Accept();
+
+    void Read(Connection& c);
+
+    // the next request in the input of `c`, if complete
+    void Parse(Connection& c);
+
+    void Flush(Connection& c);
+
+    void Close(Connection& c);
+
+    void Error(Connection& c, int status);
+
+    Connection* Find(uint64_t conn);
+
+private:
+    Handler handler_;
+    OnClose on_close_;
+
+    int listen_fd_{-1};
+    int epoll_fd_{-1};
+    int stop_fd_{-1};
+
+    std::unordered_map<uint64_t, std::function<void()>> watches_;  // by the index of the fd
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> conns_;
+
+    uint64_t next_conn_;
+};
+
+}  // namespace turbomind
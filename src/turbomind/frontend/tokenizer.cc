@@ -0,0 +1,436 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include <yaml-cpp/yaml.h>
+
+#include "src/turbomind/frontend/tokenizer.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+namespace {
+
+const std::string kSpace = "\xe2\x96\x81";  // U+2581, the space of metaspace vocabs
+
+// code point of the UTF-8 sequence at `p` and its length
+uint32_t CodePoint(const std::string& s, size_t p, size_t& len)
+{
+    const auto c = (uint8_t)s[p];
+    const int  n = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+    uint32_t   x = n == 1 ? c : c & (0x3f >> (n - 1));
+    int        i = 1;
+    for (; i < n && p + i < s.size(); ++i) {
+        x = x << 6 | ((uint8_t)s[p + i] & 0x3f);
+    }
+    len = i;
+    return x;
+}
+
+void AppendCodePoint(uint32_t x, std::string& s)
+{
+    if (x < 0x80) {
+        s += (char)x;
+    }
+    else if (x < 0x800) {
+        s += (char)(0xc0 | x >> 6);
+        s += (char)(0x80 | (x & 0x3f));
+    }
+    else if (x < 0x10000) {
+        s += (char)(0xe0 | x >> 12);
+        s += (char)(0x80 | (x >> 6 & 0x3f));
+        s += (char)(0x80 | (x & 0x3f));
+    }
+    else {
+        s += (char)(0xf0 | x >> 18);
+        s += (char)(0x80 | (x >> 12 & 0x3f));
+        s += (char)(0x80 | (x >> 6 & 0x3f));
+        s += (char)(0x80 | (x & 0x3f));
+    }
+}
+
+enum CharClass
+{
+    kLetter,
+    kDigit,
+    kBlank,  // whitespace except newlines
+    kNewline,
+    kOther,
+};
+
+CharClass Classify(uint32_t c)
+{
+    if (c == '\n' || c == '\r') {
+        return kNewline;
+    }
+    if (c < 0x80) {
+        return std::isalpha(c) ? kLetter : std::isdigit(c) ? kDigit : std::isspace(c) ? kBlank : kOther;
+    }
+    if (c == 0x85 || c == 0xa0 || c == 0x3000 || (c >= 0x2000 && c <= 0x200a)) {
+        return kBlank;
+    }
+    // general & CJK punctuation and the ASCII variants of the full width forms, the rest is approximated as letters
+    if ((c >= 0x2010 && c <= 0x205e) || (c >= 0x3001 && c <= 0x303f) || (c >= 0xff01 && c <= 0xff0f)
+        || (c >= 0xff1a && c <= 0xff20)) {
+        return kOther;
+    }
+    return kLetter;
+}
+
+bool IsSpace(CharClass c)
+{
+    return c == kBlank || c == kNewline;
+}
+
+// the node and the members of its `Sequence`s
+void CollectTypes(const YAML::Node& node, std::vector<YAML::Node>& out)
+{
+    if (!node || !node.IsMap()) {
+        return;
+    }
+    out.push_back(node);
+    for (const char* key : {"normalizers", "pretokenizers", "decoders", "processors"}) {
+        if (const auto xs = node[key]; xs && xs.IsSequence()) {
+            for (const auto& x : xs) {
+                CollectTypes(x, out);
+            }
+        }
+    }
+}
+
+std::string TypeOf(const YAML::Node& node)
+{
+    return node["type"].as<std::string>("");
+}
+
+}  // namespace
+
+Tokenizer::Tokenizer(const std::string& path)
+{
+    // JSON is a subset of YAML 1.2
+    const auto root  = YAML::LoadFile(path);
+    const auto model = root["model"];
+    const auto vocab = model["vocab"];
+    const auto merge = model["merges"];
+
+    FT_CHECK_WITH_INFO(TypeOf(model) == "BPE" || (vocab.IsMap() && merge.IsSequence()),
+                       fmtstr("Only BPE models are supported, %s", path.c_str()));
+
+    for (const auto& kv : vocab) {
+        vocab_.emplace(kv.first.as<std::string>(), kv.second.as<int>());
+    }
+
+    // "a b" or ["a", "b"]
+    int rank = 0;
+    for (const auto& m : merge) {
+        const auto key = m.IsSequence() ? m[0].as<std::string>() + " " + m[1].as<std::string>() : m.as<std::string>();
+        ranks_.emplace(key, rank++);
+    }
+
+    for (const auto& x : root["added_tokens"]) {
+        added_.emplace_back(x["content"].as<std::string>(), x["id"].as<int>());
+    }
+    std::stable_sort(
+        added_.begin(), added_.end(), [](auto& a, auto& b) { return a.first.size() > b.first.size(); });
+
+    std::vector<YAML::Node> normalizers, pre_tokenizers, decoders, processors;
+    CollectTypes(root["normalizer"], normalizers);
+    CollectTypes(root["pre_tokenizer"], pre_tokenizers);
+    CollectTypes(root["decoder"], decoders);
+    CollectTypes(root["post_processor"], processors);
+
+    for (const auto& x : pre_tokenizers) {
+        const auto type = TypeOf(x);
+        if (type == "ByteLevel") {
+            byte_level_ = true;
+        }
+        else if (type == "Split") {
+            const auto pattern = x["pattern"]["Regex"].as<std::string>("");
+            if (pattern.find("[^\\r\\n\\p{L}\\p{N}]?\\p{L}+") != std::string::npos) {
+                modern_split_ = true;
+                digit_group_  = pattern.find("\\p{N}{1,3}") != std::string::npos ? 3 : 1;
+            }
+        }
+        else if (type == "Digits") {
+            digit_group_ = x["individual_digits"].as<bool>(false) ? 1 : digit_group_;
+        }
+        else if (type == "Metaspace") {
+            const auto scheme = x["prepend_scheme"].as<std::string>("always");
+            if (x["add_prefix_space"].as<bool>(true) && scheme != "never") {
+                prepend_space_ = scheme == "first" ? 1 : 2;
+            }
+        }
+    }
+    for (const auto& x : decoders) {
+        byte_level_ |= TypeOf(x) == "ByteLevel";
+    }
+    for (const auto& x : normalizers) {
+        if (TypeOf(x) == "Prepend") {
+            prepend_space_ = 2;
+        }
+    }
+
+    byte_fallback_ = model["byte_fallback"].as<bool>(false);
+
+    if (const auto unk = model["unk_token"]; unk && !unk.IsNull()) {
+        unk_id_ = TokenId(unk.as<std::string>());
+    }
+
+    // the 1st special token of the template of single sequences, e.g. `<s> $A`
+    for (const auto& x : processors) {
+        if (TypeOf(x) == "TemplateProcessing" && x["single"].IsSequence() && x["single"].size()) {
+            if (const auto special = x["single"][0]["SpecialToken"]) {
+                const auto ids = x["special_tokens"][special["id"].as<std::string>()]["ids"];
+                bos_id_        = ids && ids.size() ? ids[0].as<int>() : -1;
+            }
+        }
+    }
+
+    // `bytes_to_unicode` of GPT-2, printable bytes map to themselves and the others to 256 + n in order
+    int n = 0;
+    for (int b = 0; b < 256; ++b) {
+        const bool printable = (b >= 33 && b <= 126) || (b >= 161 && b <= 172) || (b >= 174 && b <= 255);
+        AppendCodePoint(printable ? b : 256 + n++, byte_chars_[b]);
+    }
+
+    TM_LOG_INFO("[Tokenizer] %d tokens, %d merges, %d added (%s%s) from %s",
+                (int)vocab_.size(),
+                (int)ranks_.size(),
+                (int)added_.size(),
+                byte_level_ ? "byte-level" : "metaspace",
+                byte_level_ ? (modern_split_ ? ", llama-3 split" : ", gpt-2 split") : "",
+                path.c_str());
+}
+
+int Tokenizer::TokenId(const std::string& token) const
+{
+    for (const auto& [content, id] : added_) {
+        if (content == token) {
+            return id;
+        }
+    }
+    const auto it = vocab_.find(token);
+    return it != vocab_.end() ? it->second : -1;
+}
+
+std::vector<int> Tokenizer::Encode(const std::string& text, bool add_bos) const
+{
+    std::vector<int> ids;
+    if (add_bos && bos_id_ >= 0) {
+        ids.push_back(bos_id_);
+    }
+
+    // next occurrence of each added token, updated when passed
+    std::vector<size_t> next(added_.size());
+    for (size_t i = 0; i < added_.size(); ++i) {
+        next[i] = text.find(added_[i].first);
+    }
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        int best = -1;
+        for (size_t i = 0; i < added_.size(); ++i) {
+            if (next[i] < pos) {
+                next[i] = text.find(added_[i].first, pos);
+            }
+            // the longest one of the earliest ones
+            if (next[i] != std::string::npos && (best < 0 || next[i] < next[best])) {
+                best = i;
+            }
+        }
+        const size_t end = best < 0 ? text.size() : next[best];
+        EncodeSegment(text.substr(pos, end - pos), pos == 0, ids);
+        if (best < 0) {
+            break;
+        }
+        ids.push_back(added_[best].second);
+        pos = end + added_[best].first.size();
+    }
+
+    return ids;
+}
+
+void Tokenizer::EncodeSegment(const std::string& text, bool first, std::vector<int>& ids) const
+{
+    if (text.empty()) {
+        return;
+    }
+
+    if (byte_level_) {
+        std::string word;
+        for (size_t i = 0; i < text.size();) {
+            const size_t end = NextWord(text, i);
+            word.clear();
+            for (; i < end; ++i) {
+                word += byte_chars_[(uint8_t)text[i]];
+            }
+            EncodeWord(word, ids);
+        }
+        return;
+    }
+
+    std::string s = prepend_space_ == 2 || (prepend_space_ == 1 && first) ? kSpace : "";
+    for (const auto& c : text) {
+        if (c == ' ') {
+            s += kSpace;
+        }
+        else {
+            s += c;
+        }
+    }
+
+    // words start at the spaces after the other characters, a run of spaces is kept with the word after it
+    size_t begin = 0;
+    for (size_t p = kSpace.size(); p < s.size(); ++p) {
+        if (s.compare(p, kSpace.size(), kSpace) == 0 && s.compare(p - kSpace.size(), kSpace.size(), kSpace) != 0) {
+            EncodeWord(s.substr(begin, p - begin), ids);
+            begin = p;
+        }
+    }
+    EncodeWord(s.substr(begin), ids);
+}
+
+void Tokenizer::EncodeWord(const std::string& word, std::vector<int>& ids) const
+{
+    if (word.empty()) {
+        return;
+    }
+    if (const auto it = vocab_.find(word); it != vocab_.end()) {
+        ids.push_back(it->second);
+        return;
+    }
+
+    std::vector<std::string> symbols;
+    for (size_t p = 0, len = 0; p < word.size(); p += len) {
+        CodePoint(word, p, len);
+        symbols.push_back(word.substr(p, len));
+    }
+
+    // merge the pair of the highest priority until there is none
+    while (symbols.size() > 1) {
+        int best = -1;
+        int rank = INT_MAX;
+        for (size_t i = 0; i + 1 < symbols.size(); ++i) {
+            const auto it = ranks_.find(symbols[i] + " " + symbols[i + 1]);
+            if (it != ranks_.end() && it->second < rank) {
+                rank = it->second;
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        symbols[best] += symbols[best + 1];
+        symbols.erase(symbols.begin() + best + 1);
+    }
+
+    for (const auto& s : symbols) {
+        if (const auto it = vocab_.find(s); it != vocab_.end()) {
+            ids.push_back(it->second);
+        }
+        else if (byte_fallback_) {
+            for (const auto& c : s) {
+                char piece[8];
+                std::snprintf(piece, sizeof(piece), "<0x%02X>", (uint8_t)c);
+                if (const auto jt = vocab_.find(piece); jt != vocab_.end()) {
+                    ids.push_back(jt->second);
+                }
+            }
+        }
+        else if (unk_id_ >= 0) {
+            ids.push_back(unk_id_);
+        }
+    }
+}
+
+// GPT-2:    's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+// llama-3:  (?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|
+//           \s+(?!\S)|\s+
+size_t Tokenizer::NextWord(const std::string& s, size_t i) const
+{
+    const size_t n = s.size();
+
+    auto at = [&](size_t p, size_t& next) {
+        size_t len;
+        const auto c = Classify(CodePoint(s, p, len));
+        next         = p + len;
+        return c;
+    };
+    // end of the run of `c` from `p`, at most `max` characters
+    auto run = [&](size_t p, CharClass c, int max) {
+        for (size_t q; p < n && max-- > 0 && at(p, q) == c; p = q) {}
+        return p;
+    };
+
+    if (s[i] == '\'') {
+        for (const char* x : {"s", "t", "re", "ve", "m", "ll", "d"}) {
+            const size_t len = std::strlen(x);
+            if (i + 1 + len <= n) {
+                bool match = true;
+                for (size_t k = 0; k < len; ++k) {
+                    const char c = s[i + 1 + k];
+                    match &= (modern_split_ ? (char)std::tolower(c) : c) == x[k];
+                }
+                if (match) {
+                    return i + 1 + len;
+                }
+            }
+        }
+    }
+
+    size_t    i1, i2;
+    const int c0 = at(i, i1);
+    const int c1 = i1 < n ? at(i1, i2) : -1;
+
+    const int max_digits = digit_group_ ? digit_group_ : INT_MAX;
+
+    if (modern_split_) {
+        if (c0 == kLetter) {
+            return run(i, kLetter, INT_MAX);
+        }
+        if (c1 == kLetter && (c0 == kBlank || c0 == kOther)) {
+            return run(i1, kLetter, INT_MAX);
+        }
+        if (c0 == kDigit) {
+            return run(i, kDigit, max_digits);
+        }
+        if (c0 == kOther || (s[i] == ' ' && c1 == kOther)) {
+            return run(run(c0 == kOther ? i : i1, kOther, INT_MAX), kNewline, INT_MAX);
+        }
+        // whitespace up to the last newline of the run
+        size_t last = std::string::npos;
+        for (size_t p = i, q; p < n && IsSpace(at(p, q)); p = q) {
+            if (at(p, q) == kNewline) {
+                last = q;
+            }
+        }
+        if (last != std::string::npos) {
+            return last;
+        }
+    }
+    else {
+        const bool space = s[i] == ' ' && c1 >= 0 && !IsSpace((CharClass)c1);
+        const auto c     = space ? (CharClass)c1 : (CharClass)c0;
+        const auto p     = space ? i1 : i;
+        if (c == kLetter || c == kOther) {
+            return run(p, c, INT_MAX);
+        }
+        if (c == kDigit) {
+            return run(p, kDigit, max_digits);
+        }
+    }
+
+    // a run of whitespace followed by a word leaves its last character to the word
+    size_t end = i, last = i;
+    for (size_t q; end < n && IsSpace(at(end, q)); end = q) {
+        last = end;
+    }
+    return end < n && last > i ? last : end;
+}
+
+}  // namespace turbomind
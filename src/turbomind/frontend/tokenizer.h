@@ -0,0 +1,60 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace turbomind {
+
+// Native encoder of the prompts of the native frontend, loaded from the `tokenizer.json` of HF tokenizers with BPE
+// models, byte-level (GPT-2 style) or metaspace (sentencepiece style, with byte fallback). The added tokens are matched
+// literally before the model, the BOS token of the post processor is prepended. The byte-level pre-tokenizer is a
+// fixed scanner of the split patterns of GPT-2 and of the llama-3 / qwen-2 family that treats non-ASCII characters as
+// letters, so the ids may differ from the HF tokenizer for some texts; exact ids can be sent instead of the text.
+class Tokenizer {
+public:
+    explicit Tokenizer(const std::string& path);
+
+    std::vector<int> Encode(const std::string& text, bool add_bos = true) const;
+
+    // id of a token by its piece or the content of an added token, -1 if absent
+    int TokenId(const std::string& token) const;
+
+    size_t vocab_size() const noexcept
+    {
+        return vocab_.size();
+    }
+
+private:
+    // the model on a segment of the text without added tokens
+    void EncodeSegment(const std::string& text, bool first, std::vector<int>& ids) const;
+
+    // BPE of a pre-tokenized word in the alphabet of the vocab
+    void EncodeWord(const std::string& word, std::vector<int>& ids) const;
+
+    // end of the pre-tokenized word starting at `i` of the byte-level pre-tokenizer
+    size_t NextWord(const std::string& s, size_t i) const;
+
+private:
+    std::unordered_map<std::string, int> vocab_;
+    std::unordered_map<std::string, int> ranks_;  // "a b" -> priority of the merge
+
+    std::vector<std::pair<std::string, int>> added_;  // content -> id, longest first
+
+    std::array<std::string, 256> byte_chars_;  // byte-level alphabet of each byte
+
+    bool byte_level_{};
+    bool byte_fallback_{};
+    bool modern_split_{};   // llama-3 / qwen-2 split pattern instead of the one of GPT-2
+    int  digit_group_{};    // max digits of a word, 0 for unlimited
+    int  prepend_space_{};  // metaspace, 0 for none, 1 for the first segment, 2 for every segment
+
+    int bos_id_{-1};
+    int unk_id_{-1};
+};
+
+}  // namespace turbomind
@@ -23,4 +23,7 @@ struct Sm75: Arch<750, 800> {
 struct Sm80: Arch<800> {
 };
 
+struct Sm89: Arch<890> {
+};
+
 }  // namespace turbomind::arch
@@ -2,6 +2,7 @@
 
 #include "attention.h"
 #include "attention_config.h"
+#include "decoding.h"
 #include "src/turbomind/kernels/attention/arch.h"
 #include "src/turbomind/models/llama/llama_utils.h"
 
@@ -14,20 +15,26 @@ template<class T>
 void dispatchAttention(const AttentionParams<T>& params)
 {
     using namespace attention;
-    auto dispatch = [&](const auto dim) {
-        constexpr int kHeadDim = dim;
+
+    // Short inputs against the cache blocks (speculative verification, the tails of chunked prefills) are decoded with
+    // the queries of the heads sharing a KV head in one tile, which reads the KV once per tile instead of per head
+    if (params.block_kv && !params.cascade_q_idx && !params.prefix_len && !params.cold_len && params.cp.size <= 1
+        && !params.pre_rope_kv && dispatchMultiQueryDecoding(params)) {
+        return;
+    }
+    auto dispatch = [&](const auto dim, const auto type) {
+        constexpr int       kHeadDim = dim;
+        constexpr CacheType kType    = type;
         if (params.arch >= 80) {
-            using Config = AttentionConfig<arch::Sm80, T, kHeadDim, CacheType::kLinear>;
+            using Config = AttentionConfig<arch::Sm80, T, kHeadDim, kType>;
             return invokeAttention<typename Config::Kernel>(params);
         }
         if constexpr (!std::is_same_v<T, nv_bfloat16>) {
             if (params.arch == 75) {
-                return invokeAttention<typename AttentionConfig<arch::Sm75, T, kHeadDim, CacheType::kLinear>::Kernel>(
-                    params);
+                return invokeAttention<typename AttentionConfig<arch::Sm75, T, kHeadDim, kType>::Kernel>(params);
             }
             else if (params.arch >= 70) {
-                return invokeAttention<typename AttentionConfig<arch::Sm70, T, kHeadDim, CacheType::kLinear>::Kernel>(
-                    params);
+                return invokeAttention<typename AttentionConfig<arch::Sm70, T, kHeadDim, kType>::Kernel>(params);
             }
         }
         else {
@@ -40,18 +47,58 @@ void dispatchAttention(const AttentionParams<T>& params)
         FT_CHECK(0);
     };
 
+    // the quantized history is dequantized in registers when read from the cache blocks
+    auto dispatch_quant = [&](const auto dim, auto kv) {
+        using Tkv              = decltype(kv);
+        constexpr int kHeadDim = dim;
+        FT_CHECK_WITH_INFO(params.arch >= 80, "reading the quantized kv cache blocks requires sm80");
+        if constexpr (std::is_same_v<Tkv, fp8_e4m3>) {
+            if (params.fp8_qk && params.arch >= 89) {
+                using Config = AttentionConfig<arch::Sm89, T, kHeadDim, CacheType::kBlock, Tkv>;
+                return invokeAttention<typename Config::Kernel>(params);
+            }
+        }
+        using Config = AttentionConfig<arch::Sm80, T, kHeadDim, CacheType::kBlock, Tkv>;
+        return invokeAttention<typename Config::Kernel>(params);
+    };
+
+    // the kv of the prefills is read from the cache blocks or the linear buffer
+    auto dispatch_cache = [&](const auto dim) {
+        if (params.block_kv) {
+            if (params.quant_policy & QuantPolicy::kCacheKVInt8) {
+                return dispatch_quant(dim, uint8_t{});
+            }
+            else if (params.quant_policy & QuantPolicy::kCacheKVInt4) {
+                return dispatch_quant(dim, uint4_t{});
+            }
+            else if (params.quant_policy & QuantPolicy::kCacheKVFp8) {
+                return dispatch_quant(dim, fp8_e4m3{});
+            }
+            return dispatch(dim, std::integral_constant<CacheType, CacheType::kBlock>{});
+        }
+        return dispatch(dim, std::integral_constant<CacheType, CacheType::kLinear>{});
+    };
+
     if (params.size_per_head == 64) {
-        return dispatch(std::integral_constant<int, 64>{});
+        return dispatch_cache(std::integral_constant<int, 64>{});
     }
     else if (params.size_per_head == 128) {
-        return dispatch(std::integral_constant<int, 128>{});
+        return dispatch_cache(std::integral_constant<int, 128>{});
     }
 
+    FT_CHECK_WITH_INFO(!params.block_kv, "reading the kv cache blocks requires head_dim 64 or 128");
+
     if (params.size_per_head == 192) {
         using Config = AttentionConfig<arch::Sm80, T, 192, CacheType::kLinear>;
         return invokeAttention<typename Config::Kernel>(params);
     }
 
+    if (params.size_per_head == 256) {
+        FT_CHECK_WITH_INFO(params.arch >= 80, "head_dim 256 requires sm80");
+        using Config = AttentionConfig<arch::Sm80, T, 256, CacheType::kLinear>;
+        return invokeAttention<typename Config::Kernel>(params);
+    }
+
     FT_CHECK(0);
 }
 
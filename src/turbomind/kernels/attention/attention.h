@@ -11,4 +11,21 @@ constexpr int MAX_CTA_S = 64;
 template<typename T>
 void dispatchAttention(const AttentionParams<T>& params);
 
+namespace attention {
+
+// Context parallelism, scales the output of the rank by its share of the softmax over the keys of all the ranks, the
+// outputs are then summed over the ranks. `lse` is the log2-sum-exp of the scores of each rank [cp_size, query_num,
+// head_num]
+template<class T>
+void invokeMergeContextParallel(T*           out,
+                                const float* lse,
+                                int          cp_size,
+                                int          cp_rank,
+                                int          query_num,
+                                int          head_num,
+                                int          head_dim,
+                                cudaStream_t stream);
+
+}  // namespace attention
+
 }  // namespace turbomind
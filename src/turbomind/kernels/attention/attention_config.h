@@ -6,6 +6,8 @@
 #include "block_iterator.h"
 #include "cta_map.h"
 #include "impl_16816.h"
+#include "impl_16816_quant.h"
+#include "impl_16832_e4m3.h"
 #include "impl_1688.h"
 #include "impl_884.h"
 #include "linear_iterator.h"
@@ -22,7 +24,7 @@ enum class CacheType
     kBlock,
 };
 
-template<class Arch, class T, int HeadDim, CacheType cache_type>
+template<class Arch, class T, int HeadDim, CacheType cache_type, class Tkv = T>
 struct AttentionConfig {
     static_assert(sizeof(T) == 0, "config not found");
 };
@@ -46,13 +48,44 @@ struct AttentionConfig<arch::Sm80, T, HeadDim, CacheType::kLinear>: Base_64x64_1
     using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<2>, Attention>, CacheIter, AttentionCtaMap>;
 };
 
+struct Base_64x32_16x32 {
+    static constexpr int CTA_Q  = 64;
+    static constexpr int CTA_S  = 32;
+    static constexpr int WARP_Q = 16;
+    static constexpr int WARP_S = 32;
+};
+
+// Narrower S tiles for 256-dim heads to leave registers for the (16, 256) output fragment
+template<class T>
+struct AttentionConfig<arch::Sm80, T, 256, CacheType::kLinear>: Base_64x32_16x32 {
+    using Attention = Impl<MMA_16816, T, T, 1, CTA_Q, CTA_S, 1, WARP_Q, WARP_S, 256, 2>;
+    using CacheIter = LinearIteratorFactory<T, CTA_S, 256>;
+    using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<2>, Attention>, CacheIter, AttentionCtaMap>;
+};
+
 template<class T, int HeadDim>
 struct AttentionConfig<arch::Sm80, T, HeadDim, CacheType::kBlock>: Base_64x64_16x64 {
     using Attention = Impl<MMA_16816, T, T, 1, CTA_Q, CTA_S, 1, WARP_Q, WARP_S, HeadDim, 3>;
-    using CacheIter = LinearIteratorFactory<T, CTA_S, HeadDim>;
+    using CacheIter = GetBlockIterFactory<T, T, CTA_S, HeadDim>;
+    using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<3>, Attention>, CacheIter, AttentionCtaMap>;
+};
+
+// The history in a quantized cache is dequantized in registers when read from the blocks
+template<class T, int HeadDim, class Tkv>
+struct AttentionConfig<arch::Sm80, T, HeadDim, CacheType::kBlock, Tkv>: Base_64x64_16x64 {
+    using Attention = Impl<MMA_16816, T, Tkv, 1, CTA_Q, CTA_S, 1, WARP_Q, WARP_S, HeadDim, 3>;
+    using CacheIter = GetBlockIterFactory<T, Tkv, CTA_S, HeadDim>;
     using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<3>, Attention>, CacheIter, AttentionCtaMap>;
 };
 
+// S = Q K^T of an e4m3 cache on the fp8 tensor cores
+template<class T, int HeadDim>
+struct AttentionConfig<arch::Sm89, T, HeadDim, CacheType::kBlock, fp8_e4m3>: Base_64x64_16x64 {
+    using Attention = Impl<MMA_16832, T, fp8_e4m3, 1, CTA_Q, CTA_S, 1, WARP_Q, WARP_S, HeadDim, 3>;
+    using CacheIter = GetBlockIterFactory<T, fp8_e4m3, CTA_S, HeadDim>;
+    using Kernel    = AttentionUniversal<arch::Sm89, Mainloop<Sm80_CpAsync<3>, Attention>, CacheIter, AttentionCtaMap>;
+};
+
 template<class T, int HeadDim, CacheType Ctype>
 struct AttentionConfig<arch::Sm75, T, HeadDim, Ctype>: Base_64x64_16x64 {
     using Attention = Impl<MMA_1688, T, T, 1, CTA_Q, CTA_S, 1, WARP_Q, WARP_S, HeadDim, 2>;
@@ -21,6 +21,40 @@ struct BlockIteratorParams {
     const int* cu_block_nums;
     int        layer_id;
     int        block_len;
+    int        layer_offset;  // bytes of the block before the layer when the layers differ in layout, `layer_id` is 0
+    // [batch_size], the block the partial block of a fork is copied from by the first write to it, see
+    // `SequenceManager::TakeFirstWriteSource`. Null for none, not with context parallelism
+    char* const* cow_blocks;
+};
+
+// Context parallelism, the tokens of a sequence are dealt to the ranks in runs of `block_len`, which is the length of
+// the local cache blocks. Rank `r` holds the runs `r`, `r + size`, ... in its blocks
+struct ContextParallelParam {
+    int size;
+    int rank;
+    int block_len;
+
+    __host__ __device__ bool is_local(int t) const
+    {
+        return t / block_len % size == rank;
+    }
+    // local index of a token held by the rank
+    __host__ __device__ int local_idx(int t) const
+    {
+        return t / (block_len * size) * block_len + t % block_len;
+    }
+    // global position of a local index
+    __host__ __device__ int global_pos(int i) const
+    {
+        return (i / block_len * size + rank) * block_len + i % block_len;
+    }
+    // tokens of the rank among the first `n`
+    __host__ __device__ int local_len(int n) const
+    {
+        const int span = block_len * size;
+        const int rem  = n % span - rank * block_len;
+        return n / span * block_len + (rem < 0 ? 0 : rem < block_len ? rem : block_len);
+    }
 };
 
 /// TODO: Rename to attention::Param
@@ -46,6 +80,8 @@ struct AttentionParams {
 
     LinearIteratorParams linear_iter_params;
     BlockIteratorParams  block_iter_params;
+    // the prefill kernels read the kv from the cache blocks instead of the linear buffer
+    bool block_kv;
 
     // batch-level params
     int token_num;
@@ -61,12 +97,16 @@ struct AttentionParams {
 
     // rotary embedding
     RopeKernelParam rope_param;
+    // the keys are cached without the rotary embedding, which is applied when they are read
+    bool pre_rope_kv;
 
     // log(n) attention
     bool use_logn_attn;
     int  max_position_embeddings;
 
     int quant_policy;
+    // Q K^T of the prefills over an e4m3 cache on the fp8 tensor cores (sm89+)
+    bool fp8_qk;
 
     int    max_split_k;
     int*   split_cnt;
@@ -75,6 +115,30 @@ struct AttentionParams {
     float* partial_L;
     int*   locks;
 
+    // cascade decoding, the prefixes shared by groups of sequences are attended once by the prefill kernels, the
+    // partials of the prefix pass take the first `prefix_splits` slots and are merged with the suffixes by the reduce
+    const int* cascade_q_idx;  // [q_num], token of each query, only set for the prefix pass
+    const int* prefix_len;     // [batch_size], shared prefix skipped by the suffix pass
+    int        prefix_splits;
+
+    // tiered kv cache, the blocks of the first `cold_len` tokens are quantized with `cold_quant_policy`. They are
+    // attended by a decoding pass of their own with `cold_pass` set and `prefix_len = cold_len`, whose partials take
+    // the slots of the prefix pass
+    const int* cold_len;  // [batch_size], optional
+    int        cold_quant_policy;
+    bool       cold_pass;
+
+    // tree verification of speculative decoding, bit `j` of a query is set when it attends to the `j`-th token of the
+    // input of its sequence, the cached history is always visible. Only for inputs of at most 64 tokens
+    const uint64_t* tree_mask;  // [token_num], optional
+
+    // context parallelism, `cu_k_len` counts the local keys of the rank while the positions of the tokens follow
+    // `cp_cu_k_len`. The log2-sum-exp of the scores of each query & head is written to `cp_lse` for the merge of the
+    // partial outputs of the ranks
+    ContextParallelParam cp;
+    const int*           cp_cu_k_len;  // [batch_size + 1]
+    float*               cp_lse;       // [token_num, num_heads]
+
     int          arch;
     cudaStream_t stream;
 
@@ -55,7 +55,10 @@ void invokeAttention(const typename Kernel::ParamType& params)
     dim3 grid = cta_map.get_grid_shape();
 
     const int grid_size = grid.x * grid.y * grid.z;
-    const int split_cnt = GetSplitCount(max_split_count, grid_size, caps.y, caps.x, 8);
+    // the splits of the prefix pass are fixed as their partials are reduced by the suffix pass
+    const int split_cnt = params.cascade_q_idx ?
+                              params.prefix_splits :
+                              GetSplitCount(max_split_count, grid_size, caps.y, caps.x, 8, tile_count);
 
     // adjust split cnt and update grid shape
     cta_map.set_split_cnt(split_cnt);
@@ -65,12 +68,17 @@ void invokeAttention(const typename Kernel::ParamType& params)
 
     const int q_group_size = params.num_heads / params.num_kv_heads;
 
-    kernel_func<<<grid, block, kSmemSize, params.stream>>>(params,
-                                                           cache_iter_factory,
-                                                           cta_map,
-                                                           q_group_size,
-                                                           1,            // q_head_per_cta
-                                                           q_group_size  // cta_per_q_group
+    LaunchKernel(kernel_func,
+                 grid,
+                 block,
+                 kSmemSize,
+                 params.stream,
+                 params,
+                 cache_iter_factory,
+                 cta_map,
+                 q_group_size,
+                 1,            // q_head_per_cta
+                 q_group_size  // cta_per_q_group
     );
 
     if (auto err = cudaGetLastError(); err != cudaSuccess) {
@@ -78,8 +86,9 @@ void invokeAttention(const typename Kernel::ParamType& params)
         std::abort();
     }
 
-    if (split_cnt > 1 && Kernel::need_separate_reduce(split_cnt)) {
+    if (split_cnt > 1 && Kernel::need_separate_reduce(split_cnt) && !params.cascade_q_idx) {
         attention::invokeReduce<Kernel::kHeadDim>(params.out,
+                                                  params.cp_lse,
                                                   params.partial_M,
                                                   params.partial_L,
                                                   params.partial_O,
@@ -7,6 +7,7 @@
 #include "src/turbomind/kernels/attention/rotary_embedding.h"
 #include "src/turbomind/kernels/core/array_ops.h"
 #include "src/turbomind/kernels/core/layout.h"
+#include "src/turbomind/kernels/core/pdl.h"
 #include "src/turbomind/kernels/core/sync.h"
 #include <limits>
 #include <type_traits>
@@ -61,7 +62,7 @@ struct AttentionUniversal {
 
     __device__ bool check_h(int hi)
     {
-        if constexpr (CTA_Q > 1) {
+        if constexpr (CTA_H == 1) {
             // bypass the check for prefill kernels since `hi == 0` constantly
             return true;
         }
@@ -135,11 +136,11 @@ struct AttentionUniversal {
                 }
             }
         }
-        else if constexpr (CTA_Q == 1) {
+        else {  // the rows are (q, h) pairs
             Array<T, kVecSize> bias_Q[ITER_S][ITER_C];
             PRAGMA_UNROLL
             for (int s = 0; s < ITER_S; ++s) {
-                const int hi = offset.y + s * Map::kDeltaS;
+                const int hi = (offset.y + s * Map::kDeltaS) % CTA_H;
                 PRAGMA_UNROLL
                 for (int c = 0; c < ITER_C; ++c) {
                     const int di    = offset.x + c * Map::kDeltaC;
@@ -160,9 +161,6 @@ struct AttentionUniversal {
                 }
             }
         }
-        else {
-            static_assert(CTA_Q == 1 || CTA_H == 1);
-        }
     }
 
     template<class Iterator>
@@ -233,7 +231,7 @@ struct AttentionUniversal {
                 const int ti = (offset.y + s * Map::kDeltaS) / CTA_H + query_idx + history_len;
                 rope.apply(vec_Q[s][c], ti);
                 if constexpr (kProcessKV) {
-                    if (s == 0) {
+                    if (s == 0 && !params.pre_rope_kv) {
                         rope.apply(vec_K[0][c], ti);
                     }
                 }
@@ -244,7 +242,7 @@ struct AttentionUniversal {
             PRAGMA_UNROLL
             for (int s = 0; s < ITER_S; ++s) {
                 const int   ti = (offset.y + s * Map::kDeltaS) / CTA_H + query_idx + history_len;
-                LogNScaling logn_scaling(ti, params.max_position_embeddings);
+                LogNScaling logn_scaling(ti + rope.offset_, params.max_position_embeddings);
                 PRAGMA_UNROLL
                 for (int c = 0; c < ITER_C; ++c) {
                     logn_scaling.apply(vec_Q[s][c]);
@@ -254,7 +252,9 @@ struct AttentionUniversal {
 
         if constexpr (kProcessKV) {
             const int qi = offset.y / CTA_H;
-            const int ti = history_len;
+            // with context parallelism the new token is cached by the rank holding its position
+            const bool cp = params.cp.size > 1;
+            const int  ti = cp ? params.cp.local_idx(history_len) : history_len;
 
             Array<T, 2> param_K[1];
             Array<T, 2> param_V[1];
@@ -275,23 +275,35 @@ struct AttentionUniversal {
                 out_V[0][c] = conv_V(vec_V[0][c]);
             }
 
-            iterator.block_head_.with(
-                iterator.block_ptrs_, ti, [&](auto k_cache, auto v_cache, T* k_param, T* v_param) {
-                    PRAGMA_UNROLL
-                    for (int c = 0; c < ITER_C; ++c) {
-                        const int di = offset.x + c * Map::kDeltaC;
-                        if (qi < CTA_Q) {
-                            Store(&k_cache[di], out_K[0][c]);
-                            Store(&v_cache[di], out_V[0][c]);
+            // The partial block of a fork is filled from the block it was forked from by the first write to it. Each
+            // CTA of the sequence writes the same tokens and reads them back after the barrier below
+            if (params.block_iter_params.cow_blocks && !params.cold_pass) {
+                if (const char* src = params.block_iter_params.cow_blocks[batch_idx]) {
+                    iterator.block_head_.copy_before(
+                        iterator.block_ptrs_, history_len, src, threadIdx.x, kWarpCount * WARP_SIZE);
+                }
+            }
+
+            // the new token belongs to the recent blocks, not to the quantized ones of the cold pass
+            if ((!cp || params.cp.is_local(history_len)) && !params.cold_pass) {
+                iterator.block_head_.with(
+                    iterator.block_ptrs_, ti, [&](auto k_cache, auto v_cache, T* k_param, T* v_param) {
+                        PRAGMA_UNROLL
+                        for (int c = 0; c < ITER_C; ++c) {
+                            const int di = offset.x + c * Map::kDeltaC;
+                            if (qi < CTA_Q) {
+                                Store(&k_cache[di], out_K[0][c]);
+                                Store(&v_cache[di], out_V[0][c]);
+                            }
                         }
-                    }
-                    if constexpr (!std::is_same_v<T, Tkv>) {
-                        if (qi < CTA_Q && offset.x == 0) {
-                            StoreQuantParam<Tkv>(k_param, param_K[0]);
-                            StoreQuantParam<Tkv>(v_param, param_V[0]);
+                        if constexpr (!std::is_same_v<T, Tkv>) {
+                            if (qi < CTA_Q && offset.x == 0) {
+                                StoreQuantParam<Tkv>(k_param, param_K[0]);
+                                StoreQuantParam<Tkv>(v_param, param_V[0]);
+                            }
                         }
-                    }
-                });
+                    });
+            }
 
             __syncthreads();
         }
@@ -350,7 +362,7 @@ struct AttentionUniversal {
         }
 
         // early exit if finished flag is set
-        if (params.finished[batch_idx]) {
+        if (params.finished && params.finished[batch_idx]) {
             return;
         }
 
@@ -369,15 +381,46 @@ struct AttentionUniversal {
         const int lane_id = threadIdx.x % WARP_SIZE;
 
         const int context_len = params.cu_k_len[batch_idx + 1] - params.cu_k_len[batch_idx];
-        const int history_len = context_len - input_len;
 
-        const int tile_count = (history_len + min(query_idx + CTA_Q, input_len) + CTA_S - 1) / CTA_S;
+        // with context parallelism the keys are the local ones of the rank, the positions are global
+        const auto& cp         = params.cp;
+        const bool  is_cp      = cp.size > 1;
+        const int   global_len =
+            is_cp ? params.cp_cu_k_len[batch_idx + 1] - params.cp_cu_k_len[batch_idx] : context_len;
+
+        // the queries of the prefix pass are not part of the context, all keys are visible to them. The prefixes are
+        // multiples of `CTA_S`, so the causal mask is a no-op and there is no partial tile to mask
+        const bool is_prefix   = params.cascade_q_idx;
+        const int  history_len = is_prefix ? context_len : global_len - input_len;
+
+        const int visible_len = history_len + min(query_idx + CTA_Q, input_len);  // keys seen by the last query
+
+        // the cold pass of a tiered kv cache covers the quantized blocks before `prefix_len`, which are multiples of
+        // `CTA_S` and all visible
+        const bool is_cold = params.cold_pass;
 
-        const int tile_per_split = (tile_count + split_cnt - 1) / split_cnt;
-        const int iter_begin     = tile_per_split * split_idx;
+        const int tile_count = is_prefix ? (context_len + CTA_S - 1) / CTA_S :
+                               is_cold   ? params.prefix_len[batch_idx] / CTA_S :
+                               is_cp     ? (cp.local_len(visible_len) + CTA_S - 1) / CTA_S :
+                                           (visible_len + CTA_S - 1) / CTA_S;
+
+        // the suffix pass starts after the shared prefix, whose partials take the first slots
+        const int tile_begin = params.prefix_len && !is_cold ? params.prefix_len[batch_idx] / CTA_S : 0;
+        const int split_base = tile_begin ? params.prefix_splits : 0;
+
+        const int tile_per_split = (tile_count - tile_begin + split_cnt - 1) / split_cnt;
+        const int iter_begin     = tile_begin + tile_per_split * split_idx;
         const int iter_end       = min(iter_begin + tile_per_split, tile_count);
 
         if (iter_begin >= tile_count) {
+            // none of the keys of the rank are visible to the queries
+            if (is_cp && tile_count == 0 && split_idx == 0) {
+                StoreEmpty(qi_begin, qi_end, head_idx, params);
+            }
+            // the slots of the cold pass are all merged by the recent blocks of the sequence
+            if (is_cold && tile_count) {
+                StoreEmptyPartial(qi_begin, qi_end, head_idx, split_idx, params);
+            }
             return;
         }
 
@@ -406,12 +449,22 @@ struct AttentionUniversal {
 
         __syncthreads();
 
-        const int offset_Q = history_len + query_idx - iter_begin * CTA_S;
+        // the local keys are not contiguous in positions with context parallelism, the causal mask is applied by
+        // `ContextParallelMask` to the tiles holding keys after the first query
+        const int offset_Q = is_cp ? std::numeric_limits<int>::max() / 2 : history_len + query_idx - iter_begin * CTA_S;
         const int max_step = context_len - iter_begin * CTA_S;
 
         int tile_iter = iter_end - iter_begin - 1;
         int mask_iter = (CTA_Q + CTA_S - 1) / CTA_S + 1;
 
+        if (params.tree_mask) {  // the tiles of the whole input are masked
+            mask_iter = max(mask_iter, (input_len + CTA_S - 1) / CTA_S + 1);
+        }
+
+        if (is_cp) {
+            mask_iter = max(0, iter_end - cp.local_len(history_len + query_idx + 1) / CTA_S);
+        }
+
         cache_iter.SetTile(iter_end - 1);
 
         Mainloop mainloop;
@@ -426,36 +479,46 @@ struct AttentionUniversal {
                  mask_iter,
                  params.inv_sqrt_dh,
                  storage,
-                 StoreS(params, query_idx, head_idx, batch_idx, context_len));
+                 StoreS(params, query_idx, head_idx, batch_idx, context_len),
+                 RotateK(params, batch_idx, iter_begin),
+                 CausalMask(params, qi_begin, qi_end, history_len, query_idx, iter_begin));
 
         if constexpr (Impl::kWarpCntS > 1) {
             Impl::Merge(frag_O, frag_M, frag_L, params.inv_sqrt_dh, storage);
         }
 
-        const bool separate_reduce = need_separate_reduce(cta_map.split_count());
+        const bool separate_reduce =
+            need_separate_reduce(cta_map.split_count() + (params.prefix_len ? params.prefix_splits : 0));
 
-        if (separate_reduce && iter_end == tile_count && head_idx == 0) {
+        if (separate_reduce && iter_end == tile_count && head_idx == 0 && !is_prefix && !is_cold) {
             // Store actual split count, only used by separate reduction kernel
+            const int count = split_base + split_idx + 1;
             for (int ti = threadIdx.x; ti < CTA_Q; ti += kWarpCount * WARP_SIZE) {
                 if (qi_begin + ti < qi_end) {
-                    params.split_cnt[qi_begin + ti] = split_idx ? split_idx + 1 : 0;
+                    params.split_cnt[qi_begin + ti] = count > 1 ? count : 0;
                 }
             }
         }
 
-        if (iter_begin == 0 && iter_end == tile_count) {
+        if (iter_begin == 0 && iter_end == tile_count && !is_prefix && !is_cold && !split_base) {
             StoreO(frag_O, frag_L, qi_begin, qi_end, head_idx, params, storage);
+            if (params.cp_lse) {
+                StoreLSE(frag_M, frag_L, qi_begin, qi_end, head_idx, params);
+            }
         }
         else {
-            StorePartial(frag_O, frag_M, frag_L, qi_begin, qi_end, head_idx, split_idx, params, storage);
-            if (!separate_reduce)
-                Reduce(qi_begin, head_idx, split_idx, iter_end == tile_count, params, cta_map, smem_buf);
+            StorePartial(
+                frag_O, frag_M, frag_L, qi_begin, qi_end, head_idx, split_base + split_idx, params, storage);
+            // the prefix & cold passes are reduced with the suffixes
+            if (!separate_reduce && !is_prefix && !is_cold)
+                Reduce(qi_begin, head_idx, split_idx, split_base, iter_end == tile_count, params, cta_map, smem_buf);
         }
     }
 
     __device__ void Reduce(int              qi_begin,
                            int              head_idx,
                            int              split_idx,
+                           int              split_base,
                            bool             is_last,
                            const ParamType& params,
                            const CtaMap&    cta_map,
@@ -475,6 +538,7 @@ struct AttentionUniversal {
 
             ReduceOp reduce_op;
             reduce_op(params.out,
+                      params.cp_lse,
                       params.partial_M,
                       params.partial_L,
                       params.partial_O,
@@ -482,7 +546,7 @@ struct AttentionUniversal {
                       head_idx,
                       params.num_heads,
                       hi_end_,
-                      split_idx + 1,
+                      split_base + split_idx + 1,
                       params.max_split_k,
                       params.inv_sqrt_dh,
                       1,
@@ -531,6 +595,123 @@ struct AttentionUniversal {
         };
     }
 
+    // The keys are cached without the rotary embedding with `pre_rope_kv`, the tile of K in stage `pipe_iter` of smem
+    // is rotated before it's read. `offset_K` is the position of the tile relative to the first tile of the split, the
+    // mainloop prefetches past the last tile
+    __device__ auto RotateK(const ParamType& params, const int& batch_idx, const int& iter_begin)
+    {
+        return [&](auto& storage, int pipe_iter, int offset_K) {
+            if constexpr (kProcessKV && std::is_same_v<T, Tkv>) {
+                if (!params.pre_rope_kv || offset_K < 0) {
+                    return;
+                }
+                using SmemLayoutK = typename Impl::SmemLayoutK;
+
+                T* smem_K = storage.KV.data() + pipe_iter * SmemLayoutK::kSize;
+
+                constexpr int kPairs   = kHeadDim / 2;
+                constexpr int kThreads = kWarpCount * WARP_SIZE;
+
+                FastRoPE  rope(params.rope_param, batch_idx, std::integral_constant<int, 2>{});
+                const int ti = iter_begin * CTA_S + offset_K;
+                for (int i = threadIdx.x; i < CTA_S * kPairs; i += kThreads) {
+                    const int si = i / kPairs;
+                    const int di = i % kPairs * 2;
+                    T*        p  = &smem_K[SmemLayoutK::apply(si, di)];
+
+                    Array<T, 2> vec_K;
+                    Lds(vec_K, p);
+                    rope.init(di);
+                    rope.apply(vec_K, ti + si);
+                    Store(p, vec_K);
+                }
+                __syncthreads();
+            }
+        };
+    }
+
+    // Masks the keys of the input that are not ancestors of the query in the draft tree, on top of the causal mask.
+    // `qi` is relative to the first query of the CTA, `offset_K` to the first tile of the split
+    __device__ auto TreeMask(const ParamType& params, int qi_begin, int qi_end, int offset_K)
+    {
+        return [&params, qi_begin, qi_end, offset_K](int qi, int ki) -> bool {
+            if (!params.tree_mask || qi_begin + qi >= qi_end) {
+                return false;
+            }
+            const int t = ki - offset_K;
+            return 0 <= t && t < 64 && !(params.tree_mask[qi_begin + qi] >> t & 1);
+        };
+    }
+
+    // Context parallelism, `ki` is the local index of the key relative to the first tile of the split
+    __device__ auto ContextParallelMask(const ParamType& params, int offset_Q, int offset_K)
+    {
+        return [&params, offset_Q, offset_K](int qi, int ki) -> bool {
+            return params.cp.size > 1 && params.cp.global_pos(offset_K + ki) > offset_Q + qi;
+        };
+    }
+
+    __device__ auto
+    CausalMask(const ParamType& params, int qi_begin, int qi_end, int history_len, int query_idx, int iter_begin)
+    {
+        return [tree = TreeMask(params, qi_begin, qi_end, history_len - iter_begin * CTA_S),
+                cp   = ContextParallelMask(params, history_len + query_idx, iter_begin * CTA_S)](int qi, int ki) {
+            return tree(qi, ki) || cp(qi, ki);
+        };
+    }
+
+    // log2-sum-exp of the scores, -inf when no key is visible
+    __device__ void StoreLSE(
+        FragM& frag_M, FragL& frag_L, int qi_begin, int qi_end, int head_idx, const ParamType& params)
+    {
+        Impl::ForeachML(frag_M, frag_L, [&](int hi, int qi, int ri, float M, float L) {
+            if (qi_begin + qi < qi_end && ri == 0 && check_h(hi)) {
+                params.cp_lse[(qi_begin + qi) * params.num_heads + head_idx + hi] =
+                    L > 0.f ? M * params.inv_sqrt_dh + __log2f(L) : -std::numeric_limits<float>::infinity();
+            }
+        });
+    }
+
+    // The output of the queries without visible keys on the rank, dropped by the merge of the ranks
+    __device__ void StoreEmpty(int qi_begin, int qi_end, int head_idx, const ParamType& params)
+    {
+        const int q_num = min(CTA_Q, qi_end - qi_begin);
+        for (int i = threadIdx.x; i < q_num * CTA_H; i += kWarpCount * WARP_SIZE) {
+            const int qi = i / CTA_H;
+            const int hi = i % CTA_H;
+            if (check_h(hi)) {
+                const int index = (qi_begin + qi) * params.num_heads + head_idx + hi;
+                for (int di = 0; di < kHeadDim; ++di) {
+                    params.out[index * kHeadDim + di] = T{};
+                }
+                params.cp_lse[index] = -std::numeric_limits<float>::infinity();
+            }
+            if (params.split_cnt && head_idx == 0 && hi == 0) {
+                params.split_cnt[qi_begin + qi] = 0;
+            }
+        }
+    }
+
+    // A partial without visible keys, ignored by the reduce
+    __device__ void
+    StoreEmptyPartial(int qi_begin, int qi_end, int head_idx, int split_idx, const ParamType& params)
+    {
+        const int q_num = min(CTA_Q, qi_end - qi_begin);
+        for (int i = threadIdx.x; i < q_num * CTA_H; i += kWarpCount * WARP_SIZE) {
+            const int qi = i / CTA_H;
+            const int hi = i % CTA_H;
+            if (check_h(hi)) {
+                const int index = (qi_begin + qi) * params.num_heads * params.max_split_k
+                                  + (head_idx + hi) * params.max_split_k + split_idx;
+                for (int di = 0; di < kHeadDim; ++di) {
+                    params.partial_O[index * kHeadDim + di] = 0.f;
+                }
+                params.partial_M[index] = -std::numeric_limits<float>::infinity();
+                params.partial_L[index] = 0.f;
+            }
+        }
+    }
+
     __device__ void StorePartial(FragO&           frag_O,
                                  FragM&           frag_M,
                                  FragL&           frag_L,
@@ -542,9 +723,10 @@ struct AttentionUniversal {
                                  SharedStorage&   storage)
     {
         auto get_index = [&](int hi, int qi) {
+            // the queries of the prefix pass are scattered to their tokens
+            const int ti = params.cascade_q_idx ? params.cascade_q_idx[qi_begin + qi] : qi_begin + qi;
             // [B, H, k, D]
-            return (qi_begin + qi) * params.num_heads * params.max_split_k + (head_idx + hi) * params.max_split_k
-                   + split_idx;
+            return ti * params.num_heads * params.max_split_k + (head_idx + hi) * params.max_split_k + split_idx;
         };
 
         Impl::StoreO<false>(frag_O, frag_L, storage, [&](int hi, int qi, int di, const auto& vec) {
@@ -554,8 +736,8 @@ struct AttentionUniversal {
         });
 
         Impl::ForeachML(frag_M, frag_L, [&](int hi, int qi, int ri, float M, float L) {
-            const int index = get_index(hi, qi);
             if (qi_begin + qi < qi_end && ri == 0 && check_h(hi)) {
+                const int index = get_index(hi, qi);
                 // printf("ML %2d %2d %f %f\n", split_idx, head_idx + hi, M, L);
                 params.partial_M[index] = M;
                 params.partial_L[index] = L;
@@ -578,6 +760,8 @@ __global__ void attention_kernel(typename Kernel::ParamType            params,
 {
 #if __CUDA_ARCH__
     if constexpr (Kernel::Arch::is_compatible(__CUDA_ARCH__)) {
+        PdlWait();
+        PdlLaunchDependents();
         Kernel{q_group_size, q_head_per_cta, cta_per_q_group}(params, cache_iter_factory, cta_map, smem_buf);
     }
 #endif
@@ -0,0 +1,629 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Sweeps the prefill (`dispatchAttention`) and decoding (`dispatchDecoding`) kernels over batch size, context length,
+// head dim, GQA ratio, block length and kv cache quantization, reporting the achieved HBM bandwidth & TFLOPs and the
+// fraction of the roofline they reach. e.g.
+//   bench_attention --mode decode --batch 1,16,64 --context 4096,32768 --gqa 1,8 --quant 0,8,4
+// With several block lengths, the fastest one of each shape is summarized together with the padding of the last
+// block and the size of the block tables, e.g.
+//   bench_attention --mode decode --block-len 64,128,256 --context 1000,4000
+
+#include "attention.h"
+#include "block.h"
+#include "decoding.h"
+#include "kv_cache_utils_v2.h"
+#include "src/turbomind/kernels/attention/attention_params.h"
+#include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thrust/device_vector.h>
+#include <thrust/universal_vector.h>
+#include <tuple>
+#include <vector>
+
+using namespace turbomind;
+
+namespace {
+
+// same as `Config` of test_attention.cu
+template<class T, class Tkv>
+struct BlockConfig {
+    int head_dim_;
+    int head_num_;
+    int block_len_;
+
+    TM_HOST_DEVICE constexpr int t_bits() const
+    {
+        if constexpr (std::is_same_v<T, Tkv>) {
+            return 0;
+        }
+        else {
+            return bitsof<T>;
+        }
+    }
+
+    TM_HOST_DEVICE constexpr int q_bits() const
+    {
+        return bitsof<Tkv>;
+    }
+
+    TM_HOST_DEVICE constexpr int head_dim() const
+    {
+        return head_dim_;
+    }
+
+    TM_HOST_DEVICE int head_num() const
+    {
+        return head_num_;
+    }
+
+    TM_HOST_DEVICE constexpr int block_len() const
+    {
+        return block_len_;
+    }
+};
+
+struct Shape {
+    int batch_size;
+    int context_len;
+    int head_dim;
+    int head_num;
+    int kv_head_num;
+    int block_len;
+    int quant_policy;
+};
+
+struct Options {
+    bool prefill = true;
+    bool decode  = true;
+    bool bf16    = false;
+
+    std::vector<int> batch{1, 16, 64};
+    std::vector<int> context{1024, 8192, 32768};
+    std::vector<int> head_dim{128};
+    std::vector<int> head_num{32};
+    std::vector<int> gqa{1, 4, 8};
+    std::vector<int> block_len{64};
+    std::vector<int> quant{0, 8, 4};
+
+    int max_tokens = 1 << 16;  // of prefill shapes
+    int warmup     = 5;
+    int iters      = 20;
+
+    double peak_bw     = 0;  // GB/s
+    double peak_tflops = 0;
+};
+
+// Achieved throughput of a kernel and its efficiency against the roofline of the device
+struct Perf {
+    float  ms;
+    double bytes;
+    double flops;
+};
+
+// Times of the shapes, summarized over the block lengths by `Summarize`
+struct Record {
+    const char* kernel;
+    Shape       shape;
+    float       ms;
+};
+
+std::vector<Record>& Records()
+{
+    static std::vector<Record> records;
+    return records;
+}
+
+struct Device {
+    double bw;     // bytes/s
+    double flops;  // flops/s, dense f16 mma with f32 accumulators
+};
+
+Device QueryDevice(const Options& opts)
+{
+    int device{};
+    cudaGetDevice(&device);
+
+    auto get = [&](cudaDeviceAttr attr) {
+        int value{};
+        cudaDeviceGetAttribute(&value, attr, device);
+        return value;
+    };
+
+    const int sm_num = get(cudaDevAttrMultiProcessorCount);
+    const int clock  = get(cudaDevAttrClockRate);        // kHz
+    const int mclock = get(cudaDevAttrMemoryClockRate);  // kHz
+    const int bus    = get(cudaDevAttrGlobalMemoryBusWidth);
+    const int arch   = getSMVersion();
+
+    // dense f16 mma flops per clock per SM
+    int flops_per_clock = 1024;
+    if (arch == 80) {
+        flops_per_clock = 2048;
+    }
+    else if (arch >= 90) {
+        flops_per_clock = 4096;
+    }
+
+    Device d{};
+    d.bw    = opts.peak_bw > 0 ? opts.peak_bw * 1e9 : 2. * mclock * 1e3 * bus / 8;
+    d.flops = opts.peak_tflops > 0 ? opts.peak_tflops * 1e12 : (double)sm_num * clock * 1e3 * flops_per_clock;
+
+    printf("sm%d, %d SMs, peak %.0f GB/s, %.1f TFLOPs\n", arch, sm_num, d.bw / 1e9, d.flops / 1e12);
+
+    return d;
+}
+
+template<class F>
+float Measure(F func, int warmup, int iters)
+{
+    for (int i = 0; i < warmup; ++i) {
+        func();
+    }
+
+    cudaEvent_t ev_start, ev_end;
+    cudaEventCreate(&ev_start);
+    cudaEventCreate(&ev_end);
+
+    cudaEventRecord(ev_start);
+    for (int i = 0; i < iters; ++i) {
+        func();
+    }
+    cudaEventRecord(ev_end);
+    cudaEventSynchronize(ev_end);
+
+    float ms{};
+    cudaEventElapsedTime(&ms, ev_start, ev_end);
+
+    cudaEventDestroy(ev_start);
+    cudaEventDestroy(ev_end);
+
+    if (auto err = cudaGetLastError(); err != cudaSuccess) {
+        std::cerr << cudaGetErrorString(err) << "\n";
+        std::abort();
+    }
+
+    return ms / iters;
+}
+
+const char* QuantName(int quant_policy)
+{
+    if (quant_policy & QuantPolicy::kCacheKVInt8) {
+        return "u8";
+    }
+    else if (quant_policy & QuantPolicy::kCacheKVInt4) {
+        return "u4";
+    }
+    return "16b";
+}
+
+void Report(const char* kernel, const Shape& s, const Perf& p, const Device& d)
+{
+    Records().push_back({kernel, s, p.ms});
+
+    const double sec    = p.ms * 1e-3;
+    const double bw     = p.bytes / sec;
+    const double flops  = p.flops / sec;
+    const double t_roof = std::max(p.bytes / d.bw, p.flops / d.flops);
+
+    printf("%-8s %6d %8d %4d %4d %4d %4d %4s %10.3f %9.1f %8.2f %6.1f%%\n",
+           kernel,
+           s.batch_size,
+           s.context_len,
+           s.head_dim,
+           s.head_num,
+           s.kv_head_num,
+           s.block_len,
+           QuantName(s.quant_policy),
+           p.ms,
+           bw / 1e9,
+           flops / 1e12,
+           t_roof / sec * 100.);
+}
+
+template<class T, class Tkv>
+void Bench(const Shape& s, const Options& opts, const Device& device)
+{
+    const int B   = s.batch_size;
+    const int H   = s.head_num;
+    const int KvH = s.kv_head_num;
+    const int D   = s.head_dim;
+    const int L   = s.context_len;
+
+    BlockConfig<T, Tkv> config{D, KvH, s.block_len};
+    block::Layout       layout{config};
+
+    const int64_t block_num  = (L + s.block_len - 1) / s.block_len;
+    const int64_t block_size = layout.block_size(1);
+
+    // bytes of a token in the cache, k & v of all kv heads
+    const double token_bytes = 2. * KvH * (layout.token_data_size() + layout.token_param_size());
+
+    size_t free{}, total{};
+    cudaMemGetInfo(&free, &total);
+    if ((size_t)(B * block_num * block_size) > free * 3 / 4) {
+        printf("skipped, %.1f GB of kv cache for (%d, %d, %d, %d, %s)\n",
+               B * block_num * block_size / 1e9,
+               B,
+               L,
+               D,
+               KvH,
+               QuantName(s.quant_policy));
+        return;
+    }
+
+    RNG rng{};
+
+    // the content of the cache does not matter for the timing, the quant params are finite values anyway
+    thrust::device_vector<char> blocks(B * block_num * block_size);
+    rng.GenerateNormal((T*)blocks.data().get(), blocks.size() / sizeof(T));
+
+    std::vector<int64_t> idxs(B * block_num);
+    std::iota(idxs.begin(), idxs.end(), 0);
+    std::shuffle(idxs.begin(), idxs.end(), std::mt19937{});
+
+    thrust::universal_vector<char*> block_ptrs(B * block_num + 1);  // +1 padding
+    for (size_t i = 0; i < idxs.size(); ++i) {
+        block_ptrs[i] = blocks.data().get() + idxs[i] * block_size;
+    }
+
+    constexpr int kMaxWorkspaceTokens = 4096;  // same as `UnifiedAttentionLayer`
+    constexpr int kMaxKVSplits        = 512;
+
+    thrust::device_vector<float> partial_M(kMaxWorkspaceTokens * H);
+    thrust::device_vector<float> partial_L(kMaxWorkspaceTokens * H);
+    thrust::device_vector<float> partial_O((size_t)kMaxWorkspaceTokens * H * D);
+    thrust::device_vector<int>   split_cnt(kMaxWorkspaceTokens);
+    thrust::device_vector<int>   locks(kMaxWorkspaceTokens * H);
+
+    thrust::universal_vector<bool>  finished(B);
+    thrust::universal_vector<float> rope_base(B);
+    thrust::universal_vector<int>   cu_q_len(B + 1);
+    thrust::universal_vector<int>   cu_k_len(B + 1);
+    thrust::universal_vector<int>   cu_block_num(B + 1);
+
+    for (int i = 0; i < B; ++i) {
+        finished[i]  = false;
+        rope_base[i] = 10000.f;
+    }
+
+    AttentionParams<T> params{};
+
+    params.finished   = finished.data().get();
+    params.rope_theta = rope_base.data().get();
+    params.cu_q_len   = cu_q_len.data().get();
+    params.cu_k_len   = cu_k_len.data().get();
+
+    params.block_iter_params = BlockIteratorParams{block_ptrs.data().get(), cu_block_num.data().get(), 0, s.block_len};
+
+    params.num_heads     = H;
+    params.num_kv_heads  = KvH;
+    params.size_per_head = D;
+    params.inv_sqrt_dh   = (float)std::log2(expf(1.)) / std::sqrt((float)D);
+    params.rope_param    = RopeKernelParam{RopeType::kDefault, nullptr, D, -std::log2f(10000.f) / D, 1.f};
+
+    params.split_cnt = split_cnt.data().get();
+    params.partial_L = partial_L.data().get();
+    params.partial_M = partial_M.data().get();
+    params.partial_O = partial_O.data().get();
+    params.locks     = locks.data().get();
+
+    params.quant_policy = s.quant_policy;
+    params.arch         = getSMVersion();
+
+    if (opts.decode) {
+        thrust::device_vector<T> qkv((size_t)B * (H + 2 * KvH) * D);
+        thrust::device_vector<T> out((size_t)B * H * D);
+        rng.GenerateNormal(qkv.data().get(), qkv.size());
+
+        for (int i = 0; i <= B; ++i) {
+            cu_q_len[i]     = i;
+            cu_k_len[i]     = i * L;
+            cu_block_num[i] = i * block_num;
+        }
+
+        params.out    = out.data().get();
+        params.q      = qkv.data().get();
+        params.k      = params.q + H * D;
+        params.v      = params.k + KvH * D;
+        params.stride = (H + 2 * KvH) * D;
+
+        params.token_num   = B;
+        params.batch_size  = B;
+        params.max_q_len   = 1;
+        params.max_k_len   = L;
+        params.max_split_k = std::min(std::max(1, kMaxWorkspaceTokens / B), kMaxKVSplits);
+
+        cudaDeviceSynchronize();
+
+        Perf p{};
+        p.ms    = Measure([&] { dispatchDecoding<T>(params); }, opts.warmup, opts.iters);
+        p.bytes = B * (L * token_bytes + 2. * H * D * sizeof(T));
+        p.flops = 4. * B * H * L * D;
+
+        Report("decode", s, p, device);
+    }
+
+    if (opts.prefill && (int64_t)B * L <= opts.max_tokens) {
+        const int64_t token_num = (int64_t)B * L;
+
+        thrust::device_vector<T> qkv(token_num * (H + 2 * KvH) * D);
+        thrust::device_vector<T> out(token_num * H * D);
+        thrust::device_vector<T> kv_buf((size_t)KvH * 2 * (token_num + MAX_CTA_S) * D);
+        rng.GenerateNormal(qkv.data().get(), qkv.size());
+
+        for (int i = 0; i <= B; ++i) {
+            cu_q_len[i]     = i * L;
+            cu_k_len[i]     = i * L;
+            cu_block_num[i] = i * block_num;
+        }
+
+        params.out    = out.data().get();
+        params.q      = qkv.data().get();
+        params.k      = params.q + H * D;
+        params.v      = params.k + KvH * D;
+        params.stride = (H + 2 * KvH) * D;
+
+        params.linear_iter_params = LinearIteratorParams{kv_buf.data().get(),  //
+                                                         int(2 * token_num * D),
+                                                         int(token_num * D)};
+
+        params.token_num   = token_num;
+        params.batch_size  = B;
+        params.max_q_len   = L;
+        params.max_k_len   = L;
+        params.max_split_k = 1;
+
+        cudaDeviceSynchronize();
+
+        // new tokens -> blocks & linear buffer
+        Perf kv{};
+        kv.ms    = Measure([&] { invokeProcessFlattenKV_v2_(params, token_num); }, opts.warmup, opts.iters);
+        kv.bytes = token_num * (token_bytes + 4. * KvH * D * sizeof(T));
+        Report("kv", s, kv, device);
+
+        // causal, the i-th token of a sequence attends to i + 1 tokens
+        Perf p{};
+        p.ms    = Measure([&] { dispatchAttention(params); }, opts.warmup, opts.iters);
+        p.bytes = token_num * (2. * H * D + 2. * KvH * D) * sizeof(T);
+        p.flops = 4. * B * H * D * L * (L + 1.) / 2.;
+        Report("prefill", s, p, device);
+    }
+}
+
+template<class T>
+void Dispatch(const Shape& s, const Options& opts, const Device& device)
+{
+    if (s.quant_policy & QuantPolicy::kCacheKVInt8) {
+        Bench<T, uint8_t>(s, opts, device);
+    }
+    else if (s.quant_policy & QuantPolicy::kCacheKVInt4) {
+        Bench<T, uint4_t>(s, opts, device);
+    }
+    else {
+        Bench<T, T>(s, opts, device);
+    }
+}
+
+bool Supported(const Shape& s)
+{
+    if (s.head_num % s.kv_head_num) {
+        return false;
+    }
+    // a tile of the block iterators can't span blocks
+    if (s.block_len <= 0 || s.block_len % 64) {
+        return false;
+    }
+    if (s.head_dim == 64 || s.head_dim == 128) {
+        return true;
+    }
+    // the large head dims have no u4 decoding kernels and need sm80
+    if (s.head_dim == 192 || s.head_dim == 256) {
+        return getSMVersion() >= 80 && !(s.quant_policy & QuantPolicy::kCacheKVInt4);
+    }
+    return false;
+}
+
+// The fastest block length of each shape, the padding of the last block & the block table entries per sequence
+void Summarize()
+{
+    std::map<std::tuple<std::string, int, int, int, int, int, int>, std::vector<Record>> groups;
+    for (const auto& r : Records()) {
+        const auto& s = r.shape;
+        groups[{r.kernel, s.batch_size, s.context_len, s.head_dim, s.head_num, s.kv_head_num, s.quant_policy}]
+            .push_back(r);
+    }
+
+    bool header = false;
+    for (const auto& [key, rs] : groups) {
+        if (rs.size() < 2) {
+            continue;
+        }
+        if (!header) {
+            printf("\n%-8s %6s %8s %4s %4s %4s %4s %4s %10s %7s %7s %7s\n",
+                   "kernel",
+                   "batch",
+                   "context",
+                   "dim",
+                   "H",
+                   "KvH",
+                   "kv",
+                   "blk",
+                   "ms",
+                   "vs.best",
+                   "padding",
+                   "blocks");
+            header = true;
+        }
+        const auto best = std::min_element(rs.begin(), rs.end(), [](auto& a, auto& b) { return a.ms < b.ms; });
+        for (const auto& r : rs) {
+            const auto& s      = r.shape;
+            const int   blocks = (s.context_len + s.block_len - 1) / s.block_len;
+            printf("%-8s %6d %8d %4d %4d %4d %4s %4d %10.3f %6.1f%% %6.1f%% %7d%s\n",
+                   r.kernel,
+                   s.batch_size,
+                   s.context_len,
+                   s.head_dim,
+                   s.head_num,
+                   s.kv_head_num,
+                   QuantName(s.quant_policy),
+                   s.block_len,
+                   r.ms,
+                   (r.ms / best->ms - 1.) * 100.,
+                   (1. - (double)s.context_len / (blocks * s.block_len)) * 100.,
+                   blocks,
+                   &r == &*best ? " *" : "");
+        }
+    }
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: bench_attention [options], lists are comma separated\n"
+                 "  --mode prefill|decode|both  (both)\n"
+                 "  --dtype f16|bf16            (f16)\n"
+                 "  --batch LIST                (1,16,64)\n"
+                 "  --context LIST              context lengths (1024,8192,32768)\n"
+                 "  --head-dim LIST             (128)\n"
+                 "  --head-num LIST             query heads (32)\n"
+                 "  --gqa LIST                  query heads per kv head (1,4,8)\n"
+                 "  --block-len LIST            cache block length, multiples of 64 (64)\n"
+                 "  --quant LIST                quant_policy, 0 | 8 (u8) | 4 (u4) (0,8,4)\n"
+                 "  --max-tokens N              skip prefill shapes of more tokens (65536)\n"
+                 "  --warmup N                  (5)\n"
+                 "  --iters N                   (20)\n"
+                 "  --peak-bw GBPS              override the peak HBM bandwidth\n"
+                 "  --peak-tflops TFLOPS        override the peak tensor core throughput\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    return ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--mode") {
+            opts.prefill = value != "decode";
+            opts.decode  = value != "prefill";
+        }
+        else if (key == "--dtype") {
+            opts.bf16 = value == "bf16" || value == "bfloat16";
+        }
+        else if (key == "--batch") {
+            opts.batch = ParseInts(value);
+        }
+        else if (key == "--context") {
+            opts.context = ParseInts(value);
+        }
+        else if (key == "--head-dim") {
+            opts.head_dim = ParseInts(value);
+        }
+        else if (key == "--head-num") {
+            opts.head_num = ParseInts(value);
+        }
+        else if (key == "--gqa") {
+            opts.gqa = ParseInts(value);
+        }
+        else if (key == "--block-len") {
+            opts.block_len = ParseInts(value);
+        }
+        else if (key == "--quant") {
+            opts.quant = ParseInts(value);
+        }
+        else if (key == "--max-tokens") {
+            opts.max_tokens = std::stoi(value);
+        }
+        else if (key == "--warmup") {
+            opts.warmup = std::stoi(value);
+        }
+        else if (key == "--iters") {
+            opts.iters = std::stoi(value);
+        }
+        else if (key == "--peak-bw") {
+            opts.peak_bw = std::stod(value);
+        }
+        else if (key == "--peak-tflops") {
+            opts.peak_tflops = std::stod(value);
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    const Device device = QueryDevice(opts);
+
+    if (device.bw <= 0 || device.flops <= 0) {
+        std::cerr << "failed to query the peaks of the device, set them by --peak-bw & --peak-tflops\n";
+        return 1;
+    }
+
+    printf("%-8s %6s %8s %4s %4s %4s %4s %4s %10s %9s %8s %7s\n",
+           "kernel",
+           "batch",
+           "context",
+           "dim",
+           "H",
+           "KvH",
+           "blk",
+           "kv",
+           "ms",
+           "GB/s",
+           "TFLOPs",
+           "roof");
+
+    for (const auto& head_dim : opts.head_dim) {
+        for (const auto& head_num : opts.head_num) {
+            for (const auto& gqa : opts.gqa) {
+                for (const auto& block_len : opts.block_len) {
+                    for (const auto& quant : opts.quant) {
+                        for (const auto& context : opts.context) {
+                            for (const auto& batch : opts.batch) {
+                                if (gqa <= 0 || head_num < gqa) {
+                                    continue;
+                                }
+                                const Shape s{batch, context, head_dim, head_num, head_num / gqa, block_len, quant};
+                                if (!Supported(s)) {
+                                    continue;
+                                }
+                                if (opts.bf16) {
+#if ENABLE_BF16
+                                    Dispatch<nv_bfloat16>(s, opts, device);
+#else
+                                    std::cerr << "not built with bf16 support\n";
+                                    return 1;
+#endif
+                                }
+                                else {
+                                    Dispatch<half>(s, opts, device);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    Summarize();
+
+    return 0;
+}
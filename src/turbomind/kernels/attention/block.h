@@ -112,6 +112,28 @@ public:
             k_data(block, block_ti), v_data(block, block_ti), k_param(block, block_ti), v_param(block, block_ti));
     }
 
+    // Copies the tokens of the head before `ti` in its block from the block `src`, by `thread_num` threads. The data &
+    // the params of the tokens are contiguous in a head and are multiples of 4 bytes
+    __device__ void copy_before(char** block_ptrs, int ti, const char* src, int thread_idx, int thread_num) const
+    {
+        int block_id;
+        int block_ti;
+        get_block_coord(ti, block_id, block_ti);
+
+        char* dst = block_ptrs[block_id];
+
+        auto copy = [&](int offset, int bytes) {
+            for (int i = thread_idx * 4; i < bytes; i += thread_num * 4) {
+                *(uint32_t*)(dst + offset + i) = *(const uint32_t*)(src + offset + i);
+            }
+        };
+
+        copy(layout_.k_data(layer_id_, head_id_, 0), block_ti * layout_.token_data_size());
+        copy(layout_.v_data(layer_id_, head_id_, 0), block_ti * layout_.token_data_size());
+        copy(layout_.k_param(layer_id_, head_id_, 0), block_ti * layout_.token_param_size());
+        copy(layout_.v_param(layer_id_, head_id_, 0), block_ti * layout_.token_param_size());
+    }
+
 private:
     Layout layout_;
 
@@ -127,8 +149,12 @@ struct Layout {
 
     Config config_;
 
+    // Bytes before layer 0 of the layout. The layers of a block differ in heads & precision for mixed precision kv
+    // cache & pruned models, each is addressed as layer 0 of its own layout at its offset then
+    int layer_offset_;
+
     // This trivial ctor is defined for CTAD
-    TM_HOST_DEVICE Layout(Config config): config_{config} {}
+    TM_HOST_DEVICE Layout(Config config, int layer_offset = 0): config_{config}, layer_offset_{layer_offset} {}
 
     TM_HOST_DEVICE const Config& config() const
     {
@@ -188,7 +214,7 @@ struct Layout {
 
     TM_HOST_DEVICE int layer_data(int layer) const
     {
-        return layer * layer_size();
+        return layer_offset_ + layer * layer_size();
     }
 
     TM_HOST_DEVICE int layer_param(int layer) const
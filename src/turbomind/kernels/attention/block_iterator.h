@@ -88,7 +88,8 @@ struct CreateCacheIterFactory<CacheIterFactory, std::void_t<typename CacheIterFa
         using BlockConfig = typename BlockLayout::Config;
 
         return {
-            BlockLayout{BlockConfig{param.num_kv_heads, param.block_iter_params.block_len}},
+            BlockLayout{BlockConfig{param.num_kv_heads, param.block_iter_params.block_len},
+                        param.block_iter_params.layer_offset},
             param.block_iter_params.block_ptrs,
             param.block_iter_params.cu_block_nums,
             param.block_iter_params.layer_id,
@@ -0,0 +1,13 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "../attention_config.h"
+#include "../attention_template.h"
+
+namespace turbomind {
+
+using namespace attention;
+
+template void invokeAttention<typename AttentionConfig<arch::Sm80, half, 128, CacheType::kBlock, fp8_e4m3>::Kernel>(
+    const AttentionParams<half>& params);
+
+}  // namespace turbomind
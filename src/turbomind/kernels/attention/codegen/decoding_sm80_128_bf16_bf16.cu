@@ -19,4 +19,10 @@ invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 8, 128>>(const Att
 template bool
 invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 16, 128>>(const AttentionParams<nv_bfloat16>& params);
 
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 4, 128>>(
+    const AttentionParams<nv_bfloat16>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 8, 128>>(
+    const AttentionParams<nv_bfloat16>& params);
+
 }  // namespace turbomind
@@ -11,4 +11,10 @@ template bool invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, uint4_t, 8, 128>>
 
 template bool invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, uint4_t, 16, 128>>(const AttentionParams<nv_bfloat16>&);
 
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, uint4_t, 4, 128>>(
+    const AttentionParams<nv_bfloat16>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, uint4_t, 8, 128>>(
+    const AttentionParams<nv_bfloat16>&);
+
 }  // namespace turbomind
@@ -0,0 +1,18 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "../decoding_config.h"
+#include "../decoding_template.h"
+
+namespace turbomind {
+
+using namespace attention;
+
+template bool invokeDecoding<Decoding<arch::Sm80, half, fp8_e4m3, 8, 128>>(const AttentionParams<half>&);
+
+template bool invokeDecoding<Decoding<arch::Sm80, half, fp8_e4m3, 16, 128>>(const AttentionParams<half>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, fp8_e4m3, 4, 128>>(const AttentionParams<half>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, fp8_e4m3, 8, 128>>(const AttentionParams<half>&);
+
+}  // namespace turbomind
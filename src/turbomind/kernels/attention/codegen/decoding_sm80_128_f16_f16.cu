@@ -15,4 +15,8 @@ template bool invokeDecoding<Decoding<arch::Sm80, half, half, 8, 128>>(const Att
 
 template bool invokeDecoding<Decoding<arch::Sm80, half, half, 16, 128>>(const AttentionParams<half>& params);
 
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, half, 4, 128>>(const AttentionParams<half>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, half, 8, 128>>(const AttentionParams<half>& params);
+
 }  // namespace turbomind
@@ -19,4 +19,12 @@ invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 8, 64>>(const Atte
 template bool
 invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 16, 64>>(const AttentionParams<nv_bfloat16>& params);
 
+invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 32, 64>>(const AttentionParams<nv_bfloat16>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 4, 64>>(
+    const AttentionParams<nv_bfloat16>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, nv_bfloat16, 8, 64>>(
+    const AttentionParams<nv_bfloat16>& params);
+
 }  // namespace turbomind
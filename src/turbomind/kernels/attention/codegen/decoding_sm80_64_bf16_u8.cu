@@ -11,4 +11,12 @@ template bool invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, uint8_t, 8, 64>>(
 
 template bool invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, uint8_t, 16, 64>>(const AttentionParams<nv_bfloat16>&);
 
+template bool invokeDecoding<Decoding<arch::Sm80, nv_bfloat16, uint8_t, 32, 64>>(const AttentionParams<nv_bfloat16>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, uint8_t, 4, 64>>(
+    const AttentionParams<nv_bfloat16>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, nv_bfloat16, uint8_t, 8, 64>>(
+    const AttentionParams<nv_bfloat16>&);
+
 }  // namespace turbomind
@@ -15,4 +15,10 @@ template bool invokeDecoding<Decoding<arch::Sm80, half, half, 8, 64>>(const Atte
 
 template bool invokeDecoding<Decoding<arch::Sm80, half, half, 16, 64>>(const AttentionParams<half>& params);
 
+template bool invokeDecoding<Decoding<arch::Sm80, half, half, 32, 64>>(const AttentionParams<half>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, half, 4, 64>>(const AttentionParams<half>& params);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, half, 8, 64>>(const AttentionParams<half>& params);
+
 }  // namespace turbomind
@@ -11,4 +11,10 @@ template bool invokeDecoding<Decoding<arch::Sm80, half, uint8_t, 8, 64>>(const A
 
 template bool invokeDecoding<Decoding<arch::Sm80, half, uint8_t, 16, 64>>(const AttentionParams<half>&);
 
+template bool invokeDecoding<Decoding<arch::Sm80, half, uint8_t, 32, 64>>(const AttentionParams<half>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, uint8_t, 4, 64>>(const AttentionParams<half>&);
+
+template bool invokeDecoding<MultiQueryDecoding<arch::Sm80, half, uint8_t, 8, 64>>(const AttentionParams<half>&);
+
 }  // namespace turbomind
@@ -31,6 +31,7 @@ void dispatchDecoding(const AttentionParams<T>& params)
 {
     const bool is_kv_int8     = params.quant_policy & QuantPolicy::kCacheKVInt8;
     const bool is_kv_int4     = params.quant_policy & QuantPolicy::kCacheKVInt4;
+    const bool is_kv_fp8      = params.quant_policy & QuantPolicy::kCacheKVFp8;
     const int  query_group_sz = params.num_heads / params.num_kv_heads;
 
     using namespace attention;
@@ -41,6 +42,13 @@ void dispatchDecoding(const AttentionParams<T>& params)
         using Arch             = decltype(arch);
         using Tkv              = decltype(kv);
         constexpr int kHeadDim = dim;
+        // Groups of more than 16 heads are packed into one tile of 32 instead of a CTA per 16 heads each reading the
+        // same KV, the registers of the (32, d) output limit it to 64 dims
+        if constexpr (kHeadDim == 64 && std::is_same_v<Arch, arch::Sm80>) {
+            if (query_group_sz > 16) {
+                return invokeDecoding<Decoding<Arch, T, Tkv, 32, kHeadDim>>(params);
+            }
+        }
         if (0) {}
         else if (query_group_sz > 8) {
             return invokeDecoding<Decoding<Arch, T, Tkv, 9, kHeadDim>>(params);
@@ -73,13 +81,19 @@ void dispatchDecoding(const AttentionParams<T>& params)
     };
 
     auto dispatch_kv = [&](auto arch, const auto dim) -> bool {
-        FT_CHECK(!(is_kv_int4 && is_kv_int8));
+        FT_CHECK(is_kv_int4 + is_kv_int8 + is_kv_fp8 <= 1);
         if (is_kv_int4) {
             return dispatch_h(arch, uint4_t{}, dim);
         }
         else if (is_kv_int8) {
             return dispatch_h(arch, uint8_t{}, dim);
         }
+        else if (is_kv_fp8) {
+            if constexpr (std::is_same_v<decltype(arch), arch::Sm80>) {
+                return dispatch_h(arch, fp8_e4m3{}, dim);
+            }
+            return false;
+        }
         else {
             return dispatch_h(arch, T{}, dim);
         }
@@ -113,29 +127,90 @@ void dispatchDecoding(const AttentionParams<T>& params)
         return false;
     };
 
-    if (params.size_per_head == 192) {
-
+    auto dispatch_large = [&](const auto dim) {
+        constexpr int kHeadDim = dim;
+        FT_CHECK_WITH_INFO(params.arch >= 80, "head_dim 192/256 requires sm80");
         if (is_kv_int8) {
-            invokeDecoding<Decoding<arch::Sm80, T, uint8_t, 1, 192>>(params);
+            invokeDecoding<Decoding<arch::Sm80, T, uint8_t, 1, kHeadDim>>(params);
         }
-        else if (is_kv_int4) {
-            FT_CHECK_WITH_INFO(!is_kv_int4, "not implemented");
-            // invokeDecoding<Decoding<arch::Sm80, T, uint4_t, 1, 192>>(params);
+        else if (is_kv_int4 || is_kv_fp8) {
+            FT_CHECK_WITH_INFO(0, "not implemented");
+            // invokeDecoding<Decoding<arch::Sm80, T, uint4_t, 1, kHeadDim>>(params);
         }
         else {
-            invokeDecoding<Decoding<arch::Sm80, T, T, 1, 192>>(params);
+            invokeDecoding<Decoding<arch::Sm80, T, T, 1, kHeadDim>>(params);
         }
+    };
+
+    if (params.size_per_head == 576) {
+        FT_CHECK_WITH_INFO(params.arch >= 80 && !(is_kv_int8 || is_kv_int4 || is_kv_fp8),
+                           "latent MLA cache requires sm80 and no kv quant");
+        invokeDecoding<Decoding<arch::Sm80, T, T, 1, 576>>(params);
         return;
     }
 
+    if (params.size_per_head == 192) {
+        return dispatch_large(std::integral_constant<int, 192>{});
+    }
+    else if (params.size_per_head == 256) {
+        return dispatch_large(std::integral_constant<int, 256>{});
+    }
+
     auto success = dispatch();
 
     FT_CHECK(success);
 }
 
+template<class T>
+bool dispatchMultiQueryDecoding(const AttentionParams<T>& params)
+{
+    using namespace attention;
+
+    if (params.arch < 80 || params.max_q_len > 8) {
+        return false;
+    }
+
+    const bool is_kv_int8 = params.quant_policy & QuantPolicy::kCacheKVInt8;
+    const bool is_kv_int4 = params.quant_policy & QuantPolicy::kCacheKVInt4;
+    const bool is_kv_fp8  = params.quant_policy & QuantPolicy::kCacheKVFp8;
+
+    auto dispatch_q = [&](auto kv, const auto dim) {
+        using Tkv              = decltype(kv);
+        constexpr int kHeadDim = dim;
+        if (params.max_q_len <= 4) {
+            return invokeDecoding<MultiQueryDecoding<arch::Sm80, T, Tkv, 4, kHeadDim>>(params);
+        }
+        return invokeDecoding<MultiQueryDecoding<arch::Sm80, T, Tkv, 8, kHeadDim>>(params);
+    };
+
+    auto dispatch_kv = [&](const auto dim) {
+        if (is_kv_int4) {
+            return dispatch_q(uint4_t{}, dim);
+        }
+        else if (is_kv_int8) {
+            return dispatch_q(uint8_t{}, dim);
+        }
+        else if (is_kv_fp8) {
+            return dispatch_q(fp8_e4m3{}, dim);
+        }
+        return dispatch_q(T{}, dim);
+    };
+
+    if (params.size_per_head == 128) {
+        return dispatch_kv(std::integral_constant<int, 128>{});
+    }
+    else if (params.size_per_head == 64) {
+        return dispatch_kv(std::integral_constant<int, 64>{});
+    }
+
+    return false;
+}
+
 template void dispatchDecoding(const AttentionParams<half>& params);
+template bool dispatchMultiQueryDecoding(const AttentionParams<half>& params);
 #if ENABLE_BF16
 template void dispatchDecoding(const AttentionParams<nv_bfloat16>& params);
+template bool dispatchMultiQueryDecoding(const AttentionParams<nv_bfloat16>& params);
 #endif
 
 }  // namespace turbomind
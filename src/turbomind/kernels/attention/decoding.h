@@ -9,4 +9,8 @@ namespace turbomind {
 template<class T>
 void dispatchDecoding(const AttentionParams<T>& params);
 
+// Decodes the inputs of up to 8 tokens against the cache blocks, returns false when the params are not supported
+template<class T>
+bool dispatchMultiQueryDecoding(const AttentionParams<T>& params);
+
 }
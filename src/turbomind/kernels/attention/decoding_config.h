@@ -25,7 +25,7 @@ using Decoding = typename DecodingConfig<Arch, T, Tkv, Qh, HeadDim>::Kernel;
 
 //////////////////////////////////////////////////////////////
 template<class T, int Qh, int HeadDim>
-struct DecodingConfig<arch::Sm80, T, T, Qh, HeadDim, std::enable_if_t<!(Qh > 2)>> {
+struct DecodingConfig<arch::Sm80, T, T, Qh, HeadDim, std::enable_if_t<!(Qh > 2) && HeadDim <= 256>> {
     using Attention = Impl<MMA_SIMT, T, T, Qh, 1, 64, Qh, 1, 16, HeadDim, 3>;
     using CacheIter = GetBlockIterFactory<T, T, 64, HeadDim>;
     using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<3>, Attention>, CacheIter, DecodingCtaMap>;
@@ -40,13 +40,21 @@ struct DecodingConfig<arch::Sm80, T, T, Qh_, HeadDim, std::enable_if_t<(Qh_ > 2)
 };
 
 template<class T, int Qh_, int HeadDim>
-struct DecodingConfig<arch::Sm80, T, uint8_t, Qh_, HeadDim, std::enable_if_t<(HeadDim != 192)>> {
+struct DecodingConfig<arch::Sm80, T, uint8_t, Qh_, HeadDim, std::enable_if_t<(HeadDim <= 128)>> {
     static constexpr int Qh = (Qh_ + 7) / 8 * 8;
     using Attention         = Impl<MMA_81616, T, uint8_t, Qh, 1, 64, Qh, 1, 16, HeadDim, 5>;
     using CacheIter         = GetBlockIterFactory<T, uint8_t, 64, HeadDim>;
     using Kernel = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<5>, Attention>, CacheIter, DecodingCtaMap>;
 };
 
+template<class T, int Qh_, int HeadDim>
+struct DecodingConfig<arch::Sm80, T, fp8_e4m3, Qh_, HeadDim> {
+    static constexpr int Qh = (Qh_ + 7) / 8 * 8;
+    using Attention         = Impl<MMA_81616, T, fp8_e4m3, Qh, 1, 64, Qh, 1, 16, HeadDim, 5>;
+    using CacheIter         = GetBlockIterFactory<T, fp8_e4m3, 64, HeadDim>;
+    using Kernel = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<5>, Attention>, CacheIter, DecodingCtaMap>;
+};
+
 template<class T, int Qh_, int HeadDim>
 struct DecodingConfig<arch::Sm80, T, uint4_t, Qh_, HeadDim> {
     static constexpr int Qh = (Qh_ + 7) / 8 * 8;
@@ -76,14 +84,40 @@ struct DecodingConfig<arch::Sm70, T, Tkv, Qh, HeadDim> {
     using Kernel = AttentionUniversal<arch::Sm70, Mainloop<arch::Sm70, Attention>, CacheIter, DecodingCtaMap>;
 };
 
-template<class T>
-struct DecodingConfig<arch::Sm80, T, uint8_t, 1, 192> {
-    static constexpr int Qh      = 1;
-    static constexpr int HeadDim = 192;
+template<class T, int HeadDim>
+struct DecodingConfig<arch::Sm80, T, uint8_t, 1, HeadDim, std::enable_if_t<(HeadDim == 192 || HeadDim == 256)>> {
+    static constexpr int Qh = 1;
 
     using Attention = Impl<MMA_SIMT, T, uint8_t, Qh, 1, 64, Qh, 1, 16, HeadDim, 3>;
     using CacheIter = GetBlockIterFactory<T, uint8_t, 64, HeadDim>;
     using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<3>, Attention>, CacheIter, DecodingCtaMap>;
 };
 
+// Short inputs (speculative verification, the tails of chunked prefills) decoded against the cache blocks, the `Q`
+// queries of the `16 / Q` heads sharing a KV head are the 16 columns of a tile, masked causally per column
+template<class Arch, class T, class Tkv, int Q, int HeadDim>
+struct MultiQueryDecodingConfig {
+    static_assert(sizeof(T) == 0, "config not found");
+};
+
+template<class Arch, class T, class Tkv, int Q, int HeadDim>
+using MultiQueryDecoding = typename MultiQueryDecodingConfig<Arch, T, Tkv, Q, HeadDim>::Kernel;
+
+template<class T, class Tkv, int Q, int HeadDim>
+struct MultiQueryDecodingConfig<arch::Sm80, T, Tkv, Q, HeadDim> {
+    static constexpr int Qh     = 16 / Q;
+    static constexpr int Stages = std::is_same_v<T, Tkv> ? 3 : 5;
+    using Attention             = Impl<MMA_81616, T, Tkv, Qh, Q, 64, Qh, Q, 16, HeadDim, Stages>;
+    using CacheIter             = GetBlockIterFactory<T, Tkv, 64, HeadDim>;
+    using Kernel = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<Stages>, Attention>, CacheIter, DecodingCtaMap>;
+};
+
+// Absorbed MLA over the latent KV cache, one KV head of [rope_dim + kv_lora_rank]
+template<class T>
+struct DecodingConfig<arch::Sm80, T, T, 1, 576> {
+    using Attention = Impl<MMA_SIMT, T, T, 1, 1, 32, 1, 1, 8, 576, 2>;
+    using CacheIter = GetBlockIterFactory<T, T, 32, 576>;
+    using Kernel    = AttentionUniversal<arch::Sm80, Mainloop<Sm80_CpAsync<2>, Attention>, CacheIter, DecodingCtaMap>;
+};
+
 }  // namespace turbomind::attention
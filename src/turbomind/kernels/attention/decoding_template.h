@@ -25,8 +25,12 @@ bool invokeDecoding(const typename Kernel::ParamType& params)
         }();
     }
 
+    // slots of the partials taken by the prefix pass of cascade decoding, or by the cold pass of a tiered kv cache,
+    // which fills exactly these slots and is reduced by the pass of the recent blocks
+    const int prefix_splits = params.prefix_len && !params.cold_pass ? params.prefix_splits : 0;
+
     const int tile_count      = (params.max_k_len + Kernel::CTA_S - 1) / Kernel::CTA_S;
-    const int max_split_count = std::min(params.max_split_k, tile_count);
+    const int max_split_count = std::min(params.max_split_k - prefix_splits, tile_count);
 
     using CtaMap = typename Kernel::CtaMap;
 
@@ -61,7 +65,16 @@ bool invokeDecoding(const typename Kernel::ParamType& params)
     dim3 grid = CtaMap::get_grid_shape(params.num_kv_heads, params.batch_size, 1, cta_per_q_group);
 
     const int grid_size = grid.x * grid.y * grid.z;
-    const int split_cnt = GetSplitCount(max_split_count, grid_size, caps.y, caps.x, 4);
+
+    // The layers of a step share the same shape, evaluate the cost model once for them
+    thread_local int3 cached_shape{};
+    thread_local int  cached_split_cnt{};
+    if (const int3 shape{grid_size, tile_count, max_split_count};
+        shape.x != cached_shape.x || shape.y != cached_shape.y || shape.z != cached_shape.z) {
+        cached_split_cnt = GetSplitCount(max_split_count, grid_size, caps.y, caps.x, 4, tile_count);
+        cached_shape     = shape;
+    }
+    const int split_cnt = params.cold_pass ? params.prefix_splits : cached_split_cnt;
 
     grid = CtaMap::get_grid_shape(params.num_kv_heads, params.batch_size, split_cnt, cta_per_q_group);
 
@@ -69,22 +82,32 @@ bool invokeDecoding(const typename Kernel::ParamType& params)
 
     auto cache_iter_factory = CreateCacheIterFactory<typename Kernel::CacheIteratorFactory>::apply(params);
 
-    kernel_func<<<grid, block, kSmemSize, params.stream>>>(
-        params, cache_iter_factory, CtaMap{}, q_group_size, q_head_per_cta, cta_per_q_group);
+    LaunchKernel(kernel_func,
+                 grid,
+                 block,
+                 kSmemSize,
+                 params.stream,
+                 params,
+                 cache_iter_factory,
+                 CtaMap{},
+                 q_group_size,
+                 q_head_per_cta,
+                 cta_per_q_group);
 
     if (auto err = cudaGetLastError(); err != cudaSuccess) {
         std::cout << cudaGetErrorString(err) << "\n";
         std::abort();
     }
 
-    if (Kernel::need_separate_reduce(split_cnt)) {
+    if (!params.cold_pass && Kernel::need_separate_reduce(split_cnt + prefix_splits)) {
         attention::invokeReduce<Kernel::kHeadDim>(params.out,
+                                                  params.cp_lse,
                                                   params.partial_M,
                                                   params.partial_L,
                                                   params.partial_O,
                                                   params.split_cnt,
                                                   params.max_split_k,
-                                                  split_cnt,
+                                                  split_cnt + prefix_splits,
                                                   params.token_num,
                                                   params.num_heads,
                                                   params.inv_sqrt_dh,
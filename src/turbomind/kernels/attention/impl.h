@@ -12,6 +12,9 @@ struct MMA_16816 {
 struct MMA_81616 {
 };  // MMA_16816 transposed
 
+struct MMA_16832 {
+};  // QK in m16n8k32 e4m3, PV in m16n8k16
+
 struct MMA_1688 {
 };
 
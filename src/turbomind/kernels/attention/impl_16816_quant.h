@@ -0,0 +1,433 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/attention/impl.h"
+#include "src/turbomind/kernels/attention/impl_m16n8.h"
+#include "src/turbomind/kernels/attention/quantization.h"
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/layout.h"
+#include "src/turbomind/kernels/core/mma.h"
+#include "src/turbomind/kernels/core/smem.h"
+#include "src/turbomind/kernels/core/thread_map.h"
+#include <type_traits>
+
+namespace turbomind::attention {
+
+// Prefill over a quantized cache, the tiles of K/V are dequantized in registers after LDSM. The smem layouts, the
+// loads & the conversion follow the quantized path of `MMA_81616`, the dequantized (s16,d16) atoms are then used as
+// the B operands of the (q, s) & (q, d) m16n8k16 tiles. The conversion permutes the head dim within every X atoms of
+// 16, Q is loaded with the same permutation and O is stored with its inverse
+template<class T_,
+         class Tkv_,
+         int CTA_H_,
+         int CTA_Q_,
+         int CTA_S_,
+         int WARP_H,
+         int WARP_Q,
+         int WARP_S,
+         int HeadDim,
+         int Stages>
+struct Impl<MMA_16816, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H, WARP_Q, WARP_S, HeadDim, Stages>:
+    Impl_m16k8<T_, WARP_H, WARP_Q, WARP_S, HeadDim> {
+
+    using Base = Impl_m16k8<T_, WARP_H, WARP_Q, WARP_S, HeadDim>;
+
+    using Base::OP_M;
+    using Base::OP_N;
+    using Base::K_M;
+    using Base::K_N;
+    using Base::V_M;
+    using Base::V_N;
+
+    using typename Base::FragS;
+    using typename Base::FragO;
+    using typename Base::FragM;
+    using typename Base::FragL;
+
+    using Base::ForeachS;
+    using Base::Softmax;
+    using Base::ConvertStoP;
+
+    using T   = T_;
+    using Tkv = Tkv_;
+
+    static_assert(!std::is_same_v<T, Tkv>);
+
+    static constexpr int kHeadDim = HeadDim;
+
+    static constexpr int CTA_H = CTA_H_;
+    static constexpr int CTA_Q = CTA_Q_;
+    static constexpr int CTA_S = CTA_S_;
+
+    static constexpr int kWarpCntQ  = CTA_Q * CTA_H / WARP_Q;
+    static constexpr int kWarpCntS  = CTA_S / WARP_S;
+    static constexpr int kWarpCount = kWarpCntQ * kWarpCntS;
+
+    static_assert(kWarpCntS == 1);
+
+    static constexpr int OP_K = 16;
+
+    static constexpr int K_K = HeadDim / OP_K;  // 128 / 16 = 8
+    static constexpr int V_K = WARP_S / OP_K;   //  64 / 16 = 4  -> S4
+
+    static constexpr int S_M = WARP_S / 16;   // (s16,d16) atoms of K along S, 4
+    static constexpr int D_M = HeadDim / 16;  // (s16,d16) atoms of V along D, 8
+
+    static constexpr int X = 16 / bitsof<Tkv>;
+
+    static_assert(K_K % X == 0 && D_M % X == 0);
+
+    using FragQ = Array<T, 8>[K_K][K_M];  // ((q8, d4), (Dk, Qm), (d2, q2, d2))
+                                          //    1  2x    16  16    8x   8   1
+    using FragK = Array<T, 4>[K_K][K_N];  // ((s8, d4), (Dk, Sn), (d2, d2))
+                                          //    1  2x    16   8    8x   1
+    using FragP = Array<T, 8>[V_M][V_K];  // ((q8, s4), (Qm, Sk), (s2, q2, s2))
+                                          //    1   2    16  16     8   8   1
+    using FragV = Array<T, 4>[V_K][V_N];  // ((d8, s4), (Sk, Dn), (s2, s2))
+                                          //    1   2    16   8     8   1
+
+    using DataK  = Array<Tkv, 8 * X>[K_K / X][S_M];  // {s8,d4} [Dk/x,Sm] (d2,s2,dx,d2)
+    using ParamK = Array<T, 2>[S_M][2];              // {s8,_4} [     Sm] (   s2      )
+    using DataV  = Array<Tkv, 8 * X>[V_K][D_M / X];  // {s8,d4} [Sk,Dm/x] (s2,d2,dx,d2)
+    using ParamV = Array<T, 2>[V_K][2];              // {s8,_4} [Sk     ] (s2         )
+
+    static_assert(sizeof(FragS) / 2 == sizeof(FragP));
+
+    static constexpr auto _SmemLayoutKV(std::integral_constant<int, 8>)
+    {
+        return SmemLayoutV2<CTA_S, HeadDim, 32, 64, Swizzle<3, 4, 3>>{};
+    }
+    static constexpr auto _SmemLayoutKV(std::integral_constant<int, 4>)
+    {
+        return std::conditional_t<HeadDim % 128 == 0,
+                                  SmemLayoutV2<CTA_S, HeadDim, 32, 128, Swizzle<2, 5, 3>>,
+                                  SmemLayoutV2<CTA_S, HeadDim, 32, 64, Swizzle<3, 4, 3>>>{};
+    }
+
+    using SmemLayoutQ = std::conditional_t<HeadDim % 128 == 0,
+                                           SmemLayoutV2<CTA_Q * CTA_H, HeadDim, 64, 128, Swizzle<3, 3, 4>>,
+                                           SmemLayoutV2<CTA_Q * CTA_H, HeadDim, 64, 64, Swizzle<3, 3, 3>>>;
+    using SmemLayoutK = decltype(_SmemLayoutKV(bitsof<Tkv>));
+    using SmemLayoutV = decltype(_SmemLayoutKV(bitsof<Tkv>));
+
+    using SmemLayoutKVp = SmemLayoutV2<CTA_S, 2, CTA_S, 2, Identity>;
+
+    using PointerKV = get_pointer_type<Tkv>;
+
+    static constexpr bool kUseSmemQ = false;
+    static constexpr bool kUseSmemP = false;
+
+    union SharedStorage {
+        struct {
+            __align__(16) Array<Tkv, Stages * SmemLayoutK::kSize> KV;
+            __align__(16) T KVp[Stages * SmemLayoutKVp::kSize];
+        };
+        __align__(16) T Q[SmemLayoutQ::kSize];
+    };
+
+    using ThreadMapQ   = RakedThreadMap<HeadDim, CTA_Q * CTA_H, 8, kWarpCount>;
+    using ThreadMapKV  = RakedThreadMap<HeadDim, CTA_S, 128 / bitsof<Tkv>, kWarpCount>;
+    // `WARP_SIZE * kWarpCount / CTA_S` threads per row cover the params of the tile in a single S iter
+    using ThreadMapKVp = RakedThreadMap<2, CTA_S, 2, kWarpCount, WARP_SIZE * kWarpCount / CTA_S>;
+
+    static constexpr int kBatchK = ThreadMapKV::kIterS;
+    static constexpr int kBatchV = ThreadMapKV::kIterS;
+
+    // All warps read the whole tiles of K/V & their params
+    __device__ static void Sync()
+    {
+        __syncthreads();
+    }
+
+    template<class GmemIterK, class GmemIterV>
+    __device__ static void SetSmemKV(GmemIterK& gmem_K, GmemIterV& gmem_V, SharedStorage& storage, bool offset_kv)
+    {
+        int pred = offset_kv;
+        gmem_K.SetSmem(storage.KV.data(), storage.KVp);
+        gmem_V.SetSmem(storage.KV.data() + pred * SmemLayoutK::kSize, storage.KVp + pred * SmemLayoutKVp::kSize);
+    }
+
+    __device__ static void TransformQ(T* smem_Q, FragQ& frag_Q)
+    {
+        const int warp_id = threadIdx.x / WARP_SIZE;
+        const int lane_id = threadIdx.x % WARP_SIZE;
+
+        __syncwarp();
+
+        SmemAccessor<T, SmemLayoutQ> sQ{smem_Q};
+
+        PRAGMA_UNROLL
+        for (int m = 0; m < K_M; ++m) {
+            PRAGMA_UNROLL
+            for (int k = 0; k < K_K; k += X) {
+                PRAGMA_UNROLL
+                for (int x = 0; x < X; ++x) {
+                    PRAGMA_UNROLL
+                    for (int d = 0; d < 2; ++d) {
+                        PRAGMA_UNROLL
+                        for (int q = 0; q < 2; ++q) {
+                            const int qi = lane_id / 4 + m * OP_M + q * 8 + warp_id * WARP_Q;
+                            const int di = k * OP_K + lane_id % 4 * 2 * X + x * 2 + d * 8 * X;
+                            Load((Array<T, 2>&)frag_Q[k + x][m][d * 4 + q * 2], &sQ(qi, di));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    struct StateQK {
+        PointerKV smem_K;
+        T*        smem_K_param;
+        FragQ     frag_Q;
+        ParamK    param_K;
+        DataK     data_K;
+        FragK     frag_K;
+
+        __device__ StateQK(SharedStorage& storage, FragQ frag_Q_)
+        {
+            smem_K       = storage.KV.data();
+            smem_K_param = storage.KVp;
+            PRAGMA_UNROLL
+            for (int k = 0; k < K_K; ++k) {
+                PRAGMA_UNROLL
+                for (int m = 0; m < K_M; ++m) {
+                    frag_Q[k][m] = frag_Q_[k][m];
+                }
+            }
+        }
+
+        __device__ void Load(int k, int pipe_iter)
+        {
+            const int lane_id = threadIdx.x % WARP_SIZE;
+
+            if (k == 0) {
+                PRAGMA_UNROLL
+                for (int m = 0; m < S_M; ++m) {
+                    PRAGMA_UNROLL
+                    for (int s = 0; s < 2; ++s) {
+                        const int si = m * 16 + lane_id / 4 + s * 8;
+                        Lds(param_K[m][s],
+                            &smem_K_param[pipe_iter * SmemLayoutKVp::kSize + SmemLayoutKVp::apply(si, 0)]);
+                    }
+                }
+            }
+
+            if (k % X == 0) {
+                PRAGMA_UNROLL
+                for (int m = 0; m < S_M; ++m) {  // Load (s16,d16x) tiles
+                    const int s = m * 16 + lane_id % 16;
+                    const int c = k * 16 + lane_id / 16 * 8 * X;
+                    static_assert(sizeof(data_K[k / X][m]) == 16);
+                    ldsm_x4((Array<uint32_t, 4>&)data_K[k / X][m],
+                            cast_smem_ptr_to_uint(&smem_K[pipe_iter * SmemLayoutK::kSize + SmemLayoutK::apply(s, c)]));
+                }
+            }
+        }
+
+        // (s16,d16) atom `m` of A layout -> (s8,d16) tiles `2m` & `2m+1` of B layout
+        __device__ void Transform(int k)
+        {
+            using Converter = ConvertKvCache<Tkv, T>;
+            if (k % X == 0) {
+                PRAGMA_UNROLL
+                for (int m = 0; m < S_M; ++m) {
+                    PRAGMA_UNROLL
+                    for (int s = 0; s < 2; ++s) {
+                        PRAGMA_UNROLL
+                        for (int d = 0; d < 2; ++d) {
+                            auto dx_d2 =
+                                Converter::convert((Array<Tkv, X * 2>&)data_K[k / X][m][d * 4 * X + s * 2 * X]);
+                            PRAGMA_UNROLL
+                            for (int x = 0; x < X; ++x) {
+                                (Array<T, 2>&)frag_K[k + x][m * 2 + s][d * 2] = (Array<T, 2>&)dx_d2[x * 2];
+                            }
+                        }
+                    }
+                }
+            }
+            PRAGMA_UNROLL
+            for (int m = 0; m < S_M; ++m) {
+                PRAGMA_UNROLL
+                for (int s = 0; s < 2; ++s) {
+                    PRAGMA_UNROLL
+                    for (int i = 0; i < 4; ++i) {
+                        auto& v = frag_K[k][m * 2 + s][i];
+                        v       = __hfma(v, param_K[m][s][0], param_K[m][s][1]);
+                    }
+                }
+            }
+        }
+    };
+
+    template<class Prefetch, class Preload>
+    __device__ static void
+    ComputeQK(StateQK state_QK, FragS& frag_S, int offset, Prefetch&& prefetch, Preload&& preload)
+    {
+        PRAGMA_UNROLL
+        for (int k = 0; k < K_K; ++k) {
+            if (k < K_K - 1) {
+                state_QK.Load(k + 1, offset);
+            }
+            else {
+                ((Preload &&) preload)();
+            }
+
+            state_QK.Transform(k);
+
+            PRAGMA_UNROLL
+            for (int m = 0; m < K_M; ++m) {
+                PRAGMA_UNROLL
+                for (int n = 0; n < K_N; ++n) {
+                    mma_m16n8k16_row_col(frag_S[m][n], state_QK.frag_Q[k][m], state_QK.frag_K[k][n], frag_S[m][n]);
+                }
+            }
+            if (k < K_K - 1) {
+                ((Prefetch &&) prefetch)(k);
+            }
+            if (k == K_K - 2) {
+                ((Prefetch &&) prefetch)(K_K - 1);
+            }
+        }
+    }
+
+    struct StatePV {
+        PointerKV smem_V;
+        T*        smem_V_param;
+        ParamV    param_V;
+        DataV     data_V;
+        FragP     frag_P;
+        FragV     frag_V;
+
+        __device__ StatePV(SharedStorage& storage, bool offset = false)
+        {
+            smem_V       = storage.KV.data() + (offset ? SmemLayoutK::kSize : 0);
+            smem_V_param = storage.KVp + (offset ? SmemLayoutKVp::kSize : 0);
+        }
+
+        __device__ void Load(int k, int pipe_iter)
+        {
+            const int lane_id = threadIdx.x % WARP_SIZE;
+
+            PRAGMA_UNROLL
+            for (int s = 0; s < 2; ++s) {
+                const int si = k * 16 + lane_id / 4 + s * 8;
+                Lds(param_V[k][s], &smem_V_param[pipe_iter * SmemLayoutKVp::kSize + SmemLayoutKVp::apply(si, 0)]);
+            }
+
+            PRAGMA_UNROLL
+            for (int m = 0; m < D_M; m += X) {  // Load (s16,d16x) tiles
+                const int s = k * 16 + lane_id / 16 * 8 + lane_id % 8;
+                const int c = m * 16 + lane_id % 16 / 8 * 8 * X;
+                static_assert(sizeof(data_V[k][m / X]) == 16);
+                ldsm_x4((Array<uint32_t, 4>&)data_V[k][m / X],
+                        cast_smem_ptr_to_uint(&smem_V[pipe_iter * SmemLayoutV::kSize + SmemLayoutV::apply(s, c)]));
+            }
+        }
+
+        // (s16,d16) atom `m` -> (s16,d8) tiles `2m` & `2m+1` of B layout, transposed after the dequantization
+        __device__ void Transform(int k)
+        {
+            PRAGMA_UNROLL
+            for (int m = 0; m < D_M; m += X) {
+                PRAGMA_UNROLL
+                for (int s = 0; s < 2; ++s) {
+                    PRAGMA_UNROLL
+                    for (int d = 0; d < 2; ++d) {
+                        auto dx_d2 = ConvertKvCache<Tkv, T>::convert(
+                            (Array<Tkv, 2 * X>&)data_V[k][m / X][s * 4 * X + d * 2 * X]);
+                        PRAGMA_UNROLL
+                        for (int x = 0; x < X; ++x) {
+                            (Array<T, 2>&)frag_V[k][(m + x) * 2 + d][s * 2] = (Array<T, 2>&)dx_d2[x * 2];
+                        }
+                    }
+                }
+            }
+            PRAGMA_UNROLL
+            for (int n = 0; n < V_N; ++n) {
+                PRAGMA_UNROLL
+                for (int s = 0; s < 2; ++s) {
+                    auto& d2 = (Array<T, 2>&)frag_V[k][n][s * 2];
+                    PRAGMA_UNROLL
+                    for (int i = 0; i < 2; ++i) {
+                        d2[i] = __hfma(d2[i], param_V[k][s][0], param_V[k][s][1]);
+                    }
+                    (uint32_t&)d2 = transpose_m8n8_b16((uint32_t&)d2);
+                }
+            }
+        }
+    };
+
+    template<class Prefetch, class Preload>
+    __device__ static void
+    ComputePV(StatePV state_PV, FragO& frag_O, int offset, Prefetch&& prefetch, Preload&& preload)
+    {
+        PRAGMA_UNROLL
+        for (int k = 0; k < V_K; ++k) {
+            if (k < V_K - 1) {
+                state_PV.Load(k + 1, offset);
+            }
+            else {
+                ((Preload &&) preload)();
+            }
+
+            state_PV.Transform(k);
+
+            PRAGMA_UNROLL
+            for (int m = 0; m < V_M; ++m) {
+                PRAGMA_UNROLL
+                for (int n = 0; n < V_N; ++n) {
+                    mma_m16n8k16_row_col(frag_O[m][n], state_PV.frag_P[m][k], state_PV.frag_V[k][n], frag_O[m][n]);
+                }
+            }
+            if (k < V_K - 1) {
+                ((Prefetch &&) prefetch)(k);
+            }
+            if (k == V_K - 2) {
+                ((Prefetch &&) prefetch)(V_K - 1);
+            }
+        }
+    }
+
+    // Same as `Impl_m16k8::StoreO`, the index of the head dim is permuted back
+    template<bool is_norm, class Func>
+    __device__ static void StoreO(FragO& frag_O, FragL& frag_L, SharedStorage& storage, Func&& func)
+    {
+        FragL inv_L;
+        PRAGMA_UNROLL
+        for (int m = 0; m < V_M; ++m) {
+            PRAGMA_UNROLL
+            for (int q = 0; q < 2; ++q) {
+                inv_L[m][q] = fdividef(1.f, frag_L[m][q]);
+            }
+        }
+
+        const int warp_id = threadIdx.x / WARP_SIZE;
+        const int lane_id = threadIdx.x % WARP_SIZE;
+
+        PRAGMA_UNROLL
+        for (int m = 0; m < V_M; ++m) {
+            PRAGMA_UNROLL
+            for (int q = 0; q < 2; ++q) {
+                const int qi = lane_id / 4 * 1 + m * OP_M + q * 8 + warp_id * WARP_Q;
+                PRAGMA_UNROLL
+                for (int n = 0; n < V_N; ++n) {
+                    if constexpr (is_norm) {
+                        PRAGMA_UNROLL
+                        for (int d = 0; d < 2; ++d) {
+                            frag_O[m][n][q * 2 + d] *= inv_L[m][q];
+                        }
+                    }
+                    // n -> ((d2, dx), Dm/x)
+                    const int x  = n / 2 % X;
+                    const int d  = n % 2;
+                    const int di = n / 2 / X * X * 16 + d * 8 * X + lane_id % 4 * 2 * X + x * 2;
+                    ((Func &&) func)(qi % WARP_H, qi / WARP_H, di, (Array<float, 2>&)frag_O[m][n][q * 2]);
+                }
+            }
+        }
+    }
+};
+
+}  // namespace turbomind::attention
@@ -0,0 +1,199 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/attention/impl.h"
+#include "src/turbomind/kernels/attention/impl_16816_quant.h"
+#include "src/turbomind/kernels/attention/quantization.h"
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/mma.h"
+#include "src/turbomind/kernels/core/smem.h"
+
+namespace turbomind::attention {
+
+// Prefill over an e4m3 cache on sm89+, S = Q K^T runs on the fp8 tensor cores. The e4m3 K is fed to m16n8k32 as
+// read from the blocks (LDSM of the raw bytes gives the B layout), Q is quantized once per CTA with a scale per
+// (token, head) and S is rescaled by the scales of Q & K in f32. The symmetric params of the cache have no zero point.
+// P V is the m16n8k16 of the quantized path, as an e4m3 V would have to be transposed in smem to be the B operand
+template<class T_,
+         int CTA_H_,
+         int CTA_Q_,
+         int CTA_S_,
+         int WARP_H,
+         int WARP_Q,
+         int WARP_S,
+         int HeadDim,
+         int Stages>
+struct Impl<MMA_16832, T_, fp8_e4m3, CTA_H_, CTA_Q_, CTA_S_, WARP_H, WARP_Q, WARP_S, HeadDim, Stages>:
+    Impl<MMA_16816, T_, fp8_e4m3, CTA_H_, CTA_Q_, CTA_S_, WARP_H, WARP_Q, WARP_S, HeadDim, Stages> {
+
+    using Base = Impl<MMA_16816, T_, fp8_e4m3, CTA_H_, CTA_Q_, CTA_S_, WARP_H, WARP_Q, WARP_S, HeadDim, Stages>;
+
+    using Base::OP_M;
+    using Base::K_M;
+    using Base::K_N;
+
+    using typename Base::T;
+    using typename Base::FragS;
+    using typename Base::PointerKV;
+    using typename Base::SharedStorage;
+    using typename Base::SmemLayoutQ;
+    using typename Base::SmemLayoutK;
+    using typename Base::SmemLayoutKVp;
+
+    static constexpr int OP_K = 32;
+
+    static constexpr int K_K = HeadDim / OP_K;  // 128 / 32 = 4
+    static constexpr int S_M = WARP_S / 16;     // (s16,d32) tiles of K along S, 4
+
+    struct FragQ {
+        Array<fp8_e4m3, 16> data[K_K][K_M];  // ((q8, d4), (Dk, Qm), (d2, q2, d4))
+                                             //    1  4x    32  16   16x   8   1
+        Array<float, 2>     scale[K_M];      // ((q8, _4), Qm, q2)
+    };
+
+    using FragK  = Array<fp8_e4m3, 8>[K_K][K_N];  // ((s8, d4), (Dk, Sn), (d2, d4))
+                                                  //    1  4x    32   8   16x   1
+    using ParamK = Array<T, 2>[K_N];              // ((_8, s4), Sn, s2), scales of the columns of S
+
+    __device__ static void TransformQ(T* smem_Q, FragQ& frag_Q)
+    {
+        const int warp_id = threadIdx.x / WARP_SIZE;
+        const int lane_id = threadIdx.x % WARP_SIZE;
+
+        __syncwarp();
+
+        SmemAccessor<T, SmemLayoutQ> sQ{smem_Q};
+
+        PRAGMA_UNROLL
+        for (int m = 0; m < K_M; ++m) {
+            Array<T, 4>     vec_Q[K_K][2][2];  // [Dk, d2, q2]
+            Array<float, 2> amax{};
+            PRAGMA_UNROLL
+            for (int k = 0; k < K_K; ++k) {
+                PRAGMA_UNROLL
+                for (int d = 0; d < 2; ++d) {
+                    PRAGMA_UNROLL
+                    for (int q = 0; q < 2; ++q) {
+                        const int qi = lane_id / 4 + m * OP_M + q * 8 + warp_id * WARP_Q;
+                        const int di = k * OP_K + d * 16 + lane_id % 4 * 4;
+                        Lds(vec_Q[k][d][q], &sQ(qi, di));
+                        PRAGMA_UNROLL
+                        for (int i = 0; i < 4; ++i) {
+                            amax[q] = fmaxf(amax[q], fabsf((float)vec_Q[k][d][q][i]));
+                        }
+                    }
+                }
+            }
+            PRAGMA_UNROLL
+            for (int q = 0; q < 2; ++q) {
+                // the 4 threads of a quad hold the whole head dim of the row
+                PRAGMA_UNROLL
+                for (int mask = 1; mask < 4; mask *= 2) {
+                    amax[q] = fmaxf(amax[q], __shfl_xor_sync((uint32_t)-1, amax[q], mask));
+                }
+                // same as the scales of the cache, all zeros or underflow of the scale
+                float scale = amax[q] * (1.f / 448.f);
+                if (scale == 0.f) {
+                    scale = 1.f;
+                }
+                frag_Q.scale[m][q] = scale;
+
+                ConvertKvCache<float, fp8_e4m3> quant{scale, 0.f};
+                PRAGMA_UNROLL
+                for (int k = 0; k < K_K; ++k) {
+                    PRAGMA_UNROLL
+                    for (int d = 0; d < 2; ++d) {
+                        (Array<fp8_e4m3, 4>&)frag_Q.data[k][m][d * 8 + q * 4] = quant(cast<float>(vec_Q[k][d][q]));
+                    }
+                }
+            }
+        }
+    }
+
+    struct StateQK {
+        PointerKV smem_K;
+        T*        smem_K_param;
+        FragQ     frag_Q;
+        ParamK    param_K;
+        FragK     frag_K;
+
+        __device__ StateQK(SharedStorage& storage, FragQ frag_Q_)
+        {
+            smem_K       = storage.KV.data();
+            smem_K_param = storage.KVp;
+            frag_Q       = frag_Q_;
+        }
+
+        __device__ void Load(int k, int pipe_iter)
+        {
+            const int lane_id = threadIdx.x % WARP_SIZE;
+
+            if (k == 0) {
+                PRAGMA_UNROLL
+                for (int n = 0; n < K_N; ++n) {
+                    PRAGMA_UNROLL
+                    for (int s = 0; s < 2; ++s) {
+                        const int si  = n * 8 + lane_id % 4 * 2 + s;
+                        param_K[n][s] = smem_K_param[pipe_iter * SmemLayoutKVp::kSize + SmemLayoutKVp::apply(si, 0)];
+                    }
+                }
+            }
+
+            PRAGMA_UNROLL
+            for (int m = 0; m < S_M; ++m) {  // Load (s16,d32) tiles -> (s8,d32) tiles `2m` & `2m+1` of B layout
+                const int s = m * 16 + lane_id / 16 * 8 + lane_id % 8;
+                const int c = k * OP_K + lane_id / 8 % 2 * 16;
+                static_assert(sizeof(frag_K[k][m * 2]) * 2 == 16);
+                ldsm_x4((Array<uint32_t, 4>&)frag_K[k][m * 2],
+                        cast_smem_ptr_to_uint(&smem_K[pipe_iter * SmemLayoutK::kSize + SmemLayoutK::apply(s, c)]));
+            }
+        }
+    };
+
+    // `frag_S` is cleared by the mainloop, the products of the scales are applied once after the K dim is reduced
+    template<class Prefetch, class Preload>
+    __device__ static void
+    ComputeQK(StateQK state_QK, FragS& frag_S, int offset, Prefetch&& prefetch, Preload&& preload)
+    {
+        PRAGMA_UNROLL
+        for (int k = 0; k < K_K; ++k) {
+            if (k < K_K - 1) {
+                state_QK.Load(k + 1, offset);
+            }
+            else {
+                ((Preload &&) preload)();
+            }
+
+            PRAGMA_UNROLL
+            for (int m = 0; m < K_M; ++m) {
+                PRAGMA_UNROLL
+                for (int n = 0; n < K_N; ++n) {
+                    mma_m16n8k32_row_col(frag_S[m][n], state_QK.frag_Q.data[k][m], state_QK.frag_K[k][n], frag_S[m][n]);
+                }
+            }
+            if (k < K_K - 1) {
+                ((Prefetch &&) prefetch)(k);
+            }
+            if (k == K_K - 2) {
+                ((Prefetch &&) prefetch)(K_K - 1);
+            }
+        }
+
+        PRAGMA_UNROLL
+        for (int m = 0; m < K_M; ++m) {
+            PRAGMA_UNROLL
+            for (int n = 0; n < K_N; ++n) {
+                PRAGMA_UNROLL
+                for (int q = 0; q < 2; ++q) {
+                    PRAGMA_UNROLL
+                    for (int s = 0; s < 2; ++s) {
+                        frag_S[m][n][q * 2 + s] *= state_QK.frag_Q.scale[m][q] * (float)state_QK.param_K[n][s];
+                    }
+                }
+            }
+        }
+    }
+};
+
+}  // namespace turbomind::attention
@@ -33,9 +33,11 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
     static constexpr int CTA_Q = CTA_Q_;
     static constexpr int CTA_S = CTA_S_;
 
-    static_assert(CTA_Q == 1);
+    // The N dim of the tiles is (q, h) pairs, more than 1 query is for the short inputs decoded against the cache
+    static_assert(WARP_Q == CTA_Q);
 
     static constexpr int WARP_H = WARP_H_;
+    static constexpr int WARP_N = WARP_H * WARP_Q;
 
     static constexpr int kHeadDim = HeadDim;
 
@@ -50,11 +52,11 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
     static constexpr int OP_K = 16;
 
     static constexpr int K_M = WARP_S / OP_M;               // 1
-    static constexpr int K_N = (WARP_H + OP_N - 1) / OP_N;  // 1
+    static constexpr int K_N = (WARP_N + OP_N - 1) / OP_N;  // 1
     static constexpr int K_K = HeadDim / OP_K;              // 8
 
     static constexpr int V_M = HeadDim / OP_M;              // 8
-    static constexpr int V_N = (WARP_H + OP_N - 1) / OP_N;  // 1
+    static constexpr int V_N = (WARP_N + OP_N - 1) / OP_N;  // 1
     static constexpr int V_K = WARP_S / OP_K;               // 1
 
     using FragK = Array<T, 8>[K_K][K_M];      // (s8,d4) (Dk,Sm) (d2,s2,d2)
@@ -92,7 +94,7 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
     static constexpr bool kUseSmemQ = false;
     static constexpr bool kUseSmemP = false;
 
-    static constexpr int CTA_H1 = (CTA_H + OP_N - 1) / OP_N * OP_N;
+    static constexpr int CTA_H1 = (CTA_H * CTA_Q + OP_N - 1) / OP_N * OP_N;
 
     static constexpr auto _SmemLayoutKV(std::integral_constant<int, 16>)
     {
@@ -180,7 +182,7 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
                     for (int q = 0; q < 2; ++q) {
                         const int si = m * OP_M + lane_id / 4 * 1 + s * 8 + warp_id * WARP_S;
                         const int hi = n * OP_N + lane_id % 4 * 2 + q * 1;
-                        ((Func &&) func)(hi, /*qi*/ 0, si, /*ri*/ 0, S[m][n][s * 2 + q]);
+                        ((Func &&) func)(hi % CTA_H, hi / CTA_H, si, /*ri*/ 0, S[m][n][s * 2 + q]);
                     }
                 }
             }
@@ -197,7 +199,7 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
             for (int q = 0; q < 2; ++q) {
                 const int hi = lane_id % 4 * 2 + n * OP_N + q * 1;
                 const int ri = lane_id / 4 * 1;
-                ((Func &&) func)(hi, /*qi*/ 0, ri, frag_M[n][q], frag_L[n][q]);
+                ((Func &&) func)(hi % CTA_H, hi / CTA_H, ri, frag_M[n][q], frag_L[n][q]);
             }
         }
     }
@@ -769,7 +771,7 @@ struct Impl<MMA_81616, T_, Tkv_, CTA_H_, CTA_Q_, CTA_S_, WARP_H_, WARP_Q, WARP_S
                 const int hi = offset.y + s * Map::kDeltaS;
                 const int di = offset.x + c * Map::kDeltaC;
                 Load(tmp_O[s][c], &storage.O1[hi][di]);
-                ((Func &&) func)(hi, 0, di, tmp_O[s][c]);
+                ((Func &&) func)(hi % CTA_H, hi / CTA_H, di, tmp_O[s][c]);
             }
         }
     }
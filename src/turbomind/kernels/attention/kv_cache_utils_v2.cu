@@ -5,29 +5,39 @@
 #include "src/turbomind/kernels/attention/quantization.h"
 #include "src/turbomind/kernels/attention/rotary_embedding.h"
 #include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/pdl.h"
 #include "src/turbomind/kernels/core/thread_map.h"
 #include "src/turbomind/models/llama/llama_utils.h"
+#include <cub/block/block_scan.cuh>
 #include <type_traits>
 
 namespace turbomind {
 
 template<class Tkv, int CTA_S, int HeadDim, int WarpCnt, class T, class BlockLayout>
-__global__ void __launch_bounds__(128) ProcessKV_v2(char**          blocks,
-                                                    const T*        k,
-                                                    const T*        v,
-                                                    const T*        k_bias,
-                                                    const T*        v_bias,
-                                                    const int*      cu_q_len,
-                                                    const int*      cu_k_len,
-                                                    const int*      cu_block_num,
-                                                    RopeKernelParam rope_param,
-                                                    int64_t         stride_b,
-                                                    int64_t         stride_c,
-                                                    int64_t         stride_h,
-                                                    int64_t         stride_s,
-                                                    int             layer_id,
-                                                    BlockLayout     block_layout)
+__global__ void __launch_bounds__(128) ProcessKV_v2(char**               blocks,
+                                                    const T*             k,
+                                                    const T*             v,
+                                                    const T*             k_bias,
+                                                    const T*             v_bias,
+                                                    const int*           cu_q_len,
+                                                    const int*           cu_k_len,
+                                                    const int*           cu_block_num,
+                                                    RopeKernelParam      rope_param,
+                                                    int64_t              stride_b,
+                                                    int64_t              stride_c,
+                                                    int64_t              stride_h,
+                                                    int64_t              stride_s,
+                                                    int                  layer_id,
+                                                    BlockLayout          block_layout,
+                                                    T*                   flat_k,
+                                                    T*                   flat_v,
+                                                    int64_t              flat_stride_h,
+                                                    ContextParallelParam cp,
+                                                    char* const*         cow_blocks,
+                                                    float*               error)
 {
+    PdlWait();
+    PdlLaunchDependents();
 
     constexpr int kVecSize = sizeof(uint4) / sizeof(T);
 
@@ -131,7 +141,11 @@ __global__ void __launch_bounds__(128) ProcessKV_v2(char**          blocks,
     Array<T, 2> param_K[ITER_S];
     Array<T, 2> param_V[ITER_S];
 
-    if constexpr (!std::is_same_v<T, Tkv>) {
+    if constexpr (std::is_same_v<Tkv, fp8_e4m3>) {
+        warp_stats_e4m3<Map::kWarpThreadC>(param_K, vec_K);
+        warp_stats_e4m3<Map::kWarpThreadC>(param_V, vec_V);
+    }
+    else if constexpr (!std::is_same_v<T, Tkv>) {
         warp_stats<Map::kWarpThreadC>(param_K, vec_K, bitsof<Tkv>);
         warp_stats<Map::kWarpThreadC>(param_V, vec_V, bitsof<Tkv>);
     }
@@ -150,16 +164,69 @@ __global__ void __launch_bounds__(128) ProcessKV_v2(char**          blocks,
         }
     }
 
+    if (error) {
+        // Squared errors of the tokens as read back from the cache & their squared values, the cache is not written
+        float sum[4]{};
+        PRAGMA_UNROLL
+        for (int s = 0; s < ITER_S; ++s) {
+            const auto             p_K = StoredQuantParam<Tkv>(param_K[s]);
+            const auto             p_V = StoredQuantParam<Tkv>(param_V[s]);
+            ConvertKvCache<Tkv, T> deq_K{p_K[0], p_K[1]};
+            ConvertKvCache<Tkv, T> deq_V{p_V[0], p_V[1]};
+            const int              qi = offset.y + s * Map::kDeltaS + token_idx;
+            const int              ti = history_len + qi;
+            if (qi < q_len && (cp.size <= 1 || cp.is_local(ti))) {
+                PRAGMA_UNROLL
+                for (int c = 0; c < ITER_C; ++c) {
+                    const auto k = deq_K(out_K[s][c]);
+                    const auto v = deq_V(out_V[s][c]);
+                    PRAGMA_UNROLL
+                    for (int i = 0; i < kVecSize; ++i) {
+                        const float rk = (float)vec_K[s][c][i];
+                        const float rv = (float)vec_V[s][c][i];
+                        const float ek = (float)k[i] - rk;
+                        const float ev = (float)v[i] - rv;
+                        sum[0] += ek * ek;
+                        sum[1] += rk * rk;
+                        sum[2] += ev * ev;
+                        sum[3] += rv * rv;
+                    }
+                }
+            }
+        }
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            PRAGMA_UNROLL
+            for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+                sum[i] += __shfl_xor_sync((uint32_t)-1, sum[i], mask);
+            }
+            if (lane_id == 0) {
+                atomicAdd(&error[i], sum[i]);
+            }
+        }
+        return;
+    }
+
     blocks += cu_block_num[batch_idx];
 
     block::Head<T, Tkv, BlockLayout> block_head{block_layout, layer_id, head_idx};
 
+    // The partial block of a fork is filled from the block it was forked from by the first write to it, the first
+    // tile covers the block
+    if (cow_blocks && token_idx == 0) {
+        if (const char* src = cow_blocks[batch_idx]) {
+            block_head.copy_before((char**)blocks, history_len, src, threadIdx.x, blockDim.x);
+        }
+    }
+
     PRAGMA_UNROLL
     for (int s = 0; s < ITER_S; ++s) {
         const int qi = offset.y + s * Map::kDeltaS + token_idx;  // local offset into `input_length`
-        if (qi < q_len) {
-            const int ti = history_len + qi;  // timestep
-            block_head.with((char**)blocks, ti, [&](auto k_cache, auto v_cache, T* k_param, T* v_param) {
+        const int ti = history_len + qi;                         // timestep
+        // with context parallelism only the tokens of the rank are cached, packed in its blocks
+        if (qi < q_len && (cp.size <= 1 || cp.is_local(ti))) {
+            const int bi = cp.size > 1 ? cp.local_idx(ti) : ti;
+            block_head.with((char**)blocks, bi, [&](auto k_cache, auto v_cache, T* k_param, T* v_param) {
                 PRAGMA_UNROLL
                 for (int c = 0; c < ITER_C; ++c) {
                     int di = offset.x + c * Map::kDeltaC;
@@ -178,6 +245,31 @@ __global__ void __launch_bounds__(128) ProcessKV_v2(char**          blocks,
             });
         }
     }
+
+    if (flat_k == nullptr) {
+        return;
+    }
+
+    // Write what flattening the blocks would read back, so the new tokens don't make a round trip through the cache
+    const int ti_beg = cu_k_len[batch_idx] - cu_k_len[0] + history_len;
+
+    PRAGMA_UNROLL
+    for (int s = 0; s < ITER_S; ++s) {
+        const auto             p_K = StoredQuantParam<Tkv>(param_K[s]);
+        const auto             p_V = StoredQuantParam<Tkv>(param_V[s]);
+        ConvertKvCache<Tkv, T> deq_K{p_K[0], p_K[1]};
+        ConvertKvCache<Tkv, T> deq_V{p_V[0], p_V[1]};
+        const int              qi = offset.y + s * Map::kDeltaS + token_idx;
+        PRAGMA_UNROLL
+        for (int c = 0; c < ITER_C; ++c) {
+            const int     di    = offset.x + c * Map::kDeltaC;
+            const int64_t index = ((ti_beg + qi) + head_idx * flat_stride_h) * HeadDim + di;
+            if (qi < q_len) {
+                Store(&flat_k[index], deq_K(out_K[s][c]));
+                Store(&flat_v[index], deq_V(out_V[s][c]));
+            }
+        }
+    }
 }
 
 template<class T>
@@ -201,7 +293,14 @@ void invokeProcessKV_v2(char**                 blocks,
                         int                    head_dim,
                         int                    batch_size,
                         int                    quant_policy,
-                        cudaStream_t           stream)
+                        cudaStream_t           stream,
+                        T*                     flat_k,
+                        T*                     flat_v,
+                        int64_t                flat_stride_h,
+                        ContextParallelParam   cp,
+                        int                    layer_offset,
+                        char* const*           cow_blocks,
+                        float*                 error)
 {
     constexpr int WARPS = 4;
     constexpr int CTA_S = 64;
@@ -215,23 +314,34 @@ void invokeProcessKV_v2(char**                 blocks,
         constexpr int kHeadDim = dim;
         FT_CHECK(head_dim == kHeadDim);
 
-        block::Layout block_layout{block::Config<T, Tkv, kHeadDim>{head_num, block_seq_len}};
-
-        ProcessKV_v2<Tkv, CTA_S, kHeadDim, WARPS><<<grid, block, 0, stream>>>(blocks,
-                                                                              k,
-                                                                              v,
-                                                                              k_bias,
-                                                                              v_bias,
-                                                                              cu_q_len,
-                                                                              cu_k_len,
-                                                                              cu_block_num,
-                                                                              rope_param,
-                                                                              stride_b,
-                                                                              stride_c,
-                                                                              stride_h,
-                                                                              stride_s,
-                                                                              layer_id,
-                                                                              block_layout);
+        block::Layout block_layout{block::Config<T, Tkv, kHeadDim>{head_num, block_seq_len}, layer_offset};
+
+        LaunchKernel(ProcessKV_v2<Tkv, CTA_S, kHeadDim, WARPS, T, decltype(block_layout)>,
+                     grid,
+                     block,
+                     0,
+                     stream,
+                     blocks,
+                     k,
+                     v,
+                     k_bias,
+                     v_bias,
+                     cu_q_len,
+                     cu_k_len,
+                     cu_block_num,
+                     rope_param,
+                     stride_b,
+                     stride_c,
+                     stride_h,
+                     stride_s,
+                     layer_id,
+                     block_layout,
+                     flat_k,
+                     flat_v,
+                     flat_stride_h,
+                     cp,
+                     cow_blocks,
+                     error);
     };
 
     auto dispatch = [&](auto tkv) {
@@ -244,6 +354,14 @@ void invokeProcessKV_v2(char**                 blocks,
         else if (head_dim == 192) {
             return invoke(tkv, std::integral_constant<int, 192>{});
         }
+        else if (head_dim == 256) {
+            return invoke(tkv, std::integral_constant<int, 256>{});
+        }
+        else if (head_dim == 576) {  // latent MLA cache
+            if constexpr (std::is_same_v<decltype(tkv), T>) {
+                return invoke(tkv, std::integral_constant<int, 576>{});
+            }
+        }
         FT_CHECK(0);
     };
 
@@ -253,6 +371,9 @@ void invokeProcessKV_v2(char**                 blocks,
     else if (quant_policy & QuantPolicy::kCacheKVInt4) {
         dispatch(uint4_t{});
     }
+    else if (quant_policy & QuantPolicy::kCacheKVFp8) {
+        dispatch(fp8_e4m3{});
+    }
     else {
         dispatch(T{});
     }
@@ -279,7 +400,14 @@ void invokeProcessKV_v2(char**                 blocks,
                                      int                    head_dim,                                                  \
                                      int                    batch_size,                                                \
                                      int                    quant_policy,                                              \
-                                     cudaStream_t           stream);
+                                     cudaStream_t           stream,                                                    \
+                                     type*                  flat_k,                                                    \
+                                     type*                  flat_v,                                                    \
+                                     int64_t                flat_stride_h,                                             \
+                                     ContextParallelParam   cp,                                                        \
+                                     int                    layer_offset,                                              \
+                                     char* const*           cow_blocks,                                                \
+                                     float*                 error);
 
 INSTANTIATE_invokeProcessKV_v2(half);
 #if ENABLE_BF16
@@ -290,6 +418,7 @@ template<int CTA_S, int HeadDim, int WarpCnt, class T, class Tkv, class BlockLay
 __global__ void __launch_bounds__(128) flattenKV_v2(T*              k,
                                                     T*              v,
                                                     const Tkv**     blocks,
+                                                    const int*      cu_q_len,
                                                     const int*      cu_k_len,
                                                     const int*      cu_block_num,
                                                     RopeKernelParam rope_param,
@@ -298,7 +427,9 @@ __global__ void __launch_bounds__(128) flattenKV_v2(T*              k,
                                                     int64_t         stride_h,
                                                     int64_t         stride_s,
                                                     int             layer_id,
-                                                    BlockLayout     block_layout)
+                                                    BlockLayout     block_layout,
+                                                    const int*      cold_len,
+                                                    bool            is_cold)
 {
     constexpr int kVecSize = sizeof(uint4) / sizeof(T);
 
@@ -315,9 +446,17 @@ __global__ void __launch_bounds__(128) flattenKV_v2(T*              k,
     const int ti_beg = cu_k_len[batch_idx] - ti_0;
     const int ti_end = cu_k_len[batch_idx + 1] - ti_0;
 
-    const int seq_len = ti_end - ti_beg;
+    // only the history when the new tokens are written by `ProcessKV_v2`
+    int seq_len = ti_end - ti_beg - (cu_q_len ? cu_q_len[batch_idx + 1] - cu_q_len[batch_idx] : 0);
+
+    // tiered kv cache, the tokens before `cold_len` are in the quantized blocks, which are flattened by a launch of
+    // their own. `cold_len` is a multiple of `CTA_S`
+    int seq_beg = 0;
+    if (cold_len) {
+        (is_cold ? seq_len : seq_beg) = min(seq_len, cold_len[batch_idx]);
+    }
 
-    if (ti_beg + token_idx >= ti_end) {  // empty tile
+    if (token_idx >= seq_len || token_idx < seq_beg) {  // empty tile
         return;
     }
 
@@ -417,7 +556,11 @@ void invokeFlattenKV_v2(T*                     k,
                         int                    head_dim,
                         int                    batch_size,
                         int                    quant_policy,
-                        cudaStream_t           stream)
+                        cudaStream_t           stream,
+                        const int*             cu_q_len,
+                        const int*             cold_len,
+                        int                    cold_quant_policy,
+                        int                    layer_offset)
 {
     constexpr int kWarpCnt = 4;
     constexpr int CTA_S    = 64;
@@ -425,17 +568,22 @@ void invokeFlattenKV_v2(T*                     k,
     constexpr int block = kWarpCnt * WARP_SIZE;
     const dim3    grid((max_seq_len + CTA_S - 1) / CTA_S, head_num, batch_size);
 
+    bool is_cold = false;
+
     auto invoke = [&](auto tkv, const auto dim) {
         using Tkv = decltype(tkv);
 
         constexpr int kHeadDim = dim;
         FT_CHECK(head_dim == kHeadDim);
 
-        block::Layout block_layout{block::Config<T, Tkv, kHeadDim>{head_num, block_seq_len}};
+        // the cold blocks are of a uniform layout
+        block::Layout block_layout{block::Config<T, Tkv, kHeadDim>{head_num, block_seq_len},
+                                   is_cold ? 0 : layer_offset};
 
         flattenKV_v2<CTA_S, kHeadDim, kWarpCnt><<<grid, block, 0, stream>>>(k,
                                                                             v,
                                                                             (const Tkv**)blocks,
+                                                                            cu_q_len,
                                                                             cu_k_len,
                                                                             cu_block_num,
                                                                             rope_param,
@@ -444,7 +592,9 @@ void invokeFlattenKV_v2(T*                     k,
                                                                             stride_h,
                                                                             stride_s,
                                                                             layer_id,
-                                                                            block_layout);
+                                                                            block_layout,
+                                                                            cold_len,
+                                                                            is_cold);
     };
 
     auto dispatch = [&](auto tkv) {
@@ -457,18 +607,39 @@ void invokeFlattenKV_v2(T*                     k,
         else if (head_dim == 192) {
             return invoke(tkv, std::integral_constant<int, 192>{});
         }
+        else if (head_dim == 256) {
+            return invoke(tkv, std::integral_constant<int, 256>{});
+        }
+        else if (head_dim == 576) {  // latent MLA cache
+            if constexpr (std::is_same_v<decltype(tkv), T>) {
+                return invoke(tkv, std::integral_constant<int, 576>{});
+            }
+        }
         FT_CHECK(0);
     };
 
-    if (quant_policy & QuantPolicy::kCacheKVInt8) {
-        dispatch(uint8_t{});
-    }
-    else if (quant_policy & QuantPolicy::kCacheKVInt4) {
-        dispatch(uint4_t{});
-    }
-    else {
-        dispatch(T{});
+    auto dispatch_kv = [&](int quant_policy) {
+        if (quant_policy & QuantPolicy::kCacheKVInt8) {
+            dispatch(uint8_t{});
+        }
+        else if (quant_policy & QuantPolicy::kCacheKVInt4) {
+            dispatch(uint4_t{});
+        }
+        else if (quant_policy & QuantPolicy::kCacheKVFp8) {
+            dispatch(fp8_e4m3{});
+        }
+        else {
+            dispatch(T{});
+        }
+    };
+
+    if (cold_len) {
+        is_cold = true;
+        dispatch_kv(cold_quant_policy);
+        is_cold = false;
     }
+
+    dispatch_kv(quant_policy);
 }
 
 #define INSTANTIATE_invokeFlattenKV_v2(type)                                                                           \
@@ -489,11 +660,158 @@ void invokeFlattenKV_v2(T*                     k,
                                      int                    head_dim,                                                  \
                                      int                    batch_size,                                                \
                                      int                    quant_policy,                                              \
-                                     cudaStream_t           stream);
+                                     cudaStream_t           stream,                                                    \
+                                     const int*             cu_q_len,                                                  \
+                                     const int*             cold_len,                                                  \
+                                     int                    cold_quant_policy,                                         \
+                                     int                    layer_offset);
 
 INSTANTIATE_invokeFlattenKV_v2(half);
 #if ENABLE_BF16
 INSTANTIATE_invokeFlattenKV_v2(nv_bfloat16);
 #endif
 
+template<class T, int kVecSize>
+__global__ void cascadeQ_v2(T*              q_out,
+                            const T*        q,
+                            const T*        q_bias,
+                            const int*      q_idx,
+                            const int*      cu_k_len,
+                            RopeKernelParam rope_param,
+                            int64_t         stride,
+                            int             head_num,
+                            int             head_dim)
+{
+    const int ti = q_idx[blockIdx.x];  // token of a decoding sequence, also its batch index
+    // timestep of the token, the last of the context
+    const int step = cu_k_len[ti + 1] - cu_k_len[ti] - 1;
+
+    FastRoPE rope(rope_param, ti, std::integral_constant<int, kVecSize>{});
+
+    for (int i = threadIdx.x * kVecSize; i < head_num * head_dim; i += blockDim.x * kVecSize) {
+        const int di = i % head_dim;
+
+        Array<T, kVecSize> vec;
+        Ldg(vec, &q[ti * stride + i]);
+        if (q_bias) {
+            using namespace ops;
+            Array<T, kVecSize> bias;
+            Ldg(bias, &q_bias[i]);
+            vec = vec + bias;
+        }
+
+        rope.init(di);
+        rope.apply(vec, step);
+
+        Store(&q_out[(int64_t)blockIdx.x * head_num * head_dim + i], vec);
+    }
+}
+
+template<class T>
+void invokeCascadeQ_v2(T*                     q_out,
+                       const T*               q,
+                       const T*               q_bias,
+                       const int*             q_idx,
+                       const int*             cu_k_len,
+                       const RopeKernelParam& rope_param,
+                       int64_t                stride,
+                       int                    q_num,
+                       int                    head_num,
+                       int                    head_dim,
+                       cudaStream_t           stream)
+{
+    constexpr int kVecSize = sizeof(uint4) / sizeof(T);
+
+    const int block = std::min(head_num * head_dim / kVecSize, 1024);
+
+    cascadeQ_v2<T, kVecSize>
+        <<<q_num, block, 0, stream>>>(q_out, q, q_bias, q_idx, cu_k_len, rope_param, stride, head_num, head_dim);
+}
+
+#define INSTANTIATE_invokeCascadeQ_v2(type)                                                                            \
+    template void invokeCascadeQ_v2(type*                  q_out,                                                      \
+                                    const type*            q,                                                          \
+                                    const type*            q_bias,                                                     \
+                                    const int*             q_idx,                                                      \
+                                    const int*             cu_k_len,                                                   \
+                                    const RopeKernelParam& rope_param,                                                 \
+                                    int64_t                stride,                                                     \
+                                    int                    q_num,                                                      \
+                                    int                    head_num,                                                   \
+                                    int                    head_dim,                                                   \
+                                    cudaStream_t           stream);
+
+INSTANTIATE_invokeCascadeQ_v2(half);
+#if ENABLE_BF16
+INSTANTIATE_invokeCascadeQ_v2(nv_bfloat16);
+#endif
+
+// The rotation of the unit vector of each pair of dims, so the table matches what `FastRoPE` computes
+__global__ void ropeTable(float* table, RopeKernelParam rope_param, int table_len)
+{
+    const int di = (blockIdx.x * blockDim.x + threadIdx.x) * 2;
+    const int ti = blockIdx.y;
+    if (di >= rope_param.dim) {
+        return;
+    }
+
+    FastRoPE rope(rope_param, 0, std::integral_constant<int, 2>{});
+    rope.init(di);
+
+    Array<float, 2> cs{1.f, 0.f};
+    rope.apply(cs, ti);
+
+    Store(&table[(int64_t)ti * rope_param.dim + di], cs);
+}
+
+void invokeRopeTable(float* table, const RopeKernelParam& rope_param, int table_len, cudaStream_t stream)
+{
+    RopeKernelParam param = rope_param;
+    // the base of dynamic ntk is the model's for the table
+    if (param.type == RopeType::kDynamic) {
+        param.type = RopeType::kDefault;
+    }
+    param.base   = nullptr;
+    param.offset = nullptr;
+    param.table  = nullptr;
+
+    const int  pairs = param.dim / 2;
+    const int  block = std::min(pairs, 256);
+    const dim3 grid((pairs + block - 1) / block, table_len);
+    ropeTable<<<grid, block, 0, stream>>>(table, param, table_len);
+}
+
+__global__ void
+ContextParallelCuKLenKernel(int* local_cu_k_len, const int* cu_k_len, ContextParallelParam cp, int batch_size)
+{
+    constexpr int kBlockDim = 256;
+
+    using BlockScan = cub::BlockScan<int, kBlockDim>;
+
+    __shared__ typename BlockScan::TempStorage temp_storage;
+
+    if (threadIdx.x == 0) {
+        local_cu_k_len[0] = 0;
+    }
+
+    int base = 0;
+    for (int offset = 0; offset < batch_size; offset += kBlockDim) {
+        const int i   = offset + threadIdx.x;
+        const int len = i < batch_size ? cp.local_len(cu_k_len[i + 1] - cu_k_len[i]) : 0;
+        int       sum, total;
+        BlockScan{temp_storage}.InclusiveSum(len, sum, total);
+        if (i < batch_size) {
+            local_cu_k_len[i + 1] = base + sum;
+        }
+        base += total;
+        __syncthreads();
+    }
+}
+
+void invokeContextParallelCuKLen(
+    int* local_cu_k_len, const int* cu_k_len, const ContextParallelParam& cp, int batch_size, cudaStream_t stream)
+{
+    ContextParallelCuKLenKernel<<<1, 256, 0, stream>>>(local_cu_k_len, cu_k_len, cp, batch_size);
+}
+
 }  // namespace turbomind
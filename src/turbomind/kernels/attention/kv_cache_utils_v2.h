@@ -28,18 +28,27 @@ void invokeProcessKV_v2(char**                 blocks,
                         int                    head_dim,
                         int                    batch_size,
                         int                    quant_policy,
-                        cudaStream_t           stream = {});
+                        cudaStream_t           stream        = {},
+                        T*                     flat_k        = nullptr,
+                        T*                     flat_v        = nullptr,
+                        int64_t                flat_stride_h = 0,
+                        ContextParallelParam   cp            = {},
+                        int                    layer_offset  = 0,
+                        char* const*           cow_blocks    = nullptr,
+                        float*                 error         = nullptr);
 
+/// With context parallelism the positions of the new tokens follow `cp_cu_k_len`, only those of the rank are cached
 template<class T>
 void invokeProcessKV_v2_(const AttentionParams<T>& params)
 {
+    const bool cp = params.cp.size > 1;
     invokeProcessKV_v2((char**)params.block_iter_params.block_ptrs,
                        params.k,
                        params.v,
                        params.k_bias,
                        params.v_bias,
                        params.cu_q_len,
-                       params.cu_k_len,
+                       cp ? params.cp_cu_k_len : params.cu_k_len,
                        params.block_iter_params.cu_block_nums,
                        params.rope_param,
                        0,                                     // stride b
@@ -53,7 +62,49 @@ void invokeProcessKV_v2_(const AttentionParams<T>& params)
                        params.size_per_head,
                        params.batch_size,
                        params.quant_policy,
-                       params.stream);
+                       params.stream,
+                       (T*)nullptr,
+                       (T*)nullptr,
+                       0,
+                       params.cp,
+                       params.block_iter_params.layer_offset,
+                       params.block_iter_params.cow_blocks);
+}
+
+/// Error of the quantized kv cache on the new tokens of `params`, the cache is not written. The squared errors of the
+/// keys as read back from the cache, the squared keys, the same of the values are accumulated to `error[0..3]`
+template<class T>
+void invokeKvQuantError_(const AttentionParams<T>& params, float* error)
+{
+    const bool cp = params.cp.size > 1;
+    invokeProcessKV_v2((char**)nullptr,
+                       params.k,
+                       params.v,
+                       params.k_bias,
+                       params.v_bias,
+                       params.cu_q_len,
+                       cp ? params.cp_cu_k_len : params.cu_k_len,
+                       params.block_iter_params.cu_block_nums,
+                       params.pre_rope_kv ? RopeKernelParam{} : params.rope_param,
+                       0,                                     // stride b
+                       params.stride / params.size_per_head,  // stride c
+                       1,                                     // stride h
+                       params.stride / params.size_per_head,  // stride s
+                       params.block_iter_params.block_len,
+                       params.block_iter_params.layer_id,
+                       params.max_q_len,
+                       params.num_kv_heads,
+                       params.size_per_head,
+                       params.batch_size,
+                       params.quant_policy,
+                       params.stream,
+                       (T*)nullptr,
+                       (T*)nullptr,
+                       0,
+                       params.cp,
+                       params.block_iter_params.layer_offset,
+                       nullptr,
+                       error);
 }
 
 template<class T>
@@ -74,7 +125,11 @@ void invokeFlattenKV_v2(T*                     k,
                         int                    head_dim,
                         int                    batch_size,
                         int                    quant_policy,
-                        cudaStream_t           stream = {});
+                        cudaStream_t           stream            = {},
+                        const int*             cu_q_len          = nullptr,
+                        const int*             cold_len          = nullptr,
+                        int                    cold_quant_policy = 0,
+                        int                    layer_offset      = 0);
 
 /// TODO: remove `sum_k_len`
 template<class T>
@@ -86,6 +141,56 @@ void invokeFlattenKV_v2_(const AttentionParams<T>& params, int sum_k_len)
                        (char**)params.block_iter_params.block_ptrs,
                        params.cu_k_len,
                        params.block_iter_params.cu_block_nums,
+                       params.pre_rope_kv ? params.rope_param : RopeKernelParam{},
+                       0,
+                       1,
+                       2 * sum_k_len,
+                       1,
+                       params.block_iter_params.block_len,
+                       params.block_iter_params.layer_id,
+                       params.max_k_len,
+                       params.num_kv_heads,
+                       params.size_per_head,
+                       params.batch_size,
+                       params.quant_policy,
+                       params.stream,
+                       nullptr,
+                       params.cold_len,
+                       params.cold_quant_policy,
+                       params.block_iter_params.layer_offset);
+}
+
+/// Same result as `invokeProcessKV_v2_` followed by `invokeFlattenKV_v2_`, except that the new tokens are written to
+/// the linear buffer while being cached, only the history is read back from the blocks
+template<class T>
+void invokeProcessFlattenKV_v2_(const AttentionParams<T>& params, int sum_k_len)
+{
+    if (params.pre_rope_kv) {
+        // the cached keys differ from the flattened ones by the rotary embedding
+        auto process       = params;
+        process.rope_param = RopeKernelParam{};
+        invokeProcessKV_v2_(process);
+        invokeFlattenKV_v2_(params, sum_k_len);
+        return;
+    }
+
+    if (params.cp.size > 1 || params.block_iter_params.cow_blocks) {
+        // the new tokens of the rank are scattered among the others in the input, or the partial blocks of the forks
+        // are filled by the first write before the history is read back
+        invokeProcessKV_v2_(params);
+        invokeFlattenKV_v2_(params, sum_k_len);
+        return;
+    }
+
+    // blocks -> [H, 2, sum_k_len, D]
+    T* k = (T*)params.linear_iter_params.kv_cache;
+    T* v = k + sum_k_len * params.size_per_head;
+
+    invokeFlattenKV_v2(k,
+                       v,
+                       (char**)params.block_iter_params.block_ptrs,
+                       params.cu_k_len,
+                       params.block_iter_params.cu_block_nums,
                        RopeKernelParam{},
                        0,
                        1,
@@ -98,9 +203,63 @@ void invokeFlattenKV_v2_(const AttentionParams<T>& params, int sum_k_len)
                        params.size_per_head,
                        params.batch_size,
                        params.quant_policy,
-                       params.stream);
+                       params.stream,
+                       params.cu_q_len,
+                       params.cold_len,
+                       params.cold_quant_policy,
+                       params.block_iter_params.layer_offset);
+
+    invokeProcessKV_v2((char**)params.block_iter_params.block_ptrs,
+                       params.k,
+                       params.v,
+                       params.k_bias,
+                       params.v_bias,
+                       params.cu_q_len,
+                       params.cu_k_len,
+                       params.block_iter_params.cu_block_nums,
+                       params.rope_param,
+                       0,                                     // stride b
+                       params.stride / params.size_per_head,  // stride c
+                       1,                                     // stride h
+                       params.stride / params.size_per_head,  // stride s
+                       params.block_iter_params.block_len,
+                       params.block_iter_params.layer_id,
+                       params.max_q_len,
+                       params.num_kv_heads,
+                       params.size_per_head,
+                       params.batch_size,
+                       params.quant_policy,
+                       params.stream,
+                       k,
+                       v,
+                       2 * sum_k_len,
+                       {},
+                       params.block_iter_params.layer_offset);
 }
 
+/// Queries of cascade decoding, gathers the Q of the tokens in `q_idx` to [q_num, H, D] with the bias & the rotary
+/// embedding applied, as the prefix pass attends to them out of their sequences
+template<class T>
+void invokeCascadeQ_v2(T*                     q_out,
+                       const T*               q,
+                       const T*               q_bias,
+                       const int*             q_idx,
+                       const int*             cu_k_len,
+                       const RopeKernelParam& rope_param,
+                       int64_t                stride,
+                       int                    q_num,
+                       int                    head_num,
+                       int                    head_dim,
+                       cudaStream_t           stream);
+
+/// (cos, sin) of each pair of the rotary dims [table_len, dim] for the timesteps below `table_len`, read by `FastRoPE`
+/// through `RopeKernelParam::table`
+void invokeRopeTable(float* table, const RopeKernelParam& rope_param, int table_len, cudaStream_t stream);
+
+/// Context parallelism, the prefix sums of the local keys of the rank in the sequences of the global `cu_k_len`
+void invokeContextParallelCuKLen(
+    int* local_cu_k_len, const int* cu_k_len, const ContextParallelParam& cp, int batch_size, cudaStream_t stream);
+
 size_t
 get_cache_block_size(DataType dtype, DataType kvtype, int layer_num, int head_num, int head_dim, int block_seq_len);
 
@@ -40,7 +40,7 @@ struct Mainloop<arch::Sm70, Impl_> {
 
     static constexpr int CTA_S = Impl::CTA_S;
 
-    template<class CacheIter, class StoreS>
+    template<class CacheIter, class StoreS, class RotateK, class TreeMask>
     __device__ void operator()(FragQ&         frag_Q,
                                CacheIter&     cache_iter,
                                FragO&         frag_O,
@@ -52,7 +52,9 @@ struct Mainloop<arch::Sm70, Impl_> {
                                int            mask_iter,
                                float          qk_scale,
                                SharedStorage& storage,
-                               const StoreS&  store_S)
+                               const StoreS&   store_S,
+                               const RotateK&  rotate_K,
+                               const TreeMask& tree_mask)
     {
         GmemIterK gmem_K{};
         GmemIterV gmem_V{};
@@ -82,6 +84,7 @@ struct Mainloop<arch::Sm70, Impl_> {
             FragS frag_S{};
 
             Impl::Sync();
+            rotate_K(storage, 0, offset_K);
             state_QK.Load(0, 0);
 
             Impl::ComputeQK(state_QK, frag_S, 0, nop, [&] {});
@@ -93,7 +96,7 @@ struct Mainloop<arch::Sm70, Impl_> {
             }
 
             if constexpr (is_mask) {
-                ApplyCasualMask(frag_S, offset_Q, offset_K);
+                ApplyCasualMask(frag_S, offset_Q, offset_K, tree_mask);
             }
 
             Impl::Softmax<is_mask>(frag_S, frag_M, frag_L, frag_O, qk_scale);
@@ -118,10 +121,11 @@ struct Mainloop<arch::Sm70, Impl_> {
         }
     }
 
-    __device__ void ApplyCasualMask(FragS& frag_S, int offset_Q, int offset_K)
+    template<class TreeMask>
+    __device__ void ApplyCasualMask(FragS& frag_S, int offset_Q, int offset_K, const TreeMask& tree_mask)
     {
         Impl::ForeachS(frag_S, [&](int hi, int qi, int si, int ri, float& score) {
-            if (offset_Q + qi < offset_K + si) {
+            if (offset_Q + qi < offset_K + si || tree_mask(qi, offset_K + si)) {
                 score -= std::numeric_limits<float>::infinity();
             }
         });
@@ -81,7 +81,7 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
         }
     }
 
-    template<int head_dim, class CacheIter, class StoreS, int Stages_>
+    template<int head_dim, class CacheIter, class StoreS, class RotateK, class TreeMask, int Stages_>
     __device__ void Run(Sm80_CpAsync<Stages_>,
                         std::integral_constant<int, head_dim>,
                         FragQ&         frag_Q,
@@ -95,7 +95,9 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
                         int            mask_iter,
                         float          qk_scale,
                         SharedStorage& storage,
-                        const StoreS&  store_S)
+                        const StoreS&   store_S,
+                        const RotateK&  rotate_K,
+                        const TreeMask& tree_mask)
     {
         // multi-stage: pipe_iter * size
         //   two-stage: constant offset
@@ -152,7 +154,9 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
         typename Impl::StatePV state_PV{storage};
 
         Wait();
-        state_QK.Load(0, (++pipe_iter).r);
+        ++pipe_iter;
+        rotate_K(storage, pipe_iter.r, tile_iter * CTA_S);
+        state_QK.Load(0, pipe_iter.r);
 
         auto loop = [&](auto is_mask) {
             const int offset_K = tile_iter * CTA_S;
@@ -169,7 +173,7 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
             });
 
             if constexpr (is_mask) {
-                ApplyCasualMask(frag_S, offset_Q, offset_K);
+                ApplyCasualMask(frag_S, offset_Q, offset_K, tree_mask);
             }
 
             Impl::Softmax<is_mask>(frag_S, frag_M, frag_L, frag_O, qk_scale);
@@ -182,7 +186,9 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
 
             Impl::ComputePV(state_PV, frag_O, pipe_iter.r, prefetch_1, [&] {
                 Wait();
-                state_QK.Load(0, (++pipe_iter).r);
+                ++pipe_iter;
+                rotate_K(storage, pipe_iter.r, offset_K - CTA_S);
+                state_QK.Load(0, pipe_iter.r);
             });
         };
 
@@ -201,7 +207,7 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
     }
 
     // #if 1
-    template<class CacheIter, class StoreS>
+    template<class CacheIter, class StoreS, class RotateK, class TreeMask>
     __device__ void Run(Sm80_CpAsync<2>,
                         std::integral_constant<int, 192>,
                         FragQ&         frag_Q,
@@ -215,7 +221,9 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
                         int            mask_iter,
                         float          qk_scale,
                         SharedStorage& storage,
-                        const StoreS&  store_S)
+                        const StoreS&   store_S,
+                        const RotateK&  rotate_K,
+                        const TreeMask& tree_mask)
     {
         GmemIterK gmem_K{};
         GmemIterV gmem_V{};
@@ -267,7 +275,7 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
             prefetch_K(0);
 
             if constexpr (is_mask) {
-                ApplyCasualMask(frag_S, offset_Q, offset_K);
+                ApplyCasualMask(frag_S, offset_Q, offset_K, tree_mask);
             }
 
             Impl::Softmax<is_mask>(frag_S, frag_M, frag_L, frag_O, qk_scale);
@@ -294,13 +302,50 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
         __pipeline_wait_prior(0);
     }
 
+    // 256 can't afford the registers of the interleaved version either
+    template<class CacheIter, class StoreS, class RotateK, class TreeMask>
+    __device__ void Run(Sm80_CpAsync<2>,
+                        std::integral_constant<int, 256>,
+                        FragQ&         frag_Q,
+                        CacheIter&     cache_iter,
+                        FragO&         frag_O,
+                        FragM&         frag_M,
+                        FragL&         frag_L,
+                        int            offset_Q,
+                        int            max_step,
+                        int            tile_iter,
+                        int            mask_iter,
+                        float          qk_scale,
+                        SharedStorage& storage,
+                        const StoreS&   store_S,
+                        const RotateK&  rotate_K,
+                        const TreeMask& tree_mask)
+    {
+        Run(Sm80_CpAsync<2>{},
+            std::integral_constant<int, 192>{},
+            frag_Q,
+            cache_iter,
+            frag_O,
+            frag_M,
+            frag_L,
+            offset_Q,
+            max_step,
+            tile_iter,
+            mask_iter,
+            qk_scale,
+            storage,
+            store_S,
+            rotate_K,
+            tree_mask);
+    }
+
     // #elif 1
     // Load      : K0,K1 | V0,K2,V1,K3 ...
     // Compute   :    K0 | K1,V0,K2,V1 ...
     // - more register consumption
     // - more interleaved HMMA and FMA
     // - slight performance gain
-    template<int head_dim, class CacheIter, class StoreS>
+    template<int head_dim, class CacheIter, class StoreS, class RotateK, class TreeMask>
     __device__ void Run(Sm80_CpAsync<2>,
                         std::integral_constant<int, head_dim>,
                         FragQ&         frag_Q,
@@ -314,7 +359,9 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
                         int            mask_iter,
                         float          qk_scale,
                         SharedStorage& storage,
-                        const StoreS&  store_S)
+                        const StoreS&   store_S,
+                        const RotateK&  rotate_K,
+                        const TreeMask& tree_mask)
     {
         GmemIterK gmem_K{};
         GmemIterV gmem_V{};
@@ -354,7 +401,7 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
             const int offset_K = tile_iter * CTA_S;
 
             if constexpr (is_mask) {
-                ApplyCasualMask(frag_S, offset_Q, offset_K);
+                ApplyCasualMask(frag_S, offset_Q, offset_K, tree_mask);
             }
             Impl::Softmax<is_mask>(frag_S, frag_M, frag_L, frag_O, qk_scale);
 
@@ -418,10 +465,11 @@ struct Mainloop<Sm80_CpAsync<Stages>, Impl_> {
         Impl::Sync();
     }
 
-    __device__ void ApplyCasualMask(FragS& frag_S, int offset_Q, int offset_K)
+    template<class TreeMask>
+    __device__ void ApplyCasualMask(FragS& frag_S, int offset_Q, int offset_K, const TreeMask& tree_mask)
     {
         Impl::ForeachS(frag_S, [&](int hi, int qi, int si, int ri, float& score) {
-            if (offset_Q + qi < offset_K + si) {
+            if (offset_Q + qi < offset_K + si || tree_mask(qi, offset_K + si)) {
                 score -= std::numeric_limits<float>::infinity();
             }
         });
@@ -6,6 +6,7 @@
 #include <cmath>
 #include <cuda_bf16.h>
 #include <cuda_fp16.h>
+#include <cuda_fp8.h>
 
 namespace turbomind {
 
@@ -356,6 +357,27 @@ __device__ void warp_stats(Array<P, 2> (&param)[S], const Array<T, N> (&x)[S][C]
     }
 }
 
+// Symmetric scales for fp8 (e4m3), the zero point is kept so that the param layout is shared with integer types
+template<int WarpThreadC, class P, class T, int N, int C, int S>
+__device__ void warp_stats_e4m3(Array<P, 2> (&param)[S], const Array<T, N> (&x)[S][C])
+{
+    PRAGMA_UNROLL
+    for (int s = 0; s < S; ++s) {
+        Array<T, 2> stats{Infinity<T>(), -Infinity<T>()};
+        PRAGMA_UNROLL
+        for (int c = 0; c < C; ++c) {
+            warp_minmax<WarpThreadC>(stats, x[s][c]);
+        }
+        const float amax = fmaxf(-(float)stats[0], (float)stats[1]);
+        param[s][0]      = (P)(amax * (1.f / 448.f));
+        param[s][1]      = (P)0.f;
+        // all zeros or underflow of the scale
+        if ((float)param[s][0] == 0.f) {
+            param[s][0] = (P)1.f;
+        }
+    }
+}
+
 template<class Q, class T, class P, class B, int N, int C, int S>
 __device__ void
 quantize(Array<Q, N> (&dst)[S][C], const Array<T, N> (&src)[S][C], const Array<P, 2> (&params)[S], B n_bits)
@@ -437,6 +459,29 @@ struct ConvertKvCache<T, uint8_t> {
     }
 };
 
+//  floating point -> fp8 (e4m3)
+template<class T>
+struct ConvertKvCache<T, fp8_e4m3> {
+    float      inv_scale_;
+    __device__ ConvertKvCache(T scale, T zero)
+    {
+        inv_scale_ = fdividef(1.f, (float)scale);
+    }
+
+    template<int N>
+    __device__ auto operator()(const Array<T, N>& vi) const
+    {
+        static_assert(N % 2 == 0);
+        Array<fp8_e4m3, N> vo;
+        PRAGMA_UNROLL
+        for (int i = 0; i < N; i += 2) {
+            const float2 x{(float)vi[i] * inv_scale_, (float)vi[i + 1] * inv_scale_};
+            (__nv_fp8x2_storage_t&)vo[i] = __nv_cvt_float2_to_fp8x2(x, __NV_SATFINITE, __NV_E4M3);
+        }
+        return vo;
+    }
+};
+
 template<class T>
 struct ConvertKvCache<T, uint4_t> {
     T          inv_scale_;
@@ -694,6 +739,33 @@ struct ConvertKvCache<uint8_t, T> {
     }
 };
 
+inline __device__ Array<half, 4> cvt_f16x4_e4m3(const Array<fp8_e4m3, 4>& v)
+{
+    static constexpr uint32_t EM_MASK = 0x7f007f00;
+    static constexpr uint32_t S_MASK  = 0x80008000;
+
+    Array<half, 4> result;
+    uint32_t*      h = reinterpret_cast<uint32_t*>(&result);
+
+    // 01234567 -> 01234567 01234567
+    // SEEEEMMM    S_EEEEMM M_______
+    const uint32_t& i4s   = reinterpret_cast<const uint32_t&>(v);
+    const uint32_t  i2s_0 = __byte_perm(i4s, 0, 0x1404);
+    const uint32_t  i2s_1 = __byte_perm(i4s, 0, 0x3424);
+
+    h[0] = ((i2s_0 & EM_MASK) >> 1) | (i2s_0 & S_MASK);
+    h[1] = ((i2s_1 & EM_MASK) >> 1) | (i2s_1 & S_MASK);
+
+    // SEEEEEMM MMMMMMMM
+    //  1011100 00000000  2^(15-7) 0x5c00
+    const half exp_shift = __ushort_as_half(0x5c00);  // 2^8
+    PRAGMA_UNROLL
+    for (int i = 0; i < 4; ++i) {
+        result[i] *= exp_shift;
+    }
+    return result;
+}
+
 inline __device__ Array<nv_bfloat16, 4> cvt_bf16x4_e4m3(const Array<fp8_e4m3, 4>& v)
 {
 #if TURBOMIND_ARCH_SM80
@@ -703,8 +775,9 @@ inline __device__ Array<nv_bfloat16, 4> cvt_bf16x4_e4m3(const Array<fp8_e4m3, 4>
     Array<nv_bfloat16, 4> result;
     uint32_t*             h = reinterpret_cast<uint32_t*>(&result);
 
-    const uint32_t& i2s_0 = reinterpret_cast<const uint32_t&>(v);
-    const uint32_t  i2s_1 = i2s_0 << 8;
+    const uint32_t& i4s   = reinterpret_cast<const uint32_t&>(v);
+    const uint32_t  i2s_0 = __byte_perm(i4s, 0, 0x1404);
+    const uint32_t  i2s_1 = __byte_perm(i4s, 0, 0x3424);
 
     /// TODO: Check LOP3 is generated for (a | (b & c))
     h[0] = ((i2s_0 & EM_MASK) >> 4) | (i2s_0 & S_MASK);
@@ -713,7 +786,6 @@ inline __device__ Array<nv_bfloat16, 4> cvt_bf16x4_e4m3(const Array<fp8_e4m3, 4>
     // SEEEEEEE EMMMMMMM
     //  1111011 1         // 2^(127-7)  0x7b80
 
-    /// TODO: fuse this with per channel scaling
     const nv_bfloat16 exp_shfit = __ushort_as_bfloat16(0x7b80);  // 2^120
     PRAGMA_UNROLL
     for (int i = 0; i < 4; ++i) {
@@ -725,8 +797,13 @@ inline __device__ Array<nv_bfloat16, 4> cvt_bf16x4_e4m3(const Array<fp8_e4m3, 4>
 #endif
 };
 
+// fp8 (e4m3) -> f32/f16/bf16
 template<class T>
 struct ConvertKvCache<fp8_e4m3, T> {
+    T          scale_;
+    T          zero_;
+    __device__ ConvertKvCache(T scale, T zero): scale_{scale}, zero_{zero} {}
+
     template<int N>
     __device__ static auto convert(const Array<fp8_e4m3, N>& vi)
     {
@@ -734,13 +811,32 @@ struct ConvertKvCache<fp8_e4m3, T> {
         PRAGMA_UNROLL
         for (int n = 0; n < N; n += 4) {
             auto& ui = (const Array<fp8_e4m3, 4>&)vi[n];
-            if constexpr (std::is_same_v<T, nv_bfloat16>) {
-                return cvt_bf16x4_e4m3(ui);
+            auto& uo = (Array<T, 4>&)vo[n];
+
+            if constexpr (std::is_same_v<T, half>) {
+                uo = cvt_f16x4_e4m3(ui);
             }
-            else {
-                static_assert(!std::is_same_v<T, T>, "not implemented");
+            else if constexpr (std::is_same_v<T, float>) {
+                uo = cast<float>(cvt_f16x4_e4m3(ui));
             }
+#if __CUDA_ARCH__ >= 800
+            else if constexpr (std::is_same_v<T, nv_bfloat16>) {
+                uo = cvt_bf16x4_e4m3(ui);
+            }
+#endif
         }
+        return vo;
+    }
+
+    template<int N>
+    __device__ auto operator()(const Array<fp8_e4m3, N>& vi) const
+    {
+        auto vo = convert(vi);
+        PRAGMA_UNROLL
+        for (int i = 0; i < N; ++i) {
+            vo[i] = vo[i] * scale_ + zero_;
+        }
+        return vo;
     }
 };
 
@@ -759,4 +855,14 @@ inline __device__ void StoreQuantParam<uint4_t, half>(half* dst, Array<half, 2>
     Store(dst, src);
 }
 
+// The quant params as `StoreQuantParam` leaves them in the cache
+template<class Q, class T>
+inline __device__ Array<T, 2> StoredQuantParam(Array<T, 2> src)
+{
+    if constexpr (std::is_same_v<Q, uint4_t> && std::is_same_v<T, half> && kFuseU4F16Dequant) {
+        src[1] = src[1] - src[0] * __ushort_as_half(0x5400);
+    }
+    return src;
+}
+
 }  // namespace turbomind
@@ -1,7 +1,9 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include "src/turbomind/kernels/attention/attention.h"
 #include "src/turbomind/kernels/attention/cta_map.h"
 #include "src/turbomind/kernels/attention/reduce_kernel.h"
+#include "src/turbomind/utils/cuda_utils.h"
 
 #include <type_traits>
 
@@ -9,6 +11,7 @@ namespace turbomind::attention {
 
 template<int HeadDim, class T>
 void invokeReduce(T*           out,
+                  float*       lse,
                   float*       partial_M,
                   float*       partial_L,
                   float*       partial_O,
@@ -30,16 +33,22 @@ void invokeReduce(T*           out,
     auto invoke = [&](auto is_final, int stride_k) {
         const dim3 block = Reduce::kWarpCnt * 32;
         const dim3 grid  = ReduceCtaMap::get_grid_shape(query_num, head_num, max_split_cnt, CTA_K);
-        reduce_kernel<Reduce, is_final><<<grid, block, kSmemSize, stream>>>(out,  //
-                                                                            partial_M,
-                                                                            partial_L,
-                                                                            partial_O,
-                                                                            nullptr,
-                                                                            split_cnt,
-                                                                            partial_len,
-                                                                            head_num,
-                                                                            exp_scale,
-                                                                            stride_k);
+        LaunchKernel(reduce_kernel<Reduce, is_final>,
+                     grid,
+                     block,
+                     kSmemSize,
+                     stream,
+                     out,
+                     lse,
+                     partial_M,
+                     partial_L,
+                     partial_O,
+                     nullptr,
+                     split_cnt,
+                     partial_len,
+                     head_num,
+                     exp_scale,
+                     stride_k);
     };
 
     int stride_k = 1;
@@ -55,6 +64,7 @@ void invokeReduce(T*           out,
 
 #define INSTANTIATE_invokeReduce(dim, type)                                                                            \
     template void invokeReduce<dim>(type * out,                                                                        \
+                                    float*       lse,                                                                  \
                                     float*       partial_M,                                                            \
                                     float*       partial_L,                                                            \
                                     float*       partial_O,                                                            \
@@ -69,11 +79,77 @@ void invokeReduce(T*           out,
 INSTANTIATE_invokeReduce(64, half);
 INSTANTIATE_invokeReduce(128, half);
 INSTANTIATE_invokeReduce(192, half);
+INSTANTIATE_invokeReduce(256, half);
+INSTANTIATE_invokeReduce(576, half);
 
 #if ENABLE_BF16
 INSTANTIATE_invokeReduce(64, nv_bfloat16);
 INSTANTIATE_invokeReduce(128, nv_bfloat16);
 INSTANTIATE_invokeReduce(192, nv_bfloat16);
+INSTANTIATE_invokeReduce(256, nv_bfloat16);
+INSTANTIATE_invokeReduce(576, nv_bfloat16);
+#endif
+
+template<class T>
+__global__ void MergeContextParallelKernel(T* out, const float* lse, int cp_size, int cp_rank, int num, int head_dim)
+{
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    const int idx = blockIdx.x * (blockDim.x / WARP_SIZE) + warp_id;  // (query, head)
+
+    if (idx >= num) {
+        return;
+    }
+
+    const float x = lane_id < cp_size ? lse[lane_id * num + idx] : -std::numeric_limits<float>::infinity();
+
+    float m = x;
+    PRAGMA_UNROLL
+    for (int mask = WARP_SIZE / 2; mask >= 1; mask /= 2) {
+        m = fmaxf(m, __shfl_xor_sync(uint32_t(-1), m, mask));
+    }
+
+    const float e = x == -std::numeric_limits<float>::infinity() ? 0.f : exp2f(x - m);
+
+    float sum = e;
+    PRAGMA_UNROLL
+    for (int mask = WARP_SIZE / 2; mask >= 1; mask /= 2) {
+        sum += __shfl_xor_sync(uint32_t(-1), sum, mask);
+    }
+
+    const float scale = __shfl_sync(uint32_t(-1), e, cp_rank) / sum;
+
+    // the output of a rank without visible keys is undefined
+    T* p = out + (int64_t)idx * head_dim;
+    for (int di = lane_id; di < head_dim; di += WARP_SIZE) {
+        p[di] = scale > 0.f ? T(scale * (float)p[di]) : T{};
+    }
+}
+
+template<class T>
+void invokeMergeContextParallel(T*           out,
+                                const float* lse,
+                                int          cp_size,
+                                int          cp_rank,
+                                int          query_num,
+                                int          head_num,
+                                int          head_dim,
+                                cudaStream_t stream)
+{
+    FT_CHECK(cp_size <= WARP_SIZE);
+
+    constexpr int kWarpCnt = 4;
+
+    const int num = query_num * head_num;
+
+    MergeContextParallelKernel<<<(num + kWarpCnt - 1) / kWarpCnt, kWarpCnt * WARP_SIZE, 0, stream>>>(
+        out, lse, cp_size, cp_rank, num, head_dim);
+}
+
+template void invokeMergeContextParallel(half*, const float*, int, int, int, int, int, cudaStream_t);
+#if ENABLE_BF16
+template void invokeMergeContextParallel(nv_bfloat16*, const float*, int, int, int, int, int, cudaStream_t);
 #endif
 
 }  // namespace turbomind::attention
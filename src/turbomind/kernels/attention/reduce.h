@@ -13,6 +13,7 @@ namespace turbomind::attention {
 
 template<int HeadDim, class T>
 void invokeReduce(T*           out,
+                  float*       lse,
                   float*       partial_M,
                   float*       partial_L,
                   float*       partial_O,
@@ -2,6 +2,7 @@
 
 #include "src/turbomind/kernels/attention/cta_map.h"
 #include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/pdl.h"
 #include "src/turbomind/kernels/core/thread_map.h"
 #include <type_traits>
 
@@ -22,8 +23,10 @@ struct Reduce {
         float O[CTA_H][WarpCnt][HeadDim];
     };
 
+    // `lse` receives the log2-sum-exp of the scores of the final reductions, optional
     template<bool IsFinal>
     __device__ void operator()(T*             out,
+                               float*         lse,
                                float*         partial_M,
                                float*         partial_L,
                                float*         partial_O,
@@ -112,7 +115,13 @@ struct Reduce {
                 }
             }
 
-            if constexpr (!IsFinal) {
+            if constexpr (IsFinal) {
+                if (lse && hi < hi_end && lane_id % L == 0) {
+                    lse[query_idx * head_num + head_idx + hi] = block_L > 0.f ? block_M * exp_scale + __log2f(block_L) :
+                                                                                -std::numeric_limits<float>::infinity();
+                }
+            }
+            else {
                 PRAGMA_UNROLL
                 for (int k = 0; k < K; ++k) {
                     const int  si   = (lane_id % L + k * L) * stride_k + offset_k;
@@ -209,6 +218,7 @@ struct Reduce {
 
 template<class Reduce, bool IsFinal>
 __global__ void reduce_kernel(typename Reduce::T* out,
+                              float*              lse,
                               float*              partial_M,
                               float*              partial_L,
                               float*              partial_O,
@@ -221,6 +231,9 @@ __global__ void reduce_kernel(typename Reduce::T* out,
 {
     extern __shared__ char smem[];
 
+    PdlWait();
+    PdlLaunchDependents();
+
     const int head_idx  = ReduceCtaMap::head_idx();
     const int query_idx = ReduceCtaMap::query_idx();
     const int chunk_idx = ReduceCtaMap::split_idx();
@@ -235,6 +248,7 @@ __global__ void reduce_kernel(typename Reduce::T* out,
 
     Reduce reduce{};
     reduce(out,
+           lse,
            partial_M,
            partial_L,
            partial_O,
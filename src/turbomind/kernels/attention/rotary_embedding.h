@@ -60,6 +60,9 @@ struct FastRoPE {
     Array<float, N / 2> inv_freq_;
     bool                is_valid_;
     float               attention_scaling_{1.f};
+    int                 offset_{};
+    int                 idx_{};
+    const float*        table_{};
 
     typedef void (*Func)(Array<float, N / 2>&, int, RopeKernelParam&);
     Func fill_func_;
@@ -67,17 +70,25 @@ struct FastRoPE {
     __device__ FastRoPE(const RopeKernelParam& param, int batch_idx, std::integral_constant<int, N>): param_(param)
     {
 
+        table_ = param_.table;
         if (param_.type == RopeType::kDynamic) {
             float base          = param_.base[batch_idx];
             param_.scale_factor = -log2f(base) / param_.dim;
+            if (base != param_.table_base) {
+                table_ = nullptr;
+            }
         }
         else if (param_.type == RopeType::kYarn) {
             attention_scaling_ = param_.yarn.attention_factor;
         }
+        if (param_.offset) {
+            offset_ = param_.offset[batch_idx];
+        }
     }
 
     __device__ void init(int idx)
     {
+        idx_      = idx;
         is_valid_ = idx < param_.dim;
         switch (param_.type) {
             case RopeType::kDefault:
@@ -97,11 +108,25 @@ struct FastRoPE {
     template<typename T>
     __device__ void apply(Array<T, N>& x, float timestep)
     {
+        // the table has the attention scaling applied, see `invokeRopeTable`
+        const int ti = (int)timestep + offset_;
+        if (table_ && is_valid_ && ti < param_.table_len) {
+            Array<float, N> cs;
+            Load(cs, table_ + (int64_t)ti * param_.dim + idx_);
+            PRAGMA_UNROLL
+            for (int i = 0; i < N; i += 2) {
+                T tmp0   = (T)cs[i] * x[i] - (T)cs[i + 1] * x[i + 1];
+                T tmp1   = (T)cs[i] * x[i + 1] + (T)cs[i + 1] * x[i];
+                x[i]     = tmp0;
+                x[i + 1] = tmp1;
+            }
+            return;
+        }
         // Most models apply rotary embedding in half precision
         PRAGMA_UNROLL
         for (int i = 0; i < N; i += 2) {
             float c, s;
-            sincosf(timestep * inv_freq_[i / 2], &s, &c);
+            sincosf((timestep + offset_) * inv_freq_[i / 2], &s, &c);
             s *= attention_scaling_;
             c *= attention_scaling_;
             T tmp0 = (T)c * x[i] - (T)s * x[i + 1];
@@ -0,0 +1,567 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "cub/block/block_scan.cuh"
+
+#include "src/turbomind/kernels/attention/rotary_embedding.h"
+#include "src/turbomind/kernels/attention/sparse_decoding.h"
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include <iostream>
+#include <type_traits>
+
+namespace turbomind {
+
+template<class T>
+__global__ void UpdateBlockSummary(char**     blocks,
+                                   const int* cu_q_len,
+                                   const int* cu_k_len,
+                                   const int* cu_block_num,
+                                   int64_t    summary_offset,
+                                   int        block_len,
+                                   int        layer_id,
+                                   int        head_num,
+                                   int        head_dim)
+{
+    const int di = threadIdx.x;
+    const int hi = blockIdx.y;
+    const int bi = blockIdx.z;
+
+    const int q_len = cu_q_len[bi + 1] - cu_q_len[bi];
+    const int k_len = cu_k_len[bi + 1] - cu_k_len[bi];
+
+    // blocks from the one holding the first new token
+    const int block_idx = (k_len - q_len) / block_len + blockIdx.x;
+    const int ti_beg    = block_idx * block_len;
+
+    if (ti_beg >= k_len || di >= head_dim) {
+        return;
+    }
+
+    char* block = blocks[cu_block_num[bi] + block_idx];
+
+    // same as `block::Layout` with T == Tkv, [L, H, 2, s, D]
+    const T* k = reinterpret_cast<const T*>(block) + ((int64_t)layer_id * head_num + hi) * 2 * block_len * head_dim;
+
+    const int n = min(block_len, k_len - ti_beg);
+
+    float k_min = INFINITY;
+    float k_max = -INFINITY;
+    for (int ti = 0; ti < n; ++ti) {
+        const float x = (float)k[ti * head_dim + di];
+        k_min         = fminf(k_min, x);
+        k_max         = fmaxf(k_max, x);
+    }
+
+    T* summary = reinterpret_cast<T*>(block + summary_offset) + ((int64_t)layer_id * head_num + hi) * 2 * head_dim;
+
+    summary[di]            = (T)k_min;
+    summary[head_dim + di] = (T)k_max;
+}
+
+template<class T>
+void invokeUpdateBlockSummary(char**       blocks,
+                              const int*   cu_q_len,
+                              const int*   cu_k_len,
+                              const int*   cu_block_num,
+                              int64_t      summary_offset,
+                              int          block_len,
+                              int          layer_id,
+                              int          max_q_len,
+                              int          head_num,
+                              int          head_dim,
+                              int          batch_size,
+                              cudaStream_t stream)
+{
+    // the new tokens span at most one more block than they fill
+    const dim3 grid(ceil_div(max_q_len, block_len) + 1, head_num, batch_size);
+    const int  block = round_up(head_dim, WARP_SIZE);
+
+    UpdateBlockSummary<T><<<grid, block, 0, stream>>>(
+        blocks, cu_q_len, cu_k_len, cu_block_num, summary_offset, block_len, layer_id, head_num, head_dim);
+}
+
+// total order of the floats as unsigned integers
+__device__ inline uint32_t OrderedBits(float x)
+{
+    const uint32_t u = __float_as_uint(x);
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+template<class T, int kVecSize, int kBlockDim>
+__global__ void __launch_bounds__(kBlockDim) SelectSparseBlocks(char**          sparse_blocks,
+                                                                char**          blocks,
+                                                                const T*        q,
+                                                                const T*        q_bias,
+                                                                const int*      cu_k_len,
+                                                                const int*      cu_block_num,
+                                                                RopeKernelParam rope_param,
+                                                                int64_t         stride,
+                                                                int64_t         summary_offset,
+                                                                int             block_len,
+                                                                int             layer_id,
+                                                                int             sink,
+                                                                int             topk,
+                                                                int             recent,
+                                                                int             head_num,
+                                                                int             kv_head_num,
+                                                                int             head_dim)
+{
+    constexpr int kWarpCnt = kBlockDim / WARP_SIZE;
+
+    using BlockScan = cub::BlockScan<int, kBlockDim>;
+
+    __shared__ typename BlockScan::TempStorage scan_storage;
+    __shared__ int                             count_storage;
+
+    extern __shared__ __align__(16) char smem[];
+
+    T*        smem_Q     = reinterpret_cast<T*>(smem);                                 // [head_num, head_dim]
+    uint32_t* smem_score = reinterpret_cast<uint32_t*>(smem_Q + head_num * head_dim);  // [candidate_num]
+
+    const int bi = blockIdx.x;
+
+    const int k_len = cu_k_len[bi + 1] - cu_k_len[bi];
+    // block of the decoding token
+    const int last = (k_len - 1) / block_len;
+
+    char** src = blocks + cu_block_num[bi];
+    char** dst = sparse_blocks + (int64_t)bi * (sink + topk + recent + 1);
+
+    // the blocks between the sinks & the recent blocks compete for the `topk` slots
+    const int candidate_num = last - recent - sink;
+
+    if (candidate_num <= topk) {
+        for (int i = threadIdx.x; i <= last; i += kBlockDim) {
+            dst[i] = src[i];
+        }
+        return;
+    }
+
+    // query of the token with bias & rope, same as the decoding kernels
+    FastRoPE rope(rope_param, bi, std::integral_constant<int, kVecSize>{});
+
+    for (int i = threadIdx.x * kVecSize; i < head_num * head_dim; i += kBlockDim * kVecSize) {
+        Array<T, kVecSize> vec;
+        Ldg(vec, &q[bi * stride + i]);
+        if (q_bias) {
+            using namespace ops;
+            Array<T, kVecSize> bias;
+            Ldg(bias, &q_bias[i]);
+            vec = vec + bias;
+        }
+        rope.init(i % head_dim);
+        rope.apply(vec, k_len - 1);
+        Store(&smem_Q[i], vec);
+    }
+
+    __syncthreads();
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    const int group_size = head_num / kv_head_num;
+
+    // upper bound of q·k over the keys of a block by their min & max, summed over the heads
+    for (int j = warp_id; j < candidate_num; j += kWarpCnt) {
+        const T* summary = reinterpret_cast<const T*>(src[sink + j] + summary_offset)
+                           + (int64_t)layer_id * kv_head_num * 2 * head_dim;
+        float acc = 0.f;
+        for (int hi = 0; hi < head_num; ++hi) {
+            const T* s = summary + hi / group_size * 2 * head_dim;
+            for (int di = lane_id; di < head_dim; di += WARP_SIZE) {
+                const float x = (float)smem_Q[hi * head_dim + di];
+                acc += fmaxf(x * (float)s[di], x * (float)s[head_dim + di]);
+            }
+        }
+        PRAGMA_UNROLL
+        for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+            acc += __shfl_xor_sync((uint32_t)-1, acc, mask);
+        }
+        if (lane_id == 0) {
+            smem_score[j] = OrderedBits(acc);
+        }
+    }
+
+    __syncthreads();
+
+    auto count_if = [&](auto pred) {
+        if (threadIdx.x == 0) {
+            count_storage = 0;
+        }
+        __syncthreads();
+        int count = 0;
+        for (int j = threadIdx.x; j < candidate_num; j += kBlockDim) {
+            count += pred(smem_score[j]);
+        }
+        atomicAdd(&count_storage, count);
+        __syncthreads();
+        const int total = count_storage;
+        __syncthreads();
+        return total;
+    };
+
+    // radix select of the `topk`-th largest score
+    uint32_t kth = 0;
+    for (int bit = 31; bit >= 0; --bit) {
+        const uint32_t x = kth | (1u << bit);
+        if (count_if([&](uint32_t s) { return s >= x; }) >= topk) {
+            kth = x;
+        }
+    }
+
+    // the blocks above the `topk`-th score and the first of the ties, in the order of the sequence
+    const int tie_num = topk - count_if([&](uint32_t s) { return s > kth; });
+
+    int above_offset = 0;
+    int tie_offset   = 0;
+    for (int base = 0; base < candidate_num; base += kBlockDim) {
+        const int      j     = base + threadIdx.x;
+        const uint32_t s     = j < candidate_num ? smem_score[j] : 0;
+        const int      above = j < candidate_num && s > kth;
+        const int      tie   = j < candidate_num && s == kth;
+        int            prefix, total;
+        BlockScan{scan_storage}.ExclusiveSum(above | tie << 16, prefix, total);
+        const int tie_rank = tie_offset + (prefix >> 16);
+        if (above || (tie && tie_rank < tie_num)) {
+            dst[sink + above_offset + (prefix & 0xffff) + min(tie_rank, tie_num)] = src[sink + j];
+        }
+        above_offset += total & 0xffff;
+        tie_offset += total >> 16;
+        __syncthreads();
+    }
+
+    for (int i = threadIdx.x; i < sink; i += kBlockDim) {
+        dst[i] = src[i];
+    }
+    for (int i = threadIdx.x; i <= recent; i += kBlockDim) {
+        dst[sink + topk + i] = src[last - recent + i];
+    }
+}
+
+template<class T>
+void invokeSelectSparseBlocks(char**                 sparse_blocks,
+                              char**                 blocks,
+                              const T*               q,
+                              const T*               q_bias,
+                              const int*             cu_k_len,
+                              const int*             cu_block_num,
+                              const RopeKernelParam& rope_param,
+                              int64_t                stride,
+                              int64_t                summary_offset,
+                              int                    block_len,
+                              int                    layer_id,
+                              int                    sink,
+                              int                    topk,
+                              int                    recent,
+                              int                    max_block_num,
+                              int                    head_num,
+                              int                    kv_head_num,
+                              int                    head_dim,
+                              int                    batch_size,
+                              cudaStream_t           stream)
+{
+    constexpr int kVecSize  = sizeof(uint4) / sizeof(T);
+    constexpr int kBlockDim = 256;
+
+    auto kernel = SelectSparseBlocks<T, kVecSize, kBlockDim>;
+
+    const size_t smem_size = sizeof(T) * head_num * head_dim + sizeof(uint32_t) * max_block_num;
+
+    if (smem_size > (48 << 10)) {
+        auto err = cudaFuncSetAttribute(kernel, cudaFuncAttributeMaxDynamicSharedMemorySize, smem_size);
+        if (err) {
+            std::cout << cudaGetErrorString(err) << "\n";
+            std::abort();
+        }
+    }
+
+    kernel<<<batch_size, kBlockDim, smem_size, stream>>>(sparse_blocks,
+                                                         blocks,
+                                                         q,
+                                                         q_bias,
+                                                         cu_k_len,
+                                                         cu_block_num,
+                                                         rope_param,
+                                                         stride,
+                                                         summary_offset,
+                                                         block_len,
+                                                         layer_id,
+                                                         sink,
+                                                         topk,
+                                                         recent,
+                                                         head_num,
+                                                         kv_head_num,
+                                                         head_dim);
+}
+
+template<class T, int kVecSize, int kBlockDim>
+__global__ void __launch_bounds__(kBlockDim) AccumulateBlockScores(float*          scores,
+                                                                   int64_t         score_stride,
+                                                                   char**          blocks,
+                                                                   const T*        q,
+                                                                   const T*        q_bias,
+                                                                   const int*      cu_k_len,
+                                                                   const int*      cu_block_num,
+                                                                   RopeKernelParam rope_param,
+                                                                   int64_t         stride,
+                                                                   float           inv_sqrt_dh,
+                                                                   int             block_len,
+                                                                   int             layer_id,
+                                                                   int             head_num,
+                                                                   int             kv_head_num,
+                                                                   int             head_dim)
+{
+    constexpr int kWarpCnt    = kBlockDim / WARP_SIZE;
+    constexpr int kMaxHeadDim = 256;
+
+    __shared__ __align__(16) T smem_Q[kMaxHeadDim];
+    __shared__ float           smem_M[kWarpCnt];
+    __shared__ float           smem_L[kWarpCnt];
+
+    extern __shared__ __align__(16) char smem[];
+
+    float* smem_score = reinterpret_cast<float*>(smem);  // [block_num]
+
+    const int hi = blockIdx.x;
+    const int bi = blockIdx.y;
+
+    const int k_len     = cu_k_len[bi + 1] - cu_k_len[bi];
+    const int block_num = (k_len + block_len - 1) / block_len;
+
+    char** src = blocks + cu_block_num[bi];
+
+    // same as `block::Layout` with T == Tkv, [L, H, 2, s, D]
+    const int64_t head_offset = ((int64_t)layer_id * kv_head_num + hi / (head_num / kv_head_num)) * 2 * block_len;
+
+    // query of the token with bias & rope, same as the decoding kernels
+    FastRoPE rope(rope_param, bi, std::integral_constant<int, kVecSize>{});
+
+    for (int i = threadIdx.x * kVecSize; i < head_dim; i += kBlockDim * kVecSize) {
+        Array<T, kVecSize> vec;
+        Ldg(vec, &q[bi * stride + hi * head_dim + i]);
+        if (q_bias) {
+            using namespace ops;
+            Array<T, kVecSize> bias;
+            Ldg(bias, &q_bias[hi * head_dim + i]);
+            vec = vec + bias;
+        }
+        rope.init(i);
+        rope.apply(vec, k_len - 1);
+        Store(&smem_Q[i], vec);
+    }
+
+    for (int j = threadIdx.x; j < block_num; j += kBlockDim) {
+        smem_score[j] = 0.f;
+    }
+
+    __syncthreads();
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    // a group of lanes per key, each with a vector of the head
+    const int group     = head_dim / kVecSize;
+    const int group_num = WARP_SIZE / group;
+    const int gi        = lane_id / group;
+    const int di        = lane_id % group * kVecSize;
+
+    Array<T, kVecSize> vec_Q;
+    Load(vec_Q, &smem_Q[di]);
+
+    // q·k in log2 domain, valid in the first lane of the group
+    auto logit = [&](int ti) {
+        float acc = 0.f;
+        if (ti < k_len) {
+            const T* k = reinterpret_cast<const T*>(src[ti / block_len])
+                         + (head_offset + ti % block_len) * head_dim + di;
+            Array<T, kVecSize> vec_K;
+            Ldg(vec_K, k);
+            PRAGMA_UNROLL
+            for (int c = 0; c < kVecSize; ++c) {
+                acc += (float)vec_Q[c] * (float)vec_K[c];
+            }
+        }
+        for (int mask = group / 2; mask > 0; mask /= 2) {
+            acc += __shfl_xor_sync((uint32_t)-1, acc, mask);
+        }
+        return acc * inv_sqrt_dh;
+    };
+
+    const int step = kWarpCnt * group_num;
+
+    // max & sum of the exponentials over the keys
+    float M = -INFINITY;
+    float L = 0.f;
+    for (int base = warp_id * group_num; base < k_len; base += step) {
+        const int   ti = base + gi;
+        const float s  = logit(ti);
+        if (ti < k_len && lane_id % group == 0) {
+            const float m = fmaxf(M, s);
+            L             = L * exp2f(M - m) + exp2f(s - m);
+            M             = m;
+        }
+    }
+
+    auto merge = [](float& m, float& l, float m1, float l1) {
+        const float x = fmaxf(m, m1);
+        if (x != -INFINITY) {
+            l = l * exp2f(m - x) + l1 * exp2f(m1 - x);
+            m = x;
+        }
+    };
+
+    PRAGMA_UNROLL
+    for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+        const float m = __shfl_xor_sync((uint32_t)-1, M, mask);
+        const float l = __shfl_xor_sync((uint32_t)-1, L, mask);
+        merge(M, L, m, l);
+    }
+    if (lane_id == 0) {
+        smem_M[warp_id] = M;
+        smem_L[warp_id] = L;
+    }
+
+    __syncthreads();
+
+    M = -INFINITY;
+    L = 0.f;
+    PRAGMA_UNROLL
+    for (int w = 0; w < kWarpCnt; ++w) {
+        merge(M, L, smem_M[w], smem_L[w]);
+    }
+    const float inv_L = L > 0.f ? 1.f / L : 0.f;
+
+    // probabilities of the keys summed by block
+    for (int base = warp_id * group_num; base < k_len; base += step) {
+        const int   ti = base + gi;
+        const float s  = logit(ti);
+        if (ti < k_len && lane_id % group == 0) {
+            atomicAdd(&smem_score[ti / block_len], exp2f(s - M) * inv_L);
+        }
+    }
+
+    __syncthreads();
+
+    for (int j = threadIdx.x; j < block_num; j += kBlockDim) {
+        atomicAdd(&scores[bi * score_stride + j], smem_score[j]);
+    }
+}
+
+template<class T>
+void invokeAccumulateBlockScores(float*                 scores,
+                                 int64_t                score_stride,
+                                 char**                 blocks,
+                                 const T*               q,
+                                 const T*               q_bias,
+                                 const int*             cu_k_len,
+                                 const int*             cu_block_num,
+                                 const RopeKernelParam& rope_param,
+                                 int64_t                stride,
+                                 float                  inv_sqrt_dh,
+                                 int                    block_len,
+                                 int                    layer_id,
+                                 int                    max_block_num,
+                                 int                    head_num,
+                                 int                    kv_head_num,
+                                 int                    head_dim,
+                                 int                    batch_size,
+                                 cudaStream_t           stream)
+{
+    constexpr int kVecSize  = sizeof(uint4) / sizeof(T);
+    constexpr int kBlockDim = 256;
+
+    // a key spans a power of 2 lanes of a warp
+    const int group = head_dim / kVecSize;
+    FT_CHECK(head_dim % kVecSize == 0 && group <= WARP_SIZE && (group & (group - 1)) == 0);
+
+    auto kernel = AccumulateBlockScores<T, kVecSize, kBlockDim>;
+
+    const size_t smem_size = sizeof(float) * max_block_num;
+
+    if (smem_size > (48 << 10)) {
+        auto err = cudaFuncSetAttribute(kernel, cudaFuncAttributeMaxDynamicSharedMemorySize, smem_size);
+        if (err) {
+            std::cout << cudaGetErrorString(err) << "\n";
+            std::abort();
+        }
+    }
+
+    const dim3 grid(head_num, batch_size);
+
+    kernel<<<grid, kBlockDim, smem_size, stream>>>(scores,
+                                                   score_stride,
+                                                   blocks,
+                                                   q,
+                                                   q_bias,
+                                                   cu_k_len,
+                                                   cu_block_num,
+                                                   rope_param,
+                                                   stride,
+                                                   inv_sqrt_dh,
+                                                   block_len,
+                                                   layer_id,
+                                                   head_num,
+                                                   kv_head_num,
+                                                   head_dim);
+}
+
+#define INSTANTIATE_SPARSE_DECODING(type)                                                                              \
+    template void invokeUpdateBlockSummary<type>(char**       blocks,                                                  \
+                                                 const int*   cu_q_len,                                                \
+                                                 const int*   cu_k_len,                                                \
+                                                 const int*   cu_block_num,                                            \
+                                                 int64_t      summary_offset,                                          \
+                                                 int          block_len,                                               \
+                                                 int          layer_id,                                                \
+                                                 int          max_q_len,                                               \
+                                                 int          head_num,                                                \
+                                                 int          head_dim,                                                \
+                                                 int          batch_size,                                              \
+                                                 cudaStream_t stream);                                                 \
+    template void invokeSelectSparseBlocks(char**                 sparse_blocks,                                       \
+                                           char**                 blocks,                                              \
+                                           const type*            q,                                                   \
+                                           const type*            q_bias,                                              \
+                                           const int*             cu_k_len,                                            \
+                                           const int*             cu_block_num,                                        \
+                                           const RopeKernelParam& rope_param,                                          \
+                                           int64_t                stride,                                              \
+                                           int64_t                summary_offset,                                      \
+                                           int                    block_len,                                           \
+                                           int                    layer_id,                                            \
+                                           int                    sink,                                                \
+                                           int                    topk,                                                \
+                                           int                    recent,                                              \
+                                           int                    max_block_num,                                       \
+                                           int                    head_num,                                            \
+                                           int                    kv_head_num,                                         \
+                                           int                    head_dim,                                            \
+                                           int                    batch_size,                                          \
+                                           cudaStream_t           stream);                                             \
+    template void invokeAccumulateBlockScores(float*                 scores,                                           \
+                                              int64_t                score_stride,                                     \
+                                              char**                 blocks,                                           \
+                                              const type*            q,                                                \
+                                              const type*            q_bias,                                           \
+                                              const int*             cu_k_len,                                         \
+                                              const int*             cu_block_num,                                     \
+                                              const RopeKernelParam& rope_param,                                       \
+                                              int64_t                stride,                                           \
+                                              float                  inv_sqrt_dh,                                      \
+                                              int                    block_len,                                        \
+                                              int                    layer_id,                                         \
+                                              int                    max_block_num,                                    \
+                                              int                    head_num,                                         \
+                                              int                    kv_head_num,                                      \
+                                              int                    head_dim,                                         \
+                                              int                    batch_size,                                       \
+                                              cudaStream_t           stream);
+
+INSTANTIATE_SPARSE_DECODING(half);
+#if ENABLE_BF16
+INSTANTIATE_SPARSE_DECODING(nv_bfloat16);
+#endif
+
+}  // namespace turbomind
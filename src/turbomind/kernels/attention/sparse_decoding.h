@@ -0,0 +1,75 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/attention/attention_params.h"
+
+namespace turbomind {
+
+// Block-sparse decoding. The element-wise min & max of the keys of each cache block, [L, H, 2, D], are kept after
+// the k/v data of the block at `summary_offset`. Only non-quantized caches are supported
+
+/// Recomputes the summaries of the blocks holding the new tokens of each sequence
+template<class T>
+void invokeUpdateBlockSummary(char**       blocks,
+                              const int*   cu_q_len,
+                              const int*   cu_k_len,
+                              const int*   cu_block_num,
+                              int64_t      summary_offset,
+                              int          block_len,
+                              int          layer_id,
+                              int          max_q_len,
+                              int          head_num,
+                              int          head_dim,
+                              int          batch_size,
+                              cudaStream_t stream);
+
+/// Gathers the blocks attended by each decoding token into `sparse_blocks` [batch_size, sink + topk + recent + 1]:
+/// the first `sink` blocks, the `topk` blocks of the highest upper bounds of q·k by the summaries, the last `recent`
+/// complete blocks and the block of the token. Sequences with no more blocks than these are copied as is
+template<class T>
+void invokeSelectSparseBlocks(char**                 sparse_blocks,
+                              char**                 blocks,
+                              const T*               q,
+                              const T*               q_bias,
+                              const int*             cu_k_len,
+                              const int*             cu_block_num,
+                              const RopeKernelParam& rope_param,
+                              int64_t                stride,
+                              int64_t                summary_offset,
+                              int                    block_len,
+                              int                    layer_id,
+                              int                    sink,
+                              int                    topk,
+                              int                    recent,
+                              int                    max_block_num,
+                              int                    head_num,
+                              int                    kv_head_num,
+                              int                    head_dim,
+                              int                    batch_size,
+                              cudaStream_t           stream);
+
+/// Adds the attention probabilities of the decoding token of each sequence, summed over the heads, to the scores of
+/// the blocks holding the keys, `scores` [batch_size, score_stride]. The scores guide the eviction of the blocks of
+/// long sequences, they are exact but cost a pass over the keys of the layer. Same kv cache as the sparse decoding
+template<class T>
+void invokeAccumulateBlockScores(float*                 scores,
+                                 int64_t                score_stride,
+                                 char**                 blocks,
+                                 const T*               q,
+                                 const T*               q_bias,
+                                 const int*             cu_k_len,
+                                 const int*             cu_block_num,
+                                 const RopeKernelParam& rope_param,
+                                 int64_t                stride,
+                                 float                  inv_sqrt_dh,
+                                 int                    block_len,
+                                 int                    layer_id,
+                                 int                    max_block_num,
+                                 int                    head_num,
+                                 int                    kv_head_num,
+                                 int                    head_dim,
+                                 int                    batch_size,
+                                 cudaStream_t           stream);
+
+}  // namespace turbomind
@@ -478,10 +478,8 @@ int test_attention()
 #if DECODING
         dispatchDecoding<T>(params);
 #else
-        // input -> blocked
-        invokeProcessKV_v2_(params);
-        // blocked -> linear
-        invokeFlattenKV_v2_(params, cu_kv_lens[kBatchSize]);
+        // input -> blocked, blocked & input -> linear
+        invokeProcessFlattenKV_v2_(params, cu_kv_lens[kBatchSize]);
 
         // auto tmp = std::exchange(params.linear_iter_params.kv_cache, nullptr);
         dispatchAttention(params);
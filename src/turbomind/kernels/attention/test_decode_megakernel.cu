@@ -0,0 +1,381 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "block.h"
+#include "decoding.h"
+#include "src/turbomind/kernels/activation_kernels.h"
+#include "src/turbomind/kernels/attention/attention_params.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/norm/rms_norm.h"
+#include "src/turbomind/models/llama/decode_megakernel.h"
+#include "src/turbomind/models/llama/llama_rope.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cublas_v2.h>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <thrust/universal_vector.h>
+#include <vector>
+
+using namespace turbomind;
+
+// y[m, n] = x[m, k] W[k, n] in row-major, the dense GEMM of the regular path
+template<class T>
+void Gemm(cublasHandle_t handle, T* y, const T* x, int ldx, const T* W, int m, int n, int k)
+{
+    constexpr auto type  = std::is_same_v<T, half> ? CUDA_R_16F : CUDA_R_16BF;
+    const float    alpha = 1.f;
+    const float    beta  = 0.f;
+    check_cuda_error(cublasGemmEx(handle,
+                                  CUBLAS_OP_N,
+                                  CUBLAS_OP_N,
+                                  n,
+                                  m,
+                                  k,
+                                  &alpha,
+                                  W,
+                                  type,
+                                  n,
+                                  x,
+                                  type,
+                                  ldx,
+                                  &beta,
+                                  y,
+                                  type,
+                                  n,
+                                  CUBLAS_COMPUTE_32F,
+                                  CUBLAS_GEMM_DEFAULT));
+}
+
+// The decoder layers of a decoding step by `DecodeMegakernel` against the kernels of the regular `UnifiedDecoder`
+// path (dense GEMMs, `dispatchDecoding`, the residual RMSNorm & the SiLU activation), over the same kv cache blocks
+template<class T, int kHeadDim>
+int test_decode_megakernel(int batch_size, bool interleaved)
+{
+    constexpr int kHeadNum   = 8;
+    constexpr int kKvHeadNum = 2;
+    constexpr int kHidden    = 1024;
+    constexpr int kInterSize = 1408;
+    constexpr int kLayerNum  = 2;
+    constexpr int kBlockLen  = 64;
+    constexpr int kMaxSplitK = 16;
+    constexpr int kQkvDim    = (kHeadNum + 2 * kKvHeadNum) * kHeadDim;
+    constexpr int kAttnDim   = kHeadNum * kHeadDim;
+
+    constexpr float kRoPEBase = 10000.f;
+    constexpr float kEps      = 1e-5f;
+
+    std::cout << "batch_size = " << batch_size << ", head_dim = " << kHeadDim << ", interleaved = " << interleaved
+              << "\n";
+
+    RNG rng{};
+
+    // weights of the layers in (k, n) row-major
+    std::vector<thrust::universal_vector<T>> qkv(kLayerNum), output(kLayerNum), gate_up(kLayerNum), down(kLayerNum);
+    std::vector<thrust::universal_vector<T>> attn_norm(kLayerNum + 1), ffn_norm(kLayerNum);
+
+    for (int i = 0; i < kLayerNum; ++i) {
+        qkv[i].resize(kHidden * kQkvDim);
+        output[i].resize(kAttnDim * kHidden);
+        gate_up[i].resize(kHidden * 2 * kInterSize);
+        down[i].resize(kInterSize * kHidden);
+        ffn_norm[i].resize(kHidden);
+        rng.GenerateNormal(qkv[i].data().get(), qkv[i].size(), 1.f / std::sqrt((float)kHidden));
+        rng.GenerateNormal(output[i].data().get(), output[i].size(), 1.f / std::sqrt((float)kAttnDim));
+        rng.GenerateNormal(gate_up[i].data().get(), gate_up[i].size(), 1.f / std::sqrt((float)kHidden));
+        rng.GenerateNormal(down[i].data().get(), down[i].size(), 1.f / std::sqrt((float)kInterSize));
+        rng.GenerateUniform(ffn_norm[i].data().get(), kHidden, .5f, .75f);
+    }
+    // the last one is the output norm
+    for (auto& w : attn_norm) {
+        w.resize(kHidden);
+        rng.GenerateUniform(w.data().get(), kHidden, .5f, .75f);
+    }
+
+    cudaDeviceSynchronize();
+
+    // (gate, up) interleaved by column
+    std::vector<thrust::universal_vector<T>> gate_up_interleaved(kLayerNum);
+    for (int i = 0; i < kLayerNum; ++i) {
+        auto& src = gate_up[i];
+        auto& dst = gate_up_interleaved[i];
+        dst.resize(src.size());
+        for (int k = 0; k < kHidden; ++k) {
+            for (int c = 0; c < kInterSize; ++c) {
+                dst[(size_t)k * 2 * kInterSize + c * 2 + 0] = src[(size_t)k * 2 * kInterSize + c];
+                dst[(size_t)k * 2 * kInterSize + c * 2 + 1] = src[(size_t)k * 2 * kInterSize + kInterSize + c];
+            }
+        }
+    }
+
+    // history of different lengths, the new token is the last one
+    std::vector<int> k_lens(batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+        k_lens[i] = 97 * (i + 1) + i % 2 * kBlockLen + 1;
+    }
+    const int max_k_len = *std::max_element(k_lens.begin(), k_lens.end());
+
+    thrust::universal_vector<int> cu_q_len(batch_size + 1);
+    thrust::universal_vector<int> cu_k_len(batch_size + 1);
+    thrust::universal_vector<int> cu_block_cnts(batch_size + 1);
+    for (int i = 0; i <= batch_size; ++i) {
+        cu_q_len[i]      = i;
+        cu_k_len[i]      = i ? cu_k_len[i - 1] + k_lens[i - 1] : 0;
+        cu_block_cnts[i] = i ? cu_block_cnts[i - 1] + (k_lens[i - 1] + kBlockLen - 1) / kBlockLen : 0;
+    }
+    const int n_blocks = cu_block_cnts[batch_size];
+
+    block::Layout layout{block::Config<T, T, kHeadDim>{kKvHeadNum, kBlockLen}};
+
+    const size_t block_size = layout.block_size(kLayerNum);
+
+    // random kv history, the 2 paths append the new tokens to their own copies
+    thrust::universal_vector<char> blocks(n_blocks * block_size);
+    rng.GenerateNormal((T*)blocks.data().get(), blocks.size() / sizeof(T));
+    cudaDeviceSynchronize();
+    thrust::universal_vector<char> blocks_ref = blocks;
+
+    std::vector<size_t> idxs(n_blocks);
+    std::iota(idxs.begin(), idxs.end(), 0);
+    std::mt19937 g(n_blocks);
+    std::shuffle(idxs.begin(), idxs.end(), g);
+
+    thrust::universal_vector<char*> k_ptrs(n_blocks + 1);  // +1 padding
+    thrust::universal_vector<char*> k_ptrs_ref(n_blocks + 1);
+    for (int i = 0; i < n_blocks; ++i) {
+        k_ptrs[i]     = blocks.data().get() + idxs[i] * block_size;
+        k_ptrs_ref[i] = blocks_ref.data().get() + idxs[i] * block_size;
+    }
+
+    thrust::universal_vector<T> residual(batch_size * kHidden);
+    thrust::universal_vector<T> hidden_states(batch_size * kHidden);
+    rng.GenerateNormal(residual.data().get(), residual.size());
+
+    invokeRMSNorm(hidden_states.data().get(),
+                  residual.data().get(),
+                  attn_norm[0].data().get(),
+                  kHidden,
+                  batch_size,
+                  kEps,
+                  nullptr);
+    cudaDeviceSynchronize();
+
+    thrust::universal_vector<T> residual_ref      = residual;
+    thrust::universal_vector<T> hidden_states_ref = hidden_states;
+
+    const float scale_factor = -std::log2f(kRoPEBase) / kHeadDim;
+    const auto  rope_param   = RopeKernelParam{RopeType::kDefault, nullptr, kHeadDim, scale_factor, 1.f};
+
+    const float inv_sqrt_dh = (float)std::log2(expf(1.)) / std::sqrt((float)kHeadDim);
+
+    // regular path
+    {
+        cublasHandle_t handle{};
+        check_cuda_error(cublasCreate(&handle));
+
+        thrust::universal_vector<T> qkv_buf(batch_size * kQkvDim);
+        thrust::universal_vector<T> attn_buf(batch_size * kAttnDim);
+        thrust::universal_vector<T> gating_buf(batch_size * 2 * kInterSize);
+
+        thrust::universal_vector<bool>  finished(batch_size);
+        thrust::universal_vector<float> rope_base(batch_size);
+        thrust::universal_vector<float> partial_M(batch_size * kHeadNum * kMaxSplitK);
+        thrust::universal_vector<float> partial_L(batch_size * kHeadNum * kMaxSplitK);
+        thrust::universal_vector<float> partial_O(batch_size * kHeadNum * kMaxSplitK * kHeadDim);
+        thrust::universal_vector<int>   split_cnt(batch_size);
+        thrust::universal_vector<int>   semaphores(batch_size * kHeadNum * kMaxSplitK);
+
+        thrust::fill(finished.begin(), finished.end(), false);
+        thrust::fill(rope_base.begin(), rope_base.end(), kRoPEBase);
+        thrust::fill(semaphores.begin(), semaphores.end(), 0);
+
+        T* hidden = hidden_states_ref.data().get();
+
+        for (int layer = 0; layer < kLayerNum; ++layer) {
+            Gemm(handle, qkv_buf.data().get(), hidden, kHidden, qkv[layer].data().get(), batch_size, kQkvDim, kHidden);
+
+            AttentionParams<T> params{};
+
+            params.out    = attn_buf.data().get();
+            params.q      = qkv_buf.data().get();
+            params.k      = params.q + kHeadNum * kHeadDim;
+            params.v      = params.k + kKvHeadNum * kHeadDim;
+            params.stride = kQkvDim;
+
+            params.token_num  = batch_size;
+            params.batch_size = batch_size;
+            params.max_q_len  = 1;
+            params.max_k_len  = max_k_len;
+
+            params.block_iter_params =
+                BlockIteratorParams{k_ptrs_ref.data().get(), cu_block_cnts.data().get(), layer, kBlockLen};
+
+            params.finished   = finished.data().get();
+            params.rope_theta = rope_base.data().get();
+            params.cu_q_len   = cu_q_len.data().get();
+            params.cu_k_len   = cu_k_len.data().get();
+
+            params.num_heads     = kHeadNum;
+            params.num_kv_heads  = kKvHeadNum;
+            params.size_per_head = kHeadDim;
+            params.inv_sqrt_dh   = inv_sqrt_dh;
+            params.rope_param    = rope_param;
+
+            params.split_cnt   = split_cnt.data().get();
+            params.partial_L   = partial_L.data().get();
+            params.partial_M   = partial_M.data().get();
+            params.partial_O   = partial_O.data().get();
+            params.locks       = semaphores.data().get();
+            params.max_split_k = kMaxSplitK;
+            params.arch        = getSMVersion();
+
+            dispatchDecoding<T>(params);
+
+            Gemm(handle,
+                 hidden,
+                 attn_buf.data().get(),
+                 kAttnDim,
+                 output[layer].data().get(),
+                 batch_size,
+                 kHidden,
+                 kAttnDim);
+
+            invokeBiasResidualRMSNorm(residual_ref.data().get(),
+                                      hidden,
+                                      ffn_norm[layer].data().get(),
+                                      (const T*)nullptr,
+                                      kHidden,
+                                      batch_size,
+                                      kEps,
+                                      nullptr);
+
+            // chunked [gate, up], the activation is written to the gate
+            Gemm(handle,
+                 gating_buf.data().get(),
+                 hidden,
+                 kHidden,
+                 gate_up[layer].data().get(),
+                 batch_size,
+                 2 * kInterSize,
+                 kHidden);
+            invokeGenericActivation_v2<SiluActivation>(gating_buf.data().get(),
+                                                       gating_buf.data().get() + kInterSize,
+                                                       2 * kInterSize,
+                                                       batch_size,
+                                                       kInterSize,
+                                                       nullptr);
+
+            Gemm(handle,
+                 hidden,
+                 gating_buf.data().get(),
+                 2 * kInterSize,
+                 down[layer].data().get(),
+                 batch_size,
+                 kHidden,
+                 kInterSize);
+
+            invokeBiasResidualRMSNorm(residual_ref.data().get(),
+                                      hidden,
+                                      attn_norm[layer + 1].data().get(),
+                                      (const T*)nullptr,
+                                      kHidden,
+                                      batch_size,
+                                      kEps,
+                                      nullptr);
+        }
+
+        cudaDeviceSynchronize();
+        check_cuda_error(cublasDestroy(handle));
+    }
+
+    if (auto err = cudaGetLastError(); err != cudaSuccess) {
+        std::cout << cudaGetErrorString(err) << "\n";
+        return -1;
+    }
+
+    // megakernel
+    {
+        thrust::universal_vector<T>     qkv_buf(batch_size * kQkvDim);
+        thrust::universal_vector<T>     attn_buf(batch_size * kAttnDim);
+        thrust::universal_vector<T>     inter_buf(batch_size * kInterSize);
+        thrust::universal_vector<float> partial_O(batch_size * kHeadNum * DecodeMegakernel::kMaxSplits * kHeadDim);
+        thrust::universal_vector<float> partial_ML(batch_size * kHeadNum * DecodeMegakernel::kMaxSplits * 2);
+
+        const int grid_size = GetDecodeMegakernelGridSize<T>(kHeadDim);
+
+        // as `UnifiedDecoder::forwardDecodeMegakernel`
+        const int split_cnt = std::clamp(
+            std::min(cdiv(grid_size, batch_size * kKvHeadNum), cdiv(max_k_len, 64)), 1, DecodeMegakernel::kMaxSplits);
+
+        DecodeMegakernelParam<T> p{};
+
+        p.residual        = residual.data().get();
+        p.hidden_states   = hidden_states.data().get();
+        p.qkv_buf         = qkv_buf.data().get();
+        p.attn_buf        = attn_buf.data().get();
+        p.inter_buf       = inter_buf.data().get();
+        p.partial_O       = partial_O.data().get();
+        p.partial_ML      = partial_ML.data().get();
+        p.block_ptrs      = k_ptrs.data().get();
+        p.cu_block_counts = cu_block_cnts.data().get();
+        p.cu_k_len        = cu_k_len.data().get();
+        p.block_len       = kBlockLen;
+        p.rope            = rope_param;
+        p.inv_sqrt_dh     = inv_sqrt_dh;
+        p.batch_size      = batch_size;
+        p.hidden          = kHidden;
+        p.head_num        = kHeadNum;
+        p.kv_head_num     = kKvHeadNum;
+        p.head_dim        = kHeadDim;
+        p.inter_size      = kInterSize;
+        p.split_cnt       = split_cnt;
+        p.interleaved     = interleaved;
+        p.eps             = kEps;
+
+        for (int layer = 0; layer < kLayerNum; ++layer) {
+            p.qkv       = qkv[layer].data().get();
+            p.output    = output[layer].data().get();
+            p.gate_up   = (interleaved ? gate_up_interleaved : gate_up)[layer].data().get();
+            p.down      = down[layer].data().get();
+            p.ffn_norm  = ffn_norm[layer].data().get();
+            p.next_norm = attn_norm[layer + 1].data().get();
+            p.layer_id  = layer;
+
+            invokeDecodeMegakernel(p, grid_size, nullptr);
+        }
+
+        cudaDeviceSynchronize();
+    }
+
+    if (auto err = cudaGetLastError(); err != cudaSuccess) {
+        std::cout << cudaGetErrorString(err) << "\n";
+        return -1;
+    }
+
+    std::cout << "---------------------------------------------------\n";
+
+    // [B, hidden]
+    Compare(hidden_states.data().get(), hidden_states_ref.data().get(), kHidden, kHidden, batch_size, 0);
+    Compare(residual.data().get(), residual_ref.data().get(), kHidden, kHidden, batch_size, 0);
+
+    // the kv of the new tokens in all layers, the history is the same
+    const int block_elems = block_size / sizeof(T);
+    Compare((const T*)blocks.data().get(), (const T*)blocks_ref.data().get(), block_elems, block_elems, n_blocks, 0);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    for (int batch_size = 1; batch_size <= DecodeMegakernel::kMaxBatch; ++batch_size) {
+        test_decode_megakernel<half, 64>(batch_size, false);
+        test_decode_megakernel<half, 128>(batch_size, false);
+        test_decode_megakernel<half, 128>(batch_size, true);
+    }
+
+    // for (int batch_size = 1; batch_size <= DecodeMegakernel::kMaxBatch; ++batch_size) {
+    //     test_decode_megakernel<nv_bfloat16, 128>(batch_size, false);
+    // }
+}
@@ -8,8 +8,14 @@
 
 namespace turbomind {
 
-int GetSplitCount(
-    int max_split_cnt, int grid_size, int max_active_ctas, int sm_count, int max_wave_cnt, float alpha, float beta)
+int GetSplitCount(int   max_split_cnt,
+                  int   grid_size,
+                  int   max_active_ctas,
+                  int   sm_count,
+                  int   max_wave_cnt,
+                  int   tile_count,
+                  float cta_cost,
+                  float reduce_cost)
 {
 
     const float scale = (float)grid_size / (sm_count * max_active_ctas);
@@ -18,7 +24,8 @@ int GetSplitCount(
         float waves = std::ceil(scale * s);
         float cost  = std::numeric_limits<float>::infinity();
         if (s == 1 || waves <= max_wave_cnt) {
-            cost = (alpha / s + beta) * waves;
+            const int tiles = (tile_count + s - 1) / s;
+            cost            = (tiles + cta_cost) * waves + (s > 1 ? reduce_cost * scale * s : 0.f);
         }
         return {cost, scale * s, s};
     };
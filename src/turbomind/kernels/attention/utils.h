@@ -4,12 +4,16 @@
 
 namespace turbomind {
 
+// Split count of the kv dimension minimizing the estimated cost, in units of kv tiles processed by a CTA. A wave
+// costs the tiles of a split plus `cta_cost`, and each split adds `reduce_cost` to the reduction of the partial
+// results. Splits beyond `max_wave_cnt` waves are not considered.
 int GetSplitCount(int   max_split_cnt,
                   int   grid_size,
                   int   max_active_ctas,
                   int   sm_count,
                   int   max_wave_cnt,
-                  float alpha = 1,
-                  float beta  = 1e-3);
+                  int   tile_count,
+                  float cta_cost    = 1,
+                  float reduce_cost = .25);
 
-}
+}  // namespace turbomind
@@ -120,6 +120,43 @@ void invokeBanBadWords(T*           logits,
     sync_check_cuda_error();
 }
 
+template<typename T>
+__global__ void apply_token_bitmask(T* logits, const uint32_t* bitmask, int vocab_size, int vocab_size_padded)
+{
+    const int words = (vocab_size + 31) / 32;
+
+    logits += (int64_t)blockIdx.y * vocab_size_padded;
+    bitmask += (int64_t)blockIdx.y * words;
+
+    for (int w = blockIdx.x * blockDim.x + threadIdx.x; w < words; w += gridDim.x * blockDim.x) {
+        const uint32_t mask = bitmask[w];
+        if (mask == 0xffffffffu) {
+            continue;
+        }
+        const int end = min(32, vocab_size - w * 32);
+        for (int i = 0; i < end; ++i) {
+            if (!(mask >> i & 1)) {
+                logits[w * 32 + i] = -getMaxValue<T>();
+            }
+        }
+    }
+}
+
+template<typename T>
+void invokeApplyTokenBitmask(T*              logits,
+                             const uint32_t* bitmask,
+                             int             batch_size,
+                             int             vocab_size,
+                             int             vocab_size_padded,
+                             cudaStream_t    stream)
+{
+    const int words = (vocab_size + 31) / 32;
+    dim3      block(256);
+    dim3      grid((words + block.x - 1) / block.x, batch_size);
+    apply_token_bitmask<<<grid, block, 0, stream>>>(logits, bitmask, vocab_size, vocab_size_padded);
+    sync_check_cuda_error();
+}
+
 #define INSTANTIATE_INVOKE_BAN_BAD_WORDS(T)                                                                            \
     template void invokeBanBadWords<T>(T * logits,                                                                     \
                                        const int*   output_ids_buf,                                                    \
@@ -133,7 +170,13 @@ void invokeBanBadWords(T*           logits,
                                        int          id_offset,                                                         \
                                        int          vocab_size_padded,                                                 \
                                        size_t       step,                                                              \
-                                       cudaStream_t stream);
+                                       cudaStream_t stream);                                                           \
+    template void invokeApplyTokenBitmask<T>(T * logits,                                                               \
+                                             const uint32_t* bitmask,                                                  \
+                                             int             batch_size,                                               \
+                                             int             vocab_size,                                               \
+                                             int             vocab_size_padded,                                        \
+                                             cudaStream_t    stream);
 
 #ifdef ENABLE_FP32
 INSTANTIATE_INVOKE_BAN_BAD_WORDS(float);
@@ -18,6 +18,7 @@
 
 #include <cuda_fp16.h>
 #include <cuda_runtime.h>
+#include <stdint.h>
 
 namespace turbomind {
 
@@ -36,4 +37,14 @@ void invokeBanBadWords(T*           logits,
                        size_t       step,
                        cudaStream_t stream);
 
+// Bans the tokens whose bit is not set in the packed bitmask [batch_size, ceil(vocab_size / 32)], bit `i % 32` of
+// word `i / 32` is token `i`
+template<typename T>
+void invokeApplyTokenBitmask(T*              logits,
+                             const uint32_t* bitmask,
+                             int             batch_size,
+                             int             vocab_size,
+                             int             vocab_size_padded,
+                             cudaStream_t    stream);
+
 }  // namespace turbomind
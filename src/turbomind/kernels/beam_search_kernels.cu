@@ -0,0 +1,300 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#ifndef CUDART_VERSION
+#error CUDART_VERSION Undefined!
+#elif (CUDART_VERSION >= 11000)
+#include <cub/cub.cuh>
+#else
+#include "3rdparty/cub/cub.cuh"
+#endif
+
+#include "src/turbomind/kernels/beam_search_kernels.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include <climits>
+
+namespace turbomind {
+
+// One block per (group, beam)
+//  1. top `kMaxBeamWidth` logits of each thread, merged by `width` rounds of block argmax
+//  2. log-sum-exp over the row, the top-1 is the max
+template<typename T, int BLOCK_SIZE>
+__global__ void __launch_bounds__(BLOCK_SIZE) beamTopK(BeamSearchParams params)
+{
+    using Pair        = cub::KeyValuePair<int, float>;
+    using BlockArgMax = cub::BlockReduce<Pair, BLOCK_SIZE>;
+    using BlockSum    = cub::BlockReduce<float, BLOCK_SIZE>;
+
+    __shared__ union {
+        typename BlockArgMax::TempStorage argmax;
+        typename BlockSum::TempStorage    sum;
+    } smem;
+
+    __shared__ float s_vals[kMaxBeamWidth];
+    __shared__ int   s_ids[kMaxBeamWidth];
+    __shared__ float s_sum;
+
+    BeamSearchGroup& g   = params.groups[blockIdx.x];
+    const int        b   = blockIdx.y;
+    const int        tid = threadIdx.x;
+
+    if (g.hold || b >= g.beams || (g.finished >> b & 1)) {
+        return;
+    }
+
+    const T*  logits = (const T*)params.logits + (int64_t)g.rows[b] * params.stride;
+    const int n      = params.vocab_size;
+
+    // descending, ties keep the lower index first
+    float vals[kMaxBeamWidth];
+    int   ids[kMaxBeamWidth];
+    PRAGMA_UNROLL
+    for (int j = 0; j < kMaxBeamWidth; ++j) {
+        vals[j] = -INFINITY;
+        ids[j]  = -1;
+    }
+
+    for (int i = tid; i < n; i += BLOCK_SIZE) {
+        float v = (float)logits[i];
+        if (v > vals[kMaxBeamWidth - 1]) {
+            int id = i;
+            PRAGMA_UNROLL
+            for (int j = 0; j < kMaxBeamWidth; ++j) {
+                if (v > vals[j]) {
+                    const float tv = vals[j];
+                    const int   ti = ids[j];
+                    vals[j]        = v;
+                    ids[j]         = id;
+                    v              = tv;
+                    id             = ti;
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < g.width; ++j) {
+        const Pair top = BlockArgMax{smem.argmax}.Reduce(Pair{ids[0], vals[0]}, cub::ArgMax{});
+        if (tid == 0) {
+            s_vals[j] = top.value;
+            s_ids[j]  = top.key;
+        }
+        __syncthreads();
+        // the ids of the threads are disjoint, the owner of the winner pops its head
+        if (ids[0] >= 0 && ids[0] == s_ids[j]) {
+            PRAGMA_UNROLL
+            for (int t = 0; t < kMaxBeamWidth - 1; ++t) {
+                vals[t] = vals[t + 1];
+                ids[t]  = ids[t + 1];
+            }
+            vals[kMaxBeamWidth - 1] = -INFINITY;
+            ids[kMaxBeamWidth - 1]  = -1;
+        }
+    }
+
+    const float max_val = s_vals[0];
+
+    float sum{};
+    for (int i = tid; i < n; i += BLOCK_SIZE) {
+        sum += __expf((float)logits[i] - max_val);
+    }
+    sum = BlockSum{smem.sum}.Sum(sum);
+    if (tid == 0) {
+        s_sum = sum;
+    }
+    __syncthreads();
+
+    const float log_sum = max_val + __logf(s_sum);
+
+    if (tid < g.width) {
+        g.cand_logprobs[b][tid] = s_vals[tid] - log_sum;
+        g.cand_ids[b][tid]      = s_ids[tid];
+    }
+}
+
+__device__ inline bool IsEndId(const BeamSearchGroup& g, int id)
+{
+    for (int i = 0; i < g.end_num; ++i) {
+        if (g.end_ids[i] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One warp per group, candidate `c` is the `c % kMaxBeamWidth`-th top token of beam `c / kMaxBeamWidth`. A finished
+// beam is a single candidate with its own score, so it stays unless `width` better ones show up
+__global__ void beamSelect(BeamSearchParams params)
+{
+    static_assert(kMaxBeamWidth * kMaxBeamWidth == 2 * WARP_SIZE);
+
+    BeamSearchGroup& g    = params.groups[blockIdx.x];
+    const int        lane = threadIdx.x;
+
+    if (lane < g.beams) {
+        g.seq_len[lane] = params.sequence_length[g.rows[lane]];
+    }
+
+    if (g.hold) {
+        return;
+    }
+
+    float val[2];
+    int   slot[2];
+    PRAGMA_UNROLL
+    for (int p = 0; p < 2; ++p) {
+        const int c = lane + p * WARP_SIZE;
+        const int b = c / kMaxBeamWidth;
+        const int j = c % kMaxBeamWidth;
+        float     v = -INFINITY;
+        if (b < g.beams && j < g.width) {
+            if (g.finished >> b & 1) {
+                v = j == 0 ? g.scores[b] : -INFINITY;
+            }
+            else {
+                v = g.scores[b] + g.cand_logprobs[b][j];
+            }
+        }
+        val[p]  = v;
+        slot[p] = c;
+    }
+
+    const int seq_len = params.sequence_length[g.rows[0]];
+
+    float score  = 0.f;
+    int   parent = 0;
+    int   token  = -1;
+    int   length = 0;
+    bool  ended  = false;
+
+    for (int j = 0; j < g.width; ++j) {
+        // higher value first, ties by the lower slot
+        const int p = val[1] > val[0] || (val[1] == val[0] && slot[1] < slot[0]);
+        float     v = val[p];
+        int       s = slot[p];
+        PRAGMA_UNROLL
+        for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+            const float ov = __shfl_xor_sync((uint32_t)-1, v, mask);
+            const int   os = __shfl_xor_sync((uint32_t)-1, s, mask);
+            if (ov > v || (ov == v && os < s)) {
+                v = ov;
+                s = os;
+            }
+        }
+        PRAGMA_UNROLL
+        for (int q = 0; q < 2; ++q) {
+            if (slot[q] == s) {
+                val[q]  = -INFINITY;
+                slot[q] = INT_MAX;
+            }
+        }
+        if (lane == j) {
+            const int b = s / kMaxBeamWidth;
+            parent      = b;
+            score       = v;
+            if (g.finished >> b & 1) {
+                token  = g.end_ids[0];
+                length = g.lengths[b];
+                ended  = true;
+            }
+            else {
+                token  = g.cand_ids[b][s % kMaxBeamWidth];
+                ended  = IsEndId(g, token);
+                length = ended ? seq_len + 2 : 0;
+            }
+        }
+    }
+
+    const uint32_t finished = __ballot_sync((uint32_t)-1, lane < g.width && ended);
+
+    // the inputs of the rounds are read by all lanes
+    __syncwarp();
+
+    if (lane < g.width) {
+        g.scores[lane]  = score;
+        g.lengths[lane] = length;
+        g.parents[lane] = parent;
+        g.tokens[lane]  = token;
+    }
+    if (lane == 0) {
+        g.finished = finished;
+        g.done     = finished == (1u << g.width) - 1;
+    }
+}
+
+// One block per group
+__global__ void beamCommit(BeamSearchParams params)
+{
+    const BeamSearchGroup& g = params.groups[blockIdx.x];
+
+    const int step       = params.step;
+    const int batch_size = params.batch_size;
+
+    if (g.hold) {
+        if (const int b = threadIdx.x; b < g.beams) {
+            const int row     = g.rows[b];
+            const int seq_len = g.seq_len[b];
+            params.output_ids[step * batch_size + row] =
+                params.history[(int64_t)row * params.history_stride + seq_len + 1];
+            params.sequence_length[row] = seq_len + 1;
+            params.finished[row]        = false;
+        }
+        return;
+    }
+
+    if (g.beams > 1) {
+        for (int t = threadIdx.x; t < step; t += blockDim.x) {
+            int* ids = params.output_ids + t * batch_size;
+            int  tmp[kMaxBeamWidth];
+            PRAGMA_UNROLL
+            for (int b = 0; b < kMaxBeamWidth; ++b) {
+                if (b < g.beams) {
+                    tmp[b] = ids[g.rows[g.parents[b]]];
+                }
+            }
+            PRAGMA_UNROLL
+            for (int b = 0; b < kMaxBeamWidth; ++b) {
+                if (b < g.beams) {
+                    ids[g.rows[b]] = tmp[b];
+                }
+            }
+        }
+    }
+
+    if (const int b = threadIdx.x; b < g.beams) {
+        const int row                              = g.rows[b];
+        params.output_ids[step * batch_size + row] = g.tokens[b];
+        params.sequence_length[row]                = g.seq_len[b] + 1;
+        params.finished[row]                       = g.done || step >= params.sequence_limit_length[row];
+    }
+}
+
+template<typename T>
+void invokeBeamSearch(const BeamSearchParams& params, cudaStream_t stream)
+{
+    if (params.group_num == 0) {
+        return;
+    }
+    constexpr int block = 256;
+    beamTopK<T, block><<<dim3(params.group_num, kMaxBeamWidth), block, 0, stream>>>(params);
+    beamSelect<<<params.group_num, WARP_SIZE, 0, stream>>>(params);
+    sync_check_cuda_error();
+}
+
+void invokeBeamCommit(const BeamSearchParams& params, cudaStream_t stream)
+{
+    if (params.group_num == 0) {
+        return;
+    }
+    beamCommit<<<params.group_num, 256, 0, stream>>>(params);
+    sync_check_cuda_error();
+}
+
+#ifdef ENABLE_FP32
+template void invokeBeamSearch<float>(const BeamSearchParams& params, cudaStream_t stream);
+#endif
+template void invokeBeamSearch<half>(const BeamSearchParams& params, cudaStream_t stream);
+#ifdef ENABLE_BF16
+template void invokeBeamSearch<nv_bfloat16>(const BeamSearchParams& params, cudaStream_t stream);
+#endif
+
+}  // namespace turbomind
@@ -0,0 +1,61 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbomind {
+
+constexpr int kMaxBeamWidth  = 8;
+constexpr int kMaxBeamEndIds = 8;
+
+// A beam search request in the batch, its beams occupy rows of their own. Before the expansion only the request's row
+// is there and its top `width` tokens become the beams, `LlamaBatch` forks the sequences of the others afterwards
+struct BeamSearchGroup {
+    int rows[kMaxBeamWidth];  // of the beams in the batch, [0, beams)
+    int beams;                // 1 before the expansion, `width` after
+    int width;
+    int hold;  // the rows reproduce the next token of their history, some beams of the group are not in the step
+    int end_ids[kMaxBeamEndIds];
+    int end_num;
+
+    float scores[kMaxBeamWidth];   // cumulative logprobs of the beams, updated by the step
+    int   lengths[kMaxBeamWidth];  // of the finished beams including the end token, updated by the step
+    int   finished;                // bit mask of the finished beams, updated by the step
+
+    int parents[kMaxBeamWidth];  // beam extended by each beam
+    int tokens[kMaxBeamWidth];   // new token of each beam
+    int seq_len[kMaxBeamWidth];  // `sequence_length` of the rows before the step
+    int done;                    // every beam is finished
+
+    float cand_logprobs[kMaxBeamWidth][kMaxBeamWidth];  // scratch, top tokens of each beam
+    int   cand_ids[kMaxBeamWidth][kMaxBeamWidth];
+};
+
+struct BeamSearchParams {
+    const void*      logits;  // [batch_size, stride]
+    int              stride;
+    int              vocab_size;
+    BeamSearchGroup* groups;
+    int              group_num;
+    int              batch_size;
+    int              step;
+    int*             output_ids;  // [step + 1, batch_size]
+    int*             sequence_length;
+    bool*            finished;
+    const uint32_t*  sequence_limit_length;
+    const int*       history;  // [batch_size, history_stride], tokens of the rows
+    int              history_stride;
+};
+
+// Top `width` tokens of each live beam by log-softmax and the selection of the next beams among them by cumulative
+// logprob, the finished beams are kept as they are. Runs before the sampling of the batch, whose tokens for the rows
+// of the groups are replaced by `invokeBeamCommit`
+template<typename T>
+void invokeBeamSearch(const BeamSearchParams& params, cudaStream_t stream);
+
+// Reorders the token ids of the beams [0, step) by their parents and writes the selected tokens at `step`
+void invokeBeamCommit(const BeamSearchParams& params, cudaStream_t stream);
+
+}  // namespace turbomind
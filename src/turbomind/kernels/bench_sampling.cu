@@ -0,0 +1,607 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Sweeps the sampling & logits processing kernels of a decoding step over batch size, vocab size and the sampling
+// parameters of the requests, reporting the time of each kernel per step. e.g.
+//   bench_sampling --batch 1,16,64,256 --vocab 32000,128256,256000 --mixes topk,topp,minp --output sampling.json
+//
+// The sampling stages of `SamplingLayer` (top-k sort & filter, softmax & top-p sort, top-p/min-p filter, sampling)
+// are timed one by one with their inputs set up by the stages before, their sum is reported as `unfused` next to the
+// fused sampling kernel taking the same inputs. The penalties & stop criteria are timed the way `LogitsProcessorLayer`
+// and `StopCriteriaLayer` run them. The in-place kernels get fresh logits before each launch, only the launch is timed
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+
+#include "src/turbomind/kernels/ban_bad_words.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
+#include "src/turbomind/kernels/logprob_kernels.h"
+#include "src/turbomind/kernels/sampling_kernels.h"
+#include "src/turbomind/kernels/sampling_penalty_kernels.h"
+#include "src/turbomind/kernels/sampling_topk_kernels.h"
+#include "src/turbomind/kernels/sampling_topp_kernels.h"
+#include "src/turbomind/kernels/stop_criteria_kernels.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/constant.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+using namespace turbomind;
+
+namespace {
+
+// sampling parameters shared by the sequences of a batch
+struct Mix {
+    std::string name;
+    int         top_k;
+    float       top_p;
+    float       min_p;
+};
+
+const std::vector<Mix>& Mixes()
+{
+    static const std::vector<Mix> mixes{
+        {"greedy", 1, 1.f, 0.f},
+        {"topk", 40, 1.f, 0.f},
+        {"topkp", 40, .9f, 0.f},
+        {"topp", 0, .95f, 0.f},
+        {"minp", 0, 1.f, .05f},
+    };
+    return mixes;
+}
+
+struct Options {
+    std::vector<int>         batch{1, 16, 64, 256};
+    std::vector<int>         vocab{32000, 128256, 256000};
+    std::vector<std::string> mixes{"greedy", "topk", "topkp", "topp", "minp"};
+
+    std::string dtype = "half";
+    std::string output;
+
+    int words  = 16;  // 2-token bad words & stop words per sequence
+    int steps  = 64;  // generated tokens the criteria look back on
+    int top_n  = 5;   // logprobs of the sampled tokens
+    int warmup = 5;
+    int iters  = 50;
+};
+
+struct Result {
+    int         batch;
+    int         vocab;
+    std::string mix;  // empty for the kernels independent of the sampling parameters
+    std::string kernel;
+    float       time;  // us per step
+};
+
+template<class T>
+class Bench {
+public:
+    Bench(const Options& opts, int batch, int vocab): opts_{opts}, batch_{batch}, vocab_{vocab}
+    {
+        vocab_padded_ = (vocab + 63) / 64 * 64;
+
+        const size_t n = (size_t)batch * vocab_padded_;
+
+        check_cuda_error(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreate(&beg_));
+        check_cuda_error(cudaEventCreate(&end_));
+
+        // the logits of 2 tokens per sequence for the logprobs of the inputs
+        logits0_ = Alloc<T>(2 * n);
+        logits_  = Alloc<T>(n);
+        indices_ = Alloc<int>(n);
+        counts_  = Alloc<uint32_t>(n);
+
+        kept_         = Alloc<int>(batch);
+        top_ks_       = Alloc<int>(batch);
+        top_ps_       = Alloc<float>(batch);
+        min_ps_       = Alloc<float>(batch);
+        penalties_    = Alloc<float>(batch);
+        seeds_        = Alloc<uint64_t>(batch);
+        input_len_    = Alloc<int>(batch);
+        finished_     = Alloc<bool>(batch);
+        cum_logprobs_ = Alloc<float>(batch);
+
+        output_ids_ = Alloc<int>((size_t)opts.steps * batch);
+        bad_words_  = Alloc<int>((size_t)batch * 2 * opts.words);
+        stop_words_ = Alloc<int>((size_t)batch * 2 * opts.words);
+
+        logprobs_       = Alloc<T>((size_t)batch * kMaxLogProb);
+        logprob_ids_    = Alloc<uint32_t>((size_t)batch * kMaxLogProb);
+        logprob_nums_   = Alloc<uint32_t>(batch);
+        logprob_ws_     = Alloc<float>((size_t)2 * batch);
+        sampled_ids_    = Alloc<int>(batch);
+        sampled_length_ = Alloc<int>(batch);
+
+        std::mt19937                    gen{(uint32_t)(batch * 1000003 + vocab)};
+        std::normal_distribution<float> normal{0.f, 4.f};
+        {
+            std::vector<T> h(2 * n);
+            for (auto& x : h) {
+                x = (T)normal(gen);
+            }
+            Upload(logits0_, h);
+        }
+
+        std::uniform_int_distribution<int> token(0, vocab - 1);
+        {
+            std::vector<int> h((size_t)opts.steps * batch);
+            for (auto& x : h) {
+                x = token(gen);
+            }
+            Upload(output_ids_, h);
+        }
+        {
+            // [batch, 2, words] of tokens & end offsets, the words match nothing of the history by chance only
+            std::vector<int> h((size_t)batch * 2 * opts.words);
+            for (int b = 0; b < batch; ++b) {
+                int* tokens  = h.data() + (size_t)b * 2 * opts.words;
+                int* offsets = tokens + opts.words;
+                for (int i = 0; i < opts.words; ++i) {
+                    tokens[i]  = token(gen);
+                    offsets[i] = i / 2 * 2 + 2;
+                }
+            }
+            Upload(bad_words_, h);
+            Upload(stop_words_, h);
+        }
+
+        std::vector<uint64_t> seeds(batch);
+        std::iota(seeds.begin(), seeds.end(), 1);
+        Upload(seeds_, seeds);
+        Upload(input_len_, std::vector<int>(batch, 2));
+        Upload(penalties_, std::vector<float>(batch, 1.1f));
+
+        {
+            TopKSortFilterParams params{};
+            params.batch_size = batch;
+            params.max_top_k  = kFusedSamplingMaxTopK;
+            invokeTopKSortFilter<T>(params, stream_);
+            topk_ws_size_ = params.workspace_size;
+        }
+        {
+            TopPSortParams params{};
+            params.batch_size        = batch;
+            params.vocab_size        = vocab;
+            params.vocab_size_padded = vocab_padded_;
+            invokeTopPSort<T>(params, stream_);
+            topp_ws_size_ = params.workspace_size;
+        }
+        topk_ws_ = Alloc<char>(topk_ws_size_);
+        topp_ws_ = Alloc<char>(topp_ws_size_);
+
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+
+    ~Bench()
+    {
+        for (auto& p : buffers_) {
+            cudaFree(p);
+        }
+        cudaEventDestroy(beg_);
+        cudaEventDestroy(end_);
+        cudaStreamDestroy(stream_);
+    }
+
+    std::vector<Result> Run()
+    {
+        std::vector<Result> results;
+
+        for (const auto& name : opts_.mixes) {
+            const auto it = std::find_if(Mixes().begin(), Mixes().end(), [&](auto& m) { return m.name == name; });
+            if (it == Mixes().end()) {
+                std::cerr << "unknown mix " << name << ", skipped\n";
+                continue;
+            }
+            RunMix(*it, results);
+        }
+
+        RunPenalties(results);
+
+        return results;
+    }
+
+private:
+    template<class U>
+    U* Alloc(size_t count)
+    {
+        U* ptr{};
+        check_cuda_error(cudaMalloc(&ptr, sizeof(U) * std::max<size_t>(count, 1)));
+        buffers_.push_back(ptr);
+        return ptr;
+    }
+
+    // the pageable source is staged before the call returns
+    template<class U>
+    void Upload(U* dst, const std::vector<U>& src)
+    {
+        check_cuda_error(cudaMemcpyAsync(dst, src.data(), sizeof(U) * src.size(), cudaMemcpyHostToDevice, stream_));
+    }
+
+    // `setup` is not timed, run before each launch
+    float Measure(const std::function<void()>& setup, const std::function<void()>& run)
+    {
+        float total{};
+        for (int i = 0; i < opts_.warmup + opts_.iters; ++i) {
+            setup();
+            check_cuda_error(cudaEventRecord(beg_, stream_));
+            run();
+            check_cuda_error(cudaEventRecord(end_, stream_));
+            check_cuda_error(cudaEventSynchronize(end_));
+            float ms{};
+            check_cuda_error(cudaEventElapsedTime(&ms, beg_, end_));
+            if (i >= opts_.warmup) {
+                total += ms;
+            }
+        }
+        check_cuda_error(cudaGetLastError());
+        return total * 1000.f / opts_.iters;
+    }
+
+    void ResetLogits()
+    {
+        check_cuda_error(cudaMemcpyAsync(
+            logits_, logits0_, sizeof(T) * batch_ * vocab_padded_, cudaMemcpyDeviceToDevice, stream_));
+    }
+
+    void RunMix(const Mix& mix, std::vector<Result>& results)
+    {
+        Upload(top_ks_, std::vector<int>(batch_, mix.top_k));
+        Upload(top_ps_, std::vector<float>(batch_, mix.top_p));
+        Upload(min_ps_, std::vector<float>(batch_, mix.min_p));
+
+        // the stages of `SamplingLayer` in order, each one takes the outputs of the ones before
+        std::vector<std::pair<std::string, std::function<void()>>> stages;
+        if (mix.top_k > 0) {
+            stages.emplace_back("topk_sort_filter", [&] {
+                TopKSortFilterParams params{};
+                params.workspace         = topk_ws_;
+                params.workspace_size    = topk_ws_size_;
+                params.logits            = logits_;
+                params.sorted_logits     = logits_;
+                params.sorted_indices    = indices_;
+                params.kept              = kept_;
+                params.top_ks            = top_ks_;
+                params.max_top_k         = mix.top_k;
+                params.batch_size        = batch_;
+                params.vocab_size        = vocab_;
+                params.vocab_size_padded = vocab_padded_;
+                invokeTopKSortFilter<T>(params, stream_);
+            });
+        }
+        else {
+            stages.emplace_back("softmax", [&] {
+                invokeSoftmax<T>(logits_, vocab_padded_, vocab_, batch_, kept_, stream_);
+            });
+            stages.emplace_back("topp_sort", [&] {
+                TopPSortParams params{};
+                params.workspace         = topp_ws_;
+                params.workspace_size    = topp_ws_size_;
+                params.logits            = logits_;
+                params.sorted_logits     = logits_;
+                params.sorted_indices    = indices_;
+                params.kept              = kept_;
+                params.top_ks            = top_ks_;
+                params.top_ps            = top_ps_;
+                params.batch_size        = batch_;
+                params.vocab_size        = vocab_;
+                params.vocab_size_padded = vocab_padded_;
+                invokeTopPSort<T>(params, stream_);
+            });
+        }
+        if (mix.top_p < 1.f || mix.min_p > 0.f) {
+            stages.emplace_back("topp_minp_filter", [&] {
+                TopPMinPFilterParams params{};
+                params.sorted_logits     = logits_;
+                params.sorted_indices    = indices_;
+                params.kept              = kept_;
+                params.top_ps            = top_ps_;
+                params.min_ps            = min_ps_;
+                params.batch_size        = batch_;
+                params.vocab_size        = vocab_;
+                params.vocab_size_padded = vocab_padded_;
+                invokeTopPMinPFilter<T>(params, stream_);
+            });
+        }
+        stages.emplace_back("sampling", [&] {
+            SamplingParams params{};
+            params.logits          = logits_;
+            params.stride          = vocab_padded_;
+            params.indices         = indices_;
+            params.kept            = kept_;
+            params.random_seed     = seeds_;
+            params.batch_size      = batch_;
+            params.output_ids      = sampled_ids_;
+            params.sequence_length = sampled_length_;
+            invokeSampling<T>(params, stream_);
+        });
+
+        float unfused{};
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const float t = Measure(
+                [&] {
+                    ResetLogits();
+                    // the kept counts start from the vocab size for the softmax
+                    Upload(kept_, std::vector<int>(batch_, vocab_));
+                    for (size_t j = 0; j < i; ++j) {
+                        stages[j].second();
+                    }
+                    Upload(sampled_length_, std::vector<int>(batch_, opts_.steps));
+                },
+                stages[i].second);
+            results.push_back({batch_, vocab_, mix.name, stages[i].first, t});
+            unfused += t;
+        }
+        results.push_back({batch_, vocab_, mix.name, "unfused", unfused});
+
+        if (mix.top_k > 0 && mix.top_k <= kFusedSamplingMaxTopK) {
+            const float t = Measure([&] { Upload(sampled_length_, std::vector<int>(batch_, opts_.steps)); },
+                                    [&] {
+                                        FusedSamplingParams params{};
+                                        params.logits          = logits0_;
+                                        params.stride          = vocab_padded_;
+                                        params.vocab_size      = vocab_;
+                                        params.top_ks          = top_ks_;
+                                        params.top_ps          = top_ps_;
+                                        params.min_ps          = min_ps_;
+                                        params.max_top_k       = mix.top_k;
+                                        params.random_seed     = seeds_;
+                                        params.batch_size      = batch_;
+                                        params.output_ids      = sampled_ids_;
+                                        params.sequence_length = sampled_length_;
+                                        invokeFusedSampling<T>(params, stream_);
+                                    });
+            results.push_back({batch_, vocab_, mix.name, "fused_sampling", t});
+        }
+    }
+
+    void RunPenalties(std::vector<Result>& results)
+    {
+        const int step = opts_.steps - 1;
+
+        auto add = [&](const char* kernel, float t) { results.push_back({batch_, vocab_, "", kernel, t}); };
+
+        auto reset = [&] { ResetLogits(); };
+        auto none  = [] {};
+
+        check_cuda_error(cudaMemsetAsync(counts_, 0, sizeof(uint32_t) * batch_ * vocab_padded_, stream_));
+        invokeUpdateTokenCounts(counts_, output_ids_, nullptr, 0, batch_, vocab_padded_, 0, step, stream_);
+
+        // the counts are updated with the token of the step
+        add("token_counts", Measure(none, [&] {
+                invokeUpdateTokenCounts(
+                    counts_, output_ids_, nullptr, 0, batch_, vocab_padded_, step, step + 1, stream_);
+            }));
+
+        // repetition, frequency & presence penalties all on
+        add("token_penalties", Measure(reset, [&] {
+                invokeBatchApplyTokenPenalties(
+                    logits_, counts_, penalties_, penalties_, penalties_, batch_, vocab_, vocab_padded_, stream_);
+            }));
+
+        add("temperature", Measure(reset, [&] {
+                invokeBatchApplyTemperaturePenalty_v2(
+                    logits_, (T*)nullptr, penalties_, batch_, vocab_, vocab_padded_, stream_);
+            }));
+
+        add("ban_bad_words", Measure(reset, [&] {
+                invokeBanBadWords(logits_,
+                                  output_ids_,
+                                  nullptr,
+                                  batch_,
+                                  batch_,
+                                  1,
+                                  bad_words_,
+                                  false,
+                                  opts_.words,
+                                  0,
+                                  vocab_padded_,
+                                  step,
+                                  stream_);
+            }));
+
+        auto clear_finished = [&] { check_cuda_error(cudaMemsetAsync(finished_, 0, batch_, stream_)); };
+
+        add("stop_words", Measure(clear_finished, [&] {
+                invokeStopWordsCriterion(
+                    output_ids_, nullptr, stop_words_, finished_, 0, opts_.words, batch_, 1, step, stream_);
+            }));
+
+        // the logprob of the 2nd token of each sequence, as for the prompt logprobs
+        add("logprob_from_logits", Measure(none, [&] {
+                invokeLogProbFromLogits(cum_logprobs_,
+                                        logits0_,
+                                        output_ids_,
+                                        input_len_,
+                                        2,
+                                        batch_,
+                                        vocab_,
+                                        vocab_padded_,
+                                        logprob_ws_,
+                                        sizeof(float) * 2 * batch_,
+                                        stream_);
+            }));
+
+        add("top_n_logprobs", Measure(none, [&] {
+                invokeTopNLogProbs(logprobs_,
+                                   logprob_ids_,
+                                   logprob_nums_,
+                                   logits0_,
+                                   opts_.top_n,
+                                   batch_,
+                                   vocab_,
+                                   vocab_padded_,
+                                   stream_);
+            }));
+    }
+
+    const Options& opts_;
+
+    std::vector<void*> buffers_;
+
+    int batch_;
+    int vocab_;
+    int vocab_padded_;
+
+    cudaStream_t stream_{};
+    cudaEvent_t  beg_{};
+    cudaEvent_t  end_{};
+
+    T*        logits0_{};
+    T*        logits_{};
+    int*      indices_{};
+    uint32_t* counts_{};
+
+    int*      kept_{};
+    int*      top_ks_{};
+    float*    top_ps_{};
+    float*    min_ps_{};
+    float*    penalties_{};
+    uint64_t* seeds_{};
+    int*      input_len_{};
+    bool*     finished_{};
+    float*    cum_logprobs_{};
+
+    int* output_ids_{};
+    int* bad_words_{};
+    int* stop_words_{};
+
+    T*        logprobs_{};
+    uint32_t* logprob_ids_{};
+    uint32_t* logprob_nums_{};
+    float*    logprob_ws_{};
+    int*      sampled_ids_{};
+    int*      sampled_length_{};
+
+    char*  topk_ws_{};
+    char*  topp_ws_{};
+    size_t topk_ws_size_{};
+    size_t topp_ws_size_{};
+};
+
+void Print(const std::vector<Result>& results)
+{
+    std::printf("%8s %8s %8s %-20s %12s\n", "batch", "vocab", "mix", "kernel", "time(us)");
+    for (const auto& r : results) {
+        std::printf("%8d %8d %8s %-20s %12.2f\n",
+                    r.batch,
+                    r.vocab,
+                    r.mix.empty() ? "-" : r.mix.c_str(),
+                    r.kernel.c_str(),
+                    r.time);
+    }
+}
+
+void WriteJson(std::ostream& os, const Options& opts, const std::vector<Result>& results)
+{
+    os << "{\n  \"dtype\": \"" << opts.dtype << "\",\n  \"iters\": " << opts.iters << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        os << "    {\"batch\": " << r.batch << ", \"vocab\": " << r.vocab << ", \"mix\": \"" << r.mix
+           << "\", \"kernel\": \"" << r.kernel << "\", \"time_us\": " << r.time << "}"
+           << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n}\n";
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: bench_sampling [options]\n"
+                 "  --batch LIST        batch sizes, comma separated (1,16,64,256)\n"
+                 "  --vocab LIST        vocab sizes (32000,128256,256000)\n"
+                 "  --mixes LIST        greedy | topk | topkp | topp | minp (all of them)\n"
+                 "  --dtype T           half | float (half)\n"
+                 "  --words N           2-token bad words & stop words per sequence (16)\n"
+                 "  --steps N           generated tokens (64)\n"
+                 "  --top-n N           logprobs of the top-n tokens (5)\n"
+                 "  --warmup N          (5)\n"
+                 "  --iters N           (50)\n"
+                 "  --output FILE       write the results as JSON\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--batch") {
+            opts.batch = ParseInts(value);
+        }
+        else if (key == "--vocab") {
+            opts.vocab = ParseInts(value);
+        }
+        else if (key == "--mixes") {
+            opts.mixes = ParseList(value);
+        }
+        else if (key == "--dtype") {
+            opts.dtype = value;
+        }
+        else if (key == "--words") {
+            opts.words = std::stoi(value);
+        }
+        else if (key == "--steps") {
+            opts.steps = std::stoi(value);
+        }
+        else if (key == "--top-n") {
+            opts.top_n = std::stoi(value);
+        }
+        else if (key == "--warmup") {
+            opts.warmup = std::stoi(value);
+        }
+        else if (key == "--iters") {
+            opts.iters = std::stoi(value);
+        }
+        else if (key == "--output") {
+            opts.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    return ok && opts.words > 0 && opts.words % 2 == 0 && opts.steps > 2 && opts.iters > 0 && opts.top_n > 0
+           && opts.top_n <= kMaxTopNLogProbs && (opts.dtype == "half" || opts.dtype == "float");
+}
+
+template<class T>
+std::vector<Result> RunAll(const Options& opts)
+{
+    std::vector<Result> results;
+    for (const auto& vocab : opts.vocab) {
+        for (const auto& batch : opts.batch) {
+            std::cerr << "running batch " << batch << ", vocab " << vocab << "\n";
+            auto xs = Bench<T>{opts, batch, vocab}.Run();
+            results.insert(results.end(), xs.begin(), xs.end());
+        }
+    }
+    return results;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    const auto results = opts.dtype == "half" ? RunAll<half>(opts) : RunAll<float>(opts);
+
+    Print(results);
+
+    if (!opts.output.empty()) {
+        std::ofstream ofs(opts.output);
+        WriteJson(ofs, opts, results);
+    }
+
+    return 0;
+}
@@ -20,6 +20,12 @@
 #define TURBOMIND_ARCH_SM80 0
 #endif
 
+#if (defined(__CUDA_ARCH__) && (__CUDA_ARCH__ >= 890))
+#define TURBOMIND_ARCH_SM89 1
+#else
+#define TURBOMIND_ARCH_SM89 0
+#endif
+
 #if (defined(__CUDA_ARCH__) && (__CUDA_ARCH__ >= 900))
 #define TURBOMIND_ARCH_SM90 1
 #else
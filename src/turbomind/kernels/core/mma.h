@@ -208,4 +208,89 @@ __inline__ __device__ void mma_m16n8k16_row_col(Array<nv_bfloat16, 4>&       d,
 #endif
 }
 
+__inline__ __device__ void mma_m16n8k32_row_col(Array<int, 4>&          d,
+                                                const Array<int8_t, 16>& a,
+                                                const Array<int8_t, 8>&  b,
+                                                Array<int, 4>&           c)
+{
+#if TURBOMIND_ARCH_SM80
+    uint32_t const* A = reinterpret_cast<uint32_t const*>(&a);
+    uint32_t const* B = reinterpret_cast<uint32_t const*>(&b);
+    int const*      C = reinterpret_cast<int const*>(&c);
+    int*            D = reinterpret_cast<int*>(&d);
+    asm volatile("mma.sync.aligned.m16n8k32.row.col.s32.s8.s8.s32  {%0,%1,%2,%3}, "
+                 "{%4,%5,%6,%7}, {%8,%9}, {%10,%11,%12,%13};\n"
+                 : "=r"(D[0]), "=r"(D[1]), "=r"(D[2]), "=r"(D[3])
+                 : "r"(A[0]), "r"(A[1]), "r"(A[2]), "r"(A[3]), "r"(B[0]), "r"(B[1]),  //
+                   "r"(C[0]), "r"(C[1]), "r"(C[2]), "r"(C[3]));
+#else
+    assert(TURBOMIND_ARCH_SM80);
+#endif
+}
+
+// e4m3 x e4m3 -> f32, sm89+ with CUDA 12.4+
+__inline__ __device__ void mma_m16n8k32_row_col(Array<float, 4>&           d,
+                                                const Array<fp8_e4m3, 16>& a,
+                                                const Array<fp8_e4m3, 8>&  b,
+                                                Array<float, 4>&           c)
+{
+#if TURBOMIND_ARCH_SM89 && (__CUDACC_VER_MAJOR__ > 12 || (__CUDACC_VER_MAJOR__ == 12 && __CUDACC_VER_MINOR__ >= 4))
+    uint32_t const* A = reinterpret_cast<uint32_t const*>(&a);
+    uint32_t const* B = reinterpret_cast<uint32_t const*>(&b);
+    float const*    C = reinterpret_cast<float const*>(&c);
+    float*          D = reinterpret_cast<float*>(&d);
+    asm volatile("mma.sync.aligned.m16n8k32.row.col.f32.e4m3.e4m3.f32  {%0,%1,%2,%3}, "
+                 "{%4,%5,%6,%7}, {%8,%9}, {%10,%11,%12,%13};\n"
+                 : "=f"(D[0]), "=f"(D[1]), "=f"(D[2]), "=f"(D[3])
+                 : "r"(A[0]), "r"(A[1]), "r"(A[2]), "r"(A[3]), "r"(B[0]), "r"(B[1]),  //
+                   "f"(C[0]), "f"(C[1]), "f"(C[2]), "f"(C[3]));
+#else
+    assert(TURBOMIND_ARCH_SM89);
+#endif
+}
+
+// 2:4 sparse A of 16x32 compressed to 16x16 in the register layout of the dense m16n8k16 A, `e` holds the 2-bit
+// indices of the non-zeros, supplied by the first 2 threads of each quad (sparsity selector 0)
+__inline__ __device__ void mma_sp_m16n8k32_row_col(Array<float, 4>&      d,
+                                                   const Array<half, 8>& a,
+                                                   const Array<half, 8>& b,
+                                                   Array<float, 4>&      c,
+                                                   uint32_t              e)
+{
+#if TURBOMIND_ARCH_SM80
+    uint32_t const* A = reinterpret_cast<uint32_t const*>(&a);
+    uint32_t const* B = reinterpret_cast<uint32_t const*>(&b);
+    float const*    C = reinterpret_cast<float const*>(&c);
+    float*          D = reinterpret_cast<float*>(&d);
+    asm volatile("mma.sp.sync.aligned.m16n8k32.row.col.f32.f16.f16.f32  {%0,%1,%2,%3}, "
+                 "{%4,%5,%6,%7}, {%8,%9,%10,%11}, {%12,%13,%14,%15}, %16, 0x0;\n"
+                 : "=f"(D[0]), "=f"(D[1]), "=f"(D[2]), "=f"(D[3])
+                 : "r"(A[0]), "r"(A[1]), "r"(A[2]), "r"(A[3]), "r"(B[0]), "r"(B[1]), "r"(B[2]), "r"(B[3]),  //
+                   "f"(C[0]), "f"(C[1]), "f"(C[2]), "f"(C[3]), "r"(e));
+#else
+    assert(TURBOMIND_ARCH_SM80);
+#endif
+}
+
+__inline__ __device__ void mma_sp_m16n8k32_row_col(Array<float, 4>&             d,
+                                                   const Array<nv_bfloat16, 8>& a,
+                                                   const Array<nv_bfloat16, 8>& b,
+                                                   Array<float, 4>&             c,
+                                                   uint32_t                     e)
+{
+#if TURBOMIND_ARCH_SM80
+    uint32_t const* A = reinterpret_cast<uint32_t const*>(&a);
+    uint32_t const* B = reinterpret_cast<uint32_t const*>(&b);
+    float const*    C = reinterpret_cast<float const*>(&c);
+    float*          D = reinterpret_cast<float*>(&d);
+    asm volatile("mma.sp.sync.aligned.m16n8k32.row.col.f32.bf16.bf16.f32  {%0,%1,%2,%3}, "
+                 "{%4,%5,%6,%7}, {%8,%9,%10,%11}, {%12,%13,%14,%15}, %16, 0x0;\n"
+                 : "=f"(D[0]), "=f"(D[1]), "=f"(D[2]), "=f"(D[3])
+                 : "r"(A[0]), "r"(A[1]), "r"(A[2]), "r"(A[3]), "r"(B[0]), "r"(B[1]), "r"(B[2]), "r"(B[3]),  //
+                   "f"(C[0]), "f"(C[1]), "f"(C[2]), "f"(C[3]), "r"(e));
+#else
+    assert(TURBOMIND_ARCH_SM80);
+#endif
+}
+
 }  // namespace turbomind
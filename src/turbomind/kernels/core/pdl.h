@@ -0,0 +1,70 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <utility>
+
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// Programmatic dependent launch (sm90+). A kernel launched by `LaunchKernel` with PDL enabled may start while the
+// previous kernel of the stream is still running, so it must call `PdlWait` before it reads the outputs of the
+// previous kernels or writes any global memory. What comes before (index math, smem setup) overlaps the tail of the
+// previous kernel. `PdlLaunchDependents` lets the next kernel start its own prologue once every CTA of this one has
+// called it or exited, the next kernel still waits for this one to complete in its `PdlWait`.
+//
+// Both are no-ops for the launches without PDL and on the archs before sm90
+
+// Process-wide, set once before the engines are created
+inline bool& PdlEnabled()
+{
+    static bool enabled{};
+    return enabled;
+}
+
+#if defined(__CUDACC__)
+
+__device__ __forceinline__ void PdlWait()
+{
+#if defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 900
+    asm volatile("griddepcontrol.wait;\n" ::: "memory");
+#endif
+}
+
+__device__ __forceinline__ void PdlLaunchDependents()
+{
+#if defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 900
+    asm volatile("griddepcontrol.launch_dependents;\n" ::: "memory");
+#endif
+}
+
+// `kernel<<<grid, block, smem, stream>>>(args...)`, with the programmatic stream serialization when PDL is enabled.
+// Only for the kernels calling `PdlWait` before touching global memory
+template<class... Params, class... Args>
+void LaunchKernel(void (*kernel)(Params...), dim3 grid, dim3 block, size_t smem, cudaStream_t stream, Args&&... args)
+{
+#if CUDART_VERSION >= 12030  // programmatic edges of the captured graphs
+    if (PdlEnabled()) {
+        cudaLaunchAttribute attr{};
+        attr.id                                         = cudaLaunchAttributeProgrammaticStreamSerialization;
+        attr.val.programmaticStreamSerializationAllowed = 1;
+
+        cudaLaunchConfig_t config{};
+        config.gridDim          = grid;
+        config.blockDim         = block;
+        config.dynamicSmemBytes = smem;
+        config.stream           = stream;
+        config.attrs            = &attr;
+        config.numAttrs         = 1;
+
+        cudaLaunchKernelEx(&config, kernel, std::forward<Args>(args)...);
+        return;
+    }
+#endif
+    kernel<<<grid, block, smem, stream>>>(std::forward<Args>(args)...);
+}
+
+#endif
+
+}  // namespace turbomind
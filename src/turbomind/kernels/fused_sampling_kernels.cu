@@ -0,0 +1,357 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#ifndef CUDART_VERSION
+#error CUDART_VERSION Undefined!
+#elif (CUDART_VERSION >= 11000)
+#include <cub/cub.cuh>
+#else
+#include "3rdparty/cub/cub.cuh"
+#endif
+
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
+#include "src/turbomind/kernels/philox.cuh"
+#include "src/turbomind/kernels/reduce_kernel_utils.cuh"
+#include "src/turbomind/utils/constant.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind {
+
+// Order preserving map of floats to unsigned integers
+__device__ inline uint32_t OrderedKey(float x)
+{
+    const uint32_t u = __float_as_uint(x);
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+__device__ inline float OrderedValue(uint32_t k)
+{
+    return __uint_as_float((k & 0x80000000u) ? (k & 0x7fffffffu) : ~k);
+}
+
+// Calls `f(pos, key, i)` for the k largest elements of x[0, n) with a distinct `pos` in [0, k) for each. The key of
+// the k-th largest element is found by radix select, 8 bits per pass, which stops when a bin is taken as a whole.
+// Ties at the threshold are taken in no particular order. Called by all threads of the block
+template<int BLOCK_SIZE, class T, class F>
+__device__ void ForEachTopK(const T* x, int n, int k, F f)
+{
+    __shared__ int      s_hist[256];
+    __shared__ uint32_t s_bin;
+    __shared__ int      s_remaining;
+    __shared__ bool     s_exact;
+    __shared__ int      s_gt;
+    __shared__ int      s_eq;
+
+    const int tid = threadIdx.x;
+
+    if (tid == 0) {
+        s_gt = 0;
+        s_eq = 0;
+    }
+
+    uint32_t prefix    = 0;
+    uint32_t mask      = 0;
+    int      remaining = k;
+
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        for (int i = tid; i < 256; i += BLOCK_SIZE) {
+            s_hist[i] = 0;
+        }
+        __syncthreads();
+        for (int i = tid; i < n; i += BLOCK_SIZE) {
+            const uint32_t key = OrderedKey((float)x[i]);
+            if ((key & mask) == prefix) {
+                atomicAdd(&s_hist[(key >> shift) & 0xff], 1);
+            }
+        }
+        __syncthreads();
+        if (tid == 0) {
+            int sum = 0;
+            int b   = 255;
+            while (sum + s_hist[b] < remaining) {
+                sum += s_hist[b--];
+            }
+            s_bin       = b;
+            s_remaining = remaining - sum;
+            s_exact     = s_hist[b] == remaining - sum;
+        }
+        __syncthreads();
+        prefix |= s_bin << shift;
+        mask |= 0xffu << shift;
+        remaining        = s_remaining;
+        const bool exact = s_exact;
+        __syncthreads();
+        if (exact) {
+            break;
+        }
+    }
+
+    // Candidates with a greater prefix come first, followed by `remaining` of those equal to it
+    const int n_gt = k - remaining;
+    for (int i = tid; i < n; i += BLOCK_SIZE) {
+        const uint32_t key = OrderedKey((float)x[i]);
+        const uint32_t hi  = key & mask;
+        if (hi > prefix) {
+            f(atomicAdd(&s_gt, 1), key, i);
+        }
+        else if (hi == prefix) {
+            if (const int p = atomicAdd(&s_eq, 1); p < remaining) {
+                f(n_gt + p, key, i);
+            }
+        }
+    }
+    __syncthreads();
+}
+
+// One block per sequence
+//  1. gather the top-k candidates
+//  2. sort the candidates by (logit desc, index asc), softmax, apply top-p & min-p on the prefix sums
+//  3. sample from the kept prefix
+template<typename T, int BLOCK_SIZE, int ITEMS>
+__global__ void __launch_bounds__(BLOCK_SIZE) fusedSampling(FusedSamplingParams params)
+{
+    constexpr int kMaxK = BLOCK_SIZE * ITEMS;
+    static_assert(kMaxK <= kMaxLogProb);
+
+    using BlockSort   = cub::BlockRadixSort<uint64_t, BLOCK_SIZE, ITEMS>;
+    using BlockScan   = cub::BlockScan<float, BLOCK_SIZE>;
+    using BlockReduce = cub::BlockReduce<int, BLOCK_SIZE>;
+
+    __shared__ union {
+        typename BlockSort::TempStorage   sort;
+        typename BlockScan::TempStorage   scan;
+        typename BlockReduce::TempStorage reduce;
+        uint64_t                          candidates[kMaxK];
+    } smem;
+
+    __shared__ float s_max;
+    __shared__ float s_rand;
+    __shared__ int   s_kept;
+    __shared__ float s_sum;
+    __shared__ int   s_selected;
+
+    const int bi  = blockIdx.x;
+    const int tid = threadIdx.x;
+
+    const T*  logits = (const T*)params.logits + (int64_t)bi * params.stride;
+    const int n      = params.vocab_size;
+    const int k      = min(params.top_ks[bi], min(n, kMaxK));
+
+    if (tid == 0) {
+        const int counter = params.sequence_length ? params.sequence_length[bi] : params.step;
+        s_rand            = PhiloxUniform(params.random_seed[bi], counter);
+    }
+
+    ForEachTopK<BLOCK_SIZE>(logits, n, k, [&](int pos, uint32_t key, int i) {
+        smem.candidates[pos] = (uint64_t)key << 32 | ~(uint32_t)i;
+    });
+
+    uint64_t keys[ITEMS];
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        const int r = tid * ITEMS + j;
+        keys[j]     = r < k ? smem.candidates[r] : 0;
+    }
+    __syncthreads();
+
+    BlockSort{smem.sort}.SortDescending(keys);
+    __syncthreads();
+
+    if (tid == 0) {
+        s_max = OrderedValue(keys[0] >> 32);
+    }
+    __syncthreads();
+
+    float probs[ITEMS];
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        const int r = tid * ITEMS + j;
+        probs[j]    = r < k ? __expf(OrderedValue(keys[j] >> 32) - s_max) : 0.f;
+    }
+
+    float cumsum[ITEMS];
+    float total;
+    BlockScan{smem.scan}.InclusiveSum(probs, cumsum, total);
+    __syncthreads();
+
+    // Both filters keep a prefix of the sorted candidates, the top 1 is always kept
+    const float top_p = params.top_ps ? params.top_ps[bi] : 1.f;
+    const float min_p = params.min_ps ? params.min_ps[bi] : 0.f;
+
+    int kept = 0;
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        const int r = tid * ITEMS + j;
+        kept += r < k && (r == 0 || (cumsum[j] - probs[j] <= top_p * total && probs[j] >= min_p));
+    }
+    kept = BlockReduce{smem.reduce}.Sum(kept);
+    if (tid == 0) {
+        s_kept = kept;
+    }
+    __syncthreads();
+    kept = s_kept;
+
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        if (tid * ITEMS + j == kept - 1) {
+            s_sum = cumsum[j];
+        }
+    }
+    __syncthreads();
+    const float sum = s_sum;
+
+    // Index of the first candidate with a prefix sum greater than the random number
+    const float threshold = s_rand * sum;
+    int         selected  = 0;
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        selected += tid * ITEMS + j < kept && cumsum[j] <= threshold;
+    }
+    selected = BlockReduce{smem.reduce}.Sum(selected);
+    if (tid == 0) {
+        s_selected = min(selected, kept - 1);
+    }
+    __syncthreads();
+    selected = s_selected;
+
+    T*        sampled_logprobs = (T*)params.sampled_logprobs;
+    const int n_logprobs       = sampled_logprobs && params.sampled_indexes && params.sampled_nums ? kept : 0;
+
+    PRAGMA_UNROLL
+    for (int j = 0; j < ITEMS; ++j) {
+        const int r   = tid * ITEMS + j;
+        int       idx = ~(uint32_t)keys[j];
+        if (params.token_ids && r < kept) {
+            idx = params.token_ids[(int64_t)bi * params.stride + idx];
+        }
+        if (r == selected) {
+            params.output_ids[bi] = idx;
+            if (params.sequence_length) {
+                params.sequence_length[bi] += 1;
+            }
+        }
+        if (r < n_logprobs) {
+            sampled_logprobs[bi * kMaxLogProb + r]       = (T)__logf(probs[j] / sum);
+            params.sampled_indexes[bi * kMaxLogProb + r] = idx;
+        }
+    }
+    if (n_logprobs && tid == 0) {
+        params.sampled_nums[bi] = n_logprobs;
+    }
+}
+
+template<typename T, int BLOCK_SIZE>
+__global__ void __launch_bounds__(BLOCK_SIZE)
+    topKCandidates(T* values, int* ids, const T* logits, int ld, int n, int k, int id_offset)
+{
+    const int bi = blockIdx.x;
+
+    logits += (int64_t)bi * ld;
+    values += (int64_t)bi * k;
+    ids += (int64_t)bi * k;
+
+    if (n > 0) {
+        ForEachTopK<BLOCK_SIZE>(logits, n, min(n, k), [&](int pos, uint32_t, int i) {
+            values[pos] = logits[i];
+            ids[pos]    = id_offset + i;
+        });
+    }
+
+    for (int i = max(n, 0) + threadIdx.x; i < k; i += BLOCK_SIZE) {
+        values[i] = -getMaxValue<T>();
+        ids[i]    = id_offset;
+    }
+}
+
+template<typename T, int BLOCK_SIZE>
+__global__ void __launch_bounds__(BLOCK_SIZE) greedySampling(GreedySamplingParams params)
+{
+    using Pair        = cub::KeyValuePair<int, float>;
+    using BlockReduce = cub::BlockReduce<Pair, BLOCK_SIZE>;
+
+    __shared__ typename BlockReduce::TempStorage temp_storage;
+
+    const int bi = blockIdx.x;
+
+    const T*        logits = (const T*)params.logits + (int64_t)bi * params.stride;
+    const uint32_t* mask   = params.token_bitmask;
+    if (mask) {
+        mask += (int64_t)bi * ((params.vocab_size + 31) / 32);
+    }
+
+    // the first maximum of the thread, masked logits only win when every logit is masked
+    Pair best{0, -INFINITY};
+    for (int i = threadIdx.x; i < params.vocab_size; i += BLOCK_SIZE) {
+        float x = (float)logits[i];
+        if (mask && !(mask[i / 32] >> (i % 32) & 1)) {
+            x = -getMaxValue<float>();
+        }
+        if (x > best.value) {
+            best = {i, x};
+        }
+    }
+    best = BlockReduce{temp_storage}.Reduce(best, cub::ArgMax{});
+
+    if (threadIdx.x == 0) {
+        int idx = best.key;
+        if (params.token_ids) {
+            idx = params.token_ids[(int64_t)bi * params.stride + idx];
+        }
+        params.output_ids[bi] = idx;
+        if (params.sequence_length) {
+            params.sequence_length[bi] += 1;
+        }
+        if (params.finished && params.sequence_limit_length) {
+            params.finished[bi] |= params.step >= params.sequence_limit_length[bi];
+        }
+    }
+}
+
+template<typename T>
+void invokeFusedSampling(const FusedSamplingParams& params, cudaStream_t stream)
+{
+    constexpr int block = 256;
+    if (params.max_top_k <= block) {
+        fusedSampling<T, block, 1><<<params.batch_size, block, 0, stream>>>(params);
+    }
+    else {
+        static_assert(block * 4 == kFusedSamplingMaxTopK);
+        fusedSampling<T, block, 4><<<params.batch_size, block, 0, stream>>>(params);
+    }
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void invokeGreedySampling(const GreedySamplingParams& params, cudaStream_t stream)
+{
+    // a wide block per sequence, the small batches of greedy decoding leave most of the SMs idle otherwise
+    constexpr int block = 1024;
+    greedySampling<T, block><<<params.batch_size, block, 0, stream>>>(params);
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void invokeTopKCandidates(
+    T* values, int* ids, const T* logits, int ld, int n, int k, int id_offset, int batch_size, cudaStream_t stream)
+{
+    constexpr int block = 256;
+    topKCandidates<T, block><<<batch_size, block, 0, stream>>>(values, ids, logits, ld, n, k, id_offset);
+    sync_check_cuda_error();
+}
+
+#ifdef ENABLE_FP32
+template void invokeFusedSampling<float>(const FusedSamplingParams& params, cudaStream_t stream);
+template void invokeGreedySampling<float>(const GreedySamplingParams& params, cudaStream_t stream);
+template void invokeTopKCandidates(float*, int*, const float*, int, int, int, int, int, cudaStream_t);
+#endif
+template void invokeFusedSampling<half>(const FusedSamplingParams& params, cudaStream_t stream);
+template void invokeGreedySampling<half>(const GreedySamplingParams& params, cudaStream_t stream);
+template void invokeTopKCandidates(half*, int*, const half*, int, int, int, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeFusedSampling<nv_bfloat16>(const FusedSamplingParams& params, cudaStream_t stream);
+template void invokeGreedySampling<nv_bfloat16>(const GreedySamplingParams& params, cudaStream_t stream);
+template void
+invokeTopKCandidates(nv_bfloat16*, int*, const nv_bfloat16*, int, int, int, int, int, cudaStream_t);
+#endif
+
+}  // namespace turbomind
@@ -0,0 +1,71 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <stdint.h>
+
+namespace turbomind {
+
+// max top-k of the fused path
+constexpr int kFusedSamplingMaxTopK = 1024;
+
+struct FusedSamplingParams {
+    const void*     logits;     // [batch_size, stride]
+    const int*      token_ids;  // [batch_size, stride], token id of each logit, optional
+    int             stride;
+    int             vocab_size;
+    const int*      top_ks;  // in (0, kFusedSamplingMaxTopK]
+    const float*    top_ps;
+    const float*    min_ps;
+    int             max_top_k;
+    const uint64_t* random_seed;  // [batch_size]
+    int             step;         // counter of the random draws when `sequence_length` is missing
+    int             batch_size;
+    int*            output_ids;
+    int*            sequence_length;
+    void*           sampled_logprobs;
+    uint32_t*       sampled_indexes;
+    uint32_t*       sampled_nums;
+};
+
+// Top-k/top-p/min-p sampling in a single pass per sequence. The top-k candidates are found with a radix select over
+// the vocab and only the candidates are sorted, replacing the top-k filter, top-p/min-p filter and sampling kernels
+// for batches where every sequence has a top-k. The outputs match `invokeSampling`.
+template<typename T>
+void invokeFusedSampling(const FusedSamplingParams& params, cudaStream_t stream);
+
+struct GreedySamplingParams {
+    const void*     logits;         // [batch_size, stride]
+    const int*      token_ids;      // [batch_size, stride], token id of each logit, optional
+    const uint32_t* token_bitmask;  // [batch_size, (vocab_size + 31) / 32], allowed tokens, optional
+    int             stride;
+    int             vocab_size;
+    int             batch_size;
+    int             step;
+    int*            output_ids;
+    int*            sequence_length;
+    bool*           finished;
+    const uint32_t* sequence_limit_length;
+};
+
+// Argmax of each sequence with the token bitmask applied on the fly, the length limit is checked in the same kernel.
+// Replaces the logits processors, sampling and stop criteria for batches where every sequence is greedy, ties are
+// broken by the lowest index.
+template<typename T>
+void invokeGreedySampling(const GreedySamplingParams& params, cudaStream_t stream);
+
+// Top-k of each row of logits [batch_size, ld] in no particular order. Ids of the logits are offset by `id_offset`
+// and only the first `n` columns are considered, missing candidates (n < k) are filled with the lowest value.
+template<typename T>
+void invokeTopKCandidates(T*           values,  // [batch_size, k]
+                          int*         ids,     // [batch_size, k]
+                          const T*     logits,
+                          int          ld,
+                          int          n,
+                          int          k,
+                          int          id_offset,
+                          int          batch_size,
+                          cudaStream_t stream);
+
+}  // namespace turbomind
@@ -0,0 +1,90 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/gemm/arch.h"
+#include "src/turbomind/kernels/gemm/arch/mma_sm80.h"
+#include "src/turbomind/kernels/gemm/arch/operand_sm80_s16832.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/epilogue.h"
+#include "src/turbomind/kernels/gemm/gemm_universal.h"
+#include "src/turbomind/kernels/gemm/iterator_sm80.h"
+#include "src/turbomind/kernels/gemm/mainloop_sm80_v2.h"
+#include "src/turbomind/kernels/gemm/thread_group_map.h"
+#include "src/turbomind/kernels/gemm/tiled_mma.h"
+#include "src/turbomind/kernels/gemm/transform.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm::sm80_s16832 {
+
+// int8 x int8 -> int32 with per-row scales of A and per-column scales of B applied in the epilogue
+template<class Arch,
+         class A,
+         class B,
+         Order order_C,
+         class Tc,
+         Striding mode_A,
+         Striding mode_B,
+         Striding mode_C,
+         class CtaMap_>
+struct Sm80_s16832 {
+
+    static_assert(A::SmemCopyAtom::K == B::SmemCopyAtom::K);
+
+    static constexpr int SMEM_M = A::SmemCopyAtom::M / A::SmemCopyAtom::kFragNum;
+    static constexpr int SMEM_N = B::SmemCopyAtom::M / B::SmemCopyAtom::kFragNum;
+    static constexpr int SMEM_K = A::SmemCopyAtom::K;
+
+    template<int CTA_M,
+             int CTA_N,
+             int CTA_K,
+             int TG_M,
+             int TG_N,
+             int TG_K,
+             class PolicyA,
+             class PolicyB,
+             int  Stages,
+             bool SplitK,
+             int  TILE_C_M_    = -1,
+             int  TILE_C_N_    = -1,
+             bool FusePrefecth = true>
+    struct Type {
+
+        using Partition = Blocked<TG_M, TG_N, kColMajor>;
+        using MMA_Map   = MMA_Map<CTA_M, CTA_N, CTA_K, SMEM_M, SMEM_N, SMEM_K, Partition, TG_K>;
+        using MMA       = Tiled_MMA_v2<SM80_MMA_16x8x32_S32_S8_S8_S32_TN, MMA_Map>;
+
+        using Mainloop = MainloopSm80_v2<MMA,
+                                         A,
+                                         IteratorSm80<mode_A, PolicyA>,
+                                         Transform_Default,
+                                         VoidOperand,
+                                         1,
+                                         B,
+                                         IteratorSm80<mode_B, PolicyB>,
+                                         Transform_Default,
+                                         VoidOperand,
+                                         1,
+                                         Stages,
+                                         FusePrefecth>;
+
+        static constexpr int TILE_C_M = TILE_C_M_ == -1 ? CTA_M : TILE_C_M_;
+        static constexpr int TILE_C_N = TILE_C_N_ == -1 ? CTA_N : TILE_C_N_;
+
+        using Epilogue = gemm::Epilogue_<Tc,
+                                         CTA_M,
+                                         CTA_N,
+                                         TILE_C_M,
+                                         TILE_C_N,
+                                         MMA::kThreadCount,
+                                         Rearrange<MMA>,
+                                         sm80_s16816::Operand_C<float, order_C>,
+                                         mode_C,
+                                         SplitK,
+                                         true>;  // scale
+
+        using Kernel = GemmUniversal<Arch, Mainloop, Epilogue, CtaMap_>;
+    };
+};
+
+}  // namespace turbomind::gemm::sm80_s16832
@@ -0,0 +1,64 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/gemm/arch.h"
+#include "src/turbomind/kernels/gemm/arch/mma_sm90.h"
+#include "src/turbomind/kernels/gemm/arch/operand_sm80_s16816.h"
+#include "src/turbomind/kernels/gemm/arch/operand_sm90_gmma.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/epilogue.h"
+#include "src/turbomind/kernels/gemm/gemm_universal_sm90.h"
+#include "src/turbomind/kernels/gemm/iterator_sm80.h"
+#include "src/turbomind/kernels/gemm/mainloop_sm90.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm::sm90_gmma {
+
+// Dense K-major A & B, the smem layouts of the sm80 operands are reused for 16-bit types. With `scale_` the
+// accumulators are multiplied by per-row scales of A and per-column scales of B in the epilogue (fp8 W8A8)
+template<class Arch,
+         class Dtype,
+         class A,
+         class B,
+         Order order_C,
+         class Tc,
+         Striding mode_A,
+         Striding mode_B,
+         Striding mode_C,
+         class CtaMap_,
+         bool scale_ = false>
+struct Sm90_gmma {
+
+    template<int CTA_M, int CTA_N, int CTA_K, int TG_M, int TG_N, class PolicyA, class PolicyB, int Stages>
+    struct Type {
+
+        using Mainloop = MainloopSm90<SM90_GMMA_64x64_F32_TN<Dtype>,
+                                      TG_M,
+                                      TG_N,
+                                      A,
+                                      IteratorSm80<mode_A, PolicyA>,
+                                      B,
+                                      IteratorSm80<mode_B, PolicyB>,
+                                      CTA_M,
+                                      CTA_N,
+                                      CTA_K,
+                                      Stages>;
+
+        using Epilogue = gemm::Epilogue_<Tc,
+                                         CTA_M,
+                                         CTA_N,
+                                         CTA_M,
+                                         CTA_N,
+                                         Mainloop::WARPS * WARP_SIZE,
+                                         RearrangeGmma<Mainloop>,
+                                         sm80_s16816::Operand_C<float, order_C>,
+                                         mode_C,
+                                         false,
+                                         scale_>;
+
+        using Kernel = GemmUniversalSm90<Arch, Mainloop, Epilogue, CtaMap_>;
+    };
+};
+
+}  // namespace turbomind::gemm::sm90_gmma
@@ -0,0 +1,188 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/array.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/data_type.h"
+#include "src/turbomind/kernels/core/smem.h"
+#include "src/turbomind/kernels/gemm/desc.h"
+#include <cassert>
+#include <type_traits>
+
+#if ENABLE_BF16
+#include <cuda_bf16.h>
+#endif
+
+// `wgmma` is only available with the arch specific `sm_90a` target
+#if defined(__CUDA_ARCH_FEAT_SM90_ALL)
+#define TURBOMIND_ARCH_SM90A 1
+#else
+#define TURBOMIND_ARCH_SM90A 0
+#endif
+
+namespace turbomind::gemm {
+
+// Matrix descriptor of a K-major operand in shared memory with 128B swizzle, the canonical layout is rows of 128 bytes
+// where the 16B chunks of the i-th row are xor-ed with (i % 8), 8-row groups are `stride` bytes apart. For 16-bit types
+// this is exactly `SmemLayoutV2<S, 64, 8, 64, Swizzle<3, 3, 3>>`. The base of each 8-row group must be 1024B aligned.
+__device__ inline uint64_t make_gmma_desc_sw128(uint32_t smem_addr, uint32_t stride)
+{
+    uint64_t desc = 0;
+    desc |= (uint64_t)((smem_addr & 0x3FFFF) >> 4);
+    desc |= (uint64_t)1 << 16;  // leading byte offset, unused for swizzled K-major layouts
+    desc |= (uint64_t)((stride & 0x3FFFF) >> 4) << 32;
+    desc |= (uint64_t)1 << 62;  // 128B swizzle
+    return desc;
+}
+
+__device__ inline void gmma_fence()
+{
+#if TURBOMIND_ARCH_SM90A
+    asm volatile("wgmma.fence.sync.aligned;\n" ::: "memory");
+#endif
+}
+
+__device__ inline void gmma_commit()
+{
+#if TURBOMIND_ARCH_SM90A
+    asm volatile("wgmma.commit_group.sync.aligned;\n" ::: "memory");
+#endif
+}
+
+template<int N>
+__device__ inline void gmma_wait()
+{
+#if TURBOMIND_ARCH_SM90A
+    asm volatile("wgmma.wait_group.sync.aligned %0;\n" ::"n"(N) : "memory");
+#endif
+}
+
+// Keep the compiler from moving accesses of the accumulators across async mma instructions
+template<int N>
+__device__ inline void gmma_fence_operand(Array<float, N>& x)
+{
+    PRAGMA_UNROLL
+    for (int i = 0; i < N; ++i) {
+        asm volatile("" : "+f"(x[i])::"memory");
+    }
+}
+
+#define TM_GMMA_64x64_OUTPUTS                                                                                          \
+    "+f"(d[0]), "+f"(d[1]), "+f"(d[2]), "+f"(d[3]), "+f"(d[4]), "+f"(d[5]), "+f"(d[6]), "+f"(d[7]), "+f"(d[8]),        \
+        "+f"(d[9]), "+f"(d[10]), "+f"(d[11]), "+f"(d[12]), "+f"(d[13]), "+f"(d[14]), "+f"(d[15]), "+f"(d[16]),         \
+        "+f"(d[17]), "+f"(d[18]), "+f"(d[19]), "+f"(d[20]), "+f"(d[21]), "+f"(d[22]), "+f"(d[23]), "+f"(d[24]),        \
+        "+f"(d[25]), "+f"(d[26]), "+f"(d[27]), "+f"(d[28]), "+f"(d[29]), "+f"(d[30]), "+f"(d[31])
+
+// transpose flags of the operands are only valid for 16-bit types
+#define TM_GMMA_64x64_ASM(k, type, trans)                                                                              \
+    "{\n"                                                                                                              \
+    ".reg .pred p;\n"                                                                                                  \
+    "setp.ne.b32 p, %34, 0;\n"                                                                                         \
+    "wgmma.mma_async.sync.aligned.m64n64" k ".f32." type "." type " "                                                  \
+    "{%0, %1, %2, %3, %4, %5, %6, %7, %8, %9, %10, %11, %12, %13, %14, %15, "                                          \
+    "%16, %17, %18, %19, %20, %21, %22, %23, %24, %25, %26, %27, %28, %29, %30, %31}, "                                \
+    "%32, %33, p, 1, 1" trans ";\n"                                                                                    \
+    "}\n"
+
+// D += A * B, both A (64xK) and B (64xK) are K-major in shared memory, issued by a warpgroup (128 threads). K is 32
+// bytes of the input type, i.e. 16 for f16/bf16 and 32 for fp8
+template<class T>
+struct SM90_GMMA_64x64_F32_TN {
+    static constexpr int M = 64;
+    static constexpr int N = 64;
+    static constexpr int K = 256 / bitsof<T>;
+
+    static constexpr int kThreadCount = 128;
+
+    static constexpr auto kOpClass = OpClass::kGMMA;
+
+    using FragC = Array<float, M * N / kThreadCount>;
+
+    __device__ static void fma(FragC& d, uint64_t desc_a, uint64_t desc_b)
+    {
+#if TURBOMIND_ARCH_SM90A
+        if constexpr (std::is_same_v<T, half>) {
+            asm volatile(TM_GMMA_64x64_ASM("k16", "f16", ", 0, 0")
+                         : TM_GMMA_64x64_OUTPUTS
+                         : "l"(desc_a), "l"(desc_b), "r"(1));
+        }
+#if ENABLE_BF16
+        else if constexpr (std::is_same_v<T, nv_bfloat16>) {
+            asm volatile(TM_GMMA_64x64_ASM("k16", "bf16", ", 0, 0")
+                         : TM_GMMA_64x64_OUTPUTS
+                         : "l"(desc_a), "l"(desc_b), "r"(1));
+        }
+#endif
+        else if constexpr (std::is_same_v<T, fp8_e4m3>) {
+            asm volatile(TM_GMMA_64x64_ASM("k32", "e4m3", "")
+                         : TM_GMMA_64x64_OUTPUTS
+                         : "l"(desc_a), "l"(desc_b), "r"(1));
+        }
+        else {
+            static_assert(!std::is_same_v<T, T>, "not implemented");
+        }
+#else
+        assert(TURBOMIND_ARCH_SM90A);
+#endif
+    }
+
+    // (m, n) of the i-th pair of consecutive accumulators of the thread
+    __device__ static int2 offset_C(int thread_idx, int i)
+    {
+        const int warp_id = thread_idx % kThreadCount / WARP_SIZE;
+        const int lane_id = thread_idx % WARP_SIZE;
+        return {warp_id * 16 + lane_id / 4 + i % 2 * 8, i / 2 * 8 + lane_id % 4 * 2};
+    }
+};
+
+#undef TM_GMMA_64x64_ASM
+#undef TM_GMMA_64x64_OUTPUTS
+
+// mbarrier with CTA scope
+__device__ inline void mbarrier_init(uint64_t* bar, int count)
+{
+#if TURBOMIND_ARCH_SM90
+    asm volatile("mbarrier.init.shared::cta.b64 [%0], %1;\n" ::"r"(cast_smem_ptr_to_uint(bar)), "r"(count));
+#endif
+}
+
+__device__ inline void mbarrier_arrive(uint64_t* bar)
+{
+#if TURBOMIND_ARCH_SM90
+    asm volatile("mbarrier.arrive.shared::cta.b64 _, [%0];\n" ::"r"(cast_smem_ptr_to_uint(bar)) : "memory");
+#endif
+}
+
+// Arrive when all prior `cp.async` of the thread have completed, counts as 1 of the expected arrivals
+__device__ inline void mbarrier_arrive_cp_async(uint64_t* bar)
+{
+#if TURBOMIND_ARCH_SM90
+    asm volatile("cp.async.mbarrier.arrive.noinc.shared::cta.b64 [%0];\n" ::"r"(cast_smem_ptr_to_uint(bar))
+                 : "memory");
+#endif
+}
+
+__device__ inline void mbarrier_wait(uint64_t* bar, int phase)
+{
+#if TURBOMIND_ARCH_SM90
+    asm volatile("{\n"
+                 ".reg .pred p;\n"
+                 "WAIT:\n"
+                 "mbarrier.try_wait.parity.shared::cta.b64 p, [%0], %1;\n"
+                 "@!p bra WAIT;\n"
+                 "}\n" ::"r"(cast_smem_ptr_to_uint(bar)),
+                 "r"(phase)
+                 : "memory");
+#endif
+}
+
+// Make generic proxy writes to shared memory visible to the async proxy (`wgmma` operands)
+__device__ inline void fence_proxy_async_smem()
+{
+#if TURBOMIND_ARCH_SM90
+    asm volatile("fence.proxy.async.shared::cta;\n" ::: "memory");
+#endif
+}
+
+}  // namespace turbomind::gemm
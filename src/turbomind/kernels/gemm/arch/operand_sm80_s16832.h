@@ -0,0 +1,63 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/layout.h"
+#include "src/turbomind/kernels/core/meta.h"
+#include "src/turbomind/kernels/gemm/arch/smem_copy_sm80.h"
+#include "src/turbomind/kernels/gemm/iterator.h"
+#include "src/turbomind/kernels/gemm/operand.h"
+#include "src/turbomind/kernels/gemm/smem_copy.h"
+#include "src/turbomind/kernels/gemm/types.h"
+#include <type_traits>
+
+namespace turbomind::gemm {
+
+namespace sm80_s16832 {
+
+// Same swizzling as the 16-bit operands of `sm80_s16816` in bytes, 16 elements per 16B chunk
+struct GetSmemLayout {
+    template<int M, int K>
+    static constexpr auto apply(pair<M, K>)
+    {
+        constexpr int2 cs = mk2cs<kRowMajor>(M, K);
+        constexpr int  S0 = 8;
+        constexpr int  C0 = cs.x >= 128 ? 128 : (cs.x >= 64 ? 64 : 32);
+        using _Small      = std::conditional_t<C0 == 64, Swizzle<2, 4, 3>, Swizzle<1, 4, 3>>;
+        using Swizzle     = std::conditional_t<C0 == 128, Swizzle<3, 4, 3>, _Small>;
+        return SmemLayoutV2<cs.y, cs.x, S0, C0, Swizzle>{};
+    }
+};
+
+// (m, k), K-major only, `ldmatrix` can't transpose 8-bit elements
+template<class T>
+struct Operand_A {
+    using Dtype = T;
+
+    static constexpr Pack  kPack  = 0;
+    static constexpr Order kOrder = kRowMajor;
+
+    using SmemCopyAtom = LDSM_SM80_8x16<T, 16, 32, kColMajor>;
+
+    using GetSmemLayout = sm80_s16832::GetSmemLayout;
+    using GetGmemIter   = GetGmemIter;
+};
+
+// (n, k), K-major only
+template<class T>
+struct Operand_B {
+    using Dtype = T;
+
+    static constexpr Pack  kPack  = 0;
+    static constexpr Order kOrder = kRowMajor;
+
+    using SmemCopyAtom = LDSM_SM80_8x16<T, 16, 32, kRowMajor>;
+
+    using GetSmemLayout = sm80_s16832::GetSmemLayout;
+    using GetGmemIter   = GetGmemIter;
+};
+
+}  // namespace sm80_s16832
+
+}  // namespace turbomind::gemm
@@ -0,0 +1,49 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/data_type.h"
+#include "src/turbomind/kernels/core/layout.h"
+#include "src/turbomind/kernels/core/meta.h"
+#include "src/turbomind/kernels/gemm/iterator.h"
+#include "src/turbomind/kernels/gemm/operand.h"
+#include "src/turbomind/kernels/gemm/smem_copy.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm::sm90_gmma {
+
+// K-major tile made of 128B swizzle atoms (8 rows of 128 bytes), the swizzle is applied to 16B chunks so the number of
+// bits of the element offset depends on the element size. Equals the sm80 layout for 16-bit types
+template<class T>
+struct GetSmemLayout_SW128 {
+    template<int S, int C>
+    static constexpr auto apply(pair<S, C>)
+    {
+        constexpr int C0 = 1024 / bitsof<T>;
+        constexpr int B  = bitsof<T> == 8 ? 4 : 3;
+        return SmemLayoutV2<S, C, 8, C0, Swizzle<3, B, 3>>{};
+    }
+};
+
+// (m, k) for A and (n, k) for B, `wgmma` reads the operands from smem through descriptors so no copy atom is needed
+template<class T>
+struct Operand_K {
+    using Dtype = T;
+
+    static constexpr Pack  kPack  = 0;
+    static constexpr Order kOrder = kRowMajor;
+
+    using SmemCopyAtom = VoidSmemCopyAtom;
+
+    struct GetSmemLayout {
+        template<int M, int K>
+        static constexpr auto apply(pair<M, K>)
+        {
+            return GetSmemLayout_SW128<T>::apply(pair<M, K>{});
+        }
+    };
+
+    using GetGmemIter = GetGmemIter;
+};
+
+}  // namespace turbomind::gemm::sm90_gmma
@@ -172,6 +172,64 @@ struct LDSM_SM75_8x8 {
     }
 };
 
+// 8x8 `ldmatrix` tiles of 8-bit elements read as 8x16, K-major and without transposition
+template<class T, int M_, int K_, Order mat_order>
+struct LDSM_SM80_8x16 {
+    static_assert(bitsof<T> == 8);
+
+    static constexpr int M = M_;
+    static constexpr int K = K_;
+
+    static constexpr int iM = M / 8;
+    static constexpr int iK = K / 16;
+
+    static constexpr int kFragNum = 1;
+
+    using Frag = Array<T, 4 * iM * iK>;
+
+    __device__ static int2 get_offset(int thread_idx)
+    {
+        const int lane_id = thread_idx % WARP_SIZE;
+        int       c, s;
+        if constexpr (mat_order == kColMajor) {
+            s = lane_id % 16;
+            c = lane_id / 16 * 16;
+        }
+        else {
+            s = lane_id / 16 * 8 + lane_id % 8;
+            c = (lane_id & 8) * 2;
+        }
+        int2 mk = cs2mk<kRowMajor>(c, s);
+#if __CUDA_ARCH__ <= 750  // wrap ptrs around for sm_75
+        mk.x %= M;
+        mk.y %= K;
+#endif
+        return mk;
+    }
+
+    template<class S, class D>
+    __device__ static void copy(S&& src_ptr, D&& dst_ptr, bool)
+    {
+        if constexpr (sizeof(Frag) == 16) {
+            LDSM_x4<false>::apply((S &&) src_ptr, (D &&) dst_ptr);
+        }
+        else if constexpr (sizeof(Frag) == 8) {
+            LDSM_x2<false>::apply((S &&) src_ptr, (D &&) dst_ptr);
+        }
+        else if constexpr (sizeof(Frag) == 4) {
+            LDSM_x1<false>::apply((S &&) src_ptr, (D &&) dst_ptr);
+        }
+        else {
+            static_assert(sizeof(S) != sizeof(S), "not implemented");
+        }
+    }
+
+    __device__ static int2 unique(int thread_idx, int pack_idx)
+    {
+        return {pack_idx * WARP_SIZE + thread_idx % WARP_SIZE, 0};
+    }
+};
+
 template<class T>
 struct SmemCopy_MMA_16816_U {  // (M, K)
     static constexpr int M = 16;
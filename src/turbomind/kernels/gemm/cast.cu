@@ -1,9 +1,13 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include "cub/block/block_reduce.cuh"
+
 #include "src/turbomind/kernels/core/array_ops.h"
 #include "src/turbomind/kernels/core/common.h"
 #include "src/turbomind/kernels/core/data_type.h"
 #include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/gemm/cast.h"
+#include <cuda_fp8.h>
 
 namespace turbomind {
 
@@ -141,6 +145,203 @@ void fuse_scales_and_zeros(half* fused, const half* scales, half* zeros, size_t
     fuse_scales_and_zeros_kernel<4><<<256, 256, 0, st>>>(fused, scales, zeros, n);
 }
 
+template<int VecSize, int BlockDim, class T>
+__global__ void quant_fp8_rowwise_kernel(fp8_e4m3* dst, int dst_ld, float* scales, const T* src, int src_ld, int cols)
+{
+    const int ri = blockIdx.x;
+    const int di = threadIdx.x * VecSize;
+
+    src += (int64_t)src_ld * ri;
+    dst += (int64_t)dst_ld * ri;
+
+    Array<T, VecSize> vec;
+
+    float amax = 0.f;
+    for (int i = di; i < cols; i += BlockDim * VecSize) {
+        Ldg(vec, &src[i]);
+        PRAGMA_UNROLL
+        for (int c = 0; c < VecSize; ++c) {
+            amax = fmaxf(amax, fabsf((float)vec[c]));
+        }
+    }
+
+    using BlockReduce = cub::BlockReduce<float, BlockDim>;
+    __shared__ typename BlockReduce::TempStorage temp_storage;
+
+    amax = BlockReduce{temp_storage}.Reduce(amax, cub::Max{});
+
+    __shared__ float shared_scale;
+
+    if (threadIdx.x == 0) {
+        // 448 is the max finite value of e4m3
+        shared_scale = amax > 0.f ? amax / 448.f : 1.f;
+        scales[ri]   = shared_scale;
+    }
+
+    __syncthreads();
+
+    const float inv_scale = 1.f / shared_scale;
+
+    Array<fp8_e4m3, VecSize> out;
+    for (int i = di; i < cols; i += BlockDim * VecSize) {
+        Ldg(vec, &src[i]);
+        PRAGMA_UNROLL
+        for (int c = 0; c < VecSize; c += 2) {
+            const float2 x{(float)vec[c] * inv_scale, (float)vec[c + 1] * inv_scale};
+            (__nv_fp8x2_storage_t&)out[c] = __nv_cvt_float2_to_fp8x2(x, __NV_SATFINITE, __NV_E4M3);
+        }
+        Store(&dst[i], out);
+    }
+}
+
+template<class T>
+void quant_fp8_rowwise(
+    fp8_e4m3* dst, int dst_ld, float* scales, const T* src, int src_ld, int rows, int cols, cudaStream_t st)
+{
+    if (rows == 0) {
+        return;
+    }
+
+    constexpr int kVecSize = 16 / sizeof(T);
+
+    constexpr int block = 256;
+
+    quant_fp8_rowwise_kernel<kVecSize, block><<<rows, block, 0, st>>>(dst, dst_ld, scales, src, src_ld, cols);
+}
+
+template void quant_fp8_rowwise(
+    fp8_e4m3* dst, int dst_ld, float* scales, const half* src, int src_ld, int rows, int cols, cudaStream_t st);
+template void quant_fp8_rowwise(
+    fp8_e4m3* dst, int dst_ld, float* scales, const nv_bfloat16* src, int src_ld, int rows, int cols, cudaStream_t st);
+
+template<int VecSize, int BlockDim, class T>
+__global__ void quant_s8_rowwise_kernel(int8_t* dst, int dst_ld, float* scales, const T* src, int src_ld, int cols)
+{
+    const int ri = blockIdx.x;
+    const int di = threadIdx.x * VecSize;
+
+    src += (int64_t)src_ld * ri;
+    dst += (int64_t)dst_ld * ri;
+
+    Array<T, VecSize> vec;
+
+    float amax = 0.f;
+    for (int i = di; i < cols; i += BlockDim * VecSize) {
+        Ldg(vec, &src[i]);
+        PRAGMA_UNROLL
+        for (int c = 0; c < VecSize; ++c) {
+            amax = fmaxf(amax, fabsf((float)vec[c]));
+        }
+    }
+
+    using BlockReduce = cub::BlockReduce<float, BlockDim>;
+    __shared__ typename BlockReduce::TempStorage temp_storage;
+
+    amax = BlockReduce{temp_storage}.Reduce(amax, cub::Max{});
+
+    __shared__ float shared_scale;
+
+    if (threadIdx.x == 0) {
+        shared_scale = amax > 0.f ? amax / 127.f : 1.f;
+        scales[ri]   = shared_scale;
+    }
+
+    __syncthreads();
+
+    const float inv_scale = 1.f / shared_scale;
+
+    Array<int8_t, VecSize> out;
+    for (int i = di; i < cols; i += BlockDim * VecSize) {
+        Ldg(vec, &src[i]);
+        PRAGMA_UNROLL
+        for (int c = 0; c < VecSize; ++c) {
+            out[c] = (int8_t)fminf(fmaxf(rintf((float)vec[c] * inv_scale), -127.f), 127.f);
+        }
+        Store(&dst[i], out);
+    }
+}
+
+template<class T>
+void quant_s8_rowwise(
+    int8_t* dst, int dst_ld, float* scales, const T* src, int src_ld, int rows, int cols, cudaStream_t st)
+{
+    if (rows == 0) {
+        return;
+    }
+
+    constexpr int kVecSize = 16 / sizeof(T);
+
+    constexpr int block = 256;
+
+    quant_s8_rowwise_kernel<kVecSize, block><<<rows, block, 0, st>>>(dst, dst_ld, scales, src, src_ld, cols);
+}
+
+template void quant_s8_rowwise(
+    int8_t* dst, int dst_ld, float* scales, const half* src, int src_ld, int rows, int cols, cudaStream_t st);
+template void quant_s8_rowwise(
+    int8_t* dst, int dst_ld, float* scales, const nv_bfloat16* src, int src_ld, int rows, int cols, cudaStream_t st);
+
+__global__ void quant_u8_groupwise_kernel(
+    uint16_t* dst, half* scales, half* zeros, const half* src, int n, int group_size, float max_level)
+{
+    const int ni = threadIdx.x + blockIdx.x * blockDim.x;
+    const int gi = blockIdx.y;
+
+    if (ni >= n) {
+        return;
+    }
+
+    const int64_t offset = (int64_t)gi * group_size * n + ni;
+
+    src += offset;
+    dst += offset;
+
+    // the range always covers 0 so that the zero point is in [0, max_level]
+    float lo = 0.f;
+    float hi = 0.f;
+    for (int i = 0; i < group_size; ++i) {
+        const float x = __half2float(src[(int64_t)i * n]);
+        lo            = fminf(lo, x);
+        hi            = fmaxf(hi, x);
+    }
+
+    // quantize with the scale rounded to f16, which is what the kernels dequantize with
+    const float scale = __half2float(__float2half(hi > lo ? (hi - lo) / max_level : 1.f));
+    const float zero  = fminf(rintf(-lo / scale), max_level);
+
+    scales[(int64_t)gi * n + ni] = __float2half(scale);
+    zeros[(int64_t)gi * n + ni]  = __float2half(zero);
+
+    const float inv_scale = 1.f / scale;
+
+    for (int i = 0; i < group_size; ++i) {
+        const float x       = __half2float(src[(int64_t)i * n]);
+        dst[(int64_t)i * n] = (uint16_t)fminf(fmaxf(rintf(x * inv_scale) + zero, 0.f), max_level);
+    }
+}
+
+void quant_u8_groupwise(uint16_t*    dst,
+                        half*        scales,
+                        half*        zeros,
+                        const half*  src,
+                        int          k,
+                        int          n,
+                        int          group_size,
+                        cudaStream_t st,
+                        int          bits)
+{
+    if (k == 0 || n == 0) {
+        return;
+    }
+
+    constexpr int block = 256;
+    const dim3    grid(ceil_div(n, block), k / group_size);
+
+    const float max_level = (1 << bits) - 1;
+
+    quant_u8_groupwise_kernel<<<grid, block, 0, st>>>(dst, scales, zeros, src, n, group_size, max_level);
+}
+
 template<int VecSize, class T>
 __global__ void
 interleave_output_dims_kernel(T* __restrict__ fused, const T* __restrict__ a, const T* __restrict__ b, int m, int k)
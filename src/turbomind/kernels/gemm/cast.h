@@ -15,6 +15,28 @@ void transpose_u4(uint4_t* dst, const uint4_t* src, int s, int c, cudaStream_t s
 
 void fuse_scales_and_zeros(half* fused, const half* scales, half* zeros, size_t n, cudaStream_t st = {});
 
+// Symmetric per-row quantization to fp8 (e4m3), `scales[i]` receives the f32 dequantization scale of the i-th row
+template<class T>
+void quant_fp8_rowwise(
+    fp8_e4m3* dst, int dst_ld, float* scales, const T* src, int src_ld, int rows, int cols, cudaStream_t st = {});
+
+// Symmetric per-row quantization to int8, `scales[i]` receives the f32 dequantization scale of the i-th row
+template<class T>
+void quant_s8_rowwise(
+    int8_t* dst, int dst_ld, float* scales, const T* src, int src_ld, int rows, int cols, cudaStream_t st = {});
+
+// Asymmetric quantization of the (k, n) row-major `src` to u8 (or u4 with `bits` = 4) over groups of `group_size`
+// rows, the values are extended to u16 for `Convert`, `scales` and `zeros` are (k / group_size, n)
+void quant_u8_groupwise(uint16_t*    dst,
+                        half*        scales,
+                        half*        zeros,
+                        const half*  src,
+                        int          k,
+                        int          n,
+                        int          group_size,
+                        cudaStream_t st   = {},
+                        int          bits = 8);
+
 template<class T>
 void interleave_output_dims_impl(T* fused, const T* a, const T* b, int m, int k, cudaStream_t st);
 
@@ -69,6 +69,9 @@ static std::optional<GemmDesc> get_gemm_desc(const Operation&    operation,
 
 std::vector<LaunchSpec> get_swizzle(const int4& shape, const LaunchSpec& spec, const std::vector<int>& swizzle)
 {
+    if (spec.stream_k) {  // stream-K walks the tiles in raster order
+        return {spec};
+    }
     const auto [m, n, k, _] = shape;
     std::vector<int> vec;
     for (const auto& s : swizzle) {
@@ -207,6 +210,31 @@ std::vector<LaunchSpec> StaticGemmContext::Populate(const Kernel& kernel, const
         specs.push_back(spec);
     }
 
+    // Stream-K, the k-chunks of all tiles are evenly divided among the resident CTAs, which removes the partial wave
+    // at the cost of the fix-up of the tiles split between CTAs
+    const int64_t tiles = tiled_shape_m * tiled_shape_n;
+    if (param.stream_k && desc.stream_k && max_splits > 1 && tiles % concurrency) {
+        const int64_t iters = tiles * chunk_cnt_k;
+        const int64_t ctas  = std::min<int64_t>(concurrency, iters);
+
+        const int64_t cta_mma_cost = (int64_t)desc.cta_tile.x * desc.cta_tile.y * kernel.chunk_size_k();
+        const int64_t mma_cost     = cta_mma_cost * concurrency * cdiv(iters, ctas);
+
+        const int64_t ceil_k     = (int64_t)chunk_cnt_k * kernel.chunk_size_k();
+        const int64_t mio_cost_a = get_size(desc.type_a, tiled_shape_n * m * ceil_k);
+        const int64_t mio_cost_b = get_size(desc.type_b, tiled_shape_m * n * ceil_k);
+        // at most 1 partial tile stored & loaded per CTA
+        const int64_t mio_cost_c = get_size(DataType::F32, ctas * desc.cta_tile.x * desc.cta_tile.y) * 2;
+
+        LaunchSpec spec{};
+        spec.kernel    = const_cast<Kernel*>(&kernel);
+        spec.splits    = 1;
+        spec.stream_k  = 1;
+        spec.swizzle   = param.swizzle;
+        spec.estimated = {mio_cost_a + mio_cost_b + mio_cost_c, mma_cost};
+        specs.push_back(spec);
+    }
+
     return specs;
 }
 
@@ -288,7 +316,7 @@ static inline bool operator==(int4 a, int4 b)
 
 static inline bool operator==(LaunchSpec a, LaunchSpec b)
 {
-    return std::tie(a.kernel, a.splits, a.swizzle) == std::tie(b.kernel, b.splits, b.swizzle);
+    return std::tie(a.kernel, a.splits, a.swizzle, a.stream_k) == std::tie(b.kernel, b.splits, b.swizzle, b.stream_k);
 }
 
 Tape DynamicGemmContext::Schedule(const LaunchSpec& spec)
@@ -11,6 +11,7 @@ struct PopulateParam {
     int    max_splits;
     int    max_waves;
     int    swizzle;
+    int    stream_k;
     size_t barriers_size;
     size_t partials_size;
 };
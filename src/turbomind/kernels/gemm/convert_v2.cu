@@ -224,10 +224,39 @@ int Convert(const void*         S,  //
     return dispatch() - 1;
 }
 
+bool is_fp8_supported(int sm)
+{
+#if ENABLE_SM90_GMMA
+    return sm == 90;
+#else
+    return false;
+#endif
+}
+
+bool is_int8_supported(int sm)
+{
+    return sm >= 80;
+}
+
 std::tuple<Order, Pack, Order, Pack>
 get_weight_and_scales_layout(DataType dtype, bool is_fused_moe, int sm, bool force_simt)
 {
+    if (dtype == DataType::F8_E4M3 && !is_fused_moe && is_fp8_supported(sm)) {
+        // K-major weights with per-channel f32 scales applied in the epilogue
+        return {kColMajor, 0, {}, {}};
+    }
+
+    if (dtype == DataType::S8 && !is_fused_moe && is_int8_supported(sm)) {
+        return {kColMajor, 0, {}, {}};
+    }
+
     if (is_fused_moe) {
+#if ENABLE_SM90_GMMA
+        // K-major weights without packing for both `wgmma` and `mma.sync` kernels
+        if ((dtype == DataType::F16 || dtype == DataType::BF16) && sm >= 90) {
+            return {kColMajor, 0, {}, {}};
+        }
+#endif
         if (dtype == DataType::BF16 && sm >= 80) {
             return {kColMajor, HMMA_16816 | OPERAND_B | 1, {}, {}};
         }
@@ -254,8 +283,15 @@ get_weight_and_scales_layout(DataType dtype, bool is_fused_moe, int sm, bool for
                 return {kColMajor, HMMA_884 | OPERAND_B | 1, kRowMajor, HMMA_884 | OPERAND_V | 1};
             }
         }
+        else if (dtype == DataType::U8 && sm >= 80) {
+            return {kColMajor, HMMA_16816 | OPERAND_B | 2, kRowMajor, HMMA_16816 | OPERAND_V | 1};
+        }
     }
     else {
+        if ((dtype == DataType::F16 || dtype == DataType::BF16) && sm >= 80) {
+            // dense f16/bf16 weights (the LM head) packed like the fused MoE ones
+            return {kColMajor, HMMA_16816 | OPERAND_B | 1, {}, {}};
+        }
         if (dtype == DataType::U4) {
             if (force_simt) {
                 return {kColMajor, HMMA_SIMT | OPERAND_B | 1, kRowMajor, HMMA_SIMT | OPERAND_V | 1};
@@ -270,6 +306,9 @@ get_weight_and_scales_layout(DataType dtype, bool is_fused_moe, int sm, bool for
                 return {kColMajor, HMMA_884 | OPERAND_B | 1, kRowMajor, HMMA_884 | OPERAND_V | 1};
             }
         }
+        else if (dtype == DataType::U8 && sm >= 80) {
+            return {kRowMajor, HMMA_16816 | OPERAND_B | 2, kRowMajor, HMMA_16816 | OPERAND_V | 1};
+        }
     }
 
     std::cerr << "not implemented: dtype=" << to_string(dtype) << ", is_fused_moe=" << is_fused_moe << ", sm=" << sm
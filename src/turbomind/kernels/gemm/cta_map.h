@@ -69,19 +69,29 @@ class GemmScheduler {
     int chunks_per_split_;
     int iter_k_per_chunk_;
 
+    // Stream-K, `ctas_` persistent CTAs take even shares of the (tile, k-chunk) iterations, 0 when disabled
+    int ctas_;
+    int chunk_cnt_;
+    int iters_;
+    int consumed_;
+
     int4 tile_offset_;
     int2 iter_k_range_;
 
 public:
     TM_HOST_DEVICE
-    GemmScheduler(int4 gemm_shape, int2 tiled_mn, int splits, int log_tile, int cta_k, int chunk_size):
-        gemm_shape_{gemm_shape}, tiled_shape_{tiled_mn.x, tiled_mn.y, splits}, log_tile_{log_tile}
+    GemmScheduler(int4 gemm_shape, int2 tiled_mn, int splits, int log_tile, int cta_k, int chunk_size, int ctas = 0):
+        gemm_shape_{gemm_shape}, tiled_shape_{tiled_mn.x, tiled_mn.y, splits}, log_tile_{log_tile}, ctas_{ctas}
     {
         const int chunk_cnt = cdiv(gemm_shape_.z, chunk_size);
 
         iter_k_per_chunk_ = chunk_size / cta_k;
         chunks_per_split_ = chunk_cnt / splits;
         chunk_offset_     = splits - chunk_cnt % splits;
+
+        chunk_cnt_ = chunk_cnt;
+        iters_     = tiled_mn.x * tiled_mn.y * chunk_cnt;
+        consumed_  = 0;
     }
 
     TM_HOST_DEVICE static int get_log_tile(int2 tiled_mn, int tile_size)
@@ -102,6 +112,9 @@ public:
 
     TM_HOST_DEVICE dim3 get_grid_shape() const
     {
+        if (ctas_) {
+            return {(unsigned)ctas_, 1, 1};
+        }
         return get_grid_shape(tiled_shape_, log_tile_);
     }
 
@@ -126,11 +139,59 @@ public:
         return {};
     }
 
-    TM_DEVICE std::true_type init()
+    TM_DEVICE bool init()
     {
+        if (ctas_) {
+            return init_stream_k(blockIdx.x);
+        }
         return init(blockIdx.x, blockIdx.y, blockIdx.z);
     }
 
+    // Advance to the next unit of work of a persistent CTA
+    TM_DEVICE bool next()
+    {
+        if (!ctas_) {
+            return false;
+        }
+        consumed_ += (iter_k_range_.y - iter_k_range_.x) / iter_k_per_chunk_;
+        return init_stream_k(blockIdx.x);
+    }
+
+    // The range of a CTA is walked backwards, so the CTA holding the first chunks of a tile (`z` = 0) processes them
+    // before anything else and the chain of serial reduction never waits on the whole range of another CTA
+    TM_DEVICE bool init_stream_k(int cta)
+    {
+        const int beg = (int64_t)cta * iters_ / ctas_;
+        const int end = (int64_t)(cta + 1) * iters_ / ctas_ - consumed_;
+        if (end <= beg) {
+            return false;
+        }
+
+        const int tile     = (end - 1) / chunk_cnt_;
+        const int tile_beg = tile * chunk_cnt_;
+
+        const int first = get_stream_k_cta(tile_beg);
+        const int last  = get_stream_k_cta(tile_beg + chunk_cnt_ - 1);
+
+        if constexpr (order == kColMajor) {
+            tile_offset_ = {tile % tiled_shape_.x, tile / tiled_shape_.x, cta - first, 0};
+        }
+        else {
+            tile_offset_ = {tile / tiled_shape_.y, tile % tiled_shape_.y, cta - first, 0};
+        }
+        tiled_shape_.z = last - first + 1;
+
+        iter_k_range_ = {(max(beg, tile_beg) - tile_beg) * iter_k_per_chunk_, (end - tile_beg) * iter_k_per_chunk_};
+
+        return true;
+    }
+
+    // The CTA whose range contains the iteration
+    TM_HOST_DEVICE int get_stream_k_cta(int iter) const
+    {
+        return ((int64_t)(iter + 1) * ctas_ + iters_ - 1) / iters_ - 1;
+    }
+
     TM_DEVICE int4 gemm_shape() const
     {
         return gemm_shape_;
@@ -241,6 +302,11 @@ public:
     {
         return tile_ids_[blockIdx.x];
     }
+
+    TM_DEVICE std::false_type next()
+    {
+        return {};
+    }
 };
 
 template<class S>
@@ -40,6 +40,8 @@ enum class OpClass
     kSIMT,
     kMMA_s884,
     kMMA_s16816,
+    kGMMA,
+    kMMA_s16832,
 };
 
 inline const char* to_string(OpClass op)
@@ -51,6 +53,10 @@ inline const char* to_string(OpClass op)
             return "s884";
         case OpClass::kMMA_s16816:
             return "s16816";
+        case OpClass::kGMMA:
+            return "gmma";
+        case OpClass::kMMA_s16832:
+            return "s16832";
         default:
             return "unknown_op_cls";
     }
@@ -87,6 +93,7 @@ struct KernelDesc {
 
     // set by `KernelImpl`
     int                max_active_ctas;
+    bool               stream_k;
     cudaFuncAttributes attr;
 };
 
@@ -95,6 +102,7 @@ struct LaunchSpec {
     Kernel* kernel;
     int     swizzle;
     int     splits;
+    int     stream_k;
     float   measured;
 
     std::array<int64_t, 2> estimated;
@@ -138,7 +138,7 @@ void ExportDispatchCache(std::ostream& os, const std::vector<std::pair<GemmDesc,
                     k.c_tile.y,
                     k.split_k);
         // Runtime params
-        export_impl(os, spec.swizzle, spec.splits);
+        export_impl(os, spec.swizzle, spec.splits, spec.stream_k);
         os << std::endl;
     }
 }
@@ -214,7 +214,8 @@ void ImportDispatchCache(std::istream&                                 is,
                     k.c_tile.y,
                     k.split_k);
         LaunchSpec spec{};
-        import_impl(ss, spec.swizzle, spec.splits);
+        // `stream_k` is absent from the records of older versions and defaults to 0
+        import_impl(ss, spec.swizzle, spec.splits, spec.stream_k);
         for (const auto& p : kernels) {
             if (p->desc() == k) {
                 spec.kernel = p;
@@ -89,12 +89,12 @@ __device__ void Scale(pair<scale_S, scale_C>,
 
     if (scale_C && param_C.ptr) {
         const T*      ptr = (const T*)resolve<T, mode_C>(param_C, gemm_id).ptr.ptr + cs0.x;
-        constexpr int dc  = sizeof(Array<T, N>) * delta_C;
+        constexpr int dc  = sizeof(T) * delta_C;
         Array<T, N>   param[C];
         PRAGMA_UNROLL
         for (int c = 0; c < C; ++c) {
             if (pred(0, c)) {
-                Ldg(param[c], (const T*)(ptr + dc * c));
+                Ldg(param[c], (const T*)((const char*)ptr + dc * c));
             }
             PRAGMA_UNROLL
             for (int s = 0; s < S; ++s) {
@@ -180,12 +180,17 @@ struct EpilogueParam {
     MatrixParam partials;
     int*        locks;
 
-    // MatrixParam scale_S;
-    // MatrixParam scale_C;
+    // scales of the strided / contiguous dimension of C, used by kernels with `QuantType::kChannel`
+    MatrixParam scale_S;
+    MatrixParam scale_C;
 
     MatrixCombination_v3 combine_mat;
 
     bool silu_act;
+
+    // weighted scatter-add of the rows of C (global row idx) to the rows of `c`, the combine of the MoE experts
+    const int*   scatter_idxs;
+    const float* scatter_scales;
 };
 
 template<class Tc_,
@@ -197,7 +202,8 @@ template<class Tc_,
          class RearrangeC,
          class OperandC,
          Striding mode_C,
-         bool     SplitK_>
+         bool     SplitK_,
+         bool     Scale_ = false>
 struct Epilogue_ {
 
     using Dtype = typename OperandC::Dtype;
@@ -205,6 +211,7 @@ struct Epilogue_ {
     static constexpr auto kOrder = OperandC::kOrder;
     static constexpr auto kMode  = mode_C;
     static constexpr bool SplitK = SplitK_;
+    static constexpr bool kScale = Scale_;
 
     using Tc = Tc_;
 
@@ -305,6 +312,50 @@ struct Epilogue_ {
         }
     }
 
+    // Rows of different experts of a token land on the same row of `param.c`, the adds are atomic
+    template<class T, class VecC, class Pred>
+    __device__ void ScatterAdd(const VecC& vec_C, const EpilogueParam& param, int g, int2 cs0, Pred& pred)
+    {
+        if constexpr (kOrder == kRowMajor && kAccess % 2 == 0) {
+            const int offset = param.c.offsets ? __ldg(param.c.offsets + g) : 0;
+            PRAGMA_UNROLL
+            for (int s = 0; s < S; ++s) {
+                const int r = offset + cs0.y + s * Map::kDeltaS;
+                if (!pred(s, 0)) {
+                    continue;
+                }
+                const float scale = __ldg(param.scatter_scales + r);
+                T*          ptr   = (T*)param.c.ptr + (int64_t)__ldg(param.scatter_idxs + r) * param.c.stride + cs0.x;
+                PRAGMA_UNROLL
+                for (int c = 0; c < C; ++c) {
+                    if (pred(s, c)) {
+                        PRAGMA_UNROLL
+                        for (int i = 0; i < kAccess; i += 2) {
+                            AtomicAdd2(ptr + c * Map::kDeltaC + i, vec_C[s][c][i] * scale, vec_C[s][c][i + 1] * scale);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template<class T>
+    __device__ static void AtomicAdd2(T* p, float x, float y)
+    {
+        if constexpr (std::is_same_v<T, half>) {
+            atomicAdd((half2*)p, __floats2half2_rn(x, y));
+        }
+#if __CUDA_ARCH__ >= 800
+        else if constexpr (std::is_same_v<T, nv_bfloat16>) {
+            atomicAdd((nv_bfloat162*)p, __floats2bfloat162_rn(x, y));
+        }
+#endif
+        else if constexpr (std::is_same_v<T, float>) {
+            atomicAdd(p, x);
+            atomicAdd(p + 1, y);
+        }
+    }
+
 #if 0
     template<class FragC, class Pred>
     __device__ void
@@ -419,10 +470,19 @@ struct Epilogue_ {
         constexpr pair<Map::kDeltaC, Map::kDeltaS> delta_cs{};
 
         // opt-in scaling
-        // Scale(scale_SC{}, mode_SC{}, delta_cs, tmp_C, param.scale_S, param.scale_C, tile_offset.w, cs0, pred);
+        if constexpr (kScale) {
+            constexpr pair<true, true>   scale_SC{};
+            constexpr pair<kMode, kMode> mode_SC{};
+            Scale(scale_SC, mode_SC, delta_cs, tmp_C, param.scale_S, param.scale_C, tile_offset.w, cs0, pred);
+        }
 
         param.combine_mat((Tc*)0, constant<kMode>{}, tmp_C, cs0, tile_offset.w, delta_cs, pred);
 
+        if (param.scatter_idxs) {
+            ScatterAdd<Tc>(tmp_C, param, tile_offset.w, cs0, pred);
+            return;
+        }
+
         const MatrixData c = resolve<Tc, kMode>(param.c, tile_offset.w);
 
         if (param.silu_act) {
@@ -14,6 +14,8 @@
 #include <memory>
 #include <numeric>
 #include <optional>
+#include <set>
+#include <sstream>
 #include <vector>
 
 namespace turbomind::gemm {
@@ -56,16 +58,69 @@ struct Gemm::Impl {
             }
         }
         measurer_.emplace(CreateStoppingCriterion(tuning_.min_iter, tuning_.max_iter, tuning_.max_time));
+        lazy_ = std::getenv("TM_GEMM_LAZY") != nullptr;
+    }
+
+    // Records of a dispatch cache are only valid for the same GPU & driver
+    std::string DeviceKey() const
+    {
+        int driver{};
+        cudaDriverGetVersion(&driver);
+        std::string name = props_->name;
+        std::replace(name.begin(), name.end(), ' ', '_');
+        std::ostringstream ss;
+        ss << "# device=" << name << " sm=" << arch_ << " driver=" << driver;
+        return ss.str();
+    }
+
+    int Export(std::ostream& os) const
+    {
+        os << DeviceKey() << "\n";
+        return cache_.Export(os);
+    }
+
+    // Sections of other devices are skipped, so databases of different machines can be concatenated. Records without
+    // a section header are accepted as is.
+    int Import(std::istream& is)
+    {
+        const auto         key = DeviceKey();
+        std::ostringstream records;
+        bool               match   = true;
+        int                skipped = 0;
+        std::string        line;
+        while (std::getline(is, line)) {
+            if (line.rfind('#', 0) == 0) {
+                match = line == key;
+                continue;
+            }
+            if (match) {
+                records << line << "\n";
+            }
+            else {
+                ++skipped;
+            }
+        }
+        if (skipped) {
+            std::cerr << "[Gemm2] " << skipped << " records of other devices skipped, current: " << key << "\n";
+        }
+        std::istringstream iss{records.str()};
+        return cache_.Import(iss);
     }
 
     // find launch spec in dispatch cache, dispatch by heuristic on cache miss
     LaunchSpec Dispatch(Context& ctx, DispatchPolicy policy, GemmDesc desc, size_t barriers_size, size_t partials_size)
     {
         if (policy & DispatchPolicy::kReuse) {
+            // Shapes without an exact match are queued for tuning in lazy mode
+            if (lazy_ && !cache_.Find(desc)) {
+                misses_.insert(desc.batch_dim == 0 ? desc.m : desc.n);
+            }
             if (auto spec = cache_.LowerBound(desc)) {
                 return *spec;
             }
-            std::cerr << "Failed to find a feasible kernel in the cache, will dispatch by heuristic.\n";
+            if (!lazy_) {
+                std::cerr << "Failed to find a feasible kernel in the cache, will dispatch by heuristic.\n";
+            }
         }
 
         if (auto spec = cache_.Find(desc)) {
@@ -116,6 +171,7 @@ struct Gemm::Impl {
         param.max_splits    = tuning_.max_splits;
         param.max_waves     = tuning_.max_waves;
         param.swizzle       = tuning_.swizzle.at(0);
+        param.stream_k      = tuning_.stream_k;
         param.barriers_size = barrier_size;
         param.partials_size = partials_size;
 
@@ -174,6 +230,38 @@ struct Gemm::Impl {
         return ret;
     }
 
+    LaunchSpec DispatchPinned(Context&            ctx,
+                              const Operation&    operation,
+                              const GemmDesc&     desc,
+                              const MatrixLayout& Adesc,
+                              const MatrixLayout& Udesc,
+                              const MatrixLayout& Bdesc,
+                              const MatrixLayout& Vdesc,
+                              const MatrixLayout& Cdesc,
+                              const MatrixLayout& Ddesc,
+                              const Workspace&    workspace)
+    {
+        auto A = Adesc;
+        auto D = Ddesc;
+        A.rows = D.rows = kPinnedBatch;
+
+        LaunchSpec spec{};
+        if (auto pinned = ctx.Init(operation, A, Udesc, Bdesc, Vdesc, Cdesc, D)) {
+            spec = Dispatch(ctx, operation.dispatch, *pinned, workspace.barriers_size, workspace.partials_size);
+        }
+        if (spec.kernel && spec.kernel->is_feasible(desc)) {
+            spec.splits   = 1;
+            spec.stream_k = 0;
+            return spec;
+        }
+        if (unpinned_.insert({desc.n, desc.k}).second) {
+            std::cerr << "[Gemm2] No pinned kernel for n=" << desc.n << ", k=" << desc.k
+                      << " is feasible, the GEMM is not batch invariant.\n";
+        }
+        ctx.Init(operation, Adesc, Udesc, Bdesc, Vdesc, Cdesc, Ddesc);
+        return Dispatch(ctx, operation.dispatch, desc, workspace.barriers_size, workspace.partials_size);
+    }
+
     template<class LaunchFunc>
     int Measure(Context&        ctx,
                 const GemmDesc& desc,
@@ -241,6 +329,12 @@ struct Gemm::Impl {
     DispatchCache cache_;
 
     StaticGemmContext default_ctx_;
+
+    bool          lazy_{};
+    std::set<int> misses_;
+
+    bool                          batch_invariant_{};
+    std::set<std::pair<int, int>> unpinned_;
 };
 
 // implementation of GEMM interfaces
@@ -296,6 +390,7 @@ int Gemm::Run(const Operation&    operation,
                                    Ddesc,
                                    spec.swizzle,
                                    spec.splits,
+                                   spec.stream_k,
                                    _workspace,
                                    st);
     };
@@ -314,11 +409,20 @@ int Gemm::Run(const Operation&    operation,
 
     LaunchSpec spec{};
 
-    if (operation.dispatch & DispatchPolicy::kMeasure) {
+    // the static contexts don't take part in the launch, they can be re-initialized for the pinned shape
+    const bool pinned = impl_->batch_invariant_ && !operation.context && desc->batch_dim == 0;
+
+    // only the pinned shape is tuned when pinned
+    if (operation.dispatch & DispatchPolicy::kMeasure && (!pinned || desc->m == kPinnedBatch)) {
         impl_->Measure(context, *desc, workspace.barriers_size, workspace.partials_size, 1, launch, stream);
     }
 
-    spec = impl_->Dispatch(context, operation.dispatch, *desc, workspace.barriers_size, workspace.partials_size);
+    if (pinned) {
+        spec = impl_->DispatchPinned(context, operation, *desc, Adesc, Udesc, Bdesc, Vdesc, Cdesc, Ddesc, workspace);
+    }
+    else {
+        spec = impl_->Dispatch(context, operation.dispatch, *desc, workspace.barriers_size, workspace.partials_size);
+    }
 
     if (spec.kernel) {
         // std::cout << "[Gemm] dispatch: " << spec.kernel->name()  //
@@ -332,14 +436,56 @@ int Gemm::Run(const Operation&    operation,
     return -1;
 }
 
+std::optional<LaunchSpec> Gemm::GetLaunchSpec(const Operation&    operation,
+                                              const MatrixLayout& Adesc,
+                                              const MatrixLayout& Udesc,
+                                              const MatrixLayout& Bdesc,
+                                              const MatrixLayout& Vdesc,
+                                              const MatrixLayout& Cdesc,
+                                              const MatrixLayout& Ddesc,
+                                              const Workspace&    workspace)
+{
+    Context& context = operation.context ? *operation.context : (Context&)impl_->default_ctx_;
+
+    const auto desc = context.Init(operation, Adesc, Udesc, Bdesc, Vdesc, Cdesc, Ddesc);
+
+    if (!desc) {
+        return {};
+    }
+
+    const bool pinned = impl_->batch_invariant_ && !operation.context && desc->batch_dim == 0;
+
+    const auto spec =
+        pinned ? impl_->DispatchPinned(context, operation, *desc, Adesc, Udesc, Bdesc, Vdesc, Cdesc, Ddesc, workspace) :
+                 impl_->Dispatch(context, operation.dispatch, *desc, workspace.barriers_size, workspace.partials_size);
+
+    if (!spec.kernel) {
+        return {};
+    }
+
+    return spec;
+}
+
 int Gemm::Export(std::ostream& os)
 {
-    return impl_->cache_.Export(os);
+    return impl_->Export(os);
 }
 
 int Gemm::Import(std::istream& is)
 {
-    return impl_->cache_.Import(is);
+    return impl_->Import(is);
+}
+
+std::vector<int> Gemm::PopMisses()
+{
+    std::vector<int> ret(impl_->misses_.begin(), impl_->misses_.end());
+    impl_->misses_.clear();
+    return ret;
+}
+
+void Gemm::SetBatchInvariant(bool batch_invariant)
+{
+    impl_->batch_invariant_ = batch_invariant;
 }
 
 std::vector<int> Gemm::GetTuningSeq() const
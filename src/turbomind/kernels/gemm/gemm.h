@@ -2,9 +2,11 @@
 
 #pragma once
 
+#include "src/turbomind/kernels/gemm/desc.h"
 #include "src/turbomind/kernels/gemm/types.h"
 #include <cuda_runtime.h>
 #include <memory>
+#include <optional>
 #include <vector>
 
 namespace turbomind::gemm {
@@ -36,12 +38,31 @@ public:
                           const Workspace&    workspace,
                           cudaStream_t        stream);
 
+    // Launch spec `Run` dispatches the problem to without launching it, empty when there is no feasible kernel
+    [[nodiscard]] std::optional<LaunchSpec> GetLaunchSpec(const Operation&    operation,
+                                                          const MatrixLayout& Adesc,
+                                                          const MatrixLayout& Udesc,
+                                                          const MatrixLayout& Bdesc,
+                                                          const MatrixLayout& Vdesc,
+                                                          const MatrixLayout& Cdesc,
+                                                          const MatrixLayout& Ddesc,
+                                                          const Workspace&    workspace);
+
     [[maybe_unused]] int Export(std::ostream& os);
 
     [[maybe_unused]] int Import(std::istream& is);
 
     [[nodiscard]] std::vector<int> GetTuningSeq() const;
 
+    // Batch sizes that missed the dispatch cache since the last call, only recorded in lazy mode (`TM_GEMM_LAZY`)
+    [[nodiscard]] std::vector<int> PopMisses();
+
+    // Dense GEMMs of a (n, k) are dispatched to the kernel of `kPinnedBatch` tokens without split-k for any batch
+    // size, a row of the result doesn't depend on the others
+    void SetBatchInvariant(bool batch_invariant);
+
+    static constexpr int kPinnedBatch = 128;
+
 private:
     struct Impl;
     std::unique_ptr<Impl> impl_;
@@ -52,6 +73,12 @@ private:
 std::tuple<Order, Pack, Order, Pack>
 get_weight_and_scales_layout(DataType dtype, bool is_fused_moe, int sm, bool force_simt);
 
+// fp8 (e4m3) W8A8 kernels, only available with `wgmma` on sm_90a
+bool is_fp8_supported(int sm);
+
+// int8 W8A8 kernels with `mma.sync` s16832, sm_80 and above
+bool is_int8_supported(int sm);
+
 void* make_blocked_ptrs(const std::vector<std::pair<void*, int>>& ptrs, cudaStream_t stream);
 
 }  // namespace turbomind::gemm
@@ -7,6 +7,7 @@
 #include "src/turbomind/kernels/core/data_type.h"
 #include "src/turbomind/kernels/core/layout.h"
 #include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/core/pdl.h"
 
 #include "src/turbomind/kernels/gemm/cta_map.h"
 #include "src/turbomind/kernels/gemm/desc.h"
@@ -58,6 +59,7 @@ struct GemmUniversal {
 
     static constexpr bool kDynamicSched = is_dynamic_scheduler<CtaMap>::value;
     static constexpr bool kSplitK       = Epilogue::SplitK;
+    static constexpr bool kStreamK      = kSplitK && !kDynamicSched;
 
     using FragC = typename Impl::FragC;
 
@@ -94,6 +96,19 @@ struct GemmUniversal {
             return;
         }
 
+        // Persistent CTAs of stream-K scheduling process more than 1 unit of work
+        while (true) {
+            Run(param, epi_param, cta_map, smem_buf);
+            if (!cta_map.next()) {
+                break;
+            }
+            // The shared storage of the epilogue is reused by the next mainloop
+            __syncthreads();
+        }
+    }
+
+    __device__ void Run(const Param& param, const EpilogueParam& epi_param, CtaMap& cta_map, char* smem_buf)
+    {
         const auto [M, N, K, L] = cta_map.gemm_shape();
         const auto tile_offset  = cta_map.tile_offset();
 
@@ -169,10 +184,21 @@ __global__ void gemm_kernel(Param param, EpilogueParam epi_param, CtaMap cta_map
 {
 #if __CUDA_ARCH__
     if constexpr (Kernel::Arch::is_compatible(__CUDA_ARCH__)) {
+        PdlWait();
+        PdlLaunchDependents();
         Kernel kernel;
         kernel(param, epi_param, cta_map, smem_buf);
     }
 #endif
 }
 
+// entry point of the kernel `Gemm`
+template<class Gemm>
+struct GemmKernel {
+    static auto get()
+    {
+        return gemm_kernel<Gemm, GemmParam, EpilogueParam, typename Gemm::CtaMap>;
+    }
+};
+
 }  // namespace turbomind::gemm
@@ -0,0 +1,176 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/core/pdl.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/epilogue.h"
+#include "src/turbomind/kernels/gemm/gemm_universal.h"
+#include "src/turbomind/kernels/gemm/types.h"
+#include "src/turbomind/kernels/gemm/utils.h"
+
+namespace turbomind::gemm {
+
+// `GemmUniversal` for warp specialized mainloops, only the producer warpgroup touches global memory of A & B
+template<class Arch_, class Mainloop, class Epilogue_, class CtaMap_>
+struct GemmUniversalSm90 {
+
+    using Impl = Mainloop;
+
+    using Ta = typename Impl::Ta;
+    using Tb = typename Impl::Tb;
+    using Tu = typename Impl::Tu;
+    using Tv = typename Impl::Tv;
+
+    using Epilogue = Epilogue_;
+
+    using Tc = typename Epilogue::Tc;
+
+    using Arch   = Arch_;
+    using CtaMap = CtaMap_;
+
+    static constexpr Order kOrderC = Epilogue::kOrder;
+
+    static constexpr int CTA_M = Impl::CTA_M;
+    static constexpr int CTA_N = Impl::CTA_N;
+    static constexpr int CTA_K = Impl::CTA_K;
+
+    static constexpr bool kDynamicSched = is_dynamic_scheduler<CtaMap>::value;
+    static constexpr bool kSplitK       = Epilogue::SplitK;
+    static constexpr bool kStreamK      = false;  // the mbarrier pipeline is set up for 1 tile per CTA
+
+    using FragC = typename Impl::FragC;
+
+    static constexpr int WARP_CNT = Impl::WARPS;
+
+    using OperandA = typename Mainloop::OperandA;
+    using OperandB = typename Mainloop::OperandB;
+    using OperandU = typename Mainloop::OperandU;
+    using OperandV = typename Mainloop::OperandV;
+
+    static constexpr int kChunkSizeK = CTA_K;
+
+    struct SharedStorage {
+        union {
+            typename Mainloop::SharedStorage mainloop;
+            typename Epilogue::SharedStorage epilogue;
+        };
+        typename Mainloop::Barriers barriers;
+    };
+
+    static constexpr Order kOrderA = OperandA::kOrder;
+    static constexpr Order kOrderB = OperandB::kOrder;
+
+    static constexpr Pack kPackA = OperandA::kPack;
+    static constexpr Pack kPackB = OperandB::kPack;
+
+    using Param = GemmParam;
+
+    __device__ void operator()(const Param& param, const EpilogueParam& epi_param, CtaMap& cta_map, char* smem_buf)
+    {
+        if (!cta_map.init()) {
+            return;
+        }
+
+        const auto [M, N, K, L] = cta_map.gemm_shape();
+        const auto tile_offset  = cta_map.tile_offset();
+
+        const auto [iter_k_beg, iter_k_end] = cta_map.iter_k_range();
+
+        const int offset_m = tile_offset.x * CTA_M;
+        const int offset_n = tile_offset.y * CTA_N;
+        const int offset_k = iter_k_beg * CTA_K;
+
+        if (offset_m >= M || offset_n >= N || offset_k >= K) {  // empty tile
+            return;
+        }
+
+        const int extent_m = min(CTA_M, M - offset_m);
+        const int extent_n = min(CTA_N, N - offset_n);
+
+        SharedStorage& storage = *reinterpret_cast<SharedStorage*>(smem_buf);
+
+        __align__(8) FragC frag_C{};
+
+        const int tile_iter = iter_k_end - iter_k_beg;
+
+        const int g = tile_offset.w;
+
+        const bool is_producer = threadIdx.x < Mainloop::kProducerThreads;
+
+        typename OperandA::GmemIter gmem_A;
+        typename OperandB::GmemIter gmem_B;
+
+        if (is_producer) {
+            const auto mat_A = resolve_op<OperandA>(param.a, g);
+            const auto mat_B = resolve_op<OperandB>(param.b, g);
+            gmem_A = typename OperandA::GmemIter{mat_A, {offset_m, offset_k}, {extent_m, CTA_K}};
+            gmem_B = typename OperandB::GmemIter{mat_B, {offset_n, offset_k}, {extent_n, CTA_K}};
+        }
+
+        Mainloop mainloop{};
+        mainloop.Prologue(gmem_A, gmem_B, is_producer, storage.mainloop, storage.barriers);
+
+        if (is_producer) {
+            mainloop.Produce(gmem_A, gmem_B, tile_iter, storage.mainloop, storage.barriers);
+        }
+        else {
+            mainloop.Consume(frag_C, tile_iter, storage.mainloop, storage.barriers);
+        }
+
+        // the epilogue reuses the smem of the mainloop
+        __syncthreads();
+
+        {
+            cta_map.init();
+
+            const auto [M, N, K, L] = cta_map.gemm_shape();
+
+            const auto tiled_shape = cta_map.tiled_shape();
+            const auto tile_offset = cta_map.tile_offset();
+
+            const int2 extents = {min(CTA_M, M - tile_offset.x * CTA_M), min(CTA_N, N - tile_offset.y * CTA_N)};
+
+            const bool is_last = cta_map.iter_k_range().y * CTA_K == K;
+
+            Epilogue epilogue{};
+            epilogue(frag_C,  //
+                     tile_offset,
+                     tiled_shape,
+                     extents,
+                     cta_map.tile_id(),
+                     is_last,
+                     epi_param,
+                     storage.epilogue);
+        }
+    }
+};
+
+// The smem descriptors of `wgmma` require 1024B aligned swizzle atoms
+extern __shared__ __align__(1024) char smem_buf_sm90[];
+
+template<class Kernel, class Param, class EpilogueParam, class CtaMap>
+__global__ void __launch_bounds__(Kernel::WARP_CNT* WARP_SIZE, 1)
+    gemm_kernel_sm90(Param param, EpilogueParam epi_param, CtaMap cta_map)
+{
+#if __CUDA_ARCH__
+    if constexpr (Kernel::Arch::is_compatible(__CUDA_ARCH__)) {
+        PdlWait();
+        PdlLaunchDependents();
+        Kernel kernel;
+        kernel(param, epi_param, cta_map, smem_buf_sm90);
+    }
+#endif
+}
+
+template<class Arch, class Mainloop, class Epilogue, class CtaMap>
+struct GemmKernel<GemmUniversalSm90<Arch, Mainloop, Epilogue, CtaMap>> {
+    static auto get()
+    {
+        return gemm_kernel_sm90<GemmUniversalSm90<Arch, Mainloop, Epilogue, CtaMap>, GemmParam, EpilogueParam, CtaMap>;
+    }
+};
+
+}  // namespace turbomind::gemm
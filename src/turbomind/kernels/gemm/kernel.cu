@@ -128,15 +128,20 @@ std::string Kernel::GetName() const
 {
     std::stringstream ss;
 
+    auto quant = [&](const QuantDesc& q) {
+        if (q.type == QuantType::kDefault) {
+            ss << "g" << q.group_size;
+        }
+        else if (q.type == QuantType::kChannel) {
+            ss << "c";
+        }
+    };
+
     ss << "sm" << desc_.arch / 10;
     ss << "_" << to_string(desc_.type_a);  //
-    if ((int)desc_.quant_a.type) {
-        ss << "g" << desc_.quant_a.group_size;
-    }
+    quant(desc_.quant_a);
     ss << "_" << to_string(desc_.type_b);  //
-    if ((int)desc_.quant_b.type) {
-        ss << "g" << desc_.quant_b.group_size;
-    }
+    quant(desc_.quant_b);
     ss << "_" << to_string(desc_.type_c);
     ss << "_"                                        //
        << (desc_.order_a == kColMajor ? 'n' : 't')   //
@@ -192,7 +197,7 @@ std::vector<std::vector<LaunchSpec>> Cluster(const std::vector<LaunchSpec>& spec
                 return a.max_active_ctas < b.max_active_ctas;
             }
         }
-        return u->splits < v->splits;
+        return std::tie(u->splits, u->stream_k) < std::tie(v->splits, v->stream_k);
     };
 
     std::stable_sort(ptrs.begin(), ptrs.end(), less);
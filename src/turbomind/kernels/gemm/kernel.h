@@ -38,6 +38,7 @@ public:
                        const MatrixLayout& Ddesc,
                        int                 swizzle,
                        int                 splits,
+                       int                 stream_k,
                        Workspace&          workspace,
                        cudaStream_t        stream) const = 0;
 
@@ -0,0 +1,45 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/gemm/arch/config_sm90_gmma.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/registry.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm {
+
+using namespace sm90_gmma;
+using namespace cache_policy;
+using D = cache_policy::Default;
+
+// fp8 (e4m3) activations x fp8 (e4m3) weights, per-token scales of A and per-channel scales of B
+template<class Tc>
+void Registry::e4m3_e4m3_tnt_sm90_gmma()
+{
+#if ENABLE_SM90_GMMA
+    using C = Sm90_gmma<Sm90,
+                        fp8_e4m3,
+                        Operand_K<fp8_e4m3>,  // A
+                        Operand_K<fp8_e4m3>,  // B
+                        kRowMajor,            // order_C
+                        Tc,                   // Tc
+                        Striding::kFlat,
+                        Striding::kFlat,
+                        Striding::kFlat,
+                        GemmScheduler<kColMajor>,
+                        true>;  // scale
+
+    // clang-format off
+    Add<C::Type<128, 256, 128, 2, 1, D, D, 4>>();
+    Add<C::Type<128, 128, 128, 2, 1, D, D, 6>>();
+    Add<C::Type<128,  64, 128, 2, 1, D, D, 8>>();
+    Add<C::Type< 64, 256, 128, 1, 1, D, D, 5>>();
+    Add<C::Type< 64, 128, 128, 1, 1, D, D, 8>>();
+    Add<C::Type< 64,  64, 128, 1, 1, D, D, 8>>();
+    // clang-format on
+#endif
+}
+
+template void Registry::e4m3_e4m3_tnt_sm90_gmma<half>();
+template void Registry::e4m3_e4m3_tnt_sm90_gmma<nv_bfloat16>();
+
+}  // namespace turbomind::gemm
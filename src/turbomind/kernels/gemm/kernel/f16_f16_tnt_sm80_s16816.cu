@@ -0,0 +1,54 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/gemm/arch/config_sm80_s16816.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/registry.h"
+#include "src/turbomind/kernels/gemm/transform.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm {
+
+using namespace sm80_s16816;
+using namespace cache_policy;
+using S = cache_policy::Stream;
+using D = cache_policy::Default;
+
+// f16/bf16 activations x packed f16/bf16 weights of dense layers, same weight layout as the fused MoE ones
+template<class T>
+void Registry::f16_f16_tnt_sm80_s16816()
+{
+    using C = Sm80_s16816<Sm80,
+                          T,
+                          Operand_A<T, kRowMajor>,          // A
+                          Transform_Default,                // tarnsform A
+                          VoidOperand,                      // U
+                          Operand_B_Pack<T, kRowMajor, 1>,  // B
+                          Transform_Default,                // transform B
+                          VoidOperand,                      // V
+                          kRowMajor,                        // order_C
+                          T,                                // Tc
+                          Striding::kFlat,
+                          Striding::kFlat,
+                          Striding::kFlat,
+                          GemmScheduler<kColMajor>>;
+
+    // clang-format off
+    Add<C::Type<256, 128,  64, 4, 2, 1, D, D, 3, true, 1, 1>>();
+    Add<C::Type<128, 256,  64, 2, 4, 1, D, D, 3, true, 1, 1>>();
+    Add<C::Type<128, 128,  32, 2, 2, 1, D, D, 3, true, 1, 1>>();
+    Add<C::Type<128, 128,  64, 2, 2, 1, D, D, 3, true, 1, 1>>();
+    Add<C::Type< 64, 128,  64, 1, 4, 1, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 64,  64,  64, 2, 2, 1, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 64,  64, 128, 1, 2, 2, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 32, 128,  64, 1, 4, 1, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 32,  64, 128, 1, 2, 2, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 16, 128,  64, 1, 4, 1, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 16, 128, 128, 1, 4, 2, D, S, 3, true, 1, 1>>();
+    Add<C::Type< 16,  64, 128, 1, 2, 2, D, S, 3, true, 1, 1>>();
+    // clang-format on
+}
+
+template void Registry::f16_f16_tnt_sm80_s16816<half>();
+template void Registry::f16_f16_tnt_sm80_s16816<nv_bfloat16>();
+
+}  // namespace turbomind::gemm
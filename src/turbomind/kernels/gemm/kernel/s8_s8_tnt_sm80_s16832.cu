@@ -0,0 +1,44 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/gemm/arch/config_sm80_s16832.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/registry.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm {
+
+using namespace sm80_s16832;
+using namespace cache_policy;
+using S = cache_policy::Stream;
+using D = cache_policy::Default;
+
+// int8 activations x int8 weights, per-token scales of A and per-channel scales of B
+template<class Tc>
+void Registry::s8_s8_tnt_sm80_s16832()
+{
+    using C = Sm80_s16832<Sm80,
+                          Operand_A<int8_t>,  // A
+                          Operand_B<int8_t>,  // B
+                          kRowMajor,          // order_C
+                          Tc,                 // Tc
+                          Striding::kFlat,
+                          Striding::kFlat,
+                          Striding::kFlat,
+                          GemmScheduler<kColMajor>>;
+
+    // clang-format off
+    Add<C::Type<128, 256,  64, 2, 4, 1, D, D, 3, true>>();
+    Add<C::Type<128, 128,  64, 2, 2, 1, D, D, 4, true>>();
+    Add<C::Type<128, 128, 128, 2, 2, 1, D, D, 3, true>>();
+    Add<C::Type< 64, 128, 128, 1, 4, 1, D, S, 3, true>>();
+    Add<C::Type< 64,  64, 128, 2, 2, 1, D, S, 4, true>>();
+    Add<C::Type< 32, 128, 128, 1, 4, 1, D, S, 3, true>>();
+    Add<C::Type< 16, 128, 128, 1, 4, 1, D, S, 4, true>>();
+    Add<C::Type< 16,  64, 256, 1, 2, 2, D, S, 3, true>>();
+    // clang-format on
+}
+
+template void Registry::s8_s8_tnt_sm80_s16832<half>();
+template void Registry::s8_s8_tnt_sm80_s16832<nv_bfloat16>();
+
+}  // namespace turbomind::gemm
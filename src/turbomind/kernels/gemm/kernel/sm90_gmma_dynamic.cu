@@ -0,0 +1,74 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/gemm/arch/config_sm80_s16816.h"
+#include "src/turbomind/kernels/gemm/arch/config_sm90_gmma.h"
+#include "src/turbomind/kernels/gemm/cta_map.h"
+#include "src/turbomind/kernels/gemm/registry.h"
+#include "src/turbomind/kernels/gemm/transform.h"
+#include "src/turbomind/kernels/gemm/types.h"
+
+namespace turbomind::gemm {
+
+using namespace sm90_gmma;
+using namespace cache_policy;
+using D = cache_policy::Default;
+
+template<class T>
+void Registry::sm90_gmma_dynamic()
+{
+#if ENABLE_SM90_GMMA
+    using C = Sm90_gmma<Sm90,
+                        T,
+                        sm80_s16816::Operand_A<T, kRowMajor>,  // A
+                        sm80_s16816::Operand_B<T, kRowMajor>,  // B
+                        kRowMajor,                             // order_C
+                        T,                                     // Tc
+                        Striding::kIndexed,                    // indexed input
+                        Striding::kBlocked,
+                        Striding::kBlocked,
+                        DynamicScheduler<kColMajor>>;
+
+    // clang-format off
+    Add<C::Type<128, 256, 64, 2, 1, D, D, 4>>();
+    Add<C::Type<128, 128, 64, 2, 1, D, D, 4>>();
+    Add<C::Type<128,  64, 64, 2, 1, D, D, 6>>();
+    Add<C::Type< 64, 256, 64, 1, 1, D, D, 4>>();
+    Add<C::Type< 64, 128, 64, 1, 1, D, D, 6>>();
+    Add<C::Type< 64,  64, 64, 1, 1, D, D, 8>>();
+    // clang-format on
+
+    // The MoE weights are kept K-major without packing for the `wgmma` kernels, `mma.sync` kernels of the same
+    // layout cover the shapes below the `wgmma` tiles
+    using S = sm80_s16816::Sm80_s16816<Sm90,
+                                       T,
+                                       sm80_s16816::Operand_A<T, kRowMajor>,  // A
+                                       Transform_Default,                     // tarnsform A
+                                       VoidOperand,                           // U
+                                       sm80_s16816::Operand_B<T, kRowMajor>,  // B
+                                       Transform_Default,                     // transform B
+                                       VoidOperand,                           // V
+                                       kRowMajor,                             // order_C
+                                       T,                                     // Tc
+                                       Striding::kIndexed,                    // indexed input
+                                       Striding::kBlocked,
+                                       Striding::kBlocked,
+                                       DynamicScheduler<kColMajor>>;
+
+    // clang-format off
+    Add<S::Type<128, 128,  32, 2, 2, 1, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 96,  64,  64, 2, 2, 1, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 64, 128,  64, 1, 4, 1, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 64,  64,  64, 2, 2, 1, D, D, 5, true, 1, 1>>();
+    Add<S::Type< 64,  64, 128, 1, 2, 2, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 32,  64, 128, 1, 2, 2, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 32, 128,  64, 1, 4, 1, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 16,  64, 128, 1, 2, 2, D, D, 3, true, 1, 1>>();
+    Add<S::Type< 16, 128,  64, 1, 4, 1, D, D, 3, true, 1, 1>>();
+    // clang-format on
+#endif
+}
+
+template void Registry::sm90_gmma_dynamic<half>();
+template void Registry::sm90_gmma_dynamic<nv_bfloat16>();
+
+}  // namespace turbomind::gemm
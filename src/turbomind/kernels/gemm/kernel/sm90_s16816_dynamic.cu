@@ -115,6 +115,33 @@ void Registry::sm90_s16816_dynamic()
         Add<C::Type< 16,  64, 128, 1, 2, 2, D, D, 3, true, 1, 128>>();
         // clang-format on
     }
+
+    if constexpr (std::is_same_v<T, half>) {
+        using C = Sm80_s16816<Sm90,
+                              half,
+                              Operand_A<half, kRowMajor>,             // A
+                              Transform_Default,                      // tarnsform A
+                              VoidOperand,                            // U
+                              Operand_B_Pack<uint8_t, kRowMajor, 2>,  // B
+                              Transform_HMMA_16816<1, 0>,             // transform B,
+                              Operand_UV_Pack<uint32_t, true>,        // V
+                              kRowMajor,                              // order_C
+                              half,                                   // Tc
+                              Striding::kIndexed,                     // indexed input
+                              Striding::kBlocked,
+                              Striding::kBlocked,
+                              DynamicScheduler<kColMajor>>;
+
+        // clang-format off
+        Add<C::Type<128, 128,  32, 1, 4, 1, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 64, 128,  64, 1, 4, 1, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 64, 256,  32, 1, 4, 1, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 32,  64, 128, 1, 2, 2, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 32, 128,  64, 1, 4, 1, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 16, 128,  64, 1, 4, 1, D, D, 3, true, 1, 128>>();
+        Add<C::Type< 16,  64, 128, 1, 2, 2, D, D, 3, true, 1, 128>>();
+        // clang-format on
+    }
 }
 
 template void Registry::sm90_s16816_dynamic<half>();
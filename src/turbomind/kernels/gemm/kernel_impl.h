@@ -4,6 +4,7 @@
 
 #include "src/turbomind/kernels/core/common.h"
 #include "src/turbomind/kernels/core/data_type.h"
+#include "src/turbomind/kernels/core/pdl.h"
 #include "src/turbomind/kernels/gemm/context.h"
 #include "src/turbomind/kernels/gemm/cta_map.h"
 #include "src/turbomind/kernels/gemm/desc.h"
@@ -66,6 +67,11 @@ public:
             desc_.quant_b = QuantDesc{QuantType::kDefault, OpV::kGroupSize};
         }
 
+        if constexpr (Gemm::Epilogue::kScale) {
+            desc_.quant_a = QuantDesc{QuantType::kChannel, 0};
+            desc_.quant_b = QuantDesc{QuantType::kChannel, 0};
+        }
+
         desc_.cta_tile = {Gemm::CTA_M, Gemm::CTA_N, Gemm::CTA_K};
         desc_.mma_tile = {Impl::MMA_Map::kGroupM, Impl::MMA_Map::kGroupN, Impl::MMA_Map::kGroupK};
         chunk_size_k_  = Gemm::kChunkSizeK;
@@ -85,11 +91,11 @@ public:
         desc_.split_k = Gemm::kSplitK;
         desc_.sched   = Gemm::kDynamicSched;
 
-        desc_.arch = Gemm::Arch::value;
+        desc_.stream_k = Gemm::kStreamK;
 
-        using CtaMap = typename Gemm::CtaMap;
+        desc_.arch = Gemm::Arch::value;
 
-        auto func = gemm_kernel<Gemm, GemmParam, EpilogueParam, CtaMap>;
+        auto func = GemmKernel<Gemm>::get();
 
         if (smem_size_ > (48 << 10)) {
             cudaFuncSetAttribute(func, cudaFuncAttributeMaxDynamicSharedMemorySize, smem_size_);
@@ -100,6 +106,10 @@ public:
 
         cudaFuncGetAttributes(&desc_.attr, func);
 
+        int device_id = -1;
+        cudaGetDevice(&device_id);
+        cudaDeviceGetAttribute(&sm_count_, cudaDevAttrMultiProcessorCount, device_id);
+
         name_ = GetName();
     }
 
@@ -120,6 +130,7 @@ public:
                const MatrixLayout& Ddesc,
                int                 swizzle,
                int                 splits,
+               int                 stream_k,
                Workspace&          workspace,
                cudaStream_t        stream) const override
     {
@@ -155,6 +166,14 @@ public:
                 const int2 tiles = get_tiled_shape(m, n, CTA_M, CTA_N);
                 const int4 shape{m, n, k, 1};
 
+                // Stream-K shares the workspace of serial split-k for the fix-up of the tiles split among CTAs
+                if (Gemm::kStreamK && stream_k && chunk_cnt > 1 && FixSplits(shape, tiles, 2, workspace) > 1) {
+                    const int64_t iters = (int64_t)tiles.x * tiles.y * chunk_cnt;
+                    // All CTAs must be resident, a CTA may wait for the partial sums of the others
+                    const int ctas = std::min<int64_t>(sm_count_ * desc_.max_active_ctas, iters);
+                    return Map{shape, tiles, 1, 0, CTA_K, Gemm::kChunkSizeK, ctas};
+                }
+
                 if (splits > 1) {
                     splits = FixSplits(shape, tiles, splits, workspace);
                 }
@@ -198,16 +217,33 @@ public:
 
         const bool silu_act = ((int)operation.epilogue & (int)Epilogue::kGatedSilu);
 
+        const bool scatter = ((int)operation.epilogue & (int)Epilogue::kScatterAdd);
+
         MatrixLayout Pdesc = Ddesc;
         Pdesc.ld           = mk2cs<Gemm::kOrderC>(Pdesc.rows, Pdesc.cols).x;
 
         MatrixCombination_v3 combin_mat{to_param((void*)C, Cdesc), alpha, beta};
 
+        // per-row scales of A (U) and per-column scales of B (V) in the order of C
+        MatrixParam scale_S{};
+        MatrixParam scale_C{};
+        if constexpr (Gemm::Epilogue::kScale) {
+            scale_S = to_param((void*)U, Udesc);
+            scale_C = to_param((void*)V, _Vdesc);
+            if constexpr (Gemm::kOrderC == kColMajor) {
+                std::swap(scale_S, scale_C);
+            }
+        }
+
         EpilogueParam epilogue{to_param((void*)D, Ddesc),
                                to_param((void*)workspace.partials, Pdesc),
                                (int*)workspace.barriers,
+                               scale_S,
+                               scale_C,
                                combin_mat,
-                               silu_act};
+                               silu_act,
+                               scatter ? operation.scatter_idxs : nullptr,
+                               scatter ? operation.scatter_scales : nullptr};
 
         // std::cout << Adesc.offsets << " " << Adesc.idxs << "\n";
 
@@ -223,7 +259,9 @@ public:
 
         // std::cout << grid.x << " " << grid.y << " " << grid.z << "\n";
 
-        gemm_kernel<Gemm><<<grid, block, smem_size_, stream>>>(param, epilogue, sched);
+        auto func = GemmKernel<Gemm>::get();
+
+        LaunchKernel(func, grid, block, smem_size_, stream, param, epilogue, sched);
 
         return 0;
     }
@@ -297,6 +335,9 @@ public:
 
         return splits;
     }
+
+private:
+    int sm_count_{};
 };
 
 }  // namespace turbomind::gemm
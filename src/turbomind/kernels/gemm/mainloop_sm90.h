@@ -0,0 +1,272 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/data_type.h"
+#include "src/turbomind/kernels/core/layout.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/core/meta.h"
+#include "src/turbomind/kernels/core/smem.h"
+#include "src/turbomind/kernels/gemm/arch/mma_sm90.h"
+#include "src/turbomind/kernels/gemm/arch/operand_sm90_gmma.h"
+#include "src/turbomind/kernels/gemm/operand.h"
+#include "src/turbomind/kernels/gemm/smem_copy.h"
+#include "src/turbomind/kernels/gemm/thread_map.h"
+#include "src/turbomind/kernels/gemm/types.h"
+#include "src/turbomind/kernels/gemm/utils.h"
+#include <cuda_pipeline_primitives.h>
+
+namespace turbomind::gemm {
+
+// Warp specialized mainloop for sm90. The first warpgroup is the producer, it fills a ring of `Stages` smem buffers
+// with `cp.async` and signals a "full" mbarrier per stage. The remaining `TG_M * TG_N` warpgroups are consumers, each
+// computes a (64, CTA_N / TG_N) slice of the CTA tile with `wgmma` reading both operands from smem, and releases the
+// stage through an "empty" mbarrier once the mma reading it has retired.
+//
+// Operands are loaded with the sm80 iterators instead of TMA, this is required by the gathered A (`kIndexed`) and
+// per-expert B pointers (`kBlocked`) used by the grouped gemm. The sm80 swizzled layout of a K-major 64-wide tile is
+// the 128B swizzle layout of `wgmma` so no conversion is needed, 8-bit types use the same layout in bytes.
+template<class MMA_Atom_,
+         int TG_M,
+         int TG_N,
+         class OperandA_,
+         class IteratorA_,
+         class OperandB_,
+         class IteratorB_,
+         int CTA_M_,
+         int CTA_N_,
+         int CTA_K_,
+         int Stages_>
+struct MainloopSm90 {
+
+    using MMA_Atom = MMA_Atom_;
+
+    static constexpr int CTA_M = CTA_M_;
+    static constexpr int CTA_N = CTA_N_;
+    static constexpr int CTA_K = CTA_K_;
+
+    static constexpr int Stages = Stages_;
+
+    static constexpr auto kOpClass = MMA_Atom::kOpClass;
+
+    static constexpr int kGroupThreads    = MMA_Atom::kThreadCount;
+    static constexpr int kConsumerGroups  = TG_M * TG_N;
+    static constexpr int kProducerThreads = kGroupThreads;
+
+    static constexpr int WARPS = (1 + kConsumerGroups) * kGroupThreads / WARP_SIZE;
+
+    static constexpr int WG_M = CTA_M / TG_M;
+    static constexpr int WG_N = CTA_N / TG_N;
+
+    static_assert(WG_M == MMA_Atom::M);
+    static_assert(WG_N % MMA_Atom::N == 0);
+
+    static constexpr int kAtomN = WG_N / MMA_Atom::N;
+
+    // warpgroup partition of the CTA tile
+    struct MMA_Map {
+        static constexpr int kGroupM = TG_M;
+        static constexpr int kGroupN = TG_N;
+        static constexpr int kGroupK = 1;
+    };
+
+    using FragC = typename MMA_Atom::FragC[kAtomN];
+
+    static constexpr int kProducerWarps = kProducerThreads / WARP_SIZE;
+
+    using OperandA = MakeOperand<OperandA_, IteratorA_, CTA_M, CTA_K, kProducerWarps>;
+    using OperandU = MakeOperand<VoidOperand, IteratorA_, CTA_M, CTA_K, kProducerWarps>;
+
+    using OperandB = MakeOperand<OperandB_, IteratorB_, CTA_N, CTA_K, kProducerWarps>;
+    using OperandV = MakeOperand<VoidOperand, IteratorB_, CTA_N, CTA_K, kProducerWarps>;
+
+    using Ta = typename OperandA::Dtype;
+    using Tb = typename OperandB::Dtype;
+    using Tu = typename OperandU::Dtype;
+    using Tv = typename OperandV::Dtype;
+
+    using SmemLayoutA = typename OperandA::SmemLayout;
+    using SmemLayoutB = typename OperandB::SmemLayout;
+
+    using GmemIterA = typename OperandA::GmemIter;
+    using GmemIterB = typename OperandB::GmemIter;
+
+    // one 128B swizzle atom along K
+    static_assert(CTA_K * bitsof<Ta> == 128 * 8);
+    static_assert(OperandA::kOrder == kRowMajor && OperandB::kOrder == kRowMajor, "operands must be K-major");
+    using SW128_A = decltype(sm90_gmma::GetSmemLayout_SW128<Ta>::apply(pair<CTA_M, CTA_K>{}));
+    using SW128_B = decltype(sm90_gmma::GetSmemLayout_SW128<Tb>::apply(pair<CTA_N, CTA_K>{}));
+    static_assert(std::is_same_v<SmemLayoutA, SW128_A> && std::is_same_v<SmemLayoutB, SW128_B>);
+
+    static constexpr int kRowBytes = CTA_K * sizeof(Ta);
+
+    struct SharedStorage {
+        __align__(1024) Array<Ta, Stages * SmemLayoutA::kSize> A;
+        __align__(1024) Array<Tb, Stages * SmemLayoutB::kSize> B;
+    };
+
+    // kept out of the union with the epilogue storage
+    struct Barriers {
+        __align__(8) uint64_t full[Stages];
+        __align__(8) uint64_t empty[Stages];
+    };
+
+    __device__ void Prologue(
+        GmemIterA& gmem_A, GmemIterB& gmem_B, bool is_producer, SharedStorage& storage, Barriers& barriers)
+    {
+        if (is_producer) {
+            // rows out of the tile extent are never written by `cp.async`
+            PRAGMA_UNROLL
+            for (int s = 0; s < Stages; ++s) {
+                gmem_A.smem_data_ = storage.A.data() + s * SmemLayoutA::kSize;
+                gmem_B.smem_data_ = storage.B.data() + s * SmemLayoutB::kSize;
+                gmem_A.ClearSmem();
+                gmem_B.ClearSmem();
+            }
+        }
+
+        if (threadIdx.x == 0) {
+            PRAGMA_UNROLL
+            for (int s = 0; s < Stages; ++s) {
+                mbarrier_init(&barriers.full[s], kProducerThreads);
+                mbarrier_init(&barriers.empty[s], kConsumerGroups * kGroupThreads);
+            }
+        }
+
+        __syncthreads();
+    }
+
+    __device__ void
+    Produce(GmemIterA& gmem_A, GmemIterB& gmem_B, int tile_iter, SharedStorage& storage, Barriers& barriers)
+    {
+        PRAGMA_NO_UNROLL
+        for (int i = 0; i < tile_iter; ++i) {
+            const int s = i % Stages;
+            if (i >= Stages) {
+                mbarrier_wait(&barriers.empty[s], (i / Stages - 1) & 1);
+            }
+            gmem_A.smem_data_ = storage.A.data() + s * SmemLayoutA::kSize;
+            gmem_B.smem_data_ = storage.B.data() + s * SmemLayoutB::kSize;
+            gmem_A.Prefetch(true);
+            gmem_B.Prefetch(true);
+            mbarrier_arrive_cp_async(&barriers.full[s]);
+            gmem_A.Advance();
+            gmem_B.Advance();
+        }
+
+        __pipeline_commit();
+        __pipeline_wait_prior(0);
+    }
+
+    __device__ void Consume(FragC& frag_C, int tile_iter, SharedStorage& storage, Barriers& barriers)
+    {
+        const int wg_id = threadIdx.x / kGroupThreads - 1;
+
+        const int offset_m = wg_id % TG_M * WG_M;
+        const int offset_n = wg_id / TG_M * WG_N;
+
+        const uint32_t smem_A = cast_smem_ptr_to_uint(storage.A.data()) + offset_m * kRowBytes;
+        const uint32_t smem_B = cast_smem_ptr_to_uint(storage.B.data()) + offset_n * kRowBytes;
+
+        constexpr int kStageBytesA = SmemLayoutA::kSize * sizeof(Ta);
+        constexpr int kStageBytesB = SmemLayoutB::kSize * sizeof(Tb);
+
+        constexpr int kStepK  = MMA_Atom::K * sizeof(Ta);
+        constexpr int kStride = 8 * kRowBytes;
+
+        PRAGMA_NO_UNROLL
+        for (int i = 0; i < tile_iter; ++i) {
+            const int s = i % Stages;
+
+            mbarrier_wait(&barriers.full[s], i / Stages & 1);
+            fence_proxy_async_smem();
+
+            PRAGMA_UNROLL
+            for (int n = 0; n < kAtomN; ++n) {
+                gmma_fence_operand(frag_C[n]);
+            }
+
+            gmma_fence();
+
+            PRAGMA_UNROLL
+            for (int k = 0; k < CTA_K / MMA_Atom::K; ++k) {
+                const uint64_t desc_a = make_gmma_desc_sw128(smem_A + s * kStageBytesA + k * kStepK, kStride);
+                PRAGMA_UNROLL
+                for (int n = 0; n < kAtomN; ++n) {
+                    const uint32_t addr_b = smem_B + s * kStageBytesB + n * MMA_Atom::N * kRowBytes + k * kStepK;
+                    MMA_Atom::fma(frag_C[n], desc_a, make_gmma_desc_sw128(addr_b, kStride));
+                }
+            }
+
+            gmma_commit();
+
+            PRAGMA_UNROLL
+            for (int n = 0; n < kAtomN; ++n) {
+                gmma_fence_operand(frag_C[n]);
+            }
+
+            // the mma of the previous stage has retired after this
+            gmma_wait<1>();
+
+            if (i > 0) {
+                mbarrier_arrive(&barriers.empty[(i - 1) % Stages]);
+            }
+        }
+
+        gmma_wait<0>();
+
+        PRAGMA_UNROLL
+        for (int n = 0; n < kAtomN; ++n) {
+            gmma_fence_operand(frag_C[n]);
+        }
+    }
+};
+
+// Store the `wgmma` accumulators of the consumer warpgroups to smem for the epilogue
+template<class Mainloop>
+struct RearrangeGmma {
+    using Atom = typename Mainloop::MMA_Atom;
+
+    template<class FragC, class T, class Layout, Order order, int TM, int TN>
+    __device__ static void apply(FragC& frag_C, SmemAccessorV2<T, Layout, order>& smem_C, int2 offset_mn, pair<TM, TN>)
+    {
+        static_assert(TM == Mainloop::CTA_M && TN == Mainloop::CTA_N, "tiled epilogue is not supported");
+
+        const int wg_id = threadIdx.x / Mainloop::kGroupThreads - 1;
+
+        if (wg_id >= 0) {
+            const int offset_m = wg_id % Mainloop::MMA_Map::kGroupM * Mainloop::WG_M;
+            const int offset_n = wg_id / Mainloop::MMA_Map::kGroupM * Mainloop::WG_N;
+
+            auto ptr = &smem_C(0, 0);
+
+            PRAGMA_UNROLL
+            for (int n = 0; n < Mainloop::kAtomN; ++n) {
+                PRAGMA_UNROLL
+                for (int i = 0; i < Atom::FragC::size() / 2; ++i) {
+                    const int2 mn  = Atom::offset_C(threadIdx.x, i);
+                    const int  mm  = offset_m + mn.x;
+                    const int  nn  = offset_n + n * Atom::N + mn.y;
+                    const auto vec = (Array<T, 2>&)frag_C[n][i * 2];
+                    if constexpr (order == kRowMajor) {
+                        const int2 cs = mk2cs<order>(mm, nn);
+                        Store(&ptr[Layout::apply(cs.y, cs.x)], vec);
+                    }
+                    else {
+                        PRAGMA_UNROLL
+                        for (int j = 0; j < 2; ++j) {
+                            const int2 cs                  = mk2cs<order>(mm, nn + j);
+                            ptr[Layout::apply(cs.y, cs.x)] = vec[j];
+                        }
+                    }
+                }
+            }
+        }
+
+        __syncthreads();
+    }
+};
+
+}  // namespace turbomind::gemm
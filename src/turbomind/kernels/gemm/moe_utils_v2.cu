@@ -560,6 +560,192 @@ __global__ void MoeGateKernel_v8(float*       scales,  // [e,n]
     }
 }
 
+// Warp-per-token gating with group-limited expert selection (DeepSeek-style MoE). Experts are partitioned into
+// `n_group` contiguous groups of `lanes_per_group` lanes, the `topk_group` groups with the highest maximum score are
+// kept and the top-k experts are then selected among the survivors. The histogram of the selection is accumulated
+// in the same pass, so `MoeScanKernel_v2` can produce the offsets right after.
+template<int max_expert_num, int access_size, int block_dim, class Mask>
+__global__ void MoeGateGroupedKernel(float*       scales,  // [e,n]
+                                     Mask*        masks,   // [E,n], padded
+                                     int*         accum,   // [E,tiles]
+                                     const float* logits,  // [n,E]
+                                     int          log_tile,
+                                     int          tiles,
+                                     int          token_num,
+                                     int          token_num_padded,
+                                     int          expert_num,
+                                     int          top_k,
+                                     int          lanes_per_group,
+                                     int          topk_group,
+                                     bool         softmax,
+                                     bool         norm_topk,
+                                     float        routed_scale)
+{
+    constexpr int max_tiles        = kMoeGateMaxTiles;
+    constexpr int items_per_thread = max_expert_num / WARP_SIZE;
+
+    static_assert(max_expert_num % WARP_SIZE == 0);
+    static_assert(items_per_thread % access_size == 0);
+
+    __shared__ int shared_accum[max_tiles][max_expert_num + 1];
+
+    for (int i = threadIdx.x; i < max_tiles * (max_expert_num + 1); i += block_dim) {
+        (&shared_accum[0][0])[i] = 0;
+    }
+
+    __syncthreads();
+
+    const int lane_id = threadIdx.x % WARP_SIZE;
+    const int ti      = (threadIdx.x + blockIdx.x * block_dim) / WARP_SIZE;
+
+    float data[items_per_thread];
+    PRAGMA_UNROLL
+    for (int i = 0; i < items_per_thread; ++i) {
+        data[i] = -std::numeric_limits<float>::infinity();
+    }
+
+    float max_val = -std::numeric_limits<float>::infinity();
+    if (ti < token_num) {
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; i += access_size) {
+            const int e = lane_id * items_per_thread + i;  // blocked partition
+            if (e < expert_num) {
+                Ldg((Array<float, access_size>&)data[i], &logits[ti * expert_num + e]);
+            }
+        }
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; ++i) {
+            max_val = fmaxf(max_val, data[i]);
+        }
+    }
+
+    // score of the group, the lanes of a group are contiguous
+    float group_val = max_val;
+    PRAGMA_UNROLL
+    for (int m = WARP_SIZE / 2; m >= 1; m /= 2) {
+        if (m < lanes_per_group) {
+            group_val = fmaxf(group_val, __shfl_xor_sync((uint32_t)-1, group_val, m));
+        }
+    }
+
+    float max_logit = group_val;
+    PRAGMA_UNROLL
+    for (int m = WARP_SIZE / 2; m >= lanes_per_group; m /= 2) {
+        max_logit = fmaxf(max_logit, __shfl_xor_sync((uint32_t)-1, max_logit, m));
+    }
+
+    const int group_id = lane_id / lanes_per_group;
+
+    bool alive = false;
+    for (int k = 0; k < topk_group; ++k) {
+        float g_max_val = group_val;
+        PRAGMA_UNROLL
+        for (int m = WARP_SIZE / 2; m >= 1; m /= 2) {
+            g_max_val = fmaxf(g_max_val, __shfl_xor_sync((uint32_t)-1, g_max_val, m));
+        }
+        // tie breaking
+        const auto active = __ballot_sync((uint32_t)-1, group_val == g_max_val);
+        if (group_id == (__ffs(active) - 1) / lanes_per_group) {
+            alive     = true;
+            group_val = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    // experts of the dropped groups are excluded from the selection
+    const unsigned alive_mask = alive ? (unsigned)-1 : 0U;
+
+    unsigned mask  = alive_mask;
+    int      count = 0;
+
+    for (int k = 0; k < top_k; ++k) {
+        unsigned bit     = 1;
+        unsigned max_bit = 0;
+        float    val     = -std::numeric_limits<float>::infinity();
+        // local maximum
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; ++i) {
+            if ((mask & bit) && data[i] > val) {
+                max_bit = bit;
+                val     = data[i];
+            }
+            asm("shl.b32 %0, %1, 1;\n" : "=r"(bit) : "r"(bit));
+        }
+        float g_max_val = val;
+        PRAGMA_UNROLL
+        for (int m = WARP_SIZE / 2; m >= 1; m /= 2) {
+            g_max_val = fmaxf(g_max_val, __shfl_xor_sync((uint32_t)-1, g_max_val, m));
+        }
+        // tie breaking
+        const auto active = __ballot_sync((uint32_t)-1, val == g_max_val);
+        if (lane_id == __ffs(active) - 1) {
+            mask -= max_bit;
+            ++count;
+        }
+    }
+
+    mask = alive_mask & ~mask;
+
+    int used[items_per_thread];
+    {
+        unsigned bit = 1;
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; ++i) {
+            used[i] = (mask & bit) > 0;
+            asm("shl.b32 %0, %1, 1;\n" : "=r"(bit) : "r"(bit));
+        }
+    }
+
+    float sum_prob{};
+
+    if (softmax) {
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; ++i) {
+            if (!norm_topk || used[i]) {
+                data[i] = expf(data[i] - max_logit);
+                sum_prob += data[i];
+            }
+        }
+        PRAGMA_UNROLL
+        for (int m = WARP_SIZE / 2; m >= 1; m /= 2) {
+            sum_prob += __shfl_xor_sync((uint32_t)-1, sum_prob, m);
+        }
+        sum_prob = fdividef(1.f, sum_prob);
+    }
+    else {
+        sum_prob = 1.f;
+    }
+
+    using WarpScan = cub::WarpScan<int>;
+    __shared__ typename WarpScan::TempStorage temp_storage[block_dim / WARP_SIZE];
+
+    int idx{};
+    WarpScan{temp_storage[threadIdx.x / WARP_SIZE]}.ExclusiveSum(count, idx);
+
+    if (ti < token_num) {
+        PRAGMA_UNROLL
+        for (int i = 0; i < items_per_thread; ++i) {
+            if (used[i]) {
+                const int e                      = lane_id * items_per_thread + i;
+                masks[e * token_num_padded + ti] = idx;
+                scales[idx * token_num + ti]     = data[i] * sum_prob * routed_scale;
+                atomicAdd(&shared_accum[ti >> log_tile][e], 1);
+                ++idx;
+            }
+        }
+    }
+
+    __syncthreads();
+
+    for (int i = 0; i < max_expert_num * max_tiles; i += block_dim) {
+        int t = (threadIdx.x + i) % max_tiles;
+        int e = (threadIdx.x + i) / max_tiles;
+        if (e < expert_num && t < tiles) {
+            atomicAdd(accum + e * tiles + t, shared_accum[t][e]);
+        }
+    }
+}
+
+
 template<int N>
 inline constexpr std::integral_constant<int, N> _Int{};
 
@@ -574,6 +760,8 @@ void invokeMoeGate_V2(int*         f2n,            // [e*n]  -> n
                       int          tokens_padded,  //  round_up(n, 4)
                       int          experts,        //  E
                       int          experts_per_token,
+                      int          n_group,
+                      int          topk_group,
                       bool         softmax,
                       bool         norm_topk,
                       float        routed_scale,
@@ -613,9 +801,38 @@ void invokeMoeGate_V2(int*         f2n,            // [e*n]  -> n
                 routed_scale);
     };
 
+    auto invoke_grouped = [&](auto max_expert_num, auto vec_size) {
+        constexpr int items_per_thread = max_expert_num.value / WARP_SIZE;
+        // a single group spans the whole warp when there is no group limit
+        const int lanes_per_group = n_group > 1 ? experts / n_group / items_per_thread : WARP_SIZE;
+
+        constexpr int threads = 256;
+        const int     blocks  = ceil_div(tokens, threads / WARP_SIZE);
+
+        cudaMemsetAsync(masks, -1, sizeof(int8_t) * experts * tokens_padded, st);
+
+        MoeGateGroupedKernel<max_expert_num.value, vec_size.value, threads><<<blocks, threads, 0, st>>>(  //
+            scales,
+            (int8_t*)masks,
+            accum,
+            logits,
+            log_tile,
+            tiles,
+            tokens,
+            tokens_padded,
+            experts,
+            experts_per_token,
+            lanes_per_group,
+            n_group > 1 ? topk_group : 1,
+            softmax,
+            norm_topk,
+            routed_scale);
+    };
+
     auto fail = [&] {
         std::cerr << __FILE__ << "(" << __LINE__ << "): unsupported moe config: expert_num=" << experts
-                  << ", top_k=" << experts_per_token << ", softmax=" << softmax << ", norm_topk=" << norm_topk << "\n";
+                  << ", top_k=" << experts_per_token << ", n_group=" << n_group << ", topk_group=" << topk_group
+                  << ", softmax=" << softmax << ", norm_topk=" << norm_topk << "\n";
         std::abort();
     };
 
@@ -624,7 +841,30 @@ void invokeMoeGate_V2(int*         f2n,            // [e*n]  -> n
         fail();
     }
 
-    if (experts <= 8) {
+    // The lanes of a group must be a power of 2 that evenly divides the warp
+    auto is_groupable = [&](int items_per_thread) {
+        if (n_group <= 1) {
+            return true;
+        }
+        if (experts % n_group || experts / n_group % items_per_thread || topk_group > n_group) {
+            return false;
+        }
+        const int lanes_per_group = experts / n_group / items_per_thread;
+        return lanes_per_group <= WARP_SIZE && (lanes_per_group & (lanes_per_group - 1)) == 0;
+    };
+
+    if (n_group > 1 || experts > 160) {
+        if (experts <= 160 && is_groupable(160 / WARP_SIZE)) {
+            invoke_grouped(_Int<160>, _Int<1>);
+        }
+        else if (experts <= 256 && is_groupable(256 / WARP_SIZE)) {
+            invoke_grouped(_Int<256>, _Int<4>);
+        }
+        else {
+            fail();
+        }
+    }
+    else if (experts <= 8) {
         if (experts_per_token <= 2) {
             invoke(_Int<8>, _Int<2>, _Int<8>, _Int<4>);
         }
@@ -712,22 +952,24 @@ __global__ void MoeReduceKernel(T*           dst,         // [  n, d]
                                 const float* dst_scales,  // [n]
                                 int          dims,
                                 int          tokens,
-                                float        dst_scale)
+                                float        dst_scale,
+                                const T*     dst_src)     // [  n, d], optional
 {
     using Vec = Array<T, vec_size>;
 
     const int64_t ti = blockIdx.x;
 
     auto dst_ptr = (Vec*)dst + dims * ti;
+    auto in_ptr  = (const Vec*)(dst_src ? dst_src : dst) + dims * ti;
 
     if (dst_scales) {
         dst_scale = dst_scales[ti];
         dst_scale = fdividef(1.f, 1.f + expf(-dst_scale));
     }
 
-    // Should be warp uniforms
-    const Vec* src_ptr[exp_k];
-    float      scale[exp_k];
+    // Should be warp uniforms, `exp_k == 0` only scales `dst`
+    const Vec* src_ptr[exp_k ? exp_k : 1];
+    float      scale[exp_k ? exp_k : 1];
     PRAGMA_UNROLL
     for (int e = 0; e < exp_k; ++e) {
         src_ptr[e] = (const Vec*)src + dims * en2f[e * tokens + ti];
@@ -739,7 +981,7 @@ __global__ void MoeReduceKernel(T*           dst,         // [  n, d]
         Array<float, vec_size> accum{};
         if (dst_scale) {
             Vec v;
-            Ldg(v, dst_ptr[i].data());
+            Ldg(v, in_ptr[i].data());
             using namespace ops;
             accum = cast<float>(v) * dst_scale;
         }
@@ -756,7 +998,7 @@ __global__ void MoeReduceKernel(T*           dst,         // [  n, d]
         Array<T, vec_size> accum{};
         if (dst_scale) {
             Vec v;
-            Ldg(v, dst_ptr[i].data());
+            Ldg(v, in_ptr[i].data());
             using namespace ops;
             accum = v * (T)dst_scale;
         }
@@ -783,7 +1025,8 @@ void invokeMoeReduce(T*           dst,
                      int          experts_per_token,
                      int          dims,
                      float        dst_scale,
-                     cudaStream_t st)
+                     cudaStream_t st,
+                     const T*     dst_src)
 {
     // std::cout << __PRETTY_FUNCTION__ << std::endl;
 
@@ -799,10 +1042,13 @@ void invokeMoeReduce(T*           dst,
             dst_scales,
             dims / vec_size,
             tokens,
-            dst_scale);
+            dst_scale,
+            dst_src);
     };
 
     switch (experts_per_token) {
+        case 0:
+            return invoke(std::integral_constant<int, 0>{});
         case 1:
             return invoke(std::integral_constant<int, 1>{});
         case 2:
@@ -819,13 +1065,50 @@ void invokeMoeReduce(T*           dst,
     }
 }
 
-template void
-invokeMoeReduce(half*, const half*, const float*, const int*, const float*, int, int, int, float, cudaStream_t);
-#ifdef ENABLE_BF16
 template void invokeMoeReduce(
-    nv_bfloat16*, const nv_bfloat16*, const float*, const int*, const float*, int, int, int, float, cudaStream_t);
+    half*, const half*, const float*, const int*, const float*, int, int, int, float, cudaStream_t, const half*);
+#ifdef ENABLE_BF16
+template void invokeMoeReduce(nv_bfloat16*,
+                              const nv_bfloat16*,
+                              const float*,
+                              const int*,
+                              const float*,
+                              int,
+                              int,
+                              int,
+                              float,
+                              cudaStream_t,
+                              const nv_bfloat16*);
 #endif
 
+__global__ void MoeScatterScalesKernel(float* dst, const float* scales, const int* en2f, int count)
+{
+    const int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i < count) {
+        dst[en2f[i]] = scales[i];
+    }
+}
+
+void invokeMoeScatterScales(float* dst, const float* scales, const int* en2f, int count, cudaStream_t st)
+{
+    if (count) {
+        constexpr int threads = 256;
+        MoeScatterScalesKernel<<<cdiv(count, threads), threads, 0, st>>>(dst, scales, en2f, count);
+    }
+}
+
+__global__ void MoeAccumCountsKernel(int64_t* counts, const int* offsets, int experts)
+{
+    for (int e = threadIdx.x; e < experts; e += blockDim.x) {
+        counts[e] += offsets[e + 1] - offsets[e];
+    }
+}
+
+void invokeMoeAccumCounts(int64_t* counts, const int* offsets, int experts, cudaStream_t st)
+{
+    MoeAccumCountsKernel<<<1, 256, 0, st>>>(counts, offsets, experts);
+}
+
 std::vector<int> SampleUniform(int token_num, int expert_num, int exp_per_tok, std::mt19937& g)
 {
     std::vector<int> idxs((size_t)token_num * exp_per_tok);
@@ -879,115 +1162,4 @@ std::vector<int> SampleBalanced(int token_num, int expert_num, int exp_per_tok,
     return ret;
 }
 
-template<int max_expert_num, int items_per_thread, int access_size>
-__global__ void MoeSoftmaxMaskTopKGroups(float* logits, int token_num, int expert_num, int top_k)
-{
-    constexpr int threads_per_token = max_expert_num / items_per_thread;
-
-    static_assert((threads_per_token & (threads_per_token - 1)) == 0);
-    static_assert(items_per_thread % access_size == 0);
-
-    const int thread_idx = threadIdx.x + blockIdx.x * blockDim.x;
-
-    const int ti = thread_idx / threads_per_token;
-    const int ei = thread_idx % threads_per_token;
-
-    float data[items_per_thread];
-    PRAGMA_UNROLL
-    for (int i = 0; i < items_per_thread; ++i) {
-        data[i] = -std::numeric_limits<float>::infinity();
-    }
-    // max logit in the group
-    float max_val = -std::numeric_limits<float>::infinity();
-    if (ti < token_num) {
-        PRAGMA_UNROLL
-        for (int i = 0; i < items_per_thread; i += access_size) {
-            const int e = ei * items_per_thread + i;  // blocked partition
-            if (e < expert_num) {
-                Ldg((Array<float, access_size>&)data[i], &logits[ti * expert_num + e]);
-                PRAGMA_UNROLL
-                for (int c = 0; c < access_size; ++c) {
-                    max_val = fmaxf(max_val, data[i + c]);
-                }
-            }
-        }
-    }
-
-    const int warp_ti        = threadIdx.x % WARP_SIZE / threads_per_token;
-    const int warp_ti_offset = warp_ti * threads_per_token;
-
-    bool  alive     = false;
-    float max_logit = 0;
-
-    for (int k = 0; k < top_k; ++k) {
-        int   g_max_ei  = ei;
-        float g_max_val = max_val;
-        PRAGMA_UNROLL
-        for (int m = threads_per_token / 2; m >= 1; m /= 2) {
-            g_max_val = fmaxf(g_max_val, __shfl_xor_sync((uint32_t)-1, g_max_val, m));
-        }
-        // tie breaking
-        const auto active = __ballot_sync((uint32_t)-1, max_val == g_max_val);
-        g_max_ei          = __ffs(active >> (unsigned)warp_ti_offset) - 1;
-        if (k == 0) {
-            max_logit = g_max_val;
-        }
-        if (ei == g_max_ei) {
-            alive   = true;
-            max_val = -std::numeric_limits<float>::infinity();
-        }
-    }
-
-    float sum_prob{};
-
-    PRAGMA_NO_UNROLL
-    for (int i = 0; i < items_per_thread; ++i) {
-        data[i] = expf(data[i] - max_logit);
-        sum_prob += data[i];
-    }
-
-    PRAGMA_UNROLL
-    for (int m = threads_per_token / 2; m >= 1; m /= 2) {
-        sum_prob += __shfl_xor_sync((uint32_t)-1, sum_prob, m);
-    }
-
-    // mask dead logits
-    sum_prob = alive ? fdividef(1.f, sum_prob) : 0;
-
-    PRAGMA_UNROLL
-    for (int i = 0; i < items_per_thread; ++i) {
-        data[i] *= sum_prob;
-    }
-
-    if (ti < token_num) {
-        PRAGMA_UNROLL
-        for (int i = 0; i < items_per_thread; i += access_size) {
-            const int e = ei * items_per_thread + i;
-            if (e < expert_num) {
-                Store(&logits[ti * expert_num + e], (Array<float, access_size>&)data[i]);
-            }
-        }
-    }
-}
-
-void invokeMoeSoftmaxMaskTopKGroups(
-    float* logits, int token_num, int expert_num, int group_size, int top_k, cudaStream_t st)
-{
-    auto invoke = [&](auto max_expert_num, auto items_per_thread, auto vec_size) {
-        constexpr int thrs_per_tok = max_expert_num.value / items_per_thread.value;
-        constexpr int threads      = 256;
-        const int     blocks       = ceil_div(token_num, threads / thrs_per_tok);
-        MoeSoftmaxMaskTopKGroups<max_expert_num.value, items_per_thread.value, vec_size.value>
-            <<<blocks, threads, 0, st>>>(logits, token_num, expert_num, top_k);
-    };
-
-    if (expert_num == 160 && group_size == 20) {
-        return invoke(_Int<160>, _Int<20>, _Int<4>);
-    }
-
-    std::cerr << __FILE__ << "(" << __LINE__ << "): unsupported moe config: expert_num=" << expert_num
-              << ", group_size=" << group_size << "\n";
-    std::abort();
-}
-
 }  // namespace turbomind
@@ -10,6 +10,7 @@ namespace turbomind {
 constexpr int kMoeGateMaxTiles = 16;
 constexpr int kMoeGateVecSize  = 4;
 
+// `n_group > 1` limits the selection to the experts of the `topk_group` groups with the highest scores
 void invokeMoeGate_V2(int*         f2n,
                       int*         en2f,
                       int*         offsets,
@@ -21,6 +22,8 @@ void invokeMoeGate_V2(int*         f2n,
                       int          tokens_padded,
                       int          experts,
                       int          exp_per_tok,
+                      int          n_group,
+                      int          topk_group,
                       bool         softmax,
                       bool         norm_topk,
                       float        routed_scale,
@@ -47,6 +50,8 @@ dispatchMoeGather(T* dst, const T* src, const int* f2n, int tokens, int experts_
     }
 }
 
+// `experts_per_token == 0` only applies the scaling of `dst`. The scaled term is read from `dst_src` instead of `dst`
+// when set, e.g. the output of the shared experts computed into a buffer of its own
 template<class T>
 void invokeMoeReduce(T*           dst,
                      const T*     src,
@@ -57,10 +62,14 @@ void invokeMoeReduce(T*           dst,
                      int          experts_per_token,
                      int          dims,
                      float        dst_scale,
-                     cudaStream_t st);
+                     cudaStream_t st,
+                     const T*     dst_src = nullptr);
 
-void invokeMoeSoftmaxMaskTopKGroups(
-    float* logits, int token_num, int expert_num, int group_size, int top_k, cudaStream_t st);
+// dst[en2f[i]] = scales[i], the routing weights in the order of the expert rows
+void invokeMoeScatterScales(float* dst, const float* scales, const int* en2f, int count, cudaStream_t st);
+
+// counts[e] += offsets[e + 1] - offsets[e], number of tokens routed to each expert
+void invokeMoeAccumCounts(int64_t* counts, const int* offsets, int experts, cudaStream_t st);
 
 // Sample `e` from `E` experts uniformly for every token
 std::vector<int> SampleUniform(int token_num, int expert_num, int exp_per_tok, std::mt19937& g);
@@ -13,6 +13,8 @@ Registry::Registry(std::shared_ptr<cudaDeviceProp> device_prop):
     f16_u4g128_f16_tnt_sm75_s16816();
     f16_u4g128_f16_tnt_sm80_s16816();
     f16_u4g128_f16_tnt_sm90_s16816();
+    f16_u8g128_f16_tnt_sm80_s16816();
+    f16_u8g128_f16_tnt_sm90_s16816();
 
     sm70_s884_dynamic();
     sm75_s16816_dynamic();
@@ -20,6 +22,17 @@ Registry::Registry(std::shared_ptr<cudaDeviceProp> device_prop):
     sm90_s16816_dynamic<half>();
     sm80_s16816_dynamic<nv_bfloat16>();
     sm90_s16816_dynamic<nv_bfloat16>();
+    sm90_gmma_dynamic<half>();
+    sm90_gmma_dynamic<nv_bfloat16>();
+
+    e4m3_e4m3_tnt_sm90_gmma<half>();
+    e4m3_e4m3_tnt_sm90_gmma<nv_bfloat16>();
+    s8_s8_tnt_sm80_s16832<half>();
+    s8_s8_tnt_sm80_s16832<nv_bfloat16>();
+    f16_f16_tnt_sm80_s16816<half>();
+    f16_f16_tnt_sm80_s16816<nv_bfloat16>();
+    f16_f16_tnt_sm90_s16816<half>();
+    f16_f16_tnt_sm90_s16816<nv_bfloat16>();
 
     // u4g128_f16_f16_nnn_sm80_s16816();
 }
@@ -30,6 +30,8 @@ private:
     void f16_u4g128_f16_tnt_sm75_s16816();
     void f16_u4g128_f16_tnt_sm80_s16816();
     void f16_u4g128_f16_tnt_sm90_s16816();
+    void f16_u8g128_f16_tnt_sm80_s16816();
+    void f16_u8g128_f16_tnt_sm90_s16816();
 
     void sm70_s884_dynamic();
     void sm75_s16816_dynamic();
@@ -37,6 +39,17 @@ private:
     void sm80_s16816_dynamic();
     template<class T>
     void sm90_s16816_dynamic();
+    template<class T>
+    void sm90_gmma_dynamic();
+
+    template<class Tc>
+    void e4m3_e4m3_tnt_sm90_gmma();
+    template<class Tc>
+    void s8_s8_tnt_sm80_s16832();
+    template<class T>
+    void f16_f16_tnt_sm80_s16816();
+    template<class T>
+    void f16_f16_tnt_sm90_s16816();
 
     void u4g128_f16_f16_nnn_sm80_s16816();
 
@@ -0,0 +1,296 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/core/mma.h"
+#include "src/turbomind/kernels/gemm/sparse.h"
+
+namespace turbomind {
+
+template<class T>
+__global__ void compress_sparse_24_kernel(T* values, uint16_t* meta, int* violations, const T* src, int k, int n)
+{
+    const int64_t idx = threadIdx.x + (int64_t)blockIdx.x * blockDim.x;
+
+    if (idx >= (int64_t)n * (k / 16)) {
+        return;
+    }
+
+    // consecutive threads read consecutive columns
+    const int ni = idx % n;
+    const int ki = idx / n * 16;
+
+    Array<T, 8> vals;
+    uint32_t    e     = 0;
+    int         count = 0;
+
+    PRAGMA_UNROLL
+    for (int g = 0; g < 4; ++g) {
+        T     x[4];
+        float a[4];
+        int   nz = 0;
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            x[i] = src[(int64_t)(ki + g * 4 + i) * n + ni];
+            a[i] = fabsf((float)x[i]);
+            nz += a[i] != 0.f;
+        }
+        // the 2 largest magnitudes, which are the non-zeros of a 2:4 group
+        int i0 = 0;
+        PRAGMA_UNROLL
+        for (int i = 1; i < 4; ++i) {
+            i0 = a[i] > a[i0] ? i : i0;
+        }
+        int i1 = i0 == 0 ? 1 : 0;
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            i1 = i != i0 && a[i] > a[i1] ? i : i1;
+        }
+        if (i0 > i1) {
+            const int tmp = i0;
+            i0            = i1;
+            i1            = tmp;
+        }
+        vals[g * 2 + 0] = x[i0];
+        vals[g * 2 + 1] = x[i1];
+        e |= (i0 | i1 << 2) << (g * 4);
+        count += nz > 2;
+    }
+
+    Store(&values[(int64_t)ni * (k / 2) + ki / 2], vals);
+    meta[(int64_t)ni * (k / 16) + ki / 16] = e;
+
+    if (count) {
+        atomicAdd(violations, count);
+    }
+}
+
+template<class T>
+void compress_sparse_24(T* values, uint16_t* meta, int* violations, const T* src, int k, int n, cudaStream_t st)
+{
+    const int64_t count = (int64_t)n * (k / 16);
+
+    if (count == 0) {
+        return;
+    }
+
+    constexpr int block = 256;
+
+    compress_sparse_24_kernel<<<ceil_div<int64_t>(count, block), block, 0, st>>>(values, meta, violations, src, k, n);
+}
+
+template void compress_sparse_24(
+    half* values, uint16_t* meta, int* violations, const half* src, int k, int n, cudaStream_t st);
+template void compress_sparse_24(
+    nv_bfloat16* values, uint16_t* meta, int* violations, const nv_bfloat16* src, int k, int n, cudaStream_t st);
+
+namespace {
+
+constexpr int kCtaN    = 64;  // rows of the transposed sparse weights
+constexpr int kCtaM    = 64;  // tokens
+constexpr int kCtaK    = 64;
+constexpr int kThreads = 128;
+constexpr int kPad     = 8;
+
+}  // namespace
+
+// C^T = B^T * A^T with the 2:4 sparse B^T as the A operand of `mma.sp`, the rows of the (m, k) row-major A are the
+// columns of the col-major B operand. A warp computes 32x32 of C^T, the k tile is double buffered in registers
+template<class T>
+__global__ void __launch_bounds__(kThreads) sparse_gemm_24_kernel(T*              C,
+                                                                  int             ldc,
+                                                                  const T*        A,
+                                                                  int             lda,
+                                                                  const T*        values,
+                                                                  const uint16_t* meta,
+                                                                  int             m,
+                                                                  int             n,
+                                                                  int             k,
+                                                                  float           beta)
+{
+    __shared__ __align__(16) T        smem_b[kCtaN][kCtaK / 2 + kPad];
+    __shared__ __align__(16) uint16_t smem_e[kCtaN][kCtaK / 16];
+    __shared__ __align__(16) T        smem_a[kCtaM][kCtaK + kPad];
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    const int g = lane_id / 4;
+    const int t = lane_id % 4;
+
+    const int cta_n = blockIdx.x * kCtaN;
+    const int cta_m = blockIdx.y * kCtaM;
+
+    const int warp_n = warp_id % 2 * 32;
+    const int warp_m = warp_id / 2 * 32;
+
+    const int ldb = k / 2;
+    const int lde = k / 16;
+
+    using Vec = Array<T, 8>;
+
+    Vec   b_vec[2];
+    Vec   a_vec[4];
+    uint2 e_vec{};
+
+    auto load = [&](int k0) {
+        PRAGMA_UNROLL
+        for (int i = 0; i < 2; ++i) {
+            const int idx = threadIdx.x + i * kThreads;
+            const int r   = idx / 4;
+            const int c   = idx % 4 * 8;
+            Ldg(b_vec[i], values + (int64_t)(cta_n + r) * ldb + k0 / 2 + c);
+        }
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            const int idx = threadIdx.x + i * kThreads;
+            const int r   = idx / 8;
+            const int c   = idx % 8 * 8;
+            if (cta_m + r < m) {
+                Ldg(a_vec[i], A + (int64_t)(cta_m + r) * lda + k0 + c);
+            }
+            else {
+                a_vec[i] = {};
+            }
+        }
+        if (threadIdx.x < kCtaN) {
+            e_vec = *(const uint2*)(meta + (int64_t)(cta_n + threadIdx.x) * lde + k0 / 16);
+        }
+    };
+
+    auto store = [&] {
+        PRAGMA_UNROLL
+        for (int i = 0; i < 2; ++i) {
+            const int idx = threadIdx.x + i * kThreads;
+            Store(&smem_b[idx / 4][idx % 4 * 8], b_vec[i]);
+        }
+        PRAGMA_UNROLL
+        for (int i = 0; i < 4; ++i) {
+            const int idx = threadIdx.x + i * kThreads;
+            Store(&smem_a[idx / 8][idx % 8 * 8], a_vec[i]);
+        }
+        if (threadIdx.x < kCtaN) {
+            *(uint2*)&smem_e[threadIdx.x][0] = e_vec;
+        }
+    };
+
+    Array<float, 4> acc[2][4]{};
+
+    auto compute = [&] {
+        PRAGMA_UNROLL
+        for (int ks = 0; ks < kCtaK / 32; ++ks) {
+            Array<T, 8> frag_b[2];
+            uint32_t    frag_e[2];
+            PRAGMA_UNROLL
+            for (int i = 0; i < 2; ++i) {
+                const int r = warp_n + i * 16 + g;
+                const int c = ks * 16 + t * 2;
+                auto&     u = (Array<uint32_t, 4>&)frag_b[i];
+                u[0]        = (uint32_t&)smem_b[r][c];
+                u[1]        = (uint32_t&)smem_b[r + 8][c];
+                u[2]        = (uint32_t&)smem_b[r][c + 8];
+                u[3]        = (uint32_t&)smem_b[r + 8][c + 8];
+                // the first 2 threads of a quad supply the indices of k [0, 16) and [16, 32) of rows g and g + 8
+                const int s = ks * 2 + (t & 1);
+                frag_e[i]   = smem_e[r][s] | (uint32_t)smem_e[r + 8][s] << 16;
+            }
+            PRAGMA_UNROLL
+            for (int j = 0; j < 4; ++j) {
+                Array<T, 8> frag_a;
+                auto&       u = (Array<uint32_t, 4>&)frag_a;
+                const int   r = warp_m + j * 8 + g;
+                PRAGMA_UNROLL
+                for (int q = 0; q < 4; ++q) {
+                    u[q] = (uint32_t&)smem_a[r][ks * 32 + q * 8 + t * 2];
+                }
+                PRAGMA_UNROLL
+                for (int i = 0; i < 2; ++i) {
+                    mma_sp_m16n8k32_row_col(acc[i][j], frag_b[i], frag_a, acc[i][j], frag_e[i]);
+                }
+            }
+        }
+    };
+
+    load(0);
+
+    for (int k0 = 0; k0 < k; k0 += kCtaK) {
+        __syncthreads();
+        store();
+        __syncthreads();
+        if (k0 + kCtaK < k) {
+            load(k0 + kCtaK);
+        }
+        compute();
+    }
+
+    PRAGMA_UNROLL
+    for (int i = 0; i < 2; ++i) {
+        PRAGMA_UNROLL
+        for (int j = 0; j < 4; ++j) {
+            PRAGMA_UNROLL
+            for (int s = 0; s < 2; ++s) {
+                PRAGMA_UNROLL
+                for (int c = 0; c < 2; ++c) {
+                    const int ni = cta_n + warp_n + i * 16 + s * 8 + g;
+                    const int mi = cta_m + warp_m + j * 8 + t * 2 + c;
+                    if (mi < m) {
+                        T*    p = &C[(int64_t)mi * ldc + ni];
+                        float x = acc[i][j][s * 2 + c];
+                        if (beta) {
+                            x += beta * (float)*p;
+                        }
+                        *p = static_cast<T>(x);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<class T>
+void sparse_gemm_24(T*              C,
+                    int             ldc,
+                    const T*        A,
+                    int             lda,
+                    const T*        values,
+                    const uint16_t* meta,
+                    int             m,
+                    int             n,
+                    int             k,
+                    float           beta,
+                    cudaStream_t    st)
+{
+    if (m == 0) {
+        return;
+    }
+
+    const dim3 grid(n / kCtaN, ceil_div(m, kCtaM));
+
+    sparse_gemm_24_kernel<<<grid, kThreads, 0, st>>>(C, ldc, A, lda, values, meta, m, n, k, beta);
+}
+
+template void sparse_gemm_24(half*           C,
+                             int             ldc,
+                             const half*     A,
+                             int             lda,
+                             const half*     values,
+                             const uint16_t* meta,
+                             int             m,
+                             int             n,
+                             int             k,
+                             float           beta,
+                             cudaStream_t    st);
+template void sparse_gemm_24(nv_bfloat16*       C,
+                             int                ldc,
+                             const nv_bfloat16* A,
+                             int                lda,
+                             const nv_bfloat16* values,
+                             const uint16_t*    meta,
+                             int                m,
+                             int                n,
+                             int                k,
+                             float              beta,
+                             cudaStream_t       st);
+
+}  // namespace turbomind
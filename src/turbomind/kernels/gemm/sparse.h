@@ -0,0 +1,31 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/kernels/core/data_type.h"
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// Compress the (k, n) row-major weights pruned 2:4 along k to the (n, k / 2) row-major non-zeros and the (n, k / 16)
+// metadata of `sparse_gemm_24`, a u16 holds the 2-bit indices of the 8 non-zeros of 16 consecutive k. Groups of 4
+// with more than 2 non-zeros keep the 2 largest magnitudes and are counted in `violations`
+template<class T>
+void compress_sparse_24(T* values, uint16_t* meta, int* violations, const T* src, int k, int n, cudaStream_t st = {});
+
+// C = A * B + beta * C with the (m, k) row-major A and the (k, n) 2:4 sparse B compressed by `compress_sparse_24`,
+// `n` and `k` must be multiples of 64 and `lda` a multiple of 8
+template<class T>
+void sparse_gemm_24(T*              C,
+                    int             ldc,
+                    const T*        A,
+                    int             lda,
+                    const T*        values,
+                    const uint16_t* meta,
+                    int             m,
+                    int             n,
+                    int             k,
+                    float           beta,
+                    cudaStream_t    st = {});
+
+}  // namespace turbomind
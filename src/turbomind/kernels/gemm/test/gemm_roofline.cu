@@ -0,0 +1,334 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Reports, for the linear layers of a model, the launch spec the dispatch cache picks per token count, the achieved
+// throughput against the roofline of the device and cuBLAS on the fp16 weights as the baseline. e.g.
+//   gemm_roofline --config workspace/triton_models/weights/config.yaml --tp 2 --policy reuse --cache tm_cache
+//
+// `--output` writes the times as JSON, as read by `benchmark/search_parallel_layout.py` to cost the parallel layouts
+
+#include "src/turbomind/kernels/gemm/gpu_metric.h"
+#include "src/turbomind/kernels/gemm/kernel.h"
+#include "src/turbomind/kernels/gemm/test/testbed.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+using namespace turbomind;
+using namespace turbomind::gemm;
+
+namespace {
+
+struct Options {
+    std::string config;
+    std::string policy = "default";
+    std::string cache  = "tm_cache";
+    std::string output;
+
+    int tp         = 1;
+    int max_tokens = 8192;
+    int iters      = 20;
+
+    std::vector<int> tokens;
+
+    double peak_bw     = 0;  // GB/s
+    double peak_tflops = 0;
+};
+
+struct Shape {
+    std::string name;
+    int         n;  // output dims
+    int         k;  // input dims
+};
+
+struct Result {
+    std::string layer;
+    int         m;
+    int         n;
+    int         k;
+    float       ms;
+    float       cublas_ms;  // fp16 weights
+};
+
+// Linear layers of a decoder layer with the weights partitioned by tensor parallelism, same as `LlamaDenseWeight`
+std::vector<Shape> GetShapes(const YAML::Node& model, int tp)
+{
+    const int hidden      = model["hidden_units"].as<int>();
+    const int head_num    = model["head_num"].as<int>();
+    const int kv_head_num = model["kv_head_num"].as<int>(head_num);
+    const int head_dim    = model["size_per_head"].as<int>();
+
+    std::set<int> inter_sizes;
+    if (const auto node = model["inter_size"]; node.IsSequence()) {
+        for (const auto& x : node) {
+            inter_sizes.insert(x.as<int>());
+        }
+    }
+    else {
+        inter_sizes.insert(node.as<int>());
+    }
+
+    std::vector<Shape> shapes{
+        {"qkv", (head_num + 2 * kv_head_num) * head_dim / tp, hidden},
+        {"o", hidden, head_num * head_dim / tp},
+    };
+    for (const auto& inter_size : inter_sizes) {
+        if (inter_size > 0) {
+            shapes.push_back({"w13." + std::to_string(inter_size), inter_size * 2 / tp, hidden});
+            shapes.push_back({"w2." + std::to_string(inter_size), hidden, inter_size / tp});
+        }
+    }
+
+    return shapes;
+}
+
+template<class F>
+float Measure(F func, int iters, cudaStream_t stream)
+{
+    cudaEvent_t ev_start, ev_end;
+    cudaEventCreate(&ev_start);
+    cudaEventCreate(&ev_end);
+
+    cudaEventRecord(ev_start, stream);
+    for (int i = 0; i < iters; ++i) {
+        func();
+    }
+    cudaEventRecord(ev_end, stream);
+    cudaEventSynchronize(ev_end);
+
+    float ms{};
+    cudaEventElapsedTime(&ms, ev_start, ev_end);
+
+    cudaEventDestroy(ev_start);
+    cudaEventDestroy(ev_end);
+
+    return ms / iters;
+}
+
+template<class Testbed>
+std::vector<Result> Bench(const std::vector<Shape>& shapes, const Options& opts, DispatchPolicy policy)
+{
+    constexpr int kGroupSize = 128;  // of the u4 kernels
+
+    cudaStream_t stream{};
+    cudaStreamCreate(&stream);
+
+    int device{}, mclock{}, bus{};
+    cudaGetDevice(&device);
+    cudaDeviceGetAttribute(&mclock, cudaDevAttrMemoryClockRate, device);  // kHz
+    cudaDeviceGetAttribute(&bus, cudaDevAttrGlobalMemoryBusWidth, device);
+
+    const double peak_bw    = opts.peak_bw > 0 ? opts.peak_bw * 1e9 : 2. * mclock * 1e3 * bus / 8;
+    const double peak_flops = opts.peak_tflops > 0 ? opts.peak_tflops * 1e12 : 2. * MeasureMmaThroughput();
+
+    printf("peak %.0f GB/s, %.1f TFLOPs\n", peak_bw / 1e9, peak_flops / 1e12);
+    printf("%-12s %6s %6s %6s %-48s %6s %7s %9s %9s %8s %6s %9s\n",
+           "layer",
+           "m",
+           "n",
+           "k",
+           "kernel",
+           "splits",
+           "swizzle",
+           "ms",
+           "GB/s",
+           "TFLOPs",
+           "roof",
+           "cublas");
+
+    Testbed test{policy, opts.cache};
+
+    std::vector<Result> results;
+
+    for (const auto& s : shapes) {
+        if (s.k % kGroupSize) {
+            printf("%-12s skipped, k = %d is not a multiple of the group size %d\n", s.name.c_str(), s.k, kGroupSize);
+            continue;
+        }
+        for (const auto& m : opts.tokens) {
+            {
+                // the testbed is chatty about the packing
+                auto buf = std::cout.rdbuf(nullptr);
+                test.Initialize(m, s.n, s.k, kGroupSize, 0, 1, stream);
+                std::cout.rdbuf(buf);
+            }
+
+            // tune the shape once if requested, then time the spec picked from the cache
+            test.Run();
+            const auto saved      = test.dispatch_policy_;
+            test.dispatch_policy_ = DispatchPolicy::kDefault;
+
+            const auto spec = test.GetLaunchSpec();
+
+            test.Run();
+            const float ms     = Measure([&] { test.Run(); }, opts.iters, stream);
+            const float ref_ms = Measure([&] { test.RunCublas(); }, opts.iters, stream);
+
+            test.dispatch_policy_ = saved;
+
+            // reads of the packed operands and the write of C
+            const double bytes  = test.get_global_memory_reads() + (double)m * s.n * sizeof(half);
+            const double flops  = test.get_element_count();
+            const double sec    = ms * 1e-3;
+            const double t_roof = std::max(bytes / peak_bw, flops / peak_flops);
+
+            printf("%-12s %6d %6d %6d %-48s %6d %7d %9.4f %9.1f %8.2f %5.1f%% %9.4f\n",
+                   s.name.c_str(),
+                   m,
+                   s.n,
+                   s.k,
+                   spec ? spec->kernel->name().c_str() : "-",
+                   spec ? spec->splits : 0,
+                   spec ? spec->swizzle : 0,
+                   ms,
+                   bytes / sec / 1e9,
+                   flops / sec / 1e12,
+                   t_roof / sec * 100.,
+                   ref_ms);
+
+            results.push_back({s.name, m, s.n, s.k, ms, ref_ms});
+        }
+    }
+
+    cudaStreamDestroy(stream);
+
+    return results;
+}
+
+void WriteJson(std::ostream& os, const Options& opts, const std::vector<Result>& results)
+{
+    os << "{\n  \"tp\": " << opts.tp << ",\n  \"iters\": " << opts.iters << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        os << (i ? ",\n" : "\n") << "    {\"layer\": \"" << r.layer << "\", \"m\": " << r.m << ", \"n\": " << r.n
+           << ", \"k\": " << r.k << ", \"ms\": " << r.ms << ", \"cublas_ms\": " << r.cublas_ms << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: gemm_roofline --config FILE [options]\n"
+                 "  --config FILE           turbomind `config.yaml` of the model\n"
+                 "  --tp N                  tensor parallel size (1)\n"
+                 "  --tokens LIST           token counts, comma separated (powers of 2 up to --max-tokens)\n"
+                 "  --max-tokens N          (8192)\n"
+                 "  --policy P              default | reuse | measure, dispatch policy of the kernels (default)\n"
+                 "  --cache FILE            dispatch cache imported by `reuse` and exported by `measure` (tm_cache)\n"
+                 "  --iters N               (20)\n"
+                 "  --peak-bw GBPS          override the peak HBM bandwidth\n"
+                 "  --peak-tflops TFLOPS    override the measured peak mma throughput\n"
+                 "  --output FILE           write the results as JSON\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--config") {
+            opts.config = value;
+        }
+        else if (key == "--tp") {
+            opts.tp = std::stoi(value);
+        }
+        else if (key == "--tokens") {
+            opts.tokens = ParseInts(value);
+        }
+        else if (key == "--max-tokens") {
+            opts.max_tokens = std::stoi(value);
+        }
+        else if (key == "--policy") {
+            opts.policy = value;
+        }
+        else if (key == "--cache") {
+            opts.cache = value;
+        }
+        else if (key == "--iters") {
+            opts.iters = std::stoi(value);
+        }
+        else if (key == "--peak-bw") {
+            opts.peak_bw = std::stod(value);
+        }
+        else if (key == "--peak-tflops") {
+            opts.peak_tflops = std::stod(value);
+        }
+        else if (key == "--output") {
+            opts.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    return ok && !opts.config.empty();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (opts.tokens.empty()) {
+        for (int m = 1; m <= opts.max_tokens; m *= 2) {
+            opts.tokens.push_back(m);
+        }
+    }
+
+    auto policy = DispatchPolicy::kDefault;
+    if (opts.policy == "reuse") {
+        policy = DispatchPolicy::kReuse;
+    }
+    else if (opts.policy == "measure") {
+        policy = DispatchPolicy::kMeasure;
+    }
+    else if (opts.policy != "default") {
+        std::cerr << "unrecognized policy: " << opts.policy << "\n";
+        return 1;
+    }
+
+    const auto model = YAML::LoadFile(opts.config)["model_config"];
+
+    if (const auto weight_type = model["weight_type"].as<std::string>(""); weight_type != "int4") {
+        std::cerr << "weight_type is `" << weight_type << "`, fp weights are computed by cuBLAS, reporting the u4 "
+                  << "kernels for the shapes anyway\n";
+    }
+
+    const auto shapes = GetShapes(model, opts.tp);
+
+    int device{}, major{}, minor{};
+    cudaGetDevice(&device);
+    cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device);
+    cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, device);
+
+    std::vector<Result> results;
+
+    // same weight layouts as `get_weight_and_scales_layout` for u4 weights of dense layers
+    if (major * 10 + minor >= 75) {
+        constexpr Pack kPackB = HMMA_16816 | OPERAND_B | 2;
+        constexpr Pack kPackV = HMMA_16816 | OPERAND_V | 1;
+        results = Bench<Testbed<half, uint4_t, half, 0, kRowMajor, kRowMajor, kRowMajor, 0, kPackB, 0, kPackV>>(
+            shapes, opts, policy);
+    }
+    else {
+        constexpr Pack kPackB = HMMA_884 | OPERAND_B | 1;
+        constexpr Pack kPackV = HMMA_884 | OPERAND_V | 1;
+        results = Bench<Testbed<half, uint4_t, half, 0, kRowMajor, kColMajor, kRowMajor, 0, kPackB, 0, kPackV>>(
+            shapes, opts, policy);
+    }
+
+    if (!opts.output.empty()) {
+        std::ofstream ofs(opts.output);
+        WriteJson(ofs, opts, results);
+    }
+
+    return 0;
+}
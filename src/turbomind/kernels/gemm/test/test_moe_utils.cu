@@ -3,6 +3,7 @@
 #include "src/turbomind/kernels/gemm/tuner/cache_utils.h"
 #include "src/turbomind/kernels/gemm/types.h"
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <numeric>
 #include <sstream>
@@ -53,9 +54,14 @@ RNG& gRNG()
 
 using thrust::universal_vector;
 
+// `n_group` contiguous groups of experts ranked by their maximum logit, the experts of the `topk_group` best ones are
+// selected from. The scales are the softmax over all the experts, renormalized over the top-k with `norm_topk`
 void moe_gate_ref(int                            tokens,
                   int                            expert_num,
                   int                            experts_per_token,
+                  int                            n_group,
+                  int                            topk_group,
+                  bool                           norm_topk,
                   const universal_vector<float>& logits,
                   universal_vector<int>&         offsets,
                   universal_vector<int>&         eids,
@@ -63,58 +69,57 @@ void moe_gate_ref(int                            tokens,
                   universal_vector<int>&         en2f,
                   universal_vector<float>&       scales)
 {
-    std::vector<int> eid_range(expert_num);
-    std::iota(eid_range.begin(), eid_range.end(), 0);
+    const int group_size = expert_num / n_group;
 
     for (int t = 0; t < tokens; ++t) {
         const float* logit   = logits.data().get() + expert_num * t;
         const float  max_val = *std::max_element(logit, logit + expert_num);
-        if constexpr (0) {
-            std::vector<float> probs(logit, logit + expert_num);
-            float              sum = 0;
-            for (auto& p : probs) {
-                p = std::exp(p - max_val);
-                sum += p;
-            }
-            for (auto& p : probs) {
-                p /= sum;
-            }
-            std::vector<int> idxs = eid_range;
-            // Had to use stable sort since there is no `std::stable_nth_element`
-            std::stable_sort(idxs.begin(), idxs.end(), [&](int i, int j) {  //
-                return probs[i] > probs[j];
-            });
-            // Recover natural order in top-k
-            std::sort(idxs.begin(), idxs.begin() + experts_per_token);
-            idxs.resize(experts_per_token);
-            sum = 0;
-            for (int e = 0; e < experts_per_token; ++e) {
-                eids[e * tokens + t] = idxs[e];
-                sum += probs[idxs[e]];
+
+        std::vector<int> groups(n_group);
+        std::iota(groups.begin(), groups.end(), 0);
+        std::vector<float> group_vals(n_group);
+        for (int g = 0; g < n_group; ++g) {
+            group_vals[g] = *std::max_element(logit + g * group_size, logit + (g + 1) * group_size);
+        }
+        // ties go to the lower group
+        std::stable_sort(groups.begin(), groups.end(), [&](int i, int j) {  //
+            return group_vals[i] > group_vals[j];
+        });
+        std::vector<bool> alive(n_group);
+        for (int g = 0; g < topk_group; ++g) {
+            alive[groups[g]] = true;
+        }
+
+        std::vector<int> idxs;
+        for (int e = 0; e < expert_num; ++e) {
+            if (alive[e / group_size]) {
+                idxs.push_back(e);
             }
-            for (int e = 0; e < experts_per_token; ++e) {
-                scales[e * tokens + t] = probs[idxs[e]] / sum;
+        }
+        // Had to use stable sort since there is no `std::stable_nth_element`
+        std::stable_sort(idxs.begin(), idxs.end(), [&](int i, int j) {  //
+            return logit[i] > logit[j];
+        });
+        // Recover natural order in top-k
+        std::sort(idxs.begin(), idxs.begin() + experts_per_token);
+        idxs.resize(experts_per_token);
+
+        float sum = 0;
+        if (!norm_topk) {
+            for (int e = 0; e < expert_num; ++e) {
+                sum += std::exp(logit[e] - max_val);
             }
         }
-        else {
-            std::vector<int> idxs = eid_range;
-            // Had to use stable sort since there is no `std::stable_nth_element`
-            std::stable_sort(idxs.begin(), idxs.end(), [&](int i, int j) {  //
-                return logit[i] > logit[j];
-            });
-            // Recover natural order in top-k
-            std::sort(idxs.begin(), idxs.begin() + experts_per_token);
-            idxs.resize(experts_per_token);
-            std::vector<float> probs(experts_per_token);
-            float              sum = 0;
-            for (int e = 0; e < experts_per_token; ++e) {
-                eids[e * tokens + t] = idxs[e];
-                probs[e]             = std::exp(logit[idxs[e]] - max_val);
+        std::vector<float> probs(experts_per_token);
+        for (int e = 0; e < experts_per_token; ++e) {
+            eids[e * tokens + t] = idxs[e];
+            probs[e]             = std::exp(logit[idxs[e]] - max_val);
+            if (norm_topk) {
                 sum += probs[e];
             }
-            for (int e = 0; e < experts_per_token; ++e) {
-                scales[e * tokens + t] = probs[e] / sum;
-            }
+        }
+        for (int e = 0; e < experts_per_token; ++e) {
+            scales[e * tokens + t] = probs[e] / sum;
         }
     }
 
@@ -168,6 +173,9 @@ struct Tiling {
 bool test_moe_gate(int                     tokens,  //
                    int                     expert_num,
                    int                     experts_per_token,
+                   int                     n_group,
+                   int                     topk_group,
+                   bool                    norm_topk,
                    gemm::Tape&             tape,
                    const Tiling&           tiling,
                    universal_vector<float> logits = {})
@@ -197,7 +205,18 @@ bool test_moe_gate(int                     tokens,  //
     auto en2f_ref    = en2f;
     auto scales_ref  = scales;
 
-    moe_gate_ref(tokens, expert_num, experts_per_token, logits, offsets_ref, eids_ref, f2n_ref, en2f_ref, scales_ref);
+    moe_gate_ref(tokens,
+                 expert_num,
+                 experts_per_token,
+                 n_group,
+                 topk_group,
+                 norm_topk,
+                 logits,
+                 offsets_ref,
+                 eids_ref,
+                 f2n_ref,
+                 en2f_ref,
+                 scales_ref);
 
     cudaMemPrefetchAsync(f2n.data().get(), sizeof(int) * f2n.size(), 0);
     cudaMemPrefetchAsync(en2f.data().get(), sizeof(int) * en2f.size(), 0);
@@ -205,13 +224,6 @@ bool test_moe_gate(int                     tokens,  //
     cudaMemPrefetchAsync(scales.data().get(), sizeof(float) * scales.size(), 0);
     cudaMemPrefetchAsync(logits.data().get(), sizeof(float) * logits.size(), 0);
 
-    bool softmax = true;
-
-    if (1) {
-        invokeMoeSoftmaxMaskTopKGroups(logits.data().get(), tokens, expert_num, expert_num / 8, 8, nullptr);
-        softmax = false;
-    }
-
     for (int i = 0; i < 1; ++i) {
         gemm::CacheFlushing::flush();
         cudaMemset(accum.data().get(), 0, sizeof(int) * accum.size());
@@ -227,8 +239,10 @@ bool test_moe_gate(int                     tokens,  //
                          tokens_padded,
                          expert_num,
                          experts_per_token,
-                         softmax,
-                         false,
+                         n_group,
+                         topk_group,
+                         true,
+                         norm_topk,
                          1.f,
                          nullptr);
     }
@@ -276,6 +290,14 @@ bool test_moe_gate(int                     tokens,  //
         std::cerr << "en2f\n";
         success = false;
     }
+    for (size_t i = 0; i < scales.size(); ++i) {
+        const float x = scales[i], y = scales_ref[i];
+        if (std::abs(x - y) > 1e-6f + 1e-4f * std::abs(y)) {
+            std::cerr << "scales\n";
+            success = false;
+            break;
+        }
+    }
 
     // print_vecs(logits.data().get(), tokens, expert_num, "logits", 12);
 
@@ -347,13 +369,25 @@ int main()
     // test_moe_gate(32768, 64, 8, tape, tiling);
     // test_moe_gate(8, 60, 4, tape, tiling);
 
-    test_moe_gate(16, 160, 6, tape, tiling);
+    bool success = true;
+
+    // keeping all the groups
+    success &= test_moe_gate(16, 160, 6, 8, 8, false, tape, tiling);
+
+    // group-limited selection (DeepSeek-V3)
+    for (auto norm_topk : {false, true}) {
+        success &= test_moe_gate(16, 256, 8, 8, 4, norm_topk, tape, tiling);
+        success &= test_moe_gate(1000, 256, 8, 8, 4, norm_topk, tape, tiling);
+        success &= test_moe_gate(16, 160, 6, 8, 3, norm_topk, tape, tiling);
+    }
+
+    std::cout << (success ? "PASSED" : "FAILED") << "\n";
 
-    return 0;
+    return !success;
 
     for (int i = 1; i < 16384; ++i) {
         // std::cerr << i << std::endl;
-        auto success = test_moe_gate(i, 8, 2, tape, tiling);
+        auto success = test_moe_gate(i, 8, 2, 1, 1, true, tape, tiling);
         if (!success) {
             std::cerr << i << std::endl;
             // std::abort();
@@ -447,6 +447,25 @@ public:
         }
     }
 
+    // Launch spec chosen for the problem by the dispatch cache (or the heuristic on a miss), same as `Run`
+    std::optional<LaunchSpec> GetLaunchSpec()
+    {
+        const Operation operation{
+            dispatch_policy_,
+            Epilogue::kNone,
+            quant_a_,
+            quant_b_,
+            kBatchDim,
+            ctx_.get(),
+            nullptr,
+        };
+
+        const Workspace workspace{barriers_.data().get(), barriers_.size(), partials_.data().get(), partials_.size()};
+
+        return gemm_.GetLaunchSpec(
+            operation, a_pack_desc_, u_pack_desc_, b_pack_desc_, v_pack_desc_, c_desc_, c_desc_, workspace);
+    }
+
     void RunCublas()
     {
         if (experts_ == 0) {
@@ -23,6 +23,7 @@ void ParseTuningParams(TuningParams& params, const std::string& str)
     try_parse(params.max_splits, "max_splits");
     try_parse(params.max_waves, "max_waves");
     try_parse(params.swizzle, "swizzle");
+    try_parse(params.stream_k, "stream_k");
     try_parse(params.top_k, "top_k");
     try_parse(params.clusters, "clusters");
     try_parse(params.min_iter, "min_iter");
@@ -16,6 +16,9 @@ struct TuningParams {
     // Swizzling params
     std::vector<int> swizzle{3};
 
+    // Stream-K params, persistent CTAs with even shares of the k iterations of all tiles
+    int stream_k = 1;
+
     // Sampling params
     float top_k    = 0;
     int   clusters = 5;
@@ -89,6 +89,7 @@ enum class QuantType : int
 {
     kNone,
     kDefault,
+    kChannel,  // one f32 scale per row of A / column of B, applied in the epilogue
 };
 
 enum class Epilogue : int
@@ -96,6 +97,7 @@ enum class Epilogue : int
     kNone               = 0,
     kChannelCombination = 0x1,
     kGatedSilu          = 0x2,
+    kScatterAdd         = 0x4,  // rows of the result are weighted & added to the rows of D given by an index
 };
 
 enum class DataType : int
@@ -111,6 +113,7 @@ enum class DataType : int
     F32,
     BF16,
     TF32,
+    S8,
 };
 
 inline const char* to_string(DataType data_type)
@@ -120,6 +123,10 @@ inline const char* to_string(DataType data_type)
             return "u4";
         case DataType::U8:
             return "u8";
+        case DataType::F8_E4M3:
+            return "e4m3";
+        case DataType::F8_E5M2:
+            return "e5m2";
         case DataType::F16:
             return "f16";
         case DataType::F32:
@@ -128,6 +135,8 @@ inline const char* to_string(DataType data_type)
             return "bf16";
         case DataType::TF32:
             return "tf32";
+        case DataType::S8:
+            return "s8";
         default:
             return "unknown";
     }
@@ -149,6 +158,7 @@ inline int64_t get_size(DataType type, int64_t size)
         case DataType::U16:
             return size * 2;
         case DataType::U8:
+        case DataType::S8:
         case DataType::F8_E4M3:
         case DataType::F8_E5M2:
             return size;
@@ -186,6 +196,16 @@ struct get_data_type<uint8_t> {
     static constexpr auto value = DataType::U8;
 };
 
+template<>
+struct get_data_type<int8_t> {
+    static constexpr auto value = DataType::S8;
+};
+
+template<>
+struct get_data_type<fp8_e4m3> {
+    static constexpr auto value = DataType::F8_E4M3;
+};
+
 template<class T>
 inline constexpr auto get_data_type_v = get_data_type<T>::value;
 
@@ -208,6 +228,16 @@ struct get_dtype<DataType::U8> {
     using type = uint8_t;
 };
 
+template<>
+struct get_dtype<DataType::S8> {
+    using type = int8_t;
+};
+
+template<>
+struct get_dtype<DataType::F8_E4M3> {
+    using type = fp8_e4m3;
+};
+
 template<>
 struct get_dtype<DataType::U16> {
     using type = uint16_t;
@@ -259,6 +289,9 @@ struct Operation {
     int            batch_dim;
     Context*       context;
     void*          reserved;
+    // `Epilogue::kScatterAdd`, row i of the result is scaled by `scatter_scales[i]` & added to row `scatter_idxs[i]`
+    const int*   scatter_idxs;
+    const float* scatter_scales;
 };
 
 struct MatrixLayout {
@@ -202,6 +202,99 @@ template void invokeInputIdsEmbeddingLookupPosEncoding(__nv_bfloat16*
                                                        cudaStream_t                      stream);
 #endif
 
+template<typename T>
+__global__ void embeddingLookupSplice(T*                    dst,
+                                      int                   pitch,
+                                      const void*           embedding_table,
+                                      const int*            input_ids,
+                                      const EmbeddingRange* ranges,
+                                      int                   range_num,
+                                      int                   hidden_units,
+                                      int                   col_begin,
+                                      int                   width,
+                                      const float*          table_scales)
+{
+    const int ti = blockIdx.x;
+
+    // the first range beginning after the token
+    int lo = 0;
+    int hi = range_num;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (ranges[mid].begin <= ti) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    dst += (int64_t)ti * pitch;
+
+    const T* src;
+    if (lo > 0 && ti < ranges[lo - 1].end) {
+        const EmbeddingRange r = ranges[lo - 1];
+        src                    = (const T*)r.src + (int64_t)(ti - r.begin) * hidden_units + col_begin;
+    }
+    else if (table_scales) {
+        const int64_t row   = input_ids[ti];
+        const int8_t* q     = (const int8_t*)embedding_table + row * width;
+        const float   scale = table_scales[row];
+        for (int i = threadIdx.x; i < width; i += blockDim.x) {
+            dst[i] = T(q[i] * scale);
+        }
+        return;
+    }
+    else {
+        src = (const T*)embedding_table + (int64_t)input_ids[ti] * width;
+    }
+
+    for (int i = threadIdx.x; i < width; i += blockDim.x) {
+        dst[i] = src[i];
+    }
+}
+
+template<typename T>
+void invokeEmbeddingLookupSplice(T*                    dst,
+                                 int                   pitch,
+                                 const void*           embedding_table,
+                                 const int*            input_ids,
+                                 const EmbeddingRange* ranges,
+                                 int                   range_num,
+                                 int                   token_num,
+                                 int                   hidden_units,
+                                 int                   col_begin,
+                                 int                   width,
+                                 cudaStream_t          stream,
+                                 const float*          table_scales)
+{
+    embeddingLookupSplice<<<token_num, min(width, 512), 0, stream>>>(
+        dst, pitch, embedding_table, input_ids, ranges, range_num, hidden_units, col_begin, width, table_scales);
+    sync_check_cuda_error();
+}
+
+#define INSTANTIATE_INVOKE_EMBEDDING_LOOKUP_SPLICE(T)                                                                  \
+    template void invokeEmbeddingLookupSplice(T*                    dst,                                               \
+                                              int                   pitch,                                             \
+                                              const void*           embedding_table,                                   \
+                                              const int*            input_ids,                                         \
+                                              const EmbeddingRange* ranges,                                            \
+                                              int                   range_num,                                         \
+                                              int                   token_num,                                         \
+                                              int                   hidden_units,                                      \
+                                              int                   col_begin,                                         \
+                                              int                   width,                                             \
+                                              cudaStream_t          stream,                                            \
+                                              const float*          table_scales)
+
+#ifdef ENABLE_FP32
+INSTANTIATE_INVOKE_EMBEDDING_LOOKUP_SPLICE(float);
+#endif
+INSTANTIATE_INVOKE_EMBEDDING_LOOKUP_SPLICE(half);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_EMBEDDING_LOOKUP_SPLICE(__nv_bfloat16);
+#endif
+
 // TODO Add half2 implementation
 template<typename T>
 __global__ void transposeAxis01(T* out, T* in, const int dim0, const int dim1, const int dim2)
@@ -73,6 +73,30 @@ void invokeInputIdsEmbeddingLookupPosEncoding(T*                    from_tensor,
                                               const int             hidden_units,
                                               cudaStream_t          stream);
 
+// Rows [begin, end) of the embeddings are read from `src` [end - begin, hidden_units] in device memory
+struct EmbeddingRange {
+    int         begin;
+    int         end;
+    const void* src;
+};
+
+// Columns [col_begin, col_begin + width) of the embeddings of the tokens, from the external embeddings of the
+// `ranges` (sorted by `begin`, disjoint) or the embedding table [vocab, width] otherwise. Rows of `dst` are `pitch`
+// apart. With `table_scales` the table is int8 with a scale per row, dequantized on the fly
+template<typename T>
+void invokeEmbeddingLookupSplice(T*                    dst,
+                                 int                   pitch,
+                                 const void*           embedding_table,
+                                 const int*            input_ids,
+                                 const EmbeddingRange* ranges,
+                                 int                   range_num,
+                                 int                   token_num,
+                                 int                   hidden_units,
+                                 int                   col_begin,
+                                 int                   width,
+                                 cudaStream_t          stream,
+                                 const float*          table_scales = nullptr);
+
 template<typename T>
 void invokeInputIdsEmbeddingLookupPosEncodingSoftPrompt(inputIdsEmbeddingLookupPosEncodingSoftPromptParam<T> param);
 
@@ -29,6 +29,7 @@
 #include "src/turbomind/kernels/logprob_kernels.h"
 #include "src/turbomind/kernels/reduce_kernel_utils.cuh"
 #include "src/turbomind/macro.h"
+#include "src/turbomind/utils/constant.h"
 #include "src/turbomind/utils/logger.h"
 
 namespace turbomind {
@@ -183,6 +184,179 @@ void invokeLogProbFromLogits(float*       cum_log_probs,
         cum_log_probs, log_probs, input_lengths, max_input_length, batch_size, batch_first);
 }
 
+template<typename T>
+__global__ void
+token_log_probs_kernel(float* log_probs, const T* logits, const int* ids, int vocab_size, int vocab_size_padded)
+{
+    const int id = ids[blockIdx.x];
+    if (id < 0) {
+        return;
+    }
+
+    logits += (size_t)blockIdx.x * vocab_size_padded;
+
+    __shared__ float s_max_logit;
+
+    float local_max = -FLT_MAX;
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+        local_max = fmax(local_max, static_cast<float>(logits[i]));
+    }
+    float max_val = blockReduceMax<float>(local_max);
+    if (threadIdx.x == 0) {
+        s_max_logit = max_val;
+    }
+    __syncthreads();
+
+    float local_sum_exp = 0.0f;
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+        local_sum_exp += __expf(static_cast<float>(logits[i]) - s_max_logit);
+    }
+    float sum_exp = blockReduceSum<float>(local_sum_exp);
+    if (threadIdx.x == 0) {
+        log_probs[blockIdx.x] = static_cast<float>(logits[id]) - s_max_logit - __logf(sum_exp + 1e-9f);
+    }
+}
+
+template<typename T>
+void invokeTokenLogProbs(float*       log_probs,
+                         const T*     logits,
+                         const int*   ids,
+                         int          token_num,
+                         int          vocab_size,
+                         int          vocab_size_padded,
+                         cudaStream_t stream)
+{
+    if (token_num == 0) {
+        return;
+    }
+    token_log_probs_kernel<<<token_num, 256, 0, stream>>>(log_probs, logits, ids, vocab_size, vocab_size_padded);
+}
+
+// Inserts `v` into the descending list held by the lanes of the warp, one element per lane
+__device__ inline void warpInsert(float& top_v, int& top_i, float v, int i)
+{
+    const int   lane = threadIdx.x % 32;
+    const int   pos  = __popc(__ballot_sync(FINAL_MASK, top_v >= v));
+    const float up_v = __shfl_up_sync(FINAL_MASK, top_v, 1);
+    const int   up_i = __shfl_up_sync(FINAL_MASK, top_i, 1);
+    if (lane > pos) {
+        top_v = up_v;
+        top_i = up_i;
+    }
+    else if (lane == pos) {
+        top_v = v;
+        top_i = i;
+    }
+}
+
+// Inserts the values of the lanes that are larger than the n-th of the list
+__device__ inline void warpInsertBatch(float& top_v, int& top_i, float x, int i, int n)
+{
+    uint32_t mask = __ballot_sync(FINAL_MASK, x > __shfl_sync(FINAL_MASK, top_v, n - 1));
+    while (mask) {
+        const int   src = __ffs(mask) - 1;
+        const float v   = __shfl_sync(FINAL_MASK, x, src);
+        const int   idx = __shfl_sync(FINAL_MASK, i, src);
+        if (v > __shfl_sync(FINAL_MASK, top_v, n - 1)) {
+            warpInsert(top_v, top_i, v, idx);
+        }
+        mask &= mask - 1;
+    }
+}
+
+template<typename T, int BLOCK_SIZE>
+__global__ void top_n_log_probs_kernel(
+    T* logprobs, uint32_t* indexes, uint32_t* nums, const T* logits, int n, int vocab_size, int vocab_size_padded)
+{
+    constexpr int kWarpNum = BLOCK_SIZE / 32;
+
+    const int lane = threadIdx.x % 32;
+    const int warp = threadIdx.x / 32;
+
+    logits += (size_t)blockIdx.x * vocab_size_padded;
+
+    float top_v = -INFINITY;
+    int   top_i = -1;
+
+    // online logsumexp of the thread
+    float m = -INFINITY;
+    float s = 0.f;
+
+    // each warp reads 32 consecutive logits at a time
+    for (int base = warp * 32; base < vocab_size; base += BLOCK_SIZE) {
+        const int   i = base + lane;
+        const float x = i < vocab_size ? (float)logits[i] : -INFINITY;
+        if (x > m) {
+            s = s * __expf(m - x) + 1.f;
+            m = x;
+        }
+        else if (x > -INFINITY) {
+            s += __expf(x - m);
+        }
+        warpInsertBatch(top_v, top_i, x, i, n);
+    }
+
+    __shared__ float s_top_v[kWarpNum][32];
+    __shared__ int   s_top_i[kWarpNum][32];
+    __shared__ float s_max;
+
+    s_top_v[warp][lane] = top_v;
+    s_top_i[warp][lane] = top_i;
+
+    const float max_val = blockReduceMax<float>(m);
+    if (threadIdx.x == 0) {
+        s_max = max_val;
+    }
+    __syncthreads();
+
+    const float sum_val = blockReduceSum<float>(m > -INFINITY ? s * __expf(m - s_max) : 0.f);
+
+    if (warp == 0) {
+        for (int w = 1; w < kWarpNum; ++w) {
+            warpInsertBatch(top_v, top_i, s_top_v[w][lane], s_top_i[w][lane], n);
+        }
+        // `sum_val` is valid in thread 0 only
+        const float lse = s_max + __logf(__shfl_sync(FINAL_MASK, sum_val, 0));
+        if (lane < n) {
+            logprobs[blockIdx.x * kMaxLogProb + lane] = (T)(top_v - lse);
+            indexes[blockIdx.x * kMaxLogProb + lane]  = top_i;
+        }
+        if (lane == 0) {
+            nums[blockIdx.x] = n;
+        }
+    }
+}
+
+template<typename T>
+void invokeTopNLogProbs(T*           logprobs,
+                        uint32_t*    indexes,
+                        uint32_t*    nums,
+                        const T*     logits,
+                        int          n,
+                        int          batch_size,
+                        int          vocab_size,
+                        int          vocab_size_padded,
+                        cudaStream_t stream)
+{
+    FT_CHECK(0 < n && n <= kMaxTopNLogProbs && n <= vocab_size);
+    constexpr int block = 256;
+    top_n_log_probs_kernel<T, block>
+        <<<batch_size, block, 0, stream>>>(logprobs, indexes, nums, logits, n, vocab_size, vocab_size_padded);
+}
+
+template void invokeTopNLogProbs(float*, uint32_t*, uint32_t*, const float*, int, int, int, int, cudaStream_t);
+template void invokeTopNLogProbs(half*, uint32_t*, uint32_t*, const half*, int, int, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeTopNLogProbs(
+    __nv_bfloat16*, uint32_t*, uint32_t*, const __nv_bfloat16*, int, int, int, int, cudaStream_t);
+#endif
+
+template void invokeTokenLogProbs(float*, const float*, const int*, int, int, int, cudaStream_t);
+template void invokeTokenLogProbs(float*, const half*, const int*, int, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeTokenLogProbs(float*, const __nv_bfloat16*, const int*, int, int, int, cudaStream_t);
+#endif
+
 template void invokeLogProbFromLogits(float*       cum_log_probs,
                                       const float* logits,
                                       const int*   input_ids,
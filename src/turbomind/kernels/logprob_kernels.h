@@ -16,8 +16,13 @@
 
 #pragma once
 
+#include <cstdint>
+
 namespace turbomind {
 
+// Upper bound of `n` in `invokeTopNLogProbs`, one candidate per lane of a warp
+constexpr int kMaxTopNLogProbs = 32;
+
 template<typename T>
 void invokeLogProbFromLogits(float*       cum_log_probs,
                              const T*     logits,
@@ -31,4 +36,27 @@ void invokeLogProbFromLogits(float*       cum_log_probs,
                              const size_t workspace_size,
                              cudaStream_t stream,
                              const bool   batch_first = false);
+
+// log_probs[t] = log(softmax(logits[t, :]))[ids[t]] of packed tokens, rows with negative `ids` are skipped
+template<typename T>
+void invokeTokenLogProbs(float*       log_probs,
+                         const T*     logits,
+                         const int*   ids,
+                         int          token_num,
+                         int          vocab_size,
+                         int          vocab_size_padded,
+                         cudaStream_t stream);
+
+// Top-n of log(softmax(logits[b, :])) in descending order, found along with the logsumexp in a single pass over the
+// vocab. Rows of `logprobs` & `indexes` are strided by `kMaxLogProb`, `nums[b]` is set to n
+template<typename T>
+void invokeTopNLogProbs(T*           logprobs,
+                        uint32_t*    indexes,
+                        uint32_t*    nums,
+                        const T*     logits,
+                        int          n,
+                        int          batch_size,
+                        int          vocab_size,
+                        int          vocab_size_padded,
+                        cudaStream_t stream);
 }  // namespace turbomind
@@ -2,29 +2,72 @@
 
 #include <stdexcept>
 
+#include <cuda_fp8.h>
+
 #include "cub/block/block_reduce.cuh"
 
 #include "src/turbomind/kernels/core/array_ops.h"
 #include "src/turbomind/kernels/core/common.h"
 #include "src/turbomind/kernels/core/math.h"
 #include "src/turbomind/kernels/core/meta.h"
+#include "src/turbomind/kernels/core/pdl.h"
 
 #include "src/turbomind/kernels/norm/rms_norm.h"
 #include "src/turbomind/utils/Tensor.h"
 
 namespace turbomind {
 
+// Per-token symmetric e4m3 quantization of the normalized row `src` the block has just written, `amax` is the
+// partial abs max of the thread. Same result as `quant_fp8_rowwise` on the row
+template<class T, int block_dim, int vec_size>
+__device__ void QuantRowFp8(fp8_e4m3* dst, float* scale, const T* src, float amax, int dims, int di)
+{
+    using BlockReduce = cub::BlockReduce<float, block_dim>;
+    __shared__ typename BlockReduce::TempStorage temp_storage;
+
+    amax = BlockReduce{temp_storage}.Reduce(amax, cub::Max{});
+
+    __shared__ float shared_scale;
+
+    if (threadIdx.x == 0) {
+        // 448 is the max finite value of e4m3
+        shared_scale = amax > 0.f ? amax / 448.f : 1.f;
+        *scale       = shared_scale;
+    }
+
+    __syncthreads();
+
+    const float inv_scale = 1.f / shared_scale;
+
+    Array<T, vec_size>        vec;
+    Array<fp8_e4m3, vec_size> out;
+    for (int i = di; i < dims; i += block_dim * vec_size) {
+        Load(vec, &src[i]);
+        PRAGMA_UNROLL
+        for (int c = 0; c < vec_size; c += 2) {
+            const float2 x{(float)vec[c] * inv_scale, (float)vec[c + 1] * inv_scale};
+            (__nv_fp8x2_storage_t&)out[c] = __nv_cvt_float2_to_fp8x2(x, __NV_SATFINITE, __NV_E4M3);
+        }
+        Store(&dst[i], out);
+    }
+}
+
 template<class T, class Accum, int block_dim, int vec_size>
 __global__ void RMSNormKernel(T*       dst,
                               int      dst_ld,
                               const T* src,
                               int      src_ld,
                               const T* __restrict__ weights,
-                              int   dims,
-                              int   num,
-                              float eps,
-                              float inv_dims)
+                              int       dims,
+                              int       num,
+                              float     eps,
+                              float     inv_dims,
+                              fp8_e4m3* q_dst,
+                              float*    q_scales)
 {
+    PdlWait();
+    PdlLaunchDependents();
+
     const int ti = blockIdx.x;
     const int di = threadIdx.x * vec_size;
 
@@ -67,6 +110,8 @@ __global__ void RMSNormKernel(T*       dst,
 
     dst += dst_ld * ti;
 
+    float amax = 0.f;
+
     Array<T, vec_size> sv;
     for (int i = di; i < dims; i += block_dim * vec_size) {
         Load(vec, &src[i]);
@@ -75,14 +120,28 @@ __global__ void RMSNormKernel(T*       dst,
         for (int c = 0; c < vec_size; ++c) {
             vec[c] = (T)((float)vec[c] * sum) * sv[c];
             // vec[c] = (T)((float)vec[c] * sum * (float)sv[c]);
+            amax = fmaxf(amax, fabsf((float)vec[c]));
         }
         Store(&dst[i], vec);
     }
+
+    if (q_dst) {
+        QuantRowFp8<T, block_dim, vec_size>(q_dst + (int64_t)dims * ti, q_scales + ti, dst, amax, dims, di);
+    }
 }
 
 template<class T>
-void invokeRMSNorm(
-    T* dst, int dst_ld, const T* src, int src_ld, const T* weights, int dims, int num, float eps, cudaStream_t st)
+void invokeRMSNorm(T*           dst,
+                   int          dst_ld,
+                   const T*     src,
+                   int          src_ld,
+                   const T*     weights,
+                   int          dims,
+                   int          num,
+                   float        eps,
+                   cudaStream_t st,
+                   fp8_e4m3*    q_dst,
+                   float*       q_scales)
 {
     if (num == 0) {
         return;
@@ -93,15 +152,22 @@ void invokeRMSNorm(
     constexpr int threads = 512;
     const int     blocks  = num;
 
-    RMSNormKernel<T, float, threads, vec_size><<<blocks, threads, 0, st>>>(dst,  //
-                                                                           dst_ld,
-                                                                           src,
-                                                                           src_ld,
-                                                                           weights,
-                                                                           dims,
-                                                                           num,
-                                                                           eps,
-                                                                           1.f / dims);
+    LaunchKernel(RMSNormKernel<T, float, threads, vec_size>,
+                 blocks,
+                 threads,
+                 0,
+                 st,
+                 dst,
+                 dst_ld,
+                 src,
+                 src_ld,
+                 weights,
+                 dims,
+                 num,
+                 eps,
+                 1.f / dims,
+                 q_dst,
+                 q_scales);
 }
 
 template void invokeRMSNorm(half*        dst,
@@ -112,7 +178,9 @@ template void invokeRMSNorm(half*        dst,
                             int          dims,
                             int          num,
                             float        eps,
-                            cudaStream_t st);
+                            cudaStream_t st,
+                            fp8_e4m3*    q_dst,
+                            float*       q_scales);
 #if ENABLE_BF16
 template void invokeRMSNorm(nv_bfloat16*       dst,
                             int                dst_ld,
@@ -122,7 +190,9 @@ template void invokeRMSNorm(nv_bfloat16*       dst,
                             int                dims,
                             int                num,
                             float              eps,
-                            cudaStream_t       st);
+                            cudaStream_t       st,
+                            fp8_e4m3*          q_dst,
+                            float*             q_scales);
 #endif
 
 template<class T, class A, int vec_size, int max_dim>
@@ -137,6 +207,9 @@ __global__ void QkRMSNormKernel(T*       data,  //
 {
     static_assert((max_dim & (max_dim - 1)) == 0);
 
+    PdlWait();
+    PdlLaunchDependents();
+
     constexpr int thr_per_qk = max_dim / vec_size;
 
     const int bi = (threadIdx.x + blockIdx.x * blockDim.x) / thr_per_qk;
@@ -206,8 +279,19 @@ void invokeQkRMSNorm(void*        data,
         const int block_dim = 512;
         const int grid_dim  = cdiv(threads, block_dim);
 
-        QkRMSNormKernel<T, float, vec_size, max_dim><<<grid_dim, block_dim, 0, stream>>>(
-            (T*)data, ld, (const T*)weight, head_dim, n, token_num, eps, 1.f / head_dim);
+        LaunchKernel(QkRMSNormKernel<T, float, vec_size, max_dim>,
+                     grid_dim,
+                     block_dim,
+                     0,
+                     stream,
+                     (T*)data,
+                     ld,
+                     (const T*)weight,
+                     head_dim,
+                     n,
+                     token_num,
+                     eps,
+                     1.f / head_dim);
     };
 
     constexpr constant<128> max_dim{};
@@ -230,11 +314,16 @@ __global__ void BiasResidualRMSNormKernel(T* __restrict__ residual,
                                           T* __restrict__ hidden_states,
                                           const T* __restrict__ weights,
                                           const T* __restrict__ bias,
-                                          int   dims,
-                                          int   num,
-                                          float eps,
-                                          float inv_dims)
+                                          int       dims,
+                                          int       num,
+                                          float     eps,
+                                          float     inv_dims,
+                                          fp8_e4m3* q_dst,
+                                          float*    q_scales)
 {
+    PdlWait();
+    PdlLaunchDependents();
+
     const int ti = blockIdx.x;
     const int di = threadIdx.x * vec_size;
 
@@ -291,6 +380,8 @@ __global__ void BiasResidualRMSNormKernel(T* __restrict__ residual,
 
     sum = shared_sum;
 
+    float amax = 0.f;
+
     Array<T, vec_size> w_vec;
     for (int i = di; i < dims; i += block_dim * vec_size) {
         Load(r_vec, &residual[i]);
@@ -298,27 +389,47 @@ __global__ void BiasResidualRMSNormKernel(T* __restrict__ residual,
         PRAGMA_UNROLL
         for (int c = 0; c < vec_size; ++c) {
             r_vec[c] = (T)((float)r_vec[c] * sum) * w_vec[c];
+            amax     = fmaxf(amax, fabsf((float)r_vec[c]));
         }
         Store(&hidden_states[i], r_vec);
     }
+
+    if (q_dst) {
+        QuantRowFp8<T, block_dim, vec_size>(q_dst + (int64_t)dims * ti, q_scales + ti, hidden_states, amax, dims, di);
+    }
 }
 
 template<class T>
-void invokeBiasResidualRMSNorm(
-    T* residual, T* hidden_states, const T* weights, const T* bias, int dims, int num, float eps, cudaStream_t st)
+void invokeBiasResidualRMSNorm(T*           residual,
+                               T*           hidden_states,
+                               const T*     weights,
+                               const T*     bias,
+                               int          dims,
+                               int          num,
+                               float        eps,
+                               cudaStream_t st,
+                               fp8_e4m3*    q_dst,
+                               float*       q_scales)
 {
     constexpr int vec_size = 16 / sizeof(T);
     constexpr int threads  = 512;
     const int     blocks   = num;
 
-    BiasResidualRMSNormKernel<T, float, threads, vec_size><<<blocks, threads, 0, st>>>(residual,  //
-                                                                                       hidden_states,
-                                                                                       weights,
-                                                                                       bias,
-                                                                                       dims,
-                                                                                       num,
-                                                                                       eps,
-                                                                                       1.f / dims);
+    LaunchKernel(BiasResidualRMSNormKernel<T, float, threads, vec_size>,
+                 blocks,
+                 threads,
+                 0,
+                 st,
+                 residual,
+                 hidden_states,
+                 weights,
+                 bias,
+                 dims,
+                 num,
+                 eps,
+                 1.f / dims,
+                 q_dst,
+                 q_scales);
 }
 
 template void invokeBiasResidualRMSNorm(half*        residual,
@@ -328,7 +439,9 @@ template void invokeBiasResidualRMSNorm(half*        residual,
                                         int          dims,
                                         int          num,
                                         float        eps,
-                                        cudaStream_t st);
+                                        cudaStream_t st,
+                                        fp8_e4m3*    q_dst,
+                                        float*       q_scales);
 
 #if ENABLE_BF16
 template void invokeBiasResidualRMSNorm(nv_bfloat16*       residual,
@@ -338,7 +451,9 @@ template void invokeBiasResidualRMSNorm(nv_bfloat16*       residual,
                                         int                dims,
                                         int                num,
                                         float              eps,
-                                        cudaStream_t       st);
+                                        cudaStream_t       st,
+                                        fp8_e4m3*          q_dst,
+                                        float*             q_scales);
 #endif
 
 void invokeResidualBiasRMSNorm(void*        hidden_states,
@@ -359,14 +474,21 @@ void invokeResidualBiasRMSNorm(void*        hidden_states,
         constexpr int vec_size = sizeof(uint4) / sizeof(T);
         constexpr int threads  = 512;
         const int     blocks   = num;
-        BiasResidualRMSNormKernel<T, float, threads, vec_size><<<blocks, threads, 0, st>>>((T*)residual,  //
-                                                                                           (T*)hidden_states,
-                                                                                           (const T*)weights,
-                                                                                           (const T*)bias,
-                                                                                           dims,
-                                                                                           num,
-                                                                                           eps,
-                                                                                           1.f / dims);
+        LaunchKernel(BiasResidualRMSNormKernel<T, float, threads, vec_size>,
+                     blocks,
+                     threads,
+                     0,
+                     st,
+                     (T*)residual,
+                     (T*)hidden_states,
+                     (const T*)weights,
+                     (const T*)bias,
+                     dims,
+                     num,
+                     eps,
+                     1.f / dims,
+                     nullptr,
+                     nullptr);
     };
     switch (dtype) {
         case DataType::TYPE_FP16:
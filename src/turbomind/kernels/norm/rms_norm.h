@@ -2,18 +2,37 @@
 
 #include <cuda_runtime.h>
 
+#include "src/turbomind/kernels/core/data_type.h"
 #include "src/turbomind/utils/Tensor.h"
 
 namespace turbomind {
 
+// With `q_dst`, the normalized rows are also quantized to e4m3 per token, `q_dst` [num, dims], `q_scales` [num]
 template<class T>
-void invokeRMSNorm(
-    T* dst, int dst_ld, const T* src, int src_ld, const T* weights, int dims, int num, float eps, cudaStream_t st);
+void invokeRMSNorm(T*           dst,
+                   int          dst_ld,
+                   const T*     src,
+                   int          src_ld,
+                   const T*     weights,
+                   int          dims,
+                   int          num,
+                   float        eps,
+                   cudaStream_t st,
+                   fp8_e4m3*    q_dst    = nullptr,
+                   float*       q_scales = nullptr);
 
 template<class T>
-void invokeRMSNorm(T* dst, const T* src, const T* weights, int dims, int num, float eps, cudaStream_t st)
+void invokeRMSNorm(T*           dst,
+                   const T*     src,
+                   const T*     weights,
+                   int          dims,
+                   int          num,
+                   float        eps,
+                   cudaStream_t st,
+                   fp8_e4m3*    q_dst    = nullptr,
+                   float*       q_scales = nullptr)
 {
-    invokeRMSNorm(dst, dims, src, dims, weights, dims, num, eps, st);
+    invokeRMSNorm(dst, dims, src, dims, weights, dims, num, eps, st, q_dst, q_scales);
 }
 
 void invokeQkRMSNorm(void*        data,
@@ -27,8 +46,16 @@ void invokeQkRMSNorm(void*        data,
                      cudaStream_t stream);
 
 template<class T>
-void invokeBiasResidualRMSNorm(
-    T* residual, T* hidden_states, const T* weights, const T* bias, int dims, int num, float eps, cudaStream_t st);
+void invokeBiasResidualRMSNorm(T*           residual,
+                               T*           hidden_states,
+                               const T*     weights,
+                               const T*     bias,
+                               int          dims,
+                               int          num,
+                               float        eps,
+                               cudaStream_t st,
+                               fp8_e4m3*    q_dst    = nullptr,
+                               float*       q_scales = nullptr);
 
 void invokeResidualBiasRMSNorm(void*        hidden_states,
                                void*        residual,
@@ -0,0 +1,19 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <curand_kernel.h>
+
+namespace turbomind {
+
+// Uniform in (0, 1] of the Philox stream keyed by `seed` at `counter`. Initializing a Philox state only sets the key
+// and the counter, so the draws need no state carried between the steps, a slot is described by its seed alone
+__device__ inline float PhiloxUniform(uint64_t seed, uint64_t counter)
+{
+    curandStatePhilox4_32_10_t state;
+    curand_init(seed, counter, 0, &state);
+    return curand_uniform(&state);
+}
+
+}  // namespace turbomind
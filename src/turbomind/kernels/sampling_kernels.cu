@@ -5,6 +5,7 @@
 #else
 #include "3rdparty/cub/cub.cuh"
 #endif
+#include "src/turbomind/kernels/philox.cuh"
 #include "src/turbomind/kernels/sampling_kernels.h"
 #include "src/turbomind/kernels/sampling_topp_kernels.h"
 #include "src/turbomind/utils/constant.h"
@@ -12,28 +13,32 @@
 namespace turbomind {
 
 template<typename T, int BLOCK_SIZE>
-__global__ void sampling(const T*       logits,
-                         const int      stride,
-                         const int*     indices,
-                         const int*     kept,
-                         curandState_t* curandstate,
-                         int*           output_ids,
-                         int*           sequence_length,
-                         T*             sampled_logprobs,
-                         uint32_t*      sampled_indexes,
-                         uint32_t*      sampled_nums)
+__global__ void sampling(const T*        logits,
+                         const int       stride,
+                         const int*      indices,
+                         const int*      kept,
+                         const uint64_t* random_seed,
+                         const int       step,
+                         int*            output_ids,
+                         int*            sequence_length,
+                         T*              sampled_logprobs,
+                         uint32_t*       sampled_indexes,
+                         uint32_t*       sampled_nums)
 {
     int tid      = threadIdx.x;
     int batch_id = blockIdx.x;
     int n        = kept[batch_id];
 
     logits += stride * batch_id;
-    indices += stride * batch_id;
+    if (indices) {
+        indices += stride * batch_id;
+    }
 
     __shared__ float rand_num_s;
     __shared__ int   selected;
     if (tid == 0) {
-        rand_num_s = curand_uniform(curandstate + batch_id);
+        // keyed by the length of the sequence, so the draw is the same after the slot is swapped or migrated
+        rand_num_s = PhiloxUniform(random_seed[batch_id], sequence_length ? sequence_length[batch_id] : step);
     }
     __syncthreads();
 
@@ -51,7 +56,7 @@ __global__ void sampling(const T*       logits,
         if (count != 0 || (i + BLOCK_SIZE) >= end) {
             if (tid == min(BLOCK_SIZE - count, BLOCK_SIZE - 1)) {
                 selected             = min(i, n - 1);
-                output_ids[batch_id] = indices[selected];
+                output_ids[batch_id] = indices ? indices[selected] : selected;
 
                 if (sequence_length != nullptr) {
                     sequence_length[batch_id] += 1;
@@ -65,6 +70,22 @@ __global__ void sampling(const T*       logits,
         __syncthreads();
         sampled_logprobs += batch_id * kMaxLogProb;
         sampled_indexes += batch_id * kMaxLogProb;
+        if (!indices) {
+            // unsorted probs, the top-n logprobs are given by `invokeTopNLogProbs`, append the sampled one if missing
+            if (tid == 0) {
+                const int num = sampled_nums[batch_id];
+                int       i   = 0;
+                while (i < num && sampled_indexes[i] != selected) {
+                    ++i;
+                }
+                if (i == num && num < kMaxLogProb) {
+                    sampled_logprobs[num]  = logf(logits[selected]);
+                    sampled_indexes[num]   = selected;
+                    sampled_nums[batch_id] = num + 1;
+                }
+            }
+            return;
+        }
         int end = min(n, kMaxLogProb);
         for (int i = tid; i < end; i += BLOCK_SIZE) {
             sampled_logprobs[i] = logf(logits[i]);
@@ -89,7 +110,8 @@ void invokeSampling(SamplingParams& params, cudaStream_t stream)
                                                    params.stride,
                                                    params.indices,
                                                    params.kept,
-                                                   params.curandstate,
+                                                   params.random_seed,
+                                                   params.step,
                                                    params.output_ids,
                                                    params.sequence_length,
                                                    (T*)params.sampled_logprobs,
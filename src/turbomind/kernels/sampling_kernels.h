@@ -17,23 +17,23 @@
 #pragma once
 
 #include <cuda_runtime.h>
-#include <curand_kernel.h>
 #include <stdint.h>
 
 namespace turbomind {
 
 struct SamplingParams {
-    void*          logits;
-    int            stride;
-    int*           indices;
-    int*           kept;
-    curandState_t* curandstate;
-    size_t         batch_size;
-    int*           output_ids;
-    int*           sequence_length;
-    void*          sampled_logprobs;
-    uint32_t*      sampled_indexes;
-    uint32_t*      sampled_nums;
+    void*           logits;
+    int             stride;
+    int*            indices;  // null for unsorted logits
+    int*            kept;
+    const uint64_t* random_seed;  // [batch_size]
+    int             step;         // counter of the random draws when `sequence_length` is missing
+    size_t          batch_size;
+    int*            output_ids;
+    int*            sequence_length;
+    void*           sampled_logprobs;
+    uint32_t*       sampled_indexes;
+    uint32_t*       sampled_nums;
 };
 
 template<typename T>
@@ -661,4 +661,126 @@ INSTANTIATE_INVOKE_MIN_LENGTH_PENALTY(half);
 INSTANTIATE_INVOKE_MIN_LENGTH_PENALTY(__nv_bfloat16);
 #endif
 
+__global__ void updateTokenCounts(uint32_t* __restrict__ token_counts,
+                                  const int* __restrict__ output_ids,
+                                  const int* __restrict__ input_lengths,
+                                  const int max_input_length,
+                                  const int batch_size,
+                                  const int vocab_size,
+                                  const int begin,
+                                  const int end)
+{
+    const int bi           = blockIdx.x;
+    const int input_length = input_lengths != nullptr ? input_lengths[bi] : max_input_length;
+
+    token_counts += (size_t)bi * vocab_size;
+
+    for (int t = begin + threadIdx.x; t < end; t += blockDim.x) {
+        // Skip the padding tokens in input sequences.
+        if (t >= input_length && t < max_input_length) {
+            continue;
+        }
+        const int id = output_ids[t * batch_size + bi];
+        if (id < 0 || id >= vocab_size) {
+            continue;
+        }
+        if (t < max_input_length) {
+            atomicOr(&token_counts[id], kPromptTokenBit);
+        }
+        else {
+            atomicAdd(&token_counts[id], 1U);
+        }
+    }
+}
+
+void invokeUpdateTokenCounts(uint32_t*    token_counts,
+                             const int*   output_ids,
+                             const int*   input_lengths,
+                             const int    max_input_length,
+                             const int    batch_size,
+                             const int    vocab_size,
+                             const int    begin,
+                             const int    end,
+                             cudaStream_t stream)
+{
+    if (begin >= end) {
+        return;
+    }
+    const int block = std::min((end - begin + WARP_SIZE - 1) / WARP_SIZE * WARP_SIZE, 1024);
+    updateTokenCounts<<<batch_size, block, 0, stream>>>(
+        token_counts, output_ids, input_lengths, max_input_length, batch_size, vocab_size, begin, end);
+}
+
+template<typename T>
+__global__ void batchApplyTokenPenalties(T* __restrict__ logits,
+                                         const uint32_t* __restrict__ token_counts,
+                                         const float* __restrict__ repetition_penalties,
+                                         const float* __restrict__ frequency_penalties,
+                                         const float* __restrict__ presence_penalties,
+                                         const int vocab_size,
+                                         const int vocab_size_padded)
+{
+    const int   bi         = blockIdx.y;
+    const float repetition = repetition_penalties ? repetition_penalties[bi] : 1.f;
+    const float frequency  = frequency_penalties ? frequency_penalties[bi] : 0.f;
+    const float presence   = presence_penalties ? presence_penalties[bi] : 0.f;
+
+    logits += (size_t)bi * vocab_size_padded;
+    token_counts += (size_t)bi * vocab_size_padded;
+
+    for (int i = threadIdx.x + blockIdx.x * blockDim.x; i < vocab_size; i += blockDim.x * gridDim.x) {
+        const uint32_t count = token_counts[i];
+        if (count == 0) {
+            continue;
+        }
+        // repetition penalty over the prompt & the generated tokens, frequency & presence over the generated ones
+        const uint32_t n     = count & ~kPromptTokenBit;
+        float          logit = (float)logits[i];
+        logit                = logit < 0.0f ? logit * repetition : logit / repetition;
+        logit -= frequency * n + (n ? presence : 0.f);
+        logits[i] = (T)logit;
+    }
+}
+
+template<typename T>
+void invokeBatchApplyTokenPenalties(T*              logits,
+                                    const uint32_t* token_counts,
+                                    const float*    repetition_penalties,
+                                    const float*    frequency_penalties,
+                                    const float*    presence_penalties,
+                                    const int       batch_size,
+                                    const int       vocab_size,
+                                    const int       vocab_size_padded,
+                                    cudaStream_t    stream)
+{
+    constexpr int block = 256;
+    const dim3    grid(std::min((vocab_size + block - 1) / block, 64), batch_size);
+    batchApplyTokenPenalties<<<grid, block, 0, stream>>>(logits,
+                                                         token_counts,
+                                                         repetition_penalties,
+                                                         frequency_penalties,
+                                                         presence_penalties,
+                                                         vocab_size,
+                                                         vocab_size_padded);
+}
+
+#define INSTANTIATE_INVOKE_BATCH_APPLY_TOKEN_PENALTIES(T)                                                              \
+    template void invokeBatchApplyTokenPenalties(T*              logits,                                               \
+                                                 const uint32_t* token_counts,                                         \
+                                                 const float*    repetition_penalties,                                 \
+                                                 const float*    frequency_penalties,                                  \
+                                                 const float*    presence_penalties,                                   \
+                                                 const int       batch_size,                                           \
+                                                 const int       vocab_size,                                           \
+                                                 const int       vocab_size_padded,                                    \
+                                                 cudaStream_t    stream);
+
+#ifdef ENABLE_FP32
+INSTANTIATE_INVOKE_BATCH_APPLY_TOKEN_PENALTIES(float);
+#endif
+INSTANTIATE_INVOKE_BATCH_APPLY_TOKEN_PENALTIES(half);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_BATCH_APPLY_TOKEN_PENALTIES(__nv_bfloat16);
+#endif
+
 }  // namespace turbomind
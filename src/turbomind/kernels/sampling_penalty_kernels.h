@@ -88,4 +88,32 @@ void invokeMinLengthPenalty(T*           logits,
                             const int    end_ids_size,
                             cudaStream_t stream);
 
+// Per sequence counts of the token ids in [batch_size, vocab_size], `kPromptTokenBit` is set for the tokens in the
+// prompt and the lower bits count the generated ones
+constexpr uint32_t kPromptTokenBit = 1U << 31;
+
+// Adds the tokens at [begin, end) of `output_ids` [step, batch_size] to the counts, skipping the padding at
+// [input_length, max_input_length)
+void invokeUpdateTokenCounts(uint32_t*    token_counts,
+                             const int*   output_ids,
+                             const int*   input_lengths,
+                             const int    max_input_length,
+                             const int    batch_size,
+                             const int    vocab_size,
+                             const int    begin,
+                             const int    end,
+                             cudaStream_t stream);
+
+// Repetition, frequency & presence penalties from the token counts, the penalties are optional
+template<typename T>
+void invokeBatchApplyTokenPenalties(T*              logits,
+                                    const uint32_t* token_counts,
+                                    const float*    repetition_penalties,
+                                    const float*    frequency_penalties,
+                                    const float*    presence_penalties,
+                                    const int       batch_size,
+                                    const int       vocab_size,
+                                    const int       vocab_size_padded,
+                                    cudaStream_t    stream);
+
 }  // namespace turbomind
@@ -30,41 +30,6 @@
 
 namespace turbomind {
 
-__global__ void curandInitialize(curandState_t* state, const int size, const unsigned long long random_seed)
-{
-    if (threadIdx.x + blockIdx.x * blockDim.x < size) {
-        curand_init(random_seed, 0, 0, &state[blockIdx.x * blockDim.x + threadIdx.x]);
-    }
-}
-
-void invokeCurandInitialize(curandState_t*           state,
-                            const size_t             batch_size,
-                            const unsigned long long random_seed,
-                            cudaStream_t             stream)
-{
-    dim3 block(256);
-    dim3 grid((int)(ceil(batch_size * 1.0 / 256)));
-    curandInitialize<<<grid, block, 0, stream>>>(state, batch_size, random_seed);
-}
-
-__global__ void curandBatchInitialize(curandState_t* states, const int size, const unsigned long long* random_seeds)
-{
-    int idx = threadIdx.x + blockIdx.x * blockDim.x;
-    if (idx < size) {
-        curand_init(random_seeds[idx], 0, 0, &states[idx]);
-    }
-}
-
-void invokeCurandBatchInitialize(curandState_t*            states,
-                                 const size_t              batch_size,
-                                 const unsigned long long* random_seeds,
-                                 cudaStream_t              stream)
-{
-    dim3 block(256);
-    dim3 grid((int)(ceil(batch_size * 1.0 / 256)));
-    curandBatchInitialize<<<grid, block, 0, stream>>>(states, batch_size, random_seeds);
-}
-
 template<typename T, int BLOCK_SIZE, int BLOCKS_PER_BEAM>
 __global__ void topKSortStage1(T*         logits,
                                int*       topk_tmp_id_buf,
@@ -43,16 +43,6 @@ void invokeBatchTopKSampling(void*          workspace,
                              const int      batch_size,
                              const bool*    skip_decode);
 
-void invokeCurandInitialize(curandState_t*     state,
-                            const size_t       batch_size,
-                            unsigned long long random_seed,
-                            cudaStream_t       stream);
-
-void invokeCurandBatchInitialize(curandState_t*            states,
-                                 const size_t              batch_size,
-                                 const unsigned long long* random_seeds,
-                                 cudaStream_t              stream);
-
 struct TopKSortFilterParams {
     void*  workspace;
     size_t workspace_size;
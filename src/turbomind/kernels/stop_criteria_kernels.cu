@@ -104,6 +104,109 @@ void invokeStopWordsCriterion(const int*   output_ids,
     sync_check_cuda_error();
 }
 
+__device__ int advanceStopAutomaton(const StopNode* nodes, const StopEdge* edges, int root, int node, int token)
+{
+    while (true) {
+        // binary search in the sorted edges of the node
+        int lo = nodes[node].edge_beg;
+        int hi = nodes[node].edge_end;
+        while (lo < hi) {
+            const int mid = (lo + hi) / 2;
+            if (edges[mid].token < token) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        if (lo < nodes[node].edge_end && edges[lo].token == token) {
+            return edges[lo].next;
+        }
+        if (node == root) {
+            return root;
+        }
+        node = nodes[node].fail;
+    }
+}
+
+__global__ void stop_automaton_criterion(const int*      output_ids,
+                                         const int*      input_lengths,
+                                         const StopNode* nodes,
+                                         const StopEdge* edges,
+                                         const int*      roots,
+                                         int*            states,
+                                         bool*           finished,
+                                         int             max_input_length,
+                                         int             batch_size,
+                                         int             begin,
+                                         int             end,
+                                         bool            reset,
+                                         int             window)
+{
+    const int batch_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (batch_idx >= batch_size) {
+        return;
+    }
+    const int root = roots[batch_idx];
+    if (root < 0) {
+        return;
+    }
+    const int input_length = input_lengths != nullptr ? input_lengths[batch_idx] : max_input_length;
+
+    int node = states[batch_idx];
+    if (reset) {
+        // the last `window` tokens before `end`, excluding the padding
+        const int tail = max(end - max(max_input_length, input_length), 0);
+        begin          = tail >= window ? end - window : max(min(input_length, end) - (window - tail), 0);
+        node           = root;
+    }
+    for (int t = begin; t < end; ++t) {
+        // Skip the padding tokens in input sequences.
+        if (t >= input_length && t < max_input_length) {
+            continue;
+        }
+        node = advanceStopAutomaton(nodes, edges, root, node, output_ids[t * batch_size + batch_idx]);
+    }
+    states[batch_idx] = node;
+
+    if (nodes[node].match) {
+        finished[batch_idx] = true;
+    }
+}
+
+void invokeStopAutomatonCriterion(const int*      output_ids,
+                                  const int*      input_lengths,
+                                  const StopNode* nodes,
+                                  const StopEdge* edges,
+                                  const int*      roots,
+                                  int*            states,
+                                  bool*           finished,
+                                  int             max_input_length,
+                                  int             batch_size,
+                                  int             begin,
+                                  int             end,
+                                  bool            reset,
+                                  int             window,
+                                  cudaStream_t    stream)
+{
+    constexpr int block = 128;
+    const int     grid  = (batch_size + block - 1) / block;
+    stop_automaton_criterion<<<grid, block, 0, stream>>>(output_ids,
+                                                         input_lengths,
+                                                         nodes,
+                                                         edges,
+                                                         roots,
+                                                         states,
+                                                         finished,
+                                                         max_input_length,
+                                                         batch_size,
+                                                         begin,
+                                                         end,
+                                                         reset,
+                                                         window);
+    sync_check_cuda_error();
+}
+
 __global__ void length_criterion(bool*           finished,
                                  bool*           should_stop,
                                  int*            finished_sum,
@@ -30,6 +30,37 @@ void invokeStopWordsCriterion(const int*   output_ids,
                               int          step,
                               cudaStream_t stream);
 
+// Aho-Corasick automaton of the stop sequences, the nodes of all the sequences in a batch are concatenated
+struct StopNode {
+    int edge_beg;  // edges in [edge_beg, edge_end), sorted by token
+    int edge_end;
+    int fail;   // node of the longest proper suffix
+    int match;  // a stop sequence is a suffix of the node
+};
+
+struct StopEdge {
+    int token;
+    int next;
+};
+
+// Advances the automaton of each sequence by the tokens at [begin, end) of `output_ids` [step, batch_size] and stops
+// the sequence if a stop sequence ends at `end - 1`. With `reset` the states restart from `roots` over the last
+// `window` tokens before `end` instead. The padding at [input_length, max_input_length) is skipped
+void invokeStopAutomatonCriterion(const int*      output_ids,
+                                  const int*      input_lengths,
+                                  const StopNode* nodes,
+                                  const StopEdge* edges,
+                                  const int*      roots,
+                                  int*            states,
+                                  bool*           finished,
+                                  int             max_input_length,
+                                  int             batch_size,
+                                  int             begin,
+                                  int             end,
+                                  bool            reset,
+                                  int             window,
+                                  cudaStream_t    stream);
+
 void invokeLengthCriterion(bool*           finished,
                            bool*           should_stop,
                            int*            finished_sum,
@@ -20,12 +20,14 @@
 #include <unordered_map>
 
 #include "src/turbomind/layers/BaseLayer.h"
+#include "src/turbomind/layers/param_upload.h"
 
 namespace turbomind {
 
 struct DynamicDecodeCommonArgs {
-    size_t vocab_size;
-    size_t vocab_size_padded;
+    size_t       vocab_size;
+    size_t       vocab_size_padded;
+    ParamUpload* params;  // per-slot parameters of all the layers, uploaded after their `setup`
 };
 
 class DynamicDecodeBaseLayer: public BaseLayer {
@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
+#include "src/turbomind/kernels/beam_search_kernels.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
+#include "src/turbomind/kernels/stop_criteria_kernels.h"
 #include "src/turbomind/layers/DynamicDecodeLayer.h"
 #include "src/turbomind/layers/sampling_layers/LogitsProcessorLayer.h"
 #include "src/turbomind/layers/sampling_layers/SamplingLayer.h"
@@ -23,6 +28,29 @@
 
 namespace turbomind {
 
+namespace {
+
+// Every sequence takes the argmax of its logits and stops by the length limit only: top-k of 1 (top-p, min-p and
+// temperature keep the top-1), no penalties, bad words, stop words or logprobs. EOS is checked by the caller.
+bool IsGreedyBatch(size_t batch_size, TensorMap* runtime_args)
+{
+    for (const auto& key : {"repetition_penalty",
+                            "frequency_penalty",
+                            "presence_penalty",
+                            "min_length",
+                            "bad_words_list",
+                            "stop_words_list",
+                            "output_logprobs"}) {
+        if (runtime_args->isExist(key)) {
+            return false;
+        }
+    }
+    const int* top_k = runtime_args->getPtr<int>("runtime_top_k", nullptr);
+    return top_k && std::all_of(top_k, top_k + batch_size, [](int k) { return k == 1; });
+}
+
+}  // namespace
+
 template<typename T>
 void DynamicDecodeLayer<T>::allocateBuffer()
 {
@@ -38,7 +66,11 @@ void DynamicDecodeLayer<T>::initialize()
 {
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
 
-    DynamicDecodeCommonArgs args{vocab_size_, vocab_size_padded_};
+    params_ = std::make_unique<ParamUpload>(allocator_);
+
+    h_pinned_finished_sum_ = (int*)allocator_->malloc(sizeof(int), true, true);
+
+    DynamicDecodeCommonArgs args{vocab_size_, vocab_size_padded_, params_.get()};
     layers_.emplace_back(new LogitsProcessorLayer<T>(stream_, allocator_, is_free_buffer_after_forward_, args));
     layers_.emplace_back(new SamplingLayer<T>(stream_, allocator_, is_free_buffer_after_forward_, args));
     layers_.emplace_back(new StopCriteriaLayer<T>(stream_, allocator_, is_free_buffer_after_forward_, args));
@@ -64,6 +96,7 @@ DynamicDecodeLayer<T>::DynamicDecodeLayer(size_t           vocab_size,
 template<typename T>
 DynamicDecodeLayer<T>::~DynamicDecodeLayer()
 {
+    allocator_->free((void**)&h_pinned_finished_sum_, true);
 }
 
 template<typename T>
@@ -88,6 +121,7 @@ void DynamicDecodeLayer<T>::setup(const size_t batch_size, const size_t beam_wid
      *   \param  runtime_top_p [batch_size] on cpu, optional
      *   \param  temperature [batch_size] on cpu, optional
      *   \param  repetition_penalty [batch_size] on cpu, optional
+     *   \param  stop_words_list [batch_size, 2, stop_words_length] on cpu, optional
      *   \param  min_length [batch_size], optional
      *   \param  context_length [batch_size], optional
      *   \param  prompt_length [batch_size], optional
@@ -95,9 +129,17 @@ void DynamicDecodeLayer<T>::setup(const size_t batch_size, const size_t beam_wid
 
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
     FT_CHECK_WITH_INFO(beam_width == 1, "only support beam_width=1");
+
+    // the layers are set up again when a batch no longer qualifies
+    greedy_ = IsGreedyBatch(batch_size, runtime_args);
+    if (greedy_) {
+        return;
+    }
+
     for (const auto& layer : layers_) {
         layer->setup(batch_size, beam_width, runtime_args);
     }
+    params_->Upload(stream_);
 }
 
 template<typename T>
@@ -123,16 +165,17 @@ void DynamicDecodeLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_
      *   \param  sequence_limit_length [batch_size]
      *   \param  ite [1] on cpu
      *   \param  local_batch_size [1] on cpu
-     *   \param  stop_words_list [batch_size, 2, stop_words_length], optional
      *   \param  runtime_top_k [batch_size] on cpu, optional, uint
      *   \param  runtime_top_p [batch_size] on cpu, optional, float
      *   \param  temperature [batch_size] on cpu, optional, float
      *   \param  repetition_penalty [batch_size] on cpu, optional, float
      *   \param  bad_words_list [batch_size, 2, bad_words_length], optional
+     *   \param  random_seed [local_batch_size], uint64
+     *   \param  beam_groups [group_num], BeamSearchGroup, optional
+     *   \param  beam_history [batch_size, history_len], required by beam_groups
      *
      * output_tensors:
      *   \param  output_ids [max_seq_len, batch_size, 1]
-     *   \param  curand_state [local_batch_size]
      *   \param  finished [batch_size * beam_width], optional
      *   \param  sequence_length [batch_size * beam_width], optional
      *   \param  sampled_indexes [batch_size, 1, kMaxLogProb], optional
@@ -148,9 +191,69 @@ void DynamicDecodeLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_
     FT_CHECK(local_batch_size == batch_size);
     FT_CHECK(input_tensors->at("logits").shape.size() == 3);
 
-    for (const auto& layer : layers_) {
-        layer->forward(output_tensors, input_tensors);
+    const int step = input_tensors->at("step").getVal<int>();
+
+    // the rows of the beam search groups select their tokens from the raw logits, the tokens sampled for them in
+    // between are replaced by the commit
+    BeamSearchParams beam{};
+    if (const Tensor groups = input_tensors->at("beam_groups", Tensor{}); groups.data) {
+        FT_CHECK(!input_tensors->isExist("logit_ids"));
+        const Tensor history = input_tensors->at("beam_history");
+
+        beam.logits                = input_tensors->at("logits").data;
+        beam.stride                = vocab_size_padded_;
+        beam.vocab_size            = vocab_size_;
+        beam.groups                = groups.getPtr<BeamSearchGroup>();
+        beam.group_num             = groups.shape[0];
+        beam.batch_size            = batch_size;
+        beam.step                  = step;
+        beam.output_ids            = output_tensors->at("output_ids").getPtr<int>();
+        beam.sequence_length       = output_tensors->at("sequence_length").getPtr<int>();
+        beam.finished              = output_tensors->at("finished").getPtr<bool>();
+        beam.sequence_limit_length = input_tensors->at("sequence_limit_length").getPtr<const uint32_t>();
+        beam.history               = history.getPtr<const int>();
+        beam.history_stride        = history.shape[1];
+        invokeBeamSearch<T>(beam, stream_);
     }
+
+    if (greedy_) {
+        const Tensor logit_ids = input_tensors->at("logit_ids", Tensor{});
+
+        GreedySamplingParams params{};
+        params.logits                = input_tensors->at("logits").data;
+        params.token_ids             = logit_ids.getPtr<const int>();
+        params.token_bitmask         = input_tensors->getPtr<const uint32_t>("token_bitmask", nullptr);
+        params.stride                = logit_ids.data ? logit_ids.shape[1] : vocab_size_padded_;
+        params.vocab_size            = logit_ids.data ? logit_ids.shape[1] : vocab_size_;
+        params.batch_size            = batch_size;
+        params.step                  = step;
+        params.output_ids            = output_tensors->at("output_ids").getPtrWithOffset<int>(step * batch_size);
+        params.sequence_length       = output_tensors->getPtr<int>("sequence_length", nullptr);
+        params.finished              = output_tensors->getPtr<bool>("finished", nullptr);
+        params.sequence_limit_length = input_tensors->getPtr<const uint32_t>("sequence_limit_length", nullptr);
+
+        invokeGreedySampling<T>(params, stream_);
+
+        // the finished sequences are counted by the length criterion, which is idempotent
+        bool* should_stop = output_tensors->getPtr<bool>("should_stop", nullptr);
+        if (should_stop && params.finished && params.sequence_limit_length) {
+            invokeLengthCriterion(params.finished,
+                                  should_stop,
+                                  h_pinned_finished_sum_,
+                                  params.sequence_limit_length,
+                                  batch_size,
+                                  1,
+                                  step,
+                                  stream_);
+        }
+    }
+    else {
+        for (const auto& layer : layers_) {
+            layer->forward(output_tensors, input_tensors);
+        }
+    }
+
+    invokeBeamCommit(beam, stream_);
 }
 
 #ifdef ENABLE_FP32
@@ -35,8 +35,12 @@ protected:
     size_t          vocab_size_padded_;
     cudaDeviceProp* cuda_device_prop_;
 
+    std::unique_ptr<ParamUpload>                         params_;
     std::vector<std::unique_ptr<DynamicDecodeBaseLayer>> layers_;
 
+    bool greedy_{};                 // argmax of the logits in place of `layers_`, set by `setup`
+    int* h_pinned_finished_sum_{};  // for `should_stop` of the greedy path
+
 public:
     DynamicDecodeLayer(size_t           vocab_size,
                        size_t           vocab_size_padded,
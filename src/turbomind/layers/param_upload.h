@@ -0,0 +1,94 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "src/turbomind/utils/allocator.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/monotonic.h"
+
+namespace turbomind {
+
+// Per-slot parameters of the sampling layers packed in struct-of-arrays. The arrays added by the layers are staged
+// on host and uploaded to one device buffer by a single copy of the span that changed since the last upload, the
+// device pointers are set by `Upload`
+class ParamUpload {
+public:
+    explicit ParamUpload(IAllocator* allocator): allocator_{allocator} {}
+
+    ~ParamUpload()
+    {
+        allocator_->free(&buf_);
+    }
+
+    ParamUpload(const ParamUpload&) = delete;
+    ParamUpload& operator=(const ParamUpload&) = delete;
+
+    template<class T>
+    void Add(T** dst, const T* src, size_t count)
+    {
+        items_.push_back({(void**)dst, src, sizeof(T) * count});
+    }
+
+    void Upload(cudaStream_t stream)
+    {
+        std::vector<size_t> offsets;
+        Monotonic           plan{nullptr};
+        for (const auto& x : items_) {
+            char* p{};
+            plan(&p, x.size);
+            offsets.push_back((size_t)p);
+        }
+        const size_t size = (size_t)plan.ptr();
+
+        staging_.resize(size);
+        for (size_t i = 0; i < items_.size(); ++i) {
+            std::copy_n((const char*)items_[i].src, items_[i].size, staging_.data() + offsets[i]);
+        }
+
+        void* buf = allocator_->reMalloc(buf_, size, false);
+        if (buf != buf_ || uploaded_.size() != size) {  // content of the device buffer is lost
+            uploaded_.clear();
+        }
+        buf_ = buf;
+
+        size_t first = 0;
+        size_t last  = size;
+        if (uploaded_.size() == size) {
+            const auto head = std::mismatch(staging_.begin(), staging_.end(), uploaded_.begin());
+            const auto tail = std::mismatch(staging_.rbegin(), staging_.rend(), uploaded_.rbegin());
+            first           = head.first - staging_.begin();
+            last            = size - (tail.first - staging_.rbegin());
+        }
+        if (first < last) {
+            // pageable source, `staging_` can be reused right after the call returns
+            check_cuda_error(cudaMemcpyAsync(
+                (char*)buf_ + first, staging_.data() + first, last - first, cudaMemcpyHostToDevice, stream));
+        }
+
+        for (size_t i = 0; i < items_.size(); ++i) {
+            *items_[i].dst = (char*)buf_ + offsets[i];
+        }
+
+        uploaded_.swap(staging_);
+        items_.clear();
+    }
+
+private:
+    struct Item {
+        void**      dst;
+        const void* src;
+        size_t      size;
+    };
+
+    IAllocator* allocator_;
+    void*       buf_{};
+
+    std::vector<Item> items_;
+    std::vector<char> staging_;
+    std::vector<char> uploaded_;  // content of `buf_`
+};
+
+}  // namespace turbomind
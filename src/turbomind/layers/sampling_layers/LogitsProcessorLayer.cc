@@ -50,13 +50,9 @@ void LogitsProcessorLayer<T>::allocateBuffer(const size_t batch_size)
 {
     TM_LOG_DEBUG("%s start", __PRETTY_FUNCTION__);
 
-    repetition_penalty_buf_ =
-        reinterpret_cast<float*>(allocator_->reMalloc(repetition_penalty_buf_, sizeof(float) * batch_size, false));
-    min_lengths_buf_ = reinterpret_cast<int*>(allocator_->reMalloc(min_lengths_buf_, sizeof(int) * batch_size, false));
-    temperature_buf_ =
-        reinterpret_cast<float*>(allocator_->reMalloc(temperature_buf_, sizeof(float) * batch_size, false));
-
     repetition_penalty_.resize(batch_size);
+    frequency_penalty_.resize(batch_size);
+    presence_penalty_.resize(batch_size);
     min_lengths_.resize(batch_size);
     context_length_.resize(batch_size);
     prompt_length_.resize(batch_size);
@@ -71,15 +67,14 @@ void LogitsProcessorLayer<T>::freeBuffer()
     TM_LOG_DEBUG("%s start", __PRETTY_FUNCTION__);
 
     repetition_penalty_ = {};
+    frequency_penalty_  = {};
+    presence_penalty_   = {};
     min_lengths_        = {};
     context_length_     = {};
     prompt_length_      = {};
     temperature_        = {};
 
-    allocator_->free((void**)&repetition_penalty_workspace_);
-    allocator_->free((void**)&repetition_penalty_buf_);
-    allocator_->free((void**)&min_lengths_buf_);
-    allocator_->free((void**)&temperature_buf_);
+    allocator_->free((void**)&token_counts_);
 
     TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
 }
@@ -97,7 +92,8 @@ LogitsProcessorLayer<T>::~LogitsProcessorLayer()
 template<typename T>
 void LogitsProcessorLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_tensors)
 {
-    // apply repetition penalty -> ban bad words -> min length penalty -> temperature penalty
+    // apply repetition, frequency & presence penalties -> ban bad words -> token bitmask -> min length penalty ->
+    // temperature penalty
     // the order is same with transformers
 
     TM_LOG_DEBUG("%s start", __PRETTY_FUNCTION__);
@@ -109,27 +105,36 @@ void LogitsProcessorLayer<T>::forward(TensorMap* output_tensors, TensorMap* inpu
     const int max_input_length = input_tensors->at("max_input_length").getVal<int>();
     T*        logits           = input_tensors->at("logits").getPtr<T>();
 
-    // repetition penalty
-    if (step > 1 && repetition_penalty_type_ != RepetitionPenaltyType::None) {
-        float default_value = getDefaultPenaltyValue(repetition_penalty_type_);
-        if (!ALL_OF(repetition_penalty_.begin(), batch_size, float, default_value)) {
-            repetition_penalty_workspace_ = reinterpret_cast<int*>(allocator_->reMalloc(
-                repetition_penalty_workspace_, batch_size * step * (sizeof(int) + sizeof(float)), false));
-            invokeBatchApplyRepetitionPenalty(
-                logits,
-                repetition_penalty_buf_,
-                repetition_penalty_workspace_,
-                output_tensors->at("output_ids").getPtr<int>(),
-                batch_size,
-                batch_size,
-                args_.vocab_size_padded,
-                input_tensors->at("input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {}, nullptr}).getPtr<int>(),
-                max_input_length,
-                step,
-                repetition_penalty_type_,
-                stream_);
-            sync_check_cuda_error();
+    // repetition, frequency & presence penalties, the token counts are updated incrementally with the new tokens
+    if (repetition_penalty_on_ || frequency_penalty_on_ || presence_penalty_on_) {
+        if (step < counted_step_) {
+            counted_step_ = 0;
+        }
+        if (counted_step_ == 0) {
+            check_cuda_error(cudaMemsetAsync(
+                token_counts_, 0, sizeof(uint32_t) * batch_size * args_.vocab_size_padded, stream_));
         }
+        invokeUpdateTokenCounts(
+            token_counts_,
+            output_tensors->at("output_ids").getPtr<int>(),
+            input_tensors->at("input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {}, nullptr}).getPtr<int>(),
+            max_input_length,
+            batch_size,
+            args_.vocab_size_padded,
+            counted_step_,
+            step,
+            stream_);
+        counted_step_ = step;
+        invokeBatchApplyTokenPenalties(logits,
+                                       token_counts_,
+                                       repetition_penalty_on_ ? repetition_penalty_buf_ : nullptr,
+                                       frequency_penalty_on_ ? frequency_penalty_buf_ : nullptr,
+                                       presence_penalty_on_ ? presence_penalty_buf_ : nullptr,
+                                       batch_size,
+                                       args_.vocab_size,
+                                       args_.vocab_size_padded,
+                                       stream_);
+        sync_check_cuda_error();
     }
 
     // ban bad words
@@ -154,6 +159,17 @@ void LogitsProcessorLayer<T>::forward(TensorMap* output_tensors, TensorMap* inpu
         sync_check_cuda_error();
     }
 
+    // grammar constraints
+    if (input_tensors->isExist("token_bitmask")) {
+        invokeApplyTokenBitmask(logits,
+                                input_tensors->getPtr<const uint32_t>("token_bitmask"),
+                                batch_size,
+                                args_.vocab_size,
+                                args_.vocab_size_padded,
+                                stream_);
+        sync_check_cuda_error();
+    }
+
     // min length
     {
         const int        num_generated_tokens = step - max_input_length;
@@ -178,11 +194,17 @@ void LogitsProcessorLayer<T>::forward(TensorMap* output_tensors, TensorMap* inpu
         }
     }
 
-    // temperature
+    // temperature, the logits may be the top-k candidates of the vocab shards
     {
         if (!ALL_OF(temperature_.begin(), batch_size, float, 1.f)) {
-            invokeBatchApplyTemperaturePenalty_v2(
-                logits, (T*)nullptr, temperature_buf_, batch_size, args_.vocab_size, args_.vocab_size_padded, stream_);
+            const int vocab_size = input_tensors->at("logits").shape[2];
+            invokeBatchApplyTemperaturePenalty_v2(logits,
+                                                  (T*)nullptr,
+                                                  temperature_buf_,
+                                                  batch_size,
+                                                  std::min<int>(args_.vocab_size, vocab_size),
+                                                  vocab_size,
+                                                  stream_);
             sync_check_cuda_error();
         }
     }
@@ -197,10 +219,19 @@ void LogitsProcessorLayer<T>::setup(const size_t batch_size, const size_t beam_w
 
     allocateBuffer(batch_size);
 
-    // repetition_penalty
-    if (runtime_args->isExist("repetition_penalty")) {
-        init_host_buffer(runtime_args, "repetition_penalty", batch_size, repetition_penalty_.data(), 1.f);
-        repetition_penalty_type_ = RepetitionPenaltyType::Multiplicative;
+    // repetition, frequency & presence penalties
+    init_host_buffer(runtime_args, "repetition_penalty", batch_size, repetition_penalty_.data(), 1.f);
+    init_host_buffer(runtime_args, "frequency_penalty", batch_size, frequency_penalty_.data(), 0.f);
+    init_host_buffer(runtime_args, "presence_penalty", batch_size, presence_penalty_.data(), 0.f);
+    repetition_penalty_on_ = !ALL_OF(repetition_penalty_.begin(), batch_size, float, 1.f);
+    frequency_penalty_on_  = !ALL_OF(frequency_penalty_.begin(), batch_size, float, 0.f);
+    presence_penalty_on_   = !ALL_OF(presence_penalty_.begin(), batch_size, float, 0.f);
+
+    // the batch is re-arranged, the counts are rebuilt from the tokens on the next step
+    counted_step_ = 0;
+    if (repetition_penalty_on_ || frequency_penalty_on_ || presence_penalty_on_) {
+        token_counts_ = (uint32_t*)allocator_->reMalloc(
+            token_counts_, sizeof(uint32_t) * batch_size * args_.vocab_size_padded, false);
     }
 
     // temperature
@@ -215,11 +246,11 @@ void LogitsProcessorLayer<T>::setup(const size_t batch_size, const size_t beam_w
     std::transform(
         min_lengths_.begin(), min_lengths_.end(), prompt_length_.begin(), min_lengths_.begin(), std::plus<int>());
 
-    cudaAutoCpy(temperature_buf_, temperature_.data(), batch_size, stream_);
-    cudaAutoCpy(repetition_penalty_buf_, repetition_penalty_.data(), batch_size, stream_);
-    cudaAutoCpy(min_lengths_buf_, min_lengths_.data(), batch_size, stream_);
-
-    sync_check_cuda_error();
+    args_.params->Add(&temperature_buf_, temperature_.data(), batch_size);
+    args_.params->Add(&repetition_penalty_buf_, repetition_penalty_.data(), batch_size);
+    args_.params->Add(&frequency_penalty_buf_, frequency_penalty_.data(), batch_size);
+    args_.params->Add(&presence_penalty_buf_, presence_penalty_.data(), batch_size);
+    args_.params->Add(&min_lengths_buf_, min_lengths_.data(), batch_size);
 
     TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
 }
@@ -42,21 +42,32 @@ private:
 
     void freeBuffer() override;
 
-    // repetition penalty type
-    RepetitionPenaltyType repetition_penalty_type_ = RepetitionPenaltyType::None;
+    // penalties present in the batch
+    bool repetition_penalty_on_ = false;
+    bool frequency_penalty_on_  = false;
+    bool presence_penalty_on_   = false;
+
+    // tokens of `output_ids` in [0, counted_step_) are in `token_counts_`, 0 for rebuilding from scratch
+    int counted_step_ = 0;
 
     // host buffer
     std::vector<float> repetition_penalty_;
+    std::vector<float> frequency_penalty_;
+    std::vector<float> presence_penalty_;
     std::vector<int>   min_lengths_;
     std::vector<float> temperature_;
     std::vector<int>   context_length_;
     std::vector<int>   prompt_length_;
 
     // device buffer
-    int*   repetition_penalty_workspace_ = nullptr;
-    float* repetition_penalty_buf_       = nullptr;
-    int*   min_lengths_buf_              = nullptr;
-    float* temperature_buf_              = nullptr;
+    uint32_t* token_counts_ = nullptr;  // [batch_size, vocab_size_padded]
+
+    // in `args_.params`
+    float*    repetition_penalty_buf_ = nullptr;
+    float*    frequency_penalty_buf_  = nullptr;
+    float*    presence_penalty_buf_   = nullptr;
+    int*      min_lengths_buf_        = nullptr;
+    float*    temperature_buf_        = nullptr;
 };
 
 }  // namespace turbomind
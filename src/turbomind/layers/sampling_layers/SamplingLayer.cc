@@ -15,6 +15,8 @@
  */
 
 #include "src/turbomind/layers/sampling_layers/SamplingLayer.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
+#include "src/turbomind/kernels/logprob_kernels.h"
 #include "src/turbomind/kernels/sampling_kernels.h"
 #include "src/turbomind/kernels/sampling_topk_kernels.h"
 #include "src/turbomind/kernels/sampling_topp_kernels.h"
@@ -74,13 +76,6 @@ void SamplingLayer<T>::allocateBuffer(const size_t batch_size)
 {
     TM_LOG_DEBUG("%s start", __PRETTY_FUNCTION__);
 
-    runtime_top_k_buf_ =
-        reinterpret_cast<int*>(allocator_->reMalloc(runtime_top_k_buf_, sizeof(int) * batch_size, false));
-    runtime_top_p_buf_ =
-        reinterpret_cast<float*>(allocator_->reMalloc(runtime_top_p_buf_, sizeof(float) * batch_size, false));
-    runtime_min_p_buf_ =
-        reinterpret_cast<float*>(allocator_->reMalloc(runtime_min_p_buf_, sizeof(float) * batch_size, false));
-
     indices_ = reinterpret_cast<int*>(
         allocator_->reMalloc(indices_, batch_size * sizeof(int) * args_.vocab_size_padded, false));
     kept_ = reinterpret_cast<int*>(allocator_->reMalloc(kept_, batch_size * sizeof(int), false));
@@ -119,9 +114,6 @@ void SamplingLayer<T>::freeBuffer()
     runtime_top_p_ = {};
     runtime_min_p_ = {};
 
-    allocator_->free((void**)&runtime_top_k_buf_);
-    allocator_->free((void**)&runtime_top_p_buf_);
-    allocator_->free((void**)&runtime_min_p_buf_);
     allocator_->free((void**)&topk_ws_);
     allocator_->free((void**)&topp_ws_);
 
@@ -158,8 +150,86 @@ void SamplingLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_tenso
     const int step       = input_tensors->at("step").getVal<int>();
     logits_              = logits.getPtr<T>();
 
+    // Top-k candidates of the vocab shards, only the fused path samples from them
+    const Tensor logit_ids = input_tensors->at("logit_ids", Tensor{});
+    FT_CHECK(!logit_ids.data || min_topk_ > 0);
+
+    // The common case, every request has a top-k
+    if (min_topk_ > 0 && max_topk_ <= kFusedSamplingMaxTopK) {
+        FusedSamplingParams params{};
+        params.logits      = logits_;
+        params.token_ids   = logit_ids.getPtr<const int>();
+        params.stride      = logit_ids.data ? logit_ids.shape[1] : args_.vocab_size_padded;
+        params.vocab_size  = logit_ids.data ? logit_ids.shape[1] : args_.vocab_size;
+        params.top_ks      = runtime_top_k_buf_;
+        params.top_ps      = min_topp_ != 1.f ? runtime_top_p_buf_ : nullptr;
+        params.min_ps      = max_minp_ != 0.f ? runtime_min_p_buf_ : nullptr;
+        params.max_top_k   = max_topk_;
+        params.random_seed = input_tensors->at("random_seed").getPtr<const uint64_t>();
+        params.step        = step;
+        params.batch_size  = batch_size;
+        params.output_ids  = output_tensors->at("output_ids").getPtrWithOffset<int>(step * batch_size);
+        params.sequence_length =
+            output_tensors->at("sequence_length", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<int>();
+        params.sampled_logprobs =
+            output_tensors->at("sampled_logprobs", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<T>();
+        params.sampled_indexes =
+            output_tensors->at("sampled_indexes", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<uint32_t>();
+        params.sampled_nums =
+            output_tensors->at("sampled_nums", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<uint32_t>();
+
+        invokeFusedSampling<T>(params, stream_);
+
+        TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
+        return;
+    }
+
     cudaAutoCpy(kept_, kept_n_.data(), batch_size, stream_);
 
+    T*        sampled_logprobs = output_tensors->getPtr<T>("sampled_logprobs", nullptr);
+    uint32_t* sampled_indexes  = output_tensors->getPtr<uint32_t>("sampled_indexes", nullptr);
+    uint32_t* sampled_nums     = output_tensors->getPtr<uint32_t>("sampled_nums", nullptr);
+
+    // Pure sampling from the whole vocab, the full sort only serves the logprobs. Sample from the unsorted probs and
+    // take the top-n logprobs in one pass over the logits instead
+    if (max_topk_ == 0 && min_topp_ == 1.f && max_minp_ == 0.f && max_logprobs_ <= kMaxTopNLogProbs) {
+        if (sampled_logprobs && max_logprobs_ > 0) {
+            invokeTopNLogProbs<T>(sampled_logprobs,
+                                  sampled_indexes,
+                                  sampled_nums,
+                                  logits_,
+                                  std::min(max_logprobs_, (int)args_.vocab_size),
+                                  batch_size,
+                                  args_.vocab_size,
+                                  args_.vocab_size_padded,
+                                  stream_);
+            sync_check_cuda_error();
+        }
+
+        invokeSoftmax<T>(logits_, args_.vocab_size_padded, args_.vocab_size, batch_size, kept_, stream_);
+
+        SamplingParams params{};
+        params.logits      = logits_;
+        params.stride      = args_.vocab_size_padded;
+        params.indices     = nullptr;
+        params.kept        = kept_;
+        params.random_seed = input_tensors->at("random_seed").getPtr<const uint64_t>();
+        params.step        = step;
+        params.batch_size  = batch_size;
+        params.output_ids  = output_tensors->at("output_ids").getPtrWithOffset<int>(step * batch_size);
+        params.sequence_length =
+            output_tensors->at("sequence_length", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<int>();
+        params.sampled_logprobs = max_logprobs_ > 0 ? sampled_logprobs : nullptr;
+        params.sampled_indexes  = sampled_indexes;
+        params.sampled_nums     = sampled_nums;
+
+        invokeSampling<T>(params, stream_);
+        sync_check_cuda_error();
+
+        TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
+        return;
+    }
+
     // use topk sort if some request use topk filter
     if (max_topk_ > 0) {
         // TODO: top_k >= 64 is much slower than torch.topk()
@@ -218,7 +288,8 @@ void SamplingLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_tenso
         params.stride      = args_.vocab_size_padded;
         params.indices     = indices_;
         params.kept        = kept_;
-        params.curandstate = output_tensors->at("curand_state").getPtr<curandState_t>();
+        params.random_seed = input_tensors->at("random_seed").getPtr<const uint64_t>();
+        params.step        = step;
         params.batch_size  = batch_size;
         params.output_ids  = output_tensors->at("output_ids").getPtrWithOffset<int>(step * batch_size);
         params.sequence_length =
@@ -273,14 +344,20 @@ void SamplingLayer<T>::setup(const size_t batch_size, const size_t beam_width, T
     min_topp_ = *std::min_element(runtime_top_p_.begin(), runtime_top_p_.end());
     max_minp_ = *std::max_element(runtime_min_p_.begin(), runtime_min_p_.end());
 
+    max_logprobs_ = 0;
+    if (const Tensor output_logprobs = runtime_args->at("output_logprobs", Tensor{}); output_logprobs.data) {
+        const int* ptr = output_logprobs.getPtr<int>();
+        max_logprobs_  = *std::max_element(ptr, ptr + output_logprobs.size());
+    }
+
     allocateBuffer(batch_size);
 
     // kept
     std::fill_n(kept_n_.data(), batch_size, args_.vocab_size);
 
-    cudaAutoCpy(runtime_top_k_buf_, runtime_top_k_.data(), batch_size, stream_);
-    cudaAutoCpy(runtime_top_p_buf_, runtime_top_p_.data(), batch_size, stream_);
-    cudaAutoCpy(runtime_min_p_buf_, runtime_min_p_.data(), batch_size, stream_);
+    args_.params->Add(&runtime_top_k_buf_, runtime_top_k_.data(), batch_size);
+    args_.params->Add(&runtime_top_p_buf_, runtime_top_p_.data(), batch_size);
+    args_.params->Add(&runtime_min_p_buf_, runtime_min_p_.data(), batch_size);
 
     TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
 }
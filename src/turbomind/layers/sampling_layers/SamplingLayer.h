@@ -49,8 +49,9 @@ private:
     int                min_topk_;
     float              min_topp_;
     float              max_minp_;
+    int                max_logprobs_;
 
-    // device buffer
+    // in `args_.params`
     int*   runtime_top_k_buf_{};
     float* runtime_top_p_buf_{};
     float* runtime_min_p_buf_{};
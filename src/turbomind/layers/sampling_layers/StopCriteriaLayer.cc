@@ -17,9 +17,72 @@
 #include "src/turbomind/layers/sampling_layers/StopCriteriaLayer.h"
 #include "src/turbomind/kernels/stop_criteria_kernels.h"
 #include "src/turbomind/utils/memory_utils.h"
+#include <map>
 
 namespace turbomind {
 
+namespace {
+
+// Appends the Aho-Corasick automaton of the stop sequences in `tokens`, delimited by the end `offsets` (-1 padded),
+// returns the root
+int BuildStopAutomaton(const int*             tokens,
+                       const int*             offsets,
+                       int                    count,
+                       std::vector<StopNode>& nodes,
+                       std::vector<StopEdge>& edges,
+                       int&                   max_len)
+{
+    // trie of the sequences
+    std::vector<std::map<int, int>> children(1);
+    std::vector<int>                match(1);
+    for (int i = 0, beg = 0; i < count && offsets[i] >= 0; beg = offsets[i++]) {
+        int u = 0;
+        for (int j = beg; j < offsets[i]; ++j) {
+            const auto [it, inserted] = children[u].emplace(tokens[j], (int)children.size());
+            u                         = it->second;
+            if (inserted) {
+                children.emplace_back();
+                match.push_back(0);
+            }
+        }
+        match[u] = u != 0;
+        max_len  = std::max(max_len, offsets[i] - beg);
+    }
+
+    // failure links in BFS order, a node matches if any of its suffixes does
+    std::vector<int> fail(children.size());
+    std::vector<int> queue{0};
+    for (size_t k = 0; k < queue.size(); ++k) {
+        const int u = queue[k];
+        for (const auto& [token, v] : children[u]) {
+            if (u != 0) {
+                int f = fail[u];
+                while (f && !children[f].count(token)) {
+                    f = fail[f];
+                }
+                const auto it = children[f].find(token);
+                fail[v]       = it != children[f].end() ? it->second : 0;
+            }
+            match[v] |= match[fail[v]];
+            queue.push_back(v);
+        }
+    }
+
+    const int root = nodes.size();
+    for (size_t u = 0; u < children.size(); ++u) {
+        StopNode node{(int)edges.size(), 0, root + fail[u], match[u]};
+        for (const auto& [token, v] : children[u]) {  // sorted by token
+            edges.push_back({token, root + v});
+        }
+        node.edge_end = edges.size();
+        nodes.push_back(node);
+    }
+
+    return root;
+}
+
+}  // namespace
+
 template<typename T>
 void StopCriteriaLayer<T>::allocateBuffer()
 {
@@ -37,6 +100,11 @@ void StopCriteriaLayer<T>::freeBuffer()
 
     allocator_->free((void**)(&h_pinned_finished_sum_), true);
 
+    allocator_->free((void**)&stop_nodes_buf_);
+    allocator_->free((void**)&stop_edges_buf_);
+    allocator_->free((void**)&stop_roots_buf_);
+    allocator_->free((void**)&stop_states_buf_);
+
     TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
 }
 
@@ -58,22 +126,25 @@ void StopCriteriaLayer<T>::forward(TensorMap* output_tensors, TensorMap* input_t
     const size_t batch_size = input_tensors->at("logits").shape[0];
     const int    step       = input_tensors->at("step").getVal<int>();
 
-    if (input_tensors->isExist("stop_words_list")) {
-        const Tensor stop_words_list = input_tensors->at("stop_words_list");
-        FT_CHECK(stop_words_list.shape.size() == 3);  // [batch, 2, len]
-        size_t stop_words_len = stop_words_list.shape[2];
-        invokeStopWordsCriterion(output_tensors->at("output_ids").getPtr<const int>(),
-                                 nullptr,
-                                 stop_words_list.getPtr<const int>(),
-                                 output_tensors->at("finished").getPtr<bool>(),
-                                 0,
-                                 stop_words_len,
-                                 batch_size,
-                                 1,
-                                 step,
-                                 stream_);
-
-        sync_check_cuda_error();
+    // the automata are advanced by the new tokens only, restarted over the longest stop sequence after `setup`
+    if (stop_on_) {
+        const bool reset = last_step_ < 0 || step <= last_step_;
+        invokeStopAutomatonCriterion(
+            output_tensors->at("output_ids").getPtr<const int>(),
+            input_tensors->at("input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {}, nullptr}).getPtr<int>(),
+            stop_nodes_buf_,
+            stop_edges_buf_,
+            stop_roots_buf_,
+            stop_states_buf_,
+            output_tensors->at("finished").getPtr<bool>(),
+            input_tensors->at("max_input_length").getVal<int>(),
+            batch_size,
+            last_step_ + 1,
+            step + 1,
+            reset,
+            max_stop_len_,
+            stream_);
+        last_step_ = step;
     }
 
     if (input_tensors->isExist("sequence_limit_length")) {
@@ -99,6 +170,42 @@ void StopCriteriaLayer<T>::setup(const size_t batch_size, const size_t beam_widt
 
     allocateBuffer();
 
+    // stop sequences in [batch_size, 2, len] on host, compiled into automata
+    stop_on_   = false;
+    last_step_ = -1;
+    if (runtime_args->isExist("stop_words_list")) {
+        const Tensor& stop_words = runtime_args->at("stop_words_list");
+        FT_CHECK(stop_words.where == MEMORY_CPU && stop_words.shape.size() == 3);
+        const int len = stop_words.shape[2];
+
+        std::vector<StopNode> nodes;
+        std::vector<StopEdge> edges;
+        std::vector<int>      roots(batch_size, -1);
+        max_stop_len_ = 0;
+        for (size_t i = 0; i < batch_size; ++i) {
+            const int* tokens  = stop_words.getPtr<int>() + i * 2 * len;
+            const int* offsets = tokens + len;
+            if (offsets[0] > 0) {
+                roots[i] = BuildStopAutomaton(tokens, offsets, len, nodes, edges, max_stop_len_);
+            }
+        }
+
+        if (!edges.empty()) {
+            stop_nodes_buf_  = (StopNode*)allocator_->reMalloc(stop_nodes_buf_, sizeof(StopNode) * nodes.size());
+            stop_edges_buf_  = (StopEdge*)allocator_->reMalloc(stop_edges_buf_, sizeof(StopEdge) * edges.size());
+            stop_roots_buf_  = (int*)allocator_->reMalloc(stop_roots_buf_, sizeof(int) * batch_size);
+            stop_states_buf_ = (int*)allocator_->reMalloc(stop_states_buf_, sizeof(int) * batch_size);
+            // pageable sources, staged before the calls return
+            check_cuda_error(cudaMemcpyAsync(
+                stop_nodes_buf_, nodes.data(), sizeof(StopNode) * nodes.size(), cudaMemcpyHostToDevice, stream_));
+            check_cuda_error(cudaMemcpyAsync(
+                stop_edges_buf_, edges.data(), sizeof(StopEdge) * edges.size(), cudaMemcpyHostToDevice, stream_));
+            check_cuda_error(cudaMemcpyAsync(
+                stop_roots_buf_, roots.data(), sizeof(int) * batch_size, cudaMemcpyHostToDevice, stream_));
+            stop_on_ = true;
+        }
+    }
+
     TM_LOG_DEBUG("%s stop", __PRETTY_FUNCTION__);
 }
 
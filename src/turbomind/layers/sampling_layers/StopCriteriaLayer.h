@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "src/turbomind/kernels/stop_criteria_kernels.h"
 #include "src/turbomind/layers/DynamicDecodeBaseLayer.h"
 #include "src/turbomind/macro.h"
 
@@ -37,8 +38,19 @@ private:
 
     void freeBuffer() override;
 
+    // stop sequences of the batch
+    bool stop_on_{};
+    int  max_stop_len_{};
+    int  last_step_{-1};  // last token fed to the automata, -1 for restarting them
+
     // host buffer
     int* h_pinned_finished_sum_{};
+
+    // device buffer
+    StopNode* stop_nodes_buf_{};
+    StopEdge* stop_edges_buf_{};
+    int*      stop_roots_buf_{};
+    int*      stop_states_buf_{};
 };
 
 }  // namespace turbomind
@@ -7,10 +7,26 @@
 #include "src/turbomind/utils/string_utils.h"
 #include <algorithm>
 #include <iterator>
+#include <numeric>
 #include <stdexcept>
 
 namespace turbomind {
 
+EvictionPolicy ParseEvictionPolicy(const std::string& name)
+{
+    if (name == "lru") {
+        return EvictionPolicy::kLRU;
+    }
+    else if (name == "lfu") {
+        return EvictionPolicy::kLFU;
+    }
+    else if (name == "2q") {
+        return EvictionPolicy::k2Q;
+    }
+    FT_CHECK_WITH_INFO(0, "unknown cache eviction policy: " + name);
+    return {};
+}
+
 size_t GetSyncFreeMemSize(Barrier& barrier, std::atomic<size_t>& value)
 {
     size_t free{};
@@ -27,11 +43,22 @@ size_t GetSyncFreeMemSize(Barrier& barrier, std::atomic<size_t>& value)
     return value.load();
 }
 
-BlockManager::BlockManager(
-    size_t block_size, double block_count, int chunk_size, IAllocator* allocator, GetFreeMemSize get_free_size):
-    block_size_(block_size), allocator_(allocator)
+BlockManager::BlockManager(size_t         block_size,
+                           double         block_count,
+                           int            chunk_size,
+                           IAllocator*    allocator,
+                           GetFreeMemSize get_free_size,
+                           size_t         swap_space,
+                           EvictionPolicy eviction_policy,
+                           KvCacheLease   lease,
+                           bool           virtual_memory):
+    block_size_(block_size), eviction_policy_(eviction_policy), allocator_(allocator), lease_(std::move(lease))
 {
-    if (block_count < 1.) {
+    if (lease_.pool) {
+        // the blocks are leased on demand up to the quota
+        max_block_count_ = lease_.pool->max_bytes(lease_.tenant) / block_size;
+    }
+    else if (block_count < 1.) {
         max_block_count_ = GetBlockCount(block_size, block_count, get_free_size);
     }
     else {
@@ -48,6 +75,19 @@ BlockManager::BlockManager(
         chunk_size_ = chunk_size;
     }
 
+    if (virtual_memory) {
+        // a single chunk would never be unmapped
+        if (chunk_size < 0) {
+            chunk_size_ = static_cast<int>(std::sqrt(max_block_count_));
+        }
+        // the chunks start at multiples of the granularity
+        const size_t granularity = VirtualMemory::Granularity();
+        const int    unit        = granularity / std::gcd(block_size_, granularity);
+        chunk_size_              = std::max(1, (chunk_size_ + unit - 1) / unit) * unit;
+
+        vmm_ = std::make_unique<VirtualMemory>(block_size_ * max_block_count_);
+    }
+
     TM_LOG_INFO("[BlockManager] block_size = %.3f MB", (float)block_size_ / (1 << 20));
     TM_LOG_INFO("[BlockManager] max_block_count = %d", max_block_count_);
     TM_LOG_INFO("[BlockManager] chunk_size = %d", chunk_size_);
@@ -59,36 +99,79 @@ BlockManager::BlockManager(
     free_ids_.reserve(max_block_count_);
 
     // pre-allocate first chunk
-    Malloc();
+    if (!lease_.pool) {
+        Malloc();
+    }
     dbg(free_ids_);
+
+    if (const int host_block_count = swap_space / block_size_) {
+        host_pool_ = std::make_unique<HostBlockPool>(block_size_, host_block_count, allocator_);
+    }
 }
 
 BlockManager::~BlockManager()
 {
-    for (auto& chunk : chunks_) {
-        allocator_->free(&chunk);
+    host_pool_.reset();
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        if (vmm_) {
+            vmm_->Unmap(i * chunk_size_ * block_size_, mapped_bytes(i));
+        }
+        else {
+            allocator_->free(&chunks_[i]);
+        }
+        if (lease_.pool) {
+            lease_.pool->Return(lease_.tenant, chunk_bytes(i));
+        }
+    }
+    if (lease_.pool) {
+        lease_.pool->Leave(lease_.tenant);
     }
 }
 
 bool BlockManager::Malloc()
 {
-    auto chunk_size = std::min<int>(chunk_size_, max_block_count_ - blocks_.size());
+    // chunks are released from the back, the blocks keep their ids over the releases
+    const int begin      = chunks_.size() * chunk_size_;
+    const int chunk_size = std::min<int>(chunk_size_, max_block_count_ - begin);
+
+    if (chunk_size <= 0) {
+        return false;
+    }
 
-    if (!chunk_size) {
+    if (lease_.pool && !lease_.pool->Lease(lease_.tenant, chunk_bytes(chunks_.size()))) {
         return false;
     }
 
-    auto ptr = (std::byte*)allocator_->malloc(block_size_ * chunk_size);
+    std::byte* ptr{};
+    if (vmm_) {
+        const size_t offset = begin * block_size_;
+        if (vmm_->Map(offset, mapped_bytes(chunks_.size()))) {
+            ptr = (std::byte*)vmm_->base() + offset;
+        }
+    }
+    else {
+        ptr = (std::byte*)allocator_->malloc(block_size_ * chunk_size);
+    }
     if (!ptr) {
+        if (lease_.pool) {
+            lease_.pool->Return(lease_.tenant, chunk_bytes(chunks_.size()));
+        }
         return false;
     }
 
     chunks_.push_back(ptr);
 
     for (int i = 0; i < chunk_size; ++i, ptr += block_size_) {
-        auto& block     = blocks_.emplace_back();
+        if (begin + i == (int)blocks_.size()) {
+            blocks_.emplace_back();
+        }
+        auto& block     = blocks_[begin + i];
         block.use_count = 0;
-        block.id        = (int)blocks_.size() - 1;
+        block.ref_count = 0;
+        block.hit_count = 0;
+        block.swap      = true;
+        block.id        = begin + i;
+        block.unique_id = 0;
         block.timestamp = 0;
         block.data      = ptr;
 
@@ -98,6 +181,103 @@ bool BlockManager::Malloc()
     return true;
 }
 
+bool BlockManager::ReleaseChunk()
+{
+    if (chunks_.empty()) {
+        return false;
+    }
+
+    const int begin = (chunks_.size() - 1) * chunk_size_;
+    const int end   = std::min(begin + chunk_size_, max_block_count_);
+
+    if (std::any_of(blocks_.begin() + begin, blocks_.begin() + end, is_active)) {
+        return false;
+    }
+
+    BlockIds cached;
+    for (int i = begin; i < end; ++i) {
+        if (is_cached(blocks_[i])) {
+            cached.push_back(i);
+        }
+    }
+    EvictIds(cached);
+
+    // free ids are sorted, the blocks of the chunk are at the back
+    const auto it = std::lower_bound(free_ids_.begin(), free_ids_.end(), begin);
+    FT_CHECK(free_ids_.end() - it == end - begin);
+    free_ids_.erase(it, free_ids_.end());
+
+    // neither free nor cached, `unique_id` of 0 invalidates the references to the blocks
+    for (int i = begin; i < end; ++i) {
+        blocks_[i].data = nullptr;
+    }
+
+    if (vmm_) {
+        vmm_->Unmap(begin * block_size_, mapped_bytes(chunks_.size() - 1));
+    }
+    else {
+        allocator_->free(&chunks_.back());
+    }
+    chunks_.pop_back();
+
+    if (lease_.pool) {
+        lease_.pool->Return(lease_.tenant, chunk_bytes(chunks_.size()));
+    }
+
+    return true;
+}
+
+void BlockManager::Rebalance(int demand)
+{
+    if (!lease_.pool) {
+        if (vmm_) {
+            // Unmap the idle chunks at the back while a spare chunk is left on top of the demand. Chunks of cached
+            // blocks are kept, the ranks have the same blocks and make the same choice
+            int released = 0;
+            while (chunks_.size() > 1 && (int)free_ids_.size() >= demand + 2 * chunk_size_) {
+                const int begin = (chunks_.size() - 1) * chunk_size_;
+                const int end   = std::min(begin + chunk_size_, max_block_count_);
+                if (!std::all_of(blocks_.begin() + begin, blocks_.begin() + end, is_free) || !ReleaseChunk()) {
+                    break;
+                }
+                released += end - begin;
+            }
+            if (released) {
+                TM_LOG_INFO("[BlockManager] %d idle blocks unmapped, %.2f GB mapped",
+                            released,
+                            vmm_->mapped_bytes() / (float)(1 << 30));
+            }
+        }
+        return;
+    }
+
+    // The ranks have the same blocks, they agree on the counts so that they release & lease the same chunks
+    auto agree_max = [&](int x) { return -lease_.agree(-x); };
+
+    const int asked = agree_max((lease_.pool->demand(lease_.tenant) + block_size_ - 1) / block_size_);
+    if (asked > 0) {
+        int released = 0;
+        while (released < asked && ReleaseChunk()) {
+            released += chunk_bytes(chunks_.size()) / block_size_;
+        }
+        if (released) {
+            TM_LOG_INFO("[BlockManager] %d blocks given back to the kv cache pool", released);
+        }
+        // leave the memory to the tenants asking for it in this step
+        return;
+    }
+
+    int leased = 0;
+    while ((int)free_ids_.size() < demand && Malloc()) {
+        ++leased;
+    }
+
+    // the chunks leased by some of the ranks only are given back
+    for (int i = lease_.agree(leased); i < leased; ++i) {
+        FT_CHECK(ReleaseChunk());
+    }
+}
+
 size_t BlockManager::GetBlockCount(size_t block_size, double ratio, GetFreeMemSize get_free_size)
 {
     size_t free = get_free_size();
@@ -125,7 +305,8 @@ void BlockManager::Move(std::vector<int>& src, const std::vector<int>& delta, st
 auto BlockManager::Allocate(int count) -> std::pair<BlockIds, UniqueIds>
 {
     while (free_ids_.size() < count) {
-        if (!Malloc()) {
+        // leases of the shared pool are made by `Rebalance` only, in agreement with the other ranks
+        if (lease_.pool || !Malloc()) {
             throw std::runtime_error("out of memory");
         }
     }
@@ -138,6 +319,9 @@ auto BlockManager::Allocate(int count) -> std::pair<BlockIds, UniqueIds>
         auto& b   = blocks_[idx];
         FT_CHECK(is_free(b));  // pre-condition: uc == 0 && ts == 0
         b.use_count = 1;
+        b.ref_count = 1;
+        b.hit_count = 0;
+        b.swap      = true;
         b.unique_id = unique_id_++;
         FT_CHECK(is_active(b));  // post-condition
         block_ids[i]  = idx;
@@ -155,19 +339,57 @@ void BlockManager::Evict(int count)
 {
     FT_CHECK(count <= cached_ids_.size());
     std::vector<int> idxs(cached_ids_);
-    // get first `count` cached ids according to timestamp
-    std::nth_element(idxs.begin(), idxs.begin() + count, idxs.end(), [&](int i, int j) {
-        return blocks_[i].timestamp < blocks_[j].timestamp;
-    });
+    // get first `count` cached ids according to the policy, ties are broken by timestamp
+    auto key = [&](int i) -> std::pair<int, uint64_t> {
+        const auto& b = blocks_[i];
+        switch (eviction_policy_) {
+            case EvictionPolicy::kLFU:
+                return {b.hit_count, b.timestamp};
+            case EvictionPolicy::k2Q:
+                return {b.hit_count > 0, b.timestamp};
+            default:
+                return {0, b.timestamp};
+        }
+    };
+    std::nth_element(
+        idxs.begin(), idxs.begin() + count, idxs.end(), [&](int i, int j) { return key(i) < key(j); });
+
+    if (eviction_policy_ == EvictionPolicy::kLFU) {
+        // age the survivors so that prefixes which are no longer hot can be evicted eventually
+        std::for_each(idxs.begin() + count, idxs.end(), [&](int i) { blocks_[i].hit_count /= 2; });
+    }
+
     idxs.resize(count);
 
     // sort the retrieved ids
     std::sort(idxs.begin(), idxs.end());
 
+    EvictIds(idxs);
+}
+
+void BlockManager::EvictIds(const BlockIds& idxs)
+{
+    if (idxs.empty()) {
+        return;
+    }
+
+    if (host_pool_) {
+        UniqueIds          keys;
+        std::vector<void*> src;
+        for (const auto& idx : idxs) {
+            if (blocks_[idx].swap) {
+                keys.push_back(blocks_[idx].unique_id);
+                src.push_back(blocks_[idx].data);
+            }
+        }
+        swapped_count_ += host_pool_->SwapOut(keys, src);
+    }
+
     // set as free
     for (const auto& idx : idxs) {
         auto& b = blocks_[idx];
         FT_CHECK(is_cached(b));
+        b.ref_count = 0;
         b.unique_id = 0;
         b.timestamp = 0;
         FT_CHECK(is_free(b));
@@ -175,22 +397,56 @@ void BlockManager::Evict(int count)
 
     Move(cached_ids_, idxs, free_ids_);
 
+    evicted_count_ += idxs.size();
+
+    if (track_invalidated_) {
+        invalidated_ids_.insert(invalidated_ids_.end(), idxs.begin(), idxs.end());
+    }
+
     dbg(cached_ids_, free_ids_);
 }
 
+void BlockManager::SetSwap(const BlockIds& ids, bool swap)
+{
+    for (const auto& i : ids) {
+        blocks_[i].swap = swap;
+    }
+}
+
 void BlockManager::Free(BlockIds ids)
 {
     std::sort(ids.begin(), ids.end());
 
+    BlockIds freed;
+    freed.reserve(ids.size());
+
     for (const auto& i : ids) {
         auto& b = blocks_[i];
+        FT_CHECK(b.ref_count > 0);
+        if (--b.ref_count) {
+            continue;
+        }
         FT_CHECK(is_cached(b));  // uc == 0 && ts != 0
         b.unique_id = 0;
         b.timestamp = 0;
         FT_CHECK(is_free(b));
+        freed.push_back(i);
     }
 
-    Move(cached_ids_, ids, free_ids_);
+    Move(cached_ids_, freed, free_ids_);
+
+    if (track_invalidated_) {
+        invalidated_ids_.insert(invalidated_ids_.end(), freed.begin(), freed.end());
+    }
+}
+
+void BlockManager::Share(const BlockIds& ids)
+{
+    for (const auto& i : ids) {
+        auto& b = blocks_[i];
+        FT_CHECK(b.ref_count > 0);
+        ++b.ref_count;
+    }
 }
 
 int BlockManager::Unlock(const BlockIds& ids)
@@ -245,6 +501,13 @@ void BlockManager::Touch(const BlockIds& ids)
     });
 }
 
+void BlockManager::Hit(const BlockIds& ids)
+{
+    for (const auto& i : ids) {
+        ++blocks_[i].hit_count;
+    }
+}
+
 int BlockManager::Verify(const std::vector<int>& block_ids, const std::vector<uint64_t>& unique_ids)
 {
     FT_CHECK(block_ids.size() == unique_ids.size());
@@ -292,8 +555,9 @@ std::ostream& operator<<(std::ostream& os, const BlockManager& manager)
 
 std::ostream& operator<<(std::ostream& os, const Block& block)
 {
-    os << "id=" << block.id << ", use_count=" << block.use_count << ", unique_id=" << block.unique_id
-       << ", timestamp=" << block.timestamp << ", data=" << block.data;
+    os << "id=" << block.id << ", use_count=" << block.use_count << ", ref_count=" << block.ref_count
+       << ", hit_count=" << block.hit_count << ", unique_id=" << block.unique_id << ", timestamp=" << block.timestamp
+       << ", data=" << block.data;
     return os;
 }
 
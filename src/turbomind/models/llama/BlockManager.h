@@ -3,6 +3,9 @@
 #pragma once
 
 #include "src/turbomind/models/llama/Barrier.h"
+#include "src/turbomind/models/llama/HostBlockPool.h"
+#include "src/turbomind/models/llama/kv_cache_pool.h"
+#include "src/turbomind/models/llama/virtual_memory.h"
 #include "src/turbomind/utils/allocator.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
@@ -12,10 +15,12 @@
 #include <cuda_runtime.h>
 #include <functional>
 #include <iterator>
+#include <memory>
 #include <numeric>
 #include <queue>
 #include <sstream>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace turbomind {
@@ -27,6 +32,9 @@ namespace turbomind {
 struct Block {
     int      id;         // fixed linear id in the pool
     int      use_count;  // active sequences using the block
+    int      ref_count;  // sequences holding the block, forks share blocks without prefix caching
+    int      hit_count;  // prefix cache hits since allocation, aged by LFU eviction
+    bool     swap;       // copied to the host pool when evicted, otherwise the kv cache is recomputed
     uint64_t unique_id;  // unique for every block allocation
     uint64_t timestamp;
     void*    data;
@@ -66,14 +74,32 @@ struct Snapshot {
     std::vector<int> use_count;
 };
 
+// Order in which cached blocks are evicted
+enum class EvictionPolicy
+{
+    kLRU,  // least recently used first
+    kLFU,  // least hit first, then LRU
+    k2Q,   // blocks never hit first (e.g. one-off prompts), then LRU
+};
+
+// "lru", "lfu" or "2q"
+EvictionPolicy ParseEvictionPolicy(const std::string& name);
+
 using GetFreeMemSize = std::function<size_t()>;
 
 size_t GetSyncFreeMemSize(Barrier& barrier, std::atomic<size_t>& value);
 
 class BlockManager {
 public:
-    explicit BlockManager(
-        size_t block_size, double block_count, int chunk_size, IAllocator* allocator, GetFreeMemSize get_free_size);
+    explicit BlockManager(size_t         block_size,
+                          double         block_count,
+                          int            chunk_size,
+                          IAllocator*    allocator,
+                          GetFreeMemSize get_free_size,
+                          size_t         swap_space      = 0,
+                          EvictionPolicy eviction_policy = EvictionPolicy::kLRU,
+                          KvCacheLease   lease           = {},
+                          bool           virtual_memory  = false);
 
     ~BlockManager();
 
@@ -86,17 +112,44 @@ public:
     // active -> cached (use_count -= 1)
     [[maybe_unused]] int Unlock(const BlockIds& ids);
 
-    // cached -> free (ref_count = 0)
+    // cached -> free (ref_count = 0) in the order of the eviction policy, evicted blocks are copied to the host pool if
+    // it's enabled and they are marked for swapping
     void Evict(int count);
 
-    // cached -> free (ref_count -= 1)
+    // mark the blocks to be swapped or dropped when evicted, reset to swapping by `Allocate`
+    void SetSwap(const BlockIds& ids, bool swap);
+
+    // cached -> free (ref_count -= 1), blocks still held by other sequences are not freed
     void Free(BlockIds bs);
 
+    // ref_count += 1
+    void Share(const BlockIds& ids);
+
     // increase timestamp in reversed order
     void Touch(const BlockIds& bs);
 
+    // hit_count += 1, for blocks reused by prefix matching
+    void Hit(const BlockIds& bs);
+
     [[nodiscard]] int Verify(const BlockIds& block_ids, const UniqueIds& unique_ids);
 
+    // With a shared pool, gives back the cached blocks asked by the other tenants, or leases chunks until `demand`
+    // blocks are free. Only the leased blocks are counted as free. With virtual memory, the idle chunks beyond the
+    // demand are unmapped
+    void Rebalance(int demand);
+
+    // record the blocks freed by `Evict` & `Free` so that their owners are updated incrementally
+    void TrackInvalidated() noexcept
+    {
+        track_invalidated_ = true;
+    }
+
+    // blocks freed since the last call
+    BlockIds TakeInvalidated()
+    {
+        return std::exchange(invalidated_ids_, {});
+    }
+
     Snapshot TakeSnapshot();
 
     int max_block_count() const noexcept
@@ -104,6 +157,17 @@ public:
         return max_block_count_;
     }
 
+    // blocks of the chunks allocated so far, valid for `block`
+    int block_count() const noexcept
+    {
+        return blocks_.size();
+    }
+
+    size_t block_size() const noexcept
+    {
+        return block_size_;
+    }
+
     int active_count() const noexcept
     {
         return active_ids_.size();
@@ -116,7 +180,19 @@ public:
 
     int free_count() const noexcept
     {
-        return (max_block_count_ - blocks_.size()) + free_ids_.size();
+        return (lease_.pool ? 0 : max_block_count_ - mapped_count()) + free_ids_.size();
+    }
+
+    // blocks evicted since the start
+    int64_t evicted_count() const noexcept
+    {
+        return evicted_count_;
+    }
+
+    // evicted blocks copied to the host pool since the start
+    int64_t swapped_count() const noexcept
+    {
+        return swapped_count_;
     }
 
     Block& block(int idx)
@@ -129,6 +205,11 @@ public:
         return blocks_[idx].unique_id;
     }
 
+    HostBlockPool* host_pool() noexcept
+    {
+        return host_pool_.get();
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const BlockManager&);
 
 private:
@@ -140,22 +221,59 @@ private:
     // allocate a chunk of blocks
     bool Malloc();
 
+    // cached -> free, `ids` are sorted
+    void EvictIds(const BlockIds& ids);
+
+    // give back the last chunk if none of its blocks is active, its cached blocks are evicted
+    bool ReleaseChunk();
+
+    size_t chunk_bytes(int index) const noexcept
+    {
+        return block_size_ * std::min(chunk_size_, max_block_count_ - index * chunk_size_);
+    }
+
+    // blocks of the allocated chunks
+    int mapped_count() const noexcept
+    {
+        return std::min<int>(chunks_.size() * chunk_size_, max_block_count_);
+    }
+
+    // bytes of the virtual memory mapped for the chunk, aligned to the granularity
+    size_t mapped_bytes(int index) const noexcept
+    {
+        const size_t g = vmm_->granularity();
+        return (chunk_bytes(index) + g - 1) / g * g;
+    }
+
 private:
-    size_t      block_size_;
-    int         max_block_count_{};
-    int         chunk_size_{};
-    IAllocator* allocator_;
+    size_t         block_size_;
+    EvictionPolicy eviction_policy_;
+    int            max_block_count_{};
+    int            chunk_size_{};
+    IAllocator*    allocator_;
 
     std::vector<void*> chunks_;
 
+    // the blocks are laid out in one range of addresses, `id * block_size_` from its base
+    std::unique_ptr<VirtualMemory> vmm_;
+
     BlockIds active_ids_;
     BlockIds cached_ids_;
     BlockIds free_ids_;
 
     std::vector<Block> blocks_;  // < 100k
 
+    std::unique_ptr<HostBlockPool> host_pool_;
+
+    KvCacheLease lease_;
+
+    bool     track_invalidated_{};
+    BlockIds invalidated_ids_;
+
     uint64_t unique_id_{1};
     uint64_t timestamp_{1};
+    int64_t  evicted_count_{};
+    int64_t  swapped_count_{};
 };
 
 }  // namespace turbomind
@@ -1,128 +1,479 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
+
 #include "src/turbomind/models/llama/BlockTrie.h"
 #include "src/turbomind/models/llama/SequenceManager.h"
 
 namespace turbomind {
 
-size_t hash(const std::vector<int>& vec)
+// the prompt blocks of a batch are hashed by the workers from this many blocks on
+static constexpr size_t kParallelHashBlocks = 4096;
+
+// partial nodes kept for a parent, the oldest ones are dropped
+static constexpr int kMaxPartialNodes = 8;
+
+static size_t hash(const int* tokens, size_t n)
 {
-    size_t seed = vec.size();
-    for (const auto& i : vec) {
-        seed ^= std::hash<int>{}(i) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    size_t seed = n;
+    for (size_t i = 0; i < n; ++i) {
+        seed ^= std::hash<int>{}(tokens[i]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     }
     return seed;
 }
 
-BlockTrie::BlockTrie(size_t block_seq_len, std::shared_ptr<BlockManager> block_manager, bool enable_prefix_caching):
-    block_seq_len_(block_seq_len), block_manager_(block_manager), enable_prefix_caching_(enable_prefix_caching)
+size_t hash(const std::vector<int>& vec)
 {
-    root_ = std::make_shared<TrieNode>();
+    return hash(vec.data(), vec.size());
 }
 
-void BlockTrie::match(Sequence& seq)
+static uint64_t chain(uint64_t parent, size_t hash_key)
 {
-    BlockIds  matched_blocks;
-    UniqueIds matched_unique_ids;
+    return parent ^ (hash_key + 0x9e3779b97f4a7c15ull + (parent << 6) + (parent >> 2));
+}
 
-    std::shared_ptr<TrieNode> curr_node   = root_;
-    int                       num_matched = 0;
+ChainTable::ChainTable(): keys_(1024), values_(1024, -1), mask_{1023} {}
+
+size_t ChainTable::slot(uint64_t key) const noexcept
+{
+    // chain keys of a path differ in the low bits only by a few xor-shifts, mix them before masking
+    return (key * 0x9e3779b97f4a7c15ull >> 32) & mask_;
+}
 
-    while (num_matched + block_seq_len_ < seq.prompt.size()) {
-        std::vector<int> curr_tokens(seq.prompt.begin() + num_matched,
-                                     seq.prompt.begin() + num_matched + block_seq_len_);
-        size_t           hash_key = hash(curr_tokens);
+int ChainTable::find(uint64_t key) const noexcept
+{
+    for (size_t i = slot(key);; i = (i + 1) & mask_) {
+        if (values_[i] < 0 || keys_[i] == key) {
+            return values_[i];
+        }
+    }
+}
 
-        auto it = curr_node->children.find(hash_key);
+void ChainTable::insert(uint64_t key, int value)
+{
+    // keep the load factor below 1/2
+    if ((size_ + 1) * 2 > keys_.size()) {
+        grow();
+    }
+    size_t i = slot(key);
+    while (values_[i] >= 0) {
+        FT_CHECK(keys_[i] != key);
+        i = (i + 1) & mask_;
+    }
+    keys_[i]   = key;
+    values_[i] = value;
+    ++size_;
+}
 
-        if (it == curr_node->children.end()) {
-            break;
+void ChainTable::erase(uint64_t key)
+{
+    size_t i = slot(key);
+    while (keys_[i] != key || values_[i] < 0) {
+        FT_CHECK(values_[i] >= 0);
+        i = (i + 1) & mask_;
+    }
+    // shift back the following entries of the cluster that would become unreachable
+    for (size_t j = (i + 1) & mask_; values_[j] >= 0; j = (j + 1) & mask_) {
+        const size_t home = slot(keys_[j]);
+        if (((j - home) & mask_) >= ((j - i) & mask_)) {
+            keys_[i]   = keys_[j];
+            values_[i] = values_[j];
+            i          = j;
         }
+    }
+    values_[i] = -1;
+    --size_;
+}
 
-        if (curr_tokens != it->second->tokens) {
-            break;
+void ChainTable::grow()
+{
+    auto keys   = std::move(keys_);
+    auto values = std::move(values_);
+    keys_.assign(keys.size() * 2, 0);
+    values_.assign(keys.size() * 2, -1);
+    mask_ = keys_.size() - 1;
+    size_ = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (values[i] >= 0) {
+            insert(keys[i], values[i]);
         }
+    }
+}
 
-        matched_blocks.push_back(it->second->block_id);
-        matched_unique_ids.push_back(it->second->block_unique_id);
-        curr_node = it->second;
-        num_matched += block_seq_len_;
+BlockTrie::BlockTrie(size_t                        block_seq_len,
+                     std::shared_ptr<BlockManager> block_manager,
+                     bool                          enable_prefix_caching,
+                     std::shared_ptr<PrefixStore>  store,
+                     std::function<void(int, int)> copy):
+    block_seq_len_(block_seq_len),
+    block_manager_(block_manager),
+    enable_prefix_caching_(enable_prefix_caching),
+    hash_workers_(std::clamp<int>(std::thread::hardware_concurrency() / 4, 1, 8)),
+    store_(std::move(store)),
+    copy_(std::move(copy))
+{
+    if (enable_prefix_caching_) {
+        block_manager_->TrackInvalidated();
+    }
+}
+
+int BlockTrie::find(uint64_t chain_key, uint64_t parent, const int* tokens) const
+{
+    const int node = table_.find(chain_key);
+    if (node < 0 || nodes_[node].parent != parent
+        || !std::equal(tokens, tokens + block_seq_len_, tokens_.data() + node * block_seq_len_)) {
+        return -1;
+    }
+    return node;
+}
+
+int BlockTrie::alloc()
+{
+    if (!free_nodes_.empty()) {
+        const int node = free_nodes_.back();
+        free_nodes_.pop_back();
+        return node;
+    }
+    nodes_.emplace_back();
+    tokens_.resize(tokens_.size() + block_seq_len_);
+    return nodes_.size() - 1;
+}
+
+int BlockTrie::insert(uint64_t chain_key, uint64_t parent, const int* tokens, int block_id, uint64_t block_unique_id)
+{
+    const int node = alloc();
+    nodes_[node]   = {chain_key, next_serial_++, parent, 0, -1, (int)block_seq_len_, -1};
+    std::copy_n(tokens, block_seq_len_, tokens_.data() + node * block_seq_len_);
+    table_.insert(chain_key, node);
+    assign(node, block_id, block_unique_id);
+    return node;
+}
+
+int BlockTrie::find_partial(uint64_t parent_key, uint64_t parent, const int* tokens, int limit) const
+{
+    int best = -1;
+    for (int node = partial_.find(parent_key); node >= 0; node = nodes_[node].next) {
+        const auto& n = nodes_[node];
+        if (n.parent == parent && n.len <= limit && (best < 0 || n.len > nodes_[best].len)
+            && std::equal(tokens, tokens + n.len, tokens_.data() + node * block_seq_len_)) {
+            best = node;
+        }
+    }
+    return best;
+}
+
+int BlockTrie::insert_partial(
+    uint64_t parent_key, uint64_t parent, const int* tokens, int len, int block_id, uint64_t block_unique_id)
+{
+    const int head = partial_.find(parent_key);
+    const int node = alloc();
+    nodes_[node]   = {parent_key, next_serial_++, parent, 0, -1, len, head};
+    std::copy_n(tokens, len, tokens_.data() + node * block_seq_len_);
+    if (head >= 0) {
+        partial_.erase(parent_key);
+    }
+    partial_.insert(parent_key, node);
+    ++partial_count_;
+    assign(node, block_id, block_unique_id);
+
+    // the newest ones first
+    int count = 0;
+    for (int i = node, next; i >= 0; i = next) {
+        next = nodes_[i].next;
+        if (++count > kMaxPartialNodes) {
+            erase(i);
+        }
+    }
+    return node;
+}
+
+void BlockTrie::assign(int node, int block_id, uint64_t block_unique_id)
+{
+    auto& n = nodes_[node];
+    if (n.block_id >= 0 && block_node_[n.block_id] == node) {
+        block_node_[n.block_id] = -1;
+    }
+    if (block_id >= (int)block_node_.size()) {
+        block_node_.resize(block_manager_->max_block_count(), -1);
+    }
+    // a block belongs to one node, the previous owner is stale
+    if (const int prev = block_node_[block_id]; prev >= 0 && prev != node) {
+        erase(prev);
+    }
+    n.block_id            = block_id;
+    n.block_unique_id     = block_unique_id;
+    block_node_[block_id] = node;
+}
+
+void BlockTrie::erase(int node)
+{
+    auto& n = nodes_[node];
+    if (n.len < (int)block_seq_len_) {
+        // unlink from the partial nodes of the parent
+        if (const int head = partial_.find(n.chain_key); head == node) {
+            partial_.erase(n.chain_key);
+            if (n.next >= 0) {
+                partial_.insert(n.chain_key, n.next);
+            }
+        }
+        else {
+            int prev = head;
+            while (nodes_[prev].next != node) {
+                prev = nodes_[prev].next;
+            }
+            nodes_[prev].next = n.next;
+        }
+        --partial_count_;
+    }
+    else {
+        table_.erase(n.chain_key);
     }
+    if (block_node_[n.block_id] == node) {
+        block_node_[n.block_id] = -1;
+    }
+    n.block_id = -1;
+    free_nodes_.push_back(node);
+}
 
-    if (matched_blocks.size() > 0) {
-        // add use count
-        block_manager_->Lock(matched_blocks);
-        block_manager_->Touch(matched_blocks);
-        // only consider no history blocks
-        seq.blocks.insert(seq.blocks.end(), matched_blocks.begin(), matched_blocks.end());
-        seq.block_unique_ids.insert(seq.block_unique_ids.end(), matched_unique_ids.begin(), matched_unique_ids.end());
+int BlockTrie::load(uint64_t chain_key, uint64_t parent, const int* prompt, int index)
+{
+    // only use free blocks, loading is not worth evicting cached blocks
+    if (!store_ || block_manager_->free_count() == 0 || !store_->Match(chain_key, prompt, index)) {
+        return -1;
     }
+
+    // free -> active
+    auto [block_ids, unique_ids] = block_manager_->Allocate(1);
+    store_->Get(chain_key, block_manager_->block(block_ids[0]).data);
+
+    return insert(chain_key, parent, prompt + index * block_seq_len_, block_ids[0], unique_ids[0]);
+}
+
+std::vector<int> BlockTrie::match(const std::vector<Sequence*>& seqs)
+{
+    // the last token of a prompt is always computed, so is the block holding it
+    std::vector<size_t> offsets(seqs.size() + 1);
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        const size_t len = seqs[i]->prompt.size();
+        offsets[i + 1]   = offsets[i] + (len ? (len - 1) / block_seq_len_ : 0);
+    }
+
+    std::vector<const int*> tokens(offsets.back());
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        for (size_t b = offsets[i]; b < offsets[i + 1]; ++b) {
+            tokens[b] = seqs[i]->prompt.data() + (b - offsets[i]) * block_seq_len_;
+        }
+    }
+
+    // The hashes of the blocks are independent, the chain keys are cheap to combine afterwards
+    std::vector<size_t> hashes(tokens.size());
+    auto                compute = [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b) {
+            hashes[b] = hash(tokens[b], block_seq_len_);
+        }
+    };
+    const size_t workers = tokens.size() < kParallelHashBlocks ? 1 : hash_workers_;
+    const size_t chunk   = (tokens.size() + workers - 1) / workers;
+    {
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < workers; ++w) {
+            threads.emplace_back(compute, std::min(w * chunk, tokens.size()), std::min((w + 1) * chunk, tokens.size()));
+        }
+        compute(0, std::min(chunk, tokens.size()));
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    BlockIds locked;   // found in memory, the blocks loaded from the store are already active
+    BlockIds matched;  // of all the sequences
+    BlockIds copied;   // sources of the copied partial blocks
+
+    // chain keys of the blocks missed by the sequences so far, computed by them in this step
+    std::unordered_set<uint64_t> missing;
+
+    std::vector<int> lens(seqs.size());
+
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        auto&    seq       = *seqs[i];
+        uint64_t chain_key = 0;
+        uint64_t parent    = 0;  // chain key of the last matched block
+        uint64_t serial    = 0;  // of the last matched node
+        bool     deferred  = false;
+        BlockIds seq_locked;
+        BlockIds seq_loaded;
+
+        for (size_t b = offsets[i]; b < offsets[i + 1]; ++b) {
+            parent    = chain_key;
+            chain_key = chain(chain_key, hashes[b]);
+
+            // an earlier sequence of the batch prefills the same block, attach to it once it's cached
+            if (missing.count(chain_key)) {
+                deferred = true;
+                break;
+            }
+
+            int  node   = table_.find(chain_key);
+            bool loaded = false;
+
+            if (node < 0) {
+                // try the on-disk store
+                node   = load(chain_key, serial, seq.prompt.data(), b - offsets[i]);
+                loaded = node >= 0;
+            }
+            else if (node != find(chain_key, serial, tokens[b])) {
+                node = -1;
+            }
+
+            if (node < 0) {
+                missing.insert(chain_key);
+                chain_key = parent;
+                break;
+            }
+
+            const auto& n = nodes_[node];
+            serial        = n.serial;
+            (loaded ? seq_loaded : seq_locked).push_back(n.block_id);
+            // only consider no history blocks
+            seq.blocks.push_back(n.block_id);
+            seq.block_unique_ids.push_back(n.block_unique_id);
+        }
+
+        if (deferred) {
+            // the loaded blocks are cached for the next match
+            block_manager_->Unlock(seq_loaded);
+            seq.blocks.clear();
+            seq.block_unique_ids.clear();
+            lens[i] = -1;
+            continue;
+        }
+
+        locked.insert(locked.end(), seq_locked.begin(), seq_locked.end());
+        matched.insert(matched.end(), seq.blocks.begin(), seq.blocks.end());
+
+        lens[i] = seq.blocks.size() * block_seq_len_;
+
+        // a copy of the partial block following the matched ones, only from the free blocks like the loading
+        const int limit = (int)seq.prompt.size() - 1 - lens[i];
+        if (copy_ && limit > 0 && block_manager_->free_count()) {
+            if (const int node = find_partial(chain_key, serial, seq.prompt.data() + lens[i], limit); node >= 0) {
+                const auto& n                = nodes_[node];
+                auto [block_ids, unique_ids] = block_manager_->Allocate(1);
+                copy_(n.block_id, block_ids[0]);
+                copied.push_back(n.block_id);
+                seq.blocks.push_back(block_ids[0]);
+                seq.block_unique_ids.push_back(unique_ids[0]);
+                lens[i] += n.len;
+            }
+        }
+    }
+
+    if (!matched.empty()) {
+        // add use count for blocks found in memory, blocks shared by the sequences are counted once per sequence
+        block_manager_->Lock(locked);
+        block_manager_->Touch(matched);
+        block_manager_->Hit(matched);
+    }
+    // the sources may be cached, only the copies are active
+    block_manager_->Hit(copied);
+
+    return lens;
 }
 
 void BlockTrie::cache(const Sequence& seq)
 {
-    std::shared_ptr<TrieNode> curr_node   = root_;
-    int                       num_matched = 0;
-    int                       idx         = 0;
-    BlockIds                  cached_blocks;
+    uint64_t chain_key   = 0;
+    uint64_t serial      = 0;  // of the node of the last block
+    size_t   num_matched = 0;
+    int      idx         = 0;
+    bool     complete    = true;  // all the full blocks are cached
+    BlockIds cached_blocks;
 
     while (num_matched + block_seq_len_ <= seq.prompt.size()) {
-        std::vector<int> curr_tokens(seq.prompt.begin() + num_matched,
-                                     seq.prompt.begin() + num_matched + block_seq_len_);
-        size_t           hash_key = hash(curr_tokens);
+        const int* tokens = seq.prompt.data() + num_matched;
 
-        auto it = curr_node->children.find(hash_key);
+        const uint64_t parent_key = chain_key;
+        chain_key                 = chain(chain_key, hash(tokens, block_seq_len_));
 
         int      block_id        = seq.blocks[idx];
         uint64_t block_unique_id = seq.block_unique_ids[idx];
 
-        if (it != curr_node->children.end()) {
-            if (curr_tokens != it->second->tokens) {
+        if (int node = table_.find(chain_key); node >= 0) {
+            if (!std::equal(tokens, tokens + block_seq_len_, tokens_.data() + node * block_seq_len_)) {
+                complete = false;
                 break;
             }
-            curr_node                  = it->second;
-            curr_node->block_id        = block_id;
-            curr_node->block_unique_id = block_unique_id;
+            if (auto& n = nodes_[node]; n.parent != serial) {
+                // the node is of another prefix or of an erased parent, it gets the block of this prefix & a new
+                // serial, so that its children are not matched under this prefix
+                n.parent = serial;
+                n.serial = next_serial_++;
+            }
+            assign(node, block_id, block_unique_id);
+            serial = nodes_[node].serial;
         }
         else {
-            // insert new node
-            std::shared_ptr<TrieNode> node = std::make_shared<TrieNode>();
-            node->hash_key                 = hash_key;
-            node->tokens                   = curr_tokens;
-            node->block_id                 = block_id;
-            node->block_unique_id          = block_unique_id;
-            node->num_matched              = num_matched + block_seq_len_;
-            curr_node->children[hash_key]  = node;
-            curr_node                      = node;
-        }
-
-        cached_blocks.push_back(curr_node->block_id);
+            serial = nodes_[insert(chain_key, serial, tokens, block_id, block_unique_id)].serial;
+            if (store_) {
+                // computed block of the prompt, persist it for cold starts
+                store_->Put(
+                    chain_key, parent_key, {tokens, tokens + block_seq_len_}, block_manager_->block(block_id).data);
+            }
+        }
+
+        cached_blocks.push_back(block_id);
         num_matched += block_seq_len_;
         idx++;
     }
 
+    // the partial last block once the whole prompt is computed, the tokens appended later don't touch the kv of the
+    // cached ones
+    const int rest = seq.prompt.size() - num_matched;
+    if (copy_ && complete && rest && seq.cache_len >= (int)seq.prompt.size() && idx < (int)seq.blocks.size()) {
+        const int* tokens   = seq.prompt.data() + num_matched;
+        const int  block_id = seq.blocks[idx];
+        if (const int node = find_partial(chain_key, serial, tokens, rest); node >= 0 && nodes_[node].len == rest) {
+            assign(node, block_id, seq.block_unique_ids[idx]);
+        }
+        else {
+            insert_partial(chain_key, serial, tokens, rest, block_id, seq.block_unique_ids[idx]);
+        }
+        cached_blocks.push_back(block_id);
+    }
+
     block_manager_->Touch(cached_blocks);
 }
 
 int BlockTrie::verify()
 {
-    return verify_traverse(root_);
+    for (const auto& id : block_manager_->TakeInvalidated()) {
+        if (id >= (int)block_node_.size()) {
+            continue;
+        }
+        // the block may have been re-cached for the same node since it's freed
+        if (const int node = block_node_[id]; node >= 0) {
+            if (nodes_[node].block_unique_id != block_manager_->block(id).unique_id) {
+                erase(node);
+            }
+        }
+    }
+    return table_.size() + partial_count_ + 1;  // including the root
 }
 
-int BlockTrie::verify_traverse(std::shared_ptr<TrieNode>& node)
+void BlockTrie::flush()
 {
-    int valid_count = 1;
-    for (auto it = node->children.begin(); it != node->children.end();) {
-        if (block_manager_->unique_id(it->second->block_id) != it->second->block_unique_id) {
-            // child invalid
-            it = node->children.erase(it);
-        }
-        else {
-            valid_count += verify_traverse(it->second);
-            it++;
-        }
+    table_         = {};
+    partial_       = {};
+    partial_count_ = 0;
+    nodes_.clear();
+    tokens_.clear();
+    free_nodes_.clear();
+    std::fill(block_node_.begin(), block_node_.end(), -1);
+    if (store_) {
+        store_->Clear();
     }
-    return valid_count;
 }
 
 }  // namespace turbomind
@@ -3,8 +3,9 @@
 #pragma once
 
 #include "src/turbomind/models/llama/BlockManager.h"
+#include "src/turbomind/models/llama/PrefixStore.h"
+#include <functional>
 #include <memory>
-#include <unordered_map>
 #include <vector>
 
 namespace turbomind {
@@ -12,42 +13,128 @@ namespace turbomind {
 struct Sequence;
 
 struct TrieNode {
-    std::unordered_map<size_t, std::shared_ptr<TrieNode>> children;
-    size_t                                                hash_key;
-    std::vector<int>                                      tokens;
-    int                                                   block_id;
-    uint64_t                                              block_unique_id;
-    int                                                   num_matched;
+    uint64_t chain_key;  // hash of the path from root, of the parent for a partial node
+    uint64_t serial;     // never reused, identifies the node as a parent
+    uint64_t parent;     // serial of the parent node, 0 for the root
+    uint64_t block_unique_id;
+    int      block_id;
+    int      len;   // cached tokens, less than a block for the partial last block of a prompt
+    int      next;  // next partial node of the same parent, -1 for none
 };
 
+// Open addressing table of chain key -> node index with linear probing, erasure by backward shift
+class ChainTable {
+public:
+    ChainTable();
+
+    int find(uint64_t key) const noexcept;
+
+    // `key` must not exist
+    void insert(uint64_t key, int value);
+
+    void erase(uint64_t key);
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+private:
+    size_t slot(uint64_t key) const noexcept;
+
+    void grow();
+
+private:
+    std::vector<uint64_t> keys_;
+    std::vector<int>      values_;  // -1 for empty slots
+    size_t                mask_;
+    size_t                size_{};
+};
+
+// Cached prompt blocks keyed by the hash chain of their tokens. A lookup is a probe of the table per block, the
+// nodes & their tokens live in flat arrays and the nodes of the blocks invalidated by the block manager are removed
+// incrementally. The chain keys are not collision resistant, so a node is only matched as the child of the node
+// matched before it, which checks the whole prefix. A node may outlive its parent, it's reachable again once a
+// sequence caches the path under the re-cached parent.
+//
+// The partial last block of a prompt is cached as well, the partial nodes of a parent are matched by token prefix.
+// The owner keeps appending to the block, so a matching sequence gets a copy of it (copy on write) with the kv of the
+// cached tokens.
 class BlockTrie {
 public:
-    explicit BlockTrie(size_t block_len_, std::shared_ptr<BlockManager> block_manager, bool enable_prefix_caching);
+    // `copy(src, dst)` copies the kv of block `src` to block `dst`
+    explicit BlockTrie(size_t                        block_len_,
+                       std::shared_ptr<BlockManager> block_manager,
+                       bool                          enable_prefix_caching,
+                       std::shared_ptr<PrefixStore>  store = {},
+                       std::function<void(int, int)> copy  = {});
 
     bool enabled()
     {
         return enable_prefix_caching_;
     }
 
-    // get cached blocks for sequence
-    void match(Sequence& seq);
+    // get cached blocks for the sequences, the prompt blocks are hashed in parallel for large batches and the
+    // matched blocks are locked at once. Returns the cached tokens of each sequence, -1 for a sequence deferred as
+    // it shares a missing block with an earlier one, which prefills it once for both
+    std::vector<int> match(const std::vector<Sequence*>& seqs);
 
     // cache computed blocks for sequence
     void cache(const Sequence& seq);
 
-    // remove invalid nodes, return valid count
+    // remove the nodes of invalidated blocks, return valid count
     int verify();
 
+    // drop all the nodes and the blocks of the on-disk store, e.g. the kv of the blocks is stale with new weights
+    void flush();
+
+    PrefixStore* store() noexcept
+    {
+        return store_.get();
+    }
+
 private:
-    int verify_traverse(std::shared_ptr<TrieNode>& node);
+    // node of `chain_key` under the node of serial `parent` holding `tokens`, -1 when not cached
+    int find(uint64_t chain_key, uint64_t parent, const int* tokens) const;
+
+    int insert(uint64_t chain_key, uint64_t parent, const int* tokens, int block_id, uint64_t block_unique_id);
+
+    // longest partial node of the node `parent_key` & `parent` holding a prefix of `tokens` no longer than `limit`,
+    // -1 for none
+    int find_partial(uint64_t parent_key, uint64_t parent, const int* tokens, int limit) const;
+
+    int insert_partial(
+        uint64_t parent_key, uint64_t parent, const int* tokens, int len, int block_id, uint64_t block_unique_id);
+
+    // slot for a new node
+    int alloc();
+
+    void assign(int node, int block_id, uint64_t block_unique_id);
+
+    void erase(int node);
+
+    // load the missing block `index` of `prompt` from the on-disk store into a newly allocated block
+    int load(uint64_t chain_key, uint64_t parent, const int* prompt, int index);
 
 private:
     bool   enable_prefix_caching_;
     size_t block_seq_len_;
+    int    hash_workers_;
 
     std::shared_ptr<BlockManager> block_manager_;
 
-    std::shared_ptr<TrieNode> root_;
+    ChainTable            table_;
+    ChainTable            partial_;  // chain key of the parent -> first partial node
+    int                   partial_count_{};
+    std::vector<TrieNode> nodes_;
+    std::vector<int>      tokens_;      // [nodes, block_seq_len]
+    std::vector<int>      free_nodes_;  // recycled slots of the arena
+    std::vector<int>      block_node_;  // node of each block, -1 for none
+    uint64_t              next_serial_{1};
+
+    std::shared_ptr<PrefixStore> store_;
+
+    std::function<void(int, int)> copy_;
 };
 
 }  // namespace turbomind
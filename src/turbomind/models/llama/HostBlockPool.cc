@@ -0,0 +1,135 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/HostBlockPool.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+HostBlockPool::HostBlockPool(size_t block_size, int block_count, IAllocator* allocator):
+    block_size_{block_size}, allocator_{allocator}, stream_{allocator->returnStream()}
+{
+    data_ = (std::byte*)allocator_->malloc(block_size_ * block_count, false, true);
+
+    slots_.resize(block_count);
+    free_.reserve(block_count);
+    for (int i = block_count - 1; i >= 0; --i) {
+        slots_[i].key  = 0;
+        slots_[i].lock = 0;
+        free_.push_back(i);
+    }
+
+    check_cuda_error(cudaStreamCreateWithFlags(&copy_stream_, cudaStreamNonBlocking));
+    check_cuda_error(cudaEventCreateWithFlags(&ev_compute_, cudaEventDisableTiming));
+    check_cuda_error(cudaEventCreateWithFlags(&ev_copy_, cudaEventDisableTiming));
+
+    TM_LOG_INFO("[HostBlockPool] host block count = %d, %.3f GB",
+                block_count,
+                (float)(block_size_ * block_count) / (1 << 30));
+}
+
+HostBlockPool::~HostBlockPool()
+{
+    cudaStreamSynchronize(copy_stream_);
+    cudaEventDestroy(ev_copy_);
+    cudaEventDestroy(ev_compute_);
+    cudaStreamDestroy(copy_stream_);
+    allocator_->free((void**)&data_, true);
+}
+
+int HostBlockPool::Acquire()
+{
+    if (!free_.empty()) {
+        const int slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+    if (!lru_.empty()) {
+        const int slot = lru_.front();
+        lru_.pop_front();
+        index_.erase(slots_[slot].key);
+        return slot;
+    }
+    return -1;
+}
+
+void HostBlockPool::Free(int slot)
+{
+    auto& s = slots_[slot];
+    index_.erase(s.key);
+    s.key  = 0;
+    s.lock = 0;
+    free_.push_back(slot);
+}
+
+int HostBlockPool::SwapOut(const std::vector<uint64_t>& keys, const std::vector<void*>& src)
+{
+    FT_CHECK(keys.size() == src.size());
+    if (keys.empty()) {
+        return 0;
+    }
+
+    // wait for pending writes to the blocks
+    check_cuda_error(cudaEventRecord(ev_compute_, stream_));
+    check_cuda_error(cudaStreamWaitEvent(copy_stream_, ev_compute_));
+
+    int count = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (Contains(keys[i])) {
+            continue;
+        }
+        const int slot = Acquire();
+        if (slot < 0) {  // all slots are locked
+            break;
+        }
+        auto& s = slots_[slot];
+        s.key   = keys[i];
+        s.lock  = 0;
+        s.pos   = lru_.insert(lru_.end(), slot);
+        index_.emplace(keys[i], slot);
+        check_cuda_error(cudaMemcpyAsync(data(slot), src[i], block_size_, cudaMemcpyDeviceToHost, copy_stream_));
+        ++count;
+    }
+
+    // the blocks can't be reused until the copies are done
+    check_cuda_error(cudaEventRecord(ev_copy_, copy_stream_));
+    check_cuda_error(cudaStreamWaitEvent(stream_, ev_copy_));
+
+    return count;
+}
+
+void HostBlockPool::Lock(const std::vector<uint64_t>& keys)
+{
+    for (const auto& k : keys) {
+        auto& s = slots_[index_.at(k)];
+        if (s.lock++ == 0) {
+            lru_.erase(s.pos);
+        }
+    }
+}
+
+void HostBlockPool::Unlock(const std::vector<uint64_t>& keys)
+{
+    for (const auto& k : keys) {
+        auto& s = slots_[index_.at(k)];
+        FT_CHECK(s.lock > 0);
+        if (--s.lock == 0) {
+            s.pos = lru_.insert(lru_.end(), &s - slots_.data());
+        }
+    }
+}
+
+void HostBlockPool::Release(const std::vector<uint64_t>& keys)
+{
+    for (const auto& k : keys) {
+        if (auto it = index_.find(k); it != index_.end()) {
+            const int slot = it->second;
+            if (slots_[slot].lock == 0) {
+                lru_.erase(slots_[slot].pos);
+            }
+            Free(slot);
+        }
+    }
+}
+
+}  // namespace turbomind
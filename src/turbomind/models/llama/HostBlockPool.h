@@ -0,0 +1,99 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/utils/allocator.h"
+
+namespace turbomind {
+
+// Pinned host memory tier for k/v blocks evicted from the device pool. Slots are keyed by the `unique_id` of the
+// device block they were copied from. The swap-outs are issued on a private copy stream and ordered against the
+// compute stream with events, so they never block the host. The swap-ins are issued by the `BlockCopier` of the
+// sequence manager on the same stream, so a slot is not reused before it's read.
+class HostBlockPool {
+public:
+    HostBlockPool(size_t block_size, int block_count, IAllocator* allocator);
+
+    ~HostBlockPool();
+
+    HostBlockPool(const HostBlockPool&) = delete;
+    HostBlockPool& operator=(const HostBlockPool&) = delete;
+
+    // device -> host, unlocked slots are replaced in LRU order, blocks that do not fit are dropped
+    int SwapOut(const std::vector<uint64_t>& keys, const std::vector<void*>& src);
+
+    // pinned host copy of the block `key`
+    const void* Find(uint64_t key) const
+    {
+        return data(index_.at(key));
+    }
+
+    cudaStream_t copy_stream() const noexcept
+    {
+        return copy_stream_;
+    }
+
+    [[nodiscard]] bool Contains(uint64_t key) const
+    {
+        return index_.find(key) != index_.end();
+    }
+
+    // locked slots are never replaced
+    void Lock(const std::vector<uint64_t>& keys);
+
+    void Unlock(const std::vector<uint64_t>& keys);
+
+    // drop the slots (locked or not)
+    void Release(const std::vector<uint64_t>& keys);
+
+    int max_block_count() const noexcept
+    {
+        return (int)slots_.size();
+    }
+
+    int used_count() const noexcept
+    {
+        return (int)index_.size();
+    }
+
+private:
+    int Acquire();
+
+    void Free(int slot);
+
+    std::byte* data(int slot) const noexcept
+    {
+        return data_ + block_size_ * slot;
+    }
+
+private:
+    struct Slot {
+        uint64_t                 key;
+        int                      lock;
+        std::list<int>::iterator pos;  // position in `lru_`, valid when `lock == 0`
+    };
+
+    size_t      block_size_;
+    IAllocator* allocator_;
+
+    std::byte* data_{};
+
+    std::vector<Slot>                 slots_;
+    std::vector<int>                  free_;
+    std::list<int>                    lru_;  // unlocked slots, oldest first
+    std::unordered_map<uint64_t, int> index_;
+
+    cudaStream_t stream_{};       // compute stream
+    cudaStream_t copy_stream_{};  // swap stream
+    cudaEvent_t  ev_compute_{};
+    cudaEvent_t  ev_copy_{};
+};
+
+}  // namespace turbomind
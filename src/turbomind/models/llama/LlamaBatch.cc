@@ -1,17 +1,21 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <climits>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iomanip>
+#include <map>
 #include <memory>
 #include <memory_resource>
 #include <numeric>
 #include <random>
+#include <set>
 #include <sstream>
 #include <thread>
 #include <unordered_map>
@@ -26,25 +30,36 @@
 #include "src/turbomind/engine/gateway.h"
 #include "src/turbomind/engine/request.h"
 
+#include "src/turbomind/kernels/attention/kv_cache_utils_v2.h"
 #include "src/turbomind/kernels/core/data_type.h"
 #include "src/turbomind/kernels/decoding_kernels.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
 #include "src/turbomind/kernels/gemm/tuner/params.h"
+#include "src/turbomind/kernels/logprob_kernels.h"
 #include "src/turbomind/kernels/sampling_topk_kernels.h"
 
 #include "src/turbomind/models/llama/BlockManager.h"
 #include "src/turbomind/models/llama/LlamaBatch.h"
 #include "src/turbomind/models/llama/LlamaV2.h"
 #include "src/turbomind/models/llama/SequenceManager.h"
+#include "src/turbomind/models/llama/cascade.h"
+#include "src/turbomind/models/llama/embedding_cache.h"
+#include "src/turbomind/models/llama/memory_planner.h"
 #include "src/turbomind/models/llama/copy.h"
 #include "src/turbomind/models/llama/llama_kernels.h"
 #include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/models/llama/ngram_proposer.h"
+#include "src/turbomind/models/llama/sparse_layout.h"
+#include "src/turbomind/models/llama/symmetric_allocator.h"
 
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/anomaly_handler.h"
 #include "src/turbomind/utils/constant.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/debug_utils.h"
+#include "src/turbomind/utils/event_log.h"
 #include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/monotonic.h"
 
 namespace turbomind {
 
@@ -93,6 +108,22 @@ void DropEmbeddings(const Sequence& seq)
     seq.input_embedding_ranges.resize(sz);
 }
 
+// Rows of a batch state staged to the device every step, laid out the same on both sides to be copied at once
+size_t PlanStateRows(void* base, size_t batch_size, int** context_length, bool** finished, float** rope_theta)
+{
+    Monotonic alloc{base};
+    alloc(context_length, batch_size);
+    alloc(finished, batch_size * 2);
+    alloc(rope_theta, batch_size);
+    return (char*)alloc.ptr() - (char*)base;
+}
+
+// Sequence of beam `k` of a beam search request, the beams other than the 1st one are private to the engine
+uint64_t BeamSequenceId(uint64_t id, int k)
+{
+    return id ^ (1ULL << 63 | (uint64_t)k << 56);
+}
+
 template<typename T>
 void LlamaBatch<T>::DisableInvalidRequests(Requests& infer_reqs, Requests& kill_reqs)
 {
@@ -135,6 +166,335 @@ void LlamaBatch<T>::DisableInvalidRequests(Requests& infer_reqs, Requests& kill_
             r->ec = Request::kCancel;
         }
     }
+
+    // Requests for adapters that are not registered
+    const auto adapters = model_->weights_->adapters.get();
+    for (auto& r : infer_reqs) {
+        if (const int id = r ? r->gen_cfg.adapter_id : -1; id >= 0 && !r->ec && !(adapters && adapters->Contains(id))) {
+            TM_LOG_ERROR("Skip request for ID %lu with unknown adapter %d", r->id, id);
+            r->ec = Request::kInvalid;
+        }
+    }
+
+    // Scoring requests are stateless, neither history nor kv cache is kept
+    for (auto& r : infer_reqs) {
+        if (r && !r->ec && r->gen_cfg.score
+            && !(r->session.start_flag && r->session.end_flag && !r->session.fork_flag)) {
+            TM_LOG_ERROR("Skip scoring request for ID %lu, it must be a complete session", r->id);
+            r->ec = Request::kInvalid;
+        }
+    }
+
+    // So are the pooling requests, the hidden states of all the prompt tokens are computed
+    for (auto& r : infer_reqs) {
+        if (r && !r->ec && r->gen_cfg.pooling
+            && (r->gen_cfg.pooling > GenerationConfig::kPoolCls
+                || !(r->session.start_flag && r->session.end_flag && !r->session.fork_flag))) {
+            TM_LOG_ERROR("Skip pooling request for ID %lu, it must be a complete session of a known pooling type",
+                         r->id);
+            r->ec = Request::kInvalid;
+        }
+    }
+
+    // Warming requests only leave their prompts in the prefix cache, which the pins keep from eviction
+    for (auto& r : infer_reqs) {
+        if (r && !r->ec && (r->gen_cfg.warm || r->gen_cfg.pin_prefix)
+            && !(param_.enable_prefix_caching && r->session.start_flag && !r->session.fork_flag
+                 && !r->gen_cfg.score && !r->gen_cfg.pooling && (!r->gen_cfg.warm || r->session.end_flag))) {
+            TM_LOG_ERROR("Skip request for ID %lu, warming & pinning prompts require prefix caching and a new "
+                         "session, complete for warming",
+                         r->id);
+            r->ec = Request::kInvalid;
+        }
+    }
+
+    // Hidden states of all the tokens are only complete on the last pipeline stage
+    if (param_.pp_size > 1) {
+        for (auto& r : infer_reqs) {
+            if (r && !r->ec
+                && (r->gen_cfg.output_last_hidden_state || r->gen_cfg.output_logits == GenerationConfig::kAll
+                    || r->gen_cfg.score || r->gen_cfg.pooling)) {
+                TM_LOG_ERROR("Skip request for ID %lu, prompt logits & hidden states are not supported with "
+                             "pipeline parallelism",
+                             r->id);
+                r->ec = Request::kInvalid;
+            }
+        }
+    }
+
+    // Beam search selects the tokens from the raw logits of its beams, which are forked from the sequence after the
+    // 1st step and share the ancestor blocks. Only complete outputs without the logits processors are supported
+    auto beam_unsupported = [&](const Request& r) -> const char* {
+        const auto& c = r.gen_cfg;
+        if (c.beam_width < 1 || c.beam_width > std::min(kMaxBeamWidth, max_batch_size_)) {
+            return "beam width";
+        }
+        if (param_.num_speculative_tokens || model_->medusa_num_heads() || param_.cache_window_size
+            || param_.cache_score_budget || param_.cache_recent_blocks || param_.pp_size > 1) {
+            return "engine config";
+        }
+        if (r.stream_output || c.output_logprobs || c.output_logits || c.output_last_hidden_state || c.score
+            || c.pooling) {
+            return "outputs";
+        }
+        if (c.repetition_penalty != 1.f || c.frequency_penalty != 0.f || c.presence_penalty != 0.f
+            || c.min_new_tokens || !c.bad_ids[0].empty() || c.matcher) {
+            return "logits processors";
+        }
+        // the stop words end a beam as its end tokens
+        const auto& offsets = c.stop_ids[1];
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            if (offsets[i] != (int)i + 1) {
+                return "stop words";
+            }
+        }
+        if (c.eos_ids.size() + c.stop_ids[0].size() > kMaxBeamEndIds) {
+            return "stop words";
+        }
+        if (r.inputs.isExist("input_embedding_ranges") || r.transfer || r.session.kv_stream_flag) {
+            return "inputs";
+        }
+        // each beam may be recomputed on its own after a preemption, the beams must fit in the cache together
+        const int     block_len = model_->attn_param_.cache_block_seq_len;
+        const int64_t history   = r.session.start_flag ? 0 : std::max(r.session.step, 0);
+        const int64_t input_len = r.inputs.at("input_ids").shape[0];
+        const int64_t len       = std::min<int64_t>(history + input_len + c.max_new_tokens, session_len_);
+        if (c.beam_width * ((len + block_len - 1) / block_len) > sequence_manager_->max_block_count()) {
+            return "kv cache";
+        }
+        return nullptr;
+    };
+    for (auto& r : infer_reqs) {
+        if (r && !r->ec && r->gen_cfg.beam_width != 1) {
+            if (const char* what = beam_unsupported(*r)) {
+                TM_LOG_ERROR("Skip beam search request for ID %lu, unsupported %s", r->id, what);
+                r->ec = Request::kInvalid;
+            }
+        }
+    }
+}
+
+template<class T>
+void LlamaBatch<T>::ShareSlots(Requests& infer_reqs, int free_slot_count)
+{
+    if (!fair_share_) {
+        return;
+    }
+
+    // Failed requests and kv imports take no slot
+    auto valid = [](const auto& r) { return !r->ec && !r->transfer; };
+
+    std::vector<int>   tenants;
+    std::vector<float> weights;
+    std::vector<int>   costs;
+    for (const auto& r : infer_reqs) {
+        if (valid(r)) {
+            tenants.push_back(r->gen_cfg.tenant_id);
+            weights.push_back(r->gen_cfg.tenant_weight);
+            costs.push_back(r->inputs.at("input_ids").shape[0]);
+        }
+    }
+
+    const auto taken = fair_share_->Admit(tenants, weights, costs, free_slot_count);
+    if (taken.size() == tenants.size()) {
+        return;
+    }
+
+    std::vector<char> admit(tenants.size());
+    for (const auto& i : taken) {
+        admit[i] = 1;
+    }
+
+    Requests admitted;
+    int      k = 0;  // index in the valid requests
+    for (auto& r : infer_reqs) {
+        if (!valid(r) || admit[k++]) {
+            admitted.push_back(std::move(r));
+        }
+        else {
+            deferred_.push_back(std::move(r));
+        }
+    }
+
+    infer_reqs.swap(admitted);
+}
+
+template<class T>
+void LlamaBatch<T>::ReserveSlots(Requests& infer_reqs, int free_slot_count)
+{
+    if (!param_.reserved_slots && !param_.max_loras) {
+        return;
+    }
+
+    // Slots left for the requests of lower classes (priority > 0)
+    int quota = max_batch_size_ - param_.reserved_slots;
+    // Adapters of the batch, each takes a device slot
+    std::set<int> adapters;
+    for (int i = 0; i < state_->size; ++i) {
+        if (const auto& r = state_->requests[i]) {
+            quota -= r->gen_cfg.priority > 0;
+            if (r->gen_cfg.adapter_id >= 0) {
+                adapters.insert(r->gen_cfg.adapter_id);
+            }
+        }
+    }
+
+    Requests admitted;
+    for (auto& r : infer_reqs) {
+        // Failed requests take no slot
+        if (r->ec) {
+            admitted.push_back(std::move(r));
+            continue;
+        }
+        const bool lower   = param_.reserved_slots && r->gen_cfg.priority > 0;
+        const int  adapter = r->gen_cfg.adapter_id;
+        const bool fits    = adapter < 0 || adapters.count(adapter) || (int)adapters.size() < param_.max_loras;
+        if (free_slot_count > 0 && (!lower || quota > 0) && fits) {
+            --free_slot_count;
+            quota -= lower;
+            if (adapter >= 0) {
+                adapters.insert(adapter);
+            }
+            admitted.push_back(std::move(r));
+        }
+        else {
+            deferred_.push_back(std::move(r));
+        }
+    }
+
+    infer_reqs.swap(admitted);
+}
+
+template<typename T>
+int LlamaBatch<T>::EstimateOutputLength(const Request& r, int prompt_len) const
+{
+    const int max_new_tokens = r.gen_cfg.score || r.gen_cfg.pooling || r.gen_cfg.warm ? 0 : r.gen_cfg.max_new_tokens;
+    if (length_predictor_) {
+        return length_predictor_->Predict(r.gen_cfg.expected_output_len, prompt_len, max_new_tokens);
+    }
+    if (r.gen_cfg.expected_output_len > 0) {
+        return std::min(r.gen_cfg.expected_output_len, max_new_tokens);
+    }
+    // `max_new_tokens` until there is history
+    return output_len_avg_ > 0 ? std::min(max_new_tokens, (int)std::ceil(output_len_avg_)) : max_new_tokens;
+}
+
+template<typename T>
+void LlamaBatch<T>::SortByOutputLength(Requests& infer_reqs)
+{
+    if (!length_predictor_) {
+        return;
+    }
+    // Failed requests and kv imports take no slot, they go first
+    auto key = [&](const std::shared_ptr<Request>& r) {
+        if (r->ec || r->transfer) {
+            return -1;
+        }
+        const int input_len = r->inputs.at("input_ids").shape[0];
+        const int history   = r->session.start_flag ? 0 : std::max(r->session.step, 0);
+        return EstimateOutputLength(*r, history + input_len);
+    };
+    std::vector<std::pair<int, std::shared_ptr<Request>>> keyed;
+    for (auto& r : infer_reqs) {
+        keyed.emplace_back(key(r), std::move(r));
+    }
+    std::stable_sort(keyed.begin(), keyed.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        infer_reqs[i] = std::move(keyed[i].second);
+    }
+}
+
+template<typename T>
+void LlamaBatch<T>::AdmitRequests(Requests& infer_reqs, int free_slot_count)
+{
+    if (!param_.admission_control) {
+        return;
+    }
+
+    const int block_len = model_->attn_param_.cache_block_seq_len;
+
+    auto blocks = [&](int64_t len) {  //
+        return (int)((std::min<int64_t>(len, session_len_) + block_len - 1) / block_len);
+    };
+
+    // Projected blocks of the running sequences at the end of their outputs. Sequences already past the average
+    // grow by another block. The inactive ones are included as they come back
+    int budget  = sequence_manager_->max_block_count();
+    int running = 0;
+    for (int i = 0; i < state_->size; ++i) {
+        if (const auto& r = state_->requests[i]) {
+            const int     prompt_len = state_->h_prompt_length[i];
+            const int64_t len        = (int64_t)prompt_len + EstimateOutputLength(*r, prompt_len);
+            const int64_t end = std::max<int64_t>(len, state_->h_context_length[i] + block_len);
+            budget -= blocks(std::min<int64_t>(end, state_->seq_len_limit[i]));
+            ++running;
+        }
+    }
+    // A block for each of the running decodes on top of the projections
+    budget -= running;
+
+    Requests admitted;
+    int      taken = 0;
+    bool     hold  = false;  // FCFS, the ones after a held request are held as well
+    for (auto& r : infer_reqs) {
+        // Failed requests and kv imports take no slot
+        if (r->ec || r->transfer) {
+            admitted.push_back(std::move(r));
+            continue;
+        }
+        const int64_t input_len = r->inputs.at("input_ids").shape[0];
+        const int     history   = r->session.start_flag ? 0 : std::max(r->session.step, 0);
+        const int     demand    = blocks(history + input_len + EstimateOutputLength(*r, history + input_len));
+        // An empty batch always takes the 1st request so that oversized ones make progress
+        if (!hold && free_slot_count > 0 && (demand <= budget || (!running && !taken))) {
+            budget -= demand;
+            --free_slot_count;
+            ++taken;
+            admitted.push_back(std::move(r));
+        }
+        else {
+            hold = true;
+            deferred_.push_back(std::move(r));
+        }
+    }
+
+    infer_reqs.swap(admitted);
+}
+
+template<typename T>
+void LlamaBatch<T>::ReserveBeams(Requests& infer_reqs, int free_slot_count)
+{
+    if (std::none_of(infer_reqs.begin(), infer_reqs.end(), [](auto& r) { return r->gen_cfg.beam_width > 1; })) {
+        return;
+    }
+
+    const bool running = std::any_of(state_->requests.begin(), state_->requests.begin() + state_->size, [](auto& r) {
+        return (bool)r;
+    });
+
+    Requests admitted;
+    int      taken = 0;
+    bool     hold  = false;  // FCFS, the ones after a held request are held as well
+    for (auto& r : infer_reqs) {
+        // Failed requests take no slot
+        if (r->ec) {
+            admitted.push_back(std::move(r));
+            continue;
+        }
+        const int slots = r->gen_cfg.beam_width;
+        // An empty batch always takes the 1st request
+        if (!hold && (slots <= free_slot_count || (!running && !taken))) {
+            free_slot_count -= slots;
+            ++taken;
+            admitted.push_back(std::move(r));
+        }
+        else {
+            hold = true;
+            deferred_.push_back(std::move(r));
+        }
+    }
+
+    infer_reqs.swap(admitted);
 }
 
 template<class T>
@@ -168,24 +528,576 @@ void LlamaBatch<T>::ProcessCancelRequests(std::vector<int>& indices, std::vector
     }
 }
 
+template<class T>
+bool LlamaBatch<T>::SkipCanceledPrefill(const GenerationState& g, int first, int last)
+{
+    // The chunk of a partial prefill is neither sampled nor finished in this step. Mini-batches are synced with the
+    // DP ranks and the pipeline stages, they are left alone
+    const int size = state_->active_size;
+    if (!g.partial || g.draft_len || first != size - 1 || last != size || comm_.h_dp_group->n_ranks() > 1
+        || param_.pp_size > 1) {
+        return false;
+    }
+
+    int canceled = 0;
+    if (tp_rank_ == 0) {
+        canceled = state_->requests[first]->cancel_flag.load(std::memory_order_acquire) == -1;
+    }
+    if (tp_size_ > 1) {
+        Broadcast(comm_.h_tp_group, canceled, 0);
+    }
+
+    if (canceled) {
+        if (tp_rank_ == 0) {
+            TM_LOG_INFO("[Forward] skip the prefill chunk of canceled request %lu", (long)state_->requests[first]->id);
+        }
+        // No kv cache is written for the chunk, the sequence is interrupted at the start of the next step
+        const_cast<Sequence*>(state_->sequences[first])->input_length = 0;
+    }
+
+    return canceled;
+}
+
 template<class T>
 void LlamaBatch<T>::ProcessKillRequests(const Requests& kill_reqs, std::vector<Signal>& signals)
 {
     for (auto& r : kill_reqs) {
         if (r) {
             int ec = r->ec;
-            if (!ec) {
-                if (!sequence_manager_->Erase(r->id)) {
+            if (!ec && r->transfer && r->transfer->op == KvTransfer::kDrop) {
+                // the sequence held by the export of a migration
+                if (auto seq = sequence_manager_->Get(r->id); seq && r->transfer->release) {
+                    if (!sequence_manager_->Erase(r->id)) {
+                        ec = Request::kInvalid;
+                    }
+                }
+                else if (seq) {
+                    sequence_manager_->UpdateAndSetUnlock(*seq);
+                }
+                else {
+                    ec = Request::kInvalid;
+                }
+            }
+            else if (!ec && r->transfer) {
+                // completed in `PollTransfers`
+                if ((ec = StartTransfer(r)) == Request::kOk) {
+                    continue;
+                }
+            }
+            else if (!ec) {
+                // a session of a request held back has no sequence before its first admission
+                const bool deferred = std::find(killed_deferred_.begin(), killed_deferred_.end(), r->id)
+                                      != killed_deferred_.end();
+                if (!sequence_manager_->Erase(r->id) && !deferred) {
                     ec = Request::kInvalid;
                 }
             }
-            signals.push_back([=] {
+            signals.emplace_back([=] {
                 if (r->end_cb) {
                     r->end_cb(ec);
                 }
             });
         }
     }
+
+    killed_deferred_.clear();
+}
+
+template<class T>
+void LlamaBatch<T>::DropDeferredRequests(const Requests& kill_reqs, std::vector<Signal>& signals)
+{
+    if (kill_reqs.empty() || deferred_.empty()) {
+        return;
+    }
+
+    Requests kept;
+    for (auto& r : deferred_) {
+        const bool killed =
+            std::any_of(kill_reqs.begin(), kill_reqs.end(), [&](const auto& k) { return k && k->id == r->id; });
+        if (!killed) {
+            kept.push_back(std::move(r));
+            continue;
+        }
+        killed_deferred_.push_back(r->id);
+        signals.emplace_back(std::move(r), Request::kCancel, 0);
+    }
+
+    deferred_.swap(kept);
+}
+
+template<typename T>
+void LlamaBatch<T>::DrainImport(const KvTransfer& t)
+{
+    const int block_seq_len = model_->attn_param_.cache_block_seq_len;
+    // the layer major imports may be issued with the metadata known up front, in the block length of the engine
+    const int block_count =
+        t.block_count ? t.block_count : (std::max(t.cache_len, 0) + block_seq_len - 1) / block_seq_len;
+
+    if (block_count <= 0 || t.block_size <= 0) {
+        return;
+    }
+
+    // the layers streamed by the prefill are in the layout of the peer
+    if (t.layer_major && t.block_size != sequence_manager_->block_size()) {
+        if (tp_rank_ == 0) {
+            TM_LOG_ERROR("[Transfer] Can't drain the layers of a %ld bytes block from peer %d, the transfers between "
+                         "the engines are out of step",
+                         (long)t.block_size,
+                         t.peer);
+        }
+        return;
+    }
+
+    if (!transfer_stream_) {
+        check_cuda_error(cudaStreamCreateWithFlags(&transfer_stream_, cudaStreamNonBlocking));
+    }
+
+    // the blocks are received over each other, the contents are discarded
+    char* scratch{};
+    check_cuda_error(cudaMallocAsync(&scratch, t.block_size, transfer_stream_));
+
+    if (t.layer_major) {
+        auto        copier    = sequence_manager_->block_copier();
+        const auto& offsets   = copier->layer_offsets();
+        const int   layer_num = copier->layer_num();
+        for (int i = 0; i <= layer_num; ++i) {
+            const size_t size = (i < layer_num ? offsets[i + 1] : t.block_size) - offsets[i];
+            if (!size) {
+                continue;
+            }
+            kv_transport_->GroupStart();
+            for (int j = 0; j < block_count; ++j) {
+                kv_transport_->Recv(scratch, size, t.peer, transfer_stream_);
+            }
+            kv_transport_->GroupEnd();
+        }
+    }
+    else {
+        kv_transport_->GroupStart();
+        for (int j = 0; j < block_count; ++j) {
+            kv_transport_->Recv(scratch, t.block_size, t.peer, transfer_stream_);
+        }
+        kv_transport_->GroupEnd();
+    }
+
+    check_cuda_error(cudaFreeAsync(scratch, transfer_stream_));
+
+    if (tp_rank_ == 0) {
+        TM_LOG_WARNING("[Transfer] %d blocks from peer %d of a rejected import are discarded", block_count, t.peer);
+    }
+}
+
+template<typename T>
+int LlamaBatch<T>::StartTransfer(const std::shared_ptr<Request>& r)
+{
+    auto& t = *r->transfer;
+
+    std::lock_guard lock{transport_mutex_};
+
+    // migrations between the DP ranks copy the blocks from peer devices directly
+    const auto& migration = t.migration;
+
+    const bool remote = !migration && !t.host;
+
+    // the layer major order is only produced by the streaming prefill to a remote engine
+    if (t.layer_major && !remote) {
+        return Request::kInvalid;
+    }
+
+    if (remote && !kv_transport_) {
+        if (tp_rank_ == 0) {
+            TM_LOG_ERROR("[Transfer] No kv transport for transferring %lu", r->id);
+        }
+        return Request::kFail;
+    }
+
+    if (remote && (t.peer < 0 || t.peer >= kv_transport_->n_ranks() || t.peer == kv_transport_->rank())) {
+        if (tp_rank_ == 0) {
+            TM_LOG_ERROR("[Transfer] Invalid peer %d for transferring %lu", t.peer, r->id);
+        }
+        return Request::kInvalid;
+    }
+
+    const int64_t block_size = sequence_manager_->block_size();
+
+    const Sequence*    seq{};
+    std::vector<void*> block_ptrs;
+
+    std::vector<std::byte>* host_blocks{};  // blocks of the tp rank in host memory
+
+    if (t.op == KvTransfer::kExport) {
+        seq = sequence_manager_->Get(r->id);
+        if (!seq || seq->status != Sequence::kCached) {
+            return Request::kInvalid;
+        }
+        int cache_len{};
+        block_ptrs = sequence_manager_->LockForExport(*seq, cache_len);
+        if (migration) {
+            std::lock_guard lock{migration->mutex};
+            migration->blocks[tp_rank_] = {device_id_, block_ptrs};
+        }
+        if (t.host) {
+            std::lock_guard lock{t.host->mutex};
+            host_blocks = &t.host->blocks[tp_rank_];
+        }
+        // the request is shared by the ranks
+        if (tp_rank_ == 0) {
+            t.tokens       = seq->tokens;
+            t.random_state = seq->random_state;
+            t.rope_theta   = seq->rope_theta;
+            t.cache_len    = cache_len;
+            t.block_size   = block_size;
+            t.block_count  = (int)block_ptrs.size();
+        }
+    }
+    else {
+        if (t.block_size != block_size || t.cache_len < 0 || t.cache_len > (int)t.tokens.size()) {
+            if (tp_rank_ == 0) {
+                TM_LOG_ERROR("[Transfer] Inconsistent kv cache of %lu, block_size %ld vs %ld, cache_len %d",
+                             r->id,
+                             (long)t.block_size,
+                             (long)block_size,
+                             t.cache_len);
+            }
+            if (remote) {
+                DrainImport(t);
+            }
+            return Request::kInvalid;
+        }
+        if (t.host) {
+            // checks the blocks of all the ranks, so the ranks agree on the outcome
+            const int       block_seq_len = model_->attn_param_.cache_block_seq_len;
+            const int64_t   bytes         = (t.cache_len + block_seq_len - 1) / block_seq_len * block_size;
+            std::lock_guard lock{t.host->mutex};
+            bool            valid = true;
+            for (int i = 0; i < comm_.h_tp_group->n_ranks(); ++i) {
+                auto it = t.host->blocks.find(i);
+                valid &= it != t.host->blocks.end() && (int64_t)it->second.size() == bytes;
+            }
+            if (!valid) {
+                if (tp_rank_ == 0) {
+                    TM_LOG_ERROR("[Transfer] Inconsistent host blocks of %lu, %ld bytes expected for each of %d ranks",
+                                 r->id,
+                                 (long)bytes,
+                                 comm_.h_tp_group->n_ranks());
+                }
+                return Request::kInvalid;
+            }
+            host_blocks = &t.host->blocks.at(tp_rank_);
+        }
+        seq = sequence_manager_->CreateForImport(r->id, t.cache_len, block_ptrs);
+        if (!seq) {
+            if (remote) {
+                DrainImport(t);
+            }
+            return Request::kFail;
+        }
+        if (migration) {
+            std::lock_guard lock{migration->mutex};
+            FT_CHECK(migration->blocks.at(tp_rank_).second.size() == block_ptrs.size());
+        }
+        seq->tokens       = t.tokens;
+        seq->random_state = t.random_state;
+        seq->rope_theta   = t.rope_theta;
+    }
+
+    if (tp_rank_ == 0) {
+        TM_LOG_INFO("[Transfer] %s %lu, peer %d, %d blocks%s",
+                    t.op == KvTransfer::kExport ? "export" : "import",
+                    (long)r->id,
+                    t.peer,
+                    (int)block_ptrs.size(),
+                    host_blocks ? " (host)" : "");
+    }
+
+    if (!transfer_stream_) {
+        check_cuda_error(cudaStreamCreateWithFlags(&transfer_stream_, cudaStreamNonBlocking));
+    }
+
+    cudaEvent_t event{};
+    check_cuda_error(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+
+    // The blocks are written by `stream_`, or copied in by a fork not yet followed by a forward
+    sequence_manager_->block_copier()->Wait(stream_);
+    check_cuda_error(cudaEventRecord(event, stream_));
+    check_cuda_error(cudaStreamWaitEvent(transfer_stream_, event));
+
+    if (migration) {
+        // the exported blocks are complete & held by the exporting ranks
+        if (t.op == KvTransfer::kImport) {
+            std::lock_guard lock{migration->mutex};
+            const auto& [device, src] = migration->blocks.at(tp_rank_);
+            if (kv_allocator_ && !block_ptrs.empty()) {
+                // the peer blocks are mapped here, read them in a single launch instead of a copy per block
+                std::vector<CopyDesc> table;
+                for (size_t i = 0; i < block_ptrs.size(); ++i) {
+                    table.push_back({src[i], block_ptrs[i], (int)block_size});
+                }
+                CopyDesc* d_table{};
+                check_cuda_error(cudaMallocAsync(&d_table, sizeof(CopyDesc) * table.size(), transfer_stream_));
+                // pageable source, `table` can be released right after the call returns
+                check_cuda_error(cudaMemcpyAsync(
+                    d_table, table.data(), sizeof(CopyDesc) * table.size(), cudaMemcpyDefault, transfer_stream_));
+                invokeCopyTable(d_table, table.size(), transfer_stream_);
+                check_cuda_error(cudaFreeAsync(d_table, transfer_stream_));
+            }
+            else {
+                for (size_t i = 0; i < block_ptrs.size(); ++i) {
+                    check_cuda_error(cudaMemcpyPeerAsync(
+                        block_ptrs[i], device_id_, src[i], device, block_size, transfer_stream_));
+                }
+            }
+        }
+    }
+    else if (host_blocks) {
+        // pageable memory, the copies are staged by the driver
+        if (t.op == KvTransfer::kExport) {
+            host_blocks->resize(block_ptrs.size() * block_size);
+        }
+        for (size_t i = 0; i < block_ptrs.size(); ++i) {
+            auto h = host_blocks->data() + i * block_size;
+            if (t.op == KvTransfer::kExport) {
+                check_cuda_error(
+                    cudaMemcpyAsync(h, block_ptrs[i], block_size, cudaMemcpyDeviceToHost, transfer_stream_));
+            }
+            else {
+                check_cuda_error(
+                    cudaMemcpyAsync(block_ptrs[i], h, block_size, cudaMemcpyHostToDevice, transfer_stream_));
+            }
+        }
+    }
+    else if (t.layer_major) {
+        // the blocks were sent by the prefill, see `KvStreamer`, the export only hands over the metadata
+        if (t.op == KvTransfer::kImport) {
+            auto        copier    = sequence_manager_->block_copier();
+            const auto& offsets   = copier->layer_offsets();
+            const int   layer_num = copier->layer_num();
+            for (int i = 0; i <= layer_num; ++i) {
+                const size_t offset = offsets[i];
+                const size_t size   = (i < layer_num ? offsets[i + 1] : block_size) - offset;
+                if (!size) {
+                    continue;
+                }
+                kv_transport_->GroupStart();
+                for (const auto& p : block_ptrs) {
+                    kv_transport_->Recv((char*)p + offset, size, t.peer, transfer_stream_);
+                }
+                kv_transport_->GroupEnd();
+            }
+        }
+    }
+    else {
+        kv_transport_->GroupStart();
+        for (const auto& p : block_ptrs) {
+            if (t.op == KvTransfer::kExport) {
+                kv_transport_->Send(p, block_size, t.peer, transfer_stream_);
+            }
+            else {
+                kv_transport_->Recv(p, block_size, t.peer, transfer_stream_);
+            }
+        }
+        kv_transport_->GroupEnd();
+    }
+
+    check_cuda_error(cudaEventRecord(event, transfer_stream_));
+
+    transfers_.push_back({r, seq, event});
+
+    return Request::kOk;
+}
+
+template<typename T>
+void LlamaBatch<T>::PollTransfers(std::vector<Signal>& signals)
+{
+    if (transfers_.empty()) {
+        return;
+    }
+
+    int done = 0;
+    for (; done < (int)transfers_.size(); ++done) {
+        const auto ec = cudaEventQuery(transfers_[done].event);
+        if (ec == cudaErrorNotReady) {
+            break;
+        }
+        check_cuda_error(ec);
+    }
+
+    // The sequences are scheduled in lockstep, all ranks must agree on the completion
+    done = AllReduce(comm_.h_tp_group, done, comm::RedOp::kMin);
+
+    for (int i = 0; i < done; ++i) {
+        auto [r, seq, event] = std::move(transfers_.front());
+        transfers_.pop_front();
+
+        check_cuda_error(cudaEventDestroy(event));
+
+        if (r->transfer->op == KvTransfer::kExport && r->transfer->release) {
+            FT_CHECK(sequence_manager_->Erase(r->id));
+        }
+        else if (r->transfer->op == KvTransfer::kExport && r->transfer->migration) {
+            // held until the import is done
+        }
+        else {
+            sequence_manager_->UpdateAndSetUnlock(*seq);
+        }
+
+        signals.emplace_back([r = std::move(r)] {
+            if (r->end_cb) {
+                r->end_cb(Request::kOk);
+            }
+        });
+    }
+}
+
+template<typename T>
+int LlamaBatch<T>::StreamPrefillKv(const GenerationState& g, int first, int last, std::unique_lock<std::mutex>& lock)
+{
+    const int block_seq_len = model_->attn_param_.cache_block_seq_len;
+
+    int count = 0;
+    // the partial prefill is the last active sequence, its prompt is not complete yet
+    for (int i = first; i < std::min(last, state_->active_size - g.partial); ++i) {
+        auto&       r   = state_->requests[i];
+        const auto& seq = *state_->sequences[i];
+        if (!r->session.kv_stream_flag || r->kv_streamed) {
+            continue;
+        }
+        r->kv_streamed = true;
+        if (!lock) {
+            lock = std::unique_lock{transport_mutex_};
+        }
+        const int peer = r->session.kv_stream_peer;
+        if (!kv_transport_ || peer < 0 || peer >= kv_transport_->n_ranks() || peer == kv_transport_->rank()) {
+            if (tp_rank_ == 0) {
+                TM_LOG_ERROR("[Transfer] Can't stream the kv cache of %lu to peer %d", (long)r->id, peer);
+            }
+            continue;
+        }
+        // the evicted and the cold blocks are not in the layout of the peer
+        if (h_evicted_len_buf_[i] || !seq.cold_blocks.empty()) {
+            if (tp_rank_ == 0) {
+                TM_LOG_WARNING("[Transfer] Streaming the kv cache of %lu is skipped, the cache is not contiguous",
+                               (long)r->id);
+            }
+            continue;
+        }
+        const int          n = (h_k_len_buf_[i] + block_seq_len - 1) / block_seq_len;
+        std::vector<void*> blocks;
+        for (int j = 0; j < n; ++j) {
+            blocks.push_back(sequence_manager_->GetBlockPtr(seq.blocks.at(j)));
+        }
+        if (!kv_streamer_) {
+            const auto copier = sequence_manager_->block_copier();
+            kv_streamer_      = std::make_unique<KvStreamer>(
+                copier->layer_offsets(), sequence_manager_->block_size(), transfer_stream_);
+            model_->unified_decoder_->setKvStreamer(kv_streamer_.get());
+        }
+        kv_streamer_->Add(kv_transport_.get(), peer, std::move(blocks));
+        ++count;
+    }
+
+    return count;
+}
+
+template<typename T>
+void LlamaBatch<T>::SetKvTransport(std::unique_ptr<comm::KvTransport> transport)
+{
+    check_cuda_error(cudaSetDevice(device_id_));
+
+    std::lock_guard lock{transport_mutex_};
+
+    FT_CHECK_WITH_INFO(transfers_.empty(), "Replacing the kv transport with transfers in flight");
+
+    if (!transfer_stream_) {
+        check_cuda_error(cudaStreamCreateWithFlags(&transfer_stream_, cudaStreamNonBlocking));
+    }
+
+    // the streamed layers of the prefills are sent by the old transport
+    check_cuda_error(cudaStreamSynchronize(transfer_stream_));
+
+    kv_transport_ = std::move(transport);
+}
+
+template<typename T>
+void LlamaBatch<T>::SwapWeights(std::shared_ptr<LlamaWeight<T>> weights)
+{
+    FT_CHECK(weights != nullptr);
+
+    std::unique_lock lock{weights_mutex_};
+    FT_CHECK_WITH_INFO(!pending_weights_, "Swapping the weights with a swap in progress");
+
+    pending_weights_ = std::move(weights);
+    weights_cv_.notify_all();
+
+    if (tp_rank_ == 0) {
+        // an idle engine is blocked in `pop`
+        gateway_->interrupt(dp_rank_);
+    }
+
+    weights_cv_.wait(lock, [&] { return !pending_weights_; });
+}
+
+template<typename T>
+void LlamaBatch<T>::SwapInWeights()
+{
+    std::unique_lock lock{weights_mutex_};
+    // the weights of this rank may be staged after rank-0 has seen its own
+    weights_cv_.wait(lock, [&] { return pending_weights_ != nullptr; });
+
+    // kernels of the last step may still read the old weights
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    model_->weights_ = std::move(pending_weights_);
+
+    // kv of the cached prompts is computed by the old weights, the captured decoding graphs are invalidated by the
+    // new layers
+    sequence_manager_->FlushPrefixCache();
+
+    TM_LOG_INFO("[SwapInWeights] rank %d swapped in new weights", tp_rank_);
+
+    weights_cv_.notify_all();
+}
+
+template<typename T>
+bool LlamaBatch<T>::ResolveEmbeddings(const Request&                                 r,
+                                      int                                            input_length,
+                                      std::vector<std::shared_ptr<const std::byte>>& refs)
+{
+    if (!embedding_cache_ || !r.inputs.isExist("input_embedding_hashes")) {
+        return false;
+    }
+
+    const auto& range_tensor = r.inputs.at("input_embedding_ranges");
+    const int*  ranges       = range_tensor.getPtr<int>();
+    const auto* hashes       = r.inputs.getPtr<uint64_t>("input_embedding_hashes");
+
+    if (range_tensor.shape.size() != 3 || range_tensor.shape[2] != 2
+        || r.inputs.at("input_embedding_hashes").size() < range_tensor.shape[1]) {
+        return false;
+    }
+
+    int pre_end = 0;
+    for (size_t i = 0; i < range_tensor.shape[1]; i++) {
+        const int begin = ranges[i * 2];
+        const int end   = ranges[i * 2 + 1];
+        if (begin < 0 || end < 0) {
+            break;
+        }
+        if (begin >= end || end > input_length || begin < pre_end) {
+            return false;
+        }
+        auto data = embedding_cache_->Find(hashes[i], (end - begin) * model_->hidden_units_ * sizeof(T));
+        if (!data) {
+            TM_LOG_WARNING("[ImageFeature] Embedding %016lx of request %lu is not cached",
+                           (unsigned long)hashes[i],
+                           (unsigned long)r.id);
+            return false;
+        }
+        refs.push_back(std::move(data));
+        pre_end = end;
+    }
+
+    return !refs.empty();
 }
 
 template<typename T>
@@ -197,7 +1109,8 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
     FT_CHECK(state.size == 0);
     FT_CHECK(state.active_size == 0);
 
-    std::vector<int> existing_idx;
+    // the staging rows may still be read by the last `CopyState`
+    check_cuda_error(cudaEventSynchronize(copy_state_event_));
 
     int idx = 0;
     for (const auto& r : reqs) {
@@ -207,20 +1120,42 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
         }
 
         if (r->ec) {
-            signals.push_back([r] { UpdateState(*r, r->ec, 0); });
+            signals.emplace_back(r, r->ec, 0);
             continue;
         }
 
         const int input_length = r->inputs.at("input_ids").shape[0];
 
         if (input_length > session_len_) {
-            signals.push_back([r] { UpdateState(*r, Request::kTooLong, 0); });
+            signals.emplace_back(r, Request::kTooLong, 0);
+            continue;
+        }
+
+        if (std::any_of(transfers_.begin(), transfers_.end(), [&](auto& t) { return t.r->id == r->id; })) {
+            signals.emplace_back(r, Request::kBusy, 0);
             continue;
         }
 
-        auto ptr = r->session.start_flag ? sequence_manager_->Create(r->id) : sequence_manager_->Get(r->id);
+        // Embeddings passed by their content hashes only, they must be cached
+        const bool by_reference = r->inputs.isExist("input_embedding_ranges") && !r->inputs.isExist("input_embeddings");
+        std::vector<std::shared_ptr<const std::byte>> embedding_refs;
+        if (by_reference && !ResolveEmbeddings(*r, input_length, embedding_refs)) {
+            signals.emplace_back(r, Request::kInvalid, 0);
+            continue;
+        }
+
+        const Sequence* ptr{};
+        if (!r->session.start_flag) {
+            ptr = sequence_manager_->Get(r->id);
+        }
+        else if (r->session.fork_flag && r->session.parent_id != r->id) {
+            ptr = sequence_manager_->Fork(r->session.parent_id, r->id);
+        }
+        else {
+            ptr = sequence_manager_->Create(r->id);
+        }
         if (!ptr) {
-            signals.push_back([r] { UpdateState(*r, Request::kInvalid, 0); });
+            signals.emplace_back(r, Request::kInvalid, 0);
             continue;
         }
 
@@ -239,7 +1174,7 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
         }();
 
         if (step + input_length > session_len_) {
-            signals.push_back([r] { UpdateState(*r, Request::kTooLong, 0); });
+            signals.emplace_back(r, Request::kTooLong, 0);
             continue;
         }
 
@@ -253,7 +1188,7 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
         if (step < seq.tokens.size()) {
             // resize sequence tokens to match step
             seq.tokens.resize(step);
-            seq.cache_len = std::min(seq.cache_len, step);
+            sequence_manager_->TruncateCache(seq, step);
             DropEmbeddings(seq);
         }
 
@@ -262,17 +1197,17 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
         {
             // `output_ids` contains all token ids of the sequences
             const auto output_ids_base = state.output_ids + session_len_ * idx;
-            auto       d_output_ids    = output_ids_base;
+            auto       d_output_ids    = output_ids_base;  // staged on host
             auto       h_output_ids    = r->output_ids.getPtr<int>();
             // copy history tokens
             if (!seq.tokens.empty()) {
-                d_output_ids = Copy(seq.tokens.data(), seq.tokens.size(), d_output_ids);
+                d_output_ids = std::copy_n(seq.tokens.data(), seq.tokens.size(), d_output_ids);
                 h_output_ids = std::copy_n(seq.tokens.data(), seq.tokens.size(), h_output_ids);
             }
 
             // copy input tokens
             if (input_length) {
-                d_output_ids = Copy(input_ids, input_length, d_output_ids);
+                d_output_ids = std::copy_n(input_ids, input_length, d_output_ids);
                 h_output_ids = std::copy_n(input_ids, input_length, h_output_ids);
             }
 
@@ -280,69 +1215,132 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
             state.h_prompt_length[idx]  = d_output_ids - output_ids_base;
             state.h_context_length[idx] = d_output_ids - output_ids_base;
             state.h_finished[idx]       = false;
+
+            if (param_.num_speculative_tokens && !model_->medusa_num_heads()) {
+                state.h_tokens[idx].assign(output_ids_base, d_output_ids);
+            }
         }
 
-        // copy input tokens to prompt for prefix matching
-        if (input_length && r->session.start_flag && !r->inputs.isExist("input_embedding_ranges")) {
-            // TODO: truncate prompt to enable prefix caching for VLM
-            seq.prompt.resize(input_length);
-            std::copy_n(input_ids, input_length, seq.prompt.data());
+        // At least the last token is computed for the logits, e.g. for a fork with the complete context cached
+        if (seq.cache_len >= state.h_context_length[idx]) {
+            sequence_manager_->TruncateCache(seq, state.h_context_length[idx] - 1);
         }
 
         // copy input embeddings
+        bool hashed_embeddings = false;  // all the embeddings are identified by their content hashes
         if (r->inputs.isExist("input_embedding_ranges")) {
             const auto range_tensor = r->inputs.at("input_embedding_ranges");
-            const auto emb_tensor   = r->inputs.at("input_embeddings");
             const int* ranges       = range_tensor.getPtr<int>();
 
-            auto check_embeddings = [&](int& num_valid_embeddings) {
-                if (range_tensor.shape.size() != 3 || range_tensor.shape[2] % 2 != 0) {
-                    return false;
+            // content hash of each embedding, 0 for none
+            const auto hashes = r->inputs.getPtr<uint64_t>("input_embedding_hashes", nullptr);
+
+            if (by_reference) {
+                for (size_t i = 0; i < embedding_refs.size(); i++) {
+                    seq.input_embeddings.push_back(std::move(embedding_refs[i]));
+                    seq.input_embedding_ranges.emplace_back(ranges[i * 2] + seq.tokens.size(),
+                                                            ranges[i * 2 + 1] + seq.tokens.size());
                 }
-                int embedding_count  = range_tensor.shape[1];
-                int embedding_length = 0;
-                int pre_end          = -1;
-
-                for (size_t i = 0; i < embedding_count; i++) {
-                    int begin = ranges[i * 2];
-                    int end   = ranges[i * 2 + 1];
-                    embedding_length += (end - begin);
-                    if (begin < 0 || end < 0) {
-                        break;
+                hashed_embeddings = true;
+            }
+            else {
+                const auto emb_tensor = r->inputs.at("input_embeddings");
+
+                auto check_embeddings = [&](int& num_valid_embeddings) {
+                    if (range_tensor.shape.size() != 3 || range_tensor.shape[2] % 2 != 0) {
+                        return false;
                     }
-                    if (begin >= end || end > input_length || begin < pre_end
-                        || embedding_length * model_->hidden_units_ * sizeof(T) > emb_tensor.shape[1]) {
+                    int embedding_count  = range_tensor.shape[1];
+                    int embedding_length = 0;
+                    int pre_end          = -1;
+
+                    if (hashes && r->inputs.at("input_embedding_hashes").size() < embedding_count) {
                         return false;
                     }
-                    pre_end              = end;
-                    num_valid_embeddings = i + 1;
+
+                    for (size_t i = 0; i < embedding_count; i++) {
+                        int begin = ranges[i * 2];
+                        int end   = ranges[i * 2 + 1];
+                        embedding_length += (end - begin);
+                        if (begin < 0 || end < 0) {
+                            break;
+                        }
+                        if (begin >= end || end > input_length || begin < pre_end
+                            || embedding_length * model_->hidden_units_ * sizeof(T) > emb_tensor.shape[1]) {
+                            return false;
+                        }
+                        pre_end              = end;
+                        num_valid_embeddings = i + 1;
+                    }
+                    return true;
+                };
+
+                int num_valid_embeddings = 0;
+                if (!check_embeddings(num_valid_embeddings)) {
+                    TM_LOG_WARNING("[ImageFeature] Skip invalid input embeddings, id = %ld, input_length = %d, "
+                                   "input embeddings = %s, range_tensor = %s",
+                                   (long)seq.id,
+                                   input_length,
+                                   emb_tensor.toString().c_str(),
+                                   range_tensor.toString().c_str());
+                }
+                else {
+                    hashed_embeddings          = hashes && num_valid_embeddings;
+                    const char* emb_tensor_ptr = emb_tensor.getPtr<char>();
+                    for (size_t i = 0; i < num_valid_embeddings; i++) {
+                        int    begin = ranges[i * 2];
+                        int    end   = ranges[i * 2 + 1];
+                        size_t count = (end - begin) * model_->hidden_units_ * sizeof(T);
+
+                        std::shared_ptr<const std::byte> data;
+                        if (embedding_cache_ && hashes && hashes[i]) {
+                            data = embedding_cache_->Insert(hashes[i], emb_tensor_ptr, count);
+                        }
+                        if (!data && emb_tensor.where == MEMORY_GPU) {
+                            // e.g. the output of a vision encoder, kept on device without passing through host. The
+                            // source may be on another device of the node or opened from an IPC handle
+                            std::byte* ptr{};
+                            check_cuda_error(cudaMallocAsync(&ptr, count, stream_));
+                            check_cuda_error(cudaMemcpyAsync(ptr, emb_tensor_ptr, count, cudaMemcpyDefault, stream_));
+                            data = std::shared_ptr<const std::byte>(ptr, [stream = stream_](const std::byte* p) {
+                                check_cuda_error(cudaFreeAsync((void*)p, stream));
+                            });
+                        }
+                        if (!data) {
+                            auto ptr = new std::byte[count];
+                            std::copy_n((const std::byte*)emb_tensor_ptr, count, ptr);
+                            data = std::shared_ptr<const std::byte>(ptr, std::default_delete<std::byte[]>{});
+                        }
+                        hashed_embeddings &= hashes && hashes[i];
+
+                        seq.input_embeddings.push_back(std::move(data));
+                        seq.input_embedding_ranges.emplace_back(begin + seq.tokens.size(), end + seq.tokens.size());
+                        emb_tensor_ptr += count;
+                    }
                 }
-                return true;
-            };
-
-            int num_valid_embeddings = 0;
-            if (!check_embeddings(num_valid_embeddings)) {
-                TM_LOG_WARNING("[ImageFeature] Skip invalid input embeddings, id = %ld, input_length = %d, "
-                               "input embeddings = %s, range_tensor = %s",
-                               (long)seq.id,
-                               input_length,
-                               emb_tensor.toString().c_str(),
-                               range_tensor.toString().c_str());
             }
-            else {
-                const char* emb_tensor_ptr = emb_tensor.getPtr<char>();
-                for (size_t i = 0; i < num_valid_embeddings; i++) {
-                    int    begin = ranges[i * 2];
-                    int    end   = ranges[i * 2 + 1];
-                    size_t count = (end - begin) * model_->hidden_units_ * sizeof(T);
-                    seq.input_embeddings.emplace_back((std::byte*)emb_tensor_ptr, (std::byte*)(emb_tensor_ptr + count));
-                    seq.input_embedding_ranges.emplace_back(begin + seq.tokens.size(), end + seq.tokens.size());
-                    emb_tensor_ptr += count;
+        }
+
+        // copy input tokens to prompt for prefix matching, scoring requests needs the logits of all the tokens
+        if (input_length && r->session.start_flag && !r->gen_cfg.score && !r->gen_cfg.pooling
+            && (!r->inputs.isExist("input_embedding_ranges") || hashed_embeddings)) {
+            seq.prompt.resize(input_length);
+            std::copy_n(input_ids, input_length, seq.prompt.data());
+            // the tokens of the embeddings are keyed by the content hashes
+            if (hashed_embeddings) {
+                const int*      ranges = r->inputs.getPtr<int>("input_embedding_ranges");
+                const uint64_t* hashes = r->inputs.getPtr<uint64_t>("input_embedding_hashes");
+                for (size_t i = 0; i < seq.input_embeddings.size(); i++) {
+                    for (int k = ranges[i * 2]; k < ranges[i * 2 + 1]; ++k) {
+                        seq.prompt[k] = EmbeddingTokenId(hashes[i], k - ranges[i * 2]);
+                    }
                 }
             }
         }
 
-        const int max_new_tokens = state.requests[idx]->gen_cfg.max_new_tokens;
+        // Scoring, pooling & warming requests finish right after the prefill
+        const int max_new_tokens =
+            r->gen_cfg.score || r->gen_cfg.pooling || r->gen_cfg.warm ? 0 : r->gen_cfg.max_new_tokens;
         state.seq_len_limit[idx] = state.h_context_length[idx] + max_new_tokens;
         // `length_criterion` sets finish flag when step >= seq_limit_len, however when step == seq_limit_len
         // the actual sequence length is seq_limit_len + 1, hence seq_limit_len must truncated to session_len - 1
@@ -360,8 +1358,10 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
             }
         }
 
-        // compute rope scaling factor
-        if (r->session.start_flag) {
+        // compute rope scaling factor, a fork keeps the one of its kv cache. The cached keys don't depend on it with
+        // `pre_rope_kv_cache`, it follows the context length of each request then
+        const bool pre_rope = model_->attn_param_.pre_rope_kv_cache;
+        if ((r->session.start_flag && !(r->session.fork_flag && seq.cache_len)) || pre_rope) {
             seq.rope_theta = model_->attn_param_.rope.base;
             if (model_->attn_param_.rope.type == RopeType::kDynamic) {
                 auto scaling_factor = model_->attn_param_.rope.factor;
@@ -382,14 +1382,29 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
         }
         state.h_rope_theta[idx] = seq.rope_theta;
 
-        if (r->session.start_flag) {
-            // prepare to initialize random state for new sequence
+        if (r->session.start_flag || seq.random_state.size() != sizeof(uint64_t)) {
             h_random_seed_[idx] = r->gen_cfg.random_seed;
         }
         else {
-            // Recover device states if not a new sequence
-            h_curand_state_[existing_idx.size()] = *(curandState_t*)seq.random_state.data();
-            existing_idx.push_back(idx);
+            // the seed of the session, the draws are resumed by the length of the sequence
+            std::copy_n(seq.random_state.data(), sizeof(uint64_t), (std::byte*)&h_random_seed_[idx]);
+        }
+
+        // The beams are forked from the sequence after the 1st step
+        if (const int width = r->gen_cfg.beam_width; width > 1) {
+            auto& b = beams_[r.get()];
+            b       = {};
+            b.seqs  = {ptr};
+
+            auto& s = b.state;
+            s.width = width;
+            s.beams = 1;
+            for (const auto& id : r->gen_cfg.eos_ids) {
+                s.end_ids[s.end_num++] = id;
+            }
+            for (const auto& id : r->gen_cfg.stop_ids[0]) {
+                s.end_ids[s.end_num++] = id;
+            }
         }
 
         // increment pointer
@@ -398,21 +1413,7 @@ void LlamaBatch<T>::ProcessInferRequests(const Requests& reqs, std::vector<Signa
 
     state.size = idx;
 
-    // when there are new sequences
-    if (state.size != existing_idx.size()) {
-        // copy random seeds to device
-        Copy(h_random_seed_, state.size, d_random_seed_);
-        // initialize random states
-        invokeCurandBatchInitialize(state.curand_state, state.size, d_random_seed_, stream_);
-        sync_check_cuda_error();
-    }
-
-    if (!existing_idx.empty()) {
-        // copy existing curand states to device
-        Copy(h_curand_state_, existing_idx.size(), d_curand_state_);
-        // insert the states to their correct positions in the batch
-        IndexedCopy({}, existing_idx, std::tuple{d_curand_state_, state.curand_state, 1});
-    }
+    Copy(h_random_seed_, state.size, state.random_seed);
 }
 
 template<typename T>
@@ -427,6 +1428,16 @@ int LlamaBatch<T>::AdjustMaxInputCount(GenerationState&                    g,
     const int batch_size = sequences.size();
     input_count -= batch_size;
 
+    if (param_.split_fuse) {
+        // Every step takes `num_tokens_per_iter_` tokens, the decode tokens included, so that the prefills are fused
+        // with the decodes in chunks of the remaining budget and the step latency stays flat
+        input_count = std::max(num_tokens_per_iter_, batch_size + 1);
+        if (g.prefill_budget) {
+            input_count = std::min(input_count, g.prefill_budget + batch_size);
+        }
+        return std::min(input_count, max_forward_token_num_);
+    }
+
     // min tokens per iter for satisfying max prefill iters constraint
     input_count = (input_count + max_prefill_iters_ - 1) / max_prefill_iters_;
 
@@ -442,12 +1453,237 @@ int LlamaBatch<T>::AdjustMaxInputCount(GenerationState&                    g,
 
     // Enlarge to satisfy `max_prefill_iters_`
     input_count = std::max(g.min_input_count.front() + batch_size, num_tokens_per_iter_);
+    // Clamp to the prefill budget for `target_itl_ms`, which takes precedence over `max_prefill_iters_`
+    if (g.prefill_budget) {
+        input_count = std::min(input_count, g.prefill_budget + batch_size);
+    }
     // Clamp to conform memory constraint
     input_count = std::min(input_count, max_forward_token_num_);
 
     return input_count;
 }
 
+template<typename T>
+void LlamaBatch<T>::UpdatePrefillBudget(int prefill_tokens, float step_ms)
+{
+    // Prefills always make progress
+    constexpr int kMinBudget = 64;
+
+    const int max_budget = param_.max_prefill_token_num;
+
+    if (!prefill_budget_) {
+        prefill_budget_ = max_budget;
+    }
+
+    // Latency of decode-only steps doesn't respond to the budget
+    if (!prefill_tokens || step_ms <= 0) {
+        return;
+    }
+
+    // Multiplicative update towards the target, the ratio is damped so that a single noisy step doesn't collapse the
+    // budget. When over the target, scale what was actually scheduled as the budget may not have been used up
+    const float ratio = std::clamp(param_.target_itl_ms / step_ms, .5f, 1.25f);
+    const int   base  = ratio < 1.f ? std::min(prefill_budget_, prefill_tokens) : prefill_budget_;
+
+    prefill_budget_ = std::clamp((int)(base * ratio), std::min(kMinBudget, max_budget), max_budget);
+}
+
+template<typename T>
+void LlamaBatch<T>::UpdateBatchLimit(int batch_size, float step_ms)
+{
+    // Keeps a floor of concurrency for contexts too long to meet the target at any batch size
+    const int min_limit = std::min(8, max_batch_size_);
+
+    if (!batch_limit_) {
+        batch_limit_ = max_batch_size_;
+    }
+
+    // Only decode-only steps are informative, the prefill tokens are governed by the prefill budget
+    if (!batch_size || step_ms <= 0) {
+        return;
+    }
+
+    // Same damped multiplicative update as the prefill budget. Decode latency grows with the running sequences, over
+    // the target the limit shrinks from what is running, under it the limit grows so the GPU isn't idled at low load
+    const float ratio = std::clamp(param_.target_itl_ms / step_ms, .5f, 1.25f);
+    const int   base  = ratio < 1.f ? std::min(batch_limit_, batch_size) : batch_limit_;
+
+    batch_limit_ = std::clamp((int)std::ceil(base * ratio), min_limit, max_batch_size_);
+}
+
+template<typename T>
+int LlamaBatch<T>::ProposeDrafts(int holes)
+{
+    const int max_draft  = param_.num_speculative_tokens;
+    const int batch_size = state_->active_size;
+
+    // Only a stable batch of decoding sequences is speculated, so that the verification fits in a single mini-batch
+    // and the slots don't move before `Forward`
+    if (!max_draft || holes || incoming_->size || !batch_size || state_->size != batch_size) {
+        return 0;
+    }
+
+    int sum_k = 0;
+    for (int i = 0; i < batch_size; ++i) {
+        const auto& seq = *state_->sequences[i];
+        const auto& c   = state_->requests[i]->gen_cfg;
+        if (seq.cache_len + 1 != state_->h_context_length[i]) {
+            return 0;
+        }
+        // Outputs that are produced once per step, token masks are computed for 1 token per step
+        if (c.output_logprobs || c.output_logits || c.output_last_hidden_state || c.matcher) {
+            return 0;
+        }
+        sum_k += state_->h_context_length[i] + max_draft;
+    }
+
+    if (batch_size * (max_draft + 1) > max_forward_token_num_ || sum_k > max_context_token_num_) {
+        return 0;
+    }
+
+    // The tokens of the deferred steps are not in `h_tokens` yet
+    if (pending_steps_) {
+        return 0;
+    }
+
+    // The Medusa heads drafted for the batch at the end of the last step
+    if (const int heads = model_->medusa_num_heads()) {
+        if (medusa_size_ != batch_size) {
+            return 0;
+        }
+        Copy(medusa_ids_buf_, heads * batch_size, h_medusa_ids_);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+
+        int draft_len = std::min(max_draft, heads);
+        for (int i = 0; i < batch_size && draft_len; ++i) {
+            draft_len = std::min(draft_len, state_->seq_len_limit[i] - state_->h_context_length[i]);
+            for (int k = 0; k < draft_len; ++k) {
+                h_draft_ids_[i * max_draft + k] = h_medusa_ids_[k * batch_size + i];
+            }
+        }
+        return std::max(draft_len, 0);
+    }
+
+    // The n-gram search runs on the host copy of the tokens kept by `Finish`, the rows on device are not read
+    for (int i = 0; i < batch_size; ++i) {
+        if ((int)state_->h_tokens[i].size() != state_->h_context_length[i]) {
+            return 0;
+        }
+    }
+
+    // All sequences verify the same number of tokens
+    int draft_len = max_draft;
+    for (int i = 0; i < batch_size && draft_len; ++i) {
+        const int len = state_->h_context_length[i];
+        draft_len     = ProposeNgramDraft(state_->h_tokens[i].data(),
+                                      len,
+                                      param_.speculative_ngram_size,
+                                      std::min(draft_len, state_->seq_len_limit[i] - len),
+                                      h_draft_ids_ + i * max_draft);
+    }
+
+    return draft_len;
+}
+
+template<typename T>
+void LlamaBatch<T>::ExpandBeams()
+{
+    auto& state = *incoming_;
+
+    const int first = state.size;
+
+    for (auto& [r, b] : beams_) {
+        if (b.state.beams > 1 || b.history.empty()) {
+            continue;
+        }
+        if (state.size == first) {
+            // the staging rows may still be read by the last `CopyState`
+            check_cuda_error(cudaEventSynchronize(copy_state_event_));
+        }
+        const int i = std::find(state_->sequences.begin(), state_->sequences.begin() + state_->size, b.seqs[0])
+                      - state_->sequences.begin();
+        FT_CHECK(i < state_->size);
+        // beam `k` continues the prompt with the k-th top token of the 1st step
+        for (int k = 1; k < b.state.width; ++k) {
+            const int idx = state.size++;
+            FT_CHECK(idx < max_batch_size_ && !state.requests[idx]);
+
+            auto seq = sequence_manager_->Branch(*b.seqs[0], BeamSequenceId(r->id, k));
+
+            state.requests[idx]  = state_->requests[i];
+            state.sequences[idx] = seq;
+
+            int* output_ids = std::copy(b.history.begin(), b.history.end(), state.output_ids + idx * session_len_);
+            output_ids[-1]  = b.state.tokens[k];
+
+            state.h_prompt_length[idx]  = state_->h_prompt_length[i];
+            state.h_context_length[idx] = b.history.size();
+            state.h_finished[idx]       = false;
+            state.h_rope_theta[idx]     = state_->h_rope_theta[i];
+            state.seq_len_limit[idx]    = state_->seq_len_limit[i];
+
+            h_random_seed_[idx] = r->gen_cfg.random_seed;
+
+            b.seqs.push_back(seq);
+        }
+        b.state.beams = b.state.width;
+        b.history.clear();
+    }
+
+    if (state.size > first) {
+        Copy(h_random_seed_ + first, state.size - first, state.random_seed + first);
+    }
+}
+
+template<typename T>
+int LlamaBatch<T>::HoldBeams(const std::vector<const Sequence*>& sequences, std::vector<int>& context_lengths)
+{
+    beam_forced_.clear();
+
+    if (beams_.empty()) {
+        return 0;
+    }
+
+    std::unordered_map<const Sequence*, int> index;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        index.emplace(sequences[i], i);
+    }
+
+    auto complete = [&](int i) {
+        const auto& s = *sequences[i];
+        return s.status == Sequence::kActive && s.cache_len + s.input_length == context_lengths[i];
+    };
+
+    int held = 0;
+    for (const auto& [r, b] : beams_) {
+        const bool ready = std::all_of(b.seqs.begin(), b.seqs.end(), [&](auto s) { return complete(index.at(s)); });
+        if (ready) {
+            continue;
+        }
+        // The decoding beams wait for the others out of the step, the recomputed ones stop short of their last token,
+        // which is reproduced by the step
+        for (const auto& p : b.seqs) {
+            const int i = index.at(p);
+            if (!complete(i)) {
+                continue;
+            }
+            auto& s = const_cast<Sequence&>(*p);
+            if (s.input_length == 1) {
+                s.status       = Sequence::kLocked;
+                s.input_length = 0;
+                ++held;
+            }
+            else {
+                --s.input_length;
+                --context_lengths[i];
+                beam_forced_.push_back(p);
+            }
+        }
+    }
+
+    return held;
+}
+
 template<typename T>
 void LlamaBatch<T>::Initialize(GenerationState& g)
 {
@@ -476,16 +1712,52 @@ void LlamaBatch<T>::Initialize(GenerationState& g)
             if (auto& r = state->requests[i]) {
                 sequences.push_back(state->sequences[i]);
                 status.push_back(state->sequences[i]->status);
-                priorities.push_back(r->unique_id);
+                // Scheduling class in the top 8 bits, FCFS or earliest deadline first within a class. The deadlines
+                // are read from the requests shared by the ranks, the orders agree
+                uint64_t order = param_.edf_slack_ms ? EffectiveDeadline(*r, param_.edf_slack_ms * 1000LL) :
+                                                       r->unique_id;
+                // Shortest expected job first, FCFS among the ones of the same length. The lengths stay below the
+                // bits of the tenant ranks of `fair_share`
+                if (length_predictor_) {
+                    const int len = EstimateOutputLength(*r, state->h_prompt_length[i]);
+                    order         = (uint64_t)std::clamp(len, 0, 0xffff) << 32 | (r->unique_id & 0xffffffff);
+                }
+                priorities.push_back((uint64_t)r->gen_cfg.priority << 56 | (order & ((1ULL << 56) - 1)));
                 context_lengths.push_back(state->h_context_length[i]);
                 coords.emplace_back(state, i);
             }
         }
     };
 
+    // Can't be done after `process`, incoming sequences are not decoding
+    int draft_len = ProposeDrafts(holes);
+
     process(state_);
     process(incoming_);
 
+    if (fair_share_) {
+        // Prefills after the decodes of their class, in the order of the virtual time of their tenants. Only one
+        // prefill per step is chunked, so the order is how the prefill tokens are shared
+        std::vector<int>   tenants;
+        std::vector<float> weights;
+        for (const auto& [state, i] : coords) {
+            tenants.push_back(state->requests[i]->gen_cfg.tenant_id);
+            weights.push_back(state->requests[i]->gen_cfg.tenant_weight);
+        }
+        const auto     ranks = fair_share_->Rank(tenants, weights);
+        const uint64_t mask  = (1ULL << 48) - 1;
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            auto&      p       = priorities[i];
+            const bool prefill = context_lengths[i] - sequences[i]->cache_len > 1;
+            p = p >> 56 << 56 | (prefill ? 1ULL << 55 | (uint64_t)ranks[i] << 48 : 0) | (p & mask);
+        }
+    }
+
+    // Reserve cache blocks for the draft tokens
+    for (auto& x : context_lengths) {
+        x += draft_len;
+    }
+
     auto adjust = [this, &g](const Sequences& sequences, const std::vector<int>& context_length) -> int {
         return AdjustMaxInputCount(g, sequences, context_length);
     };
@@ -497,12 +1769,67 @@ void LlamaBatch<T>::Initialize(GenerationState& g)
         dbg(outcome);
     }
 
+    const int64_t now = RequestMetrics::now();
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        auto&      r      = coords[i].first->requests[coords[i].second];
+        const bool active = sequences[i]->status == Sequence::kActive;
+        if (r->cached_len < 0 && active) {
+            r->cached_len = sequences[i]->cache_len;
+        }
+        if (tp_rank_ == 0) {
+            if (!r->metrics.scheduled_time && active) {
+                r->metrics.scheduled_time = now;
+            }
+            if (status[i] == Sequence::kActive && !active) {
+                r->metrics.preempt_times.push_back(now);
+            }
+        }
+    }
+
+    {
+        std::lock_guard lock{cache_stats_mutex_};
+        const auto      stats = sequence_manager_->GetCacheStats();
+        if (metrics_) {
+            metrics_->preempt_swap->add(stats.preempt_swap - cache_stats_.preempt_swap);
+            metrics_->preempt_recompute->add(stats.preempt_recompute - cache_stats_.preempt_recompute);
+            metrics_->active_blocks->set(stats.active_blocks);
+            metrics_->cached_blocks->set(stats.cached_blocks);
+            metrics_->free_blocks->set(stats.free_blocks);
+        }
+        cache_stats_ = stats;
+    }
+
     bool exchange = outcome.swap_in + outcome.swap_out > 0;
 
+    if (draft_len) {
+        // The draft tokens are appended in `Forward`, until then input lengths exclude them
+        bool ok = !exchange;
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            auto& s = const_cast<Sequence&>(*sequences[i]);
+            ok      = ok && s.status == Sequence::kActive && s.cache_len + s.input_length == context_lengths[i];
+            context_lengths[i] -= draft_len;
+            s.input_length = std::min(s.input_length, context_lengths[i] - s.cache_len);
+        }
+        draft_len = ok ? draft_len : 0;
+    }
+
+    const int held = HoldBeams(sequences, context_lengths);
+
+    if (fair_share_) {
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            if (const auto& s = *sequences[i]; s.status == Sequence::kActive && s.input_length > 0) {
+                const auto& r = coords[i].first->requests[coords[i].second];
+                fair_share_->Charge(r->gen_cfg.tenant_id, s.input_length, s.input_length > 1);
+            }
+        }
+    }
+
     std::vector<int> idxs(sequences.size());
     std::iota(idxs.begin(), idxs.end(), 0);
 
-    if (exchange || holes || incoming_->size) {
+    const bool relayout = exchange || holes || incoming_->size || held;
+
+    if (relayout) {
         // put active ones first
         auto active_end = std::stable_partition(idxs.begin(), idxs.end(), [&](int idx) {
             return sequences[idx]->status == Sequence::kActive;  // current status
@@ -550,35 +1877,22 @@ void LlamaBatch<T>::Initialize(GenerationState& g)
 
     FT_CHECK(state_->size <= max_batch_size_);
 
+    // the output ids of the beams recomputing their last token are kept by the relayout above
+    for (const auto& s : beam_forced_) {
+        const int i = std::find(state_->sequences.begin(), state_->sequences.begin() + state_->active_size, s)
+                      - state_->sequences.begin();
+        FT_CHECK(i < state_->active_size);
+        --state_->h_context_length[i];
+    }
+
     /// Update block ptrs when there were
     //  1. swap-in or swap-out
     //  2. holes in the active buffer
     //  3. new allocations (for existing active sequences)
-    if (exchange || active_holes || outcome.allocation) {
-        // Prepare intermediate buffers
-        h_cu_block_counts_[0] = 0;
-
-        auto block_ptrs = h_block_ptrs_;
-
-        const int batch_size = state_->active_size;
-
-        for (int i = 0; i < batch_size; ++i) {
-            const auto& seq = *state_->sequences[i];
-
-            // cumulative num of blocks
-            h_cu_block_counts_[i + 1] = h_cu_block_counts_[i] + seq.blocks.size();
-
-            block_ptrs = std::transform(seq.blocks.cbegin(), seq.blocks.cend(), block_ptrs, [&](int block_id) {
-                return reinterpret_cast<uintptr_t>(sequence_manager_->GetBlockPtr(block_id));
-            });
-        }
-
-        static_assert(sizeof(uintptr_t) == sizeof(void*));
-
-        Copy(h_cu_block_counts_, batch_size + 1, cu_block_counts_);
-        Copy(h_block_ptrs_, h_cu_block_counts_[batch_size], block_ptrs_);
-        // Copy(h_k_block_ptrs_, h_cu_block_counts_[batch_size], k_block_ptrs_);
-        // Copy(h_v_block_ptrs_, h_cu_block_counts_[batch_size], v_block_ptrs_);
+    //  4. beams held out of the step or following other beams
+    if (exchange || active_holes || outcome.allocation || outcome.demotion || held || beams_reparented_) {
+        beams_reparented_ = false;
+        UpdateBlockTable();
     }
 
     const int batch_size = state_->active_size;
@@ -604,21 +1918,39 @@ void LlamaBatch<T>::Initialize(GenerationState& g)
         unique_ids[i] = state_->requests[i]->unique_id;
     }
 
-    // Real-time context length that will change during generation
-    Copy(state_->h_context_length, batch_size, context_length_buf_);
-    Copy(state_->h_finished, batch_size, finished_buf_);
-    Copy(state_->h_rope_theta, batch_size, rope_theta_);
+    // Real-time context length that will change during generation, staged with `h_finished` & `h_rope_theta` in a
+    // single copy as the rows are laid out the same on host
+    Copy((const char*)state_->h_context_length,
+         (char*)(state_->h_rope_theta + batch_size) - (char*)state_->h_context_length,
+         (char*)context_length_buf_);
 
     bool skip_init_sampling = std::equal(g.unique_ids.begin(),  //
                                          g.unique_ids.end() - g.partial,
                                          unique_ids.begin(),
                                          unique_ids.end() - partial);
+    // the beams of a request share its id, so do the rows they are moved to
+    skip_init_sampling = skip_init_sampling && !(relayout && !beams_.empty()) && beam_forced_.empty();
+    // the tokens of the deferred steps are indexed by the slots & the step they were sampled at
+    FT_CHECK_WITH_INFO(!pending_steps_ || (!relayout && skip_init_sampling), "Batch changed with deferred steps");
 
     g.partial                = partial;
     g.partial_context_legnth = partial_len;
     g.unique_ids             = std::move(unique_ids);
     g.finished_count         = 0;
     g.skip_init_sampling     = skip_init_sampling;
+    g.draft_len              = draft_len;
+
+    g.prefill_tokens = 0;
+    for (int i = 0; i < batch_size; ++i) {
+        const int n = state_->sequences[i]->input_length;
+        if (n > 1) {
+            g.prefill_tokens += n;
+        }
+        // the last token of a fully cached prompt is recomputed
+        if (auto& m = state_->requests[i]->metrics; tp_rank_ == 0 && (n > 1 || !m.prefill_end_time)) {
+            m.computed_tokens += n;
+        }
+    }
 
     // TM_LOG_ERROR("[Initialize] batch size: %d, active size: %d", state_->size, state_->active_size);
 
@@ -629,54 +1961,102 @@ void LlamaBatch<T>::Initialize(GenerationState& g)
 }
 
 template<typename T>
-void LlamaBatch<T>::CopyState(const std::vector<std::tuple<BatchState*, BatchState*, int, int>>& desc)
+void LlamaBatch<T>::ResetBlockTable()
 {
-    if (desc.empty()) {
-        return;
+    for (int i = 0; i <= max_batch_size_; ++i) {
+        h_cu_block_counts_[i] = i * block_stride_;
     }
+    Copy(h_cu_block_counts_, max_batch_size_ + 1, cu_block_counts_);
+    std::fill(h_block_counts_.begin(), h_block_counts_.end(), 0);
+}
 
-    std::vector<int> idxs(desc.size());
-    std::iota(idxs.begin(), idxs.end(), 0);
+template<typename T>
+void LlamaBatch<T>::UpdateBlockTable()
+{
+    static_assert(sizeof(uintptr_t) == sizeof(void*));
+
+    // Most rows only grow by a block or are unchanged, the rows of the sequences swapped in, moved between the slots
+    // or remapped by demotions & beams are rewritten from their first changed entry
+    h_copy_table_.clear();
+    for (int i = 0; i < state_->active_size; ++i) {
+        const auto& seq   = *state_->sequences[i];
+        const int   count = seq.cold_blocks.size() + seq.blocks.size();
+        FT_CHECK(count <= block_stride_);
+
+        uintptr_t* row   = h_block_ptrs_ + (size_t)i * block_stride_;
+        const int  valid = h_block_counts_[i];
+        int        first = count;
+        int        last  = 0;
+        int        k     = 0;
+
+        auto put = [&](uintptr_t ptr) {
+            if (k >= valid || row[k] != ptr) {
+                row[k] = ptr;
+                first  = std::min(first, k);
+                last   = k + 1;
+            }
+            ++k;
+        };
 
-    std::sort(idxs.begin(), idxs.end(), [&](int i, int j) { return desc[i] < desc[j]; });
+        // the cold blocks of a tiered kv cache precede the recent ones
+        for (const auto& id : seq.cold_blocks) {
+            put(reinterpret_cast<uintptr_t>(sequence_manager_->GetColdBlockPtr(id)));
+        }
+        for (const auto& id : seq.blocks) {
+            put(reinterpret_cast<uintptr_t>(sequence_manager_->GetBlockPtr(id)));
+        }
 
-    auto get_signature = [&](int i) -> std::pair<BatchState*, BatchState*> {
-        return std::make_pair(std::get<0>(desc[idxs[i]]), std::get<1>(desc[idxs[i]]));
-    };
+        h_block_counts_[i] = count;
 
-    std::vector<int> offsets;
-    auto             current = get_signature(0);
-    offsets.push_back(0);
-    for (int i = 0; i < idxs.size(); ++i) {
-        if (auto signature = get_signature(i); signature != current) {
-            current = signature;
-            offsets.push_back(i);
+        if (first < last) {
+            const size_t offset = (size_t)i * block_stride_ + first;
+            h_copy_table_.push_back(
+                {h_block_ptrs_ + offset, block_ptrs_ + offset, (int)(sizeof(uintptr_t) * (last - first))});
         }
     }
-    offsets.push_back(idxs.size());
-
-    for (int bi = 1; bi < offsets.size(); ++bi) {
-        int beg = offsets[bi - 1];
-        int end = offsets[bi];
 
-        if (beg == end) {
-            continue;
-        }
+    if (h_copy_table_.empty()) {
+        return;
+    }
 
-        auto [s, d] = get_signature(beg);
+    // The changes are read from the pinned mirror by the copies, `Finish` synchronizes the stream before the next
+    // update. Pageable table, `h_copy_table_` can be reused right after the call returns
+    FT_CHECK(h_copy_table_.size() <= 2 * max_batch_size_);
+    check_cuda_error(cudaMemcpyAsync(copy_table_,
+                                     h_copy_table_.data(),
+                                     sizeof(CopyDesc) * h_copy_table_.size(),
+                                     cudaMemcpyHostToDevice,
+                                     stream_));
+    invokeCopyTable(copy_table_, h_copy_table_.size(), stream_);
+    sync_check_cuda_error();
+}
 
-        std::vector<int> s_idx;
-        std::vector<int> d_idx;
-        for (int i = beg; i < end; ++i) {
-            s_idx.push_back(std::get<2>(desc[idxs[i]]));
-            d_idx.push_back(std::get<3>(desc[idxs[i]]));
-        }
+template<typename T>
+void LlamaBatch<T>::CopyState(const std::vector<std::tuple<BatchState*, BatchState*, int, int>>& desc)
+{
+    if (desc.empty()) {
+        return;
+    }
 
-        IndexedCopy(s_idx,
-                    d_idx,
-                    std::tuple{s->output_ids, d->output_ids, session_len_},
-                    std::tuple{s->curand_state, d->curand_state, 1});
+    // One table for all the (src, dst) buffer pairs, only the valid prefix of `output_ids` is moved
+    h_copy_table_.clear();
+    for (const auto& [s, d, si, di] : desc) {
+        h_copy_table_.push_back({s->output_ids + si * session_len_,
+                                 d->output_ids + di * session_len_,
+                                 (int)sizeof(int) * s->h_context_length[si]});
+        h_copy_table_.push_back({s->random_seed + si, d->random_seed + di, (int)sizeof(uint64_t)});
     }
+    FT_CHECK(h_copy_table_.size() <= 2 * max_batch_size_);
+
+    // pageable source, `h_copy_table_` can be reused right after the call returns
+    check_cuda_error(cudaMemcpyAsync(copy_table_,
+                                     h_copy_table_.data(),
+                                     sizeof(CopyDesc) * h_copy_table_.size(),
+                                     cudaMemcpyHostToDevice,
+                                     stream_));
+    invokeCopyTable(copy_table_, h_copy_table_.size(), stream_);
+    sync_check_cuda_error();
+    check_cuda_error(cudaEventRecord(copy_state_event_, stream_));
 
     for (const auto& [s, d, si, di] : desc) {
         d->h_prompt_length[di]  = s->h_prompt_length[si];
@@ -684,6 +2064,7 @@ void LlamaBatch<T>::CopyState(const std::vector<std::tuple<BatchState*, BatchSta
         d->h_finished[di]       = s->h_finished[si];
         d->h_rope_theta[di]     = s->h_rope_theta[si];
         d->seq_len_limit[di]    = s->seq_len_limit[si];
+        d->h_tokens[di]         = s->h_tokens[si];
         d->sequences[di]        = s->sequences[si];
         d->requests[di]         = s->requests[si];
     }
@@ -700,8 +2081,7 @@ void LlamaBatch<T>::AllocateBuffer(size_t batch_size, size_t session_len, int ca
     const size_t head_dim          = model_->size_per_head_;
     const size_t local_kv_head_num = model_->local_kv_head_num_;
     // +1 padding, BlockIterator does not use predicate
-    const size_t max_batch_block_count =
-        batch_size * ((session_len + cache_block_seq_len - 1) / cache_block_seq_len) + 1;
+    const size_t max_batch_block_count = batch_size * block_stride_ + 1;
 
     context_decoder_input_buf_ =
         (T*)allocator_->reMalloc(context_decoder_input_buf_, sizeof(T) * max_forward_token_num_ * hidden_units, false);
@@ -711,9 +2091,12 @@ void LlamaBatch<T>::AllocateBuffer(size_t batch_size, size_t session_len, int ca
     decoder_input_buf_  = (T*)allocator_->reMalloc(decoder_input_buf_, sizeof(T) * batchxbeam * hidden_units, false);
     decoder_output_buf_ = (T*)allocator_->reMalloc(decoder_output_buf_, sizeof(T) * batchxbeam * hidden_units, false);
 
+    scaled_decoder_output_buf_ =
+        (T*)allocator_->reMalloc(scaled_decoder_output_buf_, sizeof(T) * batchxbeam * hidden_units, false);
+    inv_temperature_buf_ = (float*)allocator_->reMalloc(inv_temperature_buf_, sizeof(float) * batchxbeam, false);
+
     input_ids_buf_       = (int*)allocator_->reMalloc(input_ids_buf_, sizeof(int) * batchxbeam * session_len, true);
     input_length_buf_    = (int*)allocator_->reMalloc(input_length_buf_, sizeof(int) * batchxbeam);
-    context_length_buf_  = (int*)allocator_->reMalloc(context_length_buf_, sizeof(int) * batchxbeam);
     init_context_length_ = (int*)allocator_->reMalloc(init_context_length_, sizeof(int) * batchxbeam);
 
     sequence_lengths_ = (int*)allocator_->reMalloc(sequence_lengths_, sizeof(int) * batchxbeam, false);
@@ -721,100 +2104,205 @@ void LlamaBatch<T>::AllocateBuffer(size_t batch_size, size_t session_len, int ca
     cu_block_counts_ = (int*)allocator_->reMalloc(cu_block_counts_, sizeof(int) * (batch_size + 1));
     block_ptrs_      = (uintptr_t*)allocator_->reMalloc(block_ptrs_, sizeof(uintptr_t) * max_batch_block_count);
 
+    if (copy_on_first_write_) {
+        cow_blocks_ = (char**)allocator_->reMalloc(cow_blocks_, sizeof(char*) * batch_size, false);
+    }
+
+    if (param_.kv_quant_error_interval && tp_rank_ == 0) {
+        kv_error_buf_ = (float*)allocator_->reMalloc(kv_error_buf_, sizeof(float) * 4 * model_->layer_num_, false);
+    }
+
+    copy_table_ = (CopyDesc*)allocator_->reMalloc(copy_table_, sizeof(CopyDesc) * 2 * batch_size, false);
+
     if (!logits_buf_) {  // may be alias of local_logits_buf_
         logits_buf_ = (T*)allocator_->reMalloc(logits_buf_, sizeof(T) * batchxbeam * vocab_size, false);
     }
 
+    if (const int heads = model_->medusa_num_heads()) {
+        medusa_buf_     = (T*)allocator_->reMalloc(medusa_buf_, sizeof(T) * batchxbeam * hidden_units, false);
+        medusa_ids_buf_ = (int*)allocator_->reMalloc(medusa_ids_buf_, sizeof(int) * heads * batchxbeam, false);
+    }
+
+    if (param_.candidate_sampling && tp_size_ > 1) {
+        const size_t candidate_num = batchxbeam * tp_size_ * kFusedSamplingMaxTopK;
+        candidate_logits_buf_ = (T*)allocator_->reMalloc(candidate_logits_buf_, sizeof(T) * candidate_num, false);
+        candidate_ids_buf_    = (int*)allocator_->reMalloc(candidate_ids_buf_, sizeof(int) * candidate_num, false);
+    }
+
     sampled_logprobs_ = (T*)allocator_->reMalloc(sampled_logprobs_, sizeof(T) * batchxbeam * kMaxLogProb, false);
     sampled_indexes_ =
         (uint32_t*)allocator_->reMalloc(sampled_indexes_, sizeof(uint32_t) * batchxbeam * kMaxLogProb, false);
     sampled_nums_ = (uint32_t*)allocator_->reMalloc(sampled_nums_, sizeof(uint32_t) * batchxbeam, false);
 
-    token_ids_buf_ = (int*)allocator_->reMalloc(token_ids_buf_, sizeof(int) * batchxbeam * session_len * 2, true);
+    token_ids_buf_ = (int*)allocator_->reMalloc(token_ids_buf_, sizeof(int) * batchxbeam * session_len * 2, true);
+
+    seq_limit_len_ = (uint32_t*)allocator_->reMalloc(seq_limit_len_, sizeof(uint32_t) * batch_size, false);
+
+    // `context_length_buf_`, `finished_buf_` & `rope_theta_`
+    const size_t rows_size = PlanStateRows(nullptr, batchxbeam, &context_length_buf_, &finished_buf_, &rope_theta_);
+    d_state_rows_          = allocator_->reMalloc(d_state_rows_, rows_size, true);
+    PlanStateRows(d_state_rows_, batchxbeam, &context_length_buf_, &finished_buf_, &rope_theta_);
+
+    if (param_.cache_window_size || param_.cache_score_budget) {
+        evicted_len_buf_ = (int*)allocator_->reMalloc(evicted_len_buf_, sizeof(int) * batch_size, false);
+    }
+
+    if (param_.max_loras) {
+        const size_t max_tiles = max_forward_token_num_ / kLoraTileTokens + batch_size;
+        lora_tiles_buf_ = (LoraTile*)allocator_->reMalloc(lora_tiles_buf_, sizeof(LoraTile) * max_tiles, false);
+        lora_buf_ =
+            (float*)allocator_->reMalloc(lora_buf_, sizeof(float) * max_forward_token_num_ * kLoraMaxCols, false);
+    }
+
+    is_allocate_buffer_ = true;
+}
+
+template<typename T>
+void LlamaBatch<T>::AllocatePersistantBuffer(size_t max_batch_size, int cache_block_seq_len)
+{
+    d_bad_words_ =
+        (int*)allocator_->reMalloc(d_bad_words_, sizeof(int) * max_batch_size * 2 * kMaxStopBadWordsLen, true);
+
+    d_end_ids_buf_ = (int*)allocator_->reMalloc(d_end_ids_buf_, sizeof(int) * max_batch_size * kMaxEndIdsSize, false);
+
+    for (auto& s : states_) {
+        // new requests are staged in pinned host memory, `CopyState` moves them to the device rows via UVA
+        s.output_ids = (int*)allocator_->reMalloc(
+            s.output_ids, sizeof(int) * max_batch_size * session_len_, true, &s == incoming_);
+        s.random_seed = (uint64_t*)allocator_->reMalloc(s.random_seed, sizeof(uint64_t) * max_batch_size, true);
+    }
+
+    const size_t max_batch_block_count = max_batch_size * block_stride_ + 1;
+
+    if (param_.enable_cascade_attention) {
+        const size_t size = CascadeLayout::max_size(max_batch_size);
+        cascade_buf_      = (int*)allocator_->reMalloc(cascade_buf_, sizeof(int) * size, false);
+    }
+
+    if (model_->attn_param_.sparse_decode_blocks) {
+        const size_t size = SparseLayout::max_size(max_batch_size);
+        sparse_buf_       = (int*)allocator_->reMalloc(sparse_buf_, sizeof(int) * size, false);
+    }
+
+    if (param_.cache_score_budget) {
+        block_score_stride_ = (session_len_ + cache_block_seq_len - 1) / cache_block_seq_len;
+        block_scores_buf_   = (float*)allocator_->reMalloc(
+            block_scores_buf_, sizeof(float) * max_batch_size * block_score_stride_, false);
+    }
+
+    if (param_.cache_recent_blocks) {
+        const size_t kv_size =
+            model_->local_kv_head_num_ * 2 * kDemoteChunk * cache_block_seq_len * model_->size_per_head_;
+
+        cold_len_buf_  = (int*)allocator_->reMalloc(cold_len_buf_, sizeof(int) * max_batch_size, false);
+        demote_kv_buf_ = (T*)allocator_->reMalloc(demote_kv_buf_, sizeof(T) * kv_size, false);
+        demote_ptrs_   = (uintptr_t*)allocator_->reMalloc(demote_ptrs_, sizeof(uintptr_t) * 2 * kDemoteChunk, false);
+        demote_cu_     = (int*)allocator_->reMalloc(demote_cu_, sizeof(int) * 2 * (kDemoteChunk + 1), false);
+
+        std::vector<int> cu(2 * (kDemoteChunk + 1));
+        for (int i = 0; i <= kDemoteChunk; ++i) {
+            cu[i]                    = i * cache_block_seq_len;
+            cu[kDemoteChunk + 1 + i] = i;
+        }
+        Copy(cu.data(), cu.size(), demote_cu_);
+    }
+
+    // The staging buffers are carved from a single pinned arena, allocated by the thread binding the rank to its
+    // NUMA node with `numa_affinity`. Planned with a null base for the size first
+    auto plan = [&](void* base) {
+        Monotonic alloc{base};
+
+        alloc(&h_bad_words_, max_batch_size * 2 * kMaxStopBadWordsLen);
+
+        alloc(&h_min_length_, max_batch_size);
+        alloc(&h_runtime_top_k_, max_batch_size);
+        alloc(&h_runtime_top_p_, max_batch_size);
+        alloc(&h_runtime_min_p_, max_batch_size);
+        alloc(&h_temperature_, max_batch_size);
+        alloc(&h_inv_temperature_, max_batch_size);
+        alloc(&h_repetition_penalty_, max_batch_size);
+        alloc(&h_frequency_penalty_, max_batch_size);
+        alloc(&h_presence_penalty_, max_batch_size);
+        alloc(&h_output_logprobs_, max_batch_size);
+
+        alloc(&h_random_seed_, max_batch_size);
+
+        alloc(&h_end_ids_buf_, max_batch_size * kMaxEndIdsSize);
+
+        alloc(&h_input_ids_buf_, max_batch_size * session_len_);
+        alloc(&h_input_length_buf_, max_batch_size);
+        alloc(&h_k_len_buf_, max_batch_size);
+        alloc(&h_evicted_len_buf_, max_batch_size);
+
+        alloc(&h_cu_block_counts_, max_batch_size + 1);
+        alloc(&h_block_ptrs_, max_batch_block_count);
+
+        if (copy_on_first_write_) {
+            alloc(&h_cow_blocks_, max_batch_size);
+        }
+
+        if (param_.kv_quant_error_interval && tp_rank_ == 0) {
+            alloc(&h_kv_error_, 4 * model_->layer_num_);
+        }
+
+        for (auto& s : states_) {
+            alloc(&s.h_prompt_length, max_batch_size);
+            char* rows{};
+            alloc(&rows, PlanStateRows(nullptr, max_batch_size, &s.h_context_length, &s.h_finished, &s.h_rope_theta));
+            PlanStateRows(rows, max_batch_size, &s.h_context_length, &s.h_finished, &s.h_rope_theta);
+        }
+
+        alloc(&h_seq_limit_len_, max_batch_size);
 
-    finished_buf_  = (bool*)allocator_->reMalloc(finished_buf_, sizeof(bool) * batchxbeam, false);
-    seq_limit_len_ = (uint32_t*)allocator_->reMalloc(seq_limit_len_, sizeof(uint32_t) * batch_size, false);
+        if (param_.enable_cascade_attention) {
+            alloc(&h_cascade_buf_, CascadeLayout::max_size(max_batch_size));
+        }
 
-    rope_theta_ = (float*)allocator_->reMalloc(rope_theta_, sizeof(float) * batch_size, false);
+        if (model_->attn_param_.sparse_decode_blocks) {
+            alloc(&h_sparse_buf_, SparseLayout::max_size(max_batch_size));
+        }
 
-    is_allocate_buffer_ = true;
-}
+        if (param_.cache_score_budget) {
+            alloc(&h_block_scores_buf_, max_batch_size * block_score_stride_);
+        }
 
-template<typename T>
-void LlamaBatch<T>::AllocatePersistantBuffer(size_t max_batch_size, int cache_block_seq_len)
-{
-    d_stop_words_ =
-        (int*)allocator_->reMalloc(d_stop_words_, sizeof(int) * max_batch_size * 2 * kMaxStopBadWordsLen, true);
-    d_bad_words_ =
-        (int*)allocator_->reMalloc(d_bad_words_, sizeof(int) * max_batch_size * 2 * kMaxStopBadWordsLen, true);
-    h_stop_words_ =
-        (int*)allocator_->reMalloc(h_stop_words_, sizeof(int) * max_batch_size * 2 * kMaxStopBadWordsLen, true, true);
-    h_bad_words_ =
-        (int*)allocator_->reMalloc(h_bad_words_, sizeof(int) * max_batch_size * 2 * kMaxStopBadWordsLen, true, true);
-
-    h_min_length_    = (int*)allocator_->reMalloc(h_min_length_, sizeof(int) * max_batch_size, true, true);
-    h_runtime_top_k_ = (int*)allocator_->reMalloc(h_runtime_top_k_, sizeof(int) * max_batch_size, true, true);
-    h_runtime_top_p_ = (float*)allocator_->reMalloc(h_runtime_top_p_, sizeof(float) * max_batch_size, true, true);
-    h_runtime_min_p_ = (float*)allocator_->reMalloc(h_runtime_min_p_, sizeof(float) * max_batch_size, true, true);
-    h_temperature_   = (float*)allocator_->reMalloc(h_temperature_, sizeof(float) * max_batch_size, true, true);
-    h_repetition_penalty_ =
-        (float*)allocator_->reMalloc(h_repetition_penalty_, sizeof(float) * max_batch_size, true, true);
-
-    h_random_seed_ = (unsigned long long*)allocator_->reMalloc(
-        h_random_seed_, sizeof(unsigned long long) * max_batch_size, true, true);
-    d_random_seed_ = (unsigned long long*)allocator_->reMalloc(
-        d_random_seed_, sizeof(unsigned long long) * max_batch_size, true, false);
-
-    h_curand_state_ =
-        (curandState_t*)allocator_->reMalloc(h_curand_state_, sizeof(curandState_t) * max_batch_size, true, true);
-    d_curand_state_ =
-        (curandState_t*)allocator_->reMalloc(d_curand_state_, sizeof(curandState_t) * max_batch_size, true, false);
+        if (param_.cache_recent_blocks) {
+            alloc(&h_cold_len_buf_, max_batch_size);
+        }
 
-    d_end_ids_buf_ = (int*)allocator_->reMalloc(d_end_ids_buf_, sizeof(int) * max_batch_size * kMaxEndIdsSize, false);
-    h_end_ids_buf_ =
-        (int*)allocator_->reMalloc(h_end_ids_buf_, sizeof(int) * max_batch_size * kMaxEndIdsSize, false, true);
+        alloc(&h_output_ids_, max_batch_size * session_len_);
 
-    for (auto& s : states_) {
-        s.output_ids = (int*)allocator_->reMalloc(s.output_ids, sizeof(int) * max_batch_size * session_len_, true);
-        s.curand_state =
-            (curandState_t*)allocator_->reMalloc(s.curand_state, sizeof(curandState_t) * max_batch_size, true);
-    }
+        if (param_.num_speculative_tokens) {
+            alloc(&h_draft_ids_, max_batch_size * param_.num_speculative_tokens);
+        }
 
-    const size_t max_batch_block_count =
-        max_batch_size * ((session_len_ + cache_block_seq_len - 1) / cache_block_seq_len);
+        if (const int heads = model_->medusa_num_heads()) {
+            alloc(&h_medusa_ids_, max_batch_size * heads);
+        }
 
-    {
-        h_input_ids_buf_ =
-            (int*)allocator_->reMalloc(h_input_ids_buf_, sizeof(int) * max_batch_size * session_len_, false, true);
-        h_input_length_buf_ =
-            (int*)allocator_->reMalloc(h_input_length_buf_, sizeof(int) * max_batch_size, false, true);
+        alloc(&h_sampled_logprobs_, max_batch_size * kMaxLogProb);
+        alloc(&h_sampled_indexes_, max_batch_size * kMaxLogProb);
+        alloc(&h_sampled_nums_, max_batch_size);
 
-        h_cu_block_counts_ =
-            (int*)allocator_->reMalloc(h_cu_block_counts_, sizeof(int) * (max_batch_size + 1), false, true);
-        h_block_ptrs_ =
-            (uintptr_t*)allocator_->reMalloc(h_block_ptrs_, sizeof(uintptr_t) * max_batch_block_count, false, true);
+        alloc(&h_finish_flags_, max_batch_size);
 
-        for (auto& s : states_) {
-            s.h_prompt_length =
-                (int*)allocator_->reMalloc(s.h_prompt_length, sizeof(int) * max_batch_size, false, true);
-            s.h_context_length =
-                (int*)allocator_->reMalloc(s.h_context_length, sizeof(int) * max_batch_size, false, true);
-            s.h_finished   = (bool*)allocator_->reMalloc(s.h_finished, sizeof(bool) * max_batch_size * 2, false, true);
-            s.h_rope_theta = (float*)allocator_->reMalloc(s.h_rope_theta, sizeof(float) * max_batch_size, false, true);
+        if (param_.async_output && tp_rank_ == 0) {
+            const int max_committed = param_.num_speculative_tokens + 1;
+            alloc(&h_stream_output_ids_, max_batch_size * max_committed);
+            alloc(&h_stream_seq_len_, max_batch_size);
+            alloc(&h_stream_finished_, max_batch_size);
         }
 
-        h_seq_limit_len_ =
-            (uint32_t*)allocator_->reMalloc(h_seq_limit_len_, sizeof(uint32_t) * max_batch_size, false, true);
+        return (size_t)((char*)alloc.ptr() - (char*)base);
+    };
 
-        h_output_ids_ =
-            (int*)allocator_->reMalloc(h_output_ids_, sizeof(int) * max_batch_size * session_len_, false, true);
-    }
+    FT_CHECK(!h_arena_);
+    h_arena_ = allocator_->malloc(plan(nullptr), true, true);
+    plan(h_arena_);
 
-    h_sampled_logprobs_ =
-        (T*)allocator_->reMalloc(h_sampled_logprobs_, sizeof(T) * max_batch_size * kMaxLogProb, false, true);
-    h_sampled_indexes_ = (uint32_t*)allocator_->reMalloc(
-        h_sampled_indexes_, sizeof(uint32_t) * max_batch_size * kMaxLogProb, false, true);
-    h_sampled_nums_ = (uint32_t*)allocator_->reMalloc(h_sampled_nums_, sizeof(uint32_t) * max_batch_size, false, true);
+    for (const auto& s : states_) {
+        FT_CHECK((char*)s.h_rope_theta - (char*)s.h_context_length == (char*)rope_theta_ - (char*)context_length_buf_);
+    }
 
     is_allocate_persistant_buffer_ = true;
 }
@@ -867,19 +2355,38 @@ void LlamaBatch<T>::FreeBuffer()
 
         allocator_->free((void**)&context_decoder_ids_buf_);
         allocator_->free((void**)&lora_mask_buf_);
+        allocator_->free((void**)&lora_tiles_buf_);
+        allocator_->free((void**)&lora_buf_);
 
         allocator_->free((void**)&decoder_input_buf_);
         allocator_->free((void**)&decoder_output_buf_);
+        allocator_->free((void**)&scaled_decoder_output_buf_);
+        allocator_->free((void**)&inv_temperature_buf_);
+
+        if (medusa_buf_) {
+            allocator_->free((void**)&medusa_buf_);
+            allocator_->free((void**)&medusa_ids_buf_);
+        }
 
         allocator_->free((void**)&input_ids_buf_);
         allocator_->free((void**)&input_length_buf_);
-        allocator_->free((void**)&context_length_buf_);
         allocator_->free((void**)&init_context_length_);
 
         allocator_->free((void**)&sequence_lengths_);
 
         allocator_->free((void**)&cu_block_counts_);
         allocator_->free((void**)&block_ptrs_);
+        if (cow_blocks_) {
+            allocator_->free((void**)&cow_blocks_);
+        }
+        if (kv_error_buf_) {
+            allocator_->free((void**)&kv_error_buf_);
+        }
+        allocator_->free((void**)&copy_table_);
+
+        if (tuning_block_) {
+            allocator_->free((void**)&tuning_block_);
+        }
 
         if (logits_buf_) {
             allocator_->free((void**)&logits_buf_);
@@ -887,16 +2394,33 @@ void LlamaBatch<T>::FreeBuffer()
         if (context_logits_buf_) {
             allocator_->free((void**)&context_logits_buf_);
         }
+        if (prompt_logprobs_buf_) {
+            allocator_->free((void**)&prompt_logprob_ids_buf_);
+            allocator_->free((void**)&prompt_logprobs_buf_);
+        }
+        if (pool_buf_) {
+            allocator_->free((void**)&pool_buf_);
+            allocator_->free((void**)&h_pool_buf_, true);
+            allocator_->free((void**)&pool_ranges_buf_);
+        }
+        if (candidate_logits_buf_) {
+            allocator_->free((void**)&candidate_logits_buf_);
+            allocator_->free((void**)&candidate_ids_buf_);
+        }
 
         allocator_->free((void**)&token_ids_buf_);
 
         allocator_->free((void**)&d_end_ids_buf_);
-        allocator_->free((void**)&h_end_ids_buf_, true);
 
-        allocator_->free((void**)&finished_buf_);
         allocator_->free((void**)&seq_limit_len_);
 
-        allocator_->free((void**)&rope_theta_);
+        allocator_->free(&d_state_rows_);
+        context_length_buf_ = {};
+        finished_buf_       = {};
+        rope_theta_         = {};
+        if (evicted_len_buf_) {
+            allocator_->free((void**)&evicted_len_buf_);
+        }
 
         allocator_->free((void**)&sampled_logprobs_);
         allocator_->free((void**)&sampled_indexes_);
@@ -907,33 +2431,44 @@ void LlamaBatch<T>::FreeBuffer()
 
     if (is_allocate_persistant_buffer_) {
 
-        allocator_->free((void**)&d_stop_words_);
-        allocator_->free((void**)&h_stop_words_, true);
         allocator_->free((void**)&d_bad_words_);
-        allocator_->free((void**)&h_bad_words_, true);
-        allocator_->free((void**)&d_random_seed_);
-        allocator_->free((void**)&h_random_seed_, true);
-        allocator_->free((void**)&d_curand_state_);
-        allocator_->free((void**)&h_curand_state_, true);
 
         for (auto& s : states_) {
-            allocator_->free((void**)&s.h_context_length, true);
-            allocator_->free((void**)&s.h_finished, true);
-            allocator_->free((void**)&s.h_rope_theta, true);
-            allocator_->free((void**)&s.output_ids);
-            allocator_->free((void**)&s.curand_state);
+            allocator_->free((void**)&s.output_ids, &s == incoming_);
+            allocator_->free((void**)&s.random_seed);
+        }
+
+        if (cascade_buf_) {
+            allocator_->free((void**)&cascade_buf_);
+        }
+
+        if (sparse_buf_) {
+            allocator_->free((void**)&sparse_buf_);
+        }
+
+        if (block_scores_buf_) {
+            allocator_->free((void**)&block_scores_buf_);
+        }
+
+        if (cold_len_buf_) {
+            allocator_->free((void**)&cold_len_buf_);
+            allocator_->free((void**)&demote_kv_buf_);
+            allocator_->free((void**)&demote_ptrs_);
+            allocator_->free((void**)&demote_cu_);
+        }
+
+        if (h_token_bitmask_) {
+            allocator_->free((void**)&h_token_bitmask_, true);
+            allocator_->free((void**)&d_token_bitmask_);
         }
-        allocator_->free((void**)&h_cu_block_counts_, true);
-        allocator_->free((void**)&h_block_ptrs_, true);
-        allocator_->free((void**)&h_input_ids_buf_, true);
-        allocator_->free((void**)&h_input_length_buf_, true);
-        allocator_->free((void**)&h_seq_limit_len_, true);
 
-        allocator_->free((void**)&h_output_ids_, true);
+        if (h_beam_groups_) {
+            allocator_->free((void**)&h_beam_groups_, true);
+            allocator_->free((void**)&d_beam_groups_);
+        }
 
-        allocator_->free((void**)&h_sampled_logprobs_);
-        allocator_->free((void**)&h_sampled_indexes_);
-        allocator_->free((void**)&h_sampled_nums_);
+        // all the staging buffers
+        allocator_->free(&h_arena_, true);
 
         is_allocate_persistant_buffer_ = false;
     }
@@ -946,14 +2481,57 @@ LlamaBatch<T>::~LlamaBatch()
 
     internal_thread_.join();
 
+    if (output_thread_.joinable()) {
+        {
+            std::lock_guard lock{output_mutex_};
+            output_stop_ = true;
+        }
+        output_cv_.notify_all();
+        output_thread_.join();
+    }
+
     // The dtor maybe called from unknown thread, set device id before CUDA calls
     cudaSetDevice(device_id_);
     cudaStreamSynchronize(stream_);
 
+    output_spill_.reset();
+
+    if (output_event_) {
+        cudaEventDestroy(output_event_);
+    }
+
+    if (finish_event_) {
+        cudaEventDestroy(finish_event_);
+    }
+
+    if (copy_state_event_) {
+        cudaEventDestroy(copy_state_event_);
+    }
+
+    if (kv_error_event_) {
+        cudaEventDestroy(kv_error_event_);
+    }
+
+    if (step_start_event_) {
+        cudaEventDestroy(step_start_event_);
+        cudaEventDestroy(step_end_event_);
+    }
+
+    if (transfer_stream_) {
+        cudaStreamSynchronize(transfer_stream_);
+        for (auto& t : transfers_) {
+            cudaEventDestroy(t.event);
+        }
+        transfers_.clear();
+        kv_streamer_.reset();
+        cudaStreamDestroy(transfer_stream_);
+    }
+
     FreeBuffer();
 
     model_.reset();
     sequence_manager_.reset();
+    embedding_cache_.reset();
     context_.reset();  // This destroy all objects in context except for `stream`
 }
 
@@ -974,7 +2552,7 @@ LlamaBatch<T>::LlamaBatch(const EngineParam&          param,
     device_id_(device_id),
     dp_rank_(dp_rank),
     tp_size_(model->tp_size_),
-    tp_rank_(model->tp_rank_),
+    tp_rank_(ctx->comm.h_tp_group->rank()),
     data_type_(getTensorType<T>()),
     debug_(isDebug()),
     stream_(ctx->stream),
@@ -987,16 +2565,8 @@ LlamaBatch<T>::LlamaBatch(const EngineParam&          param,
 {
     const auto cache_block_seq_len = model_->attn_param_.cache_block_seq_len;
 
-    const auto quant_policy = model_->param_.quant_policy;
-    const int  elem_bits    = quant_policy ? quant_policy : bitsof<T>;
-
-    SequenceManager::BlockConfig block_config{
-        (int)model_->size_per_head_,
-        (int)model_->local_kv_head_num_,
-        cache_block_seq_len,
-        elem_bits == bitsof<T> ? 0 : bitsof<T>,
-        elem_bits,
-    };
+    // laid out the same as planned by `PlanMemory`
+    const auto block_config = MakeBlockConfig(model_->param_, model_->attn_param_, param_, bitsof<T>);
 
     const auto get_free_size = [&] {  //
         size_t free{}, total{};
@@ -1004,14 +2574,143 @@ LlamaBatch<T>::LlamaBatch(const EngineParam&          param,
         return AllReduce(model_->comm_->h_tp_group, free, comm::RedOp::kMin);
     };
 
-    sequence_manager_.reset(new SequenceManager{model_->layer_num_,
-                                                block_config,
-                                                param.cache_max_block_count,
-                                                param.cache_chunk_size,
-                                                param.enable_prefix_caching,
-                                                tp_rank_,
-                                                allocator_,
-                                                get_free_size});
+    KvCacheLease lease{};
+    if (!param.cache_pool_key.empty()) {
+        int device{};
+        check_cuda_error(cudaGetDevice(&device));
+        // only the first engine joining the pool decides its capacity
+        size_t capacity = param.cache_pool_size * (1 << 30);
+        if (!capacity) {
+            FT_CHECK_WITH_INFO(param.cache_max_block_count < 1.,
+                               "`cache_pool_size` is required when `cache_max_entry_count` is a block count");
+            capacity = get_free_size() * param.cache_max_block_count;
+        }
+        lease.pool   = KvCachePool::Get(param.cache_pool_key, device, capacity);
+        lease.tenant = lease.pool->Join(param.cache_pool_min * (1 << 30), param.cache_pool_max * (1 << 30));
+        lease.agree  = [c = model_->comm_](int x) { return AllReduce(c->h_tp_group, x, comm::RedOp::kMin); };
+    }
+
+    if (param.symmetric_kv_cache) {
+        if (auto& d_comm = model_->comm_->d_comm; d_comm && d_comm->Query(comm::kHasPeerMapping) && !lease.pool) {
+            kv_allocator_ = std::make_unique<SymmetricAllocator>(d_comm, allocator_);
+        }
+        else if (tp_rank_ == 0) {
+            TM_LOG_WARNING("[LlamaBatch] `symmetric_kv_cache` requires the native communicator without "
+                           "`cache_pool_key`, ignored");
+        }
+    }
+
+    bool virtual_memory = param.cache_virtual_memory;
+    if (virtual_memory && kv_allocator_) {
+        // the symmetric buffers are mapped by the communicator
+        virtual_memory = false;
+        if (tp_rank_ == 0) {
+            TM_LOG_WARNING("[LlamaBatch] `cache_virtual_memory` is ignored with `symmetric_kv_cache`");
+        }
+    }
+
+    std::string prefix_store_path;
+    uint64_t    prefix_store_fingerprint{};
+    if (!param.prefix_cache_path.empty()) {
+        prefix_store_path =
+            fmtstr("%s/prefix_cache.dp%d.tp%d.bin", param.prefix_cache_path.c_str(), dp_rank_, tp_rank_);
+        // the kv of the stored blocks depends on the weights, the data type & the kv cache quantization
+        const auto& m = model_->param_;
+        std::vector<uint64_t> keys{model_->weights_->Fingerprint(),
+                                   (uint64_t)bitsof<T>,
+                                   (uint64_t)m.weight_type,
+                                   (uint64_t)m.group_size,
+                                   (uint64_t)m.quant_policy};
+        keys.insert(keys.end(), m.layer_quant_policy.begin(), m.layer_quant_policy.end());
+        for (const auto& x : keys) {
+            prefix_store_fingerprint ^= x + 0x9e3779b97f4a7c15ull + (prefix_store_fingerprint << 6)
+                                        + (prefix_store_fingerprint >> 2);
+        }
+    }
+
+    // the cold blocks hold the same heads quantized by `cold_quant_policy`
+    SequenceManager::TierConfig tier{};
+    if (param.cache_recent_blocks) {
+        const int q_bits = model_->attn_param_.cold_quant_policy & QuantPolicy::kCacheKVInt4 ? 4 : 8;
+        tier             = {param.cache_recent_blocks, bitsof<T>, q_bits, param.cache_cold_ratio};
+    }
+
+    {
+        StartupTimer::Scope _{context_->startup, "kv_cache"};
+        sequence_manager_.reset(new SequenceManager{model_->layer_num_,
+                                                    block_config,
+                                                    param.cache_max_block_count,
+                                                    param.cache_chunk_size,
+                                                    (size_t)(param.cache_swap_space * (1 << 30)),
+                                                    param.enable_prefix_caching,
+                                                    tp_rank_,
+                                                    kv_allocator_ ? kv_allocator_.get() : allocator_,
+                                                    get_free_size,
+                                                    prefix_store_path,
+                                                    (size_t)(param.prefix_cache_disk_space * (1 << 30)),
+                                                    prefix_store_fingerprint,
+                                                    param.cache_sink_size,
+                                                    param.cache_window_size,
+                                                    ParseEvictionPolicy(param.cache_eviction_policy),
+                                                    std::move(lease),
+                                                    virtual_memory,
+                                                    tier});
+    }
+
+    model_->unified_decoder_->setBlockCopier(sequence_manager_->block_copier());
+
+    sequence_manager_->SetScoreBudget(param.cache_score_budget);
+    sequence_manager_->SetPinBudget(param.cache_pin_tokens);
+
+    // The attention kernels fill the partial block of a fork when writing the first token to it, except for the
+    // kernels reading the blocks before (cascade & sparse decoding, prefix caching & tiered cache copies) and context
+    // parallelism, where the block may be held by another rank
+    copy_on_first_write_ = !param.enable_prefix_caching && !param.enable_cascade_attention
+                           && !model_->attn_param_.sparse_decode_blocks && !param.cache_recent_blocks
+                           && param.attn_cp_size == 1;
+    sequence_manager_->SetCopyOnFirstWrite(copy_on_first_write_);
+
+    if (param.cache_recent_blocks) {
+        sequence_manager_->SetDemote([this](const std::vector<void*>& src, const std::vector<void*>& dst) {
+            DemoteBlocks(src, dst);  //
+        });
+    }
+
+    if (param.cache_swap_bandwidth > 0) {
+        // Dense estimate of the prefill cost on each rank, the experts of MoE layers are not counted
+        const auto& m      = model_->param_;
+        double      params = 0;
+        for (size_t i = 0; i < m.layer_num; ++i) {
+            params += (double)m.hidden_units * m.head_dim * (2 * m.head_num + 2 * m.kv_head_num)
+                      + 3. * m.hidden_units * m.inter_size[i];
+        }
+        const double flops = param.cache_recompute_tflops * 1e12 * tp_size_;
+
+        SwapCostModel cost{};
+        cost.swap_per_block    = 2. * sequence_manager_->block_size() / (param.cache_swap_bandwidth * 1e9);
+        cost.recompute_linear  = 2. * params / flops;
+        cost.recompute_squared = 4. * m.layer_num * m.head_num * m.head_dim / flops;
+        sequence_manager_->SetSwapCostModel(cost);
+    }
+
+    if (param.l2_persist_mb > 0) {
+        l2_persist_ = std::make_unique<L2Persist>((size_t)param.l2_persist_mb << 20, stream_);
+    }
+
+    if (param.embedding_cache_size > 0) {
+        embedding_cache_ = std::make_unique<EmbeddingCache>((size_t)(param.embedding_cache_size * (1 << 30)), stream_);
+    }
+
+    if (auto store = sequence_manager_->prefix_store()) {
+        // Stores are written independently by each rank, drop them all if they diverged (e.g. partial writes)
+        const auto digests = AllGather(model_->comm_->h_tp_group, store->Digest());
+        if (std::adjacent_find(digests.begin(), digests.end(), std::not_equal_to<>{}) != digests.end()) {
+            if (tp_rank_ == 0) {
+                TM_LOG_WARNING("[LlamaBatch] Prefix cache files are inconsistent across ranks, clearing");
+            }
+            store->Clear();
+        }
+    }
 
     const size_t max_session_len = sequence_manager_->max_block_count() * cache_block_seq_len;
     if (max_session_len < session_len_) {
@@ -1025,11 +2724,19 @@ LlamaBatch<T>::LlamaBatch(const EngineParam&          param,
 
     FT_CHECK(max_context_token_num_ >= session_len_);
     FT_CHECK(max_forward_token_num_ >= max_batch_size_);
+    FT_CHECK_WITH_INFO(0 <= param_.reserved_slots && param_.reserved_slots < max_batch_size_,
+                       "`reserved_slots` must be less than `max_batch_size`");
+    if (param_.max_loras) {
+        // sequences with different adapters can't share their kv cache, tokens must stay in order of the sequences
+        FT_CHECK_WITH_INFO(!param_.enable_prefix_caching, "multi-LoRA is not supported with prefix caching");
+        FT_CHECK_WITH_INFO(param_.attn_dp_size == 1, "multi-LoRA is not supported with attention DP");
+    }
 
     for (auto& s : states_) {
         s.requests.resize(max_batch_size_);
         s.sequences.resize(max_batch_size_);
         s.seq_len_limit.resize(max_batch_size_);
+        s.h_tokens.resize(max_batch_size_);
         s.errors.resize(max_batch_size_);
     }
 
@@ -1037,10 +2744,61 @@ LlamaBatch<T>::LlamaBatch(const EngineParam&          param,
     back_     = &states_[1];
     incoming_ = &states_[2];
 
-    AllocCommBuffers();
+    {
+        // allocated from & registered with the device communicator
+        StartupTimer::Scope _{context_->startup, "comm_buffers"};
+        AllocCommBuffers();
+    }
+
+    {
+        StartupTimer::Scope _{context_->startup, "buffers"};
+        // a row of the block table holds a full session and the draft tokens
+        block_stride_ = (session_len_ + param_.num_speculative_tokens + cache_block_seq_len - 1) / cache_block_seq_len;
+        AllocateBuffer(max_batch_size_, session_len_, cache_block_seq_len);
+        AllocatePersistantBuffer(max_batch_size_, cache_block_seq_len);
+        h_block_counts_.resize(max_batch_size_);
+        ResetBlockTable();
+    }
+
+    check_cuda_error(cudaEventCreateWithFlags(&copy_state_event_, cudaEventDisableTiming));
+
+    if (kv_error_buf_) {
+        check_cuda_error(cudaEventCreateWithFlags(&kv_error_event_, cudaEventDisableTiming));
+    }
+
+    if (param_.sjf_scheduling) {
+        length_predictor_ = std::make_unique<OutputLengthPredictor>();
+    }
+
+    if (param_.fair_share) {
+        // The token counters of the tenants are exported by tp rank-0
+        fair_share_ = std::make_unique<FairShare>(param_.max_prefill_token_num,
+                                                  tp_rank_ == 0 ? fmtstr("dp_rank=\"%d\"", dp_rank_) : "");
+    }
 
-    AllocateBuffer(max_batch_size_, session_len_, cache_block_seq_len);
-    AllocatePersistantBuffer(max_batch_size_, cache_block_seq_len);
+    if (tp_rank_ == 0) {
+        auto&      r      = MetricsRegistry::instance();
+        const auto labels = fmtstr("dp_rank=\"%d\"", dp_rank_);
+
+        const char* kv_error_help   = "Relative RMS error of the quantized kv cache on the new tokens of a layer";
+        const auto  kv_error_bounds = std::vector<double>{1e-4, 2e-4, 5e-4, 1e-3, 2e-3, 5e-3, 1e-2, 2e-2, 5e-2, .1, 1};
+
+        metrics_ = Metrics{
+            r.counter("tm_steps_total", "Forward steps", labels),
+            r.counter("tm_prefill_tokens_total", "Tokens of the prefilling sequences", labels),
+            r.counter("tm_decode_tokens_total", "Tokens of the decoding sequences, draft tokens included", labels),
+            r.counter("tm_finished_requests_total", "Requests finished", labels),
+            r.counter("tm_preempt_swap_total", "Sequences preempted with their blocks swapped out", labels),
+            r.counter("tm_preempt_recompute_total", "Sequences preempted with their kv cache recomputed", labels),
+            r.histogram("tm_batch_size", "Active sequences per step", labels, ExponentialBounds(max_batch_size_)),
+            r.gauge("tm_active_blocks", "Cache blocks of the active sequences", labels),
+            r.gauge("tm_cached_blocks", "Cache blocks kept for the prefix cache", labels),
+            r.gauge("tm_free_blocks", "Free cache blocks", labels),
+            r.gauge("tm_l2_persist_bytes", "Bytes of the cache blocks in the persisting L2 window", labels),
+            r.histogram("tm_kv_quant_error", kv_error_help, labels + ",kind=\"k\"", kv_error_bounds),
+            r.histogram("tm_kv_quant_error", kv_error_help, labels + ",kind=\"v\"", kv_error_bounds),
+        };
+    }
 
     // Wait for allocations
     check_cuda_error(cudaStreamSynchronize(stream_));
@@ -1103,9 +2861,37 @@ void LlamaBatch<T>::InitializeSampling(const GenerationState& g)
     member_to_tensor(&G::top_k, "runtime_top_k", h_runtime_top_k_, 0);
     member_to_tensor(&G::top_p, "runtime_top_p", h_runtime_top_p_, 0);
     member_to_tensor(&G::min_p, "runtime_min_p", h_runtime_min_p_, 0);
-    member_to_tensor(&G::temperature, "temperature", h_temperature_, 1.f);
+    // Temperature commutes with the other logits processors except the frequency & presence penalties. Without them
+    // it's folded into the LM head as a scale of the hidden states, which saves a pass over the [batch, vocab] logits
+    {
+        constexpr float kMinFusedTemperature = .1f;  // larger scales risk overflowing the f16 hidden states
+
+        bool fusible = AnomalyHandler::level() == 0;
+        bool scaled  = false;
+        for (int i = 0; i < batch_size && fusible; ++i) {
+            const auto& c = state_->requests[i]->gen_cfg;
+            fusible       = c.temperature >= kMinFusedTemperature && c.output_logits != G::kGeneration;
+            fusible       = fusible && c.frequency_penalty == 0.f && c.presence_penalty == 0.f;
+            scaled        = scaled || c.temperature != 1.f;
+        }
+        fuse_temperature_ = fusible && scaled;
+        if (fuse_temperature_) {
+            for (int i = 0; i < batch_size; ++i) {
+                const auto& c = state_->requests[i]->gen_cfg;
+                // beam search takes the logits as they are
+                h_inv_temperature_[i] = c.beam_width > 1 ? 1.f : 1.f / (c.temperature + 1e-6f);
+            }
+            Copy(h_inv_temperature_, batch_size, inv_temperature_buf_);
+        }
+        else {
+            member_to_tensor(&G::temperature, "temperature", h_temperature_, 1.f);
+        }
+    }
     member_to_tensor(&G::repetition_penalty, "repetition_penalty", h_repetition_penalty_, 1.f);
+    member_to_tensor(&G::frequency_penalty, "frequency_penalty", h_frequency_penalty_, 0.f);
+    member_to_tensor(&G::presence_penalty, "presence_penalty", h_presence_penalty_, 0.f);
     member_to_tensor(&G::min_new_tokens, "min_length", h_min_length_, 0);
+    member_to_tensor(&G::output_logprobs, "output_logprobs", h_output_logprobs_, 0);
 
     auto init_stop_bad_words = [&](auto getter, auto key, auto h_buf, auto d_buf) {
         int                                     max_length = 0;
@@ -1157,9 +2943,31 @@ void LlamaBatch<T>::InitializeSampling(const GenerationState& g)
         Copy(h_buf, batch_size * 2 * max_length, d_buf);
         inputs.insert(key, {MEMORY_GPU, TYPE_INT32, {(size_t)batch_size, (size_t)2, (size_t)max_length}, d_buf});
     };
-    init_stop_bad_words(&G::stop_ids, "stop_words_list", h_stop_words_, d_stop_words_);
     init_stop_bad_words(&G::bad_ids, "bad_words_list", h_bad_words_, d_bad_words_);
 
+    // Stop sequences are compiled into automata by `StopCriteriaLayer` on host, their lengths are not limited
+    {
+        int max_length = 0;
+        for (int i = 0; i < batch_size; ++i) {
+            const auto& [token_ids, offsets] = state_->requests[i]->gen_cfg.stop_ids;
+            FT_CHECK(offsets.empty() || offsets.back() == token_ids.size());
+            max_length = std::max(max_length, (int)token_ids.size());
+        }
+        if (max_length) {
+            h_stop_words_.assign(batch_size * 2 * max_length, -1);
+            for (int i = 0; i < batch_size; ++i) {
+                const auto& [token_ids, offsets] = state_->requests[i]->gen_cfg.stop_ids;
+                std::copy(token_ids.begin(), token_ids.end(), h_stop_words_.begin() + i * 2 * max_length);
+                std::copy(offsets.begin(), offsets.end(), h_stop_words_.begin() + i * 2 * max_length + max_length);
+            }
+            inputs.insert("stop_words_list",
+                          {MEMORY_CPU,
+                           TYPE_INT32,
+                           {(size_t)batch_size, (size_t)2, (size_t)max_length},
+                           h_stop_words_.data()});
+        }
+    }
+
     // MinLengthPenalty
     if (inputs.isExist("min_length")) {
         inputs.insert({"prompt_length", {MEMORY_CPU, TYPE_INT32, {(size_t)batch_size}, state_->h_prompt_length}});
@@ -1198,6 +3006,37 @@ void LlamaBatch<T>::InitializeSampling(const GenerationState& g)
     };
     init_for_eos();
 
+    if (token_mask_) {
+        inputs.insert({"token_bitmask",
+                       {MEMORY_GPU, TYPE_UINT32, {(size_t)batch_size, (size_t)token_mask_words_}, d_token_bitmask_}});
+    }
+
+    // Sampling from the top-k candidates of the vocab shards requires the top-k of the processed logits to be among
+    // them, among the logits processors only temperature keeps the order
+    candidate_k_ = 0;
+    if (candidate_logits_buf_ && AnomalyHandler::level() == 0 && !token_mask_ && !inputs.isExist("repetition_penalty")
+        && !inputs.isExist("frequency_penalty") && !inputs.isExist("presence_penalty")
+        && !inputs.isExist("bad_words_list") && !inputs.isExist("min_length")) {
+        int max_k = 0;
+        for (int i = 0; i < batch_size && max_k >= 0; ++i) {
+            const int   k = h_runtime_top_k_[i];
+            const auto& c = state_->requests[i]->gen_cfg;
+            if (0 < k && k <= kFusedSamplingMaxTopK && c.output_logits != GenerationConfig::kGeneration
+                && c.beam_width == 1) {
+                max_k = std::max(max_k, k);
+            }
+            else {
+                max_k = -1;
+            }
+        }
+        const size_t logits_size = sizeof(T) * max_batch_size_ * model_->vocab_size_padded_;
+        if (max_k > 0 && model_->topKWorkspaceSize(batch_size, max_k) <= logits_size) {
+            candidate_k_ = max_k;
+            const std::vector<size_t> shape{(size_t)batch_size, (size_t)tp_size_ * max_k};
+            inputs.insert({"logit_ids", {MEMORY_GPU, TYPE_INT32, shape, candidate_ids_buf_}});
+        }
+    }
+
     inputs_ = std::move(inputs);
 
     {
@@ -1221,13 +3060,255 @@ void LlamaBatch<T>::InitializeSampling(const GenerationState& g)
     sync_check_cuda_error();
 }
 
+template<typename T>
+int LlamaBatch<T>::BuildCascade(int dc_batch_size)
+{
+    // groups smaller than these are left to the decoding kernels alone
+    constexpr int kMinGroupSize = 4;
+    constexpr int kMinPrefixLen = 256;
+
+    const int block_len = model_->attn_param_.cache_block_seq_len;
+    // the prefixes end at both a cache block and a KV tile of the attention kernels
+    const int align = std::lcm(block_len, kCascadeAlign);
+
+    // sequences sharing a prefix share the first block, windowed & speculative sequences are not grouped
+    std::map<int, std::vector<int>> candidates;
+    for (int i = 0; i < dc_batch_size; ++i) {
+        const auto& seq = *state_->sequences[i];
+        if (h_input_length_buf_[i] == 1 && h_evicted_len_buf_[i] == 0 && h_k_len_buf_[i] > align) {
+            candidates[seq.blocks.front()].push_back(i);
+        }
+    }
+
+    std::vector<int> cu_q_len{0};
+    std::vector<int> cu_k_len{0};
+    std::vector<int> cu_block_num;
+    std::vector<int> q_idx;
+    std::vector<int> prefix_len(dc_batch_size);
+
+    for (const auto& [_, members] : candidates) {
+        if ((int)members.size() < kMinGroupSize) {
+            continue;
+        }
+        const auto& first = state_->sequences[members[0]]->blocks;
+        // longest common prefix of complete blocks before the decoding tokens, which are never written again
+        int block_num = (h_k_len_buf_[members[0]] - 1) / block_len;
+        for (const auto& i : members) {
+            const auto& blocks = state_->sequences[i]->blocks;
+            const int   n      = std::min(block_num, (h_k_len_buf_[i] - 1) / block_len);
+            block_num          = std::mismatch(first.begin(), first.begin() + n, blocks.begin()).first - first.begin();
+        }
+        const int len = block_num * block_len / align * align;
+        if (len < kMinPrefixLen) {
+            continue;
+        }
+        for (const auto& i : members) {
+            q_idx.push_back(i);
+            prefix_len[i] = len;
+        }
+        cu_q_len.push_back(q_idx.size());
+        cu_k_len.push_back(cu_k_len.back() + len);
+        cu_block_num.push_back(h_cu_block_counts_[members[0]]);
+    }
+
+    if (cu_block_num.empty()) {
+        return 0;
+    }
+
+    const CascadeLayout layout{(int)cu_block_num.size(), (int)q_idx.size(), dc_batch_size};
+
+    int* buf = h_cascade_buf_;
+    layout.Store(buf);
+    std::copy(cu_q_len.begin(), cu_q_len.end(), buf + layout.cu_q_len());
+    std::copy(cu_k_len.begin(), cu_k_len.end(), buf + layout.cu_k_len());
+    std::copy(cu_block_num.begin(), cu_block_num.end(), buf + layout.cu_block_num());
+    std::copy(q_idx.begin(), q_idx.end(), buf + layout.q_idx());
+    std::copy(prefix_len.begin(), prefix_len.end(), buf + layout.prefix_len());
+
+    Copy(h_cascade_buf_, layout.size(), cascade_buf_);
+
+    return layout.size();
+}
+
+template<typename T>
+void LlamaBatch<T>::DemoteBlocks(const std::vector<void*>& src, const std::vector<void*>& dst)
+{
+    if constexpr (sizeof(T) == 2) {
+        const int block_len = model_->attn_param_.cache_block_seq_len;
+        const int head_num  = model_->local_kv_head_num_;
+        const int head_dim  = model_->size_per_head_;
+
+        const int* cu_len       = demote_cu_;
+        const int* cu_block_num = demote_cu_ + kDemoteChunk + 1;
+
+        for (size_t i = 0; i < src.size(); i += kDemoteChunk) {
+            const int n   = std::min<int>(kDemoteChunk, src.size() - i);
+            const int sum = n * block_len;
+
+            Copy((const uintptr_t*)src.data() + i, n, demote_ptrs_);
+            Copy((const uintptr_t*)dst.data() + i, n, demote_ptrs_ + kDemoteChunk);
+
+            T* k = demote_kv_buf_;
+            T* v = k + sum * head_dim;
+
+            // each block as a sequence of its own, the keys are cached with the rotary embedding applied
+            for (size_t layer = 0; layer < model_->layer_num_; ++layer) {
+                // blocks -> [H, 2, sum, D]
+                invokeFlattenKV_v2(k,
+                                   v,
+                                   (char**)demote_ptrs_,
+                                   cu_len,
+                                   cu_block_num,
+                                   RopeKernelParam{},
+                                   0,
+                                   1,
+                                   2 * sum,
+                                   1,
+                                   block_len,
+                                   layer,
+                                   block_len,
+                                   head_num,
+                                   head_dim,
+                                   n,
+                                   0,
+                                   stream_);
+                sync_check_cuda_error();
+                invokeProcessKV_v2((char**)(demote_ptrs_ + kDemoteChunk),
+                                   k,
+                                   v,
+                                   (const T*)nullptr,
+                                   (const T*)nullptr,
+                                   cu_len,
+                                   cu_len,
+                                   cu_block_num,
+                                   RopeKernelParam{},
+                                   0,
+                                   1,
+                                   2 * sum,
+                                   1,
+                                   block_len,
+                                   layer,
+                                   block_len,
+                                   head_num,
+                                   head_dim,
+                                   n,
+                                   model_->attn_param_.cold_quant_policy,
+                                   stream_);
+                sync_check_cuda_error();
+            }
+        }
+    }
+    else {
+        FT_CHECK_WITH_INFO(0, "tiered kv cache requires f16/bf16");
+    }
+}
+
+template<typename T>
+int LlamaBatch<T>::BuildSparse(int dc_batch_size)
+{
+    const int block_len = model_->attn_param_.cache_block_seq_len;
+    const int topk      = model_->attn_param_.sparse_decode_blocks;
+
+    // the block of the decoding token is always attended
+    SparseLayout layout{dc_batch_size, kSparseSinkBlocks + topk + kSparseRecentBlocks + 1, 0, 0};
+
+    int* buf = h_sparse_buf_;
+
+    int* cu_k_len     = buf + layout.cu_k_len();
+    int* offset       = buf + layout.offset();
+    int* cu_block_num = buf + layout.cu_block_num();
+
+    bool sparse = false;
+
+    cu_k_len[0] = 0;
+    for (int i = 0; i < dc_batch_size; ++i) {
+        // the drafts of speculative decoding are attended in full
+        if (h_input_length_buf_[i] != 1) {
+            return 0;
+        }
+        const int k_len = h_k_len_buf_[i];
+        const int last  = (k_len - 1) / block_len;
+        int       len   = k_len;
+        if (last - kSparseSinkBlocks - kSparseRecentBlocks > topk) {
+            // the block of the token is the last of the row
+            len    = (layout.width - 1) * block_len + k_len - last * block_len;
+            sparse = true;
+        }
+        cu_k_len[i + 1]      = cu_k_len[i] + len;
+        offset[i]            = k_len - len;
+        cu_block_num[i]      = i * layout.width;
+        layout.max_k_len     = std::max(layout.max_k_len, len);
+        layout.max_block_num = std::max(layout.max_block_num, last + 1);
+    }
+
+    if (!sparse) {
+        return 0;
+    }
+
+    layout.Store(buf);
+
+    Copy(h_sparse_buf_, layout.size(), sparse_buf_);
+
+    return layout.size();
+}
+
+template<typename T>
+void LlamaBatch<T>::LaunchTokenMasks(const GenerationState& g)
+{
+    const int batch_size = state_->active_size - g.partial;
+
+    std::vector<TokenMatcher*> matchers(batch_size);
+    token_mask_ = false;
+    for (int i = 0; i < batch_size; ++i) {
+        matchers[i] = state_->requests[i]->gen_cfg.matcher.get();
+        token_mask_ |= matchers[i] != nullptr;
+    }
+
+    if (!token_mask_) {
+        return;
+    }
+
+    if (!h_token_bitmask_) {
+        token_mask_words_ = (model_->vocab_size_ + 31) / 32;
+        const size_t size = sizeof(uint32_t) * max_batch_size_ * token_mask_words_;
+        h_token_bitmask_  = (uint32_t*)allocator_->reMalloc(h_token_bitmask_, size, false, true);
+        d_token_bitmask_  = (uint32_t*)allocator_->reMalloc(d_token_bitmask_, size, false);
+    }
+
+    // The matchers are shared by the tp ranks, only the first rank runs them
+    if (tp_rank_ == 0) {
+        if (!token_masker_) {
+            const int worker_num = std::clamp<int>(std::thread::hardware_concurrency() / 4, 1, 8);
+            token_masker_        = std::make_unique<TokenMasker>(model_->vocab_size_, worker_num);
+        }
+        token_masker_->Launch(std::move(matchers), h_token_bitmask_);
+    }
+}
+
+template<typename T>
+void LlamaBatch<T>::UploadTokenMasks(const GenerationState& g)
+{
+    NvtxScope _("UploadTokenMasks");
+
+    const int size = (state_->active_size - g.partial) * token_mask_words_;
+
+    if (token_masker_) {
+        token_masker_->Wait();
+    }
+    if (tp_size_ > 1) {
+        Broadcast(comm_.h_tp_group, h_token_bitmask_, size, 0);
+    }
+    Copy(h_token_bitmask_, size, d_token_bitmask_);
+}
+
 template<class T>
 void LlamaBatch<T>::ComputeAndOutputLogits(T* hidden_states, int first, int last)
 {
     int  token_num = 0;
     bool found     = false;
     for (int i = first; i < last; ++i) {
-        if (state_->requests[i]->gen_cfg.output_logits == GenerationConfig::kAll) {
+        const auto& c = state_->requests[i]->gen_cfg;
+        if (c.output_logits == GenerationConfig::kAll || c.score) {
             const auto& s = *state_->sequences[i];
             // Skip when the seq is filling missed cache only
             if (s.cache_len + h_input_length_buf_[i] > s.tokens.size()) {
@@ -1273,9 +3354,81 @@ void LlamaBatch<T>::ComputeAndOutputLogits(T* hidden_states, int first, int last
         return;
     }
 
+    OutputPromptLogprobs(context_logits_buf_, first, last);
+
     OutputLogits(context_logits_buf_, first, last, GenerationConfig::kAll);
 }
 
+template<class T>
+void LlamaBatch<T>::OutputPromptLogprobs(const T* logits, int first, int last)
+{
+    // [token offset in `logits`, offset in `input_ids`, count] of the valid tokens of each sequence
+    std::vector<std::array<int, 3>> ranges(last - first);
+
+    std::vector<int> ids;
+    bool             found = false;
+
+    for (int i = first; i < last; ++i) {
+        const int input_len = h_input_length_buf_[i];  // input length for this iter
+        const int offset    = ids.size();
+        ids.resize(offset + input_len, -1);
+
+        const auto& r = state_->requests[i];
+        if (!r->gen_cfg.score) {
+            continue;
+        }
+
+        const auto& s         = *state_->sequences[i];
+        const auto& input_ids = r->inputs.at("input_ids");
+        const int*  prompt    = input_ids.getPtr<int>();
+        const int   n         = input_ids.shape[0];
+
+        // position of the first token of this chunk in `input_ids`, negative for the tokens filling missed cache
+        const int begin = s.cache_len - (int)s.tokens.size();
+        // the logits of token `k` predicts token `k + 1`
+        const int lo = std::max(0, -begin);
+        const int hi = std::min(input_len, n - 1 - begin);
+        for (int k = lo; k < hi; ++k) {
+            ids[offset + k] = prompt[begin + k + 1];
+        }
+        if (lo < hi) {
+            ranges[i - first] = {offset + lo, begin + lo + 1, hi - lo};
+            found             = true;
+        }
+    }
+
+    if (!found) {
+        return;
+    }
+
+    const int token_num     = ids.size();
+    prompt_logprob_ids_buf_ = (int*)allocator_->reMalloc(prompt_logprob_ids_buf_, sizeof(int) * token_num, false);
+    prompt_logprobs_buf_    = (float*)allocator_->reMalloc(prompt_logprobs_buf_, sizeof(float) * token_num, false);
+
+    Copy(ids.data(), token_num, prompt_logprob_ids_buf_);
+
+    invokeTokenLogProbs(prompt_logprobs_buf_,
+                        logits,
+                        prompt_logprob_ids_buf_,
+                        token_num,
+                        model_->vocab_size_,
+                        model_->vocab_size_padded_,
+                        stream_);
+    sync_check_cuda_error();
+
+    for (int i = first; i < last; ++i) {
+        const auto [src, dst, count] = ranges[i - first];
+        if (count) {
+            float* dst_ptr = state_->requests[i]->outputs.getPtr<float>("prompt_logprobs");
+            if (dst == 1) {
+                // the first token has no prefix
+                dst_ptr[0] = 0.f;
+            }
+            Copy(prompt_logprobs_buf_ + src, count, dst_ptr + dst);
+        }
+    }
+}
+
 template<typename T>
 void LlamaBatch<T>::OutputLogits(const T* logits, int first, int last, GenerationConfig::OutType out_type)
 {
@@ -1326,14 +3479,12 @@ void LlamaBatch<T>::OutputLogits(const T* logits, int first, int last, Generatio
             // Skip previous chunks
             dst_ptr += std::max(0, cache_len - (history_len + offset)) * model_->vocab_size_;
 
-            check_cuda_error(cudaMemcpy2DAsync(dst_ptr,
-                                               sizeof(T) * model_->vocab_size_,
-                                               src_ptr,
-                                               sizeof(T) * model_->vocab_size_padded_,
-                                               sizeof(T) * model_->vocab_size_,
-                                               valid_len,
-                                               cudaMemcpyDefault,
-                                               stream_));
+            GetOutputSpill().Copy2D(dst_ptr,
+                                    sizeof(T) * model_->vocab_size_,
+                                    src_ptr,
+                                    sizeof(T) * model_->vocab_size_padded_,
+                                    sizeof(T) * model_->vocab_size_,
+                                    valid_len);
         }
     }
 }
@@ -1373,9 +3524,306 @@ void LlamaBatch<T>::OutputLastHiddenState(const T* hidden_states, int first, int
             // Skip previous chunks
             dst_ptr += std::max(0, cache_len - (history_len + offset)) * model_->hidden_units_;
 
-            Copy(src_ptr, valid_len * model_->hidden_units_, dst_ptr);
+            const size_t pitch = sizeof(T) * model_->hidden_units_;
+            GetOutputSpill().Copy2D(dst_ptr, pitch, src_ptr, pitch, pitch, valid_len);
+        }
+    }
+}
+
+template<class T>
+void LlamaBatch<T>::PoolHiddenStates(const T* hidden_states, int first, int last)
+{
+    // only rank-0 writes to output
+    if (tp_rank_ != 0) {
+        return;
+    }
+
+    // [row offset in `hidden_states`, count, batch index] of the pooled tokens of each sequence
+    std::vector<int> ranges;
+
+    int offset    = 0;
+    int max_count = 0;
+    for (int i = first; i < last; ++i) {
+        const int input_len = h_input_length_buf_[i];  // input length for this iter
+        const int row       = offset;
+        offset += input_len;
+
+        const auto& r = state_->requests[i];
+        if (!r->gen_cfg.pooling) {
+            continue;
+        }
+
+        const auto& s = *state_->sequences[i];
+        const int   n = r->inputs.at("input_ids").shape[0];
+
+        // position of the first token of this chunk in `input_ids`
+        const int begin = s.cache_len - (int)s.tokens.size();
+
+        int lo = 0;
+        int hi = n;
+        if (r->gen_cfg.pooling == GenerationConfig::kPoolLast) {
+            lo = n - 1;
+        }
+        else if (r->gen_cfg.pooling == GenerationConfig::kPoolCls) {
+            hi = 1;
+        }
+        // the tokens recomputed after a preemption are pooled once
+        lo = std::max({lo, r->pooled_len, begin});
+        hi = std::min(hi, begin + input_len);
+
+        const int pooled = r->pooled_len;
+        r->pooled_len    = std::max(r->pooled_len, std::min(n, begin + input_len));
+
+        if (lo < hi) {
+            ranges.insert(ranges.end(), {row + lo - begin, hi - lo, i});
+            max_count = std::max(max_count, hi - lo);
+        }
+        if (lo < hi || (r->pooled_len == n && pooled < n)) {
+            pooled_.push_back({lo < hi ? i : -1 - i, pooled, n});
+        }
+    }
+
+    if (ranges.empty()) {
+        return;
+    }
+
+    const int hidden_units = model_->hidden_units_;
+    if (!pool_buf_) {
+        pool_buf_   = (float*)allocator_->malloc(sizeof(float) * max_batch_size_ * hidden_units, false);
+        h_pool_buf_ = (float*)allocator_->malloc(sizeof(float) * max_batch_size_ * hidden_units, false, true);
+    }
+    pool_ranges_buf_ = (int*)allocator_->reMalloc(pool_ranges_buf_, sizeof(int) * ranges.size(), false);
+
+    const int range_num = ranges.size() / 3;
+    Copy(ranges.data(), ranges.size(), pool_ranges_buf_);
+
+    check_cuda_error(cudaMemsetAsync(pool_buf_, 0, sizeof(float) * max_batch_size_ * hidden_units, stream_));
+    invokeSumRows(pool_buf_, hidden_states, pool_ranges_buf_, max_count, hidden_units, range_num, stream_);
+    sync_check_cuda_error();
+
+    for (int k = 0; k < range_num; ++k) {
+        const size_t idx = ranges[k * 3 + 2];
+        Copy(pool_buf_ + idx * hidden_units, hidden_units, h_pool_buf_ + idx * hidden_units);
+    }
+}
+
+template<class T>
+void LlamaBatch<T>::OutputPooledHiddenStates()
+{
+    const int hidden_units = model_->hidden_units_;
+    for (const auto& [index, pooled, n] : pooled_) {
+        const int i = index < 0 ? -1 - index : index;
+        auto&     r = state_->requests[i];
+        float*    x = r->outputs.getPtr<float>("pooled_hidden_state");
+        if (!pooled) {
+            std::fill_n(x, hidden_units, 0.f);
+        }
+        if (index >= 0) {
+            const float* src = h_pool_buf_ + (size_t)i * hidden_units;
+            for (int k = 0; k < hidden_units; ++k) {
+                x[k] += src[k];
+            }
+        }
+        // the prompt is complete
+        if (r->pooled_len == n) {
+            float scale = r->gen_cfg.pooling == GenerationConfig::kPoolMean ? 1.f / n : 1.f;
+            if (r->gen_cfg.normalize) {
+                double sum = 0.;
+                for (int k = 0; k < hidden_units; ++k) {
+                    sum += (double)x[k] * x[k];
+                }
+                scale = sum > 0. ? 1.f / std::sqrt(sum) : 1.f;
+            }
+            for (int k = 0; k < hidden_units; ++k) {
+                x[k] *= scale;
+            }
+        }
+    }
+    pooled_.clear();
+}
+
+template<class T>
+OutputSpill& LlamaBatch<T>::GetOutputSpill()
+{
+    if (!output_spill_) {
+        // 4 chunks of 8 MB, the chunk being drained by the host leaves 3 in flight
+        output_spill_ = std::make_unique<OutputSpill>(8 << 20, 4, allocator_);
+    }
+    return *output_spill_;
+}
+
+// the outputs completed by `Finish` besides the tokens
+static bool HasTensorOutputs(const GenerationConfig& c)
+{
+    return c.output_logprobs || c.output_logits || c.output_last_hidden_state;
+}
+
+template<typename T>
+void LlamaBatch<T>::SetupBeams(const GenerationState& g)
+{
+    const int batch_size = state_->active_size - g.partial;
+
+    beam_step_.clear();
+
+    if (!beams_.empty()) {
+        if (!h_beam_groups_) {
+            const size_t size = sizeof(BeamSearchGroup) * max_batch_size_;
+            h_beam_groups_    = (BeamSearchGroup*)allocator_->reMalloc(h_beam_groups_, size, false, true);
+            d_beam_groups_    = (BeamSearchGroup*)allocator_->reMalloc(d_beam_groups_, size, false);
+        }
+
+        std::unordered_map<const Sequence*, int> rows;
+        for (int i = 0; i < batch_size; ++i) {
+            rows.emplace(state_->sequences[i], i);
+        }
+
+        // A group steps with all of its beams, the beams of the others in the step recompute their last token
+        for (auto& [r, b] : beams_) {
+            auto& s = h_beam_groups_[beam_step_.size()];
+            s       = b.state;
+            s.beams = 0;
+            for (const auto& seq : b.seqs) {
+                if (auto it = rows.find(seq); it != rows.end()) {
+                    s.rows[s.beams++] = it->second;
+                }
+            }
+            if (!s.beams) {
+                continue;
+            }
+            s.hold = s.beams < (int)b.seqs.size();
+            beam_step_.push_back(s.hold ? nullptr : r);
+            if (!s.hold && b.state.beams == 1) {
+                // the sequence with the new token, forked by `ExpandBeams`
+                b.history.resize(state_->h_context_length[s.rows[0]] + 1);
+            }
+        }
+    }
+
+    const int group_num = beam_step_.size();
+
+    // `inputs_` are kept by the steps skipping `InitializeSampling`, the tensors of the last step are replaced
+    if (group_num || inputs_.isExist("beam_groups")) {
+        TensorMap inputs;
+        for (const auto& key : inputs_.keys()) {
+            if (key != "beam_groups" && key != "beam_history") {
+                inputs.insert(key, inputs_.at(key));
+            }
+        }
+        if (group_num) {
+            Copy(h_beam_groups_, group_num, d_beam_groups_);
+            inputs.insert("beam_groups", {MEMORY_GPU, TYPE_BYTES, {(size_t)group_num}, d_beam_groups_});
+            inputs.insert("beam_history",
+                          {MEMORY_GPU, TYPE_INT32, {(size_t)batch_size, (size_t)session_len_}, state_->output_ids});
+        }
+        inputs_ = std::move(inputs);
+    }
+}
+
+template<typename T>
+void LlamaBatch<T>::UpdateBeams()
+{
+    for (size_t j = 0; j < beam_step_.size(); ++j) {
+        if (!beam_step_[j]) {
+            continue;
+        }
+        auto&       b = beams_.at(beam_step_[j]);
+        const auto& s = h_beam_groups_[j];
+
+        auto& state = b.state;
+        std::copy_n(s.scores, kMaxBeamWidth, state.scores);
+        std::copy_n(s.lengths, kMaxBeamWidth, state.lengths);
+        std::copy_n(s.parents, kMaxBeamWidth, state.parents);
+        std::copy_n(s.tokens, kMaxBeamWidth, state.tokens);
+        state.finished = s.finished;
+        state.done     = s.done;
+
+        if (s.done) {
+            b.history.clear();
+            continue;
+        }
+
+        // the token ids are reordered by `invokeBeamCommit`, the kv caches follow them
+        const int        n = b.seqs.size();
+        std::vector<int> parents(s.parents, s.parents + n);
+        for (int k = 0; k < n; ++k) {
+            if (parents[k] != k) {
+                sequence_manager_->Reparent(b.seqs, parents);
+                beams_reparented_ = true;
+                break;
+            }
+        }
+    }
+
+    beam_step_.clear();
+}
+
+template<typename T>
+int LlamaBatch<T>::ReleaseBeams(int index, bool force_stop, std::vector<int>& tokens)
+{
+    const auto r = state_->requests[index];
+
+    const auto& b = beams_.at(r.get());
+    const auto& s = b.state;
+
+    const int        n = b.seqs.size();
+    std::vector<int> rows(n);
+    for (int k = 0; k < n; ++k) {
+        rows[k] = std::find(state_->sequences.begin(), state_->sequences.begin() + state_->size, b.seqs[k])
+                  - state_->sequences.begin();
+        FT_CHECK(rows[k] < state_->size);
+    }
+
+    // tokens of the finished beams end at their end token
+    auto length = [&](int k) { return s.finished >> k & 1 ? s.lengths[k] : state_->h_context_length[rows[k]]; };
+
+    // cumulative logprob normalized by the generated length, a canceled search keeps the 1st beam
+    int best = 0;
+    if (!force_stop) {
+        const int prompt_len = state_->h_prompt_length[rows[0]];
+        float     best_score = -INFINITY;
+        for (int k = 0; k < n; ++k) {
+            const int   len   = std::max(length(k) - prompt_len, 1);
+            const float score = s.scores[k] / std::pow((float)len, r->gen_cfg.length_penalty);
+            if (score > best_score) {
+                best_score = score;
+                best       = k;
+            }
         }
     }
+
+    const int len = length(best);
+
+    tokens.resize(len);
+    Copy(state_->output_ids + rows[best] * session_len_, len, tokens.data());
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    // ! Only rank-0 writes to output
+    if (tp_rank_ == 0) {
+        std::copy(tokens.begin(), tokens.end(), r->output_ids.getPtr<int>());
+        *r->sequence_length.getPtr<int>() = len;
+    }
+
+    // the sequence of the request continues with the kv cache of the best beam
+    if (best && !r->session.end_flag) {
+        sequence_manager_->Reparent({b.seqs[0], b.seqs[best]}, {1, 1});
+    }
+
+    for (int k = 1; k < n; ++k) {
+        FT_CHECK(sequence_manager_->Erase(b.seqs[k]->id));
+        const int i          = rows[k];
+        state_->sequences[i] = nullptr;
+        state_->requests[i].reset();
+        state_->errors[i] = Request::kOk;
+    }
+
+    const int i = rows[0];
+
+    state_->h_context_length[i] = len;
+    sequence_manager_->TruncateCache(*b.seqs[0], len - 1);
+
+    beams_.erase(r.get());
+
+    return i;
 }
 
 template<typename T>
@@ -1401,7 +3849,11 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
         sync_check_cuda_error();
     }
 
-    Copy(token_ids_buf_ + (g.step - 1) * (batch_size - g.partial), batch_size - g.partial, h_output_ids_);
+    // the tokens of the steps deferred by `DeferFinish` come before the ones of this step
+    const int deferred = std::exchange(pending_steps_, 0);
+    const int steps    = deferred + g.committed;
+
+    Copy(token_ids_buf_ + (g.step - steps) * (batch_size - g.partial), (batch_size - g.partial) * steps, h_output_ids_);
     Copy(finished_buf_, batch_size, state_->h_finished);
     Copy(sequence_lengths_, batch_size, state_->h_context_length);
 
@@ -1418,14 +3870,97 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
         Copy(sampled_nums_, batch_size, h_sampled_nums_);
     }
 
+    if (block_score_batch_) {
+        Copy(block_scores_buf_, block_score_batch_ * block_score_stride_, h_block_scores_buf_);
+    }
+
+    if (!beam_step_.empty()) {
+        Copy(d_beam_groups_, beam_step_.size(), h_beam_groups_);
+        // the sequences after the 1st step of their beam search, forked for the other beams by `ExpandBeams`
+        for (const auto& r : beam_step_) {
+            if (auto it = beams_.find(r); it != beams_.end() && !it->second.history.empty()) {
+                auto&     h = it->second.history;
+                const int i = std::find(state_->sequences.begin(), state_->sequences.end(), it->second.seqs[0])
+                              - state_->sequences.begin();
+                Copy(state_->output_ids + i * session_len_, h.size(), h.data());
+            }
+        }
+    }
+
     check_cuda_error(cudaStreamSynchronize(stream_));
 
+    // the blocks of a sequence are the same as in the forward, the ones evicted later drop their scores with them
+    const int block_len = model_->attn_param_.cache_block_seq_len;
+    for (int i = 0; i < block_score_batch_; ++i) {
+        auto&        scores = state_->sequences[i]->block_scores;
+        const int    n      = (h_k_len_buf_[i] + block_len - 1) / block_len;
+        const float* src    = h_block_scores_buf_ + (size_t)i * block_score_stride_;
+        scores.resize(std::max<size_t>(scores.size(), n));
+        for (int j = 0; j < n; ++j) {
+            scores[j] += src[j];
+        }
+    }
+    block_score_batch_ = 0;
+
+    // requested logits & hidden states are complete before the signals
+    if (output_spill_) {
+        output_spill_->Flush();
+    }
+
+    OutputPooledHiddenStates();
+
+    const int64_t now = RequestMetrics::now();
+
+    if (tp_rank_ == 0) {
+        for (int i = 0; i < batch_size - g.partial; ++i) {
+            if (auto& m = state_->requests[i]->metrics; !m.prefill_end_time) {
+                m.prefill_end_time = now;
+            }
+        }
+    }
+
     // invariant: context_length = sequence_length + 1, so that h_context_length include all (including the one just
     // generated) tokens
     for (int i = 0; i < batch_size; ++i) {
         ++state_->h_context_length[i];
     }
 
+    // Sequences finished in the last deferred step ran this one as well, its token is dropped. The kv of their last
+    // token is computed then, the cache is kept to what a step ending with the finish leaves
+    const auto lag = [&](int i) { return deferred && h_finish_flags_[i] ? g.committed : 0; };
+    for (int i = 0; i < batch_size; ++i) {
+        if (const int n = lag(i)) {
+            state_->h_context_length[i] -= n;
+            auto& s     = *state_->sequences[i];
+            s.cache_len = std::min(s.cache_len, state_->h_context_length[i] - 1);
+        }
+    }
+
+    // Tokens of the n-gram drafts, on all ranks as the drafts must agree
+    if (param_.num_speculative_tokens && !model_->medusa_num_heads()) {
+        for (int i = 0; i < batch_size - g.partial; ++i) {
+            auto&     tokens = state_->h_tokens[i];
+            const int count  = state_->h_context_length[i];
+            const int n      = steps - lag(i);
+            tokens.resize(count - n);
+            for (int j = 0; j < n; ++j) {
+                tokens.push_back(h_output_ids_[j * (batch_size - g.partial) + i]);
+            }
+        }
+    }
+
+    UpdateBeams();
+
+    if (tp_rank_ == 0 && token_mask_) {
+        for (int i = 0; i < batch_size - g.partial; ++i) {
+            if (auto& r = state_->requests[i]; r && r->gen_cfg.matcher) {
+                for (int j = 0; j < g.committed; ++j) {
+                    TokenMasker::Accept(*r->gen_cfg.matcher, h_output_ids_[j * (batch_size - g.partial) + i]);
+                }
+            }
+        }
+    }
+
     // ! Only rank-0 writes to output
     if (tp_rank_ == 0 && output_logprobs) {
         NvtxScope scope("logprobs");
@@ -1454,6 +3989,17 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
         }
     }
 
+    // Streaming requests of the output thread that are still running
+    const auto is_async_output = [&](int i) {
+        const auto& r = state_->requests[i];
+        return output_launched_ && r->stream_output && !HasTensorOutputs(r->gen_cfg) && !state_->h_finished[i];
+    };
+
+    if (output_launched_) {
+        // no one else may touch the outputs of the requests until they are written
+        WaitOutput();
+    }
+
     // ! Only rank-0 writes to output
     if (tp_rank_ == 0) {
         NvtxScope scope("output_ids");
@@ -1479,12 +4025,22 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
         }
         else {
             for (int i = 0; i < batch_size - g.partial; ++i) {
-                if (auto& r = state_->requests[i]) {
-                    auto      output_ids  = static_cast<int*>(r->output_ids.data);
-                    auto      output_len  = static_cast<int*>(r->sequence_length.data);
-                    const int count       = state_->h_context_length[i];
-                    output_ids[count - 1] = h_output_ids_[i];
-                    *output_len           = count;
+                if (auto& r = state_->requests[i]; r && !is_async_output(i)) {
+                    if (!r->metrics.first_token_time) {
+                        r->metrics.first_token_time = now;
+                    }
+                    // the output of a beam search is its best beam, written as the search finishes
+                    if (r->gen_cfg.beam_width > 1) {
+                        continue;
+                    }
+                    auto      output_ids = static_cast<int*>(r->output_ids.data);
+                    auto      output_len = static_cast<int*>(r->sequence_length.data);
+                    const int count      = state_->h_context_length[i];
+                    const int n          = steps - lag(i);
+                    for (int j = 0; j < n; ++j) {
+                        output_ids[count - n + j] = h_output_ids_[j * (batch_size - g.partial) + i];
+                    }
+                    *output_len = count;
                 }
             }
         }
@@ -1528,18 +4084,20 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
         NvtxScope _("stream_and_completion_signal");
         for (int i = 0; i < batch_size - g.partial; ++i) {
             auto& r = state_->requests[i];
+            if (!r) {
+                // the other beams of a finished beam search are released with it
+                continue;
+            }
             if (state_->h_finished[i]) {
                 // Interrupt finished sequences and move the request handle into the signal closure
                 signals.push_back(Interrupt(i));
                 // Interrupt should reset r
                 FT_CHECK(!r);
             }
-            else if (r->stream_output && tp_rank_ == 0) {
+            else if (r->stream_output && tp_rank_ == 0 && !is_async_output(i)) {
                 const auto seq_len = r->sequence_length.getVal<int>();
                 // Create signals by copying the request handles for non-finished streaming requests
-                signals.push_back([this, r, seq_len] {  //
-                    UpdateState(*r, Request::kOk, seq_len);
-                });
+                signals.emplace_back(r, Request::kOk, seq_len);
             }
         }
     }
@@ -1547,12 +4105,180 @@ void LlamaBatch<T>::Finish(GenerationState& g, std::vector<Signal>& signals)
     if (g.finished_count) {
         // synchronize for interrupted sequences
         check_cuda_error(cudaStreamSynchronize(stream_));
+        if (metrics_) {
+            metrics_->finished->add(g.finished_count);
+        }
+    }
+
+    if (g.partial) {
+        const int i = batch_size - 1;
+        // recover full context length of partial
+        state_->h_context_length[i] = g.partial_context_legnth;
+    }
+
+    output_launched_ = false;
+}
+
+template<typename T>
+bool LlamaBatch<T>::DeferFinish(GenerationState& g)
+{
+    if (param_.finish_sync_interval <= 1 || pending_steps_ + 1 >= param_.finish_sync_interval) {
+        return false;
+    }
+
+    // steady decoding only, the outputs besides the tokens & the bookkeeping on host are left to `Finish`
+    if (g.partial || g.committed != 1 || g.draft_len || g.prefill_tokens || !beams_.empty() || !beam_step_.empty()
+        || block_score_batch_ || debug_) {
+        return false;
+    }
+
+    const int batch_size = state_->active_size;
+
+    for (int i = 0; i < batch_size; ++i) {
+        const auto& c = state_->requests[i]->gen_cfg;
+        if (c.output_logprobs || c.matcher || HasTensorOutputs(c)) {
+            return false;
+        }
+        // a sequence finished in this step may run the next one too, both stay below the length limit
+        if (state_->h_context_length[i] + 2 >= state_->seq_len_limit[i]) {
+            return false;
+        }
     }
 
-    if (g.partial) {
-        const int i = batch_size - 1;
-        // recover full context length of partial
-        state_->h_context_length[i] = g.partial_context_legnth;
+    if (pending_steps_) {
+        // the flags of the previous step, the kernels of this one are queued behind them
+        check_cuda_error(cudaEventSynchronize(finish_event_));
+        if (std::any_of(h_finish_flags_, h_finish_flags_ + batch_size, [](bool x) { return x; })) {
+            return false;
+        }
+    }
+
+    Copy(finished_buf_, batch_size, h_finish_flags_);
+    check_cuda_error(cudaEventRecord(finish_event_, stream_));
+
+    // the lengths on device are read by the next `Finish`
+    for (int i = 0; i < batch_size; ++i) {
+        ++state_->h_context_length[i];
+    }
+
+    ++pending_steps_;
+
+    return true;
+}
+
+template<typename T>
+void LlamaBatch<T>::FlushFinish(GenerationState& g, std::vector<Signal>& signals)
+{
+    if (!pending_steps_) {
+        return;
+    }
+
+    // no new step, only the deferred ones are read
+    g.committed = 0;
+
+    Finish(g, signals);
+
+    if (g.finished_count) {
+        comm_.h_tp_group->Sync();
+    }
+}
+
+template<typename T>
+bool LlamaBatch<T>::IsBatchSettled() const
+{
+    // each sequence takes at most a new block in a decoding step, nothing is preempted with enough free blocks
+    return incoming_->size == 0 && state_->size == state_->active_size && transfers_.empty()
+           && sequence_manager_->free_block_count() >= state_->active_size;
+}
+
+template<typename T>
+void LlamaBatch<T>::LaunchOutput(const GenerationState& g)
+{
+    const int batch_size = state_->active_size - g.partial;
+
+    OutputJob job{{}, batch_size, g.committed};
+    for (int i = 0; i < batch_size; ++i) {
+        // logprobs, logits & hidden states must be written before the sequence length, they are left to `Finish`
+        if (const auto& r = state_->requests[i]; r && r->stream_output && !HasTensorOutputs(r->gen_cfg)) {
+            job.requests.emplace_back(r, i);
+        }
+    }
+    if (job.requests.empty()) {
+        return;
+    }
+
+    if (output_launched_) {
+        // by a deferred step
+        WaitOutput();
+    }
+
+    Copy(token_ids_buf_ + (g.step - g.committed) * batch_size, batch_size * g.committed, h_stream_output_ids_);
+    Copy(finished_buf_, batch_size, h_stream_finished_);
+    Copy(sequence_lengths_, batch_size, h_stream_seq_len_);
+    check_cuda_error(cudaEventRecord(output_event_, stream_));
+
+    {
+        std::lock_guard lock{output_mutex_};
+        output_job_ = std::move(job);
+    }
+    output_cv_.notify_all();
+
+    output_launched_ = true;
+}
+
+template<typename T>
+void LlamaBatch<T>::WaitOutput()
+{
+    std::unique_lock lock{output_mutex_};
+    output_cv_.wait(lock, [&] { return !output_job_ && !output_busy_; });
+}
+
+template<typename T>
+void LlamaBatch<T>::OutputThreadEntry()
+{
+    check_cuda_error(cudaSetDevice(device_id_));
+
+    std::vector<Signal> signals;
+
+    while (true) {
+        OutputJob job;
+        {
+            std::unique_lock lock{output_mutex_};
+            output_cv_.wait(lock, [&] { return output_job_ || output_stop_; });
+            if (output_stop_) {
+                break;
+            }
+            job = std::move(*output_job_);
+            output_job_.reset();
+            output_busy_ = true;
+        }
+
+        check_cuda_error(cudaEventSynchronize(output_event_));
+
+        for (auto& [r, i] : job.requests) {
+            if (h_stream_finished_[i]) {
+                // the final state is written by `Finish`
+                continue;
+            }
+            auto      output_ids = static_cast<int*>(r->output_ids.data);
+            const int count      = h_stream_seq_len_[i] + 1;
+            for (int j = 0; j < job.committed; ++j) {
+                output_ids[count - job.committed + j] = h_stream_output_ids_[j * job.batch_size + i];
+            }
+            *static_cast<int*>(r->sequence_length.data) = count;
+            if (!r->metrics.first_token_time) {
+                r->metrics.first_token_time = RequestMetrics::now();
+            }
+            signals.emplace_back(std::move(r), Request::kOk, count);
+        }
+
+        gateway_->notify(signals);
+
+        {
+            std::lock_guard lock{output_mutex_};
+            output_busy_ = false;
+        }
+        output_cv_.notify_all();
     }
 }
 
@@ -1578,6 +4304,16 @@ auto LlamaBatch<T>::Interrupt(int index, bool force_stop, bool force_end) -> Sig
         TM_LOG_INFO("[Interrupt] slot %d, tokens [%s]", index, ss.str().c_str());
     }
 
+    std::vector<int> beam_tokens;
+    if (state_->requests[index]->gen_cfg.beam_width > 1) {
+        index = ReleaseBeams(index, force_stop, beam_tokens);
+    }
+
+    // The prompt blocks are cached by `Finish` once the prompt is computed
+    if (const auto& r = state_->requests[index]; r->gen_cfg.pin_prefix && state_->sequences[index]->prompt.empty()) {
+        sequence_manager_->PinPrefix(*state_->sequences[index], state_->h_prompt_length[index]);
+    }
+
     if (state_->requests[index]->session.end_flag || force_end) {
         // Sequence is ending this round or a stop request is issued to end it
         FT_CHECK(sequence_manager_->Erase(state_->requests[index]->id));
@@ -1589,14 +4325,15 @@ auto LlamaBatch<T>::Interrupt(int index, bool force_stop, bool force_end) -> Sig
         // Update token IDs
         seq.tokens.resize(output_len);
 
-        // output_ids is updated & synced in `Finish`
-        const auto output_ids = state_->requests[index]->output_ids.getPtr<int>();
+        // output_ids is updated & synced in `Finish`, the tokens of a beam search are the ones of its best beam
+        const auto output_ids = beam_tokens.empty() ? state_->requests[index]->output_ids.getPtr<int>() :
+                                                      beam_tokens.data();
         std::copy_n(output_ids, output_len, seq.tokens.data());
 
-        // Save random state in host memory
-        seq.random_state.resize(sizeof(curandState_t));
+        // Save the seed in host memory, the random draws are stateless otherwise
+        seq.random_state.resize(sizeof(uint64_t));
         // This async copy must be synchronized by the caller
-        Copy(state_->curand_state + index, 1, (curandState_t*)seq.random_state.data());
+        Copy(state_->random_seed + index, 1, (uint64_t*)seq.random_state.data());
 
         // Set unlock flag for corresponding blocks, will be unlocked in the next `Materialize()`
         sequence_manager_->UpdateAndSetUnlock(seq);
@@ -1606,11 +4343,23 @@ auto LlamaBatch<T>::Interrupt(int index, bool force_stop, bool force_end) -> Sig
 
     auto ec = std::exchange(state_->errors[index], Request::kOk);
 
+    if (const auto& c = state_->requests[index]->gen_cfg; length_predictor_ && !force_stop && !c.score && !c.pooling
+                                                          && !c.warm && !c.expected_output_len) {
+        const int len = state_->h_context_length[index] - state_->h_prompt_length[index];
+        length_predictor_->Update(state_->h_prompt_length[index], len);
+    }
+
+    if (tp_rank_ == 0) {
+        state_->requests[index]->metrics.finish_time = RequestMetrics::now();
+        if (param_.admission_control && !force_stop) {
+            const int len   = state_->h_context_length[index] - state_->h_prompt_length[index];
+            output_len_avg_ = output_len_avg_ > 0 ? .9f * output_len_avg_ + .1f * len : len;
+        }
+    }
+
     const auto len = state_->requests[index]->sequence_length.getVal<int>();
     // move the request handle into the signal
-    return [this, len, force_stop, r = std::move(state_->requests[index])] {  //
-        UpdateState(*r, force_stop ? Request::kCancel : Request::kFinish, len);
-    };
+    return {std::move(state_->requests[index]), force_stop ? Request::kCancel : Request::kFinish, len};
 }
 
 namespace {
@@ -1621,6 +4370,9 @@ struct RequestData {
 
     std::vector<int> cancel;  // canceled indices in current batch
     bool             abort;
+
+    int  prefill_budget;  // from rank-0
+    bool swap_weights;    // rank-0 has the new weights staged
 };
 
 }  // namespace
@@ -1631,31 +4383,62 @@ void LlamaBatch<T>::InternalThreadEntry()
     // TM_LOG_INFO("[InternalThreadEntry] %d", (int)rank_);
     check_cuda_error(cudaSetDevice(device_id_));
 
+    // Also binds the workers spawned by this thread, e.g. the token masker
+    if (param_.numa_affinity) {
+        bindThreadToDevice(device_id_);
+    }
+
     // Initialize `AnomalyHandler`
     AnomalyHandler::instance().Init(tp_rank_, model_->vocab_size_padded_, 0, max_batch_size_, stream_);
 
     GenerationState g{};
 
-    while (1) {
+    std::vector<Signal> signals;
 
+    auto receive = [&] {
         std::shared_ptr<RequestData> req;
 
         if (tp_rank_ == 0) {
             req = std::make_shared<RequestData>();
+            // running sequences over a lowered `batch_limit_` are kept, only new ones are held back
+            const int batch_limit = batch_limit_ ? batch_limit_ : max_batch_size_;
+            // the slots of the beams not forked yet are taken
+            int forking = 0;
+            for (const auto& [r, b] : beams_) {
+                forking += r->gen_cfg.beam_width - (int)b.seqs.size();
+            }
+            const int free_slot_count = std::max(batch_limit - state_->size + g.finished_count - forking, 0);
             {
                 NvtxScope  _("pop");
-                const int  free_slot_count = max_batch_size_ - state_->size + g.finished_count;
-                const bool is_empty        = (free_slot_count == max_batch_size_);
+                const bool is_empty = (state_->size == g.finished_count) && deferred_.empty();
+                // transfers are polled every step, queued GEMM shapes are tuned on idle steps
+                const bool blocking = is_empty && transfers_.empty() && tuning_queue_.empty();
+                // Fair sharing picks from a window of up to a batch of requests beyond the free slots
+                const int window =
+                    fair_share_ ? std::max<int>(free_slot_count, max_batch_size_ - deferred_.size()) : free_slot_count;
                 // Block if batch is empty AND no silbings are ready
-                gateway_->pop(req->infer, req->kill, free_slot_count, is_empty, req->abort, dp_rank_);
+                gateway_->pop(req->infer, req->kill, window, blocking, req->abort, dp_rank_);
+                gateway_->report_load(dp_rank_, state_->size - g.finished_count);
+                // Deferred requests go before the new ones, those of the killed sessions are never admitted
+                DropDeferredRequests(req->kill, signals);
+                req->infer.insert(req->infer.begin(), deferred_.begin(), deferred_.end());
+                deferred_.clear();
             }
             // Mark reqs to the same session_id as invalid (which are dangerous to the engine)
             DisableInvalidRequests(req->infer, req->kill);
+            SortByOutputLength(req->infer);
+            ShareSlots(req->infer, free_slot_count);
+            ReserveSlots(req->infer, free_slot_count);
+            AdmitRequests(req->infer, free_slot_count);
+            ReserveBeams(req->infer, free_slot_count);
             FindCanceledIndices(req->cancel);
+            req->prefill_budget = prefill_budget_;
+            {
+                std::lock_guard lock{weights_mutex_};
+                req->swap_weights = pending_weights_ != nullptr;
+            }
         }
 
-        NvtxScope scope("mainloop");
-
         // 1. Wait while rank-0 is dequeueing
         // 2. Broadcast `ec` from rank-0
         // shared_state_->barrier->wait();
@@ -1663,17 +4446,46 @@ void LlamaBatch<T>::InternalThreadEntry()
 
         Broadcast(comm_.h_tp_group, req, 0);
 
-        if (req->abort) {
-            TM_LOG_INFO("[InternalThreadEntry] stop requested.");
-            break;
+        g.prefill_budget = req->prefill_budget;
+
+        if (auto store = sequence_manager_->prefix_store()) {
+            // the ranks stage the same writes of the prefix store, up to those none of them waits for
+            const int n = store->Writable();
+            store->SetBudget(comm_.h_tp_group->n_ranks() > 1 ? AllReduce(comm_.h_tp_group, n, comm::RedOp::kMin) : n);
         }
 
-        std::vector<Signal> signals;
+        if (pending_steps_
+            && (req->abort || req->swap_weights || !req->infer.empty() || !req->kill.empty() || !req->cancel.empty())) {
+            FlushFinish(g, signals);
+        }
+
+        if (!req->abort) {
+            ProcessKillRequests(req->kill, signals);
+
+            // Shared `priority` field will be assigned by rank-0
+            ProcessInferRequests(req->infer, signals);
+
+            PollTransfers(signals);
+        }
+
+        return req;
+    };
+
+    // requests received while the previous step was running
+    std::shared_ptr<RequestData> req;
 
-        ProcessKillRequests(req->kill, signals);
+    while (1) {
+
+        if (!req) {
+            req = receive();
+        }
+
+        NvtxScope scope("mainloop");
 
-        // Shared `priority` field will be assigned by rank-0
-        ProcessInferRequests(req->infer, signals);
+        if (req->abort) {
+            TM_LOG_INFO("[InternalThreadEntry] stop requested.");
+            break;
+        }
 
         // 1. Wait while shared `requests` is being used
         // 2. Broadcast modifcations from rank-0
@@ -1681,19 +4493,65 @@ void LlamaBatch<T>::InternalThreadEntry()
 
         ProcessCancelRequests(req->cancel, signals);
 
+        // the DP groups take part in the forward of each other, swap at the same step
+        int swap_weights = req->swap_weights;
+        if (comm_.h_dp_group->n_ranks() > 1) {
+            swap_weights = AllReduce(comm_.h_dp_group, swap_weights, comm::RedOp::kMax);
+        }
+        if (swap_weights) {
+            SwapInWeights();
+        }
+
+        req.reset();
+
+        if (pending_steps_ && !IsBatchSettled()) {
+            FlushFinish(g, signals);
+        }
+
         if (tp_rank_ == 0) {
-            gateway_->notify(std::move(signals));
+            gateway_->notify(signals);
         }
 
+        ExpandBeams();
+
         Initialize(g);
 
         const int n_active = AllReduce(comm_.h_dp_group, state_->active_size, comm::RedOp::kSum);
 
         if (n_active) {
-            //
+            if (step_start_event_) {
+                check_cuda_error(cudaEventRecord(step_start_event_, stream_));
+            }
+
             Forward(g);
 
-            Finish(g, signals);
+            if (step_end_event_) {
+                check_cuda_error(cudaEventRecord(step_end_event_, stream_));
+            }
+
+            if (output_thread_.joinable()) {
+                LaunchOutput(g);
+            }
+
+            if (param_.overlap_scheduling) {
+                // Kernels of the step are in flight, take and set up new requests before waiting for the results.
+                // Cancellations and scheduling still happen after `Finish` as they depend on the finish flags
+                req = receive();
+            }
+
+            const bool deferred = DeferFinish(g);
+
+            if (!deferred) {
+                Finish(g, signals);
+            }
+
+            if (step_start_event_ && !deferred) {
+                // the stream is synchronized by `Finish`
+                float step_ms{};
+                check_cuda_error(cudaEventElapsedTime(&step_ms, step_start_event_, step_end_event_));
+                UpdatePrefillBudget(g.prefill_tokens, step_ms);
+                UpdateBatchLimit(state_->active_size, g.prefill_tokens ? 0.f : step_ms);
+            }
 
             if (g.finished_count) {
                 // Finished requests and corresponding output tensors will be released when notified
@@ -1703,9 +4561,26 @@ void LlamaBatch<T>::InternalThreadEntry()
             }
 
             if (tp_rank_ == 0) {
-                gateway_->notify(std::move(signals));
+                gateway_->notify(signals);
             }
         }
+        else if (lazy_tuning_) {
+            TuneMisses();
+        }
+
+        // only rank-0 hands over the signals, the capacity is reused
+        signals.clear();
+    }
+
+    if (AnomalyHandler::level()) {
+        const auto c = AnomalyHandler::instance().counters();
+        TM_LOG_INFO("[AnomalyHandler][rank=%d] steps: %llu, tensors: %llu, INF: %llu, NaN: %llu, sequences: %llu",
+                    tp_rank_,
+                    c.steps,
+                    c.tensors,
+                    c.n_inf,
+                    c.n_nan,
+                    c.sequences);
     }
 
     // barrier synchronization inside
@@ -1725,6 +4600,65 @@ void LlamaBatch<T>::Start()
             std::abort();
         }
     });
+
+    if (param_.target_itl_ms > 0 && tp_rank_ == 0) {
+        check_cuda_error(cudaEventCreate(&step_start_event_));
+        check_cuda_error(cudaEventCreate(&step_end_event_));
+    }
+
+    if (param_.finish_sync_interval > 1) {
+        check_cuda_error(cudaEventCreateWithFlags(&finish_event_, cudaEventDisableTiming));
+    }
+
+    if (param_.async_output && tp_rank_ == 0) {
+        check_cuda_error(cudaEventCreateWithFlags(&output_event_, cudaEventDisableTiming));
+        output_thread_ = std::thread([this] {
+            try {
+                OutputThreadEntry();
+            }
+            catch (const std::exception& e) {
+                TM_LOG_ERROR("[Engine] %s", e.what());
+                std::abort();
+            }
+        });
+    }
+}
+
+template<typename T>
+void LlamaBatch<T>::UpdateL2Persist(bool decode)
+{
+    // the shared prefixes change slowly compared to the steps
+    constexpr int kInterval = 64;
+
+    if (decode && l2_persist_steps_++ % kInterval == 0) {
+        const auto [base, size] = sequence_manager_->HotBlockWindow(l2_persist_->max_window());
+        l2_persist_->SetWindow(base, size);
+    }
+    // the prefills stream their new blocks through the L2
+    l2_persist_->Enable(decode);
+
+    if (metrics_) {
+        metrics_->l2_persist_bytes->set(l2_persist_->window());
+    }
+}
+
+template<typename T>
+void LlamaBatch<T>::ObserveKvError()
+{
+    if (!kv_error_pending_ || cudaEventQuery(kv_error_event_) != cudaSuccess) {
+        return;
+    }
+    kv_error_pending_ = false;
+    // the layers with a non-quantized cache are not measured
+    for (size_t i = 0; metrics_ && i < model_->layer_num_; ++i) {
+        const float* x = h_kv_error_ + 4 * i;
+        if (x[1] > 0) {
+            metrics_->kv_quant_error_k->observe(std::sqrt(x[0] / x[1]));
+        }
+        if (x[3] > 0) {
+            metrics_->kv_quant_error_v->observe(std::sqrt(x[2] / x[3]));
+        }
+    }
 }
 
 template<typename T>
@@ -1732,13 +4666,18 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
 {
     NvtxScope _("Forward");
 
+    StepProfiler* const profiler = context_->profiler.get();
+    if (profiler && profiler->BeginStep()) {
+        profiler->Begin(StepProfiler::kStep, -1, stream_);
+    }
+
     FT_CHECK(max_context_token_num_ >= max_batch_size_);
 
     const int active_size = state_->active_size;
+    const int draft_len   = g.draft_len;
 
-    constexpr int kLogInterval = 10;
-    if (tp_rank_ == 0 && (g.step - 1) % kLogInterval == 0) {
-        TM_LOG_INFO("------------------------- step = %d -------------------------", g.step - 1);
+    if (tp_rank_ == 0) {
+        TM_EVENT(1000, "Forward", {"step", g.step - 1}, {"active", active_size}, {"draft", draft_len});
     }
 
     int               pf_offset = -1;
@@ -1748,16 +4687,63 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
         const auto& seq = *state_->sequences[i];
         // const int   missing = state_->h_context_length[i] - seq.cache_len;
         FT_CHECK(seq.input_length >= 1);
-        h_input_length_buf_[i] = seq.input_length;
+        h_input_length_buf_[i] = seq.input_length + draft_len;
         input_d_ptrs[i]        = state_->output_ids + i * session_len_ + seq.cache_len;
-        if (seq.input_length > 1 && pf_offset < 0) {
+        if (h_input_length_buf_[i] > 1 && pf_offset < 0) {
             pf_offset = i;
         }
+        if (draft_len) {
+            // Append the draft tokens to the last generated token, verified against the sampled tokens below
+            Copy(h_draft_ids_ + i * param_.num_speculative_tokens,
+                 draft_len,
+                 state_->output_ids + i * session_len_ + state_->h_context_length[i]);
+            state_->h_context_length[i] += draft_len;
+        }
     }
     if (pf_offset < 0) {
         pf_offset = active_size;
     }
 
+    if (l2_persist_) {
+        UpdateL2Persist(pf_offset == active_size);
+    }
+
+    // Length of the kv cache in the attention, excluding the tokens evicted by the sliding window
+    for (int i = 0; i < active_size; ++i) {
+        h_evicted_len_buf_[i] = state_->sequences[i]->evicted_len;
+        h_k_len_buf_[i]       = state_->h_context_length[i] - h_evicted_len_buf_[i];
+    }
+    if (evicted_len_buf_) {
+        Copy(h_evicted_len_buf_, active_size, evicted_len_buf_);
+    }
+    if (cold_len_buf_) {
+        for (int i = 0; i < active_size; ++i) {
+            h_cold_len_buf_[i] = sequence_manager_->cold_len(*state_->sequences[i]);
+        }
+        Copy(h_cold_len_buf_, active_size, cold_len_buf_);
+    }
+
+    // Sums of the sampled step before, the step is measured again once they are read
+    ObserveKvError();
+    float* kv_error = nullptr;
+    if (kv_error_buf_ && !kv_error_pending_ && kv_error_steps_++ % param_.kv_quant_error_interval == 0) {
+        check_cuda_error(cudaMemsetAsync(kv_error_buf_, 0, sizeof(float) * 4 * model_->layer_num_, stream_));
+        kv_error = kv_error_buf_;
+    }
+
+    // The forks of the batch copy their partial blocks in the first write, the others are copied by the block copier
+    bool cow = false;
+    if (copy_on_first_write_) {
+        for (int i = 0; i < active_size; ++i) {
+            h_cow_blocks_[i] = (char*)sequence_manager_->TakeFirstWriteSource(*state_->sequences[i]);
+            cow |= h_cow_blocks_[i] != nullptr;
+        }
+        sequence_manager_->FlushFirstWrites();
+        if (cow) {
+            Copy(h_cow_blocks_, active_size, cow_blocks_);
+        }
+    }
+
     // These buffers are only accessed when there are prefill workloads
     if (pf_offset != active_size) {
         Copy(state_->h_context_length, active_size, context_length_buf_);
@@ -1767,6 +4753,9 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
     // Find mini-batch offsets: input length > 1 ? prefill() : decode()
     // Constraints on mini-batches
     //   sum(Q) <= `max_forward_token_num` && sum(K) <= `max_context_token_num`
+    // the 2nd one bounds the linear kv of the prefills, which is not used with `streaming_prefill`
+    const int max_sum_k = model_->attn_param_.streaming_prefill ? INT_MAX : max_context_token_num_;
+
     std::vector<int> offsets{0};
     // initialize first mini-batch with decode tokens
     int sum_q = pf_offset;
@@ -1774,27 +4763,54 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
     for (int i = pf_offset; i < active_size; ++i) {
         FT_CHECK(h_input_length_buf_[i] <= max_forward_token_num_);
         const int q = sum_q + h_input_length_buf_[i];
-        const int k = sum_k + state_->h_context_length[i];
-        if (q <= max_forward_token_num_ && k <= max_context_token_num_) {
+        const int k = sum_k + h_k_len_buf_[i];
+        if (q <= max_forward_token_num_ && k <= max_sum_k) {
             sum_q = q;
             sum_k = k;
         }
         else {
             offsets.push_back(i);
             sum_q = h_input_length_buf_[i];
-            sum_k = state_->h_context_length[i];
+            sum_k = h_k_len_buf_[i];
         }
     }
     offsets.push_back(active_size);
 
-    // Synchronize mini batch count with sync DP ranks
-    int n_batches = AllReduce(comm_.h_dp_group, (int)offsets.size(), comm::RedOp::kMax);
+    if (metrics_) {
+        metrics_->steps->add();
+        metrics_->decode_tokens->add(std::accumulate(h_input_length_buf_, h_input_length_buf_ + pf_offset, 0));
+        metrics_->prefill_tokens->add(
+            std::accumulate(h_input_length_buf_ + pf_offset, h_input_length_buf_ + active_size, 0));
+        metrics_->batch_size->observe(active_size);
+    }
 
-    // Populate empty batches
-    while (offsets.size() < n_batches) {
-        offsets.push_back(offsets.back());
+    // Synchronize the mini-batch count and the token counts of the mini-batches with the sync DP ranks, in a single
+    // round trip when no rank has more than `DpBatches::kInline` mini-batches
+    const std::vector<int> local_token_nums = GatherTokenNums(offsets);
+    const int              dp_size          = comm_.h_dp_group->n_ranks();
+
+    // Swap in the adapters of the active sequences
+    std::vector<int> lora_slots;
+    if (auto adapters = model_->weights_->adapters.get()) {
+        std::vector<int> ids(active_size);
+        for (int i = 0; i < active_size; ++i) {
+            ids[i] = state_->requests[i]->gen_cfg.adapter_id;
+        }
+        if (std::any_of(ids.begin(), ids.end(), [](int id) { return id >= 0; })) {
+            adapters->Acquire(ids, lora_slots, stream_);
+            lora_batch_ = {lora_tiles_buf_,
+                           0,
+                           adapters->slots(),
+                           adapters->slot_size(),
+                           adapters->ranks(),
+                           adapters->scales(),
+                           lora_buf_};
+        }
     }
 
+    // Overlaps with the forward pass
+    LaunchTokenMasks(g);
+
     // forward on mini-batches
     for (int p = 0; p < (int)offsets.size() - 1; ++p) {
         const int first           = offsets[p];
@@ -1802,12 +4818,17 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
         const int mini_batch_size = last - first;
         int*      input_ids       = context_decoder_ids_buf_;
 
+        // a killed long prompt stops consuming the GPU between its chunks
+        if (SkipCanceledPrefill(g, first, last)) {
+            continue;
+        }
+
         BatchedCopy batched_copy;
         int         sum_k = 0;
         for (int i = first; i < last; ++i) {
             input_ids = batched_copy.Add(input_d_ptrs[i], h_input_length_buf_[i], input_ids);
             if (h_input_length_buf_[i] > 1) {
-                sum_k += state_->h_context_length[i];
+                sum_k += h_k_len_buf_[i];
             }
         }
         int sum_q = input_ids - context_decoder_ids_buf_;
@@ -1820,21 +4841,49 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
         if (tp_rank_ == 0) {
             if (pf_batch_size) {
                 const auto max_q = *std::max_element(h_input_length_buf_ + first, h_input_length_buf_ + last);
-                const auto max_k = *std::max_element(state_->h_context_length + first, state_->h_context_length + last);
-                TM_LOG_INFO("[Forward] [%d, %d), dc=%d, pf=%d, sum_q=%d, sum_k=%d, max_q=%d, max_k=%d",
-                            first,
-                            last,
-                            dc_batch_size,
-                            pf_batch_size,
-                            sum_q,
-                            sum_k,
-                            max_q,
-                            max_k);
+                const auto max_k = *std::max_element(h_k_len_buf_ + first, h_k_len_buf_ + last);
+                TM_EVENT(10,
+                         "Forward.prefill",
+                         {"first", first},
+                         {"last", last},
+                         {"dc", dc_batch_size},
+                         {"pf", pf_batch_size},
+                         {"sum_q", sum_q},
+                         {"sum_k", sum_k},
+                         {"max_q", max_q},
+                         {"max_k", max_k});
+            }
+        }
+
+        FT_CHECK(local_token_nums[p * dp_size + comm_.h_dp_group->rank()] == sum_q);
+
+        if (!lora_slots.empty()) {
+            std::vector<LoraTile> tiles;
+            for (int i = first, offset = 0; i < last; offset += h_input_length_buf_[i++]) {
+                for (int t = 0; lora_slots[i] >= 0 && t < h_input_length_buf_[i]; t += kLoraTileTokens) {
+                    const int end = std::min(t + kLoraTileTokens, h_input_length_buf_[i]);
+                    tiles.push_back({offset + t, offset + end, lora_slots[i]});
+                }
             }
+            Copy(tiles.data(), tiles.size(), lora_tiles_buf_);
+            lora_batch_.tile_num = tiles.size();
+            context_->linear->set_lora_batch(tiles.empty() ? nullptr : &lora_batch_);
         }
 
-        // Synchronize batch token num with sync DP ranks
-        auto local_token_nums = AllGather(comm_.h_dp_group, sum_q);
+        // decoding sequences beyond the block budget only attend to the selected blocks
+        const int sparse_size = dc_batch_size && h_sparse_buf_ ? BuildSparse(dc_batch_size) : 0;
+
+        // the prefixes shared by the decoding sequences are attended once per group
+        const int cascade_size = dc_batch_size && h_cascade_buf_ && !sparse_size ? BuildCascade(dc_batch_size) : 0;
+
+        // the blocks of the decoding sequences are scored for the heavy-hitter eviction
+        float* block_scores = nullptr;
+        if (dc_batch_size && block_scores_buf_ && g.step % kScoreInterval == 0) {
+            check_cuda_error(cudaMemsetAsync(
+                block_scores_buf_, 0, sizeof(float) * dc_batch_size * block_score_stride_, stream_));
+            block_scores       = block_scores_buf_;
+            block_score_batch_ = dc_batch_size;
+        }
 
         // if (comm_.h_comm->rank() == 0) {
         //     std::stringstream ss;
@@ -1844,6 +4893,17 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
         //     TM_LOG_ERROR("%s", ss.str().c_str());
         // }
 
+        // the outputs of the last mini-batch are read from the temp buffers until the copies are done
+        if (output_spill_) {
+            output_spill_->Fence();
+        }
+
+        // the transport is held until the layers are sent
+        std::unique_lock<std::mutex> transport_lock;
+        if (pf_batch_size) {
+            StreamPrefillKv(g, first + dc_batch_size, last, transport_lock);
+        }
+
         model_->forwardUnified(decoder_output_buf_ + first * model_->hidden_units_,
                                context_decoder_output_buf_,  // temp
                                context_decoder_input_buf_,   // temp
@@ -1851,42 +4911,126 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
                                cu_block_counts_ + first,
                                context_decoder_ids_buf_,  // temp
                                h_input_length_buf_ + first,
-                               state_->h_context_length + first,
+                               h_k_len_buf_ + first,
                                rope_theta_ + first,
+                               evicted_len_buf_ ? evicted_len_buf_ + first : nullptr,
                                finished_buf_ + first,
                                sum_q,
-                               local_token_nums.data(),
+                               local_token_nums.data() + p * dp_size,
                                dc_batch_size,
                                pf_batch_size,
                                lora_mask_buf_,
-                               state_->sequences.data() + first);
+                               state_->sequences.data() + first,
+                               cascade_size ? cascade_buf_ : nullptr,
+                               cascade_size ? h_cascade_buf_ : nullptr,
+                               sparse_size ? sparse_buf_ : nullptr,
+                               sparse_size ? h_sparse_buf_ : nullptr,
+                               nullptr,
+                               cold_len_buf_ ? cold_len_buf_ + first : nullptr,
+                               h_cold_len_buf_ ? h_cold_len_buf_ + first : nullptr,
+                               block_scores,
+                               block_score_stride_,
+                               cow ? cow_blocks_ + first : nullptr,
+                               kv_error);
+
+        context_->linear->set_lora_batch(nullptr);
 
         ComputeAndOutputLogits(context_decoder_output_buf_, first, last);
         OutputLastHiddenState(context_decoder_output_buf_, first, last);
+        PoolHiddenStates(context_decoder_output_buf_, first, last);
+    }
+
+    model_->waitPipeline();
+
+    if (kv_error) {
+        check_cuda_error(cudaMemcpyAsync(
+            h_kv_error_, kv_error, sizeof(float) * 4 * model_->layer_num_, cudaMemcpyDeviceToHost, stream_));
+        check_cuda_error(cudaEventRecord(kv_error_event_, stream_));
+        kv_error_pending_ = true;
     }
 
-    if (active_size > g.partial) {
-        model_->postDecodeEmbedding(logits_buf_, local_logits_buf_, decoder_output_buf_, active_size - g.partial);
+    for (int i = 0; i < active_size; ++i) {
+        state_->h_context_length[i] -= draft_len;
+    }
 
-        AnomalyHandler::instance().FixLogits(logits_buf_, active_size - g.partial, 1);
+    // When verifying drafts, each iteration samples the next token of all sequences as a normal decoding step does.
+    // The iterations go on as long as every sequence sampled its draft token, as only then the KV cache and logits of
+    // the following position are valid. The results are thus identical to decoding without speculation.
+    int committed = 0;
+    while (active_size > g.partial) {
+        if (draft_len) {
+            const auto hidden_units = model_->hidden_units_;
+            check_cuda_error(cudaMemcpy2DAsync(decoder_output_buf_,
+                                               sizeof(T) * hidden_units,
+                                               context_decoder_output_buf_ + committed * hidden_units,
+                                               sizeof(T) * hidden_units * (draft_len + 1),
+                                               sizeof(T) * hidden_units,
+                                               active_size,
+                                               cudaMemcpyDefault,
+                                               stream_));
+        }
 
-        OutputLogits(logits_buf_, 0, active_size - g.partial, GenerationConfig::kGeneration);
+        if (profiler) {
+            profiler->Begin(StepProfiler::kSampling, -1, stream_);
+        }
 
         FT_CHECK(g.step >= 0);
 
-        if (!g.skip_init_sampling) {
+        if (!g.skip_init_sampling && !committed) {
             InitializeSampling(g);
         }
+
+        if (token_mask_) {
+            UploadTokenMasks(g);
+        }
+
+        // `decoder_output_buf_` is kept for the draft heads
+        const T* hidden_states = decoder_output_buf_;
+        if (fuse_temperature_) {
+            invokeScaleRows(scaled_decoder_output_buf_,
+                            decoder_output_buf_,
+                            inv_temperature_buf_,
+                            model_->hidden_units_,
+                            active_size - g.partial,
+                            stream_);
+            sync_check_cuda_error();
+            hidden_states = scaled_decoder_output_buf_;
+        }
+
+        T* logits = logits_buf_;
+        if (candidate_k_) {
+            logits = candidate_logits_buf_;
+            model_->postDecodeTopK(logits,
+                                   candidate_ids_buf_,
+                                   local_logits_buf_,
+                                   hidden_states,
+                                   active_size - g.partial,
+                                   candidate_k_);
+        }
+        else {
+            model_->postDecodeEmbedding(logits_buf_, local_logits_buf_, hidden_states, active_size - g.partial);
+
+            AnomalyHandler::instance().FixLogits(logits_buf_, active_size - g.partial, 1);
+
+            OutputLogits(logits_buf_, 0, active_size - g.partial, GenerationConfig::kGeneration);
+
+            // the logits are modified in place by the sampling
+            if (output_spill_) {
+                output_spill_->Fence();
+            }
+        }
         // stop-words & bad-words require the matched tokens to be contiguous, so item size > 1 is
         // not supported yet.
+        SetupBeams(g);
+
         model_->dynamicDecode(token_ids_buf_,
                               finished_buf_,
                               sequence_lengths_,
                               nullptr,
-                              state_->curand_state,
+                              state_->random_seed,
                               &inputs_,
                               &outputs_,
-                              logits_buf_,
+                              logits,
                               seq_limit_len_,
                               init_context_length_,
                               g.step,
@@ -1894,6 +5038,42 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
                               g.max_init_ctx_len,
                               session_len_ * 2,
                               active_size - g.partial);
+
+        if (profiler) {
+            profiler->End(StepProfiler::kSampling, -1, stream_);
+        }
+
+        if (++committed > draft_len) {
+            break;
+        }
+
+        Copy(token_ids_buf_ + g.step * active_size, active_size, h_output_ids_);
+        Copy(finished_buf_, active_size, state_->h_finished);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+
+        bool accepted = true;
+        for (int i = 0; i < active_size && accepted; ++i) {
+            const int draft = h_draft_ids_[i * param_.num_speculative_tokens + committed - 1];
+            accepted        = !state_->h_finished[i] && h_output_ids_[i] == draft;
+        }
+        if (!accepted) {
+            break;
+        }
+
+        g.step += 1;
+    }
+
+    // Drafts of the next step from the hidden states of the last sampled tokens, which are left in
+    // `decoder_output_buf_` by the iterations above
+    medusa_size_ = 0;
+    if (model_->medusa_num_heads() && active_size > g.partial) {
+        model_->medusaDecode(medusa_ids_buf_,
+                             logits_buf_,
+                             local_logits_buf_,
+                             medusa_buf_,
+                             decoder_output_buf_,
+                             active_size - g.partial);
+        medusa_size_ = active_size - g.partial;
     }
 
     std::fill(h_input_length_buf_, h_input_length_buf_ + active_size, 0);
@@ -1902,7 +5082,8 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
     for (int i = 0; i < active_size; ++i) {
         FT_CHECK((bool)state_->requests[i]);
         FT_CHECK(state_->sequences[i]);
-        state_->sequences[i]->cache_len += state_->sequences[i]->input_length;
+        // KV of the rejected draft tokens is dropped
+        state_->sequences[i]->cache_len += state_->sequences[i]->input_length + std::max(committed - 1, 0);
     }
 
     AnomalyHandler::instance().Summarize([&](const int* is_anomaly, int batch_size) {
@@ -1932,9 +5113,15 @@ bool LlamaBatch<T>::Forward(GenerationState& g)
     ////////////////////////////////////////////////
     /// ! increase the counters
     g.step += 1;
+    g.committed = std::max(committed, 1);
 
     // PrintDecodeTokens(token_ids_buf_, g.step, active_size, stream_, "Forward");
 
+    if (profiler) {
+        profiler->End(StepProfiler::kStep, -1, stream_);
+        profiler->EndStep();
+    }
+
     return true;
 }
 
@@ -1972,16 +5159,125 @@ struct TuningContext {
 
 }  // namespace
 
+template<class T>
+std::vector<int> LlamaBatch<T>::GatherTokenNums(std::vector<int>& offsets)
+{
+    auto count_tokens = [&](int p) {  //
+        return std::accumulate(h_input_length_buf_ + offsets[p], h_input_length_buf_ + offsets[p + 1], 0);
+    };
+
+    DpBatches local{(int)offsets.size() - 1};
+    for (int p = 0; p < std::min(local.n, DpBatches::kInline); ++p) {
+        local.token_nums[p] = count_tokens(p);
+    }
+    const auto batches = AllGather(comm_.h_dp_group, local);
+
+    int n_batches = 0;
+    for (const auto& b : batches) {
+        n_batches = std::max(n_batches, b.n);
+    }
+
+    // Populate empty batches
+    offsets.resize(n_batches + 1, offsets.back());
+
+    const int        dp_size = batches.size();
+    std::vector<int> token_nums(n_batches * dp_size);  // [n_batches, dp_size]
+
+    if (n_batches <= DpBatches::kInline) {
+        for (int d = 0; d < dp_size; ++d) {
+            for (int p = 0; p < batches[d].n; ++p) {
+                token_nums[p * dp_size + d] = batches[d].token_nums[p];
+            }
+        }
+        return token_nums;
+    }
+
+    // Too many mini-batches for the first round, gather the token counts of all the mini-batches
+    std::vector<int> gathered(dp_size * n_batches);  // [dp_size, n_batches]
+    int*             local_nums = gathered.data() + comm_.h_dp_group->rank() * n_batches;
+    for (int p = 0; p < n_batches; ++p) {
+        local_nums[p] = count_tokens(p);
+    }
+    AllGather(comm_.h_dp_group, gathered.data(), n_batches);
+
+    for (int d = 0; d < dp_size; ++d) {
+        for (int p = 0; p < n_batches; ++p) {
+            token_nums[p * dp_size + d] = gathered[d * n_batches + p];
+        }
+    }
+    return token_nums;
+}
+
+template<class T>
+void LlamaBatch<T>::TuneGemm(const std::vector<int>& bss)
+{
+    const auto                         max_bs = *std::max_element(bss.begin(), bss.end());
+    std::vector<int>                   input_ids(max_bs);
+    std::mt19937                       g{};
+    std::uniform_int_distribution<int> d{0, (int)model_->vocab_size_ - 1};
+    for (auto& x : input_ids) {
+        x = d(g);
+    }
+    Copy(input_ids.data(), max_bs, context_decoder_ids_buf_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    TuningContext context{*context_->linear, stream_};
+
+    /// NOTE: No explicit barrier can be used here as internal threads are waiting on it now
+    for (auto bs : bss) {
+        if (tp_rank_ == 0) {
+            TM_LOG_INFO("[Gemm2] %d", bs);
+        }
+        const int input_length     = bs;
+        auto      local_token_nums = AllGather(comm_.h_dp_group, bs);
+
+        model_->forwardUnified(decoder_output_buf_,
+                               context_decoder_output_buf_,
+                               context_decoder_input_buf_,
+                               (void**)block_ptrs_,  // invalid data
+                               cu_block_counts_,     // invalid data
+                               context_decoder_ids_buf_,
+                               &input_length,
+                               &input_length,
+                               rope_theta_,    // invalid data
+                               nullptr,
+                               finished_buf_,  // invalid data
+                               bs,
+                               local_token_nums.data(),
+                               0,
+                               1,
+                               nullptr,
+                               nullptr);
+    }
+
+    model_->waitPipeline();
+}
+
 template<class T>
 void LlamaBatch<T>::Warmup()
 {
     auto& linear = *context_->linear;
+
+    lazy_tuning_ = std::getenv("TM_GEMM_LAZY") != nullptr;
+
     if (auto str = std::getenv("TM_GEMM_IMPORT")) {
         std::ifstream ifs(str);
         const int     n_imported = linear.Import(ifs);
         if (tp_rank_ == 0) {
             TM_LOG_INFO("[Gemm2] %d records imported", n_imported);
         }
+        if (!lazy_tuning_) {
+            return;
+        }
+    }
+
+    if (lazy_tuning_) {
+        // Misses use the nearest larger tuned batch size (or the heuristic) and are tuned on idle steps
+        linear.set_measure(false);
+        tuning_block_ = allocator_->reMalloc(tuning_block_, sequence_manager_->block_size(), false);
+        if (tp_rank_ == 0) {
+            TM_LOG_INFO("[Gemm2] Lazy tuning enabled");
+        }
         return;
     }
 
@@ -1999,45 +5295,9 @@ void LlamaBatch<T>::Warmup()
     }
 
     if (!bss.empty()) {
-        const auto                         max_bs = *std::max_element(bss.begin(), bss.end());
-        std::vector<int>                   input_ids(max_bs);
-        std::mt19937                       g{};
-        std::uniform_int_distribution<int> d{0, (int)model_->vocab_size_ - 1};
-        for (auto& x : input_ids) {
-            x = d(g);
-        }
-        Copy(input_ids.data(), max_bs, context_decoder_ids_buf_);
-        check_cuda_error(cudaStreamSynchronize(stream_));
-
-        TuningContext context{linear, stream_};
-
         auto tick = std::chrono::steady_clock::now();
 
-        /// NOTE: No explicit barrier can be used here as internal threads are waiting on it now
-        for (auto bs : bss) {
-            if (tp_rank_ == 0) {
-                TM_LOG_INFO("[Gemm2] %d", bs);
-            }
-            const int input_length     = bs;
-            auto      local_token_nums = AllGather(comm_.h_dp_group, bs);
-
-            model_->forwardUnified(decoder_output_buf_,
-                                   context_decoder_output_buf_,
-                                   context_decoder_input_buf_,
-                                   (void**)block_ptrs_,  // invalid data
-                                   cu_block_counts_,     // invalid data
-                                   context_decoder_ids_buf_,
-                                   &input_length,
-                                   &input_length,
-                                   rope_theta_,    // invalid data
-                                   finished_buf_,  // invalid data
-                                   bs,
-                                   local_token_nums.data(),
-                                   0,
-                                   1,
-                                   nullptr,
-                                   nullptr);
-        }
+        TuneGemm(bss);
 
         auto tock = std::chrono::steady_clock::now();
 
@@ -2060,6 +5320,66 @@ void LlamaBatch<T>::Warmup()
     }
 }
 
+template<class T>
+void LlamaBatch<T>::TuneMisses()
+{
+    const auto misses = context_->linear->PopMisses();
+
+    std::vector<int> bss;
+    if (tp_rank_ == 0) {
+        for (const auto& bs : misses) {
+            if (bs <= max_forward_token_num_) {
+                tuning_queue_.insert(bs);
+            }
+        }
+        // A few shapes per step, new requests are received in between
+        while (!tuning_queue_.empty() && bss.size() < 4) {
+            bss.push_back(*tuning_queue_.begin());
+            tuning_queue_.erase(tuning_queue_.begin());
+        }
+    }
+
+    Broadcast(comm_.h_tp_group, bss, 0);
+
+    // The DP ranks run the passes together, shapes tuned already are skipped by the tuner
+    const int n = AllReduce(comm_.h_dp_group, (int)bss.size(), comm::RedOp::kMax);
+    if (n == 0) {
+        return;
+    }
+    bss.resize(n, bss.empty() ? 1 : bss.back());
+
+    // The cache blocks may hold live or cached sequences, the kv of the passes goes to a scratch block
+    const int block_seq_len = model_->attn_param_.cache_block_seq_len;
+    const int block_count   = (*std::max_element(bss.begin(), bss.end()) + block_seq_len - 1) / block_seq_len;
+    h_cu_block_counts_[0]   = 0;
+    h_cu_block_counts_[1]   = block_count;
+    std::fill_n(h_block_ptrs_, block_count, reinterpret_cast<uintptr_t>(tuning_block_));
+    Copy(h_cu_block_counts_, 2, cu_block_counts_);
+    Copy(h_block_ptrs_, block_count, block_ptrs_);
+
+    const auto tick = std::chrono::steady_clock::now();
+
+    TuneGemm(bss);
+
+    // the rows of the sequences coming back are rewritten
+    ResetBlockTable();
+
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    if (tp_rank_ == 0) {
+        const auto tock = std::chrono::steady_clock::now();
+        const auto str  = Join(bss.begin(), bss.end(), ", ");
+        TM_LOG_INFO("[Gemm2] Lazily tuned %s in %.2f seconds, %d pending",
+                    str.c_str(),
+                    std::chrono::duration<float, std::ratio<1, 1>>(tock - tick).count(),
+                    (int)tuning_queue_.size());
+        if (auto path = std::getenv("TM_GEMM_EXPORT")) {
+            std::ofstream ofs(path);
+            context_->linear->Export(ofs);
+        }
+    }
+}
+
 template<class T>
 void* LlamaBatch<T>::CommBufAlloc(size_t size, bool register_)
 {
@@ -2101,6 +5421,12 @@ void LlamaBatch<T>::DestroyCommunicators()
         comm_.h_comm->Sync();
 
         FreeCommBuffers();
+        if (kv_allocator_) {
+            // the chunks of the kv cache are owned by `d_comm`
+            model_->unified_decoder_->setBlockCopier(nullptr);
+            sequence_manager_.reset();
+            kv_allocator_.reset();
+        }
         comm_.h_comm->Sync();
 
         // Destroy device communicator
@@ -2109,6 +5435,12 @@ void LlamaBatch<T>::DestroyCommunicators()
         cudaStreamSynchronize(stream_);
         comm_.h_comm->Sync();
     }
+
+    if (comm_.d_pp_comm) {
+        cudaStreamSynchronize(stream_);
+        comm_.h_comm->Sync();
+        comm_.d_pp_comm = {};
+    }
 }
 
 template class LlamaBatch<half>;
@@ -2,20 +2,37 @@
 
 #pragma once
 
-#include <curand_kernel.h>
-
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+#include "src/turbomind/comm/kv_transport.h"
 #include "src/turbomind/engine/gateway.h"
 #include "src/turbomind/engine/request.h"
 
+#include "src/turbomind/kernels/beam_search_kernels.h"
+
 #include "src/turbomind/models/llama/Barrier.h"
 #include "src/turbomind/models/llama/SequenceManager.h"
 #include "src/turbomind/models/llama/context.h"
+#include "src/turbomind/models/llama/embedding_cache.h"
+#include "src/turbomind/models/llama/fair_share.h"
+#include "src/turbomind/models/llama/output_length_predictor.h"
+#include "src/turbomind/models/llama/l2_persist.h"
+#include "src/turbomind/models/llama/kv_streamer.h"
 #include "src/turbomind/models/llama/llama_kernels.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/lora_kernels.h"
+#include "src/turbomind/models/llama/output_spill.h"
+#include "src/turbomind/models/llama/token_masker.h"
 
 #include "src/turbomind/utils/allocator.h"
 #include "src/turbomind/utils/cublasMMWrapper.h"
 #include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/metrics.h"
 
 namespace turbomind {
 
@@ -24,13 +41,15 @@ struct BatchState {
     int*  h_context_length;
     bool* h_finished;
 
-    curandState_t* curand_state;
-    int*           output_ids;  // output ids in [B, S]
+    uint64_t* random_seed;  // the random draws are keyed by (seed, sequence length)
+    int*      output_ids;   // output ids in [B, S]
 
     float* h_rope_theta;
 
     std::vector<int> seq_len_limit;
 
+    std::vector<std::vector<int>> h_tokens;  // host copy of the rows of `output_ids` for the n-gram drafts
+
     std::vector<const Sequence*>          sequences;
     std::vector<std::shared_ptr<Request>> requests;
 
@@ -45,6 +64,9 @@ struct BatchState {
 template<typename T>
 class LlamaV2;
 
+template<typename T>
+struct LlamaWeight;
+
 struct GenerationState {
     int max_init_ctx_len;
     int step;
@@ -60,6 +82,12 @@ struct GenerationState {
     std::deque<int> min_input_count;
 
     int finished_count;
+
+    int draft_len;  // number of draft tokens of each sequence to be verified in this step
+    int committed;  // number of tokens generated for each sequence in this step
+
+    int prefill_tokens;  // prefill tokens scheduled in this step
+    int prefill_budget;  // max prefill tokens per step for `target_itl_ms`, 0 for no limit
 };
 
 template<typename T>
@@ -74,34 +102,147 @@ public:
     void FreeBuffer();
 
     using Requests = std::vector<std::shared_ptr<Request>>;
-    using Signal   = std::function<void()>;
 
     void DisableInvalidRequests(Requests& infer_reqs, Requests& kill_reqs);
 
+    // With `fair_share`, the free slots go to the tenants of the requests by deficit round robin, the rest is held back
+    void ShareSlots(Requests& infer_reqs, int free_slot_count);
+
+    // With `sjf_scheduling`, the requests are admitted shortest expected output first
+    void SortByOutputLength(Requests& infer_reqs);
+
+    void ReserveSlots(Requests& infer_reqs, int free_slot_count);
+
+    void AdmitRequests(Requests& infer_reqs, int free_slot_count);
+
+    // The requests held back for the sessions of `kill_reqs` are canceled, only used by rank-0
+    void DropDeferredRequests(const Requests& kill_reqs, std::vector<Signal>& signals);
+
+    // A beam search request takes a slot for each of its beams, the ones that don't fit are held back in order
+    void ReserveBeams(Requests& infer_reqs, int free_slot_count);
+
+    // Projected output length of a request of `prompt_len` tokens (history included) for admission control and
+    // `sjf_scheduling`, the same on all ranks with `sjf_scheduling`
+    int EstimateOutputLength(const Request& r, int prompt_len) const;
+
+    void UpdatePrefillBudget(int prefill_tokens, float step_ms);
+
+    void UpdateBatchLimit(int batch_size, float step_ms);
+
     void ProcessKillRequests(const Requests& reqs, std::vector<Signal>& signals);
 
     void ProcessInferRequests(const Requests& reqs, std::vector<Signal>& signals);
 
+    // Looks up the embeddings a request passes by their content hashes, false if any of them is not cached
+    bool ResolveEmbeddings(const Request& r, int input_length, std::vector<std::shared_ptr<const std::byte>>& refs);
+
+    // returns the error code when the transfer can't be started
+    int StartTransfer(const std::shared_ptr<Request>& r);
+
+    // Receives the blocks sent for a rejected import into a scratch block, so that the peer's sends complete and the
+    // later transfers between the pair stay matched
+    void DrainImport(const KvTransfer& t);
+
+    void PollTransfers(std::vector<Signal>& signals);
+
+    // Queues the blocks of the prompts completed by the prefills in [first, last) to the peers of their sessions, the
+    // forward sends them layer by layer. Returns the number of queued sequences, `lock` holds the transport when any
+    int StreamPrefillKv(const GenerationState& g, int first, int last, std::unique_lock<std::mutex>& lock);
+
     int AdjustMaxInputCount(GenerationState&                    g,
                             const std::vector<const Sequence*>& sequences,
                             const std::vector<int>&             context_length);
 
+    int ProposeDrafts(int holes);
+
+    // Forks the beams of the beam search requests after their first step into rows of `incoming_`
+    void ExpandBeams();
+
+    // The beams of a group step together, the ones of a group not completely in the step are moved out of it or
+    // recompute their last token. Returns the number of sequences moved out
+    int HoldBeams(const std::vector<const Sequence*>& sequences, std::vector<int>& context_lengths);
+
+    // Beam search groups of the rows in the step for `DynamicDecodeLayer`
+    void SetupBeams(const GenerationState& g);
+
+    // Takes the results of the beam search of the step, the kv caches of the beams follow their parents
+    void UpdateBeams();
+
+    // Keeps the best beam of the request at `index` in the row of its request and releases the others, returns the
+    // row. The tokens of the kept beam are copied to `tokens`
+    int ReleaseBeams(int index, bool force_stop, std::vector<int>& tokens);
+
     void Initialize(GenerationState& g);
 
+    // The block table has a row of `block_stride_` entries per slot, updated in place by the changed entries of the
+    // rows of the active sequences. Resets the offsets of the rows and marks the rows changed
+    void ResetBlockTable();
+
+    void UpdateBlockTable();
+
     void InitializeSampling(const GenerationState& g);
 
+    // Token bitmasks of the grammar constrained requests are filled on the host while the forward pass runs
+    void LaunchTokenMasks(const GenerationState& g);
+
+    void UploadTokenMasks(const GenerationState& g);
+
+    // Groups the decoding sequences by the prefix of cache blocks they share for cascade decoding, returns the size
+    // of the packed groups in `h_cascade_buf_` & `cascade_buf_`, 0 when there is no group worth it
+    int BuildCascade(int dc_batch_size);
+
+    // Sparse contexts of the decoding sequences longer than the block budget of block-sparse decoding, returns the
+    // size of the packed contexts in `h_sparse_buf_` & `sparse_buf_`, 0 when all sequences are attended in full
+    int BuildSparse(int dc_batch_size);
+
+    // Requantizes the recent blocks `src` of a tiered kv cache into the cold blocks `dst` on `stream_`, called by the
+    // sequence manager before the recent blocks are freed
+    void DemoteBlocks(const std::vector<void*>& src, const std::vector<void*>& dst);
+
     bool Forward(GenerationState& g);
 
+    // Re-selects the shared blocks of the persisting L2 window every few decoding steps, lifted for the prefills
+    void UpdateL2Persist(bool decode);
+
     void Finish(GenerationState& g, std::vector<Signal>& signals);
 
+    // Leaves the results of a decoding step on device when none of the sequences finished in the previous one, only
+    // the finish flags are copied to host. Read by the next `Finish` together with the ones of the step then
+    bool DeferFinish(GenerationState& g);
+
+    // Reads the results of the deferred steps before the batch may change
+    void FlushFinish(GenerationState& g, std::vector<Signal>& signals);
+
+    // No sequences come, go or move in the next `Initialize`
+    bool IsBatchSettled() const;
+
+    // Copies the new tokens of the streaming requests to host and hands them to `OutputThreadEntry`, tp rank 0 only
+    void LaunchOutput(const GenerationState& g);
+
+    // Waits for the output thread to be done with the launched outputs
+    void WaitOutput();
+
     [[nodiscard]] Signal Interrupt(int index, bool force_stop = false, bool force_end = false);
 
     void ComputeAndOutputLogits(T* hidden_states, int first, int last);
 
     void OutputLogits(const T* logits, int first, int last, GenerationConfig::OutType out_type);
 
+    // Gathers the logprobs of the prompt tokens of scoring requests from the logits of all the tokens
+    void OutputPromptLogprobs(const T* logits, int first, int last);
+
     void OutputLastHiddenState(const T* hidden_states, int first, int last);
 
+    // Reduces the hidden states of the prompt tokens of the pooling requests in the chunk on device, only `[hidden]`
+    // per request is copied to the host and accumulated into the outputs by `OutputPooledHiddenStates`
+    void PoolHiddenStates(const T* hidden_states, int first, int last);
+
+    // the stream is synchronized
+    void OutputPooledHiddenStates();
+
+    // pinned ring for the logits & hidden states requested by the prompts, created on first use
+    OutputSpill& GetOutputSpill();
+
     explicit LlamaBatch(const EngineParam&          param,
                         std::unique_ptr<LlamaV2<T>> model,
                         std::unique_ptr<Context<T>> ctx,
@@ -118,22 +259,64 @@ public:
         return *model_;
     }
 
+    Context<T>& context() noexcept
+    {
+        return *context_;
+    }
+
     int session_len() const noexcept
     {
         return session_len_;
     }
 
+    // As of the last schedule, thread-safe
+    SequenceManager::CacheStats GetCacheStats()
+    {
+        std::lock_guard lock{cache_stats_mutex_};
+        return cache_stats_;
+    }
+
     void Warmup();
 
+    // Transport for exporting / importing kv caches of sessions, may be set while the engine is running
+    void SetKvTransport(std::unique_ptr<comm::KvTransport> transport);
+
+    // Swap in the prepared `weights` of the same model at a step boundary, blocks until swapped. All the ranks must
+    // be given their weights, they swap at the same step. The prefix cache is flushed, the sessions are kept
+    void SwapWeights(std::shared_ptr<LlamaWeight<T>> weights);
+
 private:
     void FindCanceledIndices(std::vector<int>& indices);
 
     void ProcessCancelRequests(std::vector<int>& indices, std::vector<Signal>& signals);
 
+    // Whether the mini-batch [first, last) is the chunk of a canceled partial prefill, which is skipped
+    bool SkipCanceledPrefill(const GenerationState& g, int first, int last);
+
     void InternalThreadEntry();
 
     void OutputThreadEntry();
 
+    // Mini-batch count and token counts of the mini-batches of a DP rank, exchanged once per step
+    struct DpBatches {
+        static constexpr int kInline = 8;
+
+        int n;
+        int token_nums[kInline];
+    };
+
+    // Pads `offsets` to the mini-batch count of the sync DP ranks and returns the token counts of each mini-batch on
+    // every rank, [n_batches, dp_size]
+    std::vector<int> GatherTokenNums(std::vector<int>& offsets);
+
+    // Tuning passes of `bss` tokens, the GEMMs of each pass are measured
+    void TuneGemm(const std::vector<int>& bss);
+
+    // Tunes a few of the shapes that missed the dispatch cache, called on idle steps in lazy mode
+    void TuneMisses();
+
+    void SwapInWeights();
+
     void CopyState(const std::vector<std::tuple<BatchState*, BatchState*, int, int>>& desc);
 
     // analogs to `std::copy_n`
@@ -211,7 +394,7 @@ private:
     const int      device_id_;
     const int      dp_rank_;
     const int      tp_size_;
-    const int      tp_rank_;
+    const int      tp_rank_;  // in the TP ranks of all pipeline stages, 0 handles the requests
     const DataType data_type_;
     const bool     debug_;
 
@@ -222,10 +405,90 @@ private:
 
     int session_len_;  // May be truncated in ctor
 
+    // requests held back from the slots reserved for interactive requests, only used by rank-0
+    Requests deferred_;
+    // sessions of the requests dropped from `deferred_` by the kill requests of the step
+    std::vector<uint64_t> killed_deferred_;
+    // max prefill tokens per step, maintained by rank-0 and broadcast to `GenerationState::prefill_budget`
+    int prefill_budget_{};
+    // moving average of the output lengths of the finished requests for `admission_control`, only used by rank-0
+    float output_len_avg_{};
+    // max running sequences admitted by rank-0 for `target_itl_ms`, adapted on decode-only steps
+    int batch_limit_{};
+    // GPU time of the steps for `target_itl_ms`, only used by rank-0
+    cudaEvent_t step_start_event_{};
+    cudaEvent_t step_end_event_{};
+
+    std::mutex                  cache_stats_mutex_;
+    SequenceManager::CacheStats cache_stats_{};
+
+    // Updated by tp rank-0 of the DP rank, null on the other ranks
+    struct Metrics {
+        Counter*   steps;
+        Counter*   prefill_tokens;
+        Counter*   decode_tokens;
+        Counter*   finished;
+        Counter*   preempt_swap;
+        Counter*   preempt_recompute;
+        Histogram* batch_size;
+        Gauge*     active_blocks;
+        Gauge*     cached_blocks;
+        Gauge*     free_blocks;
+        Gauge*     l2_persist_bytes;
+        Histogram* kv_quant_error_k;
+        Histogram* kv_quant_error_v;
+    };
+    std::optional<Metrics> metrics_;
+
+    // Error of the quantized kv cache on the new tokens of a step in `kv_quant_error_interval`, per layer, measured on
+    // tp rank-0. The sums are read without blocking the stream once `kv_error_event_` completes, see `ObserveKvError`
+    float*      kv_error_buf_{};  // [layer_num, 4], see `invokeKvQuantError_`
+    float*      h_kv_error_{};
+    cudaEvent_t kv_error_event_{};
+    bool        kv_error_pending_{};
+    int64_t     kv_error_steps_{};
+
+    void ObserveKvError();
+
+    std::mutex                         transport_mutex_;
+    std::unique_ptr<comm::KvTransport> kv_transport_;
+    cudaStream_t                       transfer_stream_{};
+
+    struct PendingTransfer {
+        std::shared_ptr<Request> r;
+        const Sequence*          seq;
+        cudaEvent_t              event;
+    };
+    // kv cache transfers in flight, completed in order
+    std::deque<PendingTransfer> transfers_;
+
+    // sends the kv cache of the sessions with `kv_stream_flag` on `transfer_stream_` as the prefill writes it
+    std::unique_ptr<KvStreamer> kv_streamer_;
+
+    // weights staged by `SwapWeights`, taken by the engine thread
+    std::mutex                      weights_mutex_;
+    std::condition_variable         weights_cv_;
+    std::shared_ptr<LlamaWeight<T>> pending_weights_;
+
     std::unique_ptr<Context<T>>      context_;
     std::unique_ptr<LlamaV2<T>>      model_;
+    std::unique_ptr<IAllocator>      kv_allocator_;  // symmetric memory of `d_comm` for the kv cache, optional
     std::unique_ptr<SequenceManager> sequence_manager_;
 
+    std::unique_ptr<EmbeddingCache> embedding_cache_;
+
+    // tenants of the requests for `fair_share`, kept identically by all ranks, optional
+    std::unique_ptr<FairShare> fair_share_;
+
+    // output lengths of the finished requests for `sjf_scheduling`, kept identically by all ranks, optional
+    std::unique_ptr<OutputLengthPredictor> length_predictor_;
+
+    // persisting L2 window over the shared blocks of the decoding steps, optional
+    std::unique_ptr<L2Persist> l2_persist_;
+    int64_t                    l2_persist_steps_{};
+
+    std::unique_ptr<OutputSpill> output_spill_;
+
     Communicators& comm_;
 
     ///////////////////////////////////////////////////////////////////
@@ -233,12 +496,25 @@ private:
     int*       cu_block_counts_{};
     uintptr_t* block_ptrs_{};
 
+    // blocks the partial blocks of the forks are copied from by their first write, see `SetCopyOnFirstWrite`
+    bool   copy_on_first_write_{};
+    char** cow_blocks_{};
+    char** h_cow_blocks_{};
+
+    // descriptors of the sequence state copies, see `CopyState`
+    CopyDesc*             copy_table_{};
+    std::vector<CopyDesc> h_copy_table_;
+    cudaEvent_t           copy_state_event_{};  // guards the host staging rows of `incoming_`
+
     ////////////////////////////////////////////////////////////////////
     // context decoding temp buffers
     T*   context_decoder_input_buf_{};
     T*   context_decoder_output_buf_{};
     int* context_decoder_ids_buf_{};
     int* input_ids_buf_{};
+
+    void* d_state_rows_{};  // `context_length_buf_`, `finished_buf_` & `rope_theta_`, see `PlanStateRows`
+
     // lengths
     int* input_length_buf_{};    // input + cache missed length
     int* context_length_buf_{};  // history length + input_length
@@ -246,15 +522,43 @@ private:
 
     T*   decoder_input_buf_{};
     T*   decoder_output_buf_{};
-    int* sequence_lengths_{};  // current sequence length
+    int* sequence_lengths_{};
+
+    // With `fuse_temperature_` the LM head reads `decoder_output_buf_` scaled by the inverse temperatures
+    T*     scaled_decoder_output_buf_{};
+    float* inv_temperature_buf_{};
+    bool   fuse_temperature_{};  // current sequence length
     int* init_ctx_lens_{};
     int* lora_mask_buf_{};  // lora
 
+    // multi-LoRA
+    LoraTile* lora_tiles_buf_{};
+    float*    lora_buf_{};
+    LoraBatch lora_batch_{};
+
     T* logits_buf_{};        // combined logits
     T* local_logits_buf_{};  // tensor parallel local logits
     T* context_logits_buf_{};
     T* local_context_logits_buf_{};
 
+    int*   prompt_logprob_ids_buf_{};  // next token of each prompt token, -1 for the tokens not scored
+    float* prompt_logprobs_buf_{};
+
+    // sums of the pooled hidden states of the step [batch, hidden], created on first use
+    float* pool_buf_{};
+    float* h_pool_buf_{};
+    int*   pool_ranges_buf_{};
+    // [batch index, prompt tokens pooled before the step, prompt length] of the requests pooled in the step
+    std::vector<std::array<int, 3>> pooled_;
+
+    T*   candidate_logits_buf_{};  // top-k of the vocab shards [batch, tp, k]
+    int* candidate_ids_buf_{};
+    int  candidate_k_{};  // 0 when sampling from the full logits
+
+    T*   medusa_buf_{};      // [batch, hidden], hidden states of the draft heads
+    int* medusa_ids_buf_{};  // [num_heads, batch], drafts of the next step
+    int  medusa_size_{};     // batch size of the drafts, 0 when there are none
+
     size_t local_context_logits_buf_size_{};
 
     T*        sampled_logprobs_{};
@@ -265,6 +569,34 @@ private:
     uint32_t* h_sampled_nums_{};
 
     float* rope_theta_{};
+    int*   evicted_len_buf_{};  // sliding window kv cache
+
+    // cascade decoding, see `CascadeLayout`
+    int* cascade_buf_{};
+    int* h_cascade_buf_{};
+
+    // block-sparse decoding, see `SparseLayout`
+    int* sparse_buf_{};
+    int* h_sparse_buf_{};
+
+    // heavy-hitter eviction, the attention mass of the decoding tokens on their blocks every `kScoreInterval` steps,
+    // [batch_size, cdiv(session_len, block_len)]. Added to `Sequence::block_scores` when the step finishes
+    static constexpr int kScoreInterval = 8;
+
+    float* block_scores_buf_{};
+    float* h_block_scores_buf_{};
+    int    block_score_stride_{};
+    int    block_score_batch_{};  // decoding sequences scored by the last step
+
+    // tiered kv cache, tokens in the cold blocks of the sequences & the staging buffers of `DemoteBlocks`, which
+    // flattens the recent blocks to [H, 2, kDemoteChunk * block_len, D] before caching them again quantized
+    static constexpr int kDemoteChunk = 64;
+
+    int*       cold_len_buf_{};
+    int*       h_cold_len_buf_{};
+    T*         demote_kv_buf_{};
+    uintptr_t* demote_ptrs_{};  // [2, kDemoteChunk], src & dst
+    int*       demote_cu_{};    // [2, kDemoteChunk + 1], tokens & blocks of each
 
     // used by dynamic decoder
     int*      token_ids_buf_{};  // all token IDs in [S, B], indexed using `step`
@@ -274,28 +606,34 @@ private:
     int*      d_end_ids_buf_{};
 
     // pinned buffers
+    void*      h_arena_{};  // pinned memory of all the `h_*` staging buffers
     int*       h_input_ids_buf_{};
     int*       h_input_length_buf_{};
+    int*       h_k_len_buf_{};  // context length - evicted length
+    int*       h_evicted_len_buf_{};
     uint32_t*  h_seq_limit_len_{};
     int*       h_cu_block_counts_{};
-    uintptr_t* h_block_ptrs_{};
+    uintptr_t* h_block_ptrs_{};  // copy of `block_ptrs_`, the changed entries are read from it by the device
+
+    int              block_stride_{};    // entries of a row of the block table
+    std::vector<int> h_block_counts_{};  // valid entries of the rows of `h_block_ptrs_`
 
     int*   h_min_length_{};
+    int*   h_output_logprobs_{};
     int*   h_runtime_top_k_{};
     float* h_runtime_top_p_{};
     float* h_runtime_min_p_{};
     float* h_temperature_{};
+    float* h_inv_temperature_{};
     float* h_repetition_penalty_{};
-    int*   h_stop_words_{};  // [batch_size, 2, kMaxStopWordsLen]
-    int*   h_bad_words_{};
-    int*   d_stop_words_{};  // [batch_size, 2, kMaxStopWordsLen]
-    int*   d_bad_words_{};
+    float* h_frequency_penalty_{};
+    float* h_presence_penalty_{};
+    int*   h_bad_words_{};  // [batch_size, 2, kMaxStopWordsLen]
+    int*   d_bad_words_{};  // [batch_size, 2, kMaxStopWordsLen]
 
-    unsigned long long* h_random_seed_{};
-    unsigned long long* d_random_seed_{};
+    std::vector<int> h_stop_words_;  // [batch_size, 2, max_stop_words_len]
 
-    curandState_t* h_curand_state_{};
-    curandState_t* d_curand_state_{};
+    uint64_t* h_random_seed_{};
 
     std::array<BatchState, 3> states_{};
 
@@ -315,7 +653,57 @@ private:
 
     std::thread internal_thread_;
 
+    struct OutputJob {
+        std::vector<std::pair<std::shared_ptr<Request>, int>> requests;  // with their batch index
+        int                                                   batch_size;
+        int                                                   committed;
+    };
+
+    // Streaming outputs pushed by `OutputThreadEntry`, they are skipped by `Finish` unless the request finished
+    std::thread              output_thread_;
+    std::mutex               output_mutex_;
+    std::condition_variable  output_cv_;
+    std::optional<OutputJob> output_job_;
+    bool                     output_busy_{};
+    bool                     output_stop_{};
+    bool                     output_launched_{};  // by the current step
+    cudaEvent_t              output_event_{};
+
+    int*  h_stream_output_ids_{};  // [committed, batch_size]
+    int*  h_stream_seq_len_{};
+    bool* h_stream_finished_{};
+
+    // Steps with their results left on device by `DeferFinish`, the finish flags of the last one
+    int         pending_steps_{};
+    bool*       h_finish_flags_{};
+    cudaEvent_t finish_event_{};
+
     int* h_output_ids_{};
+    int* h_draft_ids_{};  // [max_batch_size, num_speculative_tokens]
+    int* h_medusa_ids_{};  // [num_heads, max_batch_size]
+
+    std::unique_ptr<TokenMasker> token_masker_;  // tp rank 0 only
+    uint32_t*                    h_token_bitmask_{};  // [max_batch_size, words], allocated on first use
+    uint32_t*                    d_token_bitmask_{};
+    int                          token_mask_words_{};
+    bool                         token_mask_{};  // the current step has constrained requests
+
+    // Beam search requests of the batch, the rows of their beams share the request
+    struct Beams {
+        std::vector<const Sequence*> seqs;     // of the beams, the 1st one is the sequence of the request
+        BeamSearchGroup              state;    // after the last step
+        std::vector<int>             history;  // tokens of the request after its 1st step, forked by `ExpandBeams`
+    };
+    std::unordered_map<const Request*, Beams> beams_;
+    std::vector<const Request*>               beam_step_;    // request of each group in the step, null for held ones
+    std::vector<const Sequence*>              beam_forced_;  // beams recomputing their last token in the step
+    BeamSearchGroup*                          h_beam_groups_{};  // [max_batch_size], allocated on first use
+    BeamSearchGroup*                          d_beam_groups_{};
+    bool                                      beams_reparented_{};  // block tables of the beams changed
+
+    bool          lazy_tuning_{};   // `TM_GEMM_LAZY`
+    std::set<int> tuning_queue_;    // tp rank 0 only
+    void*         tuning_block_{};  // receives the kv of lazy tuning passes
 };
 
 template<class T>
@@ -21,6 +21,7 @@
 #include "src/turbomind/models/llama/LlamaDecoderLayerWeight.h"
 #include "src/turbomind/kernels/gemm/cast.h"
 #include "src/turbomind/kernels/gemm/gemm.h"
+#include "src/turbomind/kernels/gemm/sparse.h"
 #include "src/turbomind/kernels/gemm/types.h"
 #include "src/turbomind/kernels/gpt_kernels.h"
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
@@ -59,7 +60,7 @@ LlamaDecoderLayerWeight<T>::LlamaDecoderLayerWeight(int                layer_id,
                                                     const LoraParam&   lora_param,
                                                     const MoeParam&    moe_param):
     head_num_(model.head_num),
-    kv_head_num_(model.kv_head_num),
+    kv_head_num_(GetLayerKvHeadNum(model, layer_id)),
     size_per_head_(model.head_dim),
     hidden_units_(model.hidden_units),
     inter_size_(model.inter_size.at(layer_id)),
@@ -68,7 +69,14 @@ LlamaDecoderLayerWeight<T>::LlamaDecoderLayerWeight(int                layer_id,
     attn_tp_size_(engine.attn_tp_size),
     attn_tp_rank_(engine.attn_tp_rank),
     mlp_tp_size_(engine.mlp_tp_size),
-    mlp_tp_rank_(engine.mlp_tp_rank)
+    mlp_tp_rank_(engine.mlp_tp_rank),
+    ep_size_(engine.ep_size),
+    ep_rank_(engine.ep_rank),
+    moe_replica_(engine.ep_size > 1 && engine.moe_replica_interval > 0),
+    fp8_linear_(engine.fp8_linear),
+    int8_linear_(engine.int8_linear),
+    w8a16_linear_(engine.w8a16_linear),
+    sparse_linear_(engine.sparse_linear)
 {
     self_attn_weights = LlamaAttentionWeight<T>{hidden_units_,
                                                 size_per_head_,
@@ -90,8 +98,14 @@ LlamaDecoderLayerWeight<T>::LlamaDecoderLayerWeight(int                layer_id,
         weight_type_ == WeightType::kINT4 && is_fuse_silu_act(),
     };
 
-    moe_weights = MoeFfnWeight<T>{
-        layer_id, moe_param, hidden_units_, weight_type_, model.group_size, mlp_tp_size_, is_fuse_silu_act()};
+    moe_weights = MoeFfnWeight<T>{layer_id,
+                                  moe_param,
+                                  hidden_units_,
+                                  weight_type_,
+                                  model.group_size,
+                                  mlp_tp_size_,
+                                  ep_size_,
+                                  is_fuse_silu_act()};
 
     if (lora_param.policy == LoraPolicy::kPlora) {
         std::vector<std::string> keys = {
@@ -130,7 +144,8 @@ LlamaDecoderLayerWeight<T>::LlamaDecoderLayerWeight(int                layer_id,
         }
     }
 
-    fused_up_and_gate_ = ffn_weights.gating.lora.policy != LoraPolicy::kPlora;
+    // multi-LoRA adapters are applied to the unfused w1 & w3
+    fused_up_and_gate_ = ffn_weights.gating.lora.policy != LoraPolicy::kPlora && !engine.max_loras;
 }
 
 template<typename T>
@@ -316,6 +331,117 @@ void LlamaDecoderLayerWeight<T>::free(cudaStream_t st)
     }
 }
 
+template<typename T>
+WeightPager::Buffers LlamaDecoderLayerWeight<T>::buffers()
+{
+    WeightPager::Buffers ret;
+
+    auto add = [&](auto& ptr, size_t size) {
+        if (ptr && size) {
+            ret.emplace_back((void**)&ptr, size);
+        }
+    };
+
+    auto add_dense = [&](LlamaDenseWeight<T>& w) {
+        w.for_each_buffer([&](void** ptr, size_t size) {
+            if (*ptr && size) {
+                ret.emplace_back(ptr, size);
+            }
+        });
+    };
+
+    auto& attn = self_attn_weights;
+    for (auto w : {&attn.qkv, &attn.output, &attn.q_proj, &attn.q_a_proj, &attn.q_b_proj, &attn.kv_a_proj}) {
+        add_dense(*w);
+    }
+    add_dense(attn.kv_b_proj);
+    if (attn.qkv.output_dims) {
+        add(attn.q_a_layernorm, sizeof(T) * attn.head_dim);
+        add(attn.kv_a_layernorm, sizeof(T) * attn.head_dim);
+    }
+    else {
+        add(attn.q_a_layernorm, sizeof(T) * attn.q_b_proj.input_dims);
+        add(attn.kv_a_layernorm, sizeof(T) * attn.kv_b_proj.input_dims);
+    }
+
+    if (inter_size_) {
+        auto& ffn = ffn_weights;
+        for (auto w : {&ffn.gating, &ffn.intermediate, &ffn.fused_gating_intermediate, &ffn.output}) {
+            add_dense(*w);
+        }
+    }
+
+    FT_CHECK_WITH_INFO(moe_weights.experts.empty(), "paging of the MoE weights is not supported");
+
+    return ret;
+}
+
+template<typename T>
+void LlamaDecoderLayerWeight<T>::snapshot(WeightSnapshot& s)
+{
+    FT_CHECK_WITH_INFO(moe_weights.experts.empty(), "snapshots of the MoE weights are not supported");
+
+    s.Buffer((void**)&self_attn_norm_weights, sizeof(T) * hidden_units_);
+    s.Buffer((void**)&ffn_norm_weights, sizeof(T) * hidden_units_);
+
+    auto& attn = self_attn_weights;
+    for (auto w : {&attn.qkv, &attn.output, &attn.q_proj, &attn.q_a_proj, &attn.q_b_proj, &attn.kv_a_proj}) {
+        SnapshotDense(s, *w);
+    }
+    SnapshotDense(s, attn.kv_b_proj);
+    if (attn.qkv.output_dims) {
+        s.Buffer((void**)&attn.q_a_layernorm, sizeof(T) * attn.head_dim);
+        s.Buffer((void**)&attn.kv_a_layernorm, sizeof(T) * attn.head_dim);
+    }
+    else {
+        s.Buffer((void**)&attn.q_a_layernorm, sizeof(T) * attn.q_b_proj.input_dims);
+        s.Buffer((void**)&attn.kv_a_layernorm, sizeof(T) * attn.kv_b_proj.input_dims);
+    }
+
+    if (inter_size_) {
+        auto& ffn = ffn_weights;
+        for (auto w : {&ffn.gating, &ffn.intermediate, &ffn.fused_gating_intermediate, &ffn.output}) {
+            SnapshotDense(s, *w);
+        }
+    }
+}
+
+template<typename T>
+std::vector<WeightPager::Buffers> LlamaDecoderLayerWeight<T>::expert_buffers()
+{
+    FT_CHECK_WITH_INFO(fused_up_and_gate_ && moe_weights.method == MoeParam::kFused,
+                       "the expert cache requires the fused MoE method with fused w1 & w3");
+
+    std::vector<WeightPager::Buffers> ret;
+    for (auto& e : moe_weights.experts) {
+        auto& b      = ret.emplace_back();
+        auto& fused  = e.fused_gating_intermediate;
+        auto& output = e.output;
+        b.emplace_back((void**)&fused.kernel, fused.kernel_size());
+        b.emplace_back((void**)&output.kernel, output.kernel_size());
+        // fused scales & zeros
+        if (fused.scales_zeros) {
+            b.emplace_back((void**)&fused.scales_zeros, fused.scales_size() * 2);
+            b.emplace_back((void**)&output.scales_zeros, output.scales_size() * 2);
+        }
+    }
+    return ret;
+}
+
+template<typename T>
+std::vector<void*> LlamaDecoderLayerWeight<T>::expert_tables()
+{
+    auto& fused  = moe_weights.block.fused_gating_intermediate;
+    auto& output = moe_weights.block.output;
+
+    std::vector<void*> ret{fused.kernel, output.kernel};
+    if (fused.scales_zeros) {
+        ret.push_back(fused.scales_zeros);
+        ret.push_back(output.scales_zeros);
+    }
+    return ret;
+}
+
 template<typename T>
 LlamaDecoderLayerWeight<T>::~LlamaDecoderLayerWeight() = default;
 
@@ -338,11 +464,15 @@ void LlamaDecoderLayerWeight<T>::loadModel(std::string dir_path, FtCudaDataType
     }
     else {
         loadWeights(moe_weights.gate, dir_path + ".moe_ffn.gate", type);
+        // experts are not split with expert parallelism
+        const size_t rank = ep_size_ > 1 ? 0 : mlp_tp_rank_;
+        const size_t size = ep_size_ > 1 ? 1 : mlp_tp_size_;
         for (size_t i = 0; i < moe_weights.experts.size(); ++i) {
-            std::string weight_name = dir_path + ".moe_ffn.experts." + std::to_string(i);
-            loadWeights(moe_weights.experts[i].gating, weight_name + ".w1", mlp_tp_rank_, type, mlp_tp_size_);
-            loadWeights(moe_weights.experts[i].intermediate, weight_name + ".w3", mlp_tp_rank_, type, mlp_tp_size_);
-            loadWeights(moe_weights.experts[i].output, weight_name + ".w2", mlp_tp_rank_, type, mlp_tp_size_);
+            const size_t e           = ep_rank_ * moe_weights.experts.size() + i;
+            std::string  weight_name = dir_path + ".moe_ffn.experts." + std::to_string(e);
+            loadWeights(moe_weights.experts[i].gating, weight_name + ".w1", rank, type, size);
+            loadWeights(moe_weights.experts[i].intermediate, weight_name + ".w3", rank, type, size);
+            loadWeights(moe_weights.experts[i].output, weight_name + ".w2", rank, type, size);
         }
     }
 }
@@ -412,11 +542,15 @@ TensorMap LlamaDecoderLayerWeight<T>::getParams(std::string prefix)
             concat(prefix, "moe_ffn.gate.weight"),
             Tensor{MEMORY_GPU, getTensorType<T>(), {moe_weights.gate.kernel_size()}, moe_weights.gate.kernel});
         auto& experts = moe_weights.experts;
+        // global expert ids, experts are not split with expert parallelism
+        auto get_expert = [&](size_t i, std::string_view name) {
+            return ep_size_ > 1 ? concat(prefix, "moe_ffn.experts", ep_rank_ * experts.size() + i, name, 0) :
+                                  get_mlp(concat("moe_ffn.experts", i, name));
+        };
         for (size_t i = 0; i < experts.size(); ++i) {
-            const std::string name = "moe_ffn.experts." + std::to_string(i);
-            getWeightTensor(experts[i].gating, false, get_mlp(concat(name, "w1")), output);
-            getWeightTensor(experts[i].intermediate, false, get_mlp(concat(name, "w3")), output);
-            getWeightTensor(experts[i].output, false, get_mlp(concat(name, "w2")), output);
+            getWeightTensor(experts[i].gating, false, get_expert(i, "w1"), output);
+            getWeightTensor(experts[i].intermediate, false, get_expert(i, "w3"), output);
+            getWeightTensor(experts[i].output, false, get_expert(i, "w2"), output);
         }
         if (moe_weights.shared_gate.kernel) {
             output.insert(concat(prefix, "moe_ffn.shared_gate.weight"),
@@ -504,10 +638,6 @@ convert_fp(LlamaDenseWeight<T>& weight, bool is_fused_moe, void* workspace, size
 {
     using namespace gemm;
 
-    if (!is_fused_moe) {
-        return;
-    }
-
     const auto [order_b, pack_b, order_v, pack_v] =
         get_weight_and_scales_layout(get_data_type_v<T>, is_fused_moe, getSMVersion(), use_simt);
 
@@ -548,6 +678,193 @@ convert_fp(LlamaDenseWeight<T>& weight, bool is_fused_moe, void* workspace, size
     weight.k_desc = dst;
 }
 
+// Quantize f16/bf16 weights to K-major fp8 (e4m3) or int8 with per-channel f32 scales
+template<class T>
+static void
+convert_w8(LlamaDenseWeight<T>& weight, gemm::DataType dtype, void* workspace, size_t size, cudaStream_t st)
+{
+    using namespace gemm;
+
+    const int input_dim  = weight.input_dims;
+    const int output_dim = weight.output_dims;
+
+    FT_CHECK(sizeof(T) * input_dim * output_dim <= size);
+
+    const auto [order_b, pack_b, order_v, pack_v] =
+        get_weight_and_scales_layout(dtype, false, getSMVersion(), false);
+
+    FT_CHECK(order_b == kColMajor && pack_b == 0);
+
+    invokeTransposeAxis01((uint16_t*)workspace, (uint16_t*)weight.kernel, input_dim, output_dim, 1, st);
+    sync_check_cuda_error();
+
+    deviceFree(weight.kernel, st);
+    deviceMalloc((char**)&weight.kernel, (size_t)input_dim * output_dim, st);
+    deviceMalloc((float**)&weight.scales_zeros, output_dim, st);
+
+    if (dtype == gemm::DataType::S8) {
+        quant_s8_rowwise((int8_t*)weight.kernel,
+                         input_dim,
+                         (float*)weight.scales_zeros,
+                         (const T*)workspace,
+                         input_dim,
+                         output_dim,
+                         input_dim,
+                         st);
+    }
+    else {
+        quant_fp8_rowwise((fp8_e4m3*)weight.kernel,
+                          input_dim,
+                          (float*)weight.scales_zeros,
+                          (const T*)workspace,
+                          input_dim,
+                          output_dim,
+                          input_dim,
+                          st);
+    }
+    sync_check_cuda_error();
+
+    weight.type = dtype == gemm::DataType::S8 ? WeightType::kINT8 : WeightType::kFP8;
+
+    weight.k_desc = {dtype, kColMajor, input_dim, output_dim, input_dim};
+    weight.q_desc = {gemm::DataType::F32, kRowMajor, 1, output_dim, output_dim};
+}
+
+// Quantize f16 weights to u8 (or u4) with group-wise scales & zeros, packed like the u4 weights for the weight-only
+// kernels
+static void convert_u8(LlamaDenseWeight<half>& weight,
+                       bool                    is_fused_moe,
+                       void*                   workspace,
+                       size_t                  size,
+                       cudaStream_t            st,
+                       gemm::DataType          dtype = gemm::DataType::U8)
+{
+    using namespace gemm;
+
+    constexpr int group_size = 128;
+
+    const int bits = dtype == gemm::DataType::U4 ? 4 : 8;
+
+    const int input_dim  = weight.input_dims;
+    const int output_dim = weight.output_dims;
+
+    FT_CHECK(sizeof(uint16_t) * input_dim * output_dim <= size);
+
+    const auto [order_b, pack_b, order_v, pack_v] =
+        get_weight_and_scales_layout(dtype, is_fused_moe, getSMVersion(), false);
+
+    const int scale_count = input_dim / group_size * output_dim;
+
+    deviceMalloc(&weight.scales, scale_count, st);
+    deviceMalloc(&weight.zeros, scale_count, st);
+
+    // u8 values extended to u16 in (k, n) row-major
+    quant_u8_groupwise((uint16_t*)workspace,
+                       weight.scales,
+                       weight.zeros,
+                       (const half*)weight.kernel,
+                       input_dim,
+                       output_dim,
+                       group_size,
+                       st,
+                       bits);
+    sync_check_cuda_error();
+
+    if (order_b == kColMajor) {
+        check_cuda_error(cudaMemcpyAsync(
+            weight.kernel, workspace, sizeof(uint16_t) * input_dim * output_dim, cudaMemcpyDefault, st));
+        invokeTransposeAxis01((uint16_t*)workspace, (uint16_t*)weight.kernel, input_dim, output_dim, 1, st);
+        sync_check_cuda_error();
+    }
+
+    deviceFree(weight.kernel, st);
+    deviceMalloc((char**)&weight.kernel, (size_t)input_dim * output_dim * bits / 8, st);
+
+    MatrixLayout w_desc{
+        gemm::DataType::F16,
+        order_b,
+        input_dim,   // k
+        output_dim,  // n
+        order_b == kRowMajor ? output_dim : input_dim,
+    };
+
+    MatrixLayout k_desc = w_desc;
+    k_desc.type         = dtype;
+    k_desc.pack         = pack_b;
+
+    FT_CHECK(Convert(workspace, w_desc, weight.kernel, k_desc, st) == 0);
+    sync_check_cuda_error();
+
+    fuse_scales_and_zeros((half*)workspace, weight.scales, weight.zeros, scale_count, st);
+    sync_check_cuda_error();
+
+    deviceFree(weight.scales, st);
+    deviceFree(weight.zeros, st);
+
+    deviceMalloc((half**)&weight.scales_zeros, scale_count * 2, st);
+
+    MatrixLayout s_desc{
+        gemm::DataType::U32,
+        order_v,
+        input_dim / group_size,  // k
+        output_dim,              // n
+        output_dim,
+    };
+
+    MatrixLayout q_desc = s_desc;
+    q_desc.pack         = pack_v;
+
+    FT_CHECK(Convert(workspace, s_desc, weight.scales_zeros, q_desc, st) == 0);
+    sync_check_cuda_error();
+
+    weight.type       = dtype == gemm::DataType::U4 ? WeightType::kINT4 : WeightType::kUINT8;
+    weight.group_size = group_size;
+
+    weight.k_desc = k_desc;
+    weight.q_desc = q_desc;
+}
+
+// Compress the weights pruned 2:4 along k, the dense weights are kept when they are not 2:4 sparse
+template<class T>
+static bool convert_sparse(LlamaDenseWeight<T>& weight, void* workspace, size_t size, cudaStream_t st)
+{
+    const int input_dim  = weight.input_dims;
+    const int output_dim = weight.output_dims;
+
+    const size_t values_size = sizeof(T) * input_dim * output_dim / 2;
+    const size_t meta_size   = sizeof(uint16_t) * input_dim / 16 * output_dim;
+
+    FT_CHECK(values_size + meta_size + sizeof(int) <= size);
+
+    auto values     = (T*)workspace;
+    auto meta       = (uint16_t*)((char*)workspace + values_size);
+    auto violations = (int*)((char*)meta + meta_size);
+
+    check_cuda_error(cudaMemsetAsync(violations, 0, sizeof(int), st));
+    compress_sparse_24(values, meta, violations, (const T*)weight.kernel, input_dim, output_dim, st);
+    sync_check_cuda_error();
+
+    int count{};
+    check_cuda_error(cudaMemcpyAsync(&count, violations, sizeof(int), cudaMemcpyDefault, st));
+    check_cuda_error(cudaStreamSynchronize(st));
+
+    if (count) {
+        TM_LOG_DEBUG("[convert_sparse] %d groups of %d x %d are not 2:4 sparse", count, input_dim, output_dim);
+        return false;
+    }
+
+    deviceFree(weight.kernel, st);
+    deviceMalloc((T**)&weight.kernel, (size_t)input_dim * output_dim / 2, st);
+    deviceMalloc(&weight.meta, (size_t)input_dim / 16 * output_dim, st);
+
+    check_cuda_error(cudaMemcpyAsync(weight.kernel, values, values_size, cudaMemcpyDefault, st));
+    check_cuda_error(cudaMemcpyAsync(weight.meta, meta, meta_size, cudaMemcpyDefault, st));
+
+    weight.type = WeightType::kSPARSE;
+
+    return true;
+}
+
 template<class T>
 static void
 convert(LlamaDenseWeight<T>& weight, bool is_fused_moe, void* workspace, size_t size, bool use_simt, cudaStream_t st)
@@ -560,7 +877,7 @@ convert(LlamaDenseWeight<T>& weight, bool is_fused_moe, void* workspace, size_t
             FT_CHECK(0);
         }
     }
-    else {
+    else if (is_fused_moe) {
         convert_fp(weight, is_fused_moe, workspace, size, use_simt, st);
     }
 }
@@ -641,8 +958,37 @@ void LlamaDecoderLayerWeight<T>::prepare(void* workspace, size_t size, const cud
 {
     const bool is_16xx = is_16xx_series(prop.name);
 
-    convert(self_attn_weights.qkv, false, workspace, size, is_16xx, st);
-    convert(self_attn_weights.output, false, workspace, size, is_16xx, st);
+    auto convert_ = [&](LlamaDenseWeight<T>& weight, bool is_fused_moe) {
+        // the fp8/int8 kernels require `k % 128 == 0` and vectorized access of the per-channel scales
+        const bool use_w8 = (fp8_linear_ || int8_linear_) && !is_fused_moe && sizeof(T) == 2
+                            && weight.type != WeightType::kINT4 && weight.input_dims % 128 == 0
+                            && weight.output_dims % 16 == 0;
+        // the weight-only kernels are instantiated for f16 with groups of 128 along k
+        const bool use_u8 = w8a16_linear_ && std::is_same_v<T, half> && weight.type != WeightType::kINT4
+                            && weight.input_dims % 128 == 0 && weight.output_dims % 8 == 0;
+        // the sparse kernel is instantiated for 16-bit weights with tiles of 64 in both n and k
+        const bool use_sparse = sparse_linear_ && weight.kernel && !is_fused_moe && weight.type != WeightType::kINT4
+                                && weight.input_dims % 64 == 0 && weight.output_dims % 64 == 0;
+        if constexpr (sizeof(T) == 2) {
+            if (use_sparse && convert_sparse(weight, workspace, size, st)) {
+                return;
+            }
+        }
+        if (use_w8) {
+            convert_w8(weight, int8_linear_ ? gemm::DataType::S8 : gemm::DataType::F8_E4M3, workspace, size, st);
+        }
+        else if (use_u8) {
+            if constexpr (std::is_same_v<T, half>) {
+                convert_u8(weight, is_fused_moe, workspace, size, st);
+            }
+        }
+        else {
+            convert(weight, is_fused_moe, workspace, size, is_16xx, st);
+        }
+    };
+
+    convert_(self_attn_weights.qkv, false);
+    convert_(self_attn_weights.output, false);
 
     auto process_ffn = [&](LlamaFfnWeight<T>& ffn, bool is_fused_moe) {
         if (fused_up_and_gate_) {
@@ -657,17 +1003,17 @@ void LlamaDecoderLayerWeight<T>::prepare(void* workspace, size_t size, const cud
                 chunk(fused_up_and_gate, ffn.gating, ffn.intermediate, workspace, size, st);
             }
 
-            convert(ffn.fused_gating_intermediate, is_fused_moe, workspace, size, is_16xx, st);
+            convert_(ffn.fused_gating_intermediate, is_fused_moe);
 
             ffn.gating.free(st);
             ffn.intermediate.free(st);
         }
         else {
-            convert(ffn.gating, is_fused_moe, workspace, size, is_16xx, st);
-            convert(ffn.intermediate, is_fused_moe, workspace, size, is_16xx, st);
+            convert_(ffn.gating, is_fused_moe);
+            convert_(ffn.intermediate, is_fused_moe);
         }
 
-        convert(ffn.output, is_fused_moe, workspace, size, is_16xx, st);
+        convert_(ffn.output, is_fused_moe);
     };
 
     if (inter_size_) {
@@ -698,6 +1044,32 @@ void LlamaDecoderLayerWeight<T>::prepare(void* workspace, size_t size, const cud
             }
         }
 
+        if (moe_replica_) {
+            FT_CHECK(fused_up_and_gate_);
+            // same layout as the local experts, the content is copied from the owner when the slot is assigned
+            auto& replica = moe_weights.replica;
+            replica       = moe_weights.experts.at(0);
+            for (auto w : {&replica.fused_gating_intermediate, &replica.output}) {
+                deviceMalloc((char**)&w->kernel, w->kernel_size(), st);
+                if (w->scales_zeros) {
+                    deviceMalloc((char**)&w->scales_zeros, w->scales_size() * 2, st);
+                }
+            }
+            replica.gating       = {};
+            replica.intermediate = {};
+
+            const auto& fused  = replica.fused_gating_intermediate;
+            const auto& output = replica.output;
+
+            fused_ptrs.push_back({fused.kernel, fused.k_desc.ld});
+            output_ptrs.push_back({output.kernel, output.k_desc.ld});
+
+            if (fused.scales_zeros) {
+                fused_param_ptrs.emplace_back(fused.scales_zeros, fused.q_desc.ld);
+                output_param_ptrs.emplace_back(output.scales_zeros, output.q_desc.ld);
+            }
+        }
+
         // Note: This assumes all experts has the same shape
         moe_weights.block = moe_weights.experts.at(0);
 
@@ -714,13 +1086,32 @@ void LlamaDecoderLayerWeight<T>::prepare(void* workspace, size_t size, const cud
         }
 
         fused.k_desc.ld = output.k_desc.ld = 0;
-        fused.k_desc.num = output.k_desc.num = moe_weights.experts.size();
+        fused.k_desc.num = output.k_desc.num = fused_ptrs.size();
 
         fused.q_desc.ld = output.q_desc.ld = 0;
-        fused.q_desc.num = output.q_desc.num = moe_weights.experts.size();
+        fused.q_desc.num = output.q_desc.num = fused_ptrs.size();
     }
 }
 
+void quantize_weight_only(
+    LlamaDenseWeight<half>& weight, gemm::DataType dtype, void* workspace, size_t size, cudaStream_t st)
+{
+    FT_CHECK(dtype == gemm::DataType::U8 || dtype == gemm::DataType::U4);
+    convert_u8(weight, false, workspace, size, st, dtype);
+}
+
+template<class T>
+void pack_dense_weight(LlamaDenseWeight<T>& weight, void* workspace, size_t size, cudaStream_t st)
+{
+    FT_CHECK(sizeof(T) * weight.input_dims * weight.output_dims <= size);
+    convert_fp(weight, false, workspace, size, false, st);
+}
+
+template void pack_dense_weight(LlamaDenseWeight<half>&, void*, size_t, cudaStream_t);
+#ifdef ENABLE_BF16
+template void pack_dense_weight(LlamaDenseWeight<__nv_bfloat16>&, void*, size_t, cudaStream_t);
+#endif
+
 #ifdef ENABLE_FP32
 template struct LlamaDecoderLayerWeight<float>;
 #endif
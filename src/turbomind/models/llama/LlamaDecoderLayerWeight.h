@@ -22,6 +22,8 @@
 
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/weight_pager.h"
+#include "src/turbomind/models/llama/weight_snapshot.h"
 #include "src/turbomind/utils/Tensor.h"
 
 namespace turbomind {
@@ -53,6 +55,18 @@ public:
 
     void free(cudaStream_t st);
 
+    // Device buffers of the prepared linear weights, the norm weights are excluded as the next layer's are read by the
+    // current one
+    WeightPager::Buffers buffers();
+
+    // Device buffers of the prepared routed experts & the blocked pointers of `moe_weights.block` referring to them,
+    // entry `e` of the i-th table is the i-th buffer of expert `e`
+    std::vector<WeightPager::Buffers> expert_buffers();
+    std::vector<void*>                expert_tables();
+
+    // Write or restore the prepared weights of the layer
+    void snapshot(WeightSnapshot& s);
+
     T* self_attn_norm_weights{};
     T* ffn_norm_weights{};
 
@@ -61,6 +75,9 @@ public:
     LlamaFfnWeight<T> ffn_weights{};
     MoeFfnWeight<T>   moe_weights{};
 
+    // pages the linear weights in from the host, null when they are resident
+    WeightPager* pager{};
+
 private:
     size_t     head_num_;
     size_t     kv_head_num_;
@@ -74,8 +91,25 @@ private:
     size_t     attn_tp_rank_;
     size_t     mlp_tp_size_;
     size_t     mlp_tp_rank_;
+    size_t     ep_size_;
+    size_t     ep_rank_;
+    bool       moe_replica_;
     bool       is_maintain_buffer_ = false;
     bool       fused_up_and_gate_;
+    bool       fp8_linear_;
+    bool       int8_linear_;
+    bool       w8a16_linear_;
+    bool       sparse_linear_;
 };
 
+// Quantizes f16 weights (k, n) to u8 or u4 with groups of 128 along k for the weight-only kernels. `workspace` holds
+// at least a copy of the weights
+void quantize_weight_only(
+    LlamaDenseWeight<half>& weight, gemm::DataType dtype, void* workspace, size_t size, cudaStream_t st);
+
+// Packs f16/bf16 weights (k, n) for the dense kernels of the gemm library (sm80+) in place of cuBLAS. `workspace`
+// holds at least a copy of the weights
+template<class T>
+void pack_dense_weight(LlamaDenseWeight<T>& weight, void* workspace, size_t size, cudaStream_t st);
+
 }  // namespace turbomind
@@ -21,6 +21,7 @@
 
 #include "src/turbomind/kernels/gemm/types.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/lora_kernels.h"
 #include "src/turbomind/models/llama/weight_type.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/memory_utils.h"
@@ -28,6 +29,8 @@
 
 namespace turbomind {
 
+class ExpertCache;
+
 inline LoraPolicy getLoraPolicy(const std::string& policy)
 {
     if (policy == "plora") {
@@ -54,14 +57,16 @@ struct LlamaDenseWeight {
     T*         scales       = nullptr;
     T*         zeros        = nullptr;
     T*         scales_zeros = nullptr;
+    uint16_t*  meta         = nullptr;  // 2:4 sparsity metadata
     int        group_size   = 1;
 
     LoraWeight lora;
+    LoraLayout adapter;  // multi-LoRA
 
     gemm::MatrixLayout k_desc;
     gemm::MatrixLayout q_desc;
 
-    LlamaDenseWeight(): type{}, lora{}, k_desc{}, q_desc{} {}
+    LlamaDenseWeight(): type{}, lora{}, adapter{}, k_desc{}, q_desc{} {}
 
     LlamaDenseWeight(size_t input_dim, size_t output_dim, WeightType type, int group_size): LlamaDenseWeight{}
     {
@@ -91,6 +96,23 @@ struct LlamaDenseWeight {
         return {sizeof(T) * input_dims * lora.r, sizeof(T) * lora.r * output_dims};
     }
 
+    // All the device buffers & their bytes in the current format, the null ones included
+    template<class F>
+    void for_each_buffer(F&& f)
+    {
+        f((void**)&kernel, kernel_size());
+        f((void**)&bias, bias_size());
+        f((void**)&scales, scales_size());
+        f((void**)&zeros, scales_size());
+        // packed u4/u8 scales & zeros, or per-channel f32 scales of the 8-bit weights
+        const bool grouped = type == WeightType::kINT4 || type == WeightType::kUINT8;
+        f((void**)&scales_zeros, grouped ? scales_size() * 2 : sizeof(float) * output_dims);
+        f((void**)&meta, sizeof(uint16_t) * input_dims / 16 * output_dims);
+        const auto [a_size, b_size] = lora_size();
+        f((void**)&lora.a, a_size);
+        f((void**)&lora.b, b_size);
+    }
+
     void malloc(cudaStream_t st, bool with_bias = false)
     {
         if (with_bias) {
@@ -120,6 +142,7 @@ struct LlamaDenseWeight {
         deviceFree(bias, st);
         deviceFree(scales, st);
         deviceFree(zeros, st);
+        deviceFree(meta, st);
         deviceFree(lora.a, st);
         deviceFree(lora.b, st);
     }
@@ -288,6 +311,7 @@ struct MoeFfnWeight {
                  WeightType      weight_type,
                  int             group_size,
                  size_t          tp,
+                 size_t          ep,
                  bool            fuse_silu_act)
     {
 
@@ -308,11 +332,17 @@ struct MoeFfnWeight {
         gate.type        = get_default_weight_type<T>();
         gate.group_size  = group_size;
 
-        experts.resize(expert_num);
+        // with expert parallelism each rank holds a contiguous range of whole experts
+        FT_CHECK(expert_num % ep == 0);
+        experts.resize(expert_num / ep);
 
         method        = param.method;
         fuse_silu_act = fuse_silu_act && method == MoeParam::kFused;
 
+        if (ep > 1) {
+            tp = 1;
+        }
+
         for (auto& e : experts) {
             // inter size is divided by tp in `FfnWeight`
             e = LlamaFfnWeight<T>{hidden_dim, (size_t)param.inter_size, tp, weight_type, group_size, fuse_silu_act};
@@ -348,6 +378,9 @@ struct MoeFfnWeight {
             e.free(st);
         }
         block.free(st);
+        deviceFree(replica.fused_gating_intermediate.scales_zeros, st);
+        deviceFree(replica.output.scales_zeros, st);
+        replica.free(st);
     }
 
     LlamaDenseWeight<T>            gate;
@@ -358,7 +391,16 @@ struct MoeFfnWeight {
     // reference into `experts`
     LlamaFfnWeight<T> block;
 
+    // spare slot for a hot expert of another rank with expert parallelism, the last expert of `block`
+    LlamaFfnWeight<T> replica;
+
     MoeParam::Method method{};
+
+    // the experts of `block` live in the host memory & are paged in by the cache, null when they are resident
+    ExpertCache* cache{};
+
+    // gate of the next cached layer, predicts the experts to prefetch from the input of this one
+    const LlamaDenseWeight<T>* next_gate{};
 };
 
 }  // namespace turbomind
@@ -21,6 +21,7 @@
 #include "src/turbomind/kernels/activation_kernels.h"
 #include "src/turbomind/models/llama/llama_utils.h"
 #include "src/turbomind/utils/anomaly_handler.h"
+#include "src/turbomind/utils/monotonic.h"
 #include "src/turbomind/utils/nvtx_utils.h"
 
 namespace turbomind {
@@ -31,8 +32,14 @@ void LlamaFfnLayer<T>::allocateBuffer(
 {
     const size_t sz = token_num * inter_size;
 
-    gating_buf_ = (T*)allocator_->reMalloc(gating_buf_, sizeof(T) * sz * inter_buf_factor, false);
-    inter_buf_  = gating_buf_ + sz;
+    if (scratch_numel_) {
+        FT_CHECK_WITH_INFO(sz * inter_buf_factor <= scratch_numel_,
+                           fmtstr("%d tokens exceed the planned scratch", (int)token_num));
+    }
+    else {
+        gating_buf_ = (T*)allocator_->reMalloc(gating_buf_, sizeof(T) * sz * inter_buf_factor, false);
+    }
+    inter_buf_ = gating_buf_ + sz;
 
     if (gating_lora_r + inter_lora_r) {
         lora_buf_ = (T*)allocator_->reMalloc(lora_buf_, sizeof(T) * token_num * (gating_lora_r + inter_lora_r));
@@ -41,11 +48,29 @@ void LlamaFfnLayer<T>::allocateBuffer(
     is_allocate_buffer_ = true;
 }
 
+template<typename T>
+size_t LlamaFfnLayer<T>::PlanScratch(void* base, size_t max_tokens, size_t max_inter_size)
+{
+    T*        gating{};
+    Monotonic alloc{base};
+    alloc(&gating, max_tokens * max_inter_size * 2);  // gating & intermediate
+
+    if (base) {
+        FT_CHECK(!is_allocate_buffer_);
+        gating_buf_    = gating;
+        scratch_numel_ = max_tokens * max_inter_size * 2;
+    }
+
+    return (char*)alloc.ptr() - (char*)base;
+}
+
 template<typename T>
 void LlamaFfnLayer<T>::freeBuffer()
 {
     if (is_allocate_buffer_) {
-        allocator_->free((void**)&gating_buf_);
+        if (!scratch_numel_) {
+            allocator_->free((void**)&gating_buf_);
+        }
         allocator_->free((void**)&lora_buf_);
         is_allocate_buffer_ = false;
     }
@@ -69,31 +94,21 @@ void LlamaFfnLayer<T>::activation(int token_num, int inter_size, bool is_chunked
 }
 
 template<typename T>
-void LlamaFfnLayer<T>::forward(TensorMap*               output_tensors,
-                               const TensorMap*         input_tensors,
-                               const LlamaFfnWeight<T>* weights)
+void LlamaFfnLayer<T>::forward(const ForwardParam& param, const LlamaFfnWeight<T>* weights)
 {
-    /**
-     * input_tensors:
-     *   \param ffn_input [token_num, hidden_dimension]
-     *
-     * output_tensors:
-     *   \param ffn_output [token_num, hidden_dimension]
-     */
-
     NvtxScope scope("ffn");
 
-    const size_t token_num  = input_tensors->at("ffn_input").shape[0];
-    const int    layer_id   = input_tensors->getVal<int>("layer_id");
+    const size_t token_num  = param.token_num;
+    const int    layer_id   = param.layer_id;
     const int    inter_size = weights->inter_size;
 
     const bool is_fused_silu = weights->fused_gating_intermediate.kernel && weights->is_fused_silu;
 
     allocateBuffer(token_num, inter_size, is_fused_silu ? 1 : 2, weights->gating.lora.r, weights->intermediate.lora.r);
 
-    const T* ffn_input_data  = input_tensors->at("ffn_input").getPtr<T>();
-    T*       ffn_output_data = output_tensors->at("ffn_output").getPtr<T>();
-    int*     lora_mask = input_tensors->at("lora_mask", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<int>();
+    const T*   ffn_input_data  = param.input;
+    T*         ffn_output_data = param.output;
+    int*       lora_mask       = param.lora_mask;
 
     if (weights->fused_gating_intermediate.kernel) {
         NvtxScope scope("fused_silu_ffn");
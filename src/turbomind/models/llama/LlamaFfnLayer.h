@@ -30,10 +30,13 @@ template<typename T>
 class LlamaFfnLayer {
 public:
     LlamaFfnLayer(const ModelParam& model, const Context<T>& ctx):
-        hidden_units_(model.hidden_units),
-        stream_(ctx.stream),
-        linear_(ctx.linear.get()),
-        allocator_(ctx.allocator.get())
+        LlamaFfnLayer(model, ctx.stream, ctx.linear.get(), ctx.allocator.get())
+    {
+    }
+
+    // On a stream other than the one of the context, with a linear of that stream
+    LlamaFfnLayer(const ModelParam& model, cudaStream_t stream, LlamaLinear<T>* linear, IAllocator* allocator):
+        hidden_units_(model.hidden_units), stream_(stream), linear_(linear), allocator_(allocator)
     {
     }
 
@@ -42,7 +45,25 @@ public:
         freeBuffer();
     }
 
-    void forward(TensorMap* output_tensors, const TensorMap* input_tensors, const LlamaFfnWeight<T>* weights);
+    struct ForwardParam {
+        T*         output;     // [token_num, hidden_units], may be `input`
+        const T*   input;      // [token_num, hidden_units]
+        int        token_num;
+        int        layer_id;
+        int*       lora_mask;  // [token_num], optional
+    };
+
+    void forward(const ForwardParam& param, const LlamaFfnWeight<T>* weights);
+
+    // Places the gating & intermediate buffers of up to `max_tokens` tokens at `base` instead of reallocating them
+    // when the shape changes, returns the bytes needed. A null `base` only computes the size
+    size_t PlanScratch(void* base, size_t max_tokens, size_t max_inter_size);
+
+    // buffers referenced by the kernels, used to validate captured graphs
+    std::vector<void*> buffers() const
+    {
+        return {gating_buf_, lora_buf_};
+    }
 
 private:
     void allocateBuffer(
@@ -62,6 +83,8 @@ private:
     T* inter_buf_{};
     T* lora_buf_{};
 
+    size_t scratch_numel_{};  // capacity of `gating_buf_` in the planned scratch
+
     bool is_allocate_buffer_{};
 };
 
@@ -1,9 +1,14 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/gemm/cast.h"
 #include "src/turbomind/kernels/gemm/gemm.h"
+#include "src/turbomind/kernels/gemm/sparse.h"
 #include "src/turbomind/kernels/gemm/types.h"
 #include "src/turbomind/models/llama/LlamaLinear.h"
 #include "src/turbomind/models/llama/llama_decoder_kernels.h"
+#include "src/turbomind/models/llama/lora_kernels.h"
+#include "src/turbomind/utils/string_utils.h"
 #include <fstream>
 
 namespace turbomind {
@@ -26,6 +31,7 @@ struct LlamaLinear<T>::Impl {
     {
         cudaFreeAsync(workspace_.barriers, stream_);
         cudaFreeAsync(workspace_.partials, stream_);
+        cudaFreeAsync(fp8_buf_, stream_);
         workspace_ = {};
     }
 
@@ -40,6 +46,7 @@ struct LlamaLinear<T>::Impl {
         if (input_data.pitch == 0) {
             input_data.pitch = weight.input_dims;
         }
+        CheckFp8Input(output_data, input_data.ptr);
         if (lora_mask != nullptr && weight.lora.r > 0) {
             FT_CHECK(type == kGemm);
             // output = lora(x) * scale
@@ -76,20 +83,69 @@ struct LlamaLinear<T>::Impl {
 
             type = kFusedAdd;
         }
+        if (lora_batch_ && weight.adapter.offset >= 0) {
+            FT_CHECK(type != kFusedSiluFfn);
+            forwardBase(output_data, input_data, batch_size, weight, type);
+            invokeLoraForward(output_data,
+                              weight.output_dims,
+                              input_data.ptr,
+                              input_data.pitch,
+                              weight.input_dims,
+                              weight.output_dims,
+                              weight.adapter,
+                              *lora_batch_,
+                              stream_);
+            return;
+        }
+        forwardBase(output_data, input_data, batch_size, weight, type);
+    }
+
+    void forward_pitched(
+        T* output_data, int output_pitch, Pitched input_data, int batch_size, const LlamaDenseWeight<T>& weight)
+    {
+        if (input_data.pitch == 0) {
+            input_data.pitch = weight.input_dims;
+        }
+        CheckFp8Input(output_data, input_data.ptr);
+        forwardBase(output_data, input_data, batch_size, weight, kGemm, output_pitch);
+    }
+
+    // `output_pitch` of 0 for the packed output of the GEMM
+    void forwardBase(T*                         output_data,
+                     Pitched                    input_data,
+                     int                        batch_size,
+                     const LlamaDenseWeight<T>& weight,
+                     Type                       type,
+                     int                        output_pitch = 0)
+    {
         switch (weight.type) {
             case WeightType::kFP16:
             case WeightType::kFP32:
             case WeightType::kBF16:
-                return forwardFp(output_data, input_data, batch_size, weight, type);
+                return forwardFp(output_data, output_pitch, input_data, batch_size, weight, type);
             case WeightType::kINT4:
-                return forwardInt4(output_data, input_data, batch_size, weight, type);
+            case WeightType::kUINT8:
+                return forwardInt4(output_data, output_pitch, input_data, batch_size, weight, type);
+            case WeightType::kFP8:
+            case WeightType::kINT8:
+                return forwardW8A8(output_data, output_pitch, input_data, batch_size, weight, type);
+            case WeightType::kSPARSE:
+                return forwardSparse(output_data, output_pitch, input_data, batch_size, weight, type);
             default:
                 FT_CHECK(0);
         }
     }
 
-    void forwardFp(T* output_data, Pitched input_data, int batch_size, const LlamaDenseWeight<T>& weight, Type type)
+    void forwardFp(T*                         output_data,
+                   int                        output_pitch,
+                   Pitched                    input_data,
+                   int                        batch_size,
+                   const LlamaDenseWeight<T>& weight,
+                   Type                       type)
     {
+        if (weight.k_desc.pack) {
+            return forwardPacked(output_data, output_pitch, input_data, batch_size, weight, type);
+        }
         cublas_wrapper_->Gemm(CUBLAS_OP_N,
                               CUBLAS_OP_N,
                               weight.output_dims,
@@ -100,17 +156,107 @@ struct LlamaLinear<T>::Impl {
                               input_data.ptr,
                               input_data.pitch,
                               output_data,
-                              weight.output_dims,
+                              output_pitch ? output_pitch : (int)weight.output_dims,
                               1.0f,
                               type == kFusedAdd ? 1.0f : 0.0f);
         // sync_check_cuda_error();
     }
 
-    void forwardInt4(T* output_data, Pitched input_data, int batch_size, const LlamaDenseWeight<T>& weight, Type type)
+    // f16/bf16 weights packed for the dense kernels of the gemm library
+    void forwardPacked(T*                         output_data,
+                       int                        output_pitch,
+                       Pitched                    input_data,
+                       int                        batch_size,
+                       const LlamaDenseWeight<T>& weight,
+                       Type                       type)
     {
         using namespace gemm;
 
-        const Operation operation{dispatch_policy_,
+        const Operation operation{policy(),
+                                  type == kFusedSiluFfn ? Epilogue::kGatedSilu : Epilogue::kNone,
+                                  {QuantType::kNone},
+                                  {QuantType::kNone},
+                                  0,
+                                  {},
+                                  nullptr};
+
+        const MatrixLayout a_desc{
+            get_data_type_v<T>,
+            kRowMajor,
+            batch_size,
+            (int)weight.input_dims,
+            input_data.pitch,
+        };
+
+        const MatrixLayout c_desc{
+            get_data_type_v<T>,
+            kRowMajor,
+            batch_size,
+            (int)weight.output_dims,
+            output_pitch ? output_pitch : type == kFusedSiluFfn ? (int)weight.output_dims / 2 : (int)weight.output_dims,
+        };
+
+        auto ec = gemm().Run(operation,
+                            1.f,
+                            input_data.ptr,
+                            a_desc,
+                            nullptr,
+                            {},
+                            weight.kernel,
+                            weight.k_desc,
+                            nullptr,
+                            {},
+                            type == kFusedAdd ? 1.0f : 0.0f,
+                            output_data,
+                            c_desc,
+                            output_data,
+                            c_desc,
+                            workspace_,
+                            stream_);
+
+        if (ec) {
+            TM_LOG_ERROR("%s: %d", __PRETTY_FUNCTION__, ec);
+        }
+    }
+
+    // 2:4 sparse weights compressed at load time
+    void forwardSparse(T*                         output_data,
+                       int                        output_pitch,
+                       Pitched                    input_data,
+                       int                        batch_size,
+                       const LlamaDenseWeight<T>& weight,
+                       Type                       type)
+    {
+        if constexpr (sizeof(T) == 2) {
+            FT_CHECK(input_data.pitch % 8 == 0);
+            sparse_gemm_24(output_data,
+                           output_pitch ? output_pitch : (int)weight.output_dims,
+                           input_data.ptr,
+                           input_data.pitch,
+                           (const T*)weight.kernel,
+                           weight.meta,
+                           batch_size,
+                           (int)weight.output_dims,
+                           (int)weight.input_dims,
+                           type == kFusedAdd ? 1.f : 0.f,
+                           stream_);
+        }
+        else {
+            FT_CHECK(0);
+        }
+    }
+
+    // group-wise quantized u4/u8 weights
+    void forwardInt4(T*                         output_data,
+                     int                        output_pitch,
+                     Pitched                    input_data,
+                     int                        batch_size,
+                     const LlamaDenseWeight<T>& weight,
+                     Type                       type)
+    {
+        using namespace gemm;
+
+        const Operation operation{policy(),
                                   type == kFusedSiluFfn ? Epilogue::kGatedSilu : Epilogue::kNone,
                                   {QuantType::kNone},
                                   {QuantType::kDefault, weight.group_size},
@@ -131,10 +277,10 @@ struct LlamaLinear<T>::Impl {
             kRowMajor,
             batch_size,
             (int)weight.output_dims,
-            type == kFusedSiluFfn ? (int)weight.output_dims / 2 : (int)weight.output_dims,
+            output_pitch ? output_pitch : type == kFusedSiluFfn ? (int)weight.output_dims / 2 : (int)weight.output_dims,
         };
 
-        auto ec = gemm_.Run(operation,
+        auto ec = gemm().Run(operation,
                             1.f,
                             input_data.ptr,
                             a_desc,
@@ -158,6 +304,124 @@ struct LlamaLinear<T>::Impl {
         }
     }
 
+    // fp8 (e4m3) or int8 weights, the activations are quantized per-token to the same type
+    void forwardW8A8(T*                         output_data,
+                     int                        output_pitch,
+                     Pitched                    input_data,
+                     int                        batch_size,
+                     const LlamaDenseWeight<T>& weight,
+                     Type                       type)
+    {
+        using namespace gemm;
+
+        if constexpr (std::is_same_v<T, float>) {
+            FT_CHECK_WITH_INFO(0, "fp8/int8 linear requires f16/bf16 activations");
+        }
+        else {
+            const int k = weight.input_dims;
+            const int n = weight.output_dims;
+
+            const bool is_int8 = weight.type == WeightType::kINT8;
+
+            // per-token quantization of the activations, unless the producer of the input has done it (fp8 only)
+            const auto [a_data, a_scales] = GetFp8Buffer(batch_size, k);
+            if (is_int8) {
+                const auto s8_data = (int8_t*)a_data;
+                quant_s8_rowwise(s8_data, k, a_scales, input_data.ptr, input_data.pitch, batch_size, k, stream_);
+                sync_check_cuda_error();
+                // the buffer no longer holds the prepared fp8 input
+                fp8_src_ = nullptr;
+            }
+            else if (input_data.ptr != fp8_src_ || batch_size != fp8_m_ || k != fp8_k_ || input_data.pitch != k) {
+                quant_fp8_rowwise(a_data, k, a_scales, input_data.ptr, input_data.pitch, batch_size, k, stream_);
+                sync_check_cuda_error();
+            }
+
+            const Operation operation{policy(),
+                                      type == kFusedSiluFfn ? Epilogue::kGatedSilu : Epilogue::kNone,
+                                      {QuantType::kChannel},
+                                      {QuantType::kChannel},
+                                      0,
+                                      {},
+                                      nullptr};
+
+            const MatrixLayout a_desc{is_int8 ? DataType::S8 : DataType::F8_E4M3, kRowMajor, batch_size, k, k};
+            const MatrixLayout u_desc{DataType::F32, kColMajor, batch_size, 1, batch_size};
+
+            const MatrixLayout c_desc{
+                get_data_type_v<T>,
+                kRowMajor,
+                batch_size,
+                n,
+                output_pitch ? output_pitch : type == kFusedSiluFfn ? n / 2 : n,
+            };
+
+            auto ec = gemm().Run(operation,
+                                1.f,
+                                a_data,
+                                a_desc,
+                                a_scales,
+                                u_desc,
+                                weight.kernel,
+                                weight.k_desc,
+                                weight.scales_zeros,
+                                weight.q_desc,
+                                type == kFusedAdd ? 1.0f : 0.0f,
+                                output_data,
+                                c_desc,
+                                output_data,
+                                c_desc,
+                                workspace_,
+                                stream_);
+
+            if (ec) {
+                TM_LOG_ERROR("%s: %d", __PRETTY_FUNCTION__, ec);
+            }
+        }
+    }
+
+    static size_t Fp8BufferSize(int m, int k)
+    {
+        return round_up<size_t>((size_t)m * k, 128) + sizeof(float) * m;
+    }
+
+    void ReserveFp8Buffer(int max_m, int max_k)
+    {
+        const size_t size = Fp8BufferSize(max_m, max_k);
+        if (size > fp8_buf_size_) {
+            check_cuda_error(cudaFreeAsync(fp8_buf_, stream_));
+            check_cuda_error(cudaMallocAsync(&fp8_buf_, size, stream_));
+            fp8_buf_size_ = size;
+            fp8_src_      = nullptr;
+        }
+    }
+
+    // fp8 (or int8) activations followed by their per-token scales, in the buffer reserved at construction which
+    // never moves, so that captured CUDA graphs keep pointing to it
+    std::pair<fp8_e4m3*, float*> GetFp8Buffer(int m, int k)
+    {
+        FT_CHECK_WITH_INFO(Fp8BufferSize(m, k) <= fp8_buf_size_,
+                           fmtstr("[LlamaLinear] fp8/int8 activations [%d, %d] exceed the reserved buffer", m, k));
+        const size_t data_size = round_up<size_t>((size_t)m * k, 128);
+        return {(fp8_e4m3*)fp8_buf_, (float*)((char*)fp8_buf_ + data_size)};
+    }
+
+    std::pair<fp8_e4m3*, float*> PrepareFp8Input(const T* src, int m, int k)
+    {
+        fp8_src_ = src;
+        fp8_m_   = m;
+        fp8_k_   = k;
+        return GetFp8Buffer(m, k);
+    }
+
+    // The prepared fp8 input stays valid for consecutive GEMMs reading `src` that don't write it
+    void CheckFp8Input(const T* output, const T* input)
+    {
+        if (input != fp8_src_ || output == fp8_src_) {
+            fp8_src_ = nullptr;
+        }
+    }
+
     void forward_moe(T*                         output_data,
                      Pitched                    input_data,
                      const int*                 indexes,
@@ -165,23 +429,28 @@ struct LlamaLinear<T>::Impl {
                      int                        batch_size,
                      const LlamaDenseWeight<T>& weight,
                      Type                       type,
-                     gemm::Context*             context)
+                     gemm::Context*             context,
+                     const int*                 scatter_idxs,
+                     const float*               scatter_scales)
     {
         using namespace gemm;
 
+        CheckFp8Input(output_data, input_data.ptr);
+
+        // rows of the result are weighted & added to the rows `scatter_idxs` of the output
+        auto epilogue = type == kFusedSiluFfn ? Epilogue::kGatedSilu : Epilogue::kNone;
+        if (scatter_idxs) {
+            epilogue = Epilogue::kScatterAdd;
+        }
+
         QuantDesc quant_b{};
-        if (weight.k_desc.type == gemm::DataType::U4) {
+        if (weight.k_desc.type == gemm::DataType::U4 || weight.k_desc.type == gemm::DataType::U8) {
             quant_b.type       = QuantType::kDefault;
             quant_b.group_size = weight.group_size;
         }
 
-        const Operation operation{dispatch_policy_,
-                                  type == kFusedSiluFfn ? Epilogue::kGatedSilu : Epilogue::kNone,
-                                  {QuantType::kNone},
-                                  quant_b,
-                                  0,
-                                  context,
-                                  nullptr};
+        const Operation operation{
+            policy(), epilogue, {QuantType::kNone}, quant_b, 0, context, nullptr, scatter_idxs, scatter_scales};
 
         MatrixLayout a_desc{
             get_data_type_v<T>,
@@ -209,7 +478,7 @@ struct LlamaLinear<T>::Impl {
 
         a_desc.num = c_desc.num = weight.k_desc.num;
 
-        auto ec = gemm_.Run(operation,
+        auto ec = gemm().Run(operation,
                             1.f,
                             input_data.ptr,
                             a_desc,
@@ -233,12 +502,33 @@ struct LlamaLinear<T>::Impl {
         }
     }
 
-    cublasMMWrapper*     cublas_wrapper_;
-    gemm::Gemm           gemm_;
-    gemm::DispatchPolicy dispatch_policy_{gemm::DispatchPolicy::kDefault};
-    cudaStream_t         stream_{};
+    // the kernels are dispatched by `base_` when set, this one only owns the workspace of its stream
+    gemm::Gemm& gemm()
+    {
+        return base_ ? base_->gemm_ : gemm_;
+    }
+
+    gemm::DispatchPolicy policy() const
+    {
+        return base_ ? base_->dispatch_policy_ : dispatch_policy_;
+    }
+
+    cublasMMWrapper*      cublas_wrapper_;
+    gemm::Gemm            gemm_;
+    gemm::DispatchPolicy  dispatch_policy_{gemm::DispatchPolicy::kDefault};
+    cudaStream_t          stream_{};
+    std::shared_ptr<Impl> base_;
 
     gemm::Workspace workspace_;
+
+    void*  fp8_buf_{};
+    size_t fp8_buf_size_{};
+
+    const T* fp8_src_{};
+    int      fp8_m_{};
+    int      fp8_k_{};
+
+    const LoraBatch* lora_batch_{};
 };
 
 template<class T>
@@ -247,6 +537,13 @@ LlamaLinear<T>::LlamaLinear(cublasMMWrapper* cublas_wrapper, cudaStream_t stream
 {
 }
 
+template<class T>
+LlamaLinear<T>::LlamaLinear(const LlamaLinear& base, cublasMMWrapper* cublas_wrapper, cudaStream_t stream):
+    impl_{std::make_shared<Impl>(cublas_wrapper, stream)}
+{
+    impl_->base_ = base.impl_;
+}
+
 template<class T>
 void LlamaLinear<T>::forward(T*                         output_data,
                              Pitched                    input_data,
@@ -259,6 +556,13 @@ void LlamaLinear<T>::forward(T*                         output_data,
     impl_->forward(output_data, input_data, batch_size, weight, type, lora_buff, lora_mask);
 }
 
+template<class T>
+void LlamaLinear<T>::forward_pitched(
+    T* output_data, int output_pitch, Pitched input_data, int batch_size, const LlamaDenseWeight<T>& weight)
+{
+    impl_->forward_pitched(output_data, output_pitch, input_data, batch_size, weight);
+}
+
 template<class T>
 void LlamaLinear<T>::forward_moe(T*                         output_data,
                                  Pitched                    input_data,
@@ -267,9 +571,30 @@ void LlamaLinear<T>::forward_moe(T*                         output_data,
                                  int                        batch_size,
                                  const LlamaDenseWeight<T>& weight,
                                  Type                       type,
-                                 gemm::Context*             context)
+                                 gemm::Context*             context,
+                                 const int*                 scatter_idxs,
+                                 const float*               scatter_scales)
+{
+    impl_->forward_moe(
+        output_data, input_data, indexes, offsets, batch_size, weight, type, context, scatter_idxs, scatter_scales);
+}
+
+template<class T>
+void LlamaLinear<T>::ReserveFp8Buffer(int max_m, int max_k)
 {
-    impl_->forward_moe(output_data, input_data, indexes, offsets, batch_size, weight, type, context);
+    impl_->ReserveFp8Buffer(max_m, max_k);
+}
+
+template<class T>
+std::pair<fp8_e4m3*, float*> LlamaLinear<T>::PrepareFp8Input(const T* src, int m, int k)
+{
+    return impl_->PrepareFp8Input(src, m, k);
+}
+
+template<class T>
+void LlamaLinear<T>::InvalidateFp8Input()
+{
+    impl_->fp8_src_ = nullptr;
 }
 
 template<class T>
@@ -278,11 +603,30 @@ void LlamaLinear<T>::set_measure(bool measure)
     impl_->dispatch_policy_ = measure ? gemm::DispatchPolicy::kMeasure : gemm::DispatchPolicy::kReuse;
 }
 
+template<class T>
+void LlamaLinear<T>::set_batch_invariant(bool batch_invariant)
+{
+    impl_->gemm().SetBatchInvariant(batch_invariant);
+    impl_->cublas_wrapper_->setBatchInvariant(batch_invariant);
+}
+
+template<class T>
+void LlamaLinear<T>::set_lora_batch(const LoraBatch* batch)
+{
+    impl_->lora_batch_ = batch;
+}
+
+template<class T>
+const LoraBatch* LlamaLinear<T>::lora_batch() const
+{
+    return impl_->lora_batch_;
+}
+
 template<class T>
 int LlamaLinear<T>::Export(std::ostream& os)
 {
     if (os) {
-        return impl_->gemm_.Export(os);
+        return impl_->gemm().Export(os);
     }
     return 0;
 }
@@ -292,7 +636,7 @@ int LlamaLinear<T>::Import(std::istream& is)
 {
     auto n_records = 0;
     if (is) {
-        n_records = impl_->gemm_.Import(is);
+        n_records = impl_->gemm().Import(is);
     }
     if (n_records) {
         impl_->dispatch_policy_ = gemm::DispatchPolicy::kReuse;
@@ -303,7 +647,13 @@ int LlamaLinear<T>::Import(std::istream& is)
 template<class T>
 std::vector<int> LlamaLinear<T>::GetTuningSeq() const
 {
-    return impl_->gemm_.GetTuningSeq();
+    return impl_->gemm().GetTuningSeq();
+}
+
+template<class T>
+std::vector<int> LlamaLinear<T>::PopMisses()
+{
+    return impl_->gemm().PopMisses();
 }
 
 #ifdef ENABLE_FP32
@@ -27,6 +27,10 @@ public:
 
     LlamaLinear(cublasMMWrapper* cublas_wrapper, cudaStream_t stream);
 
+    // GEMMs on another stream, running concurrently with those of `base`. The kernels are dispatched by `base` (its
+    // tuned shapes & batch invariance), the workspace is of its own
+    LlamaLinear(const LlamaLinear& base, cublasMMWrapper* cublas_wrapper, cudaStream_t stream);
+
     void forward(T*                         output_data,
                  Pitched                    input_data,
                  int                        batch_size,
@@ -35,6 +39,13 @@ public:
                  T*                         lora_buff = nullptr,
                  int*                       lora_mask = nullptr);
 
+    // Rows of the output are `output_pitch` apart, e.g. the vocab shard of a rank in the rows of the full logits
+    void forward_pitched(T*                         output_data,
+                         int                        output_pitch,
+                         Pitched                    input_data,
+                         int                        batch_size,
+                         const LlamaDenseWeight<T>& weight);
+
     void forward_moe(T*                         output_data,
                      Pitched                    input_data,
                      const int*                 indexes,
@@ -42,16 +53,39 @@ public:
                      int                        batch_size,
                      const LlamaDenseWeight<T>& weight,
                      Type                       type,
-                     gemm::Context*             context);
+                     gemm::Context*             context,
+                     const int*                 scatter_idxs   = {},
+                     const float*               scatter_scales = {});
+
+    // Allocates the buffer of the quantized activations of the fp8/int8 GEMMs once for up to `max_m` tokens of
+    // `max_k` input dims, it must be done before the GEMMs and outside the capture of a CUDA graph
+    void ReserveFp8Buffer(int max_m, int max_k);
+
+    // Buffer for the e4m3 activations [m, k] and per-token scales [m] of `src`, to be filled by the producer of
+    // `src`. fp8 GEMMs on `src` skip their own quantization until a GEMM reads another input or writes `src`
+    std::pair<fp8_e4m3*, float*> PrepareFp8Input(const T* src, int m, int k);
+
+    // Drops the prepared fp8 input, to be called by the writers of `src` other than the GEMMs of this linear
+    void InvalidateFp8Input();
 
     void set_measure(bool measure);
 
+    // Pin the kernels of a shape for all batch sizes, the results of a token don't depend on the batch
+    void set_batch_invariant(bool batch_invariant);
+
+    // Adapters of the tokens in the following forward passes, null for the base model only
+    void set_lora_batch(const LoraBatch* batch);
+
+    const LoraBatch* lora_batch() const;
+
     [[maybe_unused]] int Export(std::ostream& os);
 
     [[maybe_unused]] int Import(std::istream& is);
 
     std::vector<int> GetTuningSeq() const;
 
+    std::vector<int> PopMisses();
+
 private:
     struct Impl;
     std::shared_ptr<Impl> impl_;
@@ -30,10 +30,15 @@
 #include "src/turbomind/models/llama/LlamaV2.h"
 #include "src/turbomind/models/llama/LlamaWeight.h"
 #include "src/turbomind/models/llama/SequenceManager.h"
+#include "src/turbomind/models/llama/cascade.h"
+#include "src/turbomind/models/llama/llama_kernels.h"
 #include "src/turbomind/models/llama/llama_params.h"
 #include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/models/llama/sparse_layout.h"
 #include "src/turbomind/models/llama/unified_decoder.h"
 
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
 #include "src/turbomind/kernels/gpt_kernels.h"
 
 #include "src/turbomind/utils/Tensor.h"
@@ -41,6 +46,7 @@
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
 #include "src/turbomind/utils/memory_utils.h"
+#include "src/turbomind/utils/monotonic.h"
 
 namespace turbomind {
 
@@ -68,7 +74,7 @@ LlamaV2<T>::LlamaV2(const ModelParam&               model,
     head_num_(model.head_num),
     size_per_head_(model.head_dim),
     hidden_units_(model.hidden_units),
-    layer_num_(model.layer_num),
+    layer_num_((model.layer_num + engine.pp_size - 1) / engine.pp_size),
     vocab_size_(model.vocab_size),
     vocab_size_padded_(pad_vocab_size(model.vocab_size, tp_size_)),
     rmsnorm_eps_(model.norm_eps),
@@ -106,23 +112,27 @@ LlamaV2<T>::~LlamaV2()
 {
     dynamic_decode_layer_.reset();
     unified_decoder_.reset();
+
+    allocator_->free(&embedding_buf_);
 }
 
 template<typename T>
-void LlamaV2<T>::updateEmbedding(T*               decoder_input,
-                                 const int        bsz,
-                                 const int*       h_input_length,
-                                 const Sequence** sequences,
-                                 int              token_num,
-                                 int*             lora_mask,
-                                 bool*            have_embeddings)
+int LlamaV2<T>::updateEmbedding(const EmbeddingRange** embedding_ranges,
+                                const int              bsz,
+                                const int*             h_input_length,
+                                const Sequence**       sequences,
+                                int                    token_num,
+                                int*                   lora_mask,
+                                bool*                  have_embeddings)
 {
+    *embedding_ranges = nullptr;
+    *have_embeddings  = false;
+
     if (isTuning())
-        return;
+        return 0;
 
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
 
-    *have_embeddings          = false;
     int*             mask_ptr = nullptr;
     std::vector<int> mask;
     if (lora_mask != nullptr) {
@@ -130,10 +140,15 @@ void LlamaV2<T>::updateEmbedding(T*               decoder_input,
         mask_ptr = mask.data();
     }
 
+    std::vector<EmbeddingRange> table;
+    std::vector<size_t>         host_size;  // size of the embeddings of each range on host, staged with the table
+
+    int offset = 0;
     for (int i = 0; i < bsz; i++) {
         const auto& seq        = *sequences[i];
         const auto& embeddings = seq.input_embeddings;
         const auto& ranges     = seq.input_embedding_ranges;
+        const auto  first      = table.size();
         for (int j = embeddings.size() - 1; j >= 0; j--) {
             int begin = ranges[j].first;
             int end   = ranges[j].second;
@@ -149,23 +164,64 @@ void LlamaV2<T>::updateEmbedding(T*               decoder_input,
             begin            = std::max(begin, seq.cache_len);
             end              = std::min(end, seq.cache_len + h_input_length[i]);
             size_t byte_size = (end - begin) * hidden_units_ * sizeof(T);
-            T*     dst_ptr   = decoder_input + off_dst * hidden_units_;
-            auto   src_ptr   = embeddings[j].data() + off_src * hidden_units_ * sizeof(T);
-            cudaMemcpyAsync(dst_ptr, src_ptr, byte_size, cudaMemcpyDefault, stream_);
+            auto   src_ptr   = embeddings[j].get() + off_src * hidden_units_ * sizeof(T);
+
+            cudaPointerAttributes attr{};
+            check_cuda_error(cudaPointerGetAttributes(&attr, src_ptr));
+            const bool on_device = attr.type == cudaMemoryTypeDevice || attr.type == cudaMemoryTypeManaged;
+
+            table.push_back({offset + off_dst, offset + off_dst + (end - begin), src_ptr});
+            host_size.push_back(on_device ? 0 : byte_size);
             if (lora_mask != nullptr) {
                 std::fill_n(mask_ptr + off_dst, (end - begin), 1);
                 *have_embeddings = true;
             }
         }
-        decoder_input += h_input_length[i] * hidden_units_;
+        // the ranges are visited backwards
+        std::reverse(table.begin() + first, table.end());
+        std::reverse(host_size.begin() + first, host_size.end());
+        offset += h_input_length[i];
         mask_ptr += h_input_length[i];
     }
 
+    if (!table.empty()) {
+        // the table followed by the embeddings on host, uploaded in one copy
+        Monotonic          plan{nullptr};
+        EmbeddingRange*    table_ptr{};
+        std::vector<char*> staged(table.size());
+        plan(&table_ptr, table.size());
+        for (size_t k = 0; k < table.size(); ++k) {
+            if (host_size[k]) {
+                plan(&staged[k], host_size[k]);
+            }
+        }
+        const size_t size = (size_t)plan.ptr();
+
+        embedding_buf_ = allocator_->reMalloc(embedding_buf_, size, false);
+        h_embedding_buf_.resize(size);
+        for (size_t k = 0; k < table.size(); ++k) {
+            if (host_size[k]) {
+                std::copy_n((const char*)table[k].src, host_size[k], h_embedding_buf_.data() + (size_t)staged[k]);
+                table[k].src = (char*)embedding_buf_ + (size_t)staged[k];
+            }
+        }
+        std::copy_n((const char*)table.data(),
+                    sizeof(EmbeddingRange) * table.size(),
+                    h_embedding_buf_.data() + (size_t)table_ptr);
+        // pageable source, staged before the call returns
+        check_cuda_error(
+            cudaMemcpyAsync(embedding_buf_, h_embedding_buf_.data(), size, cudaMemcpyHostToDevice, stream_));
+
+        *embedding_ranges = (const EmbeddingRange*)((char*)embedding_buf_ + (size_t)table_ptr);
+    }
+
     if (lora_mask != nullptr && *have_embeddings) {
         cudaMemcpyAsync(lora_mask, mask.data(), sizeof(int) * token_num, cudaMemcpyDefault, stream_);
         cudaStreamSynchronize(stream_);
     }
     sync_check_cuda_error();
+
+    return table.size();
 }
 
 template<typename T>
@@ -178,48 +234,104 @@ void LlamaV2<T>::forwardUnified(T*               out,
                                 const int*       h_input_length,
                                 const int*       h_context_length,
                                 const float*     rope_theta,
+                                const int*       evicted_len,
                                 const bool*      finished,
                                 size_t           token_num,
                                 const int*       local_token_nums,
                                 int              dc_batch_size,
                                 int              pf_batch_size,
                                 int*             lora_mask,
-                                const Sequence** sequences)
+                                const Sequence** sequences,
+                                const int*       cascade,
+                                const int*       h_cascade,
+                                const int*       sparse,
+                                const int*       h_sparse,
+                                const uint64_t*  tree_mask,
+                                const int*       cold_len,
+                                const int*       h_cold_len,
+                                float*           block_scores,
+                                int              block_score_stride,
+                                char**           cow_blocks,
+                                float*           kv_error)
 {
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
 
+    // embedding lookup with the input embeddings spliced in, by the slice of the hidden units of each rank
+    bool have_embeddings = false;
     if (token_num) {
+        const EmbeddingRange* ranges{};
+        const int             range_num = updateEmbedding(
+            &ranges, dc_batch_size + pf_batch_size, h_input_length, sequences, token_num, lora_mask, &have_embeddings);
+
+        // the int8 table when `embedding_quant` is enabled
+        const float* table_scales    = weights_->pre_decoder_embedding_scales;
+        const void*  embedding_table = table_scales ? (const void*)weights_->pre_decoder_embedding_s8 :
+                                                      (const void*)weights_->pre_decoder_embedding_table;
+
         if (tp_size_ == 1) {
-            invokeInputIdsEmbeddingLookupPosEncoding(decoder_input,
-                                                     nullptr,  // processed somewhere else
-                                                     weights_->pre_decoder_embedding_table,
-                                                     static_cast<T*>(nullptr),
-                                                     pPromptTuningParam<T>{},
-                                                     input_ids,
-                                                     0,  // only used for position encoding
-                                                     token_num,
-                                                     token_num,
-                                                     1,
-                                                     hidden_units_,
-                                                     stream_);
+            invokeEmbeddingLookupSplice(decoder_input,
+                                        hidden_units_,
+                                        embedding_table,
+                                        input_ids,
+                                        ranges,
+                                        range_num,
+                                        token_num,
+                                        hidden_units_,
+                                        0,
+                                        hidden_units_,
+                                        stream_,
+                                        table_scales);
+        }
+        else if (use_allgather_2d_) {
+            // the slices are gathered in place into the rows of `decoder_output`
+            const int local_hidden_units = hidden_units_ / tp_size_;
+            T*        local_slice        = decoder_output + tp_rank_ * local_hidden_units;
+            invokeEmbeddingLookupSplice(local_slice,
+                                        hidden_units_,
+                                        embedding_table,
+                                        input_ids,
+                                        ranges,
+                                        range_num,
+                                        token_num,
+                                        hidden_units_,
+                                        tp_rank_ * local_hidden_units,
+                                        local_hidden_units,
+                                        stream_,
+                                        table_scales);
+
+            comm_->d_comm->AllGather2D(local_slice,
+                                       decoder_output,
+                                       hidden_units_,
+                                       local_hidden_units,
+                                       local_hidden_units,
+                                       token_num,
+                                       getTensorType<T>(),
+                                       {1, 1},
+                                       comm_->d_tp_group,
+                                       stream_);
             sync_check_cuda_error();
+
+            check_cuda_error(cudaMemcpyAsync(decoder_input,
+                                             decoder_output,
+                                             sizeof(T) * token_num * hidden_units_,
+                                             cudaMemcpyDeviceToDevice,
+                                             stream_));
         }
         else {
             const size_t local_hidden_units = hidden_units_ / tp_size_;
             const size_t slice              = token_num * local_hidden_units;
-            invokeInputIdsEmbeddingLookupPosEncoding(decoder_output + tp_rank_ * slice,
-                                                     nullptr,  // processed somewhere else
-                                                     weights_->pre_decoder_embedding_table,
-                                                     static_cast<T*>(nullptr),
-                                                     pPromptTuningParam<T>{},
-                                                     input_ids,
-                                                     0,  // only used for position encoding
-                                                     token_num,
-                                                     token_num,
-                                                     1,
-                                                     local_hidden_units,
-                                                     stream_);
-            sync_check_cuda_error();
+            invokeEmbeddingLookupSplice(decoder_output + tp_rank_ * slice,
+                                        local_hidden_units,
+                                        embedding_table,
+                                        input_ids,
+                                        ranges,
+                                        range_num,
+                                        token_num,
+                                        hidden_units_,
+                                        tp_rank_ * local_hidden_units,
+                                        local_hidden_units,
+                                        stream_,
+                                        table_scales);
 
             comm_->d_comm->AllGather(decoder_output + tp_rank_ * slice,
                                      decoder_output,
@@ -238,47 +350,56 @@ void LlamaV2<T>::forwardUnified(T*               out,
         count_and_fix(decoder_input, token_num * hidden_units_, "embedding", 1);
     }
 
-    bool have_embeddings = false;
-    if (token_num) {
-        updateEmbedding(decoder_input,
-                        dc_batch_size + pf_batch_size,
-                        h_input_length,
-                        sequences,
-                        token_num,
-                        lora_mask,
-                        &have_embeddings);
-        sync_check_cuda_error();
+    // the const inputs are only read by the layers
+    typename UnifiedDecoder<T>::ForwardParam param{};
+
+    param.decoder_input           = decoder_input;
+    param.decoder_output          = decoder_output;
+    param.last_token_hidden_units = out;
+    param.output_norm_weight      = weights_->output_norm_weight;
+    param.local_token_nums        = local_token_nums;
+
+    param.token_num       = token_num;
+    param.dc_batch_size   = dc_batch_size;
+    param.pf_batch_size   = pf_batch_size;
+    param.h_q_len         = const_cast<int*>(h_input_length);
+    param.h_k_len         = const_cast<int*>(h_context_length);
+    param.finished        = const_cast<bool*>(finished);
+    param.rope_theta      = const_cast<float*>(rope_theta);
+    param.block_ptrs      = block_ptrs;
+    param.cu_block_counts = const_cast<int*>(cu_block_cnts);
+    param.lora_mask       = have_embeddings ? lora_mask : nullptr;
+    param.evicted_len     = const_cast<int*>(evicted_len);
+
+    if (h_cascade) {
+        param.cascade   = cascade;
+        param.h_cascade = h_cascade;
     }
 
-    const auto   dtype = getTensorType<T>();
-    const size_t bsz   = dc_batch_size + pf_batch_size;
-
-    TensorMap inputs{
-        {"decoder_input", {MEMORY_GPU, dtype, {token_num, hidden_units_}, decoder_input}},
-        {"output_norm_weight", {MEMORY_GPU, dtype, {hidden_units_}, weights_->output_norm_weight}},
-        {"h_q_len", {MEMORY_CPU, TYPE_INT32, {bsz}, h_input_length}},
-        {"h_k_len", {MEMORY_CPU, TYPE_INT32, {bsz}, h_context_length}},
-        {"finished", {MEMORY_GPU, TYPE_BOOL, {bsz}, finished}},
-        {"dc_batch_size", {MEMORY_CPU, TYPE_INT32, {1}, &dc_batch_size}},
-        {"pf_batch_size", {MEMORY_CPU, TYPE_INT32, {1}, &pf_batch_size}},
-        {"rope_theta", {MEMORY_GPU, TYPE_FP32, {hidden_units_}, rope_theta}},
-        {"cu_block_counts", {MEMORY_GPU, TYPE_INT32, {bsz}, cu_block_cnts}},
-        {"local_token_nums", {MEMORY_GPU, TYPE_INT32, {1}, local_token_nums}},
-    };
+    if (h_sparse) {
+        param.sparse   = const_cast<int*>(sparse);
+        param.h_sparse = h_sparse;
+    }
 
-    TensorMap outputs{{"decoder_output", {MEMORY_GPU, dtype, {token_num, hidden_units_}, decoder_output}},
-                      {"block_ptrs", {MEMORY_GPU, TYPE_UINT64, {bsz}, block_ptrs}},
-                      {"last_token_hidden_units", {MEMORY_GPU, dtype, {bsz, hidden_units_}, out}}};
+    param.tree_mask = tree_mask;
 
-    if (lora_mask != nullptr && have_embeddings) {
-        inputs.insert({"lora_mask", {MEMORY_GPU, TYPE_INT32, {token_num}, lora_mask}});
+    if (h_cold_len) {
+        param.cold_len   = cold_len;
+        param.h_cold_len = h_cold_len;
     }
 
-    unified_decoder_->forward(&outputs, &inputs, &weights_->decoder_layer_weights);
+    param.block_scores       = block_scores;
+    param.block_score_stride = block_score_stride;
+
+    param.cow_blocks = cow_blocks;
+    param.kv_error   = kv_error;
+
+    unified_decoder_->forward(param, &weights_->decoder_layer_weights);
 }
 
 template<typename T>
-void LlamaV2<T>::postDecodeEmbedding(T* logits, T* local_logits, const T* decoder_output, int batch_size)
+void LlamaV2<T>::postDecodeEmbedding(
+    T* logits, T* local_logits, const T* decoder_output, int batch_size, const T* kernel)
 {
     NvtxScope scope("postDecodeEmbedding");
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
@@ -289,14 +410,29 @@ void LlamaV2<T>::postDecodeEmbedding(T* logits, T* local_logits, const T* decode
     FT_CHECK(vocab_size_padded_ % tp_size_ == 0);
     const size_t local_vocab_size = vocab_size_padded_ / tp_size_;
 
+    // the LM head on the gemm library when `lm_head_quant` is enabled, other heads stay on cuBLAS
+    const LlamaDenseWeight<T>* lm_head = !kernel && weights_->lm_head.kernel ? &weights_->lm_head : nullptr;
+
+    if (!kernel) {
+        kernel = weights_->post_decoder_embedding_kernel;
+    }
+
     auto invoke_gemm = [&](int first, int n, auto C, size_t batch_stride_C, size_t rank_stride_C) {
+        if (lm_head) {
+            linear_->forward_pitched(C + first * batch_stride_C + tp_rank_ * rank_stride_C,
+                                     batch_stride_C,
+                                     decoder_output + first * hidden_units_,
+                                     n,
+                                     *lm_head);
+            return;
+        }
         cublas_wrapper_->Gemm(CUBLAS_OP_T,
                               CUBLAS_OP_N,
                               local_vocab_size,  // m
                               n,
                               hidden_units_,  // k
                               &alpha,
-                              weights_->post_decoder_embedding_kernel,
+                              kernel,
                               data_type,
                               hidden_units_,  // k
                               decoder_output + first * hidden_units_,
@@ -365,12 +501,127 @@ void LlamaV2<T>::postDecodeEmbedding(T* logits, T* local_logits, const T* decode
     }
 }
 
+template<typename T>
+void LlamaV2<T>::medusaDecode(int* ids, T* logits, T* local_logits, T* buf, const T* decoder_output, int batch_size)
+{
+    NvtxScope scope("medusaDecode");
+    TM_LOG_DEBUG(__PRETTY_FUNCTION__);
+
+    float alpha = 1.f;
+    float beta  = 0.f;
+
+    for (size_t i = 0; i < weights_->medusa_heads.size(); ++i) {
+        const auto& head = weights_->medusa_heads[i];
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              hidden_units_,  // m
+                              batch_size,
+                              hidden_units_,  // k
+                              &alpha,
+                              head.res.kernel,
+                              getCudaDataType<T>(),
+                              hidden_units_,  // k
+                              decoder_output,
+                              getCudaDataType<T>(),
+                              hidden_units_,  // k
+                              &beta,
+                              buf,
+                              getCudaDataType<T>(),
+                              hidden_units_,  // ldc
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+        sync_check_cuda_error();
+
+        invokeResidualSiLU(buf, decoder_output, head.res.bias, hidden_units_, batch_size, stream_);
+        sync_check_cuda_error();
+
+        postDecodeEmbedding(logits, local_logits, buf, batch_size, (const T*)head.output.kernel);
+
+        // top-1 of the vocab, `buf` is free after the projection. Padded vocab is excluded
+        invokeTopKCandidates(
+            buf, ids + i * batch_size, logits, vocab_size_padded_, vocab_size_, 1, 0, batch_size, stream_);
+        sync_check_cuda_error();
+    }
+}
+
+template<typename T>
+size_t LlamaV2<T>::topKWorkspaceSize(int batch_size, int k) const
+{
+    const size_t local_vocab_size = vocab_size_padded_ / tp_size_;
+    const size_t candidates       = (size_t)tp_size_ * batch_size * k;
+    return sizeof(T) * (batch_size * local_vocab_size + round_up(candidates, (size_t)2)) + sizeof(int) * candidates;
+}
+
+template<typename T>
+void LlamaV2<T>::postDecodeTopK(T* logits, int* ids, T* local_logits, const T* decoder_output, int batch_size, int k)
+{
+    NvtxScope scope("postDecodeTopK");
+    TM_LOG_DEBUG(__PRETTY_FUNCTION__);
+
+    FT_CHECK(tp_size_ > 1 && vocab_size_padded_ % tp_size_ == 0);
+    const int local_vocab_size = vocab_size_padded_ / tp_size_;
+
+    float alpha = 1.f;
+    float beta  = 0.f;
+    if (weights_->lm_head.kernel) {
+        linear_->forward(local_logits, decoder_output, batch_size, weights_->lm_head);
+    }
+    else {
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              local_vocab_size,  // m
+                              batch_size,
+                              hidden_units_,  // k
+                              &alpha,
+                              weights_->post_decoder_embedding_kernel,
+                              getCudaDataType<T>(),
+                              hidden_units_,  // k
+                              decoder_output,
+                              getCudaDataType<T>(),
+                              hidden_units_,  // k
+                              &beta,
+                              local_logits,
+                              getCudaDataType<T>(),
+                              local_vocab_size,  // ldc
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+    }
+    sync_check_cuda_error();
+
+    // [tp, batch_size, k] after the local logits
+    const size_t slice  = (size_t)batch_size * k;
+    T*           values = local_logits + (size_t)batch_size * local_vocab_size;
+    int*         index  = (int*)(values + round_up(tp_size_ * slice, (size_t)2));
+
+    const int first = tp_rank_ * local_vocab_size;
+    // Padded vocab is excluded
+    const int n = std::clamp((int)vocab_size_ - first, 0, local_vocab_size);
+
+    invokeTopKCandidates(values + tp_rank_ * slice,
+                         index + tp_rank_ * slice,
+                         local_logits,
+                         local_vocab_size,
+                         n,
+                         k,
+                         first,
+                         batch_size,
+                         stream_);
+
+    comm_->d_comm->AllGather(values + tp_rank_ * slice, values, slice, getTensorType<T>(), comm_->d_tp_group, stream_);
+    comm_->d_comm->AllGather(index + tp_rank_ * slice, index, slice, TYPE_INT32, comm_->d_tp_group, stream_);
+    sync_check_cuda_error();
+
+    invokeTransposeAxis01(logits, values, tp_size_, batch_size, k, stream_);
+    invokeTransposeAxis01(ids, index, tp_size_, batch_size, k, stream_);
+    sync_check_cuda_error();
+}
+
 template<typename T>
 void LlamaV2<T>::dynamicDecode(int*            token_ids,
                                bool*           finished,
                                int*            sequence_length,
                                bool*           should_stop,
-                               curandState_t*  curand_state,
+                               const uint64_t* random_seed,
                                TensorMap*      inputs,
                                TensorMap*      outputs,
                                const T*        logits,
@@ -386,23 +637,32 @@ void LlamaV2<T>::dynamicDecode(int*            token_ids,
     TM_LOG_DEBUG(__PRETTY_FUNCTION__);
     int local_batch_size = (int)batch_size;
 
+    // The top-k candidates of `postDecodeTopK` when "logit_ids" is present
+    const size_t logit_num = inputs->isExist("logit_ids") ? inputs->at("logit_ids").shape[1] : vocab_size_padded_;
+
     std::unordered_map<std::string, Tensor> dynamic_decode_input_tensors{
-        {"logits", {MEMORY_GPU, getTensorType<T>(), {batch_size, (size_t)1, vocab_size_padded_}, logits}},
+        {"logits", {MEMORY_GPU, getTensorType<T>(), {batch_size, (size_t)1, logit_num}, logits}},
         {"step", {MEMORY_CPU, TYPE_INT32, {1}, &step}},
         {"max_input_length", {MEMORY_CPU, TYPE_INT32, {1}, &max_context_len}},
         {"sequence_limit_length", {MEMORY_GPU, TYPE_UINT32, {batch_size}, seq_limit_len}},
         {"input_lengths", {MEMORY_GPU, TYPE_INT32, {batch_size, 1}, context_length}},
         {"ite", {MEMORY_CPU, TYPE_UINT32, {1}, &ite}},
         {"local_batch_size", {MEMORY_CPU, TYPE_INT32, {1}, &local_batch_size}},
+        {"random_seed", {MEMORY_GPU, TYPE_UINT64, {batch_size}, random_seed}},
     };
 
     const std::vector<std::string> optional_inputs{"end_ids",
-                                                   "stop_words_list",
                                                    "bad_words_list",
                                                    "runtime_top_k",
                                                    "runtime_top_p",
                                                    "temperature",
-                                                   "repetition_penalty"};
+                                                   "repetition_penalty",
+                                                   "frequency_penalty",
+                                                   "presence_penalty",
+                                                   "token_bitmask",
+                                                   "logit_ids",
+                                                   "beam_groups",
+                                                   "beam_history"};
     for (const auto& key : optional_inputs) {
         if (inputs->isExist(key)) {
             dynamic_decode_input_tensors.insert({key, inputs->at(key)});
@@ -413,8 +673,7 @@ void LlamaV2<T>::dynamicDecode(int*            token_ids,
         {"output_ids", {MEMORY_GPU, TYPE_INT32, {token_ids_len, batch_size, 1U}, token_ids}},
         {"finished", {MEMORY_GPU, TYPE_BOOL, {batch_size}, finished}},
         {"sequence_length", {MEMORY_GPU, TYPE_INT32, {batch_size}, sequence_length}},
-        {"should_stop", {MEMORY_CPU, TYPE_BOOL, {1}, should_stop}},
-        {"curand_state", {MEMORY_GPU, TYPE_VOID, {batch_size}, curand_state}}};
+        {"should_stop", {MEMORY_CPU, TYPE_BOOL, {1}, should_stop}}};
 
     const std::vector<std::string> optional_outputs{
         "cum_log_probs", "output_log_probs", "sampled_indexes", "sampled_logprobs", "sampled_nums"};
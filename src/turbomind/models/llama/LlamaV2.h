@@ -22,6 +22,7 @@
 #pragma once
 
 #include "src/turbomind/comm/device_comm.h"
+#include "src/turbomind/kernels/gpt_kernels.h"
 #include "src/turbomind/layers/DynamicDecodeLayer.h"
 #include "src/turbomind/models/llama/LlamaBatch.h"
 #include "src/turbomind/models/llama/LlamaWeight.h"
@@ -53,14 +54,21 @@ public:
         return vocab_size_;
     }
 
+    // Tokens routed to each expert of the MoE layers by this rank
+    std::vector<std::vector<int64_t>> GetExpertCounts(bool reset)
+    {
+        return unified_decoder_->GetExpertCounts(reset);
+    }
+
 private:
-    void updateEmbedding(T*               decoder_input,
-                         const int        bsz,
-                         const int*       h_input_length,
-                         const Sequence** sequences,
-                         int              token_num,
-                         int*             lora_mask,
-                         bool*            have_embeddings);
+    // Range table of the input embeddings of the tokens in device memory, returns the number of ranges
+    int updateEmbedding(const EmbeddingRange** embedding_ranges,
+                        const int              bsz,
+                        const int*             h_input_length,
+                        const Sequence**       sequences,
+                        int                    token_num,
+                        int*                   lora_mask,
+                        bool*                  have_embeddings);
 
     void forwardUnified(T*               out,
                         T*               decoder_output,
@@ -71,21 +79,57 @@ private:
                         const int*       h_input_length,
                         const int*       h_context_length,
                         const float*     rope_theta,
+                        const int*       evicted_len,
                         const bool*      finished,
                         size_t           token_num,
                         const int*       local_token_nums,
                         int              dc_batch_size,
                         int              pf_batch_size,
                         int*             lora_mask,
-                        const Sequence** sequences);
+                        const Sequence** sequences,
+                        const int*       cascade            = nullptr,
+                        const int*       h_cascade          = nullptr,
+                        const int*       sparse             = nullptr,
+                        const int*       h_sparse           = nullptr,
+                        const uint64_t*  tree_mask          = nullptr,
+                        const int*       cold_len           = nullptr,
+                        const int*       h_cold_len         = nullptr,
+                        float*           block_scores       = nullptr,
+                        int              block_score_stride = 0,
+                        char**           cow_blocks         = nullptr,
+                        float*           kv_error           = nullptr);
+
+    // With pipeline parallelism, orders the results of the last stage before the following work on the stream
+    void waitPipeline()
+    {
+        unified_decoder_->waitPipeline();
+    }
+
+    // `kernel` defaults to the output embedding of the model
+    void postDecodeEmbedding(
+        T* logits, T* local_logits, const T* decoder_output, int batch_size, const T* kernel = nullptr);
 
-    void postDecodeEmbedding(T* logits, T* local_logits, const T* decoder_output, int batch_size);
+    // Greedy drafts of the Medusa heads from the final hidden states, `ids` [num_heads, batch_size]. `buf` holds
+    // [batch_size, hidden_units], the logits buffers are those of `postDecodeEmbedding`
+    void medusaDecode(int* ids, T* logits, T* local_logits, T* buf, const T* decoder_output, int batch_size);
+
+    int medusa_num_heads() const noexcept
+    {
+        return weights_->medusa_heads.size();
+    }
+
+    // With TP, gathers only the top-k logits of the vocab shard of each rank, `logits` & `ids` [batch_size, tp, k].
+    // `local_logits` is the communication buffer of `postDecodeEmbedding`
+    void postDecodeTopK(T* logits, int* ids, T* local_logits, const T* decoder_output, int batch_size, int k);
+
+    // Bytes of `local_logits` used by `postDecodeTopK`
+    size_t topKWorkspaceSize(int batch_size, int k) const;
 
     void dynamicDecode(int*            token_ids,
                        bool*           finished,
                        int*            sequence_length,
                        bool*           should_stop,
-                       curandState_t*  curand_state,
+                       const uint64_t* random_seed,
                        TensorMap*      inputs,
                        TensorMap*      outputs,
                        const T*        logits,
@@ -111,14 +155,15 @@ private:
     const size_t head_num_;
     const size_t size_per_head_;
     const size_t hidden_units_;
-    const size_t layer_num_;
+    const size_t layer_num_;  // kv cache layers of the largest pipeline stage, so that all stages hold the same blocks
     const size_t vocab_size_;
     const size_t vocab_size_padded_;
     const float  rmsnorm_eps_;
     const size_t local_head_num_;
     const size_t local_kv_head_num_;
 
-    const std::shared_ptr<LlamaWeight<T>> weights_{};
+    // swapped by the engine at a step boundary
+    std::shared_ptr<LlamaWeight<T>> weights_{};
 
     // Refs into `Context<T>`, make the pointer constant (not the pointed objects)
     cudaStream_t const     stream_;
@@ -128,6 +173,9 @@ private:
 
     bool use_allgather_2d_{false};
 
+    void*             embedding_buf_{};  // range table and staged input embeddings of `updateEmbedding`
+    std::vector<char> h_embedding_buf_;
+
     const bool is_free_buffer_after_forward_;
     const bool debug_;
 
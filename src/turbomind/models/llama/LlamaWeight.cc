@@ -19,13 +19,22 @@
 // https://github.com/NVIDIA/FasterTransformer/blob/main/src/fastertransformer/models/multi_gpu_gpt/ParallelGptWeight.cc
 
 #include "src/turbomind/models/llama/LlamaWeight.h"
+#include "src/turbomind/kernels/gemm/cast.h"
+#include "src/turbomind/kernels/gpt_kernels.h"
 #include "src/turbomind/models/llama/llama_params.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/memory_utils.h"
+#include "src/turbomind/utils/string_utils.h"
+#include <algorithm>
 #include <cuda_runtime.h>
+#include <tuple>
 
 namespace turbomind {
 
+// staging of the weight loading with safetensors, 4 streams x 2 buffers x 32 MB pinned
+static constexpr int    kLoadStreams   = 4;
+static constexpr size_t kLoadChunkSize = 32 << 20;
+
 template<typename T>
 LlamaWeight<T>::LlamaWeight(const ModelParam&  model,
                             const EngineParam& engine_param,
@@ -39,7 +48,11 @@ LlamaWeight<T>::LlamaWeight(const ModelParam&  model,
     num_layer_(model.layer_num),
     weight_type_(model.weight_type),
     tp_size_(engine_param.attn_tp_size),
-    tp_rank_(engine_param.attn_tp_rank)
+    tp_rank_(engine_param.attn_tp_rank),
+    lm_head_quant_(engine_param.lm_head_quant),
+    embedding_quant_(engine_param.embedding_quant),
+    offload_(engine_param.offload_weights),
+    expert_cache_slots_(engine_param.moe_expert_cache)
 {
     if (vocab_size_padded_ % tp_size_ != 0) {
         vocab_size_padded_ = (vocab_size_ + tp_size_ - 1) / tp_size_ * tp_size_;
@@ -51,13 +64,18 @@ LlamaWeight<T>::LlamaWeight(const ModelParam&  model,
     }
     FT_CHECK(hidden_units_ % tp_size_ == 0);
 
+    std::tie(layer_begin_, layer_end_) =
+        GetStageLayerRange((int)num_layer_, engine_param.pp_size, engine_param.pp_rank);
+
     check_cuda_error(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
 
-    decoder_layer_weights.reserve(num_layer_);
-    for (unsigned l = 0; l < num_layer_; ++l) {
-        decoder_layer_weights.emplace_back(
-            new LlamaDecoderLayerWeight<T>(l, model, engine_param, lora_param, moe_param));
-        decoder_layer_weights.back()->malloc(stream_);
+    decoder_layer_weights.resize(num_layer_);
+    layer_allocated_.resize(num_layer_);
+    for (int l = layer_begin_; l < layer_end_; ++l) {
+        decoder_layer_weights[l] = new LlamaDecoderLayerWeight<T>(l, model, engine_param, lora_param, moe_param);
+        if (!offload_ && !expert_cache_slots_) {
+            mallocLayer(l);
+        }
     }
 
     FT_CHECK(vocab_size_padded_ % tp_size_ == 0);
@@ -65,20 +83,88 @@ LlamaWeight<T>::LlamaWeight(const ModelParam&  model,
     deviceMalloc((T**)&output_norm_weight, hidden_units_, stream_);
     deviceMalloc((T**)&post_decoder_embedding_kernel, hidden_units_ * vocab_size_padded_ / tp_size_, stream_);
 
+    if (engine_param.num_speculative_tokens) {
+        const auto data_type = get_default_weight_type<T>();
+        medusa_heads.resize(model.medusa_num_heads);
+        for (auto& head : medusa_heads) {
+            head.res    = {hidden_units_, hidden_units_, data_type, 1};
+            head.output = {hidden_units_, vocab_size_padded_ / tp_size_, data_type, 1};
+            head.res.malloc(stream_, true);
+            head.output.malloc(stream_);
+        }
+    }
+
+    if (engine_param.max_loras) {
+        initAdapters(model, engine_param);
+    }
+
     // Wait for allocations
     check_cuda_error(cudaStreamSynchronize(stream_));
 }
 
+template<typename T>
+void LlamaWeight<T>::initAdapters(const ModelParam& model, const EngineParam& engine_param)
+{
+    FT_CHECK_WITH_INFO(model.mla.kv_lora_rank == 0, "multi-LoRA is not supported for MLA");
+    FT_CHECK_WITH_INFO(engine_param.max_lora_rank * 3 <= kLoraMaxCols,
+                       fmtstr("`max_lora_rank` must not exceed %d", kLoraMaxCols / 3));
+
+    // Slot layout, for each layer: qkv, wo, w1, w3, w2
+    int64_t units = 0;
+
+    auto add = [&](LlamaDenseWeight<T>& w, int sections) {
+        w.adapter.offset   = units;
+        w.adapter.sections = sections;
+        units += sections * w.input_dims + w.output_dims;
+    };
+
+    const int q_dims = model.head_num * model.head_dim / tp_size_;
+
+    for (auto& layer : decoder_layer_weights) {
+        auto& attn = layer->self_attn_weights;
+        add(attn.qkv, 3);
+        attn.qkv.adapter.bounds[0] = q_dims;
+        attn.qkv.adapter.bounds[1] = q_dims + (attn.qkv.output_dims - q_dims) / 2;
+        add(attn.output, 1);
+        if (auto& ffn = layer->ffn_weights; ffn.inter_size) {
+            add(ffn.gating, 1);
+            add(ffn.intermediate, 1);
+            add(ffn.output, 1);
+        }
+    }
+
+    adapters = std::make_unique<LoraAdapterPool>(
+        engine_param.max_loras, engine_param.max_lora_rank, units, sizeof(T), stream_);
+}
+
 template<typename T>
 LlamaWeight<T>::~LlamaWeight()
 {
+    adapters.reset();
+
+    // before the layers, the pointers into the slots are reset
+    pager_.reset();
+    expert_cache_.reset();
+
     deviceFree(pre_decoder_embedding_table, stream_);
     deviceFree(output_norm_weight, stream_);
     deviceFree(post_decoder_embedding_kernel, stream_);
 
+    deviceFree(pre_decoder_embedding_s8, stream_);
+    deviceFree(pre_decoder_embedding_scales, stream_);
+    lm_head.free(stream_);
+    deviceFree(lm_head.scales_zeros, stream_);
+
+    for (auto& head : medusa_heads) {
+        head.res.free(stream_);
+        head.output.free(stream_);
+    }
+
     for (auto& p : decoder_layer_weights) {
-        p->free(stream_);
-        delete p;
+        if (p) {
+            p->free(stream_);
+            delete p;
+        }
     }
 
     decoder_layer_weights.clear();
@@ -92,6 +178,11 @@ LlamaWeight<T>::~LlamaWeight()
 template<typename T>
 void LlamaWeight<T>::loadModel(std::string dir_path)
 {
+    if (SafeTensors::exists(dir_path)) {
+        model_file_ = std::make_unique<SafeTensors>(dir_path);
+        return;
+    }
+
     FtCudaDataType model_file_type = FtCudaDataType::FP16;
     if (weight_type_ == WeightType::kBF16) {
         model_file_type = FtCudaDataType::BF16;
@@ -110,13 +201,25 @@ void LlamaWeight<T>::loadModel(std::string dir_path)
                       dir_path + "output." + std::to_string(tp_rank_) + ".weight",
                       model_file_type);
 
-    for (unsigned layer = 0; layer < num_layer_; ++layer) {
+    for (size_t i = 0; i < medusa_heads.size(); ++i) {
+        const auto& head   = medusa_heads[i];
+        const auto  prefix = dir_path + fmtstr("medusa.%d.", (int)i);
+        loadWeightFromBin((T*)head.res.kernel, {hidden_units_ * hidden_units_}, prefix + "res.weight", model_file_type);
+        loadWeightFromBin((T*)head.res.bias, {hidden_units_}, prefix + "res.bias", model_file_type);
+        loadWeightFromBin((T*)head.output.kernel,
+                          {hidden_units_ * vocab_size_padded_ / tp_size_},
+                          prefix + "output." + std::to_string(tp_rank_) + ".weight",
+                          model_file_type);
+    }
+
+    for (int layer = layer_begin_; layer < layer_end_; ++layer) {
+        mallocLayer(layer);
         decoder_layer_weights[layer]->loadModel(dir_path + "layers." + std::to_string(layer), model_file_type);
     }
 }
 
 template<typename T>
-TensorMap LlamaWeight<T>::getParams()
+TensorMap LlamaWeight<T>::getCommonParams()
 {
     TensorMap output;
 
@@ -135,8 +238,28 @@ TensorMap LlamaWeight<T>::getParams()
                          {hidden_units_ * vocab_size_padded_ * sizeof(T) / tp_size_},
                          post_decoder_embedding_kernel});
 
+    for (size_t i = 0; i < medusa_heads.size(); ++i) {
+        const auto& head   = medusa_heads[i];
+        const auto  prefix = fmtstr("medusa.%d.", (int)i);
+        output.insert(prefix + "res.weight",
+                      Tensor{MEMORY_GPU, getTensorType<T>(), {head.res.kernel_size()}, head.res.kernel});
+        output.insert(prefix + "res.bias",
+                      Tensor{MEMORY_GPU, getTensorType<T>(), {head.res.bias_size()}, head.res.bias});
+        output.insert(prefix + "output." + std::to_string(tp_rank_) + ".weight",
+                      Tensor{MEMORY_GPU, getTensorType<T>(), {head.output.kernel_size()}, head.output.kernel});
+    }
+
+    return output;
+}
+
+template<typename T>
+TensorMap LlamaWeight<T>::getParams()
+{
+    TensorMap output = getCommonParams();
+
     // transformer layers
-    for (size_t i = 0; i < num_layer_; i++) {
+    for (int i = layer_begin_; i < layer_end_; i++) {
+        mallocLayer(i);
         std::string prefix = fmtstr("layers.%d", i);
         TensorMap   layeri = decoder_layer_weights[i]->getParams(prefix);
         for (auto [name, tensor] : layeri) {
@@ -147,13 +270,68 @@ TensorMap LlamaWeight<T>::getParams()
     return output;
 }
 
+template<typename T>
+uint64_t LlamaWeight<T>::Fingerprint()
+{
+    constexpr size_t kSampledRows = 64;
+
+    std::vector<std::pair<const void*, size_t>> ranges;
+
+    const size_t norm_bytes = sizeof(T) * hidden_units_;
+    ranges.emplace_back(output_norm_weight, norm_bytes);
+    // the norms are not paged, see `LlamaDecoderLayerWeight::buffers`
+    for (int i = layer_begin_; i < layer_end_; ++i) {
+        if (auto w = decoder_layer_weights[i]) {
+            ranges.emplace_back(w->self_attn_norm_weights, norm_bytes);
+            ranges.emplace_back(w->ffn_norm_weights, norm_bytes);
+        }
+    }
+
+    // the int8 table replaces the original one with `embedding_quant`
+    const bool   s8        = pre_decoder_embedding_s8;
+    const size_t row_bytes = hidden_units_ / tp_size_ * (s8 ? 1 : sizeof(T));
+    const auto   table     = s8 ? (const char*)pre_decoder_embedding_s8 : (const char*)pre_decoder_embedding_table;
+    for (size_t i = 0; i < kSampledRows && table; ++i) {
+        ranges.emplace_back(table + embedding_size_ * i / kSampledRows * row_bytes, row_bytes);
+    }
+
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    // FNV-1a
+    uint64_t          h = 0xcbf29ce484222325ull;
+    std::vector<char> buf;
+    for (const auto& [ptr, size] : ranges) {
+        if (!ptr) {
+            continue;
+        }
+        buf.resize(size);
+        check_cuda_error(cudaMemcpy(buf.data(), ptr, size, cudaMemcpyDefault));
+        for (const auto& c : buf) {
+            h = (h ^ (uint8_t)c) * 0x100000001b3ull;
+        }
+    }
+
+    return h;
+}
+
+template<typename T>
+void LlamaWeight<T>::mallocLayer(int layer)
+{
+    if (!layer_allocated_[layer]) {
+        decoder_layer_weights[layer]->malloc(stream_);
+        // the buffers are filled on other streams
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        layer_allocated_[layer] = true;
+    }
+}
+
 template<typename T>
 void LlamaWeight<T>::prepare(const cudaDeviceProp& prop)
 {
     const auto workspace_size = [&] {
         size_t size{};
-        for (const auto& layer : decoder_layer_weights) {
-            size = std::max(size, layer->workspace_size());
+        for (int i = layer_begin_; i < layer_end_; ++i) {
+            size = std::max(size, decoder_layer_weights[i]->workspace_size());
         }
         return size;
     }();
@@ -168,13 +346,222 @@ void LlamaWeight<T>::prepare(const cudaDeviceProp& prop)
     if (workspace_size) {
         deviceMalloc((char**)&workspace, workspace_size, stream_);
     }
-    for (auto& layer : decoder_layer_weights) {
-        layer->prepare(workspace, workspace_size, prop, stream_);
+
+    // Layer `i + 1` is read from the model files while layer `i` is being converted
+    std::unique_ptr<StagedCopier> copier;
+    if (model_file_) {
+        copier = std::make_unique<StagedCopier>(kLoadStreams, 2, kLoadChunkSize);
+        loadTensors(getCommonParams(), *copier);
+        if (layer_begin_ < layer_end_) {
+            mallocLayer(layer_begin_);
+            loadTensors(decoder_layer_weights[layer_begin_]->getParams(fmtstr("layers.%d", layer_begin_)), *copier);
+        }
+    }
+
+    FT_CHECK_WITH_INFO(copier || std::all_of(layer_allocated_.begin() + layer_begin_,
+                                             layer_allocated_.begin() + layer_end_,
+                                             [](bool x) { return x; }),
+                       "the decoder layers are not loaded");
+
+    if (offload_) {
+        pager_ = std::make_unique<WeightPager>(layer_begin_, layer_end_);
+    }
+    if (expert_cache_slots_) {
+        expert_cache_ = std::make_unique<ExpertCache>(layer_begin_, layer_end_, expert_cache_slots_);
+    }
+
+    for (int i = layer_begin_; i < layer_end_; ++i) {
+        if (copier) {
+            copier->Fence(stream_);
+            if (i + 1 < layer_end_) {
+                // allocated ahead of the conversion to keep the loading overlapped
+                mallocLayer(i + 1);
+            }
+        }
+        decoder_layer_weights[i]->prepare(workspace, workspace_size, prop, stream_);
+        if (copier && i + 1 < layer_end_) {
+            loadTensors(decoder_layer_weights[i + 1]->getParams(fmtstr("layers.%d", i + 1)), *copier);
+        }
+        if (pager_) {
+            pager_->Add(i, decoder_layer_weights[i]->buffers(), stream_);
+        }
+        if (expert_cache_ && !decoder_layer_weights[i]->moe_weights.experts.empty()) {
+            auto tables = decoder_layer_weights[i]->expert_tables();
+            expert_cache_->Add(i, decoder_layer_weights[i]->expert_buffers(), std::move(tables), stream_);
+        }
     }
 
     deviceFree(workspace, stream_);
 
+    quantizeEmbeddings();
+
+    if (pager_) {
+        pager_->Finalize(stream_);
+        for (int i = layer_begin_; i < layer_end_; ++i) {
+            decoder_layer_weights[i]->pager = pager_.get();
+        }
+        TM_LOG_INFO("[LlamaWeight<T>::prepare] %.2f GB of layer weights offloaded, %.2f GB paged in on the device",
+                    pager_->host_bytes() / (float)(1 << 30),
+                    2 * pager_->slot_bytes() / (float)(1 << 30));
+    }
+
+    if (expert_cache_) {
+        expert_cache_->Finalize(stream_);
+        for (int i = layer_begin_; i < layer_end_; ++i) {
+            auto& moe = decoder_layer_weights[i]->moe_weights;
+            if (!moe.experts.empty()) {
+                moe.cache = expert_cache_.get();
+                if (const int next = expert_cache_->Next(i); next >= 0) {
+                    moe.next_gate = &decoder_layer_weights[next]->moe_weights.gate;
+                }
+            }
+        }
+        TM_LOG_INFO("[LlamaWeight<T>::prepare] %.2f GB of routed experts offloaded, %.2f GB cached on the device",
+                    expert_cache_->host_bytes() / (float)(1 << 30),
+                    expert_cache_->device_bytes() / (float)(1 << 30));
+    }
+
     check_cuda_error(cudaStreamSynchronize(stream_));
+
+    if (copier) {
+        TM_LOG_INFO("[LlamaWeight<T>::prepare] %.2f GB loaded", copier->bytes() / (float)(1 << 30));
+        copier.reset();
+        // the files are no longer needed
+        model_file_.reset();
+    }
+}
+
+template<typename T>
+void LlamaWeight<T>::snapshot(WeightSnapshot& s)
+{
+    FT_CHECK_WITH_INFO(!offload_, "snapshots of the offloaded weights are not supported");
+
+    s.Check(sizeof(T), "data type");
+    s.Check(layer_begin_, "layer range");
+    s.Check(layer_end_, "layer range");
+
+    const size_t rows = embedding_size_;
+    const size_t cols = hidden_units_ / tp_size_;
+
+    // either the table or its int8 counterpart is present
+    s.Buffer((void**)&pre_decoder_embedding_table, sizeof(T) * rows * cols);
+    s.Buffer((void**)&pre_decoder_embedding_s8, rows * cols);
+    s.Buffer((void**)&pre_decoder_embedding_scales, sizeof(float) * rows);
+
+    s.Buffer((void**)&output_norm_weight, sizeof(T) * hidden_units_);
+    s.Buffer((void**)&post_decoder_embedding_kernel, sizeof(T) * hidden_units_ * vocab_size_padded_ / tp_size_);
+    SnapshotDense(s, lm_head);
+
+    for (auto& head : medusa_heads) {
+        SnapshotDense(s, head.res);
+        SnapshotDense(s, head.output);
+    }
+
+    for (int i = layer_begin_; i < layer_end_; ++i) {
+        decoder_layer_weights[i]->snapshot(s);
+    }
+
+    s.Finish();
+}
+
+template<typename T>
+void LlamaWeight<T>::saveSnapshot(const std::string& path)
+{
+    WeightSnapshot s{path, true, stream_};
+    snapshot(s);
+    TM_LOG_INFO("[LlamaWeight<T>::saveSnapshot] %.2f GB written to %s", s.bytes() / (float)(1 << 30), path.c_str());
+}
+
+template<typename T>
+void LlamaWeight<T>::loadSnapshot(const std::string& path)
+{
+    FT_CHECK_WITH_INFO(!model_file_, "the model files are loaded already");
+    WeightSnapshot s{path, false, stream_};
+    snapshot(s);
+    TM_LOG_INFO("[LlamaWeight<T>::loadSnapshot] %.2f GB restored from %s", s.bytes() / (float)(1 << 30), path.c_str());
+}
+
+template<typename T>
+void LlamaWeight<T>::quantizeEmbeddings()
+{
+    if constexpr (sizeof(T) == 2) {
+        const int rows = embedding_size_;
+        const int cols = hidden_units_ / tp_size_;
+        // the rows are quantized in vectors of 16 bytes
+        if (embedding_quant_ == "int8" && cols % 8) {
+            TM_LOG_WARNING("[LlamaWeight] `embedding_quant` requires `hidden_units / tp` of multiples of 8, ignored");
+        }
+        else if (embedding_quant_ == "int8") {
+            deviceMalloc(&pre_decoder_embedding_s8, (size_t)rows * cols, stream_);
+            deviceMalloc(&pre_decoder_embedding_scales, rows, stream_);
+            quant_s8_rowwise(pre_decoder_embedding_s8,
+                             cols,
+                             pre_decoder_embedding_scales,
+                             pre_decoder_embedding_table,
+                             cols,
+                             rows,
+                             cols,
+                             stream_);
+            sync_check_cuda_error();
+            deviceFree(pre_decoder_embedding_table, stream_);
+        }
+    }
+
+    if constexpr (!std::is_same_v<T, float>) {
+        const size_t k = hidden_units_;
+        const size_t n = vocab_size_padded_ / tp_size_;
+        // the weight-only kernels read groups of 128 along k, the dense ones take tiles of up to 128 along k
+        if (lm_head_quant_ != "none" && (k % 128 || n % 8)) {
+            TM_LOG_WARNING("[LlamaWeight] `lm_head_quant` requires `hidden_units` of multiples of 128 and the vocab "
+                           "shards of multiples of 8, ignored");
+        }
+        else if (lm_head_quant_ != "none") {
+            // [vocab, hidden] of the cuBLAS GEMM to the (k, n) layout of the dense weights
+            lm_head = {k, n, get_default_weight_type<T>(), 1};
+            lm_head.malloc(stream_);
+            invokeTransposeAxis01(
+                (uint16_t*)lm_head.kernel, (uint16_t*)post_decoder_embedding_kernel, n, k, 1, stream_);
+            sync_check_cuda_error();
+            deviceFree(post_decoder_embedding_kernel, stream_);
+
+            const size_t size = sizeof(uint16_t) * k * n;
+            char*        workspace{};
+            deviceMalloc(&workspace, size, stream_);
+            if (lm_head_quant_ == "dense") {
+                pack_dense_weight(lm_head, workspace, size, stream_);
+            }
+            else if constexpr (std::is_same_v<T, half>) {
+                const auto dtype = lm_head_quant_ == "int4" ? gemm::DataType::U4 : gemm::DataType::U8;
+                quantize_weight_only(lm_head, dtype, workspace, size, stream_);
+            }
+            deviceFree(workspace, stream_);
+        }
+    }
+}
+
+template<typename T>
+void LlamaWeight<T>::loadTensors(const TensorMap& params, StagedCopier& copier)
+{
+    std::vector<std::pair<const SafeTensors::Entry*, void*>> copies;
+    for (const auto& [name, tensor] : params) {
+        const size_t size = tensor.shape.at(0);
+        if (!tensor.data || !size) {
+            continue;
+        }
+        const auto entry = model_file_->find(name);
+        if (!entry) {
+            TM_LOG_WARNING("[LlamaWeight] %s is not found in the model files", name.c_str());
+            continue;
+        }
+        FT_CHECK_WITH_INFO(entry->size == size,
+                           fmtstr("size mismatch of %s, %lu vs %lu", name.c_str(), entry->size, size));
+        copies.emplace_back(entry, tensor.data);
+    }
+    // in file order for the read-ahead
+    std::sort(copies.begin(), copies.end(), [](auto& a, auto& b) { return a.first->data < b.first->data; });
+    for (const auto& [entry, dst] : copies) {
+        copier.Copy(dst, entry->data, entry->size);
+    }
 }
 
 #ifdef ENABLE_FP32
@@ -21,7 +21,12 @@
 #pragma once
 
 #include "src/turbomind/models/llama/LlamaDecoderLayerWeight.h"
+#include "src/turbomind/models/llama/expert_cache.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/lora_pool.h"
+#include "src/turbomind/models/llama/weight_loader.h"
+#include "src/turbomind/models/llama/weight_pager.h"
+#include <memory>
 
 namespace turbomind {
 
@@ -39,19 +44,61 @@ struct LlamaWeight {
     LlamaWeight(const LlamaWeight&) = delete;
     LlamaWeight& operator=(const LlamaWeight&) = delete;
 
+    // With safetensors shards in `dir_path` the tensors are streamed to the device in `prepare`
     void loadModel(std::string dir_path);
 
     TensorMap getParams();
 
     void prepare(const cudaDeviceProp& prop);
 
+    // Write the prepared weights to the snapshot at `path`
+    void saveSnapshot(const std::string& path);
+
+    // Restore the prepared weights from the snapshot at `path` in place of loading & preparing them
+    void loadSnapshot(const std::string& path);
+
+    // Digest of the prepared weights of the rank that stay as loaded, i.e. the norms & rows sampled from the embedding
+    // table. Identifies the checkpoint to the caches persisted across the runs
+    uint64_t Fingerprint();
+
+    // null for the layers of the other pipeline stages
     std::vector<LlamaDecoderLayerWeight<T>*> decoder_layer_weights;
 
     T* pre_decoder_embedding_table{};
     T* output_norm_weight{};
     T* post_decoder_embedding_kernel{};
 
+    // With `embedding_quant`, the int8 embedding table and its per-row scales replace `pre_decoder_embedding_table`
+    int8_t* pre_decoder_embedding_s8{};
+    float*  pre_decoder_embedding_scales{};
+
+    // With `lm_head_quant`, the packed (dense) or weight-only quantized [hidden, vocab / tp] output embedding replaces
+    // `post_decoder_embedding_kernel`
+    LlamaDenseWeight<T> lm_head;
+
+    // Medusa draft heads, `x + SiLU(res(x))` projected to the vocab. Only loaded with speculative decoding enabled
+    struct MedusaHead {
+        LlamaDenseWeight<T> res;     // [hidden, hidden] with bias, replicated on the ranks
+        LlamaDenseWeight<T> output;  // [hidden, vocab / tp], same layout as `post_decoder_embedding_kernel`
+    };
+    std::vector<MedusaHead> medusa_heads;
+
+    // multi-LoRA adapters, null when disabled
+    std::unique_ptr<LoraAdapterPool> adapters;
+
 private:
+    void initAdapters(const ModelParam& model, const EngineParam& engine_param);
+
+    void quantizeEmbeddings();
+
+    TensorMap getCommonParams();
+
+    void snapshot(WeightSnapshot& s);
+
+    void loadTensors(const TensorMap& params, StagedCopier& copier);
+
+    void mallocLayer(int layer);
+
     size_t     hidden_units_;
     size_t     vocab_size_;
     size_t     vocab_size_padded_;
@@ -61,9 +108,28 @@ private:
     size_t     tp_size_;  // this will follow attn tp param
     size_t     tp_rank_;
 
+    std::string lm_head_quant_;
+    std::string embedding_quant_;
+
+    // decoder layers of the pipeline stage
+    int layer_begin_;
+    int layer_end_;
+
     std::vector<int> inter_size_;
 
     cudaStream_t stream_;
+
+    std::unique_ptr<SafeTensors> model_file_;
+
+    // With `offload_weights` the layers are allocated right before they are filled, streamed layers are prepared and
+    // paged out one at a time
+    bool                         offload_;
+    std::vector<bool>            layer_allocated_;
+    std::unique_ptr<WeightPager> pager_;
+
+    // With `moe_expert_cache` the routed experts are moved to the host as the layers are prepared
+    int                          expert_cache_slots_;
+    std::unique_ptr<ExpertCache> expert_cache_;
 };
 
 }  // namespace turbomind
@@ -0,0 +1,319 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/turbomind/models/llama/PrefixStore.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+static constexpr char     kMagic[8] = "TMPFXC";
+static constexpr uint32_t kVersion  = 3;
+static constexpr size_t   kPageSize = 4096;
+
+static size_t round_up(size_t x, size_t n)
+{
+    return (x + n - 1) / n * n;
+}
+
+PrefixStore::PrefixStore(const std::string& path,
+                         size_t             block_size,
+                         int                block_len,
+                         size_t             capacity,
+                         uint64_t           fingerprint,
+                         IAllocator*        allocator):
+    path_{path},
+    block_size_{block_size},
+    block_len_{block_len},
+    fingerprint_{fingerprint},
+    allocator_{allocator},
+    stream_{allocator->returnStream()}
+{
+    header_size_ = kPageSize;
+    data_offset_ = round_up(sizeof(Meta) + sizeof(int) * block_len_, kPageSize);
+    slot_stride_ = round_up(data_offset_ + block_size_, kPageSize);
+    slot_count_  = capacity / slot_stride_;
+    file_size_   = header_size_ + slot_stride_ * slot_count_;
+
+    FT_CHECK_WITH_INFO(slot_count_ > 0, "prefix cache disk space is too small for a single block");
+
+    if (!Open(false)) {
+        throw std::runtime_error("failed to open prefix cache file " + path_);
+    }
+
+    slot_tokens_.resize(slot_count_);
+    pending_.resize(slot_count_);
+
+    for (int i = 0; i < kStagingCount; ++i) {
+        staging_.push_back((std::byte*)allocator_->malloc(block_size_, false, true));
+        check_cuda_error(cudaEventCreateWithFlags(&events_.emplace_back(), cudaEventDisableTiming));
+        free_staging_.push_back(i);
+    }
+
+    TM_LOG_INFO("[PrefixStore] %s, %d / %d blocks loaded", path_.c_str(), (int)index_.size(), slot_count_);
+
+    int device_id{};
+    check_cuda_error(cudaGetDevice(&device_id));
+    writer_ = std::thread([this, device_id] {
+        check_cuda_error(cudaSetDevice(device_id));
+        WriterThreadEntry();
+    });
+}
+
+PrefixStore::~PrefixStore()
+{
+    if (dropped_) {
+        TM_LOG_INFO("[PrefixStore] %s, %ld writes dropped under backpressure", path_.c_str(), (long)dropped_);
+    }
+    {
+        std::lock_guard lock{mutex_};
+        done_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+
+    for (size_t i = 0; i < staging_.size(); ++i) {
+        allocator_->free((void**)&staging_[i], true);
+        cudaEventDestroy(events_[i]);
+    }
+
+    if (base_) {
+        msync(base_, file_size_, MS_SYNC);
+        munmap(base_, file_size_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool PrefixStore::Open(bool reset)
+{
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    struct stat st {};
+    if (fstat(fd_, &st) != 0) {
+        return false;
+    }
+
+    reset = reset || (size_t)st.st_size != file_size_;
+
+    if (reset) {
+        if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, file_size_) != 0) {
+            return false;
+        }
+    }
+
+    void* ptr = mmap(nullptr, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    base_   = (std::byte*)ptr;
+    header_ = (Header*)base_;
+
+    const bool compatible = std::memcmp(header_->magic, kMagic, sizeof(kMagic)) == 0 && header_->version == kVersion
+                            && header_->block_len == block_len_ && header_->block_size == block_size_
+                            && header_->slot_count == slot_count_;
+
+    // the same geometry may be of another checkpoint, data type or kv cache quantization
+    const bool same_model = header_->fingerprint == fingerprint_;
+
+    if (!compatible || !same_model) {
+        if (!reset && !compatible) {
+            TM_LOG_WARNING("[PrefixStore] Incompatible prefix cache file %s, resetting", path_.c_str());
+        }
+        else if (!reset) {
+            TM_LOG_WARNING("[PrefixStore] Prefix cache file %s is of another model, resetting", path_.c_str());
+        }
+        std::memset(base_, 0, header_size_);
+        for (int i = 0; i < slot_count_; ++i) {
+            meta(i)->valid = 0;
+        }
+        std::memcpy(header_->magic, kMagic, sizeof(kMagic));
+        header_->version    = kVersion;
+        header_->block_len  = block_len_;
+        header_->block_size = block_size_;
+        header_->slot_count  = slot_count_;
+        header_->cursor      = 0;
+        header_->fingerprint = fingerprint_;
+    }
+
+    slot_keys_.assign(slot_count_, 0);
+    slot_parents_.assign(slot_count_, 0);
+    index_.clear();
+    for (int i = 0; i < slot_count_; ++i) {
+        if (auto m = meta(i); m->valid) {
+            index_.emplace(m->key, i);
+            slot_keys_[i]    = m->key;
+            slot_parents_[i] = m->parent;
+        }
+    }
+
+    return true;
+}
+
+void PrefixStore::Put(uint64_t key, uint64_t parent, const std::vector<int>& tokens, const void* src)
+{
+    FT_CHECK(tokens.size() == block_len_);
+
+    std::unique_lock lock{mutex_};
+
+    if (index_.count(key)) {
+        return;
+    }
+
+    // the engine thread never waits for the writer thread, the block is computed again on a miss
+    if (budget_ <= 0) {
+        ++dropped_;
+        return;
+    }
+    --budget_;
+
+    const int slot = header_->cursor % slot_count_;
+
+    // the staging buffer & the slot are free within the budget
+    FT_CHECK(!free_staging_.empty() && !pending_[slot]);
+
+    const int staging = free_staging_.back();
+    free_staging_.pop_back();
+
+    ++header_->cursor;
+
+    if (auto old = slot_keys_[slot]) {
+        index_.erase(old);
+    }
+    index_[key]         = slot;
+    slot_keys_[slot]    = key;
+    slot_parents_[slot] = parent;
+    slot_tokens_[slot]  = tokens;
+    pending_[slot]      = true;
+
+    check_cuda_error(cudaMemcpyAsync(staging_[staging], src, block_size_, cudaMemcpyDeviceToHost, stream_));
+    check_cuda_error(cudaEventRecord(events_[staging], stream_));
+
+    jobs_.push_back({slot, staging});
+
+    lock.unlock();
+    cv_.notify_all();
+}
+
+int PrefixStore::Writable()
+{
+    std::lock_guard lock{mutex_};
+    const int       limit = std::min<int>(free_staging_.size(), slot_count_);
+    int             n     = 0;
+    while (n < limit && !pending_[(header_->cursor + n) % slot_count_]) {
+        ++n;
+    }
+    return n;
+}
+
+void PrefixStore::SetBudget(int n)
+{
+    std::lock_guard lock{mutex_};
+    budget_ = n;
+}
+
+bool PrefixStore::Match(uint64_t key, const int* prompt, int index)
+{
+    std::lock_guard lock{mutex_};
+    // the keys are not collision resistant, the whole prefix is compared
+    for (int i = index; i >= 0; --i) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        const int  slot   = it->second;
+        const int* tokens = prompt + (size_t)i * block_len_;
+        const int* stored = pending_[slot] ? slot_tokens_[slot].data() : this->tokens(slot);
+        if (!std::equal(tokens, tokens + block_len_, stored)) {
+            return false;
+        }
+        key = slot_parents_[slot];
+    }
+    return key == 0;
+}
+
+void PrefixStore::Get(uint64_t key, void* dst)
+{
+    std::unique_lock lock{mutex_};
+    const int        slot = index_.at(key);
+    cv_.wait(lock, [&] { return !pending_[slot]; });
+    // pageable -> device, returns when the data is staged
+    check_cuda_error(cudaMemcpyAsync(dst, data(slot), block_size_, cudaMemcpyHostToDevice, stream_));
+}
+
+uint64_t PrefixStore::Digest()
+{
+    std::lock_guard lock{mutex_};
+    uint64_t        digest = index_.size();
+    for (const auto& [key, slot] : index_) {
+        uint64_t x = key + 0x9e3779b97f4a7c15ull;
+        x          = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x          = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        digest ^= x ^ (x >> 31);
+    }
+    return digest;
+}
+
+void PrefixStore::Clear()
+{
+    std::unique_lock lock{mutex_};
+    cv_.wait(lock, [&] { return jobs_.empty() && free_staging_.size() == staging_.size(); });
+    for (int i = 0; i < slot_count_; ++i) {
+        meta(i)->valid = 0;
+    }
+    header_->cursor = 0;
+    slot_keys_.assign(slot_count_, 0);
+    slot_parents_.assign(slot_count_, 0);
+    index_.clear();
+}
+
+void PrefixStore::WriterThreadEntry() noexcept
+{
+    while (true) {
+        Job job{};
+        {
+            std::unique_lock lock{mutex_};
+            cv_.wait(lock, [&] { return !jobs_.empty() || done_; });
+            if (jobs_.empty()) {
+                break;
+            }
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        check_cuda_error(cudaEventSynchronize(events_[job.staging]));
+
+        // `slot_tokens_[slot]`, `slot_keys_[slot]` & `slot_parents_[slot]` won't change while the slot is pending
+        auto m   = meta(job.slot);
+        m->valid = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        std::copy_n(slot_tokens_[job.slot].data(), block_len_, tokens(job.slot));
+        std::memcpy(data(job.slot), staging_[job.staging], block_size_);
+        m->key    = slot_keys_[job.slot];
+        m->parent = slot_parents_[job.slot];
+        std::atomic_thread_fence(std::memory_order_release);
+        m->valid = 1;
+
+        {
+            std::lock_guard lock{mutex_};
+            pending_[job.slot] = false;
+            slot_tokens_[job.slot].clear();
+            free_staging_.push_back(job.staging);
+        }
+        cv_.notify_all();
+    }
+}
+
+}  // namespace turbomind
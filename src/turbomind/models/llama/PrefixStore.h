@@ -0,0 +1,154 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/utils/allocator.h"
+
+namespace turbomind {
+
+// Memory-mapped on-disk store of prefix cache blocks, keyed by the chained hash of the block tokens (see
+// `BlockTrie`). A block records the key of its parent, a match walks the parents to the root. Slots are replaced in
+// FIFO order. Writes are staged through pinned memory and committed to the file by a background thread; the index is
+// updated eagerly so that the store state only depends on the order of `Put` calls, which keeps TP ranks in agreement.
+// The file is reset when it's of another model, see `fingerprint`.
+class PrefixStore {
+public:
+    // `fingerprint` identifies the weights, data type & kv cache quantization the blocks are computed with
+    PrefixStore(const std::string& path,
+                size_t             block_size,
+                int                block_len,
+                size_t             capacity,
+                uint64_t           fingerprint,
+                IAllocator*        allocator);
+
+    ~PrefixStore();
+
+    PrefixStore(const PrefixStore&) = delete;
+    PrefixStore& operator=(const PrefixStore&) = delete;
+
+    // Persist a computed device block following the block of `parent` (0 for the first block), no-op if the key exists.
+    // Dropped when over the budget of the step
+    void Put(uint64_t key, uint64_t parent, const std::vector<int>& tokens, const void* src);
+
+    // Writes that can be staged without waiting for the writer thread
+    [[nodiscard]] int Writable();
+
+    // The first `n` writes until the next call are staged, the rest are dropped. The same on all ranks, so that the
+    // indices stay in agreement, e.g. the least `Writable` of the ranks
+    void SetBudget(int n);
+
+    // key of block `index` of `prompt` exists and the stored tokens of the block & its parents are identical
+    [[nodiscard]] bool Match(uint64_t key, const int* prompt, int index);
+
+    // Copy a stored block to device, the key must be matched
+    void Get(uint64_t key, void* dst);
+
+    // Order independent digest of the valid keys, used to check consistency between ranks
+    [[nodiscard]] uint64_t Digest();
+
+    void Clear();
+
+    int size()
+    {
+        std::lock_guard lock{mutex_};
+        return index_.size();
+    }
+
+private:
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t block_len;
+        uint64_t block_size;
+        uint64_t slot_count;
+        uint64_t cursor;
+        uint64_t fingerprint;
+    };
+
+    struct Meta {
+        uint64_t key;
+        uint64_t parent;
+        uint32_t valid;
+        uint32_t pad;
+    };
+
+    struct Job {
+        int slot;
+        int staging;
+    };
+
+    std::byte* slot_ptr(int slot) const noexcept
+    {
+        return base_ + header_size_ + slot_stride_ * slot;
+    }
+
+    Meta* meta(int slot) const noexcept
+    {
+        return (Meta*)slot_ptr(slot);
+    }
+
+    int* tokens(int slot) const noexcept
+    {
+        return (int*)(slot_ptr(slot) + sizeof(Meta));
+    }
+
+    std::byte* data(int slot) const noexcept
+    {
+        return slot_ptr(slot) + data_offset_;
+    }
+
+    bool Open(bool reset);
+
+    void WriterThreadEntry() noexcept;
+
+private:
+    std::string  path_;
+    size_t       block_size_;
+    int          block_len_;
+    uint64_t     fingerprint_;
+    IAllocator*  allocator_;
+    cudaStream_t stream_;
+
+    size_t header_size_{};
+    size_t data_offset_{};
+    size_t slot_stride_{};
+    int    slot_count_{};
+
+    int        fd_{-1};
+    std::byte* base_{};
+    size_t     file_size_{};
+    Header*    header_{};
+
+    std::unordered_map<uint64_t, int> index_;
+    std::vector<uint64_t>             slot_keys_;
+    std::vector<uint64_t>             slot_parents_;
+    std::vector<std::vector<int>>     slot_tokens_;  // tokens of pending writes
+    std::vector<bool>                 pending_;
+
+    static constexpr int     kStagingCount = 8;
+    std::vector<std::byte*>  staging_;
+    std::vector<cudaEvent_t> events_;
+    std::vector<int>         free_staging_;
+    int                      budget_{};
+    int64_t                  dropped_{};  // writes over the budgets
+
+    std::deque<Job>         jobs_;
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    bool                    done_{};
+
+    std::thread writer_;
+};
+
+}  // namespace turbomind
@@ -6,6 +6,8 @@
 #include "src/turbomind/utils/allocator.h"
 #include "src/turbomind/utils/debug_utils.h"
 #include "src/turbomind/utils/logger.h"
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdlib>
 #include <ctime>
@@ -18,69 +20,206 @@ SequenceManager::SequenceManager(size_t             layer_num,
                                  const BlockConfig& block_config,
                                  double             block_count,
                                  int                chunk_size,
+                                 size_t             swap_space,
                                  bool               enable_prefix_caching,
                                  int                rank,
                                  IAllocator*        allocator,
-                                 GetFreeMemSize     get_free_size):
-    block_seq_len_(block_config.block_len_), rank_(rank)
+                                 GetFreeMemSize     get_free_size,
+                                 const std::string& prefix_store_path,
+                                 size_t             prefix_store_size,
+                                 uint64_t           prefix_store_fingerprint,
+                                 int                sink_size,
+                                 int                window_size,
+                                 EvictionPolicy     eviction_policy,
+                                 KvCacheLease       lease,
+                                 bool               virtual_memory,
+                                 const TierConfig&  tier,
+                                 const StateConfig& state):
+    block_seq_len_(block_config.block_len_), rank_(rank), window_size_(window_size), recent_blocks_(tier.recent_blocks)
 {
-    block::Layout layout{block_config};
-    // dump(layout);
+    sink_len_ = (sink_size + block_seq_len_ - 1) / block_seq_len_ * block_seq_len_;
 
-    size_t block_size = layout.block_size(layer_num);
+    // Evicted blocks can't be shared by the sequences
+    FT_CHECK_WITH_INFO(!window_size_ || !enable_prefix_caching, "sliding window kv cache requires no prefix caching");
 
-    block_manager_ = std::make_shared<BlockManager>(block_size, block_count, chunk_size, allocator, get_free_size);
-    block_trie_    = std::make_shared<BlockTrie>(block_config.block_len_, block_manager_, enable_prefix_caching);
+    // The cold blocks are never matched nor evicted from the middle of a sequence
+    FT_CHECK_WITH_INFO(!recent_blocks_ || (!window_size_ && !enable_prefix_caching),
+                       "tiered kv cache requires no sliding window nor prefix caching");
+
+    // A matched prefix has no state to continue from
+    FT_CHECK_WITH_INFO(!state.state_size || !enable_prefix_caching, "recurrent state cache requires no prefix caching");
+
+    // the sequences count the tokens of all the context parallel ranks in their blocks
+    auto local_config = block_config;
+    if (block_config.cp_size_ > 1) {
+        local_config.block_len_ /= block_config.cp_size_;
+    }
+
+    // the cold blocks are requantized layer by layer of the same layout
+    FT_CHECK_WITH_INFO(!recent_blocks_ || block_config.layers_.empty(),
+                       "tiered kv cache requires the same kv heads & precision in all layers");
+
+    const size_t block_size = BlockSize(layer_num, block_config);
+
+    // the recent blocks take the rest of the memory of the tiers
+    const double hot_count = recent_blocks_ && block_count < 1. ? block_count * (1. - tier.ratio) : block_count;
+
+    block_manager_ = std::make_shared<BlockManager>(block_size,
+                                                    hot_count,
+                                                    chunk_size,
+                                                    allocator,
+                                                    get_free_size,
+                                                    swap_space,
+                                                    eviction_policy,
+                                                    std::move(lease),
+                                                    virtual_memory);
+
+    // the swap-ins share the copy stream of the host pool, the slots are reused in the order of the copies
+    auto pool     = block_manager_->host_pool();
+    block_copier_ = std::make_unique<BlockCopier>(LayerOffsets(layer_num, block_config),
+                                                  block_size,
+                                                  allocator->returnStream(),
+                                                  pool ? pool->copy_stream() : nullptr);
+
+    if (recent_blocks_) {
+        auto cold_config    = local_config;
+        cold_config.t_bits_ = tier.t_bits;
+        cold_config.q_bits_ = tier.q_bits;
+
+        const size_t cold_size = block::Layout{cold_config}.block_size(layer_num);
+        const double bytes = (double)block_manager_->max_block_count() * block_size * tier.ratio / (1. - tier.ratio);
+
+        cold_manager_ = std::make_shared<BlockManager>(
+            cold_size, std::max(1., std::floor(bytes / cold_size)), chunk_size, allocator, get_free_size);
+    }
+
+    std::shared_ptr<PrefixStore> store;
+    if (enable_prefix_caching && !prefix_store_path.empty() && prefix_store_size) {
+        store = std::make_shared<PrefixStore>(prefix_store_path,
+                                              block_size,
+                                              block_config.block_len_,
+                                              prefix_store_size,
+                                              prefix_store_fingerprint,
+                                              allocator);
+    }
+
+    // copy on write of the cached partial blocks
+    auto copy = [this](int src, int dst) { block_copier_->Add(GetBlockPtr(src), GetBlockPtr(dst)); };
+
+    block_trie_ =
+        std::make_shared<BlockTrie>(block_config.block_len_, block_manager_, enable_prefix_caching, store, copy);
+
+    if (state.state_size) {
+        state_pool_ = std::make_unique<StatePool>(state.state_size, state.slot_count, allocator);
+    }
+}
+
+size_t SequenceManager::BlockSize(size_t layer_num, const BlockConfig& block_config)
+{
+    return LayerOffsets(layer_num, block_config).back() + block_config.summary_size_;
+}
+
+std::vector<size_t> SequenceManager::LayerOffsets(size_t layer_num, const BlockConfig& block_config)
+{
+    FT_CHECK(block_config.layers_.empty() || block_config.layers_.size() == layer_num);
+    std::vector<size_t> offsets{0};
+    for (size_t i = 0; i < layer_num; ++i) {
+        auto local_config = block_config.layer(i);
+        if (block_config.cp_size_ > 1) {
+            local_config.block_len_ /= block_config.cp_size_;
+        }
+        offsets.push_back(offsets.back() + block::Layout{local_config}.layer_size());
+    }
+    return offsets;
+}
+
+Sequence& SequenceTable::emplace(uint64_t id)
+{
+    uint32_t slot{};
+    if (free_.empty()) {
+        slot = slots_.size();
+        slots_.emplace_back(id);
+    }
+    else {
+        slot = free_.back();
+        free_.pop_back();
+        slots_[slot].id = id;
+    }
+    FT_CHECK(index_.emplace(id, slot).second);
+    return slots_[slot];
+}
+
+void SequenceTable::erase(uint64_t id)
+{
+    const auto it = index_.find(id);
+    FT_CHECK(it != index_.end());
+    // release the buffers of the sequence, the slot is taken by the next one
+    slots_[it->second] = Sequence{0};
+    free_.push_back(it->second);
+    index_.erase(it);
 }
 
 const Sequence* SequenceManager::Create(uint64_t id)
 {
-    Sequence sequence{id};
-    auto     it = sequences_.find(id);
-    if (it != sequences_.end()) {
+    if (auto seq = sequences_.find(id)) {
         if (rank_ == 0) {
             TM_LOG_WARNING("[SequenceManager][Create] Removing conflicting ID %ld", (long)id);
         }
-        Erase(it);
+        Erase(*seq);
     }
-    it = sequences_.emplace_hint(it, id, std::move(sequence));
-    return &it->second;
+    return &sequences_.emplace(id);
 }
 
 const Sequence* SequenceManager::Get(uint64_t id)
 {
-    if (auto it = sequences_.find(id); it != sequences_.end()) {
-        return &it->second;
-    }
-    return nullptr;
+    return sequences_.find(id);
 }
 
 bool SequenceManager::Contains(uint64_t id)
 {
-    return sequences_.find(id) != sequences_.end();
+    return sequences_.find(id) != nullptr;
 }
 
-void SequenceManager::Erase(std::map<uint64_t, Sequence>::iterator& it)
+void SequenceManager::Erase(Sequence& seq)
 {
-    auto& seq = it->second;
     if (seq.status == Sequence::kCached) {
         const int count = block_manager_->Verify(seq.blocks, seq.block_unique_ids);
         seq.blocks.resize(count);
+        if (cold_manager_) {
+            seq.cold_blocks.resize(cold_manager_->Verify(seq.cold_blocks, seq.cold_unique_ids));
+        }
     }
     else {
         UpdateAndSetUnlock(seq);
     }
+    cold_freed_.insert(cold_freed_.end(), seq.cold_blocks.begin(), seq.cold_blocks.end());
+    if (auto pool = block_manager_->host_pool()) {
+        pool->Release(seq.swapped_ids);
+    }
+    if (seq.state_slot >= 0) {
+        state_pool_->Release(seq.state_slot);
+    }
     // if prefix cache enabled, blocks will be shared by sequences, cannot be freed immediately
     if (!block_trie_->enabled()) {
         freed_.insert(freed_.end(), seq.blocks.begin(), seq.blocks.end());
     }
-    it = sequences_.erase(it);
+    // a fork erased before its first write
+    for (auto it = first_writes_.begin(); it != first_writes_.end();) {
+        if (it->id == seq.id) {
+            ReleaseFirstWrite(*it);
+            it = first_writes_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    sequences_.erase(seq.id);
 }
 
 bool SequenceManager::Erase(uint64_t id)
 {
-    if (auto it = sequences_.find(id); it != sequences_.end()) {
-        Erase(it);
+    if (auto seq = sequences_.find(id)) {
+        Erase(*seq);
         return true;
     }
     return false;
@@ -89,11 +228,11 @@ bool SequenceManager::Erase(uint64_t id)
 void SequenceManager::CacheIfEnabled(const Sequences& sequences, int active_size)
 {
     if (block_trie_->enabled()) {
-        block_trie_->verify();
+        trie_nodes_ = block_trie_->verify() - 1;
         for (int i = 0; i < active_size; ++i) {
             auto& seq = *sequences[i];
-            // only cache prompt blocks
-            if (!seq.prompt.empty()) {
+            // only cache prompt blocks, once the prompt is computed (the chunks of a long prompt take several steps)
+            if (!seq.prompt.empty() && seq.cache_len >= (int)seq.prompt.size()) {
                 block_trie_->cache(seq);
                 seq.prompt.clear();
             }
@@ -101,25 +240,693 @@ void SequenceManager::CacheIfEnabled(const Sequences& sequences, int active_size
     }
 }
 
+void SequenceManager::SetPinBudget(int tokens)
+{
+    // the pinned blocks are the ones of the prefix cache
+    FT_CHECK_WITH_INFO(!tokens || block_trie_->enabled(), "pinning prompt blocks requires prefix caching");
+    pin_budget_ = tokens / block_seq_len_;
+}
+
+int SequenceManager::PinPrefix(const Sequence& seq, int len)
+{
+    // the quantized blocks of a tiered kv cache are not cached by the prefix cache
+    if (!block_trie_->enabled() || !seq.cold_blocks.empty()) {
+        return 0;
+    }
+
+    BlockIds  blocks;
+    const int count = std::min<int>(len / block_seq_len_, seq.blocks.size());
+    for (int i = 0; i < count; ++i) {
+        if (!pinned_.count(seq.blocks[i])) {
+            blocks.push_back(seq.blocks[i]);
+        }
+    }
+
+    if (blocks.empty()) {
+        return 0;
+    }
+
+    if ((int)blocks.size() > pin_budget_) {
+        if (rank_ == 0) {
+            TM_LOG_WARNING("[SequenceManager] %d prompt blocks of ID %lu exceed the pin budget of %d blocks",
+                           (int)blocks.size(),
+                           (long)seq.id,
+                           pin_budget_);
+        }
+        return 0;
+    }
+
+    // release the oldest pins
+    while (pinned_.size() + blocks.size() > (size_t)pin_budget_) {
+        for (const auto& i : pins_.front()) {
+            pinned_.erase(i);
+        }
+        unlocked_.insert(unlocked_.end(), pins_.front().begin(), pins_.front().end());
+        pins_.pop_front();
+    }
+
+    // the blocks are locked by `seq`, they stay active when it's released
+    block_manager_->Lock(blocks);
+
+    pinned_.insert(blocks.begin(), blocks.end());
+    pins_.push_back(std::move(blocks));
+
+    return pins_.back().size();
+}
+
+void SequenceManager::UnpinAll()
+{
+    for (const auto& p : pins_) {
+        unlocked_.insert(unlocked_.end(), p.begin(), p.end());
+    }
+    pins_.clear();
+    pinned_.clear();
+}
+
+std::vector<void*> SequenceManager::LockForExport(const Sequence& seq, int& cache_len)
+{
+    FT_CHECK(seq.status == Sequence::kCached);
+
+    // the partial block of a fork is read by the export
+    FlushFirstWrites();
+
+    VerifyAndLockCached({&seq});
+
+    // swapped out blocks are not exported, neither is the window after evicted tokens nor the quantized blocks of a
+    // tiered kv cache
+    cache_len = std::min<int>(seq.cache_len, seq.evicted_len ? sink_len_ : seq.blocks.size() * block_seq_len_);
+    if (!seq.cold_blocks.empty()) {
+        cache_len = 0;
+    }
+
+    std::vector<void*> block_ptrs;
+    for (int i = 0; i < (cache_len + block_seq_len_ - 1) / block_seq_len_; ++i) {
+        block_ptrs.push_back(GetBlockPtr(seq.blocks[i]));
+    }
+
+    return block_ptrs;
+}
+
+const Sequence* SequenceManager::CreateForImport(uint64_t id, int cache_len, std::vector<void*>& block_ptrs)
+{
+    const int count = (cache_len + block_seq_len_ - 1) / block_seq_len_;
+
+    CommitUnlockAndFree();
+
+    if (block_manager_->free_count() + block_manager_->cached_count() < count) {
+        return nullptr;
+    }
+
+    if (const int evict = count - block_manager_->free_count(); evict > 0) {
+        block_manager_->Evict(evict);
+    }
+
+    auto [block_ids, unique_ids] = block_manager_->Allocate(count);
+
+    auto& seq = const_cast<Sequence&>(*Create(id));
+
+    seq.blocks.swap(block_ids);
+    seq.block_unique_ids.swap(unique_ids);
+    seq.cache_len = cache_len;
+    seq.status    = Sequence::kLocked;
+
+    block_ptrs.clear();
+    for (const auto& b : seq.blocks) {
+        block_ptrs.push_back(GetBlockPtr(b));
+    }
+
+    return &seq;
+}
+
+std::pair<BlockIds, UniqueIds> SequenceManager::ShareBlocks(const Sequence& p, int& cache_len, FirstWrite* first_write)
+{
+    BlockIds  blocks(p.blocks.begin(), p.blocks.begin() + cache_len / block_seq_len_);
+    UniqueIds unique_ids(p.block_unique_ids.begin(), p.block_unique_ids.begin() + blocks.size());
+
+    // Keep the shared blocks from being evicted for the copy
+    block_manager_->Lock(blocks);
+
+    // With prefix caching the blocks are never freed by the sequences
+    if (!block_trie_->enabled()) {
+        block_manager_->Share(blocks);
+    }
+
+    // Copy on write of the partial block, which is written by the next token of both
+    if (const int partial = cache_len % block_seq_len_) {
+        const int last = p.blocks[blocks.size()];
+        block_manager_->Lock({last});
+        if (block_manager_->free_count() || block_manager_->cached_count()) {
+            if (!block_manager_->free_count()) {
+                block_manager_->Evict(1);
+            }
+            auto [block_ids, block_unique_ids] = block_manager_->Allocate(1);
+            if (first_write) {
+                // locked & referenced until the first write, the parent may be erased before it
+                block_manager_->Share({last});
+                *first_write = {0, last, block_ids[0], block_unique_ids[0], cache_len};
+            }
+            else {
+                block_copier_->Add(GetBlockPtr(last), GetBlockPtr(block_ids[0]));
+                block_copier_->Issue();
+            }
+            blocks.push_back(block_ids[0]);
+            unique_ids.push_back(block_unique_ids[0]);
+        }
+        else {
+            cache_len -= partial;
+        }
+        if (!first_write || first_write->src < 0) {
+            unlocked_.push_back(last);
+        }
+    }
+
+    return {std::move(blocks), std::move(unique_ids)};
+}
+
+const Sequence* SequenceManager::Fork(uint64_t parent, uint64_t id)
+{
+    FT_CHECK(parent != id);
+
+    const Sequence* parent_seq = sequences_.find(parent);
+    if (!parent_seq) {
+        return nullptr;
+    }
+    const Sequence& p = *parent_seq;
+
+    CommitUnlockAndFree();
+
+    // Only the valid blocks on device of a sequence that is not running are shared, the window of a sliding window
+    // cache is never shared as it's freed by each sequence on its own, neither are the cold blocks of a tiered cache
+    int cache_len = 0;
+    int count     = 0;
+    if (p.status == Sequence::kCached && !window_size_ && p.cold_blocks.empty()) {
+        count     = block_manager_->Verify(p.blocks, p.block_unique_ids);
+        cache_len = std::min<int>(p.cache_len, count * block_seq_len_);
+    }
+
+    // Without prefix caching the partial block may be left to the first write of the fork, see `SetCopyOnFirstWrite`
+    FirstWrite first_write{0, -1};
+    const bool deferred       = copy_on_first_write_ && !block_trie_->enabled();
+    auto [blocks, unique_ids] = ShareBlocks(p, cache_len, deferred ? &first_write : nullptr);
+
+    // The fork starts with its own random state
+    std::vector<int> tokens     = p.tokens;
+    const float      rope_theta = p.rope_theta;
+
+    auto& seq = const_cast<Sequence&>(*Create(id));
+
+    seq.blocks.swap(blocks);
+    seq.block_unique_ids.swap(unique_ids);
+    seq.tokens.swap(tokens);
+    seq.rope_theta = rope_theta;
+    seq.cache_len  = cache_len;
+    seq.status     = Sequence::kLocked;
+
+    if (first_write.src >= 0) {
+        first_write.id = id;
+        first_writes_.push_back(first_write);
+    }
+
+    UpdateAndSetUnlock(seq);
+    CommitUnlockAndFree();
+
+    return &seq;
+}
+
+void SequenceManager::ReleaseFirstWrite(const FirstWrite& w)
+{
+    unlocked_.push_back(w.src);
+    freed_.push_back(w.src);
+}
+
+void* SequenceManager::TakeFirstWriteSource(const Sequence& seq)
+{
+    auto it = std::find_if(first_writes_.begin(), first_writes_.end(), [&](auto& w) { return w.id == seq.id; });
+    if (it == first_writes_.end()) {
+        return nullptr;
+    }
+
+    const FirstWrite w = *it;
+    first_writes_.erase(it);
+
+    // The source is read by the kernels enqueued before the next `Materialize`, which is when it's unlocked
+    ReleaseFirstWrite(w);
+
+    // The partial block may have been evicted before the fork is scheduled, or the fork rewound to an earlier block
+    const int i = w.cache_len / block_seq_len_;
+    if (seq.cache_len > w.cache_len || seq.cache_len / block_seq_len_ != i || i >= (int)seq.blocks.size()
+        || seq.blocks[i] != w.dst || seq.block_unique_ids[i] != w.dst_unique_id) {
+        return nullptr;
+    }
+
+    return GetBlockPtr(w.src);
+}
+
+void SequenceManager::FlushFirstWrites()
+{
+    if (first_writes_.empty()) {
+        return;
+    }
+    for (const auto& w : first_writes_) {
+        // skipped when the block is evicted, it may belong to another sequence now
+        if (block_manager_->Verify({w.dst}, {w.dst_unique_id})) {
+            block_copier_->Add(GetBlockPtr(w.src), GetBlockPtr(w.dst));
+        }
+        ReleaseFirstWrite(w);
+    }
+    first_writes_.clear();
+    block_copier_->Issue();
+}
+
+const Sequence* SequenceManager::Branch(const Sequence& parent, uint64_t id)
+{
+    FT_CHECK(parent.status == Sequence::kActive && parent.id != id);
+    FT_CHECK(!window_size_ && parent.cold_blocks.empty());
+
+    CommitUnlockAndFree();
+
+    int cache_len = parent.cache_len;
+
+    auto [blocks, unique_ids] = ShareBlocks(parent, cache_len);
+
+    const float rope_theta = parent.rope_theta;
+
+    auto& seq = const_cast<Sequence&>(*Create(id));
+
+    seq.blocks.swap(blocks);
+    seq.block_unique_ids.swap(unique_ids);
+    seq.rope_theta = rope_theta;
+    seq.cache_len  = cache_len;
+    seq.status     = Sequence::kLocked;
+
+    UpdateAndSetUnlock(seq);
+    CommitUnlockAndFree();
+
+    return &seq;
+}
+
+void SequenceManager::Reparent(const Sequences& seqs, const std::vector<int>& parents)
+{
+    FT_CHECK(seqs.size() == parents.size());
+
+    CommitUnlockAndFree();
+
+    // the new blocks are taken from the blocks before the call, a parent may be replaced by its own parent
+    std::vector<std::pair<BlockIds, UniqueIds>> blocks(seqs.size());
+    std::vector<int>                            cache_lens(seqs.size());
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        if (parents[i] != (int)i) {
+            const auto& p = *seqs.at(parents[i]);
+            FT_CHECK(p.status == Sequence::kActive && seqs[i]->status == Sequence::kActive);
+            cache_lens[i] = p.cache_len;
+            blocks[i]     = ShareBlocks(p, cache_lens[i]);
+        }
+    }
+
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        if (parents[i] == (int)i) {
+            continue;
+        }
+        auto& seq = const_cast<Sequence&>(*seqs[i]);
+        // the blocks are locked by the active sequence, with prefix caching they are never freed by the sequences
+        unlocked_.insert(unlocked_.end(), seq.blocks.begin(), seq.blocks.end());
+        if (!block_trie_->enabled()) {
+            freed_.insert(freed_.end(), seq.blocks.begin(), seq.blocks.end());
+        }
+        if (auto pool = block_manager_->host_pool()) {
+            pool->Release(seq.swapped_ids);
+        }
+        seq.swapped_ids.clear();
+        seq.blocks.swap(blocks[i].first);
+        seq.block_unique_ids.swap(blocks[i].second);
+        seq.cache_len = cache_lens[i];
+    }
+
+    CommitUnlockAndFree();
+}
+
 void SequenceManager::VerifyAndLockCached(const Sequences& sequences)
 {
     BlockIds blocks;
+    BlockIds cold_blocks;
     for (const auto& p : sequences) {
         auto& seq = const_cast<Sequence&>(*p);
         if (seq.status != Sequence::kCached) {
             continue;
         }
         FT_CHECK(seq.blocks.size() == seq.block_unique_ids.size());
+        if (cold_manager_) {
+            // The recent blocks continue the cold ones, they are useless after an invalidated cold block
+            const int cold = cold_manager_->Verify(seq.cold_blocks, seq.cold_unique_ids);
+            if (cold < (int)seq.cold_blocks.size()) {
+                DropCold(seq, cold);
+            }
+            cold_blocks.insert(cold_blocks.end(), seq.cold_blocks.begin(), seq.cold_blocks.end());
+        }
         // Verify cache blocks that may be invalidated
         const int count = block_manager_->Verify(seq.blocks, seq.block_unique_ids);
+        if (auto pool = block_manager_->host_pool(); pool && (count < seq.blocks.size() || !seq.swapped_ids.empty())) {
+            // Invalidated blocks are followed by the ones swapped out previously
+            UniqueIds evicted(seq.block_unique_ids.begin() + count, seq.block_unique_ids.end());
+            evicted.insert(evicted.end(), seq.swapped_ids.begin(), seq.swapped_ids.end());
+            pool->Unlock(seq.swapped_ids);
+            // Only a contiguous range of blocks is useful
+            int n = 0;
+            while (n < evicted.size() && pool->Contains(evicted[n])) {
+                ++n;
+            }
+            // Drop the ones that can't be restored
+            pool->Release({evicted.begin() + n, evicted.end()});
+            evicted.resize(n);
+            pool->Lock(evicted);
+            seq.swapped_ids.swap(evicted);
+        }
         seq.blocks.resize(count);
         seq.block_unique_ids.resize(count);
+        if ((int)seq.block_scores.size() > count) {
+            seq.block_scores.resize(count);
+        }
 
         blocks.insert(blocks.end(), seq.blocks.begin(), seq.blocks.end());
-        seq.cache_len = std::min<int>(seq.cache_len, seq.blocks.size() * block_seq_len_);
+        const int block_len = (seq.blocks.size() + seq.swapped_ids.size()) * block_seq_len_ + cold_len(seq);
+        if (seq.evicted_len && block_len <= sink_len_) {
+            // The window is lost, the kv cache continues from the sinks
+            seq.evicted_len = 0;
+        }
+        seq.cache_len = std::min<int>(seq.cache_len, block_len + seq.evicted_len);
         seq.status    = Sequence::kLocked;
     }
     block_manager_->Lock(blocks);
+    if (cold_manager_) {
+        cold_manager_->Lock(cold_blocks);
+    }
+}
+
+void SequenceManager::DropCold(Sequence& seq, int keep)
+{
+    if (seq.status == Sequence::kCached) {
+        const int cold  = cold_manager_->Verify(seq.cold_blocks, seq.cold_unique_ids);
+        const int count = block_manager_->Verify(seq.blocks, seq.block_unique_ids);
+        cold_freed_.insert(
+            cold_freed_.end(), seq.cold_blocks.begin() + keep, seq.cold_blocks.begin() + std::max(keep, cold));
+        freed_.insert(freed_.end(), seq.blocks.begin(), seq.blocks.begin() + count);
+    }
+    else {
+        cold_unlocked_.insert(cold_unlocked_.end(), seq.cold_blocks.begin() + keep, seq.cold_blocks.end());
+        cold_freed_.insert(cold_freed_.end(), seq.cold_blocks.begin() + keep, seq.cold_blocks.end());
+        unlocked_.insert(unlocked_.end(), seq.blocks.begin(), seq.blocks.end());
+        freed_.insert(freed_.end(), seq.blocks.begin(), seq.blocks.end());
+    }
+    if (auto pool = block_manager_->host_pool()) {
+        pool->Release(seq.swapped_ids);
+    }
+    seq.swapped_ids.clear();
+    seq.cold_blocks.resize(keep);
+    seq.cold_unique_ids.resize(keep);
+    seq.blocks.clear();
+    seq.block_unique_ids.clear();
+    seq.cache_len = std::min(seq.cache_len, keep * block_seq_len_);
+}
+
+std::pair<void*, size_t> SequenceManager::HotBlockWindow(size_t max_bytes)
+{
+    const size_t block_size = block_manager_->block_size();
+    if (max_bytes < block_size) {
+        return {};
+    }
+
+    // (address, score) of the blocks read by more than one sequence in a step
+    std::vector<std::pair<char*, int64_t>> hot;
+    for (int i = 0; i < block_manager_->block_count(); ++i) {
+        const auto& b = block_manager_->block(i);
+        if (b.use_count > 1 && b.data) {
+            hot.emplace_back((char*)b.data, (int64_t)b.use_count * (1 + b.hit_count));
+        }
+    }
+    if (hot.empty()) {
+        return {};
+    }
+    std::sort(hot.begin(), hot.end());
+
+    // the highest sum of scores over the ranges of the addresses within `max_bytes`
+    int64_t sum  = 0;
+    int64_t best = -1;
+    size_t  first{};
+    size_t  last{};
+    for (size_t i = 0, j = 0; j < hot.size(); ++j) {
+        sum += hot[j].second;
+        while ((size_t)(hot[j].first + block_size - hot[i].first) > max_bytes) {
+            sum -= hot[i++].second;
+        }
+        if (sum > best) {
+            best  = sum;
+            first = i;
+            last  = j;
+        }
+    }
+    return {hot[first].first, hot[last].first + block_size - hot[first].first};
+}
+
+void SequenceManager::TruncateCache(const Sequence& sequence, int len)
+{
+    auto& seq = const_cast<Sequence&>(sequence);
+    if (len < cold_len(seq)) {
+        // Cold blocks are never written, the tokens after the kept ones are recomputed into recent blocks
+        DropCold(seq, len / block_seq_len_);
+    }
+    // The blocks left by the heavy-hitter eviction are scattered over the positions, so is the place of `len`
+    if (seq.evicted_len && (len < sink_len_ + seq.evicted_len || (score_budget_ && len < seq.cache_len))) {
+        // Tokens after the sinks are recomputed, the blocks of the window are reused for them
+        seq.cache_len   = std::min(len, sink_len_);
+        seq.evicted_len = 0;
+        seq.block_scores.clear();
+    }
+    seq.cache_len = std::min(seq.cache_len, len);
+
+    if (block_trie_->enabled() || seq.status != Sequence::kCached) {
+        return;
+    }
+
+    // Blocks shared with forks are never written in place, the sequence drops them from the first one that would be
+    // rewritten and recomputes the tokens
+    const int first = (seq.cache_len - cold_len(seq)) / block_seq_len_;
+    for (int i = first; i < (int)seq.blocks.size(); ++i) {
+        const auto& b = block_manager_->block(seq.blocks[i]);
+        if (b.unique_id == seq.block_unique_ids[i] && b.ref_count > 1) {
+            const int valid = block_manager_->Verify(seq.blocks, seq.block_unique_ids);
+            freed_.insert(freed_.end(), seq.blocks.begin() + i, seq.blocks.begin() + std::max(i, valid));
+            seq.blocks.resize(i);
+            seq.block_unique_ids.resize(i);
+            if (auto pool = block_manager_->host_pool()) {
+                pool->Release(seq.swapped_ids);
+            }
+            seq.swapped_ids.clear();
+            seq.cache_len = std::min(seq.cache_len, cold_len(seq) + i * block_seq_len_);
+            break;
+        }
+    }
+}
+
+void SequenceManager::AssignStates(const Sequences& sequences, std::vector<bool>& deferred, int& deferred_count)
+{
+    for (int i = 0; i < sequences.size(); ++i) {
+        auto& seq = const_cast<Sequence&>(*sequences[i]);
+        if (seq.state_slot < 0) {
+            int slot = state_pool_->Acquire(seq.id);
+            if (slot < 0) {
+                // the least recently used state of a sequence out of the batch, which recomputes its context later
+                Sequence* victim{};
+                uint64_t  oldest = -1;
+                state_pool_->ForEachUsed([&](int, uint64_t owner, uint64_t timestamp) {
+                    if (auto p = sequences_.find(owner); p && p->status == Sequence::kCached && timestamp < oldest) {
+                        victim = p;
+                        oldest = timestamp;
+                    }
+                });
+                if (victim) {
+                    state_pool_->Release(victim->state_slot);
+                    victim->state_slot = -1;
+                    slot               = state_pool_->Acquire(seq.id);
+                }
+            }
+            if (slot < 0) {
+                deferred[i] = true;
+                ++deferred_count;
+                continue;
+            }
+            seq.state_slot = slot;
+            seq.state_len  = 0;
+        }
+        // a kv cache the state doesn't match, e.g. truncated, partly evicted or imported, is recomputed
+        if (seq.cache_len != seq.state_len) {
+            TruncateCache(seq, 0);
+        }
+        state_pool_->Touch(seq.state_slot);
+    }
+}
+
+void SequenceManager::EvictOutOfWindow(const Sequences& sequences)
+{
+    if (!window_size_) {
+        return;
+    }
+
+    const int sink_blocks = sink_len_ / block_seq_len_;
+
+    for (const auto& p : sequences) {
+        auto& seq = const_cast<Sequence&>(*p);
+        // Blocks before the window of the first token to be computed
+        const int last  = (seq.cache_len - window_size_ - seq.evicted_len) / block_seq_len_;
+        const int count = std::min<int>(last, seq.blocks.size()) - sink_blocks;
+        if (count <= 0) {
+            continue;
+        }
+        const auto first = seq.blocks.begin() + sink_blocks;
+        unlocked_.insert(unlocked_.end(), first, first + count);
+        freed_.insert(freed_.end(), first, first + count);
+        seq.blocks.erase(first, first + count);
+        seq.block_unique_ids.erase(seq.block_unique_ids.begin() + sink_blocks,
+                                   seq.block_unique_ids.begin() + sink_blocks + count);
+        seq.evicted_len += count * block_seq_len_;
+    }
+
+    CommitUnlockAndFree();
+}
+
+void SequenceManager::SetScoreBudget(int tokens)
+{
+    // Evicted blocks can't be shared by the sequences, the cold blocks are never evicted from the middle
+    FT_CHECK_WITH_INFO(!tokens || (!window_size_ && !recent_blocks_ && !block_trie_->enabled()),
+                       "heavy-hitter eviction requires no sliding window, tiered kv cache nor prefix caching");
+    score_budget_ = tokens;
+}
+
+void SequenceManager::EvictLowScore(const Sequences& sequences)
+{
+    if (!score_budget_) {
+        return;
+    }
+
+    const int sink_blocks = sink_len_ / block_seq_len_;
+
+    for (const auto& p : sequences) {
+        auto& seq = const_cast<Sequence&>(*p);
+        // Tokens in the blocks, the evicted ones take no room
+        const int len   = std::min<int>(seq.cache_len - seq.evicted_len, seq.blocks.size() * block_seq_len_);
+        const int over  = (len - score_budget_ + block_seq_len_ - 1) / block_seq_len_;
+        const int count = std::min(over, len / block_seq_len_ - kScoreRecentBlocks - sink_blocks);
+        if (count <= 0) {
+            continue;
+        }
+        auto& scores = seq.block_scores;
+        scores.resize(seq.blocks.size());
+        // Candidates of the lowest scores, the earlier ones first on ties, as a sliding window does without scores
+        std::vector<int> idxs(len / block_seq_len_ - kScoreRecentBlocks - sink_blocks);
+        std::iota(idxs.begin(), idxs.end(), sink_blocks);
+        std::nth_element(idxs.begin(), idxs.begin() + count, idxs.end(), [&](int a, int b) {
+            return std::make_pair(scores[a], a) < std::make_pair(scores[b], b);
+        });
+        std::vector<bool> evict(seq.blocks.size());
+        for (int i = 0; i < count; ++i) {
+            evict[idxs[i]] = true;
+        }
+        // Compact the block table in order, the positions of the kept tokens are unchanged as the keys are rotated
+        int n = 0;
+        for (int i = 0; i < (int)seq.blocks.size(); ++i) {
+            if (evict[i]) {
+                unlocked_.push_back(seq.blocks[i]);
+                freed_.push_back(seq.blocks[i]);
+                continue;
+            }
+            seq.blocks[n]           = seq.blocks[i];
+            seq.block_unique_ids[n] = seq.block_unique_ids[i];
+            scores[n]               = scores[i];
+            ++n;
+        }
+        seq.blocks.resize(n);
+        seq.block_unique_ids.resize(n);
+        scores.resize(n);
+        seq.evicted_len += count * block_seq_len_;
+    }
+
+    CommitUnlockAndFree();
+}
+
+int SequenceManager::DemoteToCold(const Sequences& sequences)
+{
+    if (!cold_manager_ || !demote_) {
+        return 0;
+    }
+
+    std::vector<void*> src;
+    std::vector<void*> dst;
+
+    // in the order of priority, the cold blocks of the cached sequences are evicted for the scheduled ones
+    for (const auto& p : sequences) {
+        auto& seq = const_cast<Sequence&>(*p);
+        // the complete blocks of the cached tokens before the recent ones
+        const int count = std::min<int>((seq.cache_len - cold_len(seq)) / block_seq_len_ - recent_blocks_,
+                                        std::min(seq.blocks.size(), seq.block_unique_ids.size()));
+        const int n     = std::min(count, cold_manager_->free_count() + cold_manager_->cached_count());
+        if (n <= 0) {
+            continue;
+        }
+        if (const int evict = n - cold_manager_->free_count(); evict > 0) {
+            cold_manager_->Evict(evict);
+        }
+        auto [block_ids, unique_ids] = cold_manager_->Allocate(n);
+        for (int i = 0; i < n; ++i) {
+            src.push_back(GetBlockPtr(seq.blocks[i]));
+            dst.push_back(GetColdBlockPtr(block_ids[i]));
+        }
+        seq.cold_blocks.insert(seq.cold_blocks.end(), block_ids.begin(), block_ids.end());
+        seq.cold_unique_ids.insert(seq.cold_unique_ids.end(), unique_ids.begin(), unique_ids.end());
+        unlocked_.insert(unlocked_.end(), seq.blocks.begin(), seq.blocks.begin() + n);
+        freed_.insert(freed_.end(), seq.blocks.begin(), seq.blocks.begin() + n);
+        seq.blocks.erase(seq.blocks.begin(), seq.blocks.begin() + n);
+        seq.block_unique_ids.erase(seq.block_unique_ids.begin(), seq.block_unique_ids.begin() + n);
+    }
+
+    if (!src.empty()) {
+        demote_(src, dst);
+    }
+
+    CommitUnlockAndFree();
+
+    return src.size();
+}
+
+void SequenceManager::SwapIn(const Sequences& sequences, const std::vector<int>& counts)
+{
+    auto pool = block_manager_->host_pool();
+    if (!pool) {
+        return;
+    }
+
+    UniqueIds keys;
+    for (int i = 0; i < sequences.size(); ++i) {
+        auto& seq = const_cast<Sequence&>(*sequences[i]);
+        if (seq.swapped_ids.empty()) {
+            continue;
+        }
+        // `counts[i]` blocks are just appended to the sequence, `cache_len` makes sure they cover the swapped ones
+        const int n     = std::min<int>(seq.swapped_ids.size(), counts[i]);
+        const int first = seq.blocks.size() - counts[i];
+        for (int j = 0; j < n; ++j) {
+            keys.push_back(seq.swapped_ids[j]);
+            block_copier_->Add(pool->Find(keys.back()), GetBlockPtr(seq.blocks[first + j]));
+        }
+        pool->Unlock(seq.swapped_ids);
+        seq.swapped_ids.clear();
+    }
+
+    if (!keys.empty()) {
+        // the layers are acquired by the forward of this step
+        block_copier_->Issue();
+        // Device blocks have new unique ids, the host copies are no longer reachable
+        pool->Release(keys);
+        dbg(keys.size());
+    }
 }
 
 void SequenceManager::CommitUnlockAndFree()
@@ -133,6 +940,16 @@ void SequenceManager::CommitUnlockAndFree()
         block_manager_->Free(freed_);
         freed_.clear();
     }
+
+    if (!cold_unlocked_.empty()) {
+        cold_manager_->Unlock(cold_unlocked_);
+        cold_unlocked_.clear();
+    }
+
+    if (!cold_freed_.empty()) {
+        cold_manager_->Free(cold_freed_);
+        cold_freed_.clear();
+    }
 }
 
 void SequenceManager::UpdateAndSetUnlock(const Sequence& sequence)
@@ -141,6 +958,10 @@ void SequenceManager::UpdateAndSetUnlock(const Sequence& sequence)
     auto& seq = const_cast<Sequence&>(sequence);
     block_manager_->Touch(seq.blocks);
     unlocked_.insert(unlocked_.end(), seq.blocks.begin(), seq.blocks.end());
+    if (cold_manager_) {
+        cold_manager_->Touch(seq.cold_blocks);
+        cold_unlocked_.insert(cold_unlocked_.end(), seq.cold_blocks.begin(), seq.cold_blocks.end());
+    }
     seq.status = Sequence::kCached;
 }
 
@@ -307,12 +1128,17 @@ void SequenceManager::SortByPriority(Sequences&                   sequences,
                                      std::vector<int>&            context_lengths,
                                      const std::vector<uint64_t>& priorities)
 {
-    // sort according to priority
-    std::vector<int> idxs(sequences.size());
-    std::iota(idxs.begin(), idxs.end(), 0);
-    std::sort(idxs.begin(), idxs.end(), [&](int i, int j) {
-        return priorities[i] < priorities[j];  //
-    });
+    // sort according to priority, the batch of steady decoding is the same as the last one
+    if (sequences != sorted_input_ || priorities != sorted_priorities_) {
+        sorted_input_      = sequences;
+        sorted_priorities_ = priorities;
+        sorted_order_.resize(sequences.size());
+        std::iota(sorted_order_.begin(), sorted_order_.end(), 0);
+        std::sort(sorted_order_.begin(), sorted_order_.end(), [&](int i, int j) {
+            return priorities[i] < priorities[j];  //
+        });
+    }
+    const auto&      idxs = sorted_order_;
     Sequences        tmp_sequences(sequences.size());
     std::vector<int> tmp_lengths(context_lengths.size());
     for (int i = 0; i < sequences.size(); ++i) {
@@ -348,13 +1174,44 @@ std::vector<int> SequenceManager::CountRequiredBlocks(const Sequences&        se
 {
     std::vector<int> required(sequences.size());
     for (int i = 0; i < sequences.size(); ++i) {
-        int seq_len = context_lengths[i] + step_length;
+        int seq_len = context_lengths[i] + step_length - sequences[i]->evicted_len - cold_len(*sequences[i]);
         int count   = (seq_len + block_seq_len_ - 1) / block_seq_len_ - static_cast<int>(sequences[i]->blocks.size());
         required[i] = std::max(0, count);
     }
     return required;
 }
 
+bool SequenceManager::MaterializeActive(const Sequences&        sequences,
+                                        const std::vector<int>& context_lengths,
+                                        const std::vector<int>& required,
+                                        int                     max_input_count,
+                                        int                     demand)
+{
+    // same as the transactions of the schedule, a sequence is left inactive once the input budget is exhausted
+    std::vector<int> input_counts(sequences.size());
+    int              remaining = max_input_count;
+    for (int i = 0; i < sequences.size(); ++i) {
+        if (remaining <= 0) {
+            return false;
+        }
+        input_counts[i] = std::min(context_lengths[i] - sequences[i]->cache_len, remaining);
+        remaining -= input_counts[i];
+    }
+
+    for (int i = 0; i < sequences.size(); ++i) {
+        const_cast<Sequence*>(sequences[i])->input_length = input_counts[i];
+    }
+
+    BlockIds  block_ids;
+    UniqueIds unique_ids;
+    if (demand) {
+        std::tie(block_ids, unique_ids) = block_manager_->Allocate(demand);
+    }
+    AssignAndActivate(sequences, required, block_ids, unique_ids);
+
+    return true;
+}
+
 void SequenceManager::AssignAndActivate(const Sequences&        sequences,  //
                                         const std::vector<int>& counts,
                                         const BlockIds&         blocks,
@@ -370,6 +1227,8 @@ void SequenceManager::AssignAndActivate(const Sequences&        sequences,  //
         s.blocks.insert(s.blocks.end(), blocks.begin() + first, blocks.begin() + last);
         s.block_unique_ids.insert(s.block_unique_ids.end(), unique_ids.begin() + first, unique_ids.begin() + last);
         s.status = Sequence::kActive;
+        // the forward folds the inputs into the state
+        s.state_len = s.cache_len + s.input_length;
         first    = last;
     }
 }
@@ -386,6 +1245,11 @@ auto SequenceManager::Materialize(Sequences                    sequences,
     // process deferred unlock and free operations
     CommitUnlockAndFree();
 
+    // Only admission, completion & preemption change the set of active sequences
+    const bool all_active = std::all_of(sequences.begin(), sequences.end(), [](auto p) {
+        return p->status == Sequence::kActive && p->swapped_ids.empty();
+    });
+
     SortByPriority(sequences, context_lengths, priorities);
 
     // SortByPriority(priorities, sequences, context_lengths);
@@ -394,29 +1258,76 @@ auto SequenceManager::Materialize(Sequences                    sequences,
     // the blocks can still be preempted later
     VerifyAndLockCached(sequences);
 
+    EvictOutOfWindow(sequences);
+
+    EvictLowScore(sequences);
+
+    const int demotion = DemoteToCold(sequences);
+
+    std::vector<bool> deferred(sequences.size());
+    int               deferred_count = 0;
+
+    if (state_pool_) {
+        AssignStates(sequences, deferred, deferred_count);
+    }
+
     if (block_trie_->enabled()) {
-        // verify blocks in trie cache
-        block_trie_->verify();
+        // verify blocks in trie cache, excluding the root
+        trie_nodes_ = block_trie_->verify() - 1;
 
-        // match prefix cache
+        // match prefix cache, for all the new sequences at once
+        std::vector<Sequence*> matching;
+        std::vector<int>       indices;
         for (int i = 0; i < sequences.size(); i++) {
-            if (!sequences[i]->prompt.empty() && sequences[i]->blocks.empty()) {
-                auto& seq = const_cast<Sequence&>(*sequences[i]);
-                block_trie_->match(seq);
-                seq.cache_len = seq.blocks.size() * block_seq_len_;
+            if (!sequences[i]->prompt.empty() && sequences[i]->blocks.empty() && sequences[i]->swapped_ids.empty()) {
+                matching.push_back(const_cast<Sequence*>(sequences[i]));
+                indices.push_back(i);
+            }
+        }
+        const auto lens = block_trie_->match(matching);
+        for (size_t i = 0; i < matching.size(); ++i) {
+            // the sequences sharing a new prefix with a prior one in the batch wait for it to be prefilled & cached
+            if (lens[i] < 0) {
+                deferred[indices[i]] = true;
+                ++deferred_count;
+                continue;
             }
+            matching[i]->cache_len = lens[i];
+            prompt_tokens_ += matching[i]->prompt.size();
+            hit_tokens_ += lens[i];
         }
+        block_copier_->Issue();
     }
 
     const int max_input_count = adjust(sequences, context_lengths);
 
     std::vector<int> required = CountRequiredBlocks(sequences, context_lengths, step_length);
+    for (int i = 0; deferred_count && i < sequences.size(); ++i) {
+        required[i] = deferred[i] ? 0 : required[i];
+    }
     // dbg(required);
 
+    const int demand = std::accumulate(required.begin(), required.end(), 0);
+
+    // blocks of a shared pool or of the virtual memory follow the demand of the batch
+    block_manager_->Rebalance(demand);
+
+    // Steady decoding, the schedule would take the growth of the batch from the free blocks without snapshotting the
+    // use counts of the whole pool. Under memory pressure the full schedule picks the victims
+    if (all_active && !deferred_count && demand <= block_manager_->free_count()
+        && MaterializeActive(sequences, context_lengths, required, max_input_count, demand)) {
+        return Outcome{demand, 0, 0, demotion};
+    }
+
     Schedule schedule(block_manager_->TakeSnapshot(), sequences.size(), max_input_count);
 
     // `schedule.last` is decreasing in the loop
     for (int i = 0; i < schedule.last; ++i) {
+        if (deferred[i]) {
+            const_cast<Sequence*>(sequences[i])->input_length = 0;
+            schedule.inactive.push_back(sequences[i]);
+            continue;
+        }
         const int input_length = context_lengths[i] - sequences[i]->cache_len;
         Transaction{sequences, i, required[i], input_length, schedule}.Process();
     }
@@ -438,6 +1349,7 @@ auto SequenceManager::Materialize(Sequences                    sequences,
 
     Outcome outcome{};
     outcome.allocation = schedule.allocate;
+    outcome.demotion   = demotion;
     outcome.swap_in    = std::count_if(schedule.active.begin(), schedule.active.end(), [](auto p) {
         if (p->status != Sequence::kActive) {
             dbg(*p);
@@ -455,6 +1367,12 @@ auto SequenceManager::Materialize(Sequences                    sequences,
     if (!schedule.victims.empty()) {
         TM_LOG_WARNING("[SeqMgr] #victim: %d", (int)schedule.victims.size());
         for (const auto& p : schedule.victims) {
+            // The blocks are still cached on device, the choice is made for when they get evicted
+            if (block_manager_->host_pool()) {
+                const bool swap = swap_cost_model_.PreferSwap(p->cache_len, p->blocks.size());
+                block_manager_->SetSwap(p->blocks, swap);
+                ++(swap ? preempt_swap_ : preempt_recompute_);
+            }
             UpdateAndSetUnlock(*p);
         }
         CommitUnlockAndFree();
@@ -475,6 +1393,9 @@ auto SequenceManager::Materialize(Sequences                    sequences,
         AssignAndActivate(schedule.active, schedule.block_counts, block_ids, unique_ids);
     }
 
+    // restore swapped blocks into the newly allocated ones
+    SwapIn(schedule.active, schedule.block_counts);
+
     // active -> locked
     for (const auto& p : schedule.inactive) {
         if (p->status == Sequence::kActive) {
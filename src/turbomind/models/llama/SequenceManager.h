@@ -4,7 +4,14 @@
 
 #include "src/turbomind/models/llama/BlockManager.h"
 #include "src/turbomind/models/llama/BlockTrie.h"
+#include "src/turbomind/models/llama/block_copier.h"
+#include "src/turbomind/models/llama/state_pool.h"
+#include <deque>
 #include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace turbomind {
 
@@ -23,6 +30,13 @@ struct Sequence {
     BlockIds  blocks;
     UniqueIds block_unique_ids;
 
+    // evicted blocks (following `blocks`) that can be restored from the host pool
+    UniqueIds swapped_ids;
+
+    // tiered kv cache, quantized blocks of the pool of cold blocks (preceding `blocks`)
+    BlockIds  cold_blocks;
+    UniqueIds cold_unique_ids;
+
     int input_length = 0;
 
     mutable std::vector<int> prompt;
@@ -31,14 +45,28 @@ struct Sequence {
 
     mutable int cache_len = 0;
 
+    // tokens dropped from the kv cache between the sinks and the recent window, `blocks` hold the kv cache of
+    // `[0, cache_len)` except `[sink_len, sink_len + evicted_len)`. The heavy-hitter eviction drops them in whole
+    // blocks anywhere after the sinks
+    int evicted_len = 0;
+
+    // attention mass received by `blocks` from the decoding tokens, guides the heavy-hitter eviction. Update by user
+    mutable std::vector<float> block_scores;
+
+    // slot of the recurrent state in the `StatePool` of a hybrid model, -1 for none. The state is of the first
+    // `state_len` tokens and can't be rewound, the kv cache is dropped when it's shorter. A state of no tokens is
+    // reset by the forward
+    int state_slot = -1;
+    int state_len  = 0;
+
     // additional data kept round-to-round
     mutable std::vector<std::byte> random_state;  // update by user
 
     mutable float rope_theta = 0.f;
 
     // embedding data
-    mutable std::vector<std::vector<std::byte>> input_embeddings;
-    mutable std::vector<std::pair<int, int>>    input_embedding_ranges;
+    mutable std::vector<std::shared_ptr<const std::byte>> input_embeddings;  // on host or in `EmbeddingCache`
+    mutable std::vector<std::pair<int, int>>              input_embedding_ranges;
 
     explicit Sequence(uint64_t _id): id(_id) {}
 
@@ -47,16 +75,65 @@ struct Sequence {
 
 using Sequences = std::vector<const Sequence*>;
 
+// Time to restore the kv cache of a preempted sequence, either by swapping its blocks out to the host pool and back
+// or by recomputing its tokens with a prefill
+struct SwapCostModel {
+    double swap_per_block;     // seconds for a round trip of a block over the host link, 0 always swaps
+    double recompute_linear;   // seconds per token, the linear layers
+    double recompute_squared;  // seconds per pair of tokens, the attention
+
+    bool PreferSwap(int cache_len, int block_count) const noexcept
+    {
+        const double recompute = cache_len * recompute_linear + .5 * cache_len * cache_len * recompute_squared;
+        return !swap_per_block || block_count * swap_per_block < recompute;
+    }
+};
+
 inline std::ostream& operator<<(std::ostream& os, const Sequence& seq)
 {
     os << "id=" << seq.id << ", status=" << seq.status << ", token_count=" << seq.tokens.size()
-       << ", block_count=" << seq.blocks.size() << ", cache_len=" << seq.cache_len
+       << ", block_count=" << seq.blocks.size() << ", swapped_count=" << seq.swapped_ids.size()
+       << ", cold_count=" << seq.cold_blocks.size()
+       << ", cache_len=" << seq.cache_len << ", evicted_len=" << seq.evicted_len
        << ", random_state_size=" << seq.random_state.size();
     return os;
 }
 
+// Sequences by id in slots of stable addresses. A lookup is a single hash probe, erased slots are reset and reused by
+// the following sequences so that the live ones stay packed in the chunks of the deque
+class SequenceTable {
+public:
+    Sequence* find(uint64_t id) noexcept
+    {
+        const auto it = index_.find(id);
+        return it == index_.end() ? nullptr : &slots_[it->second];
+    }
+
+    // `id` must not be in the table
+    Sequence& emplace(uint64_t id);
+
+    void erase(uint64_t id);
+
+    size_t size() const noexcept
+    {
+        return index_.size();
+    }
+
+private:
+    std::deque<Sequence>                   slots_;  // no reference invalidation when growing at the end
+    std::vector<uint32_t>                  free_;
+    std::unordered_map<uint64_t, uint32_t> index_;
+};
+
 class SequenceManager {
 public:
+    // Heads & precision of a layer of mixed precision kv cache or pruned models
+    struct LayerConfig {
+        int head_num;
+        int t_bits;
+        int q_bits;
+    };
+
     // clang-format off
     struct BlockConfig {
         int head_dim_;
@@ -64,6 +141,14 @@ public:
         int block_len_;
         int t_bits_;
         int q_bits_;
+        int summary_size_;  // bytes of the key summaries of block-sparse decoding after the k/v data
+        int cp_size_;       // context parallel ranks, a block holds `block_len_ / cp_size_` tokens on each
+        std::vector<LayerConfig> layers_;  // empty when all the layers are of the config above
+        BlockConfig layer(int i) const {
+            if (layers_.empty()) { return *this; }
+            const auto& l = layers_.at(i);
+            return {head_dim_, l.head_num, block_len_, l.t_bits, l.q_bits, summary_size_, cp_size_};
+        }
         int t_bits() const { return t_bits_; }
         int q_bits() const { return q_bits_; }
         int head_dim() const { return head_dim_; }
@@ -72,18 +157,51 @@ public:
     };
     // clang-format on
 
+    // Tiered kv cache, the blocks of a sequence before its last `recent_blocks` ones are requantized into a pool of
+    // cold blocks taking `ratio` of the kv cache memory
+    struct TierConfig {
+        int    recent_blocks;  // 0 disables
+        int    t_bits;         // of the cold blocks
+        int    q_bits;
+        double ratio;
+    };
+
+    // Recurrent states of the linear attention / state space layers of hybrid models, a slot of `state_size` bytes
+    // per sequence
+    struct StateConfig {
+        size_t state_size;  // 0 disables
+        int    slot_count;
+    };
+
     explicit SequenceManager(size_t             layer_num,
                              const BlockConfig& block_config,
                              double             block_count,
                              int                chunk_size,
+                             size_t             swap_space,
                              bool               enable_prefix_caching,
                              int                rank,
                              IAllocator*        allocator,
-                             GetFreeMemSize     get_free_size);
+                             GetFreeMemSize     get_free_size,
+                             const std::string& prefix_store_path = {},
+                             size_t             prefix_store_size = 0,
+                             uint64_t           prefix_store_fingerprint = 0,
+                             int                sink_size = 0,
+                             int                window_size = 0,
+                             EvictionPolicy     eviction_policy = EvictionPolicy::kLRU,
+                             KvCacheLease       lease = {},
+                             bool               virtual_memory = false,
+                             const TierConfig&  tier = {},
+                             const StateConfig& state = {});
 
     SequenceManager(const SequenceManager&)     = delete;
     SequenceManager(SequenceManager&&) noexcept = default;
 
+    // Bytes of a kv cache block of `layer_num` layers on a rank, key summaries included
+    static size_t BlockSize(size_t layer_num, const BlockConfig& block_config);
+
+    // Offsets of the `layer_num` layers in a block followed by the end of the layers, where the key summaries start
+    static std::vector<size_t> LayerOffsets(size_t layer_num, const BlockConfig& block_config);
+
     [[nodiscard]] const Sequence* Create(uint64_t id);
 
     [[nodiscard]] const Sequence* Get(uint64_t id);
@@ -98,10 +216,23 @@ public:
         int allocation;
         int swap_in;
         int swap_out;
+        int demotion;  // blocks moved to the cold pool
     };
 
     using AdjustInputCount = std::function<int(const Sequences&, const std::vector<int>&)>;
 
+    // Requantizes the kv cache of the recent blocks `src` into the cold blocks `dst`, the source blocks may be
+    // reused as soon as the call returns, so the work must be ordered before any later write to them
+    using Demote = std::function<void(const std::vector<void*>& src, const std::vector<void*>& dst)>;
+
+    void SetDemote(Demote demote)
+    {
+        demote_ = std::move(demote);
+    }
+
+    // Keeps the kv cache of the sequences within `tokens` by the scores of the blocks, see `Sequence::block_scores`
+    void SetScoreBudget(int tokens);
+
     [[nodiscard]] Outcome Materialize(Sequences                    sequences,
                                       std::vector<int>             context_lengths,
                                       const std::vector<uint64_t>& priorities,
@@ -110,30 +241,210 @@ public:
 
     void CacheIfEnabled(const Sequences& sequences, int active_size);
 
+    // Drop the kv cache of `seq` after `len` tokens
+    void TruncateCache(const Sequence& seq, int len);
+
+    // Forget the cached prompt blocks and release the pins, the blocks of the sequences are kept
+    void FlushPrefixCache()
+    {
+        block_trie_->flush();
+        trie_nodes_ = 0;
+        UnpinAll();
+    }
+
+    // Pinned prompt blocks are locked and never evicted, `tokens` is the budget of all the pins
+    void SetPinBudget(int tokens);
+
+    // Pin the complete blocks of the first `len` tokens of the active sequence `seq`, e.g. a known system prompt
+    // cached by prefix caching. Blocks pinned already are skipped, the oldest pins are released to keep the pins
+    // within the budget and a prefix over the budget is not pinned. Returns the number of the newly pinned blocks
+    int PinPrefix(const Sequence& seq, int len);
+
+    // The released blocks are unlocked by the next `Materialize`
+    void UnpinAll();
+
+    // Lock the blocks of a cached sequence for exporting its kv cache, `cache_len` is limited to the blocks on
+    // device. The blocks stay locked until `UpdateAndSetUnlock`
+    [[nodiscard]] std::vector<void*> LockForExport(const Sequence& seq, int& cache_len);
+
+    // Create sequence `id` with newly allocated blocks for `cache_len` tokens to import a kv cache into, the blocks
+    // stay locked until `UpdateAndSetUnlock`. Returns nullptr when there are not enough blocks
+    [[nodiscard]] const Sequence* CreateForImport(uint64_t id, int cache_len, std::vector<void*>& block_ptrs);
+
+    // Create sequence `id` as a fork of the cached sequence `parent`, with the same tokens and the kv cache of the
+    // parent on device. The complete blocks are shared and the partial last block is copied by `block_copier()`, or by
+    // the first write to it with `SetCopyOnFirstWrite`. Returns nullptr when `parent` doesn't exist
+    [[nodiscard]] const Sequence* Fork(uint64_t parent, uint64_t id);
+
+    // Create sequence `id` as a fork of the active sequence `parent` between the steps, sharing its kv cache in the
+    // same way. Its tokens are left to the caller
+    [[nodiscard]] const Sequence* Branch(const Sequence& parent, uint64_t id);
+
+    // Replace the kv cache of each active sequence `seqs[i]` by the one of `seqs[parents[i]]` as it was before the
+    // call, e.g. the beams of a beam search extending the same beam. The ancestor blocks are shared in the same way as
+    // `Fork` and the blocks no longer used are released
+    void Reparent(const Sequences& seqs, const std::vector<int>& parents);
+
+    // The partial last block of a fork is filled by the first write of the attention kernels to it instead of
+    // `block_copier()`, the block it is copied from is held by the fork until then. Only for the kernels that copy the
+    // block before reading it, i.e. without prefix caching, cascade or sparse decoding & context parallelism
+    void SetCopyOnFirstWrite(bool enable)
+    {
+        copy_on_first_write_ = enable;
+    }
+
+    // The block the partial block of the active sequence `seq` is copied from by the first write of the step, nullptr
+    // for none. The block is released by the next `Materialize`, after the writes are enqueued
+    [[nodiscard]] void* TakeFirstWriteSource(const Sequence& seq);
+
+    // Copies the partial blocks of the forks without a first write in the step by `block_copier()`
+    void FlushFirstWrites();
+
     [[nodiscard]] void* GetBlockPtr(int block_id)
     {
         return block_manager_->block(block_id).data;
     }
 
+    [[nodiscard]] void* GetColdBlockPtr(int block_id)
+    {
+        return cold_manager_->block(block_id).data;
+    }
+
+    // recurrent state of `seq`, nullptr for none
+    [[nodiscard]] void* GetStatePtr(const Sequence& seq)
+    {
+        return state_pool_ && seq.state_slot >= 0 ? state_pool_->data(seq.state_slot) : nullptr;
+    }
+
+    // tokens held by the cold blocks of `seq`
+    int cold_len(const Sequence& seq) const noexcept
+    {
+        return seq.cold_blocks.size() * block_seq_len_;
+    }
+
     int max_block_count() const noexcept
     {
         return block_manager_->max_block_count();
     }
 
+    int free_block_count() const noexcept
+    {
+        return block_manager_->free_count();
+    }
+
+    size_t block_size() const noexcept
+    {
+        return block_manager_->block_size();
+    }
+
+    // The contiguous range of at most `max_bytes` holding the most blocks shared by the active sequences, weighted by
+    // their prefix cache hits, for the persisting L2 window. {nullptr, 0} when no block is shared
+    std::pair<void*, size_t> HotBlockWindow(size_t max_bytes);
+
+    // Copies of the swapped in and forked blocks, the forward acquires the layers of them before reading the cache
+    BlockCopier* block_copier() noexcept
+    {
+        return block_copier_.get();
+    }
+
+    PrefixStore* prefix_store() noexcept
+    {
+        return block_trie_->store();
+    }
+
+    void SetSwapCostModel(const SwapCostModel& model) noexcept
+    {
+        swap_cost_model_ = model;
+    }
+
+    struct CacheStats {
+        int64_t prompt_tokens;   // prompt tokens looked up in the prefix cache
+        int64_t hit_tokens;      // prompt tokens served by the prefix cache
+        int64_t evicted_blocks;  // blocks evicted from the device
+        int64_t trie_nodes;      // cached prompt blocks
+        int64_t active_blocks;
+        int64_t cached_blocks;
+        int64_t free_blocks;
+        int64_t swapped_blocks;     // evicted blocks copied to the host pool
+        int64_t preempt_swap;       // preempted sequences with their blocks marked for swapping
+        int64_t preempt_recompute;  // preempted sequences with their blocks marked for recomputing
+        int64_t pinned_blocks;      // prompt blocks excluded from eviction, see `PinPrefix`
+    };
+
+    // counters are accumulated since the start
+    CacheStats GetCacheStats() const noexcept
+    {
+        return {prompt_tokens_,
+                hit_tokens_,
+                block_manager_->evicted_count(),
+                trie_nodes_,
+                block_manager_->active_count(),
+                block_manager_->cached_count(),
+                block_manager_->free_count(),
+                block_manager_->swapped_count(),
+                preempt_swap_,
+                preempt_recompute_,
+                (int64_t)pinned_.size()};
+    }
+
 private:
-    void Erase(std::map<uint64_t, Sequence>::iterator& it);
+    void Erase(Sequence& seq);
+
+    // Partial block of a fork left to its first write, `cache_len` is the length of the fork when it was created
+    struct FirstWrite {
+        uint64_t id;
+        int      src;
+        int      dst;
+        uint64_t dst_unique_id;
+        int      cache_len;
+    };
+
+    // Locks the blocks of the first `cache_len` tokens of `p` for a new owner, the complete blocks are shared and the
+    // partial last block is copied by `block_copier_`, or left to the first write to it when `first_write` is given.
+    // Without a block for the copy its tokens are dropped from `cache_len`
+    std::pair<BlockIds, UniqueIds> ShareBlocks(const Sequence& p, int& cache_len, FirstWrite* first_write = nullptr);
+
+    // Releases the source block of a first write
+    void ReleaseFirstWrite(const FirstWrite& w);
 
     void CommitUnlockAndFree();
 
     void VerifyAndLockCached(const Sequences& sequences);
 
+    void SwapIn(const Sequences& sequences, const std::vector<int>& counts);
+
+    // Free the blocks between the sinks and the recent window
+    void EvictOutOfWindow(const Sequences& sequences);
+
+    // Free the blocks of the lowest scores between the sinks and the recent blocks of the sequences over the budget
+    void EvictLowScore(const Sequences& sequences);
+
+    // Move the blocks before the recent ones of a tiered kv cache to the cold pool
+    int DemoteToCold(const Sequences& sequences);
+
+    // Drop the cold blocks of `seq` after the first `keep` ones, along with all the recent blocks following them
+    void DropCold(Sequence& seq, int keep);
+
+    // A state slot for each sequence in priority order, taken from the idle sequences in LRU order when there's no
+    // free one. The sequences left without one are deferred
+    void AssignStates(const Sequences& sequences, std::vector<bool>& deferred, int& deferred_count);
+
     std::vector<int> CountRequiredBlocks(const Sequences&        sequences,  //
                                          const std::vector<int>& context_lengths,
                                          int                     step_length);
 
-    static void SortByPriority(Sequences&                   sequences,  //
-                               std::vector<int>&            context_lengths,
-                               const std::vector<uint64_t>& priorities);
+    // The order of the last batch is reused while the sequences and their priorities are the same
+    void SortByPriority(Sequences&                   sequences,  //
+                        std::vector<int>&            context_lengths,
+                        const std::vector<uint64_t>& priorities);
+
+    // Activates a batch of active sequences whose growth is covered by the free blocks, no sequence is preempted
+    // and the full schedule is skipped. Returns false when the input budget leaves some of them inactive
+    bool MaterializeActive(const Sequences&        sequences,
+                           const std::vector<int>& context_lengths,
+                           const std::vector<int>& required,
+                           int                     max_input_count,
+                           int                     demand);
 
     static void AssignAndActivate(const Sequences&        sequences,  //
                                   const std::vector<int>& counts,
@@ -144,19 +455,61 @@ private:
     int block_seq_len_;
     int rank_;
 
-    // Use `std::map` to avoid reference invalidation
-    std::map<uint64_t, Sequence> sequences_;
+    // sliding window with attention sinks, the sinks are rounded up to whole blocks
+    int sink_len_;
+    int window_size_;
+
+    // heavy-hitter eviction, tokens kept in the kv cache of a sequence by the scores of its blocks, 0 disables. The
+    // last `kScoreRecentBlocks` complete blocks have few scores yet and are always kept
+    static constexpr int kScoreRecentBlocks = 2;
+
+    int score_budget_{};
+
+    SequenceTable sequences_;
 
     std::shared_ptr<BlockManager> block_manager_;
+    std::unique_ptr<BlockCopier>  block_copier_;
+
+    bool                    copy_on_first_write_{};
+    std::vector<FirstWrite> first_writes_;
+
+    int64_t prompt_tokens_{};
+    int64_t hit_tokens_{};
+    int64_t trie_nodes_{};
     std::shared_ptr<BlockTrie>    block_trie_;
 
+    SwapCostModel swap_cost_model_{};
+    int64_t       preempt_swap_{};
+    int64_t       preempt_recompute_{};
+
     BlockIds unlocked_;
     BlockIds freed_;
+
+    // pinned prompt blocks in the order pinned, locked once by the pins
+    int                     pin_budget_{};  // blocks
+    std::deque<BlockIds>    pins_;
+    std::unordered_set<int> pinned_;
+
+    // priority order of the last batch, the slots of the sequence table keep the addresses stable
+    Sequences             sorted_input_;
+    std::vector<uint64_t> sorted_priorities_;
+    std::vector<int>      sorted_order_;
+
+    // tiered kv cache, the cold pool has no swap space and takes no part in the scheduling of the recent blocks
+    int                           recent_blocks_{};
+    std::shared_ptr<BlockManager> cold_manager_;
+    Demote                        demote_;
+
+    BlockIds cold_unlocked_;
+    BlockIds cold_freed_;
+
+    std::unique_ptr<StatePool> state_pool_;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const SequenceManager::Outcome& oc)
 {
-    os << "allocation: " << oc.allocation << ", swap-in: " << oc.swap_in << ", swap-out: " << oc.swap_out;
+    os << "allocation: " << oc.allocation << ", swap-in: " << oc.swap_in << ", swap-out: " << oc.swap_out
+       << ", demotion: " << oc.demotion;
     return os;
 }
 
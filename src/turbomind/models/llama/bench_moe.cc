@@ -0,0 +1,738 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Times `MoeFfnLayer` of a single layer under skewed routing, over token counts and expert configurations, for the
+// naive & the fused MoE methods. e.g.
+//   bench_moe --configs 8x2,64x6,256x8 --tokens 1,16,128,1024,8192 --skew 1.2 --tp 8 --output moe.json
+//
+// Each token draws `k` distinct experts by the weights of the experts, a Zipf law of exponent `--skew` over a random
+// ranking of the experts or the tokens per expert recorded by `TurboMind.get_expert_stats` (`--record`, a layer per
+// line). The draws are replayed through the real gate: the first `E` channels of the hidden state of a token are 1 on
+// its experts and 0 elsewhere while the gate weight is the identity on them, so the gating, the routing and the
+// expert gemms all see the same assignment for both methods. The rest of the hidden state & the experts are random.
+//
+// The phases are timed one by one with their inputs set up by the phases before, as `forward` & `reduce` of the layer
+// run them: the gating gemm, the routing kernel, the gather of the rows (the fused gemm gathers them itself), the
+// expert gemms & activation and the weighted reduction. `layer` times `forward` + `reduce` of the layer itself
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+
+#include "src/turbomind/kernels/activation_kernels.h"
+#include "src/turbomind/kernels/gemm/context.h"
+#include "src/turbomind/models/llama/LlamaDecoderLayerWeight.h"
+#include "src/turbomind/models/llama/LlamaFfnLayer.h"
+#include "src/turbomind/models/llama/LlamaLinear.h"
+#include "src/turbomind/models/llama/context.h"
+#include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/models/llama/moe_ffn_layer.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/string_utils.h"
+
+using namespace turbomind;
+
+namespace {
+
+// `experts` x `k`, the hidden & intermediate sizes default to the models of the presets
+struct Config {
+    std::string name;
+    int         experts;
+    int         k;
+    int         hidden;
+    int         inter;
+};
+
+struct Options {
+    std::vector<std::string> configs{"8x2", "64x6", "256x8"};
+    std::vector<int>         tokens{1, 16, 128, 1024, 4096};
+    std::vector<std::string> methods{"naive", "fused"};
+
+    double      skew = 1.;  // Zipf exponent, 0 for uniform routing
+    std::string record;     // tokens per expert, a layer per line
+    int         record_layer = -1;  // line of `record`, the sum of all lines when < 0
+
+    int hidden = 0;  // overrides of the presets
+    int inter  = 0;
+    int tp     = 1;  // the intermediate size of the experts is sliced over the ranks
+
+    std::string dtype = "half";
+    std::string output;
+
+    bool tune   = false;  // tune the gemms of the token counts first, as the engine does at start
+    int  warmup = 5;
+    int  iters  = 20;
+};
+
+struct Result {
+    std::string config;
+    std::string method;
+    int         tokens;
+    float       imbalance;  // rows of the busiest expert over the mean
+    std::string phase;
+    float       time;  // us per forward
+};
+
+// Mixtral 8x7B, DeepSeek-V2-Lite & DeepSeek-V3
+bool MakeConfig(const std::string& name, const Options& opts, Config& c)
+{
+    static const std::vector<Config> presets{
+        {"8x2", 8, 2, 4096, 14336},
+        {"64x6", 64, 6, 2048, 1408},
+        {"256x8", 256, 8, 7168, 2048},
+    };
+    c = {name, 0, 0, 2048, 1408};
+    for (const auto& p : presets) {
+        if (p.name == name) {
+            c = p;
+        }
+    }
+    if (!c.experts && std::sscanf(name.c_str(), "%dx%d", &c.experts, &c.k) != 2) {
+        return false;
+    }
+    c.hidden = opts.hidden ? opts.hidden : c.hidden;
+    c.inter  = opts.inter ? opts.inter : c.inter;
+    // the experts of a token are encoded in the first channels of the hidden state
+    return c.experts > 0 && c.k > 0 && c.k <= c.experts && c.experts <= c.hidden && c.inter % opts.tp == 0;
+}
+
+// Weights of the experts to draw the tokens from
+std::vector<double> ExpertWeights(const Options& opts, int experts, std::mt19937& gen)
+{
+    std::vector<double> w(experts);
+    if (!opts.record.empty()) {
+        std::ifstream ifs(opts.record);
+        if (!ifs) {
+            TM_LOG_ERROR("[bench_moe] can't open %s", opts.record.c_str());
+            std::exit(1);
+        }
+        std::string line;
+        for (int i = 0; std::getline(ifs, line); ++i) {
+            line = line.substr(0, line.find('#'));
+            if (opts.record_layer >= 0 && i != opts.record_layer) {
+                continue;
+            }
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::istringstream iss(line);
+            std::vector<double> counts{std::istream_iterator<double>{iss}, std::istream_iterator<double>{}};
+            if (counts.empty()) {  // dense layers
+                continue;
+            }
+            FT_CHECK_WITH_INFO((int)counts.size() == experts,
+                               fmtstr("%d experts recorded at line %d, %d expected", (int)counts.size(), i, experts));
+            for (int e = 0; e < experts; ++e) {
+                w[e] += counts[e];
+            }
+        }
+    }
+    else {
+        std::vector<int> rank(experts);
+        std::iota(rank.begin(), rank.end(), 0);
+        std::shuffle(rank.begin(), rank.end(), gen);
+        for (int e = 0; e < experts; ++e) {
+            w[e] = std::pow(rank[e] + 1., -opts.skew);
+        }
+    }
+    return w;
+}
+
+// `k` distinct experts for each token drawn by weight without replacement, the `k` largest `log(u) / w` keys
+std::vector<int> SampleExperts(int tokens, int k, const std::vector<double>& w, std::mt19937& gen)
+{
+    FT_CHECK_WITH_INFO(std::count_if(w.begin(), w.end(), [](double x) { return x > 0; }) >= k,
+                       "fewer experts with tokens than the experts per token");
+
+    std::uniform_real_distribution<double> uniform{0., 1.};
+    std::vector<std::pair<double, int>>    keys(w.size());
+    std::vector<int>                       idxs;
+    for (int i = 0; i < tokens; ++i) {
+        for (size_t e = 0; e < w.size(); ++e) {
+            keys[e] = {w[e] > 0 ? std::log(std::max(uniform(gen), 1e-300)) / w[e] : -INFINITY, (int)e};
+        }
+        std::partial_sort(keys.begin(), keys.begin() + k, keys.end(), std::greater<>{});
+        for (int j = 0; j < k; ++j) {
+            idxs.push_back(keys[j].second);
+        }
+    }
+    return idxs;
+}
+
+float Imbalance(const std::vector<int>& idxs, int experts)
+{
+    std::vector<int> rows(experts);
+    for (const auto& e : idxs) {
+        ++rows[e];
+    }
+    const double mean = (double)idxs.size() / experts;
+    return mean > 0 ? *std::max_element(rows.begin(), rows.end()) / mean : 0.;
+}
+
+template<class T>
+class Bench {
+public:
+    Bench(const Options& opts, const Config& cfg, MoeParam::Method method, Context<T>& ctx):
+        opts_{opts}, cfg_{cfg}, method_{method}, ctx_{ctx}, stream_{ctx.stream}, inter_{cfg.inter / opts.tp}
+    {
+        check_cuda_error(cudaEventCreate(&beg_));
+        check_cuda_error(cudaEventCreate(&end_));
+
+        // a single layer of tiny attention, the dense ffn is absent
+        model_.head_num     = 1;
+        model_.head_dim     = 128;
+        model_.kv_head_num  = 1;
+        model_.hidden_units = cfg.hidden;
+        model_.layer_num    = 1;
+        model_.weight_type  = get_default_weight_type<T>();
+        model_.group_size   = 128;
+        model_.inter_size   = {0};
+
+        moe_.method            = method;
+        moe_.experts_per_token = cfg.k;
+        moe_.inter_size        = cfg.inter;
+        moe_.norm_topk_prob    = true;
+        moe_.routed_scale      = 1.f;
+        moe_.topk_group        = 1;
+        moe_.topk_method       = "greedy";
+        moe_.n_group           = 1;
+        moe_.expert_num        = {cfg.experts};
+
+        engine_.attn_tp_size = 1;
+        engine_.mlp_tp_size  = opts.tp;
+        engine_.ep_size      = 1;
+
+        weights_ = std::make_unique<LlamaDecoderLayerWeight<T>>(0, model_, engine_, LoraParam{}, moe_);
+        weights_->malloc(stream_);
+        InitWeights();
+
+        layer_ = std::make_unique<MoeFfnLayer<T>>(model_, moe_, engine_, ctx);
+
+        if (method == MoeParam::kFused) {
+            context_ = std::make_unique<gemm::MoeGemmContext>(cfg.experts, cfg.k, ctx.cuda_device_prop, stream_);
+        }
+        else {
+            expert_ffn_ = std::make_unique<LlamaFfnLayer<T>>(model_, ctx);
+        }
+
+        check_cuda_error(cudaMallocHost(&h_offsets_, sizeof(int) * (cfg.experts + 1)));
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+
+    ~Bench()
+    {
+        expert_ffn_.reset();
+        context_.reset();
+        layer_.reset();
+        weights_.reset();
+        FreeBuffers();
+        cudaFreeHost(h_offsets_);
+        cudaEventDestroy(beg_);
+        cudaEventDestroy(end_);
+    }
+
+    void Tune(int tokens)
+    {
+        Resize(tokens);
+        // the routing is sampled uniformly when tuning, the gate reads zeros
+        check_cuda_error(cudaMemsetAsync(input_, 0, sizeof(T) * tokens * cfg_.hidden, stream_));
+        isTuning() = true;
+        ctx_.linear->set_measure(true);
+        Layer(tokens);
+        ctx_.linear->set_measure(false);
+        isTuning() = false;
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+
+    std::vector<Result> Run(const std::vector<int>& idxs)
+    {
+        const int tokens = idxs.size() / cfg_.k;
+
+        Resize(tokens);
+        UploadInput(idxs);
+
+        const auto phases = Phases(tokens);
+        const auto method = method_ == MoeParam::kFused ? "fused" : "naive";
+        const auto skew   = Imbalance(idxs, cfg_.experts);
+
+        std::vector<Result> results;
+
+        float sum{};
+        for (size_t i = 0; i < phases.size(); ++i) {
+            const float t = Measure(
+                [&] {
+                    for (size_t j = 0; j < i; ++j) {
+                        phases[j].second();
+                    }
+                },
+                phases[i].second);
+            results.push_back({cfg_.name, method, tokens, skew, phases[i].first, t});
+            sum += t;
+        }
+        results.push_back({cfg_.name, method, tokens, skew, "sum", sum});
+
+        const float t = Measure([] {}, [&] { Layer(tokens); });
+        results.push_back({cfg_.name, method, tokens, skew, "layer", t});
+
+        return results;
+    }
+
+private:
+    const MoeFfnWeight<T>& moe() const
+    {
+        return weights_->moe_weights;
+    }
+
+    void Layer(int tokens)
+    {
+        layer_->forward(nullptr, input_, tokens, 0, moe());
+        layer_->reduce(output_, tokens, 0.f, 0, moe());
+    }
+
+    std::vector<std::pair<std::string, std::function<void()>>> Phases(int tokens)
+    {
+        const int experts = cfg_.experts;
+        const int k       = cfg_.k;
+        const int rows    = tokens * k;
+        const int padded  = (tokens + kMoeGateVecSize - 1) / kMoeGateVecSize * kMoeGateVecSize;
+        const int hidden  = cfg_.hidden;
+
+        std::vector<std::pair<std::string, std::function<void()>>> phases;
+
+        phases.emplace_back("gate", [=] { layer_->gate(logits_, input_, tokens, moe().gate); });
+
+        phases.emplace_back("route", [=] {
+            check_cuda_error(cudaMemsetAsync(accum_, 0, sizeof(int) * experts * kMoeGateMaxTiles, stream_));
+            check_cuda_error(cudaMemsetAsync(masks_, -1, sizeof(int8_t) * experts * padded, stream_));
+            invokeMoeGate_V2(f2n_,
+                             en2f_,
+                             offsets_,
+                             scales_,
+                             masks_,
+                             accum_,
+                             logits_,
+                             tokens,
+                             padded,
+                             experts,
+                             k,
+                             1,
+                             1,
+                             true,
+                             moe_.norm_topk_prob,
+                             moe_.routed_scale,
+                             stream_);
+        });
+
+        if (method_ == MoeParam::kNaive) {
+            phases.emplace_back("gather",
+                                [=] { dispatchMoeGather(inout_, input_, f2n_, tokens, k, hidden, stream_); });
+            // the expert offsets are read on host to launch the experts with rows one by one
+            phases.emplace_back("experts", [=] {
+                check_cuda_error(cudaMemcpyAsync(
+                    h_offsets_, offsets_, sizeof(int) * (experts + 1), cudaMemcpyDefault, stream_));
+                check_cuda_error(cudaStreamSynchronize(stream_));
+                for (int i = 0; i < experts; ++i) {
+                    if (const int count = h_offsets_[i + 1] - h_offsets_[i]) {
+                        auto io = inout_ + (size_t)h_offsets_[i] * hidden;
+                        expert_ffn_->forward({io, io, count, 0, nullptr}, &moe().experts[i]);
+                    }
+                }
+            });
+        }
+        else {
+            phases.emplace_back("experts", [=] {
+                const auto& block = moe().block;
+                context_->update(block.output.k_desc.num, k, offsets_);
+                ctx_.linear->forward_moe(inter_buf_,
+                                         {input_, hidden},
+                                         f2n_,
+                                         offsets_,
+                                         rows,
+                                         block.fused_gating_intermediate,
+                                         block.is_fused_silu ? LlamaLinear<T>::kFusedSiluFfn : LlamaLinear<T>::kGemm,
+                                         context_.get());
+                if (!block.is_fused_silu) {
+                    invokeGenericActivation_v2<SiluActivation>(
+                        inter_buf_, inter_buf_ + inter_, inter_ * 2, rows, inter_, stream_);
+                }
+                ctx_.linear->forward_moe(inout_,
+                                         {inter_buf_, block.is_fused_silu ? inter_ : inter_ * 2},
+                                         nullptr,
+                                         offsets_,
+                                         rows,
+                                         block.output,
+                                         LlamaLinear<T>::kGemm,
+                                         context_.get());
+            });
+        }
+
+        phases.emplace_back("reduce", [=] {
+            invokeMoeReduce(output_, inout_, scales_, en2f_, nullptr, tokens, k, hidden, 0.f, stream_);
+        });
+
+        return phases;
+    }
+
+    float Measure(const std::function<void()>& setup, const std::function<void()>& run)
+    {
+        float total{};
+        for (int i = 0; i < opts_.warmup + opts_.iters; ++i) {
+            setup();
+            check_cuda_error(cudaEventRecord(beg_, stream_));
+            run();
+            check_cuda_error(cudaEventRecord(end_, stream_));
+            check_cuda_error(cudaEventSynchronize(end_));
+            float ms{};
+            check_cuda_error(cudaEventElapsedTime(&ms, beg_, end_));
+            if (i >= opts_.warmup) {
+                total += ms;
+            }
+        }
+        check_cuda_error(cudaGetLastError());
+        return total * 1000.f / opts_.iters;
+    }
+
+    // The experts share the same random values, the gate is the identity on the first `E` channels
+    void InitWeights()
+    {
+        auto& moe = weights_->moe_weights;
+
+        const size_t hidden  = cfg_.hidden;
+        const size_t experts = cfg_.experts;
+
+        std::vector<T> h(experts * hidden);
+        for (size_t e = 0; e < experts; ++e) {
+            h[e * experts + e] = (T)1.f;
+        }
+        Upload((T*)moe.gate.kernel, h);
+
+        std::mt19937                          gen{(uint32_t)(experts * 131 + cfg_.k)};
+        std::uniform_real_distribution<float> uniform{-1.f, 1.f};
+
+        h.resize(hidden * inter_);
+        for (auto& x : h) {
+            x = (T)(uniform(gen) / std::sqrt((float)hidden));
+        }
+        for (auto& e : moe.experts) {
+            for (auto w : {&e.gating, &e.intermediate, &e.output}) {
+                Upload((T*)w->kernel, h);
+            }
+        }
+
+        char*        workspace{};
+        const size_t size = weights_->workspace_size();
+        check_cuda_error(cudaMallocAsync(&workspace, size, stream_));
+        weights_->prepare(workspace, size, ctx_.cuda_device_prop, stream_);
+        check_cuda_error(cudaFreeAsync(workspace, stream_));
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+
+    void UploadInput(const std::vector<int>& idxs)
+    {
+        const int tokens  = idxs.size() / cfg_.k;
+        const int hidden  = cfg_.hidden;
+        const int experts = cfg_.experts;
+
+        std::mt19937                          gen{(uint32_t)tokens};
+        std::uniform_real_distribution<float> uniform{-1.f, 1.f};
+
+        std::vector<T> h((size_t)tokens * hidden);
+        for (int i = 0; i < tokens; ++i) {
+            T* x = h.data() + (size_t)i * hidden;
+            for (int j = experts; j < hidden; ++j) {
+                x[j] = (T)uniform(gen);
+            }
+            for (int j = 0; j < cfg_.k; ++j) {
+                x[idxs[i * cfg_.k + j]] = (T)1.f;
+            }
+        }
+        Upload(input_, h);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+
+    template<class U>
+    U* Alloc(size_t count)
+    {
+        U* ptr{};
+        check_cuda_error(cudaMalloc(&ptr, sizeof(U) * std::max<size_t>(count, 1)));
+        buffers_.push_back(ptr);
+        return ptr;
+    }
+
+    void FreeBuffers()
+    {
+        for (auto& p : buffers_) {
+            cudaFree(p);
+        }
+        buffers_.clear();
+    }
+
+    // the pageable source is staged before the call returns
+    template<class U>
+    void Upload(U* dst, const std::vector<U>& src)
+    {
+        check_cuda_error(cudaMemcpyAsync(dst, src.data(), sizeof(U) * src.size(), cudaMemcpyHostToDevice, stream_));
+    }
+
+    // Buffers of the phases for `tokens` tokens
+    void Resize(int tokens)
+    {
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        FreeBuffers();
+
+        const size_t rows    = (size_t)tokens * cfg_.k;
+        const size_t experts = cfg_.experts;
+        const size_t padded  = (tokens + kMoeGateVecSize - 1) / kMoeGateVecSize * kMoeGateVecSize;
+
+        input_     = Alloc<T>((size_t)tokens * cfg_.hidden);
+        output_    = Alloc<T>((size_t)tokens * cfg_.hidden);
+        inout_     = Alloc<T>(rows * cfg_.hidden);
+        inter_buf_ = Alloc<T>(rows * inter_ * 2);
+        logits_    = Alloc<float>(tokens * experts);
+        masks_     = Alloc<int8_t>(experts * padded);
+        accum_     = Alloc<int>(experts * kMoeGateMaxTiles);
+        offsets_   = Alloc<int>(experts + 1);
+        f2n_       = Alloc<int>(rows);
+        en2f_      = Alloc<int>(rows);
+        scales_    = Alloc<float>(rows);
+    }
+
+    const Options&         opts_;
+    const Config           cfg_;
+    const MoeParam::Method method_;
+    Context<T>&            ctx_;
+    cudaStream_t const     stream_;
+    const int              inter_;  // of the rank
+
+    ModelParam  model_{};
+    MoeParam    moe_{};
+    EngineParam engine_{};
+
+    std::unique_ptr<LlamaDecoderLayerWeight<T>> weights_;
+    std::unique_ptr<MoeFfnLayer<T>>             layer_;
+    std::unique_ptr<gemm::MoeGemmContext>       context_;     // fused
+    std::unique_ptr<LlamaFfnLayer<T>>           expert_ffn_;  // naive
+
+    cudaEvent_t beg_{};
+    cudaEvent_t end_{};
+
+    std::vector<void*> buffers_;
+
+    T*      input_{};
+    T*      output_{};
+    T*      inout_{};
+    T*      inter_buf_{};
+    float*  logits_{};
+    int8_t* masks_{};
+    int*    accum_{};
+    int*    offsets_{};
+    int*    f2n_{};
+    int*    en2f_{};
+    float*  scales_{};
+
+    int* h_offsets_{};
+};
+
+template<class T>
+std::vector<Result> RunAll(const Options& opts)
+{
+    Context<T> ctx{0};
+
+    std::vector<Result> results;
+    for (size_t c = 0; c < opts.configs.size(); ++c) {
+        Config cfg;
+        MakeConfig(opts.configs[c], opts, cfg);
+
+        // the same assignments for both methods
+        std::mt19937                  gen{(uint32_t)c};
+        const auto                    weights = ExpertWeights(opts, cfg.experts, gen);
+        std::vector<std::vector<int>> idxs;
+        for (const auto& n : opts.tokens) {
+            idxs.push_back(SampleExperts(n, cfg.k, weights, gen));
+        }
+
+        for (const auto& m : opts.methods) {
+            std::cerr << "running " << cfg.name << " (hidden " << cfg.hidden << ", inter " << cfg.inter << "), " << m
+                      << "\n";
+            Bench<T> bench{opts, cfg, m == "fused" ? MoeParam::kFused : MoeParam::kNaive, ctx};
+            if (opts.tune && m == "fused") {
+                for (const auto& n : opts.tokens) {
+                    bench.Tune(n);
+                }
+            }
+            for (const auto& x : idxs) {
+                auto xs = bench.Run(x);
+                results.insert(results.end(), xs.begin(), xs.end());
+            }
+        }
+    }
+    return results;
+}
+
+void Print(const std::vector<Result>& results)
+{
+    std::printf("%8s %8s %8s %10s %-10s %12s\n", "config", "method", "tokens", "imbalance", "phase", "time(us)");
+    for (const auto& r : results) {
+        std::printf("%8s %8s %8d %10.2f %-10s %12.2f\n",
+                    r.config.c_str(),
+                    r.method.c_str(),
+                    r.tokens,
+                    r.imbalance,
+                    r.phase.c_str(),
+                    r.time);
+    }
+}
+
+void WriteJson(std::ostream& os, const Options& opts, const std::vector<Result>& results)
+{
+    os << "{\n  \"dtype\": \"" << opts.dtype << "\",\n  \"tp\": " << opts.tp << ",\n  \"skew\": " << opts.skew
+       << ",\n  \"record\": \"" << opts.record << "\",\n  \"iters\": " << opts.iters << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        os << "    {\"config\": \"" << r.config << "\", \"method\": \"" << r.method << "\", \"tokens\": " << r.tokens
+           << ", \"imbalance\": " << r.imbalance << ", \"phase\": \"" << r.phase << "\", \"time_us\": " << r.time
+           << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: bench_moe [options]\n"
+                 "  --configs LIST      experts x experts per token, 8x2 | 64x6 | 256x8 | ExK (8x2,64x6,256x8)\n"
+                 "  --tokens LIST       token counts, comma separated (1,16,128,1024,4096)\n"
+                 "  --methods LIST      naive | fused (naive,fused)\n"
+                 "  --skew F            Zipf exponent of the routing, 0 for uniform (1)\n"
+                 "  --record FILE       tokens per expert, a layer per line, instead of the Zipf law\n"
+                 "  --record-layer N    line of the record, the sum of the lines when < 0 (-1)\n"
+                 "  --hidden N          hidden size instead of the one of the preset\n"
+                 "  --inter N           intermediate size of the experts instead of the one of the preset\n"
+                 "  --tp N              ranks the intermediate size is sliced over (1)\n"
+                 "  --dtype T           half | bf16 (half)\n"
+                 "  --tune 0|1          tune the fused gemms first (0)\n"
+                 "  --warmup N          (5)\n"
+                 "  --iters N           (20)\n"
+                 "  --output FILE       write the results as JSON\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--configs") {
+            opts.configs = ParseList(value);
+        }
+        else if (key == "--tokens") {
+            opts.tokens = ParseInts(value);
+        }
+        else if (key == "--methods") {
+            opts.methods = ParseList(value);
+        }
+        else if (key == "--skew") {
+            opts.skew = std::stod(value);
+        }
+        else if (key == "--record") {
+            opts.record = value;
+        }
+        else if (key == "--record-layer") {
+            opts.record_layer = std::stoi(value);
+        }
+        else if (key == "--hidden") {
+            opts.hidden = std::stoi(value);
+        }
+        else if (key == "--inter") {
+            opts.inter = std::stoi(value);
+        }
+        else if (key == "--tp") {
+            opts.tp = std::stoi(value);
+        }
+        else if (key == "--dtype") {
+            opts.dtype = value;
+        }
+        else if (key == "--tune") {
+            opts.tune = std::stoi(value);
+        }
+        else if (key == "--warmup") {
+            opts.warmup = std::stoi(value);
+        }
+        else if (key == "--iters") {
+            opts.iters = std::stoi(value);
+        }
+        else if (key == "--output") {
+            opts.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+    if (opts.tp < 1 || opts.iters < 1 || opts.skew < 0) {
+        return false;
+    }
+    for (const auto& m : opts.methods) {
+        if (m != "naive" && m != "fused") {
+            return false;
+        }
+    }
+    for (const auto& n : opts.tokens) {
+        if (n < 1) {
+            return false;
+        }
+    }
+    for (const auto& name : opts.configs) {
+        Config cfg;
+        if (!MakeConfig(name, opts, cfg)) {
+            std::cerr << "invalid config " << name << "\n";
+            return false;
+        }
+    }
+    return opts.dtype == "half" || opts.dtype == "bf16";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Result> results;
+    if (opts.dtype == "half") {
+        results = RunAll<half>(opts);
+    }
+    else {
+#ifdef ENABLE_BF16
+        results = RunAll<__nv_bfloat16>(opts);
+#else
+        std::cerr << "bf16 is not enabled in this build\n";
+        return 1;
+#endif
+    }
+
+    Print(results);
+
+    if (!opts.output.empty()) {
+        std::ofstream ofs(opts.output);
+        WriteJson(ofs, opts, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/block_copier.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include <algorithm>
+
+namespace turbomind {
+
+BlockCopier::BlockCopier(std::vector<size_t> layer_offsets,
+                         size_t              block_size,
+                         cudaStream_t        stream,
+                         cudaStream_t        copy_stream):
+    layer_offsets_{std::move(layer_offsets)},
+    layer_num_{(int)layer_offsets_.size() - 1},
+    block_size_{block_size},
+    ready_(std::max(layer_num_, 0)),
+    stream_{stream},
+    copy_stream_{copy_stream}
+{
+    FT_CHECK(layer_num_ > 0 && layer_offsets_.back() <= block_size_);
+}
+
+BlockCopier::~BlockCopier()
+{
+    if (!ev_compute_) {
+        return;
+    }
+    cudaStreamSynchronize(copy_stream_);
+    for (auto& e : ready_) {
+        cudaEventDestroy(e);
+    }
+    cudaEventDestroy(ev_compute_);
+    if (own_stream_) {
+        cudaStreamDestroy(copy_stream_);
+    }
+}
+
+void BlockCopier::Init()
+{
+    if (!copy_stream_) {
+        check_cuda_error(cudaStreamCreateWithFlags(&copy_stream_, cudaStreamNonBlocking));
+        own_stream_ = true;
+    }
+    for (auto& e : ready_) {
+        check_cuda_error(cudaEventCreateWithFlags(&e, cudaEventDisableTiming));
+    }
+    check_cuda_error(cudaEventCreateWithFlags(&ev_compute_, cudaEventDisableTiming));
+}
+
+void BlockCopier::Add(const void* src, void* dst)
+{
+    queue_.emplace_back(src, dst);
+}
+
+void BlockCopier::Issue()
+{
+    if (queue_.empty()) {
+        return;
+    }
+
+    if (!ev_compute_) {
+        Init();
+    }
+
+    // wait for pending writes to the blocks, the destinations may be read by the previous step
+    check_cuda_error(cudaEventRecord(ev_compute_, stream_));
+    check_cuda_error(cudaStreamWaitEvent(copy_stream_, ev_compute_));
+
+    const size_t tail = layer_offsets_.back();
+
+    for (int i = 0; i < layer_num_; ++i) {
+        const size_t offset = layer_offsets_[i];
+        const size_t size   = layer_offsets_[i + 1] - offset;
+        for (const auto& [src, dst] : queue_) {
+            check_cuda_error(
+                cudaMemcpyAsync((char*)dst + offset, (const char*)src + offset, size, cudaMemcpyDefault, copy_stream_));
+            // the rest of the block (e.g. the summaries) is small and goes with the first layer
+            if (i == 0 && block_size_ > tail) {
+                check_cuda_error(cudaMemcpyAsync(
+                    (char*)dst + tail, (const char*)src + tail, block_size_ - tail, cudaMemcpyDefault, copy_stream_));
+            }
+        }
+        // recorded again by a later `Issue`, which covers the copies before it as well
+        check_cuda_error(cudaEventRecord(ready_[i], copy_stream_));
+    }
+
+    queue_.clear();
+
+    pending_ = true;
+}
+
+void BlockCopier::Acquire(int layer, cudaStream_t stream)
+{
+    if (!pending_) {
+        return;
+    }
+    check_cuda_error(cudaStreamWaitEvent(stream, ready_.at(layer)));
+    if (layer == layer_num_ - 1) {
+        pending_ = false;
+    }
+}
+
+void BlockCopier::Wait(cudaStream_t stream)
+{
+    if (!pending_) {
+        return;
+    }
+    check_cuda_error(cudaStreamWaitEvent(stream, ready_.back()));
+    pending_ = false;
+}
+
+}  // namespace turbomind
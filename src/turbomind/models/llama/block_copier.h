@@ -0,0 +1,74 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <vector>
+
+namespace turbomind {
+
+// Copies whole k/v blocks on a copy stream, the layers of the blocks are copied one after another. The layers are
+// contiguous in a block, so the forward of a layer only has to wait for the same layer of the blocks, the copies of
+// the following layers overlap with its compute
+class BlockCopier {
+public:
+    // Layer `i` of a block is `[layer_offsets[i], layer_offsets[i + 1])`, the layers are copied one by one and the rest
+    // of `block_size` with the first layer. The copies are issued on `copy_stream` when given, otherwise on a private
+    // stream
+    BlockCopier(std::vector<size_t> layer_offsets, size_t block_size, cudaStream_t stream, cudaStream_t copy_stream);
+
+    ~BlockCopier();
+
+    BlockCopier(const BlockCopier&) = delete;
+    BlockCopier& operator=(const BlockCopier&) = delete;
+
+    // Queues the copy of a block, `src` is in device or pinned host memory
+    void Add(const void* src, void* dst);
+
+    // Issues the queued copies, ordered after the work enqueued on the compute stream so far
+    void Issue();
+
+    // Orders the following work on `stream` after `layer` of the issued blocks is copied
+    void Acquire(int layer, cudaStream_t stream);
+
+    // Orders the following work on `stream` after all the issued copies
+    void Wait(cudaStream_t stream);
+
+    bool pending() const noexcept
+    {
+        return pending_;
+    }
+
+    int layer_num() const noexcept
+    {
+        return layer_num_;
+    }
+
+    // offsets of the layers in a block, the last one is the end of the layers
+    const std::vector<size_t>& layer_offsets() const noexcept
+    {
+        return layer_offsets_;
+    }
+
+private:
+    // the stream & the events are created by the first copy, the sequence manager may run without a device
+    void Init();
+
+    std::vector<size_t> layer_offsets_;
+
+    int    layer_num_;
+    size_t block_size_;
+
+    std::vector<std::pair<const void*, void*>> queue_;
+
+    std::vector<cudaEvent_t> ready_;  // the layer of the issued blocks is copied
+    cudaEvent_t              ev_compute_{};
+
+    cudaStream_t stream_{};       // compute stream
+    cudaStream_t copy_stream_{};  // copy stream
+    bool         own_stream_{};
+
+    bool pending_{};  // issued copies the compute stream has not waited for
+};
+
+}  // namespace turbomind
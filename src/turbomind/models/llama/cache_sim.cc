@@ -0,0 +1,342 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Replays a trace of requests against the real `SequenceManager` (with its `BlockManager` & `BlockTrie`) on host
+// memory, the time of a step is given by a cost model instead of the GPU. Admission, eviction & chunking settings
+// can be compared offline in seconds. The copy on write of the cached partial blocks still goes through the CUDA
+// runtime, on host memory.
+//
+// The trace has a request per line, `#` starts a comment
+//
+//     arrival_s input_len output_len [prefix_id prefix_len]
+//
+// The first `prefix_len` tokens of a prompt only depend on `prefix_id`, so that the requests of the same prefix can
+// be served by the prefix cache, the rest of the tokens are unique.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/turbomind/models/llama/SequenceManager.h"
+#include "src/turbomind/utils/allocator.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+using namespace turbomind;
+
+namespace {
+
+// The blocks are plain host memory, they are never read
+class HostAllocator: public IAllocator {
+public:
+    void* malloc(size_t size, const bool is_set_zero, bool is_host) override
+    {
+        void* ptr = std::malloc(std::max<size_t>(size, 1));
+        if (is_set_zero) {
+            std::memset(ptr, 0, size);
+        }
+        return ptr;
+    }
+
+    void free(void** ptr, bool is_host) override
+    {
+        std::free(*ptr);
+        *ptr = nullptr;
+    }
+
+    void setStream(cudaStream_t stream) override {}
+
+    cudaStream_t returnStream() override
+    {
+        return {};
+    }
+
+    void memSet(void* ptr, const int val, const size_t size) override
+    {
+        std::memset(ptr, val, size);
+    }
+
+protected:
+    bool isExist(void* address) const override
+    {
+        return false;
+    }
+
+    ReallocType isReMalloc(void* address, size_t size) const override
+    {
+        return ReallocType::REUSE;
+    }
+};
+
+struct Options {
+    std::string trace;
+
+    int         block_count    = 4096;
+    int         block_len      = 64;
+    int         max_batch_size = 256;
+    int         step_tokens    = 8192;  // tokens of a step, the decodes included
+    bool        prefix_caching = false;
+    int         chunk_size     = 256;  // blocks per allocation chunk
+    std::string eviction       = "lru";
+
+    // step time in ms, `step_ms + token_ms * tokens + kv_ms * context_tokens / 1000`
+    double step_ms  = 8.;
+    double token_ms = 0.02;
+    double kv_ms    = 0.01;
+};
+
+struct Trace {
+    double           arrival;  // s
+    int              input_len;
+    int              output_len;
+    std::vector<int> prompt;
+};
+
+struct Running {
+    int             index;  // into the trace
+    const Sequence* seq;
+    int             generated;
+    bool            active;  // in the last step
+};
+
+void Usage()
+{
+    std::fprintf(stderr,
+                 "usage: cache_sim TRACE [--blocks N] [--block-len N] [--max-batch N] [--step-tokens N]\n"
+                 "                 [--prefix-caching] [--eviction lru|lfu|2q] [--step-ms F] [--token-ms F]\n"
+                 "                 [--kv-ms F]\n");
+}
+
+bool ParseOptions(int argc, char* argv[], Options& o)
+{
+    const auto set = [&](const std::string& a, const std::string& value) {
+        if (a == "--blocks") {
+            o.block_count = std::stoi(value);
+        }
+        else if (a == "--block-len") {
+            o.block_len = std::stoi(value);
+        }
+        else if (a == "--max-batch") {
+            o.max_batch_size = std::stoi(value);
+        }
+        else if (a == "--step-tokens") {
+            o.step_tokens = std::stoi(value);
+        }
+        else if (a == "--prefix-caching") {
+            o.prefix_caching = true;
+        }
+        else if (a == "--eviction") {
+            o.eviction = value;
+        }
+        else if (a == "--step-ms") {
+            o.step_ms = std::stod(value);
+        }
+        else if (a == "--token-ms") {
+            o.token_ms = std::stod(value);
+        }
+        else if (a == "--kv-ms") {
+            o.kv_ms = std::stod(value);
+        }
+        else if (a.empty() && o.trace.empty()) {
+            o.trace = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    };
+    if (!ParseCommandLine(argc, argv, set, {"--prefix-caching"})) {
+        return false;
+    }
+    return !o.trace.empty() && o.block_count > 0 && o.block_len > 0 && o.max_batch_size > 0 && o.step_tokens > 0;
+}
+
+std::vector<Trace> LoadTrace(const std::string& path)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        TM_LOG_ERROR("[cache_sim] can't open %s", path.c_str());
+        std::exit(1);
+    }
+    std::vector<Trace> traces;
+    std::string        line;
+    int                unique = 1 << 24;  // tokens of the unique parts, apart from the prefixes
+    while (std::getline(ifs, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        Trace              t{};
+        int                prefix_id  = 0;
+        int                prefix_len = 0;
+        if (!(iss >> t.arrival >> t.input_len >> t.output_len)) {
+            continue;
+        }
+        iss >> prefix_id >> prefix_len;
+        t.input_len  = std::max(t.input_len, 1);
+        t.output_len = std::max(t.output_len, 1);
+        prefix_len   = std::clamp(prefix_len, 0, t.input_len);
+        for (int i = 0; i < t.input_len; ++i) {
+            t.prompt.push_back(i < prefix_len ? prefix_id * 65536 + i : unique++);
+        }
+        traces.push_back(std::move(t));
+    }
+    std::stable_sort(traces.begin(), traces.end(), [](auto& a, auto& b) { return a.arrival < b.arrival; });
+    return traces;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options o;
+    if (!ParseOptions(argc, argv, o)) {
+        Usage();
+        return 1;
+    }
+
+    const auto traces = LoadTrace(o.trace);
+
+    // Only the block counts matter, a block of a single tiny layer keeps the host memory small
+    SequenceManager::BlockConfig block_config{8, 1, o.block_len, 16, 16, 0, 1};
+
+    HostAllocator   allocator;
+    SequenceManager manager{1,
+                            block_config,
+                            (double)o.block_count,
+                            o.chunk_size,
+                            0,  // the host pool needs a device
+                            o.prefix_caching,
+                            0,
+                            &allocator,
+                            [] { return (size_t)0; },
+                            {},
+                            0,
+                            0,
+                            0,
+                            0,
+                            ParseEvictionPolicy(o.eviction)};
+
+    std::deque<int>      waiting;
+    std::vector<Running> running;
+    std::vector<double>  ttft;
+    std::vector<double>  latency;
+
+    double  now         = 0.;
+    size_t  next        = 0;
+    int64_t steps       = 0;
+    int64_t generated   = 0;
+    int64_t prefilled   = 0;
+    int64_t preemptions = 0;
+
+    while (next < traces.size() || !waiting.empty() || !running.empty()) {
+        if (waiting.empty() && running.empty() && traces[next].arrival > now) {
+            now = traces[next].arrival;  // idle
+        }
+        for (; next < traces.size() && traces[next].arrival <= now; ++next) {
+            waiting.push_back(next);
+        }
+
+        // FCFS admission up to the batch size, the cache manager decides what fits
+        while (!waiting.empty() && (int)running.size() < o.max_batch_size) {
+            const int   i   = waiting.front();
+            auto        seq = manager.Create(i);
+            const auto& t   = traces[i];
+            seq->prompt     = t.prompt;
+            seq->tokens     = t.prompt;
+            running.push_back({i, seq, 0, false});
+            waiting.pop_front();
+        }
+
+        Sequences             sequences;
+        std::vector<int>      context_lengths;
+        std::vector<uint64_t> priorities;
+        for (const auto& r : running) {
+            sequences.push_back(r.seq);
+            context_lengths.push_back(r.seq->tokens.size());
+            priorities.push_back(r.index);
+        }
+
+        auto adjust = [&](const Sequences& seqs, const std::vector<int>&) {
+            return std::max<int>(o.step_tokens, seqs.size() + 1);
+        };
+        (void)manager.Materialize(sequences, context_lengths, priorities, 1, adjust);
+
+        int     tokens = 0;
+        int64_t kv     = 0;
+        for (auto& r : running) {
+            const bool active = r.seq->status == Sequence::kActive;
+            preemptions += r.active && !active;
+            r.active = active;
+            if (active) {
+                tokens += r.seq->input_length;
+                kv += r.seq->cache_len + r.seq->input_length;
+            }
+        }
+
+        // the running sequences are admitted, one of them is always scheduled unless it doesn't fit at all
+        if (!tokens) {
+            TM_LOG_ERROR("[cache_sim] the kv cache can't hold a single sequence");
+            return 1;
+        }
+
+        now += (o.step_ms + o.token_ms * tokens + o.kv_ms * kv / 1000.) / 1000.;
+        ++steps;
+
+        Sequences active;
+        for (auto& r : running) {
+            if (r.active) {
+                auto& s = *r.seq;
+                s.cache_len += s.input_length;
+                prefilled += s.input_length > 1 ? s.input_length : 0;
+                active.push_back(r.seq);
+            }
+        }
+        manager.CacheIfEnabled(active, active.size());
+
+        // a new token for the sequences whose context is complete
+        for (auto it = running.begin(); it != running.end();) {
+            auto& s = *it->seq;
+            if (it->active && s.cache_len == (int)s.tokens.size()) {
+                const auto& t = traces[it->index];
+                if (it->generated++ == 0) {
+                    ttft.push_back(now - t.arrival);
+                }
+                ++generated;
+                s.tokens.push_back(-1 - it->generated);
+                if (it->generated == t.output_len) {
+                    latency.push_back(now - t.arrival);
+                    (void)manager.Erase(s.id);
+                    it = running.erase(it);
+                    continue;
+                }
+            }
+            ++it;
+        }
+    }
+
+    const auto stats = manager.GetCacheStats();
+
+    std::printf("requests       %zu\n", traces.size());
+    std::printf("steps          %ld\n", (long)steps);
+    std::printf("duration       %.3f s\n", now);
+    std::printf("throughput     %.1f tok/s, %.2f req/s\n", generated / now, traces.size() / now);
+    std::printf("prefill        %ld tok\n", (long)prefilled);
+    std::printf("ttft           mean %.3f s, p50 %.3f s, p99 %.3f s\n",
+                ttft.empty() ? 0. : std::accumulate(ttft.begin(), ttft.end(), 0.) / ttft.size(),
+                Percentile(ttft, 50),
+                Percentile(ttft, 99));
+    std::printf("latency        p50 %.3f s, p99 %.3f s\n", Percentile(latency, 50), Percentile(latency, 99));
+    std::printf("preemptions    %ld\n", (long)preemptions);
+    std::printf("prefix hits    %.2f%% (%ld / %ld tok)\n",
+                stats.prompt_tokens ? 100. * stats.hit_tokens / stats.prompt_tokens : 0.,
+                (long)stats.hit_tokens,
+                (long)stats.prompt_tokens);
+    std::printf("evicted blocks %ld\n", (long)stats.evicted_blocks);
+
+    return 0;
+}
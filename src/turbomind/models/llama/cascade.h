@@ -0,0 +1,67 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+namespace turbomind {
+
+// Decoding sequences grouped by the prefix of cache blocks they share, the prefix of a group is attended once for
+// all its members by the cascade decoding. Packed in a single int buffer, the header is followed by
+//   cu_q_len     [group_num + 1], members of the groups
+//   cu_k_len     [group_num + 1], prefix lengths, multiples of `kCascadeAlign`
+//   cu_block_num [group_num], offset of the blocks of the first member
+//   q_idx        [q_num], decoding token (also batch index) of the members
+//   prefix_len   [batch_size], prefix skipped by the decoding, 0 for the sequences in no group
+struct CascadeLayout {
+    static constexpr int kHeader = 3;
+
+    int group_num;
+    int q_num;
+    int batch_size;
+
+    static CascadeLayout Load(const int* buf)
+    {
+        return {buf[0], buf[1], buf[2]};
+    }
+
+    void Store(int* buf) const
+    {
+        buf[0] = group_num;
+        buf[1] = q_num;
+        buf[2] = batch_size;
+    }
+
+    int cu_q_len() const
+    {
+        return kHeader;
+    }
+    int cu_k_len() const
+    {
+        return cu_q_len() + group_num + 1;
+    }
+    int cu_block_num() const
+    {
+        return cu_k_len() + group_num + 1;
+    }
+    int q_idx() const
+    {
+        return cu_block_num() + group_num;
+    }
+    int prefix_len() const
+    {
+        return q_idx() + q_num;
+    }
+    int size() const
+    {
+        return prefix_len() + batch_size;
+    }
+
+    static int max_size(int batch_size)
+    {
+        return CascadeLayout{batch_size, batch_size, batch_size}.size();
+    }
+};
+
+// Prefixes are whole KV tiles of the attention kernels, so that the prefix pass needs no masking
+inline constexpr int kCascadeAlign = 64;
+
+}  // namespace turbomind
@@ -11,8 +11,10 @@
 
 #include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/models/llama/LlamaLinear.h"
+#include "src/turbomind/models/llama/step_profiler.h"
 #include "src/turbomind/utils/allocator.h"
 #include "src/turbomind/utils/cublasMMWrapper.h"
+#include "src/turbomind/utils/startup_timer.h"
 
 namespace turbomind {
 
@@ -23,6 +25,12 @@ struct Communicators {
 
     comm::DeviceComm d_comm;
     int              d_tp_group;
+    int              d_cp_group;    // ranks holding the same heads in other parts of the contexts
+    int              d_attn_group;  // context parallel and TP ranks of an attention DP group
+
+    // between the pipeline stages, one rank per stage
+    comm::DeviceComm d_pp_comm;
+    int              d_pp_result_group;
 };
 
 // Execution context for the model
@@ -38,6 +46,8 @@ struct Context {
     std::unique_ptr<LlamaLinear<T>>                 linear;
     Communicators                                   comm;
     cudaDeviceProp                                  cuda_device_prop;
+    std::unique_ptr<StepProfiler>                   profiler;  // null when profiling is disabled
+    StartupTimer*                                   startup{};  // phases of the engine start, optional
 
     Context(int device_id)
     {
@@ -80,6 +90,7 @@ struct Context {
 
     ~Context()
     {
+        profiler.reset();
         linear.reset();
         cublas_wrapper.reset();
         cublas_algo_map.reset();
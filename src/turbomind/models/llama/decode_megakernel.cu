@@ -0,0 +1,549 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <string>
+#include <type_traits>
+
+#include <cooperative_groups.h>
+
+#include "src/turbomind/kernels/attention/block.h"
+#include "src/turbomind/kernels/attention/rotary_embedding.h"
+#include "src/turbomind/kernels/core/array_ops.h"
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/models/llama/decode_megakernel.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind {
+
+namespace cg = cooperative_groups;
+
+namespace {
+
+using Mk = DecodeMegakernel;
+
+constexpr int kWarps = Mk::kThreads / WARP_SIZE;
+
+// GEMV tiles of 32 columns, each row of a tile is read by 4 lanes (a full sector each 2 lanes), a warp reads 8 rows
+// per step and the warps of a CTA split the rows
+constexpr int kTileN   = 32;
+constexpr int kLaneN   = 8;
+constexpr int kRowStep = WARP_SIZE / (kTileN / kLaneN);
+constexpr int kUnroll  = 4;
+
+template<int D>
+union SharedStorage {
+    struct {
+        float partial[kWarps][Mk::kMaxBatch][kTileN];
+        float sum[Mk::kMaxBatch][kTileN];
+    } gemv;
+    struct {
+        float m[kWarps][Mk::kMaxGroup];
+        float l[kWarps][Mk::kMaxGroup];
+        float o[kWarps][Mk::kMaxGroup][D];
+    } attn;
+    float norm[kWarps];
+};
+
+__device__ float Silu(float x)
+{
+    return x / (1.f + __expf(-x));
+}
+
+// columns of the h-th quarter of a tile
+struct DenseCols {
+    __device__ int operator()(int tile, int h) const
+    {
+        return tile * kTileN + h * kLaneN;
+    }
+};
+
+// chunked [gate, up], the first half of a tile reads gate and the second half reads up
+struct ChunkedCols {
+    int inter_size;
+    __device__ int operator()(int tile, int h) const
+    {
+        return h / 2 * inter_size + tile * (kTileN / 2) + h % 2 * kLaneN;
+    }
+};
+
+// y[b, :] = x[b, :] W over the tiles dealt to the CTA, `epi(tile, sum)` consumes the tile in `sum[b][c]`. `x` is
+// written by the previous phases of the kernel, so it's not read through the non-coherent path
+template<int D, class T, class Cols, class Epi>
+__device__ void Gemv(const T*          x,
+                     int               ldx,
+                     const T*          W,
+                     int               ldw,
+                     int               K,
+                     int               tiles,
+                     int               batch,
+                     Cols              cols,
+                     Epi&&             epi,
+                     SharedStorage<D>& smem)
+{
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+    const int h       = lane_id % (kTileN / kLaneN);
+    const int r       = lane_id / (kTileN / kLaneN);
+
+    constexpr int kStride = kWarps * kRowStep;
+
+    for (int tile = blockIdx.x; tile < tiles; tile += gridDim.x) {
+        const int n = cols(tile, h);
+
+        float acc[Mk::kMaxBatch][kLaneN]{};
+
+        for (int k0 = warp_id * kRowStep + r; k0 < K; k0 += kStride * kUnroll) {
+            Array<T, kLaneN> w[kUnroll];
+            PRAGMA_UNROLL
+            for (int u = 0; u < kUnroll; ++u) {
+                const int k = k0 + u * kStride;
+                if (k < K) {
+                    Ldg(w[u], &W[(int64_t)k * ldw + n]);
+                }
+            }
+            PRAGMA_UNROLL
+            for (int u = 0; u < kUnroll; ++u) {
+                const int k = k0 + u * kStride;
+                if (k < K) {
+                    const auto wf = cast<float>(w[u]);
+                    PRAGMA_UNROLL
+                    for (int b = 0; b < Mk::kMaxBatch; ++b) {
+                        if (b < batch) {
+                            const float xv = (float)x[b * ldx + k];
+                            PRAGMA_UNROLL
+                            for (int j = 0; j < kLaneN; ++j) {
+                                acc[b][j] += xv * wf[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // over the rows of the warp, then over the warps
+        PRAGMA_UNROLL
+        for (int b = 0; b < Mk::kMaxBatch; ++b) {
+            if (b < batch) {
+                PRAGMA_UNROLL
+                for (int j = 0; j < kLaneN; ++j) {
+                    PRAGMA_UNROLL
+                    for (int mask = kTileN / kLaneN; mask < WARP_SIZE; mask *= 2) {
+                        acc[b][j] += __shfl_xor_sync(uint32_t(-1), acc[b][j], mask);
+                    }
+                    if (r == 0) {
+                        smem.gemv.partial[warp_id][b][h * kLaneN + j] = acc[b][j];
+                    }
+                }
+            }
+        }
+        __syncthreads();
+
+        for (int i = threadIdx.x; i < batch * kTileN; i += blockDim.x) {
+            const int b = i / kTileN;
+            const int c = i % kTileN;
+            float     s = 0.f;
+            PRAGMA_UNROLL
+            for (int w = 0; w < kWarps; ++w) {
+                s += smem.gemv.partial[w][b][c];
+            }
+            smem.gemv.sum[b][c] = s;
+        }
+        __syncthreads();
+
+        epi(tile, smem.gemv.sum);
+        __syncthreads();
+    }
+}
+
+// dst[b, :] = norm(src[b, :]) * weight, a CTA per row
+template<class T, int D>
+__device__ void RMSNorm(T* dst, const T* src, const T* weight, int dims, int batch, float eps, SharedStorage<D>& smem)
+{
+    constexpr int kVec = 8;
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    for (int bi = blockIdx.x; bi < batch; bi += gridDim.x) {
+        const T* x = src + (int64_t)bi * dims;
+
+        float sum = 0.f;
+        for (int i = threadIdx.x * kVec; i < dims; i += blockDim.x * kVec) {
+            Array<T, kVec> v;
+            Load(v, &x[i]);
+            PRAGMA_UNROLL
+            for (int j = 0; j < kVec; ++j) {
+                sum += (float)v[j] * (float)v[j];
+            }
+        }
+        PRAGMA_UNROLL
+        for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+            sum += __shfl_xor_sync(uint32_t(-1), sum, mask);
+        }
+        if (lane_id == 0) {
+            smem.norm[warp_id] = sum;
+        }
+        __syncthreads();
+        sum = 0.f;
+        PRAGMA_UNROLL
+        for (int w = 0; w < kWarps; ++w) {
+            sum += smem.norm[w];
+        }
+        const float inv = rsqrtf(sum / dims + eps);
+
+        for (int i = threadIdx.x * kVec; i < dims; i += blockDim.x * kVec) {
+            Array<T, kVec> v;
+            Array<T, kVec> w;
+            Load(v, &x[i]);
+            Ldg(w, &weight[i]);
+            PRAGMA_UNROLL
+            for (int j = 0; j < kVec; ++j) {
+                v[j] = (T)((float)v[j] * inv * (float)w[j]);
+            }
+            Store(&dst[(int64_t)bi * dims + i], v);
+        }
+        __syncthreads();
+    }
+}
+
+// RoPE of q & k of the new tokens, k & v are written to the cache at the end of the sequences
+template<int D, class T, class Layout>
+__device__ void RopeAndCache(const DecodeMegakernelParam<T>& p, const Layout& layout)
+{
+    const int heads   = p.head_num + p.kv_head_num;
+    const int qkv_dim = (heads + p.kv_head_num) * D;
+    const int pairs   = p.batch_size * heads * (D / 2);
+
+    for (int i = threadIdx.x + blockIdx.x * blockDim.x; i < pairs; i += blockDim.x * gridDim.x) {
+        const int di = i % (D / 2) * 2;
+        const int hi = i / (D / 2) % heads;
+        const int bi = i / (D / 2) / heads;
+
+        const int ti = p.cu_k_len[bi + 1] - p.cu_k_len[bi] - 1;
+
+        T* x = p.qkv_buf + (int64_t)bi * qkv_dim + hi * D + di;
+
+        Array<T, 2> vec;
+        Load(vec, x);
+
+        FastRoPE rope(p.rope, bi, std::integral_constant<int, 2>{});
+        rope.init(di);
+        rope.apply(vec, ti);
+
+        if (hi < p.head_num) {
+            Store(x, vec);
+        }
+        else {
+            Array<T, 2> v;
+            Load(v, x + p.kv_head_num * D);
+            block::Head<T, T, Layout> head{layout, p.layer_id, hi - p.head_num};
+            head.with(p.block_ptrs + p.cu_block_counts[bi], ti, [&](T* k_cache, T* v_cache, T*, T*) {
+                Store(&k_cache[di], vec);
+                Store(&v_cache[di], v);
+            });
+        }
+    }
+}
+
+// Online softmax over a split of the kv of a (sequence, kv head), for all query heads of the group. The warps of the
+// CTA take interleaved tokens and are merged in smem
+template<int D, class T, class Layout>
+__device__ void
+AttentionPartials(const DecodeMegakernelParam<T>& p, const Layout& layout, SharedStorage<D>& smem)
+{
+    constexpr int kPerLane = D / WARP_SIZE;
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    const int group   = p.head_num / p.kv_head_num;
+    const int qkv_dim = (p.head_num + 2 * p.kv_head_num) * D;
+    const int items   = p.batch_size * p.kv_head_num * p.split_cnt;
+
+    for (int item = blockIdx.x; item < items; item += gridDim.x) {
+        const int si = item % p.split_cnt;
+        const int kv = item / p.split_cnt % p.kv_head_num;
+        const int bi = item / p.split_cnt / p.kv_head_num;
+
+        const int k_len = p.cu_k_len[bi + 1] - p.cu_k_len[bi];
+        const int span  = cdiv(k_len, p.split_cnt);
+        const int begin = si * span;
+        const int end   = min(k_len, begin + span);
+
+        Array<float, kPerLane> q[Mk::kMaxGroup];
+        Array<float, kPerLane> o[Mk::kMaxGroup];
+        float                  m[Mk::kMaxGroup];
+        float                  l[Mk::kMaxGroup];
+        PRAGMA_UNROLL
+        for (int g = 0; g < Mk::kMaxGroup; ++g) {
+            if (g < group) {
+                Array<T, kPerLane> vec;
+                Load(vec, p.qkv_buf + (int64_t)bi * qkv_dim + (kv * group + g) * D + lane_id * kPerLane);
+                q[g] = cast<float>(vec);
+            }
+            clear(o[g]);
+            m[g] = -INFINITY;
+            l[g] = 0.f;
+        }
+
+        block::Head<T, T, Layout> head{layout, p.layer_id, kv};
+        char** block_ptrs = p.block_ptrs + p.cu_block_counts[bi];
+
+        for (int ti = begin + warp_id; ti < end; ti += kWarps) {
+            Array<T, kPerLane> k_vec;
+            Array<T, kPerLane> v_vec;
+            head.with(block_ptrs, ti, [&](T* k_cache, T* v_cache, T*, T*) {
+                Load(k_vec, &k_cache[lane_id * kPerLane]);
+                Load(v_vec, &v_cache[lane_id * kPerLane]);
+            });
+            const auto k = cast<float>(k_vec);
+            const auto v = cast<float>(v_vec);
+            PRAGMA_UNROLL
+            for (int g = 0; g < Mk::kMaxGroup; ++g) {
+                if (g < group) {
+                    float s = 0.f;
+                    PRAGMA_UNROLL
+                    for (int j = 0; j < kPerLane; ++j) {
+                        s += q[g][j] * k[j];
+                    }
+                    PRAGMA_UNROLL
+                    for (int mask = WARP_SIZE / 2; mask > 0; mask /= 2) {
+                        s += __shfl_xor_sync(uint32_t(-1), s, mask);
+                    }
+                    s *= p.inv_sqrt_dh;
+                    const float m_new = fmaxf(m[g], s);
+                    const float scale = exp2f(m[g] - m_new);
+                    const float w     = exp2f(s - m_new);
+                    l[g]              = l[g] * scale + w;
+                    PRAGMA_UNROLL
+                    for (int j = 0; j < kPerLane; ++j) {
+                        o[g][j] = o[g][j] * scale + w * v[j];
+                    }
+                    m[g] = m_new;
+                }
+            }
+        }
+
+        PRAGMA_UNROLL
+        for (int g = 0; g < Mk::kMaxGroup; ++g) {
+            if (g < group) {
+                if (lane_id == 0) {
+                    smem.attn.m[warp_id][g] = m[g];
+                    smem.attn.l[warp_id][g] = l[g];
+                }
+                PRAGMA_UNROLL
+                for (int j = 0; j < kPerLane; ++j) {
+                    smem.attn.o[warp_id][g][lane_id * kPerLane + j] = o[g][j];
+                }
+            }
+        }
+        __syncthreads();
+
+        for (int i = threadIdx.x; i < group * D; i += blockDim.x) {
+            const int g = i / D;
+            const int d = i % D;
+            float     M = -INFINITY;
+            PRAGMA_UNROLL
+            for (int w = 0; w < kWarps; ++w) {
+                M = fmaxf(M, smem.attn.m[w][g]);
+            }
+            float L = 0.f;
+            float O = 0.f;
+            PRAGMA_UNROLL
+            for (int w = 0; w < kWarps; ++w) {
+                // the warps without tokens
+                const float f = smem.attn.m[w][g] == -INFINITY ? 0.f : exp2f(smem.attn.m[w][g] - M);
+                L += f * smem.attn.l[w][g];
+                O += f * smem.attn.o[w][g][d];
+            }
+            const int64_t idx = (int64_t)(bi * p.head_num + kv * group + g) * p.split_cnt + si;
+            p.partial_O[idx * D + d] = O;
+            if (d == 0) {
+                p.partial_ML[idx * 2 + 0] = M;
+                p.partial_ML[idx * 2 + 1] = L;
+            }
+        }
+        __syncthreads();
+    }
+}
+
+// attn[b, h * D + d] from the partials of the splits, the first split of a sequence is never empty
+template<int D, class T>
+__device__ void CombinePartials(const DecodeMegakernelParam<T>& p)
+{
+    const int count = p.batch_size * p.head_num * D;
+    for (int i = threadIdx.x + blockIdx.x * blockDim.x; i < count; i += blockDim.x * gridDim.x) {
+        const int     d    = i % D;
+        const int64_t base = (int64_t)(i / D) * p.split_cnt;
+        float         M    = -INFINITY;
+        for (int s = 0; s < p.split_cnt; ++s) {
+            M = fmaxf(M, p.partial_ML[(base + s) * 2]);
+        }
+        float L = 0.f;
+        float O = 0.f;
+        for (int s = 0; s < p.split_cnt; ++s) {
+            const float m = p.partial_ML[(base + s) * 2];
+            const float f = m == -INFINITY ? 0.f : exp2f(m - M);
+            L += f * p.partial_ML[(base + s) * 2 + 1];
+            O += f * p.partial_O[(base + s) * D + d];
+        }
+        p.attn_buf[i] = (T)(O / L);
+    }
+}
+
+template<class T, int D>
+__global__ void __launch_bounds__(Mk::kThreads) DecodeMegakernelKernel(DecodeMegakernelParam<T> p)
+{
+    __shared__ SharedStorage<D> smem;
+
+    auto grid = cg::this_grid();
+
+    const block::Layout layout{block::Config<T, T, D>{p.kv_head_num, p.block_len}};
+
+    const int B        = p.batch_size;
+    const int qkv_dim  = (p.head_num + 2 * p.kv_head_num) * D;
+    const int attn_dim = p.head_num * D;
+
+    auto store_qkv = [&](int tile, const float(*sum)[kTileN]) {
+        for (int i = threadIdx.x; i < B * kTileN; i += blockDim.x) {
+            const int b = i / kTileN;
+            const int c = i % kTileN;
+            p.qkv_buf[(int64_t)b * qkv_dim + tile * kTileN + c] = (T)sum[b][c];
+        }
+    };
+
+    auto add_residual = [&](int tile, const float(*sum)[kTileN]) {
+        for (int i = threadIdx.x; i < B * kTileN; i += blockDim.x) {
+            const int b = i / kTileN;
+            const int c = i % kTileN;
+            T&        r = p.residual[(int64_t)b * p.hidden + tile * kTileN + c];
+            r           = (T)((float)r + sum[b][c]);
+        }
+    };
+
+    // 16 outputs per tile, (gate, up) are adjacent columns when interleaved, or the 2 halves of the tile otherwise
+    auto store_act = [&](int tile, const float(*sum)[kTileN]) {
+        constexpr int kHalf = kTileN / 2;
+        for (int i = threadIdx.x; i < B * kHalf; i += blockDim.x) {
+            const int   b    = i / kHalf;
+            const int   c    = i % kHalf;
+            const float gate = p.interleaved ? sum[b][c * 2] : sum[b][c];
+            const float up   = p.interleaved ? sum[b][c * 2 + 1] : sum[b][c + kHalf];
+            p.inter_buf[(int64_t)b * p.inter_size + tile * kHalf + c] = (T)(Silu(gate) * up);
+        }
+    };
+
+    Gemv<D>(
+        p.hidden_states, p.hidden, p.qkv, qkv_dim, p.hidden, qkv_dim / kTileN, B, DenseCols{}, store_qkv, smem);
+    grid.sync();
+
+    RopeAndCache<D>(p, layout);
+    grid.sync();
+
+    AttentionPartials<D>(p, layout, smem);
+    grid.sync();
+
+    CombinePartials<D>(p);
+    grid.sync();
+
+    Gemv<D>(
+        p.attn_buf, attn_dim, p.output, p.hidden, attn_dim, p.hidden / kTileN, B, DenseCols{}, add_residual, smem);
+    grid.sync();
+
+    RMSNorm(p.hidden_states, p.residual, p.ffn_norm, p.hidden, B, p.eps, smem);
+    grid.sync();
+
+    const int gate_up_tiles = p.inter_size / (kTileN / 2);
+    if (p.interleaved) {
+        Gemv<D>(p.hidden_states,
+                p.hidden,
+                p.gate_up,
+                2 * p.inter_size,
+                p.hidden,
+                gate_up_tiles,
+                B,
+                DenseCols{},
+                store_act,
+                smem);
+    }
+    else {
+        Gemv<D>(p.hidden_states,
+                p.hidden,
+                p.gate_up,
+                2 * p.inter_size,
+                p.hidden,
+                gate_up_tiles,
+                B,
+                ChunkedCols{p.inter_size},
+                store_act,
+                smem);
+    }
+    grid.sync();
+
+    Gemv<D>(p.inter_buf,
+            p.inter_size,
+            p.down,
+            p.hidden,
+            p.inter_size,
+            p.hidden / kTileN,
+            B,
+            DenseCols{},
+            add_residual,
+            smem);
+    grid.sync();
+
+    RMSNorm(p.hidden_states, p.residual, p.next_norm, p.hidden, B, p.eps, smem);
+}
+
+template<class T, class F>
+auto DispatchHeadDim(int head_dim, F&& f)
+{
+    switch (head_dim) {
+        case 64:
+            return f(DecodeMegakernelKernel<T, 64>);
+        case 128:
+            return f(DecodeMegakernelKernel<T, 128>);
+        default:
+            FT_CHECK_WITH_INFO(0, "unsupported head dim of the decoding megakernel: " + std::to_string(head_dim));
+            return f(DecodeMegakernelKernel<T, 128>);
+    }
+}
+
+}  // namespace
+
+template<class T>
+int GetDecodeMegakernelGridSize(int head_dim)
+{
+    int device{};
+    int sm_count{};
+    check_cuda_error(cudaGetDevice(&device));
+    check_cuda_error(cudaDeviceGetAttribute(&sm_count, cudaDevAttrMultiProcessorCount, device));
+    return DispatchHeadDim<T>(head_dim, [&](auto func) {
+        int blocks{};
+        check_cuda_error(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocks, func, Mk::kThreads, 0));
+        return sm_count * blocks;
+    });
+}
+
+template<class T>
+void invokeDecodeMegakernel(const DecodeMegakernelParam<T>& param, int grid_size, cudaStream_t stream)
+{
+    FT_CHECK(0 < param.batch_size && param.batch_size <= Mk::kMaxBatch);
+    FT_CHECK(param.head_num / param.kv_head_num <= Mk::kMaxGroup);
+    FT_CHECK(0 < param.split_cnt && param.split_cnt <= Mk::kMaxSplits);
+
+    DispatchHeadDim<T>(param.head_dim, [&](auto func) {
+        void* args[] = {(void*)&param};
+        check_cuda_error(cudaLaunchCooperativeKernel((void*)func, grid_size, Mk::kThreads, args, 0, stream));
+        return 0;
+    });
+}
+
+template int  GetDecodeMegakernelGridSize<half>(int);
+template void invokeDecodeMegakernel(const DecodeMegakernelParam<half>&, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template int  GetDecodeMegakernelGridSize<nv_bfloat16>(int);
+template void invokeDecodeMegakernel(const DecodeMegakernelParam<nv_bfloat16>&, int, cudaStream_t);
+#endif
+
+}  // namespace turbomind
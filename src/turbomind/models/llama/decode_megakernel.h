@@ -0,0 +1,69 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/models/llama/llama_rope.h"
+
+namespace turbomind {
+
+// Persistent kernel running a whole Llama-style decoder layer (attention & FFN) of a tiny decoding batch in a single
+// cooperative launch, the phases of the layer are separated by grid syncs instead of kernel boundaries. For dense
+// f16/bf16 weights in (k, n) row-major and an unquantized kv cache on a single GPU
+struct DecodeMegakernel {
+    static constexpr int kMaxBatch  = 8;
+    static constexpr int kMaxGroup  = 8;   // query heads per kv head
+    static constexpr int kMaxSplits = 16;  // of the kv of a sequence in the attention
+    static constexpr int kThreads   = 256;
+};
+
+template<class T>
+struct DecodeMegakernelParam {
+    // weights of the layer
+    const T* qkv;        // [hidden, (head_num + 2 * kv_head_num) * head_dim]
+    const T* output;     // [head_num * head_dim, hidden]
+    const T* gate_up;    // [hidden, 2 * inter_size], gate & up interleaved by column or chunked, see `interleaved`
+    const T* down;       // [inter_size, hidden]
+    const T* ffn_norm;   // [hidden]
+    const T* next_norm;  // [hidden], of the next layer or the output norm
+
+    // the normed input of the layer, the normed input of the next layer on return
+    T* residual;       // [batch_size, hidden]
+    T* hidden_states;  // [batch_size, hidden]
+
+    // workspace
+    T*     qkv_buf;     // [batch_size, (head_num + 2 * kv_head_num) * head_dim]
+    T*     attn_buf;    // [batch_size, head_num * head_dim]
+    T*     inter_buf;   // [batch_size, inter_size]
+    float* partial_O;   // [batch_size, head_num, split_cnt, head_dim]
+    float* partial_ML;  // [batch_size, head_num, split_cnt, 2]
+
+    // kv cache
+    char**          block_ptrs;
+    const int*      cu_block_counts;  // [batch_size + 1]
+    const int*      cu_k_len;         // [batch_size + 1]
+    int             layer_id;
+    int             block_len;
+    RopeKernelParam rope;
+    float           inv_sqrt_dh;  // softmax scale with log2(e)
+
+    int   batch_size;
+    int   hidden;
+    int   head_num;
+    int   kv_head_num;
+    int   head_dim;  // 64 or 128
+    int   inter_size;
+    int   split_cnt;
+    bool  interleaved;  // gate & up interleaved by column (fused silu), chunked [gate, up] otherwise
+    float eps;
+};
+
+// CTAs of the grid, all of them resident
+template<class T>
+int GetDecodeMegakernelGridSize(int head_dim);
+
+template<class T>
+void invokeDecodeMegakernel(const DecodeMegakernelParam<T>& param, int grid_size, cudaStream_t stream);
+
+}  // namespace turbomind
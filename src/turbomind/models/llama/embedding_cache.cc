@@ -0,0 +1,57 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/embedding_cache.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+EmbeddingCache::EmbeddingCache(size_t capacity, cudaStream_t stream): capacity_{capacity}, stream_{stream}
+{
+    TM_LOG_INFO("[EmbeddingCache] capacity = %.3f GB", (float)capacity_ / (1 << 30));
+}
+
+std::shared_ptr<const std::byte> EmbeddingCache::Find(uint64_t key, size_t size)
+{
+    auto it = index_.find(key);
+    if (it == index_.end() || it->second->size != size) {
+        return {};
+    }
+    lru_.splice(lru_.end(), lru_, it->second);
+    return it->second->data;
+}
+
+std::shared_ptr<const std::byte> EmbeddingCache::Insert(uint64_t key, const void* src, size_t size)
+{
+    if (size > capacity_) {
+        return {};
+    }
+
+    if (auto it = index_.find(key); it != index_.end()) {
+        size_ -= it->second->size;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+
+    while (size_ + size > capacity_) {
+        size_ -= lru_.front().size;
+        index_.erase(lru_.front().key);
+        lru_.pop_front();
+    }
+
+    std::byte* ptr{};
+    check_cuda_error(cudaMallocAsync(&ptr, size, stream_));
+    check_cuda_error(cudaMemcpyAsync(ptr, src, size, cudaMemcpyDefault, stream_));
+
+    // ordered after the pending copies from the entry, the stream outlives the sequences of the engine
+    std::shared_ptr<const std::byte> data(
+        ptr, [stream = stream_](const std::byte* p) { check_cuda_error(cudaFreeAsync((void*)p, stream)); });
+
+    lru_.push_back({key, data, size});
+    index_.emplace(key, std::prev(lru_.end()));
+    size_ += size;
+
+    return data;
+}
+
+}  // namespace turbomind
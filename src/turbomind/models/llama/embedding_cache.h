@@ -0,0 +1,61 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// Device copies of input embeddings (e.g. image features) keyed by the content hash given by the caller, replaced in
+// LRU order. Sequences hold references to the entries, eviction only drops the reference of the cache so an entry
+// in use stays valid until its sequences drop it.
+class EmbeddingCache {
+public:
+    EmbeddingCache(size_t capacity, cudaStream_t stream);
+
+    EmbeddingCache(const EmbeddingCache&) = delete;
+    EmbeddingCache& operator=(const EmbeddingCache&) = delete;
+
+    // nullptr when `key` is not cached or cached with a different size
+    std::shared_ptr<const std::byte> Find(uint64_t key, size_t size);
+
+    // host/device -> device, nullptr when `size` exceeds the capacity
+    std::shared_ptr<const std::byte> Insert(uint64_t key, const void* src, size_t size);
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+private:
+    struct Entry {
+        uint64_t                         key;
+        std::shared_ptr<const std::byte> data;
+        size_t                           size;
+    };
+
+    size_t       capacity_;
+    size_t       size_{};
+    cudaStream_t stream_;
+
+    std::list<Entry>                                         lru_;  // oldest first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+};
+
+// Token id standing in for the `offset`-th token of an embedding in prefix matching, negative so that it never
+// collides with the vocab
+inline int EmbeddingTokenId(uint64_t hash, int offset)
+{
+    uint64_t x = hash + 0x9e3779b97f4a7c15ull * (offset + 1);
+    x          = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x          = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return -1 - (int)((x ^ (x >> 31)) >> 33);
+}
+
+}  // namespace turbomind
@@ -0,0 +1,294 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/expert_cache.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/memory_utils.h"
+#include <algorithm>
+#include <numeric>
+
+namespace turbomind {
+
+// offsets of the buffers in an expert, enough for the vectorized access of the kernels
+static constexpr size_t kAlignment = 256;
+
+// an entry of the blocked pointers, same as `gemm::StridedPtr`
+struct alignas(16) BlockedPtr {
+    void* ptr;
+    int   stride;
+};
+
+// entries of the i-th table in the mirror
+static BlockedPtr* entries(void* h_tables, int expert_num, size_t i)
+{
+    return (BlockedPtr*)h_tables + i * expert_num;
+}
+
+ExpertCache::ExpertCache(int layer_begin, int layer_end, int slots):
+    layer_begin_(layer_begin), layer_end_(layer_end), slots_(slots), layers_(std::max(layer_end - layer_begin, 0))
+{
+    FT_CHECK(slots_ > 0);
+    check_cuda_error(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    check_cuda_error(cudaEventCreateWithFlags(&ready_, cudaEventDisableTiming));
+}
+
+ExpertCache::~ExpertCache()
+{
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    if (hits_ + misses_) {
+        const int64_t total = hits_ + misses_;
+        TM_LOG_INFO("[ExpertCache] %.2f%% of %ld routed experts hit", 100.f * hits_ / total, (long)total);
+    }
+
+    for (auto& l : layers_) {
+        if (l.host) {
+            check_cuda_error(cudaFreeHost(l.host));
+        }
+        if (l.h_tables) {
+            check_cuda_error(cudaFreeHost(l.h_tables));
+        }
+        deviceFree(l.slots, stream_);
+    }
+    deviceFree(staging_, stream_);
+
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    check_cuda_error(cudaEventDestroy(ready_));
+    check_cuda_error(cudaStreamDestroy(stream_));
+}
+
+void ExpertCache::Add(int layer, std::vector<Buffers> experts, std::vector<void*> tables, cudaStream_t st)
+{
+    auto& l = layers_.at(layer - layer_begin_);
+    FT_CHECK(l.host == nullptr && !experts.empty());
+
+    for (const auto& [ptr, size] : experts[0]) {
+        l.offsets.push_back(l.bytes);
+        l.bytes += (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+    FT_CHECK(tables.size() == l.offsets.size());
+
+    l.expert_num = experts.size();
+
+    check_cuda_error(cudaMallocHost(&l.host, l.bytes * l.expert_num));
+
+    for (int e = 0; e < l.expert_num; ++e) {
+        FT_CHECK(experts[e].size() == l.offsets.size());
+        for (size_t i = 0; i < experts[e].size(); ++i) {
+            auto& [ptr, size] = experts[e][i];
+            check_cuda_error(
+                cudaMemcpyAsync(l.host + l.bytes * e + l.offsets[i], *ptr, size, cudaMemcpyDeviceToHost, st));
+            // the slots are not owned by the experts
+            deviceFree(*ptr, st);
+        }
+    }
+
+    // the strides of the entries are kept, only the pointers are rewritten
+    const size_t table_bytes = sizeof(BlockedPtr) * l.expert_num;
+    check_cuda_error(cudaMallocHost(&l.h_tables, table_bytes * tables.size()));
+    for (size_t i = 0; i < tables.size(); ++i) {
+        check_cuda_error(
+            cudaMemcpyAsync(entries(l.h_tables, l.expert_num, i), tables[i], table_bytes, cudaMemcpyDeviceToHost, st));
+    }
+
+    l.tables = std::move(tables);
+}
+
+void ExpertCache::Finalize(cudaStream_t st)
+{
+    // the host copies must land before the first fetch on the copy stream
+    check_cuda_error(cudaStreamSynchronize(st));
+
+    for (int i = layer_begin_; i < layer_end_; ++i) {
+        auto& l = layers_[i - layer_begin_];
+        if (!l.host) {  // dense layer
+            continue;
+        }
+        const int slots = std::min(slots_, l.expert_num);
+
+        deviceMalloc(&l.slots, l.bytes * slots, stream_);
+
+        l.slot_expert.assign(slots, -1);
+        l.expert_slot.assign(l.expert_num, -1);
+        l.last_use.assign(slots, 0);
+
+        // the experts not resident are never read, their entries refer to a valid buffer nonetheless
+        for (size_t j = 0; j < l.tables.size(); ++j) {
+            for (int e = 0; e < l.expert_num; ++e) {
+                entries(l.h_tables, l.expert_num, j)[e].ptr = l.slots + l.offsets[j];
+            }
+        }
+        Upload(l);
+
+        // the experts routed to in a step that do not fit in the slots of the layer
+        staging_bytes_ = std::max(staging_bytes_, l.bytes * (l.expert_num - slots));
+    }
+
+    if (staging_bytes_) {
+        deviceMalloc(&staging_, staging_bytes_, stream_);
+    }
+
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+std::vector<int> ExpertCache::Victims(const Layer& l, const std::vector<char>& keep) const
+{
+    std::vector<int> slots;
+    for (int s = 0; s < (int)l.slot_expert.size(); ++s) {
+        if (l.slot_expert[s] < 0 || !keep[l.slot_expert[s]]) {
+            slots.push_back(s);
+        }
+    }
+    // the empty slots are never used
+    std::stable_sort(slots.begin(), slots.end(), [&](int a, int b) { return l.last_use[a] < l.last_use[b]; });
+    return slots;
+}
+
+void ExpertCache::Fetch(Layer& l, int expert, char* dst)
+{
+    for (size_t j = 0; j < l.tables.size(); ++j) {
+        entries(l.h_tables, l.expert_num, j)[expert].ptr = dst + l.offsets[j];
+    }
+    check_cuda_error(cudaMemcpyAsync(dst, l.host + l.bytes * expert, l.bytes, cudaMemcpyHostToDevice, stream_));
+}
+
+void ExpertCache::Upload(Layer& l)
+{
+    for (size_t j = 0; j < l.tables.size(); ++j) {
+        check_cuda_error(cudaMemcpyAsync(l.tables[j],
+                                         entries(l.h_tables, l.expert_num, j),
+                                         sizeof(BlockedPtr) * l.expert_num,
+                                         cudaMemcpyHostToDevice,
+                                         stream_));
+    }
+}
+
+void ExpertCache::Acquire(int layer, const int* h_offsets, cudaStream_t stream)
+{
+    auto& l = layers_.at(layer - layer_begin_);
+    FT_CHECK(l.slots);
+
+    if (l.prefetched) {
+        // the mirror of the tables is read by the copies of the prefetch, which the GEMMs need anyway
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        l.prefetched = false;
+    }
+
+    ++clock_;
+
+    std::vector<char> need(l.expert_num);
+    std::vector<int>  missing;
+    for (int e = 0; e < l.expert_num; ++e) {
+        if (h_offsets[e + 1] > h_offsets[e]) {
+            need[e] = 1;
+            if (const int s = l.expert_slot[e]; s >= 0) {
+                l.last_use[s] = clock_;
+                ++hits_;
+            }
+            else {
+                missing.push_back(e);
+                ++misses_;
+            }
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    const auto victims = Victims(l, need);
+
+    size_t staged = 0;
+    for (size_t i = 0; i < missing.size(); ++i) {
+        const int e = missing[i];
+        if (i < victims.size()) {
+            const int s = victims[i];
+            if (l.slot_expert[s] >= 0) {
+                l.expert_slot[l.slot_expert[s]] = -1;
+            }
+            l.slot_expert[s] = e;
+            l.expert_slot[e] = s;
+            l.last_use[s]    = clock_;
+            Fetch(l, e, l.slots + l.bytes * s);
+        }
+        else {
+            // more experts than slots are routed to in the step, the rest is read from the staging area once
+            FT_CHECK(l.bytes * (staged + 1) <= staging_bytes_);
+            Fetch(l, e, staging_ + l.bytes * staged++);
+        }
+    }
+
+    Upload(l);
+
+    check_cuda_error(cudaEventRecord(ready_, stream_));
+    check_cuda_error(cudaStreamWaitEvent(stream, ready_));
+}
+
+void ExpertCache::Prefetch(int layer, const std::vector<int>& experts)
+{
+    auto& l = layers_.at(layer - layer_begin_);
+    FT_CHECK(l.slots);
+
+    std::vector<char> keep(l.expert_num);
+    std::vector<int>  missing;
+    for (const auto& e : experts) {
+        if (!keep[e]) {
+            keep[e] = 1;
+            if (l.expert_slot[e] < 0) {
+                missing.push_back(e);
+            }
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    const auto victims = Victims(l, keep);
+
+    for (size_t i = 0; i < std::min(missing.size(), victims.size()); ++i) {
+        const int e = missing[i];
+        const int s = victims[i];
+        if (l.slot_expert[s] >= 0) {
+            l.expert_slot[l.slot_expert[s]] = -1;
+        }
+        l.slot_expert[s] = e;
+        l.expert_slot[e] = s;
+        l.last_use[s]    = clock_;
+        Fetch(l, e, l.slots + l.bytes * s);
+    }
+
+    Upload(l);
+
+    l.prefetched = true;
+}
+
+int ExpertCache::Next(int layer) const noexcept
+{
+    for (int i = layer + 1; i < layer_end_; ++i) {
+        if (layers_[i - layer_begin_].host) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t ExpertCache::host_bytes() const noexcept
+{
+    size_t bytes{};
+    for (const auto& l : layers_) {
+        bytes += l.bytes * l.expert_num;
+    }
+    return bytes;
+}
+
+size_t ExpertCache::device_bytes() const noexcept
+{
+    size_t bytes = staging_bytes_;
+    for (const auto& l : layers_) {
+        bytes += l.bytes * l.slot_expert.size();
+    }
+    return bytes;
+}
+
+}  // namespace turbomind
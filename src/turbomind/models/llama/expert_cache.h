@@ -0,0 +1,97 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/models/llama/weight_pager.h"
+
+namespace turbomind {
+
+// Holds the prepared routed experts of the MoE layers in pinned host memory, each layer caches the recently used ones
+// in a few device slots (LRU). The blocked pointers read by the grouped GEMMs refer to the slots, the experts routed
+// to in a step are made resident before the GEMMs and the ones that do not fit in the slots of the layer are copied
+// to a staging area shared by the layers. The experts predicted for the next layer are prefetched on a copy stream.
+//
+// The counts of the routed experts are read on the host, so the caller synchronizes its stream before `Acquire`. All
+// the work reading the slots of the earlier steps is complete at that point, the slots are rewritten without events
+class ExpertCache {
+public:
+    using Buffers = WeightPager::Buffers;
+
+    ExpertCache(int layer_begin, int layer_end, int slots);
+
+    ~ExpertCache();
+
+    ExpertCache(const ExpertCache&) = delete;
+    ExpertCache& operator=(const ExpertCache&) = delete;
+
+    // Moves the experts of a prepared layer to the host, all experts have the same buffers. Entry `e` of the device
+    // blocked pointers `tables[i]` refers to `buffers[i]` of expert `e`
+    void Add(int layer, std::vector<Buffers> experts, std::vector<void*> tables, cudaStream_t st);
+
+    // Allocates the slots & the staging area
+    void Finalize(cudaStream_t st);
+
+    // Makes the experts with rows in `h_offsets` resident and orders the following work on `stream` after the copies
+    void Acquire(int layer, const int* h_offsets, cudaStream_t stream);
+
+    // Starts copying the missing `experts` of `layer` into its least recently used slots
+    void Prefetch(int layer, const std::vector<int>& experts);
+
+    // Next cached layer of the stage, -1 for the last one
+    int Next(int layer) const noexcept;
+
+    size_t host_bytes() const noexcept;
+
+    size_t device_bytes() const noexcept;
+
+private:
+    struct Layer {
+        std::vector<size_t> offsets;  // of the buffers in an expert
+        size_t              bytes{};  // of an expert
+        int                 expert_num{};
+        char*               host{};  // [expert_num, bytes]
+
+        std::vector<void*> tables;
+        void*              h_tables{};  // [tables, expert_num], pinned mirror
+
+        char*                 slots{};
+        std::vector<int>      slot_expert;  // expert in the slot or -1
+        std::vector<int>      expert_slot;  // slot of the expert or -1
+        std::vector<uint64_t> last_use;     // of the slots
+
+        bool prefetched{};
+    };
+
+    // Copies `expert` to `dst` on the copy stream & points its entries to it
+    void Fetch(Layer& l, int expert, char* dst);
+
+    // Copies the mirror of the tables to the device on the copy stream
+    void Upload(Layer& l);
+
+    // Slots of the layer by the last use, the ones holding `keep[e] != 0` are excluded
+    std::vector<int> Victims(const Layer& l, const std::vector<char>& keep) const;
+
+    int layer_begin_;
+    int layer_end_;
+    int slots_;
+
+    std::vector<Layer> layers_;
+
+    char*  staging_{};
+    size_t staging_bytes_{};
+
+    uint64_t clock_{};
+
+    cudaStream_t stream_{};  // copy stream
+    cudaEvent_t  ready_{};   // the copies issued so far are done
+
+    int64_t hits_{};
+    int64_t misses_{};
+};
+
+}  // namespace turbomind
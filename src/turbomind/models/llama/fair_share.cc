@@ -0,0 +1,156 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include "src/turbomind/models/llama/fair_share.h"
+
+namespace turbomind {
+
+// a tenant of no weight would never be served
+static constexpr float kMinWeight = 1e-3f;
+
+FairShare::FairShare(int quantum, std::string labels): quantum_{std::max(quantum, 1)}, labels_{std::move(labels)} {}
+
+std::vector<int> FairShare::Admit(const std::vector<int>&   tenants,
+                                  const std::vector<float>& weights,
+                                  const std::vector<int>&   costs,
+                                  int                       slots)
+{
+    const int n = tenants.size();
+
+    std::vector<int> admitted;
+    if (n <= slots) {
+        // no contention, the deficits only carry over between the rounds of waiting tenants
+        deficit_.clear();
+        admitted.resize(n);
+        std::iota(admitted.begin(), admitted.end(), 0);
+        return admitted;
+    }
+
+    // the requests of each tenant in order, the tenants in the order of their first requests
+    std::vector<int>                         order;
+    std::unordered_map<int, std::deque<int>> queues;
+    for (int i = 0; i < n; ++i) {
+        auto& q = queues[tenants[i]];
+        if (q.empty()) {
+            order.push_back(tenants[i]);
+        }
+        q.push_back(i);
+    }
+
+    std::vector<char> taken(n);
+
+    for (int left = n; slots > 0 && left > 0;) {
+        for (const auto& t : order) {
+            auto& q = queues[t];
+            if (q.empty()) {
+                continue;
+            }
+            auto& d = deficit_[t];
+            d += (double)quantum_ * std::max(weights[q.front()], kMinWeight);
+            while (!q.empty() && slots > 0 && costs[q.front()] <= d) {
+                d -= costs[q.front()];
+                taken[q.front()] = 1;
+                q.pop_front();
+                --slots;
+                --left;
+            }
+            if (slots == 0) {
+                break;
+            }
+        }
+    }
+
+    // only the tenants left waiting keep their deficits
+    std::map<int, double> deficit;
+    for (const auto& t : order) {
+        if (!queues[t].empty()) {
+            deficit.emplace(t, deficit_[t]);
+        }
+    }
+    deficit_.swap(deficit);
+
+    for (int i = 0; i < n; ++i) {
+        if (taken[i]) {
+            admitted.push_back(i);
+        }
+    }
+    return admitted;
+}
+
+std::vector<int> FairShare::Rank(const std::vector<int>& tenants, const std::vector<float>& weights)
+{
+    std::map<int, Tenant> busy;
+    std::vector<int>      fresh;
+
+    double floor = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < tenants.size(); ++i) {
+        const int t  = tenants[i];
+        auto      it = busy.find(t);
+        if (it == busy.end()) {
+            if (auto jt = busy_.find(t); jt != busy_.end()) {
+                it    = busy.emplace(t, jt->second).first;
+                floor = std::min(floor, jt->second.vtime);
+            }
+            else {
+                it = busy.emplace(t, Tenant{}).first;
+                fresh.push_back(t);
+            }
+        }
+        // the latest request sets the weight
+        it->second.weight = std::max(weights[i], kMinWeight);
+    }
+
+    for (const auto& t : fresh) {
+        busy[t].vtime = std::isinf(floor) ? 0. : floor;
+    }
+
+    busy_.swap(busy);
+
+    std::vector<std::pair<double, int>> vtimes;
+    for (const auto& [t, x] : busy_) {
+        vtimes.emplace_back(x.vtime, t);
+    }
+    std::sort(vtimes.begin(), vtimes.end());
+
+    std::unordered_map<int, int> rank;
+    for (size_t i = 0; i < vtimes.size(); ++i) {
+        rank.emplace(vtimes[i].second, std::min<int>(i, kMaxRank));
+    }
+
+    std::vector<int> ranks;
+    for (const auto& t : tenants) {
+        ranks.push_back(rank.at(t));
+    }
+    return ranks;
+}
+
+void FairShare::Charge(int tenant, int tokens, bool prefill)
+{
+    auto& t = Get(tenant);
+
+    t.vtime += tokens / (double)t.weight;
+
+    if (t.prefill_tokens) {
+        (prefill ? t.prefill_tokens : t.decode_tokens)->add(tokens);
+    }
+}
+
+FairShare::Tenant& FairShare::Get(int tenant)
+{
+    auto& t = busy_[tenant];
+    if (!labels_.empty() && !t.prefill_tokens) {
+        auto&      r      = MetricsRegistry::instance();
+        const auto labels = labels_ + ",tenant=\"" + std::to_string(tenant) + "\"";
+        t.prefill_tokens  = r.counter("tm_tenant_prefill_tokens_total", "Prefill tokens of the tenant", labels);
+        t.decode_tokens   = r.counter("tm_tenant_decode_tokens_total", "Decode tokens of the tenant", labels);
+    }
+    return t;
+}
+
+}  // namespace turbomind
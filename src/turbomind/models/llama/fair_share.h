@@ -0,0 +1,58 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "src/turbomind/utils/metrics.h"
+
+namespace turbomind {
+
+// Weighted fair sharing of the batch between the tenants of the requests (`GenerationConfig::tenant_id`). New
+// requests take the free batch slots by deficit round robin on their prompt tokens, and the prefilling sequences are
+// scheduled in the order of the virtual time of their tenants, the tokens served divided by the weight. A tenant back
+// from idle starts at the least virtual time of the busy ones, so idle tenants bank no credit. Updated identically by
+// the ranks of a batch, the orders agree
+class FairShare {
+public:
+    // `quantum` tokens (scaled by the weight) per tenant and round of the admission, the token counters of the tenants
+    // are exported with `labels` when not empty
+    FairShare(int quantum, std::string labels);
+
+    // Indices of the requests taking `slots`, in their order. Each round of the deficit round robin credits a tenant
+    // with its quantum, which admits its requests in order while their `costs` fit
+    std::vector<int>
+    Admit(const std::vector<int>& tenants, const std::vector<float>& weights, const std::vector<int>& costs, int slots);
+
+    // Ranks of the tenants of the sequences in the batch by virtual time, lower first and saturated at `kMaxRank`.
+    // The tenants absent from the batch go idle
+    std::vector<int> Rank(const std::vector<int>& tenants, const std::vector<float>& weights);
+
+    // Tokens of the tenant in the step
+    void Charge(int tenant, int tokens, bool prefill);
+
+    static constexpr int kMaxRank = 127;
+
+private:
+    struct Tenant {
+        float  weight = 1.f;
+        double vtime{};  // tokens served / weight
+
+        Counter* prefill_tokens{};
+        Counter* decode_tokens{};
+    };
+
+    Tenant& Get(int tenant);
+
+private:
+    const int         quantum_;
+    const std::string labels_;
+
+    std::map<int, Tenant> busy_;     // tenants of the last batch
+    std::map<int, double> deficit_;  // of the tenants with requests left in the queue
+};
+
+}  // namespace turbomind
@@ -0,0 +1,129 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/kv_cache_pool.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace turbomind {
+
+std::shared_ptr<KvCachePool> KvCachePool::Get(const std::string& key, int device, size_t capacity)
+{
+    static std::mutex                                                 mutex;
+    static std::unordered_map<std::string, std::weak_ptr<KvCachePool>> pools;
+
+    const auto      name = key + ":" + std::to_string(device);
+    std::lock_guard lock{mutex};
+    if (auto pool = pools[name].lock()) {
+        if (pool->capacity() != capacity) {
+            TM_LOG_WARNING("[KvCachePool] %s exists with %.2f GB, the requested %.2f GB is ignored",
+                           name.c_str(),
+                           pool->capacity() / (float)(1 << 30),
+                           capacity / (float)(1 << 30));
+        }
+        return pool;
+    }
+    auto pool   = std::make_shared<KvCachePool>(capacity);
+    pools[name] = pool;
+    TM_LOG_INFO("[KvCachePool] %s created with %.2f GB", name.c_str(), capacity / (float)(1 << 30));
+    return pool;
+}
+
+int KvCachePool::Join(size_t min_bytes, size_t max_bytes)
+{
+    std::lock_guard lock{mutex_};
+
+    max_bytes = max_bytes ? std::min(max_bytes, capacity_) : capacity_;
+
+    const size_t reserved = std::accumulate(
+        tenants_.begin(), tenants_.end(), min_bytes, [](size_t s, const Tenant& t) { return s + t.alive * t.min; });
+    FT_CHECK_WITH_INFO(reserved <= capacity_, "the guarantees of the tenants exceed the capacity of the kv cache pool");
+    FT_CHECK_WITH_INFO(min_bytes <= max_bytes, "min quota of the kv cache pool exceeds the max");
+
+    tenants_.push_back({min_bytes, max_bytes, 0, 0, true});
+    return (int)tenants_.size() - 1;
+}
+
+void KvCachePool::Leave(int tenant)
+{
+    std::lock_guard lock{mutex_};
+
+    auto& t = tenants_.at(tenant);
+    FT_CHECK(t.used == 0);
+    t = {};
+}
+
+bool KvCachePool::Lease(int tenant, size_t bytes)
+{
+    std::lock_guard lock{mutex_};
+
+    auto& t = tenants_.at(tenant);
+    if (t.used + bytes > t.max) {
+        return false;
+    }
+
+    // the unused guarantees of the others are kept
+    size_t reserved = 0;
+    for (size_t i = 0; i < tenants_.size(); ++i) {
+        if (i != tenant && tenants_[i].alive) {
+            reserved += tenants_[i].min - std::min(tenants_[i].min, tenants_[i].used);
+        }
+    }
+
+    if (used_ + reserved + bytes <= capacity_) {
+        t.used += bytes;
+        used_ += bytes;
+        return true;
+    }
+
+    // ask the tenants with the most memory above their guarantee
+    size_t need = used_ + reserved + bytes - capacity_;
+
+    std::vector<int> idxs;
+    for (size_t i = 0; i < tenants_.size(); ++i) {
+        if (i != tenant && tenants_[i].alive && tenants_[i].used > tenants_[i].min) {
+            idxs.push_back(i);
+        }
+    }
+    std::sort(idxs.begin(), idxs.end(), [&](int a, int b) {
+        return tenants_[a].used - tenants_[a].min > tenants_[b].used - tenants_[b].min;
+    });
+    for (const auto& i : idxs) {
+        if (!need) {
+            break;
+        }
+        auto&        o    = tenants_[i];
+        const size_t give = std::min(need, o.used - o.min);
+        o.demand          = std::max(o.demand, give);
+        need -= give;
+    }
+
+    return false;
+}
+
+void KvCachePool::Return(int tenant, size_t bytes)
+{
+    std::lock_guard lock{mutex_};
+
+    auto& t = tenants_.at(tenant);
+    FT_CHECK(t.used >= bytes);
+    t.used -= bytes;
+    used_ -= bytes;
+    t.demand -= std::min(t.demand, bytes);
+}
+
+size_t KvCachePool::demand(int tenant)
+{
+    std::lock_guard lock{mutex_};
+    return tenants_.at(tenant).demand;
+}
+
+size_t KvCachePool::max_bytes(int tenant)
+{
+    std::lock_guard lock{mutex_};
+    return tenants_.at(tenant).max;
+}
+
+}  // namespace turbomind
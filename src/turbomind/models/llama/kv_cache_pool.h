@@ -0,0 +1,66 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace turbomind {
+
+// Device memory budget for the kv caches of several models colocated on a device. Each model is a tenant that leases
+// its blocks in chunks within its [min, max] quota. A lease that doesn't fit the budget asks the tenants above their
+// guarantee to give back their cached blocks, the memory is returned the next time they schedule a batch
+class KvCachePool {
+public:
+    // The pool of `key` on `device`, created with `capacity` bytes by the first tenant
+    static std::shared_ptr<KvCachePool> Get(const std::string& key, int device, size_t capacity);
+
+    explicit KvCachePool(size_t capacity): capacity_{capacity} {}
+
+    // returns the tenant id, `max_bytes` of 0 leaves the tenant unbounded
+    int Join(size_t min_bytes, size_t max_bytes);
+
+    // the leases of the tenant must be returned
+    void Leave(int tenant);
+
+    bool Lease(int tenant, size_t bytes);
+
+    void Return(int tenant, size_t bytes);
+
+    // bytes the tenant is asked to give back
+    size_t demand(int tenant);
+
+    size_t max_bytes(int tenant);
+
+    size_t capacity() const noexcept
+    {
+        return capacity_;
+    }
+
+private:
+    struct Tenant {
+        size_t min;
+        size_t max;
+        size_t used;
+        size_t demand;
+        bool   alive;
+    };
+
+    std::mutex          mutex_;
+    const size_t        capacity_;
+    size_t              used_{};
+    std::vector<Tenant> tenants_;
+};
+
+// Tenancy of a block manager in a pool, the TP ranks of a model agree on the counts of leased blocks with `agree`
+struct KvCacheLease {
+    std::shared_ptr<KvCachePool> pool;
+    int                          tenant{-1};
+    std::function<int(int)>      agree;  // min over the ranks
+};
+
+}  // namespace turbomind
@@ -0,0 +1,92 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/kv_streamer.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind {
+
+KvStreamer::KvStreamer(std::vector<size_t> layer_offsets, size_t block_size, cudaStream_t stream):
+    layer_offsets_{std::move(layer_offsets)},
+    layer_num_{(int)layer_offsets_.size() - 1},
+    block_size_{block_size},
+    stream_{stream}
+{
+    FT_CHECK(layer_num_ >= 0 && layer_offsets_.back() <= block_size_);
+    check_cuda_error(cudaEventCreateWithFlags(&ev_compute_, cudaEventDisableTiming));
+    check_cuda_error(cudaEventCreateWithFlags(&ev_done_, cudaEventDisableTiming));
+}
+
+KvStreamer::~KvStreamer()
+{
+    cudaStreamSynchronize(stream_);
+    cudaEventDestroy(ev_done_);
+    cudaEventDestroy(ev_compute_);
+}
+
+void KvStreamer::Add(comm::KvTransport* transport, int peer, std::vector<void*> blocks)
+{
+    FT_CHECK(transport && next_ == 0);
+    seqs_.push_back({transport, peer, std::move(blocks)});
+}
+
+void KvStreamer::Fence(cudaStream_t stream)
+{
+    if (in_flight_) {
+        check_cuda_error(cudaStreamWaitEvent(stream, ev_done_));
+        in_flight_ = false;
+    }
+}
+
+void KvStreamer::Send(int layer)
+{
+    const size_t offset = layer_offsets_[layer];
+    const size_t size   = (layer < layer_num_ ? layer_offsets_[layer + 1] : block_size_) - offset;
+    if (!size) {
+        return;
+    }
+    for (const auto& s : seqs_) {
+        s.transport->GroupStart();
+        for (const auto& p : s.blocks) {
+            s.transport->Send((char*)p + offset, size, s.peer, stream_);
+        }
+        s.transport->GroupEnd();
+    }
+}
+
+void KvStreamer::Push(int layer, cudaStream_t stream)
+{
+    if (seqs_.empty() || layer < next_ || layer >= layer_num_) {
+        return;
+    }
+
+    check_cuda_error(cudaEventRecord(ev_compute_, stream));
+    check_cuda_error(cudaStreamWaitEvent(stream_, ev_compute_));
+
+    // the layers skipped by the forward are sent as they are, the peer expects all of them
+    for (; next_ <= layer; ++next_) {
+        Send(next_);
+    }
+}
+
+void KvStreamer::Finish(cudaStream_t stream)
+{
+    if (seqs_.empty()) {
+        return;
+    }
+
+    check_cuda_error(cudaEventRecord(ev_compute_, stream));
+    check_cuda_error(cudaStreamWaitEvent(stream_, ev_compute_));
+
+    // the rest of the blocks after the layers
+    for (; next_ <= layer_num_; ++next_) {
+        Send(next_);
+    }
+
+    check_cuda_error(cudaEventRecord(ev_done_, stream_));
+
+    seqs_.clear();
+    next_      = 0;
+    in_flight_ = true;
+}
+
+}  // namespace turbomind
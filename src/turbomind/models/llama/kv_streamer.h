@@ -0,0 +1,70 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <vector>
+
+#include "src/turbomind/comm/kv_transport.h"
+
+namespace turbomind {
+
+// Sends the cache blocks written by a prefill to a remote engine layer by layer, the layer is sent as soon as its
+// attention is done while the following layers are computed. All the layers of the blocks are sent first, followed by
+// the rest of each block (e.g. the summaries), the importing peer receives them in the same order with
+// `KvTransfer::layer_major`
+class KvStreamer {
+public:
+    // the offsets of the layers in a block as in `BlockCopier`
+    KvStreamer(std::vector<size_t> layer_offsets, size_t block_size, cudaStream_t stream);
+
+    ~KvStreamer();
+
+    KvStreamer(const KvStreamer&) = delete;
+    KvStreamer& operator=(const KvStreamer&) = delete;
+
+    // Queues the blocks of a sequence for the next forward
+    void Add(comm::KvTransport* transport, int peer, std::vector<void*> blocks);
+
+    bool empty() const noexcept
+    {
+        return seqs_.empty();
+    }
+
+    // Orders the following work on `stream` after the sends of the previous forwards, so that the blocks are not
+    // reused before they are read. The peer must have posted the import
+    void Fence(cudaStream_t stream);
+
+    // Sends `layer` of the queued blocks after the work enqueued on `stream` so far, the layers of a forward are
+    // pushed in order
+    void Push(int layer, cudaStream_t stream);
+
+    // Sends the layers not pushed by the forward and the rest of the blocks, then clears the queue
+    void Finish(cudaStream_t stream);
+
+private:
+    void Send(int layer);
+
+    struct Seq {
+        comm::KvTransport* transport;
+        int                peer;
+        std::vector<void*> blocks;
+    };
+
+    std::vector<size_t> layer_offsets_;
+
+    int    layer_num_;
+    size_t block_size_;
+
+    std::vector<Seq> seqs_;
+
+    int next_{};  // next layer to send
+
+    cudaStream_t stream_{};  // send stream
+    cudaEvent_t  ev_compute_{};
+    cudaEvent_t  ev_done_{};
+
+    bool in_flight_{};  // sends the compute stream has not been fenced with
+};
+
+}  // namespace turbomind
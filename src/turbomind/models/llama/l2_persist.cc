@@ -0,0 +1,91 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+
+#include "src/turbomind/models/llama/l2_persist.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+L2Persist::L2Persist(size_t bytes, cudaStream_t stream): stream_{stream}
+{
+    int device{};
+    check_cuda_error(cudaGetDevice(&device));
+
+    int max_persisting{};
+    int max_window{};
+    check_cuda_error(cudaDeviceGetAttribute(&max_persisting, cudaDevAttrMaxPersistingL2CacheSize, device));
+    check_cuda_error(cudaDeviceGetAttribute(&max_window, cudaDevAttrMaxAccessPolicyWindowSize, device));
+
+    if (!max_persisting || !max_window) {
+        TM_LOG_WARNING("[L2Persist] persisting L2 accesses are not supported by the device");
+        return;
+    }
+
+    carve_out_  = std::min<size_t>(bytes, max_persisting);
+    max_window_ = max_window;
+
+    check_cuda_error(cudaDeviceSetLimit(cudaLimitPersistingL2CacheSize, carve_out_));
+
+    TM_LOG_INFO("[L2Persist] %.1f MB of L2 for persisting accesses, window up to %.1f MB",
+                carve_out_ / (1024. * 1024.),
+                max_window_ / (1024. * 1024.));
+}
+
+L2Persist::~L2Persist()
+{
+    if (carve_out_) {
+        Apply(nullptr, 0);
+        // demote the lines still persisting to normal
+        check_cuda_error(cudaCtxResetPersistingL2Cache());
+        check_cuda_error(cudaDeviceSetLimit(cudaLimitPersistingL2CacheSize, 0));
+    }
+}
+
+void L2Persist::SetWindow(void* base, size_t size)
+{
+    base_ = base;
+    size_ = base ? std::min(size, max_window_) : 0;
+    if (enabled_) {
+        Apply(base_, size_);
+    }
+}
+
+void L2Persist::Enable(bool enable)
+{
+    enabled_ = enable;
+    Apply(enable ? base_ : nullptr, enable ? size_ : 0);
+}
+
+void L2Persist::Apply(void* base, size_t size)
+{
+    if (!carve_out_) {
+        return;
+    }
+    const bool apply = base && size;
+    if (apply == applied_ && (!apply || (stream_base_ == base && stream_size_ == size))) {
+        return;
+    }
+
+    cudaStreamAttrValue attr{};
+    if (apply) {
+        attr.accessPolicyWindow.base_ptr  = base;
+        attr.accessPolicyWindow.num_bytes = size;
+        attr.accessPolicyWindow.hitRatio  = std::min(1.f, (float)carve_out_ / size);
+        attr.accessPolicyWindow.hitProp   = cudaAccessPropertyPersisting;
+        attr.accessPolicyWindow.missProp  = cudaAccessPropertyStreaming;
+    }
+    check_cuda_error(cudaStreamSetAttribute(stream_, cudaStreamAttributeAccessPolicyWindow, &attr));
+
+    if (!apply) {
+        // the lines of the lifted window would keep the carve-out otherwise
+        check_cuda_error(cudaCtxResetPersistingL2Cache());
+    }
+
+    applied_     = apply;
+    stream_base_ = base;
+    stream_size_ = size;
+}
+
+}  // namespace turbomind
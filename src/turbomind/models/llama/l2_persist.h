@@ -0,0 +1,60 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// Persisting L2 accesses for one window of device memory read by every kernel of a stream, e.g. the cache blocks of
+// a prefix shared by the decoding sequences. A part of the L2 is set aside for the persisting lines, a window larger
+// than that part persists a matching fraction of its lines so that they don't thrash each other.
+//
+// The window is an attribute of the stream, the kernels captured into graphs keep the window set at the capture
+class L2Persist {
+public:
+    // `bytes` of the L2 set aside, clamped to the limit of the device
+    L2Persist(size_t bytes, cudaStream_t stream);
+
+    ~L2Persist();
+
+    L2Persist(const L2Persist&) = delete;
+    L2Persist& operator=(const L2Persist&) = delete;
+
+    // [base, base + size), clamped to `max_window()`. A null `base` clears the window
+    void SetWindow(void* base, size_t size);
+
+    // Applies the window to the following kernels of the stream or lifts it, no-op when the state doesn't change
+    void Enable(bool enable);
+
+    size_t max_window() const noexcept
+    {
+        return max_window_;
+    }
+
+    // bytes of the window in effect, 0 when lifted
+    size_t window() const noexcept
+    {
+        return applied_ ? stream_size_ : 0;
+    }
+
+private:
+    void Apply(void* base, size_t size);
+
+    cudaStream_t stream_;
+    size_t       carve_out_{};
+    size_t       max_window_{};
+
+    void*  base_{};
+    size_t size_{};
+    bool   enabled_{};
+
+    // attribute of the stream
+    bool   applied_{};
+    void*  stream_base_{};
+    size_t stream_size_{};
+};
+
+}  // namespace turbomind
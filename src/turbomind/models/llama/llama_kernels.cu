@@ -490,6 +490,89 @@ template void invokeGetFeatureOfLastToken(float*, const float*, const int*, int,
 template void invokeGetFeatureOfLastToken(__nv_bfloat16*, const __nv_bfloat16*, const int*, int, int, cudaStream_t);
 #endif  // ENABLE_BF16
 
+template<typename T>
+__global__ void residualSiLU(T* x, const T* h, const T* bias, int dims)
+{
+    const int bi = blockIdx.x;
+    for (int i = threadIdx.x; i < dims; i += blockDim.x) {
+        float v = (float)x[dims * bi + i];
+        if (bias) {
+            v += (float)bias[i];
+        }
+        x[dims * bi + i] = (T)((float)h[dims * bi + i] + v / (1.f + __expf(-v)));
+    }
+}
+
+template<typename T>
+void invokeResidualSiLU(T* x, const T* h, const T* bias, int dims, int batch_size, cudaStream_t stream)
+{
+    residualSiLU<<<batch_size, 256, 0, stream>>>(x, h, bias, dims);
+}
+
+template void invokeResidualSiLU(half*, const half*, const half*, int, int, cudaStream_t);
+template void invokeResidualSiLU(float*, const float*, const float*, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeResidualSiLU(__nv_bfloat16*, const __nv_bfloat16*, const __nv_bfloat16*, int, int, cudaStream_t);
+#endif  // ENABLE_BF16
+
+template<typename T>
+__global__ void scaleRows(T* dst, const T* src, const float* scales, int dims)
+{
+    const int   bi    = blockIdx.x;
+    const float scale = scales[bi];
+    for (int i = threadIdx.x; i < dims; i += blockDim.x) {
+        dst[dims * bi + i] = (T)((float)src[dims * bi + i] * scale);
+    }
+}
+
+template<typename T>
+void invokeScaleRows(T* dst, const T* src, const float* scales, int dims, int batch_size, cudaStream_t stream)
+{
+    scaleRows<<<batch_size, 256, 0, stream>>>(dst, src, scales, dims);
+}
+
+template void invokeScaleRows(half*, const half*, const float*, int, int, cudaStream_t);
+template void invokeScaleRows(float*, const float*, const float*, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeScaleRows(__nv_bfloat16*, const __nv_bfloat16*, const float*, int, int, cudaStream_t);
+#endif  // ENABLE_BF16
+
+template<typename T>
+__global__ void sumRows(float* dst, const T* src, const int* ranges, int dims)
+{
+    const int di = threadIdx.x + blockIdx.x * blockDim.x;
+    if (di >= dims) {
+        return;
+    }
+    const int begin = ranges[blockIdx.y * 3];
+    const int count = ranges[blockIdx.y * 3 + 1];
+    const int idx   = ranges[blockIdx.y * 3 + 2];
+
+    float sum = 0.f;
+    for (int r = blockIdx.z; r < count; r += gridDim.z) {
+        sum += (float)src[(size_t)(begin + r) * dims + di];
+    }
+    if (blockIdx.z < count) {
+        atomicAdd(&dst[(size_t)idx * dims + di], sum);
+    }
+}
+
+template<typename T>
+void invokeSumRows(
+    float* dst, const T* src, const int* ranges, int max_count, int dims, int range_num, cudaStream_t stream)
+{
+    constexpr int threads = 256;
+    // enough blocks for a single long prompt, each sums every `z`-th row
+    const dim3 grid((dims + threads - 1) / threads, range_num, std::min(max_count, 64));
+    sumRows<<<grid, threads, 0, stream>>>(dst, src, ranges, dims);
+}
+
+template void invokeSumRows(float*, const half*, const int*, int, int, int, cudaStream_t);
+template void invokeSumRows(float*, const float*, const int*, int, int, int, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeSumRows(float*, const __nv_bfloat16*, const int*, int, int, int, cudaStream_t);
+#endif  // ENABLE_BF16
+
 template<class T, int C>
 struct BatchedCopyParam {
     Array<T*, C>  src_ptr;
@@ -560,4 +643,31 @@ void invokeBatchedCopy(void** src_ptr, void** dst_ptr, int* size, int count, cud
         });
 }
 
+template<class T>
+__device__ void copyBlock(const T* __restrict__ src, T* __restrict__ dst, int size)
+{
+    for (int i = threadIdx.x; i < size; i += blockDim.x) {
+        dst[i] = src[i];
+    }
+}
+
+// one block per descriptor, vectorized when the copy is 16-byte aligned
+__global__ void copyTable(const CopyDesc* table)
+{
+    const CopyDesc d = table[blockIdx.x];
+    if (((uintptr_t)d.src | (uintptr_t)d.dst | d.size) % sizeof(uint4) == 0) {
+        copyBlock((const uint4*)d.src, (uint4*)d.dst, d.size / sizeof(uint4));
+    }
+    else {
+        copyBlock((const uint32_t*)d.src, (uint32_t*)d.dst, d.size / sizeof(uint32_t));
+    }
+}
+
+void invokeCopyTable(const CopyDesc* table, int count, cudaStream_t st)
+{
+    if (count) {
+        copyTable<<<count, 256, 0, st>>>(table);
+    }
+}
+
 }  // namespace turbomind
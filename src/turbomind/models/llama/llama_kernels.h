@@ -107,6 +107,15 @@ void invokeIndexedCopy(void**       h_src_ptr,
 
 void invokeBatchedCopy(void** src_ptr, void** dst_ptr, int* size, int count, cudaStream_t st);
 
+struct CopyDesc {
+    const void* src;
+    void*       dst;
+    int         size;  // in bytes, multiple of 4
+};
+
+// Performs the copies of a descriptor table in device memory in a single launch regardless of the count
+void invokeCopyTable(const CopyDesc* table, int count, cudaStream_t st);
+
 // ABCDe            ABCDe     e
 // ABCDEFGHIJk      ABCDEFGHIJk
 // ABCDEFGHi    ->  ABCDEFGHi i
@@ -119,6 +128,20 @@ template<typename T>
 void invokeGetFeatureOfLastToken(
     T* output, const T* input, const int* cu_seqlens, int dims, int batch_size, cudaStream_t stream);
 
+// x = h + SiLU(x + bias), [batch_size, dims], the residual block of the draft heads. `bias` is optional
+template<typename T>
+void invokeResidualSiLU(T* x, const T* h, const T* bias, int dims, int batch_size, cudaStream_t stream);
+
+// dst = src * scales[i] for the rows of [batch_size, dims]
+template<typename T>
+void invokeScaleRows(T* dst, const T* src, const float* scales, int dims, int batch_size, cudaStream_t stream);
+
+// `dst[idx] += sum(src[begin:begin + count])` in fp32 for each `[begin, count, idx]` of `ranges`, the rows of
+// `max_count` at most are split among the blocks
+template<typename T>
+void invokeSumRows(
+    float* dst, const T* src, const int* ranges, int max_count, int dims, int range_num, cudaStream_t stream);
+
 void invokeMyCopyInt(int* dst, const int* src, size_t count, cudaStream_t st);
 
 template<typename T>
@@ -2,10 +2,12 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <map>
 #include <regex>
 #include <string>
+#include <vector>
 
 #include "src/turbomind/models/llama/llama_rope.h"
 #include "src/turbomind/models/llama/weight_type.h"
@@ -35,8 +37,14 @@ struct ModelParam {
     MLAParam   mla;
     bool       qk_norm;
     int        tune_layer_num;
+    int        medusa_num_heads;  // draft heads of speculative decoding on top of the final hidden state
 
     std::vector<int> inter_size;
+
+    // kv cache quant policy & kv heads of each layer for mixed precision kv cache & pruned models, empty when the
+    // same for all. `quant_policy` is the union of the layer policies & `kv_head_num` the most kv heads of a layer then
+    std::vector<int> layer_quant_policy;
+    std::vector<int> layer_kv_head_num;
 };
 
 struct MoeParam {
@@ -67,6 +75,24 @@ struct AttentionParam {
     int  max_position_embeddings;
     // rotary embedding
     RopeParam rope;
+    // timesteps covered by the precomputed (cos, sin) table of the rotary embedding, 0 disables
+    int rope_table_len;
+    // cache the keys without the rotary embedding, the decoding kernels rotate them when read
+    bool pre_rope_kv_cache;
+    // the prefill attention reads the history from the cache blocks, the kv is not flattened to a linear buffer
+    bool streaming_prefill;
+    // cache the compressed KV of MLA instead of the per-head K/V
+    bool mla_latent_cache;
+    // top-k blocks attended by block-sparse decoding besides the sink & recent blocks, 0 disables
+    int sparse_decode_blocks;
+    // no kv splits for decoding, the attention of a sequence doesn't depend on the batch
+    bool batch_invariant;
+    // share of the SMs reserved for the decoding attention when running next to prefills, 0 disables
+    float decode_sm_ratio;
+    // quant policy of the cold blocks of a tiered kv cache, 0 when disabled
+    int cold_quant_policy;
+    // Q K^T of the prefills reading an e4m3 cache on the fp8 tensor cores
+    bool fp8_attention;
 };
 
 struct EngineParam {
@@ -78,13 +104,80 @@ struct EngineParam {
     // cache params
     float cache_max_block_count;
     int   cache_chunk_size;
+    float cache_swap_space;        // GB of pinned host memory for evicted blocks
+    float cache_swap_bandwidth;    // GB/s between host & device, 0 always swaps the blocks of preempted sequences
+    float cache_recompute_tflops;  // effective TFLOPS in prefill for the swap/recompute choice
     bool  enable_prefix_caching;
+    int   cache_pin_tokens;  // budget of the prompt blocks pinned by the requests, see `GenerationConfig::pin_prefix`
+
+    std::string prefix_cache_path;        // directory of the persistent prefix cache
+    float       prefix_cache_disk_space;  // GB per rank
+
+    float embedding_cache_size;  // GB of device memory for the input embeddings passed by content hash
+
+    int l2_persist_mb;  // L2 set aside for the blocks shared by the decoding sequences, 0 disables
+
+    int kv_quant_error_interval;  // steps between the measurements of the kv cache quantization error, 0 disables
+
+    int cache_window_size;  // recent tokens kept in the kv cache of a sequence, 0 keeps all
+    int cache_sink_size;    // leading tokens kept with the window
+    // tokens kept in the kv cache of a sequence by the attention scores of its blocks (heavy hitters), the sinks &
+    // the recent blocks are always kept, 0 disables
+    int cache_score_budget;
+
+    int         cache_recent_blocks;  // tiered kv cache, blocks at the end of a sequence kept in f16, 0 disables
+    std::string cache_cold_quant;     // precision of the older blocks, "int8" or "int4"
+    float       cache_cold_ratio;     // share of the kv cache memory taken by the cold blocks
+
+    std::string cache_eviction_policy;  // order of evicting cached blocks, "lru", "lfu" or "2q"
+
+    std::string cache_pool_key;   // engines of the same key on a device lease their blocks from one pool, "" disables
+    float       cache_pool_size;  // GB of the pool, 0 takes `cache_max_block_count` of the free memory
+    float       cache_pool_min;   // GB guaranteed to the engine
+    float       cache_pool_max;   // GB leased by the engine at most, 0 for the whole pool
+
+    bool cache_virtual_memory;  // map the chunks of the kv cache into reserved addresses on demand
 
     // chunking params
-    int max_prefill_token_num;
-    int max_context_token_num;
-    int num_tokens_per_iter;
-    int max_prefill_iters;
+    int  max_prefill_token_num;
+    int  max_context_token_num;
+    int  num_tokens_per_iter;
+    int  max_prefill_iters;
+    bool split_fuse;  // `num_tokens_per_iter` tokens per step, decodes & prefill chunks, ignores `max_prefill_iters`
+
+    int   reserved_slots;  // batch slots only open to interactive (priority 0) requests
+    float target_itl_ms;   // adapt the prefill tokens & running sequences to this inter-token latency, 0 disables
+
+    bool admission_control;  // hold new requests in the queue when their projected kv blocks don't fit
+
+    bool overlap_scheduling;  // receive requests for the next step while the current one runs
+    bool async_output;        // push the tokens of streaming requests from a separate thread once they reach host
+    int  finish_sync_interval;  // max decoding steps the host runs ahead of the finish flags, <= 1 syncs every step
+    bool enable_cuda_graph;   // replay decode-only steps with CUDA graphs
+    bool numa_affinity;       // bind the engine threads & pinned buffers of a rank to the NUMA node of its device
+
+    bool enable_cascade_attention;  // attend the prefix shared by a group of decoding sequences once for the group
+
+    int comm_overlap_tokens;  // overlap the FFN & its allreduce in chunks of this many tokens for prefills, 0 disables
+
+    std::string comm_quant;  // quantized transfers of the TP allreduces, "none", "int8" or "fp8"
+
+    int num_speculative_tokens;  // max draft tokens verified per step, 0 disables speculative decoding
+    int speculative_ngram_size;  // max n-gram size for prompt lookup drafting
+
+    bool fp8_linear;     // quantize dense weights to fp8 (e4m3) at load time and run them as W8A8
+    bool int8_linear;    // quantize dense weights to int8 at load time and run them as W8A8
+    bool w8a16_linear;   // quantize f16 weights to u8 with groups of 128 at load time and run them weight-only
+    bool sparse_linear;  // compress dense weights pruned 2:4 at load time and run them on the sparse tensor cores
+
+    bool enable_pdl;  // programmatic dependent launch of the gemm, attention & norm kernels (sm90)
+    int  decode_megakernel_batch;  // whole layers in a persistent kernel for decoding batches up to this, 0 disables
+
+    std::string lm_head_quant;    // LM head on the gemm library, "none" (cuBLAS), "dense", "int8" or "int4"
+    std::string embedding_quant;  // "none" or "int8" embedding table with per-row scales
+
+    int max_loras;      // device slots of the multi-LoRA adapters, 0 disables
+    int max_lora_rank;  // max rank of the adapters
 
     // parallel params
     int outer_dp_size;
@@ -93,8 +186,48 @@ struct EngineParam {
     int attn_dp_rank;
     int attn_tp_size;
     int attn_tp_rank;
+    int attn_cp_size;  // context parallel ranks of an attention TP rank, each holds 1/n of the kv cache
+    int attn_cp_rank;
     int mlp_tp_size;
     int mlp_tp_rank;
+    int pp_size;  // pipeline stages, each holds a contiguous range of the decoder layers
+    int pp_rank;
+    int ep_size;  // routed experts are distributed over the MLP ranks instead of being sliced when > 1
+    int ep_rank;
+
+    bool ep_overlap;  // overlap the dispatch all-to-all with the shared experts
+    int  moe_replica_interval;  // re-plan the replicas of hot experts every n steps of a MoE layer, 0 disables
+    bool moe_scatter_reduce;    // the output GEMM of the experts adds the weighted rows to the tokens atomically
+    bool moe_shared_overlap;    // the shared experts run on a side stream concurrently with the routed experts
+
+    bool prefix_aware_routing;  // route new sessions to the DP rank holding their prefix
+
+    int migrate_threshold;  // move sessions off DP ranks with this many more sequences than the lightest, 0 disables
+
+    int max_queue_depth;  // requests queued per DP rank before new sessions make room, 0 for unbounded
+    int queue_policy;     // `QueuePolicy` of a full queue: 0 reject, 1 shed the lowest priority, 2 drop past deadline
+
+    int edf_slack_ms;  // earliest deadline first, the requests without a deadline are due this long after queued
+
+    bool sjf_scheduling;  // shortest expected output first, by the hints of the requests or the finished ones
+
+    bool fair_share;  // weighted fair sharing of the batch slots and prefill tokens between the tenants
+
+    bool symmetric_kv_cache;  // kv cache chunks from `d_comm`, read directly by the peer ranks for migrations
+
+    int profile_interval;  // time the phases of one step in n with CUDA events, 0 disables
+
+    int trace_buffer;  // spans kept by the process-wide `Tracer`, 0 disables
+
+    bool candidate_sampling;  // gather the top-k of the vocab shards instead of the full logits for sampling
+
+    bool deterministic;  // batch invariant kernel choices & reductions, the outputs don't depend on the batch
+
+    bool offload_weights;  // keep the decoder layers in host memory and page them in one layer ahead
+    int  moe_expert_cache;  // device slots per MoE layer caching the routed experts kept in host memory, 0 disables
+
+    std::string detokenizer_path;     // `tokenizer.json` of the native detokenizer
+    int         detokenizer_threads;  // 0 disables
 };
 
 enum class LoraPolicy : int
@@ -113,4 +246,54 @@ struct LoraParam {
     std::map<std::string, std::pair<std::regex, float>> scale_pattern;
 };
 
+// Decoder layers [first, second) of the pipeline stage `pp_rank`
+inline std::pair<int, int> GetStageLayerRange(int layer_num, int pp_size, int pp_rank)
+{
+    return {layer_num * pp_rank / pp_size, layer_num * (pp_rank + 1) / pp_size};
+}
+
+inline int GetLayerQuantPolicy(const ModelParam& model, int layer)
+{
+    return model.layer_quant_policy.empty() ? model.quant_policy : model.layer_quant_policy.at(layer);
+}
+
+inline size_t GetLayerKvHeadNum(const ModelParam& model, int layer)
+{
+    return model.layer_kv_head_num.empty() ? model.kv_head_num : model.layer_kv_head_num.at(layer);
+}
+
+// The kv cache differs in heads or precision between the layers
+inline bool HasLayerKvConfig(const ModelParam& model)
+{
+    return !model.layer_quant_policy.empty() || !model.layer_kv_head_num.empty();
+}
+
+// Llama-style attention: MHA/GQA with a static RoPE and no bias, qk norm, MLA, logn scaling or LoRA. The attention
+// layer takes a path specialized for it at compile time
+inline bool IsLlamaAttention(const ModelParam&     model,
+                             const AttentionParam& attn,
+                             const LoraParam&      lora,
+                             const EngineParam&    engine)
+{
+    const auto rope = attn.rope.type;
+    return !model.attn_bias && !model.qk_norm && !model.mla.kv_lora_rank && !attn.use_logn_attn
+           && rope != RopeType::kNull && rope != RopeType::kDynamic && lora.policy == LoraPolicy::kNull
+           && !engine.max_loras;
+}
+
+// Llama-style decoder layers: Llama-style attention followed by a dense FFN in every layer, without MoE or weight
+// offloading. The decoder takes a path specialized for them at compile time
+inline bool IsLlamaDecoder(const ModelParam&     model,
+                           const AttentionParam& attn,
+                           const MoeParam&       moe,
+                           const LoraParam&      lora,
+                           const EngineParam&    engine)
+{
+    const auto& experts = moe.expert_num;
+    const auto& inter   = model.inter_size;
+    return IsLlamaAttention(model, attn, lora, engine) && !engine.offload_weights
+           && std::none_of(experts.begin(), experts.end(), [](int n) { return n > 0; })
+           && std::all_of(inter.begin(), inter.end(), [](int n) { return n > 0; });
+}
+
 }  // namespace turbomind
@@ -75,6 +75,14 @@ struct RopeKernelParam {
     float  scale_factor;
     float  inv_factor;
 
+    int* offset{};  // added to the timesteps, for kv cache with evicted tokens
+
+    // (cos, sin) of each pair of dims by timestep [table_len, dim], read instead of computed when present. For
+    // dynamic ntk, only the sequences with `table_base` use it
+    const float* table{};
+    int          table_len{};
+    float        table_base{};
+
     YarnRopeKernelParam   yarn;
     Llama3RopeKernelParam llama3;
 };
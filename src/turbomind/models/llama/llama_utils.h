@@ -3,6 +3,7 @@
 #pragma once
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/nvtx_utils.h"
+#include "src/turbomind/utils/tracer.h"
 #include <cuda_runtime.h>
 #include <sstream>
 #include <string>
@@ -19,6 +20,7 @@ enum QuantPolicy
     // quantize cache kv
     kCacheKVInt8 = 0x08,
     kCacheKVInt4 = 0x04,
+    kCacheKVFp8  = 0x10,  // e4m3
 };
 
 enum CmpMode
@@ -68,16 +70,28 @@ size_t curandStateGetSize();
 
 bool isDebug();
 
+// The range is also a host span of the `Tracer` when it is enabled
 struct NvtxScope {
     explicit NvtxScope(const std::string& name)
     {
         PUSH_RANGE(name.c_str());
+        if (Tracer::instance().enabled()) {
+            name_  = name;
+            begin_ = Tracer::now();
+        }
     }
 
     ~NvtxScope()
     {
         POP_RANGE;
+        if (begin_ >= 0) {
+            Tracer::instance().Add(name_.c_str(), begin_, Tracer::now());
+        }
     }
+
+private:
+    std::string name_;
+    int64_t     begin_{-1};
 };
 
 int64_t& gSequenceIds(int batch_idx);
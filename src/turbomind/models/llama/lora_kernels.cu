@@ -0,0 +1,167 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/kernels/core/common.h"
+#include "src/turbomind/kernels/core/math.h"
+#include "src/turbomind/models/llama/lora_kernels.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind {
+
+// tmp[t] = x[t] * A, A [k, cols] is shared by the tokens of the tile. Warps split the reduction over k, lane `i`
+// accumulates columns `i + c * WARP_SIZE`
+template<class T, int WARPS>
+__global__ void LoraShrink(float* tmp, const T* x, int ldx, int k, int64_t offset, int sections, LoraBatch batch)
+{
+    constexpr int C = kLoraMaxCols / WARP_SIZE;
+
+    __shared__ float smem[kLoraTileTokens][kLoraMaxCols];
+
+    const LoraTile tile = batch.tiles[blockIdx.x];
+
+    const int r    = batch.ranks[tile.slot];
+    const int cols = sections * r;
+    const int n    = tile.end - tile.begin;
+
+    const T* A = (const T*)(batch.slots + tile.slot * batch.slot_size) + offset * r;
+
+    for (int i = threadIdx.x; i < kLoraTileTokens * kLoraMaxCols; i += blockDim.x) {
+        (&smem[0][0])[i] = 0.f;
+    }
+    __syncthreads();
+
+    const int warp_id = threadIdx.x / WARP_SIZE;
+    const int lane_id = threadIdx.x % WARP_SIZE;
+
+    float acc[kLoraTileTokens][C]{};
+
+    for (int kk = warp_id; kk < k; kk += WARPS) {
+        float a[C];
+        PRAGMA_UNROLL
+        for (int c = 0; c < C; ++c) {
+            const int j = lane_id + c * WARP_SIZE;
+            a[c]        = j < cols ? (float)A[(int64_t)kk * cols + j] : 0.f;
+        }
+        PRAGMA_UNROLL
+        for (int t = 0; t < kLoraTileTokens; ++t) {
+            const float v = t < n ? (float)x[(int64_t)(tile.begin + t) * ldx + kk] : 0.f;
+            PRAGMA_UNROLL
+            for (int c = 0; c < C; ++c) {
+                acc[t][c] += v * a[c];
+            }
+        }
+    }
+
+    PRAGMA_UNROLL
+    for (int t = 0; t < kLoraTileTokens; ++t) {
+        PRAGMA_UNROLL
+        for (int c = 0; c < C; ++c) {
+            const int j = lane_id + c * WARP_SIZE;
+            if (t < n && j < cols) {
+                atomicAdd(&smem[t][j], acc[t][c]);
+            }
+        }
+    }
+    __syncthreads();
+
+    for (int i = threadIdx.x; i < n * cols; i += blockDim.x) {
+        const int t                                       = i / cols;
+        const int j                                       = i % cols;
+        tmp[(int64_t)(tile.begin + t) * kLoraMaxCols + j] = smem[t][j];
+    }
+}
+
+// y[t] += scale * tmp[t] * B, B [r, n_dims], columns in section `s` take `tmp[t][s * r, (s + 1) * r)`
+template<class T>
+__global__ void
+LoraExpand(T* y, int ldy, const float* tmp, int n_dims, int64_t offset, int bound0, int bound1, LoraBatch batch)
+{
+    __shared__ float smem[kLoraTileTokens][kLoraMaxCols];
+
+    const LoraTile tile = batch.tiles[blockIdx.x];
+
+    const int   r     = batch.ranks[tile.slot];
+    const float scale = batch.scales[tile.slot];
+    const int   n     = tile.end - tile.begin;
+    const int   cols  = (1 + (bound0 < n_dims) + (bound1 < n_dims)) * r;
+
+    const T* B = (const T*)(batch.slots + tile.slot * batch.slot_size) + offset * r;
+
+    for (int i = threadIdx.x; i < n * cols; i += blockDim.x) {
+        const int t = i / cols;
+        const int j = i % cols;
+        smem[t][j]  = tmp[(int64_t)(tile.begin + t) * kLoraMaxCols + j];
+    }
+    __syncthreads();
+
+    const int col = blockIdx.y * blockDim.x + threadIdx.x;
+    if (col >= n_dims) {
+        return;
+    }
+
+    const int s = (col >= bound0) + (col >= bound1);
+
+    float acc[kLoraTileTokens]{};
+    for (int j = 0; j < r; ++j) {
+        const float b = (float)B[(int64_t)j * n_dims + col];
+        PRAGMA_UNROLL
+        for (int t = 0; t < kLoraTileTokens; ++t) {
+            acc[t] += smem[t][s * r + j] * b;
+        }
+    }
+
+    PRAGMA_UNROLL
+    for (int t = 0; t < kLoraTileTokens; ++t) {
+        if (t < n) {
+            T& o = y[(int64_t)(tile.begin + t) * ldy + col];
+            o    = (T)((float)o + scale * acc[t]);
+        }
+    }
+}
+
+template<class T>
+void invokeLoraForward(T*                y,
+                       int               ldy,
+                       const T*          x,
+                       int               ldx,
+                       int               input_dims,
+                       int               output_dims,
+                       const LoraLayout& layout,
+                       const LoraBatch&  batch,
+                       cudaStream_t      st)
+{
+    if (batch.tile_num == 0 || layout.offset < 0) {
+        return;
+    }
+
+    constexpr int kWarps = 8;
+    LoraShrink<T, kWarps><<<batch.tile_num, kWarps * WARP_SIZE, 0, st>>>(
+        batch.buf, x, ldx, input_dims, layout.offset, layout.sections, batch);
+
+    const int bound0 = layout.sections > 1 ? layout.bounds[0] : output_dims;
+    const int bound1 = layout.sections > 2 ? layout.bounds[1] : output_dims;
+
+    constexpr int block = 256;
+    const dim3    grid(batch.tile_num, cdiv(output_dims, block));
+    LoraExpand<T><<<grid, block, 0, st>>>(y,
+                                          ldy,
+                                          batch.buf,
+                                          output_dims,
+                                          layout.offset + (int64_t)layout.sections * input_dims,
+                                          bound0,
+                                          bound1,
+                                          batch);
+    sync_check_cuda_error();
+}
+
+#ifdef ENABLE_FP32
+template void
+invokeLoraForward(float*, int, const float*, int, int, int, const LoraLayout&, const LoraBatch&, cudaStream_t);
+#endif
+template void
+invokeLoraForward(half*, int, const half*, int, int, int, const LoraLayout&, const LoraBatch&, cudaStream_t);
+#ifdef ENABLE_BF16
+template void invokeLoraForward(
+    __nv_bfloat16*, int, const __nv_bfloat16*, int, int, int, const LoraLayout&, const LoraBatch&, cudaStream_t);
+#endif
+
+}  // namespace turbomind
@@ -0,0 +1,55 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// Tokens of a tile belong to the same sequence and thus use the same adapter
+constexpr int kLoraTileTokens = 8;
+
+// max `sections * r` of a module, the fused qkv of an adapter with rank 64
+constexpr int kLoraMaxCols = 192;
+
+struct LoraTile {
+    int begin;  // token range
+    int end;
+    int slot;  // adapter slot
+};
+
+// Adapters used by the tokens of a forward pass
+struct LoraBatch {
+    const LoraTile* tiles;  // tiles of the tokens with an adapter
+    int             tile_num;
+    const char*     slots;      // adapter slots
+    size_t          slot_size;  // in bytes
+    const int*      ranks;      // [max_loras]
+    const float*    scales;     // [max_loras]
+    float*          buf;        // [token_num, kLoraMaxCols]
+};
+
+// Layout of the weights of a module in an adapter slot with rank `r`, A [input_dims, sections * r] at `offset * r`
+// followed by B [r, output_dims]. Columns of the output in section `i` use the i-th `r` columns of x * A, this is
+// how q, k, v of the fused qkv get their own A & B.
+struct LoraLayout {
+    int64_t offset   = -1;  // in elements per rank, -1 for modules without adapters
+    int     sections = 1;
+    int     bounds[2]{};  // ends of the first 2 sections
+};
+
+// SGMV, y[t] += scale[slot] * (x[t] * A[slot]) * B[slot] for the tokens in the tiles
+template<class T>
+void invokeLoraForward(T*                y,
+                       int               ldy,
+                       const T*          x,
+                       int               ldx,
+                       int               input_dims,
+                       int               output_dims,
+                       const LoraLayout& layout,
+                       const LoraBatch&  batch,
+                       cudaStream_t      st);
+
+}  // namespace turbomind
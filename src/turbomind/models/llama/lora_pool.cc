@@ -0,0 +1,185 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cstring>
+
+#include "src/turbomind/models/llama/lora_pool.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/string_utils.h"
+
+namespace turbomind {
+
+LoraAdapterPool::LoraAdapterPool(int max_loras, int max_rank, size_t slot_units, size_t elem_size, cudaStream_t stream):
+    max_loras_{max_loras},
+    max_rank_{max_rank},
+    slot_units_{slot_units},
+    elem_size_{elem_size},
+    slot_size_{elem_size * slot_units * max_rank},
+    stream_{stream},
+    slot_ids_(max_loras, -1),
+    slot_ticks_(max_loras),
+    h_ranks_(max_loras),
+    h_scales_(max_loras)
+{
+    FT_CHECK(max_loras > 0 && max_rank > 0 && slot_units > 0);
+
+    check_cuda_error(cudaMallocAsync(&slots_, slot_size_ * max_loras_, stream_));
+    check_cuda_error(cudaMallocAsync(&d_ranks_, sizeof(int) * max_loras_, stream_));
+    check_cuda_error(cudaMallocAsync(&d_scales_, sizeof(float) * max_loras_, stream_));
+    check_cuda_error(cudaMemsetAsync(d_ranks_, 0, sizeof(int) * max_loras_, stream_));
+    check_cuda_error(cudaMemsetAsync(d_scales_, 0, sizeof(float) * max_loras_, stream_));
+    check_cuda_error(cudaEventCreateWithFlags(&event_, cudaEventDisableTiming));
+
+    TM_LOG_INFO("[LoraAdapterPool] %d slots, max rank %d, %.2f MB per slot",
+                max_loras_,
+                max_rank_,
+                slot_size_ / (float)(1 << 20));
+}
+
+LoraAdapterPool::~LoraAdapterPool()
+{
+    check_cuda_error(cudaEventSynchronize(event_));
+    check_cuda_error(cudaEventDestroy(event_));
+    check_cuda_error(cudaFreeAsync(slots_, stream_));
+    check_cuda_error(cudaFreeAsync(d_ranks_, stream_));
+    check_cuda_error(cudaFreeAsync(d_scales_, stream_));
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+void LoraAdapterPool::Register(int id, int rank, float scale, const void* data, size_t size)
+{
+    FT_CHECK_WITH_INFO(id >= 0, fmtstr("invalid adapter id %d", id));
+    FT_CHECK_WITH_INFO(0 < rank && rank <= max_rank_,
+                       fmtstr("rank %d of adapter %d is out of range (0, %d]", rank, id, max_rank_));
+    FT_CHECK_WITH_INFO(size == elem_size_ * slot_units_ * rank,
+                       fmtstr("size of adapter %d (%lu) mismatches its layout (%lu)",
+                              id,
+                              (unsigned long)size,
+                              (unsigned long)(elem_size_ * slot_units_ * rank)));
+
+    char* ptr{};
+    check_cuda_error(cudaMallocHost((void**)&ptr, size));
+    std::memcpy(ptr, data, size);
+    std::shared_ptr<char> buf(ptr, [](char* p) { check_cuda_error(cudaFreeHost(p)); });
+
+    std::lock_guard lock{mutex_};
+
+    auto& a = adapters_[id];
+    if (a.data) {
+        retired_.push_back(std::move(a.data));
+    }
+    // The resident copy is stale
+    std::replace(slot_ids_.begin(), slot_ids_.end(), id, -1);
+
+    a = Adapter{std::move(buf), rank, scale};
+
+    TM_LOG_INFO("[LoraAdapterPool] adapter %d registered, rank %d, scale %f", id, rank, scale);
+}
+
+bool LoraAdapterPool::Unregister(int id)
+{
+    std::lock_guard lock{mutex_};
+
+    auto it = adapters_.find(id);
+    if (it == adapters_.end()) {
+        return false;
+    }
+    retired_.push_back(std::move(it->second.data));
+    adapters_.erase(it);
+
+    return true;
+}
+
+bool LoraAdapterPool::Contains(int id) const
+{
+    std::lock_guard lock{mutex_};
+    return adapters_.count(id);
+}
+
+void LoraAdapterPool::Acquire(const std::vector<int>& ids, std::vector<int>& slots, cudaStream_t stream)
+{
+    std::lock_guard lock{mutex_};
+
+    if (!retired_.empty() && cudaEventQuery(event_) == cudaSuccess) {
+        retired_.clear();
+    }
+
+    ++tick_;
+
+    const auto find_slot = [&](int id) {
+        auto it = std::find(slot_ids_.begin(), slot_ids_.end(), id);
+        return it == slot_ids_.end() ? -1 : (int)(it - slot_ids_.begin());
+    };
+
+    std::vector<char> taken(max_loras_);
+
+    // Resident adapters first, so that they are never replaced by the missing ones
+    slots.assign(ids.size(), -1);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] >= 0) {
+            if (const int s = find_slot(ids[i]); s >= 0) {
+                slots[i] = s;
+                taken[s] = 1;
+
+                slot_ticks_[s] = tick_;
+            }
+        }
+    }
+
+    bool uploaded = false;
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] < 0 || slots[i] >= 0) {
+            continue;
+        }
+        // Uploaded for an earlier token of the batch
+        if (const int s = find_slot(ids[i]); s >= 0) {
+            slots[i] = s;
+            continue;
+        }
+        auto it = adapters_.find(ids[i]);
+        if (it == adapters_.end()) {
+            TM_LOG_WARNING("[LoraAdapterPool] adapter %d is not registered, using the base model", ids[i]);
+            continue;
+        }
+        // Empty slots first, then the least recently used one
+        int victim = -1;
+        for (int s = 0; s < max_loras_; ++s) {
+            if (taken[s]) {
+                continue;
+            }
+            if (victim < 0 || std::make_pair(slot_ids_[s] >= 0, slot_ticks_[s])
+                                  < std::make_pair(slot_ids_[victim] >= 0, slot_ticks_[victim])) {
+                victim = s;
+            }
+        }
+        FT_CHECK_WITH_INFO(victim >= 0, "number of adapters in the batch exceeds `max_loras`");
+
+        const auto& a = it->second;
+        check_cuda_error(cudaMemcpyAsync(slots_ + victim * slot_size_,
+                                         a.data.get(),
+                                         elem_size_ * slot_units_ * a.rank,
+                                         cudaMemcpyHostToDevice,
+                                         stream));
+
+        slot_ids_[victim]   = ids[i];
+        slot_ticks_[victim] = tick_;
+        h_ranks_[victim]    = a.rank;
+        h_scales_[victim]   = a.scale;
+        taken[victim]       = 1;
+        slots[i]            = victim;
+
+        uploaded = true;
+    }
+
+    if (uploaded) {
+        check_cuda_error(
+            cudaMemcpyAsync(d_ranks_, h_ranks_.data(), sizeof(int) * max_loras_, cudaMemcpyHostToDevice, stream));
+        check_cuda_error(
+            cudaMemcpyAsync(d_scales_, h_scales_.data(), sizeof(float) * max_loras_, cudaMemcpyHostToDevice, stream));
+        check_cuda_error(cudaEventRecord(event_, stream));
+    }
+}
+
+}  // namespace turbomind
@@ -0,0 +1,101 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cuda_runtime.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace turbomind {
+
+// Registry of the LoRA adapters served by an engine. Adapters are kept in pinned host memory and swapped into a
+// fixed number of device slots on demand, replacing the least recently used slot not taken by the current batch.
+// The weights of an adapter with rank `r` are `r * slot_units` elements in the layout given by `LoraLayout`.
+//
+// A pool is owned by each rank, the ranks make the same swapping decisions as they acquire the same adapters.
+class LoraAdapterPool {
+public:
+    LoraAdapterPool(int max_loras, int max_rank, size_t slot_units, size_t elem_size, cudaStream_t stream);
+
+    ~LoraAdapterPool();
+
+    LoraAdapterPool(const LoraAdapterPool&) = delete;
+    LoraAdapterPool& operator=(const LoraAdapterPool&) = delete;
+
+    // Thread-safe, `data` (`size` bytes) is copied. Registering an existing id replaces its weights
+    void Register(int id, int rank, float scale, const void* data, size_t size);
+
+    // Thread-safe, a resident copy of the adapter is kept until its slot is replaced
+    bool Unregister(int id);
+
+    bool Contains(int id) const;
+
+    // Make the adapters resident for the next forward pass, `ids` has at most `max_loras` distinct adapters. The
+    // slot of unknown adapters and `id < 0` is -1
+    void Acquire(const std::vector<int>& ids, std::vector<int>& slots, cudaStream_t stream);
+
+    int max_loras() const noexcept
+    {
+        return max_loras_;
+    }
+
+    int max_rank() const noexcept
+    {
+        return max_rank_;
+    }
+
+    const char* slots() const noexcept
+    {
+        return slots_;
+    }
+
+    size_t slot_size() const noexcept
+    {
+        return slot_size_;
+    }
+
+    const int* ranks() const noexcept
+    {
+        return d_ranks_;
+    }
+
+    const float* scales() const noexcept
+    {
+        return d_scales_;
+    }
+
+private:
+    struct Adapter {
+        std::shared_ptr<char> data;  // pinned
+        int                   rank;
+        float                 scale;
+    };
+
+    const int    max_loras_;
+    const int    max_rank_;
+    const size_t slot_units_;
+    const size_t elem_size_;
+    const size_t slot_size_;
+
+    cudaStream_t stream_;  // for allocation
+    cudaEvent_t  event_;   // last upload
+
+    char*  slots_{};
+    int*   d_ranks_{};
+    float* d_scales_{};
+
+    std::vector<int>      slot_ids_;    // adapter in each slot, -1 for empty slots
+    std::vector<uint64_t> slot_ticks_;  // last use of each slot
+    std::vector<int>      h_ranks_;
+    std::vector<float>    h_scales_;
+    uint64_t              tick_{};
+
+    mutable std::mutex                 mutex_;
+    std::unordered_map<int, Adapter>   adapters_;
+    std::vector<std::shared_ptr<char>> retired_;  // host copies to be freed when the uploads are done
+};
+
+}  // namespace turbomind
@@ -0,0 +1,235 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/models/llama/memory_planner.h"
+#include "src/turbomind/models/llama/unified_attention_layer.h"
+
+namespace turbomind {
+
+namespace {
+
+size_t ceil_div(size_t x, size_t y)
+{
+    return (x + y - 1) / y;
+}
+
+size_t round_up(size_t x, size_t y)
+{
+    return ceil_div(x, y) * y;
+}
+
+}  // namespace
+
+// bits of the cached k/v elements of a quant policy
+static int CacheBits(int quant_policy, int elem_bits)
+{
+    if (quant_policy & QuantPolicy::kCacheKVInt4) {
+        return 4;
+    }
+    else if (quant_policy & (QuantPolicy::kCacheKVInt8 | QuantPolicy::kCacheKVFp8)) {
+        return 8;
+    }
+    return elem_bits;
+}
+
+SequenceManager::BlockConfig
+MakeBlockConfig(const ModelParam& model, const AttentionParam& attn, const EngineParam& engine, int elem_bits)
+{
+    const int t_bits = elem_bits;
+
+    elem_bits = CacheBits(model.quant_policy, elem_bits);
+
+    // the latent MLA cache is a single KV head of the compressed KV
+    const auto& mla          = model.mla;
+    const bool  mla_latent   = attn.mla_latent_cache;
+    const int   cache_dim    = mla_latent ? int(mla.kv_lora_rank + mla.qk_rope_dim) : (int)model.head_dim;
+    const int   cache_kv_num = mla_latent ? 1 : int(model.kv_head_num / engine.attn_tp_size);
+    const int   layer_num    = ceil_div(model.layer_num, engine.pp_size);
+
+    SequenceManager::BlockConfig config{
+        cache_dim,
+        cache_kv_num,
+        attn.cache_block_seq_len,
+        elem_bits == t_bits ? 0 : t_bits,
+        elem_bits,
+        // min & max of the keys of each layer & head
+        attn.sparse_decode_blocks ? layer_num * cache_kv_num * 2 * cache_dim * t_bits / 8 : 0,
+        engine.attn_cp_size,
+    };
+
+    // per-layer configs are limited to a single pipeline stage, see `LlamaTritonModel`
+    if (HasLayerKvConfig(model)) {
+        for (int i = 0; i < layer_num; ++i) {
+            const int q_bits = CacheBits(GetLayerQuantPolicy(model, i), t_bits);
+            config.layers_.push_back({int(GetLayerKvHeadNum(model, i) / engine.attn_tp_size),  //
+                                      q_bits == t_bits ? 0 : t_bits,
+                                      q_bits});
+        }
+    }
+
+    return config;
+}
+
+static MemoryPlan Plan(const ModelParam&     model,
+                       const AttentionParam& attn,
+                       const MoeParam&       moe,
+                       const EngineParam&    engine,
+                       int                   elem_size,
+                       size_t                free,
+                       bool                  suggest)
+{
+    MemoryPlan p{};
+
+    p.free = free;
+
+    const size_t T           = elem_size;
+    const size_t hidden      = model.hidden_units;
+    const size_t head_dim    = model.head_dim;
+    const size_t head_num    = model.head_num / engine.attn_tp_size;
+    const size_t kv_head_num = model.kv_head_num / engine.attn_tp_size;
+    const size_t layer_num   = ceil_div(model.layer_num, engine.pp_size);
+    const size_t vocab       = round_up(model.vocab_size, engine.attn_tp_size);
+    const size_t batch       = engine.max_batch_size;
+    const size_t session_len = engine.session_len;
+
+    // Scratch of the layers shared by the phases, see `UnifiedDecoder`
+    {
+        const size_t max_tokens = engine.max_prefill_token_num + batch;
+        const size_t ffn_tokens = round_up(max_tokens, engine.mlp_tp_size) * engine.attn_dp_size;
+
+        size_t max_inter = 0;
+        for (const auto& x : model.inter_size) {
+            max_inter = std::max(max_inter, ceil_div(x, engine.mlp_tp_size));
+        }
+
+        const size_t attn_scratch = T * max_tokens * (2 * head_num + 2 * kv_head_num) * head_dim;
+        const size_t ffn_scratch  = T * ffn_tokens * max_inter * 2;
+
+        size_t moe_scratch = 0;
+        const auto it = std::max_element(moe.expert_num.begin(), moe.expert_num.end());
+        if (it != moe.expert_num.end() && *it > 0) {
+            // routed tokens in & out, the intermediate, the gating logits & the routing tables
+            const size_t k      = moe.experts_per_token;
+            // the experts are whole on their ranks with expert parallelism
+            const size_t inter  = engine.ep_size > 1 ? moe.inter_size : ceil_div(moe.inter_size, engine.mlp_tp_size);
+            const size_t padded = round_up(ffn_tokens, 16);
+            moe_scratch = T * k * ffn_tokens * (hidden + 2 * inter) + 4 * ffn_tokens * (*it + 4 * k + 1) + *it * padded;
+            if (engine.ep_size > 1) {
+                moe_scratch += 2 * T * k * ffn_tokens * hidden + 16 * k * ffn_tokens;
+            }
+        }
+
+        // the split-k partials of the decoding & prefill kernels
+        const size_t w         = UnifiedAttentionLayer<half>::kMaxWorkspaceTokens;
+        const size_t workspace = 2 * (4 * w * head_num * (head_dim + 3) + 4 * w);
+
+        p.layer_buffers = std::max(attn_scratch, ffn_scratch + moe_scratch) + workspace;
+    }
+
+    // Buffers of `LlamaBatch`, allocated after the kv cache
+    {
+        const size_t fwd_tokens = engine.max_prefill_token_num + batch;
+        const size_t stride     = ceil_div(session_len + engine.num_speculative_tokens, attn.cache_block_seq_len);
+        const size_t blocks     = batch * stride + 1;
+
+        p.engine_buffers = T * fwd_tokens * hidden + 4 * fwd_tokens  // context inputs & ids
+                           + 3 * T * batch * hidden                  // decoder inputs & outputs
+                           + 4 * batch * session_len * 3             // input ids & token ids
+                           + 4 * batch * session_len * 2             // output ids of the device states
+                           + T * batch * vocab                       // logits
+                           + 8 * blocks;                             // block pointers
+
+        p.comm_buffers = T * engine.attn_dp_size * round_up(fwd_tokens, engine.attn_tp_size) * hidden  //
+                         + T * batch * vocab;
+    }
+
+    const auto config = MakeBlockConfig(model, attn, engine, 8 * elem_size);
+
+    p.block_size = SequenceManager::BlockSize(layer_num, config);
+    p.block_len  = attn.cache_block_seq_len;
+
+    // memory the kv cache takes its ratio of
+    const int64_t avail = (int64_t)free - (int64_t)p.layer_buffers;
+    const int64_t after = p.engine_buffers + p.comm_buffers;
+
+    auto blocks_of = [&](double ratio) {  //
+        return avail > 0 ? (int)(size_t(avail * ratio) / p.block_size) : 0;
+    };
+
+    const double ratio = engine.cache_max_block_count;
+
+    p.block_count = ratio < 1. ? blocks_of(ratio) : (int)ratio;
+    p.kv_tokens   = (int64_t)p.block_count * p.block_len;
+    p.sessions    = session_len ? p.kv_tokens / session_len : 0;
+    p.headroom    = avail - (int64_t)p.block_count * p.block_size - after;
+
+    const int64_t spare = avail - after - (int64_t)MemoryPlan::kReserve;
+
+    p.max_ratio       = avail > 0 ? std::clamp((double)spare / avail, 0., 1.) : 0.;
+    p.max_block_count = blocks_of(p.max_ratio);
+
+    if (suggest) {
+        // the largest buffers scale with these two
+        auto with = [&](int prefill, int batch_size) {
+            auto e                  = engine;
+            e.max_prefill_token_num = std::max(prefill, 1);
+            e.max_batch_size        = std::max(batch_size, 1);
+            return Plan(model, attn, moe, e, elem_size, free, false).max_block_count;
+        };
+        p.max_block_count_half_prefill = with(engine.max_prefill_token_num / 2, engine.max_batch_size);
+        p.max_block_count_half_batch   = with(engine.max_prefill_token_num, engine.max_batch_size / 2);
+    }
+
+    return p;
+}
+
+MemoryPlan PlanMemory(const ModelParam&     model,
+                      const AttentionParam& attn,
+                      const MoeParam&       moe,
+                      const EngineParam&    engine,
+                      int                   elem_size,
+                      size_t                free)
+{
+    return Plan(model, attn, moe, engine, elem_size, free, true);
+}
+
+std::vector<std::pair<std::string, double>> MemoryPlan::items() const
+{
+    return {
+        {"free", (double)free},
+        {"layer_buffers", (double)layer_buffers},
+        {"engine_buffers", (double)engine_buffers},
+        {"comm_buffers", (double)comm_buffers},
+        {"block_size", (double)block_size},
+        {"block_len", (double)block_len},
+        {"block_count", (double)block_count},
+        {"kv_tokens", (double)kv_tokens},
+        {"sessions", (double)sessions},
+        {"headroom", (double)headroom},
+        {"max_ratio", max_ratio},
+        {"max_block_count", (double)max_block_count},
+        {"max_block_count_half_prefill", (double)max_block_count_half_prefill},
+        {"max_block_count_half_batch", (double)max_block_count_half_batch},
+    };
+}
+
+std::string MemoryPlan::str() const
+{
+    const auto kb = [](double x) { return (int64_t)std::round(x / (1 << 10)); };
+    const auto mb = [](double x) { return (int64_t)std::round(x / (1 << 20)); };
+
+    std::stringstream ss;
+    ss << "free " << mb(free) << " MB, layer buffers " << mb(layer_buffers) << " MB, engine buffers "
+       << mb(engine_buffers) << " MB, comm buffers " << mb(comm_buffers) << " MB, " << block_count
+       << " kv cache blocks of " << kb(block_size) << " KB (" << kv_tokens << " tokens, " << sessions
+       << " full sessions), headroom " << mb(headroom) << " MB. `cache_max_entry_count` up to " << max_ratio << " for "
+       << max_block_count << " blocks, " << max_block_count_half_prefill << " with half `max_prefill_token_num`, "
+       << max_block_count_half_batch << " with half `max_batch_size`";
+    return ss.str();
+}
+
+}  // namespace turbomind
@@ -0,0 +1,61 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/turbomind/models/llama/SequenceManager.h"
+#include "src/turbomind/models/llama/llama_params.h"
+
+namespace turbomind {
+
+// kv cache blocks of a rank, `elem_bits` of the activations, as allocated by `LlamaBatch`
+SequenceManager::BlockConfig
+MakeBlockConfig(const ModelParam& model, const AttentionParam& attn, const EngineParam& engine, int elem_bits);
+
+// Device memory of a rank planned from the parameters, before the engine allocates any of it. The sizes follow the
+// allocations of `UnifiedDecoder` & `LlamaBatch`: the layer buffers come first, the kv cache takes
+// `cache_max_entry_count` of the memory left then (when < 1) and the engine buffers are allocated from the rest.
+// CUDA graphs, cuBLAS workspaces & the gemm tuning are not planned, `kReserve` is kept for them
+struct MemoryPlan {
+    static constexpr size_t kReserve = (size_t)512 << 20;
+
+    size_t free;            // device memory free at planning, the weights allocated already
+    size_t layer_buffers;   // scratch & workspaces of the decoder layers
+    size_t engine_buffers;  // forward, logits & token buffers of the engine
+    size_t comm_buffers;    // hidden states & logits registered with the device communicator
+
+    size_t  block_size;  // bytes of a kv cache block
+    int     block_len;   // tokens of a block
+    int     block_count;
+    int64_t kv_tokens;  // tokens the kv cache holds
+    int     sessions;   // sessions of `session_len` the kv cache holds
+
+    int64_t headroom;  // free bytes after all the planned allocations, short of memory when < `kReserve`
+
+    // Suggestions, the largest `cache_max_entry_count` leaving `kReserve` and its blocks, also with half the
+    // `max_prefill_token_num` or half the `max_batch_size`
+    double max_ratio;
+    int    max_block_count;
+    int    max_block_count_half_prefill;
+    int    max_block_count_half_batch;
+
+    // (name, value) pairs in order, bytes for the sizes
+    std::vector<std::pair<std::string, double>> items() const;
+
+    std::string str() const;
+};
+
+// `elem_size` is the size of the activations, `free` the device memory free with the weights allocated
+MemoryPlan PlanMemory(const ModelParam&     model,
+                      const AttentionParam& attn,
+                      const MoeParam&       moe,
+                      const EngineParam&    engine,
+                      int                   elem_size,
+                      size_t                free);
+
+}  // namespace turbomind
@@ -90,4 +90,154 @@ template void invokeMLACopyQKV(uint16_t*       qkv,
                                int             v_head_dim,
                                cudaStream_t    stream);
 
+template<class T, int vec_size>
+__global__ void mla_copy_latent_qkv_kernel(T*       qkv,     // [3, h, head_dim], only Q is written
+                                           T*       latent,  // [h + 1, kv_lora_rank + rope_dim]
+                                           const T* q,       // [h, head_dim]
+                                           const T* kv_a,    // [kv_lora_rank, rope_dim]
+                                           int      head_num,
+                                           int      nope_dim,
+                                           int      rope_dim,
+                                           int      kv_lora_rank)
+{
+    const int64_t ti = blockIdx.x;
+    const int     di = threadIdx.x * vec_size;
+
+    const int head_dim   = nope_dim + rope_dim;
+    const int latent_dim = kv_lora_rank + rope_dim;
+
+    T* latent_ptr = latent + ti * (head_num + 1) * latent_dim;
+
+    Array<T, vec_size> data;
+
+    for (int hi = threadIdx.y; hi < head_num; hi += blockDim.y) {
+        if (di < head_dim) {
+            // rope dims first, as the non-latent layout
+            const int src = di < rope_dim ? nope_dim + di : di - rope_dim;
+            Ldg(data, &q[(ti * head_num + hi) * head_dim + src]);
+            Store(&qkv[ti * 3 * head_num * head_dim + hi * head_dim + di], data);
+            // the nope part of the latent Q is written by the absorbed GEMM
+            if (di < rope_dim) {
+                Store(&latent_ptr[hi * latent_dim + di], data);
+            }
+        }
+    }
+
+    if (threadIdx.y == 0) {
+        for (int i = di; i < latent_dim; i += blockDim.x * vec_size) {
+            const int src = i < rope_dim ? kv_lora_rank + i : i - rope_dim;
+            Ldg(data, &kv_a[ti * latent_dim + src]);
+            Store(&latent_ptr[head_num * latent_dim + i], data);
+        }
+    }
+}
+
+template<class T>
+void invokeMLACopyLatentQKV(T*           qkv,
+                            T*           latent,
+                            const T*     q,
+                            const T*     kv_a,
+                            int          token_num,
+                            int          head_num,
+                            int          nope_dim,
+                            int          rope_dim,
+                            int          kv_lora_rank,
+                            cudaStream_t stream)
+{
+    constexpr int vec_size = 16 / sizeof(T);
+    const int     head_dim = nope_dim + rope_dim;
+
+    dim3 block(head_dim / vec_size, head_num);
+    while (block.x * block.y > 1024) {
+        block.y /= 2;
+    }
+
+    mla_copy_latent_qkv_kernel<T, vec_size>
+        <<<token_num, block, 0, stream>>>(qkv, latent, q, kv_a, head_num, nope_dim, rope_dim, kv_lora_rank);
+}
+
+template void invokeMLACopyLatentQKV(uint16_t*       qkv,
+                                     uint16_t*       latent,
+                                     const uint16_t* q,
+                                     const uint16_t* kv_a,
+                                     int             token_num,
+                                     int             head_num,
+                                     int             nope_dim,
+                                     int             rope_dim,
+                                     int             kv_lora_rank,
+                                     cudaStream_t    stream);
+
+template<class T, int vec_size>
+__global__ void mla_expand_kv_kernel(T*       kv,        // [h, 2, sum_k_len, head_dim]
+                                     const T* latent_k,  // [sum_k_len, rope_dim + kv_lora_rank]
+                                     const T* kv_b,      // [sum_k_len, h, nope_dim + v_head_dim]
+                                     int      sum_k_len,
+                                     int      head_num,
+                                     int      nope_dim,
+                                     int      rope_dim,
+                                     int      v_head_dim,
+                                     int      kv_lora_rank)
+{
+    const int64_t ti = blockIdx.x;
+    const int     di = threadIdx.x * vec_size;
+
+    const int head_dim = nope_dim + rope_dim;
+    const int kv_b_dim = nope_dim + v_head_dim;
+
+    for (int hi = threadIdx.y; hi < head_num; hi += blockDim.y) {
+        if (di < head_dim) {
+            Array<T, vec_size> k;
+            Array<T, vec_size> v{};
+            // the rope part is rotated when being cached
+            if (di < rope_dim) {
+                Ldg(k, &latent_k[ti * (rope_dim + kv_lora_rank) + di]);
+            }
+            else {
+                Ldg(k, &kv_b[(ti * head_num + hi) * kv_b_dim + di - rope_dim]);
+            }
+            if (di < v_head_dim) {
+                Ldg(v, &kv_b[(ti * head_num + hi) * kv_b_dim + nope_dim + di]);
+            }
+            T* dst = kv + (int64_t)hi * 2 * sum_k_len * head_dim;
+            Store(&dst[ti * head_dim + di], k);
+            Store(&dst[(sum_k_len + ti) * head_dim + di], v);
+        }
+    }
+}
+
+template<class T>
+void invokeMLAExpandKV(T*           kv,
+                       const T*     latent_k,
+                       const T*     kv_b,
+                       int          sum_k_len,
+                       int          head_num,
+                       int          nope_dim,
+                       int          rope_dim,
+                       int          v_head_dim,
+                       int          kv_lora_rank,
+                       cudaStream_t stream)
+{
+    constexpr int vec_size = 16 / sizeof(T);
+    const int     head_dim = nope_dim + rope_dim;
+
+    dim3 block(head_dim / vec_size, head_num);
+    while (block.x * block.y > 1024) {
+        block.y /= 2;
+    }
+
+    mla_expand_kv_kernel<T, vec_size><<<sum_k_len, block, 0, stream>>>(
+        kv, latent_k, kv_b, sum_k_len, head_num, nope_dim, rope_dim, v_head_dim, kv_lora_rank);
+}
+
+template void invokeMLAExpandKV(uint16_t*       kv,
+                                const uint16_t* latent_k,
+                                const uint16_t* kv_b,
+                                int             sum_k_len,
+                                int             head_num,
+                                int             nope_dim,
+                                int             rope_dim,
+                                int             v_head_dim,
+                                int             kv_lora_rank,
+                                cudaStream_t    stream);
+
 }  // namespace turbomind
@@ -54,4 +54,85 @@ void dispatchMLACopyQKV(T*           qkv,
     FT_CHECK(0);
 }
 
+// Latent KV cache: writes the rope-first Q of the non-latent path and `latent` of [H + 1, rope_dim + kv_lora_rank],
+// which holds the rope part of the absorbed Q of each head followed by the compressed KV of the token
+template<class T>
+void invokeMLACopyLatentQKV(T*           qkv,
+                            T*           latent,
+                            const T*     q,
+                            const T*     kv_a,
+                            int          token_num,
+                            int          head_num,
+                            int          nope_dim,
+                            int          rope_dim,
+                            int          kv_lora_rank,
+                            cudaStream_t stream);
+
+// Latent KV cache: per-head K/V of prefills from the flattened latents and their `kv_b_proj` outputs
+template<class T>
+void invokeMLAExpandKV(T*           kv,
+                       const T*     latent_k,
+                       const T*     kv_b,
+                       int          sum_k_len,
+                       int          head_num,
+                       int          nope_dim,
+                       int          rope_dim,
+                       int          v_head_dim,
+                       int          kv_lora_rank,
+                       cudaStream_t stream);
+
+template<class T>
+void dispatchMLACopyLatentQKV(T*           qkv,
+                              T*           latent,
+                              const T*     q,
+                              const T*     kv_a,
+                              int          token_num,
+                              int          head_num,
+                              int          nope_dim,
+                              int          rope_dim,
+                              int          kv_lora_rank,
+                              cudaStream_t stream)
+{
+    if constexpr (sizeof(T) == 2) {
+        return invokeMLACopyLatentQKV((uint16_t*)qkv,
+                                      (uint16_t*)latent,
+                                      (const uint16_t*)q,
+                                      (const uint16_t*)kv_a,
+                                      token_num,
+                                      head_num,
+                                      nope_dim,
+                                      rope_dim,
+                                      kv_lora_rank,
+                                      stream);
+    }
+    FT_CHECK(0);
+}
+
+template<class T>
+void dispatchMLAExpandKV(T*           kv,
+                         const T*     latent_k,
+                         const T*     kv_b,
+                         int          sum_k_len,
+                         int          head_num,
+                         int          nope_dim,
+                         int          rope_dim,
+                         int          v_head_dim,
+                         int          kv_lora_rank,
+                         cudaStream_t stream)
+{
+    if constexpr (sizeof(T) == 2) {
+        return invokeMLAExpandKV((uint16_t*)kv,
+                                 (const uint16_t*)latent_k,
+                                 (const uint16_t*)kv_b,
+                                 sum_k_len,
+                                 head_num,
+                                 nope_dim,
+                                 rope_dim,
+                                 v_head_dim,
+                                 kv_lora_rank,
+                                 stream);
+    }
+    FT_CHECK(0);
+}
+
 }  // namespace turbomind
@@ -4,6 +4,7 @@
 #include "src/turbomind/kernels/activation_kernels.h"
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
 #include "src/turbomind/models/llama/LlamaLinear.h"
+#include "src/turbomind/models/llama/expert_cache.h"
 #include "src/turbomind/models/llama/llama_params.h"
 #include "src/turbomind/models/llama/llama_utils.h"
 #include "src/turbomind/utils/cuda_utils.h"
@@ -12,32 +13,65 @@
 #include "src/turbomind/utils/string_utils.h"
 #include <cuda_runtime.h>
 #include <iomanip>
+#include <numeric>
 
 namespace turbomind {
 
+template<class T>
+size_t
+MoeFfnLayer<T>::CarveWorkspace(char* base, size_t tokens, size_t padded, size_t expert_num, size_t inter_buf_factor)
+{
+    Monotonic alloc{base};
+    alloc(&inout_buf_, tokens * param_.experts_per_token * hidden_dim_);
+    alloc(&inter_buf_, tokens * param_.experts_per_token * inter_size_ * inter_buf_factor);
+    alloc(&logits_, tokens * expert_num);
+    alloc(&masks_, expert_num * padded);
+    alloc(&f2n_, param_.experts_per_token * tokens);
+    alloc(&en2f_, param_.experts_per_token * tokens);
+    alloc(&scales_, param_.experts_per_token * tokens);
+    alloc(&row_scales_, param_.experts_per_token * tokens);
+    alloc(&shared_scales_, tokens);
+    if (ep_size_ > 1) {
+        alloc(&send_buf_, tokens * param_.experts_per_token * hidden_dim_);
+        alloc(&recv_buf_, tokens * param_.experts_per_token * hidden_dim_);
+        alloc(&ep_offsets_, ep_size_ * (expert_num + 1));
+        alloc(&ep_idxs_, 4 * tokens * param_.experts_per_token);
+    }
+    return (char*)alloc.ptr() - base;
+}
+
+template<class T>
+size_t MoeFfnLayer<T>::PlanScratch(void* base, size_t max_tokens)
+{
+    // every buffer grows with each of the arguments, the unfused gating takes the larger intermediate buffer
+    const size_t padded = (max_tokens + kMoeGateVecSize - 1) / kMoeGateVecSize * kMoeGateVecSize;
+    const size_t size   = CarveWorkspace((char*)base, max_tokens, padded, max_expert_num_, 2);
+    if (base) {
+        FT_CHECK(!workspace_);
+        scratch_tokens_ = max_tokens;
+    }
+    return size;
+}
+
 template<class T>
 void MoeFfnLayer<T>::AllocateBuffer(size_t tokens, size_t padded, size_t expert_num, size_t inter_buf_factor)
 {
-    char* base = 0;
-
-    auto allocate = [&](void* base) {
-        Monotonic alloc{base};
-        alloc(&inout_buf_, tokens * param_.experts_per_token * hidden_dim_);
-        alloc(&inter_buf_, tokens * param_.experts_per_token * inter_size_ * inter_buf_factor);
-        alloc(&logits_, tokens * expert_num);
-        alloc(&masks_, expert_num * padded);
-        alloc(&f2n_, param_.experts_per_token * tokens);
-        alloc(&en2f_, param_.experts_per_token * tokens);
-        alloc(&scales_, param_.experts_per_token * tokens);
-        alloc(&shared_scales_, tokens);
-        return (char*)alloc.ptr() - (char*)base;
-    };
+    if (scratch_tokens_) {
+        FT_CHECK_WITH_INFO(tokens <= scratch_tokens_,
+                           fmtstr("%d tokens exceed the planned scratch (%d)", (int)tokens, (int)scratch_tokens_));
+    }
+    else {
+        const auto workspace_size = CarveWorkspace(nullptr, tokens, padded, expert_num, inter_buf_factor);
 
-    const auto workspace_size = allocate(0);
+        workspace_ = (char*)allocator_->reMalloc(workspace_, workspace_size);
 
-    workspace_ = (char*)allocator_->reMalloc(workspace_, workspace_size);
+        CarveWorkspace(workspace_, tokens, padded, expert_num, inter_buf_factor);
+    }
 
-    allocate(workspace_);
+    if (ep_size_ > 1) {
+        ep_rows_   = tokens * param_.experts_per_token;
+        h_ep_idxs_ = (int*)allocator_->reMalloc(h_ep_idxs_, sizeof(int) * 4 * ep_rows_, false, true);
+    }
 }
 
 template<class T>
@@ -47,8 +81,15 @@ void MoeFfnLayer<T>::FreeBuffer()
 
     allocator_->free((void**)&accum_);
     allocator_->free((void**)&offsets_);
+    allocator_->free((void**)&expert_counts_);
 
     allocator_->free((void**)&h_offsets_, true);
+    allocator_->free((void**)&h_logits_, true);
+
+    if (ep_size_ > 1) {
+        allocator_->free((void**)&h_ep_offsets_, true);
+        allocator_->free((void**)&h_ep_idxs_, true);
+    }
 }
 
 template<class T>
@@ -79,11 +120,24 @@ void MoeFfnLayer<T>::gate(float* logits, const T* input, int tokens, const Llama
 template<class T>
 void MoeFfnLayer<T>::forward(T* output, const T* input, int tokens, int layer_id, const MoeFfnWeight<T>& moe)
 {
-    const size_t padded     = (tokens + kMoeGateVecSize - 1) / kMoeGateVecSize * kMoeGateVecSize;
-    const int    expert_num = moe.experts.size();
+    const int expert_num = moe.gate.output_dims;
 
     FT_CHECK(expert_num);
 
+    // With expert parallelism the tokens (replicated over the ranks) are routed in slices
+    ep_first_  = 0;
+    ep_tokens_ = tokens;
+    if (ep_size_ > 1) {
+        const int slice = (tokens + ep_size_ - 1) / ep_size_;
+        ep_first_       = std::min(tokens, ep_rank_ * slice);
+        ep_tokens_      = std::min(tokens, ep_first_ + slice) - ep_first_;
+    }
+
+    const T*  routed_input = input + (size_t)ep_first_ * hidden_dim_;
+    const int routed       = ep_tokens_;
+
+    const size_t padded = (routed + kMoeGateVecSize - 1) / kMoeGateVecSize * kMoeGateVecSize;
+
     const size_t inter_buf_factor = [&] {
         if (param_.method == MoeParam::kNaive) {
             return 0;  // managed by ffn
@@ -98,47 +152,48 @@ void MoeFfnLayer<T>::forward(T* output, const T* input, int tokens, int layer_id
 
     AllocateBuffer(tokens, padded, expert_num, inter_buf_factor);
 
-    gate(logits_, input, tokens, moe.gate);
-    sync_check_cuda_error();
-
-    // if (tensor_para_.rank_ == 0) {
-    //     Compare(logits_, tokens * expert_num, Concat("logit", layer_id), compare_mode, stream_);
-    // }
-
-    check_cuda_error(cudaMemsetAsync(accum_, 0, sizeof(int) * expert_num * kMoeGateMaxTiles, stream_));
-    check_cuda_error(cudaMemsetAsync(masks_, -1, sizeof(int8_t) * expert_num * padded, stream_));
+    if (routed) {
+        gate(logits_, routed_input, routed, moe.gate);
+        sync_check_cuda_error();
 
-    // dump_logits(tokens, layer_id);
+        // if (tensor_para_.rank_ == 0) {
+        //     Compare(logits_, tokens * expert_num, Concat("logit", layer_id), compare_mode, stream_);
+        // }
 
-    bool softmax = true;
-    if (param_.topk_method == "group_limited_greedy") {
-        invokeMoeSoftmaxMaskTopKGroups(
-            logits_, tokens, expert_num, expert_num / param_.n_group, param_.topk_group, stream_);
+        check_cuda_error(cudaMemsetAsync(accum_, 0, sizeof(int) * expert_num * kMoeGateMaxTiles, stream_));
+        check_cuda_error(cudaMemsetAsync(masks_, -1, sizeof(int8_t) * expert_num * padded, stream_));
+
+        // dump_logits(tokens, layer_id);
+
+        const bool group_limited = param_.topk_method == "group_limited_greedy";
+
+        /// TODO: fix illegal memory access even if NaN are present in logits
+        invokeMoeGate_V2(f2n_,
+                         en2f_,
+                         offsets_,
+                         scales_,
+                         masks_,
+                         accum_,
+                         logits_,
+                         routed,
+                         padded,
+                         expert_num,
+                         param_.experts_per_token,
+                         group_limited ? param_.n_group : 1,
+                         group_limited ? param_.topk_group : 1,
+                         true,
+                         param_.norm_topk_prob,
+                         param_.routed_scale,
+                         stream_);
         sync_check_cuda_error();
-        softmax = false;
-    }
-
-    /// TODO: fix illegal memory access even if NaN are present in logits
-    invokeMoeGate_V2(f2n_,
-                     en2f_,
-                     offsets_,
-                     scales_,
-                     masks_,
-                     accum_,
-                     logits_,
-                     tokens,
-                     padded,
-                     expert_num,
-                     param_.experts_per_token,
-                     softmax,
-                     param_.norm_topk_prob,
-                     param_.routed_scale,
-                     stream_);
-    sync_check_cuda_error();
+    }
+    else {  // empty slice
+        check_cuda_error(cudaMemsetAsync(offsets_, 0, sizeof(int) * (expert_num + 1), stream_));
+    }
 
     if (isTuning()) {
         std::mt19937     g;
-        const auto       expert_ids = SampleUniform(tokens, expert_num, param_.experts_per_token, g);
+        const auto       expert_ids = SampleUniform(routed, expert_num, param_.experts_per_token, g);
         std::vector<int> cnt(expert_num);
         for (const auto& x : expert_ids) {
             ++cnt[x];
@@ -150,6 +205,33 @@ void MoeFfnLayer<T>::forward(T* output, const T* input, int tokens, int layer_id
         check_cuda_error(
             cudaMemcpyAsync(offsets_, h_offsets_, sizeof(int) * (expert_num + 1), cudaMemcpyDefault, stream_));
     }
+    else {
+        invokeMoeAccumCounts(expert_counts_ + (size_t)layer_id * max_expert_num_, offsets_, expert_num, stream_);
+        sync_check_cuda_error();
+    }
+
+    if (moe.cache) {
+        // the next layer's gate over the input of this one predicts its experts, the residual changes little
+        const auto& next = moe.next_gate;
+        const bool  predict =
+            next && routed && routed <= kPredictTokens && !isTuning() && (int)next->output_dims <= expert_num;
+        if (predict) {
+            // the logits of this layer are consumed by the gating
+            gate(logits_, routed_input, routed, *next);
+            check_cuda_error(cudaMemcpyAsync(
+                h_logits_, logits_, sizeof(float) * routed * next->output_dims, cudaMemcpyDefault, stream_));
+        }
+        if (!isTuning()) {
+            check_cuda_error(
+                cudaMemcpyAsync(h_offsets_, offsets_, sizeof(int) * (expert_num + 1), cudaMemcpyDefault, stream_));
+        }
+        // the experts with rows are copied in, the slots are not read by any work in flight
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        moe.cache->Acquire(layer_id, h_offsets_, stream_);
+        if (predict) {
+            moe.cache->Prefetch(moe.cache->Next(layer_id), predict_experts(routed, next->output_dims));
+        }
+    }
 
     if (param_.method == MoeParam::kNaive) {
 
@@ -172,92 +254,508 @@ void MoeFfnLayer<T>::forward(T* output, const T* input, int tokens, int layer_id
             if (size_t count = h_offsets_[i + 1] - h_offsets_[i]) {
                 auto io = inout_buf_ + h_offsets_[i] * hidden_dim_;
 
-                TensorMap ffn_inputs{{"ffn_input", {MEMORY_GPU, dtype_, {count, hidden_dim_}, io}},
-                                     {"layer_id", {MEMORY_CPU, TYPE_INT32, {1}, &layer_id}}};
-                TensorMap ffn_outputs{{"ffn_output", {MEMORY_GPU, dtype_, {count, hidden_dim_}, io}}};
-
-                expert_ffn_->forward(&ffn_outputs, &ffn_inputs, &moe.experts[i]);
+                expert_ffn_->forward({io, io, (int)count, layer_id, nullptr}, &moe.experts[i]);
             }
         }
     }
+    else if (ep_size_ > 1) {
+        dispatch(routed_input, routed, layer_id, expert_num, moe);
+    }
+    else if (scatter_reduce_) {
+        invokeMoeScatterScales(row_scales_, scales_, en2f_, tokens * param_.experts_per_token, stream_);
+        sync_check_cuda_error();
+        forward_experts(nullptr, input, f2n_, tokens * param_.experts_per_token, moe);
+        scattered_ = true;
+    }
     else {
-        context_->update(expert_num, param_.experts_per_token, offsets_);
+        forward_experts(inout_buf_, input, f2n_, tokens * param_.experts_per_token, moe);
+    }
 
-        auto& block = moe.block;
+    if (moe.shared_gate.kernel) {
+        gate(shared_scales_, input, tokens, moe.shared_gate);
+    }
+}
 
-        linear_->forward_moe(inter_buf_,
-                             {input, (int)hidden_dim_},
-                             f2n_,
-                             offsets_,
-                             tokens * param_.experts_per_token,
-                             block.fused_gating_intermediate,
-                             block.is_fused_silu ? LlamaLinear<T>::kFusedSiluFfn : LlamaLinear<T>::kGemm,
-                             context_.get());
+template<class T>
+void MoeFfnLayer<T>::forward_experts(T* output, const T* input, const int* idxs, int rows, const MoeFfnWeight<T>& moe)
+{
+    // rows of the local experts are not a multiple of `experts_per_token` with expert parallelism
+    context_->update(moe.block.output.k_desc.num, ep_size_ > 1 ? 1 : param_.experts_per_token, offsets_);
+
+    auto& block = moe.block;
+
+    linear_->forward_moe(inter_buf_,
+                         {input, (int)hidden_dim_},
+                         idxs,
+                         offsets_,
+                         rows,
+                         block.fused_gating_intermediate,
+                         block.is_fused_silu ? LlamaLinear<T>::kFusedSiluFfn : LlamaLinear<T>::kGemm,
+                         context_.get());
+    sync_check_cuda_error();
+
+    if (!block.is_fused_silu) {
+        invokeGenericActivation_v2<SiluActivation>(
+            inter_buf_, inter_buf_ + inter_size_, inter_size_ * 2, rows, inter_size_, stream_);
         sync_check_cuda_error();
-        auto mode = kCmpRead;
+    }
 
-        // if (tensor_para_.rank_ == 0) {
-        //     Compare(inter_buf_,  //
-        //             tokens * param_.experts_per_token * inter_size_ * 2,
-        //             "inter_buf",
-        //             mode,
-        //             stream_);
-        // }
+    if (!output) {
+        return;
+    }
 
-        if (!block.is_fused_silu) {
-            invokeGenericActivation_v2<SiluActivation>(inter_buf_,
-                                                       inter_buf_ + inter_size_,
-                                                       inter_size_ * 2,
-                                                       tokens * param_.experts_per_token,
-                                                       inter_size_,
-                                                       stream_);
-            sync_check_cuda_error();
+    linear_->forward_moe(output,
+                         {inter_buf_, block.is_fused_silu ? (int)inter_size_ : (int)inter_size_ * 2},
+                         nullptr,
+                         offsets_,
+                         rows,
+                         block.output,
+                         LlamaLinear<T>::kGemm,
+                         context_.get());
+    sync_check_cuda_error();
+}
+
+template<class T>
+void MoeFfnLayer<T>::dispatch(
+    const T* routed_input, int routed, int layer_id, int expert_num, const MoeFfnWeight<T>& moe)
+{
+    const int local_expert_num = expert_num / ep_size_;
+
+    // Expert offsets of all ranks are needed on host to size the all-to-all
+    d_comm_->AllGather(offsets_, ep_offsets_, expert_num + 1, TYPE_INT32, 0, stream_);
+    sync_check_cuda_error();
+
+    check_cuda_error(cudaMemcpyAsync(h_ep_offsets_,
+                                     ep_offsets_,
+                                     sizeof(int) * ep_size_ * (expert_num + 1),
+                                     cudaMemcpyDefault,
+                                     stream_));
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    // expert offsets of rank `s`
+    auto offsets = [&](int s) { return h_ep_offsets_ + s * (expert_num + 1); };
+
+    if (replica_interval_ && !isTuning()) {
+        auto& load = ep_load_[layer_id];
+        load.resize(expert_num);
+        for (int s = 0; s < ep_size_; ++s) {
+            for (int e = 0; e < expert_num; ++e) {
+                load[e] += offsets(s)[e + 1] - offsets(s)[e];
+            }
+        }
+        if (++ep_steps_[layer_id] % replica_interval_ == 0) {
+            rebalance(layer_id, expert_num, moe);
+        }
+    }
+
+    // expert in the replica slot of each rank
+    const int* replicas = replica_interval_ ? replicas_[layer_id].data() : nullptr;
+
+    std::vector<int> replica_rank(expert_num, -1);
+    ep_permute_ = false;
+    for (int r = 0; replicas && r < ep_size_; ++r) {
+        if (replicas[r] >= 0) {
+            replica_rank[replicas[r]] = r;
+            ep_permute_               = true;
+        }
+    }
+
+    // Rows of rank `s` for the slots of rank `d` as (slot, first, count) in slot order, a replicated expert keeps the
+    // first half of its rows and the replica takes the rest
+    auto for_each_segment = [&](int s, int d, auto&& func) {
+        const int* o = offsets(s);
+        for (int j = 0; j < local_expert_num; ++j) {
+            const int e = d * local_expert_num + j;
+            const int n = o[e + 1] - o[e];
+            func(j, o[e], replica_rank[e] < 0 ? n : n - n / 2);
+        }
+        if (replicas && replicas[d] >= 0) {
+            const int e = replicas[d];
+            const int n = o[e + 1] - o[e];
+            func(local_expert_num, o[e] + n - n / 2, n / 2);
+        }
+    };
+
+    int* src_idxs  = h_ep_idxs_;                 // slot major -> source rank major
+    int* dst_idxs  = h_ep_idxs_ + ep_rows_;      // source rank major -> slot major
+    int* send_idxs = h_ep_idxs_ + ep_rows_ * 2;  // destination rank major -> expert major
+    int* back_idxs = h_ep_idxs_ + ep_rows_ * 3;  // expert major -> destination rank major
+
+    int sent = 0;
+    for (int d = 0; d < ep_size_; ++d) {
+        send_displs_[d] = sent;
+        for_each_segment(ep_rank_, d, [&](int, int first, int count) {
+            for (int i = first; i < first + count; ++i, ++sent) {
+                send_idxs[sent] = i;
+                back_idxs[i]    = sent;
+            }
+        });
+        send_counts_[d] = sent - send_displs_[d];
+    }
+
+    const int slots = local_expert_num + (replicas ? 1 : 0);
+
+    // (first, count) of the rows received from each source for each slot
+    std::vector<std::pair<int, int>> chunks(slots * ep_size_);
+
+    ep_recv_ = 0;
+    for (int s = 0; s < ep_size_; ++s) {
+        recv_displs_[s] = ep_recv_;
+        for_each_segment(s, ep_rank_, [&](int j, int, int count) {
+            chunks[j * ep_size_ + s] = {ep_recv_, count};
+            ep_recv_ += count;
+        });
+        recv_counts_[s] = ep_recv_ - recv_displs_[s];
+    }
+
+    // Received rows are grouped by source rank, the grouped gemm needs them grouped by slot
+    h_offsets_[0] = 0;
+    for (int j = 0, i = 0; j < slots; ++j) {
+        for (int s = 0; s < ep_size_; ++s) {
+            const auto [first, count] = chunks[j * ep_size_ + s];
+            for (int k = first; k < first + count; ++k, ++i) {
+                src_idxs[i] = k;
+                dst_idxs[k] = i;
+            }
+        }
+        h_offsets_[j + 1] = i;
+    }
+
+    check_cuda_error(cudaMemcpyAsync(ep_idxs_, src_idxs, sizeof(int) * ep_recv_, cudaMemcpyDefault, stream_));
+    check_cuda_error(
+        cudaMemcpyAsync(ep_idxs_ + ep_rows_, dst_idxs, sizeof(int) * ep_recv_, cudaMemcpyDefault, stream_));
+    if (ep_permute_) {
+        check_cuda_error(
+            cudaMemcpyAsync(ep_idxs_ + ep_rows_ * 2, send_idxs, sizeof(int) * sent, cudaMemcpyDefault, stream_));
+        check_cuda_error(
+            cudaMemcpyAsync(ep_idxs_ + ep_rows_ * 3, back_idxs, sizeof(int) * sent, cudaMemcpyDefault, stream_));
+    }
+    check_cuda_error(cudaMemcpyAsync(offsets_, h_offsets_, sizeof(int) * (slots + 1), cudaMemcpyDefault, stream_));
+
+    if (routed) {
+        if (ep_permute_) {
+            dispatchMoeGather(
+                inout_buf_, routed_input, f2n_, routed, param_.experts_per_token, hidden_dim_, stream_);
+            dispatchMoeGather(send_buf_, inout_buf_, ep_idxs_ + ep_rows_ * 2, sent, 1, hidden_dim_, stream_);
+        }
+        else {
+            dispatchMoeGather(
+                send_buf_, routed_input, f2n_, routed, param_.experts_per_token, hidden_dim_, stream_);
         }
+        sync_check_cuda_error();
+    }
+
+    for (int r = 0; r < ep_size_; ++r) {
+        send_displs_[r] *= hidden_dim_;
+        send_counts_[r] *= hidden_dim_;
+        recv_displs_[r] *= hidden_dim_;
+        recv_counts_[r] *= hidden_dim_;
+    }
+
+    cudaStream_t st = stream_;
+    if (ep_overlap_) {
+        check_cuda_error(cudaEventRecord(ev_before_dispatch_, stream_));
+        check_cuda_error(cudaStreamWaitEvent(ep_stream_, ev_before_dispatch_));
+        st = ep_stream_;
+    }
+
+    d_comm_->AllToAllV(send_buf_,
+                       send_counts_.data(),
+                       send_displs_.data(),
+                       recv_buf_,
+                       recv_counts_.data(),
+                       recv_displs_.data(),
+                       dtype_,
+                       0,
+                       st);
+    sync_check_cuda_error();
+
+    if (ep_overlap_) {
+        check_cuda_error(cudaEventRecord(ev_after_dispatch_, ep_stream_));
+    }
+}
+
+template<class T>
+void MoeFfnLayer<T>::combine(const MoeFfnWeight<T>& moe)
+{
+    if (ep_overlap_) {
+        check_cuda_error(cudaStreamWaitEvent(stream_, ev_after_dispatch_));
+    }
+
+    if (ep_recv_) {
+        dispatchMoeGather(inout_buf_, recv_buf_, ep_idxs_, ep_recv_, 1, hidden_dim_, stream_);
+        sync_check_cuda_error();
+
+        forward_experts(recv_buf_, inout_buf_, nullptr, ep_recv_, moe);
+
+        dispatchMoeGather(inout_buf_, recv_buf_, ep_idxs_ + ep_rows_, ep_recv_, 1, hidden_dim_, stream_);
+        sync_check_cuda_error();
+    }
+
+    // Results go back the way the rows came
+    d_comm_->AllToAllV(inout_buf_,
+                       recv_counts_.data(),
+                       recv_displs_.data(),
+                       send_buf_,
+                       send_counts_.data(),
+                       send_displs_.data(),
+                       dtype_,
+                       0,
+                       stream_);
+    sync_check_cuda_error();
+
+    if (ep_permute_ && ep_tokens_) {
+        // back to expert order for the reduction
+        dispatchMoeGather(recv_buf_,
+                          send_buf_,
+                          ep_idxs_ + ep_rows_ * 3,
+                          ep_tokens_ * param_.experts_per_token,
+                          1,
+                          hidden_dim_,
+                          stream_);
+        sync_check_cuda_error();
+    }
+}
+
+template<class T>
+void MoeFfnLayer<T>::rebalance(int layer_id, int expert_num, const MoeFfnWeight<T>& moe)
+{
+    const int local_expert_num = expert_num / ep_size_;
+
+    auto& load = ep_load_[layer_id];
+
+    std::vector<int64_t> rank_load(ep_size_);
+    for (int e = 0; e < expert_num; ++e) {
+        rank_load[e / local_expert_num] += load[e];
+    }
+
+    std::vector<int> order(expert_num);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return load[a] > load[b]; });
+
+    // Half of the load of the hottest experts goes to the least loaded ranks as long as it lowers the load of the owner
+    std::vector<int> plan(ep_size_, -1);
+    for (const auto& e : order) {
+        const int64_t half = load[e] / 2;
+        if (half == 0) {
+            break;
+        }
+        const int owner = e / local_expert_num;
+        int       dst   = -1;
+        for (int r = 0; r < ep_size_; ++r) {
+            if (r != owner && plan[r] < 0 && (dst < 0 || rank_load[r] < rank_load[dst])) {
+                dst = r;
+            }
+        }
+        if (dst >= 0 && rank_load[dst] + half < rank_load[owner] - half) {
+            plan[dst] = e;
+            rank_load[dst] += half;
+            rank_load[owner] -= half;
+        }
+    }
+
+    // decay the history so that the plan follows the recent routing
+    for (auto& x : load) {
+        x /= 2;
+    }
+
+    auto& replicas = replicas_[layer_id];
+    for (int r = 0; r < ep_size_; ++r) {
+        if (plan[r] >= 0 && plan[r] != replicas[r]) {
+            copy_expert(plan[r], r, expert_num, moe);
+        }
+    }
+
+    if (plan != replicas) {
+        TM_LOG_DEBUG("[MoeFfnLayer] layer %d, replicas %s", layer_id, vec2str(plan).c_str());
+    }
+
+    replicas = std::move(plan);
+}
+
+template<class T>
+void MoeFfnLayer<T>::copy_expert(int expert_id, int dst_rank, int expert_num, const MoeFfnWeight<T>& moe)
+{
+    const int local_expert_num = expert_num / ep_size_;
+    const int src_rank         = expert_id / local_expert_num;
+
+    // the weights of the expert exist on the owner only
+    const LlamaFfnWeight<T>* src = ep_rank_ == src_rank ? &moe.experts.at(expert_id % local_expert_num) : nullptr;
+    const LlamaFfnWeight<T>& dst = moe.replica;
+
+    std::vector<size_t> send_counts(ep_size_);
+    std::vector<size_t> recv_counts(ep_size_);
+    std::vector<size_t> displs(ep_size_);
+
+    // point-to-point copy through the collective, all ranks issue the same sequence
+    auto copy = [&](const void* src_ptr, void* dst_ptr, size_t bytes) {
+        if (ep_rank_ == src_rank) {
+            send_counts[dst_rank] = bytes;
+        }
+        if (ep_rank_ == dst_rank) {
+            recv_counts[src_rank] = bytes;
+        }
+        d_comm_->AllToAllV(src_ptr,
+                           send_counts.data(),
+                           displs.data(),
+                           dst_ptr,
+                           recv_counts.data(),
+                           displs.data(),
+                           TYPE_UINT8,
+                           0,
+                           stream_);
+        sync_check_cuda_error();
+    };
+
+    const auto& fused  = dst.fused_gating_intermediate;
+    const auto& output = dst.output;
+
+    copy(src ? src->fused_gating_intermediate.kernel : nullptr, fused.kernel, fused.kernel_size());
+    copy(src ? src->output.kernel : nullptr, output.kernel, output.kernel_size());
+
+    if (fused.scales_zeros) {  // fused scales & zeros
+        copy(src ? src->fused_gating_intermediate.scales_zeros : nullptr, fused.scales_zeros, fused.scales_size() * 2);
+        copy(src ? src->output.scales_zeros : nullptr, output.scales_zeros, output.scales_size() * 2);
+    }
+}
+
+template<class T>
+std::vector<int> MoeFfnLayer<T>::predict_experts(int tokens, int expert_num) const
+{
+    // the scores are monotonic in the logits, the correction bias & the group limit are ignored for the prediction
+    const int k = std::min(param_.experts_per_token, expert_num);
+
+    std::vector<int> experts;
+    std::vector<int> idxs(expert_num);
+    for (int i = 0; i < tokens; ++i) {
+        const float* logits = h_logits_ + (size_t)i * expert_num;
+        std::iota(idxs.begin(), idxs.end(), 0);
+        std::partial_sort(
+            idxs.begin(), idxs.begin() + k, idxs.end(), [&](int a, int b) { return logits[a] > logits[b]; });
+        experts.insert(experts.end(), idxs.begin(), idxs.begin() + k);
+    }
+    return experts;
+}
+
+template<class T>
+std::vector<std::vector<int64_t>> MoeFfnLayer<T>::GetExpertCounts(bool reset)
+{
+    const size_t layer_num = param_.expert_num.size();
+
+    std::vector<int64_t> buf(layer_num * max_expert_num_);
+
+    // issued on the stream of the engine to stay in order with the counting kernels
+    check_cuda_error(
+        cudaMemcpyAsync(buf.data(), expert_counts_, sizeof(int64_t) * buf.size(), cudaMemcpyDefault, stream_));
+    if (reset) {
+        check_cuda_error(cudaMemsetAsync(expert_counts_, 0, sizeof(int64_t) * buf.size(), stream_));
+    }
+    check_cuda_error(cudaStreamSynchronize(stream_));
 
-        linear_->forward_moe(inout_buf_,
+    std::vector<std::vector<int64_t>> counts(layer_num);
+    for (size_t i = 0; i < layer_num; ++i) {
+        const auto first = buf.begin() + i * max_expert_num_;
+        counts[i].assign(first, first + param_.expert_num[i]);
+    }
+
+    return counts;
+}
+
+template<class T>
+void MoeFfnLayer<T>::reduce(
+    T* output, int tokens, float output_scale, int layer_id, const MoeFfnWeight<T>& moe, const T* shared)
+{
+    const T*     src        = inout_buf_;
+    const float* dst_scales = moe.shared_gate.kernel ? shared_scales_ : nullptr;
+
+    if (scattered_) {
+        scattered_ = false;
+        // scale the shared experts first, then the epilogue of the output projection adds the weighted rows of the
+        // experts to the rows of their tokens, there is no round trip through `inout_buf_`
+        if (tokens && (dst_scales || output_scale != 1.f || shared)) {
+            invokeMoeReduce(output,
+                            (const T*)nullptr,
+                            nullptr,
+                            nullptr,
+                            dst_scales,
+                            tokens,
+                            0,
+                            hidden_dim_,
+                            output_scale,
+                            stream_,
+                            shared);
+            sync_check_cuda_error();
+        }
+        const auto& block = moe.block;
+        linear_->forward_moe(output,
                              {inter_buf_, block.is_fused_silu ? (int)inter_size_ : (int)inter_size_ * 2},
                              nullptr,
                              offsets_,
                              tokens * param_.experts_per_token,
                              block.output,
                              LlamaLinear<T>::kGemm,
-                             context_.get());
+                             context_.get(),
+                             f2n_,
+                             row_scales_);
         sync_check_cuda_error();
-        auto mode1 = kCmpRead;
-
-        // if (tensor_para_.rank_ == 0) {
-        //     Compare(inter_buf_2_,  //
-        //             tokens * param_.experts_per_token * inter_size_,
-        //             "inter_buf_2_",
-        //             mode1,
-        //             stream_);
-        //     Compare(inout_buf_,  //
-        //             tokens * param_.experts_per_token * hidden_dim_,
-        //             "inout_buf",
-        //             mode1,
-        //             stream_);
-        // }
+        return;
     }
 
-    if (moe.shared_gate.kernel) {
-        gate(shared_scales_, input, tokens, moe.shared_gate);
+    if (ep_size_ > 1) {
+        FT_CHECK(!shared);
+        combine(moe);
+        // Partial sums of the ranks are reduced by the following all-reduce, tokens routed by the other ranks only
+        // take the shared experts here
+        if (dst_scales || output_scale != 1.f) {
+            const int last = ep_first_ + ep_tokens_;
+            if (ep_first_) {
+                invokeMoeReduce(output,
+                                (const T*)nullptr,
+                                nullptr,
+                                nullptr,
+                                dst_scales,
+                                ep_first_,
+                                0,
+                                hidden_dim_,
+                                output_scale,
+                                stream_);
+            }
+            if (last < tokens) {
+                invokeMoeReduce(output + (size_t)last * hidden_dim_,
+                                (const T*)nullptr,
+                                nullptr,
+                                nullptr,
+                                dst_scales ? dst_scales + last : nullptr,
+                                tokens - last,
+                                0,
+                                hidden_dim_,
+                                output_scale,
+                                stream_);
+            }
+            sync_check_cuda_error();
+        }
+        output += (size_t)ep_first_ * hidden_dim_;
+        if (dst_scales) {
+            dst_scales += ep_first_;
+        }
+        src    = ep_permute_ ? recv_buf_ : send_buf_;
+        tokens = ep_tokens_;
     }
-}
 
-template<class T>
-void MoeFfnLayer<T>::reduce(T* output, int tokens, float output_scale, int layer_id, const MoeFfnWeight<T>& moe)
-{
-    invokeMoeReduce(output,
-                    inout_buf_,
-                    scales_,
-                    en2f_,
-                    moe.shared_gate.kernel ? shared_scales_ : nullptr,
-                    tokens,
-                    param_.experts_per_token,
-                    hidden_dim_,
-                    output_scale,
-                    stream_);
-    sync_check_cuda_error();
+    if (tokens) {
+        invokeMoeReduce(output,
+                        src,
+                        scales_,
+                        en2f_,
+                        dst_scales,
+                        tokens,
+                        param_.experts_per_token,
+                        hidden_dim_,
+                        output_scale,
+                        stream_,
+                        shared);
+        sync_check_cuda_error();
+    }
 }
 
 template<class T>
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/kernels/gemm/context.h"
 #include "src/turbomind/kernels/gemm/moe_utils_v2.h"
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
@@ -15,24 +16,38 @@ namespace turbomind {
 template<class T>
 class MoeFfnLayer {
 public:
-    MoeFfnLayer(ModelParam model, const MoeParam& param, size_t tp_size, const Context<T>& ctx):
-        inter_size_(param.inter_size / tp_size),
+    MoeFfnLayer(ModelParam model, const MoeParam& param, const EngineParam& engine, const Context<T>& ctx):
+        inter_size_(param.inter_size / (engine.ep_size > 1 ? 1 : engine.mlp_tp_size)),
         hidden_dim_(model.hidden_units),
         param_(param),
+        ep_size_(engine.ep_size),
+        ep_rank_(engine.ep_rank),
+        ep_overlap_(engine.ep_overlap && engine.ep_size > 1),
+        replica_interval_(engine.ep_size > 1 ? engine.moe_replica_interval : 0),
+        scatter_reduce_(engine.moe_scatter_reduce && engine.ep_size == 1 && param.method == MoeParam::kFused),
         dtype_(getTensorType<T>()),
         stream_(ctx.stream),
         cublas_(ctx.cublas_wrapper.get()),
         linear_(ctx.linear.get()),
-        allocator_(ctx.allocator.get())
+        allocator_(ctx.allocator.get()),
+        d_comm_(ctx.comm.d_comm)
     {
         FT_CHECK(!param.expert_num.empty());
         const int max_expert_num = *std::max_element(param.expert_num.begin(), param.expert_num.end());
 
-        if (param_.method == MoeParam::kFused) {
+        max_expert_num_ = max_expert_num;
+
+        if (param_.method == MoeParam::kFused && ep_size_ > 1) {
+            // local experts receive an arbitrary number of rows with expert parallelism, plus the replica slot
+            context_ = std::make_unique<gemm::MoeGemmContext>(
+                max_expert_num / ep_size_ + (replica_interval_ ? 1 : 0), 1, ctx.cuda_device_prop, stream_);
+        }
+        else if (param_.method == MoeParam::kFused) {
             context_ = std::make_unique<gemm::MoeGemmContext>(
                 max_expert_num, param.experts_per_token, ctx.cuda_device_prop, stream_);
         }
         else {
+            FT_CHECK_WITH_INFO(ep_size_ == 1, "expert parallelism requires the fused MoE method");
             expert_ffn_ = std::make_unique<LlamaFfnLayer<T>>(model, ctx);
         }
 
@@ -40,41 +55,113 @@ public:
 
         offsets_ = (int*)allocator_->malloc(sizeof(int) * (max_expert_num + 1));
         accum_   = (int*)allocator_->malloc(sizeof(int) * max_expert_num * kMoeGateMaxTiles);
+
+        expert_counts_ = (int64_t*)allocator_->malloc(sizeof(int64_t) * param.expert_num.size() * max_expert_num);
+
+        if (ep_size_ > 1) {
+            FT_CHECK(d_comm_ && d_comm_->n_ranks(0) == ep_size_);
+            h_ep_offsets_ = (int*)allocator_->malloc(sizeof(int) * ep_size_ * (max_expert_num + 1), false, true);
+            send_counts_.resize(ep_size_);
+            send_displs_.resize(ep_size_);
+            recv_counts_.resize(ep_size_);
+            recv_displs_.resize(ep_size_);
+        }
+
+        if (replica_interval_) {
+            ep_load_.resize(param.expert_num.size());
+            ep_steps_.resize(param.expert_num.size());
+            replicas_.resize(param.expert_num.size(), std::vector<int>(ep_size_, -1));
+        }
+
+        if (engine.moe_expert_cache) {
+            h_logits_ = (float*)allocator_->malloc(sizeof(float) * kPredictTokens * max_expert_num, false, true);
+        }
+
+        if (ep_overlap_) {
+            check_cuda_error(cudaStreamCreateWithFlags(&ep_stream_, cudaStreamNonBlocking));
+            check_cuda_error(cudaEventCreateWithFlags(&ev_before_dispatch_, cudaEventDisableTiming));
+            check_cuda_error(cudaEventCreateWithFlags(&ev_after_dispatch_, cudaEventDisableTiming));
+        }
     }
 
     void AllocateBuffer(size_t tokens, size_t padded, size_t expert_num, size_t inter_buf_factor);
 
     void FreeBuffer();
 
+    // Places the workspace of up to `max_tokens` tokens at `base` instead of reallocating it when the shape changes,
+    // returns the bytes needed. A null `base` only computes the size
+    size_t PlanScratch(void* base, size_t max_tokens);
+
     ~MoeFfnLayer()
     {
         FreeBuffer();
+        if (ep_overlap_) {
+            check_cuda_error(cudaEventDestroy(ev_after_dispatch_));
+            check_cuda_error(cudaEventDestroy(ev_before_dispatch_));
+            check_cuda_error(cudaStreamDestroy(ep_stream_));
+        }
     }
 
+    // With expert parallelism `forward` routes a slice of the tokens and dispatches them to the ranks holding their
+    // experts, the local experts run in `reduce` so that the dispatch may overlap with the shared experts
     void forward(T* output, const T* input, int tokens, int layer_id, const MoeFfnWeight<T>& moe);
 
-    void reduce(T* output, int tokens, float output_scale, int layer_id, const MoeFfnWeight<T>& moe);
+    // `shared` holds the output of the shared experts when they are not computed into `output`
+    void reduce(
+        T* output, int tokens, float output_scale, int layer_id, const MoeFfnWeight<T>& moe, const T* shared = nullptr);
 
     void gate(float* logits, const T* input, int tokens, const LlamaDenseWeight<T>& weight);
 
     void dump_logits(int token_num, int layer_id, int expert_num);
 
+    // Tokens routed to each expert by this rank since the last reset, [layer_num][expert_num]
+    std::vector<std::vector<int64_t>> GetExpertCounts(bool reset);
+
 private:
+    // Carves the buffers of the workspace from `base`, returns the bytes used
+    size_t CarveWorkspace(char* base, size_t tokens, size_t padded, size_t expert_num, size_t inter_buf_factor);
+
+    // A null `output` stops after the activation, the intermediate rows are left in `inter_buf_`
+    void forward_experts(T* output, const T* input, const int* idxs, int rows, const MoeFfnWeight<T>& moe);
+
+    void dispatch(const T* routed_input, int routed, int layer_id, int expert_num, const MoeFfnWeight<T>& moe);
+
+    void combine(const MoeFfnWeight<T>& moe);
+
+    // Assign the replica slots of the ranks to the hottest experts by the accumulated load
+    void rebalance(int layer_id, int expert_num, const MoeFfnWeight<T>& moe);
+
+    void copy_expert(int expert_id, int dst_rank, int expert_num, const MoeFfnWeight<T>& moe);
+
+    // Top experts of each token by the logits of the next layer's gate in `h_logits_`
+    std::vector<int> predict_experts(int tokens, int expert_num) const;
+
+    // the experts of the next layer are predicted for up to this many tokens with the expert cache
+    static constexpr int kPredictTokens = 64;
+
     const size_t           inter_size_;
     const size_t           hidden_dim_;
     const MoeParam         param_;
+    const int              ep_size_;
+    const int              ep_rank_;
+    const bool             ep_overlap_;
+    const int              replica_interval_;
+    const bool             scatter_reduce_;
     const DataType         dtype_;
     cudaStream_t const     stream_;
     cublasMMWrapper* const cublas_;
     LlamaLinear<T>* const  linear_;
     IAllocator* const      allocator_;
 
+    comm::DeviceCommImpl* const d_comm_;
+
     std::unique_ptr<LlamaFfnLayer<T>>     expert_ffn_;
     std::unique_ptr<gemm::MoeGemmContext> context_;
 
     int* h_offsets_{};
 
-    char* workspace_{};
+    char*  workspace_{};
+    size_t scratch_tokens_{};  // capacity of the workspace in the planned scratch
 
     T* inout_buf_{};  // [n * e, hidden_dim]
     T* inter_buf_{};  // [n * e, inter_size]
@@ -85,11 +172,50 @@ private:
     int*   f2n_{};
     int*   en2f_{};
     float* scales_{};
+    float* row_scales_{};  // [n * e], routing weights in the order of the expert rows
+
+    // the output projection of the experts is deferred to `reduce` and adds its rows to the output
+    bool scattered_{};
 
     float* shared_scales_{};
 
     int* accum_{};
     int* offsets_{};
+
+    int      max_expert_num_{};
+    int64_t* expert_counts_{};  // [layer_num, max_expert_num]
+
+    // expert parallelism, the routed slice of the tokens is [ep_first_, ep_first_ + ep_tokens_)
+    int ep_first_{};
+    int ep_tokens_{};
+    int ep_recv_{};  // rows received for the local experts
+    int ep_rows_{};  // capacity of a section of `ep_idxs_`
+
+    bool ep_permute_{};  // rows of the slice are not sent in expert order when a replica is active
+
+    T*   send_buf_{};    // [n_slice * e, hidden_dim], sorted by destination rank then slot
+    T*   recv_buf_{};    // [n * e, hidden_dim], sorted by source rank then slot
+    int* ep_offsets_{};  // [ep_size, expert_num + 1], expert offsets of all ranks
+    int* ep_idxs_{};     // [4, n * e], source rank major <-> slot major, expert major <-> destination rank major
+
+    int* h_ep_offsets_{};
+    int* h_ep_idxs_{};
+
+    std::vector<size_t> send_counts_;
+    std::vector<size_t> send_displs_;
+    std::vector<size_t> recv_counts_;
+    std::vector<size_t> recv_displs_;
+
+    // hot expert replication, the plans are computed from the all-gathered offsets so all ranks agree on them
+    std::vector<std::vector<int64_t>> ep_load_;   // [layer_num][expert_num], decayed at each re-plan
+    std::vector<int>                  ep_steps_;  // [layer_num]
+    std::vector<std::vector<int>>     replicas_;  // [layer_num][ep_size], expert in the replica slot or -1
+
+    float* h_logits_{};  // [kPredictTokens, max_expert_num], of the next layer's gate
+
+    cudaStream_t ep_stream_{};
+    cudaEvent_t  ev_before_dispatch_{};
+    cudaEvent_t  ev_after_dispatch_{};
 };
 
 }  // namespace turbomind
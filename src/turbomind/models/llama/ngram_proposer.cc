@@ -0,0 +1,28 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+
+#include "src/turbomind/models/llama/ngram_proposer.h"
+
+namespace turbomind {
+
+int ProposeNgramDraft(const int* tokens, int len, int max_ngram, int max_draft, int* draft)
+{
+    if (max_draft <= 0) {
+        return 0;
+    }
+    for (int n = std::min(max_ngram, len - 1); n >= 1; --n) {
+        const int* suffix = tokens + len - n;
+        // scan backwards so that the most recent match wins
+        for (int p = len - n - 1; p >= 0; --p) {
+            if (std::equal(suffix, suffix + n, tokens + p)) {
+                const int count = std::min(max_draft, len - (p + n));
+                std::copy_n(tokens + p + n, count, draft);
+                return count;
+            }
+        }
+    }
+    return 0;
+}
+
+}  // namespace turbomind
@@ -0,0 +1,11 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+namespace turbomind {
+
+// Prompt lookup drafting: find the latest earlier occurrence of the longest suffix n-gram (`max_ngram` >= n >= 1) of
+// `tokens[0, len)` and propose at most `max_draft` tokens that followed it. Returns the number of draft tokens.
+int ProposeNgramDraft(const int* tokens, int len, int max_ngram, int max_draft, int* draft);
+
+}  // namespace turbomind
@@ -0,0 +1,45 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/turbomind/models/llama/output_length_predictor.h"
+
+namespace turbomind {
+
+// weight of a new sample in the moving averages, the first samples are averaged evenly
+static constexpr float kAlpha = .1f;
+
+void OutputLengthPredictor::Stats::add(int x)
+{
+    ++count;
+    const float a = std::max(1.f / count, kAlpha);
+    avg += a * (x - avg);
+}
+
+int OutputLengthPredictor::Class(int prompt_len)
+{
+    int c = 0;
+    while (c + 1 < kClasses && (1 << (c + 1)) <= prompt_len) {
+        ++c;
+    }
+    return c;
+}
+
+int OutputLengthPredictor::Predict(int hint, int prompt_len, int max_new_tokens) const
+{
+    if (hint > 0) {
+        return std::min(hint, max_new_tokens);
+    }
+    const auto& c = classes_[Class(prompt_len)];
+    const auto& s = c.count >= kMinSamples ? c : all_;
+    return s.count ? std::min((int)std::ceil(s.avg), max_new_tokens) : max_new_tokens;
+}
+
+void OutputLengthPredictor::Update(int prompt_len, int output_len)
+{
+    classes_[Class(prompt_len)].add(output_len);
+    all_.add(output_len);
+}
+
+}  // namespace turbomind
@@ -0,0 +1,39 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace turbomind {
+
+// Output lengths of the requests for shortest expected job first. The hint of a request (`expected_output_len`) is
+// taken as is, otherwise the estimate is the moving average of the finished outputs with prompts of the same size
+// class (powers of 2), or of all the outputs until the class has `kMinSamples`. Updated identically by the ranks of a
+// batch, the estimates agree
+class OutputLengthPredictor {
+public:
+    // capped by `max_new_tokens`, which is also the estimate before any output finished
+    int Predict(int hint, int prompt_len, int max_new_tokens) const;
+
+    void Update(int prompt_len, int output_len);
+
+    static constexpr int kClasses    = 24;
+    static constexpr int kMinSamples = 8;
+
+private:
+    struct Stats {
+        float   avg{};
+        int64_t count{};
+
+        void add(int x);
+    };
+
+    static int Class(int prompt_len);
+
+private:
+    std::array<Stats, kClasses> classes_{};
+    Stats                       all_{};
+};
+
+}  // namespace turbomind
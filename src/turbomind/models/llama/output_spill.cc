@@ -0,0 +1,123 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cstring>
+
+#include "src/turbomind/models/llama/output_spill.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+OutputSpill::OutputSpill(size_t chunk_size, int chunk_count, IAllocator* allocator):
+    chunk_size_{chunk_size}, allocator_{allocator}, stream_{allocator->returnStream()}
+{
+    data_ = (std::byte*)allocator_->malloc(chunk_size_ * chunk_count, false, true);
+
+    chunks_.resize(chunk_count);
+    for (auto& c : chunks_) {
+        check_cuda_error(cudaEventCreateWithFlags(&c.ev, cudaEventDisableTiming));
+        c.rows = 0;
+    }
+
+    check_cuda_error(cudaStreamCreateWithFlags(&copy_stream_, cudaStreamNonBlocking));
+    check_cuda_error(cudaEventCreateWithFlags(&ev_compute_, cudaEventDisableTiming));
+    check_cuda_error(cudaEventCreateWithFlags(&ev_copy_, cudaEventDisableTiming));
+
+    TM_LOG_INFO("[OutputSpill] %d chunks of %.2f MB", chunk_count, (float)chunk_size_ / (1 << 20));
+}
+
+OutputSpill::~OutputSpill()
+{
+    // the pending chunks belong to requests that are done with
+    cudaStreamSynchronize(copy_stream_);
+    for (auto& c : chunks_) {
+        cudaEventDestroy(c.ev);
+    }
+    cudaEventDestroy(ev_copy_);
+    cudaEventDestroy(ev_compute_);
+    cudaStreamDestroy(copy_stream_);
+    allocator_->free((void**)&data_, true);
+}
+
+void OutputSpill::Drain(Chunk& c, std::byte* data)
+{
+    if (!c.rows) {
+        return;
+    }
+    check_cuda_error(cudaEventSynchronize(c.ev));
+    if (c.dpitch == c.width) {
+        std::memcpy(c.dst, data, c.width * c.rows);
+    }
+    else {
+        for (int i = 0; i < c.rows; ++i) {
+            std::memcpy(c.dst + c.dpitch * i, data + c.width * i, c.width);
+        }
+    }
+    c.rows = 0;
+}
+
+void OutputSpill::Copy2D(void* dst, size_t dpitch, const void* src, size_t spitch, size_t width, int rows)
+{
+    if (rows <= 0) {
+        return;
+    }
+
+    const int chunk_rows = chunk_size_ / width;
+    if (chunk_rows == 0) {
+        // a row does not fit in a chunk
+        check_cuda_error(cudaMemcpy2DAsync(dst, dpitch, src, spitch, width, rows, cudaMemcpyDeviceToHost, stream_));
+        return;
+    }
+
+    // wait for the pending writes to the sources
+    check_cuda_error(cudaEventRecord(ev_compute_, stream_));
+    check_cuda_error(cudaStreamWaitEvent(copy_stream_, ev_compute_));
+
+    for (int i = 0; i < rows; i += chunk_rows) {
+        const int n = std::min(chunk_rows, rows - i);
+        const int k = next_;
+        auto&     c = chunks_[k];
+
+        next_ = (next_ + 1) % chunks_.size();
+
+        // the oldest chunk is reused, its copy is most likely done by now
+        Drain(c, data(k));
+        check_cuda_error(cudaMemcpy2DAsync(data(k),
+                                           width,
+                                           (const std::byte*)src + spitch * i,
+                                           spitch,
+                                           width,
+                                           n,
+                                           cudaMemcpyDeviceToHost,
+                                           copy_stream_));
+        check_cuda_error(cudaEventRecord(c.ev, copy_stream_));
+        c.dst    = (std::byte*)dst + dpitch * i;
+        c.dpitch = dpitch;
+        c.width  = width;
+        c.rows   = n;
+    }
+
+    fence_ = true;
+}
+
+void OutputSpill::Fence()
+{
+    if (!fence_) {
+        return;
+    }
+    check_cuda_error(cudaEventRecord(ev_copy_, copy_stream_));
+    check_cuda_error(cudaStreamWaitEvent(stream_, ev_copy_));
+    fence_ = false;
+}
+
+void OutputSpill::Flush()
+{
+    // in the order of issue
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        const int k = (next_ + i) % chunks_.size();
+        Drain(chunks_[k], data(k));
+    }
+}
+
+}  // namespace turbomind
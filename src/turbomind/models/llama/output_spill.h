@@ -0,0 +1,67 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/utils/allocator.h"
+
+namespace turbomind {
+
+// Streams device rows into pageable host tensors through a ring of pinned chunks. The device -> host copies are
+// issued on a private copy stream, the host copy out of a chunk is deferred until the chunk is reused or the spill
+// is flushed. Neither the host nor the compute stream waits for the copies while the forward goes on.
+class OutputSpill {
+public:
+    OutputSpill(size_t chunk_size, int chunk_count, IAllocator* allocator);
+
+    ~OutputSpill();
+
+    OutputSpill(const OutputSpill&) = delete;
+    OutputSpill& operator=(const OutputSpill&) = delete;
+
+    // `rows` rows of `width` bytes, the pitches of `dst` (host) and `src` (device) are `dpitch` and `spitch`
+    void Copy2D(void* dst, size_t dpitch, const void* src, size_t spitch, size_t width, int rows);
+
+    // the compute stream waits for the pending reads of the sources before they are overwritten
+    void Fence();
+
+    // the outputs are complete on return
+    void Flush();
+
+private:
+    struct Chunk {
+        cudaEvent_t ev;
+        std::byte*  dst;
+        size_t      dpitch;
+        size_t      width;
+        int         rows;  // 0 when there is no pending copy
+    };
+
+    void Drain(Chunk& c, std::byte* data);
+
+    std::byte* data(int chunk) const noexcept
+    {
+        return data_ + chunk_size_ * chunk;
+    }
+
+private:
+    size_t      chunk_size_;
+    IAllocator* allocator_;
+
+    std::byte* data_{};
+
+    std::vector<Chunk> chunks_;
+    int                next_{};
+    bool               fence_{};
+
+    cudaStream_t stream_{};       // compute stream
+    cudaStream_t copy_stream_{};  // spill stream
+    cudaEvent_t  ev_compute_{};
+    cudaEvent_t  ev_copy_{};
+};
+
+}  // namespace turbomind
@@ -0,0 +1,138 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/turbomind/models/llama/sm_partition.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+SmPartition::SmPartition(float ratio)
+{
+    check_cuda_error(cudaEventCreateWithFlags(&fork_event_, cudaEventDisableTiming));
+
+    try {
+        isolated_ = CreateGreenContexts(ratio);
+    }
+    catch (const std::exception& e) {
+        TM_LOG_WARNING("[SmPartition] Failed to create green contexts: %s", e.what());
+        Destroy();
+    }
+
+    if (!isolated_) {
+        int lowest{}, greatest{};
+        check_cuda_error(cudaDeviceGetStreamPriorityRange(&lowest, &greatest));
+        check_cuda_error(cudaStreamCreateWithPriority(&streams_[0], cudaStreamNonBlocking, greatest));
+        check_cuda_error(cudaStreamCreateWithPriority(&streams_[1], cudaStreamNonBlocking, lowest));
+        for (auto& e : join_events_) {
+            check_cuda_error(cudaEventCreateWithFlags(&e, cudaEventDisableTiming));
+        }
+        TM_LOG_WARNING("[SmPartition] Green contexts are not available, the partitions fall back to stream priorities");
+    }
+}
+
+bool SmPartition::CreateGreenContexts(float ratio)
+{
+#if CUDA_VERSION >= 12050
+    int version{};
+    CUDRVCHECK(cuDriverGetVersion(&version));
+    if (version < 12050) {
+        return false;
+    }
+
+    int device_id{};
+    check_cuda_error(cudaGetDevice(&device_id));
+    CUdevice device{};
+    CUDRVCHECK(cuDeviceGet(&device, device_id));
+
+    CUdevResource all{};
+    CUDRVCHECK(cuDeviceGetDevResource(device, &all, CU_DEV_RESOURCE_TYPE_SM));
+
+    const int total = all.sm.smCount;
+    const int count = std::clamp<int>(std::lround(total * ratio), 1, total - 1);
+
+    // the count is rounded up to the granularity of the device, the rest goes to the 2nd partition
+    std::array<CUdevResource, 2> parts{};
+    unsigned                     groups = 1;
+    CUDRVCHECK(cuDevSmResourceSplitByCount(&parts[0], &groups, &all, &parts[1], 0, count));
+    if (groups != 1 || parts[1].sm.smCount == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        CUdevResourceDesc desc{};
+        CUDRVCHECK(cuDevResourceGenerateDesc(&desc, &parts[i], 1));
+        CUDRVCHECK(cuGreenCtxCreate(&green_ctxs_[i], desc, device, CU_GREEN_CTX_DEFAULT_STREAM));
+
+        CUstream stream{};
+        CUDRVCHECK(cuGreenCtxStreamCreate(&stream, green_ctxs_[i], CU_STREAM_NON_BLOCKING, 0));
+        streams_[i] = stream;
+
+        // events recorded on the stream are created in its context
+        CUcontext ctx{};
+        CUDRVCHECK(cuCtxFromGreenCtx(&ctx, green_ctxs_[i]));
+        CUDRVCHECK(cuCtxPushCurrent(ctx));
+        CUevent event{};
+        const auto ec = cuEventCreate(&event, CU_EVENT_DISABLE_TIMING);
+        CUDRVCHECK(cuCtxPopCurrent(&ctx));
+        CUDRVCHECK(ec);
+        join_events_[i] = event;
+    }
+
+    TM_LOG_INFO("[SmPartition] %d SMs partitioned as %d + %d",
+                total,
+                (int)parts[0].sm.smCount,
+                (int)parts[1].sm.smCount);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SmPartition::Destroy()
+{
+    for (int i = 0; i < 2; ++i) {
+        if (join_events_[i]) {
+            check_cuda_error(cudaEventDestroy(join_events_[i]));
+        }
+        if (streams_[i]) {
+            check_cuda_error(cudaStreamSynchronize(streams_[i]));
+            check_cuda_error(cudaStreamDestroy(streams_[i]));
+        }
+#if CUDA_VERSION >= 12050
+        if (green_ctxs_[i]) {
+            CUDRVCHECK(cuGreenCtxDestroy(green_ctxs_[i]));
+        }
+        green_ctxs_[i] = {};
+#endif
+        join_events_[i] = {};
+        streams_[i]     = {};
+    }
+}
+
+SmPartition::~SmPartition()
+{
+    Destroy();
+    check_cuda_error(cudaEventDestroy(fork_event_));
+}
+
+void SmPartition::Fork(cudaStream_t stream)
+{
+    check_cuda_error(cudaEventRecord(fork_event_, stream));
+    for (const auto& s : streams_) {
+        check_cuda_error(cudaStreamWaitEvent(s, fork_event_));
+    }
+}
+
+void SmPartition::Join(cudaStream_t stream)
+{
+    for (int i = 0; i < 2; ++i) {
+        check_cuda_error(cudaEventRecord(join_events_[i], streams_[i]));
+        check_cuda_error(cudaStreamWaitEvent(stream, join_events_[i]));
+    }
+}
+
+}  // namespace turbomind
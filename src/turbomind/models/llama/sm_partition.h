@@ -0,0 +1,57 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <array>
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+namespace turbomind {
+
+// A pair of streams on disjoint SM partitions of the current device, the 1st one with `ratio` of the SMs. The
+// partitions are green contexts of the driver (CUDA 12.5+), otherwise the streams only differ in priority with the
+// 1st one scheduled first.
+class SmPartition {
+public:
+    explicit SmPartition(float ratio);
+
+    ~SmPartition();
+
+    SmPartition(const SmPartition&) = delete;
+    SmPartition& operator=(const SmPartition&) = delete;
+
+    cudaStream_t stream(int i) const noexcept
+    {
+        return streams_[i];
+    }
+
+    // make both streams wait for the work of `stream` so far
+    void Fork(cudaStream_t stream);
+
+    // make `stream` wait for the work of both streams so far
+    void Join(cudaStream_t stream);
+
+    bool isolated() const noexcept
+    {
+        return isolated_;
+    }
+
+private:
+    bool CreateGreenContexts(float ratio);
+
+    void Destroy();
+
+private:
+    bool isolated_{};
+
+    std::array<cudaStream_t, 2> streams_{};
+    std::array<cudaEvent_t, 2>  join_events_{};  // in the context of each stream
+    cudaEvent_t                 fork_event_{};
+
+#if CUDA_VERSION >= 12050
+    std::array<CUgreenCtx, 2> green_ctxs_{};
+#endif
+};
+
+}  // namespace turbomind
@@ -0,0 +1,61 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+namespace turbomind {
+
+// Blocks always attended by block-sparse decoding on top of the top-k blocks, the leading blocks (attention sinks)
+// and the complete blocks right before the block of the decoding token
+inline constexpr int kSparseSinkBlocks   = 1;
+inline constexpr int kSparseRecentBlocks = 2;
+
+// Contexts of the decoding sequences under block-sparse decoding, where each sequence attends to `width` blocks of
+// its context at most. Packed in a single int buffer, the header is followed by
+//   cu_k_len     [batch_size + 1], lengths of the sparse contexts
+//   offset       [batch_size], positions of the tokens ahead of their indices in the sparse contexts
+//   cu_block_num [batch_size], offsets of the rows of the sparse block table
+struct SparseLayout {
+    static constexpr int kHeader = 4;
+
+    int batch_size;
+    int width;          // blocks per row of the sparse block table
+    int max_k_len;      // of the sparse contexts
+    int max_block_num;  // of the full contexts
+
+    static SparseLayout Load(const int* buf)
+    {
+        return {buf[0], buf[1], buf[2], buf[3]};
+    }
+
+    void Store(int* buf) const
+    {
+        buf[0] = batch_size;
+        buf[1] = width;
+        buf[2] = max_k_len;
+        buf[3] = max_block_num;
+    }
+
+    int cu_k_len() const
+    {
+        return kHeader;
+    }
+    int offset() const
+    {
+        return cu_k_len() + batch_size + 1;
+    }
+    int cu_block_num() const
+    {
+        return offset() + batch_size;
+    }
+    int size() const
+    {
+        return cu_block_num() + batch_size;
+    }
+
+    static int max_size(int batch_size)
+    {
+        return SparseLayout{batch_size}.size();
+    }
+};
+
+}  // namespace turbomind
@@ -0,0 +1,43 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/state_pool.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+StatePool::StatePool(size_t state_size, int slot_count, IAllocator* allocator):
+    state_size_{state_size}, allocator_{allocator}, slots_(slot_count)
+{
+    FT_CHECK(state_size_ > 0 && slot_count > 0);
+    data_ = (std::byte*)allocator_->malloc(state_size_ * slot_count);
+    for (int i = slot_count - 1; i >= 0; --i) {
+        free_.push_back(i);
+    }
+    TM_LOG_INFO("[StatePool] %d slots of %.2f MB", slot_count, state_size_ / (1024. * 1024.));
+}
+
+StatePool::~StatePool()
+{
+    allocator_->free((void**)&data_);
+}
+
+int StatePool::Acquire(uint64_t owner)
+{
+    if (free_.empty()) {
+        return -1;
+    }
+    const int slot = free_.back();
+    free_.pop_back();
+    slots_[slot] = {owner, timestamp_++, true};
+    return slot;
+}
+
+void StatePool::Release(int slot)
+{
+    FT_CHECK(slots_[slot].used);
+    slots_[slot].used = false;
+    free_.push_back(slot);
+}
+
+}  // namespace turbomind
@@ -0,0 +1,79 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "src/turbomind/utils/allocator.h"
+
+namespace turbomind {
+
+// Fixed size recurrent states of the linear attention / state space layers of hybrid models, a slot per sequence
+// alongside its k/v blocks. The memory of a sequence doesn't grow with its length. A slot is kept by its sequence
+// until the sequence is erased or an idle sequence is robbed of it in LRU order.
+class StatePool {
+public:
+    StatePool(size_t state_size, int slot_count, IAllocator* allocator);
+
+    ~StatePool();
+
+    StatePool(const StatePool&) = delete;
+    StatePool& operator=(const StatePool&) = delete;
+
+    // a free slot for sequence `owner`, -1 when there is none
+    int Acquire(uint64_t owner);
+
+    void Release(int slot);
+
+    // mark the slot used in this step
+    void Touch(int slot)
+    {
+        slots_[slot].timestamp = timestamp_++;
+    }
+
+    // the owner of each used slot and its last use, for picking the slot of an idle sequence
+    template<class F>
+    void ForEachUsed(F&& f) const
+    {
+        for (int i = 0; i < (int)slots_.size(); ++i) {
+            if (slots_[i].used) {
+                f(i, slots_[i].owner, slots_[i].timestamp);
+            }
+        }
+    }
+
+    void* data(int slot) const noexcept
+    {
+        return data_ + state_size_ * slot;
+    }
+
+    size_t state_size() const noexcept
+    {
+        return state_size_;
+    }
+
+    int free_count() const noexcept
+    {
+        return (int)free_.size();
+    }
+
+private:
+    struct Slot {
+        uint64_t owner;
+        uint64_t timestamp;
+        bool     used;
+    };
+
+    size_t state_size_;
+
+    IAllocator* allocator_;
+    std::byte*  data_{};
+
+    std::vector<Slot> slots_;
+    std::vector<int>  free_;
+    uint64_t          timestamp_{};
+};
+
+}  // namespace turbomind
@@ -0,0 +1,263 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/turbomind/models/llama/step_profiler.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/tracer.h"
+
+namespace turbomind {
+
+static int PhaseSize(StepProfiler::Phase phase, int layer_num)
+{
+    return phase == StepProfiler::kStep || phase == StepProfiler::kSampling ? 1 : layer_num;
+}
+
+StepProfiler::StepProfiler(int layer_num, int interval):
+    layer_num_{layer_num}, interval_{interval}, open_(kPhaseNum, -1)
+{
+    FT_CHECK(layer_num > 0 && interval > 0);
+
+    check_cuda_error(cudaGetDevice(&device_id_));
+
+    int size = 0;
+    for (int i = 0; i < kPhaseNum; ++i) {
+        size += PhaseSize((Phase)i, layer_num_);
+    }
+    hists_.resize(size);
+    step_us_.resize(size);
+
+    thread_ = std::thread(&StepProfiler::InternalThreadEntry, this);
+
+    TM_LOG_INFO("[StepProfiler] profiling 1 step in %d", interval_);
+}
+
+StepProfiler::~StepProfiler()
+{
+    {
+        std::lock_guard lock{queue_mutex_};
+        stop_ = true;
+    }
+    queue_cv_.notify_one();
+    thread_.join();
+
+    for (const auto& r : ranges_) {
+        free_.push_back(r.begin);
+        free_.push_back(r.end);
+    }
+    free_.insert(free_.end(), returned_.begin(), returned_.end());
+    for (const auto& e : free_) {
+        check_cuda_error(cudaEventDestroy(e));
+    }
+    if (ref_stream_) {
+        check_cuda_error(cudaEventDestroy(ref_event_));
+        check_cuda_error(cudaStreamDestroy(ref_stream_));
+    }
+}
+
+int StepProfiler::Index(Phase phase, int layer) const noexcept
+{
+    int index = 0;
+    for (int i = 0; i < phase; ++i) {
+        index += PhaseSize((Phase)i, layer_num_);
+    }
+    return index + (PhaseSize(phase, layer_num_) > 1 ? layer : 0);
+}
+
+std::pair<StepProfiler::Phase, int> StepProfiler::Decode(int index) const noexcept
+{
+    int phase = 0;
+    for (; phase < kPhaseNum - 1 && index >= PhaseSize((Phase)phase, layer_num_); ++phase) {
+        index -= PhaseSize((Phase)phase, layer_num_);
+    }
+    return {(Phase)phase, index};
+}
+
+cudaEvent_t StepProfiler::Acquire()
+{
+    if (free_.empty()) {
+        std::lock_guard lock{queue_mutex_};
+        free_.swap(returned_);
+    }
+    if (!free_.empty()) {
+        auto e = free_.back();
+        free_.pop_back();
+        return e;
+    }
+    cudaEvent_t e{};
+    check_cuda_error(cudaEventCreate(&e));
+    return e;
+}
+
+bool StepProfiler::BeginStep()
+{
+    active_ = step_++ % interval_ == 0;
+    return active_;
+}
+
+void StepProfiler::EndStep()
+{
+    if (!active_) {
+        return;
+    }
+    // Ranges left open by an early exit are dropped
+    for (auto& i : open_) {
+        if (i >= 0) {
+            free_.push_back(ranges_[i].begin);
+            ranges_[i].begin = {};
+            i                = -1;
+        }
+    }
+    ranges_.erase(std::remove_if(ranges_.begin(), ranges_.end(), [](auto& r) { return !r.begin; }), ranges_.end());
+    {
+        std::lock_guard lock{queue_mutex_};
+        queue_.push_back(std::move(ranges_));
+    }
+    queue_cv_.notify_one();
+    ranges_ = {};
+    active_ = false;
+}
+
+void StepProfiler::Begin(Phase phase, int layer, cudaStream_t stream)
+{
+    if (!active_) {
+        return;
+    }
+    FT_CHECK(open_[phase] < 0);
+    auto e = Acquire();
+    check_cuda_error(cudaEventRecord(e, stream));
+    open_[phase] = ranges_.size();
+    ranges_.push_back({Index(phase, layer), e, {}});
+}
+
+void StepProfiler::End(Phase phase, int layer, cudaStream_t stream)
+{
+    if (!active_) {
+        return;
+    }
+    auto& i = open_[phase];
+    FT_CHECK(i >= 0 && ranges_[i].index == Index(phase, layer));
+    auto e = Acquire();
+    check_cuda_error(cudaEventRecord(e, stream));
+    ranges_[i].end = e;
+    i              = -1;
+}
+
+void StepProfiler::InternalThreadEntry()
+{
+    check_cuda_error(cudaSetDevice(device_id_));
+
+    while (true) {
+        std::vector<Range> ranges;
+        {
+            std::unique_lock lock{queue_mutex_};
+            queue_cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            ranges = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        std::fill(step_us_.begin(), step_us_.end(), -1.);
+        for (const auto& r : ranges) {
+            check_cuda_error(cudaEventSynchronize(r.end));
+            float ms{};
+            check_cuda_error(cudaEventElapsedTime(&ms, r.begin, r.end));
+            step_us_[r.index] = std::max(step_us_[r.index], 0.) + ms * 1000.;
+        }
+
+        if (Tracer::instance().enabled()) {
+            Trace(ranges);
+        }
+
+        {
+            std::lock_guard lock{hist_mutex_};
+            for (size_t i = 0; i < hists_.size(); ++i) {
+                if (const double us = step_us_[i]; us >= 0) {
+                    auto&     h = hists_[i];
+                    const int b = us < 1 ? 0 : std::min<int>(std::log2(us), kBucketNum - 1);
+                    h.count += 1;
+                    h.sum_us += us;
+                    h.max_us = std::max(h.max_us, us);
+                    h.buckets[b] += 1;
+                }
+            }
+        }
+
+        std::lock_guard lock{queue_mutex_};
+        for (const auto& r : ranges) {
+            returned_.push_back(r.begin);
+            returned_.push_back(r.end);
+        }
+    }
+}
+
+void StepProfiler::Calibrate()
+{
+    if (!ref_stream_) {
+        check_cuda_error(cudaStreamCreateWithFlags(&ref_stream_, cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreate(&ref_event_));
+    }
+    // the private stream is idle, the event completes about when it is recorded
+    check_cuda_error(cudaEventRecord(ref_event_, ref_stream_));
+    check_cuda_error(cudaEventSynchronize(ref_event_));
+    ref_us_ = Tracer::now();
+}
+
+int64_t StepProfiler::HostTime(cudaEvent_t e) const
+{
+    float ms{};
+    // the events recorded before the reference, whether a negative time is reported depends on the runtime
+    if (cudaEventElapsedTime(&ms, ref_event_, e) != cudaSuccess) {
+        (void)cudaGetLastError();
+        check_cuda_error(cudaEventElapsedTime(&ms, e, ref_event_));
+        ms = -ms;
+    }
+    return ref_us_ + (int64_t)(ms * 1000.);
+}
+
+void StepProfiler::Trace(const std::vector<Range>& ranges)
+{
+    // the clocks are re-aligned after the events of the step are resolved, that bounds the drift
+    if (!ref_stream_ || Tracer::now() - ref_us_ > 1000000) {
+        Calibrate();
+    }
+    auto& tracer = Tracer::instance();
+    for (const auto& r : ranges) {
+        const auto [phase, layer] = Decode(r.index);
+        const auto begin          = HostTime(r.begin);
+        const auto end            = HostTime(r.end);
+        if (PhaseSize(phase, layer_num_) > 1) {
+            tracer.Add(name(phase), begin, end, device_id_, Tracer::kDeviceTrack, {{"layer", layer}});
+        }
+        else {
+            tracer.Add(name(phase), begin, end, device_id_, Tracer::kDeviceTrack);
+        }
+    }
+}
+
+std::vector<std::vector<StepProfiler::Histogram>> StepProfiler::Get(bool reset)
+{
+    std::vector<std::vector<Histogram>> ret(kPhaseNum);
+
+    std::lock_guard lock{hist_mutex_};
+    for (int i = 0; i < kPhaseNum; ++i) {
+        const int offset = Index((Phase)i, 0);
+        ret[i].assign(hists_.begin() + offset, hists_.begin() + offset + PhaseSize((Phase)i, layer_num_));
+    }
+    if (reset) {
+        std::fill(hists_.begin(), hists_.end(), Histogram{});
+    }
+    return ret;
+}
+
+const char* StepProfiler::name(Phase phase)
+{
+    static constexpr const char* names[]{"step", "attention", "ffn", "comm", "sampling"};
+    return names[phase];
+}
+
+}  // namespace turbomind
@@ -0,0 +1,151 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cuda_runtime.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace turbomind {
+
+// Times the phases of one forward step in `interval` with CUDA events. The events are resolved by a background
+// thread so the infer thread never waits for the device, the overhead of the steps not sampled is a branch.
+//
+// Timings are accumulated per step (mini-batches and the 2 all-reduces of a layer add up) and then binned into
+// histograms of log2 microseconds. When the `Tracer` is enabled the ranges are also device spans of the timeline,
+// placed on the host clock by an event of a private stream synchronized about once a second.
+class StepProfiler {
+public:
+    enum Phase
+    {
+        kStep,
+        kAttention,
+        kFfn,
+        kComm,
+        kSampling,
+        kPhaseNum
+    };
+
+    static constexpr int kBucketNum = 24;  // bucket `i` is [2^i, 2^(i+1)) us, the first & last are open
+
+    struct Histogram {
+        int64_t count;
+        double  sum_us;
+        double  max_us;
+        int64_t buckets[kBucketNum];
+    };
+
+    StepProfiler(int layer_num, int interval);
+
+    ~StepProfiler();
+
+    StepProfiler(const StepProfiler&) = delete;
+    StepProfiler& operator=(const StepProfiler&) = delete;
+
+    // Returns whether the step is sampled
+    bool BeginStep();
+
+    void EndStep();
+
+    bool active() const noexcept
+    {
+        return active_;
+    }
+
+    // `layer` is ignored for `kStep` & `kSampling`, no-ops when the step is not sampled
+    void Begin(Phase phase, int layer, cudaStream_t stream);
+
+    void End(Phase phase, int layer, cudaStream_t stream);
+
+    // [phase][layer], `kStep` & `kSampling` have a single entry. Thread-safe
+    std::vector<std::vector<Histogram>> Get(bool reset);
+
+    static const char* name(Phase phase);
+
+private:
+    struct Range {
+        int         index;  // into `hists_`
+        cudaEvent_t begin;
+        cudaEvent_t end;
+    };
+
+    int Index(Phase phase, int layer) const noexcept;
+
+    std::pair<Phase, int> Decode(int index) const noexcept;
+
+    void Calibrate();
+
+    // host time of a resolved event
+    int64_t HostTime(cudaEvent_t e) const;
+
+    void Trace(const std::vector<Range>& ranges);
+
+    cudaEvent_t Acquire();
+
+    void InternalThreadEntry();
+
+private:
+    const int layer_num_;
+    const int interval_;
+    int       device_id_;
+
+    int64_t step_{};
+    bool    active_{};
+
+    std::vector<Range> ranges_;  // of the current step
+    std::vector<int>   open_;    // open range of each phase
+
+    std::vector<cudaEvent_t> free_;  // by the infer thread only
+
+    std::mutex                     queue_mutex_;
+    std::condition_variable        queue_cv_;
+    std::deque<std::vector<Range>> queue_;
+    std::vector<cudaEvent_t>       returned_;  // resolved events
+    bool                           stop_{};
+
+    std::mutex             hist_mutex_;
+    std::vector<Histogram> hists_;
+    std::vector<double>    step_us_;  // by the background thread only
+
+    // by the background thread only
+    cudaStream_t ref_stream_{};
+    cudaEvent_t  ref_event_{};
+    int64_t      ref_us_{};  // host time of `ref_event_`
+
+    std::thread thread_;
+};
+
+// RAII range of a phase
+class ProfileScope {
+public:
+    ProfileScope(StepProfiler* profiler, StepProfiler::Phase phase, int layer, cudaStream_t stream):
+        profiler_{profiler && profiler->active() ? profiler : nullptr}, phase_{phase}, layer_{layer}, stream_{stream}
+    {
+        if (profiler_) {
+            profiler_->Begin(phase_, layer_, stream_);
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if (profiler_) {
+            profiler_->End(phase_, layer_, stream_);
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    StepProfiler*       profiler_;
+    StepProfiler::Phase phase_;
+    int                 layer_;
+    cudaStream_t        stream_;
+};
+
+}  // namespace turbomind
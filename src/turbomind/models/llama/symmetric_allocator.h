@@ -0,0 +1,78 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include "src/turbomind/comm/device_comm.h"
+#include "src/turbomind/utils/allocator.h"
+#include "src/turbomind/utils/cuda_utils.h"
+
+namespace turbomind {
+
+// Device memory from the allocator of the device communicator, which is mapped into the address space of every rank
+// of the communicator in the process, so peer ranks can read it directly in their kernels. Host memory is served by
+// `base`. Buffers are not registered, the registration is collective while the chunks of the kv cache are allocated
+// independently by each rank
+class SymmetricAllocator: public IAllocator {
+public:
+    SymmetricAllocator(comm::DeviceCommImpl* comm, IAllocator* base): comm_{comm}, base_{base}
+    {
+        stream_ = base_->returnStream();
+    }
+
+    void* malloc(size_t size, const bool is_set_zero = true, bool is_host = false) override
+    {
+        if (is_host) {
+            return base_->malloc(size, is_set_zero, is_host);
+        }
+        auto ptr = comm_->Allocate(size);
+        if (is_set_zero) {
+            memSet(ptr, 0, size);
+        }
+        return ptr;
+    }
+
+    void free(void** ptr, bool is_host = false) override
+    {
+        if (is_host) {
+            return base_->free(ptr, is_host);
+        }
+        if (*ptr) {
+            check_cuda_error(cudaStreamSynchronize(stream_));
+            comm_->Free(*ptr);
+            *ptr = {};
+        }
+    }
+
+    void setStream(cudaStream_t stream) override
+    {
+        stream_ = stream;
+    }
+
+    cudaStream_t returnStream() override
+    {
+        return stream_;
+    }
+
+    void memSet(void* ptr, const int val, const size_t size) override
+    {
+        check_cuda_error(cudaMemsetAsync(ptr, val, size, stream_));
+    }
+
+protected:
+    bool isExist(void* address) const override
+    {
+        return false;
+    }
+
+    ReallocType isReMalloc(void* address, size_t size) const override
+    {
+        return ReallocType::INCREASE;
+    }
+
+private:
+    comm::DeviceCommImpl* comm_;
+    IAllocator*           base_;
+    cudaStream_t          stream_{};
+};
+
+}  // namespace turbomind
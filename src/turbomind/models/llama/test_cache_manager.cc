@@ -1,6 +1,7 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
 #include "BlockManager.h"
+#include "BlockTrie.h"
 #include "SequenceManager.h"
 
 #include "src/turbomind/utils/allocator.h"
@@ -8,6 +9,8 @@
 #include "src/turbomind/utils/debug_utils.h"
 #include <catch2/catch_test_macros.hpp>
 #include <iterator>
+#include <random>
+#include <unordered_map>
 
 using namespace turbomind;
 
@@ -64,6 +67,79 @@ TEST_CASE("BlockManager")
     REQUIRE(m.cached_count() == 16);
 }
 
+TEST_CASE("BlockManager shared blocks")
+{
+    Allocator<AllocatorType::CUDA> allocator(0);
+
+    BlockManager m(1024, 32, 8, &allocator);
+
+    auto [blocks, unique_ids] = m.Allocate(4);
+    m.Share(blocks);  // held by a fork
+    m.Touch(blocks);
+    REQUIRE(m.Unlock(blocks) == 4);
+
+    m.Free(blocks);  // the fork still holds them
+    REQUIRE(m.cached_count() == 4);
+    REQUIRE(m.Verify(blocks, unique_ids) == 4);
+
+    m.Free(blocks);
+    REQUIRE(m.cached_count() == 0);
+    REQUIRE(m.free_count() == 32);
+}
+
+TEST_CASE("BlockManager 2Q eviction")
+{
+    Allocator<AllocatorType::CUDA> allocator(0);
+
+    BlockManager m(1024, 32, 8, &allocator, {}, 0, EvictionPolicy::k2Q);
+
+    auto [shared, shared_ids] = m.Allocate(4);
+    m.Touch(shared);
+    m.Hit(shared);  // reused by prefix matching
+    m.Unlock(shared);
+
+    auto [once, once_ids] = m.Allocate(4);
+    m.Touch(once);
+    m.Unlock(once);
+
+    // the older but hit blocks survive
+    m.Evict(4);
+    REQUIRE(m.Verify(shared, shared_ids) == 4);
+    REQUIRE(m.Verify(once, once_ids) == 0);
+}
+
+TEST_CASE("BlockManager shared pool")
+{
+    Allocator<AllocatorType::CUDA> allocator(0);
+
+    auto pool  = std::make_shared<KvCachePool>(32 * 1024);
+    auto agree = [](int x) { return x; };  // single rank
+
+    BlockManager a(1024, 0, 8, &allocator, {}, 0, EvictionPolicy::kLRU, {pool, pool->Join(0, 0), agree});
+    BlockManager b(1024, 0, 8, &allocator, {}, 0, EvictionPolicy::kLRU, {pool, pool->Join(8 * 1024, 0), agree});
+    REQUIRE(a.free_count() == 0);
+
+    // the guarantee of `b` is kept
+    a.Rebalance(32);
+    REQUIRE(a.free_count() == 24);
+
+    auto [blocks, unique_ids] = a.Allocate(24);
+    a.Touch(blocks);
+    a.Unlock(blocks);
+    REQUIRE(a.cached_count() == 24);
+
+    // `a` is asked to give back a chunk
+    b.Rebalance(16);
+    REQUIRE(b.free_count() == 8);
+
+    a.Rebalance(0);
+    REQUIRE(a.cached_count() == 16);
+    REQUIRE(a.Verify(blocks, unique_ids) == 16);
+
+    b.Rebalance(16);
+    REQUIRE(b.free_count() == 16);
+}
+
 TEST_CASE("SequenceManager basic test")
 {
     Allocator<AllocatorType::CUDA> allocator(0);
@@ -114,3 +190,179 @@ TEST_CASE("SequenceManager functional test")
         }
     }
 }
+
+namespace turbomind {
+size_t hash(const std::vector<int>& vec);  // of the tokens of a block
+}
+
+TEST_CASE("ChainTable")
+{
+    ChainTable                        table;
+    std::unordered_map<uint64_t, int> ref;
+    std::mt19937_64                   gen{0};
+
+    // keys of a small range to get long clusters, enough of them to grow the table
+    for (int i = 0; i < 8192; ++i) {
+        const uint64_t key = gen() % 4096;
+        if (auto it = ref.find(key); it != ref.end()) {
+            REQUIRE(table.find(key) == it->second);
+            table.erase(key);
+            ref.erase(it);
+        }
+        else {
+            table.insert(key, i);
+            ref.emplace(key, i);
+        }
+        REQUIRE(table.size() == ref.size());
+    }
+    for (uint64_t key = 0; key < 4096; ++key) {
+        const auto it = ref.find(key);
+        REQUIRE(table.find(key) == (it != ref.end() ? it->second : -1));
+    }
+}
+
+struct BlockTrieTest {
+    explicit BlockTrieTest(size_t block_len = 4): block_len{block_len} {}
+
+    // tokens of `prompt` matched in the trie, the prompt is then prefilled & cached like a sequence of the manager
+    // and its blocks are released
+    int Prefill(const std::vector<int>& prompt)
+    {
+        Sequence seq{next_id++};
+        seq.prompt    = prompt;
+        const int len = trie.match({&seq})[0];
+
+        const int count              = (prompt.size() + block_len - 1) / block_len;
+        auto [block_ids, unique_ids] = blocks->Allocate(count - seq.blocks.size());
+        seq.blocks.insert(seq.blocks.end(), block_ids.begin(), block_ids.end());
+        seq.block_unique_ids.insert(seq.block_unique_ids.end(), unique_ids.begin(), unique_ids.end());
+        seq.cache_len = prompt.size();
+
+        trie.cache(seq);
+        blocks->Touch(seq.blocks);
+        blocks->Unlock(seq.blocks);
+        last_blocks = seq.blocks;
+        return len;
+    }
+
+    // tokens of `prompt` matched in the trie without caching it
+    int Match(const std::vector<int>& prompt)
+    {
+        Sequence seq{next_id++};
+        seq.prompt    = prompt;
+        const int len = trie.match({&seq})[0];
+        blocks->Touch(seq.blocks);
+        blocks->Unlock(seq.blocks);
+        return len;
+    }
+
+    size_t                           block_len;
+    Allocator<AllocatorType::CUDA>   allocator{0};
+    std::shared_ptr<BlockManager>    blocks{std::make_shared<BlockManager>(1024, 32, 8, &allocator, GetFreeMemSize{})};
+    std::vector<std::pair<int, int>> copies;
+    BlockTrie trie{block_len, blocks, true, {}, [this](int src, int dst) { copies.emplace_back(src, dst); }};
+    uint64_t  next_id{1};
+    BlockIds  last_blocks;
+};
+
+TEST_CASE("BlockTrie match, insert & erase")
+{
+    BlockTrieTest t;
+
+    const std::vector<int> a{0, 1, 2, 3, 4, 5, 6, 7, 8};
+    REQUIRE(t.Prefill(a) == 0);
+    // 2 full blocks & the partial last one
+    REQUIRE(t.trie.verify() == 4);
+
+    // the block holding the last token is always computed
+    REQUIRE(t.Match(a) == 8);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7}) == 4);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}) == 9);  // with a copy of the partial block
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 0, 8, 9}) == 4);
+    REQUIRE(t.Match({1, 1, 2, 3, 4, 5, 6, 7, 8, 9}) == 0);
+
+    // caching a matched path adds its new blocks only
+    REQUIRE(t.Prefill({0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4}) == 8);
+    REQUIRE(t.trie.verify() == 6);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4}) == 12);
+
+    // the nodes of the freed blocks are erased
+    t.blocks->Free({t.last_blocks[2], t.last_blocks[3]});
+    REQUIRE(t.trie.verify() == 4);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4}) == 8);
+}
+
+TEST_CASE("BlockTrie evicted parent")
+{
+    BlockTrieTest t;
+
+    const std::vector<int> a{0, 1, 2, 3, 4, 5, 6, 7, 8};
+    t.Prefill(a);
+    const auto a_blocks = t.last_blocks;
+
+    // the child outlives the first block
+    t.blocks->Free({a_blocks[0]});
+    REQUIRE(t.trie.verify() == 3);
+    REQUIRE(t.Match(a) == 0);
+
+    // the first block cached again by another prompt is a new parent, the child of the old one is not matched
+    // under it
+    t.Prefill({0, 1, 2, 3, 9});
+    REQUIRE(t.Match(a) == 4);
+
+    // until the path is cached again
+    REQUIRE(t.Prefill(a) == 4);
+    REQUIRE(t.Match(a) == 8);
+}
+
+TEST_CASE("BlockTrie hash collisions")
+{
+    BlockTrieTest t(3);
+
+    // blocks of the same hash
+    const std::vector<int> x{1, 2, 3};
+    const std::vector<int> y{18, -61078107, -713545663};
+    REQUIRE(hash(x) == hash(y));
+
+    REQUIRE(t.Prefill({1, 2, 3, 4}) == 0);
+    REQUIRE(t.Match({18, -61078107, -713545663, 4}) == 0);
+
+    // the prompt of the colliding block is not cached, the cached one is kept
+    REQUIRE(t.Prefill({18, -61078107, -713545663, 4}) == 0);
+    REQUIRE(t.Match({18, -61078107, -713545663, 4}) == 0);
+    REQUIRE(t.Match({1, 2, 3, 4}) == 3);
+
+    // nor is a colliding child
+    REQUIRE(t.Prefill({0, 0, 0, 1, 2, 3, 4}) == 0);
+    REQUIRE(t.Match({0, 0, 0, 18, -61078107, -713545663, 4}) == 3);
+}
+
+TEST_CASE("BlockTrie partial last blocks")
+{
+    BlockTrieTest t;
+
+    const std::vector<int> a{0, 1, 2, 3, 4, 5};
+    t.Prefill(a);
+    const auto a_blocks = t.last_blocks;
+    REQUIRE(t.trie.verify() == 3);
+
+    // the partial block is copied for the prompts extending it
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7}) == 6);
+    REQUIRE(t.copies.size() == 1);
+    REQUIRE(t.copies[0].first == a_blocks[1]);
+
+    // or not when it's a prefix that differs, or holds the last token of the prompt
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 0, 6, 7}) == 4);
+    REQUIRE(t.Match(a) == 4);
+    REQUIRE(t.copies.size() == 1);
+
+    // the longest partial node of the parent holding a prefix of the prompt
+    t.Prefill({0, 1, 2, 3, 4, 5, 6});
+    REQUIRE(t.trie.verify() == 4);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 6, 7}) == 7);
+    REQUIRE(t.Match({0, 1, 2, 3, 4, 5, 7, 7}) == 6);
+
+    // the partial node of a freed block is erased
+    t.blocks->Free({a_blocks[1]});
+    REQUIRE(t.trie.verify() == 3);
+}
@@ -0,0 +1,105 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+
+#include "src/turbomind/models/llama/token_masker.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+TokenMasker::TokenMasker(int vocab_size, int worker_num): words_{(vocab_size + 31) / 32}
+{
+    FT_CHECK(vocab_size > 0 && worker_num > 0);
+    for (int i = 0; i < worker_num; ++i) {
+        workers_.emplace_back(&TokenMasker::InternalThreadEntry, this);
+    }
+    TM_LOG_INFO("[TokenMasker] %d workers, %d words per mask", worker_num, words_);
+}
+
+TokenMasker::~TokenMasker()
+{
+    {
+        std::lock_guard lock{mutex_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
+}
+
+void TokenMasker::Launch(std::vector<TokenMatcher*> matchers, uint32_t* bitmask)
+{
+    {
+        std::lock_guard lock{mutex_};
+        FT_CHECK(pending_ == 0);
+        matchers_ = std::move(matchers);
+        bitmask_  = bitmask;
+        next_     = 0;
+        pending_  = matchers_.size();
+    }
+    cv_.notify_all();
+}
+
+void TokenMasker::Wait()
+{
+    std::unique_lock lock{mutex_};
+    done_cv_.wait(lock, [&] { return pending_ == 0; });
+    matchers_.clear();
+}
+
+void TokenMasker::Fill(int index)
+{
+    uint32_t* mask = bitmask_ + (size_t)index * words_;
+    if (auto m = matchers_[index]) {
+        try {
+            m->FillNextTokenBitmask(mask, words_);
+            return;
+        }
+        catch (const std::exception& e) {
+            TM_LOG_ERROR("[TokenMasker] FillNextTokenBitmask: %s", e.what());
+        }
+        catch (...) {
+            TM_LOG_ERROR("[TokenMasker] FillNextTokenBitmask: unknown error");
+        }
+    }
+    std::fill_n(mask, words_, 0xffffffffu);
+}
+
+void TokenMasker::Accept(TokenMatcher& matcher, int token_id)
+{
+    try {
+        matcher.AcceptToken(token_id);
+    }
+    catch (const std::exception& e) {
+        TM_LOG_ERROR("[TokenMasker] AcceptToken(%d): %s", token_id, e.what());
+    }
+    catch (...) {
+        TM_LOG_ERROR("[TokenMasker] AcceptToken(%d): unknown error", token_id);
+    }
+}
+
+void TokenMasker::InternalThreadEntry()
+{
+    while (true) {
+        int index;
+        {
+            std::unique_lock lock{mutex_};
+            cv_.wait(lock, [&] { return stop_ || next_ < (int)matchers_.size(); });
+            if (stop_) {
+                return;
+            }
+            index = next_++;
+        }
+        Fill(index);
+        {
+            std::lock_guard lock{mutex_};
+            if (--pending_ == 0) {
+                done_cv_.notify_all();
+            }
+        }
+    }
+}
+
+}  // namespace turbomind
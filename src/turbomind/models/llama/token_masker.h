@@ -0,0 +1,62 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "src/turbomind/engine/request.h"
+
+namespace turbomind {
+
+// Fills the next token bitmasks of the constrained requests on a pool of workers, so that the grammar matchers run
+// while the device computes the forward pass of the step and only the slowest matcher may delay the sampling.
+class TokenMasker {
+public:
+    TokenMasker(int vocab_size, int worker_num);
+
+    ~TokenMasker();
+
+    TokenMasker(const TokenMasker&) = delete;
+    TokenMasker& operator=(const TokenMasker&) = delete;
+
+    // Words per row of the bitmask
+    int words() const noexcept
+    {
+        return words_;
+    }
+
+    // Start filling the rows of `bitmask` [matchers.size(), words], rows of null matchers allow all tokens
+    void Launch(std::vector<TokenMatcher*> matchers, uint32_t* bitmask);
+
+    // Wait for the last launch to complete
+    void Wait();
+
+    // A failed matcher is logged and leaves its request unconstrained
+    static void Accept(TokenMatcher& matcher, int token_id);
+
+private:
+    void Fill(int index);
+
+    void InternalThreadEntry();
+
+private:
+    const int words_;
+
+    std::vector<TokenMatcher*> matchers_;
+    uint32_t*                  bitmask_{};
+
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    int                     next_{};
+    int                     pending_{};
+    bool                    stop_{};
+
+    std::vector<std::thread> workers_;
+};
+
+}  // namespace turbomind
@@ -20,34 +20,43 @@
 // https://github.com/NVIDIA/FasterTransformer/blob/main/src/fastertransformer/layers/attention_layers/GptContextAttentionLayer.cc
 
 #include <algorithm>
+#include <climits>
 #include <math.h>
 
 #include "src/turbomind/kernels/attention/attention.h"
 #include "src/turbomind/kernels/attention/decoding.h"
 #include "src/turbomind/kernels/attention/kv_cache_utils_v2.h"
+#include "src/turbomind/kernels/attention/sparse_decoding.h"
 #include "src/turbomind/kernels/norm/rms_norm.h"
 #include "src/turbomind/macro.h"
+#include "src/turbomind/models/llama/cascade.h"
 #include "src/turbomind/models/llama/llama_kernels.h"
 #include "src/turbomind/models/llama/llama_utils.h"
+#include "src/turbomind/models/llama/memory_planner.h"
 #include "src/turbomind/models/llama/mla_utils.h"
+#include "src/turbomind/models/llama/sparse_layout.h"
 #include "src/turbomind/models/llama/unified_attention_layer.h"
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/anomaly_handler.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
 #include "src/turbomind/utils/memory_utils.h"
+#include "src/turbomind/utils/monotonic.h"
 
 namespace turbomind {
 
 template<class T>
-UnifiedAttentionLayer<T>::UnifiedAttentionLayer(
-    const ModelParam& model, const AttentionParam& attn, const LoraParam& lora, size_t tp_size, const Context<T>& ctx):
+UnifiedAttentionLayer<T>::UnifiedAttentionLayer(const ModelParam&     model,
+                                                const AttentionParam& attn,
+                                                const LoraParam&      lora,
+                                                const EngineParam&    engine,
+                                                const Context<T>&     ctx):
     head_num_(model.head_num),
     kv_head_num_(model.kv_head_num),
     size_per_head_(model.head_dim),
     hidden_units_(model.hidden_units),
-    local_head_num_(head_num_ / tp_size),
-    local_kv_head_num_(model.kv_head_num / tp_size),
+    local_head_num_(head_num_ / engine.attn_tp_size),
+    local_kv_head_num_(model.kv_head_num / engine.attn_tp_size),
     param_(attn),
     model_param_(model),
     lora_param_(lora),
@@ -55,10 +64,21 @@ UnifiedAttentionLayer<T>::UnifiedAttentionLayer(
     stream_(ctx.stream),
     linear_(ctx.linear.get()),
     allocator_(ctx.allocator.get()),
-    arch_(getSMVersion())
+    arch_(getSMVersion()),
+    is_llama_(IsLlamaAttention(model, attn, lora, engine))
 {
     FT_CHECK(head_num_ % kv_head_num_ == 0);
 
+    if (HasLayerKvConfig(model)) {
+        const auto config = MakeBlockConfig(model, attn, engine, bitsof<T>);
+        for (const auto& offset : SequenceManager::LayerOffsets(model.layer_num, config)) {
+            layer_offsets_.push_back((int)offset);
+        }
+        for (size_t i = 0; i < model.layer_num; ++i) {
+            layer_kv_head_num_.push_back(GetLayerKvHeadNum(model, i) / engine.attn_tp_size);
+        }
+    }
+
     check_cuda_error(cudaStreamCreateWithFlags(&aux_stream_, cudaStreamNonBlocking));
     check_cuda_error(cudaEventCreateWithFlags(&qkv_event_, cudaEventDisableTiming));
     check_cuda_error(cudaEventCreateWithFlags(&aux_event_, cudaEventDisableTiming));
@@ -66,8 +86,30 @@ UnifiedAttentionLayer<T>::UnifiedAttentionLayer(
     streams_[0] = stream_;
     streams_[1] = aux_stream_;
 
+    if (param_.decode_sm_ratio > 0) {
+        partition_ = std::make_unique<SmPartition>(param_.decode_sm_ratio);
+    }
+
     init_rope_kernel_param(param_.rope, rope_param_);
 
+    if (param_.rope_table_len > 0 && rope_param_.type != RopeType::kNull) {
+        rope_table_ = (float*)allocator_->malloc(sizeof(float) * param_.rope_table_len * rope_param_.dim, false);
+        invokeRopeTable(rope_table_, rope_param_, param_.rope_table_len, stream_);
+        sync_check_cuda_error();
+        rope_param_.table      = rope_table_;
+        rope_param_.table_len  = param_.rope_table_len;
+        rope_param_.table_base = param_.rope.base;
+    }
+
+    if (engine.attn_cp_size > 1) {
+        cp_ = {engine.attn_cp_size, engine.attn_cp_rank, param_.cache_block_seq_len / engine.attn_cp_size};
+        // same bound as the forward buffers of `LlamaBatch`
+        cp_max_tokens_    = engine.max_prefill_token_num + engine.max_batch_size;
+        const size_t size = sizeof(float) * cp_.size * cp_max_tokens_ * local_head_num_;
+        cp_lse_           = (float*)ctx.comm.d_comm->Allocate(size);
+        ctx.comm.d_comm->Register(cp_lse_, size);
+    }
+
     allocateWorkspace();
 }
 
@@ -82,17 +124,61 @@ void UnifiedAttentionLayer<T>::allocateBuffer(size_t q_count, size_t k_count, si
 
     const int local_q_kv_head_num = local_head_num_ + 2 * local_kv_head_num_;
 
-    qkv_buf_ = (T*)allocator_->reMalloc(qkv_buf_, sizeof(T) * q_count * local_q_kv_head_num * size_per_head_, false);
+    if (scratch_tokens_) {
+        FT_CHECK_WITH_INFO(q_count <= scratch_tokens_,
+                           fmtstr("%d tokens exceed the planned scratch (%d)", (int)q_count, (int)scratch_tokens_));
+    }
+    else {
+        qkv_buf_ =
+            (T*)allocator_->reMalloc(qkv_buf_, sizeof(T) * q_count * local_q_kv_head_num * size_per_head_, false);
+        qkv_buf_3_ =
+            (T*)allocator_->reMalloc(qkv_buf_3_, sizeof(T) * q_count * local_head_num_ * size_per_head_, false);
+    }
 
-    qkv_buf_3_ = (T*)allocator_->reMalloc(qkv_buf_3_, sizeof(T) * q_count * local_head_num_ * size_per_head_, false);
+    if (cp_.size > 1) {
+        cp_cu_k_len_ = (int*)allocator_->reMalloc(cp_cu_k_len_, sizeof(int) * (batch_size + 1), false);
+    }
 
     // Pad the tmp buffer for linear KV cache by `MAX_CTA_S` to avoid illegal accesses
     tmp_kv_buf_ = (T*)allocator_->reMalloc(
         tmp_kv_buf_, sizeof(T) * local_kv_head_num_ * 2 * (k_count + MAX_CTA_S) * size_per_head_, false);
 
+    if (param_.mla_latent_cache) {
+        const size_t latent_dim = model_param_.mla.kv_lora_rank + model_param_.mla.qk_rope_dim;
+        const size_t kv_b_dim   = size_per_head_ - model_param_.mla.qk_rope_dim + model_param_.mla.v_head_dim;
+        mla_qkv_buf_ =
+            (T*)allocator_->reMalloc(mla_qkv_buf_, sizeof(T) * q_count * (local_head_num_ + 1) * latent_dim, false);
+        mla_out_buf_ =
+            (T*)allocator_->reMalloc(mla_out_buf_, sizeof(T) * q_count * local_head_num_ * latent_dim, false);
+        mla_kv_buf_ = (T*)allocator_->reMalloc(mla_kv_buf_, sizeof(T) * 2 * (k_count + MAX_CTA_S) * latent_dim, false);
+        mla_kv_b_buf_ =
+            (T*)allocator_->reMalloc(mla_kv_b_buf_, sizeof(T) * k_count * local_head_num_ * kv_b_dim, false);
+    }
+
     is_allocate_buffer_ = true;
 }
 
+template<typename T>
+size_t UnifiedAttentionLayer<T>::PlanScratch(void* base, size_t max_tokens)
+{
+    const int local_q_kv_head_num = local_head_num_ + 2 * local_kv_head_num_;
+
+    T*        qkv{};
+    T*        qkv_3{};
+    Monotonic alloc{base};
+    alloc(&qkv, max_tokens * local_q_kv_head_num * size_per_head_);
+    alloc(&qkv_3, max_tokens * local_head_num_ * size_per_head_);
+
+    if (base) {
+        FT_CHECK(!is_allocate_buffer_);
+        qkv_buf_        = qkv;
+        qkv_buf_3_      = qkv_3;
+        scratch_tokens_ = max_tokens;
+    }
+
+    return (char*)alloc.ptr() - (char*)base;
+}
+
 template<typename T>
 void UnifiedAttentionLayer<T>::allocateWorkspace()
 {
@@ -103,6 +189,14 @@ void UnifiedAttentionLayer<T>::allocateWorkspace()
     partial_O_ = (float*)allocator_->malloc(sizeof(float) * kMaxWorkspaceTokens * local_head_num_ * size_per_head_);
     split_cnt_ = (int*)allocator_->malloc(sizeof(int) * kMaxWorkspaceTokens);
     barriers_  = (int*)allocator_->malloc(sizeof(int) * kMaxWorkspaceTokens * local_head_num_, true, false);
+
+    pf_partial_M_ = (float*)allocator_->malloc(sizeof(float) * kMaxWorkspaceTokens * local_head_num_);
+    pf_partial_L_ = (float*)allocator_->malloc(sizeof(float) * kMaxWorkspaceTokens * local_head_num_);
+    pf_partial_O_ =
+        (float*)allocator_->malloc(sizeof(float) * kMaxWorkspaceTokens * local_head_num_ * size_per_head_);
+    pf_split_cnt_ = (int*)allocator_->malloc(sizeof(int) * kMaxWorkspaceTokens);
+    pf_barriers_  = (int*)allocator_->malloc(sizeof(int) * kMaxWorkspaceTokens * local_head_num_, true, false);
+
     is_allocate_workspace_ = true;
 }
 
@@ -118,6 +212,12 @@ void UnifiedAttentionLayer<T>::freeWorkspace()
         allocator_->free((void**)&split_cnt_);
         allocator_->free((void**)&barriers_);
 
+        allocator_->free((void**)&pf_partial_M_);
+        allocator_->free((void**)&pf_partial_L_);
+        allocator_->free((void**)&pf_partial_O_);
+        allocator_->free((void**)&pf_split_cnt_);
+        allocator_->free((void**)&pf_barriers_);
+
         is_allocate_workspace_ = false;
     }
 }
@@ -128,76 +228,126 @@ void UnifiedAttentionLayer<T>::freeBuffer()
     if (is_allocate_buffer_) {
         TM_LOG_DEBUG(__PRETTY_FUNCTION__);
 
-        allocator_->free((void**)&qkv_buf_);
-        allocator_->free((void**)&qkv_buf_3_);
+        if (!scratch_tokens_) {
+            allocator_->free((void**)&qkv_buf_);
+            allocator_->free((void**)&qkv_buf_3_);
+        }
         allocator_->free((void**)&tmp_kv_buf_);
         allocator_->free((void**)&lora_buf_);
 
+        if (param_.mla_latent_cache) {
+            allocator_->free((void**)&mla_qkv_buf_);
+            allocator_->free((void**)&mla_out_buf_);
+            allocator_->free((void**)&mla_kv_buf_);
+            allocator_->free((void**)&mla_kv_b_buf_);
+        }
+
+        allocator_->free((void**)&cascade_q_buf_);
+        allocator_->free((void**)&cascade_kv_buf_);
+        allocator_->free((void**)&sparse_block_ptrs_);
+        allocator_->free((void**)&cp_cu_k_len_);
+
         is_allocate_buffer_ = false;
     }
 }
 
 template<typename T>
-inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMap* inputs, const WeightType* weights)
+void UnifiedAttentionLayer<T>::forward(const ForwardParam& param, const WeightType* weights)
 {
-    TM_LOG_DEBUG(__PRETTY_FUNCTION__);
+    if (is_llama_) {
+        forward_impl<true>(param, weights);
+    }
+    else {
+        forward_impl<false>(param, weights);
+    }
+}
 
-    /**
-     * input_tensors:
-     *   \param input_query [token_num, hidden_dim]
-     *   \param cu_q_len [batch_size+1], int
-     *   \param cu_k_len [batch_size+1], int
-     *   \param cu_block_counts [batch_size+1], int
-     *   \param finished [batch_size], bool
-     *   \param rope_theta [batch_size], float
-     *   \param h_q_len [batch_size], int on cpu
-     *   \param h_k_len [batch_size], int on cpu
-     *   \param h_cu_q_len [batch_size+1], int on cpu
-     *   \param h_cu_k_len [batch_size+1], int on cpu
-     *   \param dc_batch_size [1], int on cpu
-     *   \param pf_batch_size [1], int on cpu
-     *   \param layer_id [1], int on cpu
-     *
-     * output_tensors:
-     *   \param hidden_features [token_num, hidden_dim], float
-     *   \param block_ptrs [total_block_counts], void*
-     */
+template<typename T>
+template<bool kLlama>
+void UnifiedAttentionLayer<T>::forward_impl(const ForwardParam& p, const WeightType* weights)
+{
+    TM_LOG_DEBUG(__PRETTY_FUNCTION__);
 
     /////////////////////////////////////////////
     /// parse inputs
-    const int token_num = inputs->at("input_query").shape[0];
-    const int layer_id  = inputs->getVal<int>("layer_id");
+    const int token_num = p.token_num;
+    const int layer_id  = p.layer_id;
+
+    // the kv heads & the cache precision of the layer when the layers differ, see `HasLayerKvConfig`
+    const bool   layer_kv_config   = !layer_offsets_.empty();
+    const size_t local_kv_head_num = layer_kv_config ? layer_kv_head_num_[layer_id] : local_kv_head_num_;
+    const int    quant_policy      = GetLayerQuantPolicy(model_param_, layer_id);
 
-    const int dc_batch_size = inputs->getVal<int>("dc_batch_size");
-    const int pf_batch_size = inputs->getVal<int>("pf_batch_size");
+    const int dc_batch_size = p.dc_batch_size;
+    const int pf_batch_size = p.pf_batch_size;
     const int batch_size    = dc_batch_size + pf_batch_size;
 
-    int* h_q_len    = inputs->getPtr<int>("h_q_len");
-    int* h_k_len    = inputs->getPtr<int>("h_k_len");
-    int* cu_q_len   = inputs->getPtr<int>("cu_q_len");
-    int* cu_k_len   = inputs->getPtr<int>("cu_k_len");
-    int* h_cu_q_len = inputs->getPtr<int>("h_cu_q_len");
-    int* h_cu_k_len = inputs->getPtr<int>("h_cu_k_len");
+    const int dc_max_k_len = p.dc_max_k_len;
+
+    int* h_q_len    = p.h_q_len;
+    int* h_k_len    = p.h_k_len;
+    int* cu_q_len   = p.cu_q_len;
+    int* cu_k_len   = p.cu_k_len;
+    int* h_cu_q_len = p.h_cu_q_len;
+    int* h_cu_k_len = p.h_cu_k_len;
 
-    bool*  is_finished = inputs->getPtr<bool>("finished");
-    float* rope_theta  = inputs->getPtr<float>("rope_theta");
+    bool*  is_finished = p.finished;
+    float* rope_theta  = p.rope_theta;
+    int*   evicted_len = p.evicted_len;
 
-    void** block_ptrs     = outputs->getPtr<void*>("block_ptrs");
-    int*   cu_block_count = inputs->getPtr<int>("cu_block_counts");
+    const int* cascade   = p.cascade;
+    const int* h_cascade = p.h_cascade;
 
-    T* attention_input = inputs->getPtr<T>("input_query");
-    T* attention_out   = outputs->getPtr<T>("hidden_features");
+    int*       sparse   = p.sparse;
+    const int* h_sparse = p.h_sparse;
+
+    const uint64_t* tree_mask = p.tree_mask;
+
+    const int* cold_len   = p.cold_len;
+    const int* h_cold_len = p.h_cold_len;
+
+    float* block_scores = p.block_scores;
+
+    void** block_ptrs     = p.block_ptrs;
+    int*   cu_block_count = p.cu_block_counts;
+
+    T* attention_input = p.input;
+    T* attention_out   = p.output;
 
     if (token_num == 0) {
         return;
     }
 
+    // Context parallelism, the kernels read the local keys of the rank while the positions follow the global lengths
+    const int* cp_cu_k_len = {};
+    if (cp_.size > 1) {
+        FT_CHECK(token_num <= (int)cp_max_tokens_);
+        h_cp_k_len_.resize(batch_size);
+        h_cp_cu_k_len_.assign(batch_size + 1, 0);
+        for (int i = 0; i < batch_size; ++i) {
+            h_cp_k_len_[i]        = cp_.local_len(h_k_len[i]);
+            h_cp_cu_k_len_[i + 1] = h_cp_cu_k_len_[i] + h_cp_k_len_[i];
+        }
+        h_k_len    = h_cp_k_len_.data();
+        h_cu_k_len = h_cp_cu_k_len_.data();
+    }
+
     /////////////////////////////////////////////
     /// allocate buffers
-    allocateBuffer(token_num,                                           // shared
-                   h_cu_k_len[batch_size] - h_cu_k_len[dc_batch_size],  // prefill
+    // the prefills read their history from the cache blocks with `streaming_prefill`, the linear kv is not needed
+    const bool streaming_prefill = param_.streaming_prefill;
+
+    allocateBuffer(token_num,                                                                   // shared
+                   streaming_prefill ? 0 : h_cu_k_len[batch_size] - h_cu_k_len[dc_batch_size],  // prefill
                    batch_size,
-                   std::max(weights->qkv.lora.r, weights->output.lora.r));
+                   kLlama ? 0 : std::max(weights->qkv.lora.r, weights->output.lora.r));
+
+    if (cp_.size > 1) {
+        invokeContextParallelCuKLen(cp_cu_k_len_, cu_k_len, cp_, batch_size, stream_);
+        sync_check_cuda_error();
+        cp_cu_k_len = cu_k_len;
+        cu_k_len    = cp_cu_k_len_;
+    }
 
     // [L, 2, H, s, D]
     const size_t layer_offset = layer_id * 2 * local_kv_head_num_ * param_.cache_block_seq_len * size_per_head_;
@@ -208,9 +358,38 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
     //     Compare(attention_input, token_num * hidden_units_, Concat("qkv_input", layer_id), compare_mode, stream_);
     // }
 
-    int* lora_mask = inputs->at("lora_mask", Tensor{MEMORY_GPU, TYPE_INVALID, {}, nullptr}).getPtr<int>();
+    int* lora_mask = kLlama ? nullptr : p.lora_mask;
+
+    // Latent MLA cache: one KV head of [qk_rope_dim + kv_lora_rank] holding both K & V
+    const bool mla_latent   = !kLlama && param_.mla_latent_cache && !weights->qkv.output_dims;
+    const int  kv_lora_rank = model_param_.mla.kv_lora_rank;
+    const int  qk_rope_dim  = model_param_.mla.qk_rope_dim;
+    const int  qk_nope_dim  = size_per_head_ - qk_rope_dim;
+    const int  v_head_dim   = model_param_.mla.v_head_dim;
+    const int  latent_dim   = kv_lora_rank + qk_rope_dim;
+
+    // Cascade decoding, the prefix of a group is attended once for all its members by the prefill kernels
+    const auto cascade_layout = h_cascade ? CascadeLayout::Load(h_cascade) : CascadeLayout{};
+    const bool use_cascade    = cascade_layout.group_num && !mla_latent && !param_.use_logn_attn && !isTuning();
+    const int  sum_prefix_len = use_cascade ? h_cascade[cascade_layout.cu_k_len() + cascade_layout.group_num] : 0;
+    if (use_cascade) {
+        cascade_q_buf_  = (T*)allocator_->reMalloc(
+            cascade_q_buf_, sizeof(T) * cascade_layout.q_num * local_head_num_ * size_per_head_, false);
+        cascade_kv_buf_ = (T*)allocator_->reMalloc(
+            cascade_kv_buf_, sizeof(T) * local_kv_head_num * 2 * (sum_prefix_len + MAX_CTA_S) * size_per_head_, false);
+    }
 
-    if (weights->qkv.output_dims) {
+    // Block-sparse decoding, the key summaries of the blocks follow the k/v data of all layers
+    const int     sparse_topk    = param_.sparse_decode_blocks;
+    const auto    sparse_layout  = h_sparse ? SparseLayout::Load(h_sparse) : SparseLayout{};
+    const int64_t summary_offset = (int64_t)model_param_.layer_num * local_kv_head_num_ * 2
+                                   * param_.cache_block_seq_len * size_per_head_ * sizeof(T);
+    if (h_sparse && !isTuning()) {
+        sparse_block_ptrs_ = (void**)allocator_->reMalloc(
+            sparse_block_ptrs_, sizeof(void*) * sparse_layout.batch_size * sparse_layout.width, false);
+    }
+
+    if (kLlama || weights->qkv.output_dims) {
         //////////////////////////////////////////////
         /// qkv gemm
         // [token_num, hidden_dim] -> [token_num, 3, local_hidden_dim]
@@ -218,8 +397,10 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
             qkv_buf_, attention_input, token_num, weights->qkv, LlamaLinear<T>::kGemm, lora_buf_, lora_mask);
         sync_check_cuda_error();
 
-        if (model_param_.qk_norm) {
-            qk_norm(qkv_buf_, token_num, *weights);
+        if constexpr (!kLlama) {
+            if (model_param_.qk_norm) {
+                qk_norm(qkv_buf_, token_num, *weights);
+            }
         }
     }
     else {
@@ -270,13 +451,15 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
 
         params.q      = (T*)qkv_buf_;
         params.k      = params.q + local_head_num_ * size_per_head_;
-        params.v      = params.k + local_kv_head_num_ * size_per_head_;
-        params.stride = (local_head_num_ + 2 * local_kv_head_num_) * size_per_head_;
-
-        if (weights->qkv.bias) {
-            params.q_bias = weights->qkv.bias;
-            params.k_bias = params.q_bias + local_head_num_ * size_per_head_;
-            params.v_bias = params.k_bias + local_kv_head_num_ * size_per_head_;
+        params.v      = params.k + local_kv_head_num * size_per_head_;
+        params.stride = (local_head_num_ + 2 * local_kv_head_num) * size_per_head_;
+
+        if constexpr (!kLlama) {
+            if (weights->qkv.bias) {
+                params.q_bias = weights->qkv.bias;
+                params.k_bias = params.q_bias + local_head_num_ * size_per_head_;
+                params.v_bias = params.k_bias + local_kv_head_num * size_per_head_;
+            }
         }
 
         params.token_num  = h_cu_q_len[offset + batch_size] - h_cu_q_len[offset];
@@ -285,10 +468,15 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
         params.max_k_len  = *std::max_element(h_k_len + offset, h_k_len + offset + batch_size);
 
         // Decoding use only
+        // a layer of its own layout is addressed at its offset in the blocks
         params.block_iter_params = BlockIteratorParams{(char**)block_ptrs,  //
                                                        (int*)cu_block_count + offset,
-                                                       layer_id,
-                                                       (int)param_.cache_block_seq_len};
+                                                       layer_kv_config ? 0 : layer_id,
+                                                       (int)param_.cache_block_seq_len,
+                                                       layer_kv_config ? layer_offsets_[layer_id] : 0};
+        if (p.cow_blocks) {
+            params.block_iter_params.cow_blocks = p.cow_blocks + offset;
+        }
 
         // Prefilling use only
         const int sum_k_len       = h_cu_k_len[offset + pf_batch_size] - h_cu_k_len[offset];
@@ -301,7 +489,7 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
         params.cu_k_len = cu_k_len + offset;
 
         params.num_heads     = local_head_num_;
-        params.num_kv_heads  = local_kv_head_num_;
+        params.num_kv_heads  = local_kv_head_num;
         params.size_per_head = size_per_head_;
 
         // MSVC does not have M_LOG2E
@@ -314,35 +502,106 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
         }
 
         // rotary embedding
-        if (rope_param_.type == RopeType::kDynamic) {
-            rope_param_.base = rope_theta + offset;
+        if constexpr (!kLlama) {
+            if (rope_param_.type == RopeType::kDynamic) {
+                rope_param_.base = rope_theta + offset;
+            }
         }
-        params.rope_param = rope_param_;
+        // positions of the new tokens are ahead of their indices in the kv cache by the evicted tokens
+        rope_param_.offset = evicted_len ? evicted_len + offset : nullptr;
+        params.rope_param  = rope_param_;
+        params.pre_rope_kv = param_.pre_rope_kv_cache;
 
         // logn attn
-        params.use_logn_attn           = param_.use_logn_attn;
+        params.use_logn_attn           = !kLlama && param_.use_logn_attn;
         params.max_position_embeddings = param_.max_position_embeddings;
 
-        // Decoding use only for now
         FT_CHECK(barriers_);
-        params.split_cnt   = split_cnt_;
-        params.partial_L   = partial_L_;
-        params.partial_M   = partial_M_;
-        params.partial_O   = partial_O_;
-        params.locks       = barriers_;
-        params.max_split_k = std::min(std::max(1, kMaxWorkspaceTokens / params.token_num), max_kv_splits);
+        params.split_cnt = split_cnt_;
+        params.partial_L = partial_L_;
+        params.partial_M = partial_M_;
+        params.partial_O = partial_O_;
+        params.locks     = barriers_;
+        // the partials are indexed by the global offsets of the tokens
+        const int end_token = h_cu_q_len[offset + batch_size];
+        params.max_split_k  = std::min(std::max(1, kMaxWorkspaceTokens / end_token), max_kv_splits);
+
+        if (cp_.size > 1) {
+            params.cp                          = cp_;
+            params.cp_cu_k_len                 = cp_cu_k_len + offset;
+            params.cp_lse                      = cp_lse_ + (size_t)cp_.rank * token_num * local_head_num_;
+            params.block_iter_params.block_len = cp_.block_len;
+        }
 
         params.arch   = arch_;
         params.stream = stream;
 
-        params.quant_policy = model_param_.quant_policy;
+        params.quant_policy = quant_policy;
+        params.fp8_qk       = param_.fp8_attention && (quant_policy & QuantPolicy::kCacheKVFp8);
+
+        if (cold_len) {
+            params.cold_len          = cold_len + offset;
+            params.cold_quant_policy = param_.cold_quant_policy;
+        }
         return params;
     };
 
+    // The latents are read through the cache as a single KV head, K & V alias to the same data
+    auto UseLatentKV = [&](AttentionParams<T>& params) {
+        params.q             = mla_qkv_buf_;
+        params.k             = mla_qkv_buf_ + local_head_num_ * latent_dim;
+        params.v             = params.k;
+        params.stride        = (local_head_num_ + 1) * latent_dim;
+        params.num_kv_heads  = 1;
+        params.size_per_head = latent_dim;
+    };
+
+    // Decompress the latents of the prefills with `kv_b_proj`, before the streams fork as the GEMM runs on `stream_`
+    if (mla_latent && pf_batch_size && !isTuning()) {
+        const int offset    = dc_batch_size;
+        const int sum_k_len = h_cu_k_len[offset + pf_batch_size] - h_cu_k_len[offset];
+        auto      params    = CreateParams(offset, pf_batch_size, 1, stream_);
+        UseLatentKV(params);
+        params.linear_iter_params.kv_cache = mla_kv_buf_;
+        if constexpr (sizeof(T) == 2) {
+            invokeProcessFlattenKV_v2_(params, sum_k_len);
+            sync_check_cuda_error();
+
+            linear_->forward(mla_kv_b_buf_, {mla_kv_buf_ + qk_rope_dim, latent_dim}, sum_k_len, weights->kv_b_proj);
+            sync_check_cuda_error();
+
+            dispatchMLAExpandKV(tmp_kv_buf_,
+                                mla_kv_buf_,
+                                mla_kv_b_buf_,
+                                sum_k_len,
+                                (int)local_head_num_,
+                                qk_nope_dim,
+                                qk_rope_dim,
+                                v_head_dim,
+                                kv_lora_rank,
+                                stream_);
+            sync_check_cuda_error();
+        }
+    }
+
+    if constexpr (sizeof(T) == 2) {
+        if (p.kv_error && quant_policy && !isTuning()) {
+            auto params = CreateParams(0, batch_size, 1, stream_);
+            invokeKvQuantError_(params, p.kv_error + 4 * layer_id);
+            sync_check_cuda_error();
+        }
+    }
+
     cudaStream_t pf_stream = stream_;
     cudaStream_t dc_stream = stream_;
 
-    if (pf_batch_size && dc_batch_size) {
+    if (pf_batch_size && dc_batch_size && partition_) {
+        // the decodings run on their own SMs instead of queuing behind the CTAs of the prefills
+        partition_->Fork(stream_);
+        dc_stream = partition_->stream(0);
+        pf_stream = partition_->stream(1);
+    }
+    else if (pf_batch_size && dc_batch_size) {
         pf_stream = aux_stream_;
         check_cuda_error(cudaEventRecord(qkv_event_, stream_));
         check_cuda_error(cudaStreamWaitEvent(aux_stream_, qkv_event_));
@@ -351,16 +610,48 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
     if (pf_batch_size && !isTuning()) {
         const int offset    = dc_batch_size;
         const int sum_k_len = h_cu_k_len[offset + pf_batch_size] - h_cu_k_len[offset];
-        // We are executing prefill & decoding kernels concurrently, but only have 1 workspace
-        // disable split kv for prefill for now
-        auto params = CreateParams(offset, pf_batch_size, 1, pf_stream);
+        // A short chunk against a long history has few CTAs without splitting the kv, `GetSplitCount` weighs the
+        // splits by the query tiles & the kv length. Prefills running concurrently with the decodings have their own
+        // workspace
+        const int max_splits = param_.batch_invariant || cp_.size > 1 ? 1 : kMaxKVSplits;
+        auto      params     = CreateParams(offset, pf_batch_size, max_splits, pf_stream);
+        if (pf_stream != dc_stream) {
+            params.split_cnt = pf_split_cnt_;
+            params.partial_L = pf_partial_L_;
+            params.partial_M = pf_partial_M_;
+            params.partial_O = pf_partial_O_;
+            params.locks     = pf_barriers_;
+        }
+        if (tree_mask) {
+            FT_CHECK_WITH_INFO(params.max_q_len <= 64, "tree mask is limited to inputs of 64 tokens");
+            params.tree_mask = tree_mask;
+        }
         if constexpr (sizeof(T) == 2) {
-            invokeProcessKV_v2_(params);
-            sync_check_cuda_error();
+            if (streaming_prefill) {
+                invokeProcessKV_v2_(params);
+                sync_check_cuda_error();
+                params.block_kv = true;
+            }
+            else if (!mla_latent) {
+                invokeProcessFlattenKV_v2_(params, sum_k_len);
+                sync_check_cuda_error();
+            }
 
-            /// TODO: skip flattening for `sm_80`
-            invokeFlattenKV_v2_(params, sum_k_len);
-            sync_check_cuda_error();
+            if (sparse_topk) {
+                invokeUpdateBlockSummary<T>((char**)block_ptrs,
+                                            params.cu_q_len,
+                                            params.cu_k_len,
+                                            params.block_iter_params.cu_block_nums,
+                                            summary_offset,
+                                            param_.cache_block_seq_len,
+                                            layer_id,
+                                            params.max_q_len,
+                                            local_kv_head_num,
+                                            size_per_head_,
+                                            pf_batch_size,
+                                            pf_stream);
+                sync_check_cuda_error();
+            }
 
             dispatchAttention(params);
             sync_check_cuda_error();
@@ -368,14 +659,243 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
     }
 
     if (dc_batch_size && !isTuning()) {
-        auto params = CreateParams(0, dc_batch_size, kMaxKVSplits, dc_stream);
+        int min_cold_len = INT_MAX;
+        for (int i = 0; h_cold_len && i < dc_batch_size; ++i) {
+            min_cold_len = h_cold_len[i] ? std::min(min_cold_len, h_cold_len[i]) : min_cold_len;
+        }
+        const bool use_cold = min_cold_len < INT_MAX;
+        // the split count depends on the batch, the kv of a sequence is not split when batch invariant, except for
+        // the pass of the cold blocks
+        const int max_splits = param_.batch_invariant ? 1 + use_cold : kMaxKVSplits;
+        auto      params     = CreateParams(0, dc_batch_size, max_splits, dc_stream);
+        params.max_k_len     = std::max(params.max_k_len, cp_.size > 1 ? cp_.local_len(dc_max_k_len) : dc_max_k_len);
         if constexpr (sizeof(T) == 2) {
+            const int dc_token_num = params.token_num;
+            const int kv_b_dim     = weights->kv_b_proj.output_dims;
+            const T*  kv_b         = (const T*)weights->kv_b_proj.kernel;
+            if (mla_latent) {
+                // absorb the nope part of K into Q, q_c = W_uk^T q_nope for each head
+                context_.cublas_wrapper->stridedBatchedGemm(CUBLAS_OP_T,
+                                                            CUBLAS_OP_N,
+                                                            kv_lora_rank,
+                                                            dc_token_num,
+                                                            qk_nope_dim,
+                                                            kv_b,
+                                                            kv_b_dim,
+                                                            qk_nope_dim + v_head_dim,
+                                                            qkv_buf_ + qk_rope_dim,
+                                                            params.stride,
+                                                            size_per_head_,
+                                                            mla_qkv_buf_ + qk_rope_dim,
+                                                            (local_head_num_ + 1) * latent_dim,
+                                                            latent_dim,
+                                                            local_head_num_);
+                sync_check_cuda_error();
+                UseLatentKV(params);
+                params.out = mla_out_buf_;
+                // `partial_O_` is sized for the original head dim
+                params.max_split_k = std::min(
+                    std::max(1, kMaxWorkspaceTokens * (int)size_per_head_ / latent_dim / dc_token_num), max_splits);
+            }
+            // the partials of the prefix pass need spare split slots
+            if (use_cascade && params.max_split_k > 1) {
+                const auto& layout   = cascade_layout;
+                const int*  h_cu_q   = h_cascade + layout.cu_q_len();
+                const int*  h_cu_k   = h_cascade + layout.cu_k_len();
+                int         max_q    = 0;
+                int         max_pre  = 0;
+                int         min_pre  = INT_MAX;
+                for (int g = 0; g < layout.group_num; ++g) {
+                    max_q   = std::max(max_q, h_cu_q[g + 1] - h_cu_q[g]);
+                    max_pre = std::max(max_pre, h_cu_k[g + 1] - h_cu_k[g]);
+                    min_pre = std::min(min_pre, h_cu_k[g + 1] - h_cu_k[g]);
+                }
+                // roughly one split per 512 tokens of the shortest prefix
+                const int prefix_splits = std::clamp(min_pre / 512, 1, std::min(8, params.max_split_k - 1));
+
+                invokeCascadeQ_v2(cascade_q_buf_,
+                                  params.q,
+                                  params.q_bias,
+                                  cascade + layout.q_idx(),
+                                  params.cu_k_len,
+                                  params.rope_param,
+                                  params.stride,
+                                  layout.q_num,
+                                  local_head_num_,
+                                  size_per_head_,
+                                  dc_stream);
+                sync_check_cuda_error();
+
+                // blocks -> [H, 2, sum_prefix_len, D]
+                invokeFlattenKV_v2(cascade_kv_buf_,
+                                   cascade_kv_buf_ + sum_prefix_len * size_per_head_,
+                                   (char**)block_ptrs,
+                                   cascade + layout.cu_k_len(),
+                                   cascade + layout.cu_block_num(),
+                                   RopeKernelParam{},
+                                   0,
+                                   1,
+                                   2 * sum_prefix_len,
+                                   1,
+                                   param_.cache_block_seq_len,
+                                   params.block_iter_params.layer_id,
+                                   max_pre,
+                                   local_kv_head_num,
+                                   size_per_head_,
+                                   layout.group_num,
+                                   params.quant_policy,
+                                   dc_stream,
+                                   nullptr,
+                                   nullptr,
+                                   0,
+                                   params.block_iter_params.layer_offset);
+                sync_check_cuda_error();
+
+                // the queries are gathered with bias & rope applied
+                auto prefix          = params;
+                prefix.q             = cascade_q_buf_;
+                prefix.stride        = local_head_num_ * size_per_head_;
+                prefix.q_bias        = nullptr;
+                prefix.k_bias        = nullptr;
+                prefix.v_bias        = nullptr;
+                prefix.rope_param    = RopeKernelParam{};
+                prefix.finished      = nullptr;
+                prefix.cu_q_len      = cascade + layout.cu_q_len();
+                prefix.cu_k_len      = cascade + layout.cu_k_len();
+                prefix.batch_size    = layout.group_num;
+                prefix.max_q_len     = max_q;
+                prefix.max_k_len     = max_pre;
+                prefix.cascade_q_idx = cascade + layout.q_idx();
+                prefix.prefix_splits = prefix_splits;
+
+                prefix.linear_iter_params = LinearIteratorParams{cascade_kv_buf_,  //
+                                                                 int(2 * sum_prefix_len * size_per_head_),
+                                                                 int(sum_prefix_len * size_per_head_)};
+                dispatchAttention(prefix);
+                sync_check_cuda_error();
+
+                params.prefix_len    = cascade + layout.prefix_len();
+                params.prefix_splits = prefix_splits;
+            }
+            // the quantized blocks of a tiered kv cache are attended by a pass of their own, merged like the prefixes
+            if (use_cold) {
+                FT_CHECK_WITH_INFO(params.max_split_k > 1, "no spare split slot for the cold blocks");
+                const int cold_splits = param_.batch_invariant ?
+                                            1 :
+                                            std::clamp(min_cold_len / 512, 1, std::min(8, params.max_split_k - 1));
+
+                auto cold          = params;
+                cold.cold_pass     = true;
+                cold.prefix_len    = cold_len;
+                cold.prefix_splits = cold_splits;
+                cold.quant_policy  = param_.cold_quant_policy;
+                dispatchDecoding<T>(cold);
+                sync_check_cuda_error();
+
+                params.prefix_len    = cold_len;
+                params.prefix_splits = cold_splits;
+            }
+            if (h_sparse) {
+                const auto& layout = sparse_layout;
+                invokeSelectSparseBlocks((char**)sparse_block_ptrs_,
+                                         (char**)block_ptrs,
+                                         params.q,
+                                         params.q_bias,
+                                         params.cu_k_len,
+                                         params.block_iter_params.cu_block_nums,
+                                         params.rope_param,
+                                         params.stride,
+                                         summary_offset,
+                                         param_.cache_block_seq_len,
+                                         layer_id,
+                                         kSparseSinkBlocks,
+                                         sparse_topk,
+                                         kSparseRecentBlocks,
+                                         layout.max_block_num,
+                                         local_head_num_,
+                                         local_kv_head_num,
+                                         size_per_head_,
+                                         dc_batch_size,
+                                         dc_stream);
+                sync_check_cuda_error();
+                // the skipped blocks are treated as evicted, so that the positions of the tokens are kept
+                params.block_iter_params.block_ptrs    = (char**)sparse_block_ptrs_;
+                params.block_iter_params.cu_block_nums = sparse + layout.cu_block_num();
+                params.cu_k_len                        = sparse + layout.cu_k_len();
+                params.rope_param.offset               = sparse + layout.offset();
+                params.max_k_len                       = layout.max_k_len;
+            }
             dispatchDecoding<T>(params);
             sync_check_cuda_error();
+            if (block_scores) {
+                // over all the blocks of the sequences, after the new keys are written
+                const int block_len = param_.cache_block_seq_len;
+                const int max_k_len = *std::max_element(h_k_len, h_k_len + dc_batch_size);
+                invokeAccumulateBlockScores<T>(block_scores,
+                                               p.block_score_stride,
+                                               (char**)block_ptrs,
+                                               params.q,
+                                               params.q_bias,
+                                               cu_k_len,
+                                               cu_block_count,
+                                               rope_param_,
+                                               params.stride,
+                                               params.inv_sqrt_dh,
+                                               block_len,
+                                               layer_id,
+                                               (max_k_len + block_len - 1) / block_len,
+                                               local_head_num_,
+                                               local_kv_head_num,
+                                               size_per_head_,
+                                               dc_batch_size,
+                                               dc_stream);
+                sync_check_cuda_error();
+            }
+            if (sparse_topk) {
+                // the new keys are written by the decoding kernels
+                invokeUpdateBlockSummary<T>((char**)block_ptrs,
+                                            cu_q_len,
+                                            cu_k_len,
+                                            cu_block_count,
+                                            summary_offset,
+                                            param_.cache_block_seq_len,
+                                            layer_id,
+                                            params.max_q_len,
+                                            local_kv_head_num,
+                                            size_per_head_,
+                                            dc_batch_size,
+                                            dc_stream);
+                sync_check_cuda_error();
+            }
+            if (mla_latent) {
+                // padding of V in the output heads
+                check_cuda_error(cudaMemsetAsync(
+                    qkv_buf_3_, 0, sizeof(T) * dc_token_num * local_head_num_ * size_per_head_, dc_stream));
+                // o = W_uv o_c for each head, the rope part of the latent output is discarded
+                context_.cublas_wrapper->stridedBatchedGemm(CUBLAS_OP_N,
+                                                            CUBLAS_OP_N,
+                                                            v_head_dim,
+                                                            dc_token_num,
+                                                            kv_lora_rank,
+                                                            kv_b + qk_nope_dim,
+                                                            kv_b_dim,
+                                                            qk_nope_dim + v_head_dim,
+                                                            mla_out_buf_ + qk_rope_dim,
+                                                            local_head_num_ * latent_dim,
+                                                            latent_dim,
+                                                            qkv_buf_3_,
+                                                            local_head_num_ * size_per_head_,
+                                                            size_per_head_,
+                                                            local_head_num_);
+                sync_check_cuda_error();
+            }
         }
     }
 
-    if (pf_batch_size && dc_batch_size) {
+    if (pf_batch_size && dc_batch_size && partition_) {
+        partition_->Join(stream_);
+    }
+    else if (pf_batch_size && dc_batch_size) {
         check_cuda_error(cudaEventRecord(aux_event_, aux_stream_));
         check_cuda_error(cudaStreamWaitEvent(stream_, aux_event_));
     }
@@ -391,6 +911,18 @@ inline void UnifiedAttentionLayer<T>::forward(TensorMap* outputs, const TensorMa
         rng_.GenerateUniform(qkv_buf_3_, token_num * weights->output.input_dims, .02f, -.01f);
     }
 
+    if (cp_.size > 1 && !isTuning()) {
+        // [cp_size, token_num, H], the kernels wrote the slot of the rank
+        const size_t count = (size_t)token_num * local_head_num_;
+        context_.comm.d_comm->AllGather(
+            cp_lse_ + cp_.rank * count, cp_lse_, count, TYPE_FP32, context_.comm.d_cp_group, stream_);
+        sync_check_cuda_error();
+        // the sum over the ranks is left to the all-reduce of the output projection
+        attention::invokeMergeContextParallel(
+            qkv_buf_3_, cp_lse_, cp_.size, cp_.rank, token_num, local_head_num_, size_per_head_, stream_);
+        sync_check_cuda_error();
+    }
+
     count_and_fix(qkv_buf_3_, token_num * weights->output.input_dims, Concat("attn", layer_id), 3);
 
     //////////////////////////////////////////////
@@ -466,6 +998,25 @@ void UnifiedAttentionLayer<T>::forward_mla(const T* inputs, int token_num, const
         kv_a, kv_a_dim, kv_a, kv_a_dim, w.kv_a_layernorm, kv_lora_rank, token_num, model_param_.norm_eps, stream_);
     sync_check_cuda_error();
 
+    if (param_.mla_latent_cache) {
+        // K & V are decompressed from the cached latents by the consumers
+        dispatchMLACopyLatentQKV(qkv_buf_,
+                                 mla_qkv_buf_,
+                                 q,
+                                 kv_a,
+                                 token_num,
+                                 local_head_num_,
+                                 qk_nope_dim,
+                                 qk_rope_dim,
+                                 kv_lora_rank,
+                                 stream_);
+        sync_check_cuda_error();
+
+        deviceFree(q, stream_);
+        deviceFree(kv_a, stream_);
+        return;
+    }
+
     T* kv_b{};
     deviceMalloc((T**)&kv_b, (size_t)token_num * w.kv_b_proj.output_dims, stream_);
     sync_check_cuda_error();
@@ -499,6 +1050,9 @@ void UnifiedAttentionLayer<T>::qk_norm(T* qkv, int token_num, const WeightType&
 
     FT_CHECK(model_param_.attn_bias == false);
 
+    // the kv heads of the layer, which may be pruned
+    const int kv_head_num = (weights.qkv.output_dims / size_per_head_ - local_head_num_) / 2;
+
     invokeQkRMSNorm(qkv_buf_,
                     weights.qkv.output_dims,
                     weights.q_a_layernorm,
@@ -515,7 +1069,7 @@ void UnifiedAttentionLayer<T>::qk_norm(T* qkv, int token_num, const WeightType&
                     weights.kv_a_layernorm,
                     getTensorType<T>(),
                     size_per_head_,
-                    local_kv_head_num_,
+                    kv_head_num,
                     token_num,
                     model_param_.norm_eps,
                     aux_stream_);
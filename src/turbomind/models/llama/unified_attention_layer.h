@@ -21,13 +21,17 @@
 
 #pragma once
 
+#include <memory>
+
 #include <cuda_runtime.h>
 
+#include "src/turbomind/kernels/attention/attention_params.h"
 #include "src/turbomind/kernels/gemm/test/test_utils.h"
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
 #include "src/turbomind/models/llama/LlamaLinear.h"
 #include "src/turbomind/models/llama/context.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/sm_partition.h"
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/cuda_utils.h"
 
@@ -38,7 +42,7 @@ class UnifiedAttentionLayer {
 public:
     using WeightType = LlamaAttentionWeight<T>;
 
-    static constexpr int kMaxKVSplits        = 128;
+    static constexpr int kMaxKVSplits        = 512;  // enough to fill the SMs with a few kv heads of long contexts
     static constexpr int kMaxWorkspaceTokens = 4096;
 
     void freeBuffer();
@@ -47,11 +51,26 @@ public:
     void allocateWorkspace();
     void freeWorkspace();
 
+    // Places the qkv buffers of up to `max_tokens` tokens at `base` instead of reallocating them when the shape
+    // changes, returns the bytes needed. A null `base` only computes the size
+    size_t PlanScratch(void* base, size_t max_tokens);
+
     ~UnifiedAttentionLayer()
     {
         freeBuffer();
         freeWorkspace();
 
+        allocator_->free((void**)&rope_table_);
+
+        if (cp_lse_) {
+            // owned by `d_comm` once it's destroyed
+            if (auto& comm = context_.comm.d_comm) {
+                comm->Deregister(cp_lse_);
+                comm->Free(cp_lse_);
+            }
+            cp_lse_ = {};
+        }
+
         for (auto& s : streams_) {
             s = {};
         }
@@ -67,10 +86,81 @@ public:
     UnifiedAttentionLayer(const ModelParam&     model,
                           const AttentionParam& attn,
                           const LoraParam&      lora,
-                          size_t                tp_size,
+                          const EngineParam&    engine,
                           const Context<T>&     context);
 
-    void forward(TensorMap* outputs, const TensorMap* inputs, const WeightType* weights);
+    // Inputs & outputs of a layer. The fields of the step are set once by the caller, the ones of the layer before
+    // each layer. [batch_size] unless noted, `h_` ones are on the host, the optional ones are null when absent
+    struct ForwardParam {
+        // of the layer
+        T*   input;   // [token_num, hidden_units]
+        T*   output;  // [token_num, hidden_units], may be `input`
+        int  layer_id;
+        int* cu_q_len;    // [batch_size + 1]
+        int* cu_k_len;    // [batch_size + 1]
+        int* h_cu_q_len;  // [batch_size + 1]
+        int* h_cu_k_len;  // [batch_size + 1]
+
+        // of the step
+        int    token_num;
+        int    dc_batch_size;
+        int    pf_batch_size;
+        int    dc_max_k_len;  // lower bound of `max_k_len` for decoding, so that the launch config is stable
+        int*   h_q_len;
+        int*   h_k_len;
+        bool*  finished;
+        float* rope_theta;
+        void** block_ptrs;
+        int*   cu_block_counts;  // [batch_size + 1]
+        int*   lora_mask;        // [token_num], optional
+        int*   evicted_len;      // optional
+
+        // groups of decoding sequences sharing a prefix, see `CascadeLayout`, optional
+        const int* cascade;
+        const int* h_cascade;
+
+        // sparse contexts of the decoding sequences, see `SparseLayout`, optional
+        int*       sparse;
+        const int* h_sparse;
+
+        // draft trees of the prefills under verification, see `AttentionParams::tree_mask`, [token_num], optional
+        const uint64_t* tree_mask;
+
+        // tiered kv cache, tokens in the quantized blocks preceding the recent ones of each sequence, optional
+        const int* cold_len;
+        const int* h_cold_len;
+
+        // attention mass of the decoding tokens on the blocks of their sequences, summed over the heads & layers,
+        // [dc_batch_size, block_score_stride], optional
+        float* block_scores;
+        int    block_score_stride;
+
+        // the blocks the partial blocks of the forks are copied from by the first write, see
+        // `BlockIteratorParams::cow_blocks`, [batch_size], optional
+        char** cow_blocks;
+
+        // error of the quantized kv cache on the new tokens of each layer of the stage, see `invokeKvQuantError_`,
+        // [layer_num, 4], optional
+        float* kv_error;
+    };
+
+    void forward(const ForwardParam& param, const WeightType* weights);
+
+    // buffers referenced by the kernels, used to validate captured graphs
+    std::vector<void*> buffers() const
+    {
+        return {qkv_buf_,
+                qkv_buf_3_,
+                tmp_kv_buf_,
+                lora_buf_,
+                mla_qkv_buf_,
+                mla_out_buf_,
+                mla_kv_buf_,
+                mla_kv_b_buf_,
+                cascade_q_buf_,
+                cascade_kv_buf_,
+                sparse_block_ptrs_};
+    }
 
     void prefill(T*                output,
                  T*                tmp_kv_buffer,
@@ -108,6 +198,10 @@ public:
                 const WeightType* weights);
 
 private:
+    // `kLlama` drops the branches of the configurations other than Llama-style attention, see `IsLlamaAttention`
+    template<bool kLlama>
+    void forward_impl(const ForwardParam& param, const WeightType* weights);
+
     void forward_mla(const T* inputs, int token_num, const WeightType& weights);
 
     void qk_norm(T* qkv, int token_num, const WeightType& weights);
@@ -120,6 +214,10 @@ private:
     const size_t local_head_num_;
     const size_t local_kv_head_num_;
 
+    // kv heads of the rank & offsets in the blocks of the layers when they differ, see `HasLayerKvConfig`
+    std::vector<int> layer_kv_head_num_;
+    std::vector<int> layer_offsets_;
+
     const AttentionParam param_;
     const ModelParam     model_param_;
     const LoraParam      lora_param_;
@@ -132,15 +230,20 @@ private:
 
     const bool is_free_buffer_after_forward_{false};
 
+    const bool is_llama_;  // chosen once at construction, see `IsLlamaAttention`
+
     cudaStream_t aux_stream_;
     cudaEvent_t  qkv_event_;
     cudaEvent_t  aux_event_;
 
     std::array<cudaStream_t, 2> streams_;
 
+    std::unique_ptr<SmPartition> partition_;  // decode & prefill attention on disjoint SMs, optional
+
     RNG rng_;
 
     RopeKernelParam rope_param_{};
+    float*          rope_table_{};  // (cos, sin) by timestep, optional
 
     T*     qkv_buf_{};
     T*     q_buf_2_{};
@@ -160,8 +263,39 @@ private:
     int*   split_cnt_{};
     int*   barriers_{};  // always zero
 
+    // split-kv workspace of the prefills running concurrently with the decodings
+    float* pf_partial_M_{};
+    float* pf_partial_L_{};
+    float* pf_partial_O_{};
+    int*   pf_split_cnt_{};
+    int*   pf_barriers_{};
+
     T* tmp_kv_buf_{};
 
+    // latent MLA cache
+    T* mla_qkv_buf_{};   // [token_num, H + 1, rope_dim + kv_lora_rank], absorbed Q of the heads & the latents
+    T* mla_out_buf_{};   // [token_num, H, rope_dim + kv_lora_rank]
+    T* mla_kv_buf_{};    // [2, sum_k_len, rope_dim + kv_lora_rank], flattened latents of prefills
+    T* mla_kv_b_buf_{};  // [sum_k_len, H, nope_dim + v_head_dim]
+
+    // cascade decoding
+    T* cascade_q_buf_{};   // [q_num, H, D], queries of the groups
+    T* cascade_kv_buf_{};  // [H, 2, sum_prefix_len, D], flattened prefixes of the groups
+
+    // block-sparse decoding
+    void** sparse_block_ptrs_{};  // [batch_size, width], blocks attended by the decoding tokens
+
+    size_t scratch_tokens_{};  // capacity of the qkv buffers in the planned scratch
+
+    // context parallelism, the ranks of `d_cp_group` hold interleaved runs of the tokens of each cache block & merge
+    // their partial outputs by the log2-sum-exp of the scores
+    ContextParallelParam cp_{};
+    size_t               cp_max_tokens_{};
+    float*               cp_lse_{};       // [cp_size, cp_max_tokens_, H], registered with `d_comm`
+    int*                 cp_cu_k_len_{};  // [batch_size + 1], local keys of the rank
+    std::vector<int>     h_cp_k_len_;
+    std::vector<int>     h_cp_cu_k_len_;
+
     bool is_allocate_buffer_    = false;
     bool is_allocate_workspace_ = false;
 };
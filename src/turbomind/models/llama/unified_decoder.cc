@@ -1,5 +1,7 @@
 
 
+#include <algorithm>
+#include <cstdlib>
 #include <cuda_runtime.h>
 #include <iterator>
 #include <numeric>
@@ -15,9 +17,25 @@
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/anomaly_handler.h"
 #include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/liveness_planner.h"
 
 namespace turbomind {
 
+static DataType GetCommQuantType(const std::string& name)
+{
+    if (name.empty() || name == "none") {
+        return TYPE_INVALID;
+    }
+    else if (name == "int8") {
+        return TYPE_INT8;
+    }
+    else if (name == "fp8") {
+        return TYPE_FP8_E4M3;
+    }
+    FT_CHECK_WITH_INFO(0, "unknown comm_quant: " + name);
+    return {};
+}
+
 template<class T>
 UnifiedDecoder<T>::UnifiedDecoder(const ModelParam&     model,
                                   const EngineParam&    engine,
@@ -31,32 +49,247 @@ UnifiedDecoder<T>::UnifiedDecoder(const ModelParam&     model,
     attn_dp_size_(engine.attn_dp_size),
     attn_dp_rank_(engine.attn_dp_rank),
     mlp_tp_size_(engine.mlp_tp_size),
-    attn_tp_group_(ctx.comm.d_tp_group),
+    // partial attention outputs of the context parallel ranks are summed along with those of the TP ranks
+    attn_tp_group_(engine.attn_cp_size > 1 ? ctx.comm.d_attn_group : ctx.comm.d_tp_group),
     rmsnorm_eps_(model.norm_eps),
     stream_(ctx.stream),
     allocator_(ctx.allocator.get()),
+    linear_(ctx.linear.get()),
     d_comm_(ctx.comm.d_comm),
+    profiler_(ctx.profiler.get()),
     dtype_(getTensorType<T>()),
-    tune_layer_num_(model.tune_layer_num)
+    tune_layer_num_(model.tune_layer_num),
+    is_llama_(IsLlamaDecoder(model, attn, moe, lora, engine)),
+    comm_overlap_tokens_(ctx.comm.d_comm && engine.attn_dp_size == 1 ? engine.comm_overlap_tokens : 0),
+    comm_quant_type_(GetCommQuantType(engine.comm_quant)),
+    pp_size_(engine.pp_size),
+    pp_rank_(engine.pp_rank),
+    layer_begin_(GetStageLayerRange((int)layer_num_, pp_size_, pp_rank_).first),
+    layer_end_(GetStageLayerRange((int)layer_num_, pp_size_, pp_rank_).second),
+    d_pp_comm_(ctx.comm.d_pp_comm),
+    pp_result_group_(ctx.comm.d_pp_result_group)
 {
-    attn_layer_ = std::make_unique<UnifiedAttentionLayer<T>>(model, attn, lora, attn_tp_size_, ctx);
+    // Graphs are limited to single GPU as the custom all-reduce tracks its packet flags on host. Debug checks
+    // synchronize the stream, which is illegal during capture
+    enable_cuda_graph_ = engine.enable_cuda_graph && !d_comm_ && !d_pp_comm_ && AnomalyHandler::level() == 0
+                         && !std::getenv("TM_DEBUG_LEVEL");
+
+    attn_layer_ = std::make_unique<UnifiedAttentionLayer<T>>(model, attn, lora, engine, ctx);
 
     if (std::accumulate(moe.expert_num.begin(), moe.expert_num.end(), 0LL)) {
-        moe_ffn_layer_ = std::make_unique<MoeFfnLayer<T>>(model, moe, mlp_tp_size_, ctx);
+        moe_ffn_layer_ = std::make_unique<MoeFfnLayer<T>>(model, moe, engine, ctx);
+        // MoE dispatch reads expert offsets on host
+        enable_cuda_graph_ = false;
     }
 
     if (std::accumulate(model.inter_size.begin(), model.inter_size.end(), 0LL)) {
         ffn_layer_ = std::make_unique<LlamaFfnLayer<T>>(model, ctx);
     }
 
+    if (engine.moe_shared_overlap && moe_ffn_layer_ && ffn_layer_) {
+        // the GEMMs of the shared experts are dispatched by the linear of the context with a workspace & a cuBLAS
+        // handle of their own stream
+        check_cuda_error(cudaStreamCreateWithFlags(&shared_stream_, cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_shared_fork_, cudaEventDisableTiming));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_shared_join_, cudaEventDisableTiming));
+        cublasCreate(&shared_cublas_handle_);
+        cublasSetStream(shared_cublas_handle_, shared_stream_);
+        shared_cublas_ = std::make_unique<cublasMMWrapper>(*ctx.cublas_wrapper, shared_cublas_handle_, shared_stream_);
+        shared_linear_ = std::make_unique<LlamaLinear<T>>(*ctx.linear, shared_cublas_.get(), shared_stream_);
+        shared_ffn_layer_ =
+            std::make_unique<LlamaFfnLayer<T>>(model, shared_stream_, shared_linear_.get(), allocator_);
+    }
+
+    {
+        // Same bound as the forward buffers of `LlamaBatch`, the FFN sees the tokens of all attention DP ranks
+        const size_t max_tokens     = engine.max_prefill_token_num + engine.max_batch_size;
+        const size_t max_ffn_tokens = round_up(max_tokens, (size_t)mlp_tp_size_) * attn_dp_size_;
+        // the layers with MoE have 0 inter size for the dense FFN
+        size_t max_inter_size = 0;
+        for (const auto& x : model.inter_size) {
+            max_inter_size = std::max(max_inter_size, ceil_div((size_t)x, (size_t)mlp_tp_size_));
+        }
+
+        if (engine.fp8_linear || engine.int8_linear) {
+            // quantized activations of the W8A8 GEMMs, the widest input is one of the hidden states, the attention
+            // output, the latent ranks of MLA or the intermediate of the (naive MoE) FFN
+            size_t max_k = std::max({model.hidden_units,
+                                     ceil_div(model.head_num * model.head_dim, (size_t)attn_tp_size_),
+                                     model.mla.q_lora_rank,
+                                     model.mla.kv_lora_rank,
+                                     max_inter_size});
+            if (moe.inter_size) {
+                const size_t moe_tp = engine.ep_size > 1 ? 1 : mlp_tp_size_;
+                max_k               = std::max(max_k, ceil_div((size_t)moe.inter_size, moe_tp));
+            }
+            linear_->ReserveFp8Buffer(max_ffn_tokens, max_k);
+            if (shared_linear_) {
+                shared_linear_->ReserveFp8Buffer(max_ffn_tokens, max_k);
+            }
+        }
+
+        // Phases of a layer, the routed experts are alive from the gating to the reduction, which spans the shared
+        // experts (the dense FFN)
+        enum
+        {
+            kAttn,
+            kMoeForward,
+            kFfn,
+            kMoeReduce
+        };
+
+        LivenessPlanner planner;
+
+        // the shared experts running next to the routed ones are alive from the gating, their output till the
+        // reduction. The dense FFN of the other layers takes the same scratch
+        const int ffn_first = shared_ffn_layer_ ? kMoeForward : kFfn;
+
+        const int attn = planner.Add(attn_layer_->PlanScratch(nullptr, max_tokens), kAttn, kAttn);
+        const int ffn =
+            ffn_layer_ ?
+                planner.Add(ffn_layer_->PlanScratch(nullptr, max_ffn_tokens, max_inter_size), ffn_first, kFfn) :
+                -1;
+        const int moe = moe_ffn_layer_ ?
+                            planner.Add(moe_ffn_layer_->PlanScratch(nullptr, max_ffn_tokens), kMoeForward, kMoeReduce) :
+                            -1;
+        const int shared =
+            shared_ffn_layer_ ? planner.Add(sizeof(T) * max_ffn_tokens * hidden_units_, kMoeForward, kMoeReduce) : -1;
+
+        scratch_ = allocator_->malloc(planner.Plan(), false);
+
+        auto base = [&](int id) { return (char*)scratch_ + planner.offset(id); };
+
+        attn_layer_->PlanScratch(base(attn), max_tokens);
+        if (ffn_layer_) {
+            ffn_layer_->PlanScratch(base(ffn), max_ffn_tokens, max_inter_size);
+        }
+        if (moe_ffn_layer_) {
+            moe_ffn_layer_->PlanScratch(base(moe), max_ffn_tokens);
+        }
+        if (shared_ffn_layer_) {
+            shared_ffn_layer_->PlanScratch(base(ffn), max_ffn_tokens, max_inter_size);
+            shared_out_ = (T*)base(shared);
+        }
+    }
+
     check_cuda_error(cudaEventCreateWithFlags(&ev_h_cu_x_, cudaEventDisableTiming));
+
+    if (comm_overlap_tokens_) {
+        // so that the allreduce kernels are scheduled as soon as SMs free up from the GEMMs
+        int priority{};
+        check_cuda_error(cudaDeviceGetStreamPriorityRange(nullptr, &priority));
+        check_cuda_error(cudaStreamCreateWithPriority(&comm_stream_, cudaStreamNonBlocking, priority));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_ffn_, cudaEventDisableTiming));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_comm_, cudaEventDisableTiming));
+    }
+
+    if (engine.decode_megakernel_batch) {
+        // Single GPU as the custom all-reduce can't run inside the kernel, dense Llama-style layers over an
+        // unquantized kv cache
+        const int  group    = model.head_num / std::max<size_t>(model.kv_head_num, 1);
+        const bool eligible = sizeof(T) == 2 && is_llama_ && !d_comm_ && pp_size_ == 1 && attn_dp_size_ == 1
+                              && engine.attn_cp_size == 1 && !model.quant_policy && !HasLayerKvConfig(model)
+                              && !attn.pre_rope_kv_cache && !attn.mla_latent_cache && !attn.sparse_decode_blocks
+                              && !engine.cache_recent_blocks && (model.head_dim == 64 || model.head_dim == 128)
+                              && model.kv_head_num
+                              && model.head_num % model.kv_head_num == 0 && group <= DecodeMegakernel::kMaxGroup
+                              && hidden_units_ % 32 == 0
+                              && std::all_of(model.inter_size.begin(), model.inter_size.end(), [](int n) {
+                                     return n % 16 == 0;
+                                 });
+        if (eligible) {
+            size_t max_inter_size = 0;
+            for (const auto& x : model.inter_size) {
+                max_inter_size = std::max(max_inter_size, (size_t)x);
+            }
+            megakernel_batch_ = std::min(engine.decode_megakernel_batch, DecodeMegakernel::kMaxBatch);
+
+            auto& p       = megakernel_;
+            p.hidden      = hidden_units_;
+            p.head_num    = model.head_num;
+            p.kv_head_num = model.kv_head_num;
+            p.head_dim    = model.head_dim;
+            p.block_len   = attn.cache_block_seq_len;
+            p.eps         = rmsnorm_eps_;
+            init_rope_kernel_param(attn.rope, p.rope);
+            // model predefined softmax scale or 1/sqrt(d), MSVC does not have M_LOG2E
+            p.inv_sqrt_dh = (float)std::log2(expf(1.))
+                            * (attn.softmax_scale ? attn.softmax_scale : 1.f / std::sqrt((float)model.head_dim));
+
+            const size_t batch  = megakernel_batch_;
+            const size_t splits = DecodeMegakernel::kMaxSplits;
+            const size_t sizes[]{batch * (p.head_num + 2 * p.kv_head_num) * p.head_dim * sizeof(T),
+                                 batch * p.head_num * p.head_dim * sizeof(T),
+                                 batch * max_inter_size * sizeof(T),
+                                 batch * p.head_num * splits * p.head_dim * sizeof(float),
+                                 batch * p.head_num * splits * 2 * sizeof(float)};
+            size_t       offsets[std::size(sizes) + 1]{};
+            for (size_t i = 0; i < std::size(sizes); ++i) {
+                offsets[i + 1] = offsets[i] + round_up(sizes[i], (size_t)256);
+            }
+            megakernel_buf_ = allocator_->malloc(offsets[std::size(sizes)], false);
+
+            auto base    = [&](int i) { return (char*)megakernel_buf_ + offsets[i]; };
+            p.qkv_buf    = (T*)base(0);
+            p.attn_buf   = (T*)base(1);
+            p.inter_buf  = (T*)base(2);
+            p.partial_O  = (float*)base(3);
+            p.partial_ML = (float*)base(4);
+
+            if constexpr (sizeof(T) == 2) {
+                megakernel_grid_ = GetDecodeMegakernelGridSize<T>(model.head_dim);
+            }
+            TM_LOG_INFO("[UnifiedDecoder] decoding megakernel for batches <= %d, %d CTAs",
+                        megakernel_batch_,
+                        megakernel_grid_);
+        }
+        else {
+            TM_LOG_WARNING("[UnifiedDecoder] the decoding megakernel requires single GPU dense f16/bf16 Llama-style "
+                           "layers over an unquantized kv cache, disabled");
+        }
+    }
+
+    if (pp_size_ > 1) {
+        FT_CHECK(d_pp_comm_);
+        check_cuda_error(cudaStreamCreateWithFlags(&pp_stream_, cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_pp_send_, cudaEventDisableTiming));
+        check_cuda_error(cudaEventCreateWithFlags(&ev_pp_recv_, cudaEventDisableTiming));
+    }
 }
 
 template<typename T>
 UnifiedDecoder<T>::~UnifiedDecoder()
 {
+    for (auto& [_, g] : graphs_) {
+        if (g.exec) {
+            cudaGraphExecDestroy(g.exec);
+        }
+    }
     freeBuffer();
+    allocator_->free(&scratch_);
+    if (megakernel_buf_) {
+        allocator_->free(&megakernel_buf_);
+    }
     check_cuda_error(cudaEventDestroy(ev_h_cu_x_));
+    if (comm_stream_) {
+        check_cuda_error(cudaEventDestroy(ev_comm_));
+        check_cuda_error(cudaEventDestroy(ev_ffn_));
+        check_cuda_error(cudaStreamDestroy(comm_stream_));
+    }
+    if (pp_stream_) {
+        check_cuda_error(cudaEventDestroy(ev_pp_recv_));
+        check_cuda_error(cudaEventDestroy(ev_pp_send_));
+        check_cuda_error(cudaStreamDestroy(pp_stream_));
+    }
+    if (shared_stream_) {
+        shared_ffn_layer_.reset();
+        shared_linear_.reset();
+        shared_cublas_.reset();
+        cublasDestroy(shared_cublas_handle_);
+        check_cuda_error(cudaEventDestroy(ev_shared_join_));
+        check_cuda_error(cudaEventDestroy(ev_shared_fork_));
+        check_cuda_error(cudaStreamDestroy(shared_stream_));
+    }
 }
 
 template<typename T>
@@ -78,37 +311,62 @@ void UnifiedDecoder<T>::freeBuffer()
 }
 
 template<typename T>
-void UnifiedDecoder<T>::forwardSelfAttn(T*                attn_io,
-                                        TensorMap*        _outputs,
-                                        const TensorMap*  _inputs,
-                                        size_t            token_num,
-                                        size_t            batch_size,
-                                        int               layer_id,
-                                        const WeightType* weight)
+void UnifiedDecoder<T>::forwardSelfAttn(T*                  attn_io,
+                                        const ForwardParam& param,
+                                        size_t              token_num,
+                                        size_t              batch_size,
+                                        int                 layer_id,
+                                        const WeightType*   weight)
 {
-    TensorMap inputs(*_inputs);
-    inputs.insert("input_query", {MEMORY_GPU, dtype_, {token_num, hidden_units_}, attn_io});
-    inputs.insert("layer_id", {MEMORY_CPU, TYPE_INT32, {1}, &layer_id});
-    inputs.insert("cu_q_len", {MEMORY_GPU, TYPE_INT32, {batch_size + 1}, cu_q_len_});
-    inputs.insert("cu_k_len", {MEMORY_GPU, TYPE_INT32, {batch_size + 1}, cu_k_len_});
-    inputs.insert("h_cu_q_len", {MEMORY_CPU, TYPE_INT32, {batch_size + 1}, h_cu_q_len_});
-    inputs.insert("h_cu_k_len", {MEMORY_CPU, TYPE_INT32, {batch_size + 1}, h_cu_k_len_});
-
-    TensorMap outputs(*_outputs);
-    outputs.insert("hidden_features", {MEMORY_GPU, dtype_, {token_num, hidden_units_}, attn_io});
-
-    attn_layer_->forward(&outputs, &inputs, &weight->self_attn_weights);
+    typename UnifiedAttentionLayer<T>::ForwardParam p = param;
+
+    p.input      = attn_io;
+    p.output     = attn_io;
+    p.token_num  = token_num;
+    p.layer_id   = layer_id;
+    p.cu_q_len   = cu_q_len_;
+    p.cu_k_len   = cu_k_len_;
+    p.h_cu_q_len = h_cu_q_len_;
+    p.h_cu_k_len = h_cu_k_len_;
+
+    attn_layer_->forward(p, &weight->self_attn_weights);
 }
 
 template<typename T>
-void UnifiedDecoder<T>::AllreduceResidualRMSnorm(T*         hidden_states,
-                                                 T*         residual,
-                                                 const T*   bias,
-                                                 const T*   weight,
-                                                 int        token_num,
-                                                 int        group0,
-                                                 int        group1,
-                                                 const int* local_token_nums)
+std::pair<fp8_e4m3*, float*> UnifiedDecoder<T>::Fp8Input(const LlamaDenseWeight<T>* w, const T* x, int token_num)
+{
+    // The anomaly handler rewrites the inf/NaN of the normed states after the norm, the GEMM quantizes the fixed ones
+    // itself then
+    if (AnomalyHandler::level() >= 2) {
+        return {};
+    }
+    if (w && w->kernel && w->type == turbomind::WeightType::kFP8 && w->input_dims == hidden_units_) {
+        return linear_->PrepareFp8Input(x, token_num, hidden_units_);
+    }
+    return {};
+}
+
+template<typename T>
+const LlamaDenseWeight<T>* UnifiedDecoder<T>::FfnInputWeight(const WeightType* weight) const
+{
+    // MoE layers read the input with the router and the experts first
+    if (!weight->moe_weights.experts.empty()) {
+        return nullptr;
+    }
+    const auto& ffn = weight->ffn_weights;
+    return ffn.fused_gating_intermediate.kernel ? &ffn.fused_gating_intermediate : &ffn.gating;
+}
+
+template<typename T>
+void UnifiedDecoder<T>::AllreduceResidualRMSnorm(T*                         hidden_states,
+                                                 T*                         residual,
+                                                 const T*                   bias,
+                                                 const T*                   weight,
+                                                 int                        token_num,
+                                                 int                        group0,
+                                                 int                        group1,
+                                                 const int*                 local_token_nums,
+                                                 const LlamaDenseWeight<T>* next)
 {
     if (0) {}
     else if (group0 || group1) {
@@ -126,128 +384,199 @@ void UnifiedDecoder<T>::AllreduceResidualRMSnorm(T*         hidden_states,
         sync_check_cuda_error();
     }
     else if (d_comm_) {
-        d_comm_->AllreduceResidualBiasRMSnorm(
-            hidden_states, residual, bias, weight, rmsnorm_eps_, hidden_units_, token_num, dtype_, 0, stream_);
-        sync_check_cuda_error();
+        AllreduceResidualRMSnormTP(hidden_states, residual, bias, weight, token_num, stream_);
     }
     else {
+        // the norm quantizes the activations of a fp8 GEMM in the same pass
+        const auto [q_dst, q_scales] = Fp8Input(next, hidden_states, token_num);
         invokeBiasResidualRMSNorm(
-            residual, hidden_states, weight, bias, hidden_units_, token_num, rmsnorm_eps_, stream_);
+            residual, hidden_states, weight, bias, hidden_units_, token_num, rmsnorm_eps_, stream_, q_dst, q_scales);
         sync_check_cuda_error();
     }
 }
 
 template<typename T>
-void UnifiedDecoder<T>::forward(TensorMap* outputs, const TensorMap* inputs, const std::vector<WeightType*>* weights)
+void UnifiedDecoder<T>::AllreduceResidualRMSnormTP(
+    T* hidden_states, T* residual, const T* bias, const T* weight, int token_num, cudaStream_t stream)
 {
-    /**
-     * input tensors:
-     *   \param decoder_input [token_num, hidden_units], float
-     *   \param output_norm_weight [hidden_dims], float
-     *   \param cu_block_counts [batch_size+1], int
-     *   \param finished [batch_size], bool
-     *   \param rope_theta [batch_size], float
-     *   \param h_q_len [batch_size], int on cpu
-     *   \param h_k_len [batch_size], int on cpu
-     *   \param pf_batch_size [1], int on cpu
-     *   \param dc_batch_size [1], int on cpu
-     *
-     * output tensors:
-     *   \param decoder_output [num_token, hidden_units],
-     *   \param last_token_hidden_units [batch_size, hidden_units]
-     *   \param block_ptrs [total_block_counts], void*
-     */
-
-    const size_t token_num = inputs->at("decoder_input").shape[0];
-
-    const int pf_batch_size = inputs->getVal<int>("pf_batch_size");
-    const int dc_batch_size = inputs->getVal<int>("dc_batch_size");
-    const int batch_size    = pf_batch_size + dc_batch_size;
+    if (comm_quant_type_ != TYPE_INVALID) {
+        d_comm_->AllReduceSumQuant(
+            hidden_states, hidden_states, (size_t)token_num * hidden_units_, dtype_, comm_quant_type_, 0, stream);
+        sync_check_cuda_error();
+        invokeBiasResidualRMSNorm(
+            residual, hidden_states, weight, bias, hidden_units_, token_num, rmsnorm_eps_, stream);
+    }
+    else {
+        d_comm_->AllreduceResidualBiasRMSnorm(
+            hidden_states, residual, bias, weight, rmsnorm_eps_, hidden_units_, token_num, dtype_, 0, stream);
+    }
+    sync_check_cuda_error();
+}
 
-    const int* h_q_len = inputs->getPtr<int>("h_q_len");
-    const int* h_k_len = inputs->getPtr<int>("h_k_len");
+template<typename T>
+void UnifiedDecoder<T>::forwardFfnOverlapped(T*                hidden_states,
+                                             T*                residual,
+                                             const T*          bias,
+                                             const T*          scale_weight,
+                                             int               token_num,
+                                             int               layer_id,
+                                             const WeightType* weight)
+{
+    // rounded up to balance the chunks
+    const int chunk_num = token_num / comm_overlap_tokens_;
+    const int chunk     = round_up(ceil_div(token_num, chunk_num), 16);
 
-    T* residual      = inputs->getPtr<T>("decoder_input");
-    T* hidden_states = outputs->getPtr<T>("decoder_output");
+    for (int first = 0; first < token_num; first += chunk) {
+        const size_t num = std::min(chunk, token_num - first);
+        // rows of the tokens are independent for both the FFN & the norm
+        T* x = hidden_states + (size_t)first * hidden_units_;
+        T* r = residual + (size_t)first * hidden_units_;
 
-    T* last_token_hidden_units = outputs->getPtr<T>("last_token_hidden_units");
+        ffn_layer_->forward({x, x, (int)num, layer_id, nullptr}, &weight->ffn_weights);
 
-    {  // compute cumulative lengths
+        check_cuda_error(cudaEventRecord(ev_ffn_, stream_));
+        check_cuda_error(cudaStreamWaitEvent(comm_stream_, ev_ffn_));
 
-        h_cu_k_len_ = h_cu_q_len_ + batch_size + 1;
-        cu_k_len_   = cu_q_len_ + batch_size + 1;
+        AllreduceResidualRMSnormTP(x, r, bias, scale_weight, num, comm_stream_);
+    }
 
-        h_cu_q_len_[0] = h_cu_k_len_[0] = 0;
+    check_cuda_error(cudaEventRecord(ev_comm_, comm_stream_));
+    check_cuda_error(cudaStreamWaitEvent(stream_, ev_comm_));
+}
 
-        for (int i = 1; i <= batch_size; ++i) {
-            h_cu_q_len_[i] = h_cu_q_len_[i - 1] + h_q_len[i - 1];
-            h_cu_k_len_[i] = h_cu_k_len_[i - 1] + h_k_len[i - 1];
-        }
+template<typename T>
+void UnifiedDecoder<T>::forwardLayers(const ForwardParam&             param,
+                                      const std::vector<WeightType*>* weights,
+                                      T*                              residual,
+                                      T*                              hidden_states,
+                                      T*                              global_hidden_states,
+                                      T*                              last_token_hidden_units,
+                                      size_t                          token_num,
+                                      size_t                          global_token_num,
+                                      int                             pf_batch_size,
+                                      int                             dc_batch_size,
+                                      const int*                      local_token_nums)
+{
+    auto invoke = [&](auto func) {
+        (this->*func)(param,
+                      weights,
+                      residual,
+                      hidden_states,
+                      global_hidden_states,
+                      last_token_hidden_units,
+                      token_num,
+                      global_token_num,
+                      pf_batch_size,
+                      dc_batch_size,
+                      local_token_nums);
+    };
+    if (is_llama_) {
+        invoke(&UnifiedDecoder::forwardLayersImpl<true>);
+    }
+    else {
+        invoke(&UnifiedDecoder::forwardLayersImpl<false>);
+    }
+}
 
-        check_cuda_error(
-            cudaMemcpyAsync(cu_q_len_, h_cu_q_len_, 2 * sizeof(int) * (batch_size + 1), cudaMemcpyDefault, stream_));
+template<typename T>
+template<bool kLlama>
+void UnifiedDecoder<T>::forwardLayersImpl(const ForwardParam&             param,
+                                          const std::vector<WeightType*>* weights,
+                                          T*                              residual,
+                                          T*                              hidden_states,
+                                          T*                              global_hidden_states,
+                                          T*                              last_token_hidden_units,
+                                          size_t                          token_num,
+                                          size_t                          global_token_num,
+                                          int                             pf_batch_size,
+                                          int                             dc_batch_size,
+                                          const int*                      local_token_nums)
+{
+    const int batch_size = pf_batch_size + dc_batch_size;
+    const int pf_offset  = dc_batch_size;
 
-        check_cuda_error(cudaEventRecord(ev_h_cu_x_, stream_));
+    // the hidden states were written by the embedding lookup or the previous step since the last norm
+    linear_->InvalidateFp8Input();
+    if (shared_linear_) {
+        shared_linear_->InvalidateFp8Input();
     }
 
-    const int pf_offset = dc_batch_size;
-
-    /// Offset hidden states buffer for mixed DP
-    T*         global_hidden_states = hidden_states;
-    size_t     global_token_num     = token_num;
-    const int* local_token_nums     = inputs->getPtr<int>("local_token_nums", nullptr);
-    if (attn_dp_size_ > 1) {
-        FT_CHECK(local_token_nums);
-        std::vector cumul_token_nums(attn_dp_size_ + 1, 0);
-        std::inclusive_scan(local_token_nums, local_token_nums + attn_dp_size_, cumul_token_nums.begin() + 1);
-        hidden_states    = hidden_states + (size_t)cumul_token_nums[attn_dp_rank_] * hidden_units_;
-        global_token_num = cumul_token_nums.back();
-        // TM_LOG_ERROR("rank %d, global_token_num %d, offset %d",
-        //              attn_dp_rank_,
-        //              global_token_num,
-        //              cumul_token_nums[attn_dp_rank_]);
+    if (pp_rank_ > 0) {
+        // Residual after the layers of the previous stage, the norm of its last layer is recomputed here
+        d_pp_comm_->Recv(residual, token_num * hidden_units_, dtype_, pp_rank_ - 1, 0, stream_);
+        sync_check_cuda_error();
     }
 
     /////////////////////////////////////////////
     /// RMSNorm
-    invokeRMSNorm(hidden_states,
-                  residual,
-                  weights->at(0)->self_attn_norm_weights,
-                  hidden_units_,
-                  token_num,
-                  rmsnorm_eps_,
-                  stream_);
-    sync_check_cuda_error();
+    {
+        const auto [q_dst, q_scales] =
+            Fp8Input(&weights->at(layer_begin_)->self_attn_weights.qkv, hidden_states, token_num);
+        invokeRMSNorm(hidden_states,
+                      residual,
+                      weights->at(layer_begin_)->self_attn_norm_weights,
+                      hidden_units_,
+                      token_num,
+                      rmsnorm_eps_,
+                      stream_,
+                      q_dst,
+                      q_scales);
+        sync_check_cuda_error();
+    }
 
-    count_and_fix(hidden_states, token_num * hidden_units_, Concat("norm0", 0), 2);
+    count_and_fix(hidden_states, token_num * hidden_units_, Concat("norm0", layer_begin_), 2);
 
-    for (size_t layer = 0; layer < layer_num_; ++layer) {
+    for (int layer = layer_begin_; layer < layer_end_; ++layer) {
 
         /// TODO: do not skip the layers when they are heterogeneous
-        if (isTuning() && layer >= tune_layer_num_) {
+        if (isTuning() && layer - layer_begin_ >= tune_layer_num_) {
             continue;
         }
 
+        // offloaded linear weights of the layer
+        if constexpr (!kLlama) {
+            if (auto pager = weights->at(layer)->pager) {
+                pager->Acquire(layer, stream_);
+            }
+        }
+
+        // the cache blocks of the layer copied in by this step
+        if (block_copier_) {
+            block_copier_->Acquire(layer - layer_begin_, stream_);
+        }
+
         /////////////////////////////////////////////
         /// self-attention
-        forwardSelfAttn(hidden_states,  //
-                        outputs,
-                        inputs,
-                        token_num,
-                        batch_size,
-                        layer,
-                        weights->at(layer));
+        {
+            ProfileScope _{profiler_, StepProfiler::kAttention, layer, stream_};
+            // kv cache of the stage only holds its own layers
+            forwardSelfAttn(hidden_states,  //
+                            param,
+                            token_num,
+                            batch_size,
+                            layer - layer_begin_,
+                            weights->at(layer));
+        }
 
         count_and_fix(hidden_states, token_num * hidden_units_, Concat("attn_block", layer), 2);
 
-        AllreduceResidualRMSnorm(global_hidden_states,
-                                 residual,
-                                 weights->at(layer)->self_attn_weights.output.bias,
-                                 weights->at(layer)->ffn_norm_weights,
-                                 token_num,
-                                 attn_tp_group_,
-                                 0,
-                                 local_token_nums);
+        // the kv of the layer is written, sent while the following layers are computed
+        if (kv_streamer_) {
+            kv_streamer_->Push(layer - layer_begin_, stream_);
+        }
+
+        {
+            ProfileScope _{profiler_, StepProfiler::kComm, layer, stream_};
+            AllreduceResidualRMSnorm(global_hidden_states,
+                                     residual,
+                                     kLlama ? nullptr : weights->at(layer)->self_attn_weights.output.bias,
+                                     weights->at(layer)->ffn_norm_weights,
+                                     token_num,
+                                     attn_tp_group_,
+                                     0,
+                                     local_token_nums,
+                                     FfnInputWeight(weights->at(layer)));
+        }
 
         count_and_fix(residual, token_num * hidden_units_, Concat("residual0", layer), 2);
         count_and_fix(hidden_states, token_num * hidden_units_, Concat("norm1", layer), 2);
@@ -255,54 +584,122 @@ void UnifiedDecoder<T>::forward(TensorMap* outputs, const TensorMap* inputs, con
         ////////////////////////////////////////////
         /// feed-forward network
 
-        const bool is_moe = !weights->at(layer)->moe_weights.experts.empty();
-        if (is_moe) {
-            // Writes to internal buffer
-            moe_ffn_layer_->forward(
-                nullptr, global_hidden_states, global_token_num, layer, weights->at(layer)->moe_weights);
+        const bool is_moe = !kLlama && !weights->at(layer)->moe_weights.experts.empty();
+
+        // the dense FFN runs in every Llama-style layer, LoRA is not enabled for them
+        const bool has_ffn   = kLlama || weights->at(layer)->ffn_weights.output.kernel;
+        const bool lora_mask = !kLlama && param.lora_mask;
+
+        // The next stage recomputes the norm of the last layer of a non-last stage from the residual
+        const bool is_last_layer = layer == layer_end_ - 1;
+
+        auto scale_weight = !is_last_layer ? weights->at(layer + 1)->self_attn_norm_weights :
+                                             param.output_norm_weight;
+
+        // large prefills of dense layers
+        if (comm_overlap_tokens_ && (int)token_num >= 2 * comm_overlap_tokens_ && !is_moe && has_ffn && !lora_mask) {
+            ProfileScope _{profiler_, StepProfiler::kFfn, layer, stream_};
+            forwardFfnOverlapped(global_hidden_states,
+                                 residual,
+                                 weights->at(layer)->ffn_weights.output.bias,
+                                 scale_weight,
+                                 token_num,
+                                 layer,
+                                 weights->at(layer));
+            count_and_fix(residual, token_num * hidden_units_, Concat("residual1", layer), 2);
+            count_and_fix(hidden_states, token_num * hidden_units_, Concat("norm0", layer + 1), 2);
+            continue;
+        }
+
+        if (profiler_) {
+            profiler_->Begin(StepProfiler::kFfn, layer, stream_);
         }
 
-        if (weights->at(layer)->ffn_weights.output.kernel) {
-            int       layer_id = layer;  // int is needed
-            TensorMap ffn_inputs{
-                {"ffn_input", {MEMORY_GPU, dtype_, {global_token_num, hidden_units_}, global_hidden_states}},
-                {"layer_id", {MEMORY_CPU, TYPE_INT32, {1}, &layer_id}},
-            };
-            TensorMap ffn_outputs{
-                {"ffn_output", {MEMORY_GPU, dtype_, {global_token_num, hidden_units_}, global_hidden_states}},
-            };
-            if (inputs->isExist("lora_mask")) {
-                ffn_inputs.insert({"lora_mask", inputs->at("lora_mask")});
+        // The shared experts only read the input like the routed experts, their output is computed into a buffer of
+        // its own on `shared_stream_` and merged by the reduction of the routed experts
+        const bool overlap_shared =
+            shared_ffn_layer_ && is_moe && has_ffn && !lora_mask && !linear_->lora_batch() && !isTuning();
+
+        if (overlap_shared) {
+            check_cuda_error(cudaEventRecord(ev_shared_fork_, stream_));
+            check_cuda_error(cudaStreamWaitEvent(shared_stream_, ev_shared_fork_));
+            shared_ffn_layer_->forward(
+                {shared_out_, global_hidden_states, (int)global_token_num, layer, nullptr},
+                &weights->at(layer)->ffn_weights);
+            check_cuda_error(cudaEventRecord(ev_shared_join_, shared_stream_));
+        }
+
+        if constexpr (!kLlama) {
+            if (is_moe) {
+                // Writes to internal buffer
+                moe_ffn_layer_->forward(
+                    nullptr, global_hidden_states, global_token_num, layer, weights->at(layer)->moe_weights);
             }
-            ffn_layer_->forward(&ffn_outputs, &ffn_inputs, &weights->at(layer)->ffn_weights);
         }
 
-        if (is_moe) {
-            moe_ffn_layer_->reduce(
-                global_hidden_states, global_token_num, (bool)ffn_layer_, layer, weights->at(layer)->moe_weights);
+        if (has_ffn && !overlap_shared) {
+            ffn_layer_->forward({global_hidden_states,
+                                 global_hidden_states,
+                                 (int)global_token_num,
+                                 layer,
+                                 lora_mask ? param.lora_mask : nullptr},
+                                &weights->at(layer)->ffn_weights);
         }
 
-        count_and_fix(global_hidden_states, global_token_num * hidden_units_, Concat("ffn_block", layer), 2);
+        if constexpr (!kLlama) {
+            if (is_moe) {
+                if (overlap_shared) {
+                    check_cuda_error(cudaStreamWaitEvent(stream_, ev_shared_join_));
+                }
+                moe_ffn_layer_->reduce(global_hidden_states,
+                                       global_token_num,
+                                       (bool)ffn_layer_,
+                                       layer,
+                                       weights->at(layer)->moe_weights,
+                                       overlap_shared ? shared_out_ : nullptr);
+            }
+        }
 
-        const bool is_last_layer = layer == layer_num_ - 1;
+        if (profiler_) {
+            profiler_->End(StepProfiler::kFfn, layer, stream_);
+        }
 
-        auto scale_weight = !is_last_layer ? weights->at(layer + 1)->self_attn_norm_weights :
-                                             inputs->at("output_norm_weight").getPtr<T>();
+        count_and_fix(global_hidden_states, global_token_num * hidden_units_, Concat("ffn_block", layer), 2);
 
-        AllreduceResidualRMSnorm(global_hidden_states,
-                                 residual,
-                                 weights->at(layer)->ffn_weights.output.bias,
-                                 scale_weight,
-                                 token_num,
-                                 0,
-                                 attn_tp_group_,
-                                 local_token_nums);
+        {
+            ProfileScope _{profiler_, StepProfiler::kComm, layer, stream_};
+            AllreduceResidualRMSnorm(global_hidden_states,
+                                     residual,
+                                     kLlama ? nullptr : weights->at(layer)->ffn_weights.output.bias,
+                                     scale_weight,
+                                     token_num,
+                                     0,
+                                     attn_tp_group_,
+                                     local_token_nums,
+                                     !is_last_layer ? &weights->at(layer + 1)->self_attn_weights.qkv : nullptr);
+        }
         sync_check_cuda_error();
 
         count_and_fix(residual, token_num * hidden_units_, Concat("residual1", layer), 2);
         count_and_fix(hidden_states, token_num * hidden_units_, Concat("norm0", layer + 1), 2);
     }
 
+    if (pp_rank_ < pp_size_ - 1) {
+        d_pp_comm_->Send(residual, token_num * hidden_units_, dtype_, pp_rank_ + 1, 0, stream_);
+        sync_check_cuda_error();
+        // Results of the last stage, on a side stream so that the following mini-batches are not blocked
+        check_cuda_error(cudaEventRecord(ev_pp_send_, stream_));
+        check_cuda_error(cudaStreamWaitEvent(pp_stream_, ev_pp_send_));
+        d_pp_comm_->Recv(last_token_hidden_units,
+                         (size_t)batch_size * hidden_units_,
+                         dtype_,
+                         pp_size_ - 1,
+                         pp_result_group_,
+                         pp_stream_);
+        sync_check_cuda_error();
+        return;
+    }
+
     if (dc_batch_size) {
         check_cuda_error(cudaMemcpyAsync(last_token_hidden_units,
                                          hidden_states,
@@ -323,10 +720,321 @@ void UnifiedDecoder<T>::forward(TensorMap* outputs, const TensorMap* inputs, con
         count_and_fix(last_token_hidden_units + pf_offset * hidden_units_, pf_batch_size * hidden_units_, "pf_out", 2);
     }
 
+    // Earlier stages sample the same tokens
+    for (int i = 0; i < pp_size_ - 1; ++i) {
+        d_pp_comm_->Send(
+            last_token_hidden_units, (size_t)batch_size * hidden_units_, dtype_, i, pp_result_group_, stream_);
+        sync_check_cuda_error();
+    }
+}
+
+template<typename T>
+void UnifiedDecoder<T>::waitPipeline()
+{
+    if (pp_rank_ < pp_size_ - 1) {
+        check_cuda_error(cudaEventRecord(ev_pp_recv_, pp_stream_));
+        check_cuda_error(cudaStreamWaitEvent(stream_, ev_pp_recv_));
+    }
+}
+
+template<typename T>
+bool UnifiedDecoder<T>::isDecodeGraphEligible(const ForwardParam&             param,
+                                              const std::vector<WeightType*>* weights,
+                                              int                             pf_batch_size,
+                                              int                             dc_batch_size)
+{
+    // Timing events can't be recorded into the graph, neither can the paging of offloaded weights
+    return enable_cuda_graph_ && !(profiler_ && profiler_->active()) && pf_batch_size == 0 && 0 < dc_batch_size
+           && dc_batch_size <= kMaxGraphBatchSize && !isTuning() && !param.lora_mask && !linear_->lora_batch()
+           && !param.cascade && !param.sparse && weights->at(0)->self_attn_weights.qkv.output_dims
+           && !weights->at(layer_begin_)->pager && !param.cold_len && !param.block_scores && !param.cow_blocks
+           && !param.kv_error;
+}
+
+template<typename T>
+bool UnifiedDecoder<T>::isMegakernelEligible(const ForwardParam&             param,
+                                             const std::vector<WeightType*>* weights,
+                                             int                             pf_batch_size,
+                                             int                             dc_batch_size)
+{
+    // a single token per sequence, no speculative drafts
+    if (!megakernel_batch_ || pf_batch_size || !dc_batch_size || dc_batch_size > megakernel_batch_
+        || (int)param.token_num != dc_batch_size || isTuning() || param.cascade || param.sparse || param.cold_len
+        || param.tree_mask || param.block_scores || param.cow_blocks || param.kv_error
+        || weights->at(layer_begin_)->pager) {
+        return false;
+    }
+    if (megakernel_weights_ < 0) {
+        auto dense = [](const LlamaDenseWeight<T>& w) {
+            return w.kernel && w.type == get_default_weight_type<T>() && !w.bias;
+        };
+        megakernel_weights_ =
+            std::all_of(weights->begin() + layer_begin_, weights->begin() + layer_end_, [&](const WeightType* w) {
+                const auto& ffn = w->ffn_weights;
+                return dense(w->self_attn_weights.qkv) && dense(w->self_attn_weights.output)
+                       && dense(ffn.fused_gating_intermediate) && dense(ffn.output);
+            });
+        if (!megakernel_weights_) {
+            TM_LOG_WARNING("[UnifiedDecoder] the decoding megakernel requires unquantized weights with fused gate & "
+                           "up, disabled");
+        }
+    }
+    return megakernel_weights_;
+}
+
+template<typename T>
+void UnifiedDecoder<T>::forwardDecodeMegakernel(const ForwardParam&             param,
+                                                const std::vector<WeightType*>* weights,
+                                                T*                              residual,
+                                                T*                              hidden_states,
+                                                T*                              last_token_hidden_units,
+                                                const int*                      h_k_len,
+                                                int                             batch_size)
+{
+    if constexpr (sizeof(T) == 2) {
+        // splits of the kv of a sequence to fill the grid, 64 tokens at least
+        const int max_k_len = *std::max_element(h_k_len, h_k_len + batch_size);
+        const int split_cnt = std::clamp(std::min(cdiv(megakernel_grid_, batch_size * megakernel_.kv_head_num),
+                                                  cdiv(max_k_len, 64)),
+                                         1,
+                                         DecodeMegakernel::kMaxSplits);
+
+        invokeRMSNorm(hidden_states,
+                      residual,
+                      weights->at(layer_begin_)->self_attn_norm_weights,
+                      hidden_units_,
+                      batch_size,
+                      rmsnorm_eps_,
+                      stream_);
+        sync_check_cuda_error();
+
+        auto p            = megakernel_;
+        p.residual        = residual;
+        p.hidden_states   = hidden_states;
+        p.block_ptrs      = (char**)param.block_ptrs;
+        p.cu_block_counts = param.cu_block_counts;
+        p.cu_k_len        = cu_k_len_;
+        p.rope.offset     = param.evicted_len;
+        p.batch_size      = batch_size;
+        p.split_cnt       = split_cnt;
+
+        for (int layer = layer_begin_; layer < layer_end_; ++layer) {
+            const WeightType& w = *weights->at(layer);
+
+            if (block_copier_) {
+                block_copier_->Acquire(layer - layer_begin_, stream_);
+            }
+
+            p.qkv         = (const T*)w.self_attn_weights.qkv.kernel;
+            p.output      = (const T*)w.self_attn_weights.output.kernel;
+            p.gate_up     = (const T*)w.ffn_weights.fused_gating_intermediate.kernel;
+            p.down        = (const T*)w.ffn_weights.output.kernel;
+            p.ffn_norm    = w.ffn_norm_weights;
+            p.next_norm   = layer + 1 < layer_end_ ? weights->at(layer + 1)->self_attn_norm_weights :
+                                                     param.output_norm_weight;
+            p.inter_size  = w.ffn_weights.inter_size;
+            p.interleaved = w.ffn_weights.is_fused_silu;
+            p.layer_id    = layer - layer_begin_;
+
+            invokeDecodeMegakernel(p, megakernel_grid_, stream_);
+            sync_check_cuda_error();
+
+            if (kv_streamer_) {
+                kv_streamer_->Push(layer - layer_begin_, stream_);
+            }
+        }
+
+        check_cuda_error(cudaMemcpyAsync(last_token_hidden_units,
+                                         hidden_states,
+                                         sizeof(T) * batch_size * hidden_units_,
+                                         cudaMemcpyDefault,
+                                         stream_));
+    }
+}
+
+template<typename T>
+std::vector<void*> UnifiedDecoder<T>::graphFingerprint(const ForwardParam&             param,
+                                                       const std::vector<WeightType*>* weights)
+{
+    std::vector<void*> ret{cu_q_len_};
+    // the layer weights are immutable once prepared, new weights come with new layers
+    ret.insert(ret.end(), weights->begin(), weights->end());
+    // device buffers of the step, the optional ones excluded from the graphs are left out
+    for (const void* x : std::initializer_list<const void*>{param.decoder_input,
+                                                            param.decoder_output,
+                                                            param.last_token_hidden_units,
+                                                            param.output_norm_weight,
+                                                            param.local_token_nums,
+                                                            param.finished,
+                                                            param.rope_theta,
+                                                            param.block_ptrs,
+                                                            param.cu_block_counts,
+                                                            param.evicted_len,
+                                                            param.tree_mask}) {
+        ret.push_back(const_cast<void*>(x));
+    }
+    for (const auto& x : attn_layer_->buffers()) {
+        ret.push_back(x);
+    }
+    if (ffn_layer_) {
+        for (const auto& x : ffn_layer_->buffers()) {
+            ret.push_back(x);
+        }
+    }
+    return ret;
+}
+
+template<typename T>
+void UnifiedDecoder<T>::forwardDecodeGraph(const ForwardParam&             param,
+                                           const std::vector<WeightType*>* weights,
+                                           T*                              residual,
+                                           T*                              hidden_states,
+                                           T*                              last_token_hidden_units,
+                                           const int*                      h_k_len,
+                                           int                             batch_size)
+{
+    // The split count of decoding kernels depends on `max_k_len`, round it up to reuse the graphs
+    const int max_k_len   = *std::max_element(h_k_len, h_k_len + batch_size);
+    int       k_len_bound = kMinGraphKLen;
+    while (k_len_bound < max_k_len) {
+        k_len_bound *= 2;
+    }
+
+    ForwardParam graph_param = param;
+    graph_param.dc_max_k_len = k_len_bound;
+
+    auto run = [&] {
+        forwardLayers(graph_param,
+                      weights,
+                      residual,
+                      hidden_states,
+                      hidden_states,
+                      last_token_hidden_units,
+                      batch_size,
+                      batch_size,
+                      0,
+                      batch_size,
+                      nullptr);
+    };
+
+    auto& graph = graphs_[{batch_size, k_len_bound}];
+
+    if (graph.fingerprint != graphFingerprint(graph_param, weights)) {
+        // Buffers may be (re)allocated by this step, capture when the same setting shows up again
+        if (graph.exec) {
+            check_cuda_error(cudaGraphExecDestroy(graph.exec));
+            graph.exec = {};
+        }
+        run();
+        graph.fingerprint = graphFingerprint(graph_param, weights);
+        return;
+    }
+
+    if (!graph.exec) {
+        cudaGraph_t g{};
+        check_cuda_error(cudaStreamBeginCapture(stream_, cudaStreamCaptureModeThreadLocal));
+        run();
+        check_cuda_error(cudaStreamEndCapture(stream_, &g));
+        check_cuda_error(cudaGraphInstantiateWithFlags(&graph.exec, g, 0));
+        check_cuda_error(cudaGraphDestroy(g));
+        TM_LOG_INFO("[UnifiedDecoder] Captured decoding graph, batch size %d, k len %d", batch_size, k_len_bound);
+    }
+
+    check_cuda_error(cudaGraphLaunch(graph.exec, stream_));
+}
+
+template<typename T>
+void UnifiedDecoder<T>::forward(const ForwardParam& param, const std::vector<WeightType*>* weights)
+{
+    const size_t token_num = param.token_num;
+
+    const int pf_batch_size = param.pf_batch_size;
+    const int dc_batch_size = param.dc_batch_size;
+    const int batch_size    = pf_batch_size + dc_batch_size;
+
+    const int* h_q_len = param.h_q_len;
+    const int* h_k_len = param.h_k_len;
+
+    T* residual      = param.decoder_input;
+    T* hidden_states = param.decoder_output;
+
+    T* last_token_hidden_units = param.last_token_hidden_units;
+
+    {  // compute cumulative lengths
+
+        h_cu_k_len_ = h_cu_q_len_ + batch_size + 1;
+        cu_k_len_   = cu_q_len_ + batch_size + 1;
+
+        h_cu_q_len_[0] = h_cu_k_len_[0] = 0;
+
+        for (int i = 1; i <= batch_size; ++i) {
+            h_cu_q_len_[i] = h_cu_q_len_[i - 1] + h_q_len[i - 1];
+            h_cu_k_len_[i] = h_cu_k_len_[i - 1] + h_k_len[i - 1];
+        }
+
+        check_cuda_error(
+            cudaMemcpyAsync(cu_q_len_, h_cu_q_len_, 2 * sizeof(int) * (batch_size + 1), cudaMemcpyDefault, stream_));
+
+        check_cuda_error(cudaEventRecord(ev_h_cu_x_, stream_));
+    }
+
+    /// Offset hidden states buffer for mixed DP
+    T*         global_hidden_states = hidden_states;
+    size_t     global_token_num     = token_num;
+    const int* local_token_nums     = param.local_token_nums;
+    if (attn_dp_size_ > 1) {
+        FT_CHECK(local_token_nums);
+        std::vector cumul_token_nums(attn_dp_size_ + 1, 0);
+        std::inclusive_scan(local_token_nums, local_token_nums + attn_dp_size_, cumul_token_nums.begin() + 1);
+        hidden_states    = hidden_states + (size_t)cumul_token_nums[attn_dp_rank_] * hidden_units_;
+        global_token_num = cumul_token_nums.back();
+        // TM_LOG_ERROR("rank %d, global_token_num %d, offset %d",
+        //              attn_dp_rank_,
+        //              global_token_num,
+        //              cumul_token_nums[attn_dp_rank_]);
+    }
+
+    // the blocks sent by the previous forwards may be reused by this one
+    if (kv_streamer_) {
+        kv_streamer_->Fence(stream_);
+    }
+
+    if (isMegakernelEligible(param, weights, pf_batch_size, dc_batch_size)) {
+        forwardDecodeMegakernel(param, weights, residual, hidden_states, last_token_hidden_units, h_k_len, batch_size);
+    }
+    else if (isDecodeGraphEligible(param, weights, pf_batch_size, dc_batch_size)) {
+        // the events of the copies can't be waited by the graph
+        if (block_copier_) {
+            block_copier_->Wait(stream_);
+        }
+        forwardDecodeGraph(param, weights, residual, hidden_states, last_token_hidden_units, h_k_len, batch_size);
+    }
+    else {
+        forwardLayers(param,
+                      weights,
+                      residual,
+                      hidden_states,
+                      global_hidden_states,
+                      last_token_hidden_units,
+                      token_num,
+                      global_token_num,
+                      pf_batch_size,
+                      dc_batch_size,
+                      local_token_nums);
+    }
+
     if (is_free_buffer_after_forward_) {
         freeBuffer();
     }
 
+    // layers past the ones of this stage or skipped by the tuning
+    if (block_copier_) {
+        block_copier_->Wait(stream_);
+    }
+    if (kv_streamer_) {
+        kv_streamer_->Finish(stream_);
+    }
+
     // Wait for `h_cu_q/k_len_` to be consumed
     check_cuda_error(cudaEventSynchronize(ev_h_cu_x_));
 }
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <map>
+#include <vector>
+
 #include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/models/llama/LlamaDecoderLayerWeight.h"
 #include "src/turbomind/models/llama/LlamaFfnLayer.h"
+#include "src/turbomind/models/llama/block_copier.h"
+#include "src/turbomind/models/llama/kv_streamer.h"
 #include "src/turbomind/models/llama/context.h"
+#include "src/turbomind/models/llama/decode_megakernel.h"
 #include "src/turbomind/models/llama/llama_params.h"
 #include "src/turbomind/models/llama/moe_ffn_layer.h"
 #include "src/turbomind/models/llama/unified_attention_layer.h"
@@ -14,6 +20,16 @@ namespace turbomind {
 
 template<typename T>
 class UnifiedDecoder {
+public:
+    // The attention fields of the step & the tensors of the decoder, the fields of a layer are set by the decoder
+    struct ForwardParam: UnifiedAttentionLayer<T>::ForwardParam {
+        T*         decoder_input;            // [token_num, hidden_units], the residual
+        T*         decoder_output;           // [token_num, hidden_units]
+        T*         last_token_hidden_units;  // [batch_size, hidden_units]
+        const T*   output_norm_weight;       // [hidden_units]
+        const int* local_token_nums;         // [attn_dp_size], optional
+    };
+
 private:
     void freeBuffer();
 
@@ -31,10 +47,15 @@ private:
     cudaStream_t const stream_;
     IAllocator* const  allocator_;
 
+    LlamaLinear<T>* const linear_;
+
     comm::DeviceCommImpl* const d_comm_;
 
+    StepProfiler* const profiler_;
+
     const DataType dtype_;
     const int      tune_layer_num_;
+    const bool     is_llama_;  // chosen once at construction, see `IsLlamaDecoder`
     bool           is_free_buffer_after_forward_{};
 
     int* cu_q_len_{};
@@ -47,26 +68,163 @@ private:
     std::unique_ptr<LlamaFfnLayer<T>>         ffn_layer_;
     std::unique_ptr<MoeFfnLayer<T>>           moe_ffn_layer_;
 
+    // Temporaries of the attention, the dense FFN & the MoE, placed by their liveness in a layer
+    void* scratch_{};
+
     cudaEvent_t ev_h_cu_x_{};
 
+    // the shared experts of the MoE layers run on a stream of their own next to the routed experts, null disables
+    cudaStream_t                      shared_stream_{};
+    cudaEvent_t                       ev_shared_fork_{};
+    cudaEvent_t                       ev_shared_join_{};
+    cublasHandle_t                    shared_cublas_handle_{};
+    std::unique_ptr<cublasMMWrapper>  shared_cublas_;
+    std::unique_ptr<LlamaLinear<T>>   shared_linear_;
+    std::unique_ptr<LlamaFfnLayer<T>> shared_ffn_layer_;
+    T*                                shared_out_{};  // [max_ffn_tokens, hidden_units], in the scratch
+
+    // tokens per chunk of the overlapped ffn & allreduce, 0 disables
+    const int    comm_overlap_tokens_;
+    cudaStream_t comm_stream_{};
+    cudaEvent_t  ev_ffn_{};
+    cudaEvent_t  ev_comm_{};
+
+    const DataType comm_quant_type_;  // of the quantized TP allreduces, `TYPE_INVALID` disables
+
+    // Pipeline stages, the stage runs layers [layer_begin_, layer_end_). Non-last stages pass the residual to the
+    // next stage and receive the last token hidden states from the last stage on `pp_stream_`
+    const int                   pp_size_;
+    const int                   pp_rank_;
+    const int                   layer_begin_;
+    const int                   layer_end_;
+    comm::DeviceCommImpl* const d_pp_comm_;
+    const int                   pp_result_group_;
+    cudaStream_t                pp_stream_{};
+    cudaEvent_t                 ev_pp_send_{};
+    cudaEvent_t                 ev_pp_recv_{};
+
+    // block copies in flight, the attention of a layer waits for the same layer of the blocks
+    BlockCopier* block_copier_{};
+
+    // the layers of the prefilled blocks are sent to the remote engines as they are written
+    KvStreamer* kv_streamer_{};
+
     using WeightType = LlamaDecoderLayerWeight<T>;
 
-    void forwardSelfAttn(T*                attn_io,
-                         TensorMap*        _outputs,
-                         const TensorMap*  _inputs,
-                         size_t            token_num,
-                         size_t            batch_size,
-                         int               layer_id,
-                         const WeightType* weight);
-
-    void AllreduceResidualRMSnorm(T*         hidden_states,
-                                  T*         residual,
-                                  const T*   bias,
-                                  const T*   weight,
-                                  int        token_num,
-                                  int        t0,
-                                  int        t1,
-                                  const int* local_token_nums);
+    static constexpr int kMaxGraphBatchSize = 32;
+    static constexpr int kMinGraphKLen      = 256;
+
+    struct DecodeGraph {
+        cudaGraphExec_t    exec{};
+        std::vector<void*> fingerprint;  // device addresses baked into the graph
+    };
+
+    bool enable_cuda_graph_{};
+
+    // keyed by (batch size, bound of max k len)
+    std::map<std::pair<int, int>, DecodeGraph> graphs_;
+
+    // Persistent kernel of the layers for the decoding batches of at most `megakernel_batch_` sequences, 0 disables.
+    // The sizes of the model & the workspace in `megakernel_` are set at construction
+    int                      megakernel_batch_{};
+    int                      megakernel_grid_{};
+    int                      megakernel_weights_{-1};  // dense weights in all the layers, checked at the first use
+    DecodeMegakernelParam<T> megakernel_{};
+    void*                    megakernel_buf_{};
+
+    void forwardSelfAttn(T*                  attn_io,
+                         const ForwardParam& param,
+                         size_t              token_num,
+                         size_t              batch_size,
+                         int                 layer_id,
+                         const WeightType*   weight);
+
+    void forwardLayers(const ForwardParam&             param,
+                       const std::vector<WeightType*>* weights,
+                       T*                              residual,
+                       T*                              hidden_states,
+                       T*                              global_hidden_states,
+                       T*                              last_token_hidden_units,
+                       size_t                          token_num,
+                       size_t                          global_token_num,
+                       int                             pf_batch_size,
+                       int                             dc_batch_size,
+                       const int*                      local_token_nums);
+
+    // `kLlama` drops the branches of the configurations other than Llama-style layers, see `IsLlamaDecoder`
+    template<bool kLlama>
+    void forwardLayersImpl(const ForwardParam&             param,
+                           const std::vector<WeightType*>* weights,
+                           T*                              residual,
+                           T*                              hidden_states,
+                           T*                              global_hidden_states,
+                           T*                              last_token_hidden_units,
+                           size_t                          token_num,
+                           size_t                          global_token_num,
+                           int                             pf_batch_size,
+                           int                             dc_batch_size,
+                           const int*                      local_token_nums);
+
+    bool isDecodeGraphEligible(const ForwardParam&             param,
+                               const std::vector<WeightType*>* weights,
+                               int                             pf_batch_size,
+                               int                             dc_batch_size);
+
+    bool isMegakernelEligible(const ForwardParam&             param,
+                              const std::vector<WeightType*>* weights,
+                              int                             pf_batch_size,
+                              int                             dc_batch_size);
+
+    // decode-only steps of tiny batches, a cooperative launch per layer, see `DecodeMegakernel`
+    void forwardDecodeMegakernel(const ForwardParam&             param,
+                                 const std::vector<WeightType*>* weights,
+                                 T*                              residual,
+                                 T*                              hidden_states,
+                                 T*                              last_token_hidden_units,
+                                 const int*                      h_k_len,
+                                 int                             batch_size);
+
+    std::vector<void*> graphFingerprint(const ForwardParam& param, const std::vector<WeightType*>* weights);
+
+    // decode-only steps, captured on the second occurrence of a setting and replayed afterwards
+    void forwardDecodeGraph(const ForwardParam&             param,
+                            const std::vector<WeightType*>* weights,
+                            T*                              residual,
+                            T*                              hidden_states,
+                            T*                              last_token_hidden_units,
+                            const int*                      h_k_len,
+                            int                             batch_size);
+
+    // FFN & the allreduce of its output in chunks of tokens, the allreduce of a chunk runs on `comm_stream_` while
+    // the FFN of the next chunk computes
+    void forwardFfnOverlapped(T*                hidden_states,
+                              T*                residual,
+                              const T*          bias,
+                              const T*          scale_weight,
+                              int               token_num,
+                              int               layer_id,
+                              const WeightType* weight);
+
+    // Allreduce of the whole TP group followed by the residual & norm
+    void AllreduceResidualRMSnormTP(
+        T* hidden_states, T* residual, const T* bias, const T* weight, int token_num, cudaStream_t stream);
+
+    // `next` is the weight of the GEMM reading the norm output, it gets quantized activations when the norm can
+    // produce them
+    void AllreduceResidualRMSnorm(T*                         hidden_states,
+                                  T*                         residual,
+                                  const T*                   bias,
+                                  const T*                   weight,
+                                  int                        token_num,
+                                  int                        t0,
+                                  int                        t1,
+                                  const int*                 local_token_nums,
+                                  const LlamaDenseWeight<T>* next = nullptr);
+
+    // Buffers for the norm to quantize `x` into when `w` is a fp8 weight reading it, nulls otherwise
+    std::pair<fp8_e4m3*, float*> Fp8Input(const LlamaDenseWeight<T>* w, const T* x, int token_num);
+
+    const LlamaDenseWeight<T>* FfnInputWeight(const WeightType* weight) const;
 
 public:
     UnifiedDecoder(const ModelParam&     model,
@@ -80,7 +238,25 @@ public:
 
     ~UnifiedDecoder();
 
-    void forward(TensorMap* outputs, const TensorMap* inputs, const std::vector<WeightType*>* weights);
+    void forward(const ForwardParam& param, const std::vector<WeightType*>* weights);
+
+    // Makes `stream_` wait for the last token hidden states of this step from the last pipeline stage
+    void waitPipeline();
+
+    void setBlockCopier(BlockCopier* copier) noexcept
+    {
+        block_copier_ = copier;
+    }
+
+    void setKvStreamer(KvStreamer* streamer) noexcept
+    {
+        kv_streamer_ = streamer;
+    }
+
+    std::vector<std::vector<int64_t>> GetExpertCounts(bool reset)
+    {
+        return moe_ffn_layer_ ? moe_ffn_layer_->GetExpertCounts(reset) : std::vector<std::vector<int64_t>>{};
+    }
 };
 
 }  // namespace turbomind
@@ -0,0 +1,102 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/virtual_memory.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+namespace turbomind {
+
+static CUmemAllocationProp GetAllocationProp()
+{
+    int device{};
+    check_cuda_error(cudaGetDevice(&device));
+    CUmemAllocationProp prop{};
+    prop.type          = CU_MEM_ALLOCATION_TYPE_PINNED;
+    prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+    prop.location.id   = device;
+    return prop;
+}
+
+size_t VirtualMemory::Granularity()
+{
+    const auto prop = GetAllocationProp();
+    size_t     granularity{};
+    CUDRVCHECK(cuMemGetAllocationGranularity(&granularity, &prop, CU_MEM_ALLOC_GRANULARITY_MINIMUM));
+    return granularity;
+}
+
+VirtualMemory::VirtualMemory(size_t size): prop_{GetAllocationProp()}
+{
+    CUDRVCHECK(cuMemGetAllocationGranularity(&granularity_, &prop_, CU_MEM_ALLOC_GRANULARITY_MINIMUM));
+
+    size_ = (size + granularity_ - 1) / granularity_ * granularity_;
+    CUDRVCHECK(cuMemAddressReserve(&base_, size_, granularity_, 0, 0));
+
+    access_.location = prop_.location;
+    access_.flags    = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+
+    TM_LOG_INFO("[VirtualMemory] %.2f GB of addresses reserved", size_ / (float)(1 << 30));
+}
+
+VirtualMemory::~VirtualMemory()
+{
+    // errors are logged, a destructor must not throw
+    auto check = [](CUresult ec, const char* what) {
+        if (ec != CUDA_SUCCESS) {
+            const char* p_str{};
+            cuGetErrorString(ec, &p_str);
+            TM_LOG_ERROR("[VirtualMemory] %s failed: %s", what, p_str ? p_str : "Unknown error");
+        }
+    };
+
+    // the kernels reading the ranges must have completed
+    if (auto ec = mappings_.empty() ? cudaSuccess : cudaDeviceSynchronize(); ec != cudaSuccess) {
+        TM_LOG_ERROR("[VirtualMemory] cudaDeviceSynchronize failed: %s", cudaGetErrorString(ec));
+    }
+    for (const auto& [offset, m] : mappings_) {
+        check(cuMemUnmap(base_ + offset, m.size), "cuMemUnmap");
+        check(cuMemRelease(m.handle), "cuMemRelease");
+    }
+    mappings_.clear();
+    mapped_bytes_ = 0;
+
+    check(cuMemAddressFree(base_, size_), "cuMemAddressFree");
+}
+
+bool VirtualMemory::Map(size_t offset, size_t size)
+{
+    FT_CHECK(offset % granularity_ == 0 && size % granularity_ == 0 && offset + size <= size_);
+    FT_CHECK(!mappings_.count(offset));
+
+    CUmemGenericAllocationHandle handle{};
+    const CUresult err = cuMemCreate(&handle, size, &prop_, 0);
+    if (err == CUDA_ERROR_OUT_OF_MEMORY) {
+        return false;
+    }
+    CUDRVCHECK(err);
+
+    CUDRVCHECK(cuMemMap(base_ + offset, size, 0, handle, 0));
+    CUDRVCHECK(cuMemSetAccess(base_ + offset, size, &access_, 1));
+
+    mappings_.emplace(offset, Mapping{handle, size});
+    mapped_bytes_ += size;
+
+    return true;
+}
+
+void VirtualMemory::Unmap(size_t offset, size_t size)
+{
+    auto it = mappings_.find(offset);
+    FT_CHECK(it != mappings_.end() && it->second.size == size);
+
+    // the kernels reading the range must have completed
+    check_cuda_error(cudaDeviceSynchronize());
+
+    CUDRVCHECK(cuMemUnmap(base_ + offset, size));
+    CUDRVCHECK(cuMemRelease(it->second.handle));
+
+    mappings_.erase(it);
+    mapped_bytes_ -= size;
+}
+
+}  // namespace turbomind
@@ -0,0 +1,63 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+
+#include <cuda.h>
+
+namespace turbomind {
+
+// A range of device addresses reserved up front, backed by physical memory mapped on demand. The ranges are mapped
+// and unmapped in multiples of `granularity()`, so the memory of an unmapped range is given back to the device
+class VirtualMemory {
+public:
+    // granularity of the mappings on the current device
+    static size_t Granularity();
+
+    // `size` is rounded up to the granularity
+    explicit VirtualMemory(size_t size);
+
+    ~VirtualMemory();
+
+    VirtualMemory(const VirtualMemory&) = delete;
+    VirtualMemory& operator=(const VirtualMemory&) = delete;
+
+    // map [offset, offset + size), false when the device is out of memory
+    bool Map(size_t offset, size_t size);
+
+    // `offset` and `size` of a previous `Map`
+    void Unmap(size_t offset, size_t size);
+
+    void* base() const noexcept
+    {
+        return (void*)base_;
+    }
+
+    size_t granularity() const noexcept
+    {
+        return granularity_;
+    }
+
+    size_t mapped_bytes() const noexcept
+    {
+        return mapped_bytes_;
+    }
+
+private:
+    CUmemAllocationProp prop_{};
+    CUmemAccessDesc     access_{};
+    size_t              granularity_{};
+    size_t              size_{};
+    CUdeviceptr         base_{};
+    size_t              mapped_bytes_{};
+
+    struct Mapping {
+        CUmemGenericAllocationHandle handle;
+        size_t                       size;
+    };
+    std::map<size_t, Mapping> mappings_;  // by offset
+};
+
+}  // namespace turbomind
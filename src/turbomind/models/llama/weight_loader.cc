@@ -0,0 +1,291 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/turbomind/models/llama/weight_loader.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/string_utils.h"
+
+namespace turbomind {
+
+namespace {
+
+// Reader of the JSON subset used by safetensors headers: objects, arrays, strings and integers
+struct HeaderReader {
+    const char* p;
+    const char* end;
+
+    void ws()
+    {
+        while (p < end && std::isspace((unsigned char)*p)) {
+            ++p;
+        }
+    }
+
+    bool peek(char c)
+    {
+        ws();
+        return p < end && *p == c;
+    }
+
+    void expect(char c)
+    {
+        FT_CHECK_WITH_INFO(peek(c), fmtstr("invalid safetensors header, expecting '%c'", c));
+        ++p;
+    }
+
+    bool comma()
+    {
+        if (peek(',')) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    std::string str()
+    {
+        expect('"');
+        std::string s;
+        while (p < end && *p != '"') {
+            if (*p == '\\' && p + 1 < end) {
+                ++p;
+            }
+            s.push_back(*p++);
+        }
+        expect('"');
+        return s;
+    }
+
+    size_t integer()
+    {
+        ws();
+        FT_CHECK_WITH_INFO(p < end && std::isdigit((unsigned char)*p), "invalid safetensors header, expecting integer");
+        size_t x = 0;
+        while (p < end && std::isdigit((unsigned char)*p)) {
+            x = x * 10 + (*p++ - '0');
+        }
+        return x;
+    }
+
+    void skip()
+    {
+        if (peek('{')) {
+            ++p;
+            if (!peek('}')) {
+                do {
+                    str();
+                    expect(':');
+                    skip();
+                } while (comma());
+            }
+            expect('}');
+        }
+        else if (peek('[')) {
+            ++p;
+            if (!peek(']')) {
+                do {
+                    skip();
+                } while (comma());
+            }
+            expect(']');
+        }
+        else if (peek('"')) {
+            str();
+        }
+        else {  // numbers & literals
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && !std::isspace((unsigned char)*p)) {
+                ++p;
+            }
+        }
+    }
+};
+
+}  // namespace
+
+bool SafeTensors::exists(const std::string& dir)
+{
+    std::error_code ec;
+    for (const auto& e : std::filesystem::directory_iterator(dir, ec)) {
+        if (e.path().extension() == ".safetensors") {
+            return true;
+        }
+    }
+    return false;
+}
+
+SafeTensors::SafeTensors(const std::string& dir)
+{
+    std::vector<std::string> files;
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        if (e.is_regular_file() && e.path().extension() == ".safetensors") {
+            files.push_back(e.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const auto& path : files) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        FT_CHECK_WITH_INFO(fd >= 0, fmtstr("failed to open %s", path.c_str()));
+
+        struct stat st {};
+        FT_CHECK_WITH_INFO(fstat(fd, &st) == 0, fmtstr("failed to stat %s", path.c_str()));
+        const size_t size = st.st_size;
+
+        void* ptr = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        FT_CHECK_WITH_INFO(ptr != MAP_FAILED, fmtstr("failed to mmap %s", path.c_str()));
+
+        // tensors are mostly read in file order
+        madvise(ptr, size, MADV_SEQUENTIAL);
+
+        mappings_.push_back({ptr, size});
+
+        uint64_t header_size{};
+        FT_CHECK_WITH_INFO(size >= sizeof(header_size), fmtstr("invalid safetensors file %s", path.c_str()));
+        std::memcpy(&header_size, ptr, sizeof(header_size));
+        FT_CHECK_WITH_INFO(sizeof(header_size) + header_size <= size,
+                           fmtstr("invalid safetensors file %s", path.c_str()));
+
+        const char* header = (const char*)ptr + sizeof(header_size);
+        const char* data   = header + header_size;
+
+        parse(header, header_size, data, size - sizeof(header_size) - header_size, path);
+    }
+
+    TM_LOG_INFO("[SafeTensors] %d tensors in %d shards from %s", (int)entries_.size(), (int)files.size(), dir.c_str());
+}
+
+SafeTensors::~SafeTensors()
+{
+    for (const auto& m : mappings_) {
+        munmap(m.ptr, m.size);
+    }
+}
+
+void SafeTensors::parse(const char* header, size_t size, const char* data, size_t data_size, const std::string& path)
+{
+    HeaderReader r{header, header + size};
+
+    r.expect('{');
+    if (r.peek('}')) {
+        return;
+    }
+    do {
+        const auto name = r.str();
+        r.expect(':');
+        if (name == "__metadata__") {
+            r.skip();
+            continue;
+        }
+        Entry  e{};
+        size_t begin = 0;
+        size_t end   = 0;
+        r.expect('{');
+        do {
+            const auto key = r.str();
+            r.expect(':');
+            if (key == "dtype") {
+                e.dtype = r.str();
+            }
+            else if (key == "data_offsets") {
+                r.expect('[');
+                begin = r.integer();
+                r.expect(',');
+                end = r.integer();
+                r.expect(']');
+            }
+            else {
+                r.skip();
+            }
+        } while (r.comma());
+        r.expect('}');
+
+        FT_CHECK_WITH_INFO(begin <= end && end <= data_size,
+                           fmtstr("invalid data offsets of %s in %s", name.c_str(), path.c_str()));
+        e.data = data + begin;
+        e.size = end - begin;
+
+        if (!entries_.emplace(name, std::move(e)).second) {
+            TM_LOG_WARNING("[SafeTensors] duplicated tensor %s in %s", name.c_str(), path.c_str());
+        }
+    } while (r.comma());
+    r.expect('}');
+}
+
+const SafeTensors::Entry* SafeTensors::find(const std::string& name) const
+{
+    auto it = entries_.find(name);
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+StagedCopier::StagedCopier(int streams, int buffers_per_stream, size_t chunk_size): chunk_size_{chunk_size}
+{
+    FT_CHECK(streams > 0 && buffers_per_stream > 0 && chunk_size > 0);
+
+    streams_.resize(streams);
+    fences_.resize(streams);
+    for (int i = 0; i < streams; ++i) {
+        check_cuda_error(cudaStreamCreateWithFlags(&streams_[i], cudaStreamNonBlocking));
+        check_cuda_error(cudaEventCreateWithFlags(&fences_[i], cudaEventDisableTiming));
+    }
+
+    buffers_.resize(streams * buffers_per_stream);
+    events_.resize(buffers_.size());
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        check_cuda_error(cudaMallocHost((void**)&buffers_[i], chunk_size));
+        check_cuda_error(cudaEventCreateWithFlags(&events_[i], cudaEventDisableTiming));
+    }
+}
+
+StagedCopier::~StagedCopier()
+{
+    for (auto& s : streams_) {
+        check_cuda_error(cudaStreamSynchronize(s));
+    }
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        check_cuda_error(cudaEventDestroy(events_[i]));
+        check_cuda_error(cudaFreeHost(buffers_[i]));
+    }
+    for (size_t i = 0; i < streams_.size(); ++i) {
+        check_cuda_error(cudaEventDestroy(fences_[i]));
+        check_cuda_error(cudaStreamDestroy(streams_[i]));
+    }
+}
+
+void StagedCopier::Copy(void* dst, const void* src, size_t size)
+{
+    for (size_t offset = 0; offset < size; offset += chunk_size_) {
+        const size_t n = std::min(chunk_size_, size - offset);
+        const int    i = next_;
+        next_          = (next_ + 1) % buffers_.size();
+
+        // the previous upload from the buffer must be done before it's refilled
+        check_cuda_error(cudaEventSynchronize(events_[i]));
+        std::memcpy(buffers_[i], (const char*)src + offset, n);
+
+        cudaStream_t st = streams_[i % streams_.size()];
+        check_cuda_error(cudaMemcpyAsync((char*)dst + offset, buffers_[i], n, cudaMemcpyHostToDevice, st));
+        check_cuda_error(cudaEventRecord(events_[i], st));
+    }
+    bytes_ += size;
+}
+
+void StagedCopier::Fence(cudaStream_t stream)
+{
+    for (size_t i = 0; i < streams_.size(); ++i) {
+        check_cuda_error(cudaEventRecord(fences_[i], streams_[i]));
+        check_cuda_error(cudaStreamWaitEvent(stream, fences_[i]));
+    }
+}
+
+}  // namespace turbomind
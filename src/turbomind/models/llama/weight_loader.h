@@ -0,0 +1,83 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace turbomind {
+
+// Read-only view of the safetensors shards (`*.safetensors`) in a directory, the shards are mmap'd so that tensors
+// are read from the page cache on demand without materializing the model in host memory
+class SafeTensors {
+public:
+    struct Entry {
+        const char* data;
+        size_t      size;  // in bytes
+        std::string dtype;
+    };
+
+    explicit SafeTensors(const std::string& dir);
+
+    ~SafeTensors();
+
+    SafeTensors(const SafeTensors&) = delete;
+    SafeTensors& operator=(const SafeTensors&) = delete;
+
+    // whether `dir` contains any safetensors shard
+    static bool exists(const std::string& dir);
+
+    const Entry* find(const std::string& name) const;
+
+    size_t size() const noexcept
+    {
+        return entries_.size();
+    }
+
+private:
+    void parse(const char* header, size_t size, const char* data, size_t data_size, const std::string& path);
+
+    struct Mapping {
+        void*  ptr;
+        size_t size;
+    };
+
+    std::vector<Mapping>                   mappings_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+// Host to device copies through a ring of pinned staging buffers, the buffers are assigned to the streams round
+// robin so that filling one buffer on host overlaps the uploads of the others
+class StagedCopier {
+public:
+    StagedCopier(int streams, int buffers_per_stream, size_t chunk_size);
+
+    ~StagedCopier();
+
+    StagedCopier(const StagedCopier&) = delete;
+    StagedCopier& operator=(const StagedCopier&) = delete;
+
+    void Copy(void* dst, const void* src, size_t size);
+
+    // Make `stream` wait for all copies issued so far
+    void Fence(cudaStream_t stream);
+
+    size_t bytes() const noexcept
+    {
+        return bytes_;
+    }
+
+private:
+    size_t chunk_size_;
+    size_t bytes_{};
+    int    next_{};
+
+    std::vector<cudaStream_t> streams_;
+    std::vector<char*>        buffers_;
+    std::vector<cudaEvent_t>  events_;  // last upload from each buffer
+    std::vector<cudaEvent_t>  fences_;  // per stream
+};
+
+}  // namespace turbomind
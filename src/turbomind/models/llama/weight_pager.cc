@@ -0,0 +1,130 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include "src/turbomind/models/llama/weight_pager.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/memory_utils.h"
+#include <algorithm>
+
+namespace turbomind {
+
+// offsets of the buffers in a layer, enough for the vectorized access of the kernels
+static constexpr size_t kAlignment = 256;
+
+WeightPager::WeightPager(int layer_begin, int layer_end):
+    layer_begin_(layer_begin), layer_end_(layer_end), layers_(std::max(layer_end - layer_begin, 0))
+{
+    check_cuda_error(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    for (int s = 0; s < 2; ++s) {
+        check_cuda_error(cudaEventCreateWithFlags(&ready_[s], cudaEventDisableTiming));
+        check_cuda_error(cudaEventCreateWithFlags(&free_[s], cudaEventDisableTiming));
+    }
+}
+
+WeightPager::~WeightPager()
+{
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    for (auto& l : layers_) {
+        // the slots are not owned by the layers
+        for (auto& [ptr, size] : l.buffers) {
+            *ptr = nullptr;
+        }
+        if (l.host) {
+            check_cuda_error(cudaFreeHost(l.host));
+        }
+    }
+    for (int s = 0; s < 2; ++s) {
+        if (slots_[s]) {
+            check_cuda_error(cudaFreeAsync(slots_[s], stream_));
+        }
+        check_cuda_error(cudaEventDestroy(ready_[s]));
+        check_cuda_error(cudaEventDestroy(free_[s]));
+    }
+
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    check_cuda_error(cudaStreamDestroy(stream_));
+}
+
+void WeightPager::Add(int layer, Buffers buffers, cudaStream_t st)
+{
+    auto& l = layers_.at(layer - layer_begin_);
+    FT_CHECK(l.host == nullptr);
+
+    for (const auto& [ptr, size] : buffers) {
+        l.offsets.push_back(l.bytes);
+        l.bytes += (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    check_cuda_error(cudaMallocHost(&l.host, std::max<size_t>(l.bytes, 1)));
+
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        auto& [ptr, size] = buffers[i];
+        check_cuda_error(cudaMemcpyAsync(l.host + l.offsets[i], *ptr, size, cudaMemcpyDeviceToHost, st));
+        deviceFree(*ptr, st);
+    }
+
+    slot_bytes_ = std::max(slot_bytes_, l.bytes);
+
+    l.buffers = std::move(buffers);
+}
+
+void WeightPager::Finalize(cudaStream_t st)
+{
+    for (int s = 0; s < std::min<int>(layers_.size(), 2); ++s) {
+        check_cuda_error(cudaMallocAsync(&slots_[s], slot_bytes_, st));
+    }
+    // the host copies must land before the first fetch on the copy stream
+    check_cuda_error(cudaStreamSynchronize(st));
+
+    for (int i = layer_begin_; i < layer_end_; ++i) {
+        auto& l = layers_[i - layer_begin_];
+        FT_CHECK_WITH_INFO(l.host != nullptr, "layer " + std::to_string(i) + " is not added to the pager");
+        for (size_t j = 0; j < l.buffers.size(); ++j) {
+            *l.buffers[j].first = slots_[slot(i)] + l.offsets[j];
+        }
+    }
+}
+
+void WeightPager::Acquire(int layer, cudaStream_t stream)
+{
+    if (last_ >= 0) {
+        check_cuda_error(cudaEventRecord(free_[slot(last_)], stream));
+    }
+
+    const int s = slot(layer);
+    if (resident_[s] != layer) {
+        Fetch(layer);
+    }
+    check_cuda_error(cudaStreamWaitEvent(stream, ready_[s]));
+
+    // the other slot was released by the layer before
+    const int next = layer + 1 < layer_end_ ? layer + 1 : layer_begin_;
+    if (slot(next) != s && resident_[slot(next)] != next) {
+        Fetch(next);
+    }
+
+    last_ = layer;
+}
+
+void WeightPager::Fetch(int layer)
+{
+    const int   s = slot(layer);
+    const auto& l = layers_[layer - layer_begin_];
+
+    check_cuda_error(cudaStreamWaitEvent(stream_, free_[s]));
+    check_cuda_error(cudaMemcpyAsync(slots_[s], l.host, l.bytes, cudaMemcpyHostToDevice, stream_));
+    check_cuda_error(cudaEventRecord(ready_[s], stream_));
+
+    resident_[s] = layer;
+}
+
+size_t WeightPager::host_bytes() const noexcept
+{
+    size_t bytes{};
+    for (const auto& l : layers_) {
+        bytes += l.bytes;
+    }
+    return bytes;
+}
+
+}  // namespace turbomind
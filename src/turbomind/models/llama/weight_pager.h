@@ -0,0 +1,72 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+#include <utility>
+#include <vector>
+
+namespace turbomind {
+
+// Holds the prepared weights of the decoder layers in pinned host memory and pages them into 2 device slots, the
+// layers of the same parity share a slot. The next layer is copied on a side stream while the current one is computed.
+// The weight pointers of a layer refer to its slot permanently, so the layers stay transparent to the kernels
+class WeightPager {
+public:
+    using Buffers = std::vector<std::pair<void**, size_t>>;  // device buffers of a layer & their bytes
+
+    WeightPager(int layer_begin, int layer_end);
+
+    ~WeightPager();
+
+    WeightPager(const WeightPager&) = delete;
+    WeightPager& operator=(const WeightPager&) = delete;
+
+    // Moves the buffers of a prepared layer to the host, the buffers are freed ordered after the work on `st`
+    void Add(int layer, Buffers buffers, cudaStream_t st);
+
+    // Allocates the slots and points the buffers of all the added layers into them
+    void Finalize(cudaStream_t st);
+
+    // Orders the following work on `stream` after the weights of `layer` are resident and prefetches the next layer.
+    // The work enqueued on `stream` before the call is the last to read the previously acquired layer
+    void Acquire(int layer, cudaStream_t stream);
+
+    size_t host_bytes() const noexcept;
+
+    size_t slot_bytes() const noexcept
+    {
+        return slot_bytes_;
+    }
+
+private:
+    int slot(int layer) const noexcept
+    {
+        return (layer - layer_begin_) % 2;
+    }
+
+    void Fetch(int layer);
+
+    struct Layer {
+        Buffers             buffers;
+        std::vector<size_t> offsets;
+        char*               host{};
+        size_t              bytes{};
+    };
+
+    int layer_begin_;
+    int layer_end_;
+
+    std::vector<Layer> layers_;
+
+    size_t       slot_bytes_{};
+    char*        slots_[2]{};
+    int          resident_[2]{-1, -1};  // layer fetched into the slot
+    cudaEvent_t  ready_[2]{};           // the fetch of the slot is done
+    cudaEvent_t  free_[2]{};            // the kernels reading the slot are done
+    cudaStream_t stream_{};             // copy stream
+
+    int last_{-1};  // last acquired layer
+};
+
+}  // namespace turbomind
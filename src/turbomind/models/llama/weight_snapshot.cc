@@ -0,0 +1,129 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/turbomind/models/llama/weight_snapshot.h"
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/memory_utils.h"
+#include "src/turbomind/utils/string_utils.h"
+
+namespace turbomind {
+
+static constexpr uint64_t kSnapshotMagic   = 0x31504e53574d54ULL;  // "TMWSNP1"
+static constexpr int      kSnapshotVersion = 1;
+
+// Same staging as the weight loading, 4 streams x 2 buffers x 32 MB pinned
+static constexpr int    kUploadStreams = 4;
+static constexpr size_t kChunkSize     = 32 << 20;
+
+WeightSnapshot::WeightSnapshot(const std::string& path, bool write, cudaStream_t stream):
+    path_{path}, write_{write}, stream_{stream}
+{
+    if (write_) {
+        // written to a temporary file first so that an interrupted write never leaves a partial snapshot in place
+        ofs_.open(path_ + ".tmp", std::ios::binary | std::ios::trunc);
+        FT_CHECK_WITH_INFO(ofs_.is_open(), fmtstr("failed to open %s.tmp", path_.c_str()));
+        check_cuda_error(cudaMallocHost((void**)&staging_, kChunkSize));
+    }
+    else {
+        const int fd = open(path_.c_str(), O_RDONLY);
+        FT_CHECK_WITH_INFO(fd >= 0, fmtstr("failed to open %s", path_.c_str()));
+        struct stat st {};
+        FT_CHECK(fstat(fd, &st) == 0);
+        map_size_ = st.st_size;
+        void* ptr = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        FT_CHECK_WITH_INFO(ptr != MAP_FAILED, fmtstr("failed to map %s", path_.c_str()));
+        madvise(ptr, map_size_, MADV_SEQUENTIAL);
+        map_    = (const char*)ptr;
+        copier_ = std::make_unique<StagedCopier>(kUploadStreams, 2, kChunkSize);
+    }
+
+    Check(kSnapshotMagic, "magic");
+    Check(kSnapshotVersion, "version");
+}
+
+WeightSnapshot::~WeightSnapshot()
+{
+    // the uploads read from the mapping
+    copier_.reset();
+    if (map_) {
+        munmap((void*)map_, map_size_);
+    }
+    if (staging_) {
+        check_cuda_error(cudaFreeHost(staging_));
+    }
+}
+
+bool WeightSnapshot::exists(const std::string& path)
+{
+    struct stat st {};
+    return !path.empty() && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+void WeightSnapshot::Bytes(void* data, size_t size)
+{
+    if (write_) {
+        ofs_.write((const char*)data, size);
+    }
+    else {
+        FT_CHECK_WITH_INFO(offset_ + size <= map_size_, fmtstr("truncated weight snapshot %s", path_.c_str()));
+        std::memcpy(data, map_ + offset_, size);
+        offset_ += size;
+    }
+}
+
+void WeightSnapshot::Buffer(void** ptr, size_t size)
+{
+    if (write_) {
+        uint64_t n = *ptr ? size : 0;
+        Value(n);
+        for (size_t offset = 0; offset < n; offset += kChunkSize) {
+            const size_t m = std::min(kChunkSize, n - offset);
+            check_cuda_error(cudaMemcpyAsync(staging_, (char*)*ptr + offset, m, cudaMemcpyDeviceToHost, stream_));
+            check_cuda_error(cudaStreamSynchronize(stream_));
+            ofs_.write(staging_, m);
+        }
+        bytes_ += n;
+        return;
+    }
+
+    uint64_t n{};
+    Value(n);
+    FT_CHECK_WITH_INFO(offset_ + n <= map_size_, fmtstr("truncated weight snapshot %s", path_.c_str()));
+
+    // the sizes of the prepared buffers differ from the ones allocated for loading
+    deviceFree(*ptr, stream_);
+    if (n) {
+        deviceMalloc((char**)ptr, n, stream_);
+        // the buffers are filled on the streams of the copier
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        copier_->Copy(*ptr, map_ + offset_, n);
+        offset_ += n;
+    }
+    bytes_ += n;
+}
+
+void WeightSnapshot::Finish()
+{
+    if (write_) {
+        ofs_.close();
+        FT_CHECK_WITH_INFO(!ofs_.fail(), fmtstr("failed to write %s.tmp", path_.c_str()));
+        FT_CHECK_WITH_INFO(std::rename((path_ + ".tmp").c_str(), path_.c_str()) == 0,
+                           fmtstr("failed to move %s.tmp in place", path_.c_str()));
+    }
+    else {
+        FT_CHECK_WITH_INFO(offset_ == map_size_, fmtstr("trailing data in weight snapshot %s", path_.c_str()));
+        copier_->Fence(stream_);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+}
+
+}  // namespace turbomind
@@ -0,0 +1,99 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/models/llama/LlamaDenseWeight.h"
+#include "src/turbomind/models/llama/weight_loader.h"
+#include "src/turbomind/utils/string_utils.h"
+
+namespace turbomind {
+
+// Flat file of the prepared device weights of a rank. The same sequence of `Value` & `Buffer` calls writes the file
+// or restores it, so the layout is defined by the order the weights are visited. Restoring maps the file and uploads
+// the buffers through pinned staging, the weights are in the layouts of the kernels already and are not converted
+class WeightSnapshot {
+public:
+    // Write to `path` when `write`, otherwise restore from it. The buffers are allocated & freed on `stream`
+    WeightSnapshot(const std::string& path, bool write, cudaStream_t stream);
+
+    ~WeightSnapshot();
+
+    WeightSnapshot(const WeightSnapshot&) = delete;
+    WeightSnapshot& operator=(const WeightSnapshot&) = delete;
+
+    static bool exists(const std::string& path);
+
+    bool writing() const noexcept
+    {
+        return write_;
+    }
+
+    template<class T>
+    void Value(T& x)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Bytes(&x, sizeof(T));
+    }
+
+    // Fails on restore when the value in the file differs, for the shapes & formats the file depends on
+    template<class T>
+    void Check(T x, const char* what)
+    {
+        T y = x;
+        Value(y);
+        FT_CHECK_WITH_INFO(y == x, fmtstr("weight snapshot %s mismatch in %s", what, path_.c_str()));
+    }
+
+    // Device buffer `*ptr` of `size` bytes, null buffers are written as empty. On restore the buffer is reallocated
+    // to the size in the file, or freed when it's empty
+    void Buffer(void** ptr, size_t size);
+
+    // Write: flush the file and move it in place. Restore: wait for the uploads and check the file is consumed
+    void Finish();
+
+    size_t bytes() const noexcept
+    {
+        return bytes_;
+    }
+
+private:
+    void Bytes(void* data, size_t size);
+
+    std::string  path_;
+    bool         write_;
+    cudaStream_t stream_;
+    size_t       bytes_{};
+
+    // write
+    std::ofstream ofs_;
+    char*         staging_{};
+
+    // restore
+    const char*                   map_{};
+    size_t                        map_size_{};
+    size_t                        offset_{};
+    std::unique_ptr<StagedCopier> copier_;
+};
+
+// The format & buffers of a prepared linear weight
+template<class T>
+void SnapshotDense(WeightSnapshot& s, LlamaDenseWeight<T>& w)
+{
+    s.Check(w.input_dims, "input dims");
+    s.Check(w.output_dims, "output dims");
+    s.Value(w.type);
+    s.Value(w.group_size);
+    s.Value(w.k_desc);
+    s.Value(w.q_desc);
+    w.for_each_buffer([&](void** ptr, size_t size) { s.Buffer(ptr, size); });
+}
+
+}  // namespace turbomind
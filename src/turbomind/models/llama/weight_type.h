@@ -10,10 +10,12 @@ enum class WeightType : int
 {
     kFP32,
     kFP16,
-    kFP8,  // not supported yet
+    kFP8,  // e4m3 with per-channel scales, quantized from f16/bf16 weights at load time
     kBF16,
     kINT8,
-    kINT4
+    kINT4,
+    kUINT8,   // group-wise asymmetric u8 with f16 scales/zeros, quantized from f16 weights at load time
+    kSPARSE,  // 2:4 sparse f16/bf16 compressed along k with u16 metadata, from pruned weights at load time
 };
 
 template<class T>
@@ -49,6 +51,10 @@ inline size_t getBitSize(WeightType type)
             return 8;
         case WeightType::kINT4:
             return 4;
+        case WeightType::kUINT8:
+            return 8;
+        case WeightType::kSPARSE:  // per element of the dense weights
+            return 8;
     }
     return 0;
 }
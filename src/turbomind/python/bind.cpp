@@ -1,5 +1,6 @@
 // Copyright (c) OpenMMLab. All rights reserved.
 
+#include <cstring>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
@@ -7,17 +8,21 @@
 #include <cuda_runtime.h>
 
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/pytypes.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 
+#include "src/turbomind/engine/completion_queue.h"
 #include "src/turbomind/engine/model_request.h"
 #include "src/turbomind/python/dlpack.h"
 #include "src/turbomind/triton_backend/llama/LlamaTritonModel.h"
 #include "src/turbomind/triton_backend/transformer_triton_backend.hpp"
 #include "src/turbomind/utils/Tensor.h"
 #include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/metrics.h"
+#include "src/turbomind/utils/tracer.h"
 
 namespace py = pybind11;
 namespace ft = turbomind;
@@ -26,6 +31,22 @@ using namespace pybind11::literals;
 using ft::ManagedTensor;
 using ft::Tensor;
 
+// Python implementations of `TokenMatcher`, called from the mask workers of the engine
+struct PyTokenMatcher: ft::TokenMatcher {
+    void FillNextTokenBitmask(uint32_t* bitmask, int words) override
+    {
+        py::gil_scoped_acquire gil;
+        // a view, the array doesn't own the bitmask
+        py::array_t<int32_t> view({words}, {sizeof(int32_t)}, (int32_t*)bitmask, py::none());
+        PYBIND11_OVERRIDE_PURE_NAME(void, ft::TokenMatcher, "fill_next_token_bitmask", FillNextTokenBitmask, view);
+    }
+
+    void AcceptToken(int token_id) override
+    {
+        PYBIND11_OVERRIDE_PURE_NAME(void, ft::TokenMatcher, "accept_token", AcceptToken, token_id);
+    }
+};
+
 // prepare to bind container
 using TensorMap = std::unordered_map<std::string, ft::ManagedTensor>;
 PYBIND11_MAKE_OPAQUE(TensorMap);
@@ -299,6 +320,9 @@ struct ScopedGIL {
 
 }  // namespace
 
+static const int kKvExport = ft::KvTransfer::kExport;
+static const int kKvImport = ft::KvTransfer::kImport;
+
 PYBIND11_MODULE(_turbomind, m)
 {
     py::class_<ft::SessionParam>(m, "SessionParam")
@@ -320,7 +344,15 @@ PYBIND11_MODULE(_turbomind, m)
         .def_readwrite("id", &ft::SessionParam::id)
         .def_readwrite("step", &ft::SessionParam::step)
         .def_readwrite("start", &ft::SessionParam::start_flag)
-        .def_readwrite("end", &ft::SessionParam::end_flag);
+        .def_readwrite("end", &ft::SessionParam::end_flag)
+        .def_readwrite("fork", &ft::SessionParam::fork_flag)
+        .def_readwrite("parent_id", &ft::SessionParam::parent_id)
+        .def_readwrite("deadline", &ft::SessionParam::deadline)
+        .def_readwrite("kv_stream", &ft::SessionParam::kv_stream_flag)
+        .def_readwrite("kv_stream_peer", &ft::SessionParam::kv_stream_peer);
+
+    py::class_<ft::TokenMatcher, PyTokenMatcher, std::shared_ptr<ft::TokenMatcher>>(m, "TokenMatcher")
+        .def(py::init());
 
     py::class_<ft::GenerationConfig>(m, "GenerationConfig")
         .def(py::init())
@@ -334,19 +366,106 @@ PYBIND11_MODULE(_turbomind, m)
         .def_readwrite("min_p", &ft::GenerationConfig::min_p)
         .def_readwrite("temperature", &ft::GenerationConfig::temperature)
         .def_readwrite("repetition_penalty", &ft::GenerationConfig::repetition_penalty)
+        .def_readwrite("frequency_penalty", &ft::GenerationConfig::frequency_penalty)
+        .def_readwrite("presence_penalty", &ft::GenerationConfig::presence_penalty)
         .def_readwrite("random_seed", &ft::GenerationConfig::random_seed)
         .def_readwrite("output_logprobs", &ft::GenerationConfig::output_logprobs)
         .def_readwrite("output_last_hidden_state", &ft::GenerationConfig::output_last_hidden_state)
         .def_readwrite("output_logits", &ft::GenerationConfig::output_logits)
+        .def_readwrite("score", &ft::GenerationConfig::score)
+        .def_readwrite("pooling", &ft::GenerationConfig::pooling)
+        .def_readwrite("normalize", &ft::GenerationConfig::normalize)
+        .def_readwrite("warm", &ft::GenerationConfig::warm)
+        .def_readwrite("pin_prefix", &ft::GenerationConfig::pin_prefix)
+        .def_readwrite("output_text", &ft::GenerationConfig::output_text)
+        .def_readwrite("priority", &ft::GenerationConfig::priority)
+        .def_readwrite("adapter_id", &ft::GenerationConfig::adapter_id)
+        .def_readwrite("tenant_id", &ft::GenerationConfig::tenant_id)
+        .def_readwrite("tenant_weight", &ft::GenerationConfig::tenant_weight)
+        .def_readwrite("expected_output_len", &ft::GenerationConfig::expected_output_len)
+        .def_readwrite("beam_width", &ft::GenerationConfig::beam_width)
+        .def_readwrite("length_penalty", &ft::GenerationConfig::length_penalty)
+        .def_readwrite("matcher", &ft::GenerationConfig::matcher)
         .def("__repr__", [](const ft::GenerationConfig& c) {
             std::ostringstream oss;
             oss << c;
             return oss.str();
         });
 
+    py::class_<ft::KvTransfer, std::shared_ptr<ft::KvTransfer>>(m, "KvTransfer")
+        .def(py::init([](int op, int peer, bool release) {
+                 auto t     = std::make_shared<ft::KvTransfer>();
+                 t->op      = op;
+                 t->peer    = peer;
+                 t->release = release;
+                 return t;
+             }),
+             "op"_a,
+             "peer"_a,
+             "release"_a = true)
+        .def_readonly_static("EXPORT", &kKvExport)
+        .def_readonly_static("IMPORT", &kKvImport)
+        .def_readwrite("op", &ft::KvTransfer::op)
+        .def_readwrite("peer", &ft::KvTransfer::peer)
+        .def_readwrite("release", &ft::KvTransfer::release)
+        .def_readwrite("tokens", &ft::KvTransfer::tokens)
+        .def_property(
+            "random_state",
+            [](const ft::KvTransfer& t) {
+                return py::bytes((const char*)t.random_state.data(), t.random_state.size());
+            },
+            [](ft::KvTransfer& t, const py::bytes& b) {
+                const std::string s = b;
+                t.random_state.resize(s.size());
+                std::memcpy(t.random_state.data(), s.data(), s.size());
+            })
+        .def_readwrite("rope_theta", &ft::KvTransfer::rope_theta)
+        .def_readwrite("cache_len", &ft::KvTransfer::cache_len)
+        .def_readwrite("block_size", &ft::KvTransfer::block_size)
+        .def_readwrite("block_count", &ft::KvTransfer::block_count)
+        .def_readwrite("layer_major", &ft::KvTransfer::layer_major)
+        .def_property(
+            "host_blocks",
+            [](const ft::KvTransfer& t) -> py::object {
+                if (!t.host) {
+                    return py::none();
+                }
+                std::lock_guard lock{t.host->mutex};
+                py::list        ret(t.host->blocks.size());
+                for (const auto& [rank, blocks] : t.host->blocks) {
+                    ret[rank] = py::bytes((const char*)blocks.data(), blocks.size());
+                }
+                return ret;
+            },
+            [](ft::KvTransfer& t, const py::object& obj) {
+                if (obj.is_none()) {
+                    t.host = {};
+                    return;
+                }
+                t.host = std::make_shared<ft::KvTransfer::HostBlocks>();
+                int rank = 0;
+                for (const auto& x : obj.cast<py::list>()) {
+                    const std::string s = x.cast<py::bytes>();
+                    auto&             b = t.host->blocks[rank++];
+                    b.resize(s.size());
+                    std::memcpy(b.data(), s.data(), s.size());
+                }
+            });
+
+    py::class_<ft::RequestMetrics>(m, "RequestMetrics")
+        .def_readonly("enqueue_time", &ft::RequestMetrics::enqueue_time)
+        .def_readonly("scheduled_time", &ft::RequestMetrics::scheduled_time)
+        .def_readonly("prefill_end_time", &ft::RequestMetrics::prefill_end_time)
+        .def_readonly("first_token_time", &ft::RequestMetrics::first_token_time)
+        .def_readonly("finish_time", &ft::RequestMetrics::finish_time)
+        .def_readonly("computed_tokens", &ft::RequestMetrics::computed_tokens)
+        .def_readonly("preempt_times", &ft::RequestMetrics::preempt_times);
+
     py::class_<ft::RequestState, std::unique_ptr<ft::RequestState>>(m, "RequestState")
         .def_readonly("status", &ft::RequestState::status)
-        .def_readonly("seq_len", &ft::RequestState::seq_len);
+        .def_readonly("seq_len", &ft::RequestState::seq_len)
+        .def_readonly("cached_len", &ft::RequestState::cached_len)
+        .def_readonly("metrics", &ft::RequestState::metrics);
 
     py::class_<ft::AtomicRequestState, std::shared_ptr<ft::AtomicRequestState>>(m, "AtomicRequestState")
         .def("consume", [](ft::AtomicRequestState& s) { return s.exchange(nullptr); });
@@ -469,9 +588,11 @@ PYBIND11_MODULE(_turbomind, m)
                const ft::SessionParam&     session,
                const ft::GenerationConfig& gen_cfg,
                bool                        stream_output,
-               std::function<void()>       cb) {
+               std::function<void()>       cb,
+               std::shared_ptr<TensorMap>  output_tensors) {
                 ModelRequest::InputParam param{};
                 param.tensors       = std::move(input_tensors);
+                param.outputs       = std::move(output_tensors);
                 param.session       = session;
                 param.gen_cfg       = gen_cfg;
                 param.stream_output = stream_output;
@@ -490,7 +611,8 @@ PYBIND11_MODULE(_turbomind, m)
             "session"_a,
             "gen_cfg"_a,
             "stream_output"_a,
-            "cb"_a)
+            "cb"_a,
+            "output_tensors"_a = nullptr)
         .def(
             "cancel",
             [](ModelRequest* model_request) {
@@ -504,8 +626,71 @@ PYBIND11_MODULE(_turbomind, m)
             },
             py::call_guard<py::gil_scoped_release>(),
             "cb"_a,
+            "session_id"_a)
+        .def(
+            "transfer",
+            [](ModelRequest*                   model_request,
+               std::shared_ptr<ft::KvTransfer> transfer,
+               std::function<void(int)>        cb,
+               uint64_t                        session_id) {
+                model_request->Transfer(std::move(transfer), std::move(cb), session_id);  //
+            },
+            py::call_guard<py::gil_scoped_release>(),
+            "transfer"_a,
+            "cb"_a,
             "session_id"_a);
 
+    py::class_<ft::CompletionQueue, std::shared_ptr<ft::CompletionQueue>>(m, "CompletionQueue")
+        .def(py::init<>())
+        .def("fd", &ft::CompletionQueue::fd)
+        .def(
+            "drain",
+            [](ft::CompletionQueue& q) {
+                std::vector<uint64_t> tags;
+                q.drain(tags);
+                return tags;
+            },
+            py::call_guard<py::gil_scoped_release>());
+
+    // Submits the requests in one call, the state updates of request `i` push `tags[i]` to `queue` instead of
+    // invoking a python callback
+    m.def(
+        "forward_batch",
+        [](const std::vector<ModelRequest*>&               model_requests,
+           const std::vector<std::shared_ptr<TensorMap>>& input_tensors,
+           const std::vector<ft::SessionParam>&            sessions,
+           const std::vector<ft::GenerationConfig>&        gen_cfgs,
+           const std::vector<bool>&                        stream_output,
+           const std::vector<std::shared_ptr<TensorMap>>& output_tensors,
+           const std::vector<uint64_t>&                    tags,
+           std::shared_ptr<ft::CompletionQueue>            queue) {
+            const size_t n = model_requests.size();
+            ft::FT_CHECK(input_tensors.size() == n && sessions.size() == n && gen_cfgs.size() == n
+                         && stream_output.size() == n && output_tensors.size() == n && tags.size() == n);
+            std::vector<std::tuple<std::shared_ptr<TensorMap>, std::shared_ptr<ft::AtomicRequestState>>> ret;
+            ret.reserve(n);
+            for (size_t i = 0; i < n; ++i) {
+                ModelRequest::InputParam param{};
+                param.tensors       = input_tensors[i];
+                param.outputs       = output_tensors[i];
+                param.session       = sessions[i];
+                param.gen_cfg       = gen_cfgs[i];
+                param.stream_output = stream_output[i];
+                auto out = model_requests[i]->Forward(std::move(param), [queue, tag = tags[i]] { queue->push(tag); });
+                ret.emplace_back(std::move(out.tensors), std::move(out.state));
+            }
+            return ret;
+        },
+        py::call_guard<py::gil_scoped_release>(),
+        "model_requests"_a,
+        "input_tensors"_a,
+        "sessions"_a,
+        "gen_cfgs"_a,
+        "stream_output"_a,
+        "output_tensors"_a,
+        "tags"_a,
+        "queue"_a);
+
     // transformer model
     using ft::AbstractTransformerModel;
     using ft::LlamaTritonModel;
@@ -586,6 +771,110 @@ PYBIND11_MODULE(_turbomind, m)
             py::call_guard<py::gil_scoped_release>(),
             "device_id"_a,
             "rank"_a)
+        .def("create_all_shared_weights",
+             &AbstractTransformerModel::createAllSharedWeights,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_ids"_a,
+             "ranks"_a)
+        .def("create_engines",
+             &AbstractTransformerModel::createEngines,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_ids"_a,
+             "ranks"_a)
+        .def("get_expert_stats",
+             &AbstractTransformerModel::getExpertStats,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "reset"_a = false)
+        .def("get_profile",
+             &AbstractTransformerModel::getProfile,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "reset"_a = false)
+        .def("get_cache_stats",
+             &AbstractTransformerModel::getCacheStats,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a)
+        .def("plan_memory",
+             &AbstractTransformerModel::planMemory,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "rank"_a)
+        .def("get_startup_phases",
+             &AbstractTransformerModel::getStartupPhases,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a)
+        .def(
+            "get_metrics",
+            [](AbstractTransformerModel*) { return ft::MetricsRegistry::instance().Export(); },
+            py::call_guard<py::gil_scoped_release>())
+        .def(
+            "dump_trace",
+            [](AbstractTransformerModel*, bool reset) { return ft::Tracer::instance().Dump(reset); },
+            py::call_guard<py::gil_scoped_release>(),
+            "reset"_a = false)
+        .def("create_kv_transport_id",
+             [](AbstractTransformerModel* model) { return py::bytes(model->createKvTransportId()); })
+        .def(
+            "connect_kv_transport",
+            [](AbstractTransformerModel* model, int device_id, const py::bytes& id, int n_ranks, int rank) {
+                std::string s = id;
+                py::gil_scoped_release release;
+                model->connectKvTransport(device_id, s, n_ranks, rank);
+            },
+            "device_id"_a,
+            "id"_a,
+            "n_ranks"_a,
+            "rank"_a)
+        .def(
+            "register_adapter",
+            [](AbstractTransformerModel* model, int device_id, int id, int rank, float scale, py::object obj) {
+                py::capsule      cap = obj.attr("__dlpack__")();
+                DLManagedTensor* dlmt =
+                    static_cast<DLManagedTensor*>(PyCapsule_GetPointer(cap.ptr(), kDlTensorCapsuleName));
+                auto src = DLManagedTensorToTritonTensor(dlmt);
+                // take ownership of capsule's payload
+                cap.set_name("used_dltensor");
+                ft::FT_CHECK_WITH_INFO((*src)->where == ft::MEMORY_CPU, "adapter weights must be on host");
+                auto num_element = std::accumulate(
+                    (*src)->shape.begin(), (*src)->shape.end(), 1LL, std::multiplies<int64_t>());
+                auto num_bytes = num_element * dlmt->dl_tensor.dtype.bits / 8;
+                py::gil_scoped_release release;
+                model->registerAdapter(device_id, id, rank, scale, (*src)->data, num_bytes);
+            },
+            "device_id"_a,
+            "id"_a,
+            "rank"_a,
+            "scale"_a,
+            "weights"_a)
+        .def("unregister_adapter",
+             &AbstractTransformerModel::unregisterAdapter,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "id"_a)
+        .def("create_update_weights",
+             &AbstractTransformerModel::createUpdateWeights,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "rank"_a)
+        .def(
+            "get_update_params",
+            [](AbstractTransformerModel* model, int deviceId, int rank) {
+                auto      output = model->getUpdateParams(deviceId, rank);
+                TensorMap ret;
+                for (const auto& [k, v] : output) {
+                    ret.emplace(k, ManagedTensor{v});
+                }
+                return ret;
+            },
+            py::call_guard<py::gil_scoped_release>(),
+            "device_id"_a,
+            "rank"_a)
+        .def("commit_update_weights",
+             &AbstractTransformerModel::commitUpdateWeights,
+             py::call_guard<py::gil_scoped_release>(),
+             "device_id"_a,
+             "rank"_a)
         .def("__str__", &AbstractTransformerModel::toString)
         .def("__repr__", &AbstractTransformerModel::toString)
         .def("get_tensor_para_size", &AbstractTransformerModel::getTensorParaSize)
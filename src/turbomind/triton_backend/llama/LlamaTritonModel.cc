@@ -18,7 +18,10 @@
 // Modified from
 // https://github.com/NVIDIA/FasterTransformer/blob/main/src/fastertransformer/triton_backend/multi_gpu_gpt/ParallelGptTritonModel.cc
 
+#include <algorithm>
 #include <cctype>
+#include <memory>
+#include <mutex>
 #include <optional>
 
 #include <cuda_runtime.h>
@@ -26,14 +29,19 @@
 
 #include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/comm/host_comm.h"
+#include "src/turbomind/comm/kv_transport.h"
 #include "src/turbomind/engine/gateway.h"
 #include "src/turbomind/engine/model_request.h"
+#include "src/turbomind/kernels/core/pdl.h"
+#include "src/turbomind/kernels/gemm/gemm.h"
 #include "src/turbomind/models/llama/LlamaDenseWeight.h"
 #include "src/turbomind/models/llama/LlamaV2.h"
 #include "src/turbomind/models/llama/context.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/llama_utils.h"
 #include "src/turbomind/utils/allocator.h"
 #include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/tracer.h"
 
 #include "src/turbomind/triton_backend/llama/LlamaTritonModel.h"
 
@@ -206,6 +214,11 @@ void LlamaTritonModel<T>::handleMissingParams()
                        attn_param_.cache_block_seq_len);
     }
 
+    // a tile of the decoding kernels must not span blocks, the MLA kernels use a smaller tile
+    const int block_len = attn_param_.cache_block_seq_len;
+    FT_CHECK_WITH_INFO(block_len > 0 && block_len % 64 == 0,
+                       fmtstr("`cache_block_seq_len` must be a multiple of 64, got %d", block_len));
+
     if (!engine_param_.cache_chunk_size) {
         engine_param_.cache_chunk_size = engine_param_.cache_max_block_count;
         TM_LOG_WARNING("[LlamaTritonModel] `cache_chunk_size` is not set, default to %d.",
@@ -231,6 +244,7 @@ LlamaTritonModel<T>::~LlamaTritonModel()
         check_cuda_error(cudaSetDevice(device_id));
         engines_[device_id].reset();
         weights_[device_id].reset();
+        update_weights_[device_id].reset();
         trim_default_mempool(device_id);
     }
 }
@@ -239,7 +253,13 @@ template<typename T>
 LlamaTritonModel<T>::LlamaTritonModel(std::string                            model_dir,
                                       std::string                            config,
                                       std::function<std::shared_ptr<void>()> ffi_ctx_factory):
-    model_param_{}, attn_param_{}, moe_param_{}, lora_param_{}, engine_param_{}, weights_(getDeviceCount())
+    model_param_{},
+    attn_param_{},
+    moe_param_{},
+    lora_param_{},
+    engine_param_{},
+    weights_(getDeviceCount()),
+    update_weights_(getDeviceCount())
 {
     FT_CHECK_WITH_INFO(!(config.empty() && model_dir.empty()), "invalid init options");
 
@@ -276,6 +296,7 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
     model_param_.embedding_size     = model_reader["embedding_size"].as<int>();
     model_param_.norm_eps           = model_reader["norm_eps"].as<float>();
     model_param_.tune_layer_num     = model_reader["tune_layer_num"].as<int>(1);
+    model_param_.medusa_num_heads   = model_reader["medusa_num_heads"].as<int>(0);
     model_param_.mla.q_lora_rank    = model_reader["q_lora_rank"].as<int>();
     model_param_.mla.kv_lora_rank   = model_reader["kv_lora_rank"].as<int>();
     model_param_.mla.qk_rope_dim    = model_reader["qk_rope_dim"].as<int>();
@@ -286,6 +307,15 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
     for (auto it = inter_size.begin(); it != inter_size.end(); ++it) {
         model_param_.inter_size.push_back(it->as<int>());
     }
+    // kv heads of each layer of pruned models & the kv cache precision of each layer
+    YAML::Node layer_kv_head_num = model_reader["layer_kv_head_num"];
+    for (auto it = layer_kv_head_num.begin(); it != layer_kv_head_num.end(); ++it) {
+        model_param_.layer_kv_head_num.push_back(it->as<int>());
+    }
+    YAML::Node layer_quant_policy = engine_reader["layer_quant_policy"];
+    for (auto it = layer_quant_policy.begin(); it != layer_quant_policy.end(); ++it) {
+        model_param_.layer_quant_policy.push_back(it->as<int>());
+    }
     // Only weight classes need these
     model_param_.attn_bias  = model_reader["attn_bias"].as<int>(0);
     model_param_.qk_norm    = model_reader["qk_norm"].as<bool>();
@@ -303,12 +333,127 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
     engine_param_.max_context_token_num = engine_reader["max_context_token_num"].as<int>(0);
     engine_param_.session_len           = model_reader["session_len"].as<int>(0);
 
-    engine_param_.cache_max_block_count = engine_reader["cache_max_entry_count"].as<float>(0);
-    engine_param_.cache_chunk_size      = engine_reader["cache_chunk_size"].as<int>(0);
-    engine_param_.enable_prefix_caching = engine_reader["enable_prefix_caching"].as<bool>(false);
+    engine_param_.cache_max_block_count  = engine_reader["cache_max_entry_count"].as<float>(0);
+    engine_param_.cache_chunk_size       = engine_reader["cache_chunk_size"].as<int>(0);
+    engine_param_.cache_swap_space       = engine_reader["cache_swap_space"].as<float>(0);
+    engine_param_.cache_swap_bandwidth   = engine_reader["cache_swap_bandwidth"].as<float>(0);
+    engine_param_.cache_recompute_tflops = engine_reader["cache_recompute_tflops"].as<float>(100);
+    engine_param_.enable_prefix_caching  = engine_reader["enable_prefix_caching"].as<bool>(false);
+    engine_param_.cache_pin_tokens       = engine_reader["cache_pin_tokens"].as<int>(0);
+
+    engine_param_.prefix_cache_path       = engine_reader["prefix_cache_path"].as<std::string>("");
+    engine_param_.prefix_cache_disk_space = engine_reader["prefix_cache_disk_space"].as<float>(0);
+
+    engine_param_.embedding_cache_size = engine_reader["embedding_cache_size"].as<float>(0);
+
+    engine_param_.l2_persist_mb = engine_reader["l2_persist_mb"].as<int>(0);
+
+    engine_param_.kv_quant_error_interval = engine_reader["kv_quant_error_interval"].as<int>(0);
+
+    weight_key_ = engine_reader["weight_share_key"].as<std::string>("");
+
+    engine_param_.cache_window_size = engine_reader["cache_window_size"].as<int>(0);
+    engine_param_.cache_sink_size   = engine_reader["cache_sink_size"].as<int>(0);
+
+    engine_param_.cache_score_budget = engine_reader["cache_score_budget"].as<int>(0);
+
+    engine_param_.cache_recent_blocks = engine_reader["cache_recent_blocks"].as<int>(0);
+    engine_param_.cache_cold_quant    = engine_reader["cache_cold_quant"].as<std::string>("int4");
+    engine_param_.cache_cold_ratio    = engine_reader["cache_cold_ratio"].as<float>(.5f);
+
+    engine_param_.cache_eviction_policy = engine_reader["cache_eviction_policy"].as<std::string>("lru");
+
+    engine_param_.cache_pool_key  = engine_reader["cache_pool_key"].as<std::string>("");
+    engine_param_.cache_pool_size = engine_reader["cache_pool_size"].as<float>(0);
+    engine_param_.cache_pool_min  = engine_reader["cache_pool_min"].as<float>(0);
+    engine_param_.cache_pool_max  = engine_reader["cache_pool_max"].as<float>(0);
+
+    engine_param_.cache_virtual_memory = engine_reader["cache_virtual_memory"].as<bool>(false);
 
     engine_param_.num_tokens_per_iter = engine_reader["num_tokens_per_iter"].as<int>(0);
     engine_param_.max_prefill_iters   = engine_reader["max_prefill_iters"].as<int>(1);
+    engine_param_.split_fuse          = engine_reader["split_fuse"].as<bool>(false);
+    engine_param_.overlap_scheduling  = engine_reader["overlap_scheduling"].as<bool>(false);
+    engine_param_.async_output        = engine_reader["async_output"].as<bool>(false);
+    engine_param_.enable_cuda_graph   = engine_reader["enable_cuda_graph"].as<bool>(false);
+    engine_param_.numa_affinity       = engine_reader["numa_affinity"].as<bool>(false);
+    engine_param_.comm_overlap_tokens = engine_reader["comm_overlap_tokens"].as<int>(0);
+    engine_param_.comm_quant          = engine_reader["comm_quant"].as<std::string>("none");
+
+    engine_param_.enable_cascade_attention = engine_reader["enable_cascade_attention"].as<bool>(false);
+
+    engine_param_.reserved_slots = engine_reader["reserved_slots"].as<int>(0);
+    engine_param_.target_itl_ms  = engine_reader["target_itl_ms"].as<float>(0);
+
+    engine_param_.admission_control = engine_reader["admission_control"].as<bool>(false);
+
+    engine_param_.num_speculative_tokens = engine_reader["num_speculative_tokens"].as<int>(0);
+    engine_param_.speculative_ngram_size = engine_reader["speculative_ngram_size"].as<int>(3);
+
+    engine_param_.finish_sync_interval = engine_reader["finish_sync_interval"].as<int>(0);
+    // the drafts are proposed from the tokens on host, the requests received ahead would change the batch
+    const bool speculative = engine_param_.num_speculative_tokens || model_param_.medusa_num_heads;
+    if (engine_param_.finish_sync_interval > 1 && (engine_param_.overlap_scheduling || speculative)) {
+        TM_LOG_WARNING("[LlamaTritonModel] `finish_sync_interval` is not supported with `overlap_scheduling` or "
+                       "speculative decoding, disabled");
+        engine_param_.finish_sync_interval = 0;
+    }
+
+    engine_param_.fp8_linear = engine_reader["fp8_linear"].as<bool>(false);
+    if (engine_param_.fp8_linear && !gemm::is_fp8_supported(getSMVersion())) {
+        TM_LOG_WARNING(
+            "[LlamaTritonModel] `fp8_linear` requires sm90 and a build with `90a`, fall back to the original weights");
+        engine_param_.fp8_linear = false;
+    }
+
+    engine_param_.int8_linear = engine_reader["int8_linear"].as<bool>(false);
+    if (engine_param_.int8_linear && !gemm::is_int8_supported(getSMVersion())) {
+        TM_LOG_WARNING("[LlamaTritonModel] `int8_linear` requires sm80, fall back to the original weights");
+        engine_param_.int8_linear = false;
+    }
+    FT_CHECK_WITH_INFO(!(engine_param_.fp8_linear && engine_param_.int8_linear),
+                       "`fp8_linear` and `int8_linear` are exclusive");
+
+    engine_param_.w8a16_linear = engine_reader["w8a16_linear"].as<bool>(false);
+    if (engine_param_.w8a16_linear && getSMVersion() < 80) {
+        TM_LOG_WARNING("[LlamaTritonModel] `w8a16_linear` requires sm80, fall back to the original weights");
+        engine_param_.w8a16_linear = false;
+    }
+
+    engine_param_.sparse_linear = engine_reader["sparse_linear"].as<bool>(false);
+    if (engine_param_.sparse_linear && getSMVersion() < 80) {
+        TM_LOG_WARNING("[LlamaTritonModel] `sparse_linear` requires sm80, fall back to the dense weights");
+        engine_param_.sparse_linear = false;
+    }
+
+    engine_param_.enable_pdl = engine_reader["enable_pdl"].as<bool>(false);
+    if (engine_param_.enable_pdl && getSMVersion() < 90) {
+        TM_LOG_WARNING("[LlamaTritonModel] `enable_pdl` requires sm90, the kernels are launched in order");
+        engine_param_.enable_pdl = false;
+    }
+    PdlEnabled() = engine_param_.enable_pdl;
+
+    engine_param_.decode_megakernel_batch = engine_reader["decode_megakernel_batch"].as<int>(0);
+
+    engine_param_.lm_head_quant = engine_reader["lm_head_quant"].as<std::string>("none");
+    if (engine_param_.lm_head_quant == "dense" && (getSMVersion() < 80 || sizeof(T) != 2)) {
+        TM_LOG_WARNING("[LlamaTritonModel] `lm_head_quant` of dense requires sm80 and fp16/bf16, fall back to cuBLAS");
+        engine_param_.lm_head_quant = "none";
+    }
+    else if (engine_param_.lm_head_quant != "none" && engine_param_.lm_head_quant != "dense"
+             && (getSMVersion() < 80 || !std::is_same_v<T, half>)) {
+        TM_LOG_WARNING("[LlamaTritonModel] `lm_head_quant` requires sm80 and fp16, fall back to the original weights");
+        engine_param_.lm_head_quant = "none";
+    }
+
+    engine_param_.embedding_quant = engine_reader["embedding_quant"].as<std::string>("none");
+    if (engine_param_.embedding_quant != "none" && sizeof(T) != 2) {
+        TM_LOG_WARNING("[LlamaTritonModel] `embedding_quant` requires fp16 or bf16, fall back to the original table");
+        engine_param_.embedding_quant = "none";
+    }
+
+    engine_param_.max_loras     = engine_reader["max_loras"].as<int>(0);
+    engine_param_.max_lora_rank = engine_reader["max_lora_rank"].as<int>(64);
 
     engine_param_.outer_dp_size = engine_reader["outer_dp_size"].as<int>();
     engine_param_.outer_dp_rank = 0;
@@ -316,13 +461,78 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
     engine_param_.attn_dp_rank  = 0;
     engine_param_.attn_tp_size  = engine_reader["attn_tp_size"].as<int>();
     engine_param_.attn_tp_rank  = 0;
+    engine_param_.attn_cp_size  = engine_reader["cp"].as<int>(1);
+    engine_param_.attn_cp_rank  = 0;
     engine_param_.mlp_tp_size   = engine_reader["mlp_tp_size"].as<int>();
     engine_param_.mlp_tp_rank   = 0;
+    engine_param_.pp_size       = engine_reader["pp"].as<int>(1);
+    engine_param_.pp_rank       = 0;
+
+    engine_param_.prefix_aware_routing = engine_reader["prefix_aware_routing"].as<bool>(false);
+    engine_param_.migrate_threshold    = engine_reader["migrate_threshold"].as<int>(0);
+    engine_param_.symmetric_kv_cache   = engine_reader["symmetric_kv_cache"].as<bool>(false);
+
+    engine_param_.max_queue_depth = engine_reader["max_queue_depth"].as<int>(0);
+    const auto queue_policy       = engine_reader["queue_policy"].as<std::string>("reject");
+    engine_param_.queue_policy    = queue_policy == "shed" ? 1 : queue_policy == "deadline" ? 2 : 0;
+    engine_param_.edf_slack_ms    = engine_reader["edf_slack_ms"].as<int>(0);
+    engine_param_.fair_share      = engine_reader["fair_share"].as<bool>(false);
+    engine_param_.sjf_scheduling  = engine_reader["sjf_scheduling"].as<bool>(false);
+
+    // both take the order of the requests of a scheduling class
+    if (engine_param_.sjf_scheduling && engine_param_.edf_slack_ms) {
+        TM_LOG_WARNING("[LlamaTritonModel] `sjf_scheduling` is not supported with `edf_slack_ms`, disabled");
+        engine_param_.sjf_scheduling = false;
+    }
+
+    engine_param_.detokenizer_path    = engine_reader["detokenizer_path"].as<std::string>("");
+    engine_param_.detokenizer_threads = engine_reader["detokenizer_threads"].as<int>(0);
+
+    engine_param_.profile_interval = engine_reader["profile_interval"].as<int>(0);
+    engine_param_.trace_buffer     = engine_reader["trace_buffer"].as<int>(0);
+    if (engine_param_.trace_buffer > 0) {
+        Tracer::instance().Enable(engine_param_.trace_buffer);
+    }
 
-    comm_size_ = engine_param_.attn_dp_size * engine_param_.attn_tp_size;
+    engine_param_.candidate_sampling = engine_reader["candidate_sampling"].as<bool>(false);
+
+    comm_size_ = engine_param_.attn_dp_size * engine_param_.attn_cp_size * engine_param_.attn_tp_size;
     FT_CHECK(engine_param_.mlp_tp_size == comm_size_);
 
-    communicator_ = engine_reader["communicator"].as<std::string>();
+    communicator_      = engine_reader["communicator"].as<std::string>();
+    host_communicator_ = engine_reader["host_communicator"].as<std::string>("thread");
+    // the tp ranks broadcast the dequeued requests as shared pointers, which can't cross processes
+    FT_CHECK_WITH_INFO(host_communicator_ != "socket" || engine_param_.attn_tp_size * engine_param_.attn_cp_size == 1,
+                       "[LlamaTritonModel] `host_communicator='socket'` requires attn tp and cp size 1");
+
+    engine_param_.ep_size              = engine_reader["ep"].as<int>(1);
+    engine_param_.ep_rank              = 0;
+    engine_param_.ep_overlap           = engine_reader["ep_overlap"].as<bool>(false);
+    engine_param_.moe_replica_interval = engine_reader["moe_replica_interval"].as<int>(0);
+    engine_param_.moe_scatter_reduce   = engine_reader["moe_scatter_reduce"].as<bool>(false);
+    engine_param_.moe_shared_overlap   = engine_reader["moe_shared_overlap"].as<bool>(false);
+    FT_CHECK_WITH_INFO(engine_param_.ep_size == 1 || engine_param_.ep_size == engine_param_.mlp_tp_size,
+                       "expert parallel size must be 1 or equal to the MLP TP size");
+    FT_CHECK_WITH_INFO(engine_param_.ep_size == 1 || communicator_ == "nccl",
+                       "expert parallelism requires the `nccl` communicator");
+
+    if (engine_param_.moe_shared_overlap && engine_param_.ep_size > 1) {
+        TM_LOG_WARNING("[LlamaTritonModel] `moe_shared_overlap` is ignored with expert parallelism, see `ep_overlap`");
+        engine_param_.moe_shared_overlap = false;
+    }
+
+    if (engine_param_.pp_size > 1) {
+        // the activations are passed between the stages by NCCL
+        FT_CHECK_WITH_INFO(communicator_ == "nccl", "pipeline parallelism requires the `nccl` communicator");
+        FT_CHECK_WITH_INFO(engine_param_.attn_dp_size == 1, "pipeline parallelism requires `attn_dp_size` == 1");
+        FT_CHECK_WITH_INFO(engine_param_.max_loras == 0, "pipeline parallelism is not supported with multi-LoRA");
+        FT_CHECK_WITH_INFO(engine_param_.num_speculative_tokens == 0,
+                           "pipeline parallelism is not supported with speculative decoding");
+    }
+
+    // the adapter slots live in the weights
+    FT_CHECK_WITH_INFO(weight_key_.empty() || engine_param_.max_loras == 0,
+                       "weight sharing is not supported with multi-LoRA");
 
     lora_param_.policy        = getLoraPolicy(reader["lora_config"]["lora_policy"].as<std::string>(""));
     lora_param_.r             = lora_reader["lora_r"].as<int>(0);
@@ -348,10 +558,72 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
 
     handleMissingParams();
 
-    gateway_ = std::make_shared<Gateway>(engine_param_.outer_dp_size, engine_param_.attn_dp_size, ffi_ctx_factory);
+    FT_CHECK_WITH_INFO((int)model_param_.layer_num >= engine_param_.pp_size,
+                       fmtstr("%d layers can't be split into %d pipeline stages",
+                              (int)model_param_.layer_num,
+                              engine_param_.pp_size));
+
+    if (HasLayerKvConfig(model_param_)) {
+        auto&     m         = model_param_;
+        const int layer_num = m.layer_num;
+        // the stages would differ in the size of their blocks
+        FT_CHECK_WITH_INFO(engine_param_.pp_size == 1 && !m.mla.kv_lora_rank,
+                           "per-layer kv heads & kv cache precision require a single pipeline stage and no MLA");
+        if (!m.layer_quant_policy.empty()) {
+            FT_CHECK_WITH_INFO((int)m.layer_quant_policy.size() == layer_num,
+                               fmtstr("`layer_quant_policy` of %d layers for a model of %d layers",
+                                      (int)m.layer_quant_policy.size(),
+                                      layer_num));
+            // the features requiring a non-quantized cache check the union
+            m.quant_policy = 0;
+            for (const auto& x : m.layer_quant_policy) {
+                FT_CHECK_WITH_INFO(x == 0 || x == QuantPolicy::kCacheKVInt4 || x == QuantPolicy::kCacheKVInt8
+                                       || x == QuantPolicy::kCacheKVFp8,
+                                   fmtstr("invalid kv cache quant policy %d of a layer", x));
+                m.quant_policy |= x;
+            }
+        }
+        if (!m.layer_kv_head_num.empty()) {
+            FT_CHECK_WITH_INFO((int)m.layer_kv_head_num.size() == layer_num,
+                               fmtstr("`layer_kv_head_num` of %d layers for a model of %d layers",
+                                      (int)m.layer_kv_head_num.size(),
+                                      layer_num));
+            // the buffers are sized for the layer of the most kv heads
+            m.kv_head_num = 0;
+            for (const auto& x : m.layer_kv_head_num) {
+                FT_CHECK_WITH_INFO(x > 0 && m.head_num % x == 0 && x % engine_param_.attn_tp_size == 0,
+                                   fmtstr("%d kv heads of a layer don't divide %d heads or split into %d ranks",
+                                          x,
+                                          (int)m.head_num,
+                                          engine_param_.attn_tp_size));
+                m.kv_head_num = std::max<size_t>(m.kv_head_num, x);
+            }
+        }
+    }
+
+    if (engine_param_.kv_quant_error_interval && !model_param_.quant_policy) {
+        TM_LOG_WARNING("[LlamaTritonModel] `kv_quant_error_interval` requires a quantized kv cache, disabled");
+        engine_param_.kv_quant_error_interval = 0;
+    }
+
+    const int routing_block_len = engine_param_.enable_prefix_caching && engine_param_.prefix_aware_routing ?
+                                      attn_param_.cache_block_seq_len :
+                                      0;
+
+    gateway_ = std::make_shared<Gateway>(
+        engine_param_.outer_dp_size, engine_param_.attn_dp_size, ffi_ctx_factory, routing_block_len);
+    gateway_->enable_migration(engine_param_.migrate_threshold);
+    gateway_->set_queue_limit(engine_param_.max_queue_depth, (QueuePolicy)engine_param_.queue_policy);
+    gateway_->set_deadline_order(engine_param_.edf_slack_ms * 1000LL);
+    gateway_->set_length_order(engine_param_.sjf_scheduling);
+    if (engine_param_.detokenizer_threads > 0 && !engine_param_.detokenizer_path.empty()) {
+        gateway_->enable_detokenizer(engine_param_.detokenizer_path, engine_param_.detokenizer_threads);
+    }
 
     const auto device_count = getDeviceCount();
     engines_.resize(device_count);
+    startup_.resize(device_count);
+    memory_plans_.resize(device_count);
 
     const std::string weight_type_str = model_reader["weight_type"].as<std::string>();
     if (weight_type_str == "fp16" || weight_type_str == "float16") {
@@ -374,6 +646,204 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
         FT_CHECK(0);
     }
 
+    attn_param_.mla_latent_cache = engine_reader["mla_latent_cache"].as<bool>(false);
+    if (attn_param_.mla_latent_cache) {
+        const auto& mla = model_param_.mla;
+        // the decoding kernels are instantiated for the latent dim of DeepSeek-V2/V3
+        if (!mla.kv_lora_rank || mla.kv_lora_rank + mla.qk_rope_dim != 576) {
+            TM_LOG_WARNING("[LlamaTritonModel] `mla_latent_cache` requires an MLA model with `kv_lora_rank` + "
+                           "`qk_rope_dim` == 576, fall back to the per-head k/v cache");
+            attn_param_.mla_latent_cache = false;
+        }
+        else if (model_param_.quant_policy || model_param_.weight_type == WeightType::kINT4 || getSMVersion() < 80) {
+            TM_LOG_WARNING("[LlamaTritonModel] `mla_latent_cache` requires sm80, non-quantized kv cache and "
+                           "`kv_b_proj`, fall back to the per-head k/v cache");
+            attn_param_.mla_latent_cache = false;
+        }
+    }
+
+    attn_param_.pre_rope_kv_cache = engine_reader["pre_rope_kv_cache"].as<bool>(false);
+    if (attn_param_.pre_rope_kv_cache) {
+        // the keys are rotated in smem by the decoding kernels of the non-quantized cache
+        if (model_param_.quant_policy || attn_param_.mla_latent_cache || attn_param_.rope.type == RopeType::kNull) {
+            TM_LOG_WARNING("[LlamaTritonModel] `pre_rope_kv_cache` requires rotary embedding, non-quantized kv cache "
+                           "and no `mla_latent_cache`, disabled");
+            attn_param_.pre_rope_kv_cache = false;
+        }
+    }
+
+    // null (the default) enables it below on sm80+ when the cache is supported by the kernels reading the blocks
+    const auto streaming_prefill      = engine_reader["streaming_prefill"];
+    const bool auto_streaming_prefill = !streaming_prefill || streaming_prefill.IsNull();
+    attn_param_.streaming_prefill     = streaming_prefill.as<bool>(false);
+    if (attn_param_.streaming_prefill) {
+        // the prefill kernels reading the cache blocks are instantiated for 64/128 dims, the ones dequantizing the
+        // blocks of a quantized cache for sm80+
+        const int head_dim = model_param_.head_dim;
+        if ((model_param_.quant_policy && getSMVersion() < 80) || attn_param_.mla_latent_cache
+            || attn_param_.pre_rope_kv_cache || (head_dim != 64 && head_dim != 128)) {
+            TM_LOG_WARNING("[LlamaTritonModel] `streaming_prefill` requires head_dim 64 or 128, sm80 for quantized kv "
+                           "cache and no `mla_latent_cache` or `pre_rope_kv_cache`, disabled");
+            attn_param_.streaming_prefill = false;
+        }
+    }
+
+    attn_param_.sparse_decode_blocks = engine_reader["sparse_decode_blocks"].as<int>(0);
+    if (attn_param_.sparse_decode_blocks) {
+        // the summaries are computed from the keys in `T`, the skipped blocks take the place of evicted tokens
+        if (model_param_.quant_policy || HasLayerKvConfig(model_param_) || attn_param_.mla_latent_cache
+            || attn_param_.use_logn_attn || engine_param_.cache_window_size || attn_param_.pre_rope_kv_cache) {
+            TM_LOG_WARNING("[LlamaTritonModel] `sparse_decode_blocks` requires non-quantized kv cache of the same "
+                           "heads in all layers and no `mla_latent_cache`, logn attention, `cache_window_size` or "
+                           "`pre_rope_kv_cache`, disabled");
+            attn_param_.sparse_decode_blocks = 0;
+        }
+    }
+
+    if (engine_param_.enable_cascade_attention
+        && (attn_param_.mla_latent_cache || attn_param_.use_logn_attn || attn_param_.pre_rope_kv_cache)) {
+        TM_LOG_WARNING("[LlamaTritonModel] cascade attention does not support `mla_latent_cache`, logn attention or "
+                       "`pre_rope_kv_cache`, disabled");
+        engine_param_.enable_cascade_attention = false;
+    }
+
+    engine_param_.deterministic = engine_reader["deterministic"].as<bool>(false);
+    attn_param_.batch_invariant = engine_param_.deterministic;
+    if (engine_param_.deterministic) {
+        if (engine_param_.enable_cascade_attention) {
+            TM_LOG_WARNING("[LlamaTritonModel] cascade attention groups the sequences of a batch, disabled by "
+                           "`deterministic`");
+            engine_param_.enable_cascade_attention = false;
+        }
+        if (engine_param_.moe_scatter_reduce) {
+            TM_LOG_WARNING("[LlamaTritonModel] the atomic adds of `moe_scatter_reduce` are unordered, disabled by "
+                           "`deterministic`");
+            engine_param_.moe_scatter_reduce = false;
+        }
+        const bool native_comm = communicator_ == "native" || communicator_ == "cuda-ipc";
+        if (comm_size_ > 1 && (!native_comm || engine_param_.attn_dp_size > 1 || engine_param_.comm_quant != "none")) {
+            TM_LOG_WARNING("[LlamaTritonModel] `deterministic` orders the reductions of the `cuda-ipc` TP allreduces "
+                           "only, the outputs may still depend on the batch with %s, attention DP or `comm_quant`",
+                           communicator_.c_str());
+        }
+    }
+
+    attn_param_.decode_sm_ratio = engine_reader["decode_sm_ratio"].as<float>(0.f);
+    attn_param_.rope_table_len  = engine_reader["rope_table_len"].as<int>(0);
+
+    if (const int cp = engine_param_.attn_cp_size; cp > 1) {
+        // the local keys of a rank are not contiguous in positions, which these features rely on
+        FT_CHECK_WITH_INFO(
+            attn_param_.cache_block_seq_len % (64 * cp) == 0,
+            fmtstr("context parallelism requires `cache_block_seq_len` to be a multiple of %d", 64 * cp));
+        FT_CHECK_WITH_INFO(cp <= 32, "context parallelism supports at most 32 ranks");
+        FT_CHECK_WITH_INFO(engine_param_.num_speculative_tokens == 0,
+                           "context parallelism is not supported with speculative decoding");
+        FT_CHECK_WITH_INFO(!attn_param_.mla_latent_cache && !attn_param_.pre_rope_kv_cache
+                               && !attn_param_.sparse_decode_blocks && !engine_param_.cache_window_size,
+                           "context parallelism does not support `mla_latent_cache`, `pre_rope_kv_cache`, "
+                           "`sparse_decode_blocks` or `cache_window_size`");
+        if (engine_param_.enable_cascade_attention) {
+            TM_LOG_WARNING("[LlamaTritonModel] cascade attention is not supported with context parallelism, disabled");
+            engine_param_.enable_cascade_attention = false;
+        }
+    }
+
+    attn_param_.cold_quant_policy = 0;
+    if (engine_param_.cache_recent_blocks) {
+        const bool int4     = engine_param_.cache_cold_quant == "int4";
+        const int  head_dim = model_param_.head_dim;
+        // the cold blocks are attended by the decoding kernels of the quantized cache in a pass of their own, the
+        // partials are merged with the recent blocks like the prefixes of cascade decoding
+        if (model_param_.quant_policy || HasLayerKvConfig(model_param_) || attn_param_.mla_latent_cache
+            || attn_param_.sparse_decode_blocks || attn_param_.streaming_prefill || attn_param_.pre_rope_kv_cache
+            || engine_param_.enable_prefix_caching
+            || engine_param_.cache_window_size || engine_param_.attn_cp_size > 1
+            || !engine_param_.cache_pool_key.empty() || sizeof(T) != 2 || (int4 && head_dim != 64 && head_dim != 128)) {
+            TM_LOG_WARNING("[LlamaTritonModel] `cache_recent_blocks` requires a non-quantized f16/bf16 kv cache "
+                           "of the same heads in all layers (head_dim 64 or 128 for int4) without `mla_latent_cache`, "
+                           "`sparse_decode_blocks`, `streaming_prefill`, `pre_rope_kv_cache`, prefix caching, "
+                           "`cache_window_size`, context parallelism or `cache_pool_key`, disabled");
+            engine_param_.cache_recent_blocks = 0;
+        }
+        else {
+            FT_CHECK_WITH_INFO(int4 || engine_param_.cache_cold_quant == "int8",
+                               "`cache_cold_quant` must be 'int8' or 'int4'");
+            FT_CHECK_WITH_INFO(0 < engine_param_.cache_cold_ratio && engine_param_.cache_cold_ratio < 1,
+                               "`cache_cold_ratio` must be in (0, 1)");
+            attn_param_.cold_quant_policy = int4 ? QuantPolicy::kCacheKVInt4 : QuantPolicy::kCacheKVInt8;
+            if (engine_param_.enable_cascade_attention) {
+                TM_LOG_WARNING("[LlamaTritonModel] cascade attention is not supported with `cache_recent_blocks`, "
+                               "disabled");
+                engine_param_.enable_cascade_attention = false;
+            }
+        }
+    }
+
+    if (engine_param_.cache_score_budget) {
+        // the scores are computed from the keys in `T` like the summaries of the sparse decoding, the dropped blocks
+        // take the place of evicted tokens
+        if (model_param_.quant_policy || HasLayerKvConfig(model_param_) || attn_param_.mla_latent_cache
+            || attn_param_.use_logn_attn || attn_param_.pre_rope_kv_cache || engine_param_.enable_prefix_caching
+            || engine_param_.cache_window_size || engine_param_.cache_recent_blocks || engine_param_.attn_cp_size > 1
+            || sizeof(T) != 2) {
+            TM_LOG_WARNING("[LlamaTritonModel] `cache_score_budget` requires a non-quantized f16/bf16 kv cache "
+                           "of the same heads in all layers without `mla_latent_cache`, logn attention, "
+                           "`pre_rope_kv_cache`, prefix caching, `cache_window_size`, `cache_recent_blocks` or context "
+                           "parallelism, disabled");
+            engine_param_.cache_score_budget = 0;
+        }
+    }
+
+    // The pins lock the blocks of the prefix cache
+    if (engine_param_.cache_pin_tokens && !engine_param_.enable_prefix_caching) {
+        TM_LOG_WARNING("[LlamaTritonModel] `cache_pin_tokens` requires prefix caching, disabled");
+        engine_param_.cache_pin_tokens = 0;
+    }
+
+    // Reading the history from the cache blocks saves flattening (a copy of) the whole history for every chunk &
+    // layer of a prefill, a quantized history is also read at its own width instead of dequantized into the linear
+    // kv. The linear kv is only kept for the caches the block kernels don't support
+    if (auto_streaming_prefill && getSMVersion() >= 80) {
+        const int head_dim = model_param_.head_dim;
+        attn_param_.streaming_prefill =
+            (head_dim == 64 || head_dim == 128) && !attn_param_.mla_latent_cache && !attn_param_.pre_rope_kv_cache
+            && !engine_param_.cache_recent_blocks && !engine_param_.cache_window_size
+            && !engine_param_.cache_score_budget && engine_param_.attn_cp_size == 1;
+    }
+
+    attn_param_.fp8_attention = engine_reader["fp8_attention"].as<bool>(false);
+    if (attn_param_.fp8_attention) {
+        // only the prefills reading the e4m3 blocks run on the fp8 tensor cores, decoding is bound by reading the cache
+        if (!(model_param_.quant_policy & QuantPolicy::kCacheKVFp8) || !attn_param_.streaming_prefill
+            || getSMVersion() < 89) {
+            TM_LOG_WARNING("[LlamaTritonModel] `fp8_attention` requires sm89+, an fp8 kv cache (quant_policy 16) "
+                           "and `streaming_prefill`, disabled");
+            attn_param_.fp8_attention = false;
+        }
+    }
+
+    engine_param_.offload_weights = engine_reader["offload_weights"].as<bool>(false);
+    const auto& experts = moe_param_.expert_num;
+    if (engine_param_.offload_weights && std::any_of(experts.begin(), experts.end(), [](int n) { return n > 0; })) {
+        TM_LOG_WARNING("[LlamaTritonModel] `offload_weights` does not support MoE models, disabled");
+        engine_param_.offload_weights = false;
+    }
+
+    if (const auto dir = engine_reader["weight_snapshot"].as<std::string>(""); !dir.empty()) {
+        if (engine_param_.offload_weights) {
+            TM_LOG_WARNING("[LlamaTritonModel] `weight_snapshot` is not compatible with `offload_weights`, disabled");
+        }
+        else if (std::any_of(experts.begin(), experts.end(), [](int n) { return n > 0; })) {
+            TM_LOG_WARNING("[LlamaTritonModel] `weight_snapshot` does not support MoE models, disabled");
+        }
+        else {
+            // the key identifies the model, the parallel config & the arch the weights are prepared for
+            const auto key   = engine_reader["weight_snapshot_key"].as<std::string>("weights");
+            weight_snapshot_ = dir + "/" + key;
+        }
+    }
+
     if (auto method = get_moe_method()) {
         moe_param_.method = *method;
     }
@@ -381,22 +851,41 @@ LlamaTritonModel<T>::LlamaTritonModel(std::string                            mod
         moe_param_.method = MoeParam::kFused;
     }
 
+    engine_param_.moe_expert_cache = engine_reader["moe_expert_cache"].as<int>(0);
+    if (engine_param_.moe_expert_cache) {
+        // the blocked pointers of the grouped GEMMs are redirected to the slots, the experts are whole on each rank
+        if (!std::any_of(experts.begin(), experts.end(), [](int n) { return n > 0; })) {
+            TM_LOG_WARNING("[LlamaTritonModel] `moe_expert_cache` is ignored for dense models");
+            engine_param_.moe_expert_cache = 0;
+        }
+        else if (engine_param_.ep_size > 1 || moe_param_.method != MoeParam::kFused || engine_param_.max_loras) {
+            TM_LOG_WARNING("[LlamaTritonModel] `moe_expert_cache` requires the fused MoE method and is not supported "
+                           "with expert parallelism or multi-LoRA, disabled");
+            engine_param_.moe_expert_cache = 0;
+        }
+    }
+
     // NOTE: This runs on Python main thread
     group_ids_.resize(engine_param_.outer_dp_size);
     for (size_t i = 0; i < group_ids_.size(); ++i) {
-        group_ids_[i] = comm::CreateHostGroupId("");
+        group_ids_[i] = comm::CreateHostGroupId(host_communicator_);
         group_ids_[i]->Initialize();
     }
 
-    const int device_num = engine_param_.outer_dp_size * comm_size_;
+    // ranks of an outer DP group are laid out as [pp_size, comm_size]
+    const int group_size = engine_param_.pp_size * comm_size_;
+    const int device_num = engine_param_.outer_dp_size * group_size;
 
     engine_params_.resize(device_num, engine_param_);
     for (int i = 0; i < device_num; ++i) {
         auto& e         = engine_params_[i];
-        e.outer_dp_rank = i / comm_size_;
+        e.outer_dp_rank = i / group_size;
+        e.pp_rank       = i % group_size / comm_size_;
         e.attn_tp_rank  = i % comm_size_ % e.attn_tp_size;
-        e.attn_dp_rank  = i % comm_size_ / e.attn_tp_size;
+        e.attn_cp_rank  = i % comm_size_ / e.attn_tp_size % e.attn_cp_size;
+        e.attn_dp_rank  = i % comm_size_ / (e.attn_tp_size * e.attn_cp_size);
         e.mlp_tp_rank   = i % comm_size_;
+        e.ep_rank       = e.ep_size > 1 ? e.mlp_tp_rank : 0;
     }
 
     TM_LOG_INFO("%s", toString().c_str());
@@ -416,13 +905,68 @@ std::unique_ptr<ModelRequest> LlamaTritonModel<T>::createModelInstance(int devic
                                           model_param_.hidden_units);
 }
 
+// Prepared weights of the live instances in the process, keyed by `weight_share_key`, device & rank
+template<typename T>
+struct WeightRegistry {
+    std::mutex                                                     mutex;
+    std::unordered_map<std::string, std::weak_ptr<LlamaWeight<T>>> weights;
+
+    static WeightRegistry& instance()
+    {
+        static WeightRegistry registry;
+        return registry;
+    }
+};
+
+template<typename T>
+std::string LlamaTritonModel<T>::weightKey(int device_id, int rank) const
+{
+    return weight_key_.empty() ? std::string{} : fmtstr("%s:%d:%d", weight_key_.c_str(), device_id, rank);
+}
+
+template<typename T>
+bool LlamaTritonModel<T>::isSharedWeight(int device_id, int rank) const
+{
+    const auto key = weightKey(device_id, rank);
+    if (key.empty()) {
+        return false;
+    }
+    auto&           registry = WeightRegistry<T>::instance();
+    std::lock_guard lock{registry.mutex};
+    const auto      it = registry.weights.find(key);
+    return it != registry.weights.end() && it->second.lock() == weights_[rank];
+}
+
+template<typename T>
+std::string LlamaTritonModel<T>::snapshotPath(int rank) const
+{
+    return weight_snapshot_.empty() ? std::string{} : fmtstr("%s.%d.tmw", weight_snapshot_.c_str(), rank);
+}
+
 template<typename T>
 void LlamaTritonModel<T>::createSharedWeights(int device_id, int rank) noexcept
 {
     check_cuda_error(cudaSetDevice(device_id));
-    weights_[rank] = std::make_shared<LlamaWeight<T>>(model_param_, engine_params_.at(rank), lora_param_, moe_param_);
-    // model inited with model_dir
-    if (model_dir_ != "") {
+    // Reuse the weights of a live instance, they are loaded & prepared already
+    if (const auto key = weightKey(device_id, rank); !key.empty()) {
+        auto&           registry = WeightRegistry<T>::instance();
+        std::lock_guard lock{registry.mutex};
+        if (auto it = registry.weights.find(key); it != registry.weights.end()) {
+            if ((weights_[rank] = it->second.lock())) {
+                TM_LOG_INFO("[LlamaTritonModel] rank %d shares the weights of a live instance", rank);
+                return;
+            }
+            registry.weights.erase(it);
+        }
+    }
+    {
+        StartupTimer::Scope _{&startup_[device_id], "alloc_weights"};
+        weights_[rank] =
+            std::make_shared<LlamaWeight<T>>(model_param_, engine_params_.at(rank), lora_param_, moe_param_);
+    }
+    // model inited with model_dir, a snapshot of the prepared weights replaces the model files
+    if (model_dir_ != "" && !WeightSnapshot::exists(snapshotPath(rank))) {
+        StartupTimer::Scope _{&startup_[device_id], "load_weights"};
         weights_[device_id]->loadModel(model_dir_);
     }
 }
@@ -435,6 +979,10 @@ std::unordered_map<std::string, Tensor> LlamaTritonModel<T>::getParams(int devic
     // shared_weight should be created before getParams
     FT_CHECK(weights_[rank] != nullptr);
 
+    if (isSharedWeight(device_id, rank)) {
+        return {};
+    }
+
     TensorMap output = weights_[rank]->getParams();
 
     std::unordered_map<std::string, Tensor> result;
@@ -451,11 +999,40 @@ void LlamaTritonModel<T>::processWeights(int device_id, int rank) noexcept
     check_cuda_error(cudaSetDevice(device_id));
     FT_CHECK(weights_[device_id] != nullptr);
 
-    cudaDeviceProp props{};
-    check_cuda_error(cudaGetDeviceProperties(&props, device_id));
+    if (isSharedWeight(device_id, rank)) {
+        return;
+    }
 
-    weights_[device_id]->prepare(props);
-    sync_check_cuda_error();
+    const auto snapshot = snapshotPath(rank);
+
+    auto& timer = startup_[device_id];
+
+    if (WeightSnapshot::exists(snapshot)) {
+        StartupTimer::Scope _{&timer, "load_snapshot"};
+        weights_[device_id]->loadSnapshot(snapshot);
+    }
+    else {
+        cudaDeviceProp props{};
+        check_cuda_error(cudaGetDeviceProperties(&props, device_id));
+
+        {
+            StartupTimer::Scope _{&timer, "process_weights"};
+            weights_[device_id]->prepare(props);
+            sync_check_cuda_error();
+        }
+
+        if (!snapshot.empty()) {
+            StartupTimer::Scope _{&timer, "save_snapshot"};
+            weights_[device_id]->saveSnapshot(snapshot);
+        }
+    }
+
+    // Only prepared weights are visible to the other instances
+    if (const auto key = weightKey(device_id, rank); !key.empty()) {
+        auto&           registry = WeightRegistry<T>::instance();
+        std::lock_guard lock{registry.mutex};
+        registry.weights[key] = weights_[device_id];
+    }
 }
 
 template<class T>
@@ -463,20 +1040,48 @@ Communicators LlamaTritonModel<T>::createCommSplits(int rank)
 {
     Communicators comm{};
 
-    const int outer_rank = rank / comm_size_;
-    const int inner_rank = rank % comm_size_;
+    const int pp_size    = engine_param_.pp_size;
+    const int group_size = pp_size * comm_size_;
+    const int outer_rank = rank / group_size;
+    const int group_rank = rank % group_size;
+    const int pp_rank    = group_rank / comm_size_;
+    const int inner_rank = group_rank % comm_size_;
+
+    comm.h_comm = group_ids_[outer_rank]->CreateCommunicator(group_size, group_rank);
+
+    // ranks of an attention DP group are laid out as [cp_size, tp_size], the context parallel ranks run the same batch
+    const int tp_size  = engine_param_.attn_tp_size;
+    const int cp_size  = engine_param_.attn_cp_size;
+    const int dp_color = pp_rank * tp_size * cp_size + inner_rank % (tp_size * cp_size);
 
-    comm.h_comm = group_ids_[outer_rank]->CreateCommunicator(comm_size_, inner_rank);
+    // The TP group spans all the stages, requests are broadcast from the first one
+    comm.h_tp_group = comm.h_comm->Split(inner_rank / (tp_size * cp_size), 0);
+    comm.h_dp_group = comm.h_comm->Split(dp_color, 0);
 
-    comm.h_tp_group = comm.h_comm->Split(inner_rank / engine_param_.attn_tp_size, 0);
-    comm.h_dp_group = comm.h_comm->Split(inner_rank % engine_param_.attn_tp_size, 0);
+    // Ranks of the pipeline stage
+    const auto h_stage = pp_size > 1 ? comm.h_comm->Split(pp_rank, 0) : comm.h_comm;
+
+    if (pp_size > 1) {
+        comm.d_pp_comm = CreateDeviceCommunicator("nccl", pp_size, pp_rank, comm.h_comm->Split(inner_rank, 0));
+        // results of the last stage are sent back on a separate communicator so that they don't wait for the
+        // activations of the next mini-batch
+        comm.d_pp_result_group = comm.d_pp_comm->Split(0, 0, 0);
+    }
 
     if (comm_size_ > 1) {
-        comm.d_comm = CreateDeviceCommunicator(communicator_, comm_size_, inner_rank, comm.h_comm);
+        comm.d_comm = CreateDeviceCommunicator(communicator_, comm_size_, inner_rank, h_stage);
         //
         comm.d_tp_group = 0;
-        if (engine_param_.attn_tp_size != comm_size_) {
-            comm.d_tp_group = comm.d_comm->Split(inner_rank / engine_param_.attn_tp_size, 0, 0);
+        if (tp_size != comm_size_) {
+            comm.d_tp_group = comm.d_comm->Split(inner_rank / tp_size, 0, 0);
+        }
+        if (cp_size > 1) {
+            const int cp_color = inner_rank / (tp_size * cp_size) * tp_size + inner_rank % tp_size;
+            comm.d_cp_group    = comm.d_comm->Split(cp_color, 0, 0);
+            comm.d_attn_group  = 0;
+            if (tp_size * cp_size != comm_size_) {
+                comm.d_attn_group = comm.d_comm->Split(inner_rank / (tp_size * cp_size), 0, 0);
+            }
         }
     }
 
@@ -488,27 +1093,77 @@ void LlamaTritonModel<T>::createEngine(int device_id, int rank)
 {
     check_cuda_error(cudaSetDevice(device_id));
 
-    auto ctx = std::make_unique<Context<T>>(device_id);
+    const auto& engine_param = engine_params_.at(rank);
 
-    ctx->comm = createCommSplits(rank);
+    // Pinned buffers of the engine are allocated by this thread, bind it to the device until they are done
+    std::vector<uint64_t> affinity;
+    if (engine_param.numa_affinity) {
+        affinity = getThreadAffinity();
+        if (!bindThreadToDevice(device_id)) {
+            TM_LOG_WARNING("[LlamaTritonModel] NUMA node of device %d is unknown", device_id);
+        }
+    }
 
-    const auto& engine_param = engine_params_.at(rank);
+    auto& timer = startup_[device_id];
+
+    std::unique_ptr<Context<T>> ctx;
+    {
+        StartupTimer::Scope _{&timer, "create_context"};
+        ctx = std::make_unique<Context<T>>(device_id);
+    }
+
+    ctx->startup = &timer;
+
+    {
+        StartupTimer::Scope _{&timer, "comm_setup"};
+        ctx->comm = createCommSplits(rank);
+    }
+
+    if (engine_param.deterministic) {
+        ctx->linear->set_batch_invariant(true);
+        if (ctx->comm.d_comm) {
+            ctx->comm.d_comm->SetFixedOrder(true);
+        }
+    }
+
+    if (engine_param.profile_interval > 0) {
+        ctx->profiler = std::make_unique<StepProfiler>(model_param_.layer_num, engine_param.profile_interval);
+    }
 
     // Get `h_comm` first as ctx will be moved later
     const auto h_comm = ctx->comm.h_comm;
 
-    h_comm->Sync();
+    // time waiting for the other ranks
+    auto sync = [&] {
+        StartupTimer::Scope _{&timer, "sync"};
+        h_comm->Sync();
+    };
 
-    auto model = std::make_unique<LlamaV2<T>>(model_param_,  //
-                                              engine_param,
-                                              attn_param_,
-                                              moe_param_,
-                                              lora_param_,
-                                              *ctx,
-                                              engine_param_.max_batch_size,
-                                              weights_[device_id]);
+    sync();
 
-    h_comm->Sync();
+    {
+        size_t free{}, total{};
+        check_cuda_error(cudaMemGetInfo(&free, &total));
+        memory_plans_[device_id] = PlanMemory(model_param_, attn_param_, moe_param_, engine_param, sizeof(T), free);
+        if (rank == 0) {
+            TM_LOG_INFO("[LlamaTritonModel] Memory plan: %s", memory_plans_[device_id]->str().c_str());
+        }
+    }
+
+    std::unique_ptr<LlamaV2<T>> model;
+    {
+        StartupTimer::Scope _{&timer, "create_model"};
+        model = std::make_unique<LlamaV2<T>>(model_param_,  //
+                                             engine_param,
+                                             attn_param_,
+                                             moe_param_,
+                                             lora_param_,
+                                             *ctx,
+                                             engine_param_.max_batch_size,
+                                             weights_[device_id]);
+    }
+
+    sync();
 
     try {
         const int dp_rank   = engine_param.outer_dp_rank * engine_param.attn_dp_size + engine_param.attn_dp_rank;
@@ -527,11 +1182,12 @@ void LlamaTritonModel<T>::createEngine(int device_id, int rank)
     // Wait for pinned buffers to be allocated for all ranks, otherwise tuning will hang
     // due to concurrent kernel launch & cudaMallocHost
 
-    h_comm->Sync();
+    sync();
 
     auto& engine = *engines_[device_id];
 
     try {
+        StartupTimer::Scope _{&timer, "gemm_tuning"};
         engine.Warmup();
     }
     catch (const std::exception& e) {
@@ -539,9 +1195,170 @@ void LlamaTritonModel<T>::createEngine(int device_id, int rank)
         throw;
     }
 
-    h_comm->Sync();
+    sync();
 
     engine.Start();
+
+    if (!affinity.empty()) {
+        setThreadAffinity(affinity);
+    }
+}
+
+template<typename T>
+std::vector<std::vector<int64_t>> LlamaTritonModel<T>::getExpertStats(int device_id, bool reset)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK(engines_[device_id] != nullptr);
+    return engines_[device_id]->model().GetExpertCounts(reset);
+}
+
+template<typename T>
+std::vector<std::vector<std::vector<double>>> LlamaTritonModel<T>::getProfile(int device_id, bool reset)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK(engines_[device_id] != nullptr);
+    std::vector<std::vector<std::vector<double>>> ret;
+    if (auto& profiler = engines_[device_id]->context().profiler) {
+        for (const auto& phase : profiler->Get(reset)) {
+            auto& dst = ret.emplace_back();
+            for (const auto& h : phase) {
+                auto& row = dst.emplace_back(std::vector<double>{(double)h.count, h.sum_us, h.max_us});
+                row.insert(row.end(), std::begin(h.buckets), std::end(h.buckets));
+            }
+        }
+    }
+    return ret;
+}
+
+template<typename T>
+std::vector<int64_t> LlamaTritonModel<T>::getCacheStats(int device_id)
+{
+    FT_CHECK(engines_[device_id] != nullptr);
+    const auto s = engines_[device_id]->GetCacheStats();
+    return {s.prompt_tokens,
+            s.hit_tokens,
+            s.evicted_blocks,
+            s.trie_nodes,
+            s.active_blocks,
+            s.cached_blocks,
+            s.free_blocks,
+            s.swapped_blocks,
+            s.preempt_swap,
+            s.preempt_recompute,
+            s.pinned_blocks};
+}
+
+template<typename T>
+std::vector<std::pair<std::string, double>> LlamaTritonModel<T>::getStartupPhases(int device_id)
+{
+    return startup_.at(device_id).phases();
+}
+
+template<typename T>
+std::vector<std::pair<std::string, double>> LlamaTritonModel<T>::planMemory(int device_id, int rank)
+{
+    if (const auto& plan = memory_plans_.at(device_id)) {
+        return plan->items();
+    }
+    check_cuda_error(cudaSetDevice(device_id));
+    size_t free{}, total{};
+    check_cuda_error(cudaMemGetInfo(&free, &total));
+    return PlanMemory(model_param_, attn_param_, moe_param_, engine_params_.at(rank), sizeof(T), free).items();
+}
+
+template<typename T>
+std::string LlamaTritonModel<T>::createKvTransportId()
+{
+    // independent of the communicator inside the engine
+    return comm::CreateKvTransportId("nccl");
+}
+
+template<typename T>
+void LlamaTritonModel<T>::connectKvTransport(int device_id, const std::string& id, int n_ranks, int rank)
+{
+    // Sessions are routed independently by the peers, the devices must pair up regardless of the routing
+    FT_CHECK_WITH_INFO(engine_param_.outer_dp_size * engine_param_.attn_dp_size == 1,
+                       "kv transport requires an engine without data parallelism");
+
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK(engines_[device_id] != nullptr);
+
+    engines_[device_id]->SetKvTransport(comm::CreateKvTransport("nccl", id, n_ranks, rank));
+}
+
+template<typename T>
+void LlamaTritonModel<T>::registerAdapter(
+    int device_id, int id, int rank, float scale, const void* data, size_t size)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK(weights_[device_id] != nullptr);
+
+    auto adapters = weights_[device_id]->adapters.get();
+    FT_CHECK_WITH_INFO(adapters, "multi-LoRA is disabled, set `max_loras` to enable it");
+
+    adapters->Register(id, rank, scale, data, size);
+}
+
+template<typename T>
+bool LlamaTritonModel<T>::unregisterAdapter(int device_id, int id)
+{
+    FT_CHECK(weights_[device_id] != nullptr);
+    auto adapters = weights_[device_id]->adapters.get();
+    return adapters && adapters->Unregister(id);
+}
+
+template<typename T>
+void LlamaTritonModel<T>::createUpdateWeights(int device_id, int rank)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK(engines_[device_id] != nullptr);
+
+    update_weights_[device_id] =
+        std::make_shared<LlamaWeight<T>>(model_param_, engine_params_.at(rank), lora_param_, moe_param_);
+}
+
+template<typename T>
+std::unordered_map<std::string, Tensor> LlamaTritonModel<T>::getUpdateParams(int device_id, int rank)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK_WITH_INFO(update_weights_[device_id] != nullptr, "the weights to update are not created");
+
+    std::unordered_map<std::string, Tensor> result;
+    for (auto [name, tensor] : update_weights_[device_id]->getParams()) {
+        result.insert({{name, Tensor{tensor.where, tensor.type, tensor.shape, tensor.data}}});
+    }
+
+    return result;
+}
+
+template<typename T>
+void LlamaTritonModel<T>::commitUpdateWeights(int device_id, int rank)
+{
+    check_cuda_error(cudaSetDevice(device_id));
+    FT_CHECK_WITH_INFO(update_weights_[device_id] != nullptr, "the weights to update are not created");
+
+    auto weights = std::move(update_weights_[device_id]);
+
+    cudaDeviceProp props{};
+    check_cuda_error(cudaGetDeviceProperties(&props, device_id));
+
+    weights->prepare(props);
+    sync_check_cuda_error();
+
+    // New instances must not pick up the weights of another checkpoint, the live ones sharing the old weights keep
+    // them
+    if (const auto key = weightKey(device_id, rank); !key.empty()) {
+        auto&           registry = WeightRegistry<T>::instance();
+        std::lock_guard lock{registry.mutex};
+        const auto      it = registry.weights.find(key);
+        if (it != registry.weights.end() && it->second.lock() == weights_[device_id]) {
+            registry.weights.erase(it);
+        }
+    }
+
+    engines_[device_id]->SwapWeights(weights);
+
+    weights_[device_id] = std::move(weights);
 }
 
 template<typename T>
@@ -559,14 +1376,90 @@ std::string LlamaTritonModel<T>::toString()
        << "\nmax_prefill_token_num: " << engine_param_.max_prefill_token_num
        << "\nmax_context_token_num: " << engine_param_.max_context_token_num
        << "\nnum_tokens_per_iter: " << engine_param_.num_tokens_per_iter
-       << "\nmax_prefill_iters: " << engine_param_.max_prefill_iters << "\nsession_len: " << engine_param_.session_len
+       << "\nmax_prefill_iters: " << engine_param_.max_prefill_iters
+       << "\nsplit_fuse: " << engine_param_.split_fuse
+       << "\noverlap_scheduling: " << engine_param_.overlap_scheduling
+       << "\nasync_output: " << engine_param_.async_output
+       << "\nfinish_sync_interval: " << engine_param_.finish_sync_interval
+       << "\nenable_cuda_graph: " << engine_param_.enable_cuda_graph
+       << "\nenable_cascade_attention: " << engine_param_.enable_cascade_attention
+       << "\nreserved_slots: " << engine_param_.reserved_slots
+       << "\ntarget_itl_ms: " << engine_param_.target_itl_ms
+       << "\nadmission_control: " << engine_param_.admission_control
+       << "\nnum_speculative_tokens: " << engine_param_.num_speculative_tokens
+       << "\nspeculative_ngram_size: " << engine_param_.speculative_ngram_size
+       << "\nmedusa_num_heads: " << model_param_.medusa_num_heads
+       << "\nfp8_linear: " << engine_param_.fp8_linear << "\nint8_linear: " << engine_param_.int8_linear
+       << "\nw8a16_linear: " << engine_param_.w8a16_linear << "\nsparse_linear: " << engine_param_.sparse_linear
+       << "\nenable_pdl: " << engine_param_.enable_pdl
+       << "\ndecode_megakernel_batch: " << engine_param_.decode_megakernel_batch
+       << "\nlm_head_quant: " << engine_param_.lm_head_quant
+       << "\nembedding_quant: " << engine_param_.embedding_quant
+       << "\nmax_loras: " << engine_param_.max_loras
+       << "\nmax_lora_rank: " << engine_param_.max_lora_rank
+       << "\nep: " << engine_param_.ep_size << "\nep_overlap: " << engine_param_.ep_overlap
+       << "\nmoe_replica_interval: " << engine_param_.moe_replica_interval
+       << "\nmoe_scatter_reduce: " << engine_param_.moe_scatter_reduce
+       << "\nmoe_shared_overlap: " << engine_param_.moe_shared_overlap
+       << "\nsession_len: " << engine_param_.session_len
        << "\ncache_max_entry_count: " << engine_param_.cache_max_block_count
        << "\ncache_block_seq_len: " << attn_param_.cache_block_seq_len
-       << "\ncache_chunk_size: " << engine_param_.cache_chunk_size << "\nenable_prefix_caching: "
-       << engine_param_.enable_prefix_caching
+       << "\nmla_latent_cache: " << attn_param_.mla_latent_cache
+       << "\nsparse_decode_blocks: " << attn_param_.sparse_decode_blocks
+       << "\npre_rope_kv_cache: " << attn_param_.pre_rope_kv_cache
+       << "\nstreaming_prefill: " << attn_param_.streaming_prefill
+       << "\nfp8_attention: " << attn_param_.fp8_attention
+       << "\ncache_chunk_size: " << engine_param_.cache_chunk_size
+       << "\ncache_swap_space: " << engine_param_.cache_swap_space
+       << "\ncache_swap_bandwidth: " << engine_param_.cache_swap_bandwidth
+       << "\ncache_recompute_tflops: " << engine_param_.cache_recompute_tflops << "\nenable_prefix_caching: "
+       << engine_param_.enable_prefix_caching << "\ncache_pin_tokens: " << engine_param_.cache_pin_tokens
+       << "\nprefix_cache_path: " << engine_param_.prefix_cache_path
+       << "\nprefix_cache_disk_space: " << engine_param_.prefix_cache_disk_space
+       << "\nembedding_cache_size: " << engine_param_.embedding_cache_size
+       << "\nl2_persist_mb: " << engine_param_.l2_persist_mb
+       << "\nkv_quant_error_interval: " << engine_param_.kv_quant_error_interval
+       << "\ncache_window_size: " << engine_param_.cache_window_size
+       << "\ncache_sink_size: " << engine_param_.cache_sink_size
+       << "\ncache_score_budget: " << engine_param_.cache_score_budget
+       << "\ncache_recent_blocks: " << engine_param_.cache_recent_blocks
+       << "\ncache_cold_quant: " << engine_param_.cache_cold_quant
+       << "\ncache_cold_ratio: " << engine_param_.cache_cold_ratio
+       << "\ncache_eviction_policy: " << engine_param_.cache_eviction_policy
+       << "\ncache_pool_key: " << engine_param_.cache_pool_key
+       << "\ncache_pool_size: " << engine_param_.cache_pool_size
+       << "\ncache_pool_min: " << engine_param_.cache_pool_min
+       << "\ncache_pool_max: " << engine_param_.cache_pool_max
+       << "\ncache_virtual_memory: " << engine_param_.cache_virtual_memory
+       << "\nprefix_aware_routing: " << engine_param_.prefix_aware_routing
+       << "\nmigrate_threshold: " << engine_param_.migrate_threshold
+       << "\nmax_queue_depth: " << engine_param_.max_queue_depth
+       << "\nqueue_policy: " << engine_param_.queue_policy
+       << "\nedf_slack_ms: " << engine_param_.edf_slack_ms
+       << "\nfair_share: " << engine_param_.fair_share
+       << "\nsjf_scheduling: " << engine_param_.sjf_scheduling
+       << "\nsymmetric_kv_cache: " << engine_param_.symmetric_kv_cache
+       << "\nprofile_interval: " << engine_param_.profile_interval
+       << "\ntrace_buffer: " << engine_param_.trace_buffer
+       << "\ncandidate_sampling: " << engine_param_.candidate_sampling
+       << "\ndeterministic: " << engine_param_.deterministic
+       << "\noffload_weights: " << engine_param_.offload_weights
+       << "\nmoe_expert_cache: " << engine_param_.moe_expert_cache
+       << "\nweight_snapshot: " << weight_snapshot_
+       << "\ndecode_sm_ratio: " << attn_param_.decode_sm_ratio
+       << "\nrope_table_len: " << attn_param_.rope_table_len
+       << "\ndetokenizer_path: " << engine_param_.detokenizer_path
+       << "\ndetokenizer_threads: " << engine_param_.detokenizer_threads
+       << "\nnuma_affinity: " << engine_param_.numa_affinity
+       << "\nhost_communicator: " << host_communicator_
+       << "\ncomm_overlap_tokens: " << engine_param_.comm_overlap_tokens
+       << "\ncomm_quant: " << engine_param_.comm_quant << "\npp: " << engine_param_.pp_size
+       << "\ncp: " << engine_param_.attn_cp_size
        //    << "\ntensor_para_size: " << tensor_para_size_ << "\npipeline_para_size: " << pipeline_para_size_
        << "\nmodel_name: " << model_name_ << "\nmodel_dir: " << model_dir_
-       << "\nquant_policy: " << model_param_.quant_policy << "\ngroup_size: "
+       << "\nquant_policy: " << model_param_.quant_policy
+       << "\nlayer_quant_policy: " << vec2str(model_param_.layer_quant_policy)
+       << "\nlayer_kv_head_num: " << vec2str(model_param_.layer_kv_head_num) << "\ngroup_size: "
        << model_param_.group_size
        //    << "\nexpert_num: " << moe_param_.expert_num
        << "\nexpert_per_token: " << moe_param_.experts_per_token << "\nmoe_method: " << moe_param_.method << std::endl;
@@ -583,7 +1476,7 @@ int LlamaTritonModel<T>::getTensorParaSize()
 template<typename T>
 int LlamaTritonModel<T>::getPipelineParaSize()
 {
-    return 1;
+    return engine_param_.pp_size;
 }
 
 #ifdef ENABLE_FP32
@@ -21,6 +21,7 @@
 #pragma once
 
 #include <cuda_fp16.h>
+#include <optional>
 
 #include "src/turbomind/comm/device_comm.h"
 #include "src/turbomind/engine/gateway.h"
@@ -28,6 +29,7 @@
 #include "src/turbomind/models/llama/LlamaWeight.h"
 #include "src/turbomind/models/llama/context.h"
 #include "src/turbomind/models/llama/llama_params.h"
+#include "src/turbomind/models/llama/memory_planner.h"
 
 #include "src/turbomind/triton_backend/transformer_triton_backend.hpp"
 
@@ -50,6 +52,30 @@ public:
 
     void createEngine(int device_id, int rank) override;
 
+    std::vector<std::vector<int64_t>> getExpertStats(int device_id, bool reset) override;
+
+    std::vector<std::vector<std::vector<double>>> getProfile(int device_id, bool reset) override;
+
+    std::vector<int64_t> getCacheStats(int device_id) override;
+
+    std::vector<std::pair<std::string, double>> getStartupPhases(int device_id) override;
+
+    std::vector<std::pair<std::string, double>> planMemory(int device_id, int rank) override;
+
+    std::string createKvTransportId() override;
+
+    void connectKvTransport(int device_id, const std::string& id, int n_ranks, int rank) override;
+
+    void registerAdapter(int device_id, int id, int rank, float scale, const void* data, size_t size) override;
+
+    bool unregisterAdapter(int device_id, int id) override;
+
+    void createUpdateWeights(int device_id, int rank) override;
+
+    std::unordered_map<std::string, Tensor> getUpdateParams(int device_id, int rank) override;
+
+    void commitUpdateWeights(int device_id, int rank) override;
+
     std::string toString() override;
     int         getTensorParaSize() override;
     int         getPipelineParaSize() override;
@@ -59,6 +85,14 @@ private:
 
     Communicators createCommSplits(int rank);
 
+    // Key of the weights of the rank in the process-wide registry, empty when not shared
+    std::string weightKey(int device_id, int rank) const;
+
+    bool isSharedWeight(int device_id, int rank) const;
+
+    // Snapshot of the prepared weights of the rank, empty when disabled
+    std::string snapshotPath(int rank) const;
+
 private:
     ModelParam     model_param_;
     AttentionParam attn_param_;
@@ -69,7 +103,8 @@ private:
 
     std::vector<EngineParam> engine_params_;
 
-    std::string communicator_;  // communicator backend
+    std::string communicator_;       // communicator backend
+    std::string host_communicator_;  // backend of the host communicators
 
     std::vector<std::unique_ptr<comm::HostGroupId>> group_ids_;
 
@@ -78,11 +113,19 @@ private:
     // Weights & engine instances for the ranks
     std::vector<std::shared_ptr<LlamaWeight<T>>> weights_;
     std::vector<std::shared_ptr<Engine<T>>>      engines_;
+    // new weights being loaded by `createUpdateWeights` & `getUpdateParams`
+    std::vector<std::shared_ptr<LlamaWeight<T>>> update_weights_;
+    // phases of the start of the ranks, by device
+    std::vector<StartupTimer> startup_;
+    // device memory planned before the engines of the ranks were created, by device
+    std::vector<std::optional<MemoryPlan>> memory_plans_;
 
     bool is_fp16_;
 
     std::string model_name_;
     std::string model_dir_;
+    std::string weight_key_;  // weights are shared with the instances of the same key
+    std::string weight_snapshot_;  // path prefix of the per-rank snapshots of the prepared weights
 };
 
 }  // namespace turbomind
@@ -0,0 +1,529 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Engine-level benchmark, replays a request trace against the engine through `ModelRequest` without the python
+// frontend and reports TTFT / ITL / E2E latency percentiles, throughput and the occupancy of the kv cache blocks
+//
+// A trace is a JSON-lines file, one request per line
+//   {"arrival": 0.25, "input_len": 1024, "output_len": 128, "prefix_id": 3, "prefix_len": 512}
+// with the arrival time in seconds relative to the start of the replay. Requests of the same `prefix_id` share the
+// first `prefix_len` tokens of their prompts, `prefix_id` < 0 (or absent) means no sharing. Without a trace, one is
+// synthesized from the `--num-requests`, `--request-rate`, `--input-len`, `--output-len`, `--prefix-groups` and
+// `--prefix-ratio` options
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+#include "src/turbomind/engine/model_request.h"
+#include "src/turbomind/triton_backend/llama/LlamaTritonModel.h"
+#include "src/turbomind/utils/cli_utils.h"
+#include "src/turbomind/utils/logger.h"
+
+using namespace turbomind;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string model_dir;
+    std::string config;  // yaml file overriding `model_dir/config.yaml`
+    std::string dtype;
+    std::string trace;
+    std::string output;
+
+    int devices = 0;
+
+    // synthetic trace
+    int    num_requests  = 256;
+    double request_rate  = 0;  // requests per second, <= 0 for all at once
+    int    input_len     = 1024;
+    int    output_len    = 128;
+    int    prefix_groups = 0;
+    double prefix_ratio  = 0;
+    int    seed          = 0;
+
+    int sample_interval_ms = 100;
+};
+
+struct TraceEntry {
+    double arrival;  // seconds
+    int    input_len;
+    int    output_len;
+    int    prefix_id;
+    int    prefix_len;
+};
+
+struct CacheSample {
+    double               time;  // seconds
+    std::vector<int64_t> stats;
+};
+
+// Indices of `LlamaTritonModel::getCacheStats`
+enum CacheStat
+{
+    kPromptTokens = 0,
+    kHitTokens,
+    kEvictedBlocks,
+    kTrieNodes,
+    kActiveBlocks,
+    kCachedBlocks,
+    kFreeBlocks,
+    kSwappedBlocks,
+    kPreemptSwap,
+    kPreemptRecompute,
+};
+
+struct Record {
+    TraceEntry entry;
+
+    std::unique_ptr<ModelRequest>       request;
+    std::shared_ptr<AtomicRequestState> state;
+
+    std::mutex mutex;
+
+    Clock::time_point arrival;
+    Clock::time_point last;  // time of the last output token
+
+    int  prev_len = 0;  // sequence length at the last update
+    int  output_len{};
+    int  cached_len = -1;
+    int  status     = 0;
+    bool done       = false;
+
+    double              ttft = -1;  // seconds
+    std::vector<double> itl;        // seconds
+    double              e2e = -1;   // seconds
+};
+
+void PrintUsage()
+{
+    std::cerr << "usage: engine_bench --model-dir DIR [options]\n"
+                 "  --model-dir DIR         turbomind model dir with `config.yaml` and the weights\n"
+                 "  --config FILE           yaml config overriding `DIR/config.yaml`\n"
+                 "  --dtype TYPE            fp16 | bf16, default to `model_config.weight_type`\n"
+                 "  --devices N             number of devices, default to tp * pp\n"
+                 "  --trace FILE            JSON-lines request trace\n"
+                 "  --num-requests N        synthetic trace, number of requests (256)\n"
+                 "  --request-rate R        synthetic trace, poisson arrival rate, <= 0 for all at once (0)\n"
+                 "  --input-len N           synthetic trace, prompt length (1024)\n"
+                 "  --output-len N          synthetic trace, output length (128)\n"
+                 "  --prefix-groups N       synthetic trace, number of distinct shared prefixes (0)\n"
+                 "  --prefix-ratio R        synthetic trace, fraction of the prompt that is shared (0)\n"
+                 "  --seed N                seed of the synthetic trace and the prompt tokens (0)\n"
+                 "  --sample-interval MS    interval of sampling the kv cache occupancy (100)\n"
+                 "  --output FILE           JSON report\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& opts)
+{
+    const bool ok = ParseCommandLine(argc, argv, [&](const std::string& key, const std::string& value) {
+        if (key == "--model-dir") {
+            opts.model_dir = value;
+        }
+        else if (key == "--config") {
+            opts.config = value;
+        }
+        else if (key == "--dtype") {
+            opts.dtype = value;
+        }
+        else if (key == "--devices") {
+            opts.devices = std::stoi(value);
+        }
+        else if (key == "--trace") {
+            opts.trace = value;
+        }
+        else if (key == "--num-requests") {
+            opts.num_requests = std::stoi(value);
+        }
+        else if (key == "--request-rate") {
+            opts.request_rate = std::stod(value);
+        }
+        else if (key == "--input-len") {
+            opts.input_len = std::stoi(value);
+        }
+        else if (key == "--output-len") {
+            opts.output_len = std::stoi(value);
+        }
+        else if (key == "--prefix-groups") {
+            opts.prefix_groups = std::stoi(value);
+        }
+        else if (key == "--prefix-ratio") {
+            opts.prefix_ratio = std::stod(value);
+        }
+        else if (key == "--seed") {
+            opts.seed = std::stoi(value);
+        }
+        else if (key == "--sample-interval") {
+            opts.sample_interval_ms = std::stoi(value);
+        }
+        else if (key == "--output") {
+            opts.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    });
+    return ok && !opts.model_dir.empty();
+}
+
+std::vector<TraceEntry> LoadTrace(const std::string& path)
+{
+    std::ifstream ifs(path);
+    FT_CHECK_WITH_INFO(ifs.is_open(), fmtstr("failed to open trace `%s`", path.c_str()));
+
+    std::vector<TraceEntry> trace;
+    std::string             line;
+    while (std::getline(ifs, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        // a JSON object is a YAML flow mapping
+        const auto node = YAML::Load(line);
+        TraceEntry e{};
+        e.arrival    = node["arrival"].as<double>(0.);
+        e.input_len  = node["input_len"].as<int>();
+        e.output_len = node["output_len"].as<int>();
+        e.prefix_id  = node["prefix_id"].as<int>(-1);
+        e.prefix_len = node["prefix_len"].as<int>(0);
+        FT_CHECK_WITH_INFO(e.input_len > 0 && e.output_len > 0, fmtstr("invalid trace entry: %s", line.c_str()));
+        e.prefix_len = e.prefix_id < 0 ? 0 : std::min(e.prefix_len, e.input_len);
+        trace.push_back(e);
+    }
+
+    std::stable_sort(trace.begin(), trace.end(), [](auto& a, auto& b) { return a.arrival < b.arrival; });
+
+    return trace;
+}
+
+std::vector<TraceEntry> SynthesizeTrace(const Options& opts)
+{
+    std::mt19937                          gen(opts.seed);
+    std::exponential_distribution<double> interval(opts.request_rate > 0 ? opts.request_rate : 1.);
+
+    const int prefix_len = opts.prefix_groups > 0 ? (int)(opts.input_len * opts.prefix_ratio) : 0;
+
+    std::vector<TraceEntry> trace;
+    double                  time = 0;
+    for (int i = 0; i < opts.num_requests; ++i) {
+        TraceEntry e{};
+        e.arrival    = time;
+        e.input_len  = opts.input_len;
+        e.output_len = opts.output_len;
+        e.prefix_id  = prefix_len > 0 ? i % opts.prefix_groups : -1;
+        e.prefix_len = prefix_len > 0 ? std::min(prefix_len, opts.input_len) : 0;
+        trace.push_back(e);
+        if (opts.request_rate > 0) {
+            time += interval(gen);
+        }
+    }
+
+    return trace;
+}
+
+std::vector<int> MakePrompt(const TraceEntry& e, int vocab_size, int seed, int index)
+{
+    // avoid the low ids, which are usually special tokens
+    const int                          lo = std::min(1000, vocab_size / 2);
+    std::uniform_int_distribution<int> dist(lo, vocab_size - 1);
+
+    std::vector<int> ids(e.input_len);
+
+    std::seed_seq prefix_seq{seed, 1, e.prefix_id};
+    std::mt19937  prefix_gen(prefix_seq);
+    for (int i = 0; i < e.prefix_len; ++i) {
+        ids[i] = dist(prefix_gen);
+    }
+    std::seed_seq seq{seed, 0, index};
+    std::mt19937  gen(seq);
+    for (int i = e.prefix_len; i < e.input_len; ++i) {
+        ids[i] = dist(gen);
+    }
+
+    return ids;
+}
+
+double Seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// Consumes the latest state of a request, may be called spuriously
+void Update(Record& r, std::atomic<int>& finished, std::condition_variable& cv, std::mutex& cv_mutex)
+{
+    std::lock_guard lock{r.mutex};
+
+    if (r.done || !r.state) {
+        return;
+    }
+
+    auto s = r.state->exchange(nullptr);
+    if (!s) {
+        return;
+    }
+
+    const auto now = Clock::now();
+
+    if (s->cached_len >= 0) {
+        r.cached_len = s->cached_len;
+    }
+
+    if (s->seq_len > r.prev_len) {
+        const int n = s->seq_len - r.prev_len;
+        if (r.output_len == 0) {
+            r.ttft = Seconds(now - r.arrival);
+        }
+        else {
+            // tokens of a coalesced update are spread evenly over the interval
+            const double dt = Seconds(now - r.last) / n;
+            r.itl.insert(r.itl.end(), n, dt);
+        }
+        r.output_len += n;
+        r.prev_len = s->seq_len;
+        r.last     = now;
+    }
+
+    if (s->status != Request::kOk) {
+        r.status = s->status == Request::kFinish ? 0 : s->status;
+        r.e2e    = Seconds(now - r.arrival);
+        r.done   = true;
+        r.request.reset();
+        {
+            std::lock_guard cv_lock{cv_mutex};
+            ++finished;
+        }
+        cv.notify_one();
+    }
+}
+
+void WriteDist(std::ostream& os, const char* name, const std::vector<double>& xs, bool last = false)
+{
+    double mean = 0;
+    for (const auto& x : xs) {
+        mean += x;
+    }
+    mean /= std::max<size_t>(xs.size(), 1);
+    // in milliseconds
+    os << "    \"" << name << "\": {\"mean\": " << mean * 1e3 << ", \"p50\": " << Percentile(xs, 50) * 1e3
+       << ", \"p90\": " << Percentile(xs, 90) * 1e3 << ", \"p99\": " << Percentile(xs, 99) * 1e3
+       << ", \"max\": " << Percentile(xs, 100) * 1e3 << "}" << (last ? "\n" : ",\n");
+}
+
+template<class T>
+std::shared_ptr<AbstractTransformerModel> CreateModel(const std::string& model_dir, const std::string& config)
+{
+    // no context is needed for the callbacks of the native frontend
+    auto ctx_factory = [] { return std::shared_ptr<void>{}; };
+    return std::make_shared<LlamaTritonModel<T>>(model_dir, config, ctx_factory);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    YAML::Node reader;
+    std::string config;
+    if (!opts.config.empty()) {
+        std::ifstream     ifs(opts.config);
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        config = ss.str();
+        reader = YAML::Load(config);
+    }
+    else {
+        reader = YAML::LoadFile(opts.model_dir + "/config.yaml");
+    }
+
+    const int vocab_size  = reader["model_config"]["vocab_size"].as<int>();
+    const int session_len = reader["engine_config"]["session_len"].as<int>(0);
+
+    if (opts.dtype.empty()) {
+        opts.dtype = reader["model_config"]["weight_type"].as<std::string>("fp16");
+    }
+
+    std::shared_ptr<AbstractTransformerModel> model;
+    if (opts.dtype == "bf16" || opts.dtype == "bfloat16") {
+#ifdef ENABLE_BF16
+        model = CreateModel<__nv_bfloat16>(opts.model_dir, config);
+#else
+        TM_LOG_ERROR("turbomind has not been built with bf16 support.");
+        return 1;
+#endif
+    }
+    else {
+        model = CreateModel<half>(opts.model_dir, config);
+    }
+
+    const int devices = opts.devices ? opts.devices : model->getTensorParaSize() * model->getPipelineParaSize();
+
+    auto for_each_device = [&](auto func) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < devices; ++i) {
+            threads.emplace_back(func, i);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+
+    // same sequence as the python frontend, `createEngine` synchronizes the ranks
+    for_each_device([&](int i) { model->createSharedWeights(i, i); });
+    for_each_device([&](int i) {
+        model->processWeights(i, i);
+        model->createEngine(i, i);
+    });
+
+    TM_LOG_INFO("%s", model->toString().c_str());
+
+    const auto trace = opts.trace.empty() ? SynthesizeTrace(opts) : LoadTrace(opts.trace);
+    FT_CHECK_WITH_INFO(!trace.empty(), "empty trace");
+
+    std::vector<std::unique_ptr<Record>> records;
+    for (const auto& e : trace) {
+        if (session_len && e.input_len + e.output_len > session_len) {
+            TM_LOG_WARNING("request of %d + %d tokens exceeds the session length %d",
+                           e.input_len,
+                           e.output_len,
+                           session_len);
+        }
+        records.push_back(std::make_unique<Record>());
+        records.back()->entry = e;
+    }
+
+    std::atomic<int>        finished{};
+    std::mutex              cv_mutex;
+    std::condition_variable cv;
+
+    std::vector<CacheSample> samples;
+    std::atomic<bool>        stop{};
+
+    const auto start = Clock::now();
+
+    std::thread sampler([&] {
+        while (!stop) {
+            samples.push_back({Seconds(Clock::now() - start), model->getCacheStats(0)});
+            std::this_thread::sleep_for(std::chrono::milliseconds(opts.sample_interval_ms));
+        }
+    });
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& r = *records[i];
+
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(r.entry.arrival)));
+
+        auto ids    = std::make_shared<std::vector<int>>(MakePrompt(r.entry, vocab_size, opts.seed, i));
+        auto inputs = std::make_shared<ModelRequest::TensorMap_>();
+        inputs->emplace("input_ids", ManagedTensor{Tensor{MEMORY_CPU, TYPE_INT32, {ids->size()}, ids->data()}, ids});
+
+        ModelRequest::InputParam param{};
+        param.tensors                = inputs;
+        param.session                = {i + 1, 0, true, true, false, false, 0};
+        param.gen_cfg.max_new_tokens = r.entry.output_len;
+        param.gen_cfg.min_new_tokens = r.entry.output_len;
+        param.gen_cfg.top_k          = 1;
+        param.stream_output          = true;
+
+        {
+            std::lock_guard lock{r.mutex};
+            r.request  = model->createModelInstance(0);
+            r.arrival  = Clock::now();
+            r.prev_len = r.entry.input_len;
+            r.state    = r.request->Forward(param, [&] { Update(r, finished, cv, cv_mutex); }).state;
+        }
+        // in case the callback came before the state is available
+        Update(r, finished, cv, cv_mutex);
+    }
+
+    {
+        std::unique_lock lock{cv_mutex};
+        cv.wait(lock, [&] { return finished == (int)records.size(); });
+    }
+
+    const double duration = Seconds(Clock::now() - start);
+
+    stop = true;
+    sampler.join();
+
+    const auto cache_stats = model->getCacheStats(0);
+
+    std::vector<double> ttft, itl, e2e, tpot;
+    int64_t             input_tokens{}, output_tokens{}, cached_tokens{};
+    int                 failed{};
+    for (const auto& r : records) {
+        if (r->status) {
+            ++failed;
+            continue;
+        }
+        ttft.push_back(r->ttft);
+        e2e.push_back(r->e2e);
+        itl.insert(itl.end(), r->itl.begin(), r->itl.end());
+        if (r->output_len > 1) {
+            tpot.push_back((r->e2e - r->ttft) / (r->output_len - 1));
+        }
+        input_tokens += r->entry.input_len;
+        output_tokens += r->output_len;
+        cached_tokens += std::max(r->cached_len, 0);
+    }
+
+    std::stringstream os;
+    os << "{\n";
+    os << "  \"model_dir\": \"" << opts.model_dir << "\",\n";
+    os << "  \"trace\": \"" << opts.trace << "\",\n";
+    os << "  \"num_requests\": " << records.size() << ",\n";
+    os << "  \"failed_requests\": " << failed << ",\n";
+    os << "  \"duration\": " << duration << ",\n";
+    os << "  \"input_tokens\": " << input_tokens << ",\n";
+    os << "  \"output_tokens\": " << output_tokens << ",\n";
+    os << "  \"cached_tokens\": " << cached_tokens << ",\n";
+    os << "  \"request_throughput\": " << (records.size() - failed) / duration << ",\n";
+    os << "  \"input_throughput\": " << input_tokens / duration << ",\n";
+    os << "  \"output_throughput\": " << output_tokens / duration << ",\n";
+    os << "  \"latency_ms\": {\n";
+    WriteDist(os, "ttft", ttft);
+    WriteDist(os, "itl", itl);
+    WriteDist(os, "tpot", tpot);
+    WriteDist(os, "e2e", e2e, true);
+    os << "  },\n";
+    os << "  \"cache\": {\"prompt_tokens\": " << cache_stats[kPromptTokens]
+       << ", \"hit_tokens\": " << cache_stats[kHitTokens] << ", \"evicted_blocks\": " << cache_stats[kEvictedBlocks]
+       << ", \"preempt_swap\": " << cache_stats[kPreemptSwap]
+       << ", \"preempt_recompute\": " << cache_stats[kPreemptRecompute] << "},\n";
+    // occupancy of the blocks over time, [time, active, cached, free, swapped]
+    os << "  \"blocks\": [";
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const auto& s = samples[i];
+        os << (i ? ", " : "") << "[" << s.time << ", " << s.stats[kActiveBlocks] << ", " << s.stats[kCachedBlocks]
+           << ", " << s.stats[kFreeBlocks] << ", " << s.stats[kSwappedBlocks] << "]";
+    }
+    os << "]\n";
+    os << "}\n";
+
+    std::cout << os.str();
+
+    if (!opts.output.empty()) {
+        std::ofstream ofs(opts.output);
+        ofs << os.str();
+    }
+
+    return failed ? 2 : 0;
+}
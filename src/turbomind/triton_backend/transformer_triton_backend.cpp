@@ -20,6 +20,63 @@
 
 #include "src/turbomind/triton_backend/transformer_triton_backend.hpp"
 
+#include <exception>
+#include <thread>
+
+#include "src/turbomind/utils/cuda_utils.h"
+
 namespace turbomind {
 
+namespace {
+
+// Run `func(device_id, rank)` for all the ranks on their own threads, the first exception is rethrown after all the
+// threads are joined
+template<class Func>
+void ForEachRank(const std::vector<int>& device_ids, const std::vector<int>& ranks, Func func)
+{
+    FT_CHECK_WITH_INFO(device_ids.size() == ranks.size(), "device_ids and ranks must be of the same size");
+
+    std::vector<std::exception_ptr> errors(ranks.size());
+    std::vector<std::thread>        threads;
+    threads.reserve(ranks.size());
+
+    for (size_t i = 0; i < ranks.size(); ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                func(device_ids[i], ranks[i]);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (const auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+}  // namespace
+
+void AbstractTransformerModel::createAllSharedWeights(const std::vector<int>& device_ids, const std::vector<int>& ranks)
+{
+    ForEachRank(device_ids, ranks, [this](int device_id, int rank) { createSharedWeights(device_id, rank); });
+}
+
+void AbstractTransformerModel::createEngines(const std::vector<int>& device_ids, const std::vector<int>& ranks)
+{
+    // The collectives of `createEngine` only wait for the ranks of the same group, there is no barrier between the
+    // weight processing and the engine creation of different ranks
+    ForEachRank(device_ids, ranks, [this](int device_id, int rank) {
+        processWeights(device_id, rank);
+        createEngine(device_id, rank);
+    });
+}
+
 }  // namespace turbomind
@@ -23,6 +23,8 @@
 #include "src/turbomind/comm/device_comm.h"
 #include <functional>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #ifdef __linux__
@@ -76,8 +78,90 @@ struct AbstractTransformerModel {
 
     virtual void createEngine(int device_id, int rank) = 0;
 
+    // `createSharedWeights` for the ranks on `device_ids` concurrently, one native thread per rank
+    virtual void createAllSharedWeights(const std::vector<int>& device_ids, const std::vector<int>& ranks);
+
+    // `processWeights` followed by `createEngine` for the ranks on `device_ids` concurrently, one native thread per
+    // rank. A rank moves on to its comm splits, kv cache & tuning as soon as its own weights are ready
+    virtual void createEngines(const std::vector<int>& device_ids, const std::vector<int>& ranks);
+
     virtual std::string toString() = 0;
 
+    // [layer_num][expert_num] tokens routed to the experts by the rank on `deviceId`, empty for dense models
+    virtual std::vector<std::vector<int64_t>> getExpertStats(int deviceId, bool reset)
+    {
+        return {};
+    }
+
+    // [phase][layer][3 + bucket_num] step timings of the rank on `deviceId`, each entry is the sample count, the
+    // total & max time in us followed by the counts of the log2 us buckets. Empty when profiling is disabled
+    virtual std::vector<std::vector<std::vector<double>>> getProfile(int deviceId, bool reset)
+    {
+        return {};
+    }
+
+    // (phase, seconds) of the start of the rank on `deviceId`, in order
+    virtual std::vector<std::pair<std::string, double>> getStartupPhases(int deviceId)
+    {
+        return {};
+    }
+
+    // (item, value) of the device memory plan of the rank, planned with the free memory when its engine was created
+    // or now before that. Sizes are in bytes
+    virtual std::vector<std::pair<std::string, double>> planMemory(int deviceId, int rank)
+    {
+        return {};
+    }
+
+    // kv cache counters of the rank on `deviceId`: prompt tokens looked up in the prefix cache, prompt tokens hit,
+    // evicted blocks, cached prompt blocks, followed by the active, cached & free block counts
+    virtual std::vector<int64_t> getCacheStats(int deviceId)
+    {
+        return {};
+    }
+
+    // Create the id of a kv transport between engines, shared with the other engines out of band
+    virtual std::string createKvTransportId()
+    {
+        throw std::runtime_error("kv transport is not supported");
+    }
+
+    // Join the kv transport of `id` as engine `rank` of `n_ranks`, blocks until all the engines have joined
+    virtual void connectKvTransport(int deviceId, const std::string& id, int n_ranks, int rank)
+    {
+        throw std::runtime_error("kv transport is not supported");
+    }
+
+    // Register LoRA adapter `id` of `rank` on `deviceId`, `data` is the flattened weights sliced for the device
+    virtual void registerAdapter(int deviceId, int id, int rank, float scale, const void* data, size_t size)
+    {
+        throw std::runtime_error("multi-LoRA is not supported");
+    }
+
+    virtual bool unregisterAdapter(int deviceId, int id)
+    {
+        throw std::runtime_error("multi-LoRA is not supported");
+    }
+
+    // Allocate the weights of another checkpoint of the same model next to the live ones, filled through
+    // `getUpdateParams`
+    virtual void createUpdateWeights(int deviceId, int rank)
+    {
+        throw std::runtime_error("weight update is not supported");
+    }
+
+    virtual std::unordered_map<std::string, Tensor> getUpdateParams(int deviceId, int rank)
+    {
+        throw std::runtime_error("weight update is not supported");
+    }
+
+    // Prepare the new weights and swap them into the engine at a step boundary, the old weights are released. Blocks
+    // until swapped, to be called for all the ranks concurrently
+    virtual void commitUpdateWeights(int deviceId, int rank)
+    {
+        throw std::runtime_error("weight update is not supported");
+    }
+
     virtual int getTensorParaSize()   = 0;
     virtual int getPipelineParaSize() = 0;
 };
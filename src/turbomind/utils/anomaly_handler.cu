@@ -3,6 +3,7 @@
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
 #include "src/turbomind/utils/memory_utils.h"
+#include <algorithm>
 #include <cmath>
 #include <cub/block/block_reduce.cuh>
 #include <optional>
@@ -172,6 +173,18 @@ struct AnomalyHandler::Impl {
                 TM_LOG_WARNING("[AnomalyHandler] fallback -> %d", g_fallback);
             }
 
+            // Sampled mode, the tensors are checked every `interval` steps and a rotating 1/`stride` of them on each
+            // checked step. The logits are still checked every step
+            if (const auto interval = parse_float(str, "interval=")) {
+                g_interval = std::max(static_cast<int>(*interval), 1);
+                TM_LOG_WARNING("[AnomalyHandler] interval: %d", g_interval);
+            }
+
+            if (const auto stride = parse_float(str, "stride=")) {
+                g_stride = std::max(static_cast<int>(*stride), 1);
+                TM_LOG_WARNING("[AnomalyHandler] stride: %d", g_stride);
+            }
+
             return {};
         }();
     }
@@ -221,9 +234,16 @@ struct AnomalyHandler::Impl {
 
             check_cuda_error(cudaStreamSynchronize(stream_));
 
+            if (sampled_) {
+                ++counters_.steps;
+                counters_.tensors += info_.size();
+            }
+
             for (size_t i = 0; i < info_.size(); ++i) {
                 const auto& n_inf = h_count_[i * 2];
                 const auto& n_nan = h_count_[i * 2 + 1];
+                counters_.n_inf += n_inf;
+                counters_.n_nan += n_nan;
                 if (n_inf || n_nan) {
                     TM_LOG_WARNING("[AnomalyHandler][rank=%d] (%s) INF: %s, NaN: %s",
                                    rank_,
@@ -233,6 +253,8 @@ struct AnomalyHandler::Impl {
                 }
             }
 
+            counters_.sequences += std::count(h_is_anomaly_.begin(), h_is_anomaly_.begin() + batch_size_, 1);
+
             handler(h_is_anomaly_.data(), batch_size_);
         }
     }
@@ -252,13 +274,22 @@ struct AnomalyHandler::Impl {
                 check_cuda_error(cudaMemsetAsync(d_is_anomaly_.data().get(), 0, sizeof(int) * batch_size_, stream_));
                 batch_size_ = 0;
             }
+
+            ++step_;
+            sampled_  = step_ % g_interval == 0;
+            call_idx_ = 0;
         }
     }
 
     template<class T>
     void invokeCountAndFixAnomaly(T* data, int64_t size, const std::string& key, int level)
     {
-        if (g_level && level <= g_level) {
+        if (g_level && level <= g_level && sampled_) {
+            // rotates over the checked steps, so every tensor is covered once in `stride` checked steps
+            if (g_stride > 1 && (call_idx_++ + step_ / g_interval) % g_stride) {
+                return;
+            }
+
             FT_CHECK(size >= 0);
 
             constexpr int block = 512;
@@ -305,6 +336,8 @@ struct AnomalyHandler::Impl {
 
     static int   g_level;
     static int   g_fallback;
+    static int   g_interval;
+    static int   g_stride;
     static float g_pinf_val_;
     static float g_ninf_val_;
     static float g_nan_val_;
@@ -315,6 +348,12 @@ struct AnomalyHandler::Impl {
     int          fallback_{};
     int          max_batch_size_{};
 
+    size_type step_{};
+    bool      sampled_{true};  // tensors are checked in current step
+    int       call_idx_{};
+
+    Counters counters_{};
+
     ////////////////////////////////////////////////////////////////////////////////
     /// Members below has SINGLE iteration validity and must be cleared in `Reset`
 
@@ -331,6 +370,8 @@ struct AnomalyHandler::Impl {
 
 int   AnomalyHandler::Impl::g_level     = 0;
 int   AnomalyHandler::Impl::g_fallback  = -1;
+int   AnomalyHandler::Impl::g_interval  = 1;
+int   AnomalyHandler::Impl::g_stride    = 1;
 float AnomalyHandler::Impl::g_pinf_val_ = INFINITY;
 float AnomalyHandler::Impl::g_ninf_val_ = -INFINITY;
 float AnomalyHandler::Impl::g_nan_val_  = NAN;
@@ -350,11 +391,22 @@ void AnomalyHandler::Init(int rank, int vocab_size, int fallback, int max_batch_
     impl_->Init(rank, vocab_size, fallback, max_batch_size, stream);
 }
 
+int AnomalyHandler::level() noexcept
+{
+    Impl::GlobalInit();
+    return Impl::g_level;
+}
+
 void AnomalyHandler::Summarize(std::function<void(const int*, int)> handler)
 {
     impl_->Summarize(handler);
 }
 
+AnomalyHandler::Counters AnomalyHandler::counters() const noexcept
+{
+    return impl_->counters_;
+}
+
 void AnomalyHandler::Reset()
 {
     impl_->Reset();
@@ -17,10 +17,22 @@ public:
 
     using size_type = unsigned long long;
 
+    // Cumulated over the steps by `Summarize`
+    struct Counters {
+        size_type steps;      // steps with the tensors checked
+        size_type tensors;    // tensors checked
+        size_type n_inf;      // INF values found in the tensors
+        size_type n_nan;      // NaN values found in the tensors
+        size_type sequences;  // sequences with abnormal logits
+    };
+
     ~AnomalyHandler();
 
     static AnomalyHandler& instance();
 
+    // process level setting from `TM_ANOMALY_HANDLER`, 0 when disabled
+    static int level() noexcept;
+
     void Init(int rank, int vocab_size, int fallback, int max_batch_size, cudaStream_t stream) noexcept;
 
     template<class T>
@@ -31,6 +43,8 @@ public:
 
     void Summarize(std::function<void(const int*, int)> handler);
 
+    Counters counters() const noexcept;
+
     void Reset();
 
 private:
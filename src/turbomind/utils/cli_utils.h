@@ -0,0 +1,79 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+// Command line & report helpers of the standalone tools (benchmarks, simulators & the api server)
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace turbomind {
+
+// Comma separated list
+inline std::vector<std::string> ParseList(const std::string& str)
+{
+    std::vector<std::string> xs;
+    std::stringstream        ss(str);
+    std::string              x;
+    while (std::getline(ss, x, ',')) {
+        xs.push_back(x);
+    }
+    return xs;
+}
+
+inline std::vector<int> ParseInts(const std::string& str)
+{
+    std::vector<int> xs;
+    for (const auto& x : ParseList(str)) {
+        xs.push_back(std::stoi(x));
+    }
+    return xs;
+}
+
+// Walks the `--key value` pairs of the command line, `set(key, value)` returns false on an unknown key. The keys in
+// `flags` take no value (`value` is empty) and the arguments not starting with '-' are passed with an empty `key`.
+// False on `-h`, `--help`, a missing value or an unknown key, the caller then prints its usage
+template<class F>
+bool ParseCommandLine(int argc, char* argv[], F&& set, const std::vector<std::string>& flags = {})
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        std::string value;
+        if (key == "-h" || key == "--help") {
+            return false;
+        }
+        if (key.empty() || key[0] != '-') {
+            std::swap(key, value);
+        }
+        else if (std::find(flags.begin(), flags.end(), key) == flags.end()) {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value of " << key << "\n";
+                return false;
+            }
+            value = argv[++i];
+        }
+        if (!set(key, value)) {
+            std::cerr << "unknown option " << (key.empty() ? value : key) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// The `p`-th percentile (0 <= p <= 100) of `xs`, linearly interpolated between the closest ranks, 0 when empty
+inline double Percentile(std::vector<double> xs, double p)
+{
+    if (xs.empty()) {
+        return 0;
+    }
+    std::sort(xs.begin(), xs.end());
+    const double pos = std::clamp(p, 0., 100.) / 100. * (xs.size() - 1);
+    const size_t i   = (size_t)pos;
+    const size_t j   = std::min(i + 1, xs.size() - 1);
+    return xs[i] + (xs[j] - xs[i]) * (pos - i);
+}
+
+}  // namespace turbomind
@@ -92,6 +92,18 @@ cublasMMWrapper::cublasMMWrapper(const cublasMMWrapper& wrapper):
     }
 }
 
+cublasMMWrapper::cublasMMWrapper(const cublasMMWrapper& wrapper, cublasHandle_t cublas_handle, cudaStream_t stream):
+    cublasMMWrapper(wrapper)
+{
+    cublas_handle_   = cublas_handle;
+    stream_          = stream;
+    Atype_           = wrapper.Atype_;
+    Btype_           = wrapper.Btype_;
+    Ctype_           = wrapper.Ctype_;
+    computeType_     = wrapper.computeType_;
+    batch_invariant_ = wrapper.batch_invariant_;
+}
+
 void cublasMMWrapper::Gemm(cublasOperation_t transa,
                            cublasOperation_t transb,
                            const int         m,
@@ -191,6 +203,8 @@ void cublasMMWrapper::Gemm(cublasOperation_t transa,
             using_cublasLt = false;
         }
     }
+    // the algos are pinned through cublasLt
+    using_cublasLt |= batch_invariant_;
 
     if (using_cublasLt) {
         cublasLtMatmulDesc_t   operationDesc = NULL;
@@ -278,6 +292,12 @@ void cublasMMWrapper::Gemm(cublasOperation_t transa,
 #endif
             }
         }
+        if (batch_invariant_) {
+            findAlgo =
+                getPinnedAlgo(operationDesc, Adesc, Bdesc, Cdesc, transa, transb, m, k, lda, ldb, ldc, algo);
+            workSpace     = nullptr;
+            workspaceSize = 0;
+        }
 
         cublasLtMatmul(cublaslt_handle_,
                        operationDesc,
@@ -460,6 +480,69 @@ void cublasMMWrapper::setStream(cudaStream_t stream)
     stream_ = stream;
 }
 
+void cublasMMWrapper::setBatchInvariant(bool batch_invariant)
+{
+    batch_invariant_ = batch_invariant;
+}
+
+bool cublasMMWrapper::getPinnedAlgo(cublasLtMatmulDesc_t   operationDesc,
+                                    cublasLtMatrixLayout_t Adesc,
+                                    cublasLtMatrixLayout_t Bdesc,
+                                    cublasLtMatrixLayout_t Cdesc,
+                                    cublasOperation_t      transa,
+                                    cublasOperation_t      transb,
+                                    int                    m,
+                                    int                    k,
+                                    int                    lda,
+                                    int                    ldb,
+                                    int                    ldc,
+                                    cublasLtMatmulAlgo_t&  algo)
+{
+    const std::array<int, 9> key{transa, transb, m, k, lda, ldb, ldc, (int)Atype_, (int)computeType_};
+
+    auto it = pinned_algos_.find(key);
+    if (it == pinned_algos_.end()) {
+        cublasLtMatmulHeuristicResult_t result{};
+        int                             count = 0;
+        // `B` of shape [k, n] only, so that `ldb` is valid for the pinned batch
+        if (transb == CUBLAS_OP_N) {
+            cublasLtMatrixLayout_t     pinned_B{}, pinned_C{};
+            cublasLtMatmulPreference_t pref{};
+            uint64_t                   max_workspace = 0;
+            cublasLtMatrixLayoutCreate(&pinned_B, Btype_, k, kPinnedBatch, ldb);
+            cublasLtMatrixLayoutCreate(&pinned_C, Ctype_, m, kPinnedBatch, ldc);
+            cublasLtMatmulPreferenceCreate(&pref);
+            cublasLtMatmulPreferenceSetAttribute(
+                pref, CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &max_workspace, sizeof(max_workspace));
+            cublasLtMatmulAlgoGetHeuristic(
+                cublaslt_handle_, operationDesc, Adesc, pinned_B, pinned_C, pinned_C, pref, 1, &result, &count);
+            cublasLtMatmulPreferenceDestroy(pref);
+            cublasLtMatrixLayoutDestroy(pinned_B);
+            cublasLtMatrixLayoutDestroy(pinned_C);
+        }
+        if (count > 0) {
+            int splits = 1;
+            cublasLtMatmulAlgoConfigSetAttribute(
+                &result.algo, CUBLASLT_ALGO_CONFIG_SPLITK_NUM, &splits, sizeof(splits));
+        }
+        else {
+            TM_LOG_WARNING("[cublasMMWrapper] No pinned algo for m=%d, k=%d, the GEMM is not batch invariant", m, k);
+        }
+        it = pinned_algos_.emplace(key, std::make_pair(count > 0, result.algo)).first;
+    }
+
+    if (!it->second.first) {
+        return false;
+    }
+
+    algo = it->second.second;
+
+    cublasLtMatmulHeuristicResult_t check{};
+    return cublasLtMatmulAlgoCheck(cublaslt_handle_, operationDesc, Adesc, Bdesc, Cdesc, Cdesc, &algo, &check)
+               == CUBLAS_STATUS_SUCCESS
+           && check.workspaceSize == 0;
+}
+
 void cublasMMWrapper::stridedBatchedGemm(cublasOperation_t transa,
                                          cublasOperation_t transb,
                                          const int         m,
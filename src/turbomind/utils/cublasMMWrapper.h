@@ -51,6 +51,22 @@ protected:
     IAllocator* allocator_        = nullptr;
     void*       cublas_workspace_ = nullptr;
 
+    bool                                                                batch_invariant_ = false;
+    std::map<std::array<int, 9>, std::pair<bool, cublasLtMatmulAlgo_t>> pinned_algos_;  // failed ones are kept as false
+
+    bool getPinnedAlgo(cublasLtMatmulDesc_t   operationDesc,
+                       cublasLtMatrixLayout_t Adesc,
+                       cublasLtMatrixLayout_t Bdesc,
+                       cublasLtMatrixLayout_t Cdesc,
+                       cublasOperation_t      transa,
+                       cublasOperation_t      transb,
+                       int                    m,
+                       int                    k,
+                       int                    lda,
+                       int                    ldb,
+                       int                    ldc,
+                       cublasLtMatmulAlgo_t&  algo);
+
     friend class cublasINT8MMWrapper;
 
     void _Int8Gemm(const int     m,
@@ -88,6 +104,9 @@ public:
 
     cublasMMWrapper(const cublasMMWrapper& wrapper);
 
+    // Same data types, algo map & lock as `wrapper`, for the GEMMs on another stream
+    cublasMMWrapper(const cublasMMWrapper& wrapper, cublasHandle_t cublas_handle, cudaStream_t stream);
+
     virtual void cublasVersionCheck()
     {
         return;
@@ -203,6 +222,12 @@ public:
 #endif
     void setStream(cudaStream_t stream);
 
+    // The algo of a GEMM is picked once for `kPinnedBatch` columns without split-k & workspace and reused for any `n`,
+    // a column of the result doesn't depend on the others
+    void setBatchInvariant(bool batch_invariant);
+
+    static constexpr int kPinnedBatch = 128;
+
     void setGemmConfig(cudaDataType_t aType, cudaDataType_t bType, cudaDataType_t cType, cudaDataType_t computeType);
 
     CublasDataType getCublasDataType(cudaDataType_t data_type);
@@ -17,7 +17,15 @@
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/macro.h"
 #include "src/turbomind/utils/cuda_fp8_utils.h"
+#include <cctype>
+#include <cstdio>
 #include <regex>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace turbomind {
 
@@ -379,5 +387,85 @@ void trim_default_mempool(int device_id)
     check_cuda_error(cudaMemPoolTrimTo(mempool, 0));
 }
 
+std::vector<uint64_t> getThreadAffinity()
+{
+    std::vector<uint64_t> mask;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        mask.resize(CPU_SETSIZE / 64);
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &set)) {
+                mask[i / 64] |= 1ull << (i % 64);
+            }
+        }
+    }
+#endif
+    return mask;
+}
+
+void setThreadAffinity(const std::vector<uint64_t>& mask)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < std::min<int>(mask.size() * 64, CPU_SETSIZE); ++i) {
+        if (mask[i / 64] >> (i % 64) & 1) {
+            CPU_SET(i, &set);
+        }
+    }
+    if (CPU_COUNT(&set) && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        TM_LOG_WARNING("[setThreadAffinity] failed to set the affinity of the thread");
+    }
+#endif
+}
+
+bool bindThreadToDevice(int device_id)
+{
+    char bus_id[32]{};
+    if (cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), device_id) != cudaSuccess) {
+        return false;
+    }
+    // sysfs uses lower case hex digits, e.g. "0000:3b:00.0"
+    std::string path = bus_id;
+    std::transform(path.begin(), path.end(), path.begin(), [](unsigned char c) { return std::tolower(c); });
+    std::ifstream file("/sys/bus/pci/devices/" + path + "/local_cpulist");
+    std::string   list;
+    if (!std::getline(file, list)) {
+        return false;
+    }
+
+    auto mask = getThreadAffinity();
+
+    // cpulist format, e.g. "0-23,48-71"
+    std::vector<uint64_t> local(mask.size());
+    std::stringstream     ss(list);
+    std::string           range;
+    int                   count = 0;
+    while (std::getline(ss, range, ',')) {
+        int first{}, last{};
+        if (const int n = std::sscanf(range.c_str(), "%d-%d", &first, &last); n < 1) {
+            return false;
+        }
+        else if (n == 1) {
+            last = first;
+        }
+        for (int i = first; i <= last && i < (int)mask.size() * 64; ++i) {
+            if (mask[i / 64] >> (i % 64) & 1) {
+                local[i / 64] |= 1ull << (i % 64);
+                ++count;
+            }
+        }
+    }
+    // not allowed to run on any of the local CPUs
+    if (count == 0) {
+        return false;
+    }
+
+    setThreadAffinity(local);
+    return true;
+}
+
 /* ************************** end of common utils ************************** */
 }  // namespace turbomind
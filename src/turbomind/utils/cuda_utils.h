@@ -517,5 +517,15 @@ private:
 
 void trim_default_mempool(int device_id);
 
+// CPU mask of the calling thread, empty when not supported by the platform
+std::vector<uint64_t> getThreadAffinity();
+
+void setThreadAffinity(const std::vector<uint64_t>& mask);
+
+// Bind the calling thread to the CPUs local to the PCIe root complex of `device_id` (its NUMA node) out of the
+// allowed ones, returns false when the topology is unknown. Threads created by the thread inherit the binding, and
+// host memory it touches afterwards, e.g. pinned buffers, is placed on the local node by the first-touch policy
+bool bindThreadToDevice(int device_id);
+
 /* ************************** end of common utils ************************** */
 }  // namespace turbomind
@@ -0,0 +1,85 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+#include "src/turbomind/utils/event_log.h"
+
+namespace turbomind {
+
+EventLog& EventLog::instance()
+{
+    static EventLog inst{};
+    return inst;
+}
+
+EventLog::EventLog(): ring_{kCapacity}
+{
+    writer_ = std::thread{&EventLog::Run, this};
+}
+
+EventLog::~EventLog()
+{
+    stop_.store(true);
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+}
+
+void EventLog::Record(const char* site, int64_t suppressed, std::initializer_list<Field> fields) noexcept
+{
+    Event e;
+    e.site       = site;
+    e.time       = now();
+    e.suppressed = suppressed;
+    e.n          = std::min<int>(fields.size(), kMaxFields);
+    std::copy_n(fields.begin(), e.n, e.fields);
+    if (auto& tracer = Tracer::instance(); tracer.enabled()) {
+        Tracer::Arg args[kMaxFields];
+        for (int i = 0; i < e.n; ++i) {
+            args[i] = {e.fields[i].key, e.fields[i].value};
+        }
+        tracer.Instant(site, e.time, args, e.n);
+    }
+    if (!ring_.try_push(e)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void EventLog::Run()
+{
+    // polling, so the producers never make a syscall to wake the writer
+    while (!stop_.load()) {
+        Drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    Drain();
+}
+
+void EventLog::Drain()
+{
+    std::string line;
+    while (auto e = ring_.try_pop()) {
+        line = "[TM][INFO] [";
+        line += e->site;
+        line += "] t=" + std::to_string(e->time);
+        for (int i = 0; i < e->n; ++i) {
+            line += ' ';
+            line += e->fields[i].key;
+            line += '=';
+            line += std::to_string(e->fields[i].value);
+        }
+        if (e->suppressed) {
+            line += " suppressed=" + std::to_string(e->suppressed);
+        }
+        line += '\n';
+        fputs(line.c_str(), stderr);
+    }
+    if (const auto n = dropped_.exchange(0, std::memory_order_relaxed)) {
+        fprintf(stderr, "[TM][WARNING] [EventLog] %" PRIu64 " events dropped\n", n);
+    }
+}
+
+}  // namespace turbomind
@@ -0,0 +1,104 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <thread>
+
+#include "src/turbomind/engine/mpmc_ring.h"
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/tracer.h"
+
+namespace turbomind {
+
+// Structured events of the hot loops. The calling thread only copies the key-value fields into a lock-free ring, the
+// formatting and the writes to stderr are done by a background thread. Site names and keys must outlive the process
+// (string literals), events are dropped and counted when the ring is full. The events are also instants of the
+// `Tracer` when it is enabled
+class EventLog {
+public:
+    static constexpr int    kMaxFields = 8;
+    static constexpr size_t kCapacity  = 4096;
+
+    struct Field {
+        const char* key;
+        int64_t     value;
+    };
+
+    struct Event {
+        const char* site;
+        int64_t     time;        // microseconds of `steady_clock`
+        int64_t     suppressed;  // events of the site dropped by the rate limit since the last one
+        int         n;
+        Field       fields[kMaxFields];
+    };
+
+    static EventLog& instance();
+
+    ~EventLog();
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    void Record(const char* site, int64_t suppressed, std::initializer_list<Field> fields) noexcept;
+
+    static int64_t now() noexcept
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    EventLog();
+
+    void Run();
+
+    void Drain();
+
+    MPMCRing<Event> ring_;
+
+    std::atomic<bool>     stop_{};
+    std::atomic<uint64_t> dropped_{};
+
+    std::thread writer_;
+};
+
+// Lets at most one event per `interval_ms` through from a call site
+class RateLimit {
+public:
+    explicit RateLimit(int interval_ms): interval_{interval_ms * 1000LL} {}
+
+    // count of the events suppressed since the last one let through, -1 when this one is suppressed
+    int64_t operator()() noexcept
+    {
+        const int64_t now  = EventLog::now();
+        int64_t       last = last_.load(std::memory_order_relaxed);
+        if (now - last < interval_ || !last_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        return suppressed_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    const int64_t        interval_;
+    std::atomic<int64_t> last_{std::numeric_limits<int64_t>::min() / 2};
+    std::atomic<int64_t> suppressed_{};
+};
+
+// TM_EVENT(interval_ms, "site", {"key", value}, ...), recorded at INFO level
+#define TM_EVENT(interval_ms, site, ...)                                                                               \
+    do {                                                                                                               \
+        if (turbomind::Logger::getLogger().getLevel() <= turbomind::Logger::INFO) {                                    \
+            static turbomind::RateLimit tm_event_rate_limit_{interval_ms};                                             \
+            if (const auto suppressed = tm_event_rate_limit_(); suppressed >= 0) {                                     \
+                turbomind::EventLog::instance().Record(site, suppressed, {__VA_ARGS__});                               \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+}  // namespace turbomind
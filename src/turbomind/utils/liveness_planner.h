@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace turbomind {
+
+// Places buffers in one slab, two buffers share memory only when their live ranges [first, last] don't intersect.
+// The ranges are in any unit of time, e.g. the phases of a decoder layer
+class LivenessPlanner {
+public:
+    explicit LivenessPlanner(size_t alignment = 256): alignment_{alignment} {}
+
+    int Add(size_t size, int first, int last)
+    {
+        buffers_.push_back({(size + alignment_ - 1) / alignment_ * alignment_, first, last, 0});
+        return (int)buffers_.size() - 1;
+    }
+
+    // First fit in decreasing size order, returns the size of the slab
+    size_t Plan()
+    {
+        std::vector<int> order(buffers_.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {  //
+            return buffers_[a].size > buffers_[b].size;
+        });
+
+        size_t           total = 0;
+        std::vector<int> placed;
+        for (const auto& i : order) {
+            auto& b = buffers_[i];
+            // memory taken by the placed buffers that are alive at the same time
+            std::vector<std::pair<size_t, size_t>> taken;
+            for (const auto& j : placed) {
+                const auto& p = buffers_[j];
+                if (p.first <= b.last && b.first <= p.last) {
+                    taken.emplace_back(p.offset, p.offset + p.size);
+                }
+            }
+            std::sort(taken.begin(), taken.end());
+            size_t offset = 0;
+            for (const auto& [lo, hi] : taken) {
+                if (offset + b.size <= lo) {
+                    break;
+                }
+                offset = std::max(offset, hi);
+            }
+            b.offset = offset;
+            total    = std::max(total, offset + b.size);
+            placed.push_back(i);
+        }
+
+        return total;
+    }
+
+    size_t offset(int id) const
+    {
+        return buffers_.at(id).offset;
+    }
+
+private:
+    struct Buffer {
+        size_t size;
+        int    first;
+        int    last;
+        size_t offset;
+    };
+
+    size_t              alignment_;
+    std::vector<Buffer> buffers_;
+};
+
+}  // namespace turbomind
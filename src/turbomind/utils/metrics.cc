@@ -0,0 +1,138 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <sstream>
+
+#include "src/turbomind/utils/cuda_utils.h"
+#include "src/turbomind/utils/metrics.h"
+
+namespace turbomind {
+
+static void ExportSample(std::ostream& os, const std::string& name, const std::string& labels, const char* suffix)
+{
+    os << name << suffix;
+    if (!labels.empty()) {
+        os << '{' << labels << '}';
+    }
+    os << ' ';
+}
+
+void Counter::Export(std::ostream& os, const std::string& name, const std::string& labels) const
+{
+    ExportSample(os, name, labels, "");
+    os << value_.load(std::memory_order_relaxed) << '\n';
+}
+
+void Gauge::Export(std::ostream& os, const std::string& name, const std::string& labels) const
+{
+    ExportSample(os, name, labels, "");
+    os << value_.load(std::memory_order_relaxed) << '\n';
+}
+
+Histogram::Histogram(std::vector<double> bounds):
+    bounds_{std::move(bounds)}, counts_{std::make_unique<std::atomic<int64_t>[]>(bounds_.size() + 1)}
+{
+    for (size_t i = 0; i <= bounds_.size(); ++i) {
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(double value) noexcept
+{
+    const size_t i = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    counts_[i].fetch_add(1, std::memory_order_relaxed);
+    double sum = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+void Histogram::Export(std::ostream& os, const std::string& name, const std::string& labels) const
+{
+    const std::string sep = labels.empty() ? "" : ",";
+
+    int64_t count = 0;
+    for (size_t i = 0; i <= bounds_.size(); ++i) {
+        count += counts_[i].load(std::memory_order_relaxed);
+        os << name << "_bucket{" << labels << sep << "le=\"";
+        if (i < bounds_.size()) {
+            os << bounds_[i];
+        }
+        else {
+            os << "+Inf";
+        }
+        os << "\"} " << count << '\n';
+    }
+    ExportSample(os, name, labels, "_sum");
+    os << sum_.load(std::memory_order_relaxed) << '\n';
+    ExportSample(os, name, labels, "_count");
+    os << count << '\n';
+}
+
+std::vector<double> ExponentialBounds(double max)
+{
+    std::vector<double> bounds;
+    for (double x = 1; x <= max; x *= 2) {
+        bounds.push_back(x);
+    }
+    return bounds;
+}
+
+MetricsRegistry& MetricsRegistry::instance()
+{
+    static MetricsRegistry inst{};
+    return inst;
+}
+
+template<class M, class... Args>
+M* MetricsRegistry::Get(
+    const std::string& name, const char* type, const std::string& help, const std::string& labels, Args&&... args)
+{
+    std::lock_guard lock{mutex_};
+
+    auto& family = families_[name];
+    if (family.type.empty()) {
+        family.type = type;
+        family.help = help;
+    }
+    FT_CHECK_WITH_INFO(family.type == type, "metric " + name + " is registered with another type");
+
+    auto& m = family.metrics[labels];
+    if (!m) {
+        m = std::make_unique<M>(std::forward<Args>(args)...);
+    }
+    return static_cast<M*>(m.get());
+}
+
+Counter* MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return Get<Counter>(name, "counter", help, labels);
+}
+
+Gauge* MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return Get<Gauge>(name, "gauge", help, labels);
+}
+
+Histogram* MetricsRegistry::histogram(const std::string& name,
+                                      const std::string& help,
+                                      const std::string& labels,
+                                      std::vector<double> bounds)
+{
+    return Get<Histogram>(name, "histogram", help, labels, std::move(bounds));
+}
+
+std::string MetricsRegistry::Export() const
+{
+    std::ostringstream os;
+
+    std::lock_guard lock{mutex_};
+    for (const auto& [name, family] : families_) {
+        os << "# HELP " << name << ' ' << family.help << '\n';
+        os << "# TYPE " << name << ' ' << family.type << '\n';
+        for (const auto& [labels, m] : family.metrics) {
+            m->Export(os, name, labels);
+        }
+    }
+    return os.str();
+}
+
+}  // namespace turbomind
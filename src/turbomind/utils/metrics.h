@@ -0,0 +1,106 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace turbomind {
+
+// Process-wide registry of counters, gauges & histograms exported in the Prometheus text format. Metrics are created
+// once under a lock and updated lock-free with relaxed atomics, `Export` may be called at any time from any thread.
+//
+// `labels` are the pairs inside the braces of the exposition format, e.g. `rank="0"`. Getting a metric with the same
+// name & labels again returns the existing one, so the engines that are re-created keep their counters
+class Metric {
+public:
+    virtual ~Metric() = default;
+
+    virtual void Export(std::ostream& os, const std::string& name, const std::string& labels) const = 0;
+};
+
+class Counter: public Metric {
+public:
+    void add(int64_t n = 1) noexcept
+    {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void Export(std::ostream& os, const std::string& name, const std::string& labels) const override;
+
+private:
+    std::atomic<int64_t> value_{};
+};
+
+class Gauge: public Metric {
+public:
+    void set(int64_t value) noexcept
+    {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    void Export(std::ostream& os, const std::string& name, const std::string& labels) const override;
+
+private:
+    std::atomic<int64_t> value_{};
+};
+
+class Histogram: public Metric {
+public:
+    // upper bounds of the buckets in ascending order, the `+Inf` bucket is implied
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value) noexcept;
+
+    void Export(std::ostream& os, const std::string& name, const std::string& labels) const override;
+
+private:
+    std::vector<double>                     bounds_;
+    std::unique_ptr<std::atomic<int64_t>[]> counts_;  // non-cumulative, `bounds_.size() + 1` buckets
+    std::atomic<double>                     sum_{};
+};
+
+// Bounds of 1, 2, 4, ... `max`
+std::vector<double> ExponentialBounds(double max);
+
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    Counter* counter(const std::string& name, const std::string& help, const std::string& labels = {});
+
+    Gauge* gauge(const std::string& name, const std::string& help, const std::string& labels = {});
+
+    Histogram* histogram(const std::string& name,
+                         const std::string& help,
+                         const std::string& labels,
+                         std::vector<double> bounds);
+
+    std::string Export() const;
+
+private:
+    template<class M, class... Args>
+    M* Get(const std::string& name,
+           const char*        type,
+           const std::string& help,
+           const std::string& labels,
+           Args&&... args);
+
+    struct Family {
+        std::string                                    type;
+        std::string                                    help;
+        std::map<std::string, std::unique_ptr<Metric>> metrics;  // by labels
+    };
+
+    mutable std::mutex            mutex_;
+    std::map<std::string, Family> families_;
+};
+
+}  // namespace turbomind
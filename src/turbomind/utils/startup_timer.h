@@ -0,0 +1,62 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace turbomind {
+
+// Wall time of the phases of the engine start of a rank, e.g. weight processing, communicator setup, kv cache
+// allocation & gemm tuning. Phases recorded more than once add up, they are listed in the order first recorded. Only
+// written by the threads creating the rank, which run one after another
+class StartupTimer {
+public:
+    class Scope {
+    public:
+        Scope(StartupTimer* timer, std::string phase):
+            timer_{timer}, phase_{std::move(phase)}, start_{std::chrono::steady_clock::now()}
+        {
+        }
+
+        ~Scope()
+        {
+            if (timer_) {
+                const auto end = std::chrono::steady_clock::now();
+                timer_->Record(phase_, std::chrono::duration<double>(end - start_).count());
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StartupTimer*                         timer_;
+        std::string                           phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    void Record(const std::string& phase, double seconds)
+    {
+        for (auto& [name, t] : phases_) {
+            if (name == phase) {
+                t += seconds;
+                return;
+            }
+        }
+        phases_.emplace_back(phase, seconds);
+    }
+
+    // (phase, seconds)
+    const std::vector<std::pair<std::string, double>>& phases() const noexcept
+    {
+        return phases_;
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> phases_;
+};
+
+}  // namespace turbomind
@@ -0,0 +1,178 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include <cuda_runtime.h>
+
+#include "src/turbomind/utils/logger.h"
+#include "src/turbomind/utils/tracer.h"
+
+namespace turbomind {
+
+Tracer& Tracer::instance()
+{
+    static Tracer inst{};
+    return inst;
+}
+
+void Tracer::Enable(size_t capacity)
+{
+    if (!capacity) {
+        return;
+    }
+    std::lock_guard lock{mutex_};
+    if (capacity > ring_.size()) {
+        // oldest first, so that the spans already in the ring are kept in order
+        std::vector<Span> ring;
+        ring.reserve(capacity);
+        const size_t n = std::min(next_, ring_.size());
+        for (size_t i = next_ - n; i < next_; ++i) {
+            ring.push_back(ring_[i % ring_.size()]);
+        }
+        ring.resize(capacity);
+        ring_.swap(ring);
+        next_ = n;
+        TM_LOG_INFO("[Tracer] keeping the last %zu spans", capacity);
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+int Tracer::ThreadTrack() noexcept
+{
+    static std::atomic<int> count{};
+    thread_local const int  track = kDeviceTrack + 1 + count.fetch_add(1, std::memory_order_relaxed);
+    return track;
+}
+
+void Tracer::Push(Span& span)
+{
+    if (span.device < 0) {
+        span.device = 0;
+        (void)cudaGetDevice(&span.device);
+    }
+    std::lock_guard lock{mutex_};
+    ring_[next_++ % ring_.size()] = span;
+}
+
+static void CopyName(char* dst, const char* src)
+{
+    std::strncpy(dst, src, Tracer::kNameLen - 1);
+    dst[Tracer::kNameLen - 1] = '\0';
+}
+
+void Tracer::Add(const char* name, int64_t begin, int64_t end, int device, int track, std::initializer_list<Arg> args)
+{
+    if (!enabled()) {
+        return;
+    }
+    Span s;
+    CopyName(s.name, name);
+    s.begin    = begin;
+    s.duration = std::max<int64_t>(end - begin, 0);
+    s.device   = device;
+    s.track    = track < 0 ? ThreadTrack() : track;
+    s.n        = std::min<int>(args.size(), kMaxArgs);
+    std::copy_n(args.begin(), s.n, s.args);
+    Push(s);
+}
+
+void Tracer::Instant(const char* name, int64_t time, const Arg* args, int n)
+{
+    if (!enabled()) {
+        return;
+    }
+    Span s;
+    CopyName(s.name, name);
+    s.begin    = time;
+    s.duration = -1;
+    s.device   = -1;
+    s.track    = ThreadTrack();
+    s.n        = std::min(n, kMaxArgs);
+    std::copy_n(args, s.n, s.args);
+    Push(s);
+}
+
+static void WriteEscaped(std::ostream& os, const char* s)
+{
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            os << '\\';
+        }
+        os << (std::isprint((unsigned char)*s) ? *s : '?');
+    }
+}
+
+std::string Tracer::Dump(bool reset)
+{
+    std::vector<Span> spans;
+    {
+        std::lock_guard lock{mutex_};
+        const size_t    n = std::min(next_, ring_.size());
+        spans.reserve(n);
+        for (size_t i = next_ - n; i < next_; ++i) {
+            spans.push_back(ring_[i % ring_.size()]);
+        }
+        if (reset) {
+            next_ = 0;
+        }
+    }
+
+    std::ostringstream os;
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    // names of the processes (devices) & the threads (tracks)
+    std::map<int, std::set<int>> tracks;
+    for (const auto& s : spans) {
+        tracks[s.device].insert(s.track);
+    }
+    bool first = true;
+    for (const auto& [device, ts] : tracks) {
+        os << (first ? "" : ",") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << device
+           << ",\"args\":{\"name\":\"device " << device << "\"}}";
+        first = false;
+        for (const auto& t : ts) {
+            os << ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << device << ",\"tid\":" << t
+               << ",\"args\":{\"name\":\"";
+            if (t == kDeviceTrack) {
+                os << "gpu";
+            }
+            else {
+                os << "host " << t;
+            }
+            os << "\"}}";
+        }
+    }
+
+    for (const auto& s : spans) {
+        os << (first ? "" : ",") << "{\"name\":\"";
+        WriteEscaped(os, s.name);
+        os << "\",\"pid\":" << s.device << ",\"tid\":" << s.track << ",\"ts\":" << s.begin;
+        if (s.duration >= 0) {
+            os << ",\"ph\":\"X\",\"dur\":" << s.duration;
+        }
+        else {
+            os << ",\"ph\":\"i\",\"s\":\"t\"";
+        }
+        if (s.n) {
+            os << ",\"args\":{";
+            for (int i = 0; i < s.n; ++i) {
+                os << (i ? ",\"" : "\"");
+                WriteEscaped(os, s.args[i].key);
+                os << "\":" << s.args[i].value;
+            }
+            os << "}";
+        }
+        os << "}";
+        first = false;
+    }
+    os << "]}";
+
+    return os.str();
+}
+
+}  // namespace turbomind
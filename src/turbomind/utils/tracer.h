@@ -0,0 +1,90 @@
+// Copyright (c) OpenMMLab. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace turbomind {
+
+// Process-wide timeline of the host ranges (`NvtxScope`), the device phases resolved by the `StepProfiler` and the
+// engine events (`TM_EVENT`). The spans are kept in a ring of a fixed capacity, the oldest ones are overwritten, and
+// `Dump` formats them as a Chrome trace (JSON) that Perfetto & chrome://tracing open.
+//
+// Disabled by default, the overhead of a disabled tracer is a relaxed load
+class Tracer {
+public:
+    static constexpr int kNameLen = 48;
+    static constexpr int kMaxArgs = 4;
+
+    // track of the device spans of a device, the host threads get their own tracks
+    static constexpr int kDeviceTrack = 0;
+
+    struct Arg {
+        const char* key;  // must outlive the process (string literals)
+        int64_t     value;
+    };
+
+    struct Span {
+        char    name[kNameLen];
+        int64_t begin;     // microseconds of `steady_clock`
+        int64_t duration;  // < 0 for an instant event
+        int     device;
+        int     track;
+        int     n;
+        Arg     args[kMaxArgs];
+    };
+
+    static Tracer& instance();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Keeps the last `capacity` spans, a larger capacity than the current one grows the ring
+    void Enable(size_t capacity);
+
+    bool enabled() const noexcept
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // `track` < 0 for the track of the calling thread, `device` < 0 for the current device
+    void Add(const char*                name,
+             int64_t                    begin,
+             int64_t                    end,
+             int                        device = -1,
+             int                        track  = -1,
+             std::initializer_list<Arg> args   = {});
+
+    // on the track of the calling thread
+    void Instant(const char* name, int64_t time, const Arg* args, int n);
+
+    // Chrome trace of the spans in the ring, `reset` clears it
+    std::string Dump(bool reset);
+
+    static int64_t now() noexcept
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    Tracer() = default;
+
+    void Push(Span& span);
+
+    static int ThreadTrack() noexcept;
+
+    std::atomic<bool> enabled_{};
+
+    std::mutex        mutex_;
+    std::vector<Span> ring_;
+    size_t            next_{};  // total spans pushed
+};
+
+}  // namespace turbomind
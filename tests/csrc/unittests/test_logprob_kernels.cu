@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <assert.h>
 #include <float.h>
+#include <functional>
 #include <math.h>
 #include <stdexcept>
 #include <tuple>
@@ -9,6 +11,7 @@
 #endif
 #include "src/turbomind/kernels/logprob_kernels.h"
 #include "src/turbomind/utils/allocator.h"
+#include "src/turbomind/utils/constant.h"
 #include "src/turbomind/utils/cuda_utils.h"
 #include "src/turbomind/utils/logger.h"
 #include "src/turbomind/utils/memory_utils.h"
@@ -305,3 +308,143 @@ TYPED_TEST(LogProbKernelTest, BatchFirstAccumLongStep4096)
 {
     this->runBatchFirstTest({4096, 8, 5001, 1});
 }
+
+struct TopNLogProbsTestParam {
+    size_t batch_size;
+    size_t vocab_size;
+    int    n;
+
+    std::string toString()
+    {
+        return fmtstr("TopNLogProbsTestParam[batch=%ld, vocab=%ld, n=%d]", batch_size, vocab_size, n);
+    }
+};
+
+template<typename T>
+class TopNLogProbsTest: public FtTestBase {
+protected:
+    // Sorted top-n logits & log(softmax(logits)) of each row in [batch_size, n]
+    void computeTopNLogProbs(float*       top_logits,
+                             float*       top_logprobs,
+                             const T*     logits,
+                             const int    n,
+                             const size_t batch_size,
+                             const size_t vocab_size,
+                             const size_t vocab_size_padded)
+    {
+        std::vector<float> vec(vocab_size);
+        for (size_t i = 0; i < batch_size; ++i) {
+            float max_logits = -FLT_MAX;
+            for (size_t v = 0; v < vocab_size; ++v) {
+                vec[v]     = static_cast<float>(logits[i * vocab_size_padded + v]);
+                max_logits = std::max(max_logits, vec[v]);
+            }
+            float sum = 0.0f;
+            for (size_t v = 0; v < vocab_size; ++v) {
+                sum += expf(vec[v] - max_logits);
+            }
+            std::partial_sort(vec.begin(), vec.begin() + n, vec.end(), std::greater<float>());
+            for (int k = 0; k < n; ++k) {
+                top_logits[i * n + k]   = vec[k];
+                top_logprobs[i * n + k] = vec[k] - max_logits - log(sum);
+            }
+        }
+    }
+
+public:
+    void runTest(TopNLogProbsTestParam param)
+    {
+        const size_t batch_size = param.batch_size;
+        const size_t vocab_size = param.vocab_size;
+        const int    n          = param.n;
+        // Make multiple of 8 as GPT does.
+        const size_t vocab_size_padded = static_cast<size_t>(ceil(vocab_size / 8.f) * 8);
+
+        std::vector<T> h_logits(batch_size * vocab_size_padded);
+        initRandom(h_logits.data(), h_logits.size(), -10.0f, 10.0f);
+        // the padding must not be picked
+        for (size_t i = 0; i < batch_size; ++i) {
+            std::fill(h_logits.begin() + i * vocab_size_padded + vocab_size,
+                      h_logits.begin() + (i + 1) * vocab_size_padded,
+                      (T)100.0f);
+        }
+
+        // rows of the outputs are strided by `kMaxLogProb`
+        const size_t out_size = batch_size * kMaxLogProb;
+
+        T*        d_logits   = reinterpret_cast<T*>(allocator->malloc(sizeof(T) * h_logits.size()));
+        T*        d_logprobs = reinterpret_cast<T*>(allocator->malloc(sizeof(T) * out_size));
+        uint32_t* d_indexes  = reinterpret_cast<uint32_t*>(allocator->malloc(sizeof(uint32_t) * out_size));
+        uint32_t* d_nums     = reinterpret_cast<uint32_t*>(allocator->malloc(sizeof(uint32_t) * batch_size));
+        cudaH2Dcpy(d_logits, h_logits.data(), h_logits.size());
+
+        invokeTopNLogProbs(
+            d_logprobs, d_indexes, d_nums, d_logits, n, batch_size, vocab_size, vocab_size_padded, stream);
+
+        std::vector<T>        h_logprobs(out_size);
+        std::vector<uint32_t> h_indexes(out_size);
+        std::vector<uint32_t> h_nums(batch_size);
+        cudaD2Hcpy(h_logprobs.data(), d_logprobs, h_logprobs.size());
+        cudaD2Hcpy(h_indexes.data(), d_indexes, h_indexes.size());
+        cudaD2Hcpy(h_nums.data(), d_nums, h_nums.size());
+
+        std::vector<float> expected_logits(batch_size * n);
+        std::vector<float> expected_logprobs(batch_size * n);
+        computeTopNLogProbs(expected_logits.data(),
+                            expected_logprobs.data(),
+                            h_logits.data(),
+                            n,
+                            batch_size,
+                            vocab_size,
+                            vocab_size_padded);
+
+        // the indexes are checked through the logits they point to, which stays valid with ties
+        std::vector<float> top_logits(batch_size * n);
+        std::vector<float> top_logprobs(batch_size * n);
+        for (size_t i = 0; i < batch_size; ++i) {
+            EXPECT_EQ(h_nums[i], (uint32_t)n);
+            const auto            first = h_indexes.begin() + i * kMaxLogProb;
+            std::vector<uint32_t> indexes(first, first + n);
+            for (int k = 0; k < n; ++k) {
+                ASSERT_LT(indexes[k], vocab_size);
+                top_logits[i * n + k]   = static_cast<float>(h_logits[i * vocab_size_padded + indexes[k]]);
+                top_logprobs[i * n + k] = static_cast<float>(h_logprobs[i * kMaxLogProb + k]);
+            }
+            std::sort(indexes.begin(), indexes.end());
+            EXPECT_TRUE(std::adjacent_find(indexes.begin(), indexes.end()) == indexes.end());
+        }
+
+        std::string tag = param.toString() + (std::is_same<T, float>::value ? " (fp32)" : " (fp16)");
+        bool passed = checkResult(tag + " logits", top_logits.data(), expected_logits.data(), top_logits.size(), false);
+        passed &= checkResult(
+            tag + " logprobs", top_logprobs.data(), expected_logprobs.data(), top_logprobs.size(), false);
+        EXPECT_TRUE(passed);
+    }
+};
+
+TYPED_TEST_SUITE(TopNLogProbsTest, FloatAndHalfTypes);
+
+TYPED_TEST(TopNLogProbsTest, Top1)
+{
+    this->runTest({32, 16, 1});
+}
+
+TYPED_TEST(TopNLogProbsTest, WholeVocab)
+{
+    this->runTest({8, 16, 16});
+}
+
+TYPED_TEST(TopNLogProbsTest, FullWarp)
+{
+    this->runTest({8, 41, kMaxTopNLogProbs});
+}
+
+TYPED_TEST(TopNLogProbsTest, LargeVocab)
+{
+    this->runTest({8, 50211, 5});
+}
+
+TYPED_TEST(TopNLogProbsTest, LargeVocabFullWarp)
+{
+    this->runTest({8, 50211, kMaxTopNLogProbs});
+}
@@ -28,6 +28,7 @@
 #include <cuda_runtime.h>
 
 #include "gtest_utils.h"
+#include "src/turbomind/kernels/ban_bad_words.h"
 #include "src/turbomind/kernels/penalty_types.h"
 #include "src/turbomind/kernels/sampling_penalty_kernels.h"
 #include "src/turbomind/utils/cuda_utils.h"
@@ -119,6 +120,47 @@ void batchApplyRepetitonPenalty(T*           logits,
     delete[] penalized;
 }
 
+template<typename T>
+void batchApplyTokenPenalties(T*           logits,
+                              const int*   output_ids,
+                              const int*   input_lengths,
+                              const float* repetition_penalties,
+                              const float* frequency_penalties,
+                              const float* presence_penalties,
+                              const size_t step,
+                              const size_t max_input_length,
+                              const size_t batch_size,
+                              const size_t vocab_size,
+                              const size_t vocab_size_padded)
+{
+    bool* penalized = new bool[vocab_size];
+    int*  counts    = new int[vocab_size];
+    for (size_t i = 0; i < batch_size; ++i) {
+        std::fill_n(penalized, vocab_size, false);
+        std::fill_n(counts, vocab_size, 0);
+        for (size_t t = 0; t < step; ++t) {
+            if (t >= (size_t)input_lengths[i] && t < max_input_length) {
+                continue;
+            }
+            int token_id        = output_ids[i + t * batch_size];
+            penalized[token_id] = true;
+            counts[token_id] += t >= max_input_length;  // only the generated tokens are counted
+        }
+        size_t offset = i * vocab_size_padded;
+        for (size_t v = 0; v < vocab_size; ++v) {
+            if (!penalized[v]) {
+                continue;
+            }
+            float logit = static_cast<float>(logits[offset + v]);
+            logit       = logit < 0.0f ? logit * repetition_penalties[i] : logit / repetition_penalties[i];
+            logit -= frequency_penalties[i] * counts[v] + (counts[v] ? presence_penalties[i] : 0.f);
+            logits[offset + v] = static_cast<T>(logit);
+        }
+    }
+    delete[] counts;
+    delete[] penalized;
+}
+
 template<typename T>
 void initLogitsAndBias(
     T* logits, T* bias, const size_t batch_size, const size_t vocab_size, const size_t vocab_size_padded)
@@ -681,5 +723,184 @@ TYPED_TEST(RepetitionPenaltyTest, PenaltyTypeAdditiveHasDefaultValueZero2)
     this->runTest({batch_size, 4, 5, repetition_penalties, batch_size, RepetitionPenaltyType::Additive});
 }
 
+struct TokenPenaltyTestCase {
+    size_t batch_size;
+    size_t vocab_size;
+    size_t max_input_length;
+    float  repetition_penalty;
+    float  frequency_penalty;
+    float  presence_penalty;
+
+    std::string toString()
+    {
+        return fmtstr("TokenPenaltyTestCase[batch=%ld, vocab=%ld, max_input_length=%ld, repetition_penalty=%f, "
+                      "frequency_penalty=%f, presence_penalty=%f]",
+                      batch_size,
+                      vocab_size,
+                      max_input_length,
+                      repetition_penalty,
+                      frequency_penalty,
+                      presence_penalty);
+    }
+};
+
+template<typename T>
+class TokenPenaltyTest: public FtTestBase {
+public:
+    // The counts are updated in two chunks of steps as the logits processor does across the decoding steps, the
+    // penalties alternate between the given values and none over the batch
+    void runTest(TokenPenaltyTestCase param)
+    {
+        const size_t batch_size        = param.batch_size;
+        const size_t vocab_size        = param.vocab_size;
+        const size_t vocab_size_padded = pad_vocab_size(vocab_size);
+        const size_t max_input_length  = param.max_input_length;
+        const size_t sequence_length   = 2 * max_input_length;  // input + output
+        const size_t step              = sequence_length * 0.7;
+
+        std::vector<T>     h_logits(batch_size * vocab_size_padded);
+        std::vector<int>   h_output_ids(sequence_length * batch_size);
+        std::vector<int>   h_input_lengths(batch_size);
+        std::vector<float> h_repetition_penalties(batch_size, 1.f);
+        std::vector<float> h_frequency_penalties(batch_size, 0.f);
+        std::vector<float> h_presence_penalties(batch_size, 0.f);
+        initLogitsAndBias(h_logits.data(), (T*)nullptr, batch_size, vocab_size, vocab_size_padded);
+        initRandomInt(h_output_ids.data(), h_output_ids.size(), 0, vocab_size);
+        initRandomInt(h_input_lengths.data(), batch_size, 1, max_input_length);
+        for (size_t i = 0; i < batch_size; i += 2) {
+            h_repetition_penalties[i] = param.repetition_penalty;
+            h_frequency_penalties[i]  = param.frequency_penalty;
+            h_presence_penalties[i]   = param.presence_penalty;
+        }
+
+        T*        d_logits        = reinterpret_cast<T*>(allocator->malloc(sizeof(T) * h_logits.size()));
+        int*      d_output_ids    = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * h_output_ids.size()));
+        int*      d_input_lengths = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size));
+        uint32_t* d_token_counts  = reinterpret_cast<uint32_t*>(allocator->malloc(sizeof(uint32_t) * h_logits.size()));
+        float*    d_penalties     = reinterpret_cast<float*>(allocator->malloc(sizeof(float) * batch_size * 3));
+
+        cudaAutoCpy(d_logits, h_logits.data(), h_logits.size(), stream);
+        cudaAutoCpy(d_output_ids, h_output_ids.data(), h_output_ids.size(), stream);
+        cudaAutoCpy(d_input_lengths, h_input_lengths.data(), batch_size, stream);
+        cudaAutoCpy(d_penalties, h_repetition_penalties.data(), batch_size, stream);
+        cudaAutoCpy(d_penalties + batch_size, h_frequency_penalties.data(), batch_size, stream);
+        cudaAutoCpy(d_penalties + batch_size * 2, h_presence_penalties.data(), batch_size, stream);
+
+        cudaMemsetAsync(d_token_counts, 0, sizeof(uint32_t) * h_logits.size(), stream);
+        invokeUpdateTokenCounts(d_token_counts,
+                                d_output_ids,
+                                d_input_lengths,
+                                max_input_length,
+                                batch_size,
+                                vocab_size_padded,
+                                0,
+                                max_input_length + 1,
+                                stream);
+        invokeUpdateTokenCounts(d_token_counts,
+                                d_output_ids,
+                                d_input_lengths,
+                                max_input_length,
+                                batch_size,
+                                vocab_size_padded,
+                                max_input_length + 1,
+                                step,
+                                stream);
+        invokeBatchApplyTokenPenalties(d_logits,
+                                       d_token_counts,
+                                       d_penalties,
+                                       d_penalties + batch_size,
+                                       d_penalties + batch_size * 2,
+                                       batch_size,
+                                       vocab_size,
+                                       vocab_size_padded,
+                                       stream);
+
+        batchApplyTokenPenalties(h_logits.data(),
+                                 h_output_ids.data(),
+                                 h_input_lengths.data(),
+                                 h_repetition_penalties.data(),
+                                 h_frequency_penalties.data(),
+                                 h_presence_penalties.data(),
+                                 step,
+                                 max_input_length,
+                                 batch_size,
+                                 vocab_size,
+                                 vocab_size_padded);
+        bool passed = checkResult(param.toString(), d_logits, h_logits.data(), h_logits.size());
+        EXPECT_TRUE(passed);
+    }
+};
+
+TYPED_TEST_SUITE(TokenPenaltyTest, SamplingTypes);
+
+TYPED_TEST(TokenPenaltyTest, NoPenalty)
+{
+    this->runTest({6, 4, 5, 1.0f, 0.0f, 0.0f});
+}
+
+TYPED_TEST(TokenPenaltyTest, Repetition)
+{
+    this->runTest({6, 4, 5, 2.01f, 0.0f, 0.0f});
+}
+
+TYPED_TEST(TokenPenaltyTest, Frequency)
+{
+    this->runTest({6, 4, 5, 1.0f, 0.4f, 0.0f});
+}
+
+TYPED_TEST(TokenPenaltyTest, Presence)
+{
+    this->runTest({6, 4, 5, 1.0f, 0.0f, 0.7f});
+}
+
+TYPED_TEST(TokenPenaltyTest, Mixed)
+{
+    this->runTest({6, 4, 5, 0.53f, -0.3f, 0.6f});
+}
+
+TYPED_TEST(TokenPenaltyTest, LargeVocab)
+{
+    this->runTest({6, 50001, 1003, 2.01f, 0.4f, 0.7f});
+}
+
+template<typename T>
+class TokenBitmaskTest: public FtTestBase {};
+
+TYPED_TEST_SUITE(TokenBitmaskTest, SamplingTypes);
+
+TYPED_TEST(TokenBitmaskTest, BansUnsetBits)
+{
+    using T = TypeParam;
+
+    const int batch_size        = 3;
+    const int vocab_size        = 100;  // the last word is partial
+    const int vocab_size_padded = pad_vocab_size(vocab_size);
+    const int words             = (vocab_size + 31) / 32;
+
+    std::vector<uint32_t> h_bitmask(batch_size * words);
+    for (auto& w : h_bitmask) {
+        w = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+    }
+    std::fill_n(h_bitmask.begin() + words, words, 0xffffffffu);  // unconstrained row
+
+    std::vector<T> h_logits(batch_size * vocab_size_padded, (T)1.f);
+
+    T*        d_logits  = (T*)this->allocator->malloc(sizeof(T) * h_logits.size());
+    uint32_t* d_bitmask = (uint32_t*)this->allocator->malloc(sizeof(uint32_t) * h_bitmask.size());
+    cudaAutoCpy(d_logits, h_logits.data(), h_logits.size(), this->stream);
+    cudaAutoCpy(d_bitmask, h_bitmask.data(), h_bitmask.size(), this->stream);
+
+    invokeApplyTokenBitmask(d_logits, d_bitmask, batch_size, vocab_size, vocab_size_padded, this->stream);
+    cudaAutoCpy(h_logits.data(), d_logits, h_logits.size(), this->stream);
+    cudaStreamSynchronize(this->stream);
+
+    for (int b = 0; b < batch_size; ++b) {
+        for (int i = 0; i < vocab_size_padded; ++i) {
+            const bool allowed = i >= vocab_size || (h_bitmask[b * words + i / 32] >> (i % 32) & 1);
+            EXPECT_EQ((float)h_logits[b * vocab_size_padded + i] > 0.f, allowed) << "batch " << b << ", token " << i;
+        }
+    }
+}
+
 // Turn on the warning message.
 #pragma nv_diag_suppress 177
@@ -1,6 +1,7 @@
 #include <algorithm>  // std::fill_n
 #include <iostream>   // snprintf
 #include <math.h>     // expf, log
+#include <numeric>    // std::iota
 #include <stdlib.h>   // rand
 #include <string>     // std::string
 #include <vector>     // std::vector
@@ -10,6 +11,8 @@
 #include <cuda_runtime.h>
 #include <gtest/gtest.h>
 
+#include "src/turbomind/kernels/fused_sampling_kernels.h"
+#include "src/turbomind/kernels/philox.cuh"
 #include "src/turbomind/kernels/sampling_kernels.h"
 #include "src/turbomind/kernels/sampling_topk_kernels.h"
 #include "src/turbomind/kernels/sampling_topp_kernels.h"
@@ -27,10 +30,10 @@ using namespace turbomind;
 
 namespace {
 
-__global__ void get_curand_uniform(curandState_t* curandstate, float* output, int n)
+__global__ void get_philox_uniform(const uint64_t* random_seed, float* output, int n)
 {
     int   batch_id   = blockIdx.x;
-    float rand_num   = (float)curand_uniform(curandstate + batch_id);
+    float rand_num   = PhiloxUniform(random_seed[batch_id], 0);
     output[batch_id] = rand_num;
 }
 
@@ -276,7 +279,6 @@ public:
 protected:
     cudaStream_t                    stream;
     Allocator<AllocatorType::CUDA>* allocator;
-    curandState_t*                  curand_states;
 };
 
 template<typename T>
@@ -566,18 +568,17 @@ public:
         std::vector<int> output_sampled_nums(batch_size);
 
         // device buffer
-        T*             d_sorted_logits    = (T*)allocator->malloc(sizeof(T) * batch_size * vocab_size);
-        int*           d_sorted_indices   = (int*)allocator->malloc(sizeof(int) * batch_size * vocab_size);
-        int*           d_kept             = (int*)allocator->malloc(sizeof(int) * batch_size);
-        float*         d_top_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
-        float*         d_min_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
-        float*         d_uniforms         = (float*)(allocator->malloc(sizeof(float) * batch_size));
-        int*           d_output_ids       = (int*)(allocator->malloc(sizeof(int) * batch_size));
-        T*             d_sampled_logprobs = (T*)(allocator->malloc(sizeof(T) * batch_size * kMaxLogProb));
-        int*           d_sampled_indexes  = (int*)(allocator->malloc(sizeof(int) * batch_size * kMaxLogProb));
-        int*           d_sampled_nums     = (int*)(allocator->malloc(sizeof(int) * batch_size));
-        curandState_t* curand_states =
-            reinterpret_cast<curandState_t*>(allocator->malloc(sizeof(curandState_t) * batch_size, false));
+        T*        d_sorted_logits    = (T*)allocator->malloc(sizeof(T) * batch_size * vocab_size);
+        int*      d_sorted_indices   = (int*)allocator->malloc(sizeof(int) * batch_size * vocab_size);
+        int*      d_kept             = (int*)allocator->malloc(sizeof(int) * batch_size);
+        float*    d_top_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
+        float*    d_min_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
+        float*    d_uniforms         = (float*)(allocator->malloc(sizeof(float) * batch_size));
+        int*      d_output_ids       = (int*)(allocator->malloc(sizeof(int) * batch_size));
+        T*        d_sampled_logprobs = (T*)(allocator->malloc(sizeof(T) * batch_size * kMaxLogProb));
+        int*      d_sampled_indexes  = (int*)(allocator->malloc(sizeof(int) * batch_size * kMaxLogProb));
+        int*      d_sampled_nums     = (int*)(allocator->malloc(sizeof(int) * batch_size));
+        uint64_t* d_random_seed      = (uint64_t*)(allocator->malloc(sizeof(uint64_t) * batch_size));
 
         float boundary = 1.f;
         for (int x = vocab_size; x >= 10; x /= 10) {
@@ -602,14 +603,12 @@ public:
         cudaAutoCpy(d_kept, expected_kept.data(), batch_size, stream);
 
         // uniforms
-        for (int i = 0; i < batch_size; i++) {
-            invokeCurandInitialize(curand_states + i, 1, i, stream);
-        }
-        get_curand_uniform<<<batch_size, 1, 0, stream>>>(curand_states, d_uniforms, batch_size);
+        std::vector<uint64_t> random_seed(batch_size);
+        std::iota(random_seed.begin(), random_seed.end(), 0);
+        check_cuda_error(cudaMemcpyAsync(
+            d_random_seed, random_seed.data(), sizeof(uint64_t) * batch_size, cudaMemcpyHostToDevice, stream));
+        get_philox_uniform<<<batch_size, 1, 0, stream>>>(d_random_seed, d_uniforms, batch_size);
         cudaAutoCpy(uniforms.data(), d_uniforms, batch_size, stream);
-        for (int i = 0; i < batch_size; i++) {
-            invokeCurandInitialize(curand_states + i, 1, i, stream);
-        }
 
         // sample
         SamplingParams params{};
@@ -617,7 +616,7 @@ public:
         params.stride           = vocab_size;
         params.indices          = d_sorted_indices;
         params.kept             = d_kept;
-        params.curandstate      = curand_states;
+        params.random_seed      = d_random_seed;
         params.batch_size       = batch_size;
         params.output_ids       = d_output_ids;
         params.sequence_length  = nullptr;
@@ -668,4 +667,140 @@ TYPED_TEST(SamplingTest, Batch)
     this->runTest(32, 9700, 1024);
 };
 
+template<typename T>
+class FusedSamplingTest: public SamplingKernelTest<T> {
+protected:
+    using SamplingKernelTest<T>::stream;
+    using SamplingKernelTest<T>::allocator;
+
+public:
+    void runTest(int batch_size, int* top_ks, float* top_ps, float* min_ps, int vocab_size)
+    {
+        // host buffer
+        std::vector<T>     logits(batch_size * vocab_size);
+        std::vector<T>     expected_logits(batch_size * vocab_size);
+        std::vector<int>   expected_indices(batch_size * vocab_size);
+        std::vector<int>   expected_kept(batch_size);
+        std::vector<int>   expected_output_ids(batch_size);
+        std::vector<float> uniforms(batch_size);
+
+        std::vector<T>   sampled_logprobs(batch_size * kMaxLogProb);
+        std::vector<int> sampled_indexes(batch_size * kMaxLogProb);
+        std::vector<int> sampled_nums(batch_size);
+
+        std::vector<int> output_ids(batch_size);
+        std::vector<T>   output_sampled_logprobs(batch_size * kMaxLogProb);
+        std::vector<int> output_sampled_indexes(batch_size * kMaxLogProb);
+        std::vector<int> output_sampled_nums(batch_size);
+
+        // device buffer
+        T*        d_logits           = (T*)allocator->malloc(sizeof(T) * batch_size * vocab_size);
+        int*      d_top_ks           = (int*)allocator->malloc(sizeof(int) * batch_size);
+        float*    d_top_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
+        float*    d_min_ps           = (float*)allocator->malloc(sizeof(float) * batch_size);
+        float*    d_uniforms         = (float*)(allocator->malloc(sizeof(float) * batch_size));
+        int*      d_output_ids       = (int*)(allocator->malloc(sizeof(int) * batch_size));
+        T*        d_sampled_logprobs = (T*)(allocator->malloc(sizeof(T) * batch_size * kMaxLogProb));
+        int*      d_sampled_indexes  = (int*)(allocator->malloc(sizeof(int) * batch_size * kMaxLogProb));
+        int*      d_sampled_nums     = (int*)(allocator->malloc(sizeof(int) * batch_size));
+        uint64_t* d_random_seed      = (uint64_t*)(allocator->malloc(sizeof(uint64_t) * batch_size));
+
+        float boundary = 1.f;
+        for (int x = vocab_size; x >= 10; x /= 10) {
+            boundary *= 10;
+        }
+        initRandom(logits.data(), batch_size * vocab_size, -boundary, boundary);
+
+        cudaAutoCpy(d_logits, logits.data(), batch_size * vocab_size, stream);
+        cudaAutoCpy(d_top_ks, top_ks, batch_size, stream);
+        cudaAutoCpy(d_top_ps, top_ps, batch_size, stream);
+        cudaAutoCpy(d_min_ps, min_ps, batch_size, stream);
+
+        // uniforms
+        std::vector<uint64_t> random_seed(batch_size);
+        std::iota(random_seed.begin(), random_seed.end(), 0);
+        check_cuda_error(cudaMemcpyAsync(
+            d_random_seed, random_seed.data(), sizeof(uint64_t) * batch_size, cudaMemcpyHostToDevice, stream));
+        get_philox_uniform<<<batch_size, 1, 0, stream>>>(d_random_seed, d_uniforms, batch_size);
+        cudaAutoCpy(uniforms.data(), d_uniforms, batch_size, stream);
+
+        // gpu
+        FusedSamplingParams params{};
+        params.logits           = d_logits;
+        params.stride           = vocab_size;
+        params.vocab_size       = vocab_size;
+        params.top_ks           = d_top_ks;
+        params.top_ps           = d_top_ps;
+        params.min_ps           = d_min_ps;
+        params.max_top_k        = *std::max_element(top_ks, top_ks + batch_size);
+        params.random_seed      = d_random_seed;
+        params.batch_size       = batch_size;
+        params.output_ids       = d_output_ids;
+        params.sequence_length  = nullptr;
+        params.sampled_logprobs = d_sampled_logprobs;
+        params.sampled_indexes  = (uint32_t*)d_sampled_indexes;
+        params.sampled_nums     = (uint32_t*)d_sampled_nums;
+        invokeFusedSampling<T>(params, stream);
+
+        // outputs
+        cudaAutoCpy(output_ids.data(), d_output_ids, batch_size, stream);
+        cudaAutoCpy(output_sampled_logprobs.data(), d_sampled_logprobs, batch_size * kMaxLogProb, stream);
+        cudaAutoCpy(output_sampled_indexes.data(), d_sampled_indexes, batch_size * kMaxLogProb, stream);
+        cudaAutoCpy(output_sampled_nums.data(), d_sampled_nums, batch_size, stream);
+        cudaStreamSynchronize(stream);
+
+        // cpu
+        filterCpu(batch_size,
+                  top_ks,
+                  top_ps,
+                  min_ps,
+                  logits.data(),
+                  expected_logits.data(),
+                  expected_indices.data(),
+                  expected_kept.data(),
+                  vocab_size,
+                  true,
+                  true);
+
+        sampleCpu(batch_size,
+                  vocab_size,
+                  expected_logits.data(),
+                  expected_indices.data(),
+                  expected_kept.data(),
+                  uniforms.data(),
+                  expected_output_ids.data(),
+                  sampled_logprobs.data(),
+                  sampled_indexes.data(),
+                  sampled_nums.data());
+
+        EXPECT_TRUE(checkSample(expected_output_ids.data(),
+                                output_ids.data(),
+                                batch_size,
+                                sampled_logprobs.data(),
+                                sampled_indexes.data(),
+                                sampled_nums.data(),
+                                output_sampled_logprobs.data(),
+                                output_sampled_indexes.data(),
+                                output_sampled_nums.data()));
+    }
+};
+
+TYPED_TEST_SUITE(FusedSamplingTest, SamplingTypes);
+
+TYPED_TEST(FusedSamplingTest, OnlyTopK)
+{
+    int   top_ks[] = {1, 5, 40, 256, 1024, 31, 64, 3};
+    float top_ps[] = {1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f};
+    float min_ps[] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+    this->runTest(8, top_ks, top_ps, min_ps, 151936);
+};
+
+TYPED_TEST(FusedSamplingTest, MixedTopKTopPMinP)
+{
+    int   top_ks[] = {1, 5, 40, 256, 1024, 31, 64, 3};
+    float top_ps[] = {0.8f, 1.f, 0.5f, 0.95f, 0.9f, 1.f, 0.7f, 0.3f};
+    float min_ps[] = {0.f, 0.1f, 0.f, 0.05f, 0.f, 0.2f, 0.01f, 0.f};
+    this->runTest(8, top_ks, top_ps, min_ps, 32000);
+};
+
 }  // end of namespace
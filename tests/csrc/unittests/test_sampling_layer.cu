@@ -116,7 +116,6 @@ protected:
     float*              d_output_log_probs;
     int*                d_output_ids;
     int*                d_end_ids;
-    curandState_t*      d_curand_state;
     unsigned long long* d_random_seed;
 
     void setup(unsigned long long seed = 0)
@@ -166,7 +165,6 @@ protected:
         d_output_log_probs = reinterpret_cast<float*>(allocator->malloc(sizeof(float) * max_output_len * batchxbeam));
         d_output_ids       = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * max_seq_len * batchxbeam));
         d_end_ids          = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batchxbeam));
-        d_curand_state     = reinterpret_cast<curandState_t*>(allocator->malloc(sizeof(curandState_t) * batch_size));
         d_random_seed =
             reinterpret_cast<unsigned long long*>(allocator->malloc(sizeof(unsigned long long) * batch_size));
 
@@ -175,7 +173,6 @@ protected:
         cudaMemset(d_output_log_probs, 0, sizeof(float) * max_output_len * batchxbeam);
         cudaMemset(d_output_ids, 0, sizeof(int) * max_seq_len * batchxbeam);
         cudaMemset(d_random_seed, 0, sizeof(unsigned long long) * batch_size);
-        invokeCurandBatchInitialize(d_curand_state, batch_size, d_random_seed, stream);
         deviceFill(d_end_ids, batchxbeam, end_id, stream);
     }
 
@@ -221,7 +218,7 @@ protected:
         input_tensors->insert(
             {"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, beam_width}, d_input_lengths}});
         input_tensors->insert({"end_id", Tensor{MEMORY_CPU, TYPE_INT32, {batchxbeam}, &d_end_ids}});
-        input_tensors->insert({"random_seed", Tensor{MEMORY_CPU, TYPE_UINT64, {1}, &seed}});
+        input_tensors->insert({"random_seed", Tensor{MEMORY_GPU, TYPE_UINT64, {batch_size}, d_random_seed}});
         return input_tensors;
     }
 
@@ -238,7 +235,6 @@ protected:
             {"output_log_probs",
              Tensor{MEMORY_GPU, TYPE_FP32, {max_seq_len, batch_size, beam_width}, d_output_log_probs}});
         output_tensors->insert({"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, nullptr}});
-        output_tensors->insert({"curand_state"}, {MEMORY_GPU, TYPE_VOID, {batch_size}, d_curand_state});
         return output_tensors;
     }
 
@@ -919,7 +915,6 @@ protected:
     float*              d_output_log_probs;
     int*                d_output_ids;
     int*                d_end_ids;
-    curandState_t*      d_curand_state;
     unsigned long long* d_random_seed;
 
     void setup(SamplingLayerTestParam param)
@@ -946,7 +941,6 @@ protected:
         d_input_lengths = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batchxbeam));
         d_output_ids    = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * max_seq_len * batchxbeam));
         d_end_ids       = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size));
-        d_curand_state  = reinterpret_cast<curandState_t*>(allocator->malloc(sizeof(curandState_t) * batch_size));
         d_random_seed =
             reinterpret_cast<unsigned long long*>(allocator->malloc(sizeof(unsigned long long) * batch_size));
 
@@ -986,14 +980,11 @@ protected:
         for (size_t i = 0; i < random_seed_size; ++i) {
             random_seed[i] = i / period_size;
         }
-        cudaH2Dcpy(d_random_seed, random_seed, random_seed_size);
-        if (use_single_random_seed) {
-            invokeCurandInitialize(d_curand_state, batch_size, random_seed[0], stream);
+        std::vector<unsigned long long> batch_random_seed(batch_size);
+        for (size_t i = 0; i < batch_size; ++i) {
+            batch_random_seed[i] = random_seed[use_single_random_seed ? 0 : i];
         }
-        else {
-            invokeCurandBatchInitialize(d_curand_state, batch_size, d_random_seed, stream);
-        }
-        sync_check_cuda_error();
+        cudaH2Dcpy(d_random_seed, batch_random_seed.data(), batch_size);
 
         TensorMap runtime_args;
         runtime_args.insert({"random_seed", Tensor(MEMORY_CPU, TYPE_UINT64, {random_seed_size}, random_seed)});
@@ -1017,7 +1008,7 @@ protected:
                      {"ite", Tensor{MEMORY_CPU, TYPE_UINT32, {1}, &ite}},
                      {"local_batch_size", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &local_batch_size}},
                      {"end_id", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, d_end_ids}},
-                     {"random_seed", {MEMORY_CPU, TYPE_UINT64, {random_seed_size}, random_seed}},
+                     {"random_seed", {MEMORY_GPU, TYPE_UINT64, {batch_size}, d_random_seed}},
                      {"runtime_top_k", {MEMORY_CPU, TYPE_UINT32, {1}, &top_k}},
                      {"runtime_top_p", {MEMORY_CPU, TYPE_FP32, {1}, &top_p}}});
 
@@ -1026,8 +1017,7 @@ protected:
                     {{"output_ids",
                       Tensor{MEMORY_GPU, TYPE_INT32, {max_seq_len, batch_size, beam_width}, d_output_ids}},
                      {"finished", Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size * beam_width}, nullptr}},
-                     {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, nullptr}},
-                     {"curand_state", {MEMORY_GPU, TYPE_VOID, {batch_size}, d_curand_state}}});
+                     {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, nullptr}}});
 
                 dynamic_decode_layer->forward(&dynamic_decode_output_tensors, &dynamic_decode_input_tensors);
                 sync_check_cuda_error();
@@ -1117,7 +1107,7 @@ protected:
                  {"ite", Tensor{MEMORY_CPU, TYPE_UINT32, {1}, &ite}},
                  {"local_batch_size", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &batch_size}},
                  {"end_id", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, end_ids}},
-                 {"random_seed", {MEMORY_CPU, TYPE_UINT64, {1}, &seed}},
+                 {"random_seed", {MEMORY_GPU, TYPE_UINT64, {batch_size}, d_random_seed}},
                  {"runtime_top_k", {MEMORY_CPU, TYPE_UINT32, {1}, &top_k}},
                  {"runtime_top_p", {MEMORY_CPU, TYPE_FP32, {1}, &top_p}},
                  {"temperature", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &temperature}},
@@ -1130,8 +1120,7 @@ protected:
                  {"cum_log_probs", Tensor{MEMORY_GPU, TYPE_FP32, {batch_size * beam_width}, cum_log_probs}},
                  {"output_log_probs",
                   Tensor{MEMORY_GPU, TYPE_FP32, {max_seq_len, batch_size, beam_width}, output_log_probs}},
-                 {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, nullptr}},
-                 {"curand_state", {MEMORY_GPU, TYPE_VOID, {batch_size}, d_curand_state}}});
+                 {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, nullptr}}});
 
             dynamic_decode_layer->forward(&dynamic_decode_output_tensors, &dynamic_decode_input_tensors);
 